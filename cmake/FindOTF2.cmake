@@ -0,0 +1,44 @@
+# Try to find OTF2 headers and libraries.
+#
+# Usage of this module as follows:
+#
+#     find_package(OTF2)
+#
+# Variables used by this module, they can change the default behaviour and need
+# to be set before calling find_package:
+#
+#  OTF2_PREFIX         Set this variable to the root installation of
+#                      libotf2 if the module has problems finding the
+#                      proper installation path.
+#
+# Variables defined by this module:
+#
+#  OTF2_FOUND              System has OTF2 libraries and headers
+#  OTF2_LIBRARIES          The OTF2 library
+#  OTF2_INCLUDE_DIRS       The location of OTF2 headers
+
+find_path(OTF2_PREFIX
+    NAMES include/otf2/otf2.h
+)
+
+find_library(OTF2_LIBRARIES
+    NAMES otf2
+    HINTS ${OTF2_PREFIX}/lib
+)
+
+find_path(OTF2_INCLUDE_DIRS
+    NAMES otf2/otf2.h
+    HINTS ${OTF2_PREFIX}/include
+)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(OTF2 DEFAULT_MSG
+    OTF2_LIBRARIES
+    OTF2_INCLUDE_DIRS
+)
+
+mark_as_advanced(
+    OTF2_PREFIX_DIRS
+    OTF2_LIBRARIES
+    OTF2_INCLUDE_DIRS
+)
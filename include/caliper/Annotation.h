@@ -41,6 +41,7 @@
 #define CALI_ANNOTATION_H
 
 #include "common/cali_types.h"
+#include "cali.h"
 
 namespace cali
 {
@@ -93,6 +94,98 @@ public:
     void end();
 };
 
+
+/// \brief Scope guard for a region described by a cached handle
+///
+/// Begins the region on construction and ends it on destruction.
+/// Used by the \c _CACHED C++ annotation macros.
+
+class CachedRegion
+{
+    cali_string_handle_t* m_handle;
+
+    CachedRegion(const CachedRegion&);
+    CachedRegion& operator = (const CachedRegion&);
+
+public:
+
+    explicit CachedRegion(cali_string_handle_t* handle);
+    ~CachedRegion();
+};
+
+/// \brief Loop annotation using a cached loop handle and iteration attribute
+///
+/// Used by the \c CALI_CXX_MARK_LOOP_*_CACHED macros.
+
+class CachedLoop
+{
+    cali_string_handle_t* m_handle;
+    cali_id_t             m_iter_attr;
+    int                   m_level;
+
+    CachedLoop(const CachedLoop&);
+    CachedLoop& operator = (const CachedLoop&);
+
+public:
+
+    class Iteration {
+        cali_id_t m_attr;
+
+    public:
+
+        Iteration(cali_id_t attr, int i);
+        ~Iteration();
+    };
+
+    /// \param handle    Cached handle for the \c loop attribute
+    /// \param iter_attr Cached \c iteration\#name attribute ID.
+    ///   Created on first use if it is \c CALI_INV_ID.
+    CachedLoop(cali_string_handle_t* handle, cali_id_t* iter_attr);
+    ~CachedLoop();
+
+    Iteration iteration(int i) const {
+        return Iteration(m_iter_attr, i);
+    }
+
+    void end();
+};
+
+/// \brief Lightweight per-thread event counter
+///
+/// add() only updates a per-thread counter value and does not invoke
+/// any %Caliper callbacks, so counters can be updated at very high
+/// rates. Snapshots report the increment since the thread's previous
+/// snapshot as an immediate <em>name</em>=<em>increment</em> entry.
+///
+/// Example:
+/// \code
+/// cali::Counter bytes_packed("bytes.packed");
+///
+/// for (int i = 0; i < n; ++i)
+///   bytes_packed.add(pack(buf[i]));
+/// \endcode
+///
+/// \see cali_create_counter()
+
+class Counter
+{
+    int m_counter;
+
+public:
+
+    /// \brief Create or look up the counter \a name.
+    ///
+    /// \param name Counter attribute name
+    /// \param opt  Additional %Attribute flags
+    Counter(const char* name, int opt = 0);
+
+    void add(uint64_t val);
+
+    Counter& operator += (uint64_t val) {
+        add(val);
+        return *this;
+    }
+};
     
 /// \brief Instrumentation interface to add and manipulate context attributes
 ///
@@ -169,6 +262,50 @@ public:
     // Keep AutoScope name for backward compatibility
     typedef Guard AutoScope;
 
+    /// \brief Handle for a fixed string-valued region of the
+    ///   associated context attribute.
+    ///
+    /// Caches the context tree node of the region. Repeated begin()
+    /// calls under the same parent region skip the context tree search
+    /// and only update the blackboard.
+    ///
+    /// Example:
+    /// \code
+    ///   cali::Annotation::Region pack_region =
+    ///     cali::Annotation("myprogram.phase").region("pack");
+    ///
+    ///   for (int i = 0; i < n; ++i) {
+    ///     pack_region.begin();
+    ///     // ...
+    ///     pack_region.end();
+    ///   }
+    /// \endcode
+
+    class Region {
+        Impl*  pI;
+        char*  m_value;
+        size_t m_len;
+        void*  m_node;
+
+    public:
+
+        /// \param a     The annotation providing the context attribute
+        /// \param value The region name. The string is copied.
+        Region(const Annotation& a, const char* value);
+
+        Region(const Region&);
+
+        ~Region();
+
+        Region& operator = (const Region&);
+
+        void begin();
+        void end();
+    };
+
+    /// \brief Create a Region handle for the string value \a value
+    Region region(const char* value) const;
+
     /// \name begin() overloads
     /// \{
 
@@ -44,6 +44,9 @@
 #include "caliper/common/RuntimeConfig.h"
 
 #include <iostream>
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace cali 
@@ -95,8 +98,12 @@ class Node;
 ///   CaliperService mybinding_service { "mybinding", AnnotationBinding::make_binding<MyBinding> };
 /// \endcode
 ///
-/// Also see the \a nvprof and \a vtune service implementations for examples of
-/// using AnnotationBinding in a %Caliper service.
+/// Also see the \a nvprof, \a vtune, and \a tau service implementations for
+/// examples of using AnnotationBinding in a %Caliper service.
+///
+/// Bindings that need tool-specific handles for attributes or values
+/// (e.g., domains or registered strings) should keep them in a
+/// \a HandleCache, which creates each handle only once.
 
 class AnnotationBinding 
 {
@@ -160,6 +167,73 @@ protected:
 
 public:
 
+    /// \brief Caches tool handles for attributes and attribute values
+    ///
+    /// Creates a handle with the given creation function when an
+    /// attribute or attribute/value pair is seen for the first time,
+    /// and returns the stored handle afterwards. Values are matched by
+    /// content, so string values don't need to be converted again.
+    /// A HandleCache is not thread-safe; use one per thread (e.g., as a
+    /// \a thread_local object) or protect it with a lock.
+    template <typename HandleT>
+    class HandleCache
+    {
+        std::map< cali_id_t, HandleT > m_attr_handles;
+        std::map< std::pair<cali_id_t, Variant>, HandleT > m_value_handles;
+
+        // owns the string values used in the value handle keys
+        std::vector< std::unique_ptr<std::string> > m_strings;
+
+    public:
+
+        /// \brief Get the handle for \a attr
+        /// \param create Invoked as \a create(attr) to create the handle
+        ///   if there is none yet
+        template <typename CreateFn>
+        HandleT attribute_handle(const Attribute& attr, CreateFn create) {
+            auto it = m_attr_handles.lower_bound(attr.id());
+
+            if (it != m_attr_handles.end() && it->first == attr.id())
+                return it->second;
+
+            HandleT handle = create(attr);
+            m_attr_handles.insert(it, std::make_pair(attr.id(), handle));
+
+            return handle;
+        }
+
+        /// \brief Get the handle for the \a attr / \a value pair
+        /// \param create Invoked as \a create(attr, str) to create the
+        ///   handle if there is none yet, where \a str is the value's
+        ///   string representation. \a str remains valid for the
+        ///   lifetime of the cache.
+        template <typename CreateFn>
+        HandleT value_handle(const Attribute& attr, const Variant& value, CreateFn create) {
+            auto it = m_value_handles.find(std::make_pair(attr.id(), value));
+
+            if (it != m_value_handles.end())
+                return it->second;
+
+            std::string* str = nullptr;
+
+            if (value.type() == CALI_TYPE_STRING)
+                str = new std::string(static_cast<const char*>(value.data()), value.size());
+            else
+                str = new std::string(value.to_string());
+
+            m_strings.emplace_back(str);
+
+            // For strings, the key must refer to our own copy of the value
+            Variant v_key = (value.type() == CALI_TYPE_STRING ?
+                             Variant(CALI_TYPE_STRING, str->data(), str->size()) : value);
+
+            HandleT handle = create(attr, str->c_str());
+            m_value_handles.insert(std::make_pair(std::make_pair(attr.id(), v_key), handle));
+
+            return handle;
+        }
+    };
+
     /// \brief Constructor. Usually invoked through \a make_binding().
     AnnotationBinding()
         : m_filter(nullptr),
@@ -30,168 +30,209 @@
 // WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
 // ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+
 /// \file CaliFunctional.h
 /// Caliper C++ Functional Annotation Utilities
 
 #ifndef CALI_FUNCTIONAL_H
 #define CALI_FUNCTIONAL_H
 
-#include "Annotation.h"
+#include "Caliper.h"
 #include "cali_definitions.h"
 
 #include "common/Variant.h"
 
+#include <cstdint>
 #include <cstring>
-#include <iostream>
-#include <tuple>
+#include <string>
 #include <type_traits>
 
 namespace cali{
-struct SafeAnnotation{
-public:
-    //ValidatedAnnotation() : inner_annot("ERROR"){}
-    SafeAnnotation(const char* name, int opt=0) : inner_annot(name,opt){
-        inner_annot = Annotation(name,opt);
-    }
-    SafeAnnotation(SafeAnnotation& other) : inner_annot(other.getAnnot()) {
-        
-    }
-    Annotation& getAnnot() {
-        return inner_annot;
-    }
-    SafeAnnotation& operator = (SafeAnnotation& other){
-        inner_annot = other.getAnnot();
-        return *this;
-    }
-    SafeAnnotation& begin(){
-        inner_annot.begin();
-        return *this;
-    }
-    SafeAnnotation& begin(int data){
-        inner_annot.begin(data);
-        return *this;
-    }
-    SafeAnnotation& begin(double data){
-        inner_annot.begin(data);
-        return *this;
-    }
-    SafeAnnotation& begin(const char* data){
-        inner_annot.begin(Variant(CALI_TYPE_STRING, data, strlen(data)));
-        return *this;
-    }
-    SafeAnnotation& begin(cali_attr_type type, void* data, uint64_t size){
-        inner_annot.begin(type,data,size);
-        return *this;
-    }
-    SafeAnnotation& begin(const Variant& data){
-        inner_annot.begin(data);
-        return *this;
-    }
-    //set
-    SafeAnnotation& set(int data){
-        inner_annot.set(data);
-        return *this;
+
+//
+// --- Compile-time mapping of C++ argument types to Caliper attribute types
+//
+
+/// \brief Maps type \a T to a cali_attr_type and Variant. Types without
+///   a mapping are recorded as the string "Unmeasurable".
+template<typename T, typename Enable = void>
+struct ArgTraits {
+    static constexpr cali_attr_type type = CALI_TYPE_STRING;
+    static Variant value(const T&) {
+        return Variant(CALI_TYPE_STRING, "Unmeasurable", 12);
     }
-    SafeAnnotation& set(double data){
-        inner_annot.set(data);
-        return *this;
+};
+
+template<>
+struct ArgTraits<bool> {
+    static constexpr cali_attr_type type = CALI_TYPE_BOOL;
+    static Variant value(bool v) {
+        return Variant(v);
     }
-    SafeAnnotation& set(const char* data){
-        inner_annot.set(Variant(CALI_TYPE_STRING, data, strlen(data)));
-        return *this;
+};
+
+template<typename T>
+struct ArgTraits<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type> {
+    static constexpr cali_attr_type type = CALI_TYPE_INT;
+    static Variant value(T v) {
+        return Variant(static_cast<int>(v));
     }
-    SafeAnnotation& set(cali_attr_type type, void* data, uint64_t size){
-        inner_annot.set(type,data,size);
-        return *this;
+};
+
+template<typename T>
+struct ArgTraits<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value &&
+                                            !std::is_same<T, bool>::value>::type> {
+    static constexpr cali_attr_type type = CALI_TYPE_UINT;
+    static Variant value(T v) {
+        return Variant(static_cast<uint64_t>(v));
     }
-    SafeAnnotation& set(const Variant& data){
-        inner_annot.set(data);
-        return *this;
+};
+
+template<typename T>
+struct ArgTraits<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static constexpr cali_attr_type type = CALI_TYPE_DOUBLE;
+    static Variant value(T v) {
+        return Variant(static_cast<double>(v));
     }
-    void end(){
-        inner_annot.end();
+};
+
+template<typename T>
+struct ArgTraits<T*> {
+    static constexpr cali_attr_type type = CALI_TYPE_ADDR;
+    static Variant value(T* v) {
+        uint64_t addr = reinterpret_cast<uint64_t>(v);
+        return Variant(CALI_TYPE_ADDR, &addr, sizeof(uint64_t));
     }
-    template<typename T>
-    SafeAnnotation & begin(T start){
-        inner_annot.begin("Unmeasurable");
-        return *this;
+};
+
+template<>
+struct ArgTraits<const char*> {
+    static constexpr cali_attr_type type = CALI_TYPE_STRING;
+    static Variant value(const char* v) {
+        return Variant(CALI_TYPE_STRING, v, strlen(v));
     }
-    template<typename T>
-    SafeAnnotation & set(T start){
-        inner_annot.set("Unmeasurable");
-        return *this;
+};
+
+template<>
+struct ArgTraits<std::string> {
+    static constexpr cali_attr_type type = CALI_TYPE_STRING;
+    static Variant value(const std::string& v) {
+        return Variant(CALI_TYPE_STRING, v.c_str(), v.size());
     }
-    Annotation inner_annot;
 };
 
-cali::SafeAnnotation& wrapper_annotation(){
-        static cali::SafeAnnotation instance("wrapped_function");
-        return instance;
-}       
+//
+// --- Attributes, created once per instantiation
+//
 
 template<int N>
 const char* annotation_name(){
     static std::string name = "function_argument_"+std::to_string(N); 
     return (name.c_str());
 }
-template<int N>
-cali::SafeAnnotation& arg_annotation(){
-        static cali::SafeAnnotation instance(annotation_name<N>());
-        return instance;
-}       
-template<int N>
-cali::Annotation& arg_annotation_raw(){
-        static cali::Annotation instance(annotation_name<N>());
-        return instance;
-}       
 
+/// \brief Get or create attribute \a name with type \a type. Returns an
+///   invalid attribute if \a name exists with a different type.
+inline Attribute make_functional_attribute(const char* name, cali_attr_type type) {
+    Attribute attr = Caliper().create_attribute(name, type);
+    return attr.type() == type ? attr : Attribute::invalid;
+}
 
-//Wrap a call to a function
-template<typename LB, typename... Args>
-auto wrap(const char* name, LB body, Args... args) -> typename std::result_of<LB(Args...)>::type{
-    Annotation startedAnnot = wrapper_annotation().begin(name).getAnnot();
-    cali::Annotation::Guard func_annot(startedAnnot);
-    return body(args...);
+inline const Attribute& wrapper_attribute() {
+    static const Attribute attr = make_functional_attribute("wrapped_function", CALI_TYPE_STRING);
+    return attr;
 }
 
-cali::Annotation& dummy_annot(){
-    static cali::Annotation instance ("wrapped func");
-    return instance;
+/// \brief The attribute for the \a N th argument of type \a T
+template<int N, typename T>
+const Attribute& arg_attribute() {
+    static const Attribute attr = make_functional_attribute(annotation_name<N>(), ArgTraits<T>::type);
+    return attr;
 }
 
+template<typename T>
+const Attribute& return_attribute() {
+    static const Attribute attr = make_functional_attribute("return", ArgTraits<T>::type);
+    return attr;
+}
+
+//
+// --- Region guards
+//
+
+/// \brief Scope guard for the "wrapped_function" region \a name.
+///   With \a hint, re-uses the context tree node of the previous call.
+struct WrapperGuard {
+    explicit WrapperGuard(const char* name) {
+        Caliper().begin(wrapper_attribute(), Variant(CALI_TYPE_STRING, name, strlen(name)));
+    }
+    WrapperGuard(const char* name, Node** hint) {
+        Caliper().begin(wrapper_attribute(), Variant(CALI_TYPE_STRING, name, strlen(name)), hint);
+    }
+    ~WrapperGuard() {
+        Caliper().end(wrapper_attribute());
+    }
+
+    WrapperGuard(const WrapperGuard&) = delete;
+    WrapperGuard& operator = (const WrapperGuard&) = delete;
+};
+
 template<int N, typename... Args>
 struct ArgRecorder{
-    static auto record(const char* name) -> std::tuple<> {
-        return std::make_tuple();
-    }
+    static void begin(Caliper&, const Args&...) { }
+    static void end(Caliper&) { }
 };
 
 template <int N, typename Arg, typename... Args>
 struct ArgRecorder<N, Arg, Args...>{
     using NextRecorder = ArgRecorder<N+1,Args...>;
-    static auto record(const char* name, Arg arg, Args... args) -> decltype(std::tuple_cat(
-                                                                                        NextRecorder::record(name,args...),
-                                                                                        std::move(std::forward_as_tuple(std::move(cali::Annotation::Guard(dummy_annot())  )))
-                                                                                    )
-                                                                     ){
-        cali::Annotation::Guard func_annot (arg_annotation<N>().begin(arg).getAnnot());
-        return std::tuple_cat(
-            NextRecorder::record(name,args...),
-            std::forward_as_tuple(std::move(func_annot))
-        );
+    using Traits = ArgTraits<typename std::decay<Arg>::type>;
+
+    static void begin(Caliper& c, const Arg& arg, const Args&... args) {
+        c.begin(arg_attribute<N, typename std::decay<Arg>::type>(), Traits::value(arg));
+        NextRecorder::begin(c, args...);
+    }
+    static void end(Caliper& c) {
+        NextRecorder::end(c);
+        c.end(arg_attribute<N, typename std::decay<Arg>::type>());
+    }
+};
+
+/// \brief Scope guard for the argument regions of a call with arguments
+///   \a Args, numbered from 1
+template<typename... Args>
+struct ArgGuard {
+    explicit ArgGuard(const Args&... args) {
+        Caliper c;
+        ArgRecorder<1, Args...>::begin(c, args...);
+    }
+    ~ArgGuard() {
+        Caliper c;
+        ArgRecorder<1, Args...>::end(c);
     }
+
+    ArgGuard(const ArgGuard&) = delete;
+    ArgGuard& operator = (const ArgGuard&) = delete;
 };
 
-//TODO: fix
+template<typename T>
+void record_return_value(const T& value) {
+    Caliper c;
+    c.set(return_attribute<T>(), ArgTraits<T>::value(value));
+    c.end(return_attribute<T>());
+}
+
+//Wrap a call to a function
+template<typename LB, typename... Args>
+auto wrap(const char* name, LB body, Args... args) -> typename std::result_of<LB(Args...)>::type{
+    WrapperGuard func_annot(name);
+    return body(args...);
+}
+
 template<typename LB, typename... Args>
 auto wrap_with_args(const char* name, LB body, Args... args) -> typename std::result_of<LB(Args...)>::type{
-    Annotation startedAnnot = wrapper_annotation().begin(name).getAnnot();
-    cali::Annotation::Guard func_annot(startedAnnot);
-    #ifdef VARIADIC_RETURN_SAFE
-    auto n =ArgRecorder<1,Args...>::record(name,args...);
-    #else
-    #warning CALIPER WARNING: This  C++ compiler has bugs which prevent argument profiling
-    #endif
+    WrapperGuard  func_annot(name);
+    ArgGuard<Args...> arg_annot(args...);
     return body(args...);
 }
 
@@ -199,56 +240,45 @@ auto wrap_with_args(const char* name, LB body, Args... args) -> typename std::re
 //but through calls to wrap_function below
 template<class LB>
 struct WrappedFunction {
-    WrappedFunction(const char* func_name, LB func) : body(func){
+    WrappedFunction(const char* func_name, LB func) : body(func), hint(nullptr){
         name = func_name;
     }
     template <typename... Args>
     auto operator()(Args... args) -> typename std::result_of<LB(Args...)>::type {
-
-        cali::Annotation::Guard func_annot(wrapper_annotation().begin(name).getAnnot());
+        WrapperGuard func_annot(name, &hint);
         return body(args...);
     }
     LB body;
     const char* name;
+    Node* hint;
 };
 
 template<class LB>
 struct ArgWrappedFunction {
-    ArgWrappedFunction(const char* func_name, LB func) : body(func){
+    ArgWrappedFunction(const char* func_name, LB func) : body(func), hint(nullptr){
         name = func_name;
     }
     template <typename... Args>
     auto operator()(Args... args) -> typename std::enable_if<
         !std::is_same<typename std::result_of<LB(Args...)>::type, void>::value,
         typename std::result_of<LB(Args...)>::type>::type {
-      cali::Annotation::Guard func_annot(
-          wrapper_annotation().begin(name).getAnnot());
-      #ifdef VARIADIC_RETURN_SAFE
-      auto n =ArgRecorder<1,Args...>::record(name,args...);
-      #else
-      #warning CALIPER WARNING: This  C++ compiler has bugs which prevent argument profiling
-      #endif
+      WrapperGuard      func_annot(name, &hint);
+      ArgGuard<Args...> arg_annot(args...);
       auto return_value = body(args...);
-      cali::Annotation return_value_annot("return");
-      return_value_annot.set(return_value);
-      return_value_annot.end();
+      record_return_value(return_value);
       return return_value;
     }
     template <typename... Args>
     auto operator()(Args... args) -> typename std::enable_if<
         std::is_same<typename std::result_of<LB(Args...)>::type, void>::value,
         typename std::result_of<LB(Args...)>::type>::type {
-      cali::Annotation::Guard func_annot(
-          wrapper_annotation().begin(name).getAnnot());
-      #ifdef VARIADIC_RETURN_SAFE
-      auto n =ArgRecorder<1,Args...>::record(name,args...);
-      #else
-      #warning CALIPER WARNING: This  C++ compiler has bugs which prevent argument profiling
-      #endif
+      WrapperGuard      func_annot(name, &hint);
+      ArgGuard<Args...> arg_annot(args...);
       return body(args...);
     }
     LB body;
     const char* name;
+    Node* hint;
 };
 
 //Helper factory function to create WrappedFunction objects
@@ -44,7 +44,10 @@
 #include "common/Variant.h"
 #include "common/util/callback.hpp"
 
+#include <functional>
+#include <string>
 #include <utility>
+#include <vector>
 
 namespace cali
 {
@@ -84,6 +87,8 @@ private:
         { }
 
     Scope* scope(cali_context_scope_t scope);
+
+    void   set_overhead_attributes();
     
 
 public:
@@ -102,6 +107,15 @@ public:
     // --- Typedefs
 
     typedef std::function<bool(const SnapshotRecord*)> SnapshotFlushFn;
+
+    /// \brief A memory region to track with memory_regions_begin()
+    struct MemoryRegion {
+        const void*   ptr;
+        const char*   label;     ///< null to set the label later
+        size_t        elem_size;
+        size_t        ndims;
+        const size_t* dims;
+    };
     
     // --- Events
 
@@ -112,6 +126,8 @@ public:
             pre_create_attr_cbvec;                        
         typedef util::callback<void(Caliper*,const Attribute&,const Variant&)>
             update_cbvec;
+        typedef util::callback<void(Caliper*,size_t,const Attribute*,const Variant*)>
+            update_many_cbvec;
         typedef util::callback<void(Caliper*)>
             caliper_cbvec;
         typedef util::callback<void(Caliper*,cali_context_scope_t)>
@@ -131,6 +147,10 @@ public:
 
         typedef util::callback<void(Caliper*,const void*, const char*, size_t, size_t, const size_t*)>
             track_mem_cbvec;
+        typedef util::callback<void(Caliper*,size_t,const MemoryRegion*)>
+            track_mem_batch_cbvec;
+        typedef util::callback<void(Caliper*,const void*,const char*)>
+            label_mem_cbvec;
         typedef util::callback<void(Caliper*,const void*)>
             untrack_mem_cbvec;
                                             
@@ -144,8 +164,14 @@ public:
         update_cbvec           pre_end_evt;
         update_cbvec           post_end_evt;
 
+        update_many_cbvec      pre_set_many_evt;
+        update_many_cbvec      post_set_many_evt;
+
         scope_cbvec            create_scope_evt;
         scope_cbvec            release_scope_evt;
+        /// \brief Invoked instead of \a create_scope_evt when a new
+        ///   thread takes over the recycled scope of a finished thread
+        scope_cbvec            reuse_scope_evt;
 
         caliper_cbvec          post_init_evt;
         caliper_cbvec          finish_evt;
@@ -157,12 +183,19 @@ public:
         flush_cbvec            flush_evt;
 
         edit_snapshot_cbvec    postprocess_snapshot;
+        /// \brief Resolve deferred symbol references (symbol.ref#...) in
+        ///   a snapshot, e.g. after cross-process aggregation
+        edit_snapshot_cbvec    resolve_symbols_evt;
 
         write_cbvec            pre_write_evt;
         process_snapshot_cbvec write_snapshot;
         write_cbvec            post_write_evt;
 
         track_mem_cbvec        track_mem_evt;
+        /// \brief Track a list of memory regions at once. Region labels
+        ///   may be null, and set later with \a label_mem_evt.
+        track_mem_batch_cbvec  track_mem_batch_evt;
+        label_mem_cbvec        label_mem_evt;
         untrack_mem_cbvec      untrack_mem_evt;
 
         caliper_cbvec          clear_evt;
@@ -186,6 +219,7 @@ public:
 
     void      push_snapshot(int scopes, const SnapshotRecord* trigger_info);
     void      pull_snapshot(int scopes, const SnapshotRecord* trigger_info, SnapshotRecord* snapshot);
+    void      pull_context(int scopes, SnapshotRecord* snapshot);
 
     // --- Flush and I/O API
 
@@ -198,6 +232,13 @@ public:
 
     void      clear();
 
+    /// \}
+    /// \name Runtime service control
+    /// \{
+
+    bool      set_service_enabled(const std::string& service, bool enable, bool flush = true);
+    bool      is_service_enabled(const std::string& service) const;
+
     // --- Annotation API
 
     /// \}
@@ -205,15 +246,50 @@ public:
     /// \{
 
     cali_err  begin(const Attribute& attr, const Variant& data);
+    cali_err  begin(const Attribute& attr, const Variant& data, Node** hint);
     cali_err  end(const Attribute& attr);
     cali_err  set(const Attribute& attr, const Variant& data);
+    cali_err  set_many(size_t n, const Attribute attr[], const Variant data[]);
     cali_err  set_path(const Attribute& attr, size_t n, const Variant data[]);
 
+    /// \}
+    /// \name Event throttling
+    /// \{
+
+    /// \brief Throttle rate for set_event_throttle(): invoke no callbacks
+    static const unsigned EventThrottleCountOnly = 0xFFFFFFFF;
+
+    void      set_event_throttle(const Attribute& attr, unsigned rate);
+    uint64_t  num_throttled_events(const Attribute& attr);
+
+    /// \}
+    /// \name Region filters
+    /// \{
+
+    /// \brief Region filter function: return \c true to drop the region
+    ///   \a attr = \a value
+    typedef bool (*RegionFilterFn)(const void* arg, const Attribute& attr, const Variant& value, bool is_signal);
+
+    void      set_region_filter(const Attribute& attr, RegionFilterFn fn, const void* arg = nullptr);
+    uint64_t  num_filtered_regions(const Attribute& attr);
+
+    /// \}
+    /// \name Counters
+    /// \{
+
+    /// \brief Maximum number of counters
+    static const int MaxCounters = 64;
+
+    int       create_counter(const Attribute& attr);
+    static void add_to_counter(int counter, uint64_t val);
+
     /// \}
     /// \name Blackboard access
     /// \{
 
     Variant   exchange(const Attribute& attr, const Variant& data);
+    Variant   update(const Attribute& attr, const std::function<Variant(const Variant&)>& fn);
+    cali_err  add(const Attribute& attr, const Variant& delta);
 
     Entry     get(const Attribute& attr);
 
@@ -223,6 +299,12 @@ public:
 
     void      memory_region_begin(const void* ptr, const char* label, size_t elem_size, size_t ndim, const size_t dims[]);
 
+    /// \brief Track the \a n memory regions in \a regions at once
+    void      memory_regions_begin(size_t n, const MemoryRegion regions[]);
+
+    /// \brief Set the label of a memory region that was tracked without one
+    void      memory_region_label(const void* ptr, const char* label);
+
     void      memory_region_end(const void* ptr);
 
     // --- Direct metadata / data access API
@@ -254,6 +336,13 @@ public:
 
     std::vector<Attribute> get_attributes() const;
 
+    std::vector<Attribute> find_attributes_with(const Attribute& meta) const;
+
+    /// \brief Invoke \a fn for all current and future attributes that
+    ///   have a metadata entry \a meta (e.g., class.aggregatable)
+    void      subscribe_attributes_with(const Attribute& meta,
+                                        std::function<void(Caliper*,const Attribute&)> fn);
+
     Attribute create_attribute(const std::string& name,
                                cali_attr_type     type,
                                int                prop = CALI_ATTR_DEFAULT,
@@ -273,6 +362,22 @@ public:
     /// \brief Get the CALI_ATTR_GLOBAL entries
     std::vector<Entry> get_globals();
 
+    /// \}
+    /// \name Memory usage accounting
+    /// \{
+
+    /// \brief Memory held by a runtime component on one thread
+    struct MemoryUsage {
+        std::string component;
+        int         thread;   ///< Thread ID, or -1 for process-wide memory
+        size_t      reserved; ///< Allocated bytes
+        size_t      used;     ///< Bytes holding live data
+    };
+
+    static std::vector<MemoryUsage> memory_usage();
+
+    static std::ostream& print_memory_usage(std::ostream& os);
+
     /// \}
 
     // --- Caliper API access
@@ -123,6 +123,9 @@ public:
         append(1, &attr, &data);
     }
 
+    /// \brief Remove immediate entries with any of the \a n attributes in \a attrs
+    void remove_immediate(size_t n, const cali_id_t* attrs);
+
     Sizes capacity() const { 
         return { m_capacity.n_nodes     - m_sizes.n_nodes,
                  m_capacity.n_immediate - m_sizes.n_immediate };
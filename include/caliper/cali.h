@@ -282,6 +282,108 @@ cali_find_all_in_snapshot(const unsigned char* buf,
                           cali_entry_proc_fn   proc_fn,
                           void*                userdata);
 
+/**
+ * \}
+ * \name Indexed snapshot views
+ * \{
+ */
+
+/**
+ * \brief Opaque handle for a decoded, indexed snapshot.
+ *
+ * A snapshot view decodes a snapshot buffer once into flat
+ * attribute and value arrays plus a hash index by attribute ID. This is
+ * cheaper than repeated cali_find_first_in_snapshot() or
+ * cali_find_all_in_snapshot() calls when several attributes are read
+ * from each snapshot. A view can be re-used for any number of
+ * snapshots; it never allocates after cali_snapshot_view_create().
+ */
+typedef struct cali_snapshot_view cali_snapshot_view_t;
+
+/**
+ * \brief Create a snapshot view that holds up to \a max_entries
+ *   entries.
+ *
+ * Entries beyond \a max_entries are dropped when unpacking a snapshot.
+ * Destroy the view with cali_snapshot_view_destroy().
+ */
+cali_snapshot_view_t*
+cali_snapshot_view_create(size_t max_entries);
+
+void
+cali_snapshot_view_destroy(cali_snapshot_view_t* view);
+
+/**
+ * \brief Decode snapshot \a buf into \a view, replacing its previous
+ *   contents.
+ *
+ * The snapshot must have previously been obtained on the same process
+ * with cali_pull_snapshot().
+ *
+ * \note This function is async-signal safe
+ *
+ * \param view View to fill
+ * \param buf Snapshot buffer
+ * \param bytes_read Number of bytes read from the buffer
+ *   (i.e., length of the snapshot)
+ * \return Number of entries in the snapshot. If this is larger than
+ *   the view's capacity, the view holds only the first entries.
+ */
+size_t
+cali_snapshot_view_unpack(cali_snapshot_view_t* view,
+                          const unsigned char*  buf,
+                          size_t*               bytes_read);
+
+/**
+ * \brief Number of entries in \a view
+ */
+size_t
+cali_snapshot_view_num_entries(const cali_snapshot_view_t* view);
+
+/**
+ * \brief Attribute IDs of the entries in \a view.
+ *
+ * Entries are in the same order as with cali_unpack_snapshot(). The
+ * array has cali_snapshot_view_num_entries() elements and is valid
+ * until the next cali_snapshot_view_unpack() call on \a view.
+ */
+const cali_id_t*
+cali_snapshot_view_attributes(const cali_snapshot_view_t* view);
+
+/**
+ * \brief Values of the entries in \a view, matching
+ *   cali_snapshot_view_attributes().
+ */
+const cali_variant_t*
+cali_snapshot_view_values(const cali_snapshot_view_t* view);
+
+/**
+ * \brief Return the top-most value for attribute \a attr_id in
+ *   \a view, or an empty variant if there is none.
+ *
+ * \note This function is async-signal safe
+ */
+cali_variant_t
+cali_snapshot_view_find_first(const cali_snapshot_view_t* view,
+                              cali_id_t                   attr_id);
+
+/**
+ * \brief Return all values for attribute \a attr_id in \a view.
+ *
+ * \note This function is async-signal safe
+ *
+ * \param view The view
+ * \param attr_id Attribute ID
+ * \param values Set to an array with the values, top-most first. The
+ *   array is valid until the next cali_snapshot_view_unpack() call
+ *   on \a view.
+ * \return Number of values in \a values
+ */
+size_t
+cali_snapshot_view_find_all(const cali_snapshot_view_t* view,
+                            cali_id_t                   attr_id,
+                            const cali_variant_t**      values);
+
 /**
  * \}
  */
@@ -373,6 +475,23 @@ cali_set  (cali_id_t   attr,
            const void* value,
            size_t      size);
 
+/**
+ * \brief Change the innermost values of several attributes on the
+ *   blackboard in one call.
+ *
+ * Equivalent to calling cali_set() for each attribute/value pair in
+ * order, but acquires the blackboard lock and dispatches the batch
+ * update event only once.
+ *
+ * \param n        Number of attribute/value pairs
+ * \param attr_ids Attribute IDs
+ * \param values   Values. Each value's type must match its attribute's type.
+ * \return CALI_SUCCESS, or the error of the last failed update
+ */
+
+cali_err
+cali_set_batch(size_t n, const cali_id_t attr_ids[], const cali_variant_t values[]);
+
 cali_err  
 cali_set_double(cali_id_t attr, double val);
 cali_err  
@@ -380,6 +499,28 @@ cali_set_int(cali_id_t attr, int val);
 cali_err  
 cali_set_string(cali_id_t attr, const char* val);
 
+/**
+ * \brief Atomically add \a delta to the value of a numeric attribute.
+ *
+ * Reads, increments, and writes back the attribute's blackboard value
+ * under a single lock, starting from zero if the attribute has no
+ * value yet. This makes it safe to use a process-scope attribute as a
+ * counter shared by several threads. Unlike cali_set(), no set
+ * callbacks are invoked.
+ *
+ * \param attr  Attribute ID. The attribute must have the
+ *   CALI_ATTR_ASVALUE property and type CALI_TYPE_INT (for
+ *   cali_add_int()), CALI_TYPE_UINT, or CALI_TYPE_DOUBLE.
+ * \param delta The value to add
+ * \return CALI_ETYPE if the attribute type doesn't match,
+ *   CALI_EINV if the attribute is not stored as value
+ */
+
+cali_err
+cali_add_int(cali_id_t attr, int delta);
+cali_err
+cali_add_double(cali_id_t attr, double delta);
+
 /**
  * Put attribute with name \a attr_name on the blackboard.
  */
@@ -418,6 +559,111 @@ cali_set_string_byname(const char* attr_name, const char* val);
 cali_err
 cali_end_byname(const char* attr_name);
 
+/**
+ * \}
+ * \name Cached annotation handles
+ * \{
+ */
+
+/**
+ * \brief Cached attribute and context tree node for a string-valued
+ *   region annotation.
+ *
+ * Meant to be used as a function-local \c static, initialized with
+ * \ref CALI_STRING_HANDLE_INITIALIZER. The first
+ * cali_begin_string_cached() call resolves the attribute. Later calls
+ * skip the attribute lookup, and skip the context tree search if the
+ * region is entered under the same parent region as before.
+ *
+ * The handle's value string must remain valid for the lifetime of the
+ * program, e.g. a string literal or \c __func__.
+ */
+typedef struct cali_string_handle {
+  const char* attr_name; /**< Attribute name                             */
+  const char* value;     /**< String value                               */
+  cali_id_t   attr_id;   /**< Resolved attribute ID, CALI_INV_ID at first */
+  size_t      len;       /**< Length of \a value                         */
+  void*       node;      /**< Context tree node of the last begin        */
+} cali_string_handle_t;
+
+/**
+ * \brief Static initializer for a \ref cali_string_handle_t.
+ */
+#define CALI_STRING_HANDLE_INITIALIZER(attr_name, value) \
+  { (attr_name), (value), CALI_INV_ID, 0, 0 }
+
+/**
+ * \brief Begin the region described by the cached handle \a handle.
+ */
+cali_err
+cali_begin_string_cached(cali_string_handle_t* handle);
+
+/**
+ * \brief End the region described by the cached handle \a handle.
+ */
+cali_err
+cali_end_cached(cali_string_handle_t* handle);
+
+/**
+ * \brief Register the region \a value of string attribute \a attr_name
+ *   and return an integer handle for it.
+ *
+ * Meant for language bindings (e.g., Fortran) that can't keep a
+ * \ref cali_string_handle_t. The strings are copied. Registering the
+ * same attribute/value pair again returns the same handle.
+ *
+ * \return Region handle, or -1 on error
+ */
+int
+cali_make_region_handle(const char* attr_name, const char* value);
+
+/**
+ * \brief Begin the region with handle \a handle from
+ *   cali_make_region_handle().
+ */
+cali_err
+cali_begin_region_handle(int handle);
+
+/**
+ * \brief End the region with handle \a handle from
+ *   cali_make_region_handle().
+ */
+cali_err
+cali_end_region_handle(int handle);
+
+/**
+ * \}
+ * \name Counters
+ * \{
+ */
+
+/**
+ * \brief Create a per-thread counter for the uint attribute \a name.
+ *
+ * cali_counter_add() updates the calling thread's counter value
+ * without invoking any callbacks. Snapshots report the increment
+ * since the thread's previous snapshot as \a name=&lt;increment&gt;,
+ * so that e.g. the aggregate service sums up the increments per
+ * region. Creating a counter for \a name again returns the same
+ * handle.
+ *
+ * \param name       Attribute name
+ * \param properties Additional attribute properties. The attribute is
+ *   always created with CALI_ATTR_ASVALUE, CALI_ATTR_SCOPE_THREAD, and
+ *   CALI_ATTR_SKIP_EVENTS.
+ * \return Counter handle, or -1 on error
+ */
+int
+cali_create_counter(const char* name, int properties);
+
+/**
+ * \brief Add \a value to the calling thread's value of counter
+ *   \a counter from cali_create_counter(). Invalid handles are
+ *   ignored.
+ */
+void
+cali_counter_add(int counter, uint64_t value);
+
 /**
  * \}
  * \}
@@ -529,6 +775,45 @@ typedef enum {
 void
 cali_flush(int flush_opts);
 
+/**
+ * \brief Query the memory held by %Caliper's runtime components.
+ *
+ * Sums up the memory of all runtime components, e.g. context trees,
+ * blackboards, and trace and aggregation buffers. Set
+ * \c CALI_CALIPER_MEMORY_REPORT for a report with the memory usage per
+ * component and per thread at exit.
+ *
+ * \param reserved If not NULL, receives the number of bytes allocated
+ * \param used     If not NULL, receives the number of bytes holding
+ *    live data
+ */
+
+void
+cali_memory_usage(size_t* reserved, size_t* used);
+
+/**
+ * \}
+ * \name Runtime service control
+ * \{
+ */
+
+/**
+ * \brief Enable or disable a service at runtime.
+ *
+ * The callbacks of a disabled service are skipped, so it neither
+ * takes measurements nor records data. Disabling a service first
+ * writes out and clears its buffered data. This can be used to,
+ * e.g., switch on tracing only for a while after an anomaly has
+ * been detected.
+ *
+ * \param name   Service name, e.g. "trace"
+ * \param enable Non-zero to enable, 0 to disable the service
+ * \return CALI_EINV if the service is not active
+ */
+
+cali_err
+cali_set_service_enabled(const char* name, int enable);
+
 /**
  * \}
  */
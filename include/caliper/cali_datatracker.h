@@ -55,6 +55,17 @@ extern "C" {
  * --- Data tracking functions ------------------------------------------------
  */
 
+/**
+ * \brief A memory region to track with cali_datatracker_track_regions().
+ */
+typedef struct cali_datatracker_region {
+    const void   *ptr;            /**< Start of the region */
+    const char   *label;          /**< Label, or NULL to set it later */
+    size_t        elem_size;      /**< Size of an element in bytes */
+    const size_t *dimensions;     /**< Array of the dimensions */
+    size_t        num_dimensions; /**< Number of entries in `dimensions` */
+} cali_datatracker_region_t;
+
 /**
  * \addtogroup AnnotationAPI
  * \{
@@ -134,6 +145,34 @@ cali_datatracker_track_dimensional(const void   *ptr,
                                    const size_t *dimensions,
                                    size_t        num_dimensions);
 
+/**
+ * Track many existing allocations in Caliper at once.
+ *
+ * This is much faster than tracking each region separately: labels
+ * shared by many regions are processed only once, and the regions are
+ * inserted in address order with few lock acquisitions.
+ * Regions with a NULL label are tracked without one until it is set
+ * with `cali_datatracker_label`.
+ *
+ * \param regions Array of the regions to track
+ * \param n Number of entries in `regions`
+ */
+
+void
+cali_datatracker_track_regions(const cali_datatracker_region_t *regions,
+                               size_t n);
+
+/**
+ * Set the label of an allocation that was tracked without one.
+ *
+ * \param ptr The pointer to the beginning of the allocation
+ * \param label The label for the allocation
+ */
+
+void
+cali_datatracker_label(const void *ptr,
+                       const char *label);
+
 /**
  * Untrack a previously tracked allocation in Caliper.
  *
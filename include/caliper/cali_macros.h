@@ -90,6 +90,35 @@
 #define CALI_CXX_MARK_LOOP_ITERATION(loop_id, iter) \
     cali::Loop::Iteration __cali_iter_##loop_id ( __cali_loop_##loop_id.iteration(static_cast<int>(iter)) )
 
+/// \brief C++ macro to mark a function, using a cached handle
+///
+/// Like \ref CALI_CXX_MARK_FUNCTION, but keeps the resolved attribute
+/// and context tree node in a function-local static handle. Repeated
+/// calls skip the attribute and context tree lookups.
+
+#define CALI_CXX_MARK_FUNCTION_CACHED \
+    static cali_string_handle_t __cali_func_handle = \
+        CALI_STRING_HANDLE_INITIALIZER("function", __func__); \
+    cali::CachedRegion __cali_func_region(&__cali_func_handle)
+
+/// \brief Mark loop in C++, using cached handles
+///
+/// Like \ref CALI_CXX_MARK_LOOP_BEGIN, but keeps the loop and iteration
+/// attributes in function-local static handles. The loop \a name must
+/// be a string literal. End the loop with \ref CALI_CXX_MARK_LOOP_END,
+/// and mark iterations with \ref CALI_CXX_MARK_LOOP_ITERATION_CACHED.
+#define CALI_CXX_MARK_LOOP_BEGIN_CACHED(loop_id, name) \
+    static cali_string_handle_t __cali_loop_handle_##loop_id = \
+        CALI_STRING_HANDLE_INITIALIZER("loop", name); \
+    static cali_id_t __cali_iter_attr_##loop_id = CALI_INV_ID; \
+    cali::CachedLoop __cali_loop_##loop_id(&__cali_loop_handle_##loop_id, &__cali_iter_attr_##loop_id)
+
+/// \brief C++ macro for a loop iteration in a loop marked with
+///   \ref CALI_CXX_MARK_LOOP_BEGIN_CACHED
+/// \copydetails CALI_CXX_MARK_LOOP_ITERATION
+#define CALI_CXX_MARK_LOOP_ITERATION_CACHED(loop_id, iter) \
+    cali::CachedLoop::Iteration __cali_iter_##loop_id ( __cali_loop_##loop_id.iteration(static_cast<int>(iter)) )
+
 #endif // __cplusplus
 
 extern cali_id_t cali_function_attr_id;
@@ -233,6 +262,59 @@ extern cali_id_t cali_annotation_attr_id;
 #define CALI_MARK_END(name) \
     cali_safe_end_string(cali_annotation_attr_id, (name))
 
+/*
+ * --- Cached annotation macros
+ *
+ * These variants keep the resolved attribute and context tree node in
+ * a static local handle (see \ref cali_string_handle_t), so repeated
+ * region entries skip the attribute and context tree lookups. Region
+ * and loop names must be string literals.
+ */
+
+/// \brief Mark begin of a function, using a cached handle.
+/// \sa CALI_MARK_FUNCTION_BEGIN, CALI_MARK_FUNCTION_END_CACHED
+#define CALI_MARK_FUNCTION_BEGIN_CACHED \
+    static cali_string_handle_t __cali_func_handle = \
+        CALI_STRING_HANDLE_INITIALIZER("function", __func__); \
+    cali_begin_string_cached(&__cali_func_handle)
+
+/// \brief Mark end of a function marked with
+///   \ref CALI_MARK_FUNCTION_BEGIN_CACHED.
+#define CALI_MARK_FUNCTION_END_CACHED \
+    cali_end_cached(&__cali_func_handle)
+
+/// \brief Mark begin of a loop, using cached handles.
+///
+/// Mark iterations with \ref CALI_MARK_ITERATION_BEGIN and
+/// \ref CALI_MARK_ITERATION_END as for \ref CALI_MARK_LOOP_BEGIN.
+/// \sa CALI_MARK_LOOP_BEGIN, CALI_MARK_LOOP_END_CACHED
+#define CALI_MARK_LOOP_BEGIN_CACHED(loop_id, name) \
+    static cali_string_handle_t __cali_loop_handle_##loop_id = \
+        CALI_STRING_HANDLE_INITIALIZER("loop", name); \
+    static cali_id_t __cali_iter_##loop_id = CALI_INV_ID; \
+    cali_begin_string_cached(&__cali_loop_handle_##loop_id); \
+    if (__cali_iter_##loop_id == CALI_INV_ID) \
+        __cali_iter_##loop_id = cali_make_loop_iteration_attribute(name)
+
+/// \brief Mark end of a loop marked with \ref CALI_MARK_LOOP_BEGIN_CACHED.
+#define CALI_MARK_LOOP_END_CACHED(loop_id) \
+    cali_end_cached(&__cali_loop_handle_##loop_id)
+
+/// \brief Mark begin of a user-defined code region, using a cached handle.
+///
+/// \param region_id A region identifier, used to refer to the region
+///   in \ref CALI_MARK_END_CACHED.
+/// \param name The region name. Must be a string literal.
+/// \sa CALI_MARK_BEGIN
+#define CALI_MARK_BEGIN_CACHED(region_id, name) \
+    static cali_string_handle_t __cali_region_handle_##region_id = \
+        CALI_STRING_HANDLE_INITIALIZER("annotation", name); \
+    cali_begin_string_cached(&__cali_region_handle_##region_id)
+
+/// \brief Mark end of a region marked with \ref CALI_MARK_BEGIN_CACHED.
+#define CALI_MARK_END_CACHED(region_id) \
+    cali_end_cached(&__cali_region_handle_##region_id)
+
 /**
  * \} (group) 
  */
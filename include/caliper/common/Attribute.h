@@ -72,7 +72,7 @@ class Attribute
 public:
 
     constexpr Attribute()
-        : m_node(0)
+        : m_node(0), m_type(CALI_TYPE_INV), m_prop(CALI_ATTR_DEFAULT)
         { }
 
     cali_id_t      id() const;
@@ -80,9 +80,13 @@ public:
     std::string    name() const;
     const char*    name_c_str() const;
     
-    cali_attr_type type() const;
+    cali_attr_type type() const {
+        return m_type;
+    }
 
-    int            properties() const;
+    int            properties() const {
+        return m_prop;
+    }
 
     /// \brief Return the context tree node pointer that represents 
     ///   this attribute key.
@@ -125,10 +129,15 @@ private:
 
     const Node*            m_node;
 
+    // Type and properties never change, so they are looked up in the
+    // context tree only once in make_attribute()
+    cali_attr_type         m_type;
+    int                    m_prop;
+
     static const MetaAttributeIDs s_keys;
 
-    Attribute(const Node* node)
-        : m_node(node)
+    Attribute(const Node* node, cali_attr_type type, int prop)
+        : m_node(node), m_type(type), m_prop(prop)
         { }
 
     friend bool operator <  (const cali::Attribute& a, const cali::Attribute& b);
@@ -67,7 +67,7 @@ public:
     get_attributes() const = 0;
 
     /// \brief Return all attributes that have a metadata entry \a meta, of any value
-    std::vector<Attribute>
+    virtual std::vector<Attribute>
     find_attributes_with(const Attribute& meta) const;
 
     // --- modifying operations
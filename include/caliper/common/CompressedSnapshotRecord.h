@@ -19,6 +19,57 @@ class Node;
 
 class CompressedSnapshotRecord;
 
+//
+// --- CompressedSnapshotBatch
+//
+
+/// \brief Structure-of-arrays representation of a batch of decoded
+///   compressed snapshot records.
+///
+/// Record \a i has node entries node_ids[node_offsets[i]] to
+/// node_ids[node_offsets[i+1]-1], and immediate entries at
+/// imm_attr/imm_data[imm_offsets[i]] to [imm_offsets[i+1]-1]. The
+/// arrays are reused across decode() calls, so decoding many batches
+/// does not allocate memory per record.
+struct CompressedSnapshotBatch
+{
+    std::vector<size_t>    node_offsets;
+    std::vector<cali_id_t> node_ids;
+
+    std::vector<size_t>    imm_offsets;
+    std::vector<cali_id_t> imm_attr;
+    std::vector<Variant>   imm_data;
+
+    CompressedSnapshotBatch()
+        : node_offsets(1, 0), imm_offsets(1, 0)
+    { }
+
+    size_t num_records() const { return node_offsets.size() - 1; }
+
+    size_t num_nodes(size_t i) const      { return node_offsets[i+1] - node_offsets[i]; }
+    size_t num_immediates(size_t i) const { return imm_offsets[i+1]  - imm_offsets[i];  }
+
+    const cali_id_t* nodes(size_t i) const          { return node_ids.data() + node_offsets[i]; }
+    const cali_id_t* immediate_attr(size_t i) const { return imm_attr.data() + imm_offsets[i];  }
+    const Variant*   immediate_data(size_t i) const { return imm_data.data() + imm_offsets[i];  }
+
+    /// \brief Remove all records (keeps allocated memory)
+    void clear();
+
+    /// \brief Decode up to \a max_records consecutive compressed snapshot
+    ///   records from \a buf and append them to the batch.
+    ///
+    /// Stops at the end of the buffer or at the first incomplete or
+    /// invalid record.
+    ///
+    /// \param  buf  Buffer with consecutive compressed snapshot records
+    /// \param  len  Length of \a buf in bytes
+    /// \param  max_records Maximum number of records to decode
+    /// \param  inc  Incremented by the number of bytes read, if given
+    /// \return Number of records decoded
+    size_t decode(const unsigned char* buf, size_t len, size_t max_records, size_t* inc = nullptr);
+};
+
 //
 // --- CompressedSnapshotRecordView
 //
@@ -143,6 +194,10 @@ public:
     /// \brief Append node entries
     size_t
     append(size_t n, const Node* const node_vec[]);
+
+    /// \brief Append node entries given by node id
+    size_t
+    append(size_t n, const cali_id_t node_vec[]);
     
     /// \brief Append immediate entries
     size_t
@@ -0,0 +1,59 @@
+/// \file  HyperLogLog.h
+/// \brief HyperLogLog distinct-value counter
+
+#pragma once
+
+#include "caliper/common/Variant.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace cali
+{
+
+/// \brief HyperLogLog distinct-value counter.
+///
+/// Estimates the number of distinct values added to it with a fixed
+/// number of 6-bit registers (standard error about 6.5%). Counters can
+/// be merged, e.g. across threads or processes. With encode() and
+/// merge_code(), counters can be written to and restored from snapshot
+/// records as a set of UINT values.
+class HyperLogLog
+{
+public:
+
+    static const int NumRegisterBits = 8;
+    static const int NumRegisters    = 1 << NumRegisterBits;
+
+    HyperLogLog();
+
+    /// \brief Add a (well-mixed) 64-bit hash value
+    void     add_hash(uint64_t hash);
+
+    /// \brief Add a value. Strings are compared by content, other types
+    ///   by their 64-bit value.
+    void     add(const Variant& val) {
+        add_hash(hash(val));
+    }
+
+    void     merge(const HyperLogLog& other);
+
+    /// \brief Merge registers from a code word written by encode()
+    void     merge_code(uint64_t code);
+
+    /// \brief Append code words for all non-empty register groups to \a codes
+    void     encode(std::vector<uint64_t>& codes) const;
+
+    bool     empty() const;
+
+    /// \brief Estimated number of distinct values
+    uint64_t estimate() const;
+
+    static uint64_t hash(const Variant& val);
+
+private:
+
+    unsigned char m_registers[NumRegisters];
+};
+
+} // namespace cali
@@ -54,21 +54,34 @@ namespace cali
 
 /// \brief A context tree node.
 ///   Represents a context tree node and its (attribute key, value) pair.
-
-class Node : public IdType, public util::LockfreeIntrusiveTree<Node> 
+///
+/// The tree links are kept in an embedded tree node element. Tree
+/// operations go through a temporary LockfreeIntrusiveTree view
+/// instead of inheriting one, which would store a self pointer and a
+/// member pointer in every node: this keeps a Node at 64 bytes on
+/// 64-bit platforms, i.e. one cache line.
+
+class Node : public IdType
 {
-    util::LockfreeIntrusiveTree<Node>::Node m_treenode;
+    typedef util::LockfreeIntrusiveTree<Node> Tree;
+
+    Tree::Node m_treenode;
 
-    cali_id_t m_attribute;
-    Variant   m_data;
+    cali_id_t  m_attribute;
+    Variant    m_data;
 
     static const RecordDescriptor s_record;
 
+    Tree tree() const {
+        return Tree(const_cast<Node*>(this), &Node::m_treenode);
+    }
+
 public:
 
+    typedef Tree::depthfirst_iterator depthfirst_iterator;
+
     Node(cali_id_t id, cali_id_t attr, const Variant& data)
         : IdType(id),
-          util::LockfreeIntrusiveTree<Node>(this, &Node::m_treenode), 
         m_attribute { attr },
         m_data      { data }
         { }
@@ -85,7 +98,23 @@ public:
 
     cali_id_t attribute() const { return m_attribute; }
     Variant   data() const      { return m_data;      }    
-    
+
+    Node* parent()       const { return m_treenode.parent; }
+    Node* first_child()  const { return m_treenode.head.load(std::memory_order_relaxed); }
+    Node* next_sibling() const { return m_treenode.next;   }
+
+    void  append(Node* sub) { tree().append(sub); }
+
+    /// \brief Find a child for which \a match returns \c true.
+    ///   See util::LockfreeIntrusiveTree::find_child().
+    template<typename Match, typename ChildHash>
+    Node* find_child(size_t hash, Match match, ChildHash child_hash, unsigned threshold = 16) {
+        return tree().find_child(hash, match, child_hash, threshold);
+    }
+
+    depthfirst_iterator begin() { return tree().begin(); }
+    depthfirst_iterator end()   { return tree().end();   }
+
     static const RecordDescriptor& record_descriptor() { return s_record; }
 
     RecordMap record() const;
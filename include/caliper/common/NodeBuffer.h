@@ -44,6 +44,9 @@ public:
     void append(const NodeInfo& info);
     void append(const Node* node);
 
+    /// \brief Discard the buffer contents, but keep the allocated memory
+    void clear() { m_count = 0; m_pos = 0; }
+
     size_t count() const { return m_count; }
     size_t size() const  { return m_pos;   }
     
@@ -60,15 +60,33 @@ public:
         None,
         StdOut,
         StdErr,
-        File
+        File,
+        User
     };
 
+    enum Compression {
+        NoCompression,
+        Gzip
+    };
+
+    /// \brief Default size of the write buffer for file streams
+    static const std::size_t DefaultBufferSize = 4 * 1024 * 1024;
+
     StreamType    type() const;
 
+    Compression   compression() const;
+
     /// \brief Return a C++ ostream. Opens/creates the underlying file stream
     ///   if needed.
     std::ostream& stream();
 
+    /// \brief Write a block of pre-formatted output.
+    ///
+    /// Like stream().write(), but file streams write large blocks
+    /// directly rather than copying them into the write buffer.
+    /// Not thread-safe: callers must serialize writes.
+    void          write(const char* data, std::size_t len);
+
     OutputStream();
 
     ~OutputStream();
@@ -77,6 +95,44 @@ public:
     void
     set_stream(StreamType type);
 
+    /// \brief Write to the given user-provided C++ stream.
+    ///
+    /// The stream object must remain valid as long as this
+    /// OutputStream is in use.
+    void
+    set_stream(std::ostream* os);
+
+    /// \brief Compress the output.
+    ///
+    /// Gzip compression is done in background threads, in blocks that
+    /// the .cali readers can decompress in parallel. File names ending
+    /// in ".gz" enable gzip compression automatically. Must be set before
+    /// the first stream() call.
+    void
+    set_compression(Compression compression);
+
+    /// \brief Set the write buffer size for file streams.
+    ///
+    /// File output is written in blocks of this size (rounded up to a
+    /// multiple of 4 KiB), and otherwise only when the stream is flushed
+    /// or closed. Must be set before the first stream() call.
+    void
+    set_buffer_size(std::size_t size);
+
+    /// \brief Write files with direct I/O (O_DIRECT), bypassing the OS
+    ///   page cache. Falls back to regular I/O if the file system doesn't
+    ///   support it.
+    ///
+    /// In direct I/O mode, flushing the stream only writes complete
+    /// 4 KiB blocks: the rest is written when the stream is closed.
+    /// Must be set before the first stream() call.
+    void
+    set_direct_io(bool direct);
+
+    /// \brief Call fsync() when the file is closed
+    void
+    set_fsync(bool do_fsync);
+
     /// \brief Set stream's file name to \a filename
     void
     set_filename(const char* filename);
@@ -42,6 +42,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace cali
 {
@@ -79,6 +80,10 @@ class RuntimeConfig
 
 public:
 
+    /// \brief Function that returns the contents of the given config
+    ///   files, one string per file that could be read.
+    typedef std::vector<std::string> (*ConfigFileReadFn)(const std::vector<std::string>& filenames);
+
     /// \brief Get config entry with given \a key from given \a set
     static StringConverter get(const char* set, const char* key);
 
@@ -152,6 +157,21 @@ public:
     ///   runtime system.
     static bool            allow_read_env(bool allow);
 
+    /// \brief Set a function to obtain the config file contents when
+    ///   \t CALI_CONFIG_FILE_BROADCAST is enabled.
+    ///
+    /// The Caliper MPI runtime library uses this to read config files
+    /// on rank 0 only and broadcast their contents to the other ranks.
+    ///
+    /// \note Only effective *before* initialization of the %Caliper
+    ///   runtime system.
+    static void            set_config_file_reader(ConfigFileReadFn fn);
+
+    /// \brief Read the given config files from the local file system.
+    ///   Files that cannot be opened are skipped.
+    static std::vector<std::string>
+                           read_config_files(const std::vector<std::string>& filenames);
+
     /// \brief Print the current configuration settings.
     ///
     /// \note Only effective after initialization of the %Caliper
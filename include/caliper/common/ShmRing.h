@@ -0,0 +1,167 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file  ShmRing.h
+/// \brief Shared-memory ring buffer for live snapshot export
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace cali
+{
+
+/// \brief Layout of the shared-memory export segment
+///
+/// The segment starts with this header, followed by the node dictionary
+/// and the record ring. The dictionary is an append-only sequence of
+/// entries, each with an 8-byte commit word (payload length in the lower,
+/// entry offset / 8 in the upper 32 bits) followed by the payload, padded
+/// to 8 bytes. A dictionary entry contains one node in NodeBuffer
+/// encoding.
+///
+/// The record ring is an array of fixed-size slots. Each slot starts with
+/// a sequence word and the payload length; the payload is a
+/// CompressedSnapshotRecord. Writers claim slot number \e n with an atomic
+/// increment of \a ring_head and publish it by setting the slot's
+/// sequence word to \e 2n+2 (\e 2n+1 while it is being written). A slot
+/// is overwritten when the writers lap the ring, so readers must check
+/// the sequence word before and after copying a slot.
+struct ShmRingHeader
+{
+    static const char     magic[8];
+    static const uint32_t version = 1;
+
+    char                  id[8];
+    uint32_t              version_number;
+    uint32_t              header_size;
+    uint64_t              pid;
+
+    uint64_t              dict_offset;
+    uint64_t              dict_capacity;
+    uint64_t              ring_offset;
+    uint64_t              slot_size;
+    uint64_t              num_slots;
+
+    std::atomic<uint64_t> dict_head;   ///< Bytes reserved in the dictionary
+    std::atomic<uint64_t> ring_head;   ///< Number of slots claimed
+    std::atomic<uint64_t> num_dropped; ///< Records that didn't fit
+};
+
+/// \brief Producer side of the shared-memory ring. Lock-free and safe to
+///   use from multiple threads.
+class ShmRingWriter
+{
+    ShmRingHeader* m_header;
+    unsigned char* m_base;
+
+public:
+
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        uint32_t              len;
+        uint32_t              reserved;
+    };
+
+    /// \brief Format the \a size bytes at \a mem as export segment with
+    ///   a \a dict_size bytes node dictionary and ring slots of
+    ///   \a slot_size bytes
+    ShmRingWriter(void* mem, std::size_t size, std::size_t dict_size, std::size_t slot_size);
+
+    bool valid() const {
+        return m_header != nullptr;
+    }
+
+    /// \brief Append \a len bytes of node data to the dictionary. Returns
+    ///   \c false if the dictionary is full.
+    bool add_node(const unsigned char* data, std::size_t len);
+
+    /// \brief Publish a record. Returns \c false (and counts the record as
+    ///   dropped) if it doesn't fit into a slot.
+    bool add_record(const unsigned char* data, std::size_t len);
+
+    std::size_t max_record_size() const;
+
+    uint64_t num_records() const;
+    uint64_t num_dropped() const;
+};
+
+/// \brief Consumer side of the shared-memory ring
+///
+/// Single-threaded. Only reads the segment, so it works with a read-only
+/// mapping.
+class ShmRingReader
+{
+    const ShmRingHeader* m_header;
+    const unsigned char* m_base;
+
+    uint64_t             m_dict_pos;
+    uint64_t             m_next;
+    uint64_t             m_lost;
+
+    unsigned char*       m_buf;
+
+public:
+
+    typedef std::function<void(const unsigned char* data, std::size_t len)> DataFn;
+
+    /// \brief Attach to the export segment at \a mem
+    ShmRingReader(const void* mem, std::size_t size);
+
+    ~ShmRingReader();
+
+    ShmRingReader(const ShmRingReader&) = delete;
+    ShmRingReader& operator = (const ShmRingReader&) = delete;
+
+    bool valid() const {
+        return m_header != nullptr;
+    }
+
+    /// \brief Process new dictionary entries with \a node_fn, then all
+    ///   records published since the last call with \a record_fn.
+    ///   Returns the number of records read.
+    ///
+    /// If the writers have lapped the reader, the reader skips ahead to
+    /// the oldest record still in the ring and counts the skipped ones
+    /// as lost.
+    std::size_t poll(DataFn node_fn, DataFn record_fn);
+
+    /// \brief Number of records that were overwritten before they were read
+    uint64_t num_lost() const { return m_lost; }
+
+    uint64_t pid() const;
+};
+
+} // namespace cali
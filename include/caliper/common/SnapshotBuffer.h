@@ -10,6 +10,7 @@ namespace cali
 
 class CompressedSnapshotRecord;
 class CompressedSnapshotRecordView;
+struct CompressedSnapshotBatch;
     
 /// \brief Serialize/deserialize a set of nodes
 class SnapshotBuffer
@@ -35,6 +36,9 @@ public:
 
     void append(const CompressedSnapshotRecord& rec);
 
+    /// \brief Discard the buffer contents, but keep the allocated memory
+    void clear() { m_count = 0; m_pos = 0; }
+
     std::size_t count() const { return m_count; }
     std::size_t size() const  { return m_pos;   }
     
@@ -46,6 +50,10 @@ public:
 
     /// \brief Run function \a fn on each snapshot  
     void for_each(std::function<void(const CompressedSnapshotRecordView&)> fn) const;
+
+    /// \brief Decode all snapshots into \a batch
+    /// \return Number of records decoded
+    std::size_t decode(CompressedSnapshotBatch& batch) const;
 };
 
 } // namespace cali
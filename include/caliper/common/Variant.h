@@ -124,6 +124,12 @@ public:
     }
 
     static Variant from_string(cali_attr_type type, const char* str, bool* ok = nullptr);
+
+    /// \brief Convert the plain number in [\a str, \a str + \a len) to
+    ///   a numeric Variant of type \a type, without copying the string.
+    ///   Returns false if the text is not a plain number of that type;
+    ///   from_string() handles the other cases.
+    static bool    from_number_string(cali_attr_type type, const char* str, size_t len, Variant& val);
     
     // vector<unsigned char> data() const;
 
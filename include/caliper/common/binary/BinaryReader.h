@@ -0,0 +1,109 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file BinaryReader.h
+/// \brief BinaryReader class definition
+
+#pragma once
+
+#include "../NodeBuffer.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cali
+{
+
+/// \brief Read a stream in the binary .cali container format
+///
+/// The reader does not interpret the records: IDs are passed on as they
+/// appear in the stream. Variants given to the callbacks point into the
+/// reader's buffers and are only valid for the duration of the callback.
+///
+/// In rank-tagged containers, each rank section has its own ID space. The
+/// reader invokes the rank callback at the start of each section, before
+/// any of the section's records.
+class BinaryReader
+{
+    struct BinaryReaderImpl;
+
+    std::unique_ptr<BinaryReaderImpl> mP;
+
+public:
+
+    typedef std::function<void(const NodeBuffer::NodeInfo&)>
+        NodeFn;
+    typedef std::function<void(size_t n_nodes, const cali_id_t nodes[],
+                               size_t n_imm,   const cali_id_t attr[], const Variant vals[])>
+        SnapshotFn;
+    typedef std::function<void(uint64_t rank)>
+        RankFn;
+
+    /// \brief Entry in the rank index of a rank-tagged container
+    struct RankSection {
+        uint64_t rank;
+        uint64_t offset; ///< Byte offset of the section's rank block
+        uint64_t size;   ///< Size of the section in bytes
+    };
+
+    /// \brief Create reader for \a filename. Reads from stdin if
+    ///   \a filename is empty.
+    BinaryReader(const std::string& filename);
+
+    /// \brief Create reader for the in-memory stream [\a data,
+    ///   \a data + \a len). The buffer must remain valid while the reader
+    ///   is in use. \a name is only used in messages.
+    BinaryReader(const std::string& name, const char* data, size_t len);
+
+    ~BinaryReader();
+
+    bool read(NodeFn node_fn, SnapshotFn snapshot_fn, SnapshotFn globals_fn,
+              RankFn rank_fn = RankFn());
+
+    /// \brief Check if \a filename (or stdin, if empty) contains a
+    ///   binary .cali stream
+    static bool is_binary(const std::string& filename);
+
+    /// \brief Check if the buffer [\a data, \a data + \a len) starts
+    ///   with a binary .cali stream header
+    static bool is_binary(const char* data, size_t len);
+
+    /// \brief Read the rank index of the rank-tagged container
+    ///   \a filename into \a index. Returns \c false if the file has no
+    ///   rank index.
+    static bool rank_index(const std::string& filename, std::vector<RankSection>& index);
+};
+
+} // namespace cali
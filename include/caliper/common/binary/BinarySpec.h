@@ -0,0 +1,93 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file BinarySpec.h
+/// \brief Binary .cali container format definitions
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cali
+{
+
+/// \brief Layout of the binary .cali container format
+///
+/// A binary .cali stream starts with the 8-byte magic number, followed by
+/// the format version as variable-length encoded integer. The remainder
+/// of the stream is a sequence of blocks. Each block starts with a one-byte
+/// block type, followed by the number of records and the payload length
+/// in bytes (both variable-length encoded), and the payload itself.
+///
+/// Node blocks contain NodeBuffer data. Snapshot and globals blocks contain
+/// a sequence of CompressedSnapshotRecord buffers. Immediate string and blob
+/// values in snapshot records refer to entries in preceding string blocks
+/// by index.
+///
+/// Streams from several processes can be combined into one rank-tagged
+/// container: each process' blocks are preceded by a rank block, whose
+/// payload is the process' rank. A rank block starts a new section with
+/// its own ID space and string table. An index block at the end of the
+/// container lists rank, offset, and size of each section.
+struct BinarySpec
+{
+    static const unsigned char magic[8];
+    static const unsigned      version = 1;
+
+    enum BlockType : unsigned char {
+        NodeBlock     = 'N',
+        StringBlock   = 'S',
+        SnapshotBlock = 'C',
+        GlobalsBlock  = 'G',
+        RankBlock     = 'R',
+        IndexBlock    = 'I'
+    };
+
+    /// \brief Maximum size of a block header
+    static const std::size_t max_block_header_size = 21;
+
+    /// \brief Check if \a buf begins with the binary .cali magic number
+    static bool is_magic(const unsigned char* buf, std::size_t len);
+
+    /// \brief Return the size of the stream header (magic number and version)
+    ///   at the beginning of \a buf, or 0 if \a buf doesn't start with a
+    ///   valid header
+    static std::size_t header_size(const unsigned char* buf, std::size_t len);
+
+    /// \brief Encode a block header into \a buf, which must hold at least
+    ///   max_block_header_size bytes. Returns the header size.
+    static std::size_t write_block_header(unsigned char* buf, BlockType type,
+                                          uint64_t count, uint64_t len);
+};
+
+} // namespace cali
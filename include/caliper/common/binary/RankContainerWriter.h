@@ -0,0 +1,89 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file RankContainerWriter.h
+/// \brief RankContainerWriter class definition
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+namespace cali
+{
+
+/// \brief Combine the binary .cali streams of several processes into one
+///   rank-tagged container
+///
+/// Each appended stream is written as a rank section: a rank block
+/// followed by the stream's blocks. finish() writes the rank index.
+/// The stream header is written before the first section.
+class RankContainerWriter
+{
+    std::ostream& m_os;
+
+    bool          m_header_written;
+    uint64_t      m_offset;
+
+    struct Section {
+        uint64_t rank;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    std::vector<Section> m_sections;
+
+    void write(const unsigned char* buf, std::size_t len);
+    void write_header();
+
+public:
+
+    RankContainerWriter(std::ostream& os);
+
+    /// \brief Append the binary .cali stream in \a buf (as written by
+    ///   BinaryWriter) as the section for \a rank.
+    ///
+    /// An empty stream creates an empty section. Returns \c false if
+    /// \a buf is not a binary .cali stream.
+    bool append(uint64_t rank, const unsigned char* buf, std::size_t len);
+
+    /// \brief Write the rank index
+    void finish();
+
+    std::size_t num_sections() const {
+        return m_sections.size();
+    }
+};
+
+} // namespace cali
@@ -61,6 +61,9 @@
  *    val1 = vldec_u64(buf+pos, &pos);
  *    val2 = vldec_u64(buf+pos, &pos);
  *  ~~~~~~~~
+ *
+ *  vlenc_u64_array() and vldec_u64_array() encode and decode whole
+ *  arrays of values, e.g. node IDs, in the same format.
  */
 
 #pragma once
@@ -122,6 +125,29 @@ vldec_u64(const unsigned char* buf, size_t* inc)
     return val;
 }
 
+/*! \brief Write \a n 64-bit values into \a buf using variable-length
+ *   encoding. Same result as \a n vlenc_u64() calls.
+ *
+ * \param  vals Values to be written.
+ * \param  n    Number of values.
+ * \param  buf  Character buffer. Must be large enough to hold 10 bytes
+ *   per value.
+ * \return      Number of bytes written.
+ */
+size_t
+vlenc_u64_array(const uint64_t* vals, size_t n, unsigned char* buf);
+
+/*! \brief Read \a n variable-length encoded 64-bit values from \a buf.
+ *   Same result as \a n vldec_u64() calls.
+ *
+ * \param  buf  Buffer to read from.
+ * \param  n    Number of values to read.
+ * \param  vals Output array for \a n values.
+ * \return      Number of bytes read.
+ */
+size_t
+vldec_u64_array(const unsigned char* buf, size_t n, uint64_t* vals);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -38,14 +38,18 @@
 
 #include "../RecordMap.h"
 
+#include <cstddef>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace cali
 {
 
+class CsvRecordView;
+
 class CsvReader
 {
     struct CsvReaderImpl;
@@ -56,9 +60,56 @@ public:
 
     CsvReader(const std::string& filename);
 
+    /// \brief Read from the in-memory buffer [\a data, \a data + \a len)
+    ///   instead of a file, e.g. a file that was read ahead. The buffer
+    ///   must remain valid while the reader is in use. \a name is only
+    ///   used in messages.
+    CsvReader(const std::string& name, const char* data, std::size_t len);
+
     ~CsvReader();
 
     bool read(std::function<void(const RecordMap&)>);
+
+    /// \brief Read records in place, without copying them into RecordMaps.
+    ///   Regular files are memory-mapped. The view given to the callback is
+    ///   only valid for the duration of the call.
+    bool read_records(std::function<void(const CsvRecordView&)>);
+
+    /// \brief Read the complete records in a (possibly growing) file
+    ///   starting at byte \a offset.
+    ///
+    /// Records the writer has not finished yet (i.e., the last line, if it
+    /// isn't terminated by a newline) are skipped. On return, \a offset
+    /// points to the start of the first record that was not read, so that
+    /// repeated calls read only records appended since the last call.
+    /// \return false if the file can't be mapped or has become smaller
+    ///   than \a offset
+    bool read_records_from(std::size_t& offset, std::function<void(const CsvRecordView&)>);
+
+    /// \brief Read the records starting in the byte range [\a begin, \a end).
+    ///   \a begin must be the start of a record, e.g. a bound returned by
+    ///   record_blocks().
+    bool read_records_range(std::size_t begin, std::size_t end, std::function<void(const CsvRecordView&)>);
+
+    /// \brief Split the file into blocks of about \a block_size bytes at
+    ///   record boundaries.
+    ///
+    /// On return, \a bounds contains the start offset of each block,
+    /// followed by the file size.
+    /// \return false if the file can't be mapped
+    bool record_blocks(std::size_t block_size, std::vector<std::size_t>& bounds);
+
+    /// \brief Read a memory-mapped file with \a num_threads threads.
+    ///
+    /// Metadata (node and globals) records are read first and passed to
+    /// \a meta_handler in stream order. Then, the file is split into
+    /// chunks at record boundaries, and the remaining records are passed
+    /// to \a rec_handler from parallel threads, along with the thread index.
+    /// Falls back to sequential reading (in stream order) for stdin and
+    /// files that can't be mapped.
+    bool read_records_parallel(unsigned num_threads,
+                               std::function<void(const CsvRecordView&)> meta_handler,
+                               std::function<void(unsigned, const CsvRecordView&)> rec_handler);
 };
 
 } // namespace cali
@@ -0,0 +1,120 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file CsvRecordView.h
+/// \brief CsvRecordView class definition
+
+#pragma once
+
+#include "../RecordMap.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace cali
+{
+
+/// \brief In-place tokenizer for a single CSV record
+///
+/// Keys and values are (pointer, length) spans into the input. Only tokens
+/// that contain escape characters are copied (and unescaped) into an
+/// internal scratch buffer. A view can be re-used for parsing multiple
+/// records; it doesn't allocate memory once its buffers are large enough.
+class CsvRecordView
+{
+public:
+
+    struct Span {
+        const char* ptr;
+        std::size_t len;
+
+        bool        operator == (const char* str) const;
+        std::string to_string() const { return std::string(ptr, len); }
+    };
+
+    struct Entry {
+        Span        key;
+        std::size_t first; ///< Index of the first value
+        std::size_t count; ///< Number of values
+    };
+
+    /// \brief The keys of Caliper's node, snapshot, and globals records.
+    ///   They are resolved once while parsing.
+    enum Field {
+        Rec = 0, ///< __rec
+        Id,
+        Attr,
+        Data,
+        Parent,
+        Ref,
+        NumFields
+    };
+
+private:
+
+    std::vector<Entry> m_entries;
+    std::size_t        m_fields[NumFields]; ///< Entry index per field, or npos
+    std::vector<Span>  m_values;
+    std::vector<char>  m_scratch;
+
+public:
+
+    /// \brief Parse the record beginning at \a begin, up to the first
+    ///   unescaped newline or \a end.
+    /// \return Position after the parsed record
+    const char* parse(const char* begin, const char* end);
+
+    std::size_t  num_entries() const      { return m_entries.size(); }
+    const Entry& entry(std::size_t i) const { return m_entries[i];   }
+    const Span&  value(std::size_t i) const { return m_values[i];    }
+
+    /// \brief Return the entry with key \a key, or null if there is none
+    const Entry* find(const char* key) const;
+
+    /// \brief Return the first value of entry \a key, or an empty span
+    Span         first(const char* key) const;
+
+    /// \brief Return the entry for \a field, or null if there is none
+    const Entry* find(Field field) const {
+        return m_fields[field] == npos ? nullptr : &m_entries[m_fields[field]];
+    }
+
+    /// \brief Return the first value of \a field, or an empty span
+    Span         first(Field field) const;
+
+    static const std::size_t npos = static_cast<std::size_t>(-1);
+
+    RecordMap    to_record_map() const;
+};
+
+} // namespace cali
@@ -0,0 +1,42 @@
+/// \file  cacheline.hpp
+/// \brief Cache line size and cache-line aligned allocation
+
+#ifndef UTIL_CACHELINE_HPP
+#define UTIL_CACHELINE_HPP
+
+#include <cstddef>
+#include <new>
+
+#include <stdlib.h>
+
+namespace util
+{
+
+/// \brief Assumed cache line size, for separating data that is written
+///   by different threads
+constexpr std::size_t cacheline_size = 64;
+
+/// \brief Base class that allocates objects on cache line boundaries.
+///
+/// Before C++17, new ignores the alignment of over-aligned types. Per-thread
+/// data structures declared with alignas(cacheline_size) derive from this
+/// class so that heap allocated instances don't share their first and last
+/// cache lines with unrelated data from other threads.
+struct cacheline_aligned_new {
+    static void* operator new(std::size_t size) {
+        void* ptr = nullptr;
+
+        if (posix_memalign(&ptr, cacheline_size, size) != 0)
+            throw std::bad_alloc();
+
+        return ptr;
+    }
+
+    static void operator delete(void* ptr) noexcept {
+        free(ptr);
+    }
+};
+
+} // namespace util
+
+#endif
@@ -4,37 +4,161 @@
 #ifndef UTIL_CALLBACK_HPP
 #define UTIL_CALLBACK_HPP
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <vector>
 
 namespace util
 {
 
+/// @brief Hooks for self-profiling callback invocations.
+///
+/// Each callback is tagged with the owner ID in callback_owner() at the
+/// time it is connected. If callback_profile() is set, every invocation
+/// is bracketed with the begin/end hooks, and callback_owner() is set to
+/// the invoked callback's owner (so callbacks connected from inside a
+/// callback get the same owner).
+struct callback_profile_hooks {
+    struct token {
+        uint64_t start;
+        uint64_t saved;
+    };
+
+    token (*begin)();
+    void  (*end)(int owner, const token&);
+};
+
+inline int& callback_owner() {
+    static thread_local int owner = 0;
+    return owner;
+}
+
+inline callback_profile_hooks*& callback_profile() {
+    static callback_profile_hooks* hooks = nullptr;
+    return hooks;
+}
+
+/// @brief Bitmask of owner IDs whose callbacks are currently skipped.
+///   Used to disable services at runtime. Owners with IDs above 63
+///   can't be disabled.
+inline std::atomic<uint64_t>& callback_disabled() {
+    static std::atomic<uint64_t> mask { 0 };
+    return mask;
+}
+
+inline bool callback_is_disabled(uint64_t mask, int owner) {
+    return owner < 64 && ((mask >> owner) & 1);
+}
+
 template<class F>
-class callback
+class callback;
+
+/// @brief A list of callbacks with signature \a R(Args...)
+///
+/// Plain function pointers, which is what services connect in practice,
+/// are stored and invoked directly. Other callables go through
+/// std::function. Invoking an empty list costs a single branch.
+template<class R, class... Args>
+class callback<R(Args...)>
 {
-    std::vector< std::function<F> > mCb;
+    struct Entry {
+        R (*fn)(Args...);
+        std::function<R(Args...)> obj;
+        int owner;
+    };
+
+    std::vector<Entry> mCb;
+
+    template<class... A>
+    void invoke_profiled(callback_profile_hooks* prof, uint64_t disabled, A&&... a) {
+        for ( const Entry& e : mCb ) {
+            if (disabled && callback_is_disabled(disabled, e.owner))
+                continue;
+
+            int  prev = callback_owner();
+            auto t    = prof->begin();
+
+            callback_owner() = e.owner;
+
+            if (e.fn)
+                e.fn(a...);
+            else
+                e.obj(a...);
+
+            prof->end(e.owner, t);
+            callback_owner() = prev;
+        }
+    }
 
 public:
 
-    void connect(std::function<F> f) {
-        mCb.push_back(f);
-    } 
+    void connect(R (*fn)(Args...)) {
+        mCb.push_back(Entry { fn, nullptr, callback_owner() });
+    }
+
+    template<class Fn>
+    void connect(Fn f) {
+        mCb.push_back(Entry { nullptr, std::function<R(Args...)>(f), callback_owner() });
+    }
 
     bool empty() const {
         return mCb.empty();
     }
 
-    template<class... Args>
-    void operator()(Args... a) {
-        for ( auto& f : mCb )
-            f(a...);
+    template<class... A>
+    void operator()(A&&... a) {
+        if (mCb.empty())
+            return;
+
+        callback_profile_hooks* prof     = callback_profile();
+        uint64_t                disabled = callback_disabled().load(std::memory_order_relaxed);
+
+        if (prof) {
+            invoke_profiled(prof, disabled, a...);
+            return;
+        }
+
+        if (disabled) {
+            for ( const Entry& e : mCb ) {
+                if (callback_is_disabled(disabled, e.owner))
+                    continue;
+
+                if (e.fn)
+                    e.fn(a...);
+                else
+                    e.obj(a...);
+            }
+
+            return;
+        }
+
+        for ( const Entry& e : mCb )
+            if (e.fn)
+                e.fn(a...);
+            else
+                e.obj(a...);
     }
 
-    template<class Op, class R, class... Args>
-    R accumulate(Op op, R init, Args... a) {
-        for ( auto& f : mCb )
-            init = Op(init, f(a...));
+    /// @brief Invoke only the callbacks of \a owner, even if it is disabled
+    template<class... A>
+    void invoke_owner(int owner, A&&... a) {
+        for ( const Entry& e : mCb )
+            if (e.owner == owner) {
+                if (e.fn)
+                    e.fn(a...);
+                else
+                    e.obj(a...);
+            }
+    }
+
+    template<class Op, class Ret, class... A>
+    Ret accumulate(Op op, Ret init, A&&... a) {
+        uint64_t disabled = callback_disabled().load(std::memory_order_relaxed);
+
+        for ( const Entry& e : mCb )
+            if (!callback_is_disabled(disabled, e.owner))
+                init = op(init, e.fn ? e.fn(a...) : e.obj(a...));
 
         return init;
     }
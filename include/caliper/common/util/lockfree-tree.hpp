@@ -4,7 +4,9 @@
 #pragma once
 
 #include <atomic>
+#include <cstddef>
 #include <iterator>
+#include <vector>
 
 namespace util
 {
@@ -40,19 +42,68 @@ namespace util
 /// restrictions on the operations that can be
 /// performed. Specifically, tree nodes can only be added, but not
 /// moved or removed.
+///
+/// Children are kept in a singly linked list. For nodes with many
+/// children, find_child() maintains a hash index of the children. The
+/// index is a chain of immutable hash table segments, each covering a
+/// contiguous range of the child list: once a lookup had to walk more
+/// than a given threshold of un-indexed children, it builds a new
+/// segment for them and publishes it atomically. Segments are merged
+/// when the new one is at least as large as the next older one, so
+/// there are O(log n) segments, and each child is re-indexed O(log n)
+/// times. Lookups and appends remain lock-free. Replaced segments are
+/// kept until the node is destroyed because concurrent lookups may
+/// still use them.
    
 template<typename T> 
 class LockfreeIntrusiveTree {
 public:
 
+    struct ChildIndex;
+
     struct Node {
         T* parent;
         T* next;
         std::atomic<T*> head;
+        std::atomic<ChildIndex*> index;
 
         Node()
-            : parent(0), next(0), head(0)
+            : parent(0), next(0), head(0), index(0)
             { }
+
+        ~Node() {
+            for (ChildIndex* idx = index.load(); idx; ) {
+                ChildIndex* tmp = idx->replaced;
+                delete idx;
+                idx = tmp;
+            }
+        }
+    };
+
+    /// \brief Immutable open-addressing hash table of the children from
+    ///   \a head up to (excluding) \a stop
+    struct ChildIndex {
+        struct Slot {
+            size_t hash;
+            T*     child;
+        };
+
+        T*                head;
+        T*                stop;
+        size_t            count;
+        size_t            mask;
+        std::vector<Slot> slots;
+        ChildIndex*       older;    ///< next older segment: starts at \a stop
+        ChildIndex*       replaced; ///< previously published segment chain
+
+        template<typename Match>
+        T* find(size_t hash, Match match) const {
+            for (size_t i = hash & mask; slots[i].child; i = (i+1) & mask)
+                if (slots[i].hash == hash && match(slots[i].child))
+                    return slots[i].child;
+
+            return 0;
+        }
     };
 
 private:
@@ -69,6 +120,60 @@ private:
     LockfreeIntrusiveTree<T>        tree(T* t) const { return LockfreeIntrusiveTree<T>(t, m_node); }
     LockfreeIntrusiveTree<T>::Node& node(T* t) const { return node(t, m_node); }
 
+    /// \brief Index the children in front of segment \a top, merging
+    ///   older segments that aren't larger than the new one
+    template<typename ChildHash>
+    void build_index(ChildIndex* top, ChildHash child_hash) {
+        LockfreeIntrusiveTree<T>::Node& n = node(m_me);
+
+        T*          head  = n.head.load(std::memory_order_acquire);
+        T*          stop  = top ? top->head : 0;
+        ChildIndex* older = top;
+        size_t      count = 0;
+
+        for (T* c = head; c != stop; c = node(c).next)
+            ++count;
+
+        while (older && older->count <= count) {
+            count += older->count;
+            older  = older->older;
+        }
+
+        // load factor <= 0.5
+        size_t size = 16;
+
+        while (size < 2 * count)
+            size *= 2;
+
+        ChildIndex* idx = new ChildIndex;
+
+        idx->head     = head;
+        idx->stop     = older ? older->head : 0;
+        idx->count    = count;
+        idx->mask     = size - 1;
+        idx->older    = older;
+        idx->replaced = top;
+        idx->slots.assign(size, typename ChildIndex::Slot { 0, 0 });
+
+        for (T* c = head; c != idx->stop; c = node(c).next) {
+            size_t h = child_hash(c);
+            size_t i = h & idx->mask;
+
+            while (idx->slots[i].child)
+                i = (i+1) & idx->mask;
+
+            idx->slots[i].hash  = h;
+            idx->slots[i].child = c;
+        }
+
+        // Another thread may have published a new index in the meantime:
+        // then just drop ours
+        if (!n.index.compare_exchange_strong(top, idx,
+                                             std::memory_order_acq_rel,
+                                             std::memory_order_relaxed))
+            delete idx;
+    }
+
 public:
 
     LockfreeIntrusiveTree(T* me, LockfreeIntrusiveTree<T>::Node T::*nodeptr) 
@@ -101,6 +206,43 @@ public:
                                                std::memory_order_relaxed));
     }
 
+    /// \brief Find a child for which \a match returns \c true.
+    ///
+    /// \a hash is the hash of the key being looked up, and \a child_hash
+    /// is a function returning the hash of a child node's key. Adds an
+    /// index segment if the lookup walked more than \a threshold
+    /// un-indexed children. Building a segment allocates memory: pass a
+    /// threshold of 0 where that isn't allowed, e.g. in signal handlers,
+    /// to use the existing index only. If
+    /// there are several matching children, returns the first one in the
+    /// child list, i.e. the one appended last: segments are probed newest
+    /// first, children are inserted into a segment in list order, and
+    /// linear probing finds entries with equal hashes in insertion order.
+    template<typename Match, typename ChildHash>
+    T* find_child(size_t hash, Match match, ChildHash child_hash, unsigned threshold = 16) {
+        LockfreeIntrusiveTree<T>::Node& n = node(m_me);
+
+        ChildIndex* idx  = n.index.load(std::memory_order_acquire);
+        T*          stop = idx ? idx->head : 0;
+        T*          ret  = 0;
+        size_t      num  = 0;
+
+        for (T* c = n.head.load(std::memory_order_acquire); c != stop; c = node(c).next, ++num)
+            if (match(c)) {
+                ret = c;
+                break;
+            }
+
+        if (threshold > 0 && num > threshold)
+            build_index(idx, child_hash);
+
+        // probe segments from newest to oldest
+        for ( ; !ret && idx; idx = idx->older)
+            ret = idx->find(hash, match);
+
+        return ret;
+    }
+
     // 
     // --- Iterators ---------------------------------------------------------
     //
@@ -0,0 +1,66 @@
+/// \file  memory_counter.hpp
+/// \brief memory_counter class
+
+#ifndef UTIL_MEMORY_COUNTER_HPP
+#define UTIL_MEMORY_COUNTER_HPP
+
+#include <atomic>
+#include <cstddef>
+
+namespace util
+{
+
+/// \brief Byte counters for the memory held by one component, either
+///   process-wide or for one thread.
+///
+/// Components update \a reserved (bytes allocated) and \a used (bytes
+/// holding live data) when they allocate or free memory; the memory
+/// usage report sums them up by name and thread. Counters add themselves
+/// to a process-wide list and are never freed, so they can be read at
+/// any time. Counters for per-thread data structures come from
+/// acquire(), which re-uses counters returned with release().
+struct memory_counter {
+    static const int ProcessWide = -1;
+
+    const char*         name;
+    std::atomic<int>    thread;   ///< thread_id() of the owning thread, or ProcessWide
+    std::atomic<size_t> reserved;
+    std::atomic<size_t> used;
+    std::atomic<bool>   active;   ///< false if released and available for re-use
+    memory_counter*     next;
+
+    explicit memory_counter(const char* n, int thr = ProcessWide);
+
+    void add(size_t r, size_t u) {
+        reserved.fetch_add(r, std::memory_order_relaxed);
+        used.fetch_add(u, std::memory_order_relaxed);
+    }
+
+    void sub(size_t r, size_t u) {
+        reserved.fetch_sub(r, std::memory_order_relaxed);
+        used.fetch_sub(u, std::memory_order_relaxed);
+    }
+
+    /// \brief Set both values. Only for counters with a single writer.
+    void set(size_t r, size_t u) {
+        reserved.store(r, std::memory_order_relaxed);
+        used.store(u, std::memory_order_relaxed);
+    }
+
+    /// \brief Zero the counter and make it available for acquire()
+    void release();
+
+    /// \brief Get an unused counter for \a name, or create a new one
+    static memory_counter* acquire(const char* name, int thr);
+
+    /// \brief Head of the list of all counters
+    static memory_counter* list();
+
+    /// \brief A small, process-unique number for the calling thread,
+    ///   assigned on the first call. Numbers start at 0.
+    static int thread_id();
+};
+
+} // namespace util
+
+#endif
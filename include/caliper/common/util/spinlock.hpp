@@ -5,27 +5,98 @@
 #define UTIL_SPINLOCK_HPP
 
 #include <atomic>
+#include <cstdint>
+#include <thread>
 
 namespace util
 {
-    
+
+/// \brief Contention counters for a group of spinlocks, e.g. all locks
+///   of a class.
+///
+/// Counters are only updated when a lock() call has to wait, so the
+/// uncontended path costs nothing. Stats objects must have static
+/// storage duration: they add themselves to a process-wide list.
+struct spinlock_stats {
+    const char*           name;
+    std::atomic<uint64_t> contended; ///< lock() calls that had to wait
+    std::atomic<uint64_t> spins;     ///< pause iterations while waiting
+    std::atomic<uint64_t> yields;    ///< sched_yield calls while waiting
+    spinlock_stats*       next;
+
+    explicit spinlock_stats(const char* n);
+
+    /// \brief Head of the list of all stats objects
+    static spinlock_stats* list();
+};
+
+/// \brief Test-and-test-and-set spinlock with exponential backoff.
+///
+/// Waiting threads spin on a plain load with a CPU pause instruction,
+/// doubling the number of pauses each round. After MaxBackoff pauses in
+/// a row they yield the CPU instead, so waiters don't burn whole time
+/// slices on oversubscribed nodes.
 class spinlock {
-    std::atomic_flag m_lock;
+    std::atomic<bool> m_lock;
+    spinlock_stats*   m_stats;
 
-public:
+    static const unsigned MaxBackoff = 256;
+
+    static void cpu_relax() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        __asm__ __volatile__ ("pause" ::: "memory");
+#elif defined(__GNUC__) && defined(__aarch64__)
+        __asm__ __volatile__ ("yield" ::: "memory");
+#elif defined(__GNUC__) && defined(__powerpc__)
+        __asm__ __volatile__ ("or 27,27,27" ::: "memory");
+#endif
+    }
 
-    spinlock()
-        {
-            m_lock.clear();
+    void lock_contended() {
+        unsigned backoff = 1;
+        uint64_t spins   = 0;
+        uint64_t yields  = 0;
+
+        do {
+            while (m_lock.load(std::memory_order_relaxed)) {
+                if (backoff <= MaxBackoff) {
+                    for (unsigned i = 0; i < backoff; ++i)
+                        cpu_relax();
+
+                    spins   += backoff;
+                    backoff *= 2;
+                } else {
+                    std::this_thread::yield();
+                    ++yields;
+                }
+            }
+        } while (m_lock.exchange(true, std::memory_order_acquire));
+
+        if (m_stats) {
+            m_stats->contended.fetch_add(1,      std::memory_order_relaxed);
+            m_stats->spins.fetch_add(spins,      std::memory_order_relaxed);
+            m_stats->yields.fetch_add(yields,    std::memory_order_relaxed);
         }
+    }
+
+public:
+
+    explicit spinlock(spinlock_stats* stats = nullptr)
+        : m_lock(false), m_stats(stats)
+        { }
 
     void lock() {
-        while (m_lock.test_and_set(std::memory_order_acquire))
-            ;
+        if (m_lock.exchange(true, std::memory_order_acquire))
+            lock_contended();
+    }
+
+    bool try_lock() {
+        return !m_lock.load(std::memory_order_relaxed) &&
+            !m_lock.exchange(true, std::memory_order_acquire);
     }
 
     void unlock() {
-        m_lock.clear(std::memory_order_release);
+        m_lock.store(false, std::memory_order_release);
     }
 };
 
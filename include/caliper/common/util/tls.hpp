@@ -0,0 +1,18 @@
+/// \file  tls.hpp
+/// \brief Thread-local storage helpers
+
+#ifndef UTIL_TLS_HPP
+#define UTIL_TLS_HPP
+
+/// \brief Use the initial-exec TLS model for a thread_local variable.
+///
+/// Avoids the __tls_get_addr call on each access from within the Caliper
+/// shared library. Only use it for a few small variables: the static TLS
+/// block for dlopen'ed libraries is limited.
+#if defined(__GNUC__)
+#define CALI_TLS_INITIAL_EXEC __attribute__((tls_model("initial-exec")))
+#else
+#define CALI_TLS_INITIAL_EXEC
+#endif
+
+#endif
@@ -46,6 +46,7 @@ namespace cali
 {
 
 class CaliperMetadataAccessInterface;
+struct CompressedSnapshotBatch;
 
 /// \brief Post-processing aggregator
 /// \ingroup ReaderAPI
@@ -63,8 +64,20 @@ public:
 
     ~Aggregator();
 
+    /// \brief Limit the memory of the aggregation tables to about \a bytes.
+    ///
+    /// Above the limit, records with keys that are not in the tables yet
+    /// are hash-partitioned into temporary files in \a spill_dir
+    /// (default: $TMPDIR or /tmp). flush() aggregates the partitions one
+    /// at a time. 0 disables the limit. Call before adding records.
+    void set_memory_limit(size_t bytes, const std::string& spill_dir = "");
+
     void add(CaliperMetadataAccessInterface&, const EntryList&);
 
+    /// \brief Aggregate all records in a decoded snapshot batch.
+    ///   Avoids per-record temporary allocations.
+    void add(CaliperMetadataAccessInterface&, const CompressedSnapshotBatch&);
+
     void operator()(CaliperMetadataAccessInterface& db, const EntryList& list) {
         add(db, list);
     }
@@ -36,13 +36,13 @@
 #ifndef CALI_CALIPERMETADATADB_H
 #define CALI_CALIPERMETADATADB_H
 
+#include "IdMap.h"
 #include "RecordProcessor.h"
 
 #include "../common/Attribute.h"
 #include "../common/CaliperMetadataAccessInterface.h"
 #include "../common/RecordMap.h"
 
-#include <map>
 #include <memory>
 #include <string>
 
@@ -51,8 +51,7 @@ namespace cali
 
 class Node;
 class Variant;
-    
-typedef std::map<cali_id_t, cali_id_t> IdMap;
+struct QuerySpec;
 
 /// \brief Maintains a context tree and provides metadata information.
 /// \ingroup ReaderAPI
@@ -72,6 +71,60 @@ public:
     // --- I/O API 
     // 
 
+    /// \brief Read the .cali stream in \a filename (or stdin, if empty),
+    ///   merge it into this metadata DB, and pass on merged nodes and
+    ///   snapshots to \a node_fn and \a snap_fn. Reads both the CSV and
+    ///   the binary .cali format. With \a num_threads > 1, snapshot records
+    ///   in CSV files are processed in parallel.
+    /// \return false if the file could not be read, true otherwise
+    bool        read(const std::string& filename, NodeProcessFn node_fn, SnapshotProcessFn snap_fn,
+                     unsigned num_threads = 1);
+
+    /// \brief Read a .cali stream from the in-memory buffer [\a data,
+    ///   \a data + \a len), e.g. a file loaded by FilePrefetcher. Works
+    ///   like read(); \a name is only used in messages.
+    bool        read(const std::string& name, const char* data, std::size_t len,
+                     NodeProcessFn node_fn, SnapshotProcessFn snap_fn,
+                     unsigned num_threads = 1);
+
+    /// \brief Read the records appended to the CSV .cali file \a filename
+    ///   since the last call.
+    ///
+    /// Starts reading at byte \a offset and skips an incomplete last
+    /// record. Updates \a offset to the position after the last record
+    /// read. The caller keeps \a idmap (the mapping of the file's IDs into
+    /// this DB) and \a offset between calls, e.g. to follow a file that is
+    /// still being written. Binary .cali files are not supported.
+    /// \return false if the file could not be read, true otherwise
+    bool        read_from(const std::string& filename, std::size_t& offset, IdMap& idmap,
+                          NodeProcessFn node_fn, SnapshotProcessFn snap_fn);
+
+    /// \brief Read the records in the byte range [\a begin, \a end) of the
+    ///   CSV .cali file \a filename.
+    ///
+    /// \a begin must be a record boundary (see RecordIndex). As with
+    /// read_from(), the caller keeps \a idmap between calls. Node records
+    /// must be read before the records that refer to them.
+    /// \return false if the file could not be read, true otherwise
+    bool        read_range(const std::string& filename, std::size_t begin, std::size_t end, IdMap& idmap,
+                           NodeProcessFn node_fn, SnapshotProcessFn snap_fn);
+
+    /// \brief Push the filter and attribute references of \a spec down into
+    ///   subsequent read() calls.
+    ///
+    /// Snapshot records that do not pass the filter clauses in \a spec are
+    /// dropped before their values are copied into the DB. If \a spec
+    /// references an explicit set of attributes (through its attribute
+    /// selection or its aggregation key and operators), immediate entries
+    /// of all other attributes are skipped while decoding. Context tree
+    /// references are always kept.
+    ///
+    /// Also, context tree nodes from binary .cali streams are merged only
+    /// when the first record refers to them, so that nodes no record uses
+    /// are never materialized. Attribute nodes are merged right away.
+    /// \a node_fn in read() is then only invoked for merged nodes.
+    void        set_read_spec(const QuerySpec& spec);
+
     RecordMap   merge(const RecordMap& rec, IdMap& map);
     void        merge(const RecordMap& rec, IdMap& map, NodeProcessFn node_fn, SnapshotProcessFn snap_fn);
 
@@ -0,0 +1,80 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+/// \file DerivedMetrics.h
+/// \brief Defines DerivedMetrics
+
+#ifndef CALI_DERIVEDMETRICS_H
+#define CALI_DERIVEDMETRICS_H
+
+#include "QuerySpec.h"
+#include "RecordProcessor.h"
+
+#include <memory>
+#include <vector>
+
+namespace cali
+{
+
+class CaliperMetadataAccessInterface;
+
+/// \brief Computes derived metrics (CalQL LET clauses) for snapshot records
+/// \ingroup ReaderAPI
+///
+/// Expressions are evaluated column-wise over a batch of records:
+/// each operand attribute is read into a column of doubles once, and
+/// the arithmetic runs as simple loops over the columns. Records where
+/// an operand is missing or the result is not finite (e.g., after a
+/// division by zero) don't get the derived metric.
+
+class DerivedMetrics
+{
+    struct DerivedMetricsImpl;
+    std::shared_ptr<DerivedMetricsImpl> mP;
+
+public:
+
+    DerivedMetrics(const QuerySpec& spec);
+
+    ~DerivedMetrics();
+
+    /// \brief Return true if the spec has no derived metrics
+    bool empty() const;
+
+    /// \brief Append the derived metrics to the records in \a records
+    void process(CaliperMetadataAccessInterface& db, std::vector<EntryList>& records);
+};
+
+} // namespace cali
+
+#endif
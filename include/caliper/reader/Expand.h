@@ -68,6 +68,8 @@ public:
     void operator()(CaliperMetadataAccessInterface&, const EntryList&) const;
 
     void process_record(CaliperMetadataAccessInterface&, const EntryList&);
+
+    void process_records(CaliperMetadataAccessInterface&, const std::vector<EntryList>&);
 };
 
 } // namespace cali
@@ -0,0 +1,90 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file FilePrefetcher.h
+/// \brief FilePrefetcher class declaration
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cali
+{
+
+/// \brief Reads upcoming input files into memory in background threads.
+///
+/// Reading many small files (e.g., one per MPI rank) one after another is
+/// dominated by the latency of opening and reading each file, particularly
+/// on parallel file systems. The prefetcher loads the files in list order
+/// with a pool of I/O threads while earlier files are parsed, keeping at
+/// most \a window loaded files that have not been taken yet.
+///
+/// Files larger than \a max_file_size are not loaded. Instead, the
+/// prefetcher asks the kernel to read them ahead (posix_fadvise), and
+/// take() returns null, so the caller reads (maps) them directly as
+/// usual. The same applies to stdin (empty file names) and files that
+/// can't be read.
+/// \ingroup ReaderAPI
+
+class FilePrefetcher
+{
+    struct FilePrefetcherImpl;
+    std::shared_ptr<FilePrefetcherImpl> mP;
+
+public:
+
+    typedef std::shared_ptr< const std::vector<char> > Buffer;
+
+    FilePrefetcher(const std::vector<std::string>& files,
+                   unsigned    num_threads   = 4,
+                   std::size_t window        = 16,
+                   std::size_t max_file_size = 64 * 1024 * 1024);
+
+    /// \brief Stops the I/O threads and releases all buffers not taken yet
+    ~FilePrefetcher();
+
+    /// \brief Get the contents of file number \a index in the file list.
+    ///
+    /// Waits if the file is being loaded. Each file can be taken once.
+    /// Returns null if the file isn't prefetched; the caller should read
+    /// the file itself then. Files requested before the prefetcher
+    /// started loading them are not prefetched anymore. Thread-safe.
+    Buffer take(std::size_t index);
+
+    /// \brief Number of files loaded into memory so far
+    std::size_t num_prefetched() const;
+};
+
+} // namespace cali
@@ -40,6 +40,7 @@
 
 #include <iostream>
 #include <memory>
+#include <vector>
 
 namespace cali
 {
@@ -65,6 +66,12 @@ public:
     /// \brief Add snapshot record to formatter. 
     void process_record(CaliperMetadataAccessInterface&, const EntryList&);
 
+    /// \brief Add a batch of snapshot records to the formatter.
+    ///
+    /// Stream formatters may format the batch on multiple threads;
+    /// records are still written in order.
+    void process_records(CaliperMetadataAccessInterface&, const std::vector<EntryList>&);
+
     /// \brief Flush formatter contents.
     ///
     /// There are two types of formatters: \e Stream formatters
@@ -37,6 +37,10 @@
 
 #include "RecordProcessor.h"
 
+#include <functional>
+#include <string>
+#include <vector>
+
 namespace cali
 {
 
@@ -55,9 +59,33 @@ public:
     /// Process a snapshot record.
     virtual void process_record(CaliperMetadataAccessInterface&, const EntryList&) = 0;
 
+    /// \brief Process a batch of snapshot records.
+    ///
+    /// Output must be the same as from calling process_record() for
+    /// each record in order, which is what the default implementation
+    /// does. Stream formatters can override it to format contiguous
+    /// ranges of the batch in parallel (see format_rows()).
+    virtual void process_records(CaliperMetadataAccessInterface& db, const std::vector<EntryList>& records) {
+        for (const EntryList& rec : records)
+            process_record(db, rec);
+    }
+
     /// Flush processed contents to stream. Need not be implemented for stream formatters.
     virtual void flush(CaliperMetadataAccessInterface&, std::ostream& os)
     { }
+
+    /// \brief Format \a n rows on multiple threads and write them in order.
+    ///
+    /// Splits [0, \a n) into contiguous row ranges and calls
+    /// \a format(begin, end, buf) for each range on a separate thread,
+    /// which appends the formatted rows to the empty string \a buf.
+    /// \a write is called with each range's buffer in row order on the
+    /// calling thread, while later ranges are still being formatted.
+    /// \a format must be thread-safe. Small inputs are formatted
+    /// on the calling thread.
+    static void format_rows(std::size_t n,
+                            const std::function<void(std::size_t, std::size_t, std::string&)>& format,
+                            const std::function<void(const std::string&)>& write);
 };
 
 } // namespace cali
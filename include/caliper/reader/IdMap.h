@@ -0,0 +1,123 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file IdMap.h
+/// \brief IdMap class definition
+/// \ingroup ReaderAPI
+
+#ifndef CALI_IDMAP_H
+#define CALI_IDMAP_H
+
+#include "../common/cali_types.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+namespace cali
+{
+
+/// \brief Maps the node IDs of an input stream to the IDs of the nodes
+///   they were merged into.
+///
+/// Stream IDs are mostly small and dense (in particular, Caliper's
+/// writers number nodes sequentially), so IDs are kept in a vector
+/// indexed by the stream ID. The vector grows only as long as it stays
+/// reasonably full; IDs far beyond its end go into a hash map.
+class IdMap
+{
+    std::vector<cali_id_t>                   m_dense;
+    std::size_t                              m_num_dense;
+    std::unordered_map<cali_id_t, cali_id_t> m_sparse;
+
+    static const std::size_t min_dense_size = 4096;
+
+public:
+
+    IdMap()
+        : m_num_dense(0)
+    { }
+
+    /// \brief Return the ID that \a id maps to, or CALI_INV_ID if there is none.
+    cali_id_t find(cali_id_t id) const {
+        if (id < m_dense.size())
+            return m_dense[id];
+
+        if (m_sparse.empty())
+            return CALI_INV_ID;
+
+        auto it = m_sparse.find(id);
+        return it == m_sparse.end() ? CALI_INV_ID : it->second;
+    }
+
+    /// \brief Map \a from to \a to, unless \a from is already mapped.
+    /// \return true if the mapping was added
+    bool insert(cali_id_t from, cali_id_t to) {
+        std::size_t limit = 4 * m_num_dense;
+
+        if (limit < min_dense_size)
+            limit = min_dense_size;
+
+        if (from >= m_dense.size() && from < limit)
+            m_dense.resize(std::max<std::size_t>(from + 1, 2 * m_dense.size()), CALI_INV_ID);
+
+        if (from < m_dense.size()) {
+            if (m_dense[from] != CALI_INV_ID)
+                return false;
+
+            m_dense[from] = to;
+            ++m_num_dense;
+
+            return true;
+        }
+
+        return m_sparse.emplace(from, to).second;
+    }
+
+    std::size_t size() const {
+        return m_num_dense + m_sparse.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    void clear() {
+        m_dense.clear();
+        m_sparse.clear();
+        m_num_dense = 0;
+    }
+};
+
+} // namespace cali
+
+#endif
@@ -64,6 +64,8 @@ public:
 
     void process_record(CaliperMetadataAccessInterface&, const EntryList&);
 
+    void process_records(CaliperMetadataAccessInterface&, const std::vector<EntryList>&);
+
     void flush(CaliperMetadataAccessInterface&, std::ostream& os);
 };
 
@@ -56,7 +56,15 @@ class QueryProcessor
     
 public:
 
-    QueryProcessor(const QuerySpec&, OutputStream& stream);
+    /// \brief Create a query processor for \a spec writing to \a stream.
+    ///
+    /// With \a num_threads > 1, records are processed in a pipeline:
+    /// process_record() collects records into batches, \a num_threads
+    /// workers filter and aggregate the batches, and a single thread
+    /// formats the filtered batches in their original order. The
+    /// records' context tree nodes must then remain valid until
+    /// flush() returns.
+    QueryProcessor(const QuerySpec&, OutputStream& stream, unsigned num_threads = 1);
 
     ~QueryProcessor();
 
@@ -35,6 +35,7 @@
 
 #pragma once
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -120,6 +121,29 @@ struct QuerySpec
         std::string value;
     };
 
+    /// \brief Operation in a derived metric expression.
+    ///
+    /// A Derivation's ops are stored in postfix order.
+    struct ExpressionOp {
+        enum Op {
+            Operand,   ///< Push the value of attribute \a attr_name
+            Constant,  ///< Push \a value
+            Add, Sub, Mul, Div, Neg
+        }           op;
+        std::string attr_name;
+        double      value;
+
+        ExpressionOp(Op o, const std::string& a = "", double v = 0.0)
+            : op(o), attr_name(a), value(v)
+        { }
+    };
+
+    /// \brief A derived metric (LET clause): \a name = \a ops
+    struct Derivation {
+        std::string               name;
+        std::vector<ExpressionOp> ops;
+    };
+
     /// \brief Output formatter specification.
     struct FormatSpec {
         enum Opt {
@@ -137,11 +161,16 @@ struct QuerySpec
     typedef SelectionList<std::string>   AttributeSelection;
     typedef SelectionList<Condition>     FilterSelection;
     typedef SelectionList<SortSpec>      SortSelection;
+    typedef SelectionList<Derivation>    DerivationSelection;
 
     /// \brief List of aggregations to be performed.
     AggregationSelection         aggregation_ops;
     /// \brief List of attribute names that form the aggregation key (i.e., GROUP BY spec).
     AttributeSelection           aggregation_key;
+    /// \brief Path depth limits for aggregation key attributes (from
+    ///   GROUP BY prefix(attr,n)): only the outermost n nodes of the
+    ///   attribute's path are part of the key.
+    std::map<std::string, int>   aggregation_key_depth;
 
     /// \brief List of attributes to print in output
     AttributeSelection           attribute_selection;
@@ -149,6 +178,9 @@ struct QuerySpec
     /// \brief List of filter clauses (filters will be combined with AND)
     FilterSelection              filter;
 
+    /// \brief List of derived metrics, computed in order before formatting
+    DerivationSelection          derived;
+
     /// \brief List of sort specifications
     SortSelection                sort;
 
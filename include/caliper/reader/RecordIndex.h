@@ -0,0 +1,108 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file RecordIndex.h
+/// \brief RecordIndex class declaration
+
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cali
+{
+
+struct QuerySpec;
+
+/// \brief A block-level index of a CSV .cali file.
+///
+/// Splits a .cali file into blocks of records and summarizes for each
+/// block which attributes occur in its snapshot records, the range of
+/// their numeric values, and (in a Bloom filter) their string values.
+/// With the index, readers can skip blocks that can't contain records
+/// matching a query's WHERE clauses. Blocks with node or globals records
+/// are always selected, as later blocks may refer to their metadata.
+///
+/// Indexes are stored in a "sidecar" text file, by convention next to
+/// the .cali file (see index_filename()).
+/// \ingroup ReaderAPI
+
+class RecordIndex
+{
+    struct RecordIndexImpl;
+    std::shared_ptr<RecordIndexImpl> mP;
+
+public:
+
+    struct Block {
+        std::size_t begin;        ///< Offset of the first record in the block
+        std::size_t end;          ///< Offset past the last record in the block
+        bool        has_metadata; ///< Block contains node or globals records
+    };
+
+    RecordIndex();
+
+    ~RecordIndex();
+
+    /// \brief Build the index for the CSV .cali file \a filename, using
+    ///   blocks of about \a block_size bytes.
+    /// \return false if the file could not be read
+    bool build(const std::string& filename, std::size_t block_size = 256 * 1024);
+
+    /// \brief Write the index to \a os
+    std::ostream& write(std::ostream& os) const;
+
+    /// \brief Read an index written with write() from \a is
+    /// \return false if \a is does not contain a valid index
+    bool read(std::istream& is);
+
+    /// \brief Size of the indexed .cali file in bytes. Use this to check
+    ///   if the index is still valid for the file.
+    std::size_t file_size() const;
+
+    /// \brief All blocks in the index
+    std::vector<Block> blocks() const;
+
+    /// \brief The blocks that may contain records matching the filter
+    ///   clauses in \a spec.
+    ///
+    /// This is a conservative selection: the selected blocks may contain
+    /// non-matching records, but skipped blocks contain no matching ones.
+    std::vector<Block> select_blocks(const QuerySpec& spec) const;
+
+    /// \brief The conventional index file name for \a filename
+    static std::string index_filename(const std::string& filename);
+};
+
+} // namespace cali
@@ -0,0 +1,170 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file SnapshotTable.h
+/// \brief Columnar in-memory snapshot store
+
+#ifndef CALI_SNAPSHOTTABLE_H
+#define CALI_SNAPSHOTTABLE_H
+
+#include "QuerySpec.h"
+#include "RecordProcessor.h"
+
+#include "../common/Attribute.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cali
+{
+
+class CaliperMetadataAccessInterface;
+
+/// \brief Columnar in-memory store for snapshot records
+/// \ingroup ReaderAPI
+///
+/// Stores one column per attribute. Numeric attributes are stored in
+/// typed arrays, everything else is dictionary-encoded as strings.
+/// Nested string values (e.g., region paths) are stored as
+/// "/"-separated paths. Filtering, sorting, and aggregation run as
+/// loops over the typed column arrays instead of per-record
+/// EntryList processing.
+///
+/// The table can be used as a SnapshotProcessFn sink to collect
+/// records, and push() feeds (selected) rows back into a regular
+/// record processing chain, e.g. a formatter.
+
+class SnapshotTable
+{
+public:
+
+    enum class Storage { Int, UInt, Double, String };
+
+    struct Column {
+        std::string           name;
+        cali_id_t             attr_id;
+        cali_attr_type        type;
+        Storage               storage;
+        bool                  is_path = false; ///< Strings are "/"-separated context tree paths
+
+        std::vector<unsigned char>  valid;   ///< 1 if row has a value
+        std::vector<int64_t>        ints;    ///< Storage::Int values
+        std::vector<uint64_t>       uints;   ///< Storage::UInt values
+        std::vector<double>         doubles; ///< Storage::Double values
+        std::vector<uint32_t>       codes;   ///< Storage::String dictionary codes
+
+        /// \brief String dictionary. A deque so that Variants created
+        ///   from dictionary entries stay valid while the table grows.
+        std::deque<std::string>     dict;
+        std::unordered_map<std::string, uint32_t> dict_index;
+
+        /// \brief Get value at \a row as Variant.
+        ///   String variants point into the dictionary.
+        Variant  value(std::size_t row) const;
+
+        /// \brief Get dictionary code for \a str, create if needed
+        uint32_t encode(const std::string& str);
+    };
+
+private:
+
+    struct SnapshotTableImpl;
+    std::shared_ptr<SnapshotTableImpl> mP;
+
+public:
+
+    SnapshotTable();
+
+    ~SnapshotTable();
+
+    /// \brief Append a record. Thread-safe.
+    void add(CaliperMetadataAccessInterface&, const EntryList&);
+
+    void operator()(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        add(db, list);
+    }
+
+    std::size_t num_rows() const;
+    std::size_t num_columns() const;
+
+    const Column& column(std::size_t c) const;
+
+    /// \brief Find column by attribute name. Returns nullptr if not found.
+    const Column* column(const std::string& name) const;
+
+    /// \brief Return the indices of all rows
+    std::vector<std::size_t> all_rows() const;
+
+    /// \brief Return the rows among \a rows that pass all \a conditions
+    ///   (combined with AND). Semantics match RecordSelector: Equal and
+    ///   NotEqual match any element of a nested path.
+    std::vector<std::size_t>
+    select(const std::vector<QuerySpec::Condition>& conditions, const std::vector<std::size_t>& rows) const;
+
+    std::vector<std::size_t>
+    select(const std::vector<QuerySpec::Condition>& conditions) const {
+        return select(conditions, all_rows());
+    }
+
+    /// \brief Stable-sort \a rows by the given sort specs. The first spec
+    ///   is the primary sort key. Rows without a value sort first.
+    void sort(const std::vector<QuerySpec::SortSpec>& spec, std::vector<std::size_t>& rows) const;
+
+    /// \brief Group \a rows by the \a key columns, and compute count
+    ///   and sum of the \a sum columns per group.
+    ///
+    /// The result table has the key columns, a "count" column, and the
+    /// \a sum columns with the per-group sums, like the Aggregator's
+    /// count and sum kernels. Groups without any value of a \a sum
+    /// attribute have no sum. The count attribute is created in \a db.
+    SnapshotTable
+    aggregate(CaliperMetadataAccessInterface& db,
+              const std::vector<std::string>& key,
+              const std::vector<std::string>& sum,
+              const std::vector<std::size_t>& rows) const;
+
+    /// \brief Push \a rows as (immediate-only) records into \a push
+    void push(CaliperMetadataAccessInterface& db, const std::vector<std::size_t>& rows, SnapshotProcessFn push) const;
+
+    /// \brief Push all rows as records into \a push
+    void push(CaliperMetadataAccessInterface& db, SnapshotProcessFn push) const {
+        this->push(db, all_rows(), push);
+    }
+};
+
+} // namespace cali
+
+#endif
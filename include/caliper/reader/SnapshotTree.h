@@ -43,8 +43,9 @@
 #include "caliper/common/util/lockfree-tree.hpp"
 
 #include <functional>
-#include <map>
 #include <memory>
+#include <utility>
+#include <vector>
 
 namespace cali
 {
@@ -87,17 +88,25 @@ class CaliperMetadataAccessInterface;
     
 class SnapshotTreeNode : public util::LockfreeIntrusiveTree<SnapshotTreeNode>
 {
+public:
+
+    /// \brief Flat list of (attribute, value) pairs. Each attribute is
+    ///   contained at most once.
+    typedef std::vector< std::pair<cali::Attribute, cali::Variant> > AttributeList;
+
+private:
+
     util::LockfreeIntrusiveTree<SnapshotTreeNode>::Node m_treenode;
 
-    Attribute m_label_key;
-    Variant   m_label_value;
+    Attribute     m_label_key;
+    Variant       m_label_value;
 
-    bool      m_empty;
+    bool          m_empty;
 
-    std::map<cali::Attribute, cali::Variant> m_attributes;
+    AttributeList m_attributes;
 
-    void assign_attributes(std::map<cali::Attribute, cali::Variant>&& a) {
-        m_attributes = a;
+    void assign_attributes(AttributeList&& a) {
+        m_attributes = std::move(a);
         m_empty = false;
     }
 
@@ -126,10 +135,20 @@ public:
 
     /// \brief Access the non-path attributes of the snapshot associated
     ///   with this node.
-    const std::map<cali::Attribute, cali::Variant>& attributes() const {
+    const AttributeList& attributes() const {
         return m_attributes;
     }
 
+    /// \brief Return the value of non-path attribute \a attr, or an empty
+    ///   Variant if the node has no such attribute.
+    Variant get(const Attribute& attr) const {
+        for (const auto &p : m_attributes)
+            if (p.first == attr)
+                return p.second;
+
+        return Variant();
+    }
+
     friend class SnapshotTree;
 }; // SnapshotTreeNode
 
@@ -185,6 +204,12 @@ public:
     /// with the identified path (this node then becomes `occupied`),
     /// or a new node if no empty node with the given path exists.
     ///
+    /// The tree memoizes the path it found for each context tree node
+    /// in \a list, so that records with a common path are added quickly.
+    /// Therefore, \a is_path must return the same result for a given
+    /// (attribute,value) pair every time, and all records must come
+    /// from the same metadata manager \a db.
+    ///
     /// \param db      A Caliper metadata manager.
     /// \param list    The snapshot record.
     /// \param is_path Predicate to determine if an
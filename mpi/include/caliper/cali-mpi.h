@@ -43,11 +43,45 @@
 
 #ifdef __cplusplus
 
+#include <cstddef>
+#include <cstdint>
+
 namespace cali
 {
 
 class Aggregator;
 class CaliperMetadataDB;
+struct QuerySpec;
+
+/**
+ * \brief Per-rank statistics of the cross-process aggregation functions
+ *
+ * Filled in by aggregate_over_mpi() and aggregate_partitioned_over_mpi()
+ * if requested. The values refer to the calling rank only.
+ *
+ * \ingroup ReaderAPI
+ */
+struct MpiAggregationStats {
+    enum Stage {
+        Dictionary = 0, ///< Broadcast and merge of the global node dictionary
+        NodeLocal,      ///< Reduction among the ranks on the same node
+        Global,         ///< Reduction (or exchange) across \a comm or the node leaders
+        NumStages
+    };
+
+    struct StageInfo {
+        double   time;           ///< Wall-clock time in seconds
+        uint64_t bytes_sent;
+        uint64_t bytes_received;
+        uint64_t messages_sent;
+        uint64_t messages_received;
+        long     max_rss_kb;     ///< Peak resident set size at the end of the stage
+    };
+
+    StageInfo stage[NumStages];
+
+    static const char* stage_name(int stage);
+};
 
 /**
  * \brief Perform cross-process aggregation over MPI
@@ -62,18 +96,108 @@ class CaliperMetadataDB;
  * This function is effectively a blocking collective operation over 
  * \a comm with the usual MPI collective semantics.
  *
+ * The reduction streams results up a tree in chunks with nonblocking
+ * sends. If \a node_local_stage is set, ranks that share a node are
+ * reduced first, and then the node leaders are reduced across nodes.
+ *
  * \param db   Metadata information for \a a. The metadata database 
  *    may be modified during the operation.
  * \param a    Provides the aggregation configuration and local input
  *    records, and receives the result on rank 0. Other ranks may 
  *    receive partial results.
  * \param comm MPI communicator.
+ * \param radix Fan-in of the reduction tree (minimum 2).
+ * \param node_local_stage Reduce node-locally before the inter-node
+ *    stage (requires MPI-3).
+ * \param stats If not null, receives statistics of this rank's part
+ *    of the operation.
  *
  * \ingroup ReaderAPI
  */
     
 void 
-aggregate_over_mpi(CaliperMetadataDB& db, Aggregator& a, MPI_Comm comm);
+aggregate_over_mpi(CaliperMetadataDB& db, Aggregator& a, MPI_Comm comm,
+                   int radix = 2, bool node_local_stage = true,
+                   MpiAggregationStats* stats = nullptr);
+
+/**
+ * \brief Partition aggregation results by key across MPI
+ *
+ * Redistributes the local aggregation results in \a in so that each
+ * rank of \a comm receives, in \a out, the complete results for its
+ * share of the aggregation keys. Records are assigned to ranks by a
+ * content hash of their key entries, so the partitioning does not
+ * depend on which ranks hold which records. Unlike aggregate_over_mpi(),
+ * no single rank receives all results.
+ *
+ * This function is a blocking collective operation over \a comm. The
+ * data each rank sends must be smaller than 2 GiB.
+ *
+ * \param db   Metadata information for \a in and \a out. The metadata
+ *    database may be modified during the operation.
+ * \param spec The aggregation configuration of \a in and \a out. With
+ *    the merge() operation, specify an explicit aggregation key.
+ * \param in   Local input records
+ * \param out  Receives this rank's share of the results
+ * \param comm MPI communicator.
+ * \param stats If not null, receives statistics of this rank's part
+ *    of the operation. The exchange is reported in the Global stage.
+ *
+ * \ingroup ReaderAPI
+ */
+
+void
+aggregate_partitioned_over_mpi(CaliperMetadataDB& db, const QuerySpec& spec,
+                               Aggregator& in, Aggregator& out, MPI_Comm comm,
+                               MpiAggregationStats* stats = nullptr);
+
+/**
+ * \brief Sort aggregation results by the ORDER BY criteria across MPI
+ *
+ * Expects that each rank of \a comm holds the complete results for
+ * its aggregation keys in \a in, as produced by
+ * aggregate_partitioned_over_mpi().
+ *
+ * Without \a limit, the records are range-partitioned by their
+ * ORDER BY key (sample sort): rank 0 picks range boundaries from
+ * samples of every rank's keys, and each rank then receives in \a out
+ * the records in its range. Ranges ascend with the rank, so writing
+ * each rank's records in sorted order and concatenating them by rank
+ * gives the globally sorted result. Records with the same key go to
+ * the same rank. Without ORDER BY criteria, the local records are
+ * moved to \a out.
+ *
+ * With \a limit > 0, only rank 0 receives records in \a out: the
+ * first \a limit records in output order (top-k). Each rank keeps its
+ * local top \a limit records, and the candidates are reduced up a
+ * binary tree where each step keeps only the top \a limit again, so
+ * no rank receives more than 2 * \a limit records.
+ *
+ * Records are compared like in the table formatter: numbers by value,
+ * nested attributes by their path string. Records without a sort
+ * attribute go first. Derived (LET) metrics are not available as sort
+ * criteria here.
+ *
+ * This function is a blocking collective operation over \a comm.
+ *
+ * \param db   Metadata information for \a in and \a out. The metadata
+ *    database may be modified during the operation.
+ * \param spec The aggregation configuration and ORDER BY criteria
+ * \param in   This rank's complete results. May be modified.
+ * \param out  Receives this rank's share of the sorted results
+ * \param comm MPI communicator.
+ * \param limit Number of records to select for top-k queries, or 0
+ * \param stats If not null, receives statistics of this rank's part
+ *    of the operation. Sampling and exchange are reported in the
+ *    Global stage.
+ *
+ * \ingroup ReaderAPI
+ */
+
+void
+sort_over_mpi(CaliperMetadataDB& db, const QuerySpec& spec,
+              Aggregator& in, Aggregator& out, MPI_Comm comm,
+              size_t limit = 0, MpiAggregationStats* stats = nullptr);
 
 } /* namespace cali */
 
@@ -0,0 +1,535 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// -- cali-mpi-aggr-bench
+//
+// Scaling benchmark for Caliper's cross-process aggregation.
+//
+// Each rank generates a synthetic aggregated profile (the kind of data
+// the mpireport service and mpi-caliquery reduce) and the profiles are
+// reduced over sub-communicators of MPI_COMM_WORLD with increasing
+// numbers of ranks. The methods are
+//
+//   flat          aggregate_over_mpi() without the node-local stage
+//   node-local    aggregate_over_mpi() with the node-local stage, as
+//                 used by mpireport by default
+//   partitioned   aggregate_partitioned_over_mpi()
+//   files         mpi-caliquery's workflow: every rank reads a per-rank
+//                 .cali file (written beforehand) into an aggregator,
+//                 which is then reduced like "node-local"
+//
+// The profile of each rank has the given number of records with a
+// "region" path of the given depth and a number of by-value metrics.
+// A fraction of the records (--overlap) has keys that are the same on
+// all ranks; the other keys are unique to their rank. The overlap thus
+// determines how much the reduction shrinks the data.
+//
+// For each method, rank count, and reduction stage (dictionary,
+// node-local, global; and read for "files"), the program writes a JSON
+// record to stdout with the maximum time over all ranks (best of the
+// repetitions), the total bytes and messages sent by all ranks, the
+// maximum bytes received by one rank, and the maximum peak resident
+// set size of all ranks at the end of the stage. Note that the peak
+// resident set size is a high-water mark over the lifetime of the
+// process.
+
+#include <caliper/cali-mpi.h>
+
+#include <caliper/reader/Aggregator.h>
+#include <caliper/reader/CaliperMetadataDB.h>
+#include <caliper/reader/CalQLParser.h>
+
+#include <caliper/common/Node.h>
+#include <caliper/common/OutputStream.h>
+
+#include <caliper/common/csv/CsvWriter.h>
+
+#include <caliper/tools-util/Args.h>
+
+#include <mpi.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+using namespace cali;
+
+namespace
+{
+
+struct ProfileConfig
+{
+    long   records;
+    int    depth;
+    int    metrics;
+    double overlap;
+};
+
+struct StageResult
+{
+    double   time;
+    uint64_t bytes_sent;
+    uint64_t bytes_received_max;
+    uint64_t messages;
+    long     max_rss_kb;
+};
+
+const char* method_names[] = {
+    "flat", "node-local", "partitioned", "files", nullptr
+};
+
+const int   num_stages   = MpiAggregationStats::NumStages + 1;
+const int   read_stage   = MpiAggregationStats::NumStages;
+
+const char* stage_name(int stage)
+{
+    return stage == read_stage ? "read" : MpiAggregationStats::stage_name(stage);
+}
+
+long max_rss_kb()
+{
+    struct rusage usage;
+
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? static_cast<long>(usage.ru_maxrss) : 0;
+}
+
+/// \brief Generate this rank's synthetic profile records in \a db
+std::vector<EntryList>
+make_profile(CaliperMetadataDB& db, int rank, const ProfileConfig& cfg)
+{
+    IdMap idmap;
+
+    Attribute region_attr =
+        db.create_attribute("region", CALI_TYPE_STRING, CALI_ATTR_NESTED);
+
+    std::vector<Attribute> metric_attrs;
+
+    for (int m = 0; m < cfg.metrics; ++m)
+        metric_attrs.push_back(db.create_attribute(std::string("bench.metric.") + std::to_string(m),
+                                                   CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE));
+
+    long num_shared = static_cast<long>(cfg.overlap * cfg.records + 0.5);
+
+    std::vector<EntryList> records;
+    records.reserve(cfg.records);
+
+    for (long i = 0; i < cfg.records; ++i) {
+        // inner levels are shared between many records, the leaf
+        // makes the key unique
+
+        const Node* node = nullptr;
+
+        for (int l = 1; l <= cfg.depth; ++l) {
+            std::string name;
+
+            if (l < cfg.depth)
+                name = "level" + std::to_string(l) + "." + std::to_string(i % (4L << l));
+            else if (i < num_shared)
+                name = "shared." + std::to_string(i);
+            else
+                name = "rank" + std::to_string(rank) + "." + std::to_string(i);
+
+            node = db.merge_node(CALI_INV_ID - 1, region_attr.id(), node ? node->id() : CALI_INV_ID,
+                                 Variant(CALI_TYPE_STRING, name.c_str(), name.size()), idmap);
+        }
+
+        EntryList rec;
+
+        if (node)
+            rec.push_back(Entry(node));
+
+        for (int m = 0; m < cfg.metrics; ++m)
+            rec.push_back(Entry(metric_attrs[m], Variant(static_cast<double>((i + m + rank) % 1000))));
+
+        records.push_back(rec);
+    }
+
+    return records;
+}
+
+bool write_profile(const std::string& filename, CaliperMetadataDB& db, const std::vector<EntryList>& records)
+{
+    OutputStream stream;
+    stream.set_filename(filename.c_str());
+
+    CsvWriter writer(stream);
+
+    for (const EntryList& rec : records) {
+        std::vector<cali_id_t> node_ids;
+        std::vector<cali_id_t> attr_ids;
+        std::vector<Variant>   values;
+
+        for (const Entry& e : rec)
+            if (e.node())
+                node_ids.push_back(e.node()->id());
+            else {
+                attr_ids.push_back(e.attribute());
+                values.push_back(e.value());
+            }
+
+        writer.write_snapshot(db, node_ids.size(), node_ids.data(), attr_ids.size(), attr_ids.data(), values.data());
+    }
+
+    stream.stream().flush();
+
+    return stream.stream().good();
+}
+
+std::string aggregation_query(int metrics)
+{
+    std::string q = "SELECT count()";
+
+    for (int m = 0; m < metrics; ++m)
+        q += ",sum(bench.metric." + std::to_string(m) + ")";
+
+    return q + " GROUP BY region";
+}
+
+/// \brief Run one repetition of \a method over \a comm. Fills in the
+///   local stage statistics and returns the number of result records
+///   on this rank.
+long run_method(const std::string& method, const ProfileConfig& cfg, const std::string& filename,
+                int radix, MPI_Comm comm, MpiAggregationStats& stats, double& read_time)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    CalQLParser parser(aggregation_query(cfg.metrics).c_str());
+    QuerySpec   spec = parser.spec();
+
+    CaliperMetadataDB db;
+    Aggregator        aggr(spec);
+    Aggregator        out(spec);
+
+    read_time = 0.0;
+
+    if (method == "files") {
+        MPI_Barrier(comm);
+        double stime = MPI_Wtime();
+
+        db.read(filename,
+                [](CaliperMetadataAccessInterface&, const Node*) { },
+                aggr);
+
+        read_time = MPI_Wtime() - stime;
+    } else {
+        for (const EntryList& rec : make_profile(db, rank, cfg))
+            aggr.add(db, rec);
+    }
+
+    MPI_Barrier(comm);
+
+    if (method == "flat")
+        aggregate_over_mpi(db, aggr, comm, radix, false, &stats);
+    else if (method == "partitioned")
+        aggregate_partitioned_over_mpi(db, spec, aggr, out, comm, &stats);
+    else
+        aggregate_over_mpi(db, aggr, comm, radix, true, &stats);
+
+    long count = 0;
+
+    if (rank == 0 || method == "partitioned")
+        (method == "partitioned" ? out : aggr).flush(db, [&count](CaliperMetadataAccessInterface&, const EntryList&) {
+                ++count;
+            });
+
+    return count;
+}
+
+/// \brief Reduce the per-rank stage statistics onto rank 0 of \a comm
+void reduce_stats(const StageResult local[], StageResult global[], MPI_Comm comm)
+{
+    double             times[num_stages];
+    unsigned long long sums[2*num_stages];
+    unsigned long long maxs[num_stages];
+    long               rss[num_stages];
+
+    for (int s = 0; s < num_stages; ++s) {
+        times[s]  = local[s].time;
+        sums[2*s] = local[s].bytes_sent;
+        sums[2*s+1] = local[s].messages;
+        maxs[s]   = local[s].bytes_received_max;
+        rss[s]    = local[s].max_rss_kb;
+    }
+
+    double             g_times[num_stages];
+    unsigned long long g_sums[2*num_stages];
+    unsigned long long g_maxs[num_stages];
+    long               g_rss[num_stages];
+
+    MPI_Reduce(times, g_times, num_stages,   MPI_DOUBLE,             MPI_MAX, 0, comm);
+    MPI_Reduce(sums,  g_sums,  2*num_stages, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, comm);
+    MPI_Reduce(maxs,  g_maxs,  num_stages,   MPI_UNSIGNED_LONG_LONG, MPI_MAX, 0, comm);
+    MPI_Reduce(rss,   g_rss,   num_stages,   MPI_LONG,               MPI_MAX, 0, comm);
+
+    for (int s = 0; s < num_stages; ++s)
+        global[s] = StageResult { g_times[s], g_sums[2*s], g_maxs[s], g_sums[2*s+1], g_rss[s] };
+}
+
+std::vector<int> parse_int_list(const std::string& str)
+{
+    std::vector<int>   ret;
+    std::istringstream is(str);
+    std::string        s;
+
+    while (std::getline(is, s, ','))
+        if (!s.empty())
+            ret.push_back(std::stoi(s));
+
+    return ret;
+}
+
+std::vector<std::string> parse_string_list(const std::string& str)
+{
+    std::vector<std::string> ret;
+    std::istringstream       is(str);
+    std::string              s;
+
+    while (std::getline(is, s, ','))
+        if (!s.empty())
+            ret.push_back(s);
+
+    return ret;
+}
+
+} // namespace [anonymous]
+
+
+int main(int argc, char* argv[])
+{
+    MPI_Init(&argc, &argv);
+
+    int worldsize;
+    int worldrank;
+
+    MPI_Comm_size(MPI_COMM_WORLD, &worldsize);
+    MPI_Comm_rank(MPI_COMM_WORLD, &worldrank);
+
+    const util::Args::Table option_table[] = {
+        { "methods",     "methods",     'm', true,
+          "Comma-separated list of methods (flat, node-local, partitioned, files). Default: all", "METHODS"
+        },
+        { "ranks",       "ranks",       'n', true,
+          "Comma-separated list of rank counts. Default: powers of two up to the number of ranks", "RANKS"
+        },
+        { "records",     "records",     'r', true,
+          "Number of profile records per rank. Default: 10000", "RECORDS"
+        },
+        { "overlap",     "overlap",     0,   true,
+          "Fraction of records with keys shared by all ranks (0..1). Default: 0.5", "FRACTION"
+        },
+        { "depth",       "depth",       'd', true,
+          "Depth of the region paths. Default: 3", "DEPTH"
+        },
+        { "metrics",     "metrics",     'a', true,
+          "Number of aggregated metrics per record. Default: 2", "METRICS"
+        },
+        { "radix",       "radix",       0,   true,
+          "Fan-in of the reduction tree. Default: 2", "RADIX"
+        },
+        { "repetitions", "repetitions", 0,   true,
+          "Number of repetitions of each run. Default: 3", "N"
+        },
+        { "file-prefix", "file-prefix", 0,   true,
+          "Prefix of the per-rank files for the files method. Default: cali-mpi-aggr-bench", "PREFIX"
+        },
+        { "keep-files",  "keep-files",  0,   false,
+          "Don't delete the per-rank files at the end", nullptr
+        },
+
+        { "help", "help", 'h', false, "Print help", nullptr },
+
+        util::Args::Table::Terminator
+    };
+
+    util::Args args(option_table);
+
+    int lastarg = args.parse(argc, argv);
+
+    if (lastarg < argc || args.is_set("help")) {
+        if (worldrank == 0) {
+            if (lastarg < argc)
+                std::cerr << "cali-mpi-aggr-bench: unknown option: " << argv[lastarg] << '\n';
+
+            std::cerr << "Available options: ";
+            args.print_available_options(std::cerr);
+        }
+
+        MPI_Finalize();
+        return lastarg < argc ? 1 : 2;
+    }
+
+    ProfileConfig cfg;
+
+    cfg.records = std::max(0L, std::stol(args.get("records", "10000")));
+    cfg.depth   = std::max(1,  std::stoi(args.get("depth", "3")));
+    cfg.metrics = std::max(0,  std::stoi(args.get("metrics", "2")));
+    cfg.overlap = std::min(1.0, std::max(0.0, std::stod(args.get("overlap", "0.5"))));
+
+    int radix       = std::max(2, std::stoi(args.get("radix", "2")));
+    int repetitions = std::max(1, std::stoi(args.get("repetitions", "3")));
+
+    std::vector<std::string> methods = parse_string_list(args.get("methods"));
+
+    if (methods.empty())
+        for (const char** m = method_names; *m; ++m)
+            methods.push_back(*m);
+
+    std::vector<int> rank_counts = parse_int_list(args.get("ranks"));
+
+    if (rank_counts.empty()) {
+        for (int n = 1; n < worldsize; n *= 2)
+            rank_counts.push_back(n);
+
+        rank_counts.push_back(worldsize);
+    }
+
+    // --- Write per-rank files for the files method
+
+    std::string filename =
+        args.get("file-prefix", "cali-mpi-aggr-bench") + "-" + std::to_string(worldrank) + ".cali";
+
+    bool use_files = std::find(methods.begin(), methods.end(), "files") != methods.end();
+
+    if (use_files) {
+        CaliperMetadataDB db;
+
+        if (!write_profile(filename, db, make_profile(db, worldrank, cfg))) {
+            std::cerr << "cali-mpi-aggr-bench: cannot write " << filename << std::endl;
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+
+    // --- Run
+
+    bool first = true;
+
+    if (worldrank == 0)
+        std::cout << "[\n";
+
+    for (const std::string& method : methods) {
+        if (std::find_if(method_names, method_names + 4, [&method](const char* m){ return method == m; }) == method_names + 4) {
+            if (worldrank == 0)
+                std::cerr << "cali-mpi-aggr-bench: unknown method " << method << std::endl;
+
+            continue;
+        }
+
+        for (int n : rank_counts) {
+            if (n < 1 || n > worldsize)
+                continue;
+
+            MPI_Comm comm;
+            MPI_Comm_split(MPI_COMM_WORLD, worldrank < n ? 0 : MPI_UNDEFINED, worldrank, &comm);
+
+            if (comm != MPI_COMM_NULL) {
+                StageResult best[num_stages];
+                long        results = 0;
+
+                for (int r = 0; r < repetitions; ++r) {
+                    MpiAggregationStats stats;
+                    double              read_time = 0.0;
+
+                    long count = run_method(method, cfg, filename, radix, comm, stats, read_time);
+
+                    StageResult local[num_stages];
+                    StageResult global[num_stages];
+
+                    for (int s = 0; s < MpiAggregationStats::NumStages; ++s) {
+                        const MpiAggregationStats::StageInfo& st = stats.stage[s];
+                        local[s] = StageResult { st.time, st.bytes_sent, st.bytes_received, st.messages_sent, st.max_rss_kb };
+                    }
+
+                    local[read_stage] = StageResult { read_time, 0, 0, 0, read_time > 0.0 ? max_rss_kb() : 0 };
+
+                    reduce_stats(local, global, comm);
+
+                    long total = 0;
+                    MPI_Reduce(&count, &total, 1, MPI_LONG, MPI_SUM, 0, comm);
+
+                    if (r == 0) {
+                        std::copy(global, global + num_stages, best);
+                        results = total;
+                    } else
+                        for (int s = 0; s < num_stages; ++s)
+                            best[s].time = std::min(best[s].time, global[s].time);
+                }
+
+                int rank;
+                MPI_Comm_rank(comm, &rank);
+
+                if (rank == 0)
+                    for (int s = 0; s < num_stages; ++s) {
+                        // stages that didn't run have no peak memory sample
+                        if (best[s].max_rss_kb == 0)
+                            continue;
+
+                        std::cout << (first ? "" : ",\n")
+                                  << "{ \"method\": \""          << method
+                                  << "\", \"ranks\": "           << n
+                                  << ", \"stage\": \""           << stage_name(s)
+                                  << "\", \"records_per_rank\": " << cfg.records
+                                  << ", \"overlap\": "           << cfg.overlap
+                                  << ", \"result_records\": "    << results
+                                  << ", \"time_sec\": "          << best[s].time
+                                  << ", \"bytes_sent\": "        << best[s].bytes_sent
+                                  << ", \"bytes_received_max\": " << best[s].bytes_received_max
+                                  << ", \"messages\": "          << best[s].messages
+                                  << ", \"max_rss_kb\": "        << best[s].max_rss_kb
+                                  << " }";
+
+                        first = false;
+                    }
+
+                MPI_Comm_free(&comm);
+            }
+
+            MPI_Barrier(MPI_COMM_WORLD);
+        }
+    }
+
+    if (worldrank == 0)
+        std::cout << "\n]" << std::endl;
+
+    if (use_files && !args.is_set("keep-files"))
+        std::remove(filename.c_str());
+
+    MPI_Finalize();
+
+    return 0;
+}
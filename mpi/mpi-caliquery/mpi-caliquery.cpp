@@ -39,6 +39,7 @@
 
 #include "caliper/reader/Aggregator.h"
 #include "caliper/reader/CaliperMetadataDB.h"
+#include "caliper/reader/FilePrefetcher.h"
 #include "caliper/reader/FormatProcessor.h"
 #include "caliper/reader/QuerySpec.h"
 #include "caliper/reader/RecordProcessor.h"
@@ -47,10 +48,17 @@
 #include "caliper/common/Log.h"
 #include "caliper/common/OutputStream.h"
 #include "caliper/common/StringConverter.h"
-#include "caliper/common/csv/CsvReader.h"
 #include "caliper/common/csv/CsvWriter.h"
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
 
 using namespace cali;
 using namespace util;
@@ -72,6 +80,22 @@ const Args::Table option_table[] = {
       "List of attributes to aggregate over (collapses all other attributes): attribute[:...]",
       "ATTRIBUTES"
     },
+    { "merge", "merge", 0, false,
+      "Merge aggregated profiles: combine count, sum#, min#, max#, and avg# attributes of matching records",
+      nullptr
+    },
+    { "radix", "radix", 0, true,
+      "Fan-in of the cross-process reduction tree (default: 2)",
+      "NUMBER"
+    },
+    { "partition", "partition", 0, false,
+      "Partition results by key: each rank writes its share to <output>.<rank> (requires --output). With ORDER BY, the files hold consecutive ranges of the sorted output",
+      nullptr
+    },
+    { "prefetch", "prefetch", 0, true,
+      "Number of input files each rank claims and loads in the background ahead of parsing (default: 1, 0 disables)",
+      "NUMBER"
+    },
     { "attributes", "print-attributes", 0, true,  
       "Select attributes to print (or hide) in expanded output: [-]attribute[:...]", 
       "ATTRIBUTES" 
@@ -125,13 +149,15 @@ const Args::Table option_table[] = {
 };
 
     
-void format_output(const Args& args, const QuerySpec& spec, CaliperMetadataAccessInterface& db, Aggregator& aggregate)
+void format_output(const Args& args, const QuerySpec& spec, CaliperMetadataAccessInterface& db, Aggregator& aggregate, int rank = -1)
 {
     CALI_CXX_MARK_FUNCTION;
 
     OutputStream stream;
 
-    if (args.is_set("output"))
+    if (rank >= 0)
+        stream.set_filename((args.get("output") + "." + std::to_string(rank)).c_str());
+    else if (args.is_set("output"))
         stream.set_filename(args.get("output").c_str());
     else
         stream.set_stream(OutputStream::StdOut);
@@ -142,29 +168,190 @@ void format_output(const Args& args, const QuerySpec& spec, CaliperMetadataAcces
     format.flush(db);
 }
 
-void process_my_input(int rank, const Args& args, const QuerySpec& spec, CaliperMetadataDB& db, Aggregator& aggregate)
+/// \brief Row limit of a table formatter query (FORMAT table(N)), or 0
+size_t table_row_limit(const QuerySpec& spec)
 {
-    CALI_CXX_MARK_FUNCTION;
+    if (spec.format.opt != QuerySpec::FormatSpec::User || spec.format.formatter.name == nullptr)
+        return 0;
+    if (std::string(spec.format.formatter.name) != "table" || spec.format.args.empty())
+        return 0;
 
-    std::string filename = std::to_string(rank) + ".cali";
+    return StringConverter(spec.format.args.front()).to_uint();
+}
 
-    if (!args.arguments().empty())
-        if (!args.arguments().front().empty())
-            filename = args.arguments().front() + "/" + filename;
+/// \brief Partitioned aggregation needs an explicit key with merge()
+bool can_partition(const QuerySpec& spec)
+{
+    if (spec.aggregation_key.selection == QuerySpec::AttributeSelection::List)
+        return true;
 
-    CsvReader reader(filename);
-    IdMap idmap;
+    for (const QuerySpec::AggregationOp& op : spec.aggregation_ops.list)
+        if (op.op.name && std::string(op.op.name) == "merge")
+            return false;
 
+    return true;
+}
+
+void read_file(int rank, const std::string& filename, CaliperMetadataDB& db, Aggregator& aggregate, FilePrefetcher::Buffer buf = FilePrefetcher::Buffer())
+{
     NodeProcessFn     node_proc = [](CaliperMetadataAccessInterface&,const Node*) { return; };
     SnapshotProcessFn snap_proc = aggregate;
 
-    if (spec.filter.selection == QuerySpec::FilterSelection::List)
-        snap_proc = SnapshotFilterStep(RecordSelector(spec), snap_proc);
+    bool ok = buf ?
+        db.read(filename, buf->data(), buf->size(), node_proc, snap_proc) :
+        db.read(filename, node_proc, snap_proc);
 
-    if (!reader.read([&](const RecordMap& rec){ db.merge(rec, idmap, node_proc, snap_proc); }))
+    if (!ok)
         std::cerr << "mpi-caliquery (" << rank << "): cannot read " << filename << std::endl;
 }
 
+bool is_directory(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/// \brief Read the input files given on the command line. Ranks take the
+///   next unread file from a shared counter on rank 0 (through MPI one-sided
+///   atomics), largest files first, so that ranks with small files pick up
+///   more of them. With \a prefetch > 0, each rank claims up to
+///   \a prefetch files ahead and loads them in the background while it
+///   parses the current one.
+void process_input_files(const std::vector<std::string>& files, unsigned prefetch, const QuerySpec& spec, CaliperMetadataDB& db, Aggregator& aggregate)
+{
+    CALI_CXX_MARK_FUNCTION;
+
+    int rank;
+    int worldsize;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &worldsize);
+
+    // rank 0 sorts the files by size and broadcasts the order
+
+    std::vector<int> order(files.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    if (rank == 0) {
+        std::vector<long long> sizes(files.size(), 0);
+
+        for (size_t i = 0; i < files.size(); ++i) {
+            struct stat st;
+
+            if (stat(files[i].c_str(), &st) == 0)
+                sizes[i] = static_cast<long long>(st.st_size);
+        }
+
+        std::stable_sort(order.begin(), order.end(), [&sizes](int a, int b){
+                return sizes[a] > sizes[b];
+            });
+    }
+
+    MPI_Bcast(order.data(), static_cast<int>(order.size()), MPI_INT, 0, MPI_COMM_WORLD);
+
+    // filter and projection are applied by the reader
+    db.set_read_spec(spec);
+
+#if MPI_VERSION >= 3
+    long    counter = 0;
+    MPI_Win win;
+
+    MPI_Win_create(&counter, rank == 0 ? sizeof(long) : 0, sizeof(long), MPI_INFO_NULL, MPI_COMM_WORLD, &win);
+
+    auto claim_next = [&win,&order]() {
+        long one  = 1;
+        long next = 0;
+
+        MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
+        MPI_Fetch_and_op(&one, &next, MPI_LONG, 0, 0, MPI_SUM, win);
+        MPI_Win_unlock(0, win);
+
+        return next < static_cast<long>(order.size()) ? order[next] : -1;
+    };
+
+    // claimed files, each with its own loader while waiting to be parsed
+    std::deque< std::pair< int, std::unique_ptr<FilePrefetcher> > > claimed;
+    bool done = false;
+
+    while (true) {
+        while (!done && claimed.size() <= prefetch) {
+            int i = claim_next();
+
+            if (i < 0) {
+                done = true;
+                break;
+            }
+
+            std::unique_ptr<FilePrefetcher> loader;
+
+            // the first claimed file is parsed right away
+            if (!claimed.empty())
+                loader.reset(new FilePrefetcher(std::vector<std::string> { files[i] }, 1, 1));
+
+            claimed.emplace_back(i, std::move(loader));
+        }
+
+        if (claimed.empty())
+            break;
+
+        int i = claimed.front().first;
+        FilePrefetcher::Buffer buf;
+
+        if (claimed.front().second)
+            buf = claimed.front().second->take(0);
+
+        claimed.pop_front();
+
+        ::read_file(rank, files[i], db, aggregate, buf);
+    }
+
+    MPI_Win_free(&win);
+#else
+    std::vector<std::string> my_files;
+
+    for (size_t i = rank; i < order.size(); i += worldsize)
+        my_files.push_back(files[order[i]]);
+
+    std::unique_ptr<FilePrefetcher> prefetcher;
+
+    if (prefetch > 0 && my_files.size() > 1)
+        prefetcher.reset(new FilePrefetcher(my_files, 1, prefetch));
+
+    for (size_t i = 0; i < my_files.size(); ++i)
+        ::read_file(rank, my_files[i], db, aggregate,
+                    prefetcher ? prefetcher->take(i) : FilePrefetcher::Buffer());
+#endif
+}
+
+void process_my_input(int rank, const Args& args, const QuerySpec& spec, CaliperMetadataDB& db, Aggregator& aggregate)
+{
+    CALI_CXX_MARK_FUNCTION;
+
+    std::vector<std::string> files = args.arguments();
+
+    files.erase(std::remove(files.begin(), files.end(), std::string()), files.end());
+
+    // a list of files: distribute them dynamically
+
+    if (files.size() > 1 || (files.size() == 1 && !::is_directory(files.front()))) {
+        unsigned prefetch = StringConverter(args.get("prefetch", "1")).to_uint();
+        ::process_input_files(files, prefetch, spec, db, aggregate);
+        return;
+    }
+
+    // otherwise, read <directory>/<rank>.cali
+
+    std::string filename = std::to_string(rank) + ".cali";
+
+    if (!files.empty())
+        filename = files.front() + "/" + filename;
+
+    // filter and projection are applied by the reader
+    db.set_read_spec(spec);
+
+    ::read_file(rank, filename, db, aggregate);
+}
+
 void setup_caliper_config(const Args& args)
 {
     const char* summary_profile[][2] = {
@@ -253,6 +440,13 @@ int main(int argc, char* argv[])
         MPI_Abort(MPI_COMM_WORLD, -2);
     }
 
+    if (args.is_set("partition") && !args.is_set("output")) {
+        if (rank == 0)
+            std::cerr << "mpi-caliquery: error: --partition requires --output" << std::endl;
+
+        MPI_Abort(MPI_COMM_WORLD, -3);
+    }
+
     QuerySpec  spec = query_parser.spec();
     
     Aggregator aggregate(spec);
@@ -266,13 +460,48 @@ int main(int argc, char* argv[])
     // --- Aggregation loop
     //
 
-    aggregate_over_mpi(metadb, aggregate, MPI_COMM_WORLD);
+    size_t limit = ::table_row_limit(spec);
 
-    // --- Print output
-    //
+    if (args.is_set("partition")) {
+        Aggregator part(spec);
+
+        aggregate_partitioned_over_mpi(metadb, spec, aggregate, part, MPI_COMM_WORLD);
+
+        if (spec.sort.selection == QuerySpec::SortSelection::List) {
+            // range-partition the results for ORDER BY
+            Aggregator sorted(spec);
 
-    if (rank == 0)
-        ::format_output(args, spec, metadb, aggregate);
+            sort_over_mpi(metadb, spec, part, sorted, MPI_COMM_WORLD);
+
+            part = sorted;
+        }
+
+        ::format_output(args, spec, metadb, part, rank);
+    } else if (limit > 0 && ::can_partition(spec)) {
+        // top-k: complete the results for each key on one rank, then
+        //   reduce only the top records of each rank to rank 0
+        Aggregator part(spec);
+        Aggregator top(spec);
+
+        aggregate_partitioned_over_mpi(metadb, spec, aggregate, part, MPI_COMM_WORLD);
+        sort_over_mpi(metadb, spec, part, top, MPI_COMM_WORLD, limit);
+
+        if (rank == 0)
+            ::format_output(args, spec, metadb, top);
+    } else {
+        int radix = 2;
+
+        if (args.is_set("radix"))
+            radix = StringConverter(args.get("radix")).to_int();
+
+        aggregate_over_mpi(metadb, aggregate, MPI_COMM_WORLD, radix);
+
+        // --- Print output
+        //
+
+        if (rank == 0)
+            ::format_output(args, spec, metadb, aggregate);
+    }
 
     
     MPI_Finalize();
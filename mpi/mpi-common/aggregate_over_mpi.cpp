@@ -34,13 +34,23 @@
 
 #include "caliper/reader/Aggregator.h"
 #include "caliper/reader/CaliperMetadataDB.h"
+#include "caliper/reader/QuerySpec.h"
 
 #include "caliper/common/CompressedSnapshotRecord.h"
+#include "caliper/common/Log.h"
 #include "caliper/common/Node.h"
 #include "caliper/common/NodeBuffer.h"
 #include "caliper/common/SnapshotBuffer.h"
 
-#include <set>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/resource.h>
 
 using namespace cali;
 
@@ -48,174 +58,1104 @@ using namespace cali;
 namespace
 {
 
-void recursive_append_path(const CaliperMetadataAccessInterface& db,
-                           const Node* node,
-                           NodeBuffer& buf,
-                           std::set<cali_id_t>& written_nodes)
+// Aggregation results are streamed up the reduction tree in chunks.
+// Each chunk message has a header followed by the node data and the
+// snapshot data. Nodes are sent at most once per stream, before the
+// first snapshot that references them.
+
+struct ChunkHeader {
+    uint64_t node_count;
+    uint64_t node_bytes;
+    uint64_t snap_count;
+    uint64_t snap_bytes;
+    uint64_t last;       ///< 1 if this is the final chunk of the stream
+};
+
+const size_t chunk_size     = 1024*1024; ///< Target chunk message size in bytes
+const int    max_in_flight  = 2;         ///< Number of outstanding chunk sends
+const int    stream_tag     = 100;       ///< Message tag base (+ reduction step)
+
+typedef MpiAggregationStats::StageInfo StageInfo;
+
+/// \brief Measures time and peak memory of a stage into its StageInfo
+class StageTimer
 {
-    if (!node || node->id() == CALI_INV_ID)
-        return;
-    if (written_nodes.count(node->id()) > 0)
-        return;
+    StageInfo& m_info;
+    double     m_start;
 
-    if (node->attribute() < node->id())
-        recursive_append_path(db, db.node(node->attribute()), buf, written_nodes);
+public:
 
-    recursive_append_path(db, node->parent(), buf, written_nodes);
+    StageTimer(StageInfo& info)
+        : m_info(info), m_start(MPI_Wtime())
+        { }
 
-    if (written_nodes.count(node->id()) > 0)
-        return;
+    ~StageTimer() {
+        m_info.time += MPI_Wtime() - m_start;
+
+        struct rusage usage;
+
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+            m_info.max_rss_kb = std::max(m_info.max_rss_kb, static_cast<long>(usage.ru_maxrss));
+    }
+};
 
-    written_nodes.insert(node->id());
-    buf.append(node);
-}    
 
-void pack_and_send(int dest, CaliperMetadataAccessInterface& db, Aggregator& aggregator, MPI_Comm comm)
+/// \brief Global node dictionary.
+///
+/// Built once per aggregate_over_mpi() call by broadcasting rank 0's
+/// nodes, which every rank merges into its metadata DB. Merging is
+/// content-based (same attribute, value, and parent path), so each
+/// rank learns which of its own nodes are in the dictionary. Streams
+/// then refer to those by their global (rank 0) id and never send
+/// them; only rank-specific nodes are transferred.
+///
+/// In streams, dictionary nodes are referenced by their global id,
+/// other nodes by (local id + id_limit).
+struct NodeDictionary {
+    IdMap     to_local;   ///< global id -> local id (for receivers)
+    std::unordered_map<cali_id_t, cali_id_t>
+              to_global;  ///< local id -> global id (for senders)
+    cali_id_t id_limit;   ///< global ids are below id_limit
+
+    NodeDictionary()
+        : id_limit(0)
+        { }
+
+    bool contains(cali_id_t local_id) const {
+        return to_global.count(local_id) > 0;
+    }
+
+    cali_id_t stream_id(cali_id_t local_id) const {
+        if (local_id == CALI_INV_ID)
+            return CALI_INV_ID;
+
+        auto it = to_global.find(local_id);
+        return it == to_global.end() ? local_id + id_limit : it->second;
+    }
+};
+
+void make_node_dictionary(CaliperMetadataDB& db, MPI_Comm comm, NodeDictionary& dict, StageInfo& st)
 {
-    NodeBuffer     nodebuf;
-    SnapshotBuffer snapbuf;
+    StageTimer timer(st);
 
-    std::set<cali_id_t> written_nodes;
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    NodeBuffer nodebuf;
 
-    aggregator.flush(db,
-                     [&nodebuf,&snapbuf,&written_nodes](CaliperMetadataAccessInterface& db,
-                                                        const EntryList& list)
-                     {
-                         for (const Entry& e : list)
-                             if (e.node())
-                                 recursive_append_path(db, e.node(), nodebuf, written_nodes);
-                             else if (e.is_immediate())
-                                 recursive_append_path(db, db.node(e.attribute()), nodebuf, written_nodes);
+    if (rank == 0)
+        for (cali_id_t id = 0; db.node(id); ++id)
+            nodebuf.append(db.node(id));
 
-                         snapbuf.append(CompressedSnapshotRecord(list.size(), list.data()));
-                     });
+    unsigned long long sizes[2] = { nodebuf.count(), nodebuf.size() };
 
-    {
-        unsigned nodecount = nodebuf.count();
+    MPI_Bcast(sizes, 2, MPI_UNSIGNED_LONG_LONG, 0, comm);
 
-        MPI_Send(&nodecount, 1, MPI_UNSIGNED,
-                 dest, 1, comm);
-        // Work with pre-3.0 MPIs that take non-const void* :-/
-        MPI_Send(const_cast<unsigned char*>(nodebuf.data()), nodebuf.size(), MPI_BYTE,
-                 dest, 2, comm);
+    unsigned char* ptr = (rank == 0 ? const_cast<unsigned char*>(nodebuf.data()) : nodebuf.import(sizes[1], sizes[0]));
+
+    MPI_Bcast(ptr, static_cast<int>(sizes[1]), MPI_BYTE, 0, comm);
+
+    if (rank == 0) {
+        st.bytes_sent        += sizes[1];
+        st.messages_sent     += 1;
+    } else {
+        st.bytes_received    += sizes[1];
+        st.messages_received += 1;
     }
 
-    {
-        unsigned snapcount = snapbuf.count();
+    nodebuf.for_each([&db,&dict](const NodeBuffer::NodeInfo& info) {
+            const Node* node = db.merge_node(info.node_id, info.attr_id, info.parent_id, info.value, dict.to_local);
 
-        MPI_Send(&snapcount, 1, MPI_UNSIGNED,
-                 dest, 3, comm);
-        MPI_Send(const_cast<unsigned char*>(snapbuf.data()), snapbuf.size(), MPI_BYTE,
-                 dest, 4, comm);
-    }        
+            if (node)
+                dict.to_global[node->id()] = info.node_id;
+            if (info.node_id >= dict.id_limit)
+                dict.id_limit = info.node_id + 1;
+        });
 }
 
 
-size_t receive_and_merge_nodes(int source, CaliperMetadataDB& db, IdMap& idmap, MPI_Comm comm)
+/// \brief Encodes aggregation results into node and snapshot buffers
+///   for a stream. Nodes are written before the first snapshot that
+///   references them, and only once.
+class StreamEncoder
 {
-    unsigned count;
+    const NodeDictionary& m_dict;
 
-    MPI_Recv(&count, 1, MPI_UNSIGNED,
-             source, 1, comm, MPI_STATUS_IGNORE);
+    NodeBuffer        m_nodebuf;
+    SnapshotBuffer    m_snapbuf;
 
-    MPI_Status status;
-    int size;
+    std::vector<bool> m_written_nodes; ///< Node ids already sent, by id
 
-    MPI_Probe(source, 2, comm, &status);
-    MPI_Get_count(&status, MPI_BYTE, &size);
+    size_t            m_num_skipped;   ///< Entries dropped from oversized records
 
-    NodeBuffer nodebuf;
+    bool is_written(cali_id_t id) const {
+        return id < m_written_nodes.size() && m_written_nodes[id];
+    }
+
+    void set_written(cali_id_t id) {
+        if (id >= m_written_nodes.size())
+            m_written_nodes.resize(2*id + 1, false);
+
+        m_written_nodes[id] = true;
+    }
+
+    void append_path(const CaliperMetadataAccessInterface& db, const Node* node) {
+        if (!node || node->id() == CALI_INV_ID || is_written(node->id()) || m_dict.contains(node->id()))
+            return;
+
+        if (node->attribute() < node->id())
+            append_path(db, db.node(node->attribute()));
+
+        append_path(db, node->parent());
+
+        if (is_written(node->id()))
+            return;
+
+        set_written(node->id());
+
+        const Node* parent = node->parent();
+
+        m_nodebuf.append(NodeBuffer::NodeInfo {
+                m_dict.stream_id(node->id()),
+                m_dict.stream_id(node->attribute()),
+                m_dict.stream_id(parent ? parent->id() : CALI_INV_ID),
+                node->data()
+            });
+    }
+
+public:
+
+    StreamEncoder(const NodeDictionary& dict)
+        : m_dict(dict), m_num_skipped(0)
+        { }
+
+    ~StreamEncoder() {
+        if (m_num_skipped > 0)
+            Log(1).stream() << "aggregate_over_mpi: dropped " << m_num_skipped
+                            << " entries exceeding the per-record limit" << std::endl;
+    }
+
+    void push(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        for (const Entry& e : list)
+            if (e.node())
+                append_path(db, e.node());
+            else if (e.is_immediate())
+                append_path(db, db.node(e.attribute()));
+
+        std::vector<cali_id_t> node_ids;
+        std::vector<cali_id_t> attr_ids;
+        std::vector<Variant>   values;
+
+        node_ids.reserve(list.size());
+
+        for (const Entry& e : list)
+            if (e.node()) {
+                node_ids.push_back(m_dict.stream_id(e.node()->id()));
+            } else if (e.is_immediate()) {
+                attr_ids.push_back(m_dict.stream_id(e.attribute()));
+                values.push_back(e.value());
+            }
+
+        //   Size the buffer for the worst case (10 bytes per node id, 30 bytes
+        // per immediate entry) rather than using the record's internal buffer
+        std::vector<unsigned char> buf(2 + 10*node_ids.size() + 30*attr_ids.size());
+        CompressedSnapshotRecord rec(buf.size(), buf.data());
+
+        rec.append(node_ids.size(), node_ids.data());
+        rec.append(attr_ids.size(), attr_ids.data(), values.data());
+
+        // The record format itself limits the number of entries per record
+        m_num_skipped += rec.num_skipped();
+
+        m_snapbuf.append(rec);
+    }
+
+    size_t size() const {
+        return m_nodebuf.size() + m_snapbuf.size();
+    }
+
+    /// \brief Write a chunk message with the buffered data to \a buf
+    ///   and clear the buffers
+    void write_chunk(bool last, std::vector<unsigned char>& buf) {
+        ChunkHeader hdr = {
+            m_nodebuf.count(), m_nodebuf.size(),
+            m_snapbuf.count(), m_snapbuf.size(),
+            last ? 1u : 0u
+        };
+
+        size_t pos = buf.size();
+
+        buf.resize(pos + sizeof(hdr) + m_nodebuf.size() + m_snapbuf.size());
+
+        unsigned char* ptr = buf.data() + pos;
+
+        memcpy(ptr, &hdr, sizeof(hdr));
+        ptr += sizeof(hdr);
+        memcpy(ptr, m_nodebuf.data(), m_nodebuf.size());
+        ptr += m_nodebuf.size();
+        memcpy(ptr, m_snapbuf.data(), m_snapbuf.size());
+
+        m_nodebuf.clear();
+        m_snapbuf.clear();
+    }
+};
+
+
+class ChunkSender
+{
+    MPI_Comm          m_comm;
+    int               m_dest;
+    int               m_tag;
+
+    StageInfo&        m_stats;
+
+    StreamEncoder     m_encoder;
+
+    struct PendingSend {
+        std::vector<unsigned char> buf;
+        MPI_Request                req;
+    };
+
+    PendingSend       m_pending[max_in_flight];
+    int               m_next;
+
+    void send_chunk(bool last) {
+        PendingSend& p = m_pending[m_next];
+
+        m_next = (m_next + 1) % max_in_flight;
+
+        // wait until the buffer's previous send has completed
+        MPI_Wait(&p.req, MPI_STATUS_IGNORE);
+
+        p.buf.clear();
+        m_encoder.write_chunk(last, p.buf);
+
+        MPI_Isend(p.buf.data(), static_cast<int>(p.buf.size()), MPI_BYTE,
+                  m_dest, m_tag, m_comm, &p.req);
+
+        m_stats.bytes_sent    += p.buf.size();
+        m_stats.messages_sent += 1;
+    }
+
+public:
+
+    ChunkSender(int dest, int tag, const NodeDictionary& dict, MPI_Comm comm, StageInfo& st)
+        : m_comm(comm), m_dest(dest), m_tag(tag), m_stats(st), m_encoder(dict), m_next(0)
+        {
+            for (PendingSend& p : m_pending)
+                p.req = MPI_REQUEST_NULL;
+        }
+
+    void push(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        m_encoder.push(db, list);
+
+        if (m_encoder.size() >= chunk_size)
+            send_chunk(false);
+    }
+
+    void finish() {
+        send_chunk(true);
+
+        for (PendingSend& p : m_pending)
+            MPI_Wait(&p.req, MPI_STATUS_IGNORE);
+    }
+};
+
+
+void send_stream(int dest, int tag, CaliperMetadataAccessInterface& db, Aggregator& aggregator,
+                 const NodeDictionary& dict, MPI_Comm comm, StageInfo& st)
+{
+    ChunkSender sender(dest, tag, dict, comm, st);
+
+    aggregator.flush(db, [&sender](CaliperMetadataAccessInterface& db, const EntryList& list) {
+            sender.push(db, list);
+        });
+
+    sender.finish();
+}
+
+/// \brief Merge the chunk message in \a buf into \a aggregator.
+///   Returns true if this was the last chunk of its stream.
+bool merge_chunk(const unsigned char* buf, size_t size, CaliperMetadataDB& db, Aggregator& aggregator,
+                 IdMap& idmap, NodeBuffer& nodebuf, CompressedSnapshotBatch& batch)
+{
+    ChunkHeader hdr;
+
+    if (size < sizeof(hdr))
+        return true;
+
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    if (sizeof(hdr) + hdr.node_bytes + hdr.snap_bytes > size)
+        return hdr.last;
+
+    const unsigned char* ptr = buf + sizeof(hdr);
+
+    memcpy(nodebuf.import(hdr.node_bytes, hdr.node_count), ptr, hdr.node_bytes);
+
+    nodebuf.for_each([&db,&idmap](const NodeBuffer::NodeInfo& info) {
+            db.merge_node(info.node_id, info.attr_id, info.parent_id, info.value, idmap);
+        });
+
+    batch.clear();
+    batch.decode(ptr + hdr.node_bytes, hdr.snap_bytes, hdr.snap_count);
+
+    for (size_t r = 0; r < batch.num_records(); ++r)
+        aggregator.add(db, db.merge_snapshot(batch.num_nodes(r),      batch.nodes(r),
+                                             batch.num_immediates(r), batch.immediate_attr(r),
+                                             batch.immediate_data(r),
+                                             idmap));
+
+    return hdr.last;
+}
+
+/// \brief Receive and merge the chunk streams of \a num_children senders.
+///   Chunks are processed in arrival order, so a slow child does not
+///   block the others.
+void receive_streams(int num_children, int tag, CaliperMetadataDB& db, Aggregator& aggregator,
+                     const NodeDictionary& dict, MPI_Comm comm, StageInfo& st)
+{
+    std::vector<int>   sources;
+    std::vector<IdMap> idmaps;
+
+    std::vector<unsigned char> buf;
+    NodeBuffer                 nodebuf;
+    CompressedSnapshotBatch    batch;
+
+    int active = num_children;
+
+    while (active > 0) {
+        MPI_Status status;
+        int size = 0;
+
+        MPI_Probe(MPI_ANY_SOURCE, tag, comm, &status);
+        MPI_Get_count(&status, MPI_BYTE, &size);
+
+        int source = status.MPI_SOURCE;
+
+        buf.resize(size);
+
+        MPI_Recv(buf.data(), size, MPI_BYTE, source, tag, comm, MPI_STATUS_IGNORE);
+
+        st.bytes_received    += static_cast<uint64_t>(size);
+        st.messages_received += 1;
+
+        // each sender uses its own node id namespace, so keep one idmap
+        // per sender. It starts out with the global dictionary ids.
+
+        size_t s = 0;
+
+        for ( ; s < sources.size() && sources[s] != source; ++s)
+            ;
+
+        if (s == sources.size()) {
+            sources.push_back(source);
+            idmaps.push_back(dict.to_local);
+        }
+
+        if (::merge_chunk(buf.data(), static_cast<size_t>(size), db, aggregator, idmaps[s], nodebuf, batch))
+            --active;
+    }
+}
+
+/// \brief Computes a content hash of aggregation result records' keys.
+///   The hash is identical on all ranks for records with the same key,
+///   independent of local node ids and entry order.
+class KeyHasher
+{
+    bool                     m_key_list; ///< Whether the key is an explicit list
+    std::vector<std::string> m_key;      ///< Key attribute names (for key lists)
+    std::vector<std::string> m_results;  ///< Aggregation result attribute names
+
+    std::unordered_map<cali_id_t, uint64_t> m_node_hashes;
+    std::unordered_map<cali_id_t, bool>     m_is_key_imm;
+
+    static uint64_t mix(uint64_t h, const std::string& str) {
+        // FNV-1a
+        for (char c : str)
+            h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+
+        return (h ^ 0xff) * 0x100000001b3ull;
+    }
+
+    static uint64_t finalize(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+
+        return h;
+    }
+
+    uint64_t node_hash(CaliperMetadataAccessInterface& db, const Node* node) {
+        auto it = m_node_hashes.find(node->id());
+
+        if (it != m_node_hashes.end())
+            return it->second;
+
+        uint64_t h = 0xcbf29ce484222325ull;
+
+        for (const Node* n = node; n && n->id() != CALI_INV_ID; n = n->parent()) {
+            h = mix(h, db.get_attribute(n->attribute()).name());
+            h = mix(h, n->data().to_string());
+        }
+
+        h = finalize(h);
+        m_node_hashes[node->id()] = h;
+
+        return h;
+    }
+
+    bool is_key_imm(CaliperMetadataAccessInterface& db, cali_id_t attr_id) {
+        auto it = m_is_key_imm.find(attr_id);
+
+        if (it != m_is_key_imm.end())
+            return it->second;
+
+        std::string name = db.get_attribute(attr_id).name();
+        bool ret = m_key_list ?
+            std::find(m_key.begin(),     m_key.end(),     name) != m_key.end() :
+            std::find(m_results.begin(), m_results.end(), name) == m_results.end();
+
+        m_is_key_imm[attr_id] = ret;
+
+        return ret;
+    }
+
+public:
+
+    KeyHasher(const QuerySpec& spec)
+        : m_key_list(spec.aggregation_key.selection == QuerySpec::AttributeSelection::List),
+          m_key(spec.aggregation_key.list),
+          m_results(Aggregator::aggregation_attribute_names(spec))
+        { }
+
+    uint64_t operator()(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        uint64_t h = 0;
+
+        // add up entry hashes so that the entry order does not matter
+        for (const Entry& e : list)
+            if (e.node())
+                h += node_hash(db, e.node());
+            else if (e.is_immediate() && is_key_imm(db, e.attribute()))
+                h += finalize(mix(mix(0xcbf29ce484222325ull, db.get_attribute(e.attribute()).name()),
+                                  e.value().to_string()));
+
+        return finalize(h);
+    }
+};
+
+/// \brief Reduce over \a comm with a radix-\a radix tree, result on rank 0
+void reduce_tree(CaliperMetadataDB& db, Aggregator& aggregator, const NodeDictionary& dict, MPI_Comm comm, int radix,
+                 StageInfo& st)
+{
+    StageTimer timer(st);
+
+    int commsize;
+    int rank;
+
+    MPI_Comm_size(comm, &commsize);
+    MPI_Comm_rank(comm, &rank);
+
+    int step = 0;
+
+    for (long stride = 1; stride < commsize; stride *= radix, ++step) {
+        long group = stride * radix;
+
+        if (rank % group == 0) {
+            // receive from rank + j*stride, j = 1 .. radix-1
+            int num_children = 0;
+
+            for (long j = 1; j < radix && rank + j*stride < commsize; ++j)
+                ++num_children;
+
+            if (num_children > 0)
+                receive_streams(num_children, stream_tag + step, db, aggregator, dict, comm, st);
+        } else if (rank % stride == 0) {
+            // send up the tree (happens only once for each rank, and never for rank 0)
+            send_stream(static_cast<int>(rank - rank % group), stream_tag + step, db, aggregator, dict, comm, st);
+            break;
+        }
+    }
+}
+
+/// \brief Send each result record in \a in to the rank of \a comm given
+///   by \a dest_fn with a single all-to-all exchange. Each rank merges
+///   the records it receives into \a out.
+void exchange_records(CaliperMetadataDB& db, Aggregator& in, Aggregator& out,
+                      const std::function<int(CaliperMetadataAccessInterface&, const EntryList&)>& dest_fn,
+                      const NodeDictionary& dict, MPI_Comm comm, StageInfo& st)
+{
+    int rank;
+    int commsize;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &commsize);
+
+    // --- route local results to their destination rank
+
+    // encoders are created on demand; with many ranks, most may be unused
+    std::vector< std::unique_ptr<StreamEncoder> > encoders(commsize);
+
+    in.flush(db, [&](CaliperMetadataAccessInterface& db, const EntryList& list) {
+            int dest = dest_fn(db, list);
+
+            if (dest == rank)
+                out.add(db, list);
+            else {
+                if (!encoders[dest])
+                    encoders[dest].reset(new StreamEncoder(dict));
+
+                encoders[dest]->push(db, list);
+            }
+        });
 
-    MPI_Recv(nodebuf.import(size, count), size, MPI_BYTE,
-             source, 2, comm, MPI_STATUS_IGNORE);
+    std::vector<unsigned char> sendbuf;
+    std::vector<int> sendcounts(commsize, 0), sdispls(commsize, 0);
 
-    nodebuf.for_each([&db,&idmap](const NodeBuffer::NodeInfo& info)
-                     {
-                         db.merge_node(info.node_id, info.attr_id, info.parent_id, info.value, idmap);
-                     });
+    for (int r = 0; r < commsize; ++r) {
+        if (!encoders[r])
+            continue;
 
-    return nodebuf.size();
+        size_t pos = sendbuf.size();
+
+        encoders[r]->write_chunk(true, sendbuf);
+
+        sdispls[r]    = static_cast<int>(pos);
+        sendcounts[r] = static_cast<int>(sendbuf.size() - pos);
+    }
+
+    encoders.clear();
+
+    // --- exchange
+
+    std::vector<int> recvcounts(commsize, 0), rdispls(commsize, 0);
+
+    MPI_Alltoall(sendcounts.data(), 1, MPI_INT, recvcounts.data(), 1, MPI_INT, comm);
+
+    size_t recvsize = 0;
+
+    for (int r = 0; r < commsize; ++r) {
+        rdispls[r] = static_cast<int>(recvsize);
+        recvsize  += recvcounts[r];
+    }
+
+    std::vector<unsigned char> recvbuf(recvsize);
+
+    MPI_Alltoallv(sendbuf.data(), sendcounts.data(), sdispls.data(), MPI_BYTE,
+                  recvbuf.data(), recvcounts.data(), rdispls.data(), MPI_BYTE, comm);
+
+    for (int r = 0; r < commsize; ++r) {
+        if (sendcounts[r] > 0) {
+            st.bytes_sent        += static_cast<uint64_t>(sendcounts[r]);
+            st.messages_sent     += 1;
+        }
+        if (recvcounts[r] > 0) {
+            st.bytes_received    += static_cast<uint64_t>(recvcounts[r]);
+            st.messages_received += 1;
+        }
+    }
+
+    sendbuf.clear();
+
+    // --- merge the received shares
+
+    NodeBuffer              nodebuf;
+    CompressedSnapshotBatch batch;
+
+    for (int r = 0; r < commsize; ++r) {
+        if (recvcounts[r] == 0)
+            continue;
+
+        // each sender uses its own node id namespace
+        IdMap idmap = dict.to_local;
+
+        ::merge_chunk(recvbuf.data() + rdispls[r], static_cast<size_t>(recvcounts[r]),
+                      db, out, idmap, nodebuf, batch);
+    }
 }
 
-size_t receive_and_merge_snapshots(int source, 
-                                   CaliperMetadataDB& db, const IdMap& idmap, 
-                                   SnapshotProcessFn snap_fn,
-                                   MPI_Comm comm)
+
+/// \brief One column value of a record's ORDER BY key
+struct SortValue {
+    enum Kind : unsigned char { Empty = 0, Number = 1, String = 2 } kind;
+    double      num;
+    std::string str;
+};
+
+typedef std::vector<SortValue> SortKey;
+
+/// \brief Extracts and compares ORDER BY keys of result records. Like
+///   the table formatter, this compares numbers by value, joins nested
+///   values of an attribute into a path string, and treats the last
+///   ORDER BY entry as the most significant one.
+class RecordSorter
 {
-    unsigned count;
+    std::vector<std::string> m_names;      ///< Sort attributes, most significant first
+    std::vector<bool>        m_descending;
+    std::vector<cali_id_t>   m_attr_ids;
+
+public:
+
+    RecordSorter(const QuerySpec& spec) {
+        if (spec.sort.selection == QuerySpec::SortSelection::List)
+            for (auto it = spec.sort.list.rbegin(); it != spec.sort.list.rend(); ++it) {
+                m_names.push_back(it->attribute);
+                m_descending.push_back(it->order == QuerySpec::SortSpec::Descending);
+            }
+    }
+
+    size_t num_columns() const {
+        return m_names.size();
+    }
+
+    SortKey key(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        if (m_attr_ids.size() < m_names.size())
+            for (const std::string& name : m_names)
+                m_attr_ids.push_back(db.get_attribute(name).id());
+
+        SortKey key(m_names.size(), SortValue { SortValue::Empty, 0.0, std::string() });
+
+        for (size_t c = 0; c < m_names.size(); ++c) {
+            if (m_attr_ids[c] == CALI_INV_ID)
+                continue;
+
+            Variant val;
+
+            for (const Entry& e : list) {
+                if (e.node()) {
+                    std::string str;
+
+                    for (const Node* node = e.node(); node; node = node->parent())
+                        if (node->attribute() == m_attr_ids[c])
+                            str = node->data().to_string().append(str.empty() ? "" : "/").append(str);
+
+                    if (!str.empty()) {
+                        key[c].kind = SortValue::String;
+                        key[c].str  = str;
+                        break;
+                    }
+                } else if (e.attribute() == m_attr_ids[c]) {
+                    val = e.value();
+                    break;
+                }
+            }
+
+            if (val.empty())
+                continue;
+
+            cali_attr_type type = val.type();
+
+            if (type == CALI_TYPE_INT || type == CALI_TYPE_UINT || type == CALI_TYPE_DOUBLE) {
+                key[c].kind = SortValue::Number;
+                key[c].num  = val.to_double();
+            } else {
+                key[c].kind = SortValue::String;
+                key[c].str  = val.to_string();
+            }
+        }
+
+        return key;
+    }
+
+    /// \brief Three-way comparison in output order
+    int compare(const SortKey& lhs, const SortKey& rhs) const {
+        for (size_t c = 0; c < m_names.size() && c < lhs.size() && c < rhs.size(); ++c) {
+            const SortValue& l = lhs[c];
+            const SortValue& r = rhs[c];
+
+            int cmp = 0;
 
-    MPI_Recv(&count, 3, MPI_UNSIGNED,
-             source, 3, comm, MPI_STATUS_IGNORE);
+            if (l.kind != r.kind)
+                cmp = (l.kind < r.kind ? -1 : 1);
+            else if (l.kind == SortValue::Number)
+                cmp = (l.num < r.num ? -1 : (l.num > r.num ? 1 : 0));
+            else if (l.kind == SortValue::String)
+                cmp = l.str.compare(r.str);
 
-    MPI_Status status;
-    int size;
+            if (m_descending[c])
+                cmp = -cmp;
+            if (cmp != 0)
+                return cmp < 0 ? -1 : 1;
+        }
 
-    MPI_Probe(source, 4, comm, &status);
-    MPI_Get_count(&status, MPI_BYTE, &size);
+        return 0;
+    }
+
+    bool before(const SortKey& lhs, const SortKey& rhs) const {
+        return compare(lhs, rhs) < 0;
+    }
+};
 
-    SnapshotBuffer snapbuf;
+void encode_sort_keys(const std::vector<SortKey>& keys, std::vector<unsigned char>& buf)
+{
+    for (const SortKey& key : keys)
+        for (const SortValue& v : key) {
+            buf.push_back(v.kind);
 
-    MPI_Recv(snapbuf.import(size, count), size, MPI_BYTE,
-             source, 4, comm, MPI_STATUS_IGNORE);
+            if (v.kind == SortValue::Number) {
+                size_t pos = buf.size();
+                buf.resize(pos + sizeof(double));
+                memcpy(buf.data() + pos, &v.num, sizeof(double));
+            } else if (v.kind == SortValue::String) {
+                uint32_t len = static_cast<uint32_t>(v.str.size());
+                size_t   pos = buf.size();
+                buf.resize(pos + sizeof(len) + len);
+                memcpy(buf.data() + pos, &len, sizeof(len));
+                memcpy(buf.data() + pos + sizeof(len), v.str.data(), len);
+            }
+        }
+}
 
-    size_t pos = 0;
+void decode_sort_keys(const unsigned char* ptr, size_t size, size_t num_columns, std::vector<SortKey>& keys)
+{
+    const unsigned char* end = ptr + size;
 
-    for (size_t i = 0; i < snapbuf.count(); ++i) {
-        CompressedSnapshotRecordView view(snapbuf.data()+pos, &pos);
+    while (num_columns > 0 && ptr < end) {
+        SortKey key(num_columns, SortValue { SortValue::Empty, 0.0, std::string() });
 
-        // currently 127 entries is the max for compressed snapshots
-        cali_id_t node_ids[128];
-        cali_id_t attr_ids[128];
-        Variant   values[128];
+        for (size_t c = 0; c < num_columns && ptr < end; ++c) {
+            key[c].kind = static_cast<SortValue::Kind>(*ptr++);
 
-        view.unpack_nodes(128, node_ids);
-        view.unpack_immediate(128, attr_ids, values);
+            if (key[c].kind == SortValue::Number && ptr + sizeof(double) <= end) {
+                memcpy(&key[c].num, ptr, sizeof(double));
+                ptr += sizeof(double);
+            } else if (key[c].kind == SortValue::String && ptr + sizeof(uint32_t) <= end) {
+                uint32_t len = 0;
+                memcpy(&len, ptr, sizeof(len));
+                ptr += sizeof(len);
+                len  = std::min<uint32_t>(len, static_cast<uint32_t>(end - ptr));
+                key[c].str.assign(reinterpret_cast<const char*>(ptr), len);
+                ptr += len;
+            }
+        }
 
-        snap_fn(db, db.merge_snapshot(view.num_nodes(),      node_ids,
-                                      view.num_immediates(), attr_ids, values,
-                                      idmap));
+        keys.push_back(std::move(key));
     }
+}
+
+/// \brief Return an aggregator with the first \a limit records of \a in
+///   in output order. Ties at the cut-off are taken in flush order.
+Aggregator select_top(CaliperMetadataAccessInterface& db, const QuerySpec& spec, RecordSorter& sorter,
+                      Aggregator& in, size_t limit)
+{
+    std::vector<SortKey> keys;
+
+    in.flush(db, [&](CaliperMetadataAccessInterface& db, const EntryList& list) {
+            keys.push_back(sorter.key(db, list));
+        });
+
+    if (keys.size() <= limit)
+        return in;
 
-    return snapbuf.size();
+    // find the last key that makes the cut
+    std::vector<SortKey> tmp(keys);
+    auto cmp = [&sorter](const SortKey& a, const SortKey& b){ return sorter.before(a, b); };
+
+    std::nth_element(tmp.begin(), tmp.begin() + (limit - 1), tmp.end(), cmp);
+
+    const SortKey& cutoff = tmp[limit - 1];
+    size_t num_before = 0;
+
+    for (const SortKey& key : keys)
+        if (sorter.before(key, cutoff))
+            ++num_before;
+
+    size_t num_ties = limit - num_before;
+    size_t i = 0;
+
+    Aggregator out(spec);
+
+    in.flush(db, [&](CaliperMetadataAccessInterface& db, const EntryList& list) {
+            int c = sorter.compare(keys[i++], cutoff);
+
+            if (c < 0 || (c == 0 && num_ties > 0)) {
+                if (c == 0)
+                    --num_ties;
+
+                out.add(db, list);
+            }
+        });
+
+    return out;
 }
 
-size_t receive_and_merge(int source, CaliperMetadataDB& db, SnapshotProcessFn snap_fn, MPI_Comm comm)
+/// \brief Reduce the top \a limit records over \a comm with a radix-\a radix
+///   tree. Each receiver cuts its results down to \a limit records before
+///   passing them on, so no rank holds more than radix * limit records.
+void reduce_top(CaliperMetadataDB& db, const QuerySpec& spec, RecordSorter& sorter, Aggregator& aggregator, size_t limit,
+                const NodeDictionary& dict, MPI_Comm comm, int radix, StageInfo& st)
 {
-    IdMap  idmap;
-    size_t bytes = 0;
+    int commsize;
+    int rank;
 
-    bytes += receive_and_merge_nodes(source, db, idmap, comm);
-    bytes += receive_and_merge_snapshots(source, db, idmap, snap_fn, comm);
+    MPI_Comm_size(comm, &commsize);
+    MPI_Comm_rank(comm, &rank);
+
+    aggregator = ::select_top(db, spec, sorter, aggregator, limit);
+
+    int step = 0;
+
+    for (long stride = 1; stride < commsize; stride *= radix, ++step) {
+        long group = stride * radix;
+
+        if (rank % group == 0) {
+            int num_children = 0;
 
-    return bytes;
+            for (long j = 1; j < radix && rank + j*stride < commsize; ++j)
+                ++num_children;
+
+            if (num_children > 0) {
+                receive_streams(num_children, stream_tag + step, db, aggregator, dict, comm, st);
+                aggregator = ::select_top(db, spec, sorter, aggregator, limit);
+            }
+        } else if (rank % stride == 0) {
+            send_stream(static_cast<int>(rank - rank % group), stream_tag + step, db, aggregator, dict, comm, st);
+            break;
+        }
+    }
+}
+
+/// \brief Compute the range boundaries for sorting \a in over \a comm by
+///   sampling the local ORDER BY keys (sample sort). Returns commsize - 1
+///   splitters in output order.
+std::vector<SortKey> find_splitters(CaliperMetadataAccessInterface& db, RecordSorter& sorter, Aggregator& in,
+                                    MPI_Comm comm, StageInfo& st)
+{
+    const size_t samples_per_rank = 64;
+
+    int rank;
+    int commsize;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &commsize);
+
+    auto cmp = [&sorter](const SortKey& a, const SortKey& b){ return sorter.before(a, b); };
+
+    // --- pick regularly spaced samples from the sorted local keys
+
+    std::vector<SortKey> keys;
+
+    in.flush(db, [&](CaliperMetadataAccessInterface& db, const EntryList& list) {
+            keys.push_back(sorter.key(db, list));
+        });
+
+    std::sort(keys.begin(), keys.end(), cmp);
+
+    std::vector<SortKey> samples;
+    size_t num_samples = std::min(keys.size(), samples_per_rank);
+
+    for (size_t i = 0; i < num_samples; ++i)
+        samples.push_back(keys[(i * keys.size()) / num_samples]);
+
+    keys.clear();
+
+    std::vector<unsigned char> sendbuf;
+    ::encode_sort_keys(samples, sendbuf);
+
+    // --- gather the samples on rank 0, which picks the splitters
+
+    int sendcount = static_cast<int>(sendbuf.size());
+    std::vector<int> recvcounts(rank == 0 ? commsize : 0, 0), displs(rank == 0 ? commsize : 0, 0);
+
+    MPI_Gather(&sendcount, 1, MPI_INT, recvcounts.data(), 1, MPI_INT, 0, comm);
+
+    size_t recvsize = 0;
+
+    for (int r = 0; r < static_cast<int>(recvcounts.size()); ++r) {
+        displs[r]  = static_cast<int>(recvsize);
+        recvsize  += recvcounts[r];
+    }
+
+    std::vector<unsigned char> recvbuf(recvsize);
+
+    MPI_Gatherv(sendbuf.data(), sendcount, MPI_BYTE,
+                recvbuf.data(), recvcounts.data(), displs.data(), MPI_BYTE, 0, comm);
+
+    if (rank == 0) {
+        st.bytes_received    += recvsize;
+        st.messages_received += static_cast<uint64_t>(commsize - 1);
+    } else {
+        st.bytes_sent        += sendbuf.size();
+        st.messages_sent     += 1;
+    }
+
+    std::vector<unsigned char> splitbuf;
+
+    if (rank == 0) {
+        samples.clear();
+        ::decode_sort_keys(recvbuf.data(), recvbuf.size(), sorter.num_columns(), samples);
+        std::sort(samples.begin(), samples.end(), cmp);
+
+        std::vector<SortKey> splitters;
+
+        if (!samples.empty())
+            for (int r = 1; r < commsize; ++r)
+                splitters.push_back(samples[(r * samples.size()) / commsize]);
+
+        ::encode_sort_keys(splitters, splitbuf);
+    }
+
+    // --- broadcast the splitters
+
+    unsigned long long splitsize = splitbuf.size();
+
+    MPI_Bcast(&splitsize, 1, MPI_UNSIGNED_LONG_LONG, 0, comm);
+    splitbuf.resize(splitsize);
+    MPI_Bcast(splitbuf.data(), static_cast<int>(splitsize), MPI_BYTE, 0, comm);
+
+    std::vector<SortKey> splitters;
+    ::decode_sort_keys(splitbuf.data(), splitbuf.size(), sorter.num_columns(), splitters);
+
+    return splitters;
 }
 
-    
 } // namespace [anonymous]
 
 namespace cali
 {
 
+const char*
+MpiAggregationStats::stage_name(int stage)
+{
+    static const char* names[] = { "dictionary", "node-local", "global" };
+
+    return (stage >= 0 && stage < NumStages) ? names[stage] : "unknown";
+}
+
 void
-aggregate_over_mpi(CaliperMetadataDB& metadb, Aggregator& aggr, MPI_Comm comm)
+aggregate_over_mpi(CaliperMetadataDB& metadb, Aggregator& aggr, MPI_Comm comm, int radix, bool node_local_stage,
+                   MpiAggregationStats* stats)
+{
+    if (radix < 2)
+        radix = 2;
+
+    MpiAggregationStats tmp_stats;
+
+    if (!stats)
+        stats = &tmp_stats;
+
+    *stats = MpiAggregationStats();
+
+    NodeDictionary dict;
+
+    ::make_node_dictionary(metadb, comm, dict, stats->stage[MpiAggregationStats::Dictionary]);
+
+#if MPI_VERSION >= 3
+    if (node_local_stage) {
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+
+        // Node-local stage: reduce among the ranks that share a node
+        // (typically over shared-memory transport) first. Ordering by
+        // rank makes rank 0 of comm the leader of its node.
+
+        MPI_Comm local_comm;
+        MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &local_comm);
+
+        ::reduce_tree(metadb, aggr, dict, local_comm, radix, stats->stage[MpiAggregationStats::NodeLocal]);
+
+        int local_rank;
+        MPI_Comm_rank(local_comm, &local_rank);
+        MPI_Comm_free(&local_comm);
+
+        // Inter-node stage among the node leaders
+
+        MPI_Comm leader_comm;
+        MPI_Comm_split(comm, local_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leader_comm);
+
+        if (leader_comm != MPI_COMM_NULL) {
+            ::reduce_tree(metadb, aggr, dict, leader_comm, radix, stats->stage[MpiAggregationStats::Global]);
+            MPI_Comm_free(&leader_comm);
+        }
+
+        return;
+    }
+#endif
+
+    ::reduce_tree(metadb, aggr, dict, comm, radix, stats->stage[MpiAggregationStats::Global]);
+}
+
+void
+aggregate_partitioned_over_mpi(CaliperMetadataDB& metadb, const QuerySpec& spec,
+                               Aggregator& in, Aggregator& out, MPI_Comm comm,
+                               MpiAggregationStats* stats)
 {
-    int commsize;
     int rank;
+    int commsize;
 
-    MPI_Comm_size(comm, &commsize);
     MPI_Comm_rank(comm, &rank);
-    
-    for (int step = 0, steppow2 = 1; steppow2 < commsize; ++step, steppow2 *= 2) {
-        size_t bytes = 0;
-        
-        // receive and merge
-        if (rank % (2*steppow2) == 0 && rank + steppow2 < commsize)
-            bytes = ::receive_and_merge(rank + steppow2, metadb, aggr, comm);
-
-        // send up the tree (happens only in one step for each rank, and never for rank 0)
-        if (rank % steppow2 == 0 && rank % (2*steppow2) != 0)
-            ::pack_and_send(rank - steppow2, metadb, aggr, comm);
+    MPI_Comm_size(comm, &commsize);
+
+    MpiAggregationStats tmp_stats;
+
+    if (!stats)
+        stats = &tmp_stats;
+
+    *stats = MpiAggregationStats();
+
+    NodeDictionary dict;
+
+    ::make_node_dictionary(metadb, comm, dict, stats->stage[MpiAggregationStats::Dictionary]);
+
+    StageInfo& st = stats->stage[MpiAggregationStats::Global];
+    ::StageTimer timer(st);
+
+    ::KeyHasher hasher(spec);
+
+    ::exchange_records(metadb, in, out, [&hasher,commsize](CaliperMetadataAccessInterface& db, const EntryList& list) {
+            return static_cast<int>(hasher(db, list) % static_cast<uint64_t>(commsize));
+        }, dict, comm, st);
+}
+
+void
+sort_over_mpi(CaliperMetadataDB& metadb, const QuerySpec& spec,
+              Aggregator& in, Aggregator& out, MPI_Comm comm,
+              size_t limit, MpiAggregationStats* stats)
+{
+    MpiAggregationStats tmp_stats;
+
+    if (!stats)
+        stats = &tmp_stats;
+
+    *stats = MpiAggregationStats();
+
+    NodeDictionary dict;
+
+    ::make_node_dictionary(metadb, comm, dict, stats->stage[MpiAggregationStats::Dictionary]);
+
+    StageInfo& st = stats->stage[MpiAggregationStats::Global];
+    ::StageTimer timer(st);
+
+    ::RecordSorter sorter(spec);
+
+    if (limit > 0) {
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+
+        Aggregator top = in;
+
+        ::reduce_top(metadb, spec, sorter, top, limit, dict, comm, 2, st);
+
+        if (rank == 0)
+            top.flush(metadb, out);
+
+        return;
+    }
+
+    if (sorter.num_columns() == 0) {
+        in.flush(metadb, out);
+        return;
     }
+
+    std::vector<SortKey> splitters = ::find_splitters(metadb, sorter, in, comm, st);
+
+    auto cmp = [&sorter](const SortKey& a, const SortKey& b){ return sorter.before(a, b); };
+
+    // records equal to a splitter go to the rank above it
+    ::exchange_records(metadb, in, out, [&](CaliperMetadataAccessInterface& db, const EntryList& list) {
+            SortKey key = sorter.key(db, list);
+            return static_cast<int>(std::upper_bound(splitters.begin(), splitters.end(), key, cmp) - splitters.begin());
+        }, dict, comm, st);
 }
 
 }
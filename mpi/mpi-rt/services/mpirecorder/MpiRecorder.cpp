@@ -0,0 +1,356 @@
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+/// \file MpiRecorder.cpp
+/// Node-aggregated trace/profile recorder: writes one rank-tagged binary
+/// .cali container per node
+
+#include "MpiEvents.h"
+
+#include "caliper/CaliperService.h"
+
+#include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/Log.h"
+#include "caliper/common/Node.h"
+#include "caliper/common/OutputStream.h"
+#include "caliper/common/RuntimeConfig.h"
+
+#include "caliper/common/binary/BinaryWriter.h"
+#include "caliper/common/binary/RankContainerWriter.h"
+
+#include <mpi.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+// Maximum message size when sending stream data to the group leader
+constexpr std::size_t max_chunk_size = 64 * 1024 * 1024;
+
+constexpr int stream_data_tag = 7311;
+
+class MpiRecorder
+{
+    static std::unique_ptr<MpiRecorder> s_instance;
+
+    static const ConfigSet::Entry       s_configdata[];
+
+    std::string        m_filename;
+    unsigned           m_group_size; ///< Ranks per group; 0: one group per node
+
+    std::ostringstream m_buffer;
+    OutputStream       m_stream;
+    BinaryWriter       m_writer;
+
+    /// \brief Split \a comm into the output groups. Returns the group
+    ///   communicator.
+    MPI_Comm make_group_comm(MPI_Comm comm) {
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+
+        MPI_Comm group_comm;
+
+#if MPI_VERSION >= 3
+        if (m_group_size == 0) {
+            MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &group_comm);
+            return group_comm;
+        }
+#endif
+
+        int size = static_cast<int>(m_group_size > 0 ? m_group_size : 1);
+
+        MPI_Comm_split(comm, rank / size, rank, &group_comm);
+
+        return group_comm;
+    }
+
+#if MPI_VERSION >= 3
+    /// \brief Let the group leader write the streams of all group members
+    ///   straight out of a shared-memory window
+    void write_shared(const std::string& data, MPI_Comm group_comm,
+                      const std::vector<int>& ranks, RankContainerWriter* writer) {
+        char*   base = nullptr;
+        MPI_Win win;
+
+        MPI_Win_allocate_shared(static_cast<MPI_Aint>(data.size()), 1, MPI_INFO_NULL,
+                                group_comm, &base, &win);
+
+        MPI_Win_fence(0, win);
+        if (!data.empty())
+            memcpy(base, data.data(), data.size());
+        MPI_Win_fence(0, win);
+
+        if (writer)
+            for (std::size_t r = 0; r < ranks.size(); ++r) {
+                MPI_Aint size = 0;
+                int      disp = 0;
+                char*    ptr  = nullptr;
+
+                MPI_Win_shared_query(win, static_cast<int>(r), &size, &disp, &ptr);
+                writer->append(ranks[r], reinterpret_cast<unsigned char*>(ptr), size);
+            }
+
+        MPI_Win_fence(0, win);
+        MPI_Win_free(&win);
+    }
+#endif
+
+    /// \brief Send the streams of all group members to the group leader
+    ///   in point-to-point messages
+    void write_messages(const std::string& data, MPI_Comm group_comm,
+                        const std::vector<int>& ranks, const std::vector<unsigned long long>& sizes,
+                        RankContainerWriter* writer) {
+        if (!writer) {
+            for (std::size_t pos = 0; pos < data.size(); pos += max_chunk_size)
+                MPI_Send(const_cast<char*>(data.data()+pos),
+                         static_cast<int>(std::min(max_chunk_size, data.size()-pos)), MPI_BYTE,
+                         0, stream_data_tag, group_comm);
+
+            return;
+        }
+
+        writer->append(ranks[0], reinterpret_cast<const unsigned char*>(data.data()), data.size());
+
+        std::vector<char> buf;
+
+        for (std::size_t r = 1; r < ranks.size(); ++r) {
+            buf.resize(sizes[r]);
+
+            for (std::size_t pos = 0; pos < buf.size(); pos += max_chunk_size)
+                MPI_Recv(buf.data()+pos,
+                         static_cast<int>(std::min<std::size_t>(max_chunk_size, buf.size()-pos)), MPI_BYTE,
+                         static_cast<int>(r), stream_data_tag, group_comm, MPI_STATUS_IGNORE);
+
+            writer->append(ranks[r], reinterpret_cast<const unsigned char*>(buf.data()), buf.size());
+        }
+    }
+
+    void pre_write(Caliper*, const SnapshotRecord*) {
+        m_buffer.str(std::string());
+        m_stream.set_stream(&m_buffer);
+        m_writer = BinaryWriter(m_stream);
+    }
+
+    void write_snapshot(Caliper* c, const SnapshotRecord* snapshot) {
+        SnapshotRecord::Data   data = snapshot->data();
+        SnapshotRecord::Sizes sizes = snapshot->size();
+
+        cali_id_t node_ids[128];
+        size_t    nn = std::min<size_t>(sizes.n_nodes, 128);
+
+        for (size_t i = 0; i < nn; ++i)
+            node_ids[i] = data.node_entries[i]->id();
+
+        m_writer.write_snapshot(*c, nn, node_ids,
+                                sizes.n_immediate, data.immediate_attr, data.immediate_data);
+    }
+
+    void post_write(Caliper* c, const SnapshotRecord* flush_info) {
+        m_writer.write_globals(*c, c->get_globals());
+        m_writer.flush();
+
+        size_t num_written = m_writer.num_written();
+
+        m_writer = BinaryWriter();
+
+        std::string data = m_buffer.str();
+        m_buffer.str(std::string());
+
+        MPI_Comm comm;
+        MPI_Comm_dup(MPI_COMM_WORLD, &comm);
+
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+
+        MPI_Comm group_comm = make_group_comm(comm);
+
+        int group_rank;
+        int group_size;
+
+        MPI_Comm_rank(group_comm, &group_rank);
+        MPI_Comm_size(group_comm, &group_size);
+
+        // the group leaders determine the output file index
+
+        MPI_Comm leader_comm;
+        MPI_Comm_split(comm, group_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leader_comm);
+
+        int group = 0;
+
+        if (leader_comm != MPI_COMM_NULL) {
+            MPI_Comm_rank(leader_comm, &group);
+            MPI_Comm_free(&leader_comm);
+        }
+
+        unsigned long long size = data.size();
+
+        std::vector<int>                ranks(group_rank == 0 ? group_size : 0);
+        std::vector<unsigned long long> sizes(group_rank == 0 ? group_size : 0);
+
+        MPI_Gather(&rank, 1, MPI_INT, ranks.data(), 1, MPI_INT, 0, group_comm);
+        MPI_Gather(&size, 1, MPI_UNSIGNED_LONG_LONG, sizes.data(), 1, MPI_UNSIGNED_LONG_LONG, 0, group_comm);
+
+        OutputStream stream;
+        std::unique_ptr<RankContainerWriter> writer;
+
+        if (group_rank == 0) {
+            stream.set_filename((m_filename + "-" + std::to_string(group) + ".cali").c_str(),
+                                *c, flush_info->to_entrylist());
+
+            if (stream.compression() != OutputStream::NoCompression) {
+                Log(1).stream() << "mpirecorder: binary output can't be compressed, writing uncompressed output" << std::endl;
+                stream.set_compression(OutputStream::NoCompression);
+            }
+
+            writer.reset(new RankContainerWriter(stream.stream()));
+        }
+
+#if MPI_VERSION >= 3
+        if (m_group_size == 0)
+            write_shared(data, group_comm, ranks, writer.get());
+        else
+#endif
+            write_messages(data, group_comm, ranks, sizes, writer.get());
+
+        if (writer) {
+            writer->finish();
+
+            unsigned long long total = 0;
+
+            for (unsigned long long s : sizes)
+                total += s;
+
+            Log(1).stream() << "mpirecorder: Wrote " << writer->num_sections() << " rank sections ("
+                            << total << " bytes) to " << m_filename << "-" << group << ".cali" << std::endl;
+        }
+
+        Log(2).stream() << "mpirecorder: Wrote " << num_written << " records." << std::endl;
+
+        MPI_Comm_free(&group_comm);
+        MPI_Comm_free(&comm);
+    }
+
+    static bool mpi_available() {
+        int initialized = 0;
+        int finalized   = 0;
+
+        MPI_Initialized(&initialized);
+        MPI_Finalized(&finalized);
+
+        return initialized && !finalized;
+    }
+
+    static void pre_write_cb(Caliper* c, const SnapshotRecord* flush_info) {
+        if (!s_instance)
+            return;
+
+        // mpirecorder is collective: skip flushes outside of MPI
+        if (!mpi_available()) {
+            Log(2).stream() << "mpirecorder: MPI is not initialized, skipping output" << std::endl;
+            return;
+        }
+
+        s_instance->pre_write(c, flush_info);
+    }
+
+    static void write_snapshot_cb(Caliper* c, const SnapshotRecord*, const SnapshotRecord* snapshot) {
+        if (!s_instance || !mpi_available())
+            return;
+
+        s_instance->write_snapshot(c, snapshot);
+    }
+
+    static void post_write_cb(Caliper* c, const SnapshotRecord* flush_info) {
+        if (!s_instance || !mpi_available())
+            return;
+
+        s_instance->post_write(c, flush_info);
+    }
+
+    static void mpi_finalize_cb(Caliper* c) {
+        c->flush_and_write(nullptr);
+    }
+
+public:
+
+    MpiRecorder(const std::string& filename, unsigned group_size)
+        : m_filename(filename), m_group_size(group_size)
+        { }
+
+    static void init(Caliper* c) {
+        ConfigSet config = RuntimeConfig::init("mpirecorder", s_configdata);
+
+        s_instance.reset(new MpiRecorder(config.get("filename").to_string(),
+                                         config.get("group_size").to_uint()));
+
+        if (config.get("write_on_finalize").to_bool() == true)
+            MpiEvents::events.mpi_finalize_evt.connect(::MpiRecorder::mpi_finalize_cb);
+
+        c->events().pre_write_evt.connect(pre_write_cb);
+        c->events().write_snapshot.connect(write_snapshot_cb);
+        c->events().post_write_evt.connect(post_write_cb);
+
+        Log(1).stream() << "Registered mpirecorder service" << std::endl;
+    }
+};
+
+std::unique_ptr<MpiRecorder> MpiRecorder::s_instance;
+
+const ConfigSet::Entry       MpiRecorder::s_configdata[] = {
+    { "filename", CALI_TYPE_STRING, "caliper-node",
+      "Base name for the output files",
+      "Base name for the output files. Group leaders write\n"
+      "<filename>-<group index>.cali."
+    },
+    { "group_size", CALI_TYPE_UINT, "0",
+      "Number of processes writing into one output file",
+      "Number of processes writing into one output file.\n"
+      "0: one file per node, streams are collected through shared memory."
+    },
+    { "write_on_finalize", CALI_TYPE_BOOL, "true",
+      "Flush Caliper buffers on MPI_Finalize",
+      "Flush Caliper buffers on MPI_Finalize"
+    },
+    ConfigSet::Terminator
+};
+
+} // namespace [anonymous]
+
+namespace cali
+{
+    CaliperService mpirecorder_service = { "mpirecorder", ::MpiRecorder::init };
+}
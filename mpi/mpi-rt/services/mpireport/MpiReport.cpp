@@ -36,16 +36,24 @@
 #include "caliper/cali-mpi.h"
 
 #include "caliper/common/Log.h"
+#include "caliper/common/Node.h"
 #include "caliper/common/OutputStream.h"
 #include "caliper/common/RuntimeConfig.h"
 
+#include "caliper/common/binary/BinaryWriter.h"
+
 #include "caliper/reader/Aggregator.h"
 #include "caliper/reader/CaliperMetadataDB.h"
 #include "caliper/reader/CalQLParser.h"
 #include "caliper/reader/FormatProcessor.h"
 #include "caliper/reader/RecordSelector.h"
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
 #include <memory>
+#include <vector>
 
 using namespace cali;
 
@@ -61,11 +69,21 @@ class MpiReport
     QuerySpec         m_spec;
     CaliperMetadataDB m_db;
 
+    /// Resolve symbol references after the reduction (coordinated
+    /// symbollookup mode)
+    bool              m_resolve_symbols;
+
     Aggregator        m_a;
     RecordSelector    m_filter;
 
     std::string       m_filename;
 
+    int               m_radix;
+    bool              m_node_local_stage;
+
+    bool              m_per_group;  ///< Write one file per aggregation group
+    unsigned          m_group_size; ///< Ranks per group; 0: one group per node
+
     void add(Caliper* c, const SnapshotRecord* snapshot) {
         // this function processes our local snapshots during flush:
         //   add them to our local aggregator (m_a)
@@ -78,19 +96,265 @@ class MpiReport
                                 s.n_immediate, d.immediate_attr, d.immediate_data,
                                 *c);
 
-        if (m_filter.pass(m_db, rec))
+        // with deferred symbol lookup, filter the resolved records
+        if (m_resolve_symbols || m_filter.pass(m_db, rec))
             m_a.add(m_db, rec);
     }
 
+    /// \brief The aggregation spec for the reduction with deferred symbol
+    ///   lookup: group by the symbol references (symbol.ref#<attr>) in
+    ///   place of the symbol attributes (source.function#<attr> etc.)
+    static QuerySpec make_reduction_spec(const QuerySpec& spec) {
+        QuerySpec ret(spec);
+
+        if (spec.aggregation_key.selection != QuerySpec::AttributeSelection::List)
+            return ret;
+
+        const char* prefixes[] = {
+            "source.function#", "sourceloc#", "source.file#", "source.line#", "module#"
+        };
+
+        ret.aggregation_key.list.clear();
+
+        for (std::string name : spec.aggregation_key.list) {
+            for (const char* p : prefixes)
+                if (name.compare(0, strlen(p), p) == 0) {
+                    name = std::string("symbol.ref#") + name.substr(strlen(p));
+                    break;
+                }
+
+            if (std::find(ret.aggregation_key.list.begin(), ret.aggregation_key.list.end(), name) == ret.aggregation_key.list.end())
+                ret.aggregation_key.list.push_back(name);
+        }
+
+        return ret;
+    }
+
+    bool is_symbol_ref(cali_id_t attr_id, std::map<cali_id_t, bool>& cache) {
+        auto it = cache.find(attr_id);
+
+        if (it == cache.end())
+            it = cache.emplace(attr_id, m_db.get_attribute(attr_id).name().compare(0, 11, "symbol.ref#") == 0).first;
+
+        return it->second;
+    }
+
+    /// \brief Resolve the symbol references in the records of \a in,
+    ///   filter them, and add them to \a out. Each unique reference path
+    ///   is resolved once.
+    void resolve_symbols(Caliper* c, Aggregator& in, Aggregator& out) {
+        std::map<cali_id_t, bool>             is_ref;
+        std::map<const Node*, EntryList>      resolved;
+
+        unsigned num_resolved = 0;
+
+        in.flush(m_db, [&](CaliperMetadataAccessInterface& db, const EntryList& list) {
+                EntryList rec(list);
+
+                for (const Entry& e : list) {
+                    if (!e.node())
+                        continue;
+
+                    std::vector<const Node*> refs;
+
+                    for (const Node* node = e.node(); node && node->attribute() != CALI_INV_ID; node = node->parent())
+                        if (is_symbol_ref(node->attribute(), is_ref))
+                            refs.push_back(node);
+
+                    if (refs.empty())
+                        continue;
+
+                    // the innermost reference node identifies the reference path
+                    auto it = resolved.find(refs.front());
+
+                    if (it == resolved.end()) {
+                        // re-create the reference nodes in the runtime
+                        // context tree and let symbollookup resolve them
+                        Node* rt_node = nullptr;
+
+                        for (auto rit = refs.rbegin(); rit != refs.rend(); ++rit) {
+                            Attribute attr = c->get_attribute(m_db.get_attribute((*rit)->attribute()).name());
+
+                            if (attr != Attribute::invalid)
+                                rt_node = c->make_tree_entry(attr, (*rit)->data(), rt_node);
+                        }
+
+                        EntryList syms;
+
+                        if (rt_node) {
+                            SnapshotRecord::FixedSnapshotRecord<64> data;
+                            SnapshotRecord snapshot(data);
+
+                            snapshot.append(rt_node);
+                            c->events().resolve_symbols_evt(c, &snapshot);
+
+                            SnapshotRecord::Sizes s = snapshot.size();
+                            SnapshotRecord::Data  d = snapshot.data();
+
+                            // skip the reference node itself
+                            EntryList res =
+                                m_db.merge_snapshot(s.n_nodes - 1, d.node_entries + 1,
+                                                    s.n_immediate, d.immediate_attr, d.immediate_data,
+                                                    *c);
+
+                            syms.swap(res);
+                            ++num_resolved;
+                        }
+
+                        it = resolved.emplace(refs.front(), std::move(syms)).first;
+                    }
+
+                    rec.insert(rec.end(), it->second.begin(), it->second.end());
+                }
+
+                if (m_filter.pass(db, rec))
+                    out.add(db, rec);
+            });
+
+        Log(2).stream() << "mpireport: Resolved " << num_resolved << " symbol reference paths" << std::endl;
+    }
+
+    /// \brief Flush the reduction result \a a into \a fn, resolving
+    ///   symbol references first if needed
+    template<typename F>
+    void flush_result(Caliper* c, F fn) {
+        if (m_resolve_symbols) {
+            Aggregator out(m_spec);
+
+            resolve_symbols(c, m_a, out);
+            out.flush(m_db, fn);
+        } else {
+            m_a.flush(m_db, fn);
+        }
+    }
+
+    /// \brief Split \a comm into the output groups. Returns the group
+    ///   communicator.
+    MPI_Comm make_group_comm(MPI_Comm comm) {
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+
+        MPI_Comm group_comm;
+
+#if MPI_VERSION >= 3
+        if (m_group_size == 0) {
+            MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &group_comm);
+            return group_comm;
+        }
+#endif
+
+        int size = static_cast<int>(m_group_size > 0 ? m_group_size : 1);
+
+        MPI_Comm_split(comm, rank / size, rank, &group_comm);
+
+        return group_comm;
+    }
+
+    /// \brief Aggregate within each group, and let each group leader
+    ///   write its group's partial result in the binary .cali format.
+    ///   Global rank 0 writes an index file listing the group files.
+    void flush_per_group(Caliper* c, const SnapshotRecord* flush_info, MPI_Comm comm) {
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+
+        MPI_Comm group_comm = make_group_comm(comm);
+
+        aggregate_over_mpi(m_db, m_a, group_comm, m_radix, false);
+
+        int group_rank;
+        int group_size;
+
+        MPI_Comm_rank(group_comm, &group_rank);
+        MPI_Comm_size(group_comm, &group_size);
+        MPI_Comm_free(&group_comm);
+
+        MPI_Comm leader_comm;
+        MPI_Comm_split(comm, group_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leader_comm);
+
+        if (leader_comm == MPI_COMM_NULL)
+            return;
+
+        int group;
+        int num_groups;
+
+        MPI_Comm_rank(leader_comm, &group);
+        MPI_Comm_size(leader_comm, &num_groups);
+
+        std::string base = (m_filename.empty() || m_filename == "stdout" || m_filename == "stderr") ?
+            std::string("mpireport") : m_filename;
+
+        unsigned long long num_records = 0;
+
+        {
+            OutputStream stream;
+            stream.set_filename((base + "-" + std::to_string(group) + ".cali").c_str(),
+                                *c, flush_info->to_entrylist());
+
+            BinaryWriter writer(stream);
+
+            flush_result(c, [&writer,&num_records](CaliperMetadataAccessInterface& db, const EntryList& list) {
+                    writer.write_snapshot(db, list);
+                    ++num_records;
+                });
+
+            SnapshotRecord::Sizes s = flush_info->size();
+            SnapshotRecord::Data  d = flush_info->data();
+
+            writer.write_globals(m_db, m_db.merge_snapshot(s.n_nodes,     d.node_entries,
+                                                           s.n_immediate, d.immediate_attr, d.immediate_data,
+                                                           *c));
+            writer.flush();
+        }
+
+        // --- index file
+
+        unsigned long long info[3] = {
+            static_cast<unsigned long long>(rank),
+            static_cast<unsigned long long>(group_size),
+            num_records
+        };
+
+        std::vector<unsigned long long> all_info(group == 0 ? 3*num_groups : 0);
+
+        MPI_Gather(info, 3, MPI_UNSIGNED_LONG_LONG,
+                   all_info.data(), 3, MPI_UNSIGNED_LONG_LONG, 0, leader_comm);
+
+        MPI_Comm_free(&leader_comm);
+
+        if (group != 0)
+            return;
+
+        std::ofstream index(base + ".index");
+
+        if (!index) {
+            Log(0).stream() << "mpireport: could not open index file " << base << ".index" << std::endl;
+            return;
+        }
+
+        for (int g = 0; g < num_groups; ++g)
+            index << "group="    << g
+                  << ",leader="  << all_info[3*g]
+                  << ",ranks="   << all_info[3*g+1]
+                  << ",records=" << all_info[3*g+2]
+                  << ",file="    << base << "-" << g << ".cali"
+                  << std::endl;
+    }
+
     void flush_finish(Caliper* c, const SnapshotRecord* flush_info) {
         MPI_Comm comm;
         MPI_Comm_dup(MPI_COMM_WORLD, &comm);
         int rank;
         MPI_Comm_rank(comm, &rank);
 
+        if (m_per_group) {
+            flush_per_group(c, flush_info, comm);
+            MPI_Comm_free(&comm);
+            return;
+        }
+
         // do the global cross-process aggregation:
         //   aggregate_over_mpi() does all the magic
-        aggregate_over_mpi(m_db, m_a, comm);
+        aggregate_over_mpi(m_db, m_a, comm, m_radix, m_node_local_stage);
 
         MPI_Comm_free(&comm);
 
@@ -109,7 +373,9 @@ class MpiReport
 
             FormatProcessor formatter(m_spec, stream);
 
-            m_a.flush(m_db, formatter);
+            flush_result(c, [&formatter](CaliperMetadataAccessInterface& db, const EntryList& list) {
+                    formatter(db, list);
+                });
             formatter.flush(m_db);
         }
     }
@@ -143,7 +409,27 @@ class MpiReport
             return;
         }
 
-        s_instance.reset(new MpiReport(parser.spec(), config.get("filename").to_string()));
+        std::string mode = config.get("output_mode").to_string();
+
+        if (mode != "global" && mode != "per_group") {
+            int rank;
+            MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+            if (rank == 0)
+                Log(0).stream() << "mpireport: unknown output mode \"" << mode << "\", using \"global\"" << std::endl;
+
+            mode = "global";
+        }
+
+        // with coordinated symbollookup, resolve the symbol references
+        // after the reduction
+        bool resolve_symbols = !c->events().resolve_symbols_evt.empty();
+
+        s_instance.reset(new MpiReport(parser.spec(), resolve_symbols, config.get("filename").to_string(),
+                                       static_cast<int>(config.get("reduction_radix").to_uint()),
+                                       config.get("node_local_stage").to_bool(),
+                                       mode == "per_group",
+                                       config.get("group_size").to_uint()));
     }
 
     static void write_snapshot_cb(Caliper* c, const SnapshotRecord*, const SnapshotRecord* snapshot) {
@@ -166,8 +452,13 @@ class MpiReport
 
 public:
 
-    MpiReport(const QuerySpec& spec, const std::string& filename)
-        : m_spec(spec), m_a(spec), m_filter(spec), m_filename(filename)
+    MpiReport(const QuerySpec& spec, bool resolve_symbols, const std::string& filename, int radix, bool node_local_stage,
+              bool per_group, unsigned group_size)
+        : m_spec(spec), m_resolve_symbols(resolve_symbols),
+          m_a(resolve_symbols ? make_reduction_spec(spec) : spec),
+          m_filter(spec), m_filename(filename),
+          m_radix(radix), m_node_local_stage(node_local_stage),
+          m_per_group(per_group), m_group_size(group_size)
         { }
 
     static void init(Caliper* c) {
@@ -200,6 +491,26 @@ const ConfigSet::Entry     MpiReport::s_configdata[] = {
       "Flush Caliper buffers on MPI_Finalize",
       "Flush Caliper buffers on MPI_Finalize"      
     },
+    { "reduction_radix", CALI_TYPE_UINT, "2",
+      "Fan-in of the cross-process reduction tree",
+      "Fan-in of the cross-process reduction tree (minimum 2)"
+    },
+    { "node_local_stage", CALI_TYPE_BOOL, "true",
+      "Aggregate node-locally before the inter-node reduction",
+      "Aggregate among the processes on each node before the inter-node reduction"
+    },
+    { "output_mode", CALI_TYPE_STRING, "global",
+      "Write one global report, or one partial result file per group",
+      "Output mode. Either one of\n"
+      "   global:    Aggregate across all processes, write one report on rank 0\n"
+      "   per_group: Aggregate within groups of processes, each group leader\n"
+      "              writes its group's result in binary .cali format"
+    },
+    { "group_size", CALI_TYPE_UINT, "0",
+      "Number of processes per group in per_group output mode",
+      "Number of processes per group in per_group output mode.\n"
+      "0: one group per node."
+    },
     ConfigSet::Terminator
 };
 
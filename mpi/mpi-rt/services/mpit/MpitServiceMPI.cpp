@@ -44,9 +44,15 @@
 
 #include <mpi.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
 #include <iterator>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace cali;
@@ -91,6 +97,28 @@ namespace
     unsigned                 num_pvars_read = 0;
     unsigned                 num_pvars_read_error = 0;
 
+    // --- Background sampling
+    //
+    //   In sampling mode, a background thread reads the PVARs periodically
+    // and stores the latest values in sample slots indexed by PVAR index.
+    // Snapshots only read the slots (lock-free) and never call MPI_T.
+
+    struct PvarSample {
+        std::atomic<uint64_t> value;
+        std::atomic<bool>     valid;
+    };
+
+    std::unique_ptr<PvarSample[]> pvar_samples;
+    int                      num_pvar_samples = 0;
+
+    std::mutex               pvar_lock;  ///< Serializes MPI_T calls in sampling mode
+    std::condition_variable  sampler_cv;
+    std::thread              sampler_thread;
+    bool                     sampler_stop = false;
+    std::chrono::milliseconds sample_interval { 0 };
+
+    std::atomic<unsigned>    num_samples { 0 };
+
     //Arrays storing last values of PVARs. This is a hack. Only in place because current MPI implementations do not
     //support resetting of PVARs. So we store last value of pvars and subtract it
     // vector<array <unsigned long long int, MAX_COUNT> > last_value_unsigned_long;
@@ -103,11 +131,114 @@ namespace
           "List of comma-separated PVARs to read",
           "List of comma-separated PVARs to read. Default: all" 
         },
+        { "sample_interval", CALI_TYPE_UINT, "0",
+          "Read PVARs in a background thread every N milliseconds",
+          "Read PVARs in a background thread every N milliseconds.\n"
+          "Snapshots record the latest sampled value instead of calling MPI_T.\n"
+          "0 reads PVARs directly in each snapshot."
+        },
     	ConfigSet::Terminator
     };
 
     int num_pvars = 0;
 
+    void sample_pvars() {
+        std::lock_guard<std::mutex>
+            g(pvar_lock);
+
+        for (const PvarInfo& pvi : pvars) {
+            if (pvi.attr == Attribute::invalid || pvi.index >= num_pvar_samples)
+                continue;
+            if (pvi.handles.empty() || pvi.counts.empty() || pvi.counts[0] != 1)
+                continue;
+
+            unsigned char buf[64] = { 0 };
+            int ret = MPI_T_pvar_read(pvar_session, pvi.handles[0], buf);
+
+            if (ret == MPI_SUCCESS) {
+                uint64_t val = 0;
+                memcpy(&val, buf, sizeof(val));
+
+                pvar_samples[pvi.index].value.store(val, std::memory_order_relaxed);
+                pvar_samples[pvi.index].valid.store(true, std::memory_order_release);
+            }
+        }
+
+        ++num_samples;
+    }
+
+    void sampler_thread_loop() {
+        std::unique_lock<std::mutex> g(pvar_lock);
+
+        while (!sampler_stop) {
+            g.unlock();
+            sample_pvars();
+            g.lock();
+
+            sampler_cv.wait_for(g, sample_interval, [](){ return sampler_stop; });
+        }
+    }
+
+    void start_sampler() {
+        if (sampler_thread.joinable())
+            return;
+
+        int num = 0;
+        MPI_T_pvar_get_num(&num);
+
+        // leave room for PVARs that appear after initialization
+        num_pvar_samples = 2 * num + 64;
+        pvar_samples.reset(new PvarSample[num_pvar_samples]);
+
+        for (int i = 0; i < num_pvar_samples; ++i) {
+            pvar_samples[i].value.store(0);
+            pvar_samples[i].valid.store(false);
+        }
+
+        sampler_thread = std::thread(&sampler_thread_loop);
+
+        Log(1).stream() << "mpit: Sampling PVARs every "
+                        << sample_interval.count() << "ms" << std::endl;
+    }
+
+    void stop_sampler() {
+        if (!sampler_thread.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex>
+                g(pvar_lock);
+
+            sampler_stop = true;
+        }
+
+        sampler_cv.notify_one();
+        sampler_thread.join();
+    }
+
+    void mpi_finalize_cb(Caliper*) {
+        stop_sampler();
+    }
+
+    void sampled_snapshot_cb(Caliper* c, int scope, const SnapshotRecord*, SnapshotRecord* snapshot) {
+        for (const PvarInfo& pvi : pvars) {
+            if (pvi.attr == Attribute::invalid || pvi.index >= num_pvar_samples)
+                continue;
+
+            const PvarSample& sample = pvar_samples[pvi.index];
+
+            if (!sample.valid.load(std::memory_order_acquire))
+                continue;
+
+            uint64_t val = sample.value.load(std::memory_order_relaxed);
+            unsigned char buf[8];
+            memcpy(buf, &val, sizeof(val));
+
+            snapshot->append(pvi.attr.id(), Variant(pvi.attr.type(), buf, 8));
+            ++num_pvars_read;
+        }
+    }
+
     void snapshot_cb(Caliper* c, int scope, const SnapshotRecord*, SnapshotRecord* snapshot) {
         for (const PvarInfo& pvi : pvars) {
             if (pvi.attr == Attribute::invalid)
@@ -581,8 +712,13 @@ namespace
     }
 
     void finish_cb(Caliper*) {
+        stop_sampler();
+
         Log(1).stream() << "mpit: " << num_pvars_read << " PVARs read, " 
                         << num_pvars_read_error << " PVAR read errors." << std::endl;
+
+        if (sample_interval.count() > 0)
+            Log(1).stream() << "mpit: " << num_samples.load() << " background samples taken." << std::endl;
     }
 
     // Register the service and initalize the MPI-T interface
@@ -593,15 +729,28 @@ namespace
     	config = RuntimeConfig::init("mpit", configdata);
 
         util::split(config.get("pvars").to_string(), ',', std::back_inserter(pvar_selection));
-    
+
+        sample_interval = std::chrono::milliseconds(config.get("sample_interval").to_uint());
+
+        // MPI_T calls come from the sampler thread in sampling mode,
+        // serialized through pvar_lock
+        int thread_required =
+            sample_interval.count() > 0 ? MPI_THREAD_SERIALIZED : MPI_THREAD_SINGLE;
+
         /* Initialize MPI_T */
-        int return_val = MPI_T_init_thread(MPI_THREAD_SINGLE, &thread_provided);
+        int return_val = MPI_T_init_thread(thread_required, &thread_provided);
 
         if (return_val != MPI_SUCCESS) {
             Log(0).stream() << "MPI_T_init_thread ERROR: " << return_val << ". MPIT service disabled." << endl;
             return;
         }
 
+        if (thread_provided < thread_required) {
+            Log(0).stream() << "mpit: MPI_T does not support MPI_THREAD_SERIALIZED, "
+                "disabling background sampling." << endl;
+            sample_interval = std::chrono::milliseconds(0);
+        }
+
         /* Track a performance pvar session */
         return_val = MPI_T_pvar_session_create(&pvar_session);
         if (return_val != MPI_SUCCESS) {
@@ -611,7 +760,22 @@ namespace
         		
         do_mpit_allocate_pvar_handles(c);
 
-        c->events().snapshot.connect(&snapshot_cb);
+        if (sample_interval.count() > 0) {
+            int initialized = 0;
+            int finalized   = 0;
+
+            PMPI_Initialized(&initialized);
+            PMPI_Finalized(&finalized);
+
+            if (initialized && !finalized)
+                start_sampler();
+
+            MpiEvents::events.mpi_finalize_evt.connect(::mpi_finalize_cb);
+            c->events().snapshot.connect(&sampled_snapshot_cb);
+        } else {
+            c->events().snapshot.connect(&snapshot_cb);
+        }
+
         c->events().finish_evt.connect(&finish_cb);
 
     	Log(1).stream() << "mpit: MPI-T initialized." << endl;
@@ -620,16 +784,38 @@ namespace
     /*Thin wrapper functions to invoke pvar allocation function from another module*/
     void mpit_allocate_pvar_handles() {
         Caliper c;
+
+        std::lock_guard<std::mutex>
+            g(pvar_lock);
+
         ::do_mpit_allocate_pvar_handles(&c);
     }
 
     void mpit_allocate_bound_pvar_handles(void *handle, int bind) {
         Caliper c;
+
+        std::lock_guard<std::mutex>
+            g(pvar_lock);
+
         ::do_mpit_allocate_bound_pvar_handles(&c, handle, bind);
     }
 
+    void mpi_init_allocate_pvar_handles(Caliper* c) {
+        {
+            std::lock_guard<std::mutex>
+                g(pvar_lock);
+
+            ::do_mpit_allocate_pvar_handles(c);
+        }
+
+        // Only sample between MPI_Init and MPI_Finalize: MPI_T reads can race
+        // with the runtime's own setup and teardown
+        if (sample_interval.count() > 0)
+            start_sampler();
+    }
+
     void mpit_init(Caliper* c) {
-        MpiEvents::events.mpi_init_evt.connect(::do_mpit_allocate_pvar_handles);
+        MpiEvents::events.mpi_init_evt.connect(::mpi_init_allocate_pvar_handles);
 
         ::do_mpit_init(c);
     }
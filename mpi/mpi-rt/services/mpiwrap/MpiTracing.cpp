@@ -35,13 +35,116 @@
 #include "caliper/Caliper.h"
 #include "caliper/SnapshotRecord.h"
 
+#include "caliper/common/Log.h"
+#include "caliper/common/Node.h"
+
 #include <atomic>
+#include <cstring>
+#include <functional>
 #include <mutex>
 #include <numeric>
 #include <unordered_map>
+#include <vector>
 
 using namespace cali;
 
+namespace cali
+{
+
+extern Attribute mpifn_attr;
+extern Attribute mpirank_attr;
+
+}
+
+namespace
+{
+
+/// Key for the statistics-mode tables.
+/// The peer bucket is the floor(log2) bin of the rank distance between this
+/// process and the peer in the communicator, plus one (0 is the process
+/// itself); -1 for collectives and calls without a message. The size bin is
+/// the floor(log2) bin of the message size in bytes, plus one (0 is empty).
+struct StatsKey {
+    const char* fn;
+    Node*       comm_node;
+    int         peer_bucket;
+    int         size_bin;
+
+    bool operator == (const StatsKey& k) const {
+        return fn == k.fn && comm_node == k.comm_node && peer_bucket == k.peer_bucket && size_bin == k.size_bin;
+    }
+};
+
+struct StatsKeyHash {
+    size_t operator()(const StatsKey& k) const {
+        size_t h = std::hash<const void*>()(k.fn);
+
+        h ^= std::hash<const void*>()(k.comm_node) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        h ^= std::hash<int>()(k.peer_bucket * 64 + k.size_bin) + 0x9e3779b9 + (h << 6) + (h >> 2);
+
+        return h;
+    }
+};
+
+struct StatsValue {
+    uint64_t count { 0 };
+    uint64_t bytes { 0 };
+    Node*    node  { nullptr }; ///< Context node for the key
+};
+
+struct StatsTable {
+    std::unordered_map<StatsKey, StatsValue, StatsKeyHash> entries;
+    std::mutex                                             lock;
+};
+
+/// Key for the communication matrix tables: the peer's rank in
+/// MPI_COMM_WORLD, the direction, and the floor(log2) message size bin
+/// plus one.
+struct MatrixKey {
+    int peer;
+    int is_send;
+    int size_bin;
+
+    bool operator == (const MatrixKey& k) const {
+        return peer == k.peer && is_send == k.is_send && size_bin == k.size_bin;
+    }
+};
+
+struct MatrixKeyHash {
+    size_t operator()(const MatrixKey& k) const {
+        return std::hash<int>()((k.peer * 2 + k.is_send) * 64 + k.size_bin);
+    }
+};
+
+struct MatrixTable {
+    std::unordered_map<MatrixKey, StatsValue, MatrixKeyHash> entries;
+    std::mutex                                               lock;
+};
+
+inline int
+log2_bin(uint64_t val)
+{
+    int bin = 0;
+
+    for ( ; val; val >>= 1)
+        ++bin;
+
+    return bin;
+}
+
+/// Lower bound of a log2 bin
+inline int
+bin_min(int bin)
+{
+    return bin > 0 ? (1 << (bin-1)) : 0;
+}
+
+// The MPI function and message flag of the current call in statistics mode
+thread_local const char* t_stats_fn           = nullptr;
+thread_local bool        t_stats_msg_recorded = false;
+
+} // namespace [anonymous]
+
 
 struct MpiTracing::MpiTracingImpl
 {        
@@ -62,6 +165,17 @@ struct MpiTracing::MpiTracingImpl
     Attribute comm_is_world_attr;
     Attribute comm_list_attr;
     Attribute comm_size_attr;
+
+    Attribute stats_count_attr;
+    Attribute stats_bytes_attr;
+    Attribute stats_peer_attr;
+    Attribute stats_size_attr;
+
+    Attribute matrix_peer_attr;
+    Attribute matrix_op_attr;
+    Attribute matrix_size_attr;
+    Attribute matrix_count_attr;
+    Attribute matrix_bytes_attr;
     
     // --- MPI object mappings
     //
@@ -79,6 +193,7 @@ struct MpiTracing::MpiTracingImpl
         MPI_Datatype type;
         int          size;
 
+        MPI_Comm     comm;
         Node*        comm_node;
     };
 
@@ -99,6 +214,279 @@ struct MpiTracing::MpiTracingImpl
 
     std::atomic<uint64_t>                     call_id;
 
+    // --- Statistics mode
+    //
+
+    bool                                      stats_mode;
+
+    std::vector<StatsTable*>                  stats_tables; ///< Tables of all threads
+    std::mutex                                stats_tables_lock;
+
+    StatsTable* acquire_stats_table() {
+        static thread_local StatsTable* t_table = nullptr;
+
+        if (!t_table) {
+            t_table = new StatsTable;
+
+            std::lock_guard<std::mutex>
+                g(stats_tables_lock);
+
+            stats_tables.push_back(t_table);
+        }
+
+        return t_table;
+    }
+
+    // Create the context tree path for the given stats key. This is done
+    // once per key when it is first encountered: creating tree nodes is not
+    // safe during the flush at program exit.
+    Node* make_stats_node(Caliper* c, const StatsKey& key) {
+        Node* node = key.comm_node;
+
+        if (key.peer_bucket >= 0)
+            node = c->make_tree_entry(stats_peer_attr, Variant(bin_min(key.peer_bucket)), node);
+
+        node = c->make_tree_entry(stats_size_attr, Variant(bin_min(key.size_bin)), node);
+
+        return c->make_tree_entry(mpifn_attr,
+                                  Variant(CALI_TYPE_STRING, key.fn, strlen(key.fn)),
+                                  node);
+    }
+
+    void record_stats(Caliper* c, Node* comm_node, int peer_bucket, int size) {
+        if (!t_stats_fn)
+            return;
+
+        StatsKey key { t_stats_fn, comm_node, peer_bucket, log2_bin(static_cast<uint64_t>(size)) };
+
+        StatsTable* table = acquire_stats_table();
+
+        {
+            std::lock_guard<std::mutex>
+                g(table->lock);
+
+            StatsValue& val = table->entries[key];
+
+            if (!val.node)
+                val.node = make_stats_node(c, key);
+
+            ++val.count;
+            val.bytes += static_cast<uint64_t>(size);
+        }
+
+        t_stats_msg_recorded = true;
+    }
+
+    void record_p2p_stats(Caliper* c, int peer, int size, MPI_Comm comm, Node* comm_node) {
+        int rank = 0;
+        PMPI_Comm_rank(comm, &rank);
+
+        int dist = (peer >= 0 ? (peer > rank ? peer - rank : rank - peer) : -1);
+
+        record_stats(c, comm_node, dist >= 0 ? log2_bin(static_cast<uint64_t>(dist)) : -1, size);
+    }
+
+    void init_stats(Caliper* c) {
+        Attribute aggr_class_attr = c->get_attribute("class.aggregatable");
+        Variant   v_true(true);
+
+        stats_count_attr =
+            c->create_attribute("mpi.stats.count", CALI_TYPE_UINT,
+                                CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+                                1, &aggr_class_attr, &v_true);
+        stats_bytes_attr =
+            c->create_attribute("mpi.stats.bytes", CALI_TYPE_UINT,
+                                CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+                                1, &aggr_class_attr, &v_true);
+        stats_peer_attr  =
+            c->create_attribute("mpi.stats.peer.distance", CALI_TYPE_INT,
+                                CALI_ATTR_SKIP_EVENTS);
+        stats_size_attr  =
+            c->create_attribute("mpi.stats.size.bin", CALI_TYPE_INT,
+                                CALI_ATTR_SKIP_EVENTS);
+
+        stats_mode = true;
+    }
+
+    void flush_stats(Caliper* c, Caliper::SnapshotFlushFn proc_fn) {
+        std::lock_guard<std::mutex>
+            g(stats_tables_lock);
+
+        size_t num_written = 0;
+
+        for (StatsTable* table : stats_tables) {
+            std::lock_guard<std::mutex>
+                g(table->lock);
+
+            for (auto &p : table->entries) {
+                Node* node = p.second.node;
+
+                cali_id_t attr[2] = { stats_count_attr.id(),       stats_bytes_attr.id()       };
+                Variant   data[2] = { Variant(p.second.count), Variant(p.second.bytes) };
+
+                SnapshotRecord rec(1, &node, 2, attr, data);
+                proc_fn(&rec);
+
+                ++num_written;
+            }
+        }
+
+        Log(1).stream() << "mpiwrap: Wrote " << num_written << " message statistics records." << std::endl;
+    }
+
+    void clear_stats() {
+        std::lock_guard<std::mutex>
+            g(stats_tables_lock);
+
+        for (StatsTable* table : stats_tables) {
+            std::lock_guard<std::mutex>
+                g(table->lock);
+
+            table->entries.clear();
+        }
+    }
+
+    static void flush_stats_cb(Caliper* c, const SnapshotRecord*, Caliper::SnapshotFlushFn proc_fn);
+    static void clear_stats_cb(Caliper* c);
+
+    // --- Communication matrix mode
+    //
+
+    bool                                      matrix_mode;
+
+    std::vector<MatrixTable*>                 matrix_tables; ///< Tables of all threads
+    std::mutex                                matrix_tables_lock;
+
+    MatrixTable* acquire_matrix_table() {
+        static thread_local MatrixTable* t_table = nullptr;
+
+        if (!t_table) {
+            t_table = new MatrixTable;
+
+            std::lock_guard<std::mutex>
+                g(matrix_tables_lock);
+
+            matrix_tables.push_back(t_table);
+        }
+
+        return t_table;
+    }
+
+    /// \brief Translate \a rank in the communicator of \a comm_node into
+    ///   its rank in MPI_COMM_WORLD, using the communicator's rank list
+    int world_rank(const Node* comm_node, int rank) {
+        for (const Node* node = comm_node; node; node = node->parent())
+            if (node->attribute() == comm_list_attr.id()) {
+                const int* ranks = static_cast<const int*>(node->data().data());
+                size_t     num   = node->data().size() / sizeof(int);
+
+                return static_cast<size_t>(rank) < num ? ranks[rank] : -1;
+            }
+
+        return rank;
+    }
+
+    void record_matrix(Caliper* c, bool is_send, int peer, int size, Node* comm_node) {
+        if (peer < 0) // MPI_PROC_NULL, MPI_ANY_SOURCE
+            return;
+
+        MatrixKey key { world_rank(comm_node, peer), is_send ? 1 : 0, log2_bin(static_cast<uint64_t>(size)) };
+
+        if (key.peer < 0)
+            return;
+
+        MatrixTable* table = acquire_matrix_table();
+
+        std::lock_guard<std::mutex>
+            g(table->lock);
+
+        StatsValue& val = table->entries[key];
+
+        // As in statistics mode, create the tree path when the key is new
+        if (!val.node) {
+            Node* node = c->make_tree_entry(matrix_peer_attr, Variant(key.peer));
+
+            node = c->make_tree_entry(matrix_op_attr,
+                                      Variant(CALI_TYPE_STRING, is_send ? "send" : "recv", 4),
+                                      node);
+            val.node = c->make_tree_entry(matrix_size_attr, Variant(bin_min(key.size_bin)), node);
+        }
+
+        ++val.count;
+        val.bytes += static_cast<uint64_t>(size);
+    }
+
+    void init_matrix(Caliper* c) {
+        Attribute aggr_class_attr = c->get_attribute("class.aggregatable");
+        Variant   v_true(true);
+
+        matrix_count_attr =
+            c->create_attribute("mpi.matrix.count", CALI_TYPE_UINT,
+                                CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+                                1, &aggr_class_attr, &v_true);
+        matrix_bytes_attr =
+            c->create_attribute("mpi.matrix.bytes", CALI_TYPE_UINT,
+                                CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+                                1, &aggr_class_attr, &v_true);
+        matrix_peer_attr  =
+            c->create_attribute("mpi.matrix.peer", CALI_TYPE_INT,  CALI_ATTR_SKIP_EVENTS);
+        matrix_op_attr    =
+            c->create_attribute("mpi.matrix.op", CALI_TYPE_STRING, CALI_ATTR_SKIP_EVENTS);
+        matrix_size_attr  =
+            c->create_attribute("mpi.matrix.size.bin", CALI_TYPE_INT, CALI_ATTR_SKIP_EVENTS);
+
+        matrix_mode = true;
+    }
+
+    void flush_matrix(Caliper* c, Caliper::SnapshotFlushFn proc_fn) {
+        // The records carry our rank so that mpireport can build the
+        // rank-by-rank matrix
+        Variant rank = c->get(mpirank_attr).value();
+
+        std::lock_guard<std::mutex>
+            g(matrix_tables_lock);
+
+        size_t num_written = 0;
+
+        for (MatrixTable* table : matrix_tables) {
+            std::lock_guard<std::mutex>
+                g(table->lock);
+
+            for (auto &p : table->entries) {
+                Node* node = p.second.node;
+
+                cali_id_t attr[3] = {
+                    matrix_count_attr.id(),  matrix_bytes_attr.id(),  mpirank_attr.id()
+                };
+                Variant   data[3] = {
+                    Variant(p.second.count), Variant(p.second.bytes), rank
+                };
+
+                SnapshotRecord rec(1, &node, rank.empty() ? 2 : 3, attr, data);
+                proc_fn(&rec);
+
+                ++num_written;
+            }
+        }
+
+        Log(1).stream() << "mpiwrap: Wrote " << num_written << " communication matrix records." << std::endl;
+    }
+
+    void clear_matrix() {
+        std::lock_guard<std::mutex>
+            g(matrix_tables_lock);
+
+        for (MatrixTable* table : matrix_tables) {
+            std::lock_guard<std::mutex>
+                g(table->lock);
+
+            table->entries.clear();
+        }
+    }
+
+    static void flush_matrix_cb(Caliper* c, const SnapshotRecord*, Caliper::SnapshotFlushFn proc_fn);
+    static void clear_matrix_cb(Caliper* c);
+
     
     // --- initialization
     //
@@ -206,7 +594,14 @@ struct MpiTracing::MpiTracingImpl
     // --- point-to-point
     //
 
-    void push_send_event(Caliper* c, int size, int dest, int tag, cali::Node* comm_node) {
+    void push_send_event(Caliper* c, int size, int dest, int tag, MPI_Comm comm, cali::Node* comm_node) {
+        if (matrix_mode)
+            record_matrix(c, true, dest, size, comm_node);
+        if (stats_mode)
+            record_p2p_stats(c, dest, size, comm, comm_node);
+        if (matrix_mode || stats_mode)
+            return;
+
         cali_id_t attr[3] = {
             msg_dst_attr.id(), msg_tag_attr.id(), msg_size_attr.id()
         };
@@ -227,6 +622,7 @@ struct MpiTracing::MpiTracingImpl
         info.tag           = tag;
         info.count         = count;
         info.type          = type;
+        info.comm          = comm;
         info.comm_node     = lookup_comm(c, comm);
         
         PMPI_Type_size(type, &info.size);
@@ -238,7 +634,14 @@ struct MpiTracing::MpiTracingImpl
         req_map[*req] = info;            
     }
 
-    void push_recv_event(Caliper* c, int src, int size, int tag, Node* comm_node) {
+    void push_recv_event(Caliper* c, int src, int size, int tag, MPI_Comm comm, Node* comm_node) {
+        if (matrix_mode)
+            record_matrix(c, false, src, size, comm_node);
+        if (stats_mode)
+            record_p2p_stats(c, src, size, comm, comm_node);
+        if (matrix_mode || stats_mode)
+            return;
+
         cali_id_t attr[3] = {
             msg_src_attr.id(), msg_tag_attr.id(), msg_size_attr.id()
         };
@@ -256,7 +659,7 @@ struct MpiTracing::MpiTracingImpl
         int count = 0;
         PMPI_Get_count(status, type, &count);
         
-        push_recv_event(c, status->MPI_SOURCE, size*count, status->MPI_TAG, lookup_comm(c, comm));
+        push_recv_event(c, status->MPI_SOURCE, size*count, status->MPI_TAG, comm, lookup_comm(c, comm));
     }
 
     void handle_irecv(Caliper* c, int count, MPI_Datatype type, int src, int tag, MPI_Comm comm, MPI_Request* req) {
@@ -268,6 +671,7 @@ struct MpiTracing::MpiTracingImpl
         info.tag           = tag;
         info.type          = type;
         info.count         = count;
+        info.comm          = comm;
         info.comm_node     = lookup_comm(c, comm);
         
         std::lock_guard<std::mutex>
@@ -285,6 +689,7 @@ struct MpiTracing::MpiTracingImpl
         info.tag           = tag;
         info.type          = type;
         info.count         = count;
+        info.comm          = comm;
         info.comm_node     = lookup_comm(c, comm);
         info.size          = 0;
         
@@ -307,7 +712,7 @@ struct MpiTracing::MpiTracingImpl
             RequestInfo info = it->second;
 
             if (info.op == RequestInfo::Send)
-                push_send_event(c, info.size, info.target, info.tag, info.comm_node);
+                push_send_event(c, info.size, info.target, info.tag, info.comm, info.comm_node);
         }
     }
     
@@ -329,7 +734,7 @@ struct MpiTracing::MpiTracingImpl
                 int count = 0;
                 PMPI_Get_count(statuses+i, info.type, &count);
 
-                push_recv_event(c, statuses[i].MPI_SOURCE, size*count, statuses[i].MPI_TAG, info.comm_node);
+                push_recv_event(c, statuses[i].MPI_SOURCE, size*count, statuses[i].MPI_TAG, info.comm, info.comm_node);
             }
             
             if (!info.is_persistent)
@@ -348,6 +753,11 @@ struct MpiTracing::MpiTracingImpl
     //
 
     void push_coll_event(Caliper* c, CollectiveType coll_type, int size, int root, Node* comm_node) {
+        if (stats_mode)
+            record_stats(c, comm_node, -1, size);
+        if (matrix_mode || stats_mode)
+            return;
+
         cali_id_t attr[2] = { msg_size_attr.id(), coll_root_attr.id() };
         Variant   data[2] = { Variant(size),      Variant(root)       };
 
@@ -369,10 +779,53 @@ struct MpiTracing::MpiTracingImpl
     
     MpiTracingImpl()
         : comm_id(0),
-          call_id(0)
+          call_id(0),
+          stats_mode(false),
+          matrix_mode(false)
     { }
+
+    ~MpiTracingImpl() {
+        for (StatsTable* table : stats_tables)
+            delete table;
+        for (MatrixTable* table : matrix_tables)
+            delete table;
+    }
+
+    static MpiTracingImpl* s_stats_instance;
+    static MpiTracingImpl* s_matrix_instance;
 };
 
+MpiTracing::MpiTracingImpl* MpiTracing::MpiTracingImpl::s_stats_instance  = nullptr;
+MpiTracing::MpiTracingImpl* MpiTracing::MpiTracingImpl::s_matrix_instance = nullptr;
+
+void
+MpiTracing::MpiTracingImpl::flush_stats_cb(Caliper* c, const SnapshotRecord*, Caliper::SnapshotFlushFn proc_fn)
+{
+    if (s_stats_instance)
+        s_stats_instance->flush_stats(c, proc_fn);
+}
+
+void
+MpiTracing::MpiTracingImpl::clear_stats_cb(Caliper*)
+{
+    if (s_stats_instance)
+        s_stats_instance->clear_stats();
+}
+
+void
+MpiTracing::MpiTracingImpl::flush_matrix_cb(Caliper* c, const SnapshotRecord*, Caliper::SnapshotFlushFn proc_fn)
+{
+    if (s_matrix_instance)
+        s_matrix_instance->flush_matrix(c, proc_fn);
+}
+
+void
+MpiTracing::MpiTracingImpl::clear_matrix_cb(Caliper*)
+{
+    if (s_matrix_instance)
+        s_matrix_instance->clear_matrix();
+}
+
 
 MpiTracing::MpiTracing()
     : mP(new MpiTracingImpl)
@@ -380,6 +833,11 @@ MpiTracing::MpiTracing()
 
 MpiTracing::~MpiTracing()
 {
+    if (MpiTracingImpl::s_stats_instance == mP.get())
+        MpiTracingImpl::s_stats_instance = nullptr;
+    if (MpiTracingImpl::s_matrix_instance == mP.get())
+        MpiTracingImpl::s_matrix_instance = nullptr;
+
     mP.reset();
 }
 
@@ -395,6 +853,44 @@ MpiTracing::init_mpi(Caliper* c)
     mP->init_mpi(c);
 }
 
+void
+MpiTracing::enable_stats(Caliper* c)
+{
+    mP->init_stats(c);
+
+    MpiTracingImpl::s_stats_instance = mP.get();
+
+    c->events().flush_evt.connect(&MpiTracingImpl::flush_stats_cb);
+    c->events().clear_evt.connect(&MpiTracingImpl::clear_stats_cb);
+}
+
+void
+MpiTracing::enable_matrix(Caliper* c)
+{
+    mP->init_matrix(c);
+
+    MpiTracingImpl::s_matrix_instance = mP.get();
+
+    c->events().flush_evt.connect(&MpiTracingImpl::flush_matrix_cb);
+    c->events().clear_evt.connect(&MpiTracingImpl::clear_matrix_cb);
+}
+
+void
+MpiTracing::begin_stats_call(const char* fn)
+{
+    t_stats_fn           = fn;
+    t_stats_msg_recorded = false;
+}
+
+void
+MpiTracing::end_stats_call(Caliper* c)
+{
+    if (!t_stats_msg_recorded)
+        mP->record_stats(c, nullptr, -1, 0);
+
+    t_stats_fn = nullptr;
+}
+
 void
 MpiTracing::handle_send(Caliper* c, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm)
 {
@@ -402,7 +898,7 @@ MpiTracing::handle_send(Caliper* c, int count, MPI_Datatype type, int dest, int
     PMPI_Type_size(type, &size);
     size *= count;
 
-    mP->push_send_event(c, size, dest, tag, mP->lookup_comm(c, comm));
+    mP->push_send_event(c, size, dest, tag, comm, mP->lookup_comm(c, comm));
 }
 
 void
@@ -499,11 +995,13 @@ MpiTracing::handle_finalize(Caliper* c)
 void
 MpiTracing::push_call_id(Caliper* c)
 {
-    c->begin(mP->call_id_attr, ++(mP->call_id));
+    if (!mP->stats_mode && !mP->matrix_mode)
+        c->begin(mP->call_id_attr, ++(mP->call_id));
 }
 
 void
 MpiTracing::pop_call_id(Caliper* c)
 {
-    c->end(mP->call_id_attr);
+    if (!mP->stats_mode && !mP->matrix_mode)
+        c->end(mP->call_id_attr);
 }
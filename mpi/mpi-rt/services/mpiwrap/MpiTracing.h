@@ -62,6 +62,28 @@ public:
     void init(Caliper* c);
     void init_mpi(Caliper* c);
 
+    /// \brief Switch to statistics mode.
+    ///
+    /// In statistics mode, messages are not recorded as individual
+    /// snapshots but accumulated in thread-local tables keyed by
+    /// (function, communicator, peer bucket, message size bin), which
+    /// are written out at flush time.
+    void enable_stats(Caliper* c);
+
+    /// \brief Switch to communication matrix mode.
+    ///
+    /// In matrix mode, point-to-point messages are not recorded as
+    /// individual snapshots but accumulated in thread-local tables keyed
+    /// by (peer rank in MPI_COMM_WORLD, send/receive, message size bin),
+    /// which are written out with the process's rank at flush time.
+    void enable_matrix(Caliper* c);
+
+    /// \brief Set the MPI function the following messages are attributed to
+    ///   in statistics mode.
+    void begin_stats_call(const char* fn);
+    /// \brief Count the current call if it did not record any messages.
+    void end_stats_call(Caliper* c);
+
     void push_call_id(Caliper* c);
     void pop_call_id(Caliper* c);
 
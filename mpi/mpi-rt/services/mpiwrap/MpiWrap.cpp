@@ -49,6 +49,8 @@ Attribute mpisize_attr { Attribute::invalid };
 Attribute mpicall_attr { Attribute::invalid };
 
 bool      enable_msg_tracing = false;
+bool      enable_msg_stats   = false;
+bool      enable_msg_matrix  = false;
 
 extern void mpiwrap_init(Caliper* c, const std::string&, const std::string&);
 
@@ -73,6 +75,18 @@ ConfigSet::Entry configdata[] = {
       "Enable MPI message tracing",
       "Enable MPI message tracing"
     },
+    { "msg_stats", CALI_TYPE_BOOL, "false",
+      "Accumulate MPI call and message statistics instead of tracing",
+      "Keep per-(function, communicator, peer distance, message size) call and byte\n"
+      "counts in thread-local tables instead of creating Caliper regions and snapshots\n"
+      "for each MPI call. The tables are written out at flush time."
+    },
+    { "msg_matrix", CALI_TYPE_BOOL, "false",
+      "Accumulate a point-to-point communication matrix instead of tracing messages",
+      "Count point-to-point messages and bytes per (peer rank, send/receive, message\n"
+      "size) in thread-local tables instead of creating a snapshot for each message.\n"
+      "The tables are written out at flush time, e.g. for reduction with mpireport."
+    },
     ConfigSet::Terminator
 };
 
@@ -81,8 +95,18 @@ void mpi_register(Caliper* c)
     config = RuntimeConfig::init("mpi", configdata);
 
     enable_msg_tracing = config.get("msg_tracing").to_bool();
-
-    if (enable_msg_tracing)
+    enable_msg_stats   = config.get("msg_stats").to_bool();
+    enable_msg_matrix  = config.get("msg_matrix").to_bool();
+
+    if (enable_msg_stats || enable_msg_matrix) {
+        if (enable_msg_stats)
+            Log(1).stream() << "MPI wrapper: enabling message statistics\n";
+        if (enable_msg_matrix)
+            Log(1).stream() << "MPI wrapper: enabling communication matrix\n";
+
+        // message statistics and the matrix use the message tracing hooks
+        enable_msg_tracing = true;
+    } else if (enable_msg_tracing)
         Log(1).stream() << "MPI wrapper: enabling message tracing\n";
 
     mpifn_attr   = 
@@ -12,6 +12,7 @@
 #include <mpi.h>
 
 #include <algorithm>
+#include <cctype>
 #include <cstring>
 #include <iterator>
 #include <numeric>
@@ -25,6 +26,8 @@ extern Attribute   mpirank_attr;
 extern Attribute   mpisize_attr;
 
 extern bool        enable_msg_tracing;
+extern bool        enable_msg_stats;
+extern bool        enable_msg_matrix;
 
 }
 
@@ -34,13 +37,96 @@ using namespace std;
 namespace 
 {
 
-bool       enable_wrapper = false;
 MpiTracing tracing;
 
-{{forallfn foo}}
-bool enable_{{foo}} = false;
-{{endforallfn}}
+// Wrapper IDs and per-wrapper enable flags. The filter is resolved once at
+// initialization; a disabled wrapper costs a single flag test.
 
+enum MpiWrapperId {
+    {{forallfn foo}}
+    wrapper_id_{{foo}},
+    {{endforallfn}}
+    MPIWRAP_NUM_WRAPPERS
+};
+
+bool enabled_wrappers[MPIWRAP_NUM_WRAPPERS] = { false };
+
+const char* wrapper_names[MPIWRAP_NUM_WRAPPERS] = {
+    {{forallfn foo}}
+    "{{foo}}",
+    {{endforallfn}}
+};
+
+// MPI function groups that can be used in the whitelist/blacklist
+
+const struct MpiFunctionGroup {
+    const char*  name;
+    const char*  patterns[24];
+} function_groups[] = {
+    { "p2p",
+      { "MPI_*send", "MPI_*send_init", "MPI_*recv", "MPI_Recv_init", "MPI_Sendrecv*",
+        "MPI_Start", "MPI_Startall", "MPI_Wait*", "MPI_Test", "MPI_Testall", "MPI_Testany",
+        "MPI_Testsome", "MPI_*probe", "MPI_Request_free", "MPI_Cancel", 0 }
+    },
+    { "collective",
+      { "MPI_Barrier", "MPI_Ibarrier", "MPI_*bcast", "MPI_*gather*", "MPI_*scatter*",
+        "MPI_Reduce", "MPI_Ireduce", "MPI_*allreduce", "MPI_*reduce_scatter*",
+        "MPI_*scan", "MPI_*alltoall*", "MPI_*neighbor_*", 0 }
+    },
+    { "onesided",
+      { "MPI_Put", "MPI_Rput", "MPI_Get", "MPI_Rget", "MPI_*accumulate",
+        "MPI_Compare_and_swap", "MPI_Win_*", 0 }
+    },
+    { 0, { 0 } }
+};
+
+/// \brief Match \a str against glob-style pattern \a pattern.
+///   '*' matches any sequence of characters, '?' a single character.
+///   Matching is case-insensitive, as MPI function name capitalization
+///   varies between C and Fortran conventions.
+bool glob_match(const char* pattern, const char* str)
+{
+    const char* star = nullptr;
+    const char* back = nullptr;
+
+    while (*str) {
+        if (*pattern == '*') {
+            star = ++pattern;
+            back = str;
+        } else if (*pattern == '?' || tolower(*pattern) == tolower(*str)) {
+            ++pattern;
+            ++str;
+        } else if (star) {
+            pattern = star;
+            str     = ++back;
+        } else {
+            return false;
+        }
+    }
+
+    while (*pattern == '*')
+        ++pattern;
+
+    return *pattern == 0;
+}
+
+/// \brief Check if the MPI function \a fn matches a filter list entry.
+///   An entry can be a function group name, a glob pattern, or a function name.
+bool filter_match(const std::string& entry, const char* fn)
+{
+    for (const MpiFunctionGroup* g = function_groups; g->name; ++g)
+        if (entry == g->name) {
+            for (const char* const* p = g->patterns; *p; ++p)
+                if (glob_match(*p, fn))
+                    return true;
+
+            return false;
+        }
+
+    return glob_match(entry.c_str(), fn);
+}
+
+/// \brief Resolve the whitelist/blacklist into the enabled_wrappers table.
 void setup_filter(const std::string& whitelist_string, const std::string& blacklist_string) {
     std::vector<std::string> whitelist =
         StringConverter(whitelist_string).to_stringlist(",:");
@@ -60,46 +146,54 @@ void setup_filter(const std::string& whitelist_string, const std::string& blackl
         whitelist.erase(whitelist.begin());
     }
 
-    const struct fntable_elem {
-        const char* name;
-        bool*       enableptr; 
-    } table[] = {
-        {{forallfn foo}}
-        { "{{foo}}", &enable_{{foo}} },
-        {{endforallfn}}
-        { 0, 0 }
-    };
-
-    for (const fntable_elem* e = table; e->name && e->enableptr; ++e) {
-        if (enable_all)
-            *(e->enableptr) = true;
-
-        std::string fnstr(e->name);
+    std::vector<bool> whitelist_used(whitelist.size(), false);
+    std::vector<bool> blacklist_used(blacklist.size(), false);
 
-        if (have_whitelist) {
-            vector<string>::iterator it = std::find(whitelist.begin(), whitelist.end(), fnstr);
+    for (int id = 0; id < MPIWRAP_NUM_WRAPPERS; ++id) {
+        const char* fn = wrapper_names[id];
+        bool enable    = enable_all || !have_whitelist;
 
-            if (it != whitelist.end()) {
-                *(e->enableptr) = true;
-                whitelist.erase(it);
+        for (size_t i = 0; i < whitelist.size(); ++i)
+            if (filter_match(whitelist[i], fn)) {
+                enable = true;
+                whitelist_used[i] = true;
             }
-        }
-        if (have_blacklist) {
-            vector<string>::iterator it = std::find(blacklist.begin(), blacklist.end(), fnstr);
-
-            if (it != blacklist.end()) {
-                blacklist.erase(it);
-                *(e->enableptr) = false;
-            } else if (!have_whitelist) {
-                *(e->enableptr) = true;
+        for (size_t i = 0; i < blacklist.size(); ++i)
+            if (filter_match(blacklist[i], fn)) {
+                enable = false;
+                blacklist_used[i] = true;
             }
-        }
+
+        enabled_wrappers[id] = enable;
     }
 
-    for (vector<string>::const_iterator it = whitelist.begin(); it != whitelist.end(); ++it)
-        Log(1).stream() << "Unknown MPI function " << *it << " in MPI function whitelist" << endl;
-    for (vector<string>::const_iterator it = blacklist.begin(); it != blacklist.end(); ++it)
-        Log(1).stream() << "Unknown MPI function " << *it << " in MPI function blacklist" << endl;
+    for (size_t i = 0; i < whitelist.size(); ++i)
+        if (!whitelist_used[i])
+            Log(1).stream() << "Unknown MPI function " << whitelist[i] << " in MPI function whitelist" << endl;
+    for (size_t i = 0; i < blacklist.size(); ++i)
+        if (!blacklist_used[i])
+            Log(1).stream() << "Unknown MPI function " << blacklist[i] << " in MPI function blacklist" << endl;
+}
+
+// Begin/end the mpi.function region for a wrapped call. In message
+// statistics mode, only count the call instead.
+
+inline void
+begin_mpi_function(Caliper* c, const char* name)
+{
+    if (enable_msg_stats)
+        ::tracing.begin_stats_call(name);
+    else
+        c->begin(mpifn_attr, Variant(CALI_TYPE_STRING, name, strlen(name)));
+}
+
+inline void
+end_mpi_function(Caliper* c)
+{
+    if (enable_msg_stats)
+        ::tracing.end_stats_call(c);
+    else
+        c->end(mpifn_attr);
 }
 
 void
@@ -138,21 +232,21 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Send MPI_Bsend MPI_Rsend MPI_Ssend MPI_Isend MPI_Ibsend MPI_Irsend MPI_Issend}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
         
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));        
+        ::begin_mpi_function(&c, "{{func}}");
 
         {{callfn}}
 
         if (enable_msg_tracing)
             ::tracing.handle_send(&c, {{1}}, {{2}}, {{3}}, {{4}}, {{5}});
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
 
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -165,21 +259,21 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Send_init MPI_Bsend_init MPI_Rsend_init MPI_Ssend_init}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
         
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));        
+        ::begin_mpi_function(&c, "{{func}}");
 
         {{callfn}}
 
         if (enable_msg_tracing)
             ::tracing.handle_send_init(&c, {{1}}, {{2}}, {{3}}, {{4}}, {{5}}, {{6}});
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
 
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -192,14 +286,14 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Recv}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
         
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
 
         MPI_Status tmp_status;
         
@@ -211,7 +305,7 @@ post_init_cb(Caliper* c)
         if (enable_msg_tracing)
             ::tracing.handle_recv(&c, {{1}}, {{2}}, {{3}}, {{4}}, {{5}}, {{6}});
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
 
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);        
@@ -224,14 +318,14 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Sendrecv}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
         
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
 
         MPI_Status tmp_status;
         
@@ -245,7 +339,7 @@ post_init_cb(Caliper* c)
             ::tracing.handle_recv(&c, {{6}}, {{7}}, {{8}}, {{9}}, {{10}}, {{11}});
         }
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
 
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);        
@@ -258,14 +352,14 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Sendrecv_replace}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
         
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
 
         MPI_Status tmp_status;
         
@@ -279,7 +373,7 @@ post_init_cb(Caliper* c)
             ::tracing.handle_recv(&c, {{1}}, {{2}}, {{5}}, {{6}}, {{7}}, {{8}});
         }
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
 
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);        
@@ -292,20 +386,20 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Irecv}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
         
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
         
         if (enable_msg_tracing)
             ::tracing.handle_irecv(&c, {{1}}, {{2}}, {{3}}, {{4}}, {{5}}, {{6}});
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
 
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -318,20 +412,20 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Recv_init}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
         
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
         
         if (enable_msg_tracing)
             ::tracing.handle_recv_init(&c, {{1}}, {{2}}, {{3}}, {{4}}, {{5}}, {{6}});
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
 
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -344,21 +438,21 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Start}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         
         {{callfn}}
         
         if (enable_msg_tracing)
             ::tracing.handle_start(&c, 1, {{0}});
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -371,21 +465,21 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Startall}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         
         {{callfn}}
         
         if (enable_msg_tracing)
             ::tracing.handle_start(&c, {{0}}, {{1}});
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -398,7 +492,7 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Wait}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
@@ -411,14 +505,14 @@ post_init_cb(Caliper* c)
         if ({{1}} == MPI_STATUS_IGNORE)
             {{1}} = &tmp_status;
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         
         {{callfn}}
         
         if (enable_msg_tracing)
             ::tracing.handle_completion(&c, 1, &tmp_req, {{1}});
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -431,7 +525,7 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Waitall}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
@@ -452,14 +546,14 @@ post_init_cb(Caliper* c)
                 {{2}} = tmp_statuses;
         }
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         
         {{callfn}}
         
         if (enable_msg_tracing)
             ::tracing.handle_completion(&c, nreq, tmp_req, {{2}});
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing) {
             delete[] tmp_statuses;
@@ -476,7 +570,7 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Waitany}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
@@ -495,14 +589,14 @@ post_init_cb(Caliper* c)
                 {{3}} = &tmp_status;
         }
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         
         {{callfn}}
         
         if (enable_msg_tracing && nreq > 0)
             ::tracing.handle_completion(&c, 1, tmp_req+(*{{2}}), {{3}});
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing) {
             delete[] tmp_req;
@@ -518,7 +612,7 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Testsome MPI_Waitsome}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
@@ -539,7 +633,7 @@ post_init_cb(Caliper* c)
                 {{4}} = tmp_statuses;
         }
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         
         {{callfn}}
         
@@ -547,7 +641,7 @@ post_init_cb(Caliper* c)
             for (int i = 0; i < *{{2}}; ++i)
                 ::tracing.handle_completion(&c, 1, tmp_req+{{3}}[i], {{4}}+{{3}}[i]);
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing) {
             delete[] tmp_statuses;
@@ -564,7 +658,7 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Test}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
@@ -577,14 +671,14 @@ post_init_cb(Caliper* c)
         if ({{2}} == MPI_STATUS_IGNORE)
             {{2}} = &tmp_status;
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         
         {{callfn}}
         
         if (enable_msg_tracing && *{{1}})
             ::tracing.handle_completion(&c, 1, &tmp_req, {{2}});
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -597,7 +691,7 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Testall}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
@@ -618,14 +712,14 @@ post_init_cb(Caliper* c)
                 {{3}} = tmp_statuses;
         }
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         
         {{callfn}}
         
         if (enable_msg_tracing && *{{2}})
             ::tracing.handle_completion(&c, nreq, tmp_req, {{3}});
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing) {
             delete[] tmp_statuses;
@@ -642,7 +736,7 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Testany}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
@@ -661,14 +755,14 @@ post_init_cb(Caliper* c)
                 {{4}} = &tmp_status;
         }
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         
         {{callfn}}
         
         if (enable_msg_tracing && *{{3}})
             ::tracing.handle_completion(&c, 1, tmp_req+(*{{2}}), {{4}});
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing) {
             delete[] tmp_req;
@@ -684,21 +778,21 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Request_free}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         
         if (enable_msg_tracing)
             ::tracing.request_free(&c, {{0}});
 
         {{callfn}}
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -715,20 +809,20 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Barrier}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
 
         if (enable_msg_tracing)
             ::tracing.handle_barrier(&c, {{0}});
 
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -741,20 +835,20 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Bcast}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
 
         if (enable_msg_tracing)
             ::tracing.handle_12n(&c, {{1}}, {{2}}, {{3}}, {{4}});
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -767,20 +861,20 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Scatter}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
 
         if (enable_msg_tracing)
             ::tracing.handle_12n(&c, {{1}}, {{2}}, {{6}}, {{7}});
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -793,14 +887,14 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Scatterv}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
 
         if (enable_msg_tracing) {
@@ -811,7 +905,7 @@ post_init_cb(Caliper* c)
             ::tracing.handle_12n(&c, total_count, {{3}}, {{7}}, {{8}});
         }
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -824,20 +918,20 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Gather}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
 
         if (enable_msg_tracing)
             ::tracing.handle_n21(&c, {{1}}, {{2}}, {{6}}, {{7}});
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -850,20 +944,20 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Gatherv}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
 
         if (enable_msg_tracing)
             ::tracing.handle_n21(&c, {{1}}, {{2}}, {{7}}, {{8}});
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -876,20 +970,20 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Reduce}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
 
         if (enable_msg_tracing)
             ::tracing.handle_n21(&c, {{2}}, {{3}}, {{5}}, {{6}});
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -902,20 +996,20 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Scan MPI_Exscan}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
 
         if (enable_msg_tracing)
             ::tracing.handle_n2n(&c, {{2}}, {{3}}, {{5}});
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -928,14 +1022,14 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Reduce_scatter}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
 
         if (enable_msg_tracing) {
@@ -945,7 +1039,7 @@ post_init_cb(Caliper* c)
             ::tracing.handle_n2n(&c, {{2}}[tmp_rank], {{3}}, {{5}});
         }
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -958,20 +1052,20 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Allreduce}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
 
         if (enable_msg_tracing)
             ::tracing.handle_n2n(&c, {{2}}, {{3}}, {{5}});
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -984,20 +1078,20 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Allgather}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
 
         if (enable_msg_tracing)
             ::tracing.handle_n2n(&c, {{1}}, {{2}}, {{6}});
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -1010,20 +1104,20 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Allgatherv}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
 
         if (enable_msg_tracing)
             ::tracing.handle_n2n(&c, {{1}}, {{2}}, {{7}});
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -1036,14 +1130,14 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Alltoall}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
         
         if (enable_msg_tracing) {
@@ -1053,7 +1147,7 @@ post_init_cb(Caliper* c)
             ::tracing.handle_n2n(&c, tmp_commsize * {{1}}, {{2}}, {{6}});
         }
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -1066,14 +1160,14 @@ post_init_cb(Caliper* c)
 
 {{fn func MPI_Alltoallv}}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
 
         if (enable_msg_tracing)
             ::tracing.push_call_id(&c);
 
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
         
         if (enable_msg_tracing) {
@@ -1084,7 +1178,7 @@ post_init_cb(Caliper* c)
             ::tracing.handle_n2n(&c, total_count, {{3}}, {{8}});
         }
         
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
         
         if (enable_msg_tracing)
             ::tracing.pop_call_id(&c);
@@ -1116,14 +1210,14 @@ post_init_cb(Caliper* c)
     if (enable_msg_tracing)
         ::tracing.push_call_id(&c);
         
-    c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+    ::begin_mpi_function(&c, "{{func}}");
 
     PMPI_Barrier(MPI_COMM_WORLD);
 
     if (enable_msg_tracing)
         ::tracing.handle_init(&c);
 
-    c.end(mpifn_attr);
+    ::end_mpi_function(&c);
         
     if (enable_msg_tracing)
         ::tracing.pop_call_id(&c);
@@ -1137,14 +1231,14 @@ post_init_cb(Caliper* c)
     if (enable_msg_tracing)
         ::tracing.push_call_id(&c);
         
-    c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+    ::begin_mpi_function(&c, "{{func}}");
 
     PMPI_Barrier(MPI_COMM_WORLD);
 
     if (enable_msg_tracing)
         ::tracing.handle_finalize(&c);
 
-    c.end(mpifn_attr);
+    ::end_mpi_function(&c);
         
     if (enable_msg_tracing)
         ::tracing.pop_call_id(&c);
@@ -1177,12 +1271,12 @@ post_init_cb(Caliper* c)
     MPI_Allgatherv MPI_Alltoallv MPI_Gatherv MPI_Scatterv
 }}{
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper && ::enable_{{func}}) {
+    if (::enabled_wrappers[wrapper_id_{{func}}]) {
 #endif
         Caliper c;
-        c.begin(mpifn_attr, Variant(CALI_TYPE_STRING, "{{func}}", strlen("{{func}}")));
+        ::begin_mpi_function(&c, "{{func}}");
         {{callfn}}
-        c.end(mpifn_attr);
+        ::end_mpi_function(&c);
 #ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
@@ -1211,10 +1305,12 @@ void mpiwrap_init(Caliper* c, const std::string& whitelist, const std::string& b
 
     // --- setup wrappers
 
-    ::enable_wrapper = true;
-
     if (enable_msg_tracing)
         ::tracing.init(c);
+    if (enable_msg_stats)
+        ::tracing.enable_stats(c);
+    if (enable_msg_matrix)
+        ::tracing.enable_matrix(c);
 
     setup_filter(whitelist, blacklist);
 
@@ -1229,7 +1325,7 @@ void mpiwrap_init(Caliper* c, const std::string& whitelist, const std::string& b
     bindings.push_back(wrap_MPI_Finalize_binding);
 
     {{forallfn name MPI_Init MPI_Init_thread MPI_Finalize}}
-    if (::enable_{{name}})
+    if (::enabled_wrappers[wrapper_id_{{name}}])
         bindings.push_back(wrap_{{name}}_binding);
     {{endforallfn}}
 
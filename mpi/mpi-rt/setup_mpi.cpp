@@ -38,10 +38,12 @@
 #include "caliper/CaliperService.h"
 
 #include "caliper/common/Log.h"
+#include "caliper/common/RuntimeConfig.h"
 
 #include <mpi.h>
 
 #include <sstream>
+#include <vector>
 
 using namespace cali;
 
@@ -50,6 +52,7 @@ namespace cali
 
 extern CaliperService mpiwrap_service;
 extern CaliperService mpireport_service;
+extern CaliperService mpirecorder_service;
 #ifdef CALIPER_HAVE_MPIT
 extern CaliperService mpit_service;
 #endif
@@ -57,6 +60,7 @@ extern CaliperService mpit_service;
 CaliperService cali_mpi_services[] = {
     mpiwrap_service,
     mpireport_service,
+    mpirecorder_service,
 #ifdef CALIPER_HAVE_MPIT
     mpit_service,
 #endif
@@ -93,6 +97,73 @@ setup_mpi()
 }
 
 
+//   Config file reader for CALI_CONFIG_FILE_BROADCAST: rank 0 reads the
+// config files and broadcasts their contents. Falls back to local reads
+// if MPI is not (or no longer) initialized.
+//
+//   This is called during config initialization, before Caliper and
+// logging are initialized. Uses PMPI calls to bypass our own wrappers.
+
+std::vector<std::string>
+bcast_config_files(const std::vector<std::string>& filenames)
+{
+    int is_initialized = 0;
+    int is_finalized   = 0;
+
+    PMPI_Initialized(&is_initialized);
+    PMPI_Finalized(&is_finalized);
+
+    if (!is_initialized || is_finalized)
+        return RuntimeConfig::read_config_files(filenames);
+
+    int rank = 0;
+    PMPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    // serialize contents as count, lengths, and concatenated strings
+
+    std::vector<std::string>        contents;
+    std::vector<unsigned long long> sizes;
+    std::string                     buf;
+
+    if (rank == 0) {
+        contents = RuntimeConfig::read_config_files(filenames);
+
+        sizes.push_back(contents.size());
+
+        for (const std::string& s : contents) {
+            sizes.push_back(s.size());
+            buf.append(s);
+        }
+
+        sizes.push_back(buf.size());
+    }
+
+    unsigned long long count = sizes.empty() ? 0 : sizes.front();
+
+    PMPI_Bcast(&count, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+
+    sizes.resize(count + 2);
+
+    PMPI_Bcast(sizes.data(), static_cast<int>(count + 2), MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+
+    buf.resize(sizes.back());
+
+    if (!buf.empty())
+        PMPI_Bcast(&buf[0], static_cast<int>(buf.size()), MPI_CHAR, 0, MPI_COMM_WORLD);
+
+    if (rank != 0) {
+        size_t pos = 0;
+
+        for (unsigned long long i = 0; i < count; ++i) {
+            contents.push_back(buf.substr(pos, sizes[i+1]));
+            pos += sizes[i+1];
+        }
+    }
+
+    return contents;
+}
+
+
 void mpirt_constructor() __attribute__((constructor));
 
 void
@@ -100,6 +171,7 @@ mpirt_constructor()
 {
     Caliper::add_services(cali_mpi_services);
     Caliper::add_init_hook(setup_mpi);
+    RuntimeConfig::set_config_file_reader(bcast_config_files);
 }
 
 }
@@ -132,6 +132,18 @@ cali_set_string(cali_id_t attr, const char* val)
     return CALI_SUCCESS;
 }
 
+cali_err
+cali_add_int(cali_id_t attr, int delta)
+{
+    return CALI_SUCCESS;
+}
+
+cali_err
+cali_add_double(cali_id_t attr, double delta)
+{
+    return CALI_SUCCESS;
+}
+
 cali_err
 cali_begin_double_byname(const char* attr_name, double val)
 {
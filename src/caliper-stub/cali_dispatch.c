@@ -0,0 +1,334 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file cali_dispatch.c
+/// Caliper C interface dispatch shim
+///
+/// Applications link this library instead of libcaliper. All C API
+/// calls are no-ops until the Caliper runtime is enabled at program
+/// start by setting CALI_ENABLE: the shim then loads libcaliper with
+/// dlopen() and forwards each call through a function table. When
+/// disabled, each call costs a single test of the table pointer.
+
+#define _GNU_SOURCE
+
+#include "caliper/caliper-config.h"
+
+#include "caliper/cali.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define CALI_DISPATCH_STR_(x) #x
+#define CALI_DISPATCH_STR(x)  CALI_DISPATCH_STR_(x)
+
+#define CALI_DISPATCH_DEFAULT_LIB "libcaliper.so." CALI_DISPATCH_STR(CALIPER_MAJOR_VERSION)
+
+// cali_make_empty_variant() is defined in libcaliper-common, which we don't link
+static cali_variant_t
+dispatch_empty_variant(void)
+{
+    cali_variant_t v;
+    memset(&v, 0, sizeof(v));
+    return v;
+}
+
+//
+// --- List of forwarded functions
+//
+//   CALI_DISPATCH_FN(return type, name, parameters, arguments, disabled return value)
+//   CALI_DISPATCH_VOID_FN(name, parameters, arguments)
+//
+// cali_init() is forwarded separately below.
+//
+
+#define CALI_DISPATCH_FUNCTIONS \
+    CALI_DISPATCH_FN(cali_id_t, cali_create_attribute, \
+                     (const char* name, cali_attr_type type, int properties), \
+                     (name, type, properties), CALI_INV_ID) \
+    CALI_DISPATCH_FN(cali_id_t, cali_create_attribute_with_metadata, \
+                     (const char* name, cali_attr_type type, int properties, int n, const cali_id_t meta_attr_list[], const void* meta_val_list[], const size_t meta_size_list[]), \
+                     (name, type, properties, n, meta_attr_list, meta_val_list, meta_size_list), CALI_INV_ID) \
+    CALI_DISPATCH_FN(cali_id_t, cali_find_attribute, \
+                     (const char* name), (name), CALI_INV_ID) \
+    CALI_DISPATCH_FN(const char*, cali_attribute_name, \
+                     (cali_id_t attr_id), (attr_id), NULL) \
+    CALI_DISPATCH_FN(cali_attr_type, cali_attribute_type, \
+                     (cali_id_t attr_id), (attr_id), CALI_TYPE_INV) \
+    CALI_DISPATCH_FN(int, cali_attribute_properties, \
+                     (cali_id_t attr_id), (attr_id), 0) \
+    CALI_DISPATCH_VOID_FN(cali_push_snapshot, \
+                          (int scope, int n, const cali_id_t trigger_info_attr_list[], const void* trigger_info_val_list[], const size_t trigger_info_size_list[]), \
+                          (scope, n, trigger_info_attr_list, trigger_info_val_list, trigger_info_size_list)) \
+    CALI_DISPATCH_FN(size_t, cali_pull_snapshot, \
+                     (int scope, size_t len, unsigned char* buf), (scope, len, buf), 0) \
+    CALI_DISPATCH_VOID_FN(cali_unpack_snapshot, \
+                          (const unsigned char* buf, size_t* bytes_read, cali_entry_proc_fn proc_fn, void* user_arg), \
+                          (buf, bytes_read, proc_fn, user_arg)) \
+    CALI_DISPATCH_FN(cali_variant_t, cali_find_first_in_snapshot, \
+                     (const unsigned char* buf, cali_id_t attr_id, size_t* bytes_read), \
+                     (buf, attr_id, bytes_read), dispatch_empty_variant()) \
+    CALI_DISPATCH_VOID_FN(cali_find_all_in_snapshot, \
+                          (const unsigned char* buf, cali_id_t attr_id, size_t* bytes_read, cali_entry_proc_fn proc_fn, void* userdata), \
+                          (buf, attr_id, bytes_read, proc_fn, userdata)) \
+    CALI_DISPATCH_FN(cali_snapshot_view_t*, cali_snapshot_view_create, \
+                     (size_t max_entries), (max_entries), NULL) \
+    CALI_DISPATCH_VOID_FN(cali_snapshot_view_destroy, \
+                          (cali_snapshot_view_t* view), (view)) \
+    CALI_DISPATCH_FN(size_t, cali_snapshot_view_unpack, \
+                     (cali_snapshot_view_t* view, const unsigned char* buf, size_t* bytes_read), \
+                     (view, buf, bytes_read), 0) \
+    CALI_DISPATCH_FN(size_t, cali_snapshot_view_num_entries, \
+                     (const cali_snapshot_view_t* view), (view), 0) \
+    CALI_DISPATCH_FN(const cali_id_t*, cali_snapshot_view_attributes, \
+                     (const cali_snapshot_view_t* view), (view), NULL) \
+    CALI_DISPATCH_FN(const cali_variant_t*, cali_snapshot_view_values, \
+                     (const cali_snapshot_view_t* view), (view), NULL) \
+    CALI_DISPATCH_FN(cali_variant_t, cali_snapshot_view_find_first, \
+                     (const cali_snapshot_view_t* view, cali_id_t attr_id), \
+                     (view, attr_id), dispatch_empty_variant()) \
+    CALI_DISPATCH_FN(size_t, cali_snapshot_view_find_all, \
+                     (const cali_snapshot_view_t* view, cali_id_t attr_id, const cali_variant_t** values), \
+                     (view, attr_id, values), 0) \
+    CALI_DISPATCH_FN(cali_variant_t, cali_get, \
+                     (cali_id_t attr_id), (attr_id), dispatch_empty_variant()) \
+    CALI_DISPATCH_FN(cali_err, cali_begin, \
+                     (cali_id_t attr), (attr), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_begin_double, \
+                     (cali_id_t attr, double val), (attr, val), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_begin_int, \
+                     (cali_id_t attr, int val), (attr, val), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_begin_string, \
+                     (cali_id_t attr, const char* val), (attr, val), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_end, \
+                     (cali_id_t attr), (attr), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_safe_end_string, \
+                     (cali_id_t attr, const char* val), (attr, val), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_set, \
+                     (cali_id_t attr, const void* value, size_t size), (attr, value, size), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_set_batch, \
+                     (size_t n, const cali_id_t attr_ids[], const cali_variant_t values[]), \
+                     (n, attr_ids, values), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_set_double, \
+                     (cali_id_t attr, double val), (attr, val), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_set_int, \
+                     (cali_id_t attr, int val), (attr, val), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_set_string, \
+                     (cali_id_t attr, const char* val), (attr, val), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_add_int, \
+                     (cali_id_t attr, int delta), (attr, delta), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_add_double, \
+                     (cali_id_t attr, double delta), (attr, delta), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_begin_byname, \
+                     (const char* attr_name), (attr_name), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_begin_double_byname, \
+                     (const char* attr_name, double val), (attr_name, val), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_begin_int_byname, \
+                     (const char* attr_name, int val), (attr_name, val), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_begin_string_byname, \
+                     (const char* attr_name, const char* val), (attr_name, val), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_set_double_byname, \
+                     (const char* attr_name, double val), (attr_name, val), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_set_int_byname, \
+                     (const char* attr_name, int val), (attr_name, val), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_set_string_byname, \
+                     (const char* attr_name, const char* val), (attr_name, val), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_end_byname, \
+                     (const char* attr_name), (attr_name), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_begin_string_cached, \
+                     (cali_string_handle_t* handle), (handle), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_end_cached, \
+                     (cali_string_handle_t* handle), (handle), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(int, cali_make_region_handle, \
+                     (const char* attr_name, const char* value), (attr_name, value), -1) \
+    CALI_DISPATCH_FN(cali_err, cali_begin_region_handle, \
+                     (int handle), (handle), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(cali_err, cali_end_region_handle, \
+                     (int handle), (handle), CALI_SUCCESS) \
+    CALI_DISPATCH_FN(int, cali_create_counter, \
+                     (const char* name, int properties), (name, properties), -1) \
+    CALI_DISPATCH_VOID_FN(cali_counter_add, \
+                          (int counter, uint64_t value), (counter, value)) \
+    CALI_DISPATCH_VOID_FN(cali_config_preset, \
+                          (const char* key, const char* value), (key, value)) \
+    CALI_DISPATCH_VOID_FN(cali_config_set, \
+                          (const char* key, const char* value), (key, value)) \
+    CALI_DISPATCH_VOID_FN(cali_config_define_profile, \
+                          (const char* name, const char* keyvallist[][2]), (name, keyvallist)) \
+    CALI_DISPATCH_VOID_FN(cali_config_allow_read_env, \
+                          (int allow), (allow)) \
+    CALI_DISPATCH_VOID_FN(cali_flush, \
+                          (int flush_opts), (flush_opts)) \
+    CALI_DISPATCH_FN(int, cali_is_initialized, \
+                     (void), (), 0) \
+    CALI_DISPATCH_FN(cali_id_t, cali_make_loop_iteration_attribute, \
+                     (const char* name), (name), CALI_INV_ID)
+
+//
+// --- Function table
+//
+
+struct cali_dispatch_table {
+#define CALI_DISPATCH_FN(ret, name, params, args, dflt) ret (*name) params;
+#define CALI_DISPATCH_VOID_FN(name, params, args) void (*name) params;
+    CALI_DISPATCH_FUNCTIONS
+#undef CALI_DISPATCH_FN
+#undef CALI_DISPATCH_VOID_FN
+    void (*cali_init)(void);
+
+    cali_id_t* function_attr_id;
+    cali_id_t* loop_attr_id;
+    cali_id_t* statement_attr_id;
+    cali_id_t* annotation_attr_id;
+};
+
+static struct cali_dispatch_table  s_table_data;
+
+/// Null while Caliper is disabled, set once at program start otherwise
+static struct cali_dispatch_table* s_table = NULL;
+
+//
+// --- Copies of the API attribute IDs used by the annotation macros
+//
+
+cali_id_t cali_function_attr_id   = CALI_INV_ID;
+cali_id_t cali_loop_attr_id       = CALI_INV_ID;
+cali_id_t cali_statement_attr_id  = CALI_INV_ID;
+cali_id_t cali_annotation_attr_id = CALI_INV_ID;
+
+//
+// --- Forwarding functions
+//
+
+#define CALI_DISPATCH_FN(ret, name, params, args, dflt) \
+    ret name params {                                   \
+        if (__builtin_expect(s_table == NULL, 1))       \
+            return dflt;                                \
+        return s_table->name args;                      \
+    }
+#define CALI_DISPATCH_VOID_FN(name, params, args)       \
+    void name params {                                  \
+        if (__builtin_expect(s_table != NULL, 0))       \
+            s_table->name args;                         \
+    }
+
+CALI_DISPATCH_FUNCTIONS
+
+#undef CALI_DISPATCH_FN
+#undef CALI_DISPATCH_VOID_FN
+
+static void
+sync_attr_id(cali_id_t* dst, const cali_id_t* src)
+{
+    // If the runtime's references to the ID variables bind to our copies,
+    // they are already up-to-date
+    if (src && *src != CALI_INV_ID)
+        *dst = *src;
+}
+
+void
+cali_init()
+{
+    if (__builtin_expect(s_table == NULL, 1))
+        return;
+
+    s_table->cali_init();
+
+    sync_attr_id(&cali_function_attr_id,   s_table->function_attr_id);
+    sync_attr_id(&cali_loop_attr_id,       s_table->loop_attr_id);
+    sync_attr_id(&cali_statement_attr_id,  s_table->statement_attr_id);
+    sync_attr_id(&cali_annotation_attr_id, s_table->annotation_attr_id);
+}
+
+//
+// --- Runtime loading
+//
+
+static int
+is_disabled(const char* val)
+{
+    return !val || !*val || strcmp(val, "0") == 0 || strcasecmp(val, "false") == 0 || strcasecmp(val, "off") == 0;
+}
+
+static void cali_dispatch_load(void) __attribute__((constructor));
+
+static void
+cali_dispatch_load(void)
+{
+    const char* val = getenv("CALI_ENABLE");
+
+    if (is_disabled(val))
+        return;
+
+    // CALI_ENABLE is either a boolean or the path to the Caliper library
+    const char* lib =
+        (strcasecmp(val, "1") == 0 || strcasecmp(val, "true") == 0 || strcasecmp(val, "on") == 0) ?
+        CALI_DISPATCH_DEFAULT_LIB : val;
+
+    void* handle = dlopen(lib, RTLD_NOW | RTLD_LOCAL);
+
+    if (!handle) {
+        fprintf(stderr, "== CALIPER: dispatch: could not load %s: %s\n", lib, dlerror());
+        return;
+    }
+
+    int ok = 1;
+
+#define CALI_DISPATCH_LOOKUP(name) \
+    *(void**) (&s_table_data.name) = dlsym(handle, #name); \
+    if (!s_table_data.name) { \
+        fprintf(stderr, "== CALIPER: dispatch: %s not found in %s\n", #name, lib); \
+        ok = 0; \
+    }
+#define CALI_DISPATCH_FN(ret, name, params, args, dflt) CALI_DISPATCH_LOOKUP(name)
+#define CALI_DISPATCH_VOID_FN(name, params, args) CALI_DISPATCH_LOOKUP(name)
+    CALI_DISPATCH_FUNCTIONS
+    CALI_DISPATCH_LOOKUP(cali_init)
+#undef CALI_DISPATCH_FN
+#undef CALI_DISPATCH_VOID_FN
+#undef CALI_DISPATCH_LOOKUP
+
+    if (!ok) {
+        dlclose(handle);
+        return;
+    }
+
+    s_table_data.function_attr_id   = (cali_id_t*) dlsym(handle, "cali_function_attr_id");
+    s_table_data.loop_attr_id       = (cali_id_t*) dlsym(handle, "cali_loop_attr_id");
+    s_table_data.statement_attr_id  = (cali_id_t*) dlsym(handle, "cali_statement_attr_id");
+    s_table_data.annotation_attr_id = (cali_id_t*) dlsym(handle, "cali_annotation_attr_id");
+
+    s_table = &s_table_data;
+}
@@ -39,6 +39,7 @@
 #include "caliper/common/Log.h"
 #include "caliper/common/Variant.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cstring>
 #include <string>
@@ -116,6 +117,70 @@ Loop::end()
     }
 }
 
+// --- Cached region and loop annotation classes
+
+CachedRegion::CachedRegion(cali_string_handle_t* handle)
+    : m_handle(handle)
+{
+    cali_begin_string_cached(m_handle);
+}
+
+CachedRegion::~CachedRegion()
+{
+    cali_end_cached(m_handle);
+}
+
+CachedLoop::Iteration::Iteration(cali_id_t attr, int i)
+    : m_attr(attr)
+{
+    Caliper c;
+    c.begin(c.get_attribute(m_attr), Variant(i));
+}
+
+CachedLoop::Iteration::~Iteration()
+{
+    Caliper c;
+    c.end(c.get_attribute(m_attr));
+}
+
+CachedLoop::CachedLoop(cali_string_handle_t* handle, cali_id_t* iter_attr)
+    : m_handle(handle), m_level(0)
+{
+    if (*iter_attr == CALI_INV_ID)
+        *iter_attr = cali_make_loop_iteration_attribute(handle->value);
+
+    m_iter_attr = *iter_attr;
+
+    if (cali_begin_string_cached(m_handle) == CALI_SUCCESS)
+        ++m_level;
+}
+
+CachedLoop::~CachedLoop()
+{
+    end();
+}
+
+void
+CachedLoop::end()
+{
+    if (m_level > 0) {
+        cali_end_cached(m_handle);
+        --m_level;
+    }
+}
+
+// --- Counter class
+
+Counter::Counter(const char* name, int opt)
+    : m_counter(cali_create_counter(name, opt))
+{ }
+
+void
+Counter::add(uint64_t val)
+{
+    Caliper::add_to_counter(m_counter, val);
+}
+
 // --- Annotation implementation object
 
 struct Annotation::Impl {
@@ -143,6 +208,14 @@ struct Annotation::Impl {
             c.begin(attr, data);
     }
 
+    void begin(const Variant& data, Node** hint) {
+        Caliper   c;
+        Attribute attr = get_attribute(c, data.type());
+
+        if ((attr.type() == data.type()) && attr.type() != CALI_TYPE_INV)
+            c.begin(attr, data, hint);
+    }
+
     void set(const Variant& data) {
         Caliper   c;
         Attribute attr = get_attribute(c, data.type());
@@ -210,6 +283,68 @@ Annotation::Guard::~Guard()
     pI->detach();
 }
 
+// --- Region subclass
+
+Annotation::Region::Region(const Annotation& a, const char* value)
+    : pI(a.pI->attach()),
+      m_value(nullptr),
+      m_len(strlen(value)),
+      m_node(nullptr)
+{
+    m_value = new char[m_len + 1];
+    std::copy(value, value + m_len + 1, m_value);
+}
+
+Annotation::Region::Region(const Region& r)
+    : pI(r.pI->attach()),
+      m_value(new char[r.m_len + 1]),
+      m_len(r.m_len),
+      m_node(r.m_node)
+{
+    std::copy(r.m_value, r.m_value + m_len + 1, m_value);
+}
+
+Annotation::Region::~Region()
+{
+    delete[] m_value;
+    pI->detach();
+}
+
+Annotation::Region& Annotation::Region::operator = (const Region& r)
+{
+    if (this == &r)
+        return *this;
+
+    char* value = new char[r.m_len + 1];
+    std::copy(r.m_value, r.m_value + r.m_len + 1, value);
+
+    delete[] m_value;
+    r.pI->attach();
+    pI->detach();
+
+    pI      = r.pI;
+    m_value = value;
+    m_len   = r.m_len;
+    m_node  = r.m_node;
+
+    return *this;
+}
+
+void Annotation::Region::begin()
+{
+    pI->begin(Variant(CALI_TYPE_STRING, m_value, m_len), reinterpret_cast<Node**>(&m_node));
+}
+
+void Annotation::Region::end()
+{
+    pI->end();
+}
+
+Annotation::Region Annotation::region(const char* value) const
+{
+    return Region(*this, value);
+}
+
 // --- Constructors / destructor
 
 Annotation::Annotation(const char* name, int opt)
@@ -0,0 +1,275 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// AttributeRegistry implementation
+
+#include "AttributeRegistry.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+using namespace cali;
+
+namespace
+{
+
+struct RegistryEntry {
+    std::string name;
+    size_t      hash;
+    Node*       node;
+};
+
+/// \brief Open-addressing hash table with atomically published slots.
+///   Entries are never removed or modified once published.
+struct RegistryTable {
+    size_t                      capacity; // must be a power of 2
+    std::atomic<RegistryEntry*>* slots;
+    RegistryTable*              prev;     // retired table, kept alive for readers
+
+    RegistryTable(size_t c, RegistryTable* p)
+        : capacity(c), slots(new std::atomic<RegistryEntry*>[c]), prev(p)
+        {
+            for (size_t i = 0; i < capacity; ++i)
+                slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+
+    ~RegistryTable() {
+        delete[] slots;
+    }
+
+    RegistryEntry* find(const std::string& name, size_t hash) const {
+        size_t mask = capacity - 1;
+
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            RegistryEntry* e = slots[i].load(std::memory_order_acquire);
+
+            if (!e)
+                return nullptr;
+            if (e->hash == hash && e->name == name)
+                return e;
+        }
+    }
+
+    // Writer only. Caller must ensure there is a free slot.
+    void put(RegistryEntry* entry) {
+        size_t mask = capacity - 1;
+        size_t i    = entry->hash & mask;
+
+        while (slots[i].load(std::memory_order_relaxed))
+            i = (i + 1) & mask;
+
+        slots[i].store(entry, std::memory_order_release);
+    }
+};
+
+} // namespace [anonymous]
+
+
+struct AttributeRegistry::AttributeRegistryImpl
+{
+    std::atomic<RegistryTable*> table;
+
+    mutable std::mutex          lock;
+    std::vector<RegistryEntry*> entries;
+
+    std::unordered_map< cali_id_t, std::vector<Node*> > meta_index;
+    std::unordered_map< cali_id_t, std::vector<int>   > meta_subscribers;
+
+    AttributeRegistryImpl()
+        : table(new RegistryTable(64, nullptr))
+        { }
+
+    ~AttributeRegistryImpl() {
+        RegistryTable* t = table.load();
+
+        while (t) {
+            RegistryTable* prev = t->prev;
+            delete t;
+            t = prev;
+        }
+
+        for (RegistryEntry* e : entries)
+            delete e;
+    }
+
+    Node* find(const std::string& name) const {
+        RegistryEntry* e =
+            table.load(std::memory_order_acquire)->find(name, std::hash<std::string>()(name));
+
+        return e ? e->node : nullptr;
+    }
+
+    Node* insert(const std::string& name, Node* node,
+                 size_t n_meta, const cali_id_t* meta_ids,
+                 std::vector<int>* subscribers) {
+        size_t hash = std::hash<std::string>()(name);
+
+        std::lock_guard<std::mutex>
+            g(lock);
+
+        RegistryTable* t = table.load(std::memory_order_relaxed);
+
+        {
+            RegistryEntry* e = t->find(name, hash);
+
+            if (e)
+                return e->node;
+        }
+
+        // Keep load factor <= 0.5. Build a new table and publish it
+        // when it's complete; readers may still probe the old one.
+
+        if (2 * (entries.size() + 1) > t->capacity) {
+            RegistryTable* newt = new RegistryTable(2 * t->capacity, t);
+
+            for (RegistryEntry* e : entries)
+                newt->put(e);
+
+            table.store(newt, std::memory_order_release);
+            t = newt;
+        }
+
+        RegistryEntry* e = new RegistryEntry { name, hash, node };
+
+        entries.push_back(e);
+        t->put(e);
+
+        for (size_t i = 0; i < n_meta; ++i) {
+            meta_index[meta_ids[i]].push_back(node);
+
+            if (subscribers) {
+                auto it = meta_subscribers.find(meta_ids[i]);
+
+                if (it != meta_subscribers.end())
+                    subscribers->insert(subscribers->end(), it->second.begin(), it->second.end());
+            }
+        }
+
+        return node;
+    }
+
+    std::vector<Node*> find_with(cali_id_t meta_id) const {
+        std::lock_guard<std::mutex>
+            g(lock);
+
+        auto it = meta_index.find(meta_id);
+
+        return it == meta_index.end() ? std::vector<Node*>() : it->second;
+    }
+
+    std::vector<Node*> subscribe(cali_id_t meta_id, int subscriber) {
+        std::lock_guard<std::mutex>
+            g(lock);
+
+        meta_subscribers[meta_id].push_back(subscriber);
+
+        auto it = meta_index.find(meta_id);
+
+        return it == meta_index.end() ? std::vector<Node*>() : it->second;
+    }
+
+    std::vector<Node*> get_all() const {
+        std::lock_guard<std::mutex>
+            g(lock);
+
+        std::vector<Node*> ret;
+        ret.reserve(entries.size());
+
+        for (const RegistryEntry* e : entries)
+            ret.push_back(e->node);
+
+        return ret;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex>
+            g(lock);
+
+        return entries.size();
+    }
+};
+
+
+AttributeRegistry::AttributeRegistry()
+    : mP(new AttributeRegistryImpl)
+{ }
+
+AttributeRegistry::~AttributeRegistry()
+{
+    mP.reset();
+}
+
+Node*
+AttributeRegistry::find(const std::string& name) const
+{
+    return mP->find(name);
+}
+
+Node*
+AttributeRegistry::insert(const std::string& name, Node* node)
+{
+    return mP->insert(name, node, 0, nullptr, nullptr);
+}
+
+Node*
+AttributeRegistry::insert(const std::string& name, Node* node,
+                          size_t n_meta, const cali_id_t meta_ids[],
+                          std::vector<int>* subscribers)
+{
+    return mP->insert(name, node, n_meta, meta_ids, subscribers);
+}
+
+std::vector<Node*>
+AttributeRegistry::find_with(cali_id_t meta_id) const
+{
+    return mP->find_with(meta_id);
+}
+
+std::vector<Node*>
+AttributeRegistry::subscribe(cali_id_t meta_id, int subscriber)
+{
+    return mP->subscribe(meta_id, subscriber);
+}
+
+std::vector<Node*>
+AttributeRegistry::get_all() const
+{
+    return mP->get_all();
+}
+
+size_t
+AttributeRegistry::size() const
+{
+    return mP->size();
+}
@@ -0,0 +1,120 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file  AttributeRegistry.h
+/// \brief AttributeRegistry class declaration
+
+#pragma once
+
+#include "caliper/common/cali_types.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cali
+{
+    class Node;
+
+    /// \brief Name-to-attribute-node registry with lock-free lookups
+    ///
+    ///   Lookups do not take locks or allocate memory, and can run
+    /// concurrently with insertions. Insertions are serialized. The
+    /// hash table is append-only: on growth, a new table is published
+    /// atomically and the old one is retired (but kept alive) so that
+    /// concurrent readers can finish their probe. Lookups are therefore
+    /// safe to use from signal handlers.
+    ///
+    ///   The registry also maintains an index from metadata attribute IDs
+    /// (e.g., class.aggregatable) to the attributes that carry them, and
+    /// a list of subscribers for each metadata attribute. Index updates
+    /// and subscriptions are serialized with insertions, so a subscriber
+    /// sees each matching attribute exactly once: either in the list
+    /// returned by subscribe() or through insert().
+    class AttributeRegistry
+    {
+        struct AttributeRegistryImpl;
+
+        std::unique_ptr<AttributeRegistryImpl> mP;
+
+    public:
+
+        AttributeRegistry();
+
+        ~AttributeRegistry();
+
+        AttributeRegistry(const AttributeRegistry&) = delete;
+        AttributeRegistry& operator = (const AttributeRegistry&) = delete;
+
+        /// \brief Find the attribute node for \a name.
+        /// \return The node, or \a nullptr if there is no such attribute.
+        /// \note Lock-free and signal safe.
+        Node*
+        find(const std::string& name) const;
+
+        /// \brief Register \a node under \a name, unless an attribute with
+        ///   this name already exists.
+        /// \return The node registered under \a name: either \a node or the
+        ///   one that was registered before.
+        Node*
+        insert(const std::string& name, Node* node);
+
+        /// \brief Register \a node under \a name and index it under the
+        ///   given metadata attribute IDs.
+        /// \param subscribers If \a node was inserted, IDs of the
+        ///   subscribers for any of \a meta_ids are appended here.
+        /// \return The node registered under \a name
+        Node*
+        insert(const std::string& name, Node* node,
+               size_t n_meta, const cali_id_t meta_ids[],
+               std::vector<int>* subscribers);
+
+        /// \brief Return attribute nodes that have metadata attribute
+        ///   \a meta_id, in creation order.
+        std::vector<Node*>
+        find_with(cali_id_t meta_id) const;
+
+        /// \brief Subscribe \a subscriber to new attributes with
+        ///   metadata attribute \a meta_id.
+        /// \return The attribute nodes with \a meta_id registered so far
+        std::vector<Node*>
+        subscribe(cali_id_t meta_id, int subscriber);
+
+        /// \brief Return all registered attribute nodes in creation order.
+        std::vector<Node*>
+        get_all() const;
+
+        size_t
+        size() const;
+    };
+
+} // namespace cali
@@ -39,27 +39,40 @@
 #include "caliper/Caliper.h"
 #include "caliper/SnapshotRecord.h"
 
+#include "AttributeRegistry.h"
 #include "ContextBuffer.h"
+#include "FlushPipeline.h"
 #include "MetadataTree.h"
+#include "SelfProfile.h"
 
 #include "caliper/common/ContextRecord.h"
 #include "caliper/common/Node.h"
 #include "caliper/common/Log.h"
 #include "caliper/common/RuntimeConfig.h"
 
+#include "caliper/common/c-util/unitfmt.h"
+
+#include "caliper/common/util/cacheline.hpp"
+#include "caliper/common/util/memory_counter.hpp"
+#include "caliper/common/util/tls.hpp"
+
 #include "../services/Services.h"
 
 #include <signal.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cstring>
 #include <cstdlib>
 #include <functional>
+#include <iomanip>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <sstream>
+#include <thread>
 #include <vector>
 #include <utility>
 
@@ -79,6 +92,7 @@ extern void config_sanity_check();
 namespace
 {
     bool flush_on_exit { true };
+    bool memory_report { false };
 
     // --- helpers
 
@@ -97,6 +111,21 @@ namespace
         return CALI_SCOPE_THREAD;
     }
 
+    const size_t MaxAttributeMeta = 64;
+
+    /// Collect the distinct metadata attribute IDs on an attribute
+    /// node's path, for the attribute registry's metadata index
+    size_t
+    collect_meta_ids(const Node* node, cali_id_t* ids) {
+        size_t n = 0;
+
+        for ( ; node && node->id() != CALI_INV_ID && n < MaxAttributeMeta; node = node->parent())
+            if (std::find(ids, ids + n, node->attribute()) == ids + n)
+                ids[n++] = node->attribute();
+
+        return n;
+    }
+
 
     // --- Exit handler
 
@@ -110,8 +139,16 @@ namespace
 
             c.clear();
 
+            // disabled services still need to clean up
+            util::callback_disabled().store(0);
+
             c.events().finish_evt(&c);
 
+            if (SelfProfile::is_enabled())
+                SelfProfile::report(Log(1).stream());
+            if (memory_report)
+                Caliper::print_memory_usage(Log(1).stream());
+
             c.release_scope(c.default_scope(CALI_SCOPE_PROCESS));
             // Somehow default thread scope is not released by pthread_key_create destructor
             c.release_scope(c.default_scope(CALI_SCOPE_THREAD));
@@ -140,6 +177,30 @@ namespace
         }
     };
 
+    // --- Context tree guard for signal handlers
+
+    /// \brief Marks a thread's context tree as used from a signal handler
+    ///   while in scope, so that tree lookups don't allocate memory
+    class tree_signal_guard {
+        MetadataTree& m_tree;
+        bool          m_is_signal;
+        bool          m_prev;
+
+    public:
+
+        tree_signal_guard(MetadataTree& tree, bool is_signal)
+            : m_tree(tree), m_is_signal(is_signal), m_prev(false)
+            {
+                if (m_is_signal)
+                    m_prev = m_tree.set_signal(true);
+            }
+
+        ~tree_signal_guard() {
+            if (m_is_signal)
+                m_tree.set_signal(m_prev);
+        }
+    };
+
 } // namespace
 
 
@@ -147,7 +208,10 @@ namespace
 // Caliper Scope data
 //
 
-struct Caliper::Scope
+// Thread scopes are allocated on cache line boundaries so that the hot
+// per-thread state (siglock, blackboard, counters) doesn't share cache
+// lines with heap data of other threads.
+struct alignas(util::cacheline_size) Caliper::Scope : public util::cacheline_aligned_new
 {
     MetadataTree         tree;
     ContextBuffer        blackboard;
@@ -156,8 +220,102 @@ struct Caliper::Scope
 
     ::siglock            lock;
 
+    /// \brief Per-attribute state of throttled attributes on a thread.
+    ///   Bit i of \a enabled records if the begin event at nesting depth
+    ///   i invoked callbacks, so the matching end event does the same.
+    struct ThrottleState {
+        uint32_t depth   = 0;
+        uint32_t count   = 0;
+        uint64_t enabled = 0;
+    };
+
+    std::vector<ThrottleState> throttle_state;
+
+    /// \brief Per-attribute state of filtered attributes on a thread.
+    ///   Bit i of \a excluded records if the begin event at nesting
+    ///   depth i was dropped by the region filter, so the matching end
+    ///   event is dropped, too.
+    struct FilterState {
+        uint32_t depth    = 0;
+        uint64_t excluded = 0;
+    };
+
+    std::vector<FilterState> filter_state;
+
+    /// \brief Per-thread counter values. \a value is bumped by
+    ///   add_to_counter(), \a reported is the value at the last snapshot.
+    struct CounterSlot {
+        uint64_t value    = 0;
+        uint64_t reported = 0;
+    };
+
+    CounterSlot          counters[Caliper::MaxCounters];
+
+    /// \brief An open region of a tree attribute, pushed by begin() on
+    ///   the thread scope so that end() of properly nested regions
+    ///   doesn't have to search the blackboard and context tree.
+    struct RegionStackEntry {
+        cali_id_t attr;
+        Node*     node;
+        Node*     parent;
+    };
+
+    static const unsigned MaxRegionDepth = 64;
+
+    /// Entries are checked against the blackboard before use, so
+    /// mismatched or unstructured nesting only leaves harmless stale
+    /// entries. Regions beyond MaxRegionDepth are counted in
+    /// \a region_overflow and take the slow path in end().
+    RegionStackEntry     region_stack[MaxRegionDepth];
+    unsigned             region_depth    = 0;
+    unsigned             region_overflow = 0;
+
+    void push_region(cali_id_t attr, Node* node, Node* parent) {
+        if (region_depth < MaxRegionDepth) {
+            RegionStackEntry& r = region_stack[region_depth++];
+
+            r.attr   = attr;
+            r.node   = node;
+            r.parent = parent;
+        } else
+            ++region_overflow;
+    }
+
+    /// \brief Pop the top-most region into \a r if it is \a attr and
+    ///   \a node is still its current blackboard node. Otherwise, drops
+    ///   the stack and returns false.
+    bool pop_region(cali_id_t attr, const Node* node, RegionStackEntry& r) {
+        if (region_overflow > 0) {
+            --region_overflow;
+            return false;
+        }
+
+        if (region_depth > 0) {
+            const RegionStackEntry& top = region_stack[region_depth-1];
+
+            if (top.attr == attr && top.node == node) {
+                r = top;
+                --region_depth;
+                return true;
+            }
+        }
+
+        region_depth = 0;
+        return false;
+    }
+
     Scope(cali_context_scope_t s)
-        : scope(s) { }
+        : blackboard(s != CALI_SCOPE_THREAD), scope(s)
+        {
+            set_memory_thread(s == CALI_SCOPE_THREAD ?
+                              util::memory_counter::thread_id() : util::memory_counter::ProcessWide);
+        }
+
+    /// \brief Attribute the scope's memory to \a thread in memory accounting
+    void set_memory_thread(int thread) {
+        tree.set_memory_thread(thread);
+        blackboard.set_memory_thread(thread);
+    }
 };
 
 
@@ -176,6 +334,11 @@ struct Caliper::GlobalData
 
     static GlobalData*            sG;
 
+    // Cache of the thread's scope pointer in thread_scope_key. Uses the
+    // initial-exec TLS model so reads are a plain TLS load that is also
+    // safe in signal handlers.
+    static thread_local Scope*    t_thread_scope CALI_TLS_INITIAL_EXEC;
+
     struct InitHookList {
         void          (*hook)();
         InitHookList* next;
@@ -188,7 +351,14 @@ struct Caliper::GlobalData
     static void release_thread(void* ctx) {
         Scope* scope = static_cast<Scope*>(ctx);
 
+        t_thread_scope = nullptr;
+
         Caliper(sG, scope, 0).release_scope(scope);
+
+        // Keep the scope for re-use by a new thread. Released scopes are
+        // never deleted anyway since their trees hold live node data.
+        if (scope != sG->default_thread_scope)
+            sG->recycle_thread_scope(scope);
     }
 
     static void add_init_hook(void (*hook)()) {
@@ -208,8 +378,7 @@ struct Caliper::GlobalData
     ScopeCallbackFn        get_thread_scope_cb;
     ScopeCallbackFn        get_task_scope_cb;
 
-    mutable std::mutex     attribute_lock;
-    map<string, Node*>     attribute_nodes;
+    AttributeRegistry      attribute_registry;
     map<string, int>       attribute_prop_presets;
 
     Attribute              name_attr;
@@ -219,6 +388,7 @@ struct Caliper::GlobalData
     // Key attribute: one attribute stands in as key for all auto-merged attributes
     Attribute              key_attr;
     bool                   automerge;
+    unsigned               flush_threads;
 
     Events                 events;
 
@@ -228,6 +398,60 @@ struct Caliper::GlobalData
 
     pthread_key_t          thread_scope_key;
 
+    // Released thread scopes, ready for re-use by new threads
+    std::vector<Scope*>    thread_scope_pool;
+    std::mutex             thread_scope_pool_lock;
+
+    // Event throttling and region filters. Throttle entries are indexed
+    // by attribute ID and stored in lazily allocated chunks; they are
+    // never deleted. Region filter objects are never deleted either.
+
+    struct RegionFilter {
+        RegionFilterFn fn;
+        const void*    arg;
+    };
+
+    struct ThrottleEntry {
+        std::atomic<unsigned> rate;        ///< 0: no throttling, CountOnly: no callbacks, N: every Nth
+        std::atomic<uint64_t> num_skipped; ///< Number of events without callbacks
+        std::atomic<const RegionFilter*> filter;
+        std::atomic<uint64_t> num_filtered; ///< Number of dropped begin events
+    };
+
+    static const size_t    ThrottleChunkSize  = 1024;
+    static const size_t    ThrottleMaxChunks  = 1024;
+
+    std::atomic<ThrottleEntry*> throttle_table[ThrottleMaxChunks];
+    std::atomic<bool>      throttle_active;
+    std::atomic<bool>      filter_active;
+
+    // Counters. Entries below num_counters are never modified.
+
+    struct CounterInfo {
+        cali_id_t      attr_id;
+        cali_attr_type type;
+    };
+
+    CounterInfo            counter_info[MaxCounters];
+    std::atomic<int>       num_counters;
+    std::mutex             counter_lock;
+
+    // Subscribers for attributes with a given metadata attribute. The
+    // attribute registry refers to them by index.
+
+    typedef std::function<void(Caliper*,const Attribute&)> AttributeSubscriberFn;
+
+    std::vector<AttributeSubscriberFn> attribute_subscribers;
+    std::mutex             attribute_subscriber_lock;
+
+    void register_attribute(const Attribute& attr) {
+        cali_id_t meta_ids[MaxAttributeMeta];
+        size_t    n_meta = collect_meta_ids(default_thread_scope->tree.node(attr.id()), meta_ids);
+
+        attribute_registry.insert(attr.name(), default_thread_scope->tree.node(attr.id()),
+                                  n_meta, meta_ids, nullptr);
+    }
+
     // --- constructor
 
     GlobalData()
@@ -239,21 +463,34 @@ struct Caliper::GlobalData
           prop_attr { Attribute::invalid },
           key_attr  { Attribute::invalid },
           automerge { true },
+          flush_threads { 1 },
           process_scope        { new Scope(CALI_SCOPE_PROCESS) },
           default_thread_scope { new Scope(CALI_SCOPE_THREAD)  },
-          default_task_scope   { new Scope(CALI_SCOPE_TASK)    }
+          default_task_scope   { new Scope(CALI_SCOPE_TASK)    },
+          throttle_active      { false },
+          filter_active        { false },
+          num_counters         { 0 }
     {
+        for (size_t i = 0; i < ThrottleMaxChunks; ++i)
+            throttle_table[i].store(nullptr);
+
         automerge = config.get("automerge").to_bool();
 
+        flush_threads = config.get("flush_threads").to_uint();
+
+        if (flush_threads == 0)
+            flush_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
         ::flush_on_exit = config.get("flush_on_exit").to_bool();
+        ::memory_report = config.get("memory_report").to_bool();
 
         name_attr = Attribute::make_attribute(default_thread_scope->tree.node( 8));
         type_attr = Attribute::make_attribute(default_thread_scope->tree.node( 9));
         prop_attr = Attribute::make_attribute(default_thread_scope->tree.node(10));
 
-        attribute_nodes.insert(make_pair(name_attr.name(), default_thread_scope->tree.node(name_attr.id())));
-        attribute_nodes.insert(make_pair(type_attr.name(), default_thread_scope->tree.node(type_attr.id())));
-        attribute_nodes.insert(make_pair(prop_attr.name(), default_thread_scope->tree.node(prop_attr.id())));
+        register_attribute(name_attr);
+        register_attribute(type_attr);
+        register_attribute(prop_attr);
 
         assert(name_attr != Attribute::invalid);
         assert(type_attr != Attribute::invalid);
@@ -279,16 +516,334 @@ struct Caliper::GlobalData
         delete process_scope;
         delete default_thread_scope;
         delete default_task_scope;
+
+        for (Scope* s : thread_scope_pool)
+            delete s;
+    }
+
+    void recycle_thread_scope(Scope* scope) {
+        scope->blackboard.clear();
+        scope->throttle_state.clear();
+        scope->filter_state.clear();
+
+        for (Scope::CounterSlot& slot : scope->counters)
+            slot.value = slot.reported = 0;
+
+        scope->region_depth    = 0;
+        scope->region_overflow = 0;
+
+        std::lock_guard<std::mutex>
+            g(thread_scope_pool_lock);
+
+        thread_scope_pool.push_back(scope);
+    }
+
+    ThrottleEntry* find_throttle_entry(cali_id_t id, bool create) {
+        size_t chunk = id / ThrottleChunkSize;
+
+        if (id == CALI_INV_ID || chunk >= ThrottleMaxChunks)
+            return nullptr;
+
+        ThrottleEntry* entries = throttle_table[chunk].load(std::memory_order_acquire);
+
+        if (!entries) {
+            if (!create)
+                return nullptr;
+
+            ThrottleEntry* new_entries = new ThrottleEntry[ThrottleChunkSize];
+
+            for (size_t i = 0; i < ThrottleChunkSize; ++i) {
+                new_entries[i].rate.store(0, std::memory_order_relaxed);
+                new_entries[i].num_skipped.store(0, std::memory_order_relaxed);
+                new_entries[i].filter.store(nullptr, std::memory_order_relaxed);
+                new_entries[i].num_filtered.store(0, std::memory_order_relaxed);
+            }
+
+            if (throttle_table[chunk].compare_exchange_strong(entries, new_entries))
+                entries = new_entries;
+            else
+                delete[] new_entries;
+        }
+
+        return entries + (id % ThrottleChunkSize);
+    }
+
+    // --- flush helpers. owner selects the service whose flush callbacks
+    //   are invoked (e.g., when it is disabled), -1 selects all.
+
+    void flush(Caliper* c, int owner, const SnapshotRecord* flush_info, SnapshotFlushFn proc_fn) {
+        if (owner < 0)
+            events.pre_flush_evt(c, flush_info);
+        else
+            events.pre_flush_evt.invoke_owner(owner, c, flush_info);
+
+        auto flush_fn = [this,c,owner,flush_info](SnapshotFlushFn fn) {
+            if (owner < 0)
+                events.flush_evt(c, flush_info, fn);
+            else
+                events.flush_evt.invoke_owner(owner, c, flush_info, fn);
+        };
+
+        if (events.postprocess_snapshot.empty()) {
+            flush_fn(proc_fn);
+        } else if (flush_threads > 1) {
+            FlushPipeline pipeline(flush_threads, proc_fn);
+
+            flush_fn([&pipeline](const SnapshotRecord* input_snapshot) {
+                    return pipeline.push(input_snapshot);
+                });
+
+            pipeline.finish();
+        } else {
+            flush_fn([this,c,proc_fn](const SnapshotRecord* input_snapshot) {
+                    SnapshotRecord::FixedSnapshotRecord<80> data;
+                    SnapshotRecord snapshot(data);
+
+                    snapshot.append(*input_snapshot);
+
+                    events.postprocess_snapshot(c, &snapshot);
+                    return proc_fn(&snapshot);
+                });
+        }
+    }
+
+    void flush_and_write(Caliper* c, int owner, const SnapshotRecord* input_flush_info) {
+        SelfProfile::Timer t(SelfProfile::Flush);
+
+        if (SelfProfile::is_enabled())
+            c->set_overhead_attributes();
+
+        SnapshotRecord::FixedSnapshotRecord<80> snapshot_data;
+        SnapshotRecord flush_info(snapshot_data);
+
+        if (input_flush_info)
+            flush_info.append(*input_flush_info);
+
+        c->m_thread_scope->blackboard.snapshot(&flush_info);
+        process_scope->blackboard.snapshot(&flush_info);
+
+        Log(1).stream() << "Flushing Caliper data" << std::endl;
+
+        events.pre_write_evt(c, &flush_info);
+
+        flush(c, owner, &flush_info,
+              [this,c,&flush_info](const SnapshotRecord* snapshot){
+                  events.write_snapshot(c, &flush_info, snapshot);
+                  return true;
+              });
+
+        events.post_write_evt(c, &flush_info);
+    }
+
+    /// \brief Get the thread's throttle state for attribute \a id. Returns
+    ///   a nullptr if it doesn't exist and can't be created in a signal handler.
+    static Scope::ThrottleState* throttle_state(Scope* s, cali_id_t id, bool is_signal) {
+        if (id >= s->throttle_state.size()) {
+            if (is_signal)
+                return nullptr;
+
+            s->throttle_state.resize(std::max<size_t>(id + 1, 2 * s->throttle_state.size()));
+        }
+
+        return &s->throttle_state[id];
+    }
+
+    /// \brief Check if the region filter drops the begin event for
+    ///   \a attr = \a data, and record the decision for the matching end
+    bool begin_filtered(Scope* s, const Attribute& attr, const Variant& data, bool is_signal) {
+        ThrottleEntry* e = find_throttle_entry(attr.id(), false);
+        const RegionFilter* f = e ? e->filter.load(std::memory_order_acquire) : nullptr;
+
+        if (!f)
+            return false;
+
+        Scope::FilterState* st = filter_state(s, attr.id(), is_signal);
+
+        // Without state we couldn't match the end event, and beyond
+        // depth 64 we can't record the decision: keep these regions
+        if (!st)
+            return false;
+
+        bool excluded = st->depth < 64 && (*f->fn)(f->arg, attr, data, is_signal);
+
+        if (st->depth < 64) {
+            if (excluded)
+                st->excluded |=  (uint64_t(1) << st->depth);
+            else
+                st->excluded &= ~(uint64_t(1) << st->depth);
+        }
+
+        ++st->depth;
+
+        if (excluded)
+            e->num_filtered.fetch_add(1, std::memory_order_relaxed);
+
+        return excluded;
+    }
+
+    /// \brief Check if the region filter dropped the begin event that
+    ///   matches this end event of \a attr. Only reads existing state,
+    ///   so it is safe in signal handlers.
+    bool end_filtered(Scope* s, const Attribute& attr) {
+        if (attr.id() >= s->filter_state.size())
+            return false;
+
+        Scope::FilterState* st = &s->filter_state[attr.id()];
+
+        // begin events before the filter was installed have no state
+        if (st->depth == 0)
+            return false;
+
+        --st->depth;
+
+        return st->depth < 64 && (st->excluded & (uint64_t(1) << st->depth));
+    }
+
+    /// \brief Check if a begin event of \a attr invokes callbacks
+    bool begin_enabled(Scope* s, const Attribute& attr, bool is_signal) {
+        if (attr.skip_events())
+            return false;
+        if (!throttle_active.load(std::memory_order_relaxed))
+            return true;
+
+        ThrottleEntry* e = find_throttle_entry(attr.id(), false);
+
+        if (!e)
+            return true;
+
+        unsigned rate = e->rate.load(std::memory_order_relaxed);
+        Scope::ThrottleState* st = throttle_state(s, attr.id(), is_signal);
+        bool enabled = (rate == 0);
+
+        if (st) {
+            if (rate != 0 && rate != Caliper::EventThrottleCountOnly && ++st->count >= rate) {
+                st->count = 0;
+                enabled   = true;
+            }
+
+            if (st->depth < 64) {
+                if (enabled)
+                    st->enabled |=  (uint64_t(1) << st->depth);
+                else
+                    st->enabled &= ~(uint64_t(1) << st->depth);
+            }
+
+            ++st->depth;
+        }
+
+        if (!enabled)
+            e->num_skipped.fetch_add(1, std::memory_order_relaxed);
+
+        return enabled;
+    }
+
+    /// \brief Get the thread's filter state for attribute \a id. Returns
+    ///   a nullptr if it doesn't exist and can't be created in a signal handler.
+    static Scope::FilterState* filter_state(Scope* s, cali_id_t id, bool is_signal) {
+        if (id >= s->filter_state.size()) {
+            if (is_signal)
+                return nullptr;
+
+            s->filter_state.resize(std::max<size_t>(id + 1, 2 * s->filter_state.size()));
+        }
+
+        return &s->filter_state[id];
+    }
+
+    /// \brief Check if an end event of \a attr invokes callbacks. Follows
+    ///   the decision for the matching begin event.
+    bool end_enabled(Scope* s, const Attribute& attr, bool is_signal) {
+        if (attr.skip_events())
+            return false;
+        if (!throttle_active.load(std::memory_order_relaxed))
+            return true;
+
+        ThrottleEntry* e = find_throttle_entry(attr.id(), false);
+
+        if (!e)
+            return true;
+
+        unsigned rate = e->rate.load(std::memory_order_relaxed);
+        Scope::ThrottleState* st = throttle_state(s, attr.id(), is_signal);
+        bool enabled = (rate == 0);
+
+        // If there is no open throttled begin event, the begin event
+        // came before throttling was enabled
+        if (st && st->depth > 0) {
+            --st->depth;
+
+            if (st->depth < 64)
+                enabled = (st->enabled & (uint64_t(1) << st->depth));
+        } else if (st)
+            enabled = true;
+
+        if (!enabled)
+            e->num_skipped.fetch_add(1, std::memory_order_relaxed);
+
+        return enabled;
+    }
+
+    /// \brief Check if a set event of \a attr invokes callbacks
+    bool set_enabled(Scope* s, const Attribute& attr, bool is_signal) {
+        if (attr.skip_events())
+            return false;
+        if (!throttle_active.load(std::memory_order_relaxed))
+            return true;
+
+        ThrottleEntry* e = find_throttle_entry(attr.id(), false);
+
+        if (!e)
+            return true;
+
+        unsigned rate = e->rate.load(std::memory_order_relaxed);
+        bool enabled = (rate == 0);
+
+        if (rate != 0 && rate != Caliper::EventThrottleCountOnly) {
+            Scope::ThrottleState* st = throttle_state(s, attr.id(), is_signal);
+
+            if (st && ++st->count >= rate) {
+                st->count = 0;
+                enabled   = true;
+            }
+        }
+
+        if (!enabled)
+            e->num_skipped.fetch_add(1, std::memory_order_relaxed);
+
+        return enabled;
+    }
+
+    Scope* reuse_thread_scope() {
+        std::lock_guard<std::mutex>
+            g(thread_scope_pool_lock);
+
+        if (thread_scope_pool.empty())
+            return nullptr;
+
+        Scope* scope = thread_scope_pool.back();
+        thread_scope_pool.pop_back();
+
+        scope->set_memory_thread(util::memory_counter::thread_id());
+
+        return scope;
     }
 
     Scope* acquire_thread_scope(bool create = true) {
-        Scope* scope = static_cast<Scope*>(pthread_getspecific(thread_scope_key));
+        Scope* scope = t_thread_scope;
+
+        if (scope)
+            return scope;
+
+        // slow path: first access on this thread, or after release_thread()
+        scope = static_cast<Scope*>(pthread_getspecific(thread_scope_key));
 
         if (create && !scope) {
             scope = Caliper(this).create_scope(CALI_SCOPE_THREAD);
             pthread_setspecific(thread_scope_key, scope);
         }
 
+        t_thread_scope = scope;
+
         return scope;
     }
 
@@ -323,6 +878,9 @@ struct Caliper::GlobalData
 
         init_attribute_classes(&c);
 
+        if (config.get("self_profile").to_bool())
+            SelfProfile::enable();
+
         Services::add_default_services();
         Services::register_services(&c);
 
@@ -354,6 +912,8 @@ mutex                  Caliper::GlobalData::s_init_mutex;
 
 Caliper::GlobalData*   Caliper::GlobalData::sG = nullptr;
 
+thread_local Caliper::Scope* Caliper::GlobalData::t_thread_scope CALI_TLS_INITIAL_EXEC = nullptr;
+
 Caliper::GlobalData::InitHookList* Caliper::GlobalData::s_init_hooks = nullptr;
 
 const ConfigSet::Entry Caliper::GlobalData::s_configdata[] = {
@@ -386,6 +946,24 @@ const ConfigSet::Entry Caliper::GlobalData::s_configdata[] = {
       "Flush Caliper buffers at program exit",
       "Flush Caliper buffers at program exit"
     },
+    { "flush_threads", CALI_TYPE_UINT, "1",
+      "Number of threads for snapshot post-processing during flushes",
+      "Number of threads for snapshot post-processing (e.g., symbol lookup)\n"
+      "during flushes. 1 processes snapshots on the flushing thread,\n"
+      "0 uses one thread per hardware thread. Output services still\n"
+      "receive snapshots in order on the flushing thread."
+    },
+    { "self_profile", CALI_TYPE_BOOL, "false",
+      "Measure the time spent in Caliper",
+      "Measure the time spent in Caliper service callbacks, snapshots, and flushes.\n"
+      "Results are written to the log at exit and in cali.overhead attributes\n"
+      "at each flush."
+    },
+    { "memory_report", CALI_TYPE_BOOL, "false",
+      "Write a memory usage report at exit",
+      "Write a report of the memory reserved and used by Caliper's runtime\n"
+      "components, per component and per thread, to the log at exit."
+    },
     ConfigSet::Terminator
 };
 
@@ -470,6 +1048,17 @@ Caliper::create_scope(cali_context_scope_t st)
 {
     assert(mG != 0);
 
+    if (st == CALI_SCOPE_THREAD) {
+        Scope* s = mG->reuse_thread_scope();
+
+        if (s) {
+            m_thread_scope = s;
+            mG->events.reuse_scope_evt(this, st);
+
+            return s;
+        }
+    }
+
     Scope* s = new Scope(st);
 
     switch (st) {
@@ -569,18 +1158,12 @@ Caliper::create_attribute(const std::string& name, cali_attr_type type, int prop
     std::lock_guard<::siglock>
         g(m_thread_scope->lock);
 
-    Node* node        = nullptr;
     bool  created_now = false;
+    std::vector<int> subscribers;
 
     // Check if an attribute with this name already exists
 
-    mG->attribute_lock.lock();
-
-    auto it = mG->attribute_nodes.find(name);
-    if (it != mG->attribute_nodes.end())
-        node = it->second;
-
-    mG->attribute_lock.unlock();
+    Node* node = mG->attribute_registry.find(name);
 
     // Create attribute nodes
 
@@ -621,17 +1204,13 @@ Caliper::create_attribute(const std::string& name, cali_attr_type type, int prop
             // Check again if attribute already exists; might have been created by
             // another thread in the meantime.
             // We've created some redundant nodes then, but that's fine
-            mG->attribute_lock.lock();
-
-            auto it = mG->attribute_nodes.lower_bound(name);
+            cali_id_t meta_ids[MaxAttributeMeta];
+            size_t    n_meta = collect_meta_ids(node, meta_ids);
 
-            if (it == mG->attribute_nodes.end() || it->first != name) {
-                mG->attribute_nodes.insert(it, std::make_pair(name, node));
-                created_now = true;
-            } else
-                node = it->second;
+            Node* reg = mG->attribute_registry.insert(name, node, n_meta, meta_ids, &subscribers);
 
-            mG->attribute_lock.unlock();
+            created_now = (reg == node);
+            node = reg;
         }
     }
 
@@ -639,15 +1218,87 @@ Caliper::create_attribute(const std::string& name, cali_attr_type type, int prop
 
     Attribute attr = Attribute::make_attribute(node);
 
-    if (created_now)
+    if (created_now) {
         mG->events.create_attr_evt(this, attr);
 
+        for (int i : subscribers) {
+            GlobalData::AttributeSubscriberFn fn;
+
+            {
+                std::lock_guard<std::mutex>
+                    g(mG->attribute_subscriber_lock);
+
+                fn = mG->attribute_subscribers[i];
+            }
+
+            fn(this, attr);
+        }
+    }
+
     return attr;
 }
 
+/// \brief Return all attributes that have a metadata entry \a meta
+///
+/// Uses the attribute registry's metadata index instead of scanning
+/// all attributes.
+/// \note This function is _not_ signal safe.
+
+std::vector<Attribute>
+Caliper::find_attributes_with(const Attribute& meta) const
+{
+    std::vector<Attribute> ret;
+
+    if (!mG || meta == Attribute::invalid)
+        return ret;
+
+    std::vector<Node*> nodes = mG->attribute_registry.find_with(meta.id());
+
+    ret.reserve(nodes.size());
+
+    for (Node* node : nodes)
+        ret.push_back(Attribute::make_attribute(node));
+
+    return ret;
+}
+
+/// \brief Invoke \a fn for every attribute with metadata entry \a meta
+///
+/// \a fn is invoked right away for the existing attributes with
+/// \a meta, and later for each new attribute with \a meta after the
+/// create_attr_evt callbacks. Each matching attribute is reported
+/// exactly once, even if it is created concurrently with the
+/// subscription. There is no way to unsubscribe.
+///
+/// \note This function is _not_ signal safe.
+
+void
+Caliper::subscribe_attributes_with(const Attribute& meta,
+                                   std::function<void(Caliper*,const Attribute&)> fn)
+{
+    if (!mG || meta == Attribute::invalid)
+        return;
+
+    int index = 0;
+
+    {
+        std::lock_guard<std::mutex>
+            g(mG->attribute_subscriber_lock);
+
+        index = static_cast<int>(mG->attribute_subscribers.size());
+        mG->attribute_subscribers.push_back(fn);
+    }
+
+    std::vector<Node*> nodes = mG->attribute_registry.subscribe(meta.id(), index);
+
+    for (Node* node : nodes)
+        fn(this, Attribute::make_attribute(node));
+}
+
 /// \brief Find an attribute by name
 ///
-/// While it should be signal safe, we do not recommend using this function in a signal handler.
+/// The lookup is lock-free and does not allocate memory.
+/// \note This function is signal safe.
 ///
 /// \param name The attribute name
 /// \return Attribute object, or Attribute::invalid if not found.
@@ -657,21 +1308,9 @@ Caliper::get_attribute(const std::string& name) const
 {
     assert(mG != 0);
 
-    std::lock_guard<::siglock>
-        g(m_thread_scope->lock);
-
-    Node* node = nullptr;
-
-    mG->attribute_lock.lock();
-
-    auto it = mG->attribute_nodes.find(name);
-
-    if (it != mG->attribute_nodes.end())
-        node = it->second;
-
-    mG->attribute_lock.unlock();
+    // no signal lock necessary
 
-    return Attribute::make_attribute(node);
+    return Attribute::make_attribute(mG->attribute_registry.find(name));
 }
 
 /// \brief Find attribute by id
@@ -696,14 +1335,14 @@ Caliper::get_attributes() const
 {
     std::lock_guard<::siglock>
         g(m_thread_scope->lock);
-    std::lock_guard<std::mutex>
-        g_a(mG->attribute_lock);
 
+    std::vector<Node*>     nodes = mG->attribute_registry.get_all();
     std::vector<Attribute> ret;
-    ret.reserve(mG->attribute_nodes.size());
 
-    for (auto it : mG->attribute_nodes)
-        ret.push_back(Attribute::make_attribute(it.second));
+    ret.reserve(nodes.size());
+
+    for (Node* node : nodes)
+        ret.push_back(Attribute::make_attribute(node));
 
     return ret;
 }
@@ -792,6 +1431,50 @@ Caliper::pull_snapshot(int scopes, const SnapshotRecord* trigger_info, SnapshotR
 
     mG->events.snapshot(this, scopes, trigger_info, sbuf);
 
+    // Report counter increments since the thread's last snapshot
+
+    if (scopes & CALI_SCOPE_THREAD) {
+        int n = mG->num_counters.load(std::memory_order_acquire);
+
+        for (int i = 0; i < n; ++i) {
+            Scope::CounterSlot& slot = m_thread_scope->counters[i];
+            uint64_t val = slot.value;
+
+            if (val == slot.reported)
+                continue;
+
+            uint64_t diff = val - slot.reported;
+            slot.reported = val;
+
+            sbuf->append(mG->counter_info[i].attr_id,
+                         Variant(mG->counter_info[i].type, &diff, sizeof(uint64_t)));
+        }
+    }
+
+    for (cali_context_scope_t s : { CALI_SCOPE_TASK, CALI_SCOPE_THREAD, CALI_SCOPE_PROCESS })
+        if (scopes & s)
+            scope(s)->blackboard.snapshot(sbuf);
+}
+
+/// \brief Copy the current blackboard contents into a snapshot buffer.
+///
+/// Unlike pull_snapshot(), this does not invoke the snapshot callbacks
+/// or report counters, so it doesn't modify any measurement state. It
+/// is meant for services that need the current context, e.g. to
+/// aggregate their own data by region.
+///
+/// \note This function is signal safe.
+///
+/// \param scopes Bitfield of cali_scope_t values of the blackboards to copy
+/// \param sbuf   Caller-provided snapshot record buffer
+void
+Caliper::pull_context(int scopes, SnapshotRecord* sbuf)
+{
+    assert(mG != 0);
+
+    std::lock_guard<::siglock>
+        g(m_thread_scope->lock);
+
     for (cali_context_scope_t s : { CALI_SCOPE_TASK, CALI_SCOPE_THREAD, CALI_SCOPE_PROCESS })
         if (scopes & s)
             scope(s)->blackboard.snapshot(sbuf);
@@ -827,6 +1510,8 @@ Caliper::push_snapshot(int scopes, const SnapshotRecord* trigger_info)
     std::lock_guard<::siglock>
         g(m_thread_scope->lock);
 
+    SelfProfile::Timer t(SelfProfile::Snapshot);
+
     SnapshotRecord::FixedSnapshotRecord<80> snapshot_data;
     SnapshotRecord sbuf(snapshot_data);
 
@@ -843,22 +1528,7 @@ Caliper::flush(const SnapshotRecord* flush_info, SnapshotFlushFn proc_fn)
     std::lock_guard<::siglock>
         g(m_thread_scope->lock);
 
-    mG->events.pre_flush_evt(this, flush_info);
-
-    if (mG->events.postprocess_snapshot.empty()) {
-        mG->events.flush_evt(this, flush_info, proc_fn);
-    } else {
-        mG->events.flush_evt(this, flush_info,
-                             [this,flush_info,proc_fn](const SnapshotRecord* input_snapshot) {
-                                 SnapshotRecord::FixedSnapshotRecord<80> data;
-                                 SnapshotRecord snapshot(data);
-
-                                 snapshot.append(*input_snapshot);
-
-                                 mG->events.postprocess_snapshot(this, &snapshot);
-                                 return proc_fn(&snapshot);
-                             });
-    }
+    mG->flush(this, -1, flush_info, proc_fn);
 }
 
 
@@ -879,26 +1549,212 @@ Caliper::flush_and_write(const SnapshotRecord* input_flush_info)
     std::lock_guard<::siglock>
         g(m_thread_scope->lock);
 
-    SnapshotRecord::FixedSnapshotRecord<80> snapshot_data;
-    SnapshotRecord flush_info(snapshot_data);
+    mG->flush_and_write(this, -1, input_flush_info);
+}
 
-    if (input_flush_info)
-        flush_info.append(*input_flush_info);
 
-    m_thread_scope->blackboard.snapshot(&flush_info);
-    mG->process_scope->blackboard.snapshot(&flush_info);
+/// \brief Set the self-profiling results as global attributes.
+///
+/// Sets cali.overhead to the total time (in seconds) measured so far,
+/// and cali.overhead#\<name\> to the time of each service.
+
+void
+Caliper::set_overhead_attributes()
+{
+    double total = 0.0;
+
+    for (const SelfProfile::Result& r : SelfProfile::results()) {
+        Attribute attr =
+            create_attribute(std::string("cali.overhead#") + r.name, CALI_TYPE_DOUBLE,
+                             CALI_ATTR_ASVALUE | CALI_ATTR_GLOBAL | CALI_ATTR_SKIP_EVENTS);
+
+        set(attr, Variant(r.seconds));
+        total += r.seconds;
+    }
+
+    set(create_attribute("cali.overhead", CALI_TYPE_DOUBLE,
+                         CALI_ATTR_ASVALUE | CALI_ATTR_GLOBAL | CALI_ATTR_SKIP_EVENTS),
+        Variant(total));
+}
+
+
+/// \brief Return the memory usage of %Caliper's runtime components.
+///
+/// Sums up the memory counters (see util::memory_counter) of all runtime
+/// components by component name and thread. Values are in bytes.
+/// Entries are sorted by component name and thread; process-wide memory
+/// has thread ID -1. Counters of other threads are read while they may
+/// be updated, so the values are a momentary estimate.
+///
+/// \note This function is not signal safe.
+
+std::vector<Caliper::MemoryUsage>
+Caliper::memory_usage()
+{
+    std::map< std::pair<std::string, int>, std::pair<size_t, size_t> > usage;
+
+    for (util::memory_counter* m = util::memory_counter::list(); m; m = m->next) {
+        size_t reserved = m->reserved.load(std::memory_order_relaxed);
+        size_t used     = m->used.load(std::memory_order_relaxed);
+
+        if (reserved == 0 && used == 0)
+            continue;
+
+        auto& u = usage[std::make_pair(std::string(m->name), m->thread.load(std::memory_order_relaxed))];
+
+        u.first  += reserved;
+        u.second += used;
+    }
+
+    std::vector<MemoryUsage> ret;
+    ret.reserve(usage.size());
+
+    for (const auto& p : usage)
+        ret.push_back(MemoryUsage { p.first.first, p.first.second, p.second.first, p.second.second });
+
+    return ret;
+}
+
+namespace
+{
+
+std::ostream& print_bytes(std::ostream& os, size_t bytes)
+{
+    unitfmt_result r = unitfmt(bytes, unitfmt_bytes);
+
+    std::ostringstream sstr;
+    sstr << std::fixed << std::setprecision(1) << r.val << " " << r.symbol;
+
+    return os << std::setw(12) << sstr.str();
+}
+
+}
+
+/// \brief Write a memory usage report with the memory reserved and used
+///   per component and per thread to \a os.
+
+std::ostream&
+Caliper::print_memory_usage(std::ostream& os)
+{
+    std::vector<MemoryUsage> usage = memory_usage();
+
+    struct Sum {
+        size_t reserved = 0;
+        size_t used     = 0;
+        size_t max_thread_reserved = 0;
+        int    threads  = 0;
+    };
+
+    std::map<std::string, Sum> components;
+    std::map<int, Sum>         threads;
+    Sum                        total;
+
+    for (const MemoryUsage& u : usage) {
+        Sum& c = components[u.component];
+
+        c.reserved += u.reserved;
+        c.used     += u.used;
+
+        if (u.thread >= 0) {
+            ++c.threads;
+            c.max_thread_reserved = std::max(c.max_thread_reserved, u.reserved);
+        }
+
+        Sum& t = threads[u.thread];
+
+        t.reserved += u.reserved;
+        t.used     += u.used;
+
+        total.reserved += u.reserved;
+        total.used     += u.used;
+    }
+
+    os << "Memory usage:                   reserved        used";
+
+    for (const auto& p : components) {
+        print_bytes(print_bytes(os << "\n     " << std::left << std::setw(20) << p.first << std::right,
+                                p.second.reserved), p.second.used);
+
+        if (p.second.threads > 0)
+            print_bytes(os << "   " << p.second.threads << " thread(s), max", p.second.max_thread_reserved)
+                << " reserved per thread";
+    }
+
+    print_bytes(print_bytes(os << "\n     " << std::left << std::setw(20) << "total" << std::right,
+                            total.reserved), total.used);
+
+    os << "\n  Per thread:";
+
+    for (const auto& p : threads) {
+        std::string name =
+            p.first < 0 ? std::string("process") : std::string("thread ") + std::to_string(p.first);
+
+        print_bytes(print_bytes(os << "\n     " << std::left << std::setw(20) << name << std::right,
+                                p.second.reserved), p.second.used);
+    }
+
+    return os << std::endl;
+}
+
+
+/// \brief Enable or disable a service at runtime.
+///
+/// A disabled service's callbacks are skipped. Disabling a service first
+/// writes out and clears its buffered data, so that it isn't flushed
+/// again later, unless \a flush is false. Re-enabled services start over
+/// with empty buffers.
+/// Services that set up state when a thread starts (e.g., the sampler)
+/// don't see threads started while they are disabled.
+///
+/// \note This function is not signal safe.
+///
+/// \param service The service name
+/// \param enable  Enable (true) or disable (false) the service
+/// \param flush   Write out the service's data when disabling it
+/// \return false if \a service is not active
+
+bool
+Caliper::set_service_enabled(const std::string& service, bool enable, bool flush)
+{
+    int owner = SelfProfile::find_owner(service.c_str());
+
+    if (!mG || owner <= SelfProfile::Flush || owner >= 64) {
+        Log(0).stream() << "error: service \"" << service << "\" is not active" << endl;
+        return false;
+    }
+
+    std::atomic<uint64_t>& mask = util::callback_disabled();
+    uint64_t bit = uint64_t(1) << owner;
+
+    if (enable) {
+        if (mask.fetch_and(~bit) & bit)
+            Log(1).stream() << "Enabled service " << service << endl;
+    } else if (!(mask.fetch_or(bit) & bit)) {
+        Log(1).stream() << "Disabling service " << service << endl;
+
+        std::lock_guard<::siglock>
+            g(m_thread_scope->lock);
+
+        if (flush)
+            mG->flush_and_write(this, owner, nullptr);
+
+        mG->events.clear_evt.invoke_owner(owner, this);
+    }
 
-    Log(1).stream() << "Flushing Caliper data" << std::endl;
+    return true;
+}
 
-    mG->events.pre_write_evt(this, &flush_info);
+/// \brief Returns false if \a service is disabled or not active
 
-    flush(&flush_info,
-          [this,&flush_info](const SnapshotRecord* snapshot){
-              mG->events.write_snapshot(this, &flush_info, snapshot);
-              return true;
-          });
+bool
+Caliper::is_service_enabled(const std::string& service) const
+{
+    int owner = SelfProfile::find_owner(service.c_str());
 
-    mG->events.post_write_evt(this, &flush_info);
+    if (owner <= SelfProfile::Flush)
+        return false;
+
+    return !util::callback_is_disabled(util::callback_disabled().load(), owner);
 }
 
 
@@ -945,9 +1801,17 @@ Caliper::begin(const Attribute& attr, const Variant& data)
 
     std::lock_guard<::siglock>
         g(m_thread_scope->lock);
+    ::tree_signal_guard
+        tg(m_thread_scope->tree, m_is_signal);
+
+    if (mG->filter_active.load(std::memory_order_relaxed) &&
+        mG->begin_filtered(m_thread_scope, attr, data, m_is_signal))
+        return CALI_SUCCESS;
+
+    bool events = mG->begin_enabled(m_thread_scope, attr, m_is_signal);
 
     // invoke callbacks
-    if (!attr.skip_events())
+    if (events)
         mG->events.pre_begin_evt(this, attr, data);
 
     Scope* s = scope(attr2caliscope(attr));
@@ -955,13 +1819,82 @@ Caliper::begin(const Attribute& attr, const Variant& data)
 
     if (attr.store_as_value())
         ret = sb->set(attr, data);
-    else
-        ret = sb->set_node(mG->get_key(attr),
-                           m_thread_scope->tree.get_path(1, &attr, &data,
-                                                         sb->get_node(mG->get_key(attr))));
+    else {
+        Attribute key    = mG->get_key(attr);
+        Node*     parent = sb->get_node(key);
+        Node*     node   = m_thread_scope->tree.get_path(1, &attr, &data, parent);
+
+        ret = sb->set_node(key, node);
+
+        if (s == m_thread_scope && ret == CALI_SUCCESS)
+            s->push_region(attr.id(), node, node->parent());
+    }
+
+    // invoke callbacks
+    if (events)
+        mG->events.post_begin_evt(this, attr, data);
+
+    return ret;
+}
+
+/// \brief Push attribute:value pair on blackboard, using a cached
+///   context tree node.
+///
+/// Like begin(const Attribute&, const Variant&), but first checks if
+/// the node in \a hint is the child of the current \a attr node, and
+/// uses it instead of searching the context tree if so. Otherwise,
+/// stores the node found in the tree in \a hint. The hint may be
+/// shared between threads; a stale hint only costs a tree lookup.
+///
+/// This function is signal safe.
+///
+/// \param attr Attribute key
+/// \param data Value to set. Must match the value of the node in \a hint.
+/// \param hint Cached context tree node for \a attr and \a data
+///   of a previous call, or a pointer to \c nullptr.
+
+cali_err
+Caliper::begin(const Attribute& attr, const Variant& data, Node** hint)
+{
+    if (!mG || attr == Attribute::invalid)
+        return CALI_EINV;
+    if (attr.store_as_value())
+        return begin(attr, data);
+
+    std::lock_guard<::siglock>
+        g(m_thread_scope->lock);
+    ::tree_signal_guard
+        tg(m_thread_scope->tree, m_is_signal);
+
+    if (mG->filter_active.load(std::memory_order_relaxed) &&
+        mG->begin_filtered(m_thread_scope, attr, data, m_is_signal))
+        return CALI_SUCCESS;
+
+    bool events = mG->begin_enabled(m_thread_scope, attr, m_is_signal);
+
+    // invoke callbacks
+    if (events)
+        mG->events.pre_begin_evt(this, attr, data);
+
+    Scope* s = scope(attr2caliscope(attr));
+    ContextBuffer* sb = &s->blackboard;
+
+    Attribute key    = mG->get_key(attr);
+    Node*     parent = sb->get_node(key);
+    Node*     node   = __atomic_load_n(hint, __ATOMIC_ACQUIRE);
+
+    if (!node || node->parent() != (parent ? parent : m_thread_scope->tree.root())) {
+        node = m_thread_scope->tree.get_path(1, &attr, &data, parent);
+        __atomic_store_n(hint, node, __ATOMIC_RELEASE);
+    }
+
+    cali_err ret = sb->set_node(key, node);
+
+    if (s == m_thread_scope && ret == CALI_SUCCESS)
+        s->push_region(attr.id(), node, node->parent());
 
     // invoke callbacks
-    if (!attr.skip_events())
+    if (events)
         mG->events.post_begin_evt(this, attr, data);
 
     return ret;
@@ -984,21 +1917,54 @@ Caliper::end(const Attribute& attr)
 
     cali_err ret = CALI_EINV;
 
+    std::lock_guard<::siglock>
+        g(m_thread_scope->lock);
+    ::tree_signal_guard
+        tg(m_thread_scope->tree, m_is_signal);
+
+    if (mG->filter_active.load(std::memory_order_relaxed) &&
+        mG->end_filtered(m_thread_scope, attr))
+        return CALI_SUCCESS;
+
     Scope* s = scope(attr2caliscope(attr));
     ContextBuffer* sb = &s->blackboard;
 
+    // Fast path: properly nested end of the top-most region on the
+    // thread's region stack
+
+    if (s == m_thread_scope && !attr.store_as_value()) {
+        Attribute key = mG->get_key(attr);
+        Scope::RegionStackEntry r;
+
+        if (s->pop_region(attr.id(), sb->get_node(key), r)) {
+            Variant value = r.node->data();
+            bool events = mG->end_enabled(m_thread_scope, attr, m_is_signal);
+
+            if (events)
+                mG->events.pre_end_evt(this, attr, value);
+
+            if (r.parent == m_thread_scope->tree.root())
+                ret = sb->unset(key);
+            else
+                ret = sb->set_node(key, r.parent);
+
+            if (events)
+                mG->events.post_end_evt(this, attr, value);
+
+            return ret;
+        }
+    }
+
     Entry  e = get(attr);
 
     if (e.is_empty())
         return CALI_ESTACK;
 
-    std::lock_guard<::siglock>
-        g(m_thread_scope->lock);
+    bool events = mG->end_enabled(m_thread_scope, attr, m_is_signal);
 
     // invoke callbacks
-    if (!attr.skip_events())
-        if (!e.is_empty()) // prevent executing events for
-            mG->events.pre_end_evt(this, attr, e.value());
+    if (events)
+        mG->events.pre_end_evt(this, attr, e.value());
 
     if (attr.store_as_value())
         ret = sb->unset(attr);
@@ -1019,7 +1985,7 @@ Caliper::end(const Attribute& attr)
     }
 
     // invoke callbacks
-    if (!attr.skip_events())
+    if (events)
         mG->events.post_end_evt(this, attr, e.value());
 
     return ret;
@@ -1048,12 +2014,16 @@ Caliper::set(const Attribute& attr, const Variant& data)
 
     std::lock_guard<::siglock>
         g(m_thread_scope->lock);
+    ::tree_signal_guard
+        tg(m_thread_scope->tree, m_is_signal);
 
     Scope* s = scope(attr2caliscope(attr));
     ContextBuffer* sb = &s->blackboard;
 
+    bool events = mG->set_enabled(m_thread_scope, attr, m_is_signal);
+
     // invoke callbacks
-    if (!attr.skip_events())
+    if (events)
         mG->events.pre_set_evt(this, attr, data);
 
     if (attr.store_as_value())
@@ -1065,12 +2035,80 @@ Caliper::set(const Attribute& attr, const Variant& data)
     }
 
     // invoke callbacks
-    if (!attr.skip_events())
+    if (events)
         mG->events.post_set_evt(this, attr, data);
 
     return ret;
 }
 
+/// \brief Set values for several attributes on the blackboard.
+///
+/// Works like calling set() for each attribute/value pair in order, but
+/// takes the scope lock only once. The pre_set_many/post_set_many
+/// callbacks are invoked once for the whole batch, including entries for
+/// attributes with the CALI_ATTR_SKIP_EVENTS property. The per-attribute
+/// pre_set/post_set callbacks are still invoked for each pair, unless
+/// CALI_ATTR_SKIP_EVENTS is set.
+///
+/// This function is signal safe.
+///
+/// \param n    Number of attribute/value pairs
+/// \param attr Attribute keys
+/// \param data Values to set
+/// \return CALI_SUCCESS if all values were set, otherwise the error
+///   of the last failed update
+
+cali_err
+Caliper::set_many(size_t n, const Attribute attr[], const Variant data[])
+{
+    if (!mG)
+        return CALI_EINV;
+
+    cali_err ret = CALI_SUCCESS;
+
+    std::lock_guard<::siglock>
+        g(m_thread_scope->lock);
+    ::tree_signal_guard
+        tg(m_thread_scope->tree, m_is_signal);
+
+    // invoke callbacks
+    mG->events.pre_set_many_evt(this, n, attr, data);
+
+    for (size_t i = 0; i < n; ++i) {
+        if (attr[i] == Attribute::invalid) {
+            ret = CALI_EINV;
+            continue;
+        }
+
+        ContextBuffer* sb = &scope(attr2caliscope(attr[i]))->blackboard;
+        cali_err       r  = CALI_EINV;
+
+        bool events = mG->set_enabled(m_thread_scope, attr[i], m_is_signal);
+
+        if (events)
+            mG->events.pre_set_evt(this, attr[i], data[i]);
+
+        if (attr[i].store_as_value())
+            r = sb->set(attr[i], data[i]);
+        else {
+            Attribute key = mG->get_key(attr[i]);
+
+            r = sb->set_node(key, m_thread_scope->tree.replace_first_in_path(sb->get_node(key), attr[i], data[i]));
+        }
+
+        if (events)
+            mG->events.post_set_evt(this, attr[i], data[i]);
+
+        if (r != CALI_SUCCESS)
+            ret = r;
+    }
+
+    // invoke callbacks
+    mG->events.post_set_many_evt(this, n, attr, data);
+
+    return ret;
+}
+
 /// \brief Set a list of values for attribute \a attr blackboard.
 ///
 /// Sets the given values on the blackboard. Overwrites
@@ -1096,12 +2134,16 @@ Caliper::set_path(const Attribute& attr, size_t n, const Variant* data) {
 
     std::lock_guard<::siglock>
         g(m_thread_scope->lock);
+    ::tree_signal_guard
+        tg(m_thread_scope->tree, m_is_signal);
 
     Scope* s = scope(attr2caliscope(attr));
     ContextBuffer* sb = &s->blackboard;
 
+    bool events = mG->set_enabled(m_thread_scope, attr, m_is_signal);
+
     // invoke callbacks
-    if (!attr.skip_events())
+    if (events)
         mG->events.pre_set_evt(this, attr, data[n-1]);
 
     if (attr.store_as_value()) {
@@ -1115,12 +2157,184 @@ Caliper::set_path(const Attribute& attr, size_t n, const Variant* data) {
     }
 
     // invoke callbacks
-    if (!attr.skip_events())
+    if (events)
         mG->events.post_set_evt(this, attr, data[n-1]);
 
     return ret;
 }
 
+// --- Event throttling
+
+/// \brief Limit the callbacks invoked for updates of \a attr.
+///
+/// Throttled updates still change the blackboard, but only some or none
+/// of them invoke the pre/post begin/set/end callbacks. With \a rate
+/// N > 1, every Nth begin/end pair (and every Nth set) on each thread
+/// invokes callbacks. Begin/end pairs stay matched: an end event invokes
+/// callbacks only if its begin event did. With
+/// \a rate == EventThrottleCountOnly, no callbacks are invoked, and the
+/// updates are only counted. A \a rate of 0 or 1 removes the throttle.
+///
+/// \param attr The attribute
+/// \param rate Throttle rate
+
+void
+Caliper::set_event_throttle(const Attribute& attr, unsigned rate)
+{
+    if (!mG || attr == Attribute::invalid)
+        return;
+
+    GlobalData::ThrottleEntry* e = mG->find_throttle_entry(attr.id(), true);
+
+    if (!e) {
+        Log(0).stream() << "error: cannot throttle events for attribute " << attr.name() << endl;
+        return;
+    }
+
+    e->rate.store(rate > 1 ? rate : 0);
+    mG->throttle_active.store(true);
+}
+
+/// \brief Install a region filter for \a attr.
+///
+/// Caliper invokes \a fn on every begin event for \a attr. If it
+/// returns \c true, the begin event and its matching end event are
+/// dropped: they return right away without updating the blackboard,
+/// creating context tree nodes, or invoking callbacks. Nested regions
+/// inside a dropped region are not affected. \a fn may be invoked
+/// in a signal handler (its \a is_signal argument is set then) and on
+/// any thread. A \a fn of \c nullptr removes the filter.
+///
+/// Decisions are tracked per thread, so begin and end events of a
+/// filtered attribute must happen on the same thread.
+///
+/// \param attr The attribute
+/// \param fn   Filter function
+/// \param arg  User argument passed to \a fn
+
+void
+Caliper::set_region_filter(const Attribute& attr, RegionFilterFn fn, const void* arg)
+{
+    if (!mG || attr == Attribute::invalid)
+        return;
+
+    GlobalData::ThrottleEntry* e = mG->find_throttle_entry(attr.id(), true);
+
+    if (!e) {
+        Log(0).stream() << "error: cannot filter regions for attribute " << attr.name() << endl;
+        return;
+    }
+
+    e->filter.store(fn ? new GlobalData::RegionFilter { fn, arg } : nullptr,
+                    std::memory_order_release);
+    mG->filter_active.store(true);
+}
+
+/// \brief Returns the number of begin events of \a attr that were
+///   dropped by a region filter
+
+uint64_t
+Caliper::num_filtered_regions(const Attribute& attr)
+{
+    if (!mG || attr == Attribute::invalid)
+        return 0;
+
+    GlobalData::ThrottleEntry* e = mG->find_throttle_entry(attr.id(), false);
+
+    return e ? e->num_filtered.load() : 0;
+}
+
+/// \brief Returns the number of updates of \a attr that didn't invoke
+///   callbacks because of set_event_throttle().
+
+uint64_t
+Caliper::num_throttled_events(const Attribute& attr)
+{
+    if (!mG || attr == Attribute::invalid)
+        return 0;
+
+    GlobalData::ThrottleEntry* e = mG->find_throttle_entry(attr.id(), false);
+
+    return e ? e->num_skipped.load() : 0;
+}
+
+// --- Counters
+
+/// \brief Create a counter for the integer attribute \a attr.
+///
+/// Counters are per-thread accumulators. add_to_counter() only updates
+/// the calling thread's counter value and invokes no callbacks. Each
+/// snapshot that includes the thread scope reports the increment since
+/// the thread's previous snapshot as an immediate \a attr entry. \a attr
+/// should therefore have the CALI_ATTR_ASVALUE property. Creating a
+/// counter for the same attribute again returns the existing counter.
+///
+/// \return Counter handle, or -1 on error
+
+int
+Caliper::create_counter(const Attribute& attr)
+{
+    if (!mG || attr == Attribute::invalid)
+        return -1;
+
+    cali_attr_type type = attr.type();
+
+    if (type != CALI_TYPE_INT && type != CALI_TYPE_UINT) {
+        Log(0).stream() << "error: counter attribute " << attr.name()
+                        << " must have type int or uint" << endl;
+        return -1;
+    }
+
+    std::lock_guard<std::mutex>
+        g(mG->counter_lock);
+
+    int n = mG->num_counters.load();
+
+    for (int i = 0; i < n; ++i)
+        if (mG->counter_info[i].attr_id == attr.id())
+            return i;
+
+    if (n >= MaxCounters) {
+        Log(0).stream() << "error: cannot create counter " << attr.name()
+                        << ": too many counters" << endl;
+        return -1;
+    }
+
+    mG->counter_info[n].attr_id = attr.id();
+    mG->counter_info[n].type    = type;
+
+    mG->num_counters.store(n + 1, std::memory_order_release);
+
+    return n;
+}
+
+/// \brief Add \a val to the calling thread's value of \a counter.
+///
+/// Negative increments of int counters wrap around. Only reads the
+/// cached thread scope pointer on the fast path, so it does not need
+/// a Caliper instance object.
+
+void
+Caliper::add_to_counter(int counter, uint64_t val)
+{
+    if (counter < 0 || counter >= MaxCounters)
+        return;
+
+    Scope* scope = GlobalData::t_thread_scope;
+
+    if (!scope) {
+        // slow path: first access on this thread
+        Caliper c;
+
+        if (!c)
+            return;
+
+        scope = c.m_thread_scope;
+    }
+
+    scope->counters[counter].value += val;
+}
+
 // --- Query
 
 /// \brief Retrieve top-most entry for the given attribute key from the blackboard.
@@ -1164,6 +2378,32 @@ Caliper::memory_region_begin(const void* ptr, const char* label, size_t elem_siz
     mG->events.track_mem_evt(this, ptr, label, elem_size, ndims, dims);    
 }
 
+void
+Caliper::memory_regions_begin(size_t n, const MemoryRegion regions[])
+{
+    std::lock_guard<::siglock>
+        g(m_thread_scope->lock);
+
+    if (!mG->events.track_mem_batch_evt.empty()) {
+        mG->events.track_mem_batch_evt(this, n, regions);
+        return;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        if (regions[i].label)
+            mG->events.track_mem_evt(this, regions[i].ptr, regions[i].label,
+                                     regions[i].elem_size, regions[i].ndims, regions[i].dims);
+}
+
+void
+Caliper::memory_region_label(const void* ptr, const char* label)
+{
+    std::lock_guard<::siglock>
+        g(m_thread_scope->lock);
+
+    mG->events.label_mem_evt(this, ptr, label);
+}
+
 void
 Caliper::memory_region_end(const void* ptr)
 {
@@ -1189,6 +2429,8 @@ Caliper::make_entrylist(size_t n, const Attribute* attr, const Variant* value, S
 {
     std::lock_guard<::siglock>
         g(m_thread_scope->lock);
+    ::tree_signal_guard
+        tg(m_thread_scope->tree, m_is_signal);
 
     Node* node = parent;
 
@@ -1220,6 +2462,8 @@ Caliper::make_entrylist(const Attribute& attr, size_t n, const Variant* value, S
 
     std::lock_guard<::siglock>
         g(m_thread_scope->lock);
+    ::tree_signal_guard
+        tg(m_thread_scope->tree, m_is_signal);
 
     if (attr.store_as_value())
         // only store one value entry
@@ -1244,6 +2488,8 @@ Caliper::make_tree_entry(size_t n, const Node* nodelist[], Node* parent)
 {
     std::lock_guard<::siglock>
         g(m_thread_scope->lock);
+    ::tree_signal_guard
+        tg(m_thread_scope->tree, m_is_signal);
 
     return m_thread_scope->tree.get_path(n, nodelist, parent);
 }
@@ -1266,6 +2512,8 @@ Caliper::make_tree_entry(const Attribute& attr, const Variant& data, Node*  pare
 
     std::lock_guard<::siglock>
         g(m_thread_scope->lock);
+    ::tree_signal_guard
+        tg(m_thread_scope->tree, m_is_signal);
 
     return m_thread_scope->tree.get_path(1, &attr, &data, parent);
 }
@@ -1310,6 +2558,88 @@ Caliper::exchange(const Attribute& attr, const Variant& data)
     return scope(attr2caliscope(attr))->blackboard.exchange(attr, data);
 }
 
+/// Atomically update a value on the blackboard. Invokes \a fn with the
+/// current value for the given attribute key (or an empty Variant if
+/// there is none) and stores the result, all under a single lock of the
+/// blackboard. Concurrent updates of a process-scope attribute from
+/// several threads are therefore never lost.
+///
+/// Like exchange(), this function does not invoke the set callbacks.
+/// \a fn must not call back into the %Caliper API.
+///
+/// This function is signal safe if \a fn is.
+///
+/// \param attr Attribute key. Must have AS_VALUE attribute property.
+/// \param fn   Computes the new value from the current one. If it
+///   returns an empty Variant, the blackboard is left unchanged.
+///
+/// \return The new value.
+
+Variant
+Caliper::update(const Attribute& attr, const std::function<Variant(const Variant&)>& fn)
+{
+    if (!mG || attr == Attribute::invalid || !attr.store_as_value())
+        return Variant();
+
+    std::lock_guard<::siglock>
+        g(m_thread_scope->lock);
+
+    return scope(attr2caliscope(attr))->blackboard.update(attr, fn);
+}
+
+/// Atomically add \a delta to the value of a numeric attribute on the
+/// blackboard, starting from zero if the attribute has no value yet.
+/// \see update()
+///
+/// \param attr  Attribute key. Must have AS_VALUE property and type
+///   CALI_TYPE_INT, CALI_TYPE_UINT, or CALI_TYPE_DOUBLE.
+/// \param delta The value to add. Converted to the attribute's type.
+///
+/// \return CALI_ETYPE if the attribute type is not numeric or
+///   \a delta can't be converted, CALI_EINV if the attribute is not
+///   stored as value, CALI_SUCCESS otherwise.
+
+cali_err
+Caliper::add(const Attribute& attr, const Variant& delta)
+{
+    if (!mG || attr == Attribute::invalid || !attr.store_as_value())
+        return CALI_EINV;
+
+    cali_attr_type type = attr.type();
+    bool ok = false;
+
+    switch (type) {
+    case CALI_TYPE_INT:
+    {
+        int d = delta.to_int(&ok);
+
+        if (ok)
+            update(attr, [d](const Variant& v){ return Variant(v.to_int() + d); });
+    }
+    break;
+    case CALI_TYPE_UINT:
+    {
+        uint64_t d = delta.to_uint(&ok);
+
+        if (ok)
+            update(attr, [d](const Variant& v){ return Variant(v.to_uint() + d); });
+    }
+    break;
+    case CALI_TYPE_DOUBLE:
+    {
+        double d = delta.to_double(&ok);
+
+        if (ok)
+            update(attr, [d](const Variant& v){ return Variant(v.to_double() + d); });
+    }
+    break;
+    default:
+        break;
+    }
+
+    return ok ? CALI_SUCCESS : CALI_ETYPE;
+}
+
 
 //
 // --- Caliper constructor & singleton API
@@ -39,10 +39,13 @@
 #include "caliper/common/Attribute.h"
 #include "caliper/common/Node.h"
 
+#include "caliper/common/util/memory_counter.hpp"
 #include "caliper/common/util/spinlock.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <mutex>
 #include <vector>
 
@@ -51,6 +54,12 @@
 using namespace cali;
 using namespace std;
 
+namespace
+{
+
+util::spinlock_stats s_lock_stats("ContextBuffer");
+
+}
 
 struct ContextBuffer::ContextBufferImpl
 {
@@ -58,6 +67,9 @@ struct ContextBuffer::ContextBufferImpl
 
     mutable util::spinlock m_lock;
 
+    // buffers that are only accessed by a single thread (thread scope) don't need the lock
+    bool m_shared;
+
     // m_attr array stores attribute ids for context nodes, hidden entries, and immediate entries
     // m_data array stores context node ids, hidden values, and immediate data
     // boundaries within the arrays are defined by m_num_nodes and m_num_hidden
@@ -75,32 +87,292 @@ struct ContextBuffer::ContextBufferImpl
     vector<Variant>::size_type m_num_hidden;
 
     vector<Variant>::size_type m_max_entries;
-    
+
+    // m_index maps attribute ids to their slot in the attr/data arrays.
+    //   It is an open-addressing hash table, its size is a power of 2.
+
+    struct IndexSlot {
+        cali_id_t key;
+        size_t    pos;
+    };
+
+    static const size_t npos = ~static_cast<size_t>(0);
+
+    vector<IndexSlot> m_index;
+
+    // Shared buffers publish a copy of their snapshot entries after each
+    // update, so that snapshot() readers don't take the lock or write any
+    // shared memory. There are two copies: writers fill the inactive one
+    // and then advance m_version, whose lowest bit selects the active
+    // copy. Readers copy out of the active one and retry if m_version
+    // changed in the meantime. Writers never modify the active copy, so
+    // a reader in a signal handler that interrupted a writer on the same
+    // thread still succeeds.
+
+    static const size_t PublishedCapacity = 128;
+
+    struct Published {
+        bool      overflow;  ///< Too many entries: readers must take the lock
+        size_t    num_nodes;
+        size_t    num_imm;
+        Node*     nodes[PublishedCapacity];
+        cali_id_t attrs[PublishedCapacity];
+        Variant   data[PublishedCapacity];
+    };
+
+    Published             m_published[2];
+    std::atomic<uint64_t> m_version;
+
+    util::memory_counter* m_memory;
+
+    // --- lock helper
+
+    struct buffer_lock {
+        const ContextBufferImpl* b;
+
+        buffer_lock(const ContextBufferImpl* p)
+            : b(p) {
+            if (b->m_shared)
+                b->m_lock.lock();
+        }
+
+        ~buffer_lock() {
+            if (b->m_shared)
+                b->m_lock.unlock();
+        }
+    };
+
+    // --- index operations
+
+    static size_t hash_id(cali_id_t id) {
+        uint64_t h = static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(h ^ (h >> 32));
+    }
+
+    size_t find_pos(cali_id_t id) const {
+        size_t mask = m_index.size() - 1;
+
+        for (size_t i = hash_id(id) & mask; m_index[i].key != CALI_INV_ID; i = (i + 1) & mask)
+            if (m_index[i].key == id)
+                return m_index[i].pos;
+
+        return npos;
+    }
+
+    void index_put(cali_id_t id, size_t pos) {
+        size_t mask = m_index.size() - 1;
+        size_t i    = hash_id(id) & mask;
+
+        while (m_index[i].key != CALI_INV_ID && m_index[i].key != id)
+            i = (i + 1) & mask;
+
+        m_index[i].key = id;
+        m_index[i].pos = pos;
+    }
+
+    // remove \a id, moving later entries of its probe chain back
+    void index_erase(cali_id_t id) {
+        size_t mask = m_index.size() - 1;
+        size_t i    = hash_id(id) & mask;
+
+        while (m_index[i].key != id) {
+            if (m_index[i].key == CALI_INV_ID)
+                return;
+
+            i = (i + 1) & mask;
+        }
+
+        for (size_t j = (i + 1) & mask; m_index[j].key != CALI_INV_ID; j = (j + 1) & mask) {
+            size_t home = hash_id(m_index[j].key) & mask;
+
+            // move slot j into the gap at i if its home slot isn't in (i, j]
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                m_index[i] = m_index[j];
+                i = j;
+            }
+        }
+
+        m_index[i].key = CALI_INV_ID;
+    }
+
+    void rebuild_index() {
+        size_t size = 64;
+
+        while (size < 2 * m_keys.size())
+            size *= 2;
+
+        m_index.assign(size, IndexSlot { CALI_INV_ID, 0 });
+
+        for (size_t n = 0; n < m_keys.size(); ++n)
+            index_put(m_keys[n], n);
+    }
+
+    void swap_entries(size_t a, size_t b) {
+        if (a == b)
+            return;
+
+        std::swap(m_keys[a], m_keys[b]);
+        std::swap(m_attr[a], m_attr[b]);
+        std::swap(m_data[a], m_data[b]);
+
+        index_put(m_keys[a], a);
+        index_put(m_keys[b], b);
+    }
+
+    /// \brief Update the memory counter. Called when entries are added or removed.
+    void update_memory() {
+        size_t element_bytes = sizeof(cali_id_t) + 2 * sizeof(Variant);
+
+        m_memory->set(sizeof(ContextBufferImpl)
+                      + m_keys.capacity()  * element_bytes
+                      + m_nodes.capacity() * sizeof(Node*)
+                      + m_index.capacity() * sizeof(IndexSlot),
+                      sizeof(ContextBufferImpl)
+                      + m_keys.size()      * element_bytes
+                      + m_nodes.size()     * sizeof(Node*)
+                      + m_index.size()     * sizeof(IndexSlot));
+    }
+
+    size_t push_entry(cali_id_t id, const Variant& value) {
+        m_keys.push_back(id);
+        m_attr.push_back(Variant(id));
+        m_data.push_back(value);
+
+        if (2 * m_keys.size() > m_index.size())
+            rebuild_index();
+        else
+            index_put(id, m_keys.size() - 1);
+
+        update_memory();
+
+        return m_keys.size() - 1;
+    }
+
+    // move the (new) last entry into the node section
+    void move_back_to_nodes() {
+        size_t n = m_keys.size() - 1;
+
+        swap_entries(n, m_num_nodes);
+
+        // the entry previously at m_num_nodes is now at the back:
+        // if it was hidden, move it to the end of the hidden section
+        if (m_num_hidden > 0)
+            swap_entries(n, m_num_nodes + m_num_hidden);
+
+        ++m_num_nodes;
+    }
+
+    // --- publication (shared buffers only, called with the lock held)
+
+    void publish() {
+        if (!m_shared)
+            return;
+
+        uint64_t   v = m_version.load(std::memory_order_relaxed);
+        Published& p = m_published[(v + 1) & 1];
+
+        // Readers of the previous version may still be reading this copy.
+        // Make sure they see the version change before any of our updates
+        // so that they retry.
+        std::atomic_thread_fence(std::memory_order_release);
+
+        size_t first_imm = m_num_nodes + m_num_hidden;
+        size_t n_imm     = m_data.size() - first_imm;
+
+        p.overflow = (m_num_nodes > PublishedCapacity || n_imm > PublishedCapacity);
+
+        if (!p.overflow) {
+            std::copy(m_nodes.begin(), m_nodes.begin() + m_num_nodes, p.nodes);
+            std::copy(m_keys.begin() + first_imm, m_keys.end(), p.attrs);
+            std::copy(m_data.begin() + first_imm, m_data.end(), p.data);
+
+            p.num_nodes = m_num_nodes;
+            p.num_imm   = n_imm;
+        }
+
+        m_version.store(v + 1, std::memory_order_release);
+    }
+
+    /// \brief Copy the published entries into \a sbuf. Returns false if
+    ///   the entries didn't fit into the published copy.
+    bool snapshot_published(SnapshotRecord* sbuf) const {
+        Node*     nodes[PublishedCapacity];
+        cali_id_t attrs[PublishedCapacity];
+        Variant   data[PublishedCapacity];
+
+        size_t    n_nodes = 0;
+        size_t    n_imm   = 0;
+
+        uint64_t  v = 0;
+
+        do {
+            v = m_version.load(std::memory_order_acquire);
+
+            const Published& p = m_published[v & 1];
+
+            if (p.overflow)
+                return false;
+
+            // the sizes may be torn if we race with a writer: clamp them
+            n_nodes = std::min(p.num_nodes, PublishedCapacity);
+            n_imm   = std::min(p.num_imm,   PublishedCapacity);
+
+            std::copy(p.nodes, p.nodes + n_nodes, nodes);
+            std::copy(p.attrs, p.attrs + n_imm,   attrs);
+            std::copy(p.data,  p.data  + n_imm,   data);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while (m_version.load(std::memory_order_relaxed) != v);
+
+        if (n_nodes + n_imm > 0)
+            sbuf->append(n_nodes, nodes, n_imm, attrs, data);
+
+        return true;
+    }
+
     // --- constructor
 
-    ContextBufferImpl() 
-        : m_num_nodes   { 0 },
+    ContextBufferImpl(bool shared)
+        : m_lock        { &s_lock_stats },
+          m_shared      { shared },
+          m_num_nodes   { 0 },
           m_num_hidden  { 0 },
-          m_max_entries { 0 }
+          m_max_entries { 0 },
+          m_version     { 0 },
+          m_memory      { util::memory_counter::acquire("blackboard", util::memory_counter::ProcessWide) }
         {
             m_keys.reserve(64);
             m_attr.reserve(64);
             m_data.reserve(64);
 
             m_nodes.reserve(32);
+
+            rebuild_index();
+
+            for (Published& p : m_published) {
+                p.overflow  = false;
+                p.num_nodes = 0;
+                p.num_imm   = 0;
+            }
+
+            update_memory();
         }
 
+    ~ContextBufferImpl() {
+        m_memory->release();
+    }
+
     // --- interface
 
     Variant get(const Attribute& attr) const {
         Variant ret;
 
-        std::lock_guard<util::spinlock> lock(m_lock);
+        buffer_lock lock(this);
 
-        auto it = std::find(m_keys.begin(), m_keys.end(), attr.id());
+        size_t n = find_pos(attr.id());
 
-        if (it != m_keys.end())
-            ret = m_data[it-m_keys.begin()];
+        if (n != npos)
+            ret = m_data[n];
 
         return ret;
     }
@@ -108,14 +380,11 @@ struct ContextBuffer::ContextBufferImpl
     Node* get_node(const Attribute& attr) const {
         Node* ret = nullptr;
 
-        std::lock_guard<util::spinlock> lock(m_lock);
-
-        auto end = m_keys.begin() + m_num_nodes;
-        auto it  = std::find(m_keys.begin(), end, attr.id());
+        buffer_lock lock(this);
 
-        if (it != end) {
-            vector<Variant>::size_type n = it - m_keys.begin();
+        size_t n = find_pos(attr.id());
 
+        if (n < m_num_nodes) {
             assert(n < m_nodes.size());
             ret = m_nodes[n];
         }
@@ -126,69 +395,76 @@ struct ContextBuffer::ContextBufferImpl
     Variant exchange(const Attribute& attr, const Variant& value) {
         Variant ret;
 
-        {
-            std::lock_guard<util::spinlock> lock(m_lock);
+        buffer_lock lock(this);
 
-            // Only handle immediate or hidden entries for now
-            auto it = std::find(m_keys.begin() + m_num_nodes, m_keys.end(), attr.id());
+        // Only handle immediate or hidden entries for now
+        size_t n = find_pos(attr.id());
 
-            if (it != m_keys.end()) {
-                ret = m_data[it-m_keys.begin()];
-                m_data[it-m_keys.begin()] = value;
-            }
+        if (n != npos && n >= m_num_nodes) {
+            ret = m_data[n];
+            m_data[n] = value;
+        } else {
+            set_unlocked(attr, value, n);
         }
-        
-        if (ret.empty())
-            set(attr, value);
+
+        publish();
 
         return ret;
     }
 
-    cali_err set(const Attribute& attr, const Variant& value) {
-        std::lock_guard<util::spinlock> lock(m_lock);
+    Variant update(const Attribute& attr, const std::function<Variant(const Variant&)>& fn) {
+        buffer_lock lock(this);
+
+        size_t  n   = find_pos(attr.id());
+        Variant ret = fn(n != npos && n >= m_num_nodes ? m_data[n] : Variant());
+
+        if (ret.empty())
+            return ret;
+
+        if (n != npos && n >= m_num_nodes)
+            m_data[n] = ret;
+        else
+            set_unlocked(attr, ret, n);
+
+        publish();
+
+        return ret;
+    }
 
-        auto it = std::find(m_keys.begin(), m_keys.end(), attr.id());
+    // --- set an entry. Caller must hold the lock and publish() afterwards.
 
-        if (it != m_keys.end()) {
+    void set_unlocked(const Attribute& attr, const Variant& value, size_t n) {
+        if (n != npos) {
             // Update entry
 
-            m_data[it - m_keys.begin()] = value;
+            m_data[n] = value;
         } else {
             // Add new entry
 
-            m_keys.push_back(attr.id());
-            m_attr.push_back(Variant(attr.id()));
-            m_data.push_back(value);
+            n = push_entry(attr.id(), value);
 
             if (!attr.store_as_value()) {
                 // this is a node, move it up front
 
                 m_nodes.push_back(nullptr);
-
-                if (m_num_nodes < m_keys.size()-1) {
-                    std::swap(m_keys.back(), m_keys[m_num_nodes]);
-                    std::swap(m_attr.back(), m_attr[m_num_nodes]);
-                    std::swap(m_data.back(), m_data[m_num_nodes]);
-                }
-
-                ++m_num_nodes;
+                move_back_to_nodes();
             } else if (attr.is_hidden()) {
                 // move "hidden" entry to the middle
-                
-                auto n = m_num_nodes + m_num_hidden;
-
-                if (n < m_keys.size()-1) {
-                    std::swap(m_keys.back(), m_keys[n]);
-                    std::swap(m_attr.back(), m_attr[n]);
-                    std::swap(m_data.back(), m_data[n]);
-                }
 
+                swap_entries(n, m_num_nodes + m_num_hidden);
                 ++m_num_hidden;
             }
         }
 
         m_max_entries = std::max(m_max_entries, m_attr.size());
-        
+    }
+
+    cali_err set(const Attribute& attr, const Variant& value) {
+        buffer_lock lock(this);
+
+        set_unlocked(attr, value, find_pos(attr.id()));
+        publish();
+
         return CALI_SUCCESS;
     }
 
@@ -196,16 +472,13 @@ struct ContextBuffer::ContextBufferImpl
         if (!node || attr.store_as_value())
             return CALI_EINV;
 
-        std::lock_guard<util::spinlock> lock(m_lock);
+        buffer_lock lock(this);
 
-        auto end = m_keys.begin() + m_num_nodes;
-        auto it  = std::find(m_keys.begin(), end, attr.id());
+        size_t n = find_pos(attr.id());
 
-        if (it != end) {
+        if (n < m_num_nodes) {
             // Update entry
 
-            vector<Variant>::size_type n = it - m_keys.begin();
-
             assert(n < m_nodes.size());
 
             m_data[n]  = Variant(node->id());
@@ -213,44 +486,32 @@ struct ContextBuffer::ContextBufferImpl
         } else {
             // Add new entry
 
-            m_keys.emplace_back(attr.id());
-            m_attr.emplace_back(Variant(attr.id()));
-            m_data.emplace_back(node->id());
+            push_entry(attr.id(), Variant(node->id()));
 
             m_nodes.push_back(node);
 
             // this is a node, move entry in attr/data array up front
-
-            if (m_num_nodes < m_keys.size()-1) {
-                std::swap(m_keys.back(), m_keys[m_num_nodes]);
-                std::swap(m_attr.back(), m_attr[m_num_nodes]);
-                std::swap(m_data.back(), m_data[m_num_nodes]);
-            }
-            if (m_num_hidden > 0) {
-                std::swap(m_keys.back(), m_keys[m_num_nodes+m_num_hidden]);
-                std::swap(m_attr.back(), m_attr[m_num_nodes+m_num_hidden]);
-                std::swap(m_data.back(), m_data[m_num_nodes+m_num_hidden]);
-            }
-
-            ++m_num_nodes;
+            move_back_to_nodes();
         }
 
         m_max_entries = std::max(m_max_entries, m_attr.size());
 
+        publish();
+
         return CALI_SUCCESS;
     }
 
     cali_err unset(const Attribute& attr) {
         cali_err ret = CALI_SUCCESS;
 
-        std::lock_guard<util::spinlock> lock(m_lock);
+        buffer_lock lock(this);
 
-        auto it = std::find(m_keys.begin(), m_keys.end(), attr.id());
+        size_t n = find_pos(attr.id());
 
-        if (it != m_keys.end()) {
-            vector<Variant>::size_type n = it - m_keys.begin();
+        if (n != npos) {
+            index_erase(attr.id());
 
-            m_keys.erase(it);
+            m_keys.erase(m_keys.begin() + n);
             m_attr.erase(m_attr.begin() + n);
             m_data.erase(m_data.begin() + n);
 
@@ -261,13 +522,40 @@ struct ContextBuffer::ContextBufferImpl
                 --m_num_nodes;
             else if (n < m_num_nodes + m_num_hidden)
                 --m_num_hidden;
+
+            // entries behind n have moved
+            for (size_t k = n; k < m_keys.size(); ++k)
+                index_put(m_keys[k], k);
+
+            update_memory();
+            publish();
         }
 
         return ret;
     }
 
+    void clear() {
+        buffer_lock lock(this);
+
+        m_keys.clear();
+        m_attr.clear();
+        m_data.clear();
+        m_nodes.clear();
+
+        m_num_nodes  = 0;
+        m_num_hidden = 0;
+
+        std::fill(m_index.begin(), m_index.end(), IndexSlot { CALI_INV_ID, 0 });
+
+        update_memory();
+        publish();
+    }
+
     void snapshot(SnapshotRecord* sbuf) const {
-        std::lock_guard<util::spinlock> lock(m_lock);
+        if (m_shared && snapshot_published(sbuf))
+            return;
+
+        buffer_lock lock(this);
 
         cali::Node* const*   nodeptr = m_num_nodes > 0 ? m_nodes.data() : nullptr;
 
@@ -288,13 +576,15 @@ struct ContextBuffer::ContextBufferImpl
     }
 };
 
+const size_t ContextBuffer::ContextBufferImpl::PublishedCapacity;
+
 
 //
 // --- ContextBuffer public interface
 //
 
-ContextBuffer::ContextBuffer()
-    : mP(new ContextBufferImpl)
+ContextBuffer::ContextBuffer(bool shared)
+    : mP(new ContextBufferImpl(shared))
 { }
 
 ContextBuffer::~ContextBuffer()
@@ -317,6 +607,11 @@ Variant ContextBuffer::exchange(const Attribute& attr, const Variant& data)
     return mP->exchange(attr, data);
 }
 
+Variant ContextBuffer::update(const Attribute& attr, const std::function<Variant(const Variant&)>& fn)
+{
+    return mP->update(attr, fn);
+}
+
 cali_err ContextBuffer::set_node(const Attribute& attr, Node* node)
 {
     return mP->set_node(attr, node);
@@ -332,6 +627,11 @@ cali_err ContextBuffer::unset(const Attribute& attr)
     return mP->unset(attr);
 }
 
+void ContextBuffer::clear()
+{
+    mP->clear();
+}
+
 void ContextBuffer::snapshot(SnapshotRecord* sbuf) const
 {
     mP->snapshot(sbuf);
@@ -341,3 +641,8 @@ std::ostream& ContextBuffer::print_statistics(std::ostream& os) const
 {
     return mP->print_statistics(os);
 }
+
+void ContextBuffer::set_memory_thread(int thread)
+{
+    mP->m_memory->thread.store(thread);
+}
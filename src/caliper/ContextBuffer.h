@@ -39,6 +39,7 @@
 #include "caliper/common/Record.h"
 #include "caliper/common/Variant.h"
 
+#include <functional>
 #include <iostream>
 #include <memory>
 
@@ -57,7 +58,10 @@ class ContextBuffer
 
 public:
 
-    ContextBuffer();
+    /// \brief Create a blackboard buffer.
+    /// \param shared Whether the buffer can be accessed by multiple
+    ///   threads. Non-shared (i.e., thread-scope) buffers skip locking.
+    explicit ContextBuffer(bool shared = true);
     ~ContextBuffer();
 
     /// @name set / unset entries
@@ -68,10 +72,23 @@ public:
 
     Variant  exchange(const Attribute&, const Variant&);
 
+    /// \brief Atomically replace the immediate entry for \a attr with
+    ///   the result of \a fn.
+    ///
+    /// \a fn receives the current value (empty if there is none) and
+    /// runs while the buffer is locked, so it must not call back into
+    /// the buffer. If \a fn returns an empty Variant, the entry is left
+    /// unchanged.
+    /// \return The new value
+    Variant  update(const Attribute&, const std::function<Variant(const Variant&)>& fn);
+
     cali_err set_node(const Attribute&, Node*);
     cali_err set(const Attribute&, const Variant&);
     cali_err unset(const Attribute&);
 
+    /// \brief Remove all entries. Keeps allocated storage for re-use.
+    void     clear();
+
     /// @}
     /// @name get context
     /// @{
@@ -84,6 +101,10 @@ public:
 
     std::ostream& print_statistics(std::ostream& os) const;
 
+    /// \brief Set the thread that memory accounting attributes the
+    ///   buffer to
+    void     set_memory_thread(int thread);
+
     /// @}
 };
 
@@ -0,0 +1,284 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file FlushPipeline.cpp
+/// FlushPipeline implementation
+
+#include "FlushPipeline.h"
+
+#include "caliper/SnapshotRecord.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+// Number of snapshots per batch
+constexpr size_t batch_size = 256;
+
+/// \brief A batch of snapshots in flat arrays
+struct Batch {
+    struct Record {
+        size_t n_nodes;
+        size_t n_imm;
+    };
+
+    std::vector<Record>    records;
+    std::vector<Node*>     nodes;
+    std::vector<cali_id_t> attr;
+    std::vector<Variant>   data;
+
+    bool                   done = false;
+
+    void append(const SnapshotRecord* snapshot) {
+        SnapshotRecord::Data  d = snapshot->data();
+        SnapshotRecord::Sizes s = snapshot->size();
+
+        records.push_back({ s.n_nodes, s.n_immediate });
+        for (size_t i = 0; i < s.n_nodes; ++i)
+            nodes.push_back(const_cast<Node*>(d.node_entries[i]));
+        attr.insert (attr.end(),  d.immediate_attr, d.immediate_attr + s.n_immediate);
+        data.insert (data.end(),  d.immediate_data, d.immediate_data + s.n_immediate);
+    }
+
+    /// \brief Invoke \a fn for a SnapshotRecord view of each snapshot.
+    ///   With \a replace, replaces the batch contents with the records as
+    ///   modified by \a fn.
+    template<typename Fn>
+    bool for_each(Fn fn, bool replace) {
+        Batch out;
+        size_t node_pos = 0, imm_pos = 0;
+
+        for (const Record& r : records) {
+            SnapshotRecord::FixedSnapshotRecord<80> snapshot_data;
+            SnapshotRecord snapshot(snapshot_data);
+
+            snapshot.append(r.n_nodes, nodes.data() + node_pos, r.n_imm, attr.data() + imm_pos, data.data() + imm_pos);
+
+            node_pos += r.n_nodes;
+            imm_pos  += r.n_imm;
+
+            if (!fn(&snapshot))
+                return false;
+
+            if (replace)
+                out.append(&snapshot);
+        }
+
+        if (replace) {
+            records.swap(out.records);
+            nodes.swap(out.nodes);
+            attr.swap(out.attr);
+            data.swap(out.data);
+        }
+
+        return true;
+    }
+};
+
+}
+
+struct FlushPipeline::FlushPipelineImpl
+{
+    Caliper::SnapshotFlushFn m_proc_fn;
+
+    std::shared_ptr<Batch>   m_current;
+
+    std::mutex               m_lock;
+    std::condition_variable  m_work_cv;
+    std::condition_variable  m_done_cv;
+
+    std::deque< std::shared_ptr<Batch> > m_output; ///< batches in flush order
+    std::deque< std::shared_ptr<Batch> > m_work;   ///< batches waiting for a worker
+
+    size_t                   m_max_batches;
+    bool                     m_stop;
+    bool                     m_stopped_by_output;
+
+    std::vector<std::thread> m_threads;
+
+    void worker() {
+        Caliper c = Caliper::instance();
+
+        while (true) {
+            std::shared_ptr<Batch> batch;
+
+            {
+                std::unique_lock<std::mutex> g(m_lock);
+
+                m_work_cv.wait(g, [this](){ return m_stop || !m_work.empty(); });
+
+                if (m_work.empty())
+                    return;
+
+                batch = m_work.front();
+                m_work.pop_front();
+            }
+
+            batch->for_each([&c](SnapshotRecord* snapshot){
+                    c.events().postprocess_snapshot(&c, snapshot);
+                    return true;
+                }, true);
+
+            {
+                std::lock_guard<std::mutex> g(m_lock);
+                batch->done = true;
+            }
+
+            m_done_cv.notify_all();
+        }
+    }
+
+    /// \brief Write out processed batches at the front of the output queue.
+    ///   If \a all is set, waits for and writes all batches. Otherwise,
+    ///   only waits if there are too many batches in flight.
+    void write_batches(bool all) {
+        while (!m_stopped_by_output) {
+            std::shared_ptr<Batch> batch;
+
+            {
+                std::unique_lock<std::mutex> g(m_lock);
+
+                if (m_output.empty())
+                    return;
+
+                if (!m_output.front()->done) {
+                    if (!all && m_output.size() <= m_max_batches)
+                        return;
+
+                    m_done_cv.wait(g, [this](){ return m_output.front()->done; });
+                }
+
+                batch = m_output.front();
+                m_output.pop_front();
+            }
+
+            if (!batch->for_each(m_proc_fn, false))
+                m_stopped_by_output = true;
+        }
+    }
+
+    void submit() {
+        if (!m_current)
+            return;
+
+        {
+            std::lock_guard<std::mutex> g(m_lock);
+
+            m_output.push_back(m_current);
+            m_work.push_back(m_current);
+        }
+
+        m_work_cv.notify_one();
+        m_current.reset();
+    }
+
+    bool push(const SnapshotRecord* snapshot) {
+        if (m_stopped_by_output)
+            return false;
+
+        if (!m_current)
+            m_current = std::make_shared<Batch>();
+
+        m_current->append(snapshot);
+
+        if (m_current->records.size() >= batch_size) {
+            submit();
+            write_batches(false);
+        }
+
+        return !m_stopped_by_output;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> g(m_lock);
+            m_stop = true;
+        }
+
+        m_work_cv.notify_all();
+
+        for (auto& t : m_threads)
+            t.join();
+
+        m_threads.clear();
+    }
+
+    void finish() {
+        submit();
+        write_batches(true);
+        stop();
+    }
+
+    FlushPipelineImpl(unsigned num_threads, Caliper::SnapshotFlushFn proc_fn)
+        : m_proc_fn(proc_fn),
+          m_max_batches(4 * num_threads),
+          m_stop(false),
+          m_stopped_by_output(false)
+    {
+        for (unsigned i = 0; i < num_threads; ++i)
+            m_threads.emplace_back(&FlushPipelineImpl::worker, this);
+    }
+
+    ~FlushPipelineImpl() {
+        if (!m_threads.empty())
+            finish();
+    }
+};
+
+
+FlushPipeline::FlushPipeline(unsigned num_threads, Caliper::SnapshotFlushFn proc_fn)
+    : mP(new FlushPipelineImpl(num_threads, proc_fn))
+{ }
+
+FlushPipeline::~FlushPipeline()
+{
+    mP.reset();
+}
+
+bool
+FlushPipeline::push(const SnapshotRecord* snapshot)
+{
+    return mP->push(snapshot);
+}
+
+void
+FlushPipeline::finish()
+{
+    mP->finish();
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file FlushPipeline.h
+/// \brief Runs snapshot post-processing in parallel during flushes
+
+#ifndef CALI_FLUSHPIPELINE_H
+#define CALI_FLUSHPIPELINE_H
+
+#include "caliper/Caliper.h"
+
+#include <memory>
+
+namespace cali
+{
+
+/// \brief Staged flush pipeline.
+///
+/// The flushing thread pushes the snapshots produced by the flush
+/// callbacks into the pipeline. They are collected in batches, and a
+/// pool of worker threads runs the postprocess_snapshot callbacks on the
+/// batches, each worker with its own Caliper instance. The processed
+/// snapshots are handed to the output function on the flushing thread,
+/// in their original order. Output services thus see the same sequence
+/// of snapshots as in a serial flush.
+///
+/// Post-processing callbacks must be thread-safe to be used in a
+/// pipeline.
+class FlushPipeline
+{
+    struct FlushPipelineImpl;
+    std::unique_ptr<FlushPipelineImpl> mP;
+
+public:
+
+    FlushPipeline(unsigned num_threads, Caliper::SnapshotFlushFn proc_fn);
+
+    ~FlushPipeline();
+
+    /// \brief Add a snapshot. May write out processed snapshots.
+    /// \return false if the output function asked to stop the flush
+    bool push(const SnapshotRecord* snapshot);
+
+    /// \brief Process and write all remaining snapshots, and stop the
+    ///   worker threads
+    void finish();
+};
+
+} // namespace cali
+
+#endif
@@ -32,28 +32,39 @@
 
 #include "MemoryPool.h"
 
+#include "caliper/common/Log.h"
 #include "caliper/common/RuntimeConfig.h"
 
 #include "caliper/common/c-util/unitfmt.h"
 
+#include "caliper/common/util/memory_counter.hpp"
 #include "caliper/common/util/spinlock.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <cstring>
 #include <mutex>
 #include <vector>
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 
 using namespace cali;
 using namespace std;
 
+namespace
+{
+
+util::spinlock_stats s_lock_stats("MemoryPool");
+
+}
 
 struct MemoryPool::MemoryPoolImpl
 {
     // --- data
 
-    const size_t chunksize = 64 * 1024;
-
     static const ConfigSet::Entry s_configdata[];
 
     template<typename T> 
@@ -61,67 +72,312 @@ struct MemoryPool::MemoryPoolImpl
         T*     ptr;
         size_t wmark;
         size_t size;
+        bool   mapped;  // allocated with mmap (size is rounded up to the page size)
     };
 
+    enum HugePageMode { NoHugePages, TransparentHugePages, ExplicitHugePages };
+
+    //   Per-thread arena: a chunk carved from the shared pool that its
+    // owning thread bump-allocates from without locking.
+
+    struct Arena {
+        uint64_t*           ptr;
+        size_t              wmark;
+        size_t              size;
+        std::atomic<size_t> used;  // words; written by the owning thread only
+
+        Arena()
+            : ptr(nullptr), wmark(0), size(0), used(0)
+            { }
+    };
+
+    // Max. number of pools a thread keeps arenas for. There are only a
+    // few pools per process; the shared pool serves any further ones.
+    static const size_t MaxThreadArenas = 16;
+
     ConfigSet                 m_config;
 
+    size_t                    m_chunksize;   // in words
+    size_t                    m_arenasize;   // in words
+    uint64_t                  m_serial;
+
+    bool                      m_use_mmap;
+    HugePageMode              m_hugepages;
+    bool                      m_numa_local;
+
     util::spinlock            m_lock;
         
     vector< Chunk<uint64_t> > m_chunks;
     size_t                    m_index;
     bool                      m_can_expand;
 
+    vector<Arena*>            m_arenas;
+
     size_t                    m_total_reserved;
-    size_t                    m_total_used;
-    
+    size_t                    m_total_used;   // direct (non-arena) allocations
+
+    util::memory_counter*     m_memory;       // in bytes
+
+    static uint64_t next_serial() {
+        static std::atomic<uint64_t> s_serial { 0 };
+        return ++s_serial;
+    }
+
     // --- interface 
 
+    /// \brief Allocate a chunk of at least \a len words. Requires m_lock
+    ///   (or exclusive access during construction).
+    Chunk<uint64_t> allocate_chunk(size_t len) {
+        if (!m_use_mmap)
+            return { new uint64_t[len], 0, len, false };
+
+        size_t align = (m_hugepages == NoHugePages ? sysconf(_SC_PAGESIZE) : 2 * 1024 * 1024);
+        size_t bytes = ((len * sizeof(uint64_t) + align - 1) / align) * align;
+        void*  ptr   = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+        if (m_hugepages == ExplicitHugePages) {
+            ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+            if (ptr == MAP_FAILED) {
+                Log(1).stream() << "MemoryPool: huge page allocation failed, falling back to regular pages" << std::endl;
+                m_hugepages = TransparentHugePages;
+            }
+        }
+#endif
+
+        if (ptr == MAP_FAILED)
+            ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (ptr == MAP_FAILED) {
+            Log(0).stream() << "MemoryPool: mmap failed, using heap memory" << std::endl;
+            return { new uint64_t[len], 0, len, false };
+        }
+
+#ifdef MADV_HUGEPAGE
+        if (m_hugepages == TransparentHugePages)
+            madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+
+        return { static_cast<uint64_t*>(ptr), 0, bytes / sizeof(uint64_t), true };
+    }
+
+    void free_chunk(Chunk<uint64_t>& c) {
+        if (c.mapped)
+            munmap(c.ptr, c.size * sizeof(uint64_t));
+        else
+            delete[] c.ptr;
+    }
+
     void expand(size_t bytes) {
-        size_t len = max((bytes+sizeof(uint64_t)-1)/sizeof(uint64_t), chunksize);
+        size_t len = max((bytes+sizeof(uint64_t)-1)/sizeof(uint64_t), m_chunksize);
 
-        m_chunks.push_back( { new uint64_t[len], 0, len } );
+        m_chunks.push_back(allocate_chunk(len));
 
         m_index = m_chunks.size() - 1;
-        m_total_reserved += len;
+        m_total_reserved += m_chunks.back().size;
+        m_memory->add(m_chunks.back().size * sizeof(uint64_t), 0);
     }
 
-    void* allocate(size_t bytes, bool can_expand) {
-        size_t n = (bytes+sizeof(uint64_t)-1)/sizeof(uint64_t);
+    /// \brief Allocate a dedicated arena chunk of \a n words for the calling thread.
+    ///   The calling thread touches every page first so that the OS
+    /// places the pages on the thread's NUMA node (first-touch policy).
+    Chunk<uint64_t> allocate_local_chunk(size_t n) {
+        Chunk<uint64_t> c;
 
-        std::lock_guard<util::spinlock> lock(m_lock);
-        
+        {
+            std::lock_guard<util::spinlock> lock(m_lock);
+
+            c = allocate_chunk(n);
+
+            // Keep m_index on the current shared chunk so that it never
+            // allocates from the new chunk
+            m_chunks.push_back(c);
+            m_total_reserved += c.size;
+            m_memory->add(c.size * sizeof(uint64_t), 0);
+        }
+
+        size_t page = sysconf(_SC_PAGESIZE) / sizeof(uint64_t);
+
+        for (size_t i = 0; i < c.size; i += page)
+            c.ptr[i] = 0;
+
+        return c;
+    }
+
+    /// \brief Allocate \a n words from the shared chunks. Requires m_lock.
+    uint64_t* allocate_shared(size_t n, bool can_expand) {
         if (m_index == m_chunks.size() || m_chunks[m_index].wmark + n > m_chunks[m_index].size) {
             if (can_expand)
-                expand(bytes);
+                expand(n * sizeof(uint64_t));
             else
                 return nullptr;
         }
 
-        void *ptr = static_cast<void*>(m_chunks[m_index].ptr + m_chunks[m_index].wmark);
+        uint64_t* ptr = m_chunks[m_index].ptr + m_chunks[m_index].wmark;
         m_chunks[m_index].wmark += n;
 
-        m_total_used += n;
         return ptr;
     }
 
-    std::ostream& print_statistics(std::ostream& os) const {
+    /// \brief Get the calling thread's arena for this pool, or a nullptr
+    ///   if the thread's arena table is full. Creates the arena if the
+    ///   thread doesn't have one yet and \a create is set; this allocates
+    ///   heap memory and takes the pool lock.
+    Arena* get_arena(bool create) {
+        // Pools are identified by their serial number rather than their address,
+        // so entries of deleted pools can never be mistaken for a new pool.
+        // The table must be trivially destructible: Caliper still allocates
+        // in exit handlers, which run after thread-local destructors.
+        struct ThreadArena {
+            uint64_t serial;
+            Arena*   arena;
+        };
+
+        static thread_local ThreadArena t_arenas[MaxThreadArenas];
+        static thread_local size_t      t_num_arenas = 0;
+
+        for (size_t i = 0; i < t_num_arenas; ++i)
+            if (t_arenas[i].serial == m_serial)
+                return t_arenas[i].arena;
+
+        if (!create || t_num_arenas >= MaxThreadArenas)
+            return nullptr;
+
+        Arena* arena = new Arena;
+
+        {
+            std::lock_guard<util::spinlock> lock(m_lock);
+            m_arenas.push_back(arena);
+        }
+
+        t_arenas[t_num_arenas].serial = m_serial;
+        t_arenas[t_num_arenas].arena  = arena;
+        ++t_num_arenas;
+
+        return arena;
+    }
+
+    void* allocate(size_t bytes, bool can_expand) {
+        size_t n = (bytes+sizeof(uint64_t)-1)/sizeof(uint64_t);
+
+        // Large requests, and threads without a free arena slot, go
+        // directly to the shared pool. So do threads without an arena yet
+        // if the pool can't expand (e.g., in signal handlers).
+
+        Arena* arena = (n > m_arenasize / 4 ? nullptr : get_arena(can_expand));
+
+        if (!arena) {
+            std::lock_guard<util::spinlock> lock(m_lock);
+
+            uint64_t* ptr = allocate_shared(n, can_expand);
+
+            if (ptr) {
+                m_total_used += n;
+                m_memory->add(0, n * sizeof(uint64_t));
+            }
+
+            return ptr;
+        }
+
+        if (arena->wmark + n > arena->size) {
+            // Carve a new arena chunk from the shared pool. The rest of the
+            // old arena chunk is wasted.
+
+            uint64_t* ptr  = nullptr;
+            size_t    size = m_arenasize;
+
+            if (m_numa_local) {
+                if (!can_expand)
+                    return nullptr;
+
+                Chunk<uint64_t> c = allocate_local_chunk(m_arenasize);
+
+                ptr  = c.ptr;
+                size = c.size;
+            } else {
+                std::lock_guard<util::spinlock> lock(m_lock);
+                ptr = allocate_shared(m_arenasize, can_expand);
+            }
+
+            if (!ptr)
+                return nullptr;
+
+            arena->ptr   = ptr;
+            arena->wmark = 0;
+            arena->size  = size;
+        }
+
+        void* ptr = static_cast<void*>(arena->ptr + arena->wmark);
+
+        arena->wmark += n;
+        arena->used.store(arena->used.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        m_memory->add(0, n * sizeof(uint64_t));
+
+        return ptr;
+    }
+
+    std::ostream& print_statistics(std::ostream& os) {
+        size_t reserved = 0;
+        size_t used     = 0;
+        size_t arenas   = 0;
+
+        {
+            std::lock_guard<util::spinlock> lock(m_lock);
+
+            reserved = m_total_reserved;
+            used     = m_total_used;
+            arenas   = m_arenas.size();
+
+            for (const Arena* a : m_arenas)
+                used += a->used.load(std::memory_order_relaxed);
+        }
+
         unitfmt_result bytes_reserved 
-            = unitfmt(m_total_reserved, unitfmt_bytes);
+            = unitfmt(reserved * sizeof(uint64_t), unitfmt_bytes);
         unitfmt_result bytes_used     
-            = unitfmt(m_total_used,     unitfmt_bytes);
+            = unitfmt(used     * sizeof(uint64_t), unitfmt_bytes);
 
         os << "Metadata memory pool: "
            << bytes_reserved.val << " " << bytes_reserved.symbol << " reserved, "
-           << bytes_used.val     << " " << bytes_used.symbol     << " used";
+           << bytes_used.val     << " " << bytes_used.symbol     << " used, "
+           << arenas << " thread arena(s)";
 
         return os;
     }
     
     MemoryPoolImpl() 
-        : m_config { RuntimeConfig::init("memory", s_configdata) }, m_index { 0 },
-          m_total_reserved { 0 }, m_total_used { 0 }
+        : m_config { RuntimeConfig::init("memory", s_configdata) },
+          m_serial { next_serial() },
+          m_use_mmap { false },
+          m_hugepages { NoHugePages },
+          m_numa_local { false },
+          m_lock { &s_lock_stats },
+          m_index { 0 },
+          m_total_reserved { 0 }, m_total_used { 0 },
+          m_memory { util::memory_counter::acquire("metadata tree", util::memory_counter::ProcessWide) }
     {
         m_can_expand = m_config.get("can_expand").to_bool();
+        m_numa_local = m_config.get("numa_local_arenas").to_bool();
+
+        std::string hp = m_config.get("hugepages").to_string();
+
+        if (hp == "transparent")
+            m_hugepages = TransparentHugePages;
+        else if (hp == "explicit")
+            m_hugepages = ExplicitHugePages;
+        else {
+            if (hp != "none")
+                Log(0).stream() << "MemoryPool: unknown hugepages mode \"" << hp << "\", using \"none\"" << std::endl;
+
+            m_hugepages = NoHugePages;
+        }
+
+        m_use_mmap = m_config.get("use_mmap").to_bool() || m_hugepages != NoHugePages;
+
+        m_chunksize  = max<size_t>(1, m_config.get("chunk_size").to_uint() / sizeof(uint64_t));
+        m_arenasize  = max<size_t>(1, m_config.get("arena_size").to_uint() / sizeof(uint64_t));
+
         size_t s     = m_config.get("pool_size").to_uint();
 
         expand(s);
@@ -129,9 +385,12 @@ struct MemoryPool::MemoryPoolImpl
     
     ~MemoryPoolImpl() {            
         for ( auto &c : m_chunks )
-            delete[] c.ptr;
+            free_chunk(c);
+        for ( Arena* a : m_arenas )
+            delete a;
 
         m_chunks.clear();
+        m_memory->release();
     }
 };
 
@@ -147,6 +406,34 @@ const ConfigSet::Entry MemoryPool::MemoryPoolImpl::s_configdata[] = {
       "Allow memory pool to expand at runtime",
       "Allow memory pool to expand at runtime"
     },
+    { "chunk_size", CALI_TYPE_UINT, "65536",
+      "Minimum size of memory chunks added when the pool expands (in bytes)",
+      "Minimum size of memory chunks added when the pool expands (in bytes)"
+    },
+    { "arena_size", CALI_TYPE_UINT, "16384",
+      "Size of per-thread arena chunks carved from the pool (in bytes)",
+      "Size of per-thread arena chunks carved from the pool (in bytes).\n"
+      "Threads allocate from their own arena without locking.\n"
+      "Requests larger than a quarter of the arena size are allocated\n"
+      "from the shared pool directly."
+    },
+    { "use_mmap", CALI_TYPE_BOOL, "false",
+      "Allocate memory pool chunks with mmap",
+      "Allocate memory pool chunks with mmap instead of the heap"
+    },
+    { "hugepages", CALI_TYPE_STRING, "none",
+      "Huge page backing for memory pool chunks: none, transparent, or explicit",
+      "Huge page backing for memory pool chunks. Implies use_mmap.\n"
+      "  none:        Regular pages\n"
+      "  transparent: Advise the kernel to use transparent huge pages\n"
+      "  explicit:    Use explicit (hugetlbfs) huge pages; falls back to\n"
+      "               transparent huge pages if none are available"
+    },
+    { "numa_local_arenas", CALI_TYPE_BOOL, "false",
+      "Allocate each thread arena chunk separately on the thread's NUMA node",
+      "Allocate each thread arena chunk separately, and first-touch its pages\n"
+      "from the owning thread so that they are placed on the thread's NUMA node"
+    },
     ConfigSet::Terminator
 };
 
@@ -173,6 +460,11 @@ void* MemoryPool::allocate(size_t bytes)
     return mP->allocate(bytes, mP->m_can_expand);
 }
 
+void MemoryPool::set_memory_thread(int thread)
+{
+    mP->m_memory->thread.store(thread);
+}
+
 std::ostream& MemoryPool::print_statistics(std::ostream& os) const
 {
     return mP->print_statistics(os);
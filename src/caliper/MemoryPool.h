@@ -68,6 +68,10 @@ public:
 
     void* allocate(std::size_t bytes);
 
+    /// \brief Set the thread that memory accounting attributes the
+    ///   pool to (a util::memory_counter thread id)
+    void set_memory_thread(int thread);
+
     std::ostream& print_statistics(std::ostream& os) const;
 };
 
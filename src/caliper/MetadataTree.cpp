@@ -39,21 +39,58 @@
 #include "MemoryPool.h"
 
 #include "caliper/common/Attribute.h"
+#include "caliper/common/Log.h"
 #include "caliper/common/Node.h"
 #include "caliper/common/RuntimeConfig.h"
 #include "caliper/common/Variant.h"
 
+#include "caliper/common/c-util/unitfmt.h"
+
+#include "caliper/common/util/memory_counter.hpp"
 #include "caliper/common/util/spinlock.hpp"
 
 #include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
 #include <utility>
+#include <vector>
+
+#include <sys/mman.h>
 
 // #define METADATATREE_BENCHMARK
 
 using namespace cali;
 
+namespace
+{
+
+util::spinlock_stats s_orphaned_mempool_lock_stats("MetadataTree orphaned mempools");
+
+util::memory_counter s_directory_memory("metadata tree");
+util::memory_counter s_string_table_memory("metadata tree string table");
+
+/// \brief FNV-1a hash of \a n bytes at \a p
+uint64_t hash_bytes(const void* p, size_t n, uint64_t h = 0xcbf29ce484222325ull)
+{
+    const unsigned char* c = static_cast<const unsigned char*>(p);
+
+    for (size_t i = 0; i < n; ++i) {
+        h ^= c[i];
+        h *= 0x100000001b3ull;
+    }
+
+    return h;
+}
+
+}
+
 struct MetadataTree::MetadataTreeImpl
 {
     struct NodeBlock {
@@ -61,17 +98,97 @@ struct MetadataTree::MetadataTreeImpl
         size_t index;
     };
 
+    //   The node block directory is split into segments that are allocated
+    // on demand. Segment s holds (num_blocks << s) blocks, so the directory
+    // grows geometrically and has no practical upper limit. Segments are
+    // never moved or freed, so node lookups by id remain lock-free.
+
+    static const size_t max_segments = 40;
+
+    //   String values of context tree nodes are interned in a process-wide
+    // table, so that equal strings share storage and child lookups can
+    // compare them by pointer. The table uses open addressing and is
+    // insert-only, so lookups are lock-free. The strings are stored in
+    // the memory pool of the tree that inserted them, after a header.
+    //   Large USR (blob) values are stored out-of-line in the same table,
+    // so a blob that appears under many parents is kept only once. Blob
+    // nodes are still compared by value in child lookups.
+
+    struct InternedString {
+        uint64_t hash;
+        uint64_t len;
+
+        const char* data() const {
+            return reinterpret_cast<const char*>(this + 1);
+        }
+    };
+
+    static const size_t max_string_probes = 64;
+
+    //   The string table and the directory segments are mapped with mmap:
+    // the OS zero-fills the pages on first touch, so a short-lived process
+    // that creates only a handful of nodes doesn't pay for initializing
+    // them. Unlike malloc, this also works in signal handlers, which may
+    // have to add a directory segment. All-zero bytes are a valid empty
+    // state for both (null pointers).
+
+    static void* zeroed_alloc(size_t bytes) {
+        void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    static void zeroed_free(void* ptr, size_t bytes) {
+        if (ptr)
+            munmap(ptr, bytes);
+    }
+
     struct GlobalData {
         GlobalData(MemoryPool& pool)
             : config(RuntimeConfig::init("contexttree", s_configdata)),
               root(CALI_INV_ID, CALI_INV_ID, Variant()),
               next_block(1),
-              node_blocks(0)
+              strings(nullptr),
+              string_slots(0),
+              num_strings(0),
+              shared_bytes(0),
+              all_strings_interned(true)
             {
-                num_blocks      = config.get("num_blocks").to_uint();
+                num_blocks      = std::max<size_t>(1, config.get("num_blocks").to_uint());
                 nodes_per_block = config.get("nodes_per_block").to_uint();
 
-                node_blocks = new NodeBlock[num_blocks];
+                for (size_t s = 0; s < max_segments; ++s)
+                    segments[s].store(nullptr);
+
+                size_t intern_size = config.get("string_intern_size").to_uint();
+
+                min_blob_size = config.get("blob_intern_size").to_uint();
+
+                if (intern_size > 0) {
+                    string_slots = 64;
+
+                    while (string_slots < intern_size)
+                        string_slots *= 2;
+
+                    strings = static_cast<std::atomic<const InternedString*>*>(
+                        zeroed_alloc(string_slots * sizeof(std::atomic<const InternedString*>)));
+
+                    if (strings)
+                        s_string_table_memory.add(string_slots * sizeof(void*), string_slots * sizeof(void*));
+                    else {
+                        Log(0).stream() << "contexttree: could not allocate string table, string interning disabled"
+                                        << std::endl;
+                        string_slots = 0;
+                    }
+                }
+
+                if (!strings)
+                    all_strings_interned.store(false);
+
+                NodeBlock* block0 = node_block(0, true);
+
+                if (!block0)
+                    throw std::bad_alloc();
 
                 Node* chunk = static_cast<Node*>(pool.allocate(nodes_per_block * sizeof(Node)));
 
@@ -96,8 +213,17 @@ struct MetadataTree::MetadataTreeImpl
                 };
 
                 for (const NodeInfo* info = bootstrap_nodes; info->id != CALI_INV_ID; ++info) {
+                    Variant data = info->data;
+
+                    if (data.type() == CALI_TYPE_STRING) {
+                        const char* str = intern(static_cast<const char*>(data.data()), data.size(), &pool);
+
+                        if (str)
+                            data = Variant(CALI_TYPE_STRING, str, data.size());
+                    }
+
                     Node* node = new(chunk + info->id) 
-                        Node(info->id, info->attr_id, info->data);
+                        Node(info->id, info->attr_id, data);
 
                     if (info->parent != CALI_INV_ID)
                         chunk[info->parent].append(node);
@@ -108,48 +234,174 @@ struct MetadataTree::MetadataTreeImpl
                         type_nodes[info->data.to_attr_type()] = node;
                 }
 
-                node_blocks[0].chunk = chunk;
-                node_blocks[0].index = 11;
+                block0->chunk = chunk;
+                block0->index = 11;
             }
 
         ~GlobalData() {
-            delete[] node_blocks;
-        }            
+            for (size_t s = 0; s < max_segments; ++s)
+                zeroed_free(segments[s].load(), (num_blocks << s) * sizeof(NodeBlock));
+
+            zeroed_free(strings, string_slots * sizeof(std::atomic<const InternedString*>));
+        }
+
+        /// \brief Return the interned copy of the string \a str, or null if
+        ///   it's not in the table.
+        ///
+        /// If \a pool is given, inserts the string (with a copy allocated
+        /// from \a pool) if it's not in the table yet. If the table is
+        /// full, or disabled, this returns null and clears
+        /// \a all_strings_interned, unless \a is_string is false (i.e.,
+        /// for blob values).
+        const char* intern(const char* str, size_t len, MemoryPool* pool, bool is_string = true) {
+            if (string_slots == 0)
+                return nullptr;
+
+            uint64_t        h    = ::hash_bytes(str, len);
+            InternedString* mine = nullptr;
+
+            for (size_t i = 0; i < max_string_probes && i < string_slots; ++i) {
+                std::atomic<const InternedString*>& slot = strings[(h + i) & (string_slots - 1)];
+                const InternedString* p = slot.load(std::memory_order_acquire);
+
+                if (!p) {
+                    if (!pool)
+                        return nullptr;
+                    // keep the load factor at 3/4 or less
+                    if (num_strings.load(std::memory_order_relaxed) >= string_slots - string_slots/4)
+                        break;
+
+                    if (!mine) {
+                        const size_t align = 8;
+
+                        mine = static_cast<InternedString*>(pool->allocate(sizeof(InternedString) + len + (align - len%align)));
+
+                        if (!mine)
+                            break;
+
+                        mine->hash = h;
+                        mine->len  = len;
+                        memcpy(const_cast<char*>(mine->data()), str, len);
+                    }
+
+                    if (slot.compare_exchange_strong(p, mine, std::memory_order_acq_rel)) {
+                        num_strings.fetch_add(1, std::memory_order_relaxed);
+                        return mine->data();
+                    }
+
+                    // Another thread has filled the slot: check its string
+                }
+
+                if (p->hash == h && p->len == len && memcmp(p->data(), str, len) == 0) {
+                    if (pool)
+                        shared_bytes.fetch_add(len, std::memory_order_relaxed);
+
+                    return p->data();
+                }
+            }
+
+            if (pool && is_string)
+                all_strings_interned.store(false);
+
+            return nullptr;
+        }
+
+        /// \brief Return the node block with the given index.
+        ///   Allocates the directory segment holding it if \a create is set.
+        ///   Returns null if the segment doesn't exist or can't be mapped.
+        NodeBlock* node_block(size_t block, bool create) {
+            size_t seg   = 0;
+            size_t start = 0;
+            size_t len   = num_blocks;
+
+            while (block >= start + len) {
+                start += len;
+                len   *= 2;
+
+                if (++seg >= max_segments)
+                    return nullptr;
+            }
+
+            NodeBlock* segment = segments[seg].load(std::memory_order_acquire);
+
+            if (!segment && create) {
+                NodeBlock* new_segment = static_cast<NodeBlock*>(zeroed_alloc(len * sizeof(NodeBlock)));
+
+                if (!new_segment)
+                    return nullptr;
+
+                // Another thread may have allocated the segment in the meantime
+                if (segments[seg].compare_exchange_strong(segment, new_segment)) {
+                    segment = new_segment;
+                    s_directory_memory.add(len * sizeof(NodeBlock), len * sizeof(NodeBlock));
+                } else
+                    zeroed_free(new_segment, len * sizeof(NodeBlock));
+            }
+
+            return segment ? segment + (block - start) : nullptr;
+        }
 
         static const ConfigSet::Entry s_configdata[];
 
         ConfigSet               config;
 
         Node                    root;
-        std::atomic<unsigned>   next_block;
-        NodeBlock*              node_blocks;
+        std::atomic<size_t>     next_block;
+        std::atomic<NodeBlock*> segments[max_segments];
 
-        size_t                  num_blocks;
+        size_t                  num_blocks;      // size of the first directory segment
         size_t                  nodes_per_block;
 
         Node*                   type_nodes[CALI_MAXTYPE+1];
 
+        std::atomic<const InternedString*>* strings;
+        size_t                  string_slots;    // power of 2, or 0 if interning is disabled
+        std::atomic<size_t>     num_strings;
+        std::atomic<size_t>     shared_bytes;    // value bytes not copied thanks to interning
+        size_t                  min_blob_size;   // smallest USR value to intern, or 0
+        //   Set as long as every string node value is interned. Before a
+        // string that can't be interned is stored, this is cleared, and
+        // child lookups fall back to comparing string contents.
+        std::atomic<bool>       all_strings_interned;
+
         //   Keep the memory pools from tree objects that have been deleted
         // because we still need to access their node data.
         //
         //   TODO: find a strategy to merge them into someone else's mempool
         // and free up the unallocated memory in the pool.
         std::vector<MemoryPool> orphaned_mempools;
-        util::spinlock          orphaned_mempool_lock;
+        util::spinlock          orphaned_mempool_lock { &s_orphaned_mempool_lock_stats };
     };
 
     static std::atomic<GlobalData*> mG;
 
     MemoryPool  m_mempool;    
     NodeBlock*  m_nodeblock;
+    size_t      m_nodeblock_id;   // global index of m_nodeblock
 
     unsigned    m_num_nodes;
     unsigned    m_num_blocks;
 
+    std::chrono::steady_clock::time_point m_start_time;
+
+    //   Child list walk length after which a node's shared child index is
+    // (re)built. See LockfreeIntrusiveTree::find_child().
+    unsigned    m_index_threshold;
+
+    //   Set while the tree is used from a signal handler: lookups don't
+    // build child index segments then, because that allocates memory.
+    bool        m_in_signal;
+
+    //   Nodes created by this tree per attribute. Context tree nodes are
+    // never freed, so an attribute with unbounded distinct values (e.g.
+    // an iteration counter stored as a reference attribute) grows the
+    // tree for the lifetime of the process. We warn once when an
+    // attribute exceeds m_node_warning nodes.
+    std::unordered_map<cali_id_t, size_t> m_attr_nodes;
+    size_t      m_node_warning;
+
 #ifdef METADATATREE_BENCHMARK
     unsigned    m_num_lookups;
-    unsigned    m_max_lookup_ops;
-    unsigned    m_tot_lookup_ops;
 #endif
 
     //
@@ -158,12 +410,14 @@ struct MetadataTree::MetadataTreeImpl
 
     MetadataTreeImpl()
         : m_nodeblock(nullptr),
+          m_nodeblock_id(0),
           m_num_nodes(0),
-          m_num_blocks(0)
+          m_num_blocks(0),
+          m_index_threshold(0),
+          m_in_signal(false),
+          m_node_warning(0)
 #ifdef METADATATREE_BENCHMARK
-        , m_num_lookups(0),
-          m_max_lookup_ops(0),
-          m_tot_lookup_ops(0)
+        , m_num_lookups(0)
 #endif
         {
             GlobalData* g = mG.load();
@@ -174,13 +428,17 @@ struct MetadataTree::MetadataTreeImpl
                 // Set mG. If mG != new_g, some other thread has set it, 
                 // so just delete our new object.
                 if (mG.compare_exchange_strong(g, new_g)) {
-                    m_nodeblock = new_g->node_blocks;
+                    m_nodeblock = new_g->node_block(0, false);
 
                     ++m_num_blocks;
                     m_num_nodes = m_nodeblock->index;
                 } else
                     delete new_g;
             }
+
+            m_index_threshold = mG.load()->config.get("child_index_threshold").to_uint();
+            m_node_warning    = mG.load()->config.get("node_warning").to_uint();
+            m_start_time      = std::chrono::steady_clock::now();
         }
 
     ~MetadataTreeImpl() {
@@ -195,13 +453,29 @@ struct MetadataTree::MetadataTreeImpl
         //     n.~Node(); // Nodes have been allocated in our own pools with placement new, just call destructor here
     }
 
+    /// \brief Account for a new node of attribute \a attr_id
+    void count_node(cali_id_t attr_id) {
+        size_t count = ++m_attr_nodes[attr_id];
+
+        if (m_node_warning > 0 && count == m_node_warning) {
+            Node* attr_node = node(attr_id);
+
+            Log(1).stream() << "Attribute "
+                            << (attr_node ? attr_node->data().to_string() : std::to_string(attr_id))
+                            << " has created " << count << " context tree nodes on this thread."
+                            << " Context tree nodes are never freed. Consider storing it as a value"
+                            << " (CALI_ATTR_ASVALUE) or via CALI_CALIPER_ATTRIBUTE_PROPERTIES."
+                            << std::endl;
+        }
+    }
+
     /// \brief Get a node block with \param n free entries
 
     bool have_free_nodeblock(size_t n) {
         GlobalData* g = mG.load();
 
         if (!m_nodeblock || m_nodeblock->index + n >= g->nodes_per_block) {
-            if (g->next_block.load() >= g->num_blocks)
+            if (n >= g->nodes_per_block)
                 return false;
 
             // allocate new node block
@@ -211,12 +485,14 @@ struct MetadataTree::MetadataTreeImpl
             if (!chunk)
                 return false;
 
-            size_t block_index = g->next_block++;
+            size_t     block_index = g->next_block++;
+            NodeBlock* block       = g->node_block(block_index, true);
 
-            if (block_index >= g->num_blocks)
+            if (!block)
                 return false;
 
-            m_nodeblock = g->node_blocks + block_index;
+            m_nodeblock    = block;
+            m_nodeblock_id = block_index;
 
             m_nodeblock->chunk = chunk;
             m_nodeblock->index = 0;
@@ -227,10 +503,120 @@ struct MetadataTree::MetadataTreeImpl
         return true;
     }
 
+    //
+    // --- Child lookup
+    //
+
+    static size_t child_hash(cali_id_t attr, const Variant& data) {
+        // FNV-1a over the attribute id and value bytes
+        uint64_t h = 0xcbf29ce484222325ull;
+
+        auto mix = [&h](const unsigned char* p, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                h ^= p[i];
+                h *= 0x100000001b3ull;
+            }
+        };
+
+        mix(reinterpret_cast<const unsigned char*>(&attr), sizeof(attr));
+        mix(static_cast<const unsigned char*>(data.data()), data.size());
+
+        return static_cast<size_t>(h ^ (h >> 32));
+    }
+
+    /// \brief Find the child of \a parent with the given attribute and value.
+    ///   Uses the parent's child index for high-fanout nodes.
+
+    Node*
+    find_child(Node* parent, cali_id_t attr, const Variant& data, bool is_interned = false) {
+#ifdef METADATATREE_BENCHMARK
+        ++m_num_lookups;
+#endif
+
+        GlobalData* g = mG.load();
+
+        if (data.type() == CALI_TYPE_STRING && g->all_strings_interned.load(std::memory_order_acquire)) {
+            // Compare interned strings by pointer. If the string isn't
+            // interned, no node has this value.
+            const void* str = data.data();
+
+            if (!is_interned)
+                str = g->intern(static_cast<const char*>(data.data()), data.size(), nullptr);
+            if (!str)
+                return nullptr;
+
+            return parent->find_child(child_hash(attr, data),
+                                      [attr,str](const Node* n) {
+                                          return n->attribute() == attr && n->data().data() == str;
+                                      },
+                                      [](const Node* n) {
+                                          return child_hash(n->attribute(), n->data());
+                                      },
+                                      m_in_signal ? 0 : m_index_threshold);
+        }
+
+        return parent->find_child(child_hash(attr, data),
+                                  [attr,&data](const Node* n) {
+                                      return n->equals(attr, data);
+                                  },
+                                  [](const Node* n) {
+                                      return child_hash(n->attribute(), n->data());
+                                  },
+                                  m_in_signal ? 0 : m_index_threshold);
+    }
+
     //
     // --- Modifying tree operations
     //
 
+    /// \brief Get the storage for the data of \a n new nodes in \a ptrs.
+    ///   Uses the interned copy for strings and large USR values. Other
+    ///   strings and USR data are copied into one allocation from our
+    ///   memory pool.
+    ///   \a attr_stride is 0 if all nodes have the same attribute.
+    bool store_node_data(size_t n, const Attribute* attr, size_t attr_stride, const Variant* data, const void** ptrs) {
+        GlobalData*  g         = mG.load();
+        const size_t align     = 8;
+        size_t       data_size = 0;
+
+        for (size_t i = 0; i < n; ++i) {
+            cali_attr_type type = attr[i * attr_stride].type();
+
+            ptrs[i] = data[i].data();
+
+            if (type == CALI_TYPE_STRING)
+                ptrs[i] = g->intern(static_cast<const char*>(data[i].data()), data[i].size(), &m_mempool);
+            else if (type == CALI_TYPE_USR)
+                ptrs[i] = (g->min_blob_size > 0 && data[i].size() >= g->min_blob_size
+                           ? g->intern(static_cast<const char*>(data[i].data()), data[i].size(), &m_mempool, false)
+                           : nullptr);
+
+            if ((type == CALI_TYPE_USR || type == CALI_TYPE_STRING) && !ptrs[i])
+                data_size += data[i].size() + (align - data[i].size()%align);
+        }
+
+        if (data_size == 0)
+            return true;
+
+        char* ptr = static_cast<char*>(m_mempool.allocate(data_size));
+
+        if (!ptr)
+            return false;
+
+        for (size_t i = 0; i < n; ++i) {
+            cali_attr_type type = attr[i * attr_stride].type();
+
+            if ((type == CALI_TYPE_USR || type == CALI_TYPE_STRING) && !ptrs[i]) {
+                size_t size = data[i].size();
+
+                ptrs[i] = memcpy(ptr, data[i].data(), size);
+                ptr    += size + (align - size%align);
+            }
+        }
+
+        return true;
+    }
+
     /// \brief Creates \param n new nodes hierarchically under \param parent 
 
     Node*
@@ -240,23 +626,14 @@ struct MetadataTree::MetadataTreeImpl
         if (!have_free_nodeblock(n))
             return 0;
         
-        // Calculate and allocate required memory
-
-        const size_t align = 8;
-        size_t data_size   = 0;
+        // Get the node data storage
 
-        bool   copy        = (attr.type() == CALI_TYPE_USR || attr.type() == CALI_TYPE_STRING);
-        char*  ptr         = nullptr;
+        const void*  stack_ptrs[16];
+        std::vector<const void*> heap_ptrs(n > 16 ? n : 0);
+        const void** ptrs = (n > 16 ? heap_ptrs.data() : stack_ptrs);
 
-        if (copy) {
-            for (size_t i = 0; i < n; ++i)
-                data_size += data[i].size() + (align - data[i].size()%align);
-
-            ptr = static_cast<char*>(m_mempool.allocate(data_size));
-
-            if (!ptr)
-                return nullptr;
-        }
+        if (!store_node_data(n, &attr, 0, data, ptrs))
+            return nullptr;
 
         Node* node = nullptr;
 
@@ -265,22 +642,16 @@ struct MetadataTree::MetadataTreeImpl
         GlobalData* g = mG.load();
 
         for (size_t i = 0; i < n; ++i) {
-            const void* dptr { data[i].data() };
-            size_t size      { data[i].size() }; 
-
-            if (copy) {
-                dptr = memcpy(ptr, dptr, size);
-                ptr += size+(align-size%align);
-            }
-
             size_t index = m_nodeblock->index++;
 
             node = new(m_nodeblock->chunk + index)
-                Node((m_nodeblock - g->node_blocks) * g->nodes_per_block + index, attr.id(), Variant(attr.type(), dptr, size));
+                Node(m_nodeblock_id * g->nodes_per_block + index, attr.id(), Variant(attr.type(), ptrs[i], data[i].size()));
 
             if (parent)
                 parent->append(node);
 
+            count_node(attr.id());
+
             parent = node;
         }
 
@@ -298,23 +669,14 @@ struct MetadataTree::MetadataTreeImpl
         if (!have_free_nodeblock(n))
             return 0;
 
-        // Calculate and allocate required memory
-
-        const size_t align = 8;
-        size_t data_size   = 0;
-
-        for (size_t i = 0; i < n; ++i)
-            if (attr[i].type() == CALI_TYPE_USR || attr[i].type() == CALI_TYPE_STRING)
-                data_size += data[i].size() + (align - data[i].size()%align);
-
-        char* ptr  = nullptr;
+        // Get the node data storage
 
-        if (data_size > 0) {
-            ptr = static_cast<char*>(m_mempool.allocate(data_size));
+        const void*  stack_ptrs[16];
+        std::vector<const void*> heap_ptrs(n > 16 ? n : 0);
+        const void** ptrs = (n > 16 ? heap_ptrs.data() : stack_ptrs);
 
-            if (!ptr)
-                return nullptr;
-        }
+        if (!store_node_data(n, attr, 1, data, ptrs))
+            return nullptr;
 
         Node* node = nullptr;
         GlobalData* g = mG.load();
@@ -322,24 +684,16 @@ struct MetadataTree::MetadataTreeImpl
         // Create nodes
 
         for (size_t i = 0; i < n; ++i) {
-            bool   copy { attr[i].type() == CALI_TYPE_USR || attr[i].type() == CALI_TYPE_STRING };
-
-            const void* dptr { data[i].data() };
-            size_t size      { data[i].size() }; 
-
-            if (copy) {
-                dptr = memcpy(ptr, dptr, size);
-                ptr += size+(align-size%align);
-            }
-
             size_t index = m_nodeblock->index++;
 
             node = new(m_nodeblock->chunk + index) 
-                Node((m_nodeblock - g->node_blocks) * g->nodes_per_block + index, attr[i].id(), Variant(attr[i].type(), dptr, size));
+                Node(m_nodeblock_id * g->nodes_per_block + index, attr[i].id(), Variant(attr[i].type(), ptrs[i], data[i].size()));
 
             if (parent)
                 parent->append(node);
 
+            count_node(attr[i].id());
+
             parent = node;
         }
 
@@ -358,23 +712,8 @@ struct MetadataTree::MetadataTreeImpl
 
         for (size_t i = 0; i < n; ++i) {
             parent = node;
+            node   = find_child(parent, attr.id(), data[i]);
 
-#ifdef METADATATREE_BENCHMARK
-            unsigned num_ops = 1;
-#endif
-            
-            for (node = parent->first_child(); node && !node->equals(attr.id(), data[i]); node = node->next_sibling())
-#ifdef METADATATREE_BENCHMARK
-                ++num_ops
-#endif
-                ;
-
-#ifdef METADATATREE_BENCHMARK
-            ++m_num_lookups;
-            m_tot_lookup_ops += num_ops;
-            m_max_lookup_ops  = std::max(m_max_lookup_ops, num_ops);
-#endif
-            
             if (!node)
                 break;
 
@@ -397,22 +736,7 @@ struct MetadataTree::MetadataTreeImpl
 
         for (size_t i = 0; i < n; ++i) {
             parent = node;
-
-#ifdef METADATATREE_BENCHMARK
-            unsigned num_ops = 1;
-#endif
-
-            for (node = parent->first_child(); node && !node->equals(attr[i].id(), data[i]); node = node->next_sibling())
-#ifdef METADATATREE_BENCHMARK
-                ++num_ops
-#endif
-                ;
-
-#ifdef METADATATREE_BENCHMARK
-            ++m_num_lookups;
-            m_tot_lookup_ops += num_ops;
-            m_max_lookup_ops  = std::max(m_max_lookup_ops, num_ops);
-#endif
+            node   = find_child(parent, attr[i].id(), data[i]);
 
             if (!node)
                 break;
@@ -447,23 +771,8 @@ struct MetadataTree::MetadataTreeImpl
         if (!parent)
             parent = &(g->root);
         
-        Node* node = nullptr;
-
-#ifdef METADATATREE_BENCHMARK
-            unsigned num_ops = 1;
-#endif
-
-        for ( node = parent->first_child(); node && !node->equals(from->attribute(), from->data()); node = node->next_sibling())
-#ifdef METADATATREE_BENCHMARK
-                ++num_ops
-#endif
-            ;
-
-#ifdef METADATATREE_BENCHMARK
-            ++m_num_lookups;
-            m_tot_lookup_ops += num_ops;
-            m_max_lookup_ops  = std::max(m_max_lookup_ops, num_ops);
-#endif
+        // tree node values are already interned
+        Node* node = find_child(parent, from->attribute(), from->data(), true);
 
         if (!node) {
             if (!have_free_nodeblock(1))
@@ -472,11 +781,12 @@ struct MetadataTree::MetadataTreeImpl
             size_t index = m_nodeblock->index++;
 
             node = new(m_nodeblock->chunk + index) 
-                Node((m_nodeblock - g->node_blocks) * g->nodes_per_block + index, from->attribute(), from->data());
+                Node(m_nodeblock_id * g->nodes_per_block + index, from->attribute(), from->data());
             
             parent->append(node);
 
             ++m_num_nodes;
+            count_node(from->attribute());
         }
 
         return node;
@@ -554,10 +864,12 @@ struct MetadataTree::MetadataTreeImpl
         size_t block = id / g->nodes_per_block;
         size_t index = id % g->nodes_per_block;
 
-        if (block >= g->num_blocks || index >= g->node_blocks[block].index)
+        NodeBlock* b = g->node_block(block, false);
+
+        if (!b || index >= b->index)
             return nullptr;
 
-        return g->node_blocks[block].chunk + index;
+        return b->chunk + index;
     }
 
     //
@@ -566,18 +878,50 @@ struct MetadataTree::MetadataTreeImpl
 
     std::ostream& 
     print_statistics(std::ostream& os) const {
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start_time).count();
+
         m_mempool.print_statistics(
-            os << "Metadata tree: " << m_num_blocks << " blocks, " << m_num_nodes << " nodes\n      "
+            os << "Metadata tree: " << m_num_blocks << " blocks, " << m_num_nodes << " nodes ("
+               << (sec > 0.0 ? m_num_nodes / sec : 0.0) << " nodes/sec), "
+               << mG.load()->next_block.load() << " blocks used globally\n      "
 #ifdef METADATATREE_BENCHMARK
             << "  "
-            << m_num_lookups << " lookups with "
-            << m_tot_lookup_ops << " ops total (max "
-            << m_max_lookup_ops << " , avg "
-            << (m_num_lookups > 0 ? static_cast<double>(m_tot_lookup_ops) / m_num_lookups : 0.0)
-            << ").\n      "
+            << m_num_lookups << " lookups.\n      "
 #endif
                                    );
 
+        {
+            GlobalData* g = mG.load();
+
+            if (g->string_slots > 0) {
+                unitfmt_result shared = unitfmt(g->shared_bytes.load(), unitfmt_bytes);
+
+                os << "\n      Intern table: " << g->num_strings.load() << " values, "
+                   << shared.val << " " << shared.symbol << " shared";
+            }
+        }
+
+        // List the attributes that created the most nodes
+
+        std::vector< std::pair<cali_id_t, size_t> > top(m_attr_nodes.begin(), m_attr_nodes.end());
+        size_t ntop = std::min<size_t>(top.size(), 5);
+
+        std::partial_sort(top.begin(), top.begin() + ntop, top.end(),
+                          [](const std::pair<cali_id_t, size_t>& a, const std::pair<cali_id_t, size_t>& b) {
+                              return a.second > b.second;
+                          });
+
+        if (ntop > 0)
+            os << "\n      Nodes by attribute:";
+
+        for (size_t i = 0; i < ntop; ++i) {
+            Node* attr_node = node(top[i].first);
+
+            os << (i > 0 ? ", " : " ")
+               << (attr_node ? attr_node->data().to_string() : std::to_string(top[i].first))
+               << " " << top[i].second;
+        }
+
 	return os;
     }
 };
@@ -591,8 +935,35 @@ const ConfigSet::Entry MetadataTree::MetadataTreeImpl::GlobalData::s_configdata[
       "Number of context tree nodes in a node block", 
     },
     { "num_blocks", CALI_TYPE_UINT, "16384",
-      "Maximum number of context tree node blocks",
-      "Maximum number of context tree node blocks"
+      "Initial number of context tree node block slots",
+      "Initial number of context tree node block slots.\n"
+      "Node storage grows beyond this as needed."
+    },
+    { "child_index_threshold", CALI_TYPE_UINT, "16",
+      "Child list walk length after which a node's child index is built",
+      "Number of un-indexed children a child lookup may walk before the\n"
+      "parent node's hashed child index is built or rebuilt.\n"
+      "The index is shared by all threads. Set to 0 to disable the index."
+    },
+    { "node_warning", CALI_TYPE_UINT, "100000",
+      "Warn when an attribute creates this many context tree nodes",
+      "Print a warning when a single attribute has created this many\n"
+      "context tree nodes on a thread. Context tree nodes are never freed,\n"
+      "so this usually indicates an attribute with unbounded distinct\n"
+      "values that should be stored as a value attribute. 0 disables the warning."
+    },
+    { "string_intern_size", CALI_TYPE_UINT, "65536",
+      "Number of slots in the context tree string intern table",
+      "Number of slots in the process-wide intern table for context tree\n"
+      "string values. Equal strings share storage and are compared by pointer\n"
+      "in child lookups. When the table is 3/4 full, new strings are stored\n"
+      "separately and compared by value again. 0 disables interning."
+    },
+    { "blob_intern_size", CALI_TYPE_UINT, "32",
+      "Minimum size of USR values to store in the intern table",
+      "Minimum size in bytes of USR (blob) values to store in the context\n"
+      "tree intern table. Equal blobs of this size or larger share storage.\n"
+      "Smaller blobs are copied for each node. 0 stores all blobs separately."
     },
     ConfigSet::Terminator 
 };
@@ -693,3 +1064,17 @@ MetadataTree::print_statistics(std::ostream& os) const
 {
     return mP->print_statistics(os);
 }
+
+void
+MetadataTree::set_memory_thread(int thread)
+{
+    mP->m_mempool.set_memory_thread(thread);
+}
+
+bool
+MetadataTree::set_signal(bool is_signal)
+{
+    bool prev = mP->m_in_signal;
+    mP->m_in_signal = is_signal;
+    return prev;
+}
@@ -102,6 +102,18 @@ namespace cali
 
         std::ostream&
         print_statistics(std::ostream& os) const;
+
+        /// \brief Set the thread that memory accounting attributes the
+        ///   tree's memory pool to
+        void
+        set_memory_thread(int thread);
+
+        /// \brief Mark the tree as being used from a signal handler.
+        ///   Child lookups don't build index segments (which allocates
+        ///   memory) while this is set.
+        /// \return The previous setting
+        bool
+        set_signal(bool is_signal);
     };
 
 } // namespace cali
@@ -0,0 +1,265 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+/// \file SelfProfile.cpp
+/// \brief Caliper self-profiling implementation
+
+#include "SelfProfile.h"
+
+#include "caliper/common/util/spinlock.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+using namespace cali;
+
+namespace
+{
+
+const int MaxOwners = 64;
+
+inline uint64_t read_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct Counters {
+    // Only the owner thread writes the counters. Atomics let
+    // results() read them while the thread is running.
+    std::atomic<uint64_t> ticks[MaxOwners];
+    std::atomic<uint64_t> calls[MaxOwners];
+
+    Counters() {
+        for (int i = 0; i < MaxOwners; ++i) {
+            ticks[i].store(0, std::memory_order_relaxed);
+            calls[i].store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+struct GlobalData {
+    std::mutex               lock;
+    std::vector<std::string> owners { "caliper", "snapshot", "flush" };
+    std::vector<Counters*>   threads;
+
+    uint64_t                 start_ticks = 0;
+    std::chrono::steady_clock::time_point start_time;
+};
+
+GlobalData* g_data = nullptr;
+
+GlobalData* global_data()
+{
+    // Intentionally leaked: threads may finish after static destruction
+    if (!g_data)
+        g_data = new GlobalData;
+
+    return g_data;
+}
+
+struct ThreadData {
+    Counters* counters;
+    uint64_t  child_ticks; ///< Ticks spent in nested timed scopes
+};
+
+// Thread counters are never deleted, so results include finished
+// threads, and the exit handler can still use the main thread's
+// counters after thread-local destructors ran.
+thread_local ThreadData t_data { nullptr, 0 };
+
+ThreadData& thread_data()
+{
+    if (!t_data.counters) {
+        t_data.counters = new Counters;
+
+        GlobalData* g = global_data();
+        std::lock_guard<std::mutex> lck(g->lock);
+        g->threads.push_back(t_data.counters);
+    }
+
+    return t_data;
+}
+
+util::callback_profile_hooks s_hooks = { &SelfProfile::begin, &SelfProfile::end };
+
+} // namespace
+
+
+bool SelfProfile::s_enabled = false;
+
+int
+SelfProfile::add_owner(const char* name)
+{
+    GlobalData* g = global_data();
+    std::lock_guard<std::mutex> lck(g->lock);
+
+    auto it = std::find(g->owners.begin(), g->owners.end(), std::string(name));
+
+    if (it != g->owners.end())
+        return static_cast<int>(it - g->owners.begin());
+    if (g->owners.size() >= MaxOwners)
+        return Core;
+
+    g->owners.push_back(name);
+
+    return static_cast<int>(g->owners.size() - 1);
+}
+
+int
+SelfProfile::find_owner(const char* name)
+{
+    GlobalData* g = global_data();
+    std::lock_guard<std::mutex> lck(g->lock);
+
+    auto it = std::find(g->owners.begin(), g->owners.end(), std::string(name));
+
+    return it != g->owners.end() ? static_cast<int>(it - g->owners.begin()) : -1;
+}
+
+void
+SelfProfile::enable()
+{
+    GlobalData* g = global_data();
+
+    g->start_ticks = read_ticks();
+    g->start_time  = std::chrono::steady_clock::now();
+
+    s_enabled = true;
+    util::callback_profile() = &s_hooks;
+}
+
+SelfProfile::Token
+SelfProfile::begin()
+{
+    ThreadData& td = thread_data();
+    Token t { read_ticks(), td.child_ticks };
+
+    td.child_ticks = 0;
+
+    return t;
+}
+
+void
+SelfProfile::end(int owner, const Token& t)
+{
+    ThreadData& td    = thread_data();
+    uint64_t    total = read_ticks() - t.start;
+    uint64_t    excl  = total > td.child_ticks ? total - td.child_ticks : 0;
+
+    if (owner < 0 || owner >= MaxOwners)
+        owner = Core;
+
+    td.counters->ticks[owner].store(td.counters->ticks[owner].load(std::memory_order_relaxed) + excl, std::memory_order_relaxed);
+    td.counters->calls[owner].store(td.counters->calls[owner].load(std::memory_order_relaxed) + 1,    std::memory_order_relaxed);
+
+    td.child_ticks = t.saved + total;
+}
+
+std::vector<SelfProfile::Result>
+SelfProfile::results()
+{
+    GlobalData* g = global_data();
+    std::lock_guard<std::mutex> lck(g->lock);
+
+    // Calibrate ticks against the steady clock over the whole run
+    double   sec   = std::chrono::duration<double>(std::chrono::steady_clock::now() - g->start_time).count();
+    uint64_t ticks = read_ticks() - g->start_ticks;
+    double   sec_per_tick = ticks > 0 ? sec / static_cast<double>(ticks) : 0.0;
+
+    std::vector<Result> ret;
+
+    for (size_t i = 0; i < g->owners.size(); ++i) {
+        uint64_t t = 0;
+        uint64_t n = 0;
+
+        for (const Counters* c : g->threads) {
+            t += c->ticks[i].load(std::memory_order_relaxed);
+            n += c->calls[i].load(std::memory_order_relaxed);
+        }
+
+        if (n > 0)
+            ret.push_back(Result { g->owners[i], t * sec_per_tick, n });
+    }
+
+    return ret;
+}
+
+std::ostream&
+SelfProfile::report(std::ostream& os)
+{
+    std::vector<Result> res = results();
+    std::ostringstream  sstr;
+    double total = 0.0;
+
+    sstr << std::fixed << std::setprecision(3);
+
+    for (const Result& r : res) {
+        sstr << "\n     " << std::left << std::setw(16) << r.name << std::right
+             << std::setw(12) << r.seconds * 1000.0 << " ms "
+             << std::setw(12) << r.calls << " calls";
+
+        total += r.seconds;
+    }
+
+    sstr << "\n     " << std::left << std::setw(16) << "total" << std::right
+         << std::setw(12) << total * 1000.0 << " ms";
+
+    // spinlock contention: only list locks that had to wait
+
+    std::ostringstream lsstr;
+
+    for (util::spinlock_stats* s = util::spinlock_stats::list(); s; s = s->next) {
+        uint64_t contended = s->contended.load(std::memory_order_relaxed);
+
+        if (contended == 0)
+            continue;
+
+        lsstr << "\n     " << std::left << std::setw(32) << s->name << std::right
+              << std::setw(12) << contended << " contended "
+              << std::setw(14) << s->spins.load(std::memory_order_relaxed) << " spins "
+              << std::setw(10) << s->yields.load(std::memory_order_relaxed) << " yields";
+    }
+
+    if (!lsstr.str().empty())
+        sstr << "\nSpinlock contention:" << lsstr.str();
+
+    return os << "Self-profile (exclusive time):" << sstr.str() << std::endl;
+}
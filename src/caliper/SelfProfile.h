@@ -0,0 +1,125 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+/// \file SelfProfile.h
+/// \brief Measures the time Caliper spends in service callbacks,
+///   snapshots, and flushes.
+
+#ifndef CALI_SELFPROFILE_H
+#define CALI_SELFPROFILE_H
+
+#include "caliper/common/util/callback.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace cali
+{
+
+/// \brief Caliper self-profiling.
+///
+/// When enabled, every event callback invocation is timed and accounted
+/// to the service that connected the callback (its "owner"). The time
+/// is exclusive: time spent in nested callbacks, e.g. snapshot callbacks
+/// run from an event callback, is accounted to the nested callback's
+/// owner. Snapshots and flushes account their own (non-callback) time
+/// to the "snapshot" and "flush" owners.
+class SelfProfile
+{
+public:
+
+    enum Owner {
+        Core     = 0, ///< Callbacks not connected by a service
+        Snapshot = 1, ///< push_snapshot() outside of callbacks
+        Flush    = 2  ///< flush_and_write() outside of callbacks
+    };
+
+    typedef util::callback_profile_hooks::token Token;
+
+    /// \brief Register an owner name and return its ID
+    static int   add_owner(const char* name);
+
+    /// \brief Return the ID of owner \a name, or -1 if there is none
+    static int   find_owner(const char* name);
+
+    static void  enable();
+
+    static bool  is_enabled() {
+        return s_enabled;
+    }
+
+    static Token begin();
+    static void  end(int owner, const Token& t);
+
+    struct Result {
+        std::string name;
+        double      seconds;
+        uint64_t    calls;
+    };
+
+    /// \brief Accumulated per-owner results of all threads
+    static std::vector<Result> results();
+
+    static std::ostream& report(std::ostream& os);
+
+    /// \brief Times a scope if self-profiling is enabled
+    class Timer {
+        int   m_owner;
+        bool  m_active;
+        Token m_t;
+
+    public:
+
+        Timer(int owner)
+            : m_owner(owner), m_active(s_enabled)
+            {
+                if (m_active)
+                    m_t = begin();
+            }
+
+        ~Timer() {
+            if (m_active)
+                end(m_owner, m_t);
+        }
+    };
+
+private:
+
+    static bool s_enabled;
+};
+
+} // namespace cali
+
+#endif // CALI_SELFPROFILE_H
@@ -37,6 +37,7 @@
 #include "caliper/common/CaliperMetadataAccessInterface.h"
 #include "caliper/common/Node.h"
 
+#include <algorithm>
 #include <iostream>
 
 using namespace cali;
@@ -92,6 +93,26 @@ SnapshotRecord::append(size_t n, Node* const* node_vec, size_t m, const cali_id_
     m_sizes.n_immediate += max_immediate;
 }
 
+void
+SnapshotRecord::remove_immediate(size_t n, const cali_id_t* attrs)
+{
+    size_t j = 0;
+
+    for (size_t i = 0; i < m_sizes.n_immediate; ++i) {
+        if (std::find(attrs, attrs + n, m_attr_array[i]) != attrs + n)
+            continue;
+
+        if (i != j) {
+            m_attr_array[j] = m_attr_array[i];
+            m_data_array[j] = m_data_array[i];
+        }
+
+        ++j;
+    }
+
+    m_sizes.n_immediate = j;
+}
+
 Entry
 SnapshotRecord::get(const Attribute& attr) const
 {
@@ -115,7 +136,9 @@ SnapshotRecord::get(const Attribute& attr) const
 std::vector<Entry> 
 SnapshotRecord::to_entrylist() const
 {
-    std::vector<Entry> vec(m_sizes.n_nodes + m_sizes.n_immediate);
+    std::vector<Entry> vec;
+
+    vec.reserve(m_sizes.n_nodes + m_sizes.n_immediate);
 
     for (size_t i = 0; i < m_sizes.n_nodes; ++i)
         vec.push_back(Entry(m_node_array[i]));
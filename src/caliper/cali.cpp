@@ -43,9 +43,13 @@
 #include "caliper/common/RuntimeConfig.h"
 #include "caliper/common/Variant.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <unordered_map>
 #include <mutex>
+#include <string>
+#include <vector>
 
 
 using namespace cali;
@@ -303,6 +307,199 @@ cali_find_all_in_snapshot(const unsigned char* buf,
         *bytes_read += pos;
 }
 
+//
+// --- Indexed snapshot views
+//
+
+//   The view keeps the snapshot entries in unpack order, plus a copy of
+// the values grouped by attribute for find_all(). The open-addressing
+// index maps attribute IDs to their group. Index slots are tagged with
+// the generation of the unpack that wrote them, so unpacking a new
+// snapshot doesn't need to clear the index.
+
+struct cali_snapshot_view {
+    struct IndexSlot {
+        cali_id_t attr;
+        unsigned  gen;
+        size_t    first;
+        size_t    count;
+        size_t    fill;
+    };
+
+    size_t                      capacity;
+    size_t                      num_entries;
+    unsigned                    gen;
+
+    std::vector<cali_id_t>      attrs;
+    std::vector<cali_variant_t> values;
+    std::vector<cali_variant_t> grouped;
+    std::vector<IndexSlot>      index;
+
+    cali_snapshot_view(size_t max_entries)
+        : capacity(max_entries), num_entries(0), gen(1),
+          attrs(max_entries), values(max_entries), grouped(max_entries)
+        {
+            size_t slots = 16;
+
+            while (slots < 2 * max_entries)
+                slots *= 2;
+
+            index.assign(slots, IndexSlot { CALI_INV_ID, 0, 0, 0, 0 });
+        }
+
+    IndexSlot* find_slot(cali_id_t attr) {
+        size_t mask = index.size() - 1;
+
+        for (size_t i = (attr * 0x9E3779B97F4A7C15ULL) >> 32; ; ++i) {
+            IndexSlot* slot = &index[i & mask];
+
+            if (slot->gen != gen || slot->attr == attr)
+                return slot;
+        }
+    }
+
+    const IndexSlot* find_slot(cali_id_t attr) const {
+        const IndexSlot* slot = const_cast<cali_snapshot_view*>(this)->find_slot(attr);
+
+        return slot->gen == gen ? slot : nullptr;
+    }
+
+    void append(cali_id_t attr, const cali_variant_t& val) {
+        attrs[num_entries]  = attr;
+        values[num_entries] = val;
+        ++num_entries;
+
+        IndexSlot* slot = find_slot(attr);
+
+        if (slot->gen != gen)
+            *slot = IndexSlot { attr, gen, 0, 0, 0 };
+
+        ++slot->count;
+    }
+
+    void build_groups() {
+        size_t pos = 0;
+
+        // assign group offsets in order of first appearance
+        for (size_t i = 0; i < num_entries; ++i) {
+            IndexSlot* slot = find_slot(attrs[i]);
+
+            if (slot->fill == 0) {
+                slot->first = pos;
+                pos += slot->count;
+            }
+
+            grouped[slot->first + slot->fill] = values[i];
+            ++slot->fill;
+        }
+    }
+
+    void reset() {
+        num_entries = 0;
+
+        if (++gen == 0) {
+            // generation counter wrapped around: clear out stale slots
+            for (IndexSlot& slot : index)
+                slot.gen = 0;
+
+            gen = 1;
+        }
+    }
+};
+
+cali_snapshot_view_t*
+cali_snapshot_view_create(size_t max_entries)
+{
+    return new cali_snapshot_view(max_entries);
+}
+
+void
+cali_snapshot_view_destroy(cali_snapshot_view_t* view)
+{
+    delete view;
+}
+
+size_t
+cali_snapshot_view_unpack(cali_snapshot_view_t* view,
+                          const unsigned char*  buf,
+                          size_t*               bytes_read)
+{
+    size_t pos   = 0;
+    size_t total = 0;
+
+    view->reset();
+
+    Caliper c;
+
+    auto add = [view,&total](cali_id_t attr, const Variant& val) {
+        if (view->num_entries < view->capacity)
+            view->append(attr, val.c_variant());
+
+        ++total;
+    };
+
+    CompressedSnapshotRecordView(buf, &pos).unpack(&c, [&add](const Entry& e) {
+            if (e.is_immediate())
+                add(e.attribute(), e.value());
+            else
+                for (const Node* node = e.node(); node && node->id() != CALI_INV_ID; node = node->parent())
+                    add(node->attribute(), node->data());
+
+            return true;
+        });
+
+    view->build_groups();
+
+    if (bytes_read)
+        *bytes_read += pos;
+
+    return total;
+}
+
+size_t
+cali_snapshot_view_num_entries(const cali_snapshot_view_t* view)
+{
+    return view->num_entries;
+}
+
+const cali_id_t*
+cali_snapshot_view_attributes(const cali_snapshot_view_t* view)
+{
+    return view->attrs.data();
+}
+
+const cali_variant_t*
+cali_snapshot_view_values(const cali_snapshot_view_t* view)
+{
+    return view->values.data();
+}
+
+cali_variant_t
+cali_snapshot_view_find_first(const cali_snapshot_view_t* view,
+                              cali_id_t                   attr_id)
+{
+    const cali_snapshot_view::IndexSlot* slot = view->find_slot(attr_id);
+
+    return slot ? view->grouped[slot->first] : cali_make_empty_variant();
+}
+
+size_t
+cali_snapshot_view_find_all(const cali_snapshot_view_t* view,
+                            cali_id_t                   attr_id,
+                            const cali_variant_t**      values)
+{
+    const cali_snapshot_view::IndexSlot* slot = view->find_slot(attr_id);
+
+    if (!slot) {
+        *values = nullptr;
+        return 0;
+    }
+
+    *values = view->grouped.data() + slot->first;
+
+    return slot->count;
+}
+
 //
 // --- Blackboard access interface
 //
@@ -352,6 +549,44 @@ cali_set(cali_id_t attr_id, const void* value, size_t size)
     return c.set(attr, Variant(attr.type(), value, size));
 }
 
+cali_err
+cali_set_batch(size_t n, const cali_id_t attr_ids[], const cali_variant_t values[])
+{
+    const size_t MAX_BATCH = 32;
+
+    Attribute attr[MAX_BATCH];
+    Variant   data[MAX_BATCH];
+
+    Caliper   c;
+    cali_err  ret = CALI_SUCCESS;
+
+    for (size_t b = 0; b < n; b += MAX_BATCH) {
+        size_t m = std::min(n - b, MAX_BATCH);
+        size_t k = 0;
+
+        for (size_t i = 0; i < m; ++i) {
+            Attribute a = c.get_attribute(attr_ids[b+i]);
+            Variant   v(values[b+i]);
+
+            if (a == Attribute::invalid || a.type() != v.type()) {
+                ret = (a == Attribute::invalid ? CALI_EINV : CALI_ETYPE);
+                continue;
+            }
+
+            attr[k] = a;
+            data[k] = v;
+            ++k;
+        }
+
+        cali_err r = c.set_many(k, attr, data);
+
+        if (r != CALI_SUCCESS)
+            ret = r;
+    }
+
+    return ret;
+}
+
 cali_err
 cali_begin_double(cali_id_t attr_id, double val)
 {
@@ -424,6 +659,30 @@ cali_set_string(cali_id_t attr_id, const char* val)
     return c.set(attr, Variant(CALI_TYPE_STRING, val, strlen(val)));
 }
 
+cali_err
+cali_add_int(cali_id_t attr_id, int delta)
+{
+    Caliper   c;
+    Attribute attr = c.get_attribute(attr_id);
+
+    if (attr.type() != CALI_TYPE_INT && attr.type() != CALI_TYPE_UINT)
+        return CALI_ETYPE;
+
+    return c.add(attr, Variant(delta));
+}
+
+cali_err
+cali_add_double(cali_id_t attr_id, double delta)
+{
+    Caliper   c;
+    Attribute attr = c.get_attribute(attr_id);
+
+    if (attr.type() != CALI_TYPE_DOUBLE)
+        return CALI_ETYPE;
+
+    return c.add(attr, Variant(delta));
+}
+
 cali_err
 cali_safe_end_string(cali_id_t attr_id, const char* val)
 {
@@ -557,6 +816,169 @@ cali_end_byname(const char* attr_name)
     return c.end(attr);
 }
 
+cali_err
+cali_begin_string_cached(cali_string_handle_t* handle)
+{
+    Caliper   c;
+    Attribute attr;
+
+    cali_id_t attr_id = __atomic_load_n(&handle->attr_id, __ATOMIC_ACQUIRE);
+
+    if (attr_id == CALI_INV_ID) {
+        attr = c.create_attribute(handle->attr_name, CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+
+        if (attr == Attribute::invalid || attr.type() != CALI_TYPE_STRING)
+            return CALI_EINV;
+
+        // concurrent first calls store the same values
+        handle->len = strlen(handle->value);
+        __atomic_store_n(&handle->attr_id, attr.id(), __ATOMIC_RELEASE);
+    } else {
+        attr = c.get_attribute(attr_id);
+    }
+
+    return c.begin(attr, Variant(CALI_TYPE_STRING, handle->value, handle->len),
+                   reinterpret_cast<Node**>(&handle->node));
+}
+
+cali_err
+cali_end_cached(cali_string_handle_t* handle)
+{
+    Caliper c;
+
+    return c.end(c.get_attribute(__atomic_load_n(&handle->attr_id, __ATOMIC_ACQUIRE)));
+}
+
+namespace
+{
+
+/// \brief Process-wide table of cached string handles for integer
+///   region handles (used, e.g., by the Fortran API).
+///
+/// Grows in fixed-size chunks, so that looking up a handle needs no lock.
+class RegionHandleTable
+{
+    static const int ChunkBits = 8;
+    static const int ChunkSize = 1 << ChunkBits;
+    static const int MaxChunks = 1024;
+
+    std::atomic<cali_string_handle_t*> m_chunks[MaxChunks];
+    int                                m_count;
+
+    std::unordered_map<std::string, int> m_index; // protected by m_lock
+    std::mutex                           m_lock;
+
+public:
+
+    RegionHandleTable()
+        : m_count(0)
+    {
+        for (int i = 0; i < MaxChunks; ++i)
+            m_chunks[i].store(nullptr);
+    }
+
+    int add(const char* attr_name, const char* value) {
+        std::string key(attr_name);
+        key.append(1, '\0').append(value);
+
+        std::lock_guard<std::mutex>
+            g(m_lock);
+
+        auto it = m_index.find(key);
+
+        if (it != m_index.end())
+            return it->second;
+        if (m_count >= MaxChunks * ChunkSize)
+            return -1;
+
+        int h = m_count;
+        cali_string_handle_t* chunk = m_chunks[h >> ChunkBits].load();
+
+        if (!chunk) {
+            chunk = new cali_string_handle_t[ChunkSize];
+            m_chunks[h >> ChunkBits].store(chunk);
+        }
+
+        // the handle keeps pointers into its own copies of the strings
+        char* buf = new char[key.size() + 1];
+        memcpy(buf, key.data(), key.size());
+        buf[key.size()] = '\0';
+
+        cali_string_handle_t init = CALI_STRING_HANDLE_INITIALIZER(buf, buf + strlen(attr_name) + 1);
+        chunk[h & (ChunkSize-1)] = init;
+
+        m_index.emplace(std::move(key), h);
+        // publish the new handle only after it is initialized
+        __atomic_store_n(&m_count, h + 1, __ATOMIC_RELEASE);
+
+        return h;
+    }
+
+    cali_string_handle_t* get(int h) {
+        if (h < 0 || h >= __atomic_load_n(&m_count, __ATOMIC_ACQUIRE))
+            return nullptr;
+
+        return m_chunks[h >> ChunkBits].load(std::memory_order_relaxed) + (h & (ChunkSize-1));
+    }
+
+    static RegionHandleTable& instance() {
+        static RegionHandleTable* s_table = new RegionHandleTable;
+        return *s_table;
+    }
+};
+
+}
+
+int
+cali_make_region_handle(const char* attr_name, const char* value)
+{
+    if (!attr_name || !value)
+        return -1;
+
+    return RegionHandleTable::instance().add(attr_name, value);
+}
+
+cali_err
+cali_begin_region_handle(int handle)
+{
+    cali_string_handle_t* h = RegionHandleTable::instance().get(handle);
+
+    return h ? cali_begin_string_cached(h) : CALI_EINV;
+}
+
+cali_err
+cali_end_region_handle(int handle)
+{
+    cali_string_handle_t* h = RegionHandleTable::instance().get(handle);
+
+    return h ? cali_end_cached(h) : CALI_EINV;
+}
+
+//
+// --- Counters
+//
+
+int
+cali_create_counter(const char* name, int properties)
+{
+    Caliper   c;
+    Attribute class_aggr_attr = c.get_attribute("class.aggregatable");
+    Variant   v_true(true);
+
+    Attribute attr =
+        c.create_attribute(name, CALI_TYPE_UINT,
+                           properties | CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD | CALI_ATTR_SKIP_EVENTS,
+                           1, &class_aggr_attr, &v_true);
+
+    return c.create_counter(attr);
+}
+
+void
+cali_counter_add(int counter, uint64_t value)
+{
+    Caliper::add_to_counter(counter, value);
+}
+
 void
 cali_config_preset(const char* key, const char* value)
 {
@@ -601,6 +1023,31 @@ cali_flush(int flush_opts)
         c.clear();
 }
 
+void
+cali_memory_usage(size_t* reserved, size_t* used)
+{
+    size_t r = 0;
+    size_t u = 0;
+
+    for (const Caliper::MemoryUsage& m : Caliper::memory_usage()) {
+        r += m.reserved;
+        u += m.used;
+    }
+
+    if (reserved)
+        *reserved = r;
+    if (used)
+        *used = u;
+}
+
+cali_err
+cali_set_service_enabled(const char* name, int enable)
+{
+    Caliper c;
+
+    return c.set_service_enabled(name, enable != 0) ? CALI_SUCCESS : CALI_EINV;
+}
+
 void
 cali_init()
 {
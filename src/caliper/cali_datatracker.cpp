@@ -37,6 +37,7 @@
 
 #include <cstdlib>
 #include <numeric>
+#include <vector>
 
 using namespace cali;
 
@@ -76,6 +77,26 @@ cali_datatracker_track_dimensional(const void      *ptr,
     Caliper::instance().memory_region_begin(ptr, label, elem_size, ndims, dimensions);
 }
 
+void
+cali_datatracker_track_regions(const cali_datatracker_region_t *regions,
+                               size_t n)
+{
+    std::vector<Caliper::MemoryRegion> vec(n);
+
+    for (size_t i = 0; i < n; ++i)
+        vec[i] = { regions[i].ptr, regions[i].label, regions[i].elem_size,
+                   regions[i].num_dimensions, regions[i].dimensions };
+
+    Caliper::instance().memory_regions_begin(n, vec.data());
+}
+
+void
+cali_datatracker_label(const void *ptr,
+                       const char *label)
+{
+    Caliper::instance().memory_region_label(ptr, label);
+}
+
 void*
 cali_datatracker_allocate_dimensional(const char   *label,
                                       size_t        elem_size, 
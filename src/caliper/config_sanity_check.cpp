@@ -118,7 +118,7 @@ check_service_dependency(const service_group_t dependent,
                     << " to CALI_SERVICES_ENABLE to generate Caliper output." << std::endl;
 }
 
-void check_services(const std::vector<std::string>& services)
+void check_services(const std::vector<std::string>& services, bool fused_timing)
 {
     const struct ServiceDependency {
         ServiceGroupID dept; ServiceGroupID depcy; 
@@ -130,9 +130,14 @@ void check_services(const std::vector<std::string>& services)
         { OfflineOutput,   SnapshotBuffer  }
     };
 
-    for (const ServiceDependency &d : dependencies)
+    for (const ServiceDependency &d : dependencies) {
+        // in fused timing mode, aggregate measures regions without snapshots
+        if (fused_timing && d.dept == SnapshotProcess && d.depcy == SnapshotTrigger)
+            continue;
+
         check_service_dependency(service_groups[d.dept], service_groups[d.depcy],
                                  services);
+    }
 }
 
 } // namespace [anonymous]
@@ -158,7 +163,7 @@ void config_sanity_check()
     if (std::find(services.begin(), services.end(), "validator") != services.end())
         return;
 
-    ::check_services(services);
+    ::check_services(services, RuntimeConfig::get("aggregate", "fused_timing").to_bool());
 }
 
 }
@@ -0,0 +1,66 @@
+// Tests for the AnnotationBinding helpers
+
+#include "caliper/AnnotationBinding.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+using namespace cali;
+
+TEST(AnnotationBindingTest, HandleCache)
+{
+    Caliper c;
+
+    Attribute str_attr =
+        c.create_attribute("test.binding.handlecache.str", CALI_TYPE_STRING, CALI_ATTR_NESTED);
+    Attribute int_attr =
+        c.create_attribute("test.binding.handlecache.int", CALI_TYPE_INT);
+
+    AnnotationBinding::HandleCache<int> cache;
+
+    int num_created = 0;
+
+    auto make_attr_handle = [&num_created](const Attribute& attr) {
+        return static_cast<int>(attr.id()) + 100 * ++num_created;
+    };
+    auto make_value_handle = [&num_created](const Attribute&, const char* str) {
+        return static_cast<int>(std::strlen(str)) + 100 * ++num_created;
+    };
+
+    int h_attr = cache.attribute_handle(str_attr, make_attr_handle);
+
+    EXPECT_EQ(num_created, 1);
+    EXPECT_EQ(cache.attribute_handle(str_attr, make_attr_handle), h_attr);
+    EXPECT_EQ(num_created, 1);
+
+    // string values must be matched by content, not by address
+
+    char buf[16];
+    std::strcpy(buf, "foo");
+
+    int h_foo = cache.value_handle(str_attr, Variant(CALI_TYPE_STRING, buf, 3), make_value_handle);
+
+    EXPECT_EQ(num_created, 2);
+
+    std::strcpy(buf, "ba");
+
+    int h_ba  = cache.value_handle(str_attr, Variant(CALI_TYPE_STRING, buf, 2), make_value_handle);
+
+    EXPECT_EQ(num_created, 3);
+    EXPECT_NE(h_foo, h_ba);
+
+    std::string foo("foo");
+
+    EXPECT_EQ(cache.value_handle(str_attr, Variant(CALI_TYPE_STRING, foo.data(), foo.size()), make_value_handle), h_foo);
+    EXPECT_EQ(num_created, 3);
+
+    // the same value on a different attribute gets its own handle
+
+    int h_int_a = cache.value_handle(int_attr, Variant(42), make_value_handle);
+    int h_int_b = cache.value_handle(int_attr, Variant(42), make_value_handle);
+
+    EXPECT_EQ(num_created, 4);
+    EXPECT_EQ(h_int_a, h_int_b);
+    EXPECT_EQ(h_int_a % 100, 2); // strlen("42")
+}
@@ -101,3 +101,94 @@ TEST(AttributeAPITest, GlobalAttributes) {
 
     EXPECT_EQ(it->value(global_attr).to_int(), 42);
 }
+
+TEST(AttributeAPITest, FindAndSubscribeAttributesWith) {
+    Caliper c;
+
+    Attribute class_attr =
+        c.create_attribute("test.attr.subscribe.class", CALI_TYPE_BOOL, CALI_ATTR_DEFAULT);
+    Variant v_true(true);
+
+    Attribute a1 =
+        c.create_attribute("test.attr.subscribe.1", CALI_TYPE_INT, CALI_ATTR_DEFAULT,
+                           1, &class_attr, &v_true);
+    Attribute other =
+        c.create_attribute("test.attr.subscribe.other", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+
+    std::vector<Attribute> found = c.find_attributes_with(class_attr);
+
+    ASSERT_EQ(found.size(), 1);
+    EXPECT_EQ(found[0], a1);
+
+    std::vector<Attribute> seen;
+
+    c.subscribe_attributes_with(class_attr, [&seen](Caliper*, const Attribute& attr){
+            seen.push_back(attr);
+        });
+
+    ASSERT_EQ(seen.size(), 1);
+    EXPECT_EQ(seen[0], a1);
+
+    Attribute a2 =
+        c.create_attribute("test.attr.subscribe.2", CALI_TYPE_INT, CALI_ATTR_DEFAULT,
+                           1, &class_attr, &v_true);
+    c.create_attribute("test.attr.subscribe.other2", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    // existing attribute: no new notification
+    c.create_attribute("test.attr.subscribe.1", CALI_TYPE_INT, CALI_ATTR_DEFAULT,
+                       1, &class_attr, &v_true);
+
+    ASSERT_EQ(seen.size(), 2);
+    EXPECT_EQ(seen[1], a2);
+
+    // the index agrees with the generic metadata scan
+    std::vector<Attribute> all = c.get_attributes();
+    size_t num_with = std::count_if(all.begin(), all.end(), [&class_attr](const Attribute& a){
+            return !a.get(class_attr).empty();
+        });
+
+    EXPECT_EQ(c.find_attributes_with(class_attr).size(), num_with);
+    EXPECT_EQ(std::count(seen.begin(), seen.end(), other), 0);
+}
+
+TEST(AttributeAPITest, BeginEndNesting) {
+    Caliper c;
+
+    Attribute outer =
+        c.create_attribute("test.attr.nesting.outer", CALI_TYPE_INT, CALI_ATTR_NESTED);
+    Attribute inner =
+        c.create_attribute("test.attr.nesting.inner", CALI_TYPE_INT, CALI_ATTR_NESTED);
+
+    // properly nested, deeper than the thread's region stack
+
+    for (int i = 0; i < 100; ++i)
+        ASSERT_EQ(c.begin(i % 2 ? inner : outer, Variant(i)), CALI_SUCCESS);
+    for (int i = 99; i >= 0; --i) {
+        Attribute attr = (i % 2 ? inner : outer);
+
+        ASSERT_EQ(c.get(attr).value().to_int(), i);
+        ASSERT_EQ(c.end(attr), CALI_SUCCESS);
+    }
+
+    EXPECT_TRUE(c.get(outer).is_empty());
+    EXPECT_TRUE(c.get(inner).is_empty());
+
+    // mismatched end: the outer region is removed from the middle
+
+    c.begin(outer, Variant(1));
+    c.begin(inner, Variant(2));
+    c.begin(outer, Variant(3));
+
+    EXPECT_EQ(c.end(inner), CALI_SUCCESS);
+    EXPECT_EQ(c.get(outer).value().to_int(), 3);
+    EXPECT_TRUE(c.get(inner).is_empty());
+
+    EXPECT_EQ(c.end(outer), CALI_SUCCESS);
+    EXPECT_EQ(c.get(outer).value().to_int(), 1);
+
+    c.begin(inner, Variant(4));
+
+    EXPECT_EQ(c.end(inner), CALI_SUCCESS);
+    EXPECT_EQ(c.end(outer), CALI_SUCCESS);
+    EXPECT_TRUE(c.get(outer).is_empty());
+    EXPECT_EQ(c.end(outer), CALI_ESTACK);
+}
@@ -0,0 +1,150 @@
+// Tests for the attribute registry
+
+#include "../AttributeRegistry.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+// The registry only stores node pointers, it never dereferences them
+Node* fake_node(size_t i)
+{
+    return reinterpret_cast<Node*>(static_cast<uintptr_t>(0x1000 + 16*i));
+}
+
+}
+
+TEST(AttributeRegistryTest, InsertAndFind) {
+    AttributeRegistry reg;
+
+    EXPECT_EQ(reg.find("test.attr"), nullptr);
+
+    Node* n1 = fake_node(1);
+    Node* n2 = fake_node(2);
+
+    EXPECT_EQ(reg.insert("test.attr",  n1), n1);
+    EXPECT_EQ(reg.insert("test.attr2", n2), n2);
+
+    // don't replace existing entries
+    EXPECT_EQ(reg.insert("test.attr",  n2), n1);
+
+    EXPECT_EQ(reg.find("test.attr"),  n1);
+    EXPECT_EQ(reg.find("test.attr2"), n2);
+    EXPECT_EQ(reg.find("test.attr3"), nullptr);
+
+    EXPECT_EQ(reg.size(), 2);
+
+    std::vector<Node*> all = reg.get_all();
+
+    ASSERT_EQ(all.size(), 2);
+    EXPECT_EQ(all[0], n1);
+    EXPECT_EQ(all[1], n2);
+}
+
+TEST(AttributeRegistryTest, Grow) {
+    AttributeRegistry reg;
+
+    const size_t N = 5000;
+
+    for (size_t i = 0; i < N; ++i)
+        ASSERT_EQ(reg.insert(std::string("test.grow.") + std::to_string(i), fake_node(i)), fake_node(i));
+
+    EXPECT_EQ(reg.size(), N);
+
+    for (size_t i = 0; i < N; ++i)
+        EXPECT_EQ(reg.find(std::string("test.grow.") + std::to_string(i)), fake_node(i));
+}
+
+TEST(AttributeRegistryTest, ConcurrentReadWrite) {
+    AttributeRegistry reg;
+
+    const size_t N = 2000;
+
+    std::vector<std::string> names;
+
+    for (size_t i = 0; i < N; ++i)
+        names.push_back(std::string("test.concurrent.") + std::to_string(i));
+
+    reg.insert(names[0], fake_node(0));
+
+    std::thread writer([&](){
+            for (size_t i = 1; i < N; ++i)
+                reg.insert(names[i], fake_node(i));
+        });
+
+    std::vector<std::thread> readers;
+    std::vector<int>         errors(2, 0);
+
+    for (int t = 0; t < 2; ++t)
+        readers.emplace_back([&,t](){
+                for (int r = 0; r < 20; ++r)
+                    for (size_t i = 0; i < N; ++i) {
+                        Node* node = reg.find(names[i]);
+
+                        // entries may not exist yet, but must never be wrong
+                        if (node && node != fake_node(i))
+                            ++errors[t];
+                    }
+
+                if (reg.find(names[0]) != fake_node(0))
+                    ++errors[t];
+            });
+
+    writer.join();
+
+    for (auto& t : readers)
+        t.join();
+
+    EXPECT_EQ(errors[0], 0);
+    EXPECT_EQ(errors[1], 0);
+
+    for (size_t i = 0; i < N; ++i)
+        EXPECT_EQ(reg.find(names[i]), fake_node(i));
+}
+
+TEST(AttributeRegistryTest, MetaIndex) {
+    AttributeRegistry reg;
+
+    cali_id_t meta_a[] = { 100 };
+    cali_id_t meta_b[] = { 100, 200 };
+
+    std::vector<int> subs;
+
+    reg.insert("test.meta.1", fake_node(1), 1, meta_a, &subs);
+    EXPECT_TRUE(subs.empty());
+
+    std::vector<Node*> existing = reg.subscribe(200, 7);
+    EXPECT_TRUE(existing.empty());
+
+    existing = reg.subscribe(100, 3);
+    ASSERT_EQ(existing.size(), 1);
+    EXPECT_EQ(existing[0], fake_node(1));
+
+    reg.insert("test.meta.2", fake_node(2), 2, meta_b, &subs);
+
+    ASSERT_EQ(subs.size(), 2);
+    EXPECT_EQ(subs[0], 3);
+    EXPECT_EQ(subs[1], 7);
+
+    // re-inserting an existing name doesn't notify or re-index
+    subs.clear();
+    reg.insert("test.meta.2", fake_node(3), 2, meta_b, &subs);
+    EXPECT_TRUE(subs.empty());
+
+    std::vector<Node*> with_a = reg.find_with(100);
+
+    ASSERT_EQ(with_a.size(), 2);
+    EXPECT_EQ(with_a[0], fake_node(1));
+    EXPECT_EQ(with_a[1], fake_node(2));
+
+    EXPECT_EQ(reg.find_with(200).size(), 1);
+    EXPECT_TRUE(reg.find_with(300).empty());
+}
@@ -521,3 +521,95 @@ TEST(C_Snapshot_Test, FindAllInSnapshot) {
         EXPECT_EQ(t5.entries[0].val, node_int_2);
     }
 }
+
+TEST(C_Snapshot_Test, SnapshotView) {
+    Caliper c;
+
+    Attribute node_str_attr =
+        c.create_attribute("view.node.str", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute node_int_attr =
+        c.create_attribute("view.node.int", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    Attribute val_int_attr =
+        c.create_attribute("view.val.int", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    Variant node_str_1(CALI_TYPE_STRING, "My wonderful view test string", 29);
+    Variant node_str_2(CALI_TYPE_STRING, "My other view test string", 25);
+
+    Attribute attr_in[] = {
+        node_str_attr, node_int_attr, val_int_attr, node_str_attr, val_int_attr
+    };
+    Variant data_in[] = {
+        node_str_1,    Variant(42),   Variant(2020), node_str_2,    Variant(1212)
+    };
+
+    SnapshotRecord::FixedSnapshotRecord<20> snapshot_data;
+    SnapshotRecord snapshot(snapshot_data);
+
+    c.make_entrylist(5, attr_in, data_in, snapshot);
+
+    CompressedSnapshotRecord rec;
+
+    ASSERT_EQ(rec.append(&snapshot), 0);
+
+    cali_snapshot_view_t* view = cali_snapshot_view_create(16);
+
+    // unpack twice to check that the view is reset in between
+    for (int pass = 0; pass < 2; ++pass) {
+        size_t bytes_read = 0;
+
+        EXPECT_EQ(cali_snapshot_view_unpack(view, rec.data(), &bytes_read), 5);
+        EXPECT_EQ(bytes_read, rec.size());
+        ASSERT_EQ(cali_snapshot_view_num_entries(view), 5);
+
+        // the flat arrays match cali_unpack_snapshot()
+        UnpackSnapshotTestData t1;
+        bytes_read = 0;
+        cali_unpack_snapshot(rec.data(), &bytes_read, ::test_entry_proc_op, &t1);
+
+        ASSERT_EQ(t1.entries.size(), 5);
+
+        const cali_id_t*      attrs = cali_snapshot_view_attributes(view);
+        const cali_variant_t* vals  = cali_snapshot_view_values(view);
+
+        for (size_t i = 0; i < 5; ++i) {
+            EXPECT_EQ(attrs[i], t1.entries[i].attr_id);
+            EXPECT_EQ(Variant(vals[i]), t1.entries[i].val);
+        }
+
+        EXPECT_EQ(Variant(cali_snapshot_view_find_first(view, node_str_attr.id())), node_str_2);
+        EXPECT_EQ(Variant(cali_snapshot_view_find_first(view, node_int_attr.id())).to_int(), 42);
+        EXPECT_EQ(Variant(cali_snapshot_view_find_first(view, val_int_attr.id())).to_int(), 2020);
+        EXPECT_TRUE(Variant(cali_snapshot_view_find_first(view, CALI_INV_ID)).empty());
+
+        const cali_variant_t* found = nullptr;
+
+        ASSERT_EQ(cali_snapshot_view_find_all(view, node_str_attr.id(), &found), 2);
+        EXPECT_EQ(Variant(found[0]), node_str_2);
+        EXPECT_EQ(Variant(found[1]), node_str_1);
+
+        ASSERT_EQ(cali_snapshot_view_find_all(view, val_int_attr.id(), &found), 2);
+        EXPECT_EQ(Variant(found[0]).to_int(), 2020);
+        EXPECT_EQ(Variant(found[1]).to_int(), 1212);
+
+        EXPECT_EQ(cali_snapshot_view_find_all(view, CALI_INV_ID, &found), 0);
+    }
+
+    {
+        // an empty snapshot clears the view
+        CompressedSnapshotRecord empty;
+
+        EXPECT_EQ(cali_snapshot_view_unpack(view, empty.data(), nullptr), 0);
+        EXPECT_EQ(cali_snapshot_view_num_entries(view), 0);
+        EXPECT_TRUE(Variant(cali_snapshot_view_find_first(view, val_int_attr.id())).empty());
+    }
+
+    cali_snapshot_view_destroy(view);
+
+    // entries beyond the view capacity are dropped
+    view = cali_snapshot_view_create(2);
+
+    EXPECT_EQ(cali_snapshot_view_unpack(view, rec.data(), nullptr), 5);
+    EXPECT_EQ(cali_snapshot_view_num_entries(view), 2);
+
+    cali_snapshot_view_destroy(view);
+}
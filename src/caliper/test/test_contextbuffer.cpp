@@ -0,0 +1,374 @@
+// Tests for the blackboard buffer
+
+#include "../ContextBuffer.h"
+
+#include "caliper/cali.h"
+#include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/Attribute.h"
+#include "caliper/common/Node.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+void test_set_get_unset(bool shared)
+{
+    Caliper c;
+
+    std::string prefix = std::string("test.ctxbuf.") + (shared ? "shared." : "local.");
+
+    Attribute node_attr =
+        c.create_attribute(prefix + "node", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    Attribute hidden_attr =
+        c.create_attribute(prefix + "hidden", CALI_TYPE_INT, CALI_ATTR_ASVALUE | CALI_ATTR_HIDDEN);
+
+    std::vector<Attribute> imm_attrs;
+
+    // enough entries to grow the lookup index
+    for (int i = 0; i < 100; ++i)
+        imm_attrs.push_back(c.create_attribute(prefix + "imm." + std::to_string(i),
+                                               CALI_TYPE_INT, CALI_ATTR_ASVALUE));
+
+    ContextBuffer buf(shared);
+
+    for (int i = 0; i < 100; ++i)
+        EXPECT_EQ(buf.set(imm_attrs[i], Variant(i)), CALI_SUCCESS);
+
+    EXPECT_EQ(buf.set(hidden_attr, Variant(-1)), CALI_SUCCESS);
+
+    Node node(42, node_attr.id(), Variant(42));
+
+    EXPECT_EQ(buf.set_node(node_attr, &node), CALI_SUCCESS);
+    EXPECT_EQ(buf.get_node(node_attr), &node);
+    EXPECT_EQ(buf.get_node(imm_attrs[0]), nullptr);
+
+    for (int i = 0; i < 100; ++i)
+        EXPECT_EQ(buf.get(imm_attrs[i]).to_int(), i);
+
+    EXPECT_EQ(buf.get(hidden_attr).to_int(), -1);
+
+    EXPECT_EQ(buf.exchange(imm_attrs[7], Variant(700)).to_int(), 7);
+    EXPECT_EQ(buf.get(imm_attrs[7]).to_int(), 700);
+
+    EXPECT_EQ(buf.unset(imm_attrs[3]), CALI_SUCCESS);
+    EXPECT_TRUE(buf.get(imm_attrs[3]).empty());
+    EXPECT_EQ(buf.get(imm_attrs[4]).to_int(), 4);
+
+    {
+        // snapshot contains the node and all non-hidden immediate entries
+        SnapshotRecord::FixedSnapshotRecord<128> snapshot_data;
+        SnapshotRecord rec(snapshot_data);
+
+        buf.snapshot(&rec);
+
+        EXPECT_EQ(rec.size().n_nodes, 1);
+        EXPECT_EQ(rec.size().n_immediate, 99);
+        EXPECT_EQ(rec.data().node_entries[0], &node);
+
+        for (size_t n = 0; n < rec.size().n_immediate; ++n)
+            EXPECT_NE(rec.data().immediate_attr[n], hidden_attr.id());
+    }
+
+    EXPECT_EQ(buf.unset(node_attr), CALI_SUCCESS);
+    EXPECT_EQ(buf.get_node(node_attr), nullptr);
+    EXPECT_EQ(buf.get(hidden_attr).to_int(), -1);
+    EXPECT_EQ(buf.get(imm_attrs[99]).to_int(), 99);
+}
+
+}
+
+TEST(ContextBufferTest, SharedBuffer) {
+    test_set_get_unset(true);
+}
+
+TEST(ContextBufferTest, ThreadLocalBuffer) {
+    test_set_get_unset(false);
+}
+
+TEST(ContextBufferTest, UnsetMany) {
+    Caliper c;
+
+    std::vector<Attribute> attrs;
+
+    for (int i = 0; i < 80; ++i)
+        attrs.push_back(c.create_attribute(std::string("test.ctxbuf.unsetmany.") + std::to_string(i),
+                                           CALI_TYPE_INT, CALI_ATTR_ASVALUE));
+
+    ContextBuffer buf(false);
+
+    for (int i = 0; i < 80; ++i)
+        EXPECT_EQ(buf.set(attrs[i], Variant(i)), CALI_SUCCESS);
+
+    // unset every third entry, in an order that leaves gaps in probe chains
+    for (int i = 78; i >= 0; i -= 3)
+        EXPECT_EQ(buf.unset(attrs[i]), CALI_SUCCESS);
+
+    for (int i = 0; i < 80; ++i) {
+        if (i % 3 == 0)
+            EXPECT_TRUE(buf.get(attrs[i]).empty()) << "attribute " << i;
+        else
+            EXPECT_EQ(buf.get(attrs[i]).to_int(), i) << "attribute " << i;
+    }
+
+    // re-set and update remaining entries
+    for (int i = 0; i < 80; ++i)
+        EXPECT_EQ(buf.set(attrs[i], Variant(100 + i)), CALI_SUCCESS);
+    for (int i = 0; i < 80; ++i)
+        EXPECT_EQ(buf.get(attrs[i]).to_int(), 100 + i);
+}
+
+TEST(ContextBufferTest, Clear) {
+    Caliper c;
+
+    Attribute node_attr =
+        c.create_attribute("test.ctxbuf.clear.node", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    Attribute imm_attr =
+        c.create_attribute("test.ctxbuf.clear.imm",  CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    ContextBuffer buf(false);
+
+    Node node(42, node_attr.id(), Variant(42));
+
+    EXPECT_EQ(buf.set_node(node_attr, &node), CALI_SUCCESS);
+    EXPECT_EQ(buf.set(imm_attr, Variant(7)), CALI_SUCCESS);
+
+    buf.clear();
+
+    EXPECT_EQ(buf.get_node(node_attr), nullptr);
+    EXPECT_TRUE(buf.get(imm_attr).empty());
+
+    {
+        SnapshotRecord::FixedSnapshotRecord<8> snapshot_data;
+        SnapshotRecord rec(snapshot_data);
+
+        buf.snapshot(&rec);
+
+        EXPECT_EQ(rec.size().n_nodes, 0);
+        EXPECT_EQ(rec.size().n_immediate, 0);
+    }
+
+    // the buffer is usable after clear
+    EXPECT_EQ(buf.set(imm_attr, Variant(8)), CALI_SUCCESS);
+    EXPECT_EQ(buf.get(imm_attr).to_int(), 8);
+}
+
+TEST(ContextBufferTest, RecycledThreadScope) {
+    Attribute attr =
+        Caliper().create_attribute("test.ctxbuf.recycled", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    std::thread t1([attr](){
+            Caliper c;
+            c.set(attr, Variant(1));
+            EXPECT_EQ(c.get(attr).value().to_int(), 1);
+        });
+    t1.join();
+
+    // a new thread may take over the first thread's scope, but starts
+    // with an empty blackboard
+    std::thread t2([attr](){
+            Caliper c;
+            EXPECT_TRUE(c.get(attr).value().empty());
+        });
+    t2.join();
+}
+
+TEST(ContextBufferTest, ConcurrentSnapshot) {
+    Caliper c;
+
+    Attribute counter_attr =
+        c.create_attribute("test.ctxbuf.concurrent.counter", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+    Attribute const_attr =
+        c.create_attribute("test.ctxbuf.concurrent.const",   CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    ContextBuffer buf(true);
+
+    buf.set(const_attr,   Variant(42));
+    buf.set(counter_attr, Variant(0));
+
+    const int num_updates = 20000;
+
+    std::thread writer([&](){
+            for (int i = 1; i <= num_updates; ++i)
+                buf.set(counter_attr, Variant(i));
+        });
+
+    std::vector<std::thread> readers;
+    std::vector<int>         errors(4, 0);
+
+    for (int r = 0; r < 4; ++r)
+        readers.emplace_back([&buf,&errors,r,counter_attr,const_attr](){
+                int last = 0;
+
+                while (last < num_updates) {
+                    SnapshotRecord::FixedSnapshotRecord<8> snapshot_data;
+                    SnapshotRecord rec(snapshot_data);
+
+                    buf.snapshot(&rec);
+
+                    if (rec.size().n_immediate != 2) {
+                        ++errors[r];
+                        break;
+                    }
+
+                    for (size_t n = 0; n < 2; ++n) {
+                        int val = rec.data().immediate_data[n].to_int();
+
+                        if (rec.data().immediate_attr[n] == const_attr.id() && val != 42)
+                            ++errors[r];
+                        if (rec.data().immediate_attr[n] == counter_attr.id()) {
+                            // updates become visible in order
+                            if (val < last)
+                                ++errors[r];
+
+                            last = val;
+                        }
+                    }
+                }
+            });
+
+    writer.join();
+
+    for (std::thread& t : readers)
+        t.join();
+
+    for (int r = 0; r < 4; ++r)
+        EXPECT_EQ(errors[r], 0) << "reader " << r;
+}
+
+TEST(ContextBufferTest, SharedBufferManyEntries) {
+    Caliper c;
+
+    ContextBuffer buf(true);
+
+    // more entries than the published copy holds: snapshots take the lock
+    for (int i = 0; i < 200; ++i)
+        buf.set(c.create_attribute("test.ctxbuf.many." + std::to_string(i), CALI_TYPE_INT, CALI_ATTR_ASVALUE),
+                Variant(i));
+
+    SnapshotRecord::FixedSnapshotRecord<256> snapshot_data;
+    SnapshotRecord rec(snapshot_data);
+
+    buf.snapshot(&rec);
+
+    EXPECT_EQ(rec.size().n_immediate, 200);
+}
+
+TEST(ContextBufferTest, ConcurrentUpdate) {
+    Caliper c;
+
+    Attribute int_attr =
+        c.create_attribute("test.ctxbuf.update.int", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+    Attribute dbl_attr =
+        c.create_attribute("test.ctxbuf.update.dbl", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    ContextBuffer buf(true);
+
+    // update() inserts missing entries; an empty result keeps the entry unchanged
+    EXPECT_EQ(buf.update(int_attr, [](const Variant& v){ return Variant(v.to_int() + 1); }).to_int(), 1);
+    EXPECT_TRUE(buf.update(int_attr, [](const Variant&){ return Variant(); }).empty());
+    EXPECT_EQ(buf.get(int_attr).to_int(), 1);
+
+    // exchange() also inserts missing entries and returns an empty previous value
+    EXPECT_TRUE(buf.exchange(dbl_attr, Variant(0.5)).empty());
+    EXPECT_DOUBLE_EQ(buf.get(dbl_attr).to_double(), 0.5);
+
+    const int num_threads = 4;
+    const int num_updates = 10000;
+
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back([&buf,int_attr,dbl_attr](){
+                for (int i = 0; i < num_updates; ++i) {
+                    buf.update(int_attr, [](const Variant& v){ return Variant(v.to_int() + 1); });
+                    buf.update(dbl_attr, [](const Variant& v){ return Variant(v.to_double() + 0.5); });
+                }
+            });
+
+    for (std::thread& t : threads)
+        t.join();
+
+    EXPECT_EQ(buf.get(int_attr).to_int(), 1 + num_threads * num_updates);
+    EXPECT_DOUBLE_EQ(buf.get(dbl_attr).to_double(), 0.5 * (1 + num_threads * num_updates));
+}
+
+TEST(ContextBufferTest, CaliperAdd) {
+    Caliper c;
+
+    Attribute uint_attr =
+        c.create_attribute("test.ctxbuf.add.uint", CALI_TYPE_UINT,
+                           CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_PROCESS);
+    Attribute str_attr =
+        c.create_attribute("test.ctxbuf.add.str", CALI_TYPE_STRING,
+                           CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_PROCESS);
+    Attribute node_attr =
+        c.create_attribute("test.ctxbuf.add.node", CALI_TYPE_INT, CALI_ATTR_SCOPE_PROCESS);
+
+    EXPECT_EQ(c.add(str_attr,  Variant(1)), CALI_ETYPE);
+    EXPECT_EQ(c.add(node_attr, Variant(1)), CALI_EINV);
+
+    const int num_threads = 4;
+    const int num_updates = 10000;
+
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back([uint_attr](){
+                for (int i = 0; i < num_updates; ++i)
+                    cali_add_int(uint_attr.id(), 2);
+            });
+
+    for (std::thread& t : threads)
+        t.join();
+
+    EXPECT_EQ(c.get(uint_attr).value().to_uint(), 2u * num_threads * num_updates);
+    EXPECT_EQ(cali_add_double(uint_attr.id(), 1.0), CALI_ETYPE);
+}
+
+namespace
+{
+
+int num_snapshot_cb_calls = 0;
+
+void count_snapshot_cb(Caliper*, int, const SnapshotRecord*, SnapshotRecord*)
+{
+    ++num_snapshot_cb_calls;
+}
+
+}
+
+TEST(ContextBufferTest, PullContext) {
+    Caliper c;
+
+    Attribute region_attr =
+        c.create_attribute("test.ctxbuf.pullctx.region", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute value_attr =
+        c.create_attribute("test.ctxbuf.pullctx.value",  CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    c.events().snapshot.connect(&count_snapshot_cb);
+
+    c.begin(region_attr, Variant(CALI_TYPE_STRING, "r", 1));
+    c.set(value_attr, Variant(7));
+
+    SnapshotRecord::FixedSnapshotRecord<8> snapshot_data;
+    SnapshotRecord rec(snapshot_data);
+
+    c.pull_context(CALI_SCOPE_THREAD, &rec);
+
+    EXPECT_EQ(num_snapshot_cb_calls, 0);
+
+    EXPECT_EQ(rec.get(value_attr).value().to_int(), 7);
+    EXPECT_EQ(rec.get(region_attr).value().to_string(), std::string("r"));
+
+    c.end(region_attr);
+    c.end(value_attr);
+}
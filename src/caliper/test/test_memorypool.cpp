@@ -0,0 +1,89 @@
+// Tests for the memory pool
+
+#include "../MemoryPool.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace cali;
+
+TEST(MemoryPoolTest, Allocate) {
+    MemoryPool pool;
+
+    char* p1 = static_cast<char*>(pool.allocate(13));
+    char* p2 = static_cast<char*>(pool.allocate(8));
+    char* p3 = static_cast<char*>(pool.allocate(1024*1024)); // larger than an arena
+
+    ASSERT_NE(p1, nullptr);
+    ASSERT_NE(p2, nullptr);
+    ASSERT_NE(p3, nullptr);
+
+    // allocations are 8-byte aligned and don't overlap
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(p1) % 8, 0);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(p2) % 8, 0);
+    EXPECT_TRUE(p2 >= p1 + 13 || p1 >= p2 + 8);
+
+    memset(p1, 0x1, 13);
+    memset(p2, 0x2, 8);
+    memset(p3, 0x3, 1024*1024);
+
+    EXPECT_EQ(p1[12], 0x1);
+    EXPECT_EQ(p2[7],  0x2);
+
+    std::ostringstream os;
+    pool.print_statistics(os);
+
+    EXPECT_NE(os.str().find("used"), std::string::npos);
+}
+
+TEST(MemoryPoolTest, ThreadArenas) {
+    MemoryPool pool;
+
+    const int    num_threads = 4;
+    const int    num_allocs  = 5000;
+    const size_t size        = 40;
+
+    std::vector< std::vector<char*> > ptrs(num_threads);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back([&,t](){
+                for (int i = 0; i < num_allocs; ++i) {
+                    char* p = static_cast<char*>(pool.allocate(size));
+
+                    if (p)
+                        memset(p, t+1, size);
+
+                    ptrs[t].push_back(p);
+                }
+            });
+
+    for (auto &t : threads)
+        t.join();
+
+    // check that each thread's data is intact, i.e. no overlapping allocations
+
+    std::vector< std::pair<char*, int> > all;
+
+    for (int t = 0; t < num_threads; ++t)
+        for (char* p : ptrs[t]) {
+            ASSERT_NE(p, nullptr);
+
+            for (size_t i = 0; i < size; ++i)
+                ASSERT_EQ(p[i], t+1);
+
+            all.push_back(std::make_pair(p, t));
+        }
+
+    std::sort(all.begin(), all.end());
+
+    for (size_t i = 1; i < all.size(); ++i)
+        EXPECT_GE(all[i].first, all[i-1].first + size);
+}
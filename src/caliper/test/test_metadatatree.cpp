@@ -9,8 +9,16 @@
 
 #include <gtest/gtest.h>
 
+#include <vector>
+
 using namespace cali;
 
+TEST(MetadataTreeTest, NodeSize) {
+    // nodes should fit in a cache line on 64-bit platforms
+    if (sizeof(void*) == 8)
+        EXPECT_LE(sizeof(Node), 64);
+}
+
 TEST(MetadataTreeTest, BigTree) {
     // just create a lot of nodes
     Caliper c;
@@ -112,3 +120,187 @@ TEST(MetadataTreeTest, ReplaceAll) {
 
     tree.print_statistics(std::cout) << std::endl;
 }
+
+TEST(MetadataTreeTest, HighFanout) {
+    Caliper c;
+
+    Attribute str_attr =
+        c.create_attribute("test.metatree.fanout.str", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute int_attr =
+        c.create_attribute("test.metatree.fanout.int", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+
+    MetadataTree tree;
+
+    Variant v_parent(CALI_TYPE_STRING, "fanout.parent", 14);
+    Node* parent = tree.get_path(str_attr, 1, &v_parent, nullptr);
+
+    ASSERT_NE(parent, nullptr);
+
+    // create many children under the same parent
+
+    const int N = 2000;
+    std::vector<Node*> children;
+
+    for (int i = 0; i < N; ++i) {
+        Variant v(i);
+        Node* node = tree.get_path(int_attr, 1, &v, parent);
+
+        ASSERT_NE(node, nullptr);
+        EXPECT_EQ(node->parent(), parent);
+
+        children.push_back(node);
+    }
+
+    // repeated lookups (through the child list and, for long child list
+    // walks, the child index) must return the existing nodes
+
+    for (int pass = 0; pass < 3; ++pass)
+        for (int i = 0; i < N; ++i) {
+            Variant v(i);
+            EXPECT_EQ(tree.get_path(int_attr, 1, &v, parent), children[i]);
+        }
+
+    // other trees (threads) find the same nodes
+
+    MetadataTree other;
+
+    for (int i = 0; i < N; i += 7) {
+        Variant v(i);
+        EXPECT_EQ(other.get_path(int_attr, 1, &v, parent), children[i]);
+    }
+
+    // same value with a different attribute is a different node
+
+    Variant v_str(CALI_TYPE_STRING, "42", 3);
+    Node* str_node = tree.get_path(str_attr, 1, &v_str, parent);
+
+    ASSERT_NE(str_node, nullptr);
+    EXPECT_EQ(str_node->attribute(), str_attr.id());
+    EXPECT_NE(str_node, children[42]);
+
+    tree.print_statistics(std::cout) << std::endl;
+}
+
+TEST(MetadataTreeTest, InternedStrings) {
+    Caliper c;
+
+    Attribute str_attr =
+        c.create_attribute("test.metatree.intern.str", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute int_attr =
+        c.create_attribute("test.metatree.intern.int", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+
+    MetadataTree tree;
+
+    std::string name_a = "a.rather.long.region.name.with.a.common.prefix.1";
+    std::string name_b = "a.rather.long.region.name.with.a.common.prefix.2";
+
+    Variant v_p1(1);
+    Variant v_p2(2);
+
+    Node* p1 = tree.get_path(int_attr, 1, &v_p1, nullptr);
+    Node* p2 = tree.get_path(int_attr, 1, &v_p2, nullptr);
+
+    ASSERT_NE(p1, nullptr);
+    ASSERT_NE(p2, nullptr);
+
+    // equal strings in different places of the tree share storage
+
+    std::string copy_a = name_a;
+
+    Variant v_a(CALI_TYPE_STRING, name_a.data(), name_a.size());
+    Variant v_a_copy(CALI_TYPE_STRING, copy_a.data(), copy_a.size());
+    Variant v_b(CALI_TYPE_STRING, name_b.data(), name_b.size());
+
+    Node* a1 = tree.get_path(str_attr, 1, &v_a, p1);
+    Node* a2 = tree.get_path(str_attr, 1, &v_a_copy, p2);
+    Node* b1 = tree.get_path(str_attr, 1, &v_b, p1);
+
+    ASSERT_NE(a1, nullptr);
+    ASSERT_NE(a2, nullptr);
+    ASSERT_NE(b1, nullptr);
+
+    EXPECT_NE(a1, a2);
+    EXPECT_NE(a1, b1);
+    EXPECT_EQ(a1->data().data(), a2->data().data());
+    EXPECT_NE(a1->data().data(), b1->data().data());
+    EXPECT_NE(a1->data().data(), static_cast<const void*>(name_a.data()));
+    EXPECT_EQ(a1->data().to_string(), name_a);
+    EXPECT_EQ(b1->data().to_string(), name_b);
+
+    // lookups with another copy of the string find the existing nodes,
+    // also from other trees (threads)
+
+    copy_a = name_a;
+
+    MetadataTree other;
+
+    EXPECT_EQ(tree.get_path(str_attr, 1, &v_a_copy, p1), a1);
+    EXPECT_EQ(other.get_path(str_attr, 1, &v_a_copy, p2), a2);
+    EXPECT_EQ(other.get_path(str_attr, 1, &v_b, p1), b1);
+
+    // multi-attribute paths use the same table
+
+    Attribute attrs[2] = { str_attr, str_attr };
+    Variant   vals[2]  = { v_b, v_a_copy };
+
+    Node* ba = other.get_path(2, attrs, vals, p2);
+
+    ASSERT_NE(ba, nullptr);
+    EXPECT_EQ(ba->data().data(), a1->data().data());
+    EXPECT_EQ(ba->parent()->data().data(), b1->data().data());
+}
+
+TEST(MetadataTreeTest, SharedBlobs) {
+    Caliper c;
+
+    Attribute usr_attr =
+        c.create_attribute("test.metatree.blob", CALI_TYPE_USR, CALI_ATTR_DEFAULT);
+    Attribute int_attr =
+        c.create_attribute("test.metatree.blob.parent", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+
+    MetadataTree tree;
+
+    Variant v_p1(1);
+    Variant v_p2(2);
+
+    Node* p1 = tree.get_path(int_attr, 1, &v_p1, nullptr);
+    Node* p2 = tree.get_path(int_attr, 1, &v_p2, nullptr);
+
+    ASSERT_NE(p1, nullptr);
+    ASSERT_NE(p2, nullptr);
+
+    // large blobs are stored once, small ones are copied for each node
+
+    std::vector<unsigned char> large(256);
+    std::vector<unsigned char> small(4);
+
+    for (size_t i = 0; i < large.size(); ++i)
+        large[i] = static_cast<unsigned char>(i);
+    for (size_t i = 0; i < small.size(); ++i)
+        small[i] = static_cast<unsigned char>(i);
+
+    Variant v_large(CALI_TYPE_USR, large.data(), large.size());
+    Variant v_small(CALI_TYPE_USR, small.data(), small.size());
+
+    Node* l1 = tree.get_path(usr_attr, 1, &v_large, p1);
+    Node* l2 = tree.get_path(usr_attr, 1, &v_large, p2);
+    Node* s1 = tree.get_path(usr_attr, 1, &v_small, p1);
+    Node* s2 = tree.get_path(usr_attr, 1, &v_small, p2);
+
+    ASSERT_NE(l1, nullptr);
+    ASSERT_NE(l2, nullptr);
+    ASSERT_NE(s1, nullptr);
+    ASSERT_NE(s2, nullptr);
+
+    EXPECT_NE(l1, l2);
+    EXPECT_EQ(l1->data().data(), l2->data().data());
+    EXPECT_NE(l1->data().data(), static_cast<const void*>(large.data()));
+    EXPECT_NE(s1->data().data(), s2->data().data());
+    EXPECT_EQ(l1->data(), v_large);
+    EXPECT_EQ(s2->data(), v_small);
+
+    // lookups still compare blobs by value
+
+    EXPECT_EQ(tree.get_path(usr_attr, 1, &v_large, p1), l1);
+    EXPECT_EQ(tree.get_path(usr_attr, 1, &v_small, p2), s2);
+}
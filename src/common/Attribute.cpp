@@ -49,12 +49,24 @@ Attribute::make_attribute(const Node* node)
     if (!node || node->attribute() == CALI_INV_ID || node->attribute() != s_keys.name_attr_id)
         return Attribute::invalid;
 
-    // Find type attribute
-    for (const Node* p = node; p && p->attribute() != CALI_INV_ID; p = p->parent()) 
-        if (p->attribute() == s_keys.type_attr_id)
-            return Attribute(node);
+    // Find type and properties attributes
+    cali_attr_type type = CALI_TYPE_INV;
+    int            prop = CALI_ATTR_DEFAULT;
+    bool           have_prop = false;
+
+    for (const Node* p = node; p && p->attribute() != CALI_INV_ID; p = p->parent()) {
+        if (type == CALI_TYPE_INV && p->attribute() == s_keys.type_attr_id)
+            type = p->data().to_attr_type();
+        else if (!have_prop && p->attribute() == s_keys.prop_attr_id) {
+            prop = p->data().to_int();
+            have_prop = true;
+        }
+    }
+
+    if (type == CALI_TYPE_INV)
+        return Attribute::invalid;
 
-    return Attribute::invalid;
+    return Attribute(node, type, prop);
 }
 
 cali_id_t
@@ -83,26 +95,6 @@ Attribute::name_c_str() const
     return nullptr;
 }
 
-cali_attr_type
-Attribute::type() const 
-{
-    for (const Node* node = m_node; node && node->attribute() != CALI_INV_ID; node = node->parent())
-        if (node->attribute() == s_keys.type_attr_id)
-            return node->data().to_attr_type();
-
-    return CALI_TYPE_INV;
-}
-
-int
-Attribute::properties() const 
-{
-    for (const Node* node = m_node; node && node->attribute() != CALI_INV_ID; node = node->parent())
-        if (node->attribute() == s_keys.prop_attr_id)
-            return node->data().to_int();
-
-    return CALI_ATTR_DEFAULT;
-}
-
 Variant
 Attribute::get(const Attribute& attr) const
 {
@@ -129,4 +121,4 @@ cali::operator << (std::ostream& os, const Attribute& a)
 const MetaAttributeIDs MetaAttributeIDs::invalid { CALI_INV_ID, CALI_INV_ID, CALI_INV_ID };
 const MetaAttributeIDs Attribute::s_keys { 8, 9, 10 };
 
-const Attribute Attribute::invalid { 0 };
+const Attribute Attribute::invalid { nullptr, CALI_TYPE_INV, CALI_ATTR_DEFAULT };
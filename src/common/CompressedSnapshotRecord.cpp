@@ -38,6 +38,113 @@ namespace
 
         return dst;
     }
+
+    /// \brief Variable-length integer decoding with fast paths for the
+    ///   common one- and two-byte cases. Same semantics as vldec_u64().
+    inline uint64_t fast_vldec_u64(const unsigned char* buf, size_t* pos)
+    {
+        const unsigned char* p = buf + *pos;
+
+        if (!(p[0] & 0x80)) {
+            *pos += 1;
+            return p[0];
+        }
+        if (!(p[1] & 0x80)) {
+            *pos += 2;
+            return (p[0] & 0x7F) | (static_cast<uint64_t>(p[1]) << 7);
+        }
+
+        return vldec_u64(p, pos);
+    }
+
+    /// \brief Check that \a n complete variable-length integers start at
+    ///   \a pos within the first \a len bytes of \a buf.
+    inline bool vlenc_complete(const unsigned char* buf, size_t len, size_t pos, int n)
+    {
+        // the longest encoding of a 64-bit value is 10 bytes
+        if (pos + 10*n <= len)
+            return true;
+
+        for ( ; n > 0; --n) {
+            size_t end = pos + 10;
+
+            while (pos < len && pos < end && (buf[pos] & 0x80))
+                ++pos;
+            if (pos >= len || pos >= end)
+                return false;
+
+            ++pos;
+        }
+
+        return true;
+    }
+}
+
+//
+// --- CompressedSnapshotBatch
+//
+
+void
+CompressedSnapshotBatch::clear()
+{
+    node_offsets.assign(1, 0);
+    node_ids.clear();
+    imm_offsets.assign(1, 0);
+    imm_attr.clear();
+    imm_data.clear();
+}
+
+size_t
+CompressedSnapshotBatch::decode(const unsigned char* buf, size_t len, size_t max_records, size_t* inc)
+{
+    size_t pos   = 0;
+    size_t count = 0;
+
+    while (count < max_records && pos < len) {
+        size_t p = pos;
+
+        // record layout: [ n_nodes, node ids..., n_imm, (attr id, variant)... ]
+
+        size_t n_nodes = buf[p++];
+        size_t n_base  = node_ids.size();
+
+        bool ok = true;
+
+        for (size_t i = 0; ok && i < n_nodes; ++i)
+            if ((ok = ::vlenc_complete(buf, len, p, 1)))
+                node_ids.push_back(::fast_vldec_u64(buf, &p));
+
+        ok = ok && p < len;
+
+        size_t n_imm  = ok ? buf[p++] : 0;
+        size_t i_base = imm_attr.size();
+
+        // immediate entries: attribute id and packed variant (two vlencs)
+        for (size_t i = 0; ok && i < n_imm; ++i)
+            if ((ok = ::vlenc_complete(buf, len, p, 3))) {
+                imm_attr.push_back(::fast_vldec_u64(buf, &p));
+                imm_data.push_back(Variant::unpack(buf+p, &p, &ok));
+            }
+
+        if (!ok) {
+            // drop the partial record
+            node_ids.resize(n_base);
+            imm_attr.resize(i_base);
+            imm_data.resize(i_base);
+            break;
+        }
+
+        node_offsets.push_back(node_ids.size());
+        imm_offsets.push_back(imm_attr.size());
+
+        pos = p;
+        ++count;
+    }
+
+    if (inc)
+        *inc += pos;
+
+    return count;
 }
 
 //
@@ -75,7 +182,7 @@ CompressedSnapshotRecordView::unpack_next_entry(const CaliperMetadataAccessInter
     
     if (n < m_num_nodes) {
         ++n;
-        return Entry(c->node(vldec_u64(m_buffer+pos, &pos)));
+        return Entry(c->node(::fast_vldec_u64(m_buffer, &pos)));
     }
 
     if (n == m_num_nodes)
@@ -84,7 +191,7 @@ CompressedSnapshotRecordView::unpack_next_entry(const CaliperMetadataAccessInter
     if (n < m_num_nodes + m_num_imm) {
         ++n;
 
-        cali_id_t attr = vldec_u64(m_buffer+pos, &pos);
+        cali_id_t attr = ::fast_vldec_u64(m_buffer, &pos);
         Variant   data = Variant::unpack(m_buffer+pos, &pos, nullptr);
 
         return Entry(attr, data);
@@ -98,10 +205,8 @@ void
 CompressedSnapshotRecordView::unpack_nodes(size_t n, cali_id_t node_vec[]) const
 {
     size_t max = std::min(n, m_num_nodes);
-    size_t pos = 1;
 
-    for (size_t i = 0; i < max; ++i)
-        node_vec[i] = vldec_u64(m_buffer+pos, &pos);
+    vldec_u64_array(m_buffer+1, max, node_vec);
 }
 
 /// \brief Unpack immediate entries
@@ -112,7 +217,7 @@ CompressedSnapshotRecordView::unpack_immediate(size_t n, cali_id_t attr_vec[], V
     size_t pos = m_imm_pos + 1;
 
     for (size_t i = 0; i < max; ++i) {
-        attr_vec[i] = vldec_u64(m_buffer+pos, &pos);
+        attr_vec[i] = ::fast_vldec_u64(m_buffer, &pos);
         data_vec[i] = Variant::unpack(m_buffer+pos, &pos, nullptr);
     }
 }
@@ -125,17 +230,19 @@ CompressedSnapshotRecordView::to_entrylist(const CaliperMetadataAccessInterface*
     list.reserve(m_num_nodes + m_num_imm);
 
     {
-        size_t pos = 1;
+        cali_id_t node_vec[256]; // the node count is stored in one byte
+
+        unpack_nodes(m_num_nodes, node_vec);
 
         for (size_t i = 0; i < m_num_nodes; ++i)
-            list.push_back(Entry(c->node(vldec_u64(m_buffer+pos, &pos))));
+            list.push_back(Entry(c->node(node_vec[i])));
     }
 
     {
         size_t pos = m_imm_pos + 1;
 
         for (size_t i = 0; i < m_num_imm; ++i) {
-            cali_id_t attr = vldec_u64(m_buffer+pos, &pos);
+            cali_id_t attr = ::fast_vldec_u64(m_buffer, &pos);
             Variant   data = Variant::unpack(m_buffer+pos, &pos, nullptr);
 
             list.push_back(Entry(attr, data));
@@ -182,6 +289,28 @@ CompressedSnapshotRecord::append(size_t n, const Node* const node_vec[])
 {
     size_t skipped = 0;
 
+    while (n > 0) {
+        cali_id_t ids[m_blocksize];
+        size_t blk = std::min(n, m_blocksize);
+
+        for (size_t i = 0; i < blk; ++i)
+            ids[i] = node_vec[i]->id();
+
+        skipped  += append(blk, ids);
+
+        node_vec += blk;
+        n        -= blk;
+    }
+
+    return skipped;
+}
+
+/// \brief Append node entries given by node id
+size_t
+CompressedSnapshotRecord::append(size_t n, const cali_id_t node_vec[])
+{
+    size_t skipped = 0;
+
     // blockwise encode, size check, and copy
     while (n > 0) {
         unsigned char tmp[m_blocksize*10];
@@ -189,8 +318,7 @@ CompressedSnapshotRecord::append(size_t n, const Node* const node_vec[])
         size_t len = 0;
 
         // encode to temp buffer
-        for (size_t i = 0; i < blk; ++i)
-            len += vlenc_u64(node_vec[i]->id(), tmp+len);
+        len = vlenc_u64_array(node_vec, blk, tmp);
 
         // size check, copy to actual buffer
         if (m_num_nodes+blk < 128 && m_imm_pos+m_imm_len+len <= m_buffer_len) {
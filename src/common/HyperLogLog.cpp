@@ -0,0 +1,189 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// HyperLogLog class implementation
+
+#include "caliper/common/HyperLogLog.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace cali;
+
+namespace
+{
+
+// Registers per code word and the word index shift in encode()
+const int RegistersPerCode = 9;
+const int CodeIndexShift   = 6 * RegistersPerCode;
+
+inline uint64_t
+fnv1a(const void* ptr, size_t len)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(ptr);
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < len; ++i)
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+
+    return h;
+}
+
+/// MurmurHash3 finalizer: spreads FNV output over all bits, which
+/// HyperLogLog's register index and rank rely on
+inline uint64_t
+fmix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+} // namespace [anonymous]
+
+HyperLogLog::HyperLogLog()
+{
+    std::fill_n(m_registers, NumRegisters, 0);
+}
+
+void
+HyperLogLog::add_hash(uint64_t hash)
+{
+    int      idx  = static_cast<int>(hash >> (64 - NumRegisterBits));
+    uint64_t w    = hash << NumRegisterBits;
+    int      rank = 1;
+
+    // rank: position of the leftmost 1 bit in the remaining bits
+    for ( ; rank <= 64 - NumRegisterBits && !(w & (1ULL << 63)); ++rank)
+        w <<= 1;
+
+    if (m_registers[idx] < rank)
+        m_registers[idx] = static_cast<unsigned char>(rank);
+}
+
+void
+HyperLogLog::merge(const HyperLogLog& other)
+{
+    for (int i = 0; i < NumRegisters; ++i)
+        m_registers[i] = std::max(m_registers[i], other.m_registers[i]);
+}
+
+void
+HyperLogLog::merge_code(uint64_t code)
+{
+    int first = static_cast<int>(code >> CodeIndexShift) * RegistersPerCode;
+
+    for (int i = 0; i < RegistersPerCode && first + i < NumRegisters; ++i) {
+        unsigned char r = static_cast<unsigned char>((code >> (6*i)) & 0x3F);
+        m_registers[first+i] = std::max(m_registers[first+i], r);
+    }
+}
+
+void
+HyperLogLog::encode(std::vector<uint64_t>& codes) const
+{
+    for (int first = 0; first < NumRegisters; first += RegistersPerCode) {
+        uint64_t code = 0;
+
+        for (int i = 0; i < RegistersPerCode && first + i < NumRegisters; ++i)
+            code |= static_cast<uint64_t>(m_registers[first+i]) << (6*i);
+
+        if (code)
+            codes.push_back(code | (static_cast<uint64_t>(first / RegistersPerCode) << CodeIndexShift));
+    }
+}
+
+bool
+HyperLogLog::empty() const
+{
+    return std::all_of(m_registers, m_registers + NumRegisters,
+                       [](unsigned char r) { return r == 0; });
+}
+
+uint64_t
+HyperLogLog::estimate() const
+{
+    const double m = static_cast<double>(NumRegisters);
+
+    double sum   = 0.0;
+    int    zeros = 0;
+
+    for (int i = 0; i < NumRegisters; ++i) {
+        sum += std::ldexp(1.0, -static_cast<int>(m_registers[i]));
+
+        if (m_registers[i] == 0)
+            ++zeros;
+    }
+
+    double e = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+
+    // small-range correction (linear counting)
+    if (e <= 2.5 * m && zeros > 0)
+        e = m * std::log(m / zeros);
+
+    return static_cast<uint64_t>(e + 0.5);
+}
+
+uint64_t
+HyperLogLog::hash(const Variant& val)
+{
+    cali_attr_type type = val.type();
+
+    if (type == CALI_TYPE_STRING || type == CALI_TYPE_USR) {
+        // Strings may or may not include the terminating NUL depending on
+        // where they come from; ignore it so that the hashes agree
+        const char* str = static_cast<const char*>(val.data());
+        size_t      len = val.size();
+
+        if (type == CALI_TYPE_STRING)
+            while (len > 0 && str[len-1] == '\0')
+                --len;
+
+        return ::fmix64(::fnv1a(str, len));
+    }
+
+    uint64_t bits = 0;
+
+    if (type == CALI_TYPE_DOUBLE) {
+        double d = val.to_double();
+        std::memcpy(&bits, &d, sizeof(bits));
+    } else {
+        bits = val.to_uint();
+    }
+
+    return ::fmix64(::fnv1a(&bits, sizeof(bits)));
+}
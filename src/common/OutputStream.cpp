@@ -32,16 +32,225 @@
 
 #include "caliper/common/OutputStream.h"
 
+#include "caliper/caliper-config.h"
+
 #include "caliper/common/Log.h"
 #include "caliper/common/SnapshotTextFormatter.h"
 
+#ifdef CALIPER_HAVE_ZLIB
+#include "util/gzip_util.h"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
 #include <mutex>
 #include <sstream>
+#include <streambuf>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace cali;
 
+namespace
+{
+
+/// Block alignment for direct I/O
+const std::size_t Alignment = 4096;
+
+/// \brief Stream buffer for files that issues writes in large, aligned
+///   blocks.
+///
+/// Output is collected in a page-aligned buffer and written when the
+/// buffer is full, on sync(), and on close(). With direct I/O (O_DIRECT),
+/// only multiples of the block alignment are written until the file is
+/// closed, so sync() may keep the last partial block in the buffer.
+class FileStreambuf : public std::streambuf
+{
+    int         m_fd;
+    char*       m_buf;
+    std::size_t m_size;
+    bool        m_direct;
+    bool        m_fsync;
+    bool        m_error;
+    std::string m_filename;
+
+    bool write_all(const char* data, std::size_t len) {
+        while (len > 0) {
+            ssize_t ret = ::write(m_fd, data, len);
+
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                if (!m_error)
+                    Log(0).stream() << "OutputStream: error writing " << m_filename << ": "
+                                    << std::strerror(errno) << std::endl;
+
+                m_error = true;
+                return false;
+            }
+
+            data += ret;
+            len  -= static_cast<std::size_t>(ret);
+        }
+
+        return true;
+    }
+
+    bool write_buffer(bool final) {
+        if (m_fd < 0 || !m_buf)
+            return false;
+
+        std::size_t len = pptr() - pbase();
+        std::size_t n   = len;
+
+        if (m_direct) {
+            if (final) {
+                // The tail is not a multiple of the alignment; write it
+                // without O_DIRECT
+                int flags = fcntl(m_fd, F_GETFL);
+#ifdef O_DIRECT
+                if (flags >= 0)
+                    fcntl(m_fd, F_SETFL, flags & ~O_DIRECT);
+#endif
+            } else {
+                n = len - len % Alignment;
+            }
+        }
+
+        bool ok = write_all(m_buf, n);
+
+        if (n < len)
+            std::memmove(m_buf, m_buf + n, len - n);
+
+        setp(m_buf, m_buf + m_size);
+        pbump(static_cast<int>(len - n));
+
+        return ok;
+    }
+
+protected:
+
+    int_type overflow(int_type ch) override {
+        if (!write_buffer(false))
+            return traits_type::eof();
+
+        if (traits_type::eq_int_type(ch, traits_type::eof()))
+            return traits_type::not_eof(ch);
+
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+
+        return ch;
+    }
+
+    int sync() override {
+        return write_buffer(false) ? 0 : -1;
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize count) override {
+        std::size_t len = static_cast<std::size_t>(count);
+
+        // Write large chunks (e.g., pre-formatted output blocks) directly
+        // instead of copying them through the buffer. Not with direct
+        // I/O, which needs aligned writes.
+        if (m_direct || len < m_size || !m_buf)
+            return std::streambuf::xsputn(s, count);
+
+        if (!write_buffer(false) || !write_all(s, len))
+            return 0;
+
+        return count;
+    }
+
+public:
+
+    FileStreambuf()
+        : m_fd(-1), m_buf(nullptr), m_size(0), m_direct(false), m_fsync(false), m_error(false)
+        { }
+
+    ~FileStreambuf() {
+        close();
+    }
+
+    bool open(const std::string& filename, std::size_t buffer_size, bool direct, bool do_fsync) {
+        close();
+
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+        if (direct) {
+#ifdef O_DIRECT
+            flags |= O_DIRECT;
+#else
+            Log(1).stream() << "OutputStream: direct I/O is not supported on this platform" << std::endl;
+            direct = false;
+#endif
+        }
+
+        m_fd = ::open(filename.c_str(), flags, 0666);
+
+        if (m_fd < 0 && direct) {
+            // e.g., file systems that don't support O_DIRECT
+            Log(1).stream() << "OutputStream: can't use direct I/O for " << filename
+                            << ": " << std::strerror(errno) << std::endl;
+
+            direct = false;
+            m_fd   = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        }
+
+        if (m_fd < 0)
+            return false;
+
+        m_size = std::max<std::size_t>(Alignment, (buffer_size + Alignment - 1) / Alignment * Alignment);
+
+        void* ptr = nullptr;
+
+        if (posix_memalign(&ptr, Alignment, m_size) != 0) {
+            ::close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+
+        m_buf      = static_cast<char*>(ptr);
+        m_direct   = direct;
+        m_fsync    = do_fsync;
+        m_error    = false;
+        m_filename = filename;
+
+        setp(m_buf, m_buf + m_size);
+
+        return true;
+    }
+
+    bool close() {
+        if (m_fd < 0)
+            return true;
+
+        bool ok = write_buffer(true);
+
+        if (m_fsync && fsync(m_fd) != 0) {
+            Log(0).stream() << "OutputStream: fsync failed for " << m_filename << ": "
+                            << std::strerror(errno) << std::endl;
+            ok = false;
+        }
+
+        ::close(m_fd);
+        std::free(m_buf);
+
+        m_fd  = -1;
+        m_buf = nullptr;
+
+        setp(nullptr, nullptr);
+
+        return ok;
+    }
+};
+
+} // namespace [anonymous]
+
 struct OutputStream::OutputStreamImpl
 {
     StreamType    type;
@@ -50,7 +259,21 @@ struct OutputStream::OutputStreamImpl
     std::mutex    init_mutex;
     
     std::string   filename;
-    std::ofstream fs;
+    FileStreambuf filebuf;
+    std::ostream  fs;
+
+    std::ostream* user_os;
+
+    Compression   compression;
+
+    std::size_t   buffer_size;
+    bool          direct_io;
+    bool          use_fsync;
+
+#ifdef CALIPER_HAVE_ZLIB
+    std::unique_ptr<util::GzipStreambuf> zbuf;
+    std::unique_ptr<std::ostream>        zs;
+#endif
 
     void init() {        
         if (is_initialized)
@@ -58,49 +281,102 @@ struct OutputStream::OutputStreamImpl
 
         std::lock_guard<std::mutex>
             g(init_mutex);
-        
-        is_initialized = true;
 
-        if (type == StreamType::File) {
-            fs.open(filename);
+        if (is_initialized)
+            return;
 
-            if (!fs.is_open()) {
+        if (type == StreamType::File) {
+            if (filebuf.open(filename, buffer_size, direct_io, use_fsync)) {
+                fs.rdbuf(&filebuf);
+            } else {
                 type = StreamType::None;
                 
                 Log(0).stream() << "Could not open output stream " << filename << std::endl;
             }
         }
+
+        if (compression == Gzip && type != StreamType::None) {
+#ifdef CALIPER_HAVE_ZLIB
+            zbuf.reset(new util::GzipStreambuf(uncompressed_stream()));
+            zs.reset(new std::ostream(zbuf.get()));
+#else
+            Log(0).stream() << "OutputStream: gzip compression is not available, writing uncompressed output" << std::endl;
+            compression = NoCompression;
+#endif
+        }
+
+        is_initialized = true;
+    }
+
+    std::ostream& uncompressed_stream() {
+        switch (type) {
+        case StdOut:
+            return std::cout;
+        case StdErr:
+            return std::cerr;
+        case User:
+            return *user_os;
+        default:
+            return fs;
+        }
     }
 
     std::ostream& stream() {
         init();
+
+#ifdef CALIPER_HAVE_ZLIB
+        if (zs)
+            return *zs;
+#endif
     
         switch (type) {
         case StdOut:
             return std::cout;
         case StdErr:
             return std::cerr;
+        case User:
+            return *user_os;
         default:
             return fs;
         }
     }
 
     void reset() {
-        fs.close();
+#ifdef CALIPER_HAVE_ZLIB
+        zs.reset();
+        zbuf.reset(); // writes pending compressed output
+#endif
+        fs.rdbuf(nullptr);
+        filebuf.close();
         filename.clear();        
+        user_os = nullptr;
         type = StreamType::None;
         is_initialized = false;
     }
     
     OutputStreamImpl()
-        : type(StreamType::None), is_initialized(false)
+        : type(StreamType::None), is_initialized(false), fs(nullptr), user_os(nullptr), compression(NoCompression),
+          buffer_size(DefaultBufferSize), direct_io(false), use_fsync(false)
     { }
 
-    OutputStreamImpl(const char* name)
-        : type(StreamType::None), is_initialized(false), filename(name)
-    { }
+    ~OutputStreamImpl() {
+        reset();
+    }
 };
 
+namespace
+{
+
+bool
+has_gz_suffix(const std::string& filename)
+{
+    return filename.size() > 3 && filename.compare(filename.size() - 3, 3, ".gz") == 0;
+}
+
+}
+
+const std::size_t OutputStream::DefaultBufferSize;
+
 OutputStream::OutputStream()
     : mP(new OutputStreamImpl)
 { }
@@ -116,12 +392,48 @@ OutputStream::type() const
     return mP->type;
 }
 
+OutputStream::Compression
+OutputStream::compression() const
+{
+    return mP->compression;
+}
+
+void
+OutputStream::set_compression(Compression compression)
+{
+    mP->compression = compression;
+}
+
+void
+OutputStream::set_buffer_size(std::size_t size)
+{
+    mP->buffer_size = size;
+}
+
+void
+OutputStream::set_direct_io(bool direct)
+{
+    mP->direct_io = direct;
+}
+
+void
+OutputStream::set_fsync(bool do_fsync)
+{
+    mP->use_fsync = do_fsync;
+}
+
 std::ostream&
 OutputStream::stream()
 {
     return mP->stream();
 }
 
+void
+OutputStream::write(const char* data, std::size_t len)
+{
+    mP->stream().write(data, len);
+}
+
 void
 OutputStream::set_stream(StreamType type)
 {
@@ -129,6 +441,15 @@ OutputStream::set_stream(StreamType type)
     mP->type = type;
 }
 
+void
+OutputStream::set_stream(std::ostream* os)
+{
+    mP->reset();
+
+    mP->user_os = os;
+    mP->type    = os ? StreamType::User : StreamType::None;
+}
+
 void
 OutputStream::set_filename(const char* filename)
 {
@@ -136,6 +457,9 @@ OutputStream::set_filename(const char* filename)
 
     mP->filename = filename;
     mP->type     = StreamType::File;
+
+    if (::has_gz_suffix(mP->filename))
+        mP->compression = Gzip;
 }
 
 void
@@ -155,5 +479,8 @@ OutputStream::set_filename(const char* formatstr, const CaliperMetadataAccessInt
         
         mP->filename = fnamestr.str();
         mP->type     = StreamType::File;
+
+        if (::has_gz_suffix(mP->filename))
+            mP->compression = Gzip;
     }
 }
@@ -159,6 +159,7 @@ struct RuntimeConfigImpl
     static const ConfigSet::Entry            s_configdata[];
 
     static bool                              s_allow_read_env;
+    static RuntimeConfig::ConfigFileReadFn   s_file_reader;
 
     // combined profile: initially receives settings made through "add" API,
     // then merges all selected profiles in here
@@ -219,18 +220,31 @@ struct RuntimeConfigImpl
             m_config_profiles[current_profile_name] = current_profile;
     }
 
-    void read_config_files(const std::vector<std::string>& filenames) {
+    static vector<string> read_local_files(const vector<string>& filenames) {
+        vector<string> contents;
+
+        for (const auto &s : filenames) {
+            ifstream fs(s.c_str());
+
+            if (fs)
+                contents.emplace_back(istreambuf_iterator<char>(fs), istreambuf_iterator<char>());
+        }
+
+        return contents;
+    }
+
+    void read_config_files(const std::vector<std::string>& filenames, bool broadcast) {
         // read builtin profiles
 
         istringstream is(::builtin_profiles);
         read_config_profiles(is);
 
+        vector<string> contents =
+            (broadcast && s_file_reader) ? (*s_file_reader)(filenames) : read_local_files(filenames);
 
-        for (const auto &s : filenames) {
-            ifstream fs(s.c_str());
-
-            if (fs)
-                read_config_profiles(fs);
+        for (const auto &s : contents) {
+            istringstream fs(s);
+            read_config_profiles(fs);
         }
     }
 
@@ -240,7 +254,8 @@ struct RuntimeConfigImpl
         init_config_cfg.init("config", s_configdata, s_allow_read_env, m_combined_profile, m_top_profile);
 
         // read config files
-        read_config_files(init_config_cfg.get("file").to_stringlist());
+        read_config_files(init_config_cfg.get("file").to_stringlist(),
+                          init_config_cfg.get("file_broadcast").to_bool());
 
         // merge "default" profile into combined profile
         {
@@ -344,10 +359,17 @@ const ConfigSet::Entry RuntimeConfigImpl::s_configdata[] = {
       "List of configuration files",
       "Comma-separated list of configuration files"
     },
+    { "file_broadcast", CALI_TYPE_BOOL, "false",
+      "Read configuration files on MPI rank 0 only",
+      "Read configuration files on MPI rank 0 only and broadcast their\n"
+      "contents to the other ranks. Requires the Caliper MPI runtime library\n"
+      "and that all ranks initialize Caliper collectively (e.g., in MPI_Init)."
+    },
     ConfigSet::Terminator
 };
 
 bool RuntimeConfigImpl::s_allow_read_env { true };
+RuntimeConfig::ConfigFileReadFn RuntimeConfigImpl::s_file_reader { nullptr };
 
 } // namespace cali
 
@@ -424,6 +446,18 @@ RuntimeConfig::allow_read_env(bool allow)
     return RuntimeConfigImpl::s_allow_read_env;
 }
 
+void
+RuntimeConfig::set_config_file_reader(ConfigFileReadFn fn)
+{
+    RuntimeConfigImpl::s_file_reader = fn;
+}
+
+std::vector<std::string>
+RuntimeConfig::read_config_files(const std::vector<std::string>& filenames)
+{
+    return RuntimeConfigImpl::read_local_files(filenames);
+}
+
 // "hidden" function to be used by tests
 
 namespace cali
@@ -0,0 +1,300 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file ShmRing.cpp
+/// Shared-memory ring buffer implementation
+
+#include "caliper/common/ShmRing.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include <unistd.h>
+
+using namespace cali;
+
+namespace
+{
+
+inline uint64_t align8(uint64_t n)
+{
+    return (n + 7) & ~static_cast<uint64_t>(7);
+}
+
+inline uint64_t align64(uint64_t n)
+{
+    return (n + 63) & ~static_cast<uint64_t>(63);
+}
+
+/// \brief The commit word of the dictionary entry at \a pos with payload
+///   length \a len
+inline uint64_t dict_commit_word(uint64_t pos, uint64_t len)
+{
+    return (((pos / 8 + 1) & 0xFFFFFFFF) << 32) | (len & 0xFFFFFFFF);
+}
+
+inline std::atomic<uint64_t>* as_atomic(unsigned char* ptr)
+{
+    return reinterpret_cast<std::atomic<uint64_t>*>(ptr);
+}
+
+inline const std::atomic<uint64_t>* as_atomic(const unsigned char* ptr)
+{
+    return reinterpret_cast<const std::atomic<uint64_t>*>(ptr);
+}
+
+}
+
+const char ShmRingHeader::magic[8] = { 'C', 'A', 'L', 'I', '-', 'S', 'H', 'M' };
+
+//
+// --- ShmRingWriter
+//
+
+ShmRingWriter::ShmRingWriter(void* mem, std::size_t size, std::size_t dict_size, std::size_t slot_size)
+    : m_header(nullptr), m_base(static_cast<unsigned char*>(mem))
+{
+    uint64_t header_size   = align64(sizeof(ShmRingHeader));
+    uint64_t dict_capacity = align8(dict_size);
+    uint64_t ring_offset   = align64(header_size + dict_capacity);
+
+    slot_size = align8(std::max<uint64_t>(slot_size, sizeof(Slot) + 8));
+
+    if (size < ring_offset + 2 * slot_size)
+        return;
+
+    memset(mem, 0, ring_offset);
+
+    ShmRingHeader* h = new(mem) ShmRingHeader;
+
+    h->version_number = ShmRingHeader::version;
+    h->header_size    = static_cast<uint32_t>(header_size);
+    h->pid            = static_cast<uint64_t>(getpid());
+    h->dict_offset    = header_size;
+    h->dict_capacity  = dict_capacity;
+    h->ring_offset    = ring_offset;
+    h->slot_size      = slot_size;
+    h->num_slots      = (size - ring_offset) / slot_size;
+
+    h->dict_head.store(0);
+    h->ring_head.store(0);
+    h->num_dropped.store(0);
+
+    for (uint64_t i = 0; i < h->num_slots; ++i)
+        new(m_base + ring_offset + i * slot_size) Slot { { 0 }, 0, 0 };
+
+    // readers check the id last, so write it after everything else
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(h->id, ShmRingHeader::magic, sizeof(h->id));
+
+    m_header = h;
+}
+
+bool
+ShmRingWriter::add_node(const unsigned char* data, std::size_t len)
+{
+    if (!m_header)
+        return false;
+
+    uint64_t total = 8 + align8(len);
+    uint64_t pos   = m_header->dict_head.fetch_add(total, std::memory_order_relaxed);
+
+    if (pos + total > m_header->dict_capacity)
+        return false;
+
+    unsigned char* entry = m_base + m_header->dict_offset + pos;
+
+    memcpy(entry + 8, data, len);
+    as_atomic(entry)->store(dict_commit_word(pos, len), std::memory_order_release);
+
+    return true;
+}
+
+bool
+ShmRingWriter::add_record(const unsigned char* data, std::size_t len)
+{
+    if (!m_header)
+        return false;
+
+    if (len > max_record_size()) {
+        m_header->num_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint64_t n = m_header->ring_head.fetch_add(1, std::memory_order_relaxed);
+
+    unsigned char* ptr  = m_base + m_header->ring_offset + (n % m_header->num_slots) * m_header->slot_size;
+    Slot*          slot = reinterpret_cast<Slot*>(ptr);
+
+    slot->seq.store(2*n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->len = static_cast<uint32_t>(len);
+    memcpy(ptr + sizeof(Slot), data, len);
+
+    slot->seq.store(2*n + 2, std::memory_order_release);
+
+    return true;
+}
+
+std::size_t
+ShmRingWriter::max_record_size() const
+{
+    return m_header ? m_header->slot_size - sizeof(Slot) : 0;
+}
+
+uint64_t
+ShmRingWriter::num_records() const
+{
+    return m_header ? m_header->ring_head.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t
+ShmRingWriter::num_dropped() const
+{
+    return m_header ? m_header->num_dropped.load(std::memory_order_relaxed) : 0;
+}
+
+//
+// --- ShmRingReader
+//
+
+ShmRingReader::ShmRingReader(const void* mem, std::size_t size)
+    : m_header(nullptr),
+      m_base(static_cast<const unsigned char*>(mem)),
+      m_dict_pos(0),
+      m_next(0),
+      m_lost(0),
+      m_buf(nullptr)
+{
+    const ShmRingHeader* h = static_cast<const ShmRingHeader*>(mem);
+
+    if (size < sizeof(ShmRingHeader) || memcmp(h->id, ShmRingHeader::magic, sizeof(h->id)) != 0)
+        return;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (h->version_number != ShmRingHeader::version)
+        return;
+    if (h->slot_size < sizeof(ShmRingWriter::Slot) || h->dict_offset + h->dict_capacity > h->ring_offset)
+        return;
+    if (h->ring_offset + h->num_slots * h->slot_size > size || h->num_slots == 0)
+        return;
+
+    uint64_t head = h->ring_head.load(std::memory_order_acquire);
+
+    // start with the oldest record still in the ring
+    m_next   = head > h->num_slots ? head - h->num_slots : 0;
+    m_buf    = new unsigned char[h->slot_size];
+    m_header = h;
+}
+
+ShmRingReader::~ShmRingReader()
+{
+    delete[] m_buf;
+}
+
+std::size_t
+ShmRingReader::poll(DataFn node_fn, DataFn record_fn)
+{
+    if (!m_header)
+        return 0;
+
+    //   read new dictionary entries: stop at the first one that isn't
+    // committed yet
+
+    const unsigned char* dict = m_base + m_header->dict_offset;
+
+    while (m_dict_pos + 8 <= m_header->dict_capacity) {
+        uint64_t word = as_atomic(dict + m_dict_pos)->load(std::memory_order_acquire);
+        uint64_t len  = word & 0xFFFFFFFF;
+
+        if (word != dict_commit_word(m_dict_pos, len) || m_dict_pos + 8 + len > m_header->dict_capacity)
+            break;
+
+        node_fn(dict + m_dict_pos + 8, len);
+        m_dict_pos += 8 + align8(len);
+    }
+
+    //   read records
+
+    const uint64_t num_slots = m_header->num_slots;
+    const uint64_t max_len   = m_header->slot_size - sizeof(ShmRingWriter::Slot);
+
+    uint64_t head = m_header->ring_head.load(std::memory_order_acquire);
+
+    if (head - m_next > num_slots) {
+        m_lost += head - num_slots - m_next;
+        m_next  = head - num_slots;
+    }
+
+    std::size_t count = 0;
+
+    for ( ; m_next < head; ++m_next) {
+        const unsigned char* ptr =
+            m_base + m_header->ring_offset + (m_next % num_slots) * m_header->slot_size;
+        const ShmRingWriter::Slot* slot =
+            reinterpret_cast<const ShmRingWriter::Slot*>(ptr);
+
+        uint64_t expected = 2*m_next + 2;
+        uint64_t seq      = slot->seq.load(std::memory_order_acquire);
+
+        if (seq < expected) // not published yet: retry in the next poll
+            break;
+        if (seq > expected) { // overwritten
+            ++m_lost;
+            continue;
+        }
+
+        std::size_t len = std::min<uint64_t>(slot->len, max_len);
+        memcpy(m_buf, ptr + sizeof(ShmRingWriter::Slot), len);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (slot->seq.load(std::memory_order_relaxed) != seq) { // overwritten while copying
+            ++m_lost;
+            continue;
+        }
+
+        record_fn(m_buf, len);
+        ++count;
+    }
+
+    return count;
+}
+
+uint64_t
+ShmRingReader::pid() const
+{
+    return m_header ? m_header->pid : 0;
+}
@@ -73,3 +73,9 @@ SnapshotBuffer::for_each(const std::function<void(const CompressedSnapshotRecord
     for (size_t i = 0; i < m_count && pos < m_pos; ++i)
         fn(CompressedSnapshotRecordView(m_buffer + pos, &pos));
 }
+
+size_t
+SnapshotBuffer::decode(CompressedSnapshotBatch& batch) const
+{
+    return batch.decode(m_buffer, m_pos, m_count);
+}
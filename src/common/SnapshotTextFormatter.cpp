@@ -8,13 +8,127 @@
 
 #include "caliper/common/util/split.hpp"
 
+#include "util/number_util.h"
+
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <iterator>
 #include <mutex>
 #include <vector>
 
 using namespace cali;
 
+namespace
+{
+
+/// \brief Output buffer for one formatted record. Uses a fixed-size
+///   buffer on the stack, and moves to the heap only for very long lines.
+class LineBuffer
+{
+    char                    m_stack[2048];
+    std::unique_ptr<char[]> m_heap;
+    char*                   m_buf;
+    size_t                  m_cap;
+    size_t                  m_len;
+
+    void reserve(size_t n) {
+        if (m_len + n <= m_cap)
+            return;
+
+        size_t cap = std::max(2 * m_cap, m_len + n);
+        char*  buf = new char[cap];
+
+        memcpy(buf, m_buf, m_len);
+
+        m_heap.reset(buf);
+        m_buf = buf;
+        m_cap = cap;
+    }
+
+public:
+
+    LineBuffer()
+        : m_buf(m_stack), m_cap(sizeof(m_stack)), m_len(0)
+        { }
+
+    const char* data() const { return m_buf; }
+    size_t      size() const { return m_len; }
+
+    void append(const char* str, size_t n) {
+        reserve(n);
+        memcpy(m_buf + m_len, str, n);
+        m_len += n;
+    }
+
+    void append(const std::string& str) {
+        append(str.data(), str.size());
+    }
+
+    void append_spaces(size_t n) {
+        reserve(n);
+        memset(m_buf + m_len, ' ', n);
+        m_len += n;
+    }
+
+    /// \brief Insert \a n spaces at position \a pos
+    void insert_spaces(size_t pos, size_t n) {
+        reserve(n);
+        memmove(m_buf + pos + n, m_buf + pos, m_len - pos);
+        memset(m_buf + pos, ' ', n);
+        m_len += n;
+    }
+};
+
+/// \brief Append \a v to \a buf. Produces the same text as Variant::to_string().
+void
+append_value(LineBuffer& buf, const Variant& v)
+{
+    char tmp[64];
+    int  n = -1;
+
+    switch (v.type()) {
+    case CALI_TYPE_STRING:
+    {
+        const char* str = static_cast<const char*>(v.data());
+        size_t      len = v.size();
+
+        if (len && str[len-1] == 0)
+            --len;
+
+        buf.append(str, len);
+    }
+        return;
+    case CALI_TYPE_INT:
+        n = static_cast<int>(util::format_int(v.to_int(), tmp));
+        break;
+    case CALI_TYPE_UINT:
+        n = static_cast<int>(util::format_uint(v.to_uint(), tmp));
+        break;
+    case CALI_TYPE_ADDR:
+        n = static_cast<int>(util::format_hex(v.to_uint(), tmp));
+        break;
+    case CALI_TYPE_DOUBLE:
+        n = util::format_double(v.to_double(), tmp, sizeof(tmp));
+        break;
+    case CALI_TYPE_BOOL:
+        if (v.to_bool())
+            buf.append("true", 4);
+        else
+            buf.append("false", 5);
+        return;
+    default:
+        break;
+    }
+
+    if (n >= 0 && n < static_cast<int>(sizeof(tmp)))
+        buf.append(tmp, n);
+    else
+        buf.append(v.to_string());
+}
+
+} // namespace
+
 
 struct cali::SnapshotTextFormatter::SnapshotTextFormatterImpl
 {
@@ -22,18 +136,27 @@ struct cali::SnapshotTextFormatter::SnapshotTextFormatterImpl
         std::string prefix;
 
         std::string attr_name;
-        Attribute   attr;
+        cali_id_t   attr_id;
 
         int         width;
         char        align; // 'l', 'r', 'c' 
     };
 
-    std::vector<Field> m_fields;    
-    std::mutex         m_field_mutex;
+    /// \brief The compiled format: the fields, with attribute IDs
+    ///   once they have been resolved.
+    struct Program {
+        std::vector<Field> fields;
+        bool               resolved;
+    };
+
+    std::shared_ptr<const Program> m_program;
+    std::mutex                     m_program_mutex;
 
     void 
     parse(const std::string& formatstring) {
-        m_fields.clear();
+        std::shared_ptr<Program> program = std::make_shared<Program>();
+
+        program->resolved = false;
 
         // parse format: "(prefix string) %[<width+alignment(l|r|c)>]attr_name% ... "
         // FIXME: this is a very primitive parser
@@ -43,7 +166,7 @@ struct cali::SnapshotTextFormatter::SnapshotTextFormatterImpl
         util::split(formatstring, '%', std::back_inserter(split_string));
 
         while (!split_string.empty()) {
-            Field field = { "", "", Attribute::invalid, 0, 'l' };
+            Field field = { "", "", CALI_INV_ID, 0, 'l' };
 
             field.prefix = split_string.front();
             split_string.erase(split_string.begin());
@@ -85,79 +208,122 @@ struct cali::SnapshotTextFormatter::SnapshotTextFormatterImpl
                 split_string.erase(split_string.begin());
             }
 
-            m_fields.push_back(field);
+            program->fields.push_back(field);
         }
-    }
 
-    std::ostream& 
-    print(std::ostream& os, const CaliperMetadataAccessInterface& db, const std::vector<Entry>& list) {
-        std::vector<Field> fields;
+        std::lock_guard<std::mutex>
+            g(m_program_mutex);
 
-        {
-            std::lock_guard<std::mutex>
-                g(m_field_mutex);
+        m_program = program;
+    }
 
-            fields.assign(m_fields.begin(), m_fields.end());
-        }
+    /// \brief Get the compiled program, and resolve attribute names on first use
+    std::shared_ptr<const Program>
+    get_program(const CaliperMetadataAccessInterface& db) {
+        std::lock_guard<std::mutex>
+            g(m_program_mutex);
 
-        bool update = false;
+        if (m_program && !m_program->resolved) {
+            std::shared_ptr<Program> program = std::make_shared<Program>(*m_program);
 
-        for (Field& f : fields) {
-            if (!f.attr_name.empty()) {
-                f.attr = db.get_attribute(f.attr_name);
-                f.attr_name.clear();
+            for (Field& f : program->fields) {
+                if (f.attr_name.empty())
+                    continue;
 
-                cali_attr_type type = f.attr.type();
+                Attribute attr = db.get_attribute(f.attr_name);
+                cali_attr_type type = attr.type();
 
-                f.align = (type == CALI_TYPE_DOUBLE ||
-                           type == CALI_TYPE_INT    ||
-                           type == CALI_TYPE_UINT   ||
-                           type == CALI_TYPE_ADDR) ? 'r' : 'l';
-                
-                update = true;
+                f.attr_id = attr.id();
+                f.align   = (type == CALI_TYPE_DOUBLE ||
+                             type == CALI_TYPE_INT    ||
+                             type == CALI_TYPE_UINT   ||
+                             type == CALI_TYPE_ADDR) ? 'r' : 'l';
             }
 
-            std::string str;
+            program->resolved = true;
+            m_program = program;
+        }
 
-            if (f.attr != Attribute::invalid) {
-                Entry e;
+        return m_program;
+    }
 
-                for (auto it = list.begin(); it != list.end(); ++it)
-                    if ((*it).count(f.attr)) {
-                        e = *it;
-                        break;
+    /// \brief Append the value(s) of attribute \a id in \a list to \a buf.
+    ///   Nested values are written root-first, separated by "/".
+    static void
+    append_entry(LineBuffer& buf, cali_id_t id, const std::vector<Entry>& list) {
+        for (const Entry& e : list) {
+            if (e.node()) {
+                const Node* stack[64];
+                size_t      n = 0;
+
+                for (const Node* node = e.node(); node; node = node->parent())
+                    if (node->attribute() == id) {
+                        if (n == 64) {
+                            // very deep nesting: fall back to a heap vector
+                            std::vector<const Node*> vec;
+
+                            for (const Node* node = e.node(); node; node = node->parent())
+                                if (node->attribute() == id)
+                                    vec.push_back(node);
+                            for (auto it = vec.rbegin(); it != vec.rend(); ++it) {
+                                if (it != vec.rbegin())
+                                    buf.append("/", 1);
+                                append_value(buf, (*it)->data());
+                            }
+
+                            return;
+                        }
+
+                        stack[n++] = node;
                     }
 
-                if (e.node()) {
-                    for (const Node* node = e.node(); node; node = node->parent())
-                        if (node->attribute() == f.attr.id())
-                            str = node->data().to_string().append(str.size() ? "/" : "").append(str);
-                } else if (e.is_immediate()) {
-                    str.append(e.value().to_string());
+                if (n == 0)
+                    continue;
+
+                for (size_t i = n; i > 0; --i) {
+                    append_value(buf, stack[i-1]->data());
+
+                    if (i > 1)
+                        buf.append("/", 1);
                 }
+
+                return;
+            } else if (e.is_immediate() && e.attribute() == id) {
+                append_value(buf, e.value());
+                return;
             }
+        }
+    }
 
-            static const char whitespace[80+1] = 
-                "                                        "
-                "                                        ";
+    std::ostream& 
+    print(std::ostream& os, const CaliperMetadataAccessInterface& db, const std::vector<Entry>& list) {
+        std::shared_ptr<const Program> program = get_program(db);
 
-            int len = str.size();
-            int w   = len < f.width ? std::min<int>(f.width - len, 80) : 0;
+        if (!program)
+            return os;
 
-            if (f.align == 'r')
-                os << f.prefix << (w > 0 ? whitespace+(80-w) : "") << str;
-            else
-                os << f.prefix << str << (w > 0 ? whitespace+(80-w) : "");
-        }
+        LineBuffer buf;
+
+        for (const Field& f : program->fields) {
+            buf.append(f.prefix);
+
+            size_t start = buf.size();
 
-        if (update) {
-            std::lock_guard<std::mutex>
-                g(m_field_mutex);
+            if (f.attr_id != CALI_INV_ID)
+                append_entry(buf, f.attr_id, list);
 
-            m_fields.swap(fields);
+            int len = static_cast<int>(buf.size() - start);
+            int w   = len < f.width ? std::min<int>(f.width - len, 80) : 0;
+
+            if (w > 0) {
+                if (f.align == 'r')
+                    buf.insert_spaces(start, w);
+                else
+                    buf.append_spaces(w);
+            }
         }
 
-        return os;
+        return os.write(buf.data(), buf.size());
     }
 };
 
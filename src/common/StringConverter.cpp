@@ -35,10 +35,12 @@
 
 #include "caliper/common/StringConverter.h"
 
+#include "util/number_util.h"
 #include "util/parse_util.h"
 
 #include <algorithm>
 #include <cctype>
+#include <climits>
 #include <sstream>
 
 cali_id_t
@@ -98,6 +100,15 @@ cali::StringConverter::to_int(bool* okptr) const
     bool ok  = false;
     int  res = 0;
 
+    int64_t i = 0;
+
+    if (util::parse_int(m_str.data(), m_str.size(), i) && i >= INT_MIN && i <= INT_MAX) {
+        if (okptr)
+            *okptr = true;
+
+        return static_cast<int>(i);
+    }
+
     try {
         res = std::stoi(m_str);
         ok  = true;
@@ -117,6 +128,13 @@ cali::StringConverter::to_uint(bool* okptr, int base) const
     bool ok = false;
     uint64_t res = 0;
 
+    if (util::parse_uint(m_str.data(), m_str.size(), res, base)) {
+        if (okptr)
+            *okptr = true;
+
+        return res;
+    }
+
     try {
         res = std::stoull(m_str, nullptr, base);
         ok  = true;
@@ -136,6 +154,13 @@ cali::StringConverter::to_double(bool* okptr) const
     bool   ok  = false;
     double res = 0;
 
+    if (util::parse_double(m_str.data(), m_str.size(), res)) {
+        if (okptr)
+            *okptr = true;
+
+        return res;
+    }
+
     try {
         res = std::stod(m_str);
         ok  = true;
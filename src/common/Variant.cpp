@@ -37,8 +37,11 @@
 
 #include "caliper/common/StringConverter.h"
 
+#include "util/number_util.h"
+
 #include <algorithm>
 #include <cctype>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
 #include <iomanip>
@@ -81,10 +84,16 @@ Variant::to_string() const
     }
         break;
     case CALI_TYPE_INT:
-        ret = std::to_string(to_int());
+    {
+        char buf[24];
+        ret.assign(buf, util::format_int(to_int(), buf));
+    }
         break;
     case CALI_TYPE_UINT:
-        ret = std::to_string(to_uint());
+    {
+        char buf[24];
+        ret.assign(buf, util::format_uint(to_uint(), buf));
+    }
         break;
     case CALI_TYPE_STRING:
     {
@@ -99,13 +108,20 @@ Variant::to_string() const
         break;
     case CALI_TYPE_ADDR:
     {
-        std::ostringstream os;
-        os << std::hex << to_uint();
-        ret = os.str();
+        char buf[24];
+        ret.assign(buf, util::format_hex(to_uint(), buf));
     }
         break;
     case CALI_TYPE_DOUBLE:
-        ret = std::to_string(to_double());
+    {
+        char buf[32];
+        int  n = util::format_double(to_double(), buf, sizeof(buf));
+
+        if (n >= 0 && n < static_cast<int>(sizeof(buf)))
+            ret.assign(buf, n);
+        else
+            ret = std::to_string(to_double());
+    }
         break;
     case CALI_TYPE_BOOL:
         ret = to_bool() ? "true" : "false";
@@ -120,11 +136,61 @@ Variant::to_string() const
     return ret;
 }
 
+bool
+Variant::from_number_string(cali_attr_type type, const char* str, size_t len, Variant& val)
+{
+    switch (type) {
+    case CALI_TYPE_INT:
+    {
+        int64_t i = 0;
+
+        if (util::parse_int(str, len, i) && i >= INT_MIN && i <= INT_MAX) {
+            val = Variant(static_cast<int>(i));
+            return true;
+        }
+    }
+        break;
+    case CALI_TYPE_UINT:
+    case CALI_TYPE_ADDR:
+    {
+        uint64_t u = 0;
+
+        if (util::parse_uint(str, len, u, type == CALI_TYPE_ADDR ? 16 : 10)) {
+            val = Variant(type, &u, sizeof(uint64_t));
+            return true;
+        }
+    }
+        break;
+    case CALI_TYPE_DOUBLE:
+    {
+        double d = 0.0;
+
+        if (util::parse_double(str, len, d)) {
+            val = Variant(d);
+            return true;
+        }
+    }
+        break;
+    default:
+        break;
+    }
+
+    return false;
+}
+
 Variant
 Variant::from_string(cali_attr_type type, const char* str, bool* okptr)
 {
     Variant ret;
     bool    ok = false;
+
+    // try the fast conversions for plain numbers first
+    if (from_number_string(type, str, strlen(str), ret)) {
+        if (okptr)
+            *okptr = true;
+
+        return ret;
+    }
     
     switch (type) {
     case CALI_TYPE_INV:
@@ -0,0 +1,382 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file BinaryReader.cpp
+/// BinaryReader implementation
+
+#include "caliper/common/binary/BinaryReader.h"
+
+#include "caliper/common/binary/BinarySpec.h"
+
+#include "caliper/common/CompressedSnapshotRecord.h"
+#include "caliper/common/Log.h"
+
+#include "caliper/common/c-util/vlenc.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+// Padding after the payload so that decoding a corrupt block
+// doesn't run past the buffer
+constexpr size_t payload_padding = 16;
+
+bool read_u64(std::istream& is, uint64_t& val)
+{
+    unsigned char buf[10];
+    size_t n = 0;
+
+    do {
+        int c = is.get();
+
+        if (c == std::char_traits<char>::eof())
+            return false;
+
+        buf[n] = static_cast<unsigned char>(c);
+    } while ((buf[n++] & 0x80) && n < sizeof(buf));
+
+    val = vldec_u64(buf, nullptr);
+
+    return true;
+}
+
+/// \brief Read-only stream buffer over a memory region
+class MemoryStreamBuf : public std::streambuf
+{
+public:
+
+    MemoryStreamBuf(const char* data, size_t len) {
+        char* p = const_cast<char*>(data);
+        setg(p, p, p + len);
+    }
+
+protected:
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode) override {
+        char* p = (dir == std::ios_base::beg ? eback() : (dir == std::ios_base::end ? egptr() : gptr())) + off;
+
+        if (p < eback() || p > egptr())
+            return pos_type(off_type(-1));
+
+        setg(eback(), p, egptr());
+
+        return pos_type(p - eback());
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode mode) override {
+        return seekoff(off_type(pos), std::ios_base::beg, mode);
+    }
+};
+
+}
+
+struct BinaryReader::BinaryReaderImpl
+{
+    std::string m_filename;
+
+    /// In-memory input given to the constructor, or null
+    const char* m_buf;
+    size_t      m_buflen;
+
+    std::vector<std::string> m_strings;
+
+    BinaryReaderImpl(const std::string& filename)
+        : m_filename { filename }, m_buf { nullptr }, m_buflen { 0 }
+        { }
+
+    BinaryReaderImpl(const std::string& name, const char* data, size_t len)
+        : m_filename { name }, m_buf { data }, m_buflen { len }
+        { }
+
+    /// \brief Read the stream header, assuming the first magic byte has
+    ///   already been consumed
+    bool read_header(std::istream& is) {
+        unsigned char buf[sizeof(BinarySpec::magic)];
+
+        buf[0] = BinarySpec::magic[0];
+        is.read(reinterpret_cast<char*>(buf+1), sizeof(buf)-1);
+
+        if (!is || !BinarySpec::is_magic(buf, sizeof(buf))) {
+            Log(0).stream() << "BinaryReader: " << m_filename << ": Invalid header" << std::endl;
+            return false;
+        }
+
+        uint64_t version = 0;
+
+        if (!::read_u64(is, version) || version > BinarySpec::version) {
+            Log(0).stream() << "BinaryReader: " << m_filename
+                            << ": Unsupported format version " << version << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    void read_strings(const unsigned char* buf, size_t count, size_t len) {
+        size_t pos = 0;
+
+        for (size_t i = 0; i < count && pos < len; ++i) {
+            size_t slen = vldec_u64(buf+pos, &pos);
+
+            slen = std::min(slen, len - std::min(pos, len));
+            m_strings.emplace_back(reinterpret_cast<const char*>(buf+pos), slen);
+            pos += slen;
+        }
+    }
+
+    void read_snapshots(const unsigned char* buf, size_t count, size_t len, SnapshotFn fn) {
+        cali_id_t nodes[128];
+        cali_id_t attr[128];
+        Variant   vals[128];
+
+        size_t pos = 0;
+
+        for (size_t i = 0; i < count && pos < len; ++i) {
+            CompressedSnapshotRecordView view(buf+pos, &pos);
+
+            size_t nn = std::min<size_t>(view.num_nodes(),      128);
+            size_t ni = std::min<size_t>(view.num_immediates(), 128);
+
+            view.unpack_nodes(nn, nodes);
+            view.unpack_immediate(ni, attr, vals);
+
+            // resolve string table references
+            for (size_t j = 0; j < ni; ++j) {
+                cali_attr_type type = vals[j].type();
+
+                if (type != CALI_TYPE_STRING && type != CALI_TYPE_USR)
+                    continue;
+
+                uint64_t index = vals[j].c_variant().value.v_uint;
+
+                if (index < m_strings.size())
+                    vals[j] = Variant(type, m_strings[index].data(), m_strings[index].size());
+                else
+                    vals[j] = Variant();
+            }
+
+            fn(nn, nodes, ni, attr, vals);
+        }
+    }
+
+    bool read(std::istream& is, NodeFn node_fn, SnapshotFn snapshot_fn, SnapshotFn globals_fn, RankFn rank_fn) {
+        std::vector<unsigned char> payload;
+
+        if (is.get() != BinarySpec::magic[0] || !read_header(is))
+            return false;
+
+        for (int type = is.get(); type != std::char_traits<char>::eof(); type = is.get()) {
+            // concatenated streams: skip the header of the next stream
+            if (type == BinarySpec::magic[0]) {
+                if (!read_header(is))
+                    return false;
+
+                continue;
+            }
+
+            uint64_t count = 0;
+            uint64_t len   = 0;
+
+            if (!::read_u64(is, count) || !::read_u64(is, len)) {
+                Log(0).stream() << "BinaryReader: " << m_filename << ": Truncated block header" << std::endl;
+                return false;
+            }
+
+            if (type == BinarySpec::NodeBlock) {
+                NodeBuffer nodebuf;
+
+                is.read(reinterpret_cast<char*>(nodebuf.import(len + payload_padding, count)), len);
+                nodebuf.import(len, count);
+
+                if (static_cast<uint64_t>(is.gcount()) != len) {
+                    Log(0).stream() << "BinaryReader: " << m_filename << ": Truncated block" << std::endl;
+                    return false;
+                }
+
+                nodebuf.for_each(node_fn);
+
+                continue;
+            }
+
+            payload.assign(len + payload_padding, 0);
+            is.read(reinterpret_cast<char*>(payload.data()), len);
+
+            if (static_cast<uint64_t>(is.gcount()) != len) {
+                Log(0).stream() << "BinaryReader: " << m_filename << ": Truncated block" << std::endl;
+                return false;
+            }
+
+            switch (type) {
+            case BinarySpec::StringBlock:
+                read_strings(payload.data(), count, len);
+                break;
+            case BinarySpec::SnapshotBlock:
+                read_snapshots(payload.data(), count, len, snapshot_fn);
+                break;
+            case BinarySpec::GlobalsBlock:
+                read_snapshots(payload.data(), count, len, globals_fn);
+                break;
+            case BinarySpec::RankBlock:
+                // new rank section: string table references start over
+                m_strings.clear();
+
+                if (rank_fn)
+                    rank_fn(vldec_u64(payload.data(), nullptr));
+                break;
+            default:
+                // skip unknown block types
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    bool read(NodeFn node_fn, SnapshotFn snapshot_fn, SnapshotFn globals_fn, RankFn rank_fn) {
+        if (m_buf) {
+            MemoryStreamBuf buf(m_buf, m_buflen);
+            std::istream    is(&buf);
+
+            return read(is, node_fn, snapshot_fn, globals_fn, rank_fn);
+        }
+
+        if (m_filename.empty())
+            return read(std::cin, node_fn, snapshot_fn, globals_fn, rank_fn);
+
+        std::ifstream is(m_filename.c_str(), std::ios::binary);
+
+        if (!is)
+            return false;
+
+        return read(is, node_fn, snapshot_fn, globals_fn, rank_fn);
+    }
+};
+
+BinaryReader::BinaryReader(const std::string& filename)
+    : mP { new BinaryReaderImpl(filename) }
+{ }
+
+BinaryReader::BinaryReader(const std::string& name, const char* data, size_t len)
+    : mP { new BinaryReaderImpl(name, data, len) }
+{ }
+
+BinaryReader::~BinaryReader()
+{ }
+
+bool
+BinaryReader::read(NodeFn node_fn, SnapshotFn snapshot_fn, SnapshotFn globals_fn, RankFn rank_fn)
+{
+    return mP->read(node_fn, snapshot_fn, globals_fn, rank_fn);
+}
+
+bool
+BinaryReader::is_binary(const std::string& filename)
+{
+    if (filename.empty())
+        return std::cin.peek() == BinarySpec::magic[0];
+
+    std::ifstream is(filename.c_str(), std::ios::binary);
+    unsigned char buf[sizeof(BinarySpec::magic)];
+
+    is.read(reinterpret_cast<char*>(buf), sizeof(buf));
+
+    return is && BinarySpec::is_magic(buf, sizeof(buf));
+}
+
+bool
+BinaryReader::is_binary(const char* data, size_t len)
+{
+    return BinarySpec::is_magic(reinterpret_cast<const unsigned char*>(data), len);
+}
+
+bool
+BinaryReader::rank_index(const std::string& filename, std::vector<RankSection>& index)
+{
+    std::ifstream is(filename.c_str(), std::ios::binary);
+    unsigned char buf[sizeof(BinarySpec::magic)];
+
+    is.read(reinterpret_cast<char*>(buf), sizeof(buf));
+
+    uint64_t version = 0;
+
+    if (!is || !BinarySpec::is_magic(buf, sizeof(buf)) || !::read_u64(is, version))
+        return false;
+
+    // skip over the blocks until we find the index
+
+    for (int type = is.get(); type != std::char_traits<char>::eof(); type = is.get()) {
+        uint64_t count = 0;
+        uint64_t len   = 0;
+
+        if (!::read_u64(is, count) || !::read_u64(is, len))
+            return false;
+
+        if (type != BinarySpec::IndexBlock) {
+            is.seekg(len, std::ios::cur);
+
+            if (!is)
+                return false;
+
+            continue;
+        }
+
+        std::vector<unsigned char> payload(len + payload_padding, 0);
+        is.read(reinterpret_cast<char*>(payload.data()), len);
+
+        if (static_cast<uint64_t>(is.gcount()) != len)
+            return false;
+
+        size_t pos = 0;
+
+        index.clear();
+
+        for (uint64_t i = 0; i < count && pos < len; ++i) {
+            RankSection s;
+
+            s.rank   = vldec_u64(payload.data()+pos, &pos);
+            s.offset = vldec_u64(payload.data()+pos, &pos);
+            s.size   = vldec_u64(payload.data()+pos, &pos);
+
+            index.push_back(s);
+        }
+
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,76 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file BinarySpec.cpp
+/// BinarySpec implementation
+
+#include "caliper/common/binary/BinarySpec.h"
+
+#include "caliper/common/c-util/vlenc.h"
+
+#include <cstring>
+
+using namespace cali;
+
+const unsigned char BinarySpec::magic[8] = { 0x89, 'C', 'A', 'L', 'I', '\r', '\n', 0x1a };
+
+bool
+BinarySpec::is_magic(const unsigned char* buf, std::size_t len)
+{
+    return len >= sizeof(magic) && memcmp(buf, magic, sizeof(magic)) == 0;
+}
+
+std::size_t
+BinarySpec::header_size(const unsigned char* buf, std::size_t len)
+{
+    if (!is_magic(buf, len))
+        return 0;
+
+    // version number: variable-length encoded, up to 10 bytes
+    for (std::size_t pos = sizeof(magic); pos < len && pos < sizeof(magic) + 10; ++pos)
+        if (!(buf[pos] & 0x80))
+            return pos + 1;
+
+    return 0;
+}
+
+std::size_t
+BinarySpec::write_block_header(unsigned char* buf, BlockType type, uint64_t count, uint64_t len)
+{
+    std::size_t pos = 0;
+
+    buf[pos++] = type;
+    pos += vlenc_u64(count, buf+pos);
+    pos += vlenc_u64(len,   buf+pos);
+
+    return pos;
+}
@@ -0,0 +1,371 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file BinaryWriter.cpp
+/// BinaryWriter implementation
+
+#include "caliper/common/binary/BinaryWriter.h"
+
+#include "caliper/common/binary/BinarySpec.h"
+
+#include "caliper/common/CaliperMetadataAccessInterface.h"
+#include "caliper/common/CompressedSnapshotRecord.h"
+#include "caliper/common/Log.h"
+#include "caliper/common/Node.h"
+#include "caliper/common/NodeBuffer.h"
+#include "caliper/common/OutputStream.h"
+
+#include "caliper/common/c-util/vlenc.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace cali;
+
+namespace
+{
+
+// Write out snapshot blocks when the buffered snapshot data exceeds this size
+constexpr size_t snapshot_block_size = 64 * 1024;
+
+//   Output node ids are taken from a process-wide counter, so that streams
+// written one after another to the same target never re-use an id for a
+// different node.
+std::atomic<cali_id_t> s_next_id { 11 };
+
+void write_block(std::ostream& os, BinarySpec::BlockType type, size_t count, const unsigned char* data, size_t len)
+{
+    unsigned char header[BinarySpec::max_block_header_size];
+    size_t pos = BinarySpec::write_block_header(header, type, count, len);
+
+    os.write(reinterpret_cast<const char*>(header), pos);
+    os.write(reinterpret_cast<const char*>(data),   len);
+}
+
+}
+
+struct BinaryWriter::BinaryWriterImpl
+{
+    OutputStream  m_os;
+    std::mutex    m_lock;
+
+    bool          m_header_written;
+
+    //   Nodes are written on demand and renumbered sequentially in the order
+    // they are written, i.e. parents and attributes before their users.
+    // Maps runtime node ids to output ids.
+    std::unordered_map<cali_id_t, cali_id_t> m_written_nodes;
+
+    std::map<std::string, uint64_t> m_string_index;
+
+    NodeBuffer    m_nodes;
+
+    std::vector<unsigned char> m_strings;
+    size_t        m_num_strings;
+
+    std::vector<unsigned char> m_snapshots;
+    size_t        m_num_snapshots;
+
+    std::size_t   m_num_written;
+    std::size_t   m_num_skipped;
+
+    BinaryWriterImpl(OutputStream& os)
+        : m_os(os),
+          m_header_written(false),
+          m_num_strings(0),
+          m_num_snapshots(0),
+          m_num_written(0),
+          m_num_skipped(0)
+    { }
+
+    ~BinaryWriterImpl() {
+        std::lock_guard<std::mutex>
+            g(m_lock);
+
+        if (m_nodes.count() > 0 || m_num_strings > 0 || m_num_snapshots > 0)
+            write_pending();
+
+        if (m_num_skipped > 0)
+            Log(1).stream() << "BinaryWriter: dropped " << m_num_skipped
+                            << " snapshot entries exceeding the per-record limit"
+                            << std::endl;
+    }
+
+    // NOTE: All of the functions below assume that m_lock is locked!
+
+    void write_header() {
+        unsigned char buf[sizeof(BinarySpec::magic) + 10];
+        size_t pos = sizeof(BinarySpec::magic);
+
+        memcpy(buf, BinarySpec::magic, pos);
+        pos += vlenc_u64(BinarySpec::version, buf+pos);
+
+        m_os.stream().write(reinterpret_cast<const char*>(buf), pos);
+        m_header_written = true;
+    }
+
+    /// \brief Write out buffered nodes, strings, and snapshots (in that order,
+    ///   so that snapshots only refer to data written before them)
+    void write_pending() {
+        std::ostream& os = m_os.stream();
+
+        if (!m_header_written)
+            write_header();
+
+        if (m_nodes.count() > 0) {
+            ::write_block(os, BinarySpec::NodeBlock, m_nodes.count(), m_nodes.data(), m_nodes.size());
+            m_nodes.clear();
+        }
+        if (m_num_strings > 0) {
+            ::write_block(os, BinarySpec::StringBlock, m_num_strings, m_strings.data(), m_strings.size());
+            m_strings.clear();
+            m_num_strings = 0;
+        }
+        if (m_num_snapshots > 0) {
+            ::write_block(os, BinarySpec::SnapshotBlock, m_num_snapshots, m_snapshots.data(), m_snapshots.size());
+            m_snapshots.clear();
+            m_num_snapshots = 0;
+        }
+
+        os.flush();
+    }
+
+    /// \brief Write node \a id and everything it refers to, return its output id
+    cali_id_t recursive_write_node(const CaliperMetadataAccessInterface& db, cali_id_t id) {
+        if (id < 11) // don't write the hard-coded metadata nodes
+            return id;
+
+        auto it = m_written_nodes.find(id);
+
+        if (it != m_written_nodes.end())
+            return it->second;
+
+        Node* node = db.node(id);
+
+        if (!node)
+            return CALI_INV_ID;
+
+        NodeBuffer::NodeInfo info;
+
+        info.attr_id   = recursive_write_node(db, node->attribute());
+        info.parent_id = CALI_INV_ID;
+        info.value     = node->data();
+
+        Node* parent = node->parent();
+
+        if (parent && parent->id() != CALI_INV_ID)
+            info.parent_id = recursive_write_node(db, parent->id());
+
+        info.node_id = s_next_id.fetch_add(1);
+
+        m_nodes.append(info);
+        m_written_nodes.emplace(id, info.node_id);
+
+        ++m_num_written;
+
+        return info.node_id;
+    }
+
+    /// \brief Replace pointer-type (string and blob) values with an index
+    ///   into the string table
+    Variant make_portable(const Variant& v) {
+        cali_attr_type type = v.type();
+
+        if (type != CALI_TYPE_STRING && type != CALI_TYPE_USR)
+            return v;
+
+        std::string str(static_cast<const char*>(v.data()), v.size());
+        auto it = m_string_index.find(str);
+
+        if (it == m_string_index.end()) {
+            unsigned char buf[10];
+            size_t len = vlenc_u64(str.size(), buf);
+
+            m_strings.insert(m_strings.end(), buf, buf+len);
+            m_strings.insert(m_strings.end(), str.begin(), str.end());
+            ++m_num_strings;
+
+            it = m_string_index.insert(std::make_pair(str, m_string_index.size())).first;
+        }
+
+        cali_variant_t cv = v.c_variant();
+        cv.value.v_uint = it->second;
+
+        return Variant(cv);
+    }
+
+    void append_record(std::vector<unsigned char>& vec,
+                       const CaliperMetadataAccessInterface& db,
+                       size_t n_nodes, const cali_id_t nodes[],
+                       size_t n_imm,   const cali_id_t attr[], const Variant vals[])
+    {
+        std::vector<cali_id_t> node_vec;
+        std::vector<cali_id_t> attr_vec(n_imm);
+        std::vector<Variant>   data_vec(n_imm);
+
+        node_vec.reserve(n_nodes);
+
+        for (size_t i = 0; i < n_nodes; ++i) {
+            cali_id_t id = recursive_write_node(db, nodes[i]);
+
+            if (id != CALI_INV_ID)
+                node_vec.push_back(id);
+        }
+        for (size_t i = 0; i < n_imm; ++i) {
+            attr_vec[i] = recursive_write_node(db, attr[i]);
+            data_vec[i] = make_portable(vals[i]);
+        }
+
+        //   Size the buffer for the worst case: two count bytes, up to 10 bytes
+        // per node id, and 30 bytes per immediate entry (id and packed variant).
+        std::vector<unsigned char> buf(2 + 10*node_vec.size() + 30*n_imm);
+        CompressedSnapshotRecord rec(buf.size(), buf.data());
+
+        rec.append(node_vec.size(), node_vec.data());
+        rec.append(n_imm, attr_vec.data(), data_vec.data());
+
+        // The record format itself limits the number of entries per record
+        m_num_skipped += rec.num_skipped();
+
+        vec.insert(vec.end(), rec.data(), rec.data() + rec.size());
+    }
+
+    void write_snapshot(const CaliperMetadataAccessInterface& db,
+                        size_t n_nodes, const cali_id_t nodes[],
+                        size_t n_imm,   const cali_id_t attr[], const Variant vals[])
+    {
+        std::lock_guard<std::mutex>
+            g(m_lock);
+
+        append_record(m_snapshots, db, n_nodes, nodes, n_imm, attr, vals);
+
+        ++m_num_snapshots;
+        ++m_num_written;
+
+        if (m_snapshots.size() > snapshot_block_size)
+            write_pending();
+    }
+
+    void write_entrylist(const CaliperMetadataAccessInterface& db, const std::vector<Entry>& list, bool globals) {
+        std::vector<cali_id_t> nodes;
+        std::vector<cali_id_t> attr;
+        std::vector<Variant>   vals;
+
+        nodes.reserve(list.size());
+
+        for (const Entry& e : list)
+            if (e.node()) {
+                nodes.push_back(e.node()->id());
+            } else if (e.is_immediate()) {
+                attr.push_back(e.attribute());
+                vals.push_back(e.value());
+            }
+
+        if (!globals) {
+            write_snapshot(db, nodes.size(), nodes.data(), attr.size(), attr.data(), vals.data());
+            return;
+        }
+
+        std::lock_guard<std::mutex>
+            g(m_lock);
+
+        std::vector<unsigned char> rec;
+
+        append_record(rec, db, nodes.size(), nodes.data(), attr.size(), attr.data(), vals.data());
+        write_pending();
+        ::write_block(m_os.stream(), BinarySpec::GlobalsBlock, 1, rec.data(), rec.size());
+        m_os.stream().flush();
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex>
+            g(m_lock);
+
+        write_pending();
+    }
+};
+
+
+BinaryWriter::BinaryWriter(OutputStream& os)
+    : mP(new BinaryWriterImpl(os))
+{ }
+
+BinaryWriter::~BinaryWriter()
+{
+    mP.reset();
+}
+
+size_t BinaryWriter::num_written() const
+{
+    return mP ? mP->m_num_written : 0;
+}
+
+void BinaryWriter::write_snapshot(const CaliperMetadataAccessInterface& db,
+                                  size_t n_nodes, const cali_id_t nodes[],
+                                  size_t n_imm,   const cali_id_t attr[], const Variant vals[])
+{
+    mP->write_snapshot(db, n_nodes, nodes, n_imm, attr, vals);
+}
+
+void BinaryWriter::write_snapshot(const CaliperMetadataAccessInterface& db, const std::vector<Entry>& list)
+{
+    mP->write_entrylist(db, list, false);
+}
+
+void BinaryWriter::write_globals(const CaliperMetadataAccessInterface& db, const std::vector<Entry>& list)
+{
+    mP->write_entrylist(db, list, true);
+}
+
+void BinaryWriter::flush()
+{
+    if (mP)
+        mP->flush();
+}
+
+void BinaryWriter::operator()(const CaliperMetadataAccessInterface& db, const Node* node)
+{
+    std::lock_guard<std::mutex>
+        g(mP->m_lock);
+
+    mP->recursive_write_node(db, node->id());
+}
+
+void BinaryWriter::operator()(const CaliperMetadataAccessInterface& db, const std::vector<Entry>& list)
+{
+    mP->write_entrylist(db, list, false);
+}
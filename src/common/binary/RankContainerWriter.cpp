@@ -0,0 +1,128 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file RankContainerWriter.cpp
+/// RankContainerWriter implementation
+
+#include "caliper/common/binary/RankContainerWriter.h"
+
+#include "caliper/common/binary/BinarySpec.h"
+
+#include "caliper/common/c-util/vlenc.h"
+
+#include <cstring>
+#include <ostream>
+
+using namespace cali;
+
+RankContainerWriter::RankContainerWriter(std::ostream& os)
+    : m_os(os), m_header_written(false), m_offset(0)
+{ }
+
+void
+RankContainerWriter::write(const unsigned char* buf, std::size_t len)
+{
+    m_os.write(reinterpret_cast<const char*>(buf), len);
+    m_offset += len;
+}
+
+void
+RankContainerWriter::write_header()
+{
+    if (m_header_written)
+        return;
+
+    unsigned char header[sizeof(BinarySpec::magic) + 10];
+    std::size_t pos = sizeof(BinarySpec::magic);
+
+    memcpy(header, BinarySpec::magic, pos);
+    pos += vlenc_u64(BinarySpec::version, header+pos);
+
+    write(header, pos);
+    m_header_written = true;
+}
+
+bool
+RankContainerWriter::append(uint64_t rank, const unsigned char* buf, std::size_t len)
+{
+    std::size_t hdr = 0;
+
+    if (len > 0) {
+        hdr = BinarySpec::header_size(buf, len);
+
+        if (hdr == 0)
+            return false;
+    }
+
+    write_header();
+
+    unsigned char payload[10];
+    std::size_t   plen = vlenc_u64(rank, payload);
+
+    unsigned char block[BinarySpec::max_block_header_size];
+    std::size_t   blen = BinarySpec::write_block_header(block, BinarySpec::RankBlock, 1, plen);
+
+    Section s = { rank, m_offset, 0 };
+
+    write(block, blen);
+    write(payload, plen);
+    write(buf+hdr, len-hdr);
+
+    s.size = m_offset - s.offset;
+    m_sections.push_back(s);
+
+    return true;
+}
+
+void
+RankContainerWriter::finish()
+{
+    write_header();
+
+    std::vector<unsigned char> payload(m_sections.size() * 30);
+    std::size_t pos = 0;
+
+    for (const Section& s : m_sections) {
+        pos += vlenc_u64(s.rank,   payload.data()+pos);
+        pos += vlenc_u64(s.offset, payload.data()+pos);
+        pos += vlenc_u64(s.size,   payload.data()+pos);
+    }
+
+    unsigned char block[BinarySpec::max_block_header_size];
+    std::size_t   blen =
+        BinarySpec::write_block_header(block, BinarySpec::IndexBlock, m_sections.size(), pos);
+
+    write(block, blen);
+    write(payload.data(), pos);
+
+    m_os.flush();
+}
@@ -32,3 +32,44 @@ vlenc_u64(uint64_t val, unsigned char* buf);
 
 extern inline uint64_t
 vldec_u64(const unsigned char* buf, size_t* inc);
+
+size_t
+vlenc_u64_array(const uint64_t* vals, size_t n, unsigned char* buf)
+{
+    size_t pos = 0;
+    size_t i   = 0;
+
+    for (i = 0; i < n; ++i) {
+        /* single-byte values are the common case for ids */
+        if (vals[i] < 0x80)
+            buf[pos++] = vals[i];
+        else
+            pos += vlenc_u64(vals[i], buf+pos);
+    }
+
+    return pos;
+}
+
+size_t
+vldec_u64_array(const unsigned char* buf, size_t n, uint64_t* vals)
+{
+    size_t pos = 0;
+    size_t i   = 0;
+
+    for (i = 0; i < n; ++i) {
+        const unsigned char* p = buf + pos;
+
+        /* fast paths for one- and two-byte values */
+        if (!(p[0] & 0x80)) {
+            vals[i] = p[0];
+            pos += 1;
+        } else if (!(p[1] & 0x80)) {
+            vals[i] = (p[0] & 0x7F) | ((uint64_t) p[1] << 7);
+            pos += 2;
+        } else {
+            vals[i] = vldec_u64(p, &pos);
+        }
+    }
+
+    return pos;
+}
@@ -34,48 +34,467 @@
 /// CsvReader implementation
 
 #include "caliper/common/csv/CsvReader.h"
-#include "caliper/common/csv/CsvSpec.h"
+#include "caliper/common/csv/CsvRecordView.h"
 
+#include "caliper/caliper-config.h"
+
+#include "caliper/common/Log.h"
+
+#include "../util/gzip_util.h"
+
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace cali;
 using namespace std;
 
+namespace
+{
+
+/// \brief Check if \a line ends in an unescaped escape character, i.e.
+///   the record continues in the next line
+bool is_continued(const string& line)
+{
+    size_t n = 0;
+
+    for (auto it = line.rbegin(); it != line.rend() && *it == '\\'; ++it)
+        ++n;
+
+    return (n % 2) == 1;
+}
+
+bool is_meta_record(const CsvRecordView& view)
+{
+    CsvRecordView::Span rec_name = view.first(CsvRecordView::Rec);
+
+    return rec_name == "node" || rec_name == "globals";
+}
+
+/// \brief Quick check if the record starting at \a p is a snapshot record
+bool is_snapshot_line(const char* p, const char* end)
+{
+    const char   prefix[] = "__rec=ctx,";
+    const size_t len      = sizeof(prefix) - 1;
+
+    return static_cast<size_t>(end - p) >= len && memcmp(p, prefix, len) == 0;
+}
+
+/// \brief Return the beginning of the next record after position \a p
+///   in the buffer starting at \a data
+const char* next_record(const char* data, const char* p, const char* end)
+{
+    while (p < end) {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+
+        if (!nl)
+            return end;
+
+        // the newline is escaped if it is preceded by an odd number of escape characters
+        size_t n = 0;
+
+        for (const char* c = nl; c > data && *(c-1) == '\\'; --c)
+            ++n;
+
+        p = nl + 1;
+
+        if (n % 2 == 0)
+            break;
+    }
+
+    return p;
+}
+
+bool read_stream(istream& is, function<void(const CsvRecordView&)> rec_handler)
+{
+    CsvRecordView view;
+    string        line;
+
+    for (string next; getline(is, line); ) {
+        while (::is_continued(line) && getline(is, next))
+            line.append(1, '\n').append(next);
+
+        view.parse(line.data(), line.data() + line.size());
+        rec_handler(view);
+    }
+
+    return true;
+}
+
+}
+
 struct CsvReader::CsvReaderImpl
 {
     string m_filename;
 
+    /// In-memory input given to the constructor, or null
+    const char* m_buf;
+    size_t      m_buflen;
+
     CsvReaderImpl(const string& filename)
-        : m_filename { filename }
+        : m_filename { filename }, m_buf { nullptr }, m_buflen { 0 }
         { }
 
-    bool read(function<void(const RecordMap&)> rec_handler) {
-        if (m_filename.empty()) {
-            // empty file: read from stdin
+    CsvReaderImpl(const string& name, const char* data, size_t len)
+        : m_filename { name }, m_buf { data }, m_buflen { len }
+        { }
+
+    /// Decompressed file contents for gzip-compressed files
+    vector<char> m_inflated;
+
+    /// \brief Decompress gzip-compressed input in [\a data, \a data + \a len)
+    ///   into m_inflated, and point \a data and \a len there. Unmaps
+    ///   \a addr if it's not null.
+    void inflate_if_gzip(const char*& data, size_t& len, void* addr) {
+        if (util::is_gzip(data, len)) {
+            bool ok = false;
+
+#ifdef CALIPER_HAVE_ZLIB
+            ok = util::gzip_decompress(data, len, m_inflated, std::max(1u, std::thread::hardware_concurrency()));
+
+            if (!ok)
+                Log(0).stream() << "CsvReader: " << m_filename << ": corrupt gzip data" << std::endl;
+#else
+            Log(0).stream() << "CsvReader: " << m_filename
+                            << ": can't read compressed file (zlib support is not enabled)" << std::endl;
+#endif
+
+            if (addr)
+                munmap(addr, len);
+
+            if (!ok)
+                m_inflated.clear();
+
+            data = m_inflated.data();
+            len  = m_inflated.size();
+        }
+    }
+
+    /// \brief Map the file given by \a fd into memory. Gzip-compressed
+    ///   files are decompressed into memory instead.
+    /// \return false if the file can't be mapped (e.g., for FIFOs)
+    bool map_file(int fd, const char*& data, size_t& len) {
+        struct stat st;
+
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+            return false;
+
+        data = nullptr;
+        len  = static_cast<size_t>(st.st_size);
+
+        if (len == 0)
+            return true;
+
+        void* addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (addr == MAP_FAILED)
+            return false;
+
+        data = static_cast<const char*>(addr);
+
+        inflate_if_gzip(data, len, addr);
+
+        return true;
+    }
+
+    /// \brief Get the input in memory: the buffer given to the
+    ///   constructor, or the mapped file.
+    /// \return false if the file can't be opened or mapped
+    bool map_input(const char*& data, size_t& len) {
+        if (m_buf) {
+            data = m_buf;
+            len  = m_buflen;
+
+            if (len > 0)
+                inflate_if_gzip(data, len, nullptr);
+
+            return true;
+        }
+
+        int fd = open(m_filename.c_str(), O_RDONLY);
+
+        if (fd < 0)
+            return false;
+
+        bool ret = map_file(fd, data, len);
+
+        close(fd);
+
+        return ret;
+    }
+
+    void unmap_file(const char* data, size_t len) {
+        if (!m_inflated.empty() && data == m_inflated.data())
+            vector<char>().swap(m_inflated);
+        else if (data && data != m_buf)
+            munmap(const_cast<char*>(data), len);
+    }
+
+    /// \brief Map the input into memory and parse records in place.
+    /// \return false if the file can't be mapped (e.g., for FIFOs)
+    bool read_mapped(function<void(const CsvRecordView&)> rec_handler) {
+        const char* data = nullptr;
+        size_t      len  = 0;
+
+        if (!map_input(data, len))
+            return false;
+        if (len == 0)
+            return true;
+
+        if (!m_buf)
+            madvise(const_cast<char*>(data), len, MADV_SEQUENTIAL);
+
+        CsvRecordView view;
+
+        const char* end = data + len;
+
+        for (const char* p = data; p < end; ) {
+            p = view.parse(p, end);
+            rec_handler(view);
+        }
+
+        unmap_file(data, len);
+
+        return true;
+    }
+
+    bool read_records(function<void(const CsvRecordView&)> rec_handler) {
+        if (m_filename.empty() && !m_buf)
+            return ::read_stream(std::cin, rec_handler);
+
+        if (read_mapped(rec_handler))
+            return true;
+        if (m_buf)
+            return false;
+
+        ifstream is(m_filename.c_str());
+
+        if (!is)
+            return false;
+
+        return ::read_stream(is, rec_handler);
+    }
+
+    bool read_records_from(size_t& offset, function<void(const CsvRecordView&)> rec_handler) {
+        if (m_filename.empty() && !m_buf)
+            return false;
 
-            for (string line ; getline(std::cin, line); )
-                rec_handler(CsvSpec::read_record(line));
-        } else {
-            // read from file
+        const char* data = nullptr;
+        size_t      len  = 0;
 
-            ifstream is(m_filename.c_str());
+        bool mapped = map_input(data, len);
 
-            if (!is)
-                return false;
+        // can't continue if the file was truncated or replaced by a smaller one
+        if (!mapped || len < offset) {
+            unmap_file(data, len);
+            return false;
+        }
+
+        const char* end = data + len;
+        const char* p   = data + offset;
+
+        // Only read complete records, i.e. up to the last unescaped newline.
+        // The writer may be in the middle of writing the last one.
+        const char* last = p;
+
+        for (const char* q = p; q < end; ) {
+            q = ::next_record(data, q, end);
+
+            if (q == end) {
+                // next_record() also returns end for an unterminated or
+                // escaped last newline
+                size_t n = 0;
+
+                for (const char* c = end-1; c > data && *(c-1) == '\\'; --c)
+                    ++n;
+
+                if (*(end-1) != '\n' || n % 2 == 1)
+                    break;
+            }
+
+            last = q;
+        }
+
+        CsvRecordView view;
+
+        while (p < last) {
+            p = view.parse(p, last);
+            rec_handler(view);
+        }
+
+        offset = static_cast<size_t>(last - data);
+
+        unmap_file(data, len);
+
+        return true;
+    }
+
+    bool read_records_range(size_t begin, size_t end, function<void(const CsvRecordView&)> rec_handler) {
+        if (m_filename.empty() && !m_buf)
+            return false;
+
+        const char* data = nullptr;
+        size_t      len  = 0;
+
+        bool mapped = map_input(data, len);
+
+        if (!mapped || end > len || begin > end) {
+            unmap_file(data, len);
+            return false;
+        }
+
+        CsvRecordView view;
 
-            for (string line ; getline(is, line); )
-                rec_handler(CsvSpec::read_record(line));
+        for (const char* p = data + begin; p < data + end; ) {
+            p = view.parse(p, data + end);
+            rec_handler(view);
         }
 
+        unmap_file(data, len);
+
         return true;
     }
+
+    bool record_blocks(size_t block_size, vector<size_t>& bounds) {
+        if (m_filename.empty() && !m_buf)
+            return false;
+
+        const char* data = nullptr;
+        size_t      len  = 0;
+
+        bool mapped = map_input(data, len);
+
+        if (!mapped)
+            return false;
+
+        const char* end = data + len;
+
+        bounds.clear();
+        bounds.push_back(0);
+
+        for (size_t p = 0; p + block_size < len; ) {
+            // start searching one byte early in case the block ends
+            // exactly at a record boundary
+            const char* q = ::next_record(data, data + p + std::max<size_t>(block_size, 1) - 1, end);
+
+            if (q == end)
+                break;
+
+            p = static_cast<size_t>(q - data);
+            bounds.push_back(p);
+        }
+
+        if (len > 0)
+            bounds.push_back(len);
+
+        unmap_file(data, len);
+
+        return true;
+    }
+
+    bool read_records_parallel(unsigned num_threads,
+                               function<void(const CsvRecordView&)> meta_handler,
+                               function<void(unsigned, const CsvRecordView&)> rec_handler) {
+        auto dispatch = [&](const CsvRecordView& view){
+            if (::is_meta_record(view))
+                meta_handler(view);
+            else
+                rec_handler(0, view);
+        };
+
+        if (num_threads < 2 || (m_filename.empty() && !m_buf))
+            return read_records(dispatch);
+
+        const char* data = nullptr;
+        size_t      len  = 0;
+
+        bool mapped = map_input(data, len);
+
+        if (!mapped)
+            return read_records(dispatch);
+        if (len == 0)
+            return true;
+
+        const char* end = data + len;
+
+        // Pass 1: read metadata records in order. Snapshot records in
+        // parallel chunks may refer to metadata anywhere before them.
+
+        {
+            CsvRecordView view;
+
+            for (const char* p = data; p < end; )
+                if (::is_snapshot_line(p, end)) {
+                    p = ::next_record(data, p, end);
+                } else {
+                    p = view.parse(p, end);
+
+                    if (::is_meta_record(view))
+                        meta_handler(view);
+                }
+        }
+
+        // Pass 2: split file into chunks at record boundaries, and read
+        // snapshot records in parallel
+
+        std::vector<const char*> bounds(num_threads + 1, end);
+
+        bounds[0] = data;
+
+        for (unsigned t = 1; t < num_threads; ++t)
+            bounds[t] = std::max(bounds[t-1], ::next_record(data, data + (len / num_threads) * t, end));
+
+        auto chunk_fn = [&](unsigned t) {
+            CsvRecordView view;
+
+            for (const char* p = bounds[t]; p < bounds[t+1]; ) {
+                bool is_snapshot = ::is_snapshot_line(p, end);
+
+                p = view.parse(p, end);
+
+                if (is_snapshot || !::is_meta_record(view))
+                    rec_handler(t, view);
+            }
+        };
+
+        std::vector<std::thread> threads;
+
+        for (unsigned t = 1; t < num_threads; ++t)
+            threads.emplace_back(chunk_fn, t);
+
+        chunk_fn(0);
+
+        for (auto& t : threads)
+            t.join();
+
+        unmap_file(data, len);
+
+        return true;
+    }
+
+    bool read(function<void(const RecordMap&)> rec_handler) {
+        return read_records([&rec_handler](const CsvRecordView& view){
+                rec_handler(view.to_record_map());
+            });
+    }
 };
 
 CsvReader::CsvReader(const string& filename)
     : mP { new CsvReaderImpl(filename) }
 { }
 
+CsvReader::CsvReader(const string& name, const char* data, size_t len)
+    : mP { new CsvReaderImpl(name, data, len) }
+{ }
+
 CsvReader::~CsvReader()
 { }
 
@@ -84,3 +503,35 @@ CsvReader::read(function<void(const RecordMap&)> rec_handler)
 {
     return mP->read(rec_handler);
 }
+
+bool
+CsvReader::read_records(function<void(const CsvRecordView&)> rec_handler)
+{
+    return mP->read_records(rec_handler);
+}
+
+bool
+CsvReader::read_records_from(size_t& offset, function<void(const CsvRecordView&)> rec_handler)
+{
+    return mP->read_records_from(offset, rec_handler);
+}
+
+bool
+CsvReader::read_records_range(size_t begin, size_t end, function<void(const CsvRecordView&)> rec_handler)
+{
+    return mP->read_records_range(begin, end, rec_handler);
+}
+
+bool
+CsvReader::record_blocks(size_t block_size, std::vector<size_t>& bounds)
+{
+    return mP->record_blocks(block_size, bounds);
+}
+
+bool
+CsvReader::read_records_parallel(unsigned num_threads,
+                                 function<void(const CsvRecordView&)> meta_handler,
+                                 function<void(unsigned, const CsvRecordView&)> rec_handler)
+{
+    return mP->read_records_parallel(num_threads, meta_handler, rec_handler);
+}
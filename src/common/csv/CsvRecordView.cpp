@@ -0,0 +1,213 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file CsvRecordView.cpp
+/// CsvRecordView implementation
+
+#include "caliper/common/csv/CsvRecordView.h"
+
+#include "caliper/common/Log.h"
+
+#include <cstring>
+
+using namespace cali;
+
+namespace
+{
+
+const char csv_sep = ',';
+const char csv_esc = '\\';
+
+const struct FieldName {
+    const char* name;
+    std::size_t len;
+} field_names[] = {
+    { "__rec",  5 },
+    { "id",     2 },
+    { "attr",   4 },
+    { "data",   4 },
+    { "parent", 6 },
+    { "ref",    3 }
+};
+
+static_assert(sizeof(field_names)/sizeof(field_names[0]) == CsvRecordView::NumFields,
+              "field_names must match CsvRecordView::Field");
+
+}
+
+bool
+CsvRecordView::Span::operator == (const char* str) const
+{
+    return strncmp(ptr, str, len) == 0 && str[len] == '\0';
+}
+
+const char*
+CsvRecordView::parse(const char* begin, const char* end)
+{
+    m_entries.clear();
+    m_values.clear();
+    m_scratch.clear();
+
+    for (std::size_t f = 0; f < NumFields; ++f)
+        m_fields[f] = npos;
+
+    // Unescaped tokens can't be longer than the input, so the scratch buffer
+    // doesn't get re-allocated (which would invalidate spans into it) below.
+    if (m_scratch.capacity() < static_cast<std::size_t>(end - begin))
+        m_scratch.reserve(end - begin);
+
+    const char* tok     = begin;
+    bool        escaped = false;
+    bool        in_key  = true;
+    const char* p       = begin;
+
+    auto finish_token = [&](const char* tok_end) {
+        Span span = { tok, static_cast<std::size_t>(tok_end - tok) };
+
+        if (escaped) {
+            std::size_t start = m_scratch.size();
+
+            for (const char* c = tok; c < tok_end; ++c) {
+                if (*c == ::csv_esc && ++c == tok_end)
+                    break;
+
+                m_scratch.push_back(*c);
+            }
+
+            span.ptr = m_scratch.data() + start;
+            span.len = m_scratch.size() - start;
+        }
+
+        if (in_key)
+            m_entries.push_back({ span, m_values.size(), 0 });
+        else {
+            m_values.push_back(span);
+            ++m_entries.back().count;
+        }
+
+        in_key  = false;
+        escaped = false;
+        tok     = tok_end + 1;
+    };
+
+    auto finish_entry = [&](){
+        const Entry& e = m_entries.back();
+
+        if (e.count == 0) {
+            if (e.key.len > 0)
+                Log(1).stream() << "Invalid CSV entry: " << e.key.to_string() << std::endl;
+
+            m_entries.pop_back();
+        } else {
+            for (std::size_t f = 0; f < NumFields; ++f)
+                if (e.key.len == ::field_names[f].len && memcmp(e.key.ptr, ::field_names[f].name, e.key.len) == 0) {
+                    if (m_fields[f] == npos)
+                        m_fields[f] = m_entries.size() - 1;
+                    break;
+                }
+        }
+
+        in_key = true;
+    };
+
+    for ( ; p < end && *p != '\n'; ++p)
+        if (*p == ::csv_esc) {
+            escaped = true;
+
+            if (++p == end)
+                break;
+        } else if (*p == '=') {
+            finish_token(p);
+        } else if (*p == ::csv_sep) {
+            finish_token(p);
+            finish_entry();
+        }
+
+    if (p > end)
+        p = end;
+
+    finish_token(p);
+    finish_entry();
+
+    return p < end ? p + 1 : end;
+}
+
+const CsvRecordView::Entry*
+CsvRecordView::find(const char* key) const
+{
+    for (const Entry& e : m_entries)
+        if (e.key == key)
+            return &e;
+
+    return nullptr;
+}
+
+CsvRecordView::Span
+CsvRecordView::first(const char* key) const
+{
+    const Entry* e = find(key);
+
+    if (e && e->count > 0)
+        return m_values[e->first];
+
+    return { "", 0 };
+}
+
+CsvRecordView::Span
+CsvRecordView::first(Field field) const
+{
+    const Entry* e = find(field);
+
+    if (e && e->count > 0)
+        return m_values[e->first];
+
+    return { "", 0 };
+}
+
+RecordMap
+CsvRecordView::to_record_map() const
+{
+    RecordMap rec;
+
+    for (const Entry& e : m_entries) {
+        std::vector<std::string> data;
+
+        data.reserve(e.count);
+
+        for (std::size_t i = e.first; i < e.first + e.count; ++i)
+            data.emplace_back(m_values[i].ptr, m_values[i].len);
+
+        rec.insert(std::make_pair(e.key.to_string(), std::move(data)));
+    }
+
+    return rec;
+}
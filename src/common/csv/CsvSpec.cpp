@@ -84,6 +84,34 @@ struct CsvSpecImpl
         return vec;
     }
 
+    /// \brief Write \a v, formatting numbers and strings without creating
+    ///   a temporary string
+    void write_value(ostream& os, const Variant& v) {
+        char buf[24];
+
+        switch (v.type()) {
+        case CALI_TYPE_INT:
+            os.write(buf, util::format_int(v.to_int(), buf));
+            break;
+        case CALI_TYPE_UINT:
+            os.write(buf, util::format_uint(v.to_uint(), buf));
+            break;
+        case CALI_TYPE_STRING:
+        {
+            const char* str = static_cast<const char*>(v.data());
+            std::size_t len = v.size();
+
+            if (len && str[len-1] == 0)
+                --len;
+
+            util::write_esc_string(os, str, len, m_esc_chars);
+        }
+            break;
+        default:
+            util::write_esc_string(os, v.to_string(), m_esc_chars);
+        }
+    }
+
     void write_record(ostream& os, const RecordDescriptor& record, const int count[], const Variant* data[]) {
         os << "__rec=" << record.name;
 
@@ -91,10 +119,10 @@ struct CsvSpecImpl
             if (count[e] > 0)
                 os << "," << record.entries[e];
             for (int c = 0; c < count[e]; ++c)
-                util::write_esc_string(os << '=', data[e][c].to_string(), m_esc_chars);
+                write_value(os << '=', data[e][c]);
         }
 
-        os << endl;
+        os << '\n';
     }
 
     void write_record(ostream& os, const RecordMap& record) {
@@ -108,7 +136,7 @@ struct CsvSpecImpl
         }
 
         if (count)
-            os << endl;
+            os << '\n';
     }
 
     RecordMap read_record(const string& line) {
@@ -42,19 +42,32 @@
 #include "caliper/common/Node.h"
 #include "caliper/common/OutputStream.h"
 
+#include <algorithm>
+#include <atomic>
 #include <mutex>
-#include <set>
+#include <unordered_map>
 
 using namespace cali;
 
+namespace
+{
+
+//   Output node ids are taken from a process-wide counter, so that streams
+// written one after another to the same target (e.g., several flushes to
+// stdout) never re-use an id for a different node.
+std::atomic<cali_id_t> s_next_id { 11 };
+
+}
 
 struct CsvWriter::CsvWriterImpl
 {
     OutputStream  m_os;
     std::mutex    m_os_lock;
 
-    std::set<cali_id_t> m_written_nodes;
-    std::mutex    m_written_nodes_lock;
+    //   Nodes are written on demand and renumbered sequentially in the order
+    // they are written, i.e. parents and attributes before their users.
+    // Maps runtime node ids to output ids.
+    std::unordered_map<cali_id_t, cali_id_t> m_written_nodes;
 
     std::size_t   m_num_written;
 
@@ -62,49 +75,46 @@ struct CsvWriter::CsvWriterImpl
         : m_os(os),
           m_num_written(0)
     { }
-    
-    void recursive_write_node(const CaliperMetadataAccessInterface& db, cali_id_t id)
+
+    /// \brief Write node \a id and everything it refers to, return its output id.
+    ///   Assumes that m_os_lock is locked.
+    cali_id_t recursive_write_node(const CaliperMetadataAccessInterface& db, cali_id_t id)
     {
         if (id < 11) // don't write the hard-coded metadata nodes
-            return;
+            return id;
 
-        {
-            std::lock_guard<std::mutex>
-                g(m_written_nodes_lock);
+        auto it = m_written_nodes.find(id);
 
-            if (m_written_nodes.count(id) > 0)
-                return;
-        }
+        if (it != m_written_nodes.end())
+            return it->second;
 
         Node* node = db.node(id);
 
         if (!node)
-            return;
+            return CALI_INV_ID;
 
-        recursive_write_node(db, node->attribute());
+        Variant v_id;
+        Variant v_attr(recursive_write_node(db, node->attribute()));
+        Variant v_data(node->data());
+        Variant v_parent;
 
         Node* parent = node->parent();
 
         if (parent && parent->id() != CALI_INV_ID)
-            recursive_write_node(db, parent->id());
+            v_parent = Variant(recursive_write_node(db, parent->id()));
 
-        {
-            std::lock_guard<std::mutex>
-                g(m_os_lock);
-            
-            CsvSpec::write_record(m_os.stream(), node->record());
-            ++m_num_written;
-        }
-
-        {
-            std::lock_guard<std::mutex>
-                g(m_written_nodes_lock);
-
-            if (m_written_nodes.count(id) > 0)
-                return;
-       
-            m_written_nodes.insert(id);
-        }
+        cali_id_t out_id = s_next_id.fetch_add(1);
+        v_id = Variant(out_id);
+
+        int               n[4] = { 1, 1, 1, v_parent.empty() ? 0 : 1 };
+        const Variant* data[4] = { &v_id, &v_attr, &v_data, &v_parent };
+
+        CsvSpec::write_record(m_os.stream(), Node::record_descriptor(), n, data);
+        ++m_num_written;
+
+        m_written_nodes.emplace(id, out_id);
+
+        return out_id;
     }
 
     void write_snapshot(const CaliperMetadataAccessInterface& db,
@@ -117,25 +127,19 @@ struct CsvWriter::CsvWriterImpl
         Variant v_node[128];
         Variant v_attr[128];
 
-        for (int i = 0; i < nn; ++i) {
-            v_node[i] = Variant(nodes[i]);
-            recursive_write_node(db, nodes[i]);
-        }
-        for (int i = 0; i < ni;   ++i) {
-            v_attr[i] = Variant(attr[i]);
-            recursive_write_node(db, attr[i]);
-        }
+        std::lock_guard<std::mutex>
+            g(m_os_lock);
+
+        for (int i = 0; i < nn; ++i)
+            v_node[i] = Variant(recursive_write_node(db, nodes[i]));
+        for (int i = 0; i < ni;   ++i)
+            v_attr[i] = Variant(recursive_write_node(db, attr[i]));
 
         int               n[3] = { nn,     ni,     ni   };
         const Variant* data[3] = { v_node, v_attr, vals };
 
-        {
-            std::lock_guard<std::mutex>
-                g(m_os_lock);
-            
-            CsvSpec::write_record(m_os.stream(), ContextRecord::record_descriptor(), n, data);
-            ++m_num_written;
-        }
+        CsvSpec::write_record(m_os.stream(), ContextRecord::record_descriptor(), n, data);
+        ++m_num_written;
     }
 
     void write_entrylist(const CaliperMetadataAccessInterface& db,
@@ -149,21 +153,22 @@ struct CsvWriter::CsvWriterImpl
         int nn = 0;
         int ni = 0;
 
+        std::lock_guard<std::mutex>
+            g(m_os_lock);
+
         for (const Entry& e : list)
             if (e.node()) {
                 if (nn > 127)
                     continue;
             
-                recursive_write_node(db, e.node()->id());
-                v_node[nn] = Variant(e.node()->id());
+                v_node[nn] = Variant(recursive_write_node(db, e.node()->id()));
 
                 ++nn;
             } else if (e.is_immediate()) {
                 if (ni > 127)
                     continue;
             
-                recursive_write_node(db, e.attribute());
-                v_attr[ni] = Variant(e.attribute());
+                v_attr[ni] = Variant(recursive_write_node(db, e.attribute()));
                 v_data[ni] = e.value();
 
                 ++ni;
@@ -172,12 +177,7 @@ struct CsvWriter::CsvWriterImpl
         int               n[3] = { nn,     ni,     ni     };
         const Variant* data[3] = { v_node, v_attr, v_data };
 
-        {
-            std::lock_guard<std::mutex>
-                g(m_os_lock);
-            
-            CsvSpec::write_record(m_os.stream(), record, n, data);
-        }        
+        CsvSpec::write_record(m_os.stream(), record, n, data);
     }
 };
 
@@ -215,6 +215,9 @@ void CsvWriter::write_globals(const CaliperMetadataAccessInterface& db, const st
 
 void CsvWriter::operator()(const CaliperMetadataAccessInterface& db, const Node* node)
 {
+    std::lock_guard<std::mutex>
+        g(mP->m_os_lock);
+
     mP->recursive_write_node(db, node->id());
 }
 
@@ -296,3 +296,76 @@ TEST(CompressedSnapshotRecordTest, Unpack) {
 
     EXPECT_EQ(t2.count(), 2);
 }
+
+TEST(CompressedSnapshotRecordTest, BatchDecode) {
+    // use node and attribute ids with one-, two-, and multi-byte encodings
+    cali_id_t attr_in[3] = { 7, 300, 123456789 };
+    Variant   data_in[3] = { Variant(CALI_TYPE_INT), Variant(1.23), Variant(-42.0) };
+
+    Node* n1 = new Node(1, 1, Variant(CALI_TYPE_STRING, "whee", 4));
+    Node* n2 = new Node(200, 2, Variant(-1.0));
+    Node* n3 = new Node(1ull << 40, 2, Variant(42.0));
+
+    n1->append(n2);
+    n1->append(n3);
+
+    const Node* node_in[3] = { n1, n2, n3 };
+
+    std::vector<unsigned char> buf;
+
+    for (int i = 0; i < 3; ++i) {
+        CompressedSnapshotRecord rec;
+
+        rec.append(i+1, node_in);
+        rec.append(3-i, attr_in+i, data_in+i);
+
+        buf.insert(buf.end(), rec.data(), rec.data() + rec.size());
+    }
+
+    CompressedSnapshotBatch batch;
+    size_t pos = 0;
+
+    ASSERT_EQ(batch.decode(buf.data(), buf.size(), 16, &pos), static_cast<size_t>(3));
+    EXPECT_EQ(pos, buf.size());
+    ASSERT_EQ(batch.num_records(), static_cast<size_t>(3));
+
+    for (size_t r = 0; r < 3; ++r) {
+        ASSERT_EQ(batch.num_nodes(r), r+1);
+        ASSERT_EQ(batch.num_immediates(r), 3-r);
+
+        for (size_t i = 0; i < r+1; ++i)
+            EXPECT_EQ(batch.nodes(r)[i], node_in[i]->id());
+
+        for (size_t i = 0; i < 3-r; ++i) {
+            EXPECT_EQ(batch.immediate_attr(r)[i], attr_in[r+i]);
+            EXPECT_EQ(batch.immediate_data(r)[i], data_in[r+i]);
+        }
+    }
+
+    // max_records limit, and appending to an existing batch
+
+    batch.clear();
+    pos = 0;
+
+    EXPECT_EQ(batch.decode(buf.data(), buf.size(), 1, &pos), static_cast<size_t>(1));
+    EXPECT_EQ(batch.decode(buf.data()+pos, buf.size()-pos, 16, &pos), static_cast<size_t>(2));
+    EXPECT_EQ(pos, buf.size());
+    ASSERT_EQ(batch.num_records(), static_cast<size_t>(3));
+    EXPECT_EQ(batch.nodes(2)[2], n3->id());
+    EXPECT_EQ(batch.immediate_attr(2)[0], attr_in[2]);
+
+    // truncated input: incomplete last record must be dropped
+
+    batch.clear();
+    pos = 0;
+
+    EXPECT_EQ(batch.decode(buf.data(), buf.size()-1, 16, &pos), static_cast<size_t>(2));
+    EXPECT_LT(pos, buf.size());
+    EXPECT_EQ(batch.num_records(), static_cast<size_t>(2));
+    EXPECT_EQ(batch.node_ids.size(), static_cast<size_t>(3));
+    EXPECT_EQ(batch.imm_attr.size(), static_cast<size_t>(5));
+
+    delete n3;
+    delete n2;
+    delete n1;
+}
@@ -0,0 +1,65 @@
+// Test the CsvReader class
+
+#include "caliper/common/csv/CsvReader.h"
+#include "caliper/common/csv/CsvRecordView.h"
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <vector>
+
+using namespace cali;
+
+TEST(CsvReaderTest, ReadParallel) {
+    const char* filename = "test_csvreader_parallel.cali";
+
+    {
+        std::ofstream os(filename);
+
+        for (int i = 0; i < 1000; ++i) {
+            os << "__rec=node,id=" << 100+i << ",attr=8,data=attr\\\n" << i << ",parent=3\n";
+            os << "__rec=ctx,ref=" << 100+i << "\n";
+        }
+
+        os << "__rec=globals,ref=100\n";
+    }
+
+    std::vector<std::string> meta;
+    std::set<std::string>    refs;
+    std::mutex               refs_lock;
+    std::atomic<unsigned>    max_thread(0);
+
+    CsvReader reader(filename);
+
+    bool ret = reader.read_records_parallel(4,
+        [&](const CsvRecordView& rec){
+            meta.push_back(rec.first("__rec").to_string() + ":" + rec.first("data").to_string());
+        },
+        [&](unsigned t, const CsvRecordView& rec){
+            std::lock_guard<std::mutex>
+                g(refs_lock);
+
+            refs.insert(rec.first("ref").to_string());
+
+            if (t > max_thread)
+                max_thread = t;
+        });
+
+    std::remove(filename);
+
+    EXPECT_TRUE(ret);
+    EXPECT_LT(max_thread.load(), 4u);
+
+    ASSERT_EQ(meta.size(), 1001u);
+    EXPECT_EQ(meta[0],    std::string("node:attr\n0"));
+    EXPECT_EQ(meta[999],  std::string("node:attr\n999"));
+    EXPECT_EQ(meta[1000], std::string("globals:"));
+
+    ASSERT_EQ(refs.size(), 1000u);
+    EXPECT_EQ(refs.count("100"),  1u);
+    EXPECT_EQ(refs.count("1099"), 1u);
+}
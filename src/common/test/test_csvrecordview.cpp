@@ -0,0 +1,102 @@
+// Test the CsvRecordView class
+
+#include "caliper/common/csv/CsvRecordView.h"
+
+#include "gtest/gtest.h"
+
+#include <cstring>
+
+using namespace cali;
+
+TEST(CsvRecordViewTest, ParseRecord) {
+    const char* input = "__rec=ctx,ref=12=13,attr=8,data=4\n__rec=node,id=14";
+    const char* end   = input + strlen(input);
+
+    CsvRecordView view;
+
+    const char* p = view.parse(input, end);
+
+    ASSERT_EQ(view.num_entries(), 4u);
+
+    EXPECT_TRUE(view.first("__rec") == "ctx");
+    EXPECT_TRUE(view.first("attr")  == "8");
+    EXPECT_TRUE(view.first("data")  == "4");
+    EXPECT_EQ(view.find("id"), nullptr);
+
+    const CsvRecordView::Entry* ref = view.find("ref");
+
+    ASSERT_NE(ref, nullptr);
+    ASSERT_EQ(ref->count, 2u);
+    EXPECT_TRUE(view.value(ref->first)   == "12");
+    EXPECT_TRUE(view.value(ref->first+1) == "13");
+
+    // values without escapes point into the input
+    EXPECT_TRUE(view.first("data").ptr > input);
+    EXPECT_TRUE(view.first("data").ptr < p);
+
+    EXPECT_EQ(view.parse(p, end), end);
+    EXPECT_EQ(view.num_entries(), 2u);
+    EXPECT_TRUE(view.first("__rec") == "node");
+    EXPECT_TRUE(view.first("id")    == "14");
+}
+
+TEST(CsvRecordViewTest, ParseEscapes) {
+    const char* input = "__rec=node,data=a\\,b\\=c\\\nd\\\\,k\\=ey=v\n";
+    const char* end   = input + strlen(input);
+
+    CsvRecordView view;
+
+    EXPECT_EQ(view.parse(input, end), end);
+
+    ASSERT_EQ(view.num_entries(), 3u);
+    EXPECT_EQ(view.first("data").to_string(), std::string("a,b=c\nd\\"));
+    EXPECT_EQ(view.first("k=ey").to_string(), std::string("v"));
+
+    RecordMap rec = view.to_record_map();
+
+    ASSERT_EQ(rec.count("data"), 1u);
+    EXPECT_EQ(rec["data"].front(), std::string("a,b=c\nd\\"));
+}
+
+TEST(CsvRecordViewTest, InvalidEntries) {
+    const char* input = "__rec=ctx,invalid,attr=8";
+
+    CsvRecordView view;
+
+    view.parse(input, input + strlen(input));
+
+    EXPECT_EQ(view.num_entries(), 2u);
+    EXPECT_EQ(view.find("invalid"), nullptr);
+
+    view.parse(input, input);
+
+    EXPECT_EQ(view.num_entries(), 0u);
+}
+
+TEST(CsvRecordViewTest, Fields) {
+    const char* input = "__rec=node,id=14,attr=8,data=a\\,b,parent=3,idx=7\n__rec=ctx,ref=14";
+    const char* end   = input + strlen(input);
+
+    CsvRecordView view;
+
+    const char* p = view.parse(input, end);
+
+    EXPECT_TRUE(view.first(CsvRecordView::Rec)    == "node");
+    EXPECT_TRUE(view.first(CsvRecordView::Id)     == "14");
+    EXPECT_TRUE(view.first(CsvRecordView::Attr)   == "8");
+    EXPECT_TRUE(view.first(CsvRecordView::Data)   == "a,b");
+    EXPECT_TRUE(view.first(CsvRecordView::Parent) == "3");
+    EXPECT_EQ(view.find(CsvRecordView::Ref), nullptr);
+    EXPECT_EQ(view.find(CsvRecordView::Id), view.find("id"));
+
+    // fields are reset for each record
+    view.parse(p, end);
+
+    EXPECT_TRUE(view.first(CsvRecordView::Rec) == "ctx");
+    EXPECT_EQ(view.find(CsvRecordView::Id), nullptr);
+
+    const CsvRecordView::Entry* ref = view.find(CsvRecordView::Ref);
+
+    ASSERT_NE(ref, nullptr);
+    EXPECT_EQ(ref->count, 1u);
+}
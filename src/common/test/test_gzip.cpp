@@ -0,0 +1,145 @@
+// Test gzip-compressed output streams and the CsvReader decompression
+
+#include "../util/gzip_util.h"
+
+#include "caliper/common/OutputStream.h"
+
+#include "caliper/common/csv/CsvReader.h"
+#include "caliper/common/csv/CsvRecordView.h"
+
+#include "gtest/gtest.h"
+
+#include <zlib.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+std::string
+make_text(int lines)
+{
+    std::ostringstream os;
+
+    for (int i = 0; i < lines; ++i)
+        os << "__rec=ctx,ref=" << 100 + (i % 7) << ",attr=8,data=" << i << "\n";
+
+    return os.str();
+}
+
+/// Compress \a str into a single gzip member with plain zlib
+std::string
+zlib_gzip(const std::string& str)
+{
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+
+    deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+
+    std::vector<char> out(deflateBound(&zs, str.size()) + 32);
+
+    zs.next_in   = reinterpret_cast<Bytef*>(const_cast<char*>(str.data()));
+    zs.avail_in  = str.size();
+    zs.next_out  = reinterpret_cast<Bytef*>(out.data());
+    zs.avail_out = out.size();
+
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+
+    return std::string(out.data(), out.size());
+}
+
+} // namespace [anonymous]
+
+TEST(GzipTest, MemberRoundTrip) {
+    std::string text = make_text(10000);
+
+    std::vector<char> compressed;
+
+    // three members
+    ASSERT_TRUE(util::gzip_compress_member(text.data(), 1000, compressed));
+    ASSERT_TRUE(util::gzip_compress_member(text.data() + 1000, 50000, compressed));
+    ASSERT_TRUE(util::gzip_compress_member(text.data() + 51000, text.size() - 51000, compressed));
+
+    EXPECT_TRUE(util::is_gzip(compressed.data(), compressed.size()));
+    EXPECT_LT(compressed.size(), text.size() / 2);
+
+    std::vector<char> out;
+
+    ASSERT_TRUE(util::gzip_decompress(compressed.data(), compressed.size(), out, 4));
+    EXPECT_EQ(std::string(out.data(), out.size()), text);
+
+    ASSERT_TRUE(util::gzip_decompress(compressed.data(), compressed.size(), out, 1));
+    EXPECT_EQ(std::string(out.data(), out.size()), text);
+
+    // an incomplete last member is skipped
+    ASSERT_TRUE(util::gzip_decompress(compressed.data(), compressed.size() - 10, out, 4));
+    EXPECT_EQ(std::string(out.data(), out.size()), text.substr(0, 51000));
+
+    // corrupt data
+    compressed[30] ^= 0x55;
+    EXPECT_FALSE(util::gzip_decompress(compressed.data(), compressed.size(), out, 4));
+}
+
+TEST(GzipTest, ForeignGzip) {
+    std::string text = make_text(2000);
+    std::string gz   = zlib_gzip(text.substr(0, 1234)) + zlib_gzip(text.substr(1234));
+
+    std::vector<char> out;
+
+    ASSERT_TRUE(util::gzip_decompress(gz.data(), gz.size(), out, 4));
+    EXPECT_EQ(std::string(out.data(), out.size()), text);
+
+    // truncated
+    ASSERT_TRUE(util::gzip_decompress(gz.data(), gz.size() - 100, out, 4));
+    EXPECT_EQ(std::string(out.data(), out.size()), text.substr(0, 1234));
+}
+
+TEST(GzipTest, CompressedOutputStream) {
+    const char* filename = "test_gzip_outputstream.cali.gz";
+    const int   lines    = 100000; // several compression blocks
+
+    {
+        OutputStream stream;
+        stream.set_filename(filename);
+
+        EXPECT_EQ(stream.compression(), OutputStream::Gzip);
+
+        std::ostream& os = stream.stream();
+
+        for (int i = 0; i < lines; ++i)
+            os << "__rec=ctx,ref=" << 100 + (i % 7) << ",attr=8,data=" << i << "\n";
+    }
+
+    {
+        std::ifstream is(filename, std::ios::binary);
+        char magic[2] = { 0, 0 };
+
+        is.read(magic, 2);
+        EXPECT_TRUE(util::is_gzip(magic, 2));
+    }
+
+    CsvReader reader(filename);
+    int  count = 0;
+    bool order = true;
+
+    bool ret = reader.read_records([&](const CsvRecordView& rec){
+            if (rec.first("data").to_string() != std::to_string(count))
+                order = false;
+            ++count;
+        });
+
+    std::remove(filename);
+
+    EXPECT_TRUE(ret);
+    EXPECT_TRUE(order);
+    EXPECT_EQ(count, lines);
+}
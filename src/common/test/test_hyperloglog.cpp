@@ -0,0 +1,62 @@
+#include "caliper/common/HyperLogLog.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace cali;
+
+TEST(HyperLogLogTest, SmallAndLargeCounts) {
+    HyperLogLog hll;
+
+    EXPECT_TRUE(hll.empty());
+    EXPECT_EQ(hll.estimate(), 0);
+
+    // duplicates don't count
+    for (int i = 0; i < 1000; ++i)
+        hll.add(Variant(i % 10));
+
+    EXPECT_FALSE(hll.empty());
+    EXPECT_EQ(hll.estimate(), 10);
+
+    for (int i = 0; i < 100000; ++i)
+        hll.add(Variant(i));
+
+    EXPECT_NEAR(static_cast<double>(hll.estimate()), 100000.0, 100000.0 * 0.2);
+}
+
+TEST(HyperLogLogTest, StringsIgnoreTerminator) {
+    HyperLogLog hll;
+
+    hll.add(Variant(CALI_TYPE_STRING, "foo", 4));
+    hll.add(Variant(CALI_TYPE_STRING, "foo", 3));
+    hll.add(Variant(CALI_TYPE_STRING, "bar", 3));
+
+    EXPECT_EQ(hll.estimate(), 2);
+}
+
+TEST(HyperLogLogTest, MergeAndEncode) {
+    HyperLogLog a, b;
+
+    for (int i = 0; i < 5000; ++i)
+        a.add(Variant(i));
+    for (int i = 2500; i < 7500; ++i)
+        b.add(Variant(i));
+
+    std::vector<uint64_t> codes;
+    b.encode(codes);
+
+    EXPECT_LE(codes.size(), static_cast<size_t>((HyperLogLog::NumRegisters + 8) / 9));
+
+    HyperLogLog c(a);
+
+    for (uint64_t code : codes)
+        c.merge_code(code);
+
+    a.merge(b);
+
+    EXPECT_EQ(a.estimate(), c.estimate());
+    EXPECT_NEAR(static_cast<double>(a.estimate()), 7500.0, 7500.0 * 0.2);
+}
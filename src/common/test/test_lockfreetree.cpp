@@ -0,0 +1,116 @@
+#include "caliper/common/util/lockfree-tree.hpp"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+struct TestNode : public util::LockfreeIntrusiveTree<TestNode> {
+    util::LockfreeIntrusiveTree<TestNode>::Node m_treenode;
+    int key;
+
+    TestNode(int k)
+        : util::LockfreeIntrusiveTree<TestNode>(this, &TestNode::m_treenode), key(k)
+        { }
+};
+
+TestNode* find(TestNode* parent, int key, unsigned threshold = 4)
+{
+    return parent->find_child(static_cast<size_t>(key) * 0x9E3779B97F4A7C15ull,
+                              [key](const TestNode* n) { return n->key == key; },
+                              [](const TestNode* n) {
+                                  return static_cast<size_t>(n->key) * 0x9E3779B97F4A7C15ull;
+                              },
+                              threshold);
+}
+
+}
+
+TEST(LockfreeTreeTest, HighFanoutFindChild) {
+    TestNode root(-1);
+    std::vector<TestNode*> children;
+
+    for (int i = 0; i < 1000; ++i) {
+        children.push_back(new TestNode(i));
+        root.append(children.back());
+
+        // lookups interleaved with appends exercise index rebuilds
+        if (i % 7 == 0)
+            EXPECT_EQ(find(&root, i / 2), children[i / 2]);
+    }
+
+    for (int i = 0; i < 1000; ++i)
+        EXPECT_EQ(find(&root, i), children[i]);
+
+    EXPECT_EQ(find(&root, 1000), nullptr);
+    EXPECT_EQ(find(&root, 1, 0), children[1]);
+
+    for (TestNode* n : children)
+        delete n;
+}
+
+TEST(LockfreeTreeTest, DuplicatesFindNewest) {
+    TestNode root(-1);
+    std::vector<TestNode*> children;
+
+    for (int i = 0; i < 100; ++i) {
+        children.push_back(new TestNode(i));
+        root.append(children.back());
+    }
+
+    // build the index
+    EXPECT_EQ(find(&root, 0), children[0]);
+
+    TestNode* dup_a = new TestNode(5);
+    root.append(dup_a);
+
+    EXPECT_EQ(find(&root, 5), dup_a);
+
+    // again, with the duplicate in the index
+    for (int i = 100; i < 300; ++i) {
+        children.push_back(new TestNode(i));
+        root.append(children.back());
+    }
+
+    EXPECT_EQ(find(&root, 0), children[0]);
+    EXPECT_EQ(find(&root, 5), dup_a);
+
+    delete dup_a;
+
+    for (TestNode* n : children)
+        delete n;
+}
+
+TEST(LockfreeTreeTest, ConcurrentAppendAndFind) {
+    TestNode root(-1);
+
+    const int num_threads = 4;
+    const int num_keys    = 2000;
+
+    std::vector< std::vector<TestNode*> > nodes(num_threads);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back([&root,&nodes,t](){
+                for (int i = 0; i < num_keys; ++i) {
+                    int key = i * num_threads + t;
+
+                    nodes[t].push_back(new TestNode(key));
+                    root.append(nodes[t].back());
+
+                    EXPECT_EQ(find(&root, key), nodes[t].back());
+                }
+            });
+
+    for (std::thread& t : threads)
+        t.join();
+
+    for (int t = 0; t < num_threads; ++t)
+        for (int i = 0; i < num_keys; ++i) {
+            EXPECT_EQ(find(&root, i * num_threads + t), nodes[t][i]);
+            delete nodes[t][i];
+        }
+}
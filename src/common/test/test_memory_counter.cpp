@@ -0,0 +1,92 @@
+#include "caliper/common/util/memory_counter.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+util::memory_counter s_test_counter("test_memory_counter");
+
+bool in_list(const util::memory_counter* c)
+{
+    for (const util::memory_counter* p = util::memory_counter::list(); p; p = p->next)
+        if (p == c)
+            return true;
+
+    return false;
+}
+
+}
+
+TEST(MemoryCounterTest, AddSub) {
+    s_test_counter.add(100, 40);
+    s_test_counter.add(28, 24);
+
+    EXPECT_EQ(s_test_counter.reserved.load(), 128u);
+    EXPECT_EQ(s_test_counter.used.load(), 64u);
+
+    s_test_counter.sub(128, 64);
+
+    EXPECT_EQ(s_test_counter.reserved.load(), 0u);
+    EXPECT_EQ(s_test_counter.used.load(), 0u);
+
+    EXPECT_TRUE(in_list(&s_test_counter));
+    EXPECT_EQ(s_test_counter.thread.load(), util::memory_counter::ProcessWide);
+}
+
+TEST(MemoryCounterTest, AcquireRelease) {
+    util::memory_counter* a = util::memory_counter::acquire("test_acquire", 1);
+    util::memory_counter* b = util::memory_counter::acquire("test_acquire", 2);
+
+    ASSERT_NE(a, nullptr);
+    ASSERT_NE(b, nullptr);
+    EXPECT_NE(a, b);
+    EXPECT_TRUE(in_list(a));
+    EXPECT_TRUE(in_list(b));
+    EXPECT_EQ(a->thread.load(), 1);
+
+    a->set(64, 32);
+    a->release();
+
+    EXPECT_EQ(a->reserved.load(), 0u);
+    EXPECT_EQ(a->used.load(), 0u);
+
+    // the released counter is re-used for the same name only
+    util::memory_counter* c = util::memory_counter::acquire("test_acquire_other", 3);
+    EXPECT_NE(c, a);
+
+    util::memory_counter* d = util::memory_counter::acquire("test_acquire", 4);
+    EXPECT_EQ(d, a);
+    EXPECT_EQ(d->thread.load(), 4);
+
+    b->release();
+    c->release();
+    d->release();
+}
+
+TEST(MemoryCounterTest, ThreadId) {
+    const int num_threads = 4;
+
+    std::vector<int>         ids(num_threads, -1);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back([&ids,t](){
+                ids[t] = util::memory_counter::thread_id();
+                EXPECT_EQ(ids[t], util::memory_counter::thread_id());
+            });
+
+    for (std::thread& t : threads)
+        t.join();
+
+    std::set<int> unique(ids.begin(), ids.end());
+    unique.insert(util::memory_counter::thread_id());
+
+    EXPECT_EQ(unique.size(), static_cast<size_t>(num_threads + 1));
+    EXPECT_EQ(unique.count(-1), 0u);
+}
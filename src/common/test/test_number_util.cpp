@@ -0,0 +1,97 @@
+// Test the number conversion helpers
+
+#include "../util/number_util.h"
+
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace util;
+
+TEST(NumberUtilTest, FormatInt) {
+    char buf[32];
+
+    EXPECT_EQ(std::string(buf, format_uint(0, buf)), std::string("0"));
+    EXPECT_EQ(std::string(buf, format_uint(UINT64_MAX, buf)), std::string("18446744073709551615"));
+    EXPECT_EQ(std::string(buf, format_int(-42, buf)), std::string("-42"));
+    EXPECT_EQ(std::string(buf, format_int(INT64_MIN, buf)), std::string("-9223372036854775808"));
+    EXPECT_EQ(std::string(buf, format_hex(0xbeef, buf)), std::string("beef"));
+}
+
+TEST(NumberUtilTest, FormatDoubleMatchesPrintf) {
+    const double vals[] = {
+        0.0, -0.0, 1.0, -1.5, 0.1, 1138.0, 3.14159265358979, 1e-7, 5e-7, 4.9999999e-7,
+        123456789.123456789, 9.1e18, 1e19, 1e300, -2.5e-3, 0.0000015, std::nan(""), HUGE_VAL
+    };
+
+    for (double v : vals) {
+        char ref[352], buf[352];
+
+        snprintf(ref, sizeof(ref), "%f", v);
+
+        int n = format_double(v, buf, sizeof(buf));
+
+        ASSERT_GE(n, 0);
+        EXPECT_EQ(std::string(buf, n), std::string(ref)) << "value " << v;
+    }
+
+    // pseudo-random values across magnitudes
+    uint64_t x = 42;
+
+    for (int i = 0; i < 10000; ++i) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+
+        double v = std::ldexp(static_cast<double>(x >> 11), static_cast<int>(i % 120) - 100);
+        char   ref[352], buf[352];
+
+        snprintf(ref, sizeof(ref), "%f", v);
+        format_double(v, buf, sizeof(buf));
+
+        EXPECT_STREQ(buf, ref);
+    }
+}
+
+TEST(NumberUtilTest, ParseInt) {
+    int64_t  i = 0;
+    uint64_t u = 0;
+
+    EXPECT_TRUE(parse_int("-42", 3, i));
+    EXPECT_EQ(i, -42);
+    EXPECT_TRUE(parse_int("9223372036854775807", 19, i));
+    EXPECT_EQ(i, INT64_MAX);
+    EXPECT_FALSE(parse_int("9223372036854775808", 19, i));
+    EXPECT_FALSE(parse_int("12a", 3, i));
+    EXPECT_FALSE(parse_int("", 0, i));
+    EXPECT_FALSE(parse_int(" 1", 2, i));
+
+    EXPECT_TRUE(parse_uint("18446744073709551615", 20, u));
+    EXPECT_EQ(u, UINT64_MAX);
+    EXPECT_FALSE(parse_uint("18446744073709551616", 20, u));
+    EXPECT_TRUE(parse_uint("7ffF", 4, u, 16));
+    EXPECT_EQ(u, 0x7fffu);
+}
+
+TEST(NumberUtilTest, ParseDouble) {
+    const char* strs[] = {
+        "0", "-0.0", "1138.000000", "3.141593", "0.1", "-2.5e-3", "1E22", "9007199254740992", ".5", "5."
+    };
+
+    for (const char* s : strs) {
+        double d = -1.0;
+
+        ASSERT_TRUE(parse_double(s, strlen(s), d)) << s;
+        EXPECT_EQ(d, std::strtod(s, nullptr)) << s;
+        EXPECT_EQ(std::signbit(d), std::signbit(std::strtod(s, nullptr))) << s;
+    }
+
+    const char* rejected[] = { "", "-", ".", "1e", "abc", "1.0x", "inf", "1e400", "123456789012345678" };
+
+    for (const char* s : rejected) {
+        double d = 0.0;
+        EXPECT_FALSE(parse_double(s, strlen(s), d)) << s;
+    }
+}
@@ -0,0 +1,83 @@
+// Test OutputStream file output
+
+#include "caliper/common/OutputStream.h"
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace cali;
+
+namespace
+{
+
+std::string
+read_file(const char* filename)
+{
+    std::ifstream     is(filename);
+    std::stringstream ss;
+
+    ss << is.rdbuf();
+
+    return ss.str();
+}
+
+void
+write_and_check(const char* filename, std::size_t buffer_size, bool direct, bool do_fsync)
+{
+    std::ostringstream expected;
+
+    {
+        OutputStream stream;
+
+        stream.set_filename(filename);
+        stream.set_buffer_size(buffer_size);
+        stream.set_direct_io(direct);
+        stream.set_fsync(do_fsync);
+
+        EXPECT_EQ(stream.type(), OutputStream::File);
+
+        std::ostream& os = stream.stream();
+
+        for (int i = 0; i < 20000; ++i) {
+            os << "__rec=ctx,ref=" << i << '\n';
+            expected << "__rec=ctx,ref=" << i << '\n';
+        }
+
+        os.flush();
+
+        if (!direct)
+            EXPECT_EQ(read_file(filename), expected.str());
+
+        os << "last";
+        expected << "last";
+    }
+
+    EXPECT_EQ(read_file(filename), expected.str());
+
+    std::remove(filename);
+}
+
+} // namespace [anonymous]
+
+TEST(OutputStreamTest, BufferedFile) {
+    write_and_check("test_outputstream_buffered.txt", OutputStream::DefaultBufferSize, false, false);
+    write_and_check("test_outputstream_small.txt", 100, false, true);
+}
+
+TEST(OutputStreamTest, DirectIO) {
+    // falls back to regular I/O where O_DIRECT isn't supported
+    write_and_check("test_outputstream_direct.txt", 8192, true, true);
+}
+
+TEST(OutputStreamTest, InvalidFile) {
+    OutputStream stream;
+
+    stream.set_filename("/this/directory/does/not/exist/file.txt");
+    stream.stream() << "test";
+
+    EXPECT_EQ(stream.type(), OutputStream::None);
+}
@@ -0,0 +1,181 @@
+#include "caliper/common/ShmRing.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+std::string to_string(const unsigned char* data, std::size_t len)
+{
+    return std::string(reinterpret_cast<const char*>(data), len);
+}
+
+const unsigned char* to_data(const std::string& str)
+{
+    return reinterpret_cast<const unsigned char*>(str.data());
+}
+
+}
+
+TEST(ShmRingTest, WriteAndRead) {
+    std::vector<unsigned char> mem(16 * 1024);
+
+    ShmRingWriter writer(mem.data(), mem.size(), 1024, 64);
+
+    ASSERT_TRUE(writer.valid());
+    EXPECT_EQ(writer.max_record_size(), 64u - sizeof(ShmRingWriter::Slot));
+
+    EXPECT_TRUE(writer.add_node(to_data("node-a"), 6));
+    EXPECT_TRUE(writer.add_record(to_data("rec-1"), 5));
+
+    ShmRingReader reader(mem.data(), mem.size());
+
+    ASSERT_TRUE(reader.valid());
+
+    std::vector<std::string> nodes;
+    std::vector<std::string> recs;
+
+    auto node_fn = [&nodes](const unsigned char* d, std::size_t l) { nodes.push_back(to_string(d, l)); };
+    auto rec_fn  = [&recs](const unsigned char* d, std::size_t l)  { recs.push_back(to_string(d, l));  };
+
+    EXPECT_EQ(reader.poll(node_fn, rec_fn), 1u);
+
+    EXPECT_TRUE(writer.add_node(to_data("node-bb"), 7));
+    EXPECT_TRUE(writer.add_record(to_data("rec-2"), 5));
+    EXPECT_FALSE(writer.add_record(mem.data(), 100)); // too large
+
+    EXPECT_EQ(reader.poll(node_fn, rec_fn), 1u);
+    EXPECT_EQ(reader.poll(node_fn, rec_fn), 0u);
+
+    ASSERT_EQ(nodes.size(), 2u);
+    EXPECT_EQ(nodes[0], "node-a");
+    EXPECT_EQ(nodes[1], "node-bb");
+    ASSERT_EQ(recs.size(), 2u);
+    EXPECT_EQ(recs[0], "rec-1");
+    EXPECT_EQ(recs[1], "rec-2");
+
+    EXPECT_EQ(writer.num_records(), 2u);
+    EXPECT_EQ(writer.num_dropped(), 1u);
+    EXPECT_EQ(reader.num_lost(), 0u);
+}
+
+TEST(ShmRingTest, DictionaryFull) {
+    std::vector<unsigned char> mem(4096);
+
+    ShmRingWriter writer(mem.data(), mem.size(), 32, 64);
+
+    ASSERT_TRUE(writer.valid());
+
+    EXPECT_TRUE(writer.add_node(to_data("0123456789"), 10));  // 8 + 16 bytes
+    EXPECT_FALSE(writer.add_node(to_data("0123456789"), 10));
+
+    ShmRingReader reader(mem.data(), mem.size());
+    int n = 0;
+
+    reader.poll([&n](const unsigned char*, std::size_t){ ++n; },
+                [](const unsigned char*, std::size_t){ });
+
+    EXPECT_EQ(n, 1);
+}
+
+TEST(ShmRingTest, Overrun) {
+    std::vector<unsigned char> mem(4096);
+
+    ShmRingWriter writer(mem.data(), mem.size(), 0, 64);
+    ShmRingReader reader(mem.data(), mem.size());
+
+    ASSERT_TRUE(writer.valid());
+    ASSERT_TRUE(reader.valid());
+
+    std::size_t num_slots = 0;
+
+    // find the number of slots: write until the first record is overwritten
+    for (int i = 0; i < 1000; ++i) {
+        std::string s = std::to_string(i);
+        writer.add_record(to_data(s), s.size());
+    }
+
+    std::vector<int> recs;
+
+    reader.poll([](const unsigned char*, std::size_t){ },
+                [&recs](const unsigned char* d, std::size_t l){ recs.push_back(std::stoi(to_string(d, l))); });
+
+    num_slots = recs.size();
+
+    ASSERT_GT(num_slots, 2u);
+    ASSERT_LT(num_slots, 1000u);
+
+    // we get the newest records, the others are lost
+    EXPECT_EQ(recs.back(), 999);
+    EXPECT_EQ(recs.front(), 1000 - static_cast<int>(num_slots));
+    EXPECT_EQ(reader.num_lost(), 1000 - num_slots);
+}
+
+TEST(ShmRingTest, ConcurrentWriters) {
+    std::vector<unsigned char> mem(64 * 1024);
+
+    ShmRingWriter writer(mem.data(), mem.size(), 1024, 64);
+    ShmRingReader reader(mem.data(), mem.size());
+
+    ASSERT_TRUE(writer.valid());
+    ASSERT_TRUE(reader.valid());
+
+    const int num_threads = 4;
+    const int num_recs    = 20000;
+
+    std::atomic<bool> done(false);
+
+    std::size_t num_read = 0;
+    std::size_t num_bad  = 0;
+
+    auto rec_fn = [&](const unsigned char* d, std::size_t l) {
+        // each record is a thread id followed by a repeated byte pattern
+        ++num_read;
+
+        if (l != 32 || d[0] >= num_threads) {
+            ++num_bad;
+            return;
+        }
+        for (std::size_t i = 2; i < l; ++i)
+            if (d[i] != d[1])
+                ++num_bad;
+    };
+    auto node_fn = [](const unsigned char*, std::size_t) { };
+
+    std::thread consumer([&]() {
+            while (!done.load())
+                reader.poll(node_fn, rec_fn);
+            reader.poll(node_fn, rec_fn);
+        });
+
+    std::vector<std::thread> producers;
+
+    for (int t = 0; t < num_threads; ++t)
+        producers.emplace_back([&writer,t,num_recs]() {
+                unsigned char buf[32];
+
+                for (int i = 0; i < num_recs; ++i) {
+                    buf[0] = static_cast<unsigned char>(t);
+                    memset(buf+1, i % 251, sizeof(buf)-1);
+                    writer.add_record(buf, sizeof(buf));
+                }
+            });
+
+    for (auto& t : producers)
+        t.join();
+
+    done.store(true);
+    consumer.join();
+
+    EXPECT_EQ(writer.num_records(), static_cast<uint64_t>(num_threads * num_recs));
+    EXPECT_EQ(num_bad, 0u);
+    EXPECT_EQ(num_read + reader.num_lost(), static_cast<std::size_t>(num_threads * num_recs));
+}
@@ -49,3 +49,43 @@ TEST(SnapshotTextFormatterTest, FormatTest) {
         EXPECT_EQ(os.str(), std::string("42whee"));
     }    
 }
+
+TEST(SnapshotTextFormatterTest, NestedAndImmediate) {
+    Node* strtype_attr_n = new Node(3, 9, Variant(CALI_TYPE_STRING));
+    Node* dbltype_attr_n = new Node(2, 9, Variant(CALI_TYPE_DOUBLE));
+
+    Node* str_attr = new Node(100, 8, Variant(CALI_TYPE_STRING, "str.attr", 9));
+    Node* dbl_attr = new Node(101, 8, Variant(CALI_TYPE_STRING, "dbl.attr", 9));
+
+    strtype_attr_n->append(str_attr);
+    dbltype_attr_n->append(dbl_attr);
+
+    MockupMetadataDB db;
+
+    db.add_attribute(Attribute::make_attribute(str_attr));
+    db.add_attribute(Attribute::make_attribute(dbl_attr));
+
+    Node* outer_node = new Node(200, 100, Variant(CALI_TYPE_STRING, "outer", 6));
+    Node* inner_node = new Node(201, 100, Variant(CALI_TYPE_STRING, "inner", 6));
+
+    outer_node->append(inner_node);
+
+    db.add_node(outer_node);
+    db.add_node(inner_node);
+
+    SnapshotTextFormatter format("%[14]str.attr%|%[10]dbl.attr%|%missing.attr%|");
+
+    {
+        std::ostringstream os;
+        format.print(os, db, { Entry(inner_node), Entry(Attribute::make_attribute(dbl_attr), Variant(2.5)) });
+
+        EXPECT_EQ(os.str(), std::string("outer/inner   |  2.500000||"));
+    }
+
+    {
+        std::ostringstream os;
+        format.print(os, db, { });
+
+        EXPECT_EQ(os.str(), std::string("              |          ||"));
+    }
+}
@@ -0,0 +1,65 @@
+#include "caliper/common/util/spinlock.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+util::spinlock_stats s_test_stats("test_spinlock");
+
+}
+
+TEST(SpinlockTest, MutualExclusion) {
+    util::spinlock lock(&s_test_stats);
+    uint64_t       counter = 0;
+
+    const int num_threads = 8;
+    const int num_iter    = 20000;
+
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back([&](){
+                for (int i = 0; i < num_iter; ++i) {
+                    std::lock_guard<util::spinlock>
+                        g(lock);
+
+                    ++counter;
+                }
+            });
+
+    for (std::thread& t : threads)
+        t.join();
+
+    EXPECT_EQ(counter, static_cast<uint64_t>(num_threads * num_iter));
+
+    // contended lock() calls always spin before acquiring the lock
+    EXPECT_LE(s_test_stats.contended.load(), s_test_stats.spins.load());
+}
+
+TEST(SpinlockTest, TryLock) {
+    util::spinlock lock;
+
+    EXPECT_TRUE(lock.try_lock());
+    EXPECT_FALSE(lock.try_lock());
+
+    lock.unlock();
+
+    EXPECT_TRUE(lock.try_lock());
+    lock.unlock();
+}
+
+TEST(SpinlockTest, StatsList) {
+    bool found = false;
+
+    for (util::spinlock_stats* s = util::spinlock_stats::list(); s; s = s->next)
+        if (std::strcmp(s->name, "test_spinlock") == 0)
+            found = true;
+
+    EXPECT_TRUE(found);
+}
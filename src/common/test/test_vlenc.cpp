@@ -0,0 +1,76 @@
+#include "caliper/common/c-util/vlenc.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+std::vector<uint64_t> make_values(size_t n)
+{
+    std::mt19937_64       rng(42);
+    std::vector<uint64_t> vals;
+
+    // mix of all encoded lengths, including 0 and the largest values
+    for (size_t i = 0; i < n; ++i) {
+        unsigned bits = rng() % 65;
+        uint64_t val  = (bits == 64 ? rng() : rng() & ((1ull << bits) - 1));
+
+        vals.push_back(val);
+    }
+
+    vals.push_back(0);
+    vals.push_back(127);
+    vals.push_back(128);
+    vals.push_back((1ull << 56) - 1);
+    vals.push_back(1ull << 56);
+    vals.push_back(UINT64_MAX);
+
+    return vals;
+}
+
+}
+
+TEST(VLEncTest, ArrayEncodingMatchesScalar) {
+    std::vector<uint64_t> vals = make_values(1000);
+
+    std::vector<unsigned char> a(10 * vals.size());
+    std::vector<unsigned char> b(10 * vals.size());
+
+    size_t len_a = vlenc_u64_array(vals.data(), vals.size(), a.data());
+    size_t len_b = 0;
+
+    for (uint64_t v : vals)
+        len_b += vlenc_u64(v, b.data() + len_b);
+
+    ASSERT_EQ(len_a, len_b);
+
+    for (size_t i = 0; i < len_a; ++i)
+        EXPECT_EQ(a[i], b[i]) << "at byte " << i;
+}
+
+TEST(VLEncTest, ArrayDecoding) {
+    std::vector<uint64_t> vals = make_values(1000);
+
+    std::vector<unsigned char> buf(10 * vals.size());
+    size_t len = vlenc_u64_array(vals.data(), vals.size(), buf.data());
+
+    std::vector<uint64_t> out(vals.size());
+
+    EXPECT_EQ(vldec_u64_array(buf.data(), vals.size(), out.data()), len);
+    EXPECT_EQ(out, vals);
+
+    // partial decode
+    size_t pos = 0;
+
+    for (size_t i = 0; i < 10; ++i)
+        vldec_u64(buf.data() + pos, &pos);
+
+    EXPECT_EQ(vldec_u64_array(buf.data(), 10, out.data()), pos);
+
+    for (size_t i = 0; i < 10; ++i)
+        EXPECT_EQ(out[i], vals[i]);
+}
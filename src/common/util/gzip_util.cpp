@@ -0,0 +1,452 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file gzip_util.cpp
+/// Block-parallel gzip compression and decompression
+
+#include "gzip_util.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+
+using namespace util;
+
+namespace
+{
+
+/// Size of the gzip member header written by gzip_compress_member()
+const std::size_t HeaderSize = 20;
+/// Offset of the member size field in the header
+const std::size_t SizeOffset = 16;
+/// Size of the gzip member trailer (CRC32 and uncompressed size)
+const std::size_t TrailerSize = 8;
+
+inline void
+write_le32(unsigned char* p, uint32_t val)
+{
+    for (int i = 0; i < 4; ++i)
+        p[i] = static_cast<unsigned char>((val >> (8*i)) & 0xFF);
+}
+
+inline uint32_t
+read_le32(const unsigned char* p)
+{
+    return   static_cast<uint32_t>(p[0])        | (static_cast<uint32_t>(p[1]) << 8)
+          | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+struct Member {
+    std::size_t in_pos;  ///< Position of the deflate data in the input
+    std::size_t in_len;  ///< Length of the deflate data
+    std::size_t out_pos; ///< Position of the decompressed data in the output
+    std::size_t out_len; ///< Uncompressed size
+    uint32_t    crc;
+};
+
+/// \brief Parse the header of a member written by gzip_compress_member()
+///   at \a p.
+/// \return The member size, 0 if it's not one of our members, or
+///   SIZE_MAX if it is incomplete
+std::size_t
+member_size(const unsigned char* p, std::size_t len)
+{
+    if (len < HeaderSize)
+        return len >= 4 && p[3] == 0x04 ? SIZE_MAX : 0;
+
+    if (p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || p[3] != 0x04 ||
+        p[10] != 8   || p[11] != 0   || p[12] != 'C' || p[13] != 'A' || p[14] != 4 || p[15] != 0)
+        return 0;
+
+    std::size_t size = read_le32(p + SizeOffset);
+
+    if (size < HeaderSize + TrailerSize)
+        return 0;
+
+    return size > len ? SIZE_MAX : size;
+}
+
+bool
+inflate_member(z_stream& zs, const char* in, const Member& m, char* out)
+{
+    if (inflateReset(&zs) != Z_OK)
+        return false;
+
+    zs.next_in   = reinterpret_cast<Bytef*>(const_cast<char*>(in + m.in_pos));
+    zs.avail_in  = static_cast<uInt>(m.in_len);
+    zs.next_out  = reinterpret_cast<Bytef*>(out + m.out_pos);
+    zs.avail_out = static_cast<uInt>(m.out_len);
+
+    if (inflate(&zs, Z_FINISH) != Z_STREAM_END || zs.avail_out != 0)
+        return false;
+
+    return crc32(0, reinterpret_cast<const Bytef*>(out + m.out_pos), static_cast<uInt>(m.out_len)) == m.crc;
+}
+
+bool
+decompress_members(const char* data, const std::vector<Member>& members, char* out, unsigned num_threads)
+{
+    std::atomic<std::size_t> next(0);
+    std::atomic<bool>        ok(true);
+
+    auto fn = [&](){
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+
+        if (inflateInit2(&zs, -15) != Z_OK) {
+            ok = false;
+            return;
+        }
+
+        for (std::size_t i = next++; i < members.size() && ok; i = next++)
+            if (!inflate_member(zs, data, members[i], out))
+                ok = false;
+
+        inflateEnd(&zs);
+    };
+
+    num_threads = std::max(1u, std::min<unsigned>(num_threads, members.size()));
+
+    std::vector<std::thread> threads;
+
+    for (unsigned t = 1; t < num_threads; ++t)
+        threads.emplace_back(fn);
+
+    fn();
+
+    for (auto& t : threads)
+        t.join();
+
+    return ok;
+}
+
+/// \brief Decompress arbitrary (possibly multi-member) gzip data
+///   sequentially and append it to \a out.
+bool
+decompress_sequential(const char* data, std::size_t len, std::vector<char>& out)
+{
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+
+    if (inflateInit2(&zs, 15 + 16) != Z_OK)
+        return false;
+
+    std::size_t complete = out.size(); // output size after the last complete member
+    std::size_t pos      = 0;          // consumed input
+    bool        ok       = true;
+
+    while (true) {
+        if (zs.avail_in == 0) {
+            if (pos >= len)
+                break; // end of input; the last member may be incomplete
+
+            zs.next_in  = reinterpret_cast<Bytef*>(const_cast<char*>(data + pos));
+            zs.avail_in = static_cast<uInt>(std::min<std::size_t>(len - pos, 1 << 30));
+        }
+
+        std::size_t n     = out.size();
+        std::size_t chunk = std::max<std::size_t>(4 * static_cast<std::size_t>(zs.avail_in), 64 * 1024);
+
+        out.resize(n + chunk);
+
+        zs.next_out  = reinterpret_cast<Bytef*>(out.data() + n);
+        zs.avail_out = static_cast<uInt>(chunk);
+
+        uInt avail_in = zs.avail_in;
+        int  ret      = inflate(&zs, Z_NO_FLUSH);
+
+        pos += avail_in - zs.avail_in;
+        out.resize(n + chunk - zs.avail_out);
+
+        if (ret == Z_STREAM_END) {
+            complete = out.size();
+
+            // continue with the next member, if there is one
+            if (pos >= len || !is_gzip(data + pos, len - pos) || inflateReset(&zs) != Z_OK)
+                break;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            ok = false;
+            break;
+        }
+    }
+
+    inflateEnd(&zs);
+    out.resize(complete);
+
+    return ok;
+}
+
+} // namespace [anonymous]
+
+
+bool
+util::gzip_compress_member(const char* data, std::size_t len, std::vector<char>& out, int level)
+{
+    if (len > UINT_MAX / 2)
+        return false;
+
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+
+    if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    std::size_t start = out.size();
+    std::size_t bound = deflateBound(&zs, len);
+
+    out.resize(start + HeaderSize + bound + TrailerSize);
+
+    unsigned char* p = reinterpret_cast<unsigned char*>(out.data() + start);
+
+    const unsigned char header[HeaderSize] = {
+        0x1f, 0x8b, 8, 0x04, // magic, deflate, FEXTRA flag
+        0, 0, 0, 0,          // mtime
+        0, 0xff,             // extra flags, OS (unknown)
+        8, 0,                // extra field length
+        'C', 'A', 4, 0,      // subfield ID and length
+        0, 0, 0, 0           // member size (set below)
+    };
+
+    std::memcpy(p, header, HeaderSize);
+
+    zs.next_in   = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    zs.avail_in  = static_cast<uInt>(len);
+    zs.next_out  = p + HeaderSize;
+    zs.avail_out = static_cast<uInt>(bound);
+
+    int ret = deflate(&zs, Z_FINISH);
+    std::size_t clen = zs.total_out;
+
+    deflateEnd(&zs);
+
+    if (ret != Z_STREAM_END) {
+        out.resize(start);
+        return false;
+    }
+
+    std::size_t size = HeaderSize + clen + TrailerSize;
+
+    write_le32(p + SizeOffset, static_cast<uint32_t>(size));
+    write_le32(p + HeaderSize + clen, static_cast<uint32_t>(crc32(0, reinterpret_cast<const Bytef*>(data), static_cast<uInt>(len))));
+    write_le32(p + HeaderSize + clen + 4, static_cast<uint32_t>(len));
+
+    out.resize(start + size);
+
+    return true;
+}
+
+bool
+util::gzip_decompress(const char* data, std::size_t len, std::vector<char>& out, unsigned num_threads)
+{
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+
+    std::vector<Member> members;
+    std::size_t pos   = 0;
+    std::size_t total = 0;
+
+    // Find our own members first: their headers tell us where they end
+
+    while (pos < len) {
+        std::size_t size = member_size(p + pos, len - pos);
+
+        if (size == 0 || size == SIZE_MAX)
+            break;
+
+        Member m;
+
+        m.in_pos  = pos + HeaderSize;
+        m.in_len  = size - HeaderSize - TrailerSize;
+        m.out_pos = total;
+        m.out_len = read_le32(p + pos + size - 4);
+        m.crc     = read_le32(p + pos + size - 8);
+
+        members.push_back(m);
+
+        total += m.out_len;
+        pos   += size;
+    }
+
+    out.clear();
+    out.resize(total);
+
+    if (!members.empty() && !decompress_members(data, members, out.data(), num_threads))
+        return false;
+
+    // The rest is either an incomplete member of ours, or foreign gzip data
+
+    if (pos < len && member_size(p + pos, len - pos) != SIZE_MAX)
+        return decompress_sequential(data + pos, len - pos, out);
+
+    return true;
+}
+
+
+GzipStreambuf::GzipStreambuf(std::ostream& target, unsigned num_threads, std::size_t block_size)
+    : m_target(target),
+      m_block_size(std::max<std::size_t>(block_size, 1024)),
+      m_max_jobs(2 * std::max(num_threads, 1u)),
+      m_next_seq(0),
+      m_next_write(0),
+      m_stop(false),
+      m_error(false)
+{
+    m_buffer.resize(m_block_size);
+    setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+
+    for (unsigned t = 0; t < std::max(num_threads, 1u); ++t)
+        m_workers.emplace_back(&GzipStreambuf::worker_loop, this);
+}
+
+GzipStreambuf::~GzipStreambuf()
+{
+    flush();
+
+    {
+        std::lock_guard<std::mutex> g(m_lock);
+        m_stop = true;
+    }
+
+    m_job_cv.notify_all();
+
+    for (auto& t : m_workers)
+        t.join();
+}
+
+void
+GzipStreambuf::worker_loop()
+{
+    std::unique_lock<std::mutex> g(m_lock);
+
+    while (true) {
+        m_job_cv.wait(g, [this](){ return m_stop || !m_jobs.empty(); });
+
+        if (m_jobs.empty())
+            break; // stopped
+
+        Job job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+
+        g.unlock();
+
+        std::vector<char> out;
+        bool ok = gzip_compress_member(job.data.data(), job.data.size(), out);
+
+        g.lock();
+
+        // write blocks in order; only one worker writes at a time
+        m_write_cv.wait(g, [this,&job](){ return m_next_write == job.seq; });
+
+        g.unlock();
+
+        if (ok)
+            m_target.write(out.data(), out.size());
+
+        g.lock();
+
+        if (!ok || !m_target)
+            m_error = true;
+
+        ++m_next_write;
+
+        job.data.clear();
+        m_free.push_back(std::move(job.data));
+
+        m_write_cv.notify_all();
+    }
+}
+
+void
+GzipStreambuf::handoff()
+{
+    std::size_t len = pptr() - pbase();
+
+    if (len == 0)
+        return;
+
+    std::unique_lock<std::mutex> g(m_lock);
+
+    // block while too many blocks are in flight
+    m_write_cv.wait(g, [this](){ return m_next_seq - m_next_write < m_max_jobs; });
+
+    m_buffer.resize(len);
+    m_jobs.push_back(Job { m_next_seq++, std::move(m_buffer) });
+
+    if (m_free.empty()) {
+        m_buffer = std::vector<char>();
+    } else {
+        m_buffer = std::move(m_free.back());
+        m_free.pop_back();
+    }
+
+    g.unlock();
+
+    m_job_cv.notify_one();
+
+    m_buffer.resize(m_block_size);
+    setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+}
+
+GzipStreambuf::int_type
+GzipStreambuf::overflow(int_type ch)
+{
+    handoff();
+
+    if (traits_type::eq_int_type(ch, traits_type::eof()))
+        return traits_type::not_eof(ch);
+
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+
+    return ch;
+}
+
+int
+GzipStreambuf::sync()
+{
+    return flush() ? 0 : -1;
+}
+
+bool
+GzipStreambuf::flush()
+{
+    handoff();
+
+    std::unique_lock<std::mutex> g(m_lock);
+
+    m_write_cv.wait(g, [this](){ return m_next_write == m_next_seq; });
+    m_target.flush();
+
+    return !m_error;
+}
@@ -0,0 +1,132 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file gzip_util.h
+/// Block-parallel gzip compression and decompression
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+namespace util
+{
+
+/// \brief Check for the gzip magic number at the start of \a data
+inline bool
+is_gzip(const char* data, std::size_t len)
+{
+    return len >= 2 &&
+        static_cast<unsigned char>(data[0]) == 0x1f &&
+        static_cast<unsigned char>(data[1]) == 0x8b;
+}
+
+/// \brief Compress \a len bytes from \a data into a single gzip member,
+///   and append it to \a out.
+///
+/// The gzip header contains the size of the member in an extra field
+/// (subfield ID "CA"), so that readers can find member boundaries
+/// without decompressing.
+bool
+gzip_compress_member(const char* data, std::size_t len, std::vector<char>& out, int level = 6);
+
+/// \brief Decompress the gzip data in \a data into \a out.
+///
+/// Members written by gzip_compress_member() are decompressed in
+/// parallel with up to \a num_threads threads; other gzip data is
+/// decompressed sequentially. An incomplete member at the end of the
+/// input (e.g., in a file that is still being written) is ignored.
+/// \return false if the data is corrupt
+bool
+gzip_decompress(const char* data, std::size_t len, std::vector<char>& out, unsigned num_threads);
+
+/// \brief A stream buffer that writes gzip-compressed data to a target
+///   stream.
+///
+/// Output is split into blocks, which are compressed into independent
+/// gzip members by a pool of worker threads and written to the target
+/// in their original order. sync() (i.e., flushing the stream) waits
+/// until all data written so far has reached the target.
+class GzipStreambuf : public std::streambuf
+{
+    struct Job {
+        uint64_t          seq;
+        std::vector<char> data;
+    };
+
+    std::ostream&           m_target;
+    std::size_t             m_block_size;
+    std::size_t             m_max_jobs;
+
+    std::vector<char>       m_buffer;
+    std::deque<Job>         m_jobs;
+    std::vector< std::vector<char> >
+                            m_free;
+
+    uint64_t                m_next_seq;
+    uint64_t                m_next_write;
+    bool                    m_stop;
+    bool                    m_error;
+
+    std::mutex              m_lock;
+    std::condition_variable m_job_cv;
+    std::condition_variable m_write_cv;
+
+    std::vector<std::thread> m_workers;
+
+    void worker_loop();
+    void handoff();
+
+protected:
+
+    int_type overflow(int_type ch) override;
+    int      sync() override;
+
+public:
+
+    GzipStreambuf(std::ostream& target, unsigned num_threads = 2, std::size_t block_size = 1024*1024);
+
+    ~GzipStreambuf();
+
+    /// \brief Compress and write all pending output.
+    /// \return false if compression failed
+    bool     flush();
+};
+
+} // namespace util
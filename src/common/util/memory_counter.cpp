@@ -0,0 +1,100 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file memory_counter.cpp
+/// Memory usage counter list
+
+#include "caliper/common/util/memory_counter.hpp"
+
+#include <cstring>
+
+namespace
+{
+
+std::atomic<util::memory_counter*> s_counter_list { nullptr };
+std::atomic<int>                   s_num_threads  { 0 };
+
+}
+
+using namespace util;
+
+const int memory_counter::ProcessWide;
+
+memory_counter::memory_counter(const char* n, int thr)
+    : name(n), thread(thr), reserved(0), used(0), active(true), next(nullptr)
+{
+    memory_counter* head = s_counter_list.load();
+
+    do {
+        next = head;
+    } while (!s_counter_list.compare_exchange_weak(head, this));
+}
+
+void
+memory_counter::release()
+{
+    set(0, 0);
+    active.store(false);
+}
+
+memory_counter*
+memory_counter::acquire(const char* name, int thr)
+{
+    for (memory_counter* c = s_counter_list.load(); c; c = c->next) {
+        bool expect = false;
+
+        if (std::strcmp(c->name, name) == 0 && c->active.compare_exchange_strong(expect, true)) {
+            c->thread.store(thr);
+            return c;
+        }
+    }
+
+    // counters are never freed
+    return new memory_counter(name, thr);
+}
+
+memory_counter*
+memory_counter::list()
+{
+    return s_counter_list.load();
+}
+
+int
+memory_counter::thread_id()
+{
+    static thread_local int t_id = -1;
+
+    if (t_id < 0)
+        t_id = s_num_threads.fetch_add(1);
+
+    return t_id;
+}
@@ -0,0 +1,293 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file number_util.cpp
+/// Locale-independent number parsing and formatting
+
+#include "number_util.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+
+const double pow10_table[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+} // namespace [anonymous]
+
+namespace util
+{
+
+size_t
+format_uint(uint64_t val, char* buf)
+{
+    char   tmp[20];
+    size_t n = 0;
+
+    do {
+        tmp[n++] = '0' + static_cast<char>(val % 10);
+        val /= 10;
+    } while (val);
+
+    for (size_t i = 0; i < n; ++i)
+        buf[i] = tmp[n-1-i];
+
+    return n;
+}
+
+size_t
+format_int(int64_t val, char* buf)
+{
+    if (val < 0) {
+        buf[0] = '-';
+        return 1 + format_uint(UINT64_C(0) - static_cast<uint64_t>(val), buf+1);
+    }
+
+    return format_uint(static_cast<uint64_t>(val), buf);
+}
+
+size_t
+format_hex(uint64_t val, char* buf)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    char   tmp[16];
+    size_t n = 0;
+
+    do {
+        tmp[n++] = digits[val & 0xF];
+        val >>= 4;
+    } while (val);
+
+    for (size_t i = 0; i < n; ++i)
+        buf[i] = tmp[n-1-i];
+
+    return n;
+}
+
+int
+format_double(double val, char* buf, size_t size)
+{
+#ifdef __SIZEOF_INT128__
+    // sign + 19 integer digits + '.' + 6 decimals
+    if (size > 27 && std::isfinite(val) && std::fabs(val) < 9.2e18) {
+        // val = m * 2^e exactly; round m * 2^e * 10^6 to an integer q,
+        // then q / 10^6 are the integer digits and q % 10^6 the decimals.
+
+        int      e = 0;
+        uint64_t m = static_cast<uint64_t>(std::ldexp(std::frexp(std::fabs(val), &e), 53));
+
+        e -= 53;
+
+        unsigned __int128 q = static_cast<unsigned __int128>(m) * 1000000u;
+
+        if (e >= 0) {
+            q <<= e;
+        } else if (e > -100) {
+            unsigned __int128 r    = q & ((static_cast<unsigned __int128>(1) << -e) - 1);
+            unsigned __int128 half = static_cast<unsigned __int128>(1) << (-e - 1);
+
+            q >>= -e;
+
+            // round half to even, like printf
+            if (r > half || (r == half && (q & 1)))
+                ++q;
+        } else {
+            q = 0;
+        }
+
+        size_t n = 0;
+
+        if (std::signbit(val))
+            buf[n++] = '-';
+
+        n += format_uint(static_cast<uint64_t>(q / 1000000u), buf+n);
+        buf[n++] = '.';
+
+        uint64_t frac = static_cast<uint64_t>(q % 1000000u);
+
+        for (int i = 5; i >= 0; --i, frac /= 10)
+            buf[n+i] = '0' + static_cast<char>(frac % 10);
+
+        n += 6;
+        buf[n] = '\0';
+
+        return static_cast<int>(n);
+    }
+#endif
+
+    return snprintf(buf, size, "%f", val);
+}
+
+bool
+parse_int(const char* str, size_t len, int64_t& val)
+{
+    bool neg = false;
+    size_t p = 0;
+
+    if (p < len && (str[p] == '-' || str[p] == '+'))
+        neg = (str[p++] == '-');
+
+    uint64_t u = 0;
+
+    if (!parse_uint(str+p, len-p, u))
+        return false;
+    if (u > (neg ? UINT64_C(0x8000000000000000) : UINT64_C(0x7FFFFFFFFFFFFFFF)))
+        return false;
+
+    val = neg ? static_cast<int64_t>(UINT64_C(0) - u) : static_cast<int64_t>(u);
+
+    return true;
+}
+
+bool
+parse_uint(const char* str, size_t len, uint64_t& val, int base)
+{
+    if (len == 0 || (base != 10 && base != 16))
+        return false;
+
+    uint64_t u = 0;
+    uint64_t limit = UINT64_MAX / static_cast<uint64_t>(base);
+
+    for (size_t p = 0; p < len; ++p) {
+        int d = hex_digit(str[p]);
+
+        if (d < 0 || d >= base || u > limit)
+            return false;
+
+        u *= static_cast<uint64_t>(base);
+
+        if (u > UINT64_MAX - static_cast<uint64_t>(d))
+            return false;
+
+        u += static_cast<uint64_t>(d);
+    }
+
+    val = u;
+
+    return true;
+}
+
+bool
+parse_double(const char* str, size_t len, double& val)
+{
+    size_t p   = 0;
+    bool   neg = false;
+
+    if (p < len && (str[p] == '-' || str[p] == '+'))
+        neg = (str[p++] == '-');
+
+    uint64_t mantissa = 0;
+    int      ndigits  = 0; // significant digits in mantissa
+    int      exp10    = 0;
+    bool     any      = false;
+
+    for ( ; p < len && str[p] >= '0' && str[p] <= '9'; ++p, any = true)
+        if (mantissa > 0 || str[p] != '0') {
+            if (++ndigits > 19)
+                return false;
+
+            mantissa = 10 * mantissa + static_cast<uint64_t>(str[p] - '0');
+        }
+
+    if (p < len && str[p] == '.')
+        for (++p; p < len && str[p] >= '0' && str[p] <= '9'; ++p, any = true) {
+            if (mantissa > 0 || str[p] != '0') {
+                if (++ndigits > 19)
+                    return false;
+
+                mantissa = 10 * mantissa + static_cast<uint64_t>(str[p] - '0');
+            }
+
+            --exp10;
+        }
+
+    if (!any)
+        return false;
+
+    if (p < len && (str[p] == 'e' || str[p] == 'E')) {
+        bool eneg = false;
+        int  e    = 0;
+
+        ++p;
+
+        if (p < len && (str[p] == '-' || str[p] == '+'))
+            eneg = (str[p++] == '-');
+        if (p == len)
+            return false;
+
+        for ( ; p < len && str[p] >= '0' && str[p] <= '9'; ++p)
+            if ((e = 10 * e + (str[p] - '0')) > 1000)
+                return false;
+
+        exp10 += eneg ? -e : e;
+    }
+
+    if (p != len)
+        return false;
+
+    double d = 0.0;
+
+    // Both the mantissa and the power of ten are exact doubles here,
+    // so a single multiplication or division rounds correctly.
+
+    if (mantissa != 0) {
+        if (mantissa > (UINT64_C(1) << 53) || exp10 < -22 || exp10 > 22)
+            return false;
+
+        d = static_cast<double>(mantissa);
+        d = exp10 < 0 ? d / pow10_table[-exp10] : d * pow10_table[exp10];
+    }
+
+    val = neg ? -d : d;
+
+    return true;
+}
+
+} // namespace util
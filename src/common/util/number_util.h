@@ -0,0 +1,91 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file number_util.h
+/// Locale-independent number parsing and formatting on caller-provided buffers
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace util
+{
+
+/// \brief Write the decimal representation of \a val to \a buf, which must
+///   hold at least 20 characters. Returns the number of characters written.
+///   The output is not null-terminated.
+size_t
+format_uint(uint64_t val, char* buf);
+
+/// \brief Write the decimal representation of \a val to \a buf, which must
+///   hold at least 21 characters. Returns the number of characters written.
+size_t
+format_int(int64_t val, char* buf);
+
+/// \brief Write the lower-case hexadecimal representation of \a val
+///   to \a buf, which must hold at least 16 characters.
+size_t
+format_hex(uint64_t val, char* buf);
+
+/// \brief Write \a val to \a buf in the same format as printf("%f"),
+///   with the same return value semantics as snprintf().
+///
+/// Values below 2^63 are converted exactly with integer arithmetic; others
+/// go through snprintf().
+int
+format_double(double val, char* buf, size_t size);
+
+/// \brief Parse the decimal integer in [\a str, \a str + \a len) into \a val.
+///
+/// The parse functions only accept spans that consist entirely of a
+/// plain number in range and return false otherwise. Callers then fall
+/// back to the (more lenient) standard library conversions.
+bool
+parse_int(const char* str, size_t len, int64_t& val);
+
+/// \brief Parse the unsigned integer in [\a str, \a str + \a len) with
+///   base 10 or 16 into \a val.
+bool
+parse_uint(const char* str, size_t len, uint64_t& val, int base = 10);
+
+/// \brief Parse the decimal floating-point number in [\a str, \a str + \a len)
+///   into \a val.
+///
+/// Numbers with up to 19 significant digits whose decimal exponent is
+/// small enough for an exact power of ten (which includes all printf("%f")
+/// output up to 2^53) are converted directly with correct rounding.
+/// Returns false for other input.
+bool
+parse_double(const char* str, size_t len, double& val);
+
+} // namespace util
@@ -35,6 +35,13 @@
 
 #pragma once
 
+#include "caliper/common/Variant.h"
+
+#include "number_util.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <string>
 
@@ -46,16 +53,17 @@ namespace util
 inline std::ostream&
 write_esc_string(std::ostream& os, const char* str, std::string::size_type size, const char* mask_chars = "\\\"", char esc = '\\')
 {
-    for (size_t i = 0; i < size; ++i) {
-        for (const char* p = mask_chars; *p; ++p)
-            if (str[i] == *p) {
-                os << esc;
-                break;
-            }
-        
-        os << str[i];
-    }
-    
+    size_t run = 0; // start of the current run of unescaped characters
+
+    for (size_t i = 0; i < size; ++i)
+        if (strchr(mask_chars, str[i]) && str[i] != '\0') {
+            os.write(str + run, i - run);
+            os.put(esc);
+            run = i;
+        }
+
+    os.write(str + run, size - run);
+
     return os;
 }
 
@@ -65,4 +73,147 @@ write_esc_string(std::ostream& os, const std::string& str, const char* mask_char
     return write_esc_string(os, str.data(), str.size(), mask_chars, esc);
 }
 
+/// \brief Growable character buffer for building output text.
+///
+/// Text is appended in place without going through ostream insertion.
+/// clear() keeps the allocated capacity, so a buffer that is re-used
+/// across records stops allocating once it has reached its working
+/// size.
+class WriteBuffer
+{
+    std::string m_buf;
+
+public:
+
+    WriteBuffer(std::string::size_type reserve = 4096) {
+        m_buf.reserve(reserve);
+    }
+
+    void clear() { m_buf.clear(); }
+
+    bool empty() const { return m_buf.empty(); }
+
+    std::string::size_type size() const { return m_buf.size(); }
+
+    const char* data() const { return m_buf.data(); }
+
+    WriteBuffer& append(char c) {
+        m_buf.push_back(c);
+        return *this;
+    }
+
+    WriteBuffer& append(const char* str, std::string::size_type size) {
+        m_buf.append(str, size);
+        return *this;
+    }
+
+    WriteBuffer& append(const char* str) {
+        return append(str, strlen(str));
+    }
+
+    WriteBuffer& append(const std::string& str) {
+        return append(str.data(), str.size());
+    }
+
+    WriteBuffer& append(const WriteBuffer& other) {
+        return append(other.data(), other.size());
+    }
+
+    /// \brief Append \a str, escaping all characters in \a mask_chars with \a esc.
+    WriteBuffer& append_esc(const char* str, std::string::size_type size, const char* mask_chars = "\\\"", char esc = '\\') {
+        for (std::string::size_type i = 0; i < size; ++i) {
+            if (strchr(mask_chars, str[i]) && str[i] != '\0')
+                m_buf.push_back(esc);
+
+            m_buf.push_back(str[i]);
+        }
+
+        return *this;
+    }
+
+    WriteBuffer& append_esc(const std::string& str, const char* mask_chars = "\\\"", char esc = '\\') {
+        return append_esc(str.data(), str.size(), mask_chars, esc);
+    }
+
+    WriteBuffer& append_uint(unsigned long long val) {
+        char tmp[24];
+        int  n = 0;
+
+        do {
+            tmp[n++] = '0' + static_cast<char>(val % 10);
+            val /= 10;
+        } while (val);
+
+        while (n > 0)
+            m_buf.push_back(tmp[--n]);
+
+        return *this;
+    }
+
+    WriteBuffer& append_int(long long val) {
+        if (val < 0) {
+            m_buf.push_back('-');
+            return append_uint(0ULL - static_cast<unsigned long long>(val));
+        }
+
+        return append_uint(static_cast<unsigned long long>(val));
+    }
+
+    /// \brief Append the string representation of \a val.
+    ///
+    /// Produces the same text as cali::Variant::to_string(), but writes
+    /// the common types without creating a temporary string.
+    /// String values are escaped if \a esc is set.
+    WriteBuffer& append_variant(const cali::Variant& val, bool esc = false) {
+        switch (val.type()) {
+        case CALI_TYPE_INV:
+            break;
+        case CALI_TYPE_INT:
+            append_int(val.to_int());
+            break;
+        case CALI_TYPE_UINT:
+            append_uint(val.to_uint());
+            break;
+        case CALI_TYPE_STRING:
+        {
+            const char* str = static_cast<const char*>(val.data());
+            std::string::size_type len = val.size();
+
+            if (len && str[len-1] == 0)
+                --len;
+
+            if (esc)
+                append_esc(str, len);
+            else
+                append(str, len);
+        }
+            break;
+        case CALI_TYPE_DOUBLE:
+        {
+            // same format as std::to_string(double)
+            char tmp[352];
+            int  n = util::format_double(val.to_double(), tmp, sizeof(tmp));
+
+            if (n > 0)
+                append(tmp, std::min<std::string::size_type>(n, sizeof(tmp)-1));
+        }
+            break;
+        case CALI_TYPE_BOOL:
+            append(val.to_bool() ? "true" : "false");
+            break;
+        default:
+            if (esc)
+                append_esc(val.to_string());
+            else
+                append(val.to_string());
+        }
+
+        return *this;
+    }
+
+    std::ostream& write_to(std::ostream& os) const {
+        return os.write(m_buf.data(), m_buf.size());
+    }
+};
+
 } // namespace util
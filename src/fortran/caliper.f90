@@ -285,6 +285,85 @@ contains
   end subroutine cali_end
 
   
+  !
+  ! --- Region handles
+  !
+
+  ! cali_make_region_handle
+  subroutine cali_make_region_handle(attr_name, val, handle)
+    use, intrinsic :: iso_c_binding, only : C_NULL_CHAR
+    implicit none
+
+    character(len=*),  intent(in)  :: attr_name
+    character(len=*),  intent(in)  :: val
+    integer,           intent(out) :: handle
+
+    ! int cali_make_region_handle(const char* attr_name, const char* value);
+    interface
+       integer(kind=C_INT) function cali_make_region_handle_c (attr_name, val) &
+            bind(C, name='cali_make_region_handle')
+         use, intrinsic :: iso_c_binding, only : C_CHAR, C_INT
+         character(kind=C_CHAR), intent(in) :: attr_name(*)
+         character(kind=C_CHAR), intent(in) :: val(*)
+       end function cali_make_region_handle_c
+    end interface
+
+    handle = cali_make_region_handle_c( trim(attr_name)//C_NULL_CHAR, &
+         trim(val)//C_NULL_CHAR )
+  end subroutine cali_make_region_handle
+
+  ! cali_begin_region_handle
+  subroutine cali_begin_region_handle(handle, err)
+    use, intrinsic :: iso_c_binding, only : C_INT
+    implicit none
+
+    integer,                     intent(in) :: handle
+    integer(kind(CALI_SUCCESS)), intent(out), optional :: err
+
+    integer(kind(CALI_SUCCESS))             :: err_
+
+    ! cali_err cali_begin_region_handle(int handle);
+    interface
+       integer(kind=C_INT) function cali_begin_region_handle_c (handle) &
+            bind(C, name='cali_begin_region_handle')
+         use, intrinsic :: iso_c_binding, only : C_INT
+         integer(kind=C_INT), intent(in), value :: handle
+       end function cali_begin_region_handle_c
+    end interface
+
+    err_ = cali_begin_region_handle_c(handle)
+
+    if (present(err)) then
+       err = err_
+    end if
+  end subroutine cali_begin_region_handle
+
+  ! cali_end_region_handle
+  subroutine cali_end_region_handle(handle, err)
+    use, intrinsic :: iso_c_binding, only : C_INT
+    implicit none
+
+    integer,                     intent(in) :: handle
+    integer(kind(CALI_SUCCESS)), intent(out), optional :: err
+
+    integer(kind(CALI_SUCCESS))             :: err_
+
+    ! cali_err cali_end_region_handle(int handle);
+    interface
+       integer(kind=C_INT) function cali_end_region_handle_c (handle) &
+            bind(C, name='cali_end_region_handle')
+         use, intrinsic :: iso_c_binding, only : C_INT
+         integer(kind=C_INT), intent(in), value :: handle
+       end function cali_end_region_handle_c
+    end interface
+
+    err_ = cali_end_region_handle_c(handle)
+
+    if (present(err)) then
+       err = err_
+    end if
+  end subroutine cali_end_region_handle
+
   !
   ! --- _byname "overloads"
   !
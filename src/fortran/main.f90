@@ -6,6 +6,7 @@ program testf03
   integer                    :: cali_ret
   integer(kind(CALI_INV_ID)) :: iter_attr
   integer                    :: i, count
+  integer                    :: work_region
 
   ! Mark "initialization" phase
   call cali_begin_byname('initialization')
@@ -20,6 +21,9 @@ program testf03
      call cali_create_attribute('iteration', CALI_TYPE_INT, &
           CALI_ATTR_ASVALUE, iter_attr)
 
+     ! register a handle for the "work" region once, outside of the loop
+     call cali_make_region_handle('annotation', 'work', work_region)
+
      do i = 1,count
         ! Update iteration counter attribute
         call cali_set_int(iter_attr, i)
@@ -27,7 +31,10 @@ program testf03
         ! A Caliper snapshot taken at this point will contain
         ! { "loop", "iteration"=<i> } 
         
-        ! perform calculation
+        ! perform calculation in the "work" region: handle-based
+        ! annotations don't convert strings or look up names per call
+        call cali_begin_region_handle(work_region)
+        call cali_end_region_handle(work_region)
      end do
 
      ! Clear the iteration counter attribute (otherwise, snapshots taken
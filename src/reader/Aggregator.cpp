@@ -38,30 +38,119 @@
 
 #include "caliper/common/Attribute.h"
 #include "caliper/common/CaliperMetadataAccessInterface.h"
+#include "caliper/common/CompressedSnapshotRecord.h"
+#include "caliper/common/HyperLogLog.h"
 #include "caliper/common/Log.h"
 #include "caliper/common/Node.h"
 
 #include "caliper/common/cali_types.h"
 
-#include "caliper/common/c-util/vlenc.h"
-
 #include "caliper/common/util/split.hpp"
 
 #include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <iostream>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
 #include <iterator>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
+
+#include <pthread.h>
+#include <unistd.h>
 
 using namespace cali;
 using namespace std;
 
-#define MAX_KEYLEN 32
-
 namespace
 {
 
+/// \brief Per-thread list of (aggregator serial, shard) pairs
+typedef std::vector< std::pair<uint64_t, void*> > ThreadShardList;
+
+pthread_key_t  s_thread_shard_list_key;
+std::once_flag s_thread_shard_list_once;
+
+void delete_thread_shard_list(void* ptr)
+{
+    delete static_cast<ThreadShardList*>(ptr);
+}
+
+/// \brief Get the calling thread's shard list.
+///
+/// The list is a heap object released by a pthread key destructor at thread
+/// exit rather than a thread_local vector: the main thread's thread_local
+/// objects are already destroyed when exit handlers run a final flush.
+ThreadShardList* get_thread_shard_list()
+{
+    thread_local ThreadShardList* t_list = nullptr;
+
+    if (!t_list) {
+        std::call_once(s_thread_shard_list_once, [](){
+                pthread_key_create(&s_thread_shard_list_key, delete_thread_shard_list);
+            });
+
+        t_list = new ThreadShardList;
+        pthread_setspecific(s_thread_shard_list_key, t_list);
+    }
+
+    return t_list;
+}
+
+//
+// --- Batch reductions
+//
+
+// Plain loops with independent partial results, so that the compiler
+// can vectorize them
+
+template<typename T>
+T batch_sum(const T* v, size_t n)
+{
+    T s[4] = { 0, 0, 0, 0 };
+    size_t i = 0;
+
+    for ( ; i + 4 <= n; i += 4) {
+        s[0] += v[i];
+        s[1] += v[i+1];
+        s[2] += v[i+2];
+        s[3] += v[i+3];
+    }
+    for ( ; i < n; ++i)
+        s[0] += v[i];
+
+    return (s[0] + s[1]) + (s[2] + s[3]);
+}
+
+template<typename T>
+void batch_minmax(const T* v, size_t n, T& min, T& max)
+{
+    T lo = min;
+    T hi = max;
+
+    for (size_t i = 0; i < n; ++i) {
+        lo = v[i] < lo ? v[i] : lo;
+        hi = v[i] > hi ? v[i] : hi;
+    }
+
+    min = lo;
+    max = hi;
+}
+
+/// \brief The records of an input batch, grouped by aggregation key
+struct AggregateBatch {
+    const EntryList* lists;       ///< Entry lists of the records, by record index
+    const size_t*    order;       ///< Record indices, grouped by key
+    const size_t*    group_begin; ///< Start of group g in \a order; group_begin[num_groups] is the end
+    size_t           num_groups;
+};
+
 class AggregateKernel {
 public:
 
@@ -70,6 +159,10 @@ public:
     
     virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) = 0;
     virtual void append_result(CaliperMetadataAccessInterface& db, EntryList& list) = 0;
+
+    /// \brief Merge partial result of \a other into this kernel.
+    ///   \a other must have been created from the same config.
+    virtual void merge(AggregateKernel* other) = 0;
 };
 
 class AggregateKernelConfig
@@ -79,7 +172,20 @@ public:
     virtual ~AggregateKernelConfig()
         { }
 
-    virtual AggregateKernel* make_kernel() = 0;
+    /// \brief Size of the kernel objects this config creates
+    virtual size_t           kernel_size() const = 0;
+    /// \brief Construct a kernel in \a mem, which holds kernel_size() bytes
+    virtual AggregateKernel* make_kernel(void* mem) = 0;
+
+    /// \brief Aggregate a batch of records. \a kernels holds this
+    ///   config's kernel for each group in \a batch.
+    ///
+    /// The default implementation calls aggregate() for each record.
+    virtual void aggregate_batch(CaliperMetadataAccessInterface& db, const AggregateBatch& batch, AggregateKernel* const kernels[]) {
+        for (size_t g = 0; g < batch.num_groups; ++g)
+            for (size_t i = batch.group_begin[g]; i < batch.group_begin[g+1]; ++i)
+                kernels[g]->aggregate(db, batch.lists[batch.order[i]]);
+    }
 };
 
 
@@ -102,8 +208,34 @@ public:
             return m_attr;
         }        
         
-        AggregateKernel* make_kernel() {
-            return new CountKernel(this);
+        size_t kernel_size() const {
+            return sizeof(CountKernel);
+        }
+
+        AggregateKernel* make_kernel(void* mem) {
+            return new (mem) CountKernel(this);
+        }
+
+        void aggregate_batch(CaliperMetadataAccessInterface& db, const AggregateBatch& batch, AggregateKernel* const kernels[]) {
+            cali_id_t count_attr_id = attribute(db).id();
+
+            for (size_t g = 0; g < batch.num_groups; ++g) {
+                uint64_t count = 0;
+
+                for (size_t i = batch.group_begin[g]; i < batch.group_begin[g+1]; ++i) {
+                    uint64_t c = 1;
+
+                    for (const Entry& e : batch.lists[batch.order[i]])
+                        if (e.attribute() == count_attr_id) {
+                            c = e.value().to_uint();
+                            break;
+                        }
+
+                    count += c;
+                }
+
+                static_cast<CountKernel*>(kernels[g])->m_count += count;
+            }
         }
 
         Config()
@@ -132,16 +264,20 @@ public:
     }
 
     virtual void append_result(CaliperMetadataAccessInterface& db, EntryList& list) {
-        uint64_t count = m_count.load();
+        uint64_t count = m_count;
         
         if (count > 0)
             list.push_back(Entry(m_config->attribute(db),
                                  Variant(CALI_TYPE_UINT, &count, sizeof(uint64_t))));
     }
 
+    virtual void merge(AggregateKernel* other) {
+        m_count += static_cast<CountKernel*>(other)->m_count;
+    }
+
 private:
 
-    std::atomic<uint64_t> m_count;
+    uint64_t m_count;
     Config*  m_config;
 };
 
@@ -166,8 +302,74 @@ public:
             return m_aggr_attr;
         }
         
-        AggregateKernel* make_kernel() {
-            return new SumKernel(this);
+        size_t kernel_size() const {
+            return sizeof(SumKernel);
+        }
+
+        AggregateKernel* make_kernel(void* mem) {
+            return new (mem) SumKernel(this);
+        }
+
+        void aggregate_batch(CaliperMetadataAccessInterface& db, const AggregateBatch& batch, AggregateKernel* const kernels[]) {
+            Attribute aggr_attr = get_aggr_attr(db);
+
+            if (aggr_attr == Attribute::invalid)
+                return;
+
+            cali_attr_type type = aggr_attr.type();
+
+            if (type != CALI_TYPE_DOUBLE && type != CALI_TYPE_INT && type != CALI_TYPE_UINT) {
+                AggregateKernelConfig::aggregate_batch(db, batch, kernels);
+                return;
+            }
+
+            cali_id_t id = aggr_attr.id();
+
+            std::vector<double>   dv;
+            std::vector<int64_t>  iv;
+            std::vector<uint64_t> uv;
+
+            for (size_t g = 0; g < batch.num_groups; ++g) {
+                dv.clear();
+                iv.clear();
+                uv.clear();
+
+                for (size_t i = batch.group_begin[g]; i < batch.group_begin[g+1]; ++i)
+                    for (const Entry& e : batch.lists[batch.order[i]])
+                        if (e.attribute() == id) {
+                            switch (type) {
+                            case CALI_TYPE_DOUBLE:
+                                dv.push_back(e.value().to_double());
+                                break;
+                            case CALI_TYPE_INT:
+                                iv.push_back(e.value().to_int());
+                                break;
+                            default:
+                                uv.push_back(e.value().to_uint());
+                            }
+
+                            break;
+                        }
+
+                SumKernel* k = static_cast<SumKernel*>(kernels[g]);
+
+                switch (type) {
+                case CALI_TYPE_DOUBLE:
+                    if (!dv.empty())
+                        k->m_sum = Variant(k->m_sum.to_double() + batch_sum(dv.data(), dv.size()));
+                    k->m_count += dv.size();
+                    break;
+                case CALI_TYPE_INT:
+                    if (!iv.empty())
+                        k->m_sum = Variant(static_cast<int>(k->m_sum.to_int() + batch_sum(iv.data(), iv.size())));
+                    k->m_count += iv.size();
+                    break;
+                default:
+                    if (!uv.empty())
+                        k->m_sum = Variant(k->m_sum.to_uint() + batch_sum(uv.data(), uv.size()));
+                    k->m_count += uv.size();
+                }
+            }
         }
 
         Config(const std::string& name)
@@ -187,9 +389,6 @@ public:
         { }
     
     virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        std::lock_guard<std::mutex>
-            g(m_lock);
-        
         Attribute aggr_attr = m_config->get_aggr_attr(db);
 
         if (aggr_attr == Attribute::invalid)
@@ -224,11 +423,37 @@ public:
             list.push_back(Entry(m_config->get_aggr_attr(db), m_sum));
     }
 
+    virtual void merge(AggregateKernel* other) {
+        SumKernel* o = static_cast<SumKernel*>(other);
+
+        if (o->m_count == 0)
+            return;
+
+        if (m_count == 0) {
+            m_sum = o->m_sum;
+        } else {
+            switch (m_sum.type()) {
+            case CALI_TYPE_DOUBLE:
+                m_sum = Variant(m_sum.to_double() + o->m_sum.to_double());
+                break;
+            case CALI_TYPE_INT:
+                m_sum = Variant(m_sum.to_int()    + o->m_sum.to_int()   );
+                break;
+            case CALI_TYPE_UINT:
+                m_sum = Variant(m_sum.to_uint()   + o->m_sum.to_uint()  );
+                break;
+            default:
+                ;
+            }
+        }
+
+        m_count += o->m_count;
+    }
+
 private:
 
     unsigned   m_count;
     Variant    m_sum;
-    std::mutex m_lock;
     Config*    m_config;
 };
 
@@ -288,8 +513,85 @@ public:
             return true;
         }
                 
-        AggregateKernel* make_kernel() {
-            return new StatisticsKernel(this);
+        size_t kernel_size() const {
+            return sizeof(StatisticsKernel);
+        }
+
+        AggregateKernel* make_kernel(void* mem) {
+            return new (mem) StatisticsKernel(this);
+        }
+
+        /// \brief Collect the target values of the records in group \a g.
+        ///   Aggregates records that need the generic path (e.g., with
+        ///   already-aggregated min#/max#/... entries) directly.
+        template<typename T, typename F>
+        void collect_batch(CaliperMetadataAccessInterface& db, const AggregateBatch& batch, size_t g,
+                           AggregateKernel* k, const StatisticsAttributes& stat_attr, F convert,
+                           std::vector<T>& vals) {
+            cali_id_t id = m_target_attr.id();
+
+            for (size_t i = batch.group_begin[g]; i < batch.group_begin[g+1]; ++i) {
+                const EntryList& list = batch.lists[batch.order[i]];
+
+                const Entry* val = nullptr;
+                bool generic     = false;
+
+                for (const Entry& e : list) {
+                    cali_id_t a = e.attribute();
+
+                    if (a == id) {
+                        generic = generic || val;
+                        val = &e;
+                    } else if (a == stat_attr.min.id() || a == stat_attr.max.id() ||
+                               a == stat_attr.sum.id() || a == stat_attr.count.id()) {
+                        generic = true;
+                    }
+                }
+
+                if (generic)
+                    k->aggregate(db, list);
+                else if (val)
+                    vals.push_back(convert(val->value()));
+            }
+        }
+
+        void aggregate_batch(CaliperMetadataAccessInterface& db, const AggregateBatch& batch, AggregateKernel* const kernels[]) {
+            Attribute target_attr = get_target_attr(db);
+            StatisticsAttributes stat_attr;
+
+            if (!get_statistics_attributes(db, stat_attr))
+                return;
+
+            std::vector<double>   dv;
+            std::vector<int64_t>  iv;
+            std::vector<uint64_t> uv;
+
+            for (size_t g = 0; g < batch.num_groups; ++g) {
+                StatisticsKernel* k = static_cast<StatisticsKernel*>(kernels[g]);
+
+                switch (target_attr.type()) {
+                case CALI_TYPE_DOUBLE:
+                    dv.clear();
+                    k->init_minmax(target_attr.type());
+                    collect_batch(db, batch, g, k, stat_attr, [](const Variant& v){ return v.to_double(); }, dv);
+                    k->add_values(dv.data(), dv.size());
+                    break;
+                case CALI_TYPE_INT:
+                    iv.clear();
+                    k->init_minmax(target_attr.type());
+                    collect_batch(db, batch, g, k, stat_attr, [](const Variant& v){ return static_cast<int64_t>(v.to_int()); }, iv);
+                    k->add_values(iv.data(), iv.size());
+                    break;
+                case CALI_TYPE_UINT:
+                    uv.clear();
+                    k->init_minmax(target_attr.type());
+                    collect_batch(db, batch, g, k, stat_attr, [](const Variant& v){ return v.to_uint(); }, uv);
+                    k->add_values(uv.data(), uv.size());
+                    break;
+                default:
+                    ;
+                }
+            }
         }
 
         Config(const std::string& name)
@@ -308,10 +610,72 @@ public:
         : m_count(0), m_sum(0), m_config(config)
         { }
 
-    virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        std::lock_guard<std::mutex>
-            g(m_lock);
+    /// \brief Initialize the min/max values for \a type if not set yet
+    void init_minmax(cali_attr_type type) {
+        switch (type) {
+        case CALI_TYPE_DOUBLE:
+            if (m_min.empty())
+                m_min = Variant(std::numeric_limits<double>::max());
+            if (m_max.empty())
+                m_max = Variant(std::numeric_limits<double>::min());
+            break;
+        case CALI_TYPE_INT:
+            if (m_min.empty())
+                m_min = Variant(std::numeric_limits<int>::max());
+            if (m_max.empty())
+                m_max = Variant(std::numeric_limits<int>::min());
+            break;
+        case CALI_TYPE_UINT:
+            if (m_min.empty())
+                m_min = Variant(std::numeric_limits<uint64_t>::max());
+            if (m_max.empty())
+                m_max = Variant(std::numeric_limits<uint64_t>::min());
+            break;
+        default:
+            ;
+        }
+    }
 
+    void add_values(const double* v, size_t n) {
+        if (n == 0)
+            return;
+
+        double min = m_min.to_double(), max = m_max.to_double();
+        batch_minmax(v, n, min, max);
+
+        m_sum    = Variant(m_sum.to_double() + batch_sum(v, n));
+        m_min    = Variant(min);
+        m_max    = Variant(max);
+        m_count += n;
+    }
+
+    void add_values(const int64_t* v, size_t n) {
+        if (n == 0)
+            return;
+
+        int64_t min = m_min.to_int(), max = m_max.to_int();
+        batch_minmax(v, n, min, max);
+
+        m_sum    = Variant(static_cast<int>(m_sum.to_int() + batch_sum(v, n)));
+        m_min    = Variant(static_cast<int>(min));
+        m_max    = Variant(static_cast<int>(max));
+        m_count += n;
+    }
+
+    void add_values(const uint64_t* v, size_t n) {
+        if (n == 0)
+            return;
+
+        uint64_t min = m_min.to_uint(), max = m_max.to_uint();
+        batch_minmax(v, n, min, max);
+
+        m_sum    = Variant(m_sum.to_uint() + batch_sum(v, n));
+        m_min    = Variant(min);
+        m_max    = Variant(max);
+        m_count += n;
+    }
+
+    virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
         Attribute target_attr = m_config->get_target_attr(db);
         StatisticsAttributes stat_attr;
 
@@ -424,6 +788,41 @@ public:
         }
     }
 
+    virtual void merge(AggregateKernel* other) {
+        StatisticsKernel* o = static_cast<StatisticsKernel*>(other);
+
+        if (o->m_min.empty())
+            return;
+
+        if (m_min.empty()) {
+            m_sum = o->m_sum;
+            m_min = o->m_min;
+            m_max = o->m_max;
+        } else {
+            switch (m_min.type()) {
+            case CALI_TYPE_DOUBLE:
+                m_sum = Variant(m_sum.to_double() + o->m_sum.to_double());
+                m_min = Variant(std::min(m_min.to_double(), o->m_min.to_double()));
+                m_max = Variant(std::max(m_max.to_double(), o->m_max.to_double()));
+                break;
+            case CALI_TYPE_INT:
+                m_sum = Variant(m_sum.to_int() + o->m_sum.to_int());
+                m_min = Variant(std::min(m_min.to_int(), o->m_min.to_int()));
+                m_max = Variant(std::max(m_max.to_int(), o->m_max.to_int()));
+                break;
+            case CALI_TYPE_UINT:
+                m_sum = Variant(m_sum.to_uint() + o->m_sum.to_uint());
+                m_min = Variant(std::min(m_min.to_uint(), o->m_min.to_uint()));
+                m_max = Variant(std::max(m_max.to_uint(), o->m_max.to_uint()));
+                break;
+            default:
+                ;
+            }
+        }
+
+        m_count += o->m_count;
+    }
+
 private:
 
     unsigned   m_count;
@@ -432,8 +831,6 @@ private:
     Variant    m_min;
     Variant    m_max;
 
-    std::mutex m_lock;
-    
     Config*    m_config;
 };
 
@@ -500,8 +897,12 @@ public:
             return true;
         }
                 
-        AggregateKernel* make_kernel() {
-            return new PercentageKernel(this);
+        size_t kernel_size() const {
+            return sizeof(PercentageKernel);
+        }
+
+        AggregateKernel* make_kernel(void* mem) {
+            return new (mem) PercentageKernel(this);
         }
 
         Config(const std::vector<std::string>& names)
@@ -526,9 +927,6 @@ public:
 
 
     virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        std::lock_guard<std::mutex>
-            g(m_lock);
-
         std::pair<Attribute,Attribute> target_attrs = m_config->get_target_attrs(db);
         Attribute percentage_attr, sum1_attr, sum2_attr;
 
@@ -561,13 +959,18 @@ public:
         }
     }
 
+    virtual void merge(AggregateKernel* other) {
+        PercentageKernel* o = static_cast<PercentageKernel*>(other);
+
+        m_sum1 += o->m_sum1;
+        m_sum2 += o->m_sum2;
+    }
+
 private:
 
     double    m_sum1;
     double    m_sum2;
 
-    std::mutex m_lock;
-    
     Config*    m_config;
 };
 
@@ -585,7 +988,8 @@ public:
 
         Attribute   m_percentage_attr;
 
-        std::mutex  m_total_lock;
+        /// Total of all partial sums. Only updated in merge(), which runs
+        /// serially in Aggregator::flush(), so it needs no lock.
         double      m_total;
 
     public:
@@ -624,14 +1028,15 @@ public:
             return true;
         }
                 
-        AggregateKernel* make_kernel() {
-            return new PercentTotalKernel(this);
+        size_t kernel_size() const {
+            return sizeof(PercentTotalKernel);
         }
 
-        void add(double val) {
-            std::lock_guard<std::mutex>
-                g(m_total_lock);
+        AggregateKernel* make_kernel(void* mem) {
+            return new (mem) PercentTotalKernel(this);
+        }
 
+        void add_to_total(double val) {
             m_total += val;
         }
 
@@ -670,11 +1075,8 @@ public:
         for (const Entry& e : list) {
             cali_id_t id = e.attribute();
             
-            if (id == target_id || id == sum_id) {
-                double val = e.value().to_double();
-                m_sum += val;
-                m_config->add(val);
-            } 
+            if (id == target_id || id == sum_id)
+                m_sum += e.value().to_double();
         }
     }
 
@@ -692,132 +1094,1125 @@ public:
         }
     }
 
+    virtual void merge(AggregateKernel* other) {
+        double sum = static_cast<PercentTotalKernel*>(other)->m_sum;
+
+        // The total is computed from the thread-local partial results when
+        // they are merged into the result table, i.e. once per result entry
+        // and thread rather than once per record.
+        m_sum += sum;
+        m_config->add_to_total(sum);
+    }
+
 private:
 
     double     m_sum;
     
-    std::mutex m_lock;    
     Config*    m_config;
 };
 
-enum KernelID {
-    Count        = 0,
-    Sum          = 1,
-    Statistics   = 2,
-    Percentage   = 3,
-    PercentTotal = 4
-};
+//
+// --- QuantileKernel
+//
 
-#define MAX_KERNEL_ID 4
+/// \brief Mergeable quantile sketch with bounded memory.
+///
+/// Positive values are counted in logarithmic bins as in DDSketch: bin
+/// \a i covers (gamma^(i-1), gamma^i], which bounds the relative error of
+/// quantile estimates. When more than MaxBins bins are in use, gamma is
+/// squared and neighboring bins are combined ("uniform collapse"). This
+/// keeps the full value range at reduced accuracy. Sketches at different
+/// collapse levels are merged at the coarser level. Values <= 0 are
+/// counted in a separate zero bin.
+class QuantileSketch {
+public:
 
-const char* kernel_args[] = { "attribute" };
-const char* kernel_2args[] = { "numerator", "denominator" };
+    static const int    MaxBins = 64;
 
-const QuerySpec::FunctionSignature kernel_signatures[] = {
-    { KernelID::Count,        "count",         0, 0, nullptr      },
-    { KernelID::Sum,          "sum",           1, 1, kernel_args  },
-    { KernelID::Statistics,   "statistics",    1, 1, kernel_args  },
-    { KernelID::Percentage,   "percentage",    2, 2, kernel_2args },
-    { KernelID::PercentTotal, "percent_total", 1, 1, kernel_args  },
-    
-    QuerySpec::FunctionSignatureTerminator
-};
+    QuantileSketch()
+        : m_level(0), m_zero_count(0)
+        { }
 
-const struct KernelInfo {
-    const char* name;
-    AggregateKernelConfig* (*create)(const std::vector<std::string>& cfg);
-} kernel_list[] = {
-    { "count",         CountKernel::Config::create        },
-    { "sum",           SumKernel::Config::create          },
-    { "statistics",    StatisticsKernel::Config::create   },
-    { "percentage",    PercentageKernel::Config::create   },
-    { "percent_total", PercentTotalKernel::Config::create },
-    { 0, 0 }
-};
+    void add(double val, uint64_t count = 1) {
+        if (!(val > 0.0)) {
+            m_zero_count += count;
+            return;
+        }
 
-} // namespace [anonymous]
+        m_bins[index(val)] += count;
 
+        while (m_bins.size() > static_cast<size_t>(MaxBins))
+            collapse();
+    }
 
-struct Aggregator::AggregatorImpl
-{
-    // --- data
+    void merge(const QuantileSketch& other) {
+        while (m_level < other.m_level)
+            collapse();
 
-    vector<string>         m_key_strings;
-    vector<cali_id_t>      m_key_ids;
-    std::mutex             m_key_lock;
+        for (const auto &b : other.m_bins) {
+            int i = b.first;
 
-    bool                   m_select_all;
-    
-    vector<AggregateKernelConfig*> m_kernel_configs;
-    
-    struct TrieNode {
-        uint32_t next[256] = { 0 };
-        vector<AggregateKernel*> kernels;
+            for (int l = other.m_level; l < m_level; ++l)
+                i = collapse_index(i);
 
-        ~TrieNode() {
-            for (AggregateKernel* k : kernels)
-                delete k;
-            kernels.clear();
+            m_bins[i] += b.second;
         }
-    };
 
-    std::vector<TrieNode*> m_trie;    
-    std::mutex             m_trie_lock;
-    
-    //
-    // --- parse config
-    //
+        m_zero_count += other.m_zero_count;
 
-    void parse_key(const string& key) {
-        util::split(key, ':', back_inserter(m_key_strings));
-        m_select_all = m_key_strings.empty();
+        while (m_bins.size() > static_cast<size_t>(MaxBins))
+            collapse();
     }
 
-    void parse_aggr_config(const string& configstr) {
-        vector<string> aggregators;
-        
-        util::split(configstr, ':', back_inserter(aggregators));
+    uint64_t count() const {
+        uint64_t total = m_zero_count;
 
-        for (const string& s : aggregators) {
-            string::size_type oparen = s.find_first_of('(');
-            string::size_type cparen = s.find_last_of(')');
+        for (const auto &b : m_bins)
+            total += b.second;
 
-            string kernelname = s.substr(0, oparen);
-            vector<string> kernelattrs;
+        return total;
+    }
 
-            if (cparen != string::npos && cparen > oparen+1) {
-                string kernelattrs_str = s.substr(oparen+1, cparen-oparen-1);
-                util::split(kernelattrs_str, ',', back_inserter(kernelattrs));
-            }
+    /// \brief Estimate the \a q quantile (0 <= \a q <= 1)
+    double quantile(double q) const {
+        uint64_t total = count();
 
-            const ::KernelInfo* ki = ::kernel_list;
+        if (total == 0)
+            return 0.0;
 
-            for ( ; ki->name && ki->create && kernelname != ki->name; ++ki)
-                ;
+        double   rank = q * static_cast<double>(total - 1);
+        uint64_t acc  = m_zero_count;
 
-            if (ki->create)
-                m_kernel_configs.push_back((*ki->create)(kernelattrs));
-            else
-                Log(0).stream() << "aggregator: unknown aggregation kernel \"" << kernelname << "\"" << std::endl;
+        if (rank < static_cast<double>(acc))
+            return 0.0;
+
+        for (const auto &b : m_bins) {
+            acc += b.second;
+
+            if (rank < static_cast<double>(acc))
+                return value(b.first);
         }
+
+        return m_bins.empty() ? 0.0 : value(m_bins.rbegin()->first);
     }
 
-    void configure(const QuerySpec& spec) {
-        //
-        // --- key config
-        //
-        
-        m_kernel_configs.clear();
-        m_key_strings.clear();
-        m_select_all = false;
-        
-        switch (spec.aggregation_key.selection) {
+    //   The sketch is written into aggregation output records as a list of
+    // UINT values, so it can be re-aggregated from .cali files and across
+    // MPI ranks. Each value holds a bin index (upper 20 bits) and a count
+    // (lower 44 bits). Two reserved indices hold the collapse level and the
+    // zero bin count.
+
+    void encode(std::vector<uint64_t>& codes) const {
+        codes.push_back(make_code(LevelCode, static_cast<uint64_t>(m_level)));
+
+        if (m_zero_count > 0)
+            codes.push_back(make_code(ZeroCode, m_zero_count));
+
+        for (const auto &b : m_bins)
+            codes.push_back(make_code(static_cast<uint64_t>(clamp_index(b.first) + IndexOffset), b.second));
+    }
+
+    static QuantileSketch decode(const std::vector<uint64_t>& codes) {
+        QuantileSketch sketch;
+
+        for (uint64_t c : codes)
+            if ((c >> CountBits) == LevelCode)
+                sketch.m_level = static_cast<int>(c & CountMask);
+
+        for (uint64_t c : codes) {
+            uint64_t idx   = c >> CountBits;
+            uint64_t count = c & CountMask;
+
+            if (idx == ZeroCode)
+                sketch.m_zero_count += count;
+            else if (idx != LevelCode)
+                sketch.m_bins[static_cast<int>(idx) - IndexOffset] += count;
+        }
+
+        return sketch;
+    }
+
+private:
+
+    static const int      CountBits   = 44;
+    static const uint64_t CountMask   = (1ULL << CountBits) - 1;
+    static const int      IndexOffset = (1 << 19);
+    static const uint64_t LevelCode   = (1ULL << 20) - 1;
+    static const uint64_t ZeroCode    = (1ULL << 20) - 2;
+
+    static uint64_t make_code(uint64_t idx, uint64_t count) {
+        return (idx << CountBits) | (count < CountMask ? count : CountMask);
+    }
+
+    static int clamp_index(int i) {
+        return std::max(-IndexOffset, std::min(IndexOffset - 3, i));
+    }
+
+    /// Bin index at the next collapse level (integer ceil(i/2))
+    static int collapse_index(int i) {
+        return i > 0 ? (i + 1) / 2 : i / 2;
+    }
+
+    double log_gamma() const {
+        // gamma = (1+a)/(1-a) with a 1% relative accuracy at level 0
+        return std::log(1.01 / 0.99) * static_cast<double>(1 << m_level);
+    }
+
+    int index(double val) const {
+        return static_cast<int>(std::ceil(std::log(val) / log_gamma()));
+    }
+
+    double value(int i) const {
+        double lg = log_gamma();
+        return 2.0 * std::exp(lg * i) / (std::exp(lg) + 1.0);
+    }
+
+    void collapse() {
+        std::map<int, uint64_t> bins;
+
+        for (const auto &b : m_bins)
+            bins[collapse_index(b.first)] += b.second;
+
+        m_bins.swap(bins);
+        ++m_level;
+    }
+
+    int                     m_level;
+    uint64_t                m_zero_count;
+    std::map<int, uint64_t> m_bins;
+};
+
+class QuantileKernel : public AggregateKernel {
+public:
+
+    class Config : public AggregateKernelConfig {
+        std::string            m_target_attr_name;
+        Attribute              m_target_attr;
+        Attribute              m_sketch_attr;
+
+        std::vector<std::string> m_percentile_strs;
+        std::vector<double>    m_percentiles;
+        std::vector<Attribute> m_percentile_attrs;
+
+    public:
+
+        Attribute get_target_attr(CaliperMetadataAccessInterface& db) {
+            if (m_target_attr == Attribute::invalid)
+                m_target_attr = db.get_attribute(m_target_attr_name);
+
+            return m_target_attr;
+        }
+
+        bool get_quantile_attributes(CaliperMetadataAccessInterface& db,
+                                     Attribute& sketch_attr,
+                                     std::vector<Attribute>& percentile_attrs) {
+            // The output attribute types don't depend on the target
+            // attribute, so we can re-aggregate sketches without it.
+            if (m_sketch_attr != Attribute::invalid) {
+                sketch_attr      = m_sketch_attr;
+                percentile_attrs = m_percentile_attrs;
+                return true;
+            }
+
+            std::vector<Attribute> attrs;
+
+            for (const std::string& p : m_percentile_strs)
+                attrs.push_back(db.create_attribute("p" + p + "#" + m_target_attr_name,
+                                                    CALI_TYPE_DOUBLE,
+                                                    CALI_ATTR_SKIP_EVENTS | CALI_ATTR_ASVALUE));
+
+            m_percentile_attrs = attrs;
+            m_sketch_attr =
+                db.create_attribute("quantile.sketch#" + m_target_attr_name,
+                                    CALI_TYPE_UINT,
+                                    CALI_ATTR_SKIP_EVENTS | CALI_ATTR_ASVALUE | CALI_ATTR_HIDDEN);
+
+            sketch_attr      = m_sketch_attr;
+            percentile_attrs = m_percentile_attrs;
+
+            return true;
+        }
+
+        const std::vector<double>& percentiles() const {
+            return m_percentiles;
+        }
+
+        size_t kernel_size() const {
+            return sizeof(QuantileKernel);
+        }
+
+        AggregateKernel* make_kernel(void* mem) {
+            return new (mem) QuantileKernel(this);
+        }
+
+        Config(const std::vector<std::string>& args)
+            : m_target_attr_name(args.front()),
+              m_target_attr(Attribute::invalid),
+              m_sketch_attr(Attribute::invalid)
+        {
+            std::vector<std::string> p_args(args.begin() + 1, args.end());
+
+            if (p_args.empty())
+                p_args = { "50", "90", "99" };
+
+            for (const std::string& s : p_args) {
+                char*  end = nullptr;
+                double p   = std::strtod(s.c_str(), &end);
+
+                if (s.empty() || *end != '\0' || !(p >= 0.0 && p <= 100.0)) {
+                    Log(0).stream() << "aggregate: quantile: invalid percentile \"" << s << "\"" << std::endl;
+                    continue;
+                }
+
+                m_percentile_strs.push_back(s);
+                m_percentiles.push_back(p / 100.0);
+            }
+
+            Log(2).stream() << "aggregate: creating quantile kernel for attribute "
+                            << m_target_attr_name << std::endl;
+        }
+
+        static AggregateKernelConfig* create(const std::vector<std::string>& cfg) {
+            return new Config(cfg);
+        }
+    };
+
+    QuantileKernel(Config* config)
+        : m_config(config)
+        { }
+
+    virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        Attribute target_attr = m_config->get_target_attr(db);
+        Attribute sketch_attr;
+        std::vector<Attribute> p_attrs;
+
+        if (!m_config->get_quantile_attributes(db, sketch_attr, p_attrs))
+            return;
+
+        cali_id_t target_id = target_attr.id();
+        cali_id_t sketch_id = sketch_attr.id();
+
+        std::vector<uint64_t> codes;
+
+        for (const Entry& e : list) {
+            cali_id_t id = e.attribute();
+
+            if (id == target_id)
+                m_sketch.add(e.value().to_double());
+            else if (id == sketch_id)
+                codes.push_back(e.value().to_uint());
+        }
+
+        // re-aggregate sketches from previous aggregation results
+        if (!codes.empty())
+            m_sketch.merge(QuantileSketch::decode(codes));
+    }
+
+    virtual void append_result(CaliperMetadataAccessInterface& db, EntryList& list) {
+        if (m_sketch.count() == 0)
+            return;
+
+        Attribute sketch_attr;
+        std::vector<Attribute> p_attrs;
+
+        if (!m_config->get_quantile_attributes(db, sketch_attr, p_attrs))
+            return;
+
+        const std::vector<double>& p = m_config->percentiles();
+
+        for (size_t i = 0; i < p.size() && i < p_attrs.size(); ++i)
+            list.push_back(Entry(p_attrs[i], Variant(m_sketch.quantile(p[i]))));
+
+        std::vector<uint64_t> codes;
+        m_sketch.encode(codes);
+
+        for (uint64_t c : codes)
+            list.push_back(Entry(sketch_attr, Variant(cali_make_variant_from_uint(c))));
+    }
+
+    virtual void merge(AggregateKernel* other) {
+        m_sketch.merge(static_cast<QuantileKernel*>(other)->m_sketch);
+    }
+
+private:
+
+    QuantileSketch m_sketch;
+
+    Config*        m_config;
+};
+
+//
+// --- CountDistinctKernel
+//
+
+class CountDistinctKernel : public AggregateKernel {
+public:
+
+    class Config : public AggregateKernelConfig {
+        std::string m_target_attr_name;
+        Attribute   m_target_attr;
+        Attribute   m_result_attr;
+        Attribute   m_hll_attr;
+
+    public:
+
+        Attribute get_target_attr(CaliperMetadataAccessInterface& db) {
+            if (m_target_attr == Attribute::invalid)
+                m_target_attr = db.get_attribute(m_target_attr_name);
+
+            return m_target_attr;
+        }
+
+        // Like the quantile sketch, the result attributes don't depend on
+        // the target attribute, so we can merge previous results without it
+        void get_result_attributes(CaliperMetadataAccessInterface& db,
+                                   Attribute& result_attr,
+                                   Attribute& hll_attr) {
+            if (m_result_attr == Attribute::invalid) {
+                m_result_attr =
+                    db.create_attribute("count_distinct#" + m_target_attr_name,
+                                        CALI_TYPE_UINT,
+                                        CALI_ATTR_SKIP_EVENTS | CALI_ATTR_ASVALUE);
+                m_hll_attr =
+                    db.create_attribute("distinct.hll#" + m_target_attr_name,
+                                        CALI_TYPE_UINT,
+                                        CALI_ATTR_SKIP_EVENTS | CALI_ATTR_ASVALUE | CALI_ATTR_HIDDEN);
+            }
+
+            result_attr = m_result_attr;
+            hll_attr    = m_hll_attr;
+        }
+
+        size_t kernel_size() const {
+            return sizeof(CountDistinctKernel);
+        }
+
+        AggregateKernel* make_kernel(void* mem) {
+            return new (mem) CountDistinctKernel(this);
+        }
+
+        Config(const std::vector<std::string>& args)
+            : m_target_attr_name(args.front()),
+              m_target_attr(Attribute::invalid),
+              m_result_attr(Attribute::invalid),
+              m_hll_attr(Attribute::invalid)
+        {
+            Log(2).stream() << "aggregate: creating count_distinct kernel for attribute "
+                            << m_target_attr_name << std::endl;
+        }
+
+        static AggregateKernelConfig* create(const std::vector<std::string>& cfg) {
+            return new Config(cfg);
+        }
+    };
+
+    CountDistinctKernel(Config* config)
+        : m_config(config)
+        { }
+
+    virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        Attribute target_attr = m_config->get_target_attr(db);
+        Attribute result_attr, hll_attr;
+
+        m_config->get_result_attributes(db, result_attr, hll_attr);
+
+        cali_id_t target_id = target_attr.id();
+        cali_id_t hll_id    = hll_attr.id();
+
+        for (const Entry& e : list) {
+            if (e.is_reference()) {
+                // count every value of the target attribute on the node's path
+                if (target_id != CALI_INV_ID)
+                    for (const Node* node = e.node(); node; node = node->parent())
+                        if (node->attribute() == target_id)
+                            m_hll.add(node->data());
+            } else {
+                cali_id_t id = e.attribute();
+
+                if (id == target_id)
+                    m_hll.add(e.value());
+                else if (id == hll_id)
+                    m_hll.merge_code(e.value().to_uint());
+            }
+        }
+    }
+
+    virtual void append_result(CaliperMetadataAccessInterface& db, EntryList& list) {
+        if (m_hll.empty())
+            return;
+
+        Attribute result_attr, hll_attr;
+
+        m_config->get_result_attributes(db, result_attr, hll_attr);
+
+        list.push_back(Entry(result_attr, Variant(cali_make_variant_from_uint(m_hll.estimate()))));
+
+        std::vector<uint64_t> codes;
+        m_hll.encode(codes);
+
+        for (uint64_t c : codes)
+            list.push_back(Entry(hll_attr, Variant(cali_make_variant_from_uint(c))));
+    }
+
+    virtual void merge(AggregateKernel* other) {
+        m_hll.merge(static_cast<CountDistinctKernel*>(other)->m_hll);
+    }
+
+private:
+
+    HyperLogLog m_hll;
+
+    Config*     m_config;
+};
+
+//
+// --- MergeKernel
+//
+
+/// \brief Merges already-aggregated records, e.g. profiles written by the
+///   aggregate service or by earlier cali-query runs.
+///
+/// The combine operation is derived from the attribute name: counts
+/// (count, aggregate.count, count#x), sums (sum#x), and histogram bins are
+/// added, min#x and max#x take the minimum and maximum, and avg#x is
+/// averaged with the record counts as weights. Records without a count
+/// attribute count as one. Other attributes are ignored.
+class MergeKernel : public AggregateKernel {
+public:
+
+    enum Op { Ignore, Count, Sum, Min, Max, Avg };
+
+    class Config : public AggregateKernelConfig {
+        std::mutex                        m_lock;
+        std::unordered_map<cali_id_t, Op> m_ops;
+        Attribute                         m_count_attr;
+
+        static bool has_prefix(const std::string& name, const char* prefix) {
+            return name.compare(0, strlen(prefix), prefix) == 0;
+        }
+
+    public:
+
+        static Op op_for_name(const std::string& name) {
+            if (name == "count" || name == "aggregate.count")
+                return Count;
+            if (has_prefix(name, "sum#") || has_prefix(name, "count#") || has_prefix(name, "histogram.bin."))
+                return Sum;
+            if (has_prefix(name, "min#"))
+                return Min;
+            if (has_prefix(name, "max#"))
+                return Max;
+            if (has_prefix(name, "avg#"))
+                return Avg;
+
+            return Ignore;
+        }
+
+        /// \brief Get the combine operation for attribute \a id. Called
+        ///   once per attribute and kernel, so the lock is rarely contended.
+        Op get_op(CaliperMetadataAccessInterface& db, cali_id_t id) {
+            std::lock_guard<std::mutex>
+                g(m_lock);
+
+            auto it = m_ops.find(id);
+
+            if (it != m_ops.end())
+                return it->second;
+
+            Attribute attr = db.get_attribute(id);
+            Op        op   = (attr == Attribute::invalid ? Ignore : op_for_name(attr.name()));
+
+            if (op == Count && m_count_attr == Attribute::invalid)
+                m_count_attr = attr;
+
+            m_ops[id] = op;
+
+            return op;
+        }
+
+        /// \brief The count attribute of the input, or "count" if there was none
+        Attribute count_attr(CaliperMetadataAccessInterface& db) {
+            std::lock_guard<std::mutex>
+                g(m_lock);
+
+            if (m_count_attr == Attribute::invalid)
+                m_count_attr = db.create_attribute("count", CALI_TYPE_UINT, CALI_ATTR_ASVALUE);
+
+            return m_count_attr;
+        }
+
+        size_t kernel_size() const {
+            return sizeof(MergeKernel);
+        }
+
+        AggregateKernel* make_kernel(void* mem) {
+            return new (mem) MergeKernel(this);
+        }
+
+        Config()
+            : m_count_attr(Attribute::invalid)
+        {
+            Log(2).stream() << "aggregate: creating merge kernel" << std::endl;
+        }
+
+        static AggregateKernelConfig* create(const std::vector<std::string>&) {
+            return new Config;
+        }
+    };
+
+    MergeKernel(Config* config)
+        : m_count(0), m_config(config)
+        { }
+
+    virtual void aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        // find the record count first: it weighs the averages
+
+        double count = 1.0;
+
+        for (const Entry& e : list)
+            if (e.is_immediate() && get_slot(db, e.attribute()).op == Count)
+                count = e.value().to_double();
+
+        for (const Entry& e : list) {
+            if (!e.is_immediate())
+                continue;
+
+            Slot& s = get_slot(db, e.attribute());
+
+            if (s.op == Avg) {
+                s.val     = Variant(s.val.to_double() + count * e.value().to_double());
+                s.weight += count;
+            } else if (s.op != Ignore && s.op != Count) {
+                s.val     = combine(s.op, s.val, e.value());
+            }
+        }
+
+        m_count += static_cast<uint64_t>(count + 0.5);
+    }
+
+    virtual void append_result(CaliperMetadataAccessInterface& db, EntryList& list) {
+        if (m_count == 0)
+            return;
+
+        list.push_back(Entry(m_config->count_attr(db), Variant(cali_make_variant_from_uint(m_count))));
+
+        for (const Slot& s : m_slots) {
+            if (s.val.empty())
+                continue;
+
+            if (s.op == Avg) {
+                if (s.weight > 0.0)
+                    list.push_back(Entry(db.get_attribute(s.attr), Variant(s.val.to_double() / s.weight)));
+            } else if (s.op != Ignore && s.op != Count) {
+                list.push_back(Entry(db.get_attribute(s.attr), s.val));
+            }
+        }
+    }
+
+    virtual void merge(AggregateKernel* other) {
+        MergeKernel* o = static_cast<MergeKernel*>(other);
+
+        for (const Slot& os : o->m_slots) {
+            auto it = std::find_if(m_slots.begin(), m_slots.end(), [&os](const Slot& s){
+                    return s.attr == os.attr;
+                });
+
+            if (it == m_slots.end()) {
+                m_slots.push_back(os);
+                continue;
+            }
+
+            if (os.op == Avg) {
+                it->val     = Variant(it->val.to_double() + os.val.to_double());
+                it->weight += os.weight;
+            } else if (os.op != Ignore && os.op != Count && !os.val.empty()) {
+                it->val     = combine(os.op, it->val, os.val);
+            }
+        }
+
+        m_count += o->m_count;
+    }
+
+private:
+
+    struct Slot {
+        cali_id_t attr;
+        Op        op;
+        Variant   val;    ///< Combined value; the weighted sum for averages
+        double    weight; ///< Sum of weights for averages
+    };
+
+    Slot& get_slot(CaliperMetadataAccessInterface& db, cali_id_t id) {
+        for (Slot& s : m_slots)
+            if (s.attr == id)
+                return s;
+
+        m_slots.push_back({ id, m_config->get_op(db, id), Variant(), 0.0 });
+
+        return m_slots.back();
+    }
+
+    static Variant combine(Op op, const Variant& a, const Variant& b) {
+        if (a.empty())
+            return b;
+
+        switch (b.type()) {
+        case CALI_TYPE_DOUBLE:
+        {
+            double x = a.to_double(), y = b.to_double();
+            return Variant(op == Min ? std::min(x, y) : (op == Max ? std::max(x, y) : x + y));
+        }
+        case CALI_TYPE_INT:
+        {
+            int x = a.to_int(), y = b.to_int();
+            return Variant(op == Min ? std::min(x, y) : (op == Max ? std::max(x, y) : x + y));
+        }
+        case CALI_TYPE_UINT:
+        {
+            uint64_t x = a.to_uint(), y = b.to_uint();
+            return Variant(cali_make_variant_from_uint(op == Min ? std::min(x, y) : (op == Max ? std::max(x, y) : x + y)));
+        }
+        default:
+            return a;
+        }
+    }
+
+    std::vector<Slot> m_slots;
+    uint64_t          m_count;
+
+    Config*           m_config;
+};
+
+enum KernelID {
+    Count        = 0,
+    Sum          = 1,
+    Statistics   = 2,
+    Percentage   = 3,
+    PercentTotal = 4,
+    Quantile     = 5,
+    CountDistinct = 6,
+    Merge        = 7
+};
+
+#define MAX_KERNEL_ID 7
+
+const char* kernel_args[] = { "attribute" };
+const char* kernel_2args[] = { "numerator", "denominator" };
+const char* quantile_args[] = { "attribute", "percentile", "percentile", "percentile", "percentile",
+                                "percentile", "percentile", "percentile", "percentile" };
+
+const QuerySpec::FunctionSignature kernel_signatures[] = {
+    { KernelID::Count,        "count",         0, 0, nullptr      },
+    { KernelID::Sum,          "sum",           1, 1, kernel_args  },
+    { KernelID::Statistics,   "statistics",    1, 1, kernel_args  },
+    { KernelID::Percentage,   "percentage",    2, 2, kernel_2args },
+    { KernelID::PercentTotal, "percent_total", 1, 1, kernel_args  },
+    { KernelID::Quantile,     "quantile",      1, 9, quantile_args },
+    { KernelID::CountDistinct, "count_distinct", 1, 1, kernel_args },
+    { KernelID::Merge,        "merge",         0, 0, nullptr      },
+    
+    QuerySpec::FunctionSignatureTerminator
+};
+
+const struct KernelInfo {
+    const char* name;
+    AggregateKernelConfig* (*create)(const std::vector<std::string>& cfg);
+} kernel_list[] = {
+    { "count",         CountKernel::Config::create        },
+    { "sum",           SumKernel::Config::create          },
+    { "statistics",    StatisticsKernel::Config::create   },
+    { "percentage",    PercentageKernel::Config::create   },
+    { "percent_total", PercentTotalKernel::Config::create },
+    { "quantile",      QuantileKernel::Config::create     },
+    { "count_distinct", CountDistinctKernel::Config::create },
+    { "merge",         MergeKernel::Config::create        },
+    { 0, 0 }
+};
+
+const size_t KernelArenaBlockSize = 64 * 1024;
+
+/// \brief Bump allocator for aggregation kernels. Kernels must be
+///   destroyed explicitly; the arena only releases the memory.
+class KernelArena {
+    std::vector< std::unique_ptr<char[]> > m_blocks;
+
+    size_t m_pos;
+    size_t m_block_size;
+    size_t m_reserved;
+
+public:
+
+    KernelArena()
+        : m_pos(0), m_block_size(0), m_reserved(0)
+        { }
+
+    size_t reserved() const {
+        return m_reserved;
+    }
+
+    void* allocate(size_t size) {
+        const size_t align = alignof(std::max_align_t);
+
+        size = (size + align - 1) / align * align;
+
+        if (m_blocks.empty() || m_pos + size > m_block_size) {
+            m_block_size = std::max(KernelArenaBlockSize, size);
+            m_blocks.emplace_back(new char[m_block_size]);
+            m_pos = 0;
+            m_reserved += m_block_size;
+        }
+
+        void* ptr = m_blocks.back().get() + m_pos;
+        m_pos += size;
+
+        return ptr;
+    }
+
+    void clear() {
+        m_blocks.clear();
+        m_pos        = 0;
+        m_block_size = 0;
+        m_reserved   = 0;
+    }
+};
+
+/// \brief Open-addressing hash table that maps normalized aggregation
+///   keys (sequences of 64-bit words) to their aggregation kernels
+///
+/// Keys and kernel pointers are kept in contiguous arrays in insertion
+/// order, kernel objects in an arena.
+class AggregationTable {
+    struct Slot {
+        uint64_t hash;
+        uint32_t entry; ///< entry index + 1, 0 marks an empty slot
+    };
+
+    struct KeyRef {
+        size_t begin;
+        size_t len;
+    };
+
+    std::vector<Slot>             m_slots;
+    std::vector<KeyRef>           m_keys;
+    std::vector<uint64_t>         m_key_words;
+    std::vector<AggregateKernel*> m_kernels; ///< m_num_kernels kernels per entry
+    size_t                        m_num_kernels;
+
+    KernelArena                   m_arena;
+
+    static uint64_t mix(uint64_t h) {
+        // splitmix64 finalizer
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+
+        return h;
+    }
+
+    bool key_equals(size_t e, const uint64_t* key, size_t len) const {
+        return m_keys[e].len == len && std::equal(key, key + len, m_key_words.begin() + m_keys[e].begin);
+    }
+
+    void grow() {
+        std::vector<Slot> slots(std::max<size_t>(64, 2 * m_slots.size()), Slot { 0, 0 });
+        size_t mask = slots.size() - 1;
+
+        for (const Slot& s : m_slots)
+            if (s.entry) {
+                size_t i = s.hash & mask;
+
+                while (slots[i].entry)
+                    i = (i + 1) & mask;
+
+                slots[i] = s;
+            }
+
+        m_slots.swap(slots);
+    }
+
+public:
+
+    AggregationTable()
+        : m_num_kernels(0)
+        { }
+
+    ~AggregationTable() {
+        clear();
+    }
+
+    size_t size() const {
+        return m_keys.size();
+    }
+
+    size_t num_kernels() const {
+        return m_num_kernels;
+    }
+
+    static uint64_t hash(const uint64_t* key, size_t len) {
+        uint64_t h = len;
+
+        for (size_t i = 0; i < len; ++i)
+            h = mix(h ^ key[i]) + 0x9e3779b97f4a7c15ULL;
+
+        return h;
+    }
+
+    /// \brief Approximate memory held by the table, in bytes. Does not
+    ///   include memory that kernels allocate themselves.
+    size_t memory_size() const {
+        return m_slots.capacity()     * sizeof(Slot)
+            +  m_keys.capacity()      * sizeof(KeyRef)
+            +  m_key_words.capacity() * sizeof(uint64_t)
+            +  m_kernels.capacity()   * sizeof(AggregateKernel*)
+            +  m_arena.reserved();
+    }
+
+    /// \brief Return the entry index for \a key, or size() if it isn't
+    ///   in the table
+    size_t find(const uint64_t* key, size_t len) const {
+        if (m_slots.empty())
+            return m_keys.size();
+
+        uint64_t h    = hash(key, len);
+        size_t   mask = m_slots.size() - 1;
+
+        for (size_t i = h & mask; m_slots[i].entry; i = (i + 1) & mask)
+            if (m_slots[i].hash == h && key_equals(m_slots[i].entry - 1, key, len))
+                return m_slots[i].entry - 1;
+
+        return m_keys.size();
+    }
+
+    /// \brief Find the kernels for \a key, or create them from \a configs.
+    ///   The returned pointer is valid until the next insertion.
+    AggregateKernel** get(const uint64_t* key, size_t len, const std::vector<AggregateKernelConfig*>& configs) {
+        if (2 * (m_keys.size() + 1) > m_slots.size())
+            grow();
+
+        uint64_t h    = hash(key, len);
+        size_t   mask = m_slots.size() - 1;
+        size_t   i    = h & mask;
+
+        for ( ; m_slots[i].entry; i = (i + 1) & mask)
+            if (m_slots[i].hash == h && key_equals(m_slots[i].entry - 1, key, len))
+                return m_kernels.data() + (m_slots[i].entry - 1) * m_num_kernels;
+
+        size_t e = m_keys.size();
+
+        if (e == 0)
+            m_num_kernels = configs.size();
+
+        m_keys.push_back(KeyRef { m_key_words.size(), len });
+        m_key_words.insert(m_key_words.end(), key, key + len);
+
+        for (AggregateKernelConfig* c : configs)
+            m_kernels.push_back(c->make_kernel(m_arena.allocate(c->kernel_size())));
+
+        m_slots[i] = Slot { h, static_cast<uint32_t>(e + 1) };
+
+        return m_kernels.data() + e * m_num_kernels;
+    }
+
+    const uint64_t* key(size_t e, size_t* len) const {
+        *len = m_keys[e].len;
+        return m_key_words.data() + m_keys[e].begin;
+    }
+
+    AggregateKernel** kernels(size_t e) {
+        return m_kernels.data() + e * m_num_kernels;
+    }
+
+    /// \brief Return entry indices ordered by key: by key length first,
+    ///   then keys without key node (first word CALI_INV_ID) before others,
+    ///   then by key words
+    std::vector<size_t> sorted_entries() const {
+        std::vector<size_t> ret(m_keys.size());
+
+        for (size_t e = 0; e < ret.size(); ++e)
+            ret[e] = e;
+
+        std::sort(ret.begin(), ret.end(), [this](size_t a, size_t b){
+                if (m_keys[a].len != m_keys[b].len)
+                    return m_keys[a].len < m_keys[b].len;
+
+                const uint64_t* ka = m_key_words.data() + m_keys[a].begin;
+                const uint64_t* kb = m_key_words.data() + m_keys[b].begin;
+
+                bool a_node = (ka[0] != CALI_INV_ID);
+                bool b_node = (kb[0] != CALI_INV_ID);
+
+                if (a_node != b_node)
+                    return b_node;
+
+                return std::lexicographical_compare(ka, ka + m_keys[a].len, kb, kb + m_keys[b].len);
+            });
+
+        return ret;
+    }
+
+    void clear() {
+        for (AggregateKernel* k : m_kernels)
+            k->~AggregateKernel();
+
+        m_slots.clear();
+        m_keys.clear();
+        m_key_words.clear();
+        m_kernels.clear();
+        m_arena.clear();
+
+        m_num_kernels = 0;
+    }
+};
+
+} // namespace [anonymous]
+
+
+struct Aggregator::AggregatorImpl
+{
+    // --- data
+
+    vector<string>         m_key_strings;
+    std::map<string, int>  m_key_depth;   ///< Path depth limits by key attribute name
+
+    bool                   m_select_all;
+    
+    vector<AggregateKernelConfig*> m_kernel_configs;
+    
+    /// \brief Thread-local partial aggregation state.
+    ///   Only the owning thread accesses a shard until flush().
+    struct Shard {
+        AggregationTable  table;
+
+        vector<string>    key_strings; ///< Key attributes not yet found in the DB
+        vector<cali_id_t> key_ids;
+        vector<int>       key_depths;  ///< Path depth limit per key_ids entry, 0 if none
+        vector<size_t>    key_pos;     ///< Position of each key_ids entry in m_key_strings
+        bool              has_key_depth = false;
+
+        /// Key node for records with a single reference entry, by reference node
+        std::unordered_map<const Node*, const Node*> key_node_cache;
+
+        // scratch space reused across process() calls
+        vector<const Node*> nodes;
+        vector<int>         skip;
+        vector<uint64_t>    key;
+        EntryList           list;
+
+        // batch processing scratch space
+        vector<EntryList>        batch_lists;
+        vector<size_t>           batch_group;   ///< Group index by record
+        vector<size_t>           batch_order;
+        vector<size_t>           batch_begin;
+        vector<AggregateKernel*> batch_group_kernels; ///< num_kernels per group
+        vector<AggregateKernel*> batch_kernels;
+        std::unordered_map<AggregateKernel*, size_t> batch_group_ids;
+
+        // spilling
+        bool              may_spill = false;
+        bool              spilling  = false; ///< Table is full: spill records with new keys
+        vector< vector<uint64_t> > spill_buf;   ///< Encoded records by partition
+    };
+
+    // --- external-memory aggregation
+
+    /// \brief Spill records to this many hash partitions
+    static const size_t    NumSpillPartitions = 16;
+    static const size_t    SpillBufferWords   = 16 * 1024;
+
+    size_t                 m_memory_limit;   ///< Approx. table memory limit in bytes, 0 if unlimited
+    std::string            m_spill_dir;
+    std::atomic<bool>      m_spill_enabled;
+    std::atomic<size_t>    m_merged_size;    ///< Memory size of the merged table
+    std::atomic<size_t>    m_num_spilled;    ///< Number of spilled records
+    std::vector<FILE*>     m_spill_files;
+    std::mutex             m_spill_lock;
+
+    uint64_t               m_serial;      ///< Unique instance ID for thread-local shard lookup
+
+    std::vector<Shard*>    m_shards;
+    std::mutex             m_shards_lock;
+
+    AggregationTable       m_table;       ///< Merged results
+    
+    //
+    // --- parse config
+    //
+
+    void parse_key(const string& key) {
+        util::split(key, ':', back_inserter(m_key_strings));
+
+        // prefix(attribute,depth) entries
+        for (string& s : m_key_strings) {
+            if (s.compare(0, 7, "prefix(") != 0 || s.back() != ')')
+                continue;
+
+            string::size_type comma = s.find_last_of(',');
+            int depth = 0;
+
+            if (comma != string::npos)
+                depth = std::atoi(s.c_str() + comma + 1);
+
+            if (comma == string::npos || comma <= 7 || depth < 1) {
+                Log(0).stream() << "aggregator: invalid key \"" << s << "\"" << std::endl;
+                continue;
+            }
+
+            s = s.substr(7, comma - 7);
+            m_key_depth[s] = depth;
+        }
+
+        m_select_all = m_key_strings.empty();
+    }
+
+    void parse_aggr_config(const string& configstr) {
+        vector<string> aggregators;
+        
+        util::split(configstr, ':', back_inserter(aggregators));
+
+        for (const string& s : aggregators) {
+            string::size_type oparen = s.find_first_of('(');
+            string::size_type cparen = s.find_last_of(')');
+
+            string kernelname = s.substr(0, oparen);
+            vector<string> kernelattrs;
+
+            if (cparen != string::npos && cparen > oparen+1) {
+                string kernelattrs_str = s.substr(oparen+1, cparen-oparen-1);
+                util::split(kernelattrs_str, ',', back_inserter(kernelattrs));
+            }
+
+            const ::KernelInfo* ki = ::kernel_list;
+
+            for ( ; ki->name && ki->create && kernelname != ki->name; ++ki)
+                ;
+
+            if (ki->create)
+                m_kernel_configs.push_back((*ki->create)(kernelattrs));
+            else
+                Log(0).stream() << "aggregator: unknown aggregation kernel \"" << kernelname << "\"" << std::endl;
+        }
+    }
+
+    void configure(const QuerySpec& spec) {
+        //
+        // --- key config
+        //
+        
+        m_kernel_configs.clear();
+        m_key_strings.clear();
+        m_key_depth.clear();
+        m_select_all = false;
+        
+        switch (spec.aggregation_key.selection) {
         case QuerySpec::AttributeSelection::Default:
         case QuerySpec::AttributeSelection::All:
             m_select_all  = true;
             break;
         case QuerySpec::AttributeSelection::List:
             m_key_strings = spec.aggregation_key.list;
+            m_key_depth   = spec.aggregation_key_depth;
             break;
         default:
             ; 
@@ -852,137 +2247,208 @@ struct Aggregator::AggregatorImpl
     }
     
     //
-    // --- aggregation db ops
+    // --- snapshot processing
     //
-    
-    TrieNode* get_trienode(uint32_t id) {
-        // Assume trie is locked!!
-        
-        if (id >= m_trie.size())
-            m_trie.resize(id+1);
-
-        if (!m_trie[id])
-            m_trie[id] = new TrieNode;
 
-        return m_trie[id];
-    }
+    /// \brief Get the calling thread's shard, create it if needed
+    Shard* get_shard() {
+        // Look up shards by instance serial rather than by pointer:
+        // the list may contain entries of destroyed aggregator instances
+        ThreadShardList* t_shards = get_thread_shard_list();
 
-    TrieNode* find_trienode(size_t n, unsigned char* key) {
-        std::lock_guard<std::mutex>
-            g(m_trie_lock);
+        for (const auto &p : *t_shards)
+            if (p.first == m_serial)
+                return static_cast<Shard*>(p.second);
 
-        TrieNode* trie = get_trienode(0);
+        Shard* shard = new Shard;
 
-        for ( size_t i = 0; trie && i < n; ++i ) {
-            uint32_t id = trie->next[key[i]];
+        shard->key_strings = m_key_strings;
+        shard->may_spill   = m_spill_enabled.load();
 
-            if (!id) {
-                id = static_cast<uint32_t>(m_trie.size()+1);
-                trie->next[key[i]] = id;
-            }
+        {
+            std::lock_guard<std::mutex>
+                g(m_shards_lock);
 
-            trie = get_trienode(id);
+            m_shards.push_back(shard);
         }
 
-        if (trie->kernels.empty())
-            for (AggregateKernelConfig* c : m_kernel_configs)
-                trie->kernels.push_back(c->make_kernel());
-        
-        return trie;
-    }
+        t_shards->push_back(std::make_pair(m_serial, static_cast<void*>(shard)));
 
-    //
-    // --- snapshot processing
-    //
+        return shard;
+    }
 
-    std::vector<cali_id_t> update_key_attribute_ids(CaliperMetadataAccessInterface& db) {
-        std::lock_guard<std::mutex>
-            g(m_key_lock);
+    void update_key_attribute_ids(CaliperMetadataAccessInterface& db, Shard* shard) {
+        auto it = shard->key_strings.begin();
         
-        auto it = m_key_strings.begin();
-        
-        while (it != m_key_strings.end()) {
+        while (it != shard->key_strings.end()) {
             Attribute attr = db.get_attribute(*it);
 
             if (attr != Attribute::invalid) {
-                m_key_ids.push_back(attr.id());
-                it = m_key_strings.erase(it);
+                auto dit  = m_key_depth.find(*it);
+                int depth = (dit == m_key_depth.end() ? 0 : dit->second);
+
+                // Keep key_ids in m_key_strings order, not in the order
+                // the attributes show up in this shard's data: the
+                // immediate part of the key is built in key_ids order,
+                // and flush() merges the shard tables by raw key words.
+                size_t pos = std::find(m_key_strings.begin(), m_key_strings.end(), *it) - m_key_strings.begin();
+                size_t k   = std::upper_bound(shard->key_pos.begin(), shard->key_pos.end(), pos) - shard->key_pos.begin();
+
+                shard->key_ids.insert(shard->key_ids.begin() + k, attr.id());
+                shard->key_depths.insert(shard->key_depths.begin() + k, depth);
+                shard->key_pos.insert(shard->key_pos.begin() + k, pos);
+                shard->has_key_depth = shard->has_key_depth || depth > 0;
+
+                it = shard->key_strings.erase(it);
             } else
                 ++it;
         }
+    }
 
-        return m_key_ids;
+    void process(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        process(db, get_shard(), list);
     }
 
-    size_t pack_key(const Node* key_node, const vector<Entry>& immediates, CaliperMetadataAccessInterface& db, unsigned char* key) {
-        unsigned char node_key[10];
-        size_t        node_key_len  = 0;
+    /// \brief Aggregate a batch of records. Groups the records by key
+    ///   first, and then updates each kernel for all groups at once.
+    void process(CaliperMetadataAccessInterface& db, const CompressedSnapshotBatch& batch) {
+        Shard* shard   = get_shard();
+        size_t n_rec   = batch.num_records();
+        size_t n_kern  = m_kernel_configs.size();
+        size_t n_group = 0;
 
-        if (key_node)
-            node_key_len = vlenc_u64(key_node->id(), node_key);
+        if (shard->batch_lists.size() < n_rec)
+            shard->batch_lists.resize(n_rec);
 
-        uint64_t      num_immediate = 0;
-        unsigned char imm_key[MAX_KEYLEN];
-        size_t        imm_key_len = 0;
-        
-        for (const Entry& e : immediates) {
-            unsigned char buf[32]; // max space for one immediate entry
-            size_t        p = 0;
+        shard->batch_group.assign(n_rec, 0);
+        shard->batch_group_kernels.clear();
+        shard->batch_group_ids.clear();
+
+        for (size_t r = 0; r < n_rec; ++r) {
+            EntryList& list = shard->batch_lists[r];
+            list.clear();
+
+            size_t n_nodes = batch.num_nodes(r);
+            size_t n_imm   = batch.num_immediates(r);
 
-            // need to convert the Variant to its actual type before saving
-            bool    ok = true;
-            Variant v  = e.value();
+            const cali_id_t* node_ids = batch.nodes(r);
+            const cali_id_t* attr     = batch.immediate_attr(r);
+            const Variant*   data     = batch.immediate_data(r);
 
-            if (!ok)
+            for (size_t i = 0; i < n_nodes; ++i)
+                list.push_back(Entry(db.node(node_ids[i])));
+            for (size_t i = 0; i < n_imm; ++i)
+                list.push_back(Entry(attr[i], data[i]));
+
+            AggregateKernel** kernels = get_kernels(db, shard, list);
+
+            if (!kernels) {
+                // spilled
+                shard->batch_group[r] = n_rec;
+                continue;
+            }
+            if (n_kern == 0)
                 continue;
-            
-            p += vlenc_u64(e.attribute(), buf+p);
-            p += v.pack(buf+p);
 
-            // discard entry if it won't fit in the key buf :-(
-            if (p + imm_key_len + node_key_len + 1 >= MAX_KEYLEN)
-                break;
+            // kernel objects are unique to an entry and don't move, so
+            // the first one identifies the group
+            auto ret = shard->batch_group_ids.emplace(kernels[0], n_group);
+
+            if (ret.second) {
+                shard->batch_group_kernels.insert(shard->batch_group_kernels.end(), kernels, kernels + n_kern);
+                ++n_group;
+            }
 
-            ++num_immediate;
-            memcpy(imm_key+imm_key_len, buf, p);
-            imm_key_len += p;
+            shard->batch_group[r] = ret.first->second;
         }
-        
-        size_t pos = vlenc_u64(2*num_immediate + (key_node ? 1 : 0), key);
-        
-        memcpy(key+pos, node_key, node_key_len);
-        pos += node_key_len;
-        memcpy(key+pos, imm_key,  imm_key_len);
-        pos += imm_key_len;
 
-        return pos;
+        if (n_group == 0)
+            return;
+
+        // --- Sort record indices by group (keeps record order within groups)
+
+        std::vector<size_t>& begin = shard->batch_begin;
+        std::vector<size_t>& order = shard->batch_order;
+
+        begin.assign(n_group + 1, 0);
+        order.resize(n_rec);
+
+        for (size_t r = 0; r < n_rec; ++r)
+            if (shard->batch_group[r] < n_rec)
+                ++begin[shard->batch_group[r] + 1];
+        for (size_t g = 0; g < n_group; ++g)
+            begin[g+1] += begin[g];
+        {
+            std::vector<size_t> pos(begin.begin(), begin.end() - 1);
+
+            for (size_t r = 0; r < n_rec; ++r)
+                if (shard->batch_group[r] < n_rec)
+                    order[pos[shard->batch_group[r]]++] = r;
+        }
+
+        AggregateBatch groups = { shard->batch_lists.data(), order.data(), begin.data(), n_group };
+
+        // --- Update the kernels
+
+        std::vector<AggregateKernel*>& kernels = shard->batch_kernels;
+
+        kernels.resize(n_group);
+
+        for (size_t k = 0; k < n_kern; ++k) {
+            for (size_t g = 0; g < n_group; ++g)
+                kernels[g] = shard->batch_group_kernels[g*n_kern + k];
+
+            m_kernel_configs[k]->aggregate_batch(db, groups, kernels.data());
+        }
     }
-    
-    void process(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        std::vector<cali_id_t>   key_ids = update_key_attribute_ids(db);
-                
-        // --- Unravel nodes, filter for key attributes
 
-        std::vector<const Node*> nodes;
-        std::vector<Entry>       immediates;
-        
-        nodes.reserve(80);
-        immediates.reserve(key_ids.size());        
+    /// \brief Make the key node: the (possibly new) context tree branch
+    ///   with the key attributes found in the reference entries of \a list
+    const Node* make_key_node(CaliperMetadataAccessInterface& db, Shard* shard, const EntryList& list) {
+        const std::vector<cali_id_t>& key_ids = shard->key_ids;
+        std::vector<const Node*>&     nodes   = shard->nodes;
+
+        nodes.clear();
 
         bool select_all = m_select_all;
-        
-        for (const Entry& e : list)
-            for (const Node* node = e.node(); node && node->attribute() != CALI_INV_ID; node = node->parent())
-                if (select_all || std::find(key_ids.begin(), key_ids.end(), node->attribute()) != key_ids.end())
-                    nodes.push_back(node);    
+        bool limited    = !select_all && shard->has_key_depth;
 
-        // Only include explicitly selected immediate entries in the key.
-        // Add them in key_ids order to make sure they're normalized
-        for (cali_id_t id : key_ids)
-            for (const Entry& e : list)
-                if (e.is_immediate() && e.attribute() == id)
-                    immediates.push_back(e);
+        std::vector<int>& skip = shard->skip;
         
+        for (const Entry& e : list) {
+            if (limited) {
+                // For depth-limited attributes, skip the innermost nodes
+                // beyond the given depth
+                skip.assign(key_ids.size(), 0);
+
+                for (const Node* node = e.node(); node && node->attribute() != CALI_INV_ID; node = node->parent()) {
+                    auto it = std::find(key_ids.begin(), key_ids.end(), node->attribute());
+
+                    if (it != key_ids.end())
+                        ++skip[it - key_ids.begin()];
+                }
+
+                for (size_t k = 0; k < key_ids.size(); ++k)
+                    skip[k] = (shard->key_depths[k] > 0 ? std::max(skip[k] - shard->key_depths[k], 0) : 0);
+            }
+
+            for (const Node* node = e.node(); node && node->attribute() != CALI_INV_ID; node = node->parent()) {
+                if (select_all) {
+                    nodes.push_back(node);
+                    continue;
+                }
+
+                auto it = std::find(key_ids.begin(), key_ids.end(), node->attribute());
+
+                if (it == key_ids.end())
+                    continue;
+                if (limited && skip[it - key_ids.begin()] > 0)
+                    --skip[it - key_ids.begin()];
+                else
+                    nodes.push_back(node);
+            }
+        }
+
         // --- Group by attribute, reverse nodes (restores original order) and get/create tree node.
         //       Keeps nested attributes separate.
 
@@ -994,114 +2460,433 @@ struct Aggregator::AggregatorImpl
 
         std::reverse(nodes.begin(), nodes.end());
 
-        const Node*   key_node = db.make_tree_entry(nodes.size(), nodes.data());
+        return db.make_tree_entry(nodes.size(), nodes.data());
+    }
+
+    void process(CaliperMetadataAccessInterface& db, Shard* shard, const EntryList& list) {
+        AggregateKernel** kernels = get_kernels(db, shard, list);
 
-        // --- Pack key
+        if (!kernels) // spilled
+            return;
 
-        unsigned char key[MAX_KEYLEN];
-        size_t        pos  = pack_key(key_node, immediates, db, key);
+        for (size_t i = 0; i < shard->table.num_kernels(); ++i)
+            kernels[i]->aggregate(db, list);
+    }
 
-        TrieNode*     trie = find_trienode(pos, key);
+    /// \brief Get (or create) the aggregation kernels for the key of \a list.
+    ///   Returns null if the record was spilled.
+    AggregateKernel** get_kernels(CaliperMetadataAccessInterface& db, Shard* shard, const EntryList& list) {
+        if (!shard->key_strings.empty()) {
+            size_t n = shard->key_ids.size();
 
-        if (!trie)
-            return;
+            update_key_attribute_ids(db, shard);
 
-        // --- Aggregate
-        
-        for (AggregateKernel* k : trie->kernels)
-            k->aggregate(db, list);
+            if (shard->key_ids.size() != n)
+                shard->key_node_cache.clear();
+        }
+
+        // --- Get the key node. Most records have a single reference entry:
+        //       cache their key node.
+
+        const Node* ref  = nullptr;
+        int         nref = 0;
+
+        for (const Entry& e : list)
+            if (e.node()) {
+                ref = e.node();
+                ++nref;
+            }
+
+        const Node* key_node = nullptr;
+
+        if (nref == 1) {
+            auto it = shard->key_node_cache.find(ref);
+
+            if (it == shard->key_node_cache.end())
+                it = shard->key_node_cache.emplace(ref, make_key_node(db, shard, list)).first;
+
+            key_node = it->second;
+        } else
+            key_node = make_key_node(db, shard, list);
+
+        // --- Make the normalized key: key node id, followed by
+        //       (attribute id, type, value) for the selected immediate
+        //       entries in key_ids order
+
+        std::vector<uint64_t>& key = shard->key;
+
+        key.clear();
+        key.push_back(key_node ? key_node->id() : CALI_INV_ID);
+
+        for (cali_id_t id : shard->key_ids)
+            for (const Entry& e : list)
+                if (e.is_immediate() && e.attribute() == id) {
+                    cali_variant_t v = e.value().c_variant();
+
+                    key.push_back(id);
+                    key.push_back(v.type_and_size);
+                    key.push_back(v.value.v_uint);
+                }
+
+        if (shard->spilling) {
+            size_t e = shard->table.find(key.data(), key.size());
+
+            if (e < shard->table.size())
+                return shard->table.kernels(e);
+            if (spill(shard, key, list))
+                return nullptr;
+        }
+
+        size_t n = shard->table.size();
+        AggregateKernel** kernels = shard->table.get(key.data(), key.size(), m_kernel_configs);
+
+        if (shard->may_spill && shard->table.size() != n && shard->table.size() % 256 == 0)
+            check_memory_limit(shard);
+
+        return kernels;
     }
 
     //
-    // --- Flush
+    // --- Spilling
     //
 
-    void unpack_key(const unsigned char* key, const CaliperMetadataAccessInterface& db, EntryList& list) {
-        // key format: 2*N + node flag, node id, N * (attr id, Variant)
+    /// \brief Switch \a shard to spill mode if the tables exceed the memory limit
+    void check_memory_limit(Shard* shard) {
+        size_t num_shards = 1;
 
-        size_t   p = 0;
-        uint64_t n = vldec_u64(key + p, &p);
+        {
+            std::lock_guard<std::mutex>
+                g(m_shards_lock);
 
-        if (n % 2 == 1)
-            list.push_back(Entry(db.node(vldec_u64(key + p, &p))));
+            num_shards = std::max<size_t>(1, m_shards.size());
+        }
 
-        for (unsigned i = 0; i < n/2; ++i) {
-            bool      ok   = true;
-            
-            cali_id_t id   = static_cast<cali_id_t>(vldec_u64(key+p, &p));
-            Variant   data = Variant::unpack(key+p, &p, &ok);
+        size_t merged = m_merged_size.load();
+        size_t limit  = (m_memory_limit > merged ? (m_memory_limit - merged) / num_shards : 0);
 
-            if (ok)
-                list.push_back(Entry(db.get_attribute(id), data));
+        if (shard->table.memory_size() > limit) {
+            shard->spilling = true;
+            shard->spill_buf.resize(NumSpillPartitions);
         }
     }
-    
-    void recursive_flush(size_t n, unsigned char* key, TrieNode* trie,
-                         CaliperMetadataAccessInterface& db, const SnapshotProcessFn push) {
-        if (!trie)
-            return;
 
-        // --- Write current entry (if it represents a snapshot)
-        
-        if (!trie->kernels.empty()) {
-            EntryList list;
+    /// \brief Encode \a list into the shard's spill buffer for the
+    ///   partition of \a key.
+    ///
+    /// Record format: number of entries, then (0, node id) for reference
+    /// entries, or (1, attribute id, variant type_and_size, variant value)
+    /// for immediate entries. Strings and blobs are kept as pointers,
+    /// like in the in-memory keys: spill files are only read by this
+    /// process while the metadata DB is alive.
+    bool spill(Shard* shard, const std::vector<uint64_t>& key, const EntryList& list) {
+        if (!m_spill_enabled.load())
+            return false;
 
-            // Decode & add key node entry
-            unpack_key(key, db, list);
+        size_t p = (AggregationTable::hash(key.data(), key.size()) >> 32) % NumSpillPartitions;
+        std::vector<uint64_t>& buf = shard->spill_buf[p];
 
-            // Write aggregation variables
-            for (AggregateKernel* k : trie->kernels)
-                k->append_result(db, list);
+        buf.push_back(list.size());
 
-            push(db, list);
+        for (const Entry& e : list) {
+            if (e.is_reference()) {
+                buf.push_back(0);
+                buf.push_back(e.node()->id());
+            } else {
+                cali_variant_t v = e.value().c_variant();
+
+                buf.push_back(1);
+                buf.push_back(e.attribute());
+                buf.push_back(v.type_and_size);
+                buf.push_back(v.value.v_uint);
+            }
         }
 
-        // --- Recursively iterate over subsequent DB entries
+        ++m_num_spilled;
 
-        unsigned char* next_key = static_cast<unsigned char*>(alloca(n+2));
+        if (buf.size() >= SpillBufferWords)
+            return write_spill_buffer(p, buf);
 
-        memset(next_key, 0, n+2);
-        memcpy(next_key, key, n);
-        
-        for (size_t i = 0; i < 256; ++i) {
-            if (trie->next[i] == 0)
+        return true;
+    }
+
+    FILE* open_spill_file() {
+        std::string path = m_spill_dir + "/caliper-aggregate-XXXXXX";
+        std::vector<char> buf(path.begin(), path.end());
+        buf.push_back('\0');
+
+        int fd = mkstemp(buf.data());
+
+        if (fd < 0)
+            return nullptr;
+
+        // Only accessed through the descriptor: remove the name right
+        // away so it won't be left over
+        unlink(buf.data());
+
+        return fdopen(fd, "w+b");
+    }
+
+    /// \brief Append the encoded records in \a buf to partition \a p.
+    ///   On error, disables spilling and returns false.
+    bool write_spill_buffer(size_t p, std::vector<uint64_t>& buf) {
+        if (buf.empty())
+            return true;
+
+        std::lock_guard<std::mutex>
+            g(m_spill_lock);
+
+        if (!m_spill_files[p])
+            m_spill_files[p] = open_spill_file();
+
+        bool ok = m_spill_files[p] &&
+            fwrite(buf.data(), sizeof(uint64_t), buf.size(), m_spill_files[p]) == buf.size();
+
+        buf.clear();
+
+        if (!ok && m_spill_enabled.exchange(false))
+            Log(0).stream() << "aggregator: error: could not write spill file in " << m_spill_dir
+                            << ", spilled records are lost" << std::endl;
+
+        return ok;
+    }
+
+    /// \brief Read the next spilled record from \a fp into \a list
+    bool read_spilled_record(CaliperMetadataAccessInterface& db, FILE* fp, EntryList& list) {
+        uint64_t n = 0;
+
+        list.clear();
+
+        if (fread(&n, sizeof(uint64_t), 1, fp) != 1)
+            return false;
+
+        for (uint64_t i = 0; i < n; ++i) {
+            uint64_t w[4];
+
+            if (fread(w, sizeof(uint64_t), 2, fp) != 2)
+                return false;
+
+            if (w[0] == 0) {
+                list.push_back(Entry(db.node(w[1])));
+                continue;
+            }
+
+            if (fread(w + 2, sizeof(uint64_t), 2, fp) != 2)
+                return false;
+
+            cali_variant_t v;
+
+            v.type_and_size = w[2];
+            v.value.v_uint  = w[3];
+
+            list.push_back(Entry(w[1], Variant(v)));
+        }
+
+        return true;
+    }
+
+    /// \brief Aggregate the spilled records one partition at a time, and
+    ///   push the results. Results for keys that are also in the merged
+    ///   table include the merged table's values; these keys are marked
+    ///   in \a absorbed.
+    void flush_spilled(CaliperMetadataAccessInterface& db, const SnapshotProcessFn push, std::vector<bool>& absorbed) {
+        for (Shard* shard : m_shards)
+            for (size_t p = 0; p < shard->spill_buf.size(); ++p)
+                write_spill_buffer(p, shard->spill_buf[p]);
+
+        Shard shard;
+
+        shard.key_strings = m_key_strings;
+
+        EntryList rec;
+        size_t    num_keys = 0;
+
+        for (FILE* fp : m_spill_files) {
+            if (!fp)
                 continue;
 
-            TrieNode* next = get_trienode(trie->next[i]);
-            next_key[n]    = static_cast<unsigned char>(i);
+            fflush(fp);
+            rewind(fp);
+
+            while (read_spilled_record(db, fp, rec))
+                process(db, &shard, rec);
+
+            // keep appending to the partition after the flush
+            fseek(fp, 0, SEEK_END);
+
+            AggregationTable& t = shard.table;
+
+            for (size_t e : t.sorted_entries()) {
+                size_t          len = 0;
+                const uint64_t* key = t.key(e, &len);
 
-            recursive_flush(n+1, next_key, next, db, push);
+                AggregateKernel** kernels = t.kernels(e);
+                size_t            m       = m_table.find(key, len);
+
+                if (m < m_table.size()) {
+                    AggregateKernel** src = m_table.kernels(m);
+
+                    for (size_t i = 0; i < t.num_kernels() && i < m_table.num_kernels(); ++i)
+                        kernels[i]->merge(src[i]);
+
+                    absorbed[m] = true;
+                }
+
+                EntryList list;
+
+                unpack_key(key, len, db, list);
+
+                for (size_t i = 0; i < t.num_kernels(); ++i)
+                    kernels[i]->append_result(db, list);
+
+                push(db, list);
+            }
+
+            num_keys = std::max(num_keys, t.size());
+            t.clear();
         }
+
+        Log(1).stream() << "aggregator: aggregated " << m_num_spilled.load() << " spilled records"
+                        << " in " << NumSpillPartitions << " partitions"
+                        << " (max. " << num_keys << " keys per partition)" << std::endl;
     }
-    
+
+    void set_memory_limit(size_t bytes, const std::string& dir) {
+        m_memory_limit = bytes;
+        m_spill_dir    = dir;
+
+        if (m_spill_dir.empty()) {
+            const char* tmpdir = getenv("TMPDIR");
+            m_spill_dir = (tmpdir && *tmpdir ? tmpdir : "/tmp");
+        }
+
+        bool enable = (bytes > 0);
+
+        // percent_total needs the total of all entries before it can
+        // write any result, so it can't work partition by partition
+        for (AggregateKernelConfig* c : m_kernel_configs)
+            if (dynamic_cast<PercentTotalKernel::Config*>(c)) {
+                if (enable)
+                    Log(1).stream() << "aggregator: percent_total() does not support a memory limit"
+                                    << std::endl;
+                enable = false;
+            }
+
+        m_spill_enabled.store(enable);
+        m_spill_files.assign(NumSpillPartitions, nullptr);
+    }
+
+    //
+    // --- Flush
+    //
+
+    void unpack_key(const uint64_t* key, size_t len, CaliperMetadataAccessInterface& db, EntryList& list) {
+        // key format: key node id, N * (attr id, variant type_and_size, variant value)
+
+        if (key[0] != CALI_INV_ID)
+            list.push_back(Entry(db.node(key[0])));
+
+        for (size_t i = 1; i + 3 <= len; i += 3) {
+            cali_variant_t v;
+
+            v.type_and_size = key[i+1];
+            v.value.v_uint  = key[i+2];
+
+            list.push_back(Entry(db.get_attribute(key[i]), Variant(v)));
+        }
+    }
+
     void flush(CaliperMetadataAccessInterface& db, const SnapshotProcessFn push) {
         // NOTE: No locking: we assume flush() runs serially!
-        
-        TrieNode*     trie = get_trienode(0);
-        unsigned char key  = 0;
 
-        recursive_flush(0, &key, trie, db, push);
+        // Move the thread-local partial results into the merged table
+        for (Shard* shard : m_shards) {
+            AggregationTable& t = shard->table;
+
+            for (size_t e = 0; e < t.size(); ++e) {
+                size_t          len = 0;
+                const uint64_t* key = t.key(e, &len);
+
+                AggregateKernel** src    = t.kernels(e);
+                AggregateKernel** target = m_table.get(key, len, m_kernel_configs);
+
+                for (size_t i = 0; i < t.num_kernels() && i < m_table.num_kernels(); ++i)
+                    target[i]->merge(src[i]);
+            }
+
+            t.clear();
+        }
+
+        for (Shard* shard : m_shards)
+            shard->spilling = false;
+
+        m_merged_size.store(m_table.memory_size());
+
+        std::vector<bool> absorbed(m_table.size(), false);
+
+        if (m_num_spilled.load() > 0)
+            flush_spilled(db, push, absorbed);
+
+        if (m_table.num_kernels() == 0)
+            return;
+
+        for (size_t e : m_table.sorted_entries()) {
+            if (absorbed[e])
+                continue;
+
+            EntryList list;
+
+            size_t          len = 0;
+            const uint64_t* key = m_table.key(e, &len);
+
+            // Decode & add key entries
+            unpack_key(key, len, db, list);
+
+            // Write aggregation variables
+            AggregateKernel** kernels = m_table.kernels(e);
+
+            for (size_t i = 0; i < m_table.num_kernels(); ++i)
+                kernels[i]->append_result(db, list);
+
+            push(db, list);
+        }
     }
 
-    AggregatorImpl() 
-        : m_select_all(false)
-    {
-        m_trie.reserve(4096);
+    static uint64_t next_serial() {
+        static std::atomic<uint64_t> s_serial(0);
+        return ++s_serial;
     }
 
+    AggregatorImpl() 
+        : m_select_all(false),
+          m_memory_limit(0),
+          m_spill_enabled(false),
+          m_merged_size(0),
+          m_num_spilled(0),
+          m_serial(next_serial())
+    { }
+
     AggregatorImpl(const QuerySpec& spec) 
-        : m_select_all(false)
+        : m_select_all(false),
+          m_memory_limit(0),
+          m_spill_enabled(false),
+          m_merged_size(0),
+          m_num_spilled(0),
+          m_serial(next_serial())
     {
         configure(spec);
-        m_trie.reserve(4096);
     }
 
     ~AggregatorImpl() {
-        for (TrieNode* e : m_trie)
-            delete e;
+        for (Shard* shard : m_shards)
+            delete shard;
+
+        m_shards.clear();
+        m_table.clear();
+
+        for (FILE* fp : m_spill_files)
+            if (fp)
+                fclose(fp);
 
-        m_trie.clear();
-        
         for (AggregateKernelConfig* c : m_kernel_configs)
             delete c;
 
@@ -1132,12 +2917,24 @@ Aggregator::flush(CaliperMetadataAccessInterface& db, SnapshotProcessFn push)
     mP->flush(db, push);
 }
 
+void
+Aggregator::set_memory_limit(size_t bytes, const std::string& spill_dir)
+{
+    mP->set_memory_limit(bytes, spill_dir);
+}
+
 void
 Aggregator::add(CaliperMetadataAccessInterface& db, const EntryList& list)
 {
     mP->process(db, list);
 }
 
+void
+Aggregator::add(CaliperMetadataAccessInterface& db, const CompressedSnapshotBatch& batch)
+{
+    mP->process(db, batch);
+}
+
 const QuerySpec::FunctionSignature*
 Aggregator::aggregation_defs()
 {
@@ -1172,6 +2969,22 @@ Aggregator::aggregation_attribute_names(const QuerySpec& spec)
             case KernelID::PercentTotal:
                 ret.push_back(std::string("percent_total#") + op.args[0]);
                 break;
+            case KernelID::Quantile:
+                if (op.args.size() > 1) {
+                    for (auto it = op.args.begin() + 1; it != op.args.end(); ++it)
+                        ret.push_back(std::string("p") + *it + "#" + op.args[0]);
+                } else {
+                    for (const char* p : { "50", "90", "99" })
+                        ret.push_back(std::string("p") + p + "#" + op.args[0]);
+                }
+                break;
+            case KernelID::CountDistinct:
+                ret.push_back(std::string("count_distinct#") + op.args[0]);
+                break;
+            case KernelID::Merge:
+                // merged attributes depend on the input
+                ret.push_back("count");
+                break;
             }
         }
     }
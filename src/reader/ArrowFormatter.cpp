@@ -0,0 +1,828 @@
+// Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Write records in the Apache Arrow IPC file format
+
+#include "caliper/reader/ArrowFormatter.h"
+
+#include "caliper/reader/QuerySpec.h"
+
+#include "caliper/common/Attribute.h"
+#include "caliper/common/CaliperMetadataAccessInterface.h"
+#include "caliper/common/Node.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+using namespace cali;
+
+namespace
+{
+
+//
+// --- A minimal FlatBuffers serializer
+//
+//   Arrow IPC metadata is encoded as FlatBuffers. We build a small
+// object tree and serialize it front-to-back: each table is preceded by
+// its vtable, and child objects follow their parent, so that all
+// offsets point forward. The result is a valid flatbuffer, even though
+// it is laid out differently from what the flatc-generated builders
+// produce. Assumes a little-endian host.
+//
+
+struct FbObject;
+
+typedef std::shared_ptr<FbObject> FbRef;
+
+struct FbObject
+{
+    enum Kind { Table, String, TableVector, StructVector };
+
+    struct Field {
+        int      slot;
+        int      size;  ///< Size of a scalar field in bytes
+        uint64_t bits;  ///< Value of a scalar field
+        FbRef    child; ///< Child object for offset fields
+    };
+
+    Kind               kind;
+    std::vector<Field> fields;   ///< Table fields
+    std::string        data;     ///< String contents or struct vector bytes
+    std::vector<FbRef> elems;    ///< Table vector elements
+    uint32_t           count;    ///< Number of struct vector elements
+
+    FbObject(Kind k)
+        : kind(k), count(0)
+        { }
+
+    FbObject* add(int slot, int size, uint64_t bits) {
+        fields.push_back(Field { slot, size, bits, FbRef() });
+        return this;
+    }
+
+    FbObject* add(int slot, FbRef child) {
+        fields.push_back(Field { slot, 4, 0, child });
+        return this;
+    }
+};
+
+FbRef fb_table()
+{
+    return std::make_shared<FbObject>(FbObject::Table);
+}
+
+FbRef fb_string(const std::string& str)
+{
+    FbRef obj = std::make_shared<FbObject>(FbObject::String);
+    obj->data = str;
+    return obj;
+}
+
+FbRef fb_vector(const std::vector<FbRef>& elems)
+{
+    FbRef obj = std::make_shared<FbObject>(FbObject::TableVector);
+    obj->elems = elems;
+    return obj;
+}
+
+/// \brief A vector of structs. All Arrow IPC structs we use have
+///   8-byte alignment.
+FbRef fb_structs(const std::string& data, uint32_t count)
+{
+    FbRef obj = std::make_shared<FbObject>(FbObject::StructVector);
+    obj->data  = data;
+    obj->count = count;
+    return obj;
+}
+
+class FbWriter
+{
+    std::string m_buf;
+
+    void pad_to(size_t align) {
+        m_buf.append((align - m_buf.size() % align) % align, '\0');
+    }
+
+    template<typename T>
+    size_t put(T val) {
+        size_t pos = m_buf.size();
+        m_buf.append(reinterpret_cast<const char*>(&val), sizeof(T));
+        return pos;
+    }
+
+    void patch_offset(size_t at, size_t target) {
+        uint32_t off = static_cast<uint32_t>(target - at);
+        std::memcpy(&m_buf[at], &off, sizeof(off));
+    }
+
+    size_t write_table(const FbObject& obj) {
+        // put larger fields first so that every field is naturally aligned
+
+        std::vector<const FbObject::Field*> fields;
+
+        for (const FbObject::Field& f : obj.fields)
+            fields.push_back(&f);
+
+        std::stable_sort(fields.begin(), fields.end(),
+                         [](const FbObject::Field* a, const FbObject::Field* b){
+                             return a->size > b->size;
+                         });
+
+        int nslots = 0;
+
+        for (const FbObject::Field* f : fields)
+            nslots = std::max(nslots, f->slot + 1);
+
+        std::vector<uint16_t> voffsets(nslots, 0);
+        size_t tsize = 4; // soffset to vtable
+
+        for (const FbObject::Field* f : fields) {
+            tsize = (tsize + f->size - 1) / f->size * f->size;
+            voffsets[f->slot] = static_cast<uint16_t>(tsize);
+            tsize += f->size;
+        }
+
+        // vtable, then the table itself at an 8-byte boundary
+
+        pad_to(4);
+
+        size_t vt_pos = put<uint16_t>(static_cast<uint16_t>(4 + 2*nslots));
+        put<uint16_t>(static_cast<uint16_t>(tsize));
+
+        for (uint16_t o : voffsets)
+            put<uint16_t>(o);
+
+        pad_to(8);
+
+        size_t tbl_pos = put<int32_t>(static_cast<int32_t>(m_buf.size() - vt_pos));
+        m_buf.resize(tbl_pos + tsize, '\0');
+
+        for (const FbObject::Field* f : fields)
+            if (!f->child)
+                std::memcpy(&m_buf[tbl_pos + voffsets[f->slot]], &f->bits, f->size);
+
+        for (const FbObject::Field* f : fields)
+            if (f->child)
+                patch_offset(tbl_pos + voffsets[f->slot], write(*f->child));
+
+        return tbl_pos;
+    }
+
+    size_t write(const FbObject& obj) {
+        size_t pos = 0;
+
+        switch (obj.kind) {
+        case FbObject::Table:
+            pos = write_table(obj);
+            break;
+        case FbObject::String:
+            pad_to(4);
+            pos = put<uint32_t>(static_cast<uint32_t>(obj.data.size()));
+            m_buf.append(obj.data);
+            m_buf.push_back('\0');
+            break;
+        case FbObject::TableVector:
+        {
+            pad_to(4);
+            pos = put<uint32_t>(static_cast<uint32_t>(obj.elems.size()));
+
+            std::vector<size_t> offsets;
+
+            for (size_t i = 0; i < obj.elems.size(); ++i)
+                offsets.push_back(put<uint32_t>(0));
+            for (size_t i = 0; i < obj.elems.size(); ++i)
+                patch_offset(offsets[i], write(*obj.elems[i]));
+        }
+            break;
+        case FbObject::StructVector:
+            // align the elements (not the length prefix) to 8 bytes
+            pad_to(4);
+            if (m_buf.size() % 8 == 0)
+                put<uint32_t>(0);
+            pos = put<uint32_t>(obj.count);
+            m_buf.append(obj.data);
+            break;
+        }
+
+        return pos;
+    }
+
+public:
+
+    std::string finish(const FbObject& root) {
+        m_buf.clear();
+        put<uint32_t>(0);
+        patch_offset(0, write(root));
+
+        return m_buf;
+    }
+};
+
+template<typename T>
+void append_bytes(std::string& str, T val)
+{
+    str.append(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+//
+// --- Arrow IPC metadata
+//
+
+// Constants from Arrow's Schema.fbs and Message.fbs
+
+const uint16_t ArrowMetadataV5       = 4;
+
+const uint8_t  ArrowTypeInt          = 2;
+const uint8_t  ArrowTypeFloatingPoint = 3;
+const uint8_t  ArrowTypeUtf8         = 5;
+const uint8_t  ArrowTypeBool         = 6;
+
+const uint16_t ArrowPrecisionDouble  = 2;
+
+const uint8_t  ArrowHeaderSchema     = 1;
+const uint8_t  ArrowHeaderDictionaryBatch = 2;
+const uint8_t  ArrowHeaderRecordBatch = 3;
+
+/// Max. number of rows per record batch
+const size_t   ArrowBatchRows = 64*1024;
+
+FbRef make_int_type(int bits, bool is_signed)
+{
+    FbRef t = fb_table();
+    t->add(0, 4, bits)->add(1, 1, is_signed ? 1 : 0);
+    return t;
+}
+
+FbRef make_message(uint8_t header_type, FbRef header, int64_t body_length)
+{
+    FbRef msg = fb_table();
+
+    msg->add(0, 2, ArrowMetadataV5);
+    msg->add(1, 1, header_type);
+    msg->add(2, header);
+    msg->add(3, 8, static_cast<uint64_t>(body_length));
+
+    return msg;
+}
+
+/// \brief Message body: a list of 8-byte aligned buffers
+struct ArrowBody {
+    std::string data;
+    std::string buffers; ///< Buffer structs for the RecordBatch metadata
+    uint32_t    nbuffers;
+    std::string nodes;   ///< FieldNode structs for the RecordBatch metadata
+    uint32_t    nnodes;
+
+    ArrowBody()
+        : nbuffers(0), nnodes(0)
+        { }
+
+    void add_buffer(const void* ptr, size_t size) {
+        append_bytes<int64_t>(buffers, data.size());
+        append_bytes<int64_t>(buffers, size);
+        ++nbuffers;
+
+        data.append(static_cast<const char*>(ptr), size);
+        data.append((8 - size % 8) % 8, '\0');
+    }
+
+    void add_node(size_t length, size_t null_count) {
+        append_bytes<int64_t>(nodes, length);
+        append_bytes<int64_t>(nodes, null_count);
+        ++nnodes;
+    }
+
+    FbRef make_record_batch(size_t length) const {
+        FbRef rb = fb_table();
+
+        rb->add(0, 8, length);
+        rb->add(1, fb_structs(nodes, nnodes));
+        rb->add(2, fb_structs(buffers, nbuffers));
+
+        return rb;
+    }
+};
+
+/// \brief File footer Block structs for the messages in the file
+struct ArrowBlocks {
+    std::string data;
+    uint32_t    count;
+
+    ArrowBlocks()
+        : count(0)
+        { }
+
+    void add(size_t offset, size_t metadata_length, size_t body_length) {
+        append_bytes<int64_t>(data, offset);
+        append_bytes<int32_t>(data, metadata_length);
+        append_bytes<int32_t>(data, 0); // padding
+        append_bytes<int64_t>(data, body_length);
+        ++count;
+    }
+};
+
+/// \brief Pack a byte-per-value vector into an Arrow bitmap
+std::vector<uint8_t> pack_bits(const std::vector<uint8_t>& vec, size_t begin, size_t end)
+{
+    std::vector<uint8_t> bits((end - begin + 7) / 8, 0);
+
+    for (size_t i = begin; i < end; ++i)
+        if (vec[i])
+            bits[(i-begin)/8] |= static_cast<uint8_t>(1 << ((i-begin) % 8));
+
+    return bits;
+}
+
+} // namespace [anonymous]
+
+
+struct ArrowFormatter::ArrowFormatterImpl
+{
+    enum ColumnType {
+        Undecided, Int64, UInt64, Float64, Boolean, Dictionary
+    };
+
+    /// \brief A column. Values are stored as raw 64-bit words, dictionary
+    ///   columns store indices into the column's dictionary.
+    struct Column {
+        std::string           name;
+        Attribute             attr;
+        ColumnType            type;
+
+        std::vector<uint64_t> values;
+        std::vector<uint8_t>  valid;
+
+        std::vector<std::string> dict;
+        std::unordered_map<std::string, uint32_t> dict_index;
+
+        Column(const std::string& n, const Attribute& a, size_t nrows)
+            : name(n), attr(Attribute::invalid), type(Undecided), values(nrows, 0), valid(nrows, 0)
+            {
+                set_attribute(a);
+            }
+
+        void set_attribute(const Attribute& a) {
+            attr = a;
+
+            if (a == Attribute::invalid)
+                return;
+
+            switch (a.type()) {
+            case CALI_TYPE_INT:
+                type = Int64;
+                break;
+            case CALI_TYPE_UINT:
+            case CALI_TYPE_ADDR:
+                type = UInt64;
+                break;
+            case CALI_TYPE_DOUBLE:
+                type = Float64;
+                break;
+            case CALI_TYPE_BOOL:
+                type = Boolean;
+                break;
+            default:
+                type = Dictionary;
+            }
+        }
+
+        void push_null() {
+            values.push_back(0);
+            valid.push_back(0);
+        }
+
+        void push_string(const std::string& str) {
+            auto it = dict_index.find(str);
+
+            if (it == dict_index.end()) {
+                it = dict_index.emplace(str, static_cast<uint32_t>(dict.size())).first;
+                dict.push_back(str);
+            }
+
+            values.push_back(it->second);
+            valid.push_back(1);
+        }
+
+        void push_value(const Variant& v) {
+            bool     ok = true;
+            uint64_t bits = 0;
+
+            switch (type) {
+            case Int64:
+            {
+                int64_t i = 0;
+
+                if (v.type() == CALI_TYPE_INT)
+                    i = v.to_int(&ok);
+                else if (v.type() == CALI_TYPE_UINT || v.type() == CALI_TYPE_ADDR)
+                    i = static_cast<int64_t>(v.to_uint(&ok));
+                else
+                    i = static_cast<int64_t>(v.to_double(&ok));
+
+                std::memcpy(&bits, &i, sizeof(bits));
+            }
+                break;
+            case UInt64:
+                if (v.type() == CALI_TYPE_DOUBLE)
+                    bits = static_cast<uint64_t>(v.to_double(&ok));
+                else
+                    bits = v.to_uint(&ok);
+                break;
+            case Float64:
+            {
+                double d = v.to_double(&ok);
+                std::memcpy(&bits, &d, sizeof(bits));
+            }
+                break;
+            case Boolean:
+                bits = v.to_bool(&ok) ? 1 : 0;
+                break;
+            default:
+                push_string(v.to_string());
+                return;
+            }
+
+            if (ok) {
+                values.push_back(bits);
+                valid.push_back(1);
+            } else
+                push_null();
+        }
+    };
+
+    std::vector<Column> m_cols;
+    size_t              m_nrows;
+    bool                m_auto_column;
+
+    std::mutex          m_lock;
+
+    ArrowFormatterImpl()
+        : m_nrows(0), m_auto_column(false)
+        { }
+
+    void configure(const QuerySpec& spec) {
+        switch (spec.attribute_selection.selection) {
+        case QuerySpec::AttributeSelection::Default:
+        case QuerySpec::AttributeSelection::All:
+            m_auto_column = true;
+            break;
+        case QuerySpec::AttributeSelection::List:
+            for (const std::string& s : spec.attribute_selection.list)
+                m_cols.emplace_back(s, Attribute::invalid, 0);
+            break;
+        case QuerySpec::AttributeSelection::None:
+            break;
+        }
+    }
+
+    void update_column_attribute(CaliperMetadataAccessInterface& db, cali_id_t attr_id) {
+        for (const Column& col : m_cols)
+            if (col.attr.id() == attr_id)
+                return;
+
+        Attribute attr = db.get_attribute(attr_id);
+
+        if (attr == Attribute::invalid)
+            return;
+
+        std::string name = attr.name();
+
+        // Skip internal "cali." and ".event" attributes
+        if (name.compare(0, 5, "cali." ) == 0 ||
+            name.compare(0, 6, "event.") == 0)
+            return;
+
+        m_cols.emplace_back(name, attr, m_nrows);
+    }
+
+    void update_columns(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        if (m_auto_column)
+            for (const Entry& e : list) {
+                if (e.node()) {
+                    for (const Node* node = e.node(); node && node->attribute() != CALI_INV_ID; node = node->parent())
+                        update_column_attribute(db, node->attribute());
+                } else
+                    update_column_attribute(db, e.attribute());
+            }
+
+        for (Column& col : m_cols)
+            if (col.attr == Attribute::invalid)
+                col.set_attribute(db.get_attribute(col.name));
+    }
+
+    void add(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        std::lock_guard<std::mutex>
+            g(m_lock);
+
+        update_columns(db, list);
+
+        std::vector<Variant>     cells(m_cols.size());
+        std::vector<std::string> paths(m_cols.size());
+
+        bool active = false;
+
+        for (size_t c = 0; c < m_cols.size(); ++c) {
+            const Column& col = m_cols[c];
+
+            if (col.attr == Attribute::invalid)
+                continue;
+
+            cali_id_t id = col.attr.id();
+
+            for (const Entry& e : list) {
+                if (e.node()) {
+                    if (col.type == Dictionary) {
+                        // tree paths: join all values on the path
+                        for (const Node* node = e.node(); node; node = node->parent())
+                            if (node->attribute() == id)
+                                paths[c] = node->data().to_string().append(paths[c].empty() ? "" : "/").append(paths[c]);
+
+                        if (!paths[c].empty())
+                            break;
+                    } else {
+                        // numbers: take the innermost value
+                        for (const Node* node = e.node(); node && cells[c].empty(); node = node->parent())
+                            if (node->attribute() == id)
+                                cells[c] = node->data();
+
+                        if (!cells[c].empty())
+                            break;
+                    }
+                } else if (e.attribute() == id) {
+                    cells[c] = e.value();
+                    break;
+                }
+            }
+
+            if (!cells[c].empty() || !paths[c].empty())
+                active = true;
+        }
+
+        if (!active)
+            return;
+
+        for (size_t c = 0; c < m_cols.size(); ++c) {
+            if (!paths[c].empty())
+                m_cols[c].push_string(paths[c]);
+            else if (!cells[c].empty())
+                m_cols[c].push_value(cells[c]);
+            else
+                m_cols[c].push_null();
+        }
+
+        ++m_nrows;
+    }
+
+    FbRef make_field(const Column& col, int64_t dict_id) const {
+        FbRef field = fb_table();
+
+        field->add(0, fb_string(col.name));
+        field->add(1, 1, 1); // nullable
+
+        switch (col.type) {
+        case Int64:
+        case UInt64:
+            field->add(2, 1, ArrowTypeInt);
+            field->add(3, make_int_type(64, col.type == Int64));
+            break;
+        case Float64:
+        {
+            FbRef t = fb_table();
+            t->add(0, 2, ArrowPrecisionDouble);
+            field->add(2, 1, ArrowTypeFloatingPoint);
+            field->add(3, t);
+        }
+            break;
+        case Boolean:
+            field->add(2, 1, ArrowTypeBool);
+            field->add(3, fb_table());
+            break;
+        default:
+        {
+            FbRef enc = fb_table();
+            enc->add(0, 8, static_cast<uint64_t>(dict_id));
+            enc->add(1, make_int_type(32, true));
+            enc->add(2, 1, 0); // not ordered
+
+            field->add(2, 1, ArrowTypeUtf8);
+            field->add(3, fb_table());
+            field->add(4, enc);
+        }
+        }
+
+        field->add(5, fb_vector(std::vector<FbRef>()));
+
+        return field;
+    }
+
+    FbRef make_schema() const {
+        std::vector<FbRef> fields;
+
+        for (size_t c = 0; c < m_cols.size(); ++c)
+            fields.push_back(make_field(m_cols[c], static_cast<int64_t>(c)));
+
+        FbRef schema = fb_table();
+
+        schema->add(0, 2, 0); // little endian
+        schema->add(1, fb_vector(fields));
+
+        return schema;
+    }
+
+    ArrowBody make_dictionary_body(const Column& col) const {
+        ArrowBody body;
+
+        std::vector<int32_t> offsets(1, 0);
+        std::string data;
+
+        for (const std::string& s : col.dict) {
+            data.append(s);
+            offsets.push_back(static_cast<int32_t>(data.size()));
+        }
+
+        body.add_node(col.dict.size(), 0);
+        body.add_buffer(nullptr, 0);
+        body.add_buffer(offsets.data(), offsets.size() * sizeof(int32_t));
+        body.add_buffer(data.data(), data.size());
+
+        return body;
+    }
+
+    ArrowBody make_record_batch_body(size_t begin, size_t end) const {
+        ArrowBody body;
+
+        for (const Column& col : m_cols) {
+            size_t nulls = std::count(col.valid.begin() + begin, col.valid.begin() + end, 0);
+
+            body.add_node(end - begin, nulls);
+
+            if (nulls > 0) {
+                std::vector<uint8_t> validity = pack_bits(col.valid, begin, end);
+                body.add_buffer(validity.data(), validity.size());
+            } else
+                body.add_buffer(nullptr, 0);
+
+            switch (col.type) {
+            case Int64:
+            case UInt64:
+            case Float64:
+                body.add_buffer(col.values.data() + begin, (end - begin) * sizeof(uint64_t));
+                break;
+            case Boolean:
+            {
+                std::vector<uint8_t> bytes(col.values.begin() + begin, col.values.begin() + end);
+                std::vector<uint8_t> bits = pack_bits(bytes, 0, bytes.size());
+                body.add_buffer(bits.data(), bits.size());
+            }
+                break;
+            default:
+            {
+                std::vector<int32_t> indices(col.values.begin() + begin, col.values.begin() + end);
+                body.add_buffer(indices.data(), indices.size() * sizeof(int32_t));
+            }
+            }
+        }
+
+        return body;
+    }
+
+    /// \brief Write an encapsulated IPC message. Appends the message's
+    ///   file block descriptor to \a blocks if given.
+    static void write_message(std::ostream& os, size_t& pos, const FbRef& msg, const std::string& body,
+                              ArrowBlocks* blocks = nullptr) {
+        std::string meta = FbWriter().finish(*msg);
+        meta.append((8 - meta.size() % 8) % 8, '\0');
+
+        if (blocks)
+            blocks->add(pos, 8 + meta.size(), body.size());
+
+        std::string buf;
+
+        append_bytes<uint32_t>(buf, 0xFFFFFFFF);
+        append_bytes<int32_t>(buf, meta.size());
+
+        os.write(buf.data(), buf.size());
+        os.write(meta.data(), meta.size());
+        os.write(body.data(), body.size());
+
+        pos += buf.size() + meta.size() + body.size();
+    }
+
+    void flush(std::ostream& os) {
+        // NOTE: No locking, assume flush() runs serially
+
+        // columns that never got an attribute contain only nulls
+        for (Column& col : m_cols)
+            if (col.type == Undecided)
+                col.type = Dictionary;
+
+        const char magic[8] = { 'A', 'R', 'R', 'O', 'W', '1', 0, 0 };
+
+        os.write(magic, 8);
+
+        size_t      pos = 8;
+        ArrowBlocks dict_blocks, batch_blocks;
+
+        write_message(os, pos, make_message(ArrowHeaderSchema, make_schema(), 0), std::string());
+
+        for (size_t c = 0; c < m_cols.size(); ++c) {
+            if (m_cols[c].type != Dictionary)
+                continue;
+
+            ArrowBody body = make_dictionary_body(m_cols[c]);
+
+            FbRef batch = fb_table();
+            batch->add(0, 8, c);
+            batch->add(1, body.make_record_batch(m_cols[c].dict.size()));
+
+            write_message(os, pos, make_message(ArrowHeaderDictionaryBatch, batch, body.data.size()),
+                          body.data, &dict_blocks);
+        }
+
+        for (size_t begin = 0; begin < m_nrows; begin += ArrowBatchRows) {
+            size_t    end  = std::min(m_nrows, begin + ArrowBatchRows);
+            ArrowBody body = make_record_batch_body(begin, end);
+
+            write_message(os, pos, make_message(ArrowHeaderRecordBatch, body.make_record_batch(end - begin), body.data.size()),
+                          body.data, &batch_blocks);
+        }
+
+        // end-of-stream marker, footer, and trailing magic
+
+        std::string buf;
+
+        append_bytes<uint32_t>(buf, 0xFFFFFFFF);
+        append_bytes<int32_t>(buf, 0);
+
+        FbRef footer = fb_table();
+
+        footer->add(0, 2, ArrowMetadataV5);
+        footer->add(1, make_schema());
+        footer->add(2, fb_structs(dict_blocks.data, dict_blocks.count));
+        footer->add(3, fb_structs(batch_blocks.data, batch_blocks.count));
+
+        std::string fbuf = FbWriter().finish(*footer);
+
+        buf.append(fbuf);
+        append_bytes<int32_t>(buf, fbuf.size());
+        buf.append(magic, 6);
+
+        os.write(buf.data(), buf.size());
+        os.flush();
+    }
+};
+
+
+ArrowFormatter::ArrowFormatter(const QuerySpec& spec)
+    : mP { new ArrowFormatterImpl }
+{
+    mP->configure(spec);
+}
+
+ArrowFormatter::~ArrowFormatter()
+{
+    mP.reset();
+}
+
+void
+ArrowFormatter::process_record(CaliperMetadataAccessInterface& db, const EntryList& list)
+{
+    mP->add(db, list);
+}
+
+void
+ArrowFormatter::flush(CaliperMetadataAccessInterface&, std::ostream& os)
+{
+    mP->flush(os);
+}
@@ -39,6 +39,7 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cstdlib>
 #include <sstream>
 
 using namespace cali;
@@ -79,6 +80,7 @@ struct CalQLParser::CalQLParserImpl
         Aggregate,
         Format,
         Group,
+        Let,
         Select,
         Sort,
         Where
@@ -91,6 +93,7 @@ struct CalQLParser::CalQLParserImpl
             { "aggregate", Aggregate },
             { "format",    Format    },
             { "group",     Group     },
+            { "let",       Let       },
             { "select",    Select    },
             { "order",     Sort      },
             { "where",     Where     },
@@ -214,6 +217,22 @@ struct CalQLParser::CalQLParserImpl
         
         do {
             std::string w = util::read_word(is, ",;=<>()\n");
+            std::vector<std::string> args = parse_arglist(is);
+
+            if (!args.empty()) {
+                // prefix(attribute, depth)
+                std::transform(w.begin(), w.end(), w.begin(), ::tolower);
+
+                int depth = (args.size() == 2 ? std::atoi(args[1].c_str()) : 0);
+
+                if (w != "prefix" || args.size() != 2 || args[0].empty() || depth < 1) {
+                    set_error("Expected prefix(attribute, depth) in GROUP BY", is);
+                    return;
+                }
+
+                w = args[0];
+                spec.aggregation_key_depth[w] = depth;
+            }
 
             if (!w.empty()) {
                 spec.aggregation_key.selection = QuerySpec::AttributeSelection::List;
@@ -227,6 +246,137 @@ struct CalQLParser::CalQLParserImpl
             is.unget();
     }
     
+    /// \brief Parse an expression operand (attribute name or number)
+    void
+    parse_operand(std::istream& is, std::vector<QuerySpec::ExpressionOp>& ops) {
+        std::string w = util::read_word(is, ",;=<>()+-*/\n");
+
+        if (w.empty()) {
+            set_error("Expected operand", is);
+            return;
+        }
+
+        // a number's exponent sign stops read_word: "1e-3"
+        if (std::isdigit(w[0]) && (w.back() == 'e' || w.back() == 'E')) {
+            char c = is.peek();
+
+            if (c == '+' || c == '-') {
+                w.push_back(is.get());
+                w.append(util::read_word(is, ",;=<>()+-*/\n"));
+            }
+        }
+
+        if (std::isdigit(w[0]) || w[0] == '.') {
+            std::size_t pos = 0;
+            double      val = 0.0;
+
+            try {
+                val = std::stod(w, &pos);
+            } catch (...) {
+                pos = 0;
+            }
+
+            if (pos == w.size()) {
+                ops.emplace_back(QuerySpec::ExpressionOp::Constant, "", val);
+                return;
+            }
+        }
+
+        ops.emplace_back(QuerySpec::ExpressionOp::Operand, w);
+    }
+
+    /// \brief Parse factor : '-' factor | '(' expression ')' | operand
+    void
+    parse_factor(std::istream& is, std::vector<QuerySpec::ExpressionOp>& ops) {
+        char c = util::read_char(is);
+
+        if (c == '-') {
+            parse_factor(is, ops);
+            ops.emplace_back(QuerySpec::ExpressionOp::Neg);
+        } else if (c == '(') {
+            parse_expression(is, ops);
+
+            if (!error && util::read_char(is) != ')')
+                set_error("Expected ')'", is);
+        } else {
+            if (is.good())
+                is.unget();
+
+            parse_operand(is, ops);
+        }
+    }
+
+    /// \brief Parse term : factor (('*'|'/') factor)*
+    void
+    parse_term(std::istream& is, std::vector<QuerySpec::ExpressionOp>& ops) {
+        parse_factor(is, ops);
+
+        while (!error && is.good()) {
+            char c = util::read_char(is);
+
+            if (c != '*' && c != '/') {
+                if (is.good())
+                    is.unget();
+                break;
+            }
+
+            parse_factor(is, ops);
+            ops.emplace_back(c == '*' ? QuerySpec::ExpressionOp::Mul : QuerySpec::ExpressionOp::Div);
+        }
+    }
+
+    /// \brief Parse expression : term (('+'|'-') term)*
+    void
+    parse_expression(std::istream& is, std::vector<QuerySpec::ExpressionOp>& ops) {
+        parse_term(is, ops);
+
+        while (!error && is.good()) {
+            char c = util::read_char(is);
+
+            if (c != '+' && c != '-') {
+                if (is.good())
+                    is.unget();
+                break;
+            }
+
+            parse_term(is, ops);
+            ops.emplace_back(c == '+' ? QuerySpec::ExpressionOp::Add : QuerySpec::ExpressionOp::Sub);
+        }
+    }
+
+    void
+    parse_let(std::istream& is) {
+        // LET name = expression, name = expression, ...
+        char c = '\0';
+
+        do {
+            QuerySpec::Derivation d;
+
+            d.name = util::read_word(is, ",;=<>()+-*/\n");
+
+            if (d.name.empty()) {
+                set_error("Expected name for LET", is);
+                return;
+            }
+            if (util::read_char(is) != '=') {
+                set_error(std::string("Expected '=' after ") + d.name, is);
+                return;
+            }
+
+            parse_expression(is, d.ops);
+
+            if (!error) {
+                spec.derived.selection = QuerySpec::DerivationSelection::List;
+                spec.derived.list.push_back(d);
+            }
+
+            c = util::read_char(is);
+        } while (!error && is.good() && c == ',');
+
+        if (c)
+            is.unget();
+    }
+
     void
     parse_select(std::istream& is) {
         // SELECT selection, selection, ...
@@ -441,6 +591,9 @@ struct CalQLParser::CalQLParserImpl
             // we expect that "by" has already been read
             parse_groupby(is);
             break;
+        case Let:
+            parse_let(is);
+            break;
         case Select:
             parse_select(is);
             break;
@@ -499,6 +652,7 @@ struct CalQLParser::CalQLParserImpl
         spec.attribute_selection.selection = QuerySpec::AttributeSelection::Default;
         spec.filter.selection              = QuerySpec::FilterSelection::None;
         spec.sort.selection                = QuerySpec::SortSelection::None;
+        spec.derived.selection             = QuerySpec::DerivationSelection::None;
         spec.format.opt                    = QuerySpec::FormatSpec::Default;
     }
 };
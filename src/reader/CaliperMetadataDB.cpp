@@ -34,7 +34,12 @@
 
 #include "caliper/reader/CaliperMetadataDB.h"
 
+#include "caliper/reader/QuerySpec.h"
+#include "caliper/reader/RecordSelector.h"
+
+#include "caliper/common/binary/BinaryReader.h"
 #include "caliper/common/csv/CsvReader.h"
+#include "caliper/common/csv/CsvRecordView.h"
 
 #include "caliper/common/Log.h"
 #include "caliper/common/Node.h"
@@ -42,11 +47,17 @@
 #include "caliper/common/StringConverter.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstring>
 #include <iostream>
 #include <map>
 #include <mutex>
+#include <new>
+#include <set>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 using namespace cali;
@@ -71,8 +82,8 @@ namespace
 
     inline cali_id_t
     map_id(cali_id_t id, const IdMap& idmap) {
-        auto it = idmap.find(id);
-        return it == idmap.end() ? id : it->second;
+        cali_id_t mapped = idmap.find(id);
+        return mapped == CALI_INV_ID ? id : mapped;
     }
     
     inline cali_id_t
@@ -80,8 +91,7 @@ namespace
         cali_id_t id = id_from_rec(rec, key);
 
         if (id != CALI_INV_ID) {
-            auto it = idmap.find(id);
-            return it == idmap.end() ? id : it->second;
+            return ::map_id(id, idmap);
         }
 
         return CALI_INV_ID;
@@ -93,36 +103,356 @@ namespace
         cali_id_t id = StringConverter(str).to_uint(&ok);
 
         if (ok) {
-            auto it = idmap.find(id);
-            return it == idmap.end() ? id : it->second;
+            return ::map_id(id, idmap);
         }
 
         return CALI_INV_ID;
     }
+
+    inline cali_id_t
+    id_from_span(const CsvRecordView::Span& s) {
+        if (s.len == 0 || s.len > 20)
+            return CALI_INV_ID;
+
+        cali_id_t id = 0;
+
+        for (size_t i = 0; i < s.len; ++i) {
+            if (s.ptr[i] < '0' || s.ptr[i] > '9')
+                return CALI_INV_ID;
+
+            id = 10 * id + (s.ptr[i] - '0');
+        }
+
+        return id;
+    }
+
+    inline size_t
+    hash_bytes(const void* ptr, size_t len, uint64_t h = 0xcbf29ce484222325ULL) {
+        // FNV-1a
+        const unsigned char* p = static_cast<const unsigned char*>(ptr);
+
+        for (size_t i = 0; i < len; ++i)
+            h = (h ^ p[i]) * 0x100000001b3ULL;
+
+        return static_cast<size_t>(h);
+    }
+
+    /// \brief Hash a variant consistent with Variant::operator==
+    inline size_t
+    hash_variant(const Variant& v, uint64_t h) {
+        cali_variant_t cv = v.c_variant();
+
+        h = ::hash_bytes(&cv.type_and_size, sizeof(cv.type_and_size), h);
+
+        if (v.type() == CALI_TYPE_STRING || v.type() == CALI_TYPE_USR)
+            return ::hash_bytes(v.data(), v.size(), h);
+
+        return ::hash_bytes(&cv.value.v_uint, sizeof(cv.value.v_uint), h);
+    }
+
+    /// \brief Hash a node value. Strings in the metadata DB are interned,
+    ///   so they are hashed (and compared) by their address.
+    inline size_t
+    hash_node_value(const Variant& v, uint64_t h) {
+        if (v.type() != CALI_TYPE_STRING)
+            return ::hash_variant(v, h);
+
+        cali_variant_t cv = v.c_variant();
+
+        h = ::hash_bytes(&cv.type_and_size, sizeof(cv.type_and_size), h);
+
+        return ::hash_bytes(&cv.value.unmanaged_ptr, sizeof(cv.value.unmanaged_ptr), h);
+    }
+
+    /// \brief Collect the names of all attributes \a spec may read from
+    ///   immediate snapshot entries into \a names. Attributes ending in
+    ///   one of \a suffixes are read as well.
+    /// \return false if \a spec may read any attribute (e.g., for default
+    ///   attribute selections), true otherwise
+    bool
+    projection_from_spec(const QuerySpec& spec, std::set<std::string>& names, std::vector<std::string>& suffixes) {
+        names.clear();
+        suffixes.clear();
+
+        switch (spec.aggregation_ops.selection) {
+        case QuerySpec::AggregationSelection::Default:
+        case QuerySpec::AggregationSelection::All:
+            return false;
+        case QuerySpec::AggregationSelection::List:
+            // aggregated output only contains the key and the aggregation results
+            if (spec.aggregation_key.selection == QuerySpec::AttributeSelection::Default ||
+                spec.aggregation_key.selection == QuerySpec::AttributeSelection::All)
+                return false;
+
+            names.insert(spec.aggregation_key.list.begin(), spec.aggregation_key.list.end());
+
+            // Aggregation kernels also re-aggregate their own results
+            // from earlier aggregations, e.g. "count" or "min#<attr>".
+            names.insert("count");
+
+            for (const QuerySpec::AggregationOp& op : spec.aggregation_ops.list)
+                for (const std::string& arg : op.args) {
+                    names.insert(arg);
+                    suffixes.push_back("#" + arg);
+                }
+
+            break;
+        case QuerySpec::AggregationSelection::None:
+            if (spec.attribute_selection.selection != QuerySpec::AttributeSelection::List)
+                return false;
+
+            names.insert(spec.attribute_selection.list.begin(), spec.attribute_selection.list.end());
+
+            for (const QuerySpec::SortSpec& s : spec.sort.list)
+                names.insert(s.attribute);
+
+            break;
+        }
+
+        if (spec.filter.selection == QuerySpec::FilterSelection::List)
+            for (const QuerySpec::Condition& c : spec.filter.list)
+                names.insert(c.attr_name);
+
+        // derived metrics can read attributes that aren't selected
+        if (spec.derived.selection == QuerySpec::DerivationSelection::List)
+            for (const QuerySpec::Derivation& d : spec.derived.list)
+                for (const QuerySpec::ExpressionOp& op : d.ops)
+                    if (op.op == QuerySpec::ExpressionOp::Operand)
+                        names.insert(op.attr_name);
+
+        // formatter arguments may name attributes as well
+        if (spec.format.opt == QuerySpec::FormatSpec::User)
+            names.insert(spec.format.args.begin(), spec.format.args.end());
+
+        return true;
+    }
 } // namespace 
 
 struct CaliperMetadataDB::CaliperMetadataDBImpl
 {
+    //   Nodes are constructed in place in fixed-size blocks, indexed by
+    // node ID. Lookups by ID don't need a lock. New nodes are added under
+    // m_node_lock; m_num_nodes is updated only after the node is in place.
+
+    static const size_t       NodeBlockBits = 14;
+    static const size_t       NodeBlockSize = (1 << NodeBlockBits);
+    static const size_t       MaxNodeBlocks = 16384;
+
+    typedef std::aligned_storage<sizeof(Node), alignof(Node)>::type NodeStorage;
+
+    //   Interned strings and the (parent, attribute, value) -> node index
+    // are split into shards indexed by hash value, each with its own lock.
+
+    static const size_t       NumShards     = 64;
+
+    struct StringRef {
+        const char* str;
+        size_t      len;
+        size_t      hash;
+    };
+
+    struct StringRefHash {
+        size_t operator()(const StringRef& s) const { return s.hash; }
+    };
+
+    struct StringRefEq {
+        bool operator()(const StringRef& a, const StringRef& b) const {
+            return a.len == b.len && 0 == memcmp(a.str, b.str, a.len);
+        }
+    };
+
+    /// \brief Bump allocator for string data
+    struct StringArena {
+        static const size_t ChunkSize = 64 * 1024;
+
+        std::vector<char*>  chunks;
+        size_t              pos = ChunkSize;
+
+        char* allocate(size_t len) {
+            if (len > ChunkSize / 4) { // large strings get their own chunk
+                char* ptr = new char[len];
+                chunks.insert(chunks.begin(), ptr); // keep current chunk at the back
+                return ptr;
+            }
+
+            if (pos + len > ChunkSize) {
+                chunks.push_back(new char[ChunkSize]);
+                pos = 0;
+            }
+
+            char* ptr = chunks.back() + pos;
+            pos += len;
+
+            return ptr;
+        }
+
+        ~StringArena() {
+            for (char* chunk : chunks)
+                delete[] chunk;
+        }
+    };
+
+    struct StringShard {
+        std::unordered_set<StringRef, StringRefHash, StringRefEq> strings;
+        StringArena arena;
+        std::mutex  lock;
+    };
+
+    struct NodeKey {
+        cali_id_t   parent;
+        cali_id_t   attr;
+        Variant     data;
+        size_t      hash;
+
+        NodeKey(cali_id_t p, cali_id_t a, const Variant& v)
+            : parent(p), attr(a), data(v),
+              hash(::hash_node_value(v, ::hash_bytes(&a, sizeof(a), ::hash_bytes(&p, sizeof(p)))))
+            { }
+
+        /// \brief Value equality. Interned strings are equal only if
+        ///   they have the same address.
+        static bool same_value(const Variant& a, const Variant& b) {
+            if (a.type() == CALI_TYPE_STRING)
+                return a.c_variant().type_and_size == b.c_variant().type_and_size && a.data() == b.data();
+
+            return a == b;
+        }
+    };
+
+    struct NodeKeyHash {
+        size_t operator()(const NodeKey& k) const { return k.hash; }
+    };
+
+    struct NodeKeyEq {
+        bool operator()(const NodeKey& a, const NodeKey& b) const {
+            return a.parent == b.parent && a.attr == b.attr && NodeKey::same_value(a.data, b.data);
+        }
+    };
+
+    struct NodeShard {
+        std::unordered_map<NodeKey, Node*, NodeKeyHash, NodeKeyEq> nodes;
+        std::mutex lock;
+    };
+
     Node                      m_root;         ///< (Artificial) root node
-    vector<Node*>             m_nodes;        ///< Node list
-    mutable mutex             m_node_lock;
+    std::atomic<NodeStorage*> m_node_blocks[MaxNodeBlocks];
+    std::atomic<size_t>       m_num_nodes;
+    mutable mutex             m_node_lock;    ///< Serializes node creation
+
+    NodeShard                 m_node_shards[NumShards];
 
     Node*                     m_type_nodes[CALI_MAXTYPE+1] = { 0 };
     
     map<string, Node*>        m_attributes;
     mutable mutex             m_attribute_lock;
 
-    vector<const char*>       m_string_db;
-    mutable mutex             m_string_db_lock;
+    StringShard               m_string_shards[NumShards];
 
     vector<Entry>             m_globals;
     mutex                     m_globals_lock;
+
+    std::unique_ptr<RecordSelector> m_read_filter;   ///< Filter pushed down from set_read_spec()
+    std::set<std::string>     m_projection;           ///< Attributes kept for immediate entries in read()
+    vector<std::string>       m_projection_suffixes;  ///< Attribute name suffixes kept in read()
+    bool                      m_use_projection = false;
+    vector<bool>              m_skip_attr;            ///< Per attribute ID: skip immediate entries. Uses m_attribute_lock.
+    bool                      m_lazy_nodes = false;   ///< Merge binary stream nodes on first reference. Set by set_read_spec().
+
+    /// \brief Node records of a binary stream that have not been merged yet.
+    ///   String data is copied into \a data; the node's value points into
+    ///   it only while the node is being merged.
+    struct PendingNodes {
+        struct Info {
+            cali_id_t      attr_id;
+            cali_id_t      parent_id;
+            cali_variant_t value;
+            size_t         offset; ///< String data offset in \a data
+        };
+
+        std::unordered_map<cali_id_t, Info> nodes;
+        std::vector<char> data;
+
+        void add(const NodeBuffer::NodeInfo& info) {
+            Info i { info.attr_id, info.parent_id, info.value.c_variant(), data.size() };
+
+            if (info.value.type() == CALI_TYPE_STRING) {
+                const char* str = static_cast<const char*>(info.value.data());
+                data.insert(data.end(), str, str + info.value.size());
+            }
+
+            nodes.emplace(info.node_id, i);
+        }
+
+        /// \brief Move the pending node \a id into \a info.
+        /// \return false if there is no such pending node
+        bool take(cali_id_t id, NodeBuffer::NodeInfo& info) {
+            auto it = nodes.find(id);
+
+            if (it == nodes.end())
+                return false;
+
+            const Info& i = it->second;
+
+            info.node_id   = id;
+            info.attr_id   = i.attr_id;
+            info.parent_id = i.parent_id;
+            info.value     = Variant(i.value);
+
+            if (info.value.type() == CALI_TYPE_STRING)
+                info.value = Variant(CALI_TYPE_STRING, data.data() + i.offset, info.value.size());
+
+            nodes.erase(it);
+
+            return true;
+        }
+
+        void clear() {
+            nodes.clear();
+            data.clear();
+        }
+    };
     
     inline Node* node(cali_id_t id) const {
-        std::lock_guard<std::mutex>
-            g(m_node_lock);
+        if (id == CALI_INV_ID || id >= m_num_nodes.load(std::memory_order_acquire))
+            return nullptr;
 
-        return id < m_nodes.size() ? m_nodes[id] : nullptr;
+        NodeStorage* block = m_node_blocks[id >> NodeBlockBits].load(std::memory_order_relaxed);
+
+        return reinterpret_cast<Node*>(block + (id & (NodeBlockSize-1)));
+    }
+
+    inline size_t num_nodes() const {
+        return m_num_nodes.load(std::memory_order_acquire);
+    }
+
+    inline NodeShard& node_shard(size_t hash) {
+        return m_node_shards[(hash >> 32) % NumShards];
+    }
+
+    /// \brief Construct the next node in the node table and publish it.
+    Node* alloc_node(cali_id_t attr_id, const Variant& data) {
+        // NOTE: We assume that m_node_lock is locked!
+
+        size_t id    = m_num_nodes.load(std::memory_order_relaxed);
+        size_t block = id >> NodeBlockBits;
+
+        if (block >= MaxNodeBlocks) {
+            Log(0).stream() << "CaliperMetadataDB: Maximum number of nodes exceeded" << std::endl;
+            return nullptr;
+        }
+
+        NodeStorage* ptr = m_node_blocks[block].load(std::memory_order_relaxed);
+
+        if (!ptr) {
+            ptr = new NodeStorage[NodeBlockSize];
+            m_node_blocks[block].store(ptr, std::memory_order_relaxed);
+        }
+
+        Node* node = new(ptr + (id & (NodeBlockSize-1))) Node(id, attr_id, data);
+
+        m_num_nodes.store(id + 1, std::memory_order_release);
+
+        return node;
     }
 
     void setup_bootstrap_nodes() {
@@ -150,56 +480,139 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
 
         // Create nodes
 
-        m_nodes.resize(11);
-        
         for (const NodeInfo* info = bootstrap_nodes; info->id != CALI_INV_ID; ++info) {
-            Node* node = new Node(info->id, info->attr_id, info->data);
+            // node keys compare strings by address, so use the interned copy
+            Variant data = info->data;
 
-            m_nodes[info->id] = node;
-                    
-            if (info->parent != CALI_INV_ID)
-                m_nodes[info->parent]->append(node);
-            else
-                m_root.append(node);
+            if (data.type() == CALI_TYPE_STRING)
+                data = make_string_variant(static_cast<const char*>(data.data()), data.size());
+
+            // bootstrap node IDs are consecutive
+            Node* node = alloc_node(info->attr_id, data);
+
+            assert(node->id() == info->id);
+
+            Node* parent = (info->parent != CALI_INV_ID ? this->node(info->parent) : &m_root);
+
+            parent->append(node);
+            node_shard_insert(node);
             
             if (info->attr_id == 9 /* type node */)
                 m_type_nodes[info->data.to_attr_type()] = node;
             else if (info->attr_id == 8 /* attribute node*/)
-                m_attributes.insert(make_pair(info->data.to_string(), node));
+                m_attributes.insert(make_pair(data.to_string(), node));
         }
     }
 
+    void node_shard_insert(Node* node) {
+        // NOTE: Shard lock must be held, or no other threads may be active
+        const Node* parent = node->parent();
+
+        NodeKey key(parent ? parent->id() : CALI_INV_ID, node->attribute(), node->data());
+        node_shard(key.hash).nodes.emplace(key, node);
+    }
+
     Node* create_node(cali_id_t attr_id, const Variant& data, Node* parent) {
-        // NOTE: We assume that m_node_lock is locked!
-        
-        Node* node = new Node(m_nodes.size(), attr_id, data);
-        
-        m_nodes.push_back(node);
+        std::lock_guard<std::mutex>
+            g(m_node_lock);
 
-        if (parent)
+        Node* node = alloc_node(attr_id, data);
+
+        if (node && parent)
             parent->append(node);
 
         return node;
     }
 
+    /// \brief Find the child of \a parent with the given attribute and
+    ///   value, or create it. Sets \a new_node if a node was created.
+    ///   If \a data is a string, it must be in the string database.
+    Node* find_or_create_node(cali_id_t attr_id, const Variant& data, Node* parent, bool& new_node) {
+        NodeKey    key(parent->id(), attr_id, data);
+        NodeShard& shard = node_shard(key.hash);
+
+        std::lock_guard<std::mutex>
+            g(shard.lock);
+
+        auto it = shard.nodes.find(key);
+
+        if (it != shard.nodes.end()) {
+            new_node = false;
+            return it->second;
+        }
+
+        Node* node = create_node(attr_id, data, parent);
+
+        if (node)
+            shard.nodes.emplace(key, node);
+
+        new_node = (node != nullptr);
+        return node;
+    }
+
+    void update_projection(const Node* attr_node) {
+        // NOTE: We assume that m_attribute_lock is locked!
+
+        if (!m_use_projection)
+            return;
+        if (attr_node->id() >= m_skip_attr.size())
+            m_skip_attr.resize(attr_node->id() + 1, false);
+
+        std::string name = attr_node->data().to_string();
+        bool        keep = (m_projection.count(name) > 0);
+
+        for (auto it = m_projection_suffixes.begin(); !keep && it != m_projection_suffixes.end(); ++it)
+            keep = (name.size() > it->size() && name.compare(name.size() - it->size(), it->size(), *it) == 0);
+
+        m_skip_attr[attr_node->id()] = !keep;
+    }
+
+    inline bool skip_immediate(cali_id_t attr_id) const {
+        std::lock_guard<std::mutex>
+            g(m_attribute_lock);
+
+        return attr_id < m_skip_attr.size() && m_skip_attr[attr_id];
+    }
+
+    void set_read_spec(const QuerySpec& spec) {
+        m_lazy_nodes = true;
+
+        if (spec.filter.selection == QuerySpec::FilterSelection::List && !spec.filter.list.empty())
+            m_read_filter.reset(new RecordSelector(spec));
+        else
+            m_read_filter.reset();
+
+        std::lock_guard<std::mutex>
+            g(m_attribute_lock);
+
+        m_use_projection = ::projection_from_spec(spec, m_projection, m_projection_suffixes);
+        m_skip_attr.clear();
+
+        for (auto &p : m_attributes)
+            update_projection(p.second);
+    }
+
     /// \brief Make string variant from string database 
     Variant make_string_variant(const char* str, size_t len) {
+        StringRef    ref   = { str, len, ::hash_bytes(str, len) };
+        StringShard& shard = m_string_shards[(ref.hash >> 32) % NumShards];
+
         std::lock_guard<std::mutex>
-            g(m_string_db_lock);
-                
-        auto it = std::upper_bound(m_string_db.begin(), m_string_db.end(), str,
-                                   [len](const char* a, const char* b) { return strncmp(a, b, len) < 0; });
+            g(shard.lock);
 
-        if (it != m_string_db.end() && str == *it)
-            return Variant(CALI_TYPE_STRING, *it, len);
+        auto it = shard.strings.find(ref);
 
-        char* ptr = new char[len + 1];
-        strncpy(ptr, str, len);
+        if (it != shard.strings.end())
+            return Variant(CALI_TYPE_STRING, it->str, len);
+
+        char* ptr = shard.arena.allocate(len + 1);
+        memcpy(ptr, str, len);
         ptr[len] = '\0';
-        
-        m_string_db.insert(it, ptr);
 
-        return Variant(CALI_TYPE_STRING, ptr, len);        
+        ref.str = ptr;
+        shard.strings.insert(ref);
+
+        return Variant(CALI_TYPE_STRING, ptr, len);
     }
     
     Variant make_variant(cali_attr_type type, const std::string& str) {
@@ -222,6 +635,36 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
         return ret;
     }
 
+    Variant make_variant(cali_attr_type type, const CsvRecordView::Span& str) {
+        switch (type) {
+        case CALI_TYPE_INV:
+            return Variant();
+        case CALI_TYPE_USR:
+            Log(0).stream() << "CaliperMetadataDB: Can't read USR data at this point" << std::endl;
+            return Variant(CALI_TYPE_USR, nullptr, 0);
+        case CALI_TYPE_STRING:
+            return make_string_variant(str.ptr, str.len);
+        default:
+            break;
+        }
+
+        Variant ret;
+
+        if (Variant::from_number_string(type, str.ptr, str.len, ret))
+            return ret;
+
+        // numeric values are short: avoid the string copy
+        char buf[64];
+
+        if (str.len >= sizeof(buf))
+            return Variant::from_string(type, str.to_string().c_str());
+
+        memcpy(buf, str.ptr, str.len);
+        buf[str.len] = '\0';
+
+        return Variant::from_string(type, buf);
+    }
+
     /// Merge node given by un-mapped node info from stream with given \a idmap into DB
     /// If \a v_data is a string, it must already be in the string database!
     const Node* merge_node(cali_id_t node_id, cali_id_t attr_id, cali_id_t prnt_id, const Variant& v_data) {
@@ -241,10 +684,9 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
         Node* parent = &m_root;
 
         if (prnt_id != CALI_INV_ID) {
-            std::lock_guard<std::mutex>
-                g(m_node_lock);            
+            parent = node(prnt_id);
 
-            if (prnt_id >= m_nodes.size()) {
+            if (!parent) {
                 Log(0).stream() << "CaliperMetadataDB::merge_node(): Invalid parent node " << prnt_id << " for "
                                 <<  "id="       << node_id
                                 << ", attr="   << attr_id 
@@ -253,31 +695,17 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
                                 << std::endl;
                 return nullptr;
             }
-
-            parent = m_nodes[prnt_id];
         }
 
-        Node* node     = nullptr;
         bool  new_node = false;
-
-        {
-            std::lock_guard<std::mutex>
-                g(m_node_lock);
-
-            for ( node = parent->first_child(); node && !node->equals(attr_id, v_data); node = node->next_sibling() )
-                ;
-
-            if (!node) {
-                node     = create_node(attr_id, v_data, parent);
-                new_node = true;
-            }
-        }
+        Node* node     = find_or_create_node(attr_id, v_data, parent, new_node);
 
         if (new_node && node->attribute() == Attribute::meta_attribute_keys().name_attr_id) {
             std::lock_guard<std::mutex>
                 g(m_attribute_lock);
             
             m_attributes.insert(make_pair(string(node->data().to_string()), node));
+            update_projection(node);
         }
 
         return node;
@@ -291,8 +719,8 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
 
         const Node* node = merge_node(node_id, attr_id, prnt_id, v_data);
 
-        if (node_id != node->id())
-            idmap.insert(make_pair(node_id, node->id()));
+        if (node && node_id != node->id())
+            idmap.insert(node_id, node->id());
 
         return node;
     }
@@ -326,6 +754,130 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
         return node;
     }
 
+    /// Merge node from a binary .cali stream
+    const Node* merge_node_info(const NodeBuffer::NodeInfo& info, IdMap& idmap) {
+        Attribute attr   = attribute(::map_id(info.attr_id, idmap));
+        Variant   v_data = info.value;
+
+        if (attr.is_hidden() || v_data.type() == CALI_TYPE_USR) // skip reading data from hidden entries
+            v_data = Variant(CALI_TYPE_USR, nullptr, 0);
+        else if (v_data.type() == CALI_TYPE_STRING)
+            v_data = make_string_variant(static_cast<const char*>(v_data.data()), v_data.size());
+
+        const Node* node = merge_node(info.node_id, info.attr_id, info.parent_id, v_data, idmap);
+
+        if (!node) {
+            Log(0).stream() << "CaliperMetadataDB::merge_node_info(): Invalid node " << info.node_id << endl;
+            return nullptr;
+        }
+
+        return node;
+    }
+
+    /// Merge the pending node \a id from a binary .cali stream, after the
+    /// nodes it refers to. Does nothing if \a id isn't pending.
+    void merge_pending_node(CaliperMetadataDB* db, cali_id_t id, PendingNodes& pending, IdMap& idmap, NodeProcessFn& node_fn) {
+        NodeBuffer::NodeInfo info;
+
+        if (!pending.take(id, info))
+            return;
+
+        merge_pending_node(db, info.attr_id,   pending, idmap, node_fn);
+        merge_pending_node(db, info.parent_id, pending, idmap, node_fn);
+
+        const Node* node = merge_node_info(info, idmap);
+
+        if (node)
+            node_fn(*db, node);
+    }
+
+    /// Merge snapshot from a binary .cali stream into \a list. Immediate
+    /// string values still point into the stream buffer: they are moved
+    /// into the string database in finish_snapshot(). With \a project,
+    /// skips immediate entries outside the read projection.
+    void merge_snapshot_record(size_t n_nodes, const cali_id_t node_ids[],
+                               size_t n_imm,   const cali_id_t attr_ids[], const Variant values[],
+                               const IdMap& idmap, bool project, EntryList& list)
+    {
+        list.clear();
+        list.reserve(n_nodes + n_imm);
+
+        for (size_t i = 0; i < n_nodes; ++i) {
+            Node* node = this->node(::map_id(node_ids[i], idmap));
+
+            if (node)
+                list.push_back(Entry(node));
+        }
+
+        for (size_t i = 0; i < n_imm; ++i) {
+            cali_id_t attr_id = ::map_id(attr_ids[i], idmap);
+
+            if (project && skip_immediate(attr_id))
+                continue;
+
+            Attribute attr = attribute(attr_id);
+
+            if (attr == Attribute::invalid)
+                continue;
+
+            Variant v_data = values[i];
+
+            if (v_data.type() == CALI_TYPE_USR)
+                v_data = Variant(CALI_TYPE_USR, nullptr, 0);
+
+            list.push_back(Entry(attr, v_data));
+        }
+    }
+
+    /// Apply the pushed-down read filter to \a list (if \a filter is set),
+    /// then move its immediate string values into the string database.
+    /// \return false if the record was filtered out
+    bool finish_snapshot(const CaliperMetadataDB* db, bool filter, EntryList& list) {
+        if (filter && m_read_filter && !m_read_filter->pass(*db, list))
+            return false;
+
+        for (Entry& e : list)
+            if (e.is_immediate()) {
+                Variant v_data = e.value();
+
+                if (v_data.type() == CALI_TYPE_STRING)
+                    e = Entry(e.attribute(),
+                              make_string_variant(static_cast<const char*>(v_data.data()), v_data.size()));
+            }
+
+        return true;
+    }
+
+    const Node* merge_node_record(const CsvRecordView& rec, IdMap& idmap) {
+        cali_id_t node_id = ::id_from_span(rec.first(CsvRecordView::Id));
+        cali_id_t attr_id = ::id_from_span(rec.first(CsvRecordView::Attr));
+        cali_id_t prnt_id = ::id_from_span(rec.first(CsvRecordView::Parent));
+        Variant   v_data;
+
+        {
+            Attribute attr = attribute(::map_id(attr_id, idmap));
+
+            if (attr.is_hidden()) { // skip reading data from hidden entries
+                v_data = Variant(CALI_TYPE_USR, nullptr, 0);
+            } else {
+                const CsvRecordView::Entry* e = rec.find(CsvRecordView::Data);
+
+                if (e && e->count > 0)
+                    v_data = make_variant(attr.type(), rec.value(e->first));
+            }
+        }
+
+        const Node* node = merge_node(node_id, attr_id, prnt_id, v_data, idmap);
+
+        if (!node) {
+            Log(0).stream() << "CaliperMetadataDB::merge_node_record(): Invalid node from record: "
+                            << rec.to_record_map() << endl;
+            return nullptr;
+        }
+
+        return node;
+    }
+
     EntryList merge_snapshot(size_t n_nodes, const cali_id_t node_ids[],
                              size_t n_imm,   const cali_id_t attr_ids[], const Variant values[],
                              const IdMap& idmap) const
@@ -344,7 +896,7 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
         if (!node || node->id() == CALI_INV_ID)
             return nullptr;
         if (node->id() < 11)
-            return m_nodes[node->id()];
+            return this->node(node->id());
 
         const Node* attr_node = 
             recursive_merge_node(db.node(node->attribute()), db);
@@ -380,13 +932,10 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
 
         if (r_it != rec.end())
             for (const std::string& str : r_it->second) {
-                cali_id_t id = ::map_id_from_string(str, idmap);
+                Node* node = this->node(::map_id_from_string(str, idmap));
 
-                std::lock_guard<std::mutex>
-                    g(m_node_lock);
-                
-                if (id < m_nodes.size())
-                    list.push_back(Entry(m_nodes[id]));
+                if (node)
+                    list.push_back(Entry(node));
             }
 
         auto a_it = rec.find("attr");
@@ -403,6 +952,46 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
         return list;
     }
 
+    /// Merge snapshot record into \a list. Re-uses the storage in \a list.
+    /// As with merge_snapshot_record(), string values must be moved into
+    /// the string database with finish_snapshot().
+    void merge_ctx_record_to_list(const CsvRecordView& rec, IdMap& idmap, bool project, EntryList& list) {
+        list.clear();
+
+        const CsvRecordView::Entry* r = rec.find(CsvRecordView::Ref);
+
+        if (r)
+            for (size_t i = r->first; i < r->first + r->count; ++i) {
+                Node* node = this->node(::map_id(::id_from_span(rec.value(i)), idmap));
+
+                if (node)
+                    list.push_back(Entry(node));
+            }
+
+        const CsvRecordView::Entry* a = rec.find(CsvRecordView::Attr);
+        const CsvRecordView::Entry* d = rec.find(CsvRecordView::Data);
+
+        if (a && d && a->count == d->count)
+            for (size_t i = 0; i < a->count; ++i) {
+                cali_id_t attr_id = ::map_id(::id_from_span(rec.value(a->first + i)), idmap);
+
+                if (project && skip_immediate(attr_id))
+                    continue; // don't parse values we don't need
+
+                Attribute attr = attribute(attr_id);
+
+                if (attr == Attribute::invalid)
+                    continue;
+
+                CsvRecordView::Span val = rec.value(d->first + i);
+
+                if (attr.type() == CALI_TYPE_STRING)
+                    list.push_back(Entry(attr, Variant(CALI_TYPE_STRING, val.ptr, val.len)));
+                else
+                    list.push_back(Entry(attr, make_variant(attr.type(), val)));
+            }
+    }
+
     RecordMap merge_ctx_record(const RecordMap& rec, IdMap& idmap) {
         RecordMap record(rec);
 
@@ -468,14 +1057,150 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
         }
     }
 
+    void merge(CaliperMetadataDB* db, const CsvRecordView& rec, IdMap& idmap, NodeProcessFn& node_fn, SnapshotProcessFn& snap_fn, EntryList& list) {
+        CsvRecordView::Span rec_name = rec.first(CsvRecordView::Rec);
+
+        if (rec_name == "node") {
+            const Node* node = merge_node_record(rec, idmap);
+
+            if (node)
+                node_fn(*db, node);
+        } else if (rec_name == "ctx") {
+            merge_ctx_record_to_list(rec, idmap, m_use_projection, list);
+
+            if (finish_snapshot(db, true, list))
+                snap_fn(*db, list);
+        } else if (rec_name == "globals") {
+            merge_ctx_record_to_list(rec, idmap, false, list);
+            finish_snapshot(db, false, list);
+
+            std::lock_guard<std::mutex>
+                g(m_globals_lock);
+
+            m_globals = list;
+        }
+    }
+
+    /// \brief Read \a filename, or the in-memory copy [\a data, \a data + \a len)
+    ///   of it if \a data is not null
+    bool read(CaliperMetadataDB* db, const std::string& filename, const char* data, std::size_t len, NodeProcessFn node_fn, SnapshotProcessFn snap_fn, unsigned num_threads) {
+        IdMap idmap;
+
+        bool is_binary =
+            (data ? BinaryReader::is_binary(data, len) : BinaryReader::is_binary(filename));
+
+        if (!is_binary) {
+            std::unique_ptr<CsvReader> p_reader(data ? new CsvReader(filename, data, len) : new CsvReader(filename));
+            CsvReader& reader = *p_reader;
+
+            // one entry list buffer per reader thread
+            std::vector<EntryList> lists(std::max(num_threads, 1u));
+
+            // Metadata records are read sequentially before any parallel chunk
+            // is processed, so the idmap is read-only in rec_handler.
+            return reader.read_records_parallel(num_threads,
+                [&](const CsvRecordView& rec){
+                    merge(db, rec, idmap, node_fn, snap_fn, lists[0]);
+                },
+                [&](unsigned t, const CsvRecordView& rec){
+                    merge(db, rec, idmap, node_fn, snap_fn, lists[t]);
+                });
+        }
+
+        std::unique_ptr<BinaryReader> p_reader(data ? new BinaryReader(filename, data, len) : new BinaryReader(filename));
+        BinaryReader& reader = *p_reader;
+        EntryList     list;
+        PendingNodes  pending;
+
+        // With lazy nodes, only attribute definitions are merged right away.
+        // Other nodes are merged when the first record refers to them.
+        auto resolve = [&](size_t n, const cali_id_t ids[]) {
+            if (m_lazy_nodes)
+                for (size_t i = 0; i < n; ++i)
+                    merge_pending_node(db, ids[i], pending, idmap, node_fn);
+        };
+
+        return reader.read(
+            [&](const NodeBuffer::NodeInfo& info){
+                if (m_lazy_nodes) {
+                    pending.add(info);
+
+                    if (info.attr_id == 8 /* cali.attribute.name */)
+                        merge_pending_node(db, info.node_id, pending, idmap, node_fn);
+
+                    return;
+                }
+
+                const Node* node = merge_node_info(info, idmap);
+
+                if (node)
+                    node_fn(*db, node);
+            },
+            [&](size_t nn, const cali_id_t nodes[], size_t ni, const cali_id_t attr[], const Variant vals[]){
+                resolve(nn, nodes);
+                resolve(ni, attr);
+
+                merge_snapshot_record(nn, nodes, ni, attr, vals, idmap, m_use_projection, list);
+
+                if (finish_snapshot(db, true, list))
+                    snap_fn(*db, list);
+            },
+            [&](size_t nn, const cali_id_t nodes[], size_t ni, const cali_id_t attr[], const Variant vals[]){
+                EntryList list;
+
+                resolve(nn, nodes);
+                resolve(ni, attr);
+
+                merge_snapshot_record(nn, nodes, ni, attr, vals, idmap, false, list);
+                finish_snapshot(db, false, list);
+
+                std::lock_guard<std::mutex>
+                    g(m_globals_lock);
+
+                m_globals = std::move(list);
+            },
+            [&](uint64_t){
+                // each rank section of a rank-tagged container has its own IDs
+                idmap.clear();
+                pending.clear();
+            });
+    }
+
+    bool read_from(CaliperMetadataDB* db, const std::string& filename, std::size_t& offset, IdMap& idmap, NodeProcessFn node_fn, SnapshotProcessFn snap_fn) {
+        if (BinaryReader::is_binary(filename)) {
+            Log(0).stream() << "CaliperMetadataDB: " << filename
+                            << ": incremental reading is not supported for binary .cali files"
+                            << std::endl;
+            return false;
+        }
+
+        CsvReader reader(filename);
+        EntryList list;
+
+        return reader.read_records_from(offset, [&](const CsvRecordView& rec){
+                merge(db, rec, idmap, node_fn, snap_fn, list);
+            });
+    }
+
+    bool read_range(CaliperMetadataDB* db, const std::string& filename, std::size_t begin, std::size_t end, IdMap& idmap, NodeProcessFn node_fn, SnapshotProcessFn snap_fn) {
+        if (BinaryReader::is_binary(filename))
+            return false;
+
+        CsvReader reader(filename);
+        EntryList list;
+
+        return reader.read_records_range(begin, end, [&](const CsvRecordView& rec){
+                merge(db, rec, idmap, node_fn, snap_fn, list);
+            });
+    }
+
     Attribute attribute(cali_id_t id) const {
-        std::lock_guard<std::mutex>
-            g(m_node_lock);
-        
-        if (id >= m_nodes.size())
+        Node* node = this->node(id);
+
+        if (!node)
             return Attribute::invalid;
 
-        return Attribute::make_attribute(m_nodes[id]);
+        return Attribute::make_attribute(node);
     }
 
     Attribute attribute(const std::string& name) const {
@@ -511,14 +1236,16 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
             if (attr[i].store_as_value())
                 continue;
 
-            std::lock_guard<std::mutex>
-                g(m_node_lock);
-            
-            for (node = parent->first_child(); node && !node->equals(attr[i].id(), data[i]); node = node->next_sibling())
-                ;
+            Variant v_data = data[i];
+
+            if (v_data.type() == CALI_TYPE_STRING)
+                v_data = make_string_variant(static_cast<const char*>(v_data.data()), v_data.size());
+
+            bool new_node = false;
+            node = find_or_create_node(attr[i].id(), v_data, parent, new_node);
 
             if (!node)
-                node = create_node(attr[i].id(), data[i], parent);
+                break;
 
             parent = node;
         }
@@ -533,14 +1260,16 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
             parent = &m_root;
 
         for (size_t i = 0; i < n; ++i) {
-            std::lock_guard<std::mutex>
-                g(m_node_lock);
-            
-            for (node = parent->first_child(); node && !node->equals(nodelist[i]->attribute(), nodelist[i]->data()); node = node->next_sibling())
-                ;
+            Variant v_data = nodelist[i]->data();
+
+            if (v_data.type() == CALI_TYPE_STRING)
+                v_data = make_string_variant(static_cast<const char*>(v_data.data()), v_data.size());
+
+            bool new_node = false;
+            node = find_or_create_node(nodelist[i]->attribute(), v_data, parent, new_node);
 
             if (!node)
-                node = create_node(nodelist[i]->attribute(), nodelist[i]->data(), parent);
+                break;
 
             parent = node;
         }
@@ -644,16 +1373,21 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl
     }
     
     CaliperMetadataDBImpl()
-        : m_root { CALI_INV_ID, CALI_INV_ID, { } }
+        : m_root { CALI_INV_ID, CALI_INV_ID, { } }, m_num_nodes(0)
         {
+            for (auto& b : m_node_blocks)
+                b.store(nullptr, std::memory_order_relaxed);
+
             setup_bootstrap_nodes();
         }
 
     ~CaliperMetadataDBImpl() {
-        for (const char* str : m_string_db)
-            delete[] str;
-        for (Node* n : m_nodes)
-            delete n;
+        size_t n = num_nodes();
+
+        for (size_t id = 0; id < n; ++id)
+            node(id)->~Node();
+        for (auto& b : m_node_blocks)
+            delete[] b.load(std::memory_order_relaxed);
     }
 }; // CaliperMetadataDBImpl
 
@@ -681,6 +1415,36 @@ CaliperMetadataDB::merge(const RecordMap& rec, IdMap& map, NodeProcessFn node_fn
     mP->merge(this, rec, map, node_fn, snap_fn);
 }
 
+void
+CaliperMetadataDB::set_read_spec(const QuerySpec& spec)
+{
+    mP->set_read_spec(spec);
+}
+
+bool
+CaliperMetadataDB::read(const std::string& filename, NodeProcessFn node_fn, SnapshotProcessFn snap_fn, unsigned num_threads)
+{
+    return mP->read(this, filename, nullptr, 0, node_fn, snap_fn, num_threads);
+}
+
+bool
+CaliperMetadataDB::read(const std::string& name, const char* data, std::size_t len, NodeProcessFn node_fn, SnapshotProcessFn snap_fn, unsigned num_threads)
+{
+    return mP->read(this, name, data, len, node_fn, snap_fn, num_threads);
+}
+
+bool
+CaliperMetadataDB::read_from(const std::string& filename, std::size_t& offset, IdMap& idmap, NodeProcessFn node_fn, SnapshotProcessFn snap_fn)
+{
+    return mP->read_from(this, filename, offset, idmap, node_fn, snap_fn);
+}
+
+bool
+CaliperMetadataDB::read_range(const std::string& filename, std::size_t begin, std::size_t end, IdMap& idmap, NodeProcessFn node_fn, SnapshotProcessFn snap_fn)
+{
+    return mP->read_range(this, filename, begin, end, idmap, node_fn, snap_fn);
+}
+
 const Node*
 CaliperMetadataDB::merge_node(cali_id_t node_id, cali_id_t attr_id, cali_id_t prnt_id, const Variant& value, IdMap& idmap)
 {
@@ -0,0 +1,222 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+/// \file DerivedMetrics.cpp
+/// DerivedMetrics implementation
+
+#include "caliper/reader/DerivedMetrics.h"
+
+#include "caliper/common/Attribute.h"
+#include "caliper/common/CaliperMetadataAccessInterface.h"
+#include "caliper/common/Entry.h"
+#include "caliper/common/Variant.h"
+
+#include <cmath>
+#include <limits>
+#include <map>
+
+using namespace cali;
+
+namespace
+{
+
+typedef std::vector<double> Column;
+
+/// \brief Read the values of \a attr in \a records into \a col.
+///   Missing or non-numeric values become NaN.
+void
+fill_column(const Attribute& attr, const std::vector<EntryList>& records, Column& col)
+{
+    col.assign(records.size(), std::numeric_limits<double>::quiet_NaN());
+
+    if (attr == Attribute::invalid)
+        return;
+
+    cali_id_t id = attr.id();
+
+    for (std::size_t i = 0; i < records.size(); ++i)
+        for (const Entry& e : records[i]) {
+            Variant v = e.value(id);
+
+            if (v.empty())
+                continue;
+
+            bool   ok  = false;
+            double val = v.to_double(&ok);
+
+            if (ok)
+                col[i] = val;
+
+            break;
+        }
+}
+
+} // namespace [anonymous]
+
+
+struct DerivedMetrics::DerivedMetricsImpl
+{
+    std::vector<QuerySpec::Derivation> m_derivations;
+
+    // evaluation stack; columns are re-used across batches
+    std::vector<Column> m_stack;
+    std::size_t         m_top;
+
+    Column& push(std::size_t n) {
+        if (m_top == m_stack.size())
+            m_stack.emplace_back();
+
+        Column& col = m_stack[m_top++];
+        col.resize(n);
+
+        return col;
+    }
+
+    template<typename Op>
+    void binary_op(Op op) {
+        Column& b = m_stack[--m_top];
+        Column& a = m_stack[m_top - 1];
+
+        const std::size_t n = a.size();
+
+        double*       pa = a.data();
+        const double* pb = b.data();
+
+        for (std::size_t i = 0; i < n; ++i)
+            pa[i] = op(pa[i], pb[i]);
+    }
+
+    void evaluate(const QuerySpec::Derivation& d,
+                  CaliperMetadataAccessInterface& db,
+                  const std::vector<EntryList>& records,
+                  std::map<std::string, Column>& columns) {
+        const std::size_t n = records.size();
+
+        m_top = 0;
+
+        for (const QuerySpec::ExpressionOp& op : d.ops) {
+            switch (op.op) {
+            case QuerySpec::ExpressionOp::Operand:
+            {
+                auto it = columns.find(op.attr_name);
+
+                if (it == columns.end()) {
+                    it = columns.emplace(op.attr_name, Column()).first;
+                    fill_column(db.get_attribute(op.attr_name), records, it->second);
+                }
+
+                push(n) = it->second;
+            }
+                break;
+            case QuerySpec::ExpressionOp::Constant:
+                push(n).assign(n, op.value);
+                break;
+            case QuerySpec::ExpressionOp::Add:
+                binary_op([](double a, double b){ return a + b; });
+                break;
+            case QuerySpec::ExpressionOp::Sub:
+                binary_op([](double a, double b){ return a - b; });
+                break;
+            case QuerySpec::ExpressionOp::Mul:
+                binary_op([](double a, double b){ return a * b; });
+                break;
+            case QuerySpec::ExpressionOp::Div:
+                binary_op([](double a, double b){ return a / b; });
+                break;
+            case QuerySpec::ExpressionOp::Neg:
+            {
+                Column& a = m_stack[m_top - 1];
+
+                for (double& v : a)
+                    v = -v;
+            }
+                break;
+            }
+        }
+    }
+
+    void process(CaliperMetadataAccessInterface& db, std::vector<EntryList>& records) {
+        if (records.empty())
+            return;
+
+        // operand and derived metric columns for this batch
+        std::map<std::string, Column> columns;
+
+        for (const QuerySpec::Derivation& d : m_derivations) {
+            evaluate(d, db, records, columns);
+
+            if (m_top != 1)
+                continue;
+
+            Column&   result = m_stack[0];
+            Attribute attr   =
+                db.create_attribute(d.name, CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+            for (std::size_t i = 0; i < records.size(); ++i)
+                if (std::isfinite(result[i]))
+                    records[i].push_back(Entry(attr, Variant(result[i])));
+
+            // later expressions can refer to this metric
+            columns[d.name].swap(result);
+        }
+    }
+
+    DerivedMetricsImpl(const QuerySpec& spec)
+        : m_top(0)
+    {
+        if (spec.derived.selection == QuerySpec::DerivationSelection::List)
+            m_derivations = spec.derived.list;
+    }
+};
+
+
+DerivedMetrics::DerivedMetrics(const QuerySpec& spec)
+    : mP(new DerivedMetricsImpl(spec))
+{ }
+
+DerivedMetrics::~DerivedMetrics()
+{
+    mP.reset();
+}
+
+bool
+DerivedMetrics::empty() const
+{
+    return mP->m_derivations.empty();
+}
+
+void
+DerivedMetrics::process(CaliperMetadataAccessInterface& db, std::vector<EntryList>& records)
+{
+    mP->process(db, records);
+}
@@ -49,7 +49,7 @@
 #include <iterator>
 #include <mutex>
 #include <set>
-#include <sstream>
+#include <unordered_map>
 
 using namespace cali;
 using namespace std;
@@ -59,6 +59,20 @@ struct Expand::ExpandImpl
     set<string>  m_selected;
     set<string>  m_deselected;
 
+    /// \brief Cached attribute name and selection status
+    struct AttributeInfo {
+        string name;
+        bool   selected;
+    };
+
+    // Cached attribute info and formatted expansions of reference nodes.
+    // Entries are never modified or removed once inserted; references to
+    // unordered_map elements stay valid across insertions.
+    unordered_map<cali_id_t, AttributeInfo> m_attr_cache;
+    unordered_map<const Node*, string>      m_node_cache;
+
+    std::mutex   m_cache_lock;
+
     OutputStream m_os;
 
     std::mutex   m_os_lock;
@@ -99,57 +113,131 @@ struct Expand::ExpandImpl
             break;
         }
     }
-    
-    void print(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        int nentry = 0;
 
-        std::ostringstream os;
-        
-        for (const Entry& e : list) {
-            if (e.node()) {
-                vector<const Node*> nodes;
+    const AttributeInfo& attribute_info(CaliperMetadataAccessInterface& db, cali_id_t attr_id) {
+        std::lock_guard<std::mutex>
+            g(m_cache_lock);
+
+        auto it = m_attr_cache.find(attr_id);
+
+        if (it == m_attr_cache.end()) {
+            string name = db.get_attribute(attr_id).name();
+            bool   selected =
+                (m_selected.empty() || m_selected.count(name) > 0) && m_deselected.count(name) == 0;
+
+            it = m_attr_cache.emplace(attr_id, AttributeInfo { name, selected }).first;
+        }
+
+        return it->second;
+    }
+
+    /// \brief Format the expansion of the context tree branch ending at \a node
+    string expand_node(CaliperMetadataAccessInterface& db, const Node* node) {
+        vector<const Node*> nodes;
+
+        for ( ; node && node->attribute() != CALI_INV_ID; node = node->parent())
+            if (attribute_info(db, node->attribute()).selected)
+                nodes.push_back(node);
+
+        stable_sort(nodes.begin(), nodes.end(), [](const Node* a, const Node* b) { return a->attribute() < b->attribute(); } );
+
+        string    str;
+        cali_id_t prev_attr_id = CALI_INV_ID;
+
+        for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+            if ((*it)->attribute() != prev_attr_id) {
+                if (!str.empty())
+                    str.push_back(',');
+
+                str.append(attribute_info(db, (*it)->attribute()).name).push_back('=');
+                prev_attr_id = (*it)->attribute();
+            } else {
+                str.push_back('/');
+            }
+
+            str.append((*it)->data().to_string());
+        }
+
+        return str;
+    }
+
+    const string& node_expansion(CaliperMetadataAccessInterface& db, const Node* node) {
+        {
+            std::lock_guard<std::mutex>
+                g(m_cache_lock);
 
-                for (const Node* node = e.node(); node && node->attribute() != CALI_INV_ID; node = node->parent()) {
-                    string name = db.get_attribute(node->attribute()).name();
+            auto it = m_node_cache.find(node);
 
-                    if ((!m_selected.empty() && m_selected.count(name) == 0) || m_deselected.count(name))
-                        continue;
+            if (it != m_node_cache.end())
+                return it->second;
+        }
+
+        string str = expand_node(db, node);
 
-                    nodes.push_back(node);
-                }
+        std::lock_guard<std::mutex>
+            g(m_cache_lock);
+
+        return m_node_cache.emplace(node, std::move(str)).first->second;
+    }
 
-                if (nodes.empty())
+    /// \brief Append the expansion of \a list and a newline to \a out,
+    ///   unless it's empty
+    void format(CaliperMetadataAccessInterface& db, const EntryList& list, string& out) {
+        std::size_t start = out.size();
+
+        for (const Entry& e : list) {
+            if (e.node()) {
+                const string& str = node_expansion(db, e.node());
+
+                if (str.empty())
                     continue;
+                if (out.size() > start)
+                    out.push_back(',');
 
-                stable_sort(nodes.begin(), nodes.end(), [](const Node* a, const Node* b) { return a->attribute() < b->attribute(); } );
-	  
-                cali_id_t prev_attr_id = CALI_INV_ID;
-
-                for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
-                    if ((*it)->attribute() != prev_attr_id) {
-                        os << (nentry++ ? "," : "") << db.get_attribute((*it)->attribute()).name() << '=';
-                        prev_attr_id = (*it)->attribute();
-                    } else {
-                        os << '/';
-                    }
-                    os << (*it)->data().to_string();
-                }
+                out.append(str);
             } else if (e.attribute() != CALI_INV_ID) {
-                string name = db.get_attribute(e.attribute()).name();
+                const AttributeInfo& info = attribute_info(db, e.attribute());
 
-                if ((!m_selected.empty() && m_selected.count(name) == 0) || m_deselected.count(name))
+                if (!info.selected)
                     continue;
+                if (out.size() > start)
+                    out.push_back(',');
 
-                os << (nentry++ ? "," : "") << name << '=' << e.value();
+                out.append(info.name).push_back('=');
+                out.append(e.value().to_string());
             }
         }
-        
-        if (nentry > 0) {
-            std::lock_guard<std::mutex>
-                g(m_os_lock);
-            
-            m_os.stream() << os.str() << endl;
-        }
+
+        if (out.size() > start)
+            out.push_back('\n');
+    }
+
+    void write(const string& out) {
+        if (out.empty())
+            return;
+
+        std::lock_guard<std::mutex>
+            g(m_os_lock);
+
+        m_os.write(out.data(), out.size());
+    }
+
+    void print(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        string out;
+
+        format(db, list, out);
+        write(out);
+    }
+
+    void print(CaliperMetadataAccessInterface& db, const std::vector<EntryList>& records) {
+        Formatter::format_rows(records.size(),
+                               [this,&db,&records](size_t begin, size_t end, string& out) {
+                                   for (size_t i = begin; i < end; ++i)
+                                       format(db, records[i], out);
+                               },
+                               [this](const string& out) {
+                                   write(out);
+                               });
     }
 };
 
@@ -182,3 +270,9 @@ Expand::process_record(CaliperMetadataAccessInterface& db, const EntryList& list
 {
     mP->print(db, list);
 }
+
+void
+Expand::process_records(CaliperMetadataAccessInterface& db, const std::vector<EntryList>& records)
+{
+    mP->print(db, records);
+}
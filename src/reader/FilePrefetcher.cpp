@@ -0,0 +1,249 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file FilePrefetcher.cpp
+/// FilePrefetcher class implementation
+
+#include "caliper/reader/FilePrefetcher.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cali;
+
+namespace
+{
+
+enum class FileState { Pending, Loading, Ready, Skipped, Taken };
+
+/// \brief Read the regular file \a filename into \a buf, or issue a
+///   read-ahead hint if it's larger than \a max_size.
+/// \return true if the file was read into \a buf
+bool load_file(const std::string& filename, std::size_t max_size, std::vector<char>& buf)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    std::size_t len = static_cast<std::size_t>(st.st_size);
+
+    if (len > max_size) {
+        // Too large to copy: the reader maps the file itself, but we can
+        // still have the kernel start reading it
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+        close(fd);
+        return false;
+    }
+
+    buf.resize(len);
+
+    std::size_t pos = 0;
+
+    while (pos < len) {
+        ssize_t ret = read(fd, buf.data() + pos, len - pos);
+
+        if (ret <= 0)
+            break;
+
+        pos += static_cast<std::size_t>(ret);
+    }
+
+    close(fd);
+
+    // the file may have been truncated while reading it
+    buf.resize(pos);
+
+    return pos == len;
+}
+
+} // namespace [anonymous]
+
+struct FilePrefetcher::FilePrefetcherImpl
+{
+    std::vector<std::string>       files;
+    std::vector<FileState>         state;
+    std::vector<FilePrefetcher::Buffer> buffers;
+
+    std::size_t                    window;
+    std::size_t                    max_file_size;
+
+    std::size_t                    next;        ///< Next file to load
+    std::size_t                    num_loaded;  ///< Loaded files not taken yet
+    std::size_t                    num_prefetched;
+    bool                           stop;
+
+    std::mutex                     lock;
+    std::condition_variable        loader_cv;   ///< Signals loaders: window space or stop
+    std::condition_variable        ready_cv;    ///< Signals take(): a file finished loading
+
+    std::vector<std::thread>       threads;
+
+    void loader() {
+        std::unique_lock<std::mutex> g(lock);
+
+        while (true) {
+            loader_cv.wait(g, [this](){
+                    return stop || (next < files.size() && num_loaded < window);
+                });
+
+            if (stop)
+                return;
+
+            std::size_t i = next++;
+
+            // skip files that were already requested
+            if (state[i] != FileState::Pending)
+                continue;
+            if (files[i].empty()) {
+                state[i] = FileState::Skipped;
+                ready_cv.notify_all();
+                continue;
+            }
+
+            state[i] = FileState::Loading;
+            ++num_loaded;
+
+            g.unlock();
+
+            std::shared_ptr< std::vector<char> > buf(new std::vector<char>);
+            bool ok = load_file(files[i], max_file_size, *buf);
+
+            g.lock();
+
+            if (ok) {
+                buffers[i] = buf;
+                state[i]   = FileState::Ready;
+                ++num_prefetched;
+            } else {
+                state[i]   = FileState::Skipped;
+                --num_loaded;
+                loader_cv.notify_one();
+            }
+
+            ready_cv.notify_all();
+        }
+    }
+
+    FilePrefetcher::Buffer take(std::size_t i) {
+        if (i >= files.size())
+            return FilePrefetcher::Buffer();
+
+        std::unique_lock<std::mutex> g(lock);
+
+        if (state[i] == FileState::Pending) {
+            // not started yet: the caller reads it itself
+            state[i] = FileState::Taken;
+            return FilePrefetcher::Buffer();
+        }
+
+        ready_cv.wait(g, [this,i](){ return state[i] != FileState::Loading; });
+
+        FilePrefetcher::Buffer ret;
+
+        if (state[i] == FileState::Ready) {
+            ret.swap(buffers[i]);
+            --num_loaded;
+            loader_cv.notify_one();
+        }
+
+        state[i] = FileState::Taken;
+
+        return ret;
+    }
+
+    FilePrefetcherImpl(const std::vector<std::string>& f, unsigned num_threads, std::size_t w, std::size_t max_size)
+        : files(f),
+          state(f.size(), FileState::Pending),
+          buffers(f.size()),
+          window(std::max<std::size_t>(w, 1)),
+          max_file_size(max_size),
+          next(0),
+          num_loaded(0),
+          num_prefetched(0),
+          stop(false)
+    {
+        num_threads = std::min<std::size_t>(std::max(num_threads, 1u), std::min(window, files.size()));
+
+        for (unsigned t = 0; t < num_threads; ++t)
+            threads.emplace_back(&FilePrefetcherImpl::loader, this);
+    }
+
+    ~FilePrefetcherImpl() {
+        {
+            std::lock_guard<std::mutex> g(lock);
+            stop = true;
+        }
+
+        loader_cv.notify_all();
+
+        for (std::thread& t : threads)
+            t.join();
+    }
+};
+
+FilePrefetcher::FilePrefetcher(const std::vector<std::string>& files, unsigned num_threads, std::size_t window, std::size_t max_file_size)
+    : mP { new FilePrefetcherImpl(files, num_threads, window, max_file_size) }
+{ }
+
+FilePrefetcher::~FilePrefetcher()
+{
+    mP.reset();
+}
+
+FilePrefetcher::Buffer
+FilePrefetcher::take(std::size_t index)
+{
+    return mP->take(index);
+}
+
+std::size_t
+FilePrefetcher::num_prefetched() const
+{
+    std::lock_guard<std::mutex> g(mP->lock);
+    return mP->num_prefetched;
+}
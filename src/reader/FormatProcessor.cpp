@@ -32,6 +32,8 @@
 
 #include "caliper/reader/FormatProcessor.h"
 
+#include "caliper/reader/ArrowFormatter.h"
+#include "caliper/reader/DerivedMetrics.h"
 #include "caliper/reader/Expand.h"
 #include "caliper/reader/JsonFormatter.h"
 #include "caliper/reader/JsonSplitFormatter.h"
@@ -44,14 +46,21 @@
 
 #include "caliper/common/csv/CsvWriter.h"
 
+#include <mutex>
+
 using namespace cali;
 
 namespace
 {
 
+/// Number of records per derived metric evaluation batch
+const std::size_t DerivedBatchSize = 1024;
+
 const char* format_kernel_args[] = { "format", "title" };
 const char* tree_kernel_args[]   = { "path-attributes" }; 
+const char* table_kernel_args[]  = { "limit" };
 const char* json_kernel_args[]   = { "split", "pretty", "quote-all" }; 
+const char* json_split_kernel_args[] = { "stream" };
 
 enum FormatterID {
     Cali        = 0,
@@ -60,7 +69,8 @@ enum FormatterID {
     Format      = 3,
     Table       = 4,
     Tree        = 5,
-    JsonSplit   = 6
+    JsonSplit   = 6,
+    Arrow       = 7
 };
 
 const QuerySpec::FunctionSignature formatters[] = {
@@ -69,9 +79,10 @@ const QuerySpec::FunctionSignature formatters[] = {
     { FormatterID::Json,      "json",       0, 3, json_kernel_args },
     { FormatterID::Expand,    "expand",     0, 0, nullptr },
     { FormatterID::Format,    "format",     1, 2, format_kernel_args },
-    { FormatterID::Table,     "table",      0, 0, nullptr },
+    { FormatterID::Table,     "table",      0, 1, table_kernel_args },
     { FormatterID::Tree,      "tree",       0, 1, tree_kernel_args   },
-    { FormatterID::JsonSplit, "json-split", 0, 0, nullptr },
+    { FormatterID::JsonSplit, "json-split", 0, 1, json_split_kernel_args },
+    { FormatterID::Arrow,     "arrow",      0, 0, nullptr },
     
     QuerySpec::FunctionSignatureTerminator
 };
@@ -102,6 +113,70 @@ struct FormatProcessor::FormatProcessorImpl
     Formatter*   m_formatter;
     OutputStream m_stream;
 
+    // Records are collected in batches for computing derived metrics
+    DerivedMetrics         m_derived;
+    std::vector<EntryList> m_batch;
+    std::mutex             m_batch_lock;
+
+    // Compute derived metrics for the current batch and pass it on to
+    // the formatter. Must hold m_batch_lock.
+    void process_batch(CaliperMetadataAccessInterface& db) {
+        m_derived.process(db, m_batch);
+
+        if (m_formatter)
+            m_formatter->process_records(db, m_batch);
+
+        m_batch.clear();
+    }
+
+    void process_records(CaliperMetadataAccessInterface& db, const std::vector<EntryList>& records) {
+        if (m_derived.empty()) {
+            if (m_formatter)
+                m_formatter->process_records(db, records);
+
+            return;
+        }
+
+        std::lock_guard<std::mutex>
+            g(m_batch_lock);
+
+        for (const EntryList& rec : records) {
+            m_batch.push_back(rec);
+
+            if (m_batch.size() >= DerivedBatchSize)
+                process_batch(db);
+        }
+    }
+
+    void process_record(CaliperMetadataAccessInterface& db, const EntryList& rec) {
+        if (m_derived.empty()) {
+            if (m_formatter)
+                m_formatter->process_record(db, rec);
+
+            return;
+        }
+
+        std::lock_guard<std::mutex>
+            g(m_batch_lock);
+
+        m_batch.push_back(rec);
+
+        if (m_batch.size() >= DerivedBatchSize)
+            process_batch(db);
+    }
+
+    void flush(CaliperMetadataAccessInterface& db) {
+        if (!m_derived.empty()) {
+            std::lock_guard<std::mutex>
+                g(m_batch_lock);
+
+            process_batch(db);
+        }
+
+        if (m_formatter)
+            m_formatter->flush(db, m_stream.stream());
+    }
+
     void create_formatter(const QuerySpec& spec) {
         if (spec.format.opt == QuerySpec::FormatSpec::Default) {
             m_formatter = new CaliFormatter(m_stream);
@@ -128,12 +203,15 @@ struct FormatProcessor::FormatProcessorImpl
             case FormatterID::JsonSplit:
                 m_formatter = new JsonSplitFormatter(m_stream, spec);
                 break;
+            case FormatterID::Arrow:
+                m_formatter = new ArrowFormatter(spec);
+                break;
             }
         }
     }
     
     FormatProcessorImpl(OutputStream& stream, const QuerySpec& spec)
-        : m_stream(stream), m_formatter(nullptr)
+        : m_formatter(nullptr), m_stream(stream), m_derived(spec)
     {
         create_formatter(spec);
     }
@@ -163,13 +241,17 @@ FormatProcessor::formatter_defs()
 void
 FormatProcessor::process_record(CaliperMetadataAccessInterface& db, const EntryList& rec)
 {
-    if (mP->m_formatter)
-        mP->m_formatter->process_record(db, rec);
+    mP->process_record(db, rec);
+}
+
+void
+FormatProcessor::process_records(CaliperMetadataAccessInterface& db, const std::vector<EntryList>& records)
+{
+    mP->process_records(db, records);
 }
 
 void
 FormatProcessor::flush(CaliperMetadataAccessInterface& db)
 {
-    if (mP->m_formatter)
-        mP->m_formatter->flush(db, mP->m_stream.stream());
+    mP->flush(db);
 }
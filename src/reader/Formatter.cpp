@@ -0,0 +1,89 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file Formatter.cpp
+/// Formatter base class implementation
+
+#include "caliper/reader/Formatter.h"
+
+#include <algorithm>
+#include <thread>
+
+using namespace cali;
+
+namespace
+{
+
+const std::size_t min_range_size = 1024;
+const std::size_t max_range_size = 65536;
+
+}
+
+void
+Formatter::format_rows(std::size_t n,
+                       const std::function<void(std::size_t, std::size_t, std::string&)>& format,
+                       const std::function<void(const std::string&)>& write)
+{
+    unsigned nthreads = std::min<unsigned>(std::max(1u, std::thread::hardware_concurrency()), 8);
+
+    if (nthreads < 2 || n < 2 * min_range_size) {
+        std::string buf;
+        format(0, n, buf);
+        write(buf);
+        return;
+    }
+
+    std::size_t range = std::min(std::max(n / nthreads, min_range_size), max_range_size);
+
+    std::vector<std::string> bufs(nthreads);
+
+    // Format up to nthreads ranges at a time. Each range's buffer is
+    // written as soon as its thread is done, while the threads for the
+    // following ranges keep formatting.
+
+    for (std::size_t wave = 0; wave < n; wave += nthreads * range) {
+        std::vector<std::thread> threads;
+
+        for (unsigned t = 0; t < nthreads && wave + t * range < n; ++t) {
+            std::size_t begin = wave + t * range;
+            std::size_t end   = std::min(n, begin + range);
+
+            bufs[t].clear();
+            threads.emplace_back([&format,&bufs,t,begin,end](){ format(begin, end, bufs[t]); });
+        }
+
+        for (std::size_t t = 0; t < threads.size(); ++t) {
+            threads[t].join();
+            write(bufs[t]);
+        }
+    }
+}
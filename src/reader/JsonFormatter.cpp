@@ -49,6 +49,7 @@
 #include <algorithm>
 #include <functional>
 #include <iterator>
+#include <map>
 #include <mutex>
 #include <set>
 #include <sstream>
@@ -127,141 +128,205 @@ struct JsonFormatter::JsonFormatterImpl
         }
     }
     
-    void print(CaliperMetadataAccessInterface& db, const EntryList& list) {
+    /// \brief Cached per-attribute output information
+    struct AttributeInfo {
+        std::string    key;           ///< Escaped and quoted name with ':'
+        cali_attr_type type;
+        bool           print_node;    ///< Print as context tree node
+        bool           print_value;   ///< Print as immediate value
+    };
+
+    std::map<cali_id_t, AttributeInfo> m_attr_info;
+    std::mutex                         m_attr_info_lock;
+
+    const AttributeInfo* get_attribute_info(CaliperMetadataAccessInterface& db, cali_id_t id) {
+        std::lock_guard<std::mutex>
+            g(m_attr_info_lock);
+
+        auto it = m_attr_info.find(id);
 
-        std::vector<std::string> key_value_pairs;
-        std::ostringstream ss_key_value;
+        if (it != m_attr_info.end())
+            return &(it->second);
 
-        std::ostringstream os;
+        Attribute attr = db.get_attribute(id);
+        string    name = attr.name();
 
-        bool writing_attr_data = false;
+        bool selected   = m_selected.count(name) > 0;
+        bool deselected = m_deselected.count(name) > 0;
+
+        AttributeInfo info;
+
+        util::WriteBuffer key(name.size() + 4);
+        key.append('"').append_esc(name).append("\":", 2);
         
+        info.key         = std::string(key.data(), key.size());
+        info.type        = attr.type();
+        info.print_node  = 
+            (selected && !deselected) || !(!m_selected.empty() || attr.is_hidden() || attr.is_global());
+        info.print_value = 
+            !(attr.is_hidden() || (!m_selected.empty() && !selected) || deselected);
+
+        return &(m_attr_info.emplace(id, std::move(info)).first->second);
+    }
+    
+    struct NodeInfo {
+        const Node*          node;
+        const AttributeInfo* info;
+    };
+
+    /// \brief Append the JSON key-value pairs for \a list to \a buf
+    /// \return false if \a list has nothing to print
+    bool format(CaliperMetadataAccessInterface& db, const EntryList& list, util::WriteBuffer& buf) {
+        // Per-thread scratch space, re-used across records
+        static thread_local std::vector<NodeInfo> nodes;
+
+        int count = 0;
+
         for (const Entry& e : list) {
 
             if (e.node()) {
 
                 // First find all nodes selected for printing
-                vector<const Node*> nodes;
-                for (const Node* node = e.node(); node && node->attribute() != CALI_INV_ID; node = node->parent()) {
-                    Attribute attr = db.get_attribute(node->attribute());
-                    string name = attr.name();
+                nodes.clear();
 
-                    bool selected = m_selected.count(name) > 0 && !(m_deselected.count(name) > 0);
+                for (const Node* node = e.node(); node && node->attribute() != CALI_INV_ID; node = node->parent()) {
+                    const AttributeInfo* info = get_attribute_info(db, node->attribute());
 
-                    if (!selected && (!m_selected.empty() || attr.is_hidden() || attr.is_global()))
+                    if (!info->print_node)
                         continue;
 
-                    nodes.push_back(node);
+                    // Sort nodes consistently based on attribute id.
+                    //   Insertion sort keeps the order of nodes with the same
+                    //   attribute; node lists are short.
+                    NodeInfo n { node, info };
+                    auto it = nodes.end();
+
+                    for ( ; it != nodes.begin() && (it-1)->node->attribute() > node->attribute(); --it)
+                        ;
+
+                    nodes.insert(it, n);
                 }
 
-                if (nodes.empty())
-                    continue;
+                // Go through all nodes in reverse order
+                for (auto it = nodes.rbegin(); it != nodes.rend(); ) {
+                    cali_id_t attr_id = it->node->attribute();
+                    const AttributeInfo* info = it->info;
 
-                // Sort all nodes consistently baseed on attribute id
-                stable_sort(nodes.begin(), nodes.end(), [](const Node* a, const Node* b) { return a->attribute() < b->attribute(); } );
-	  
-                cali_id_t prev_attr_id = CALI_INV_ID;
+                    if (count++ > 0)
+                        buf.append(',').append(m_opt_pretty ? "\n\t" : "");
 
-                bool quotes = m_opt_quote_all | false;
+                    buf.append(info->key);
 
-                // Go through all nodes in reverse order
-                for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
-
-                    // Get attribute information
-                    cali_id_t attr_id = (*it)->attribute();
-                    Attribute attr = db.get_attribute(attr_id);
-                    cali_attr_type attr_type = attr.type();
-
-                    // Check if we encountered a new attribute
-                    if (attr_id != prev_attr_id) {
-
-                        // Check if we are completing a previous attribute
-                        if (writing_attr_data) {
-                            // Complete a pair and push it back, then clear the stringstream
-                            ss_key_value << (quotes ? "\"" : "");
-                            key_value_pairs.push_back(ss_key_value.str());
-                            ss_key_value.str(std::string());
-                        }
-
-                        // Start new attribute
-                        quotes = m_opt_quote_all | false;
-                        util::write_esc_string(ss_key_value << '"', attr.name()) << '"' << ':';
-
-                        // If STRING or USR, or if nested attribute values x/y/z, start quotes
-                        if (attr_type == CALI_TYPE_STRING || attr_type == CALI_TYPE_USR 
-                                || ((it+1 != nodes.rend()) && (*(it+1))->attribute()) != attr_id) {
-                            quotes = true;
-                        }
-
-                        if (quotes) {
-                            ss_key_value << '"';
-                        }
-
-                        writing_attr_data = true;
-                        prev_attr_id = attr_id;
-
-                    } else {
-                        ss_key_value << '/';
-                    }
+                    // Context tree values are always quoted. They may be
+                    // nested x/y/z paths.
+                    buf.append('"');
 
-                    util::write_esc_string(ss_key_value, (*it)->data().to_string());
-                }
+                    for (int n = 0; it != nodes.rend() && it->node->attribute() == attr_id; ++it, ++n) {
+                        if (n > 0)
+                            buf.append('/');
+
+                        buf.append_variant(it->node->data(), true);
+                    }
 
-                if (writing_attr_data) {
-                    ss_key_value << (quotes ? "\"" : "");
-                    key_value_pairs.push_back(ss_key_value.str());
-                    ss_key_value.str(std::string());
-                    writing_attr_data = false;
-                    quotes = m_opt_quote_all | false;
+                    buf.append('"');
                 }
 
             } else if (e.attribute() != CALI_INV_ID) {
-                Attribute attr = db.get_attribute(e.attribute());
-                string name = attr.name();
-                cali_attr_type attr_type = attr.type();
+                const AttributeInfo* info = get_attribute_info(db, e.attribute());
 
                 // Check if this attribute is selected for printing
-                if (attr.is_hidden() || (!m_selected.empty() && m_selected.count(name) == 0) || m_deselected.count(name))
+                if (!info->print_value)
                     continue;
 
-                bool quotes = m_opt_quote_all | false;
+                if (count++ > 0)
+                    buf.append(',').append(m_opt_pretty ? "\n\t" : "");
 
-                util::write_esc_string(ss_key_value << '"', name) << '"' << ':' ;
-                
-                string data = e.value().to_string();
-                if (attr_type == CALI_TYPE_STRING || attr_type == CALI_TYPE_USR)
-                    quotes = true;
+                buf.append(info->key);
+
+                bool quotes = m_opt_quote_all
+                    || info->type == CALI_TYPE_STRING || info->type == CALI_TYPE_USR;
 
                 if (quotes)
-                    ss_key_value << '"' << data << '"';
+                    buf.append('"').append_variant(e.value()).append('"');
                 else
-                    ss_key_value << data;
-
-                key_value_pairs.push_back(ss_key_value.str());
-                ss_key_value.str(std::string());
+                    buf.append_variant(e.value());
             }
         }
 
-        for(size_t i = 0; i < key_value_pairs.size(); ++i)
-        {
-            if(i != 0)
-                os << "," << (m_opt_pretty ? "\n\t" : "");
-            os << key_value_pairs[i];
-        }
+        return count > 0;
+    }
+
+    void print(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        // Per-thread scratch space, re-used across records
+        static thread_local util::WriteBuffer buf;
+
+        buf.clear();
 
-        if (!key_value_pairs.empty()) {
+        if (format(db, list, buf)) {
             std::lock_guard<std::mutex>
                 g(m_os_lock);
+
+            std::ostream& os = m_os.stream();
             
-            m_os.stream() << (m_opt_split ? "" : (m_first_row ? "[\n" : ","));
-            m_os.stream() << (m_first_row ? "" : "\n") << "{" << (m_opt_pretty ? "\n\t" : "");
-            m_os.stream() << os.str();
-            m_os.stream() << (m_opt_pretty ? "\n" : "" ) << "}";
+            os << (m_opt_split ? "" : (m_first_row ? "[\n" : ","));
+            os << (m_first_row ? "" : "\n") << "{" << (m_opt_pretty ? "\n\t" : "");
+            buf.write_to(os);
+            os << (m_opt_pretty ? "\n" : "" ) << "}";
             
             m_first_row = false;
         }
     }
 
+    /// \brief Format records [\a begin, \a end) of \a records into \a out.
+    ///
+    /// Every row gets the separator of a non-first row; write_rows()
+    /// fixes the very first row of the output.
+    void format_rows(CaliperMetadataAccessInterface& db, const std::vector<EntryList>& records, size_t begin, size_t end, std::string& out) {
+        util::WriteBuffer buf;
+
+        for (size_t i = begin; i < end; ++i) {
+            buf.clear();
+
+            if (!format(db, records[i], buf))
+                continue;
+
+            out.append(m_opt_split ? "\n{" : ",\n{").append(m_opt_pretty ? "\n\t" : "");
+            out.append(buf.data(), buf.size());
+            out.append(m_opt_pretty ? "\n" : "").push_back('}');
+        }
+    }
+
+    void write_rows(const std::string& out) {
+        if (out.empty())
+            return;
+
+        std::lock_guard<std::mutex>
+            g(m_os_lock);
+
+        if (m_first_row) {
+            // replace the non-first row separator
+            std::size_t skip = (m_opt_split ? 1 : 2);
+
+            if (!m_opt_split)
+                m_os.write("[\n", 2);
+
+            m_os.write(out.data() + skip, out.size() - skip);
+            m_first_row = false;
+        } else {
+            m_os.write(out.data(), out.size());
+        }
+    }
+
+    void print(CaliperMetadataAccessInterface& db, const std::vector<EntryList>& records) {
+        Formatter::format_rows(records.size(),
+                               [this,&db,&records](size_t begin, size_t end, std::string& out) {
+                                   format_rows(db, records, begin, end, out);
+                               },
+                               [this](const std::string& out) {
+                                   write_rows(out);
+                               });
+    }
+
     void write_globals(CaliperMetadataAccessInterface& db, std::ostream& os) {
         std::vector<Entry>               globals = db.get_globals();
         std::map<cali_id_t, std::string> global_vals;
@@ -302,6 +367,12 @@ JsonFormatter::process_record(CaliperMetadataAccessInterface& db, const EntryLis
     mP->print(db, list);
 }
 
+void
+JsonFormatter::process_records(CaliperMetadataAccessInterface& db, const std::vector<EntryList>& records)
+{
+    mP->print(db, records);
+}
+
 void JsonFormatter::flush(CaliperMetadataAccessInterface& db, std::ostream& os)
 {
     if (!mP->m_opt_split)
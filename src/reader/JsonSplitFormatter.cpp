@@ -52,7 +52,6 @@
 #include <iterator>
 #include <mutex>
 #include <set>
-#include <sstream>
 #include <iostream>
 
 
@@ -79,6 +78,20 @@ class Hierarchy
 
         const std::string& label() const { return m_label; }
 
+        /// \brief Compare label with \a val without creating a temporary string
+        bool label_equals(const Variant& val) const {
+            if (val.type() != CALI_TYPE_STRING)
+                return val.to_string() == m_label;
+
+            const char* str = static_cast<const char*>(val.data());
+            size_t      len = val.size();
+
+            if (len && str[len-1] == 0)
+                --len;
+
+            return len == m_label.size() && m_label.compare(0, len, str, len) == 0;
+        }
+
         std::ostream& write_json(std::ostream& os) const {
             util::write_esc_string(os << "{ \"label\": \"", m_label) << "\"";
 
@@ -142,16 +155,16 @@ public:
 
         for (const Entry& e : vec) {
             HierarchyNode* parent = node;
-            std::string    label  = e.value().to_string();
+            Variant        val    = e.value();
             
-            for (node = parent->first_child(); node && (label != node->label()); node = node->next_sibling())
+            for (node = parent->first_child(); node && !node->label_equals(val); node = node->next_sibling())
                 ;
 
             if (!node) {
                 std::lock_guard<std::mutex>
                     g(m_nodes_lock);
                 
-                node = new HierarchyNode(m_nodes.size(), label);
+                node = new HierarchyNode(m_nodes.size(), val.to_string());
                 m_nodes.push_back(node);
                 
                 parent->append(node);
@@ -193,6 +206,7 @@ public:
 struct JsonSplitFormatter::JsonSplitFormatterImpl
 { 
     bool                     m_select_all;
+    bool                     m_opt_stream;
     std::vector<std::string> m_attr_names;
     
     std::mutex               m_init_lock;
@@ -225,6 +239,7 @@ struct JsonSplitFormatter::JsonSplitFormatterImpl
     
     JsonSplitFormatterImpl(OutputStream& os)
         : m_select_all(false),
+          m_opt_stream(false),
           m_initialized(false),
           m_row_count(0),
           m_os(os)
@@ -233,6 +248,10 @@ struct JsonSplitFormatter::JsonSplitFormatterImpl
     void configure(const QuerySpec& spec) {
         m_select_all = false;
 
+        for (const std::string& arg : spec.format.args)
+            if (arg == "stream")
+                m_opt_stream = true;
+
         switch (spec.attribute_selection.selection) {
         case QuerySpec::AttributeSelection::Default:
         case QuerySpec::AttributeSelection::All:
@@ -280,8 +299,10 @@ struct JsonSplitFormatter::JsonSplitFormatterImpl
             m_columns.push_back(path);
     }
 
-    void write_hierarchy_entry(std::ostream& os, const EntryList& list, const std::vector<Attribute>& path_attrs) {
-        std::vector<Entry> path;
+    void write_hierarchy_entry(util::WriteBuffer& buf, const EntryList& list, const std::vector<Attribute>& path_attrs) {
+        static thread_local std::vector<Entry> path;
+
+        path.clear();
 
         for (const Entry& e : list)
             for (const Node* node = e.node(); node && node->id() != CALI_INV_ID; node = node->parent())
@@ -295,26 +316,53 @@ struct JsonSplitFormatter::JsonSplitFormatterImpl
         cali_id_t id = m_hierarchy.get_id(path);
 
         if (id != CALI_INV_ID)
-            os << id;
+            buf.append_uint(id);
         else
-            os << "null";
+            buf.append("null");
     }
 
-    void write_immediate_entry(std::ostream& os, const EntryList& list, const Attribute& attr) {
+    void write_immediate_entry(util::WriteBuffer& buf, const EntryList& list, const Attribute& attr) {
         cali_attr_type type = attr.type();
         bool quote = !(type == CALI_TYPE_INT || type == CALI_TYPE_UINT || type == CALI_TYPE_DOUBLE);
         
         for (const Entry& e : list)
             if (e.attribute() == attr.id()) {
                 if (quote)
-                    util::write_esc_string(os << "\"", e.value().to_string()) << "\"";
+                    buf.append('"').append_variant(e.value(), true).append('"');
                 else
-                    os << e.value().to_string();
+                    buf.append_variant(e.value());
                 
                 return;
             }
 
-        os << "null";
+        buf.append("null");
+    }
+
+    /// \brief Write the "columns" and "column_metadata" fields
+    std::ostream& write_columns(std::ostream& os) {
+        os << "  \"columns\": [";
+
+        {
+            int count = 0;
+            for (const Column& c : m_columns)
+                util::write_esc_string(os << (count++ > 0 ? ", " : " ") << "\"", c.title) << "\"";
+        }
+        
+        // close "columns", start "column_metadata"
+        os << " ],\n  \"column_metadata\": [";
+        
+        {
+            int count = 0;
+            
+            for (const Column& c : m_columns) 
+                os << (count++ > 0 ? " }, { " : " { ")
+                   << "\"is_value\": " << (c.is_hierarchy ? "false" : "true");
+            
+            if (count > 0)
+                os << " } ";
+        }
+
+        return os << " ]";
     }
     
     void process_record(const CaliperMetadataAccessInterface& db, const EntryList& list) {
@@ -329,28 +377,40 @@ struct JsonSplitFormatter::JsonSplitFormatterImpl
             m_initialized = true;
         }
 
-        std::ostringstream os;
-        os << "[ ";
+        // Per-thread row buffer, re-used across records
+        static thread_local util::WriteBuffer buf;
+
+        buf.clear();
+        buf.append("[ ", 2);
 
         int count = 0;
 
         for (const Column& c : m_columns) {
             if (count++ > 0)
-                os << ", ";
+                buf.append(", ", 2);
 
             if (c.is_hierarchy)
-                write_hierarchy_entry(os, list, c.attributes);
+                write_hierarchy_entry(buf, list, c.attributes);
             else 
-                write_immediate_entry(os, list, c.attributes.front());
+                write_immediate_entry(buf, list, c.attributes.front());
         }
 
-        os << " ]";
+        buf.append(" ]", 2);
 
         {
             std::lock_guard<std::mutex>
                 g(m_os_lock);
 
-            m_os.stream() << (m_row_count++ > 0 ? ",\n    " : "{\n   \"data\": [\n    ") << os.str();
+            std::ostream& os = m_os.stream();
+
+            if (m_row_count++ > 0)
+                os << ",\n    ";
+            else if (m_opt_stream)
+                write_columns(os << "{\n") << ",\n  \"data\": [\n    ";
+            else
+                os << "{\n   \"data\": [\n    ";
+
+            buf.write_to(os);
         }
     }
 
@@ -379,34 +439,24 @@ struct JsonSplitFormatter::JsonSplitFormatterImpl
     }
     
     void write_metadata(CaliperMetadataAccessInterface& db) {
-        // close "data" field, start "columns" 
-        m_os.stream() << (m_row_count > 0 ? "\n  ],\n" : "{\n") << "  \"columns\": [";
+        std::ostream& os = m_os.stream();
 
-        {
-            int count = 0;
-            for (const Column& c : m_columns)
-                util::write_esc_string(m_os.stream() << (count++ > 0 ? ", " : " ") << "\"", c.title) << "\"";
-        }
-        
-        // close "columns", start "column_metadata"
-        m_os.stream() << " ],\n  \"column_metadata\": [";
-        
-        {
-            int count = 0;
-            
-            for (const Column& c : m_columns) 
-                m_os.stream() << (count++ > 0 ? " }, { " : " { ")
-                              << "\"is_value\": " << (c.is_hierarchy ? "false" : "true");
-            
-            if (count > 0)
-                m_os.stream() << " } ";
+        if (m_opt_stream) {
+            // columns were written before the first row
+            if (m_row_count > 0)
+                os << "\n  ],\n  ";
+            else
+                write_columns(os << "{\n") << ",\n  \"data\": [ ],\n  ";
+        } else {
+            // close "data" field, write "columns" and "column_metadata"
+            write_columns(os << (m_row_count > 0 ? "\n  ],\n" : "{\n")) << ",\n  ";
         }
-        
-        // close "column_metadata", write "nodes"
-        m_hierarchy.write_nodes( m_os.stream() << " ],\n  " );
+
+        // write "nodes"
+        m_hierarchy.write_nodes(os);
 
         // write globals and finish
-        write_globals(m_os.stream(), db) << "\n}" << std::endl;
+        write_globals(os, db) << "\n}" << std::endl;
     }
 };
 
@@ -38,8 +38,27 @@
 
 #include "caliper/common/CaliperMetadataAccessInterface.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 using namespace cali;
 
+namespace
+{
+
+/// Number of records per pipeline batch
+const std::size_t BatchSize = 256;
+
+/// Number of aggregation results passed to the formatter at once
+const std::size_t FlushBatchSize = 65536;
+
+}
+
 struct QueryProcessor::QueryProcessorImpl
 {
     Aggregator        aggregator;
@@ -48,8 +67,194 @@ struct QueryProcessor::QueryProcessorImpl
 
     bool              do_aggregate;
 
+    //
+    // --- Pipeline for num_threads > 1:
+    //   process_record() collects records into batches, filter/aggregation
+    //   workers take batches from the input queue, and a single format
+    //   thread formats the filtered batches in their original order.
+    //
+
+    struct Batch {
+        std::size_t                     seq;
+        CaliperMetadataAccessInterface* db;
+        std::vector<EntryList>          records;
+    };
+
+    unsigned                  num_threads;
+    std::size_t               queue_capacity;
+
+    std::mutex                batch_lock;
+    Batch                     batch;         // protected by batch_lock
+
+    std::mutex                queue_lock;
+    std::condition_variable   in_not_empty;
+    std::condition_variable   in_not_full;
+    std::condition_variable   out_ready;
+    std::condition_variable   out_not_full;
+
+    std::deque<Batch>         in_queue;      // protected by queue_lock
+    std::map<std::size_t, Batch> out_queue;  // protected by queue_lock
+    std::size_t               next_seq;      // protected by batch_lock
+    std::size_t               next_out_seq;  // protected by queue_lock
+    bool                      closing;       // protected by queue_lock
+    bool                      workers_done;  // protected by queue_lock
+
+    std::vector<std::thread>  workers;
+    std::thread               format_thread;
+
+    void
+    worker_fn() {
+        while (true) {
+            Batch b;
+
+            {
+                std::unique_lock<std::mutex>
+                    g(queue_lock);
+
+                in_not_empty.wait(g, [this](){ return !in_queue.empty() || closing; });
+
+                if (in_queue.empty())
+                    break;
+
+                b = std::move(in_queue.front());
+                in_queue.pop_front();
+            }
+
+            in_not_full.notify_one();
+
+            b.records.erase(std::remove_if(b.records.begin(), b.records.end(),
+                                           [this,&b](const EntryList& rec) {
+                                               return !filter.pass(*b.db, rec);
+                                           }),
+                            b.records.end());
+
+            if (do_aggregate) {
+                for (const EntryList& rec : b.records)
+                    aggregator.add(*b.db, rec);
+            } else {
+                std::unique_lock<std::mutex>
+                    g(queue_lock);
+
+                // Don't let the format queue grow without bounds while
+                // an earlier batch is still being filtered
+                out_not_full.wait(g, [this,&b](){ return b.seq < next_out_seq + queue_capacity; });
+
+                out_queue.emplace(b.seq, std::move(b));
+                out_ready.notify_one();
+            }
+        }
+    }
+
+    void
+    format_fn() {
+        while (true) {
+            Batch b;
+
+            {
+                std::unique_lock<std::mutex>
+                    g(queue_lock);
+
+                out_ready.wait(g, [this](){
+                        return (!out_queue.empty() && out_queue.begin()->first == next_out_seq)
+                            || (workers_done && out_queue.empty());
+                    });
+
+                if (out_queue.empty())
+                    break;
+
+                b = std::move(out_queue.begin()->second);
+                out_queue.erase(out_queue.begin());
+                ++next_out_seq;
+            }
+
+            out_not_full.notify_all();
+
+            formatter.process_records(*b.db, b.records);
+        }
+    }
+
+    void
+    start_pipeline() {
+        closing      = false;
+        workers_done = false;
+        next_out_seq = 0;
+
+        for (unsigned t = 0; t < num_threads; ++t)
+            workers.emplace_back(&QueryProcessorImpl::worker_fn, this);
+
+        if (!do_aggregate)
+            format_thread = std::thread(&QueryProcessorImpl::format_fn, this);
+    }
+
+    void
+    stop_pipeline() {
+        {
+            std::lock_guard<std::mutex>
+                g(queue_lock);
+            closing = true;
+        }
+
+        in_not_empty.notify_all();
+
+        for (auto &t : workers)
+            t.join();
+
+        workers.clear();
+
+        {
+            std::lock_guard<std::mutex>
+                g(queue_lock);
+            workers_done = true;
+        }
+
+        out_ready.notify_all();
+
+        if (format_thread.joinable())
+            format_thread.join();
+    }
+
+    // Submit the current batch. Must hold batch_lock.
+    void
+    submit_batch() {
+        if (batch.records.empty())
+            return;
+        if (next_seq == 0)
+            start_pipeline();
+
+        batch.seq = next_seq++;
+
+        {
+            std::unique_lock<std::mutex>
+                g(queue_lock);
+
+            in_not_full.wait(g, [this](){ return in_queue.size() < queue_capacity; });
+            in_queue.push_back(std::move(batch));
+        }
+
+        in_not_empty.notify_one();
+
+        batch.records.clear();
+        batch.records.reserve(BatchSize);
+    }
+
     void
     process_record(CaliperMetadataAccessInterface& db, const EntryList& rec) {
+        if (num_threads > 1) {
+            std::lock_guard<std::mutex>
+                g(batch_lock);
+
+            if (batch.db != &db)
+                submit_batch();
+
+            batch.db = &db;
+            batch.records.push_back(rec);
+
+            if (batch.records.size() >= BatchSize)
+                submit_batch();
+
+            return;
+        }
+
         if (filter.pass(db, rec)) {
             if (do_aggregate)
                 aggregator.add(db, rec);
@@ -60,22 +265,64 @@ struct QueryProcessor::QueryProcessorImpl
 
     void
     flush(CaliperMetadataAccessInterface& db) {
-        aggregator.flush(db, formatter);
+        if (num_threads > 1) {
+            std::lock_guard<std::mutex>
+                g(batch_lock);
+
+            submit_batch();
+
+            if (next_seq > 0)
+                stop_pipeline();
+
+            next_seq = 0;
+        }
+
+        // Pass aggregation results on in batches so stream formatters
+        // can format them in parallel
+
+        std::vector<EntryList> results;
+
+        aggregator.flush(db, [this,&results](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+                results.push_back(rec);
+
+                if (results.size() >= FlushBatchSize) {
+                    formatter.process_records(db, results);
+                    results.clear();
+                }
+            });
+
+        if (!results.empty())
+            formatter.process_records(db, results);
+
         formatter.flush(db);
     }
     
-    QueryProcessorImpl(const QuerySpec& spec, OutputStream& stream)
+    QueryProcessorImpl(const QuerySpec& spec, OutputStream& stream, unsigned threads)
         : aggregator(spec),
           filter(spec),
-          formatter(spec, stream)
+          formatter(spec, stream),
+          num_threads(threads),
+          queue_capacity(2 * std::max(threads, 1u)),
+          next_seq(0),
+          next_out_seq(0),
+          closing(false),
+          workers_done(false)
     {
         do_aggregate = (spec.aggregation_ops.selection != QuerySpec::AggregationSelection::None);
+
+        batch.db = nullptr;
+        batch.records.reserve(num_threads > 1 ? BatchSize : 0);
+    }
+
+    ~QueryProcessorImpl() {
+        if (next_seq > 0)
+            stop_pipeline();
     }
 };
 
 
-QueryProcessor::QueryProcessor(const QuerySpec& spec, OutputStream& stream)
-    : mP(new QueryProcessorImpl(spec, stream))
+QueryProcessor::QueryProcessor(const QuerySpec& spec, OutputStream& stream, unsigned num_threads)
+    : mP(new QueryProcessorImpl(spec, stream, num_threads))
 { }
 
 QueryProcessor::~QueryProcessor()
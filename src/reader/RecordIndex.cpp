@@ -0,0 +1,506 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file RecordIndex.cpp
+/// RecordIndex class implementation
+
+#include "caliper/reader/RecordIndex.h"
+
+#include "caliper/reader/CaliperMetadataDB.h"
+#include "caliper/reader/QuerySpec.h"
+
+#include "caliper/common/Entry.h"
+#include "caliper/common/Node.h"
+#include "caliper/common/Variant.h"
+
+#include "caliper/common/csv/CsvReader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <unordered_set>
+
+using namespace cali;
+
+namespace
+{
+
+const int         IndexVersion = 1;
+
+/// Number of 64-bit words in each block's Bloom filter
+const std::size_t BloomWords   = 16;
+const std::size_t BloomBits    = BloomWords * 64;
+const int         BloomHashes  = 3;
+
+uint64_t
+hash_string_value(unsigned attr, const std::string& str)
+{
+    // FNV-1a; must be stable across builds since it is stored in index files
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (int i = 0; i < 4; ++i) {
+        h ^= (attr >> (8*i)) & 0xFF;
+        h *= 0x100000001b3ULL;
+    }
+    for (unsigned char c : str) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+bool
+is_numeric(cali_attr_type type)
+{
+    return type == CALI_TYPE_INT || type == CALI_TYPE_UINT || type == CALI_TYPE_DOUBLE;
+}
+
+std::vector<std::string>
+split(const std::string& str, char sep, std::size_t max_fields = std::string::npos)
+{
+    std::vector<std::string> ret;
+    std::size_t pos = 0;
+
+    while (ret.size() + 1 < max_fields) {
+        std::size_t p = str.find(sep, pos);
+
+        if (p == std::string::npos)
+            break;
+
+        ret.push_back(str.substr(pos, p - pos));
+        pos = p + 1;
+    }
+
+    ret.push_back(str.substr(pos));
+
+    return ret;
+}
+
+} // namespace [anonymous]
+
+
+struct RecordIndex::RecordIndexImpl
+{
+    struct AttributeInfo {
+        std::string    name;
+        cali_attr_type type;
+    };
+
+    struct ValueRange {
+        bool   numeric; ///< min/max are valid
+        double min;
+        double max;
+    };
+
+    struct BlockInfo {
+        Block                          block;
+        std::size_t                    num_records;
+        std::map<unsigned, ValueRange> attributes;
+        std::vector<uint64_t>          bloom;
+
+        void add_string(unsigned attr, const std::string& str) {
+            if (bloom.empty())
+                bloom.assign(BloomWords, 0);
+
+            uint64_t h  = hash_string_value(attr, str);
+            uint64_t h2 = (h >> 32) | 1;
+
+            for (int i = 0; i < BloomHashes; ++i) {
+                std::size_t bit = (h + i * h2) % BloomBits;
+                bloom[bit / 64] |= (uint64_t(1) << (bit % 64));
+            }
+        }
+
+        bool may_contain_string(unsigned attr, const std::string& str) const {
+            if (bloom.empty())
+                return false;
+
+            uint64_t h  = hash_string_value(attr, str);
+            uint64_t h2 = (h >> 32) | 1;
+
+            for (int i = 0; i < BloomHashes; ++i) {
+                std::size_t bit = (h + i * h2) % BloomBits;
+
+                if (!(bloom[bit / 64] & (uint64_t(1) << (bit % 64))))
+                    return false;
+            }
+
+            return true;
+        }
+    };
+
+    std::size_t                     file_size;
+    std::vector<AttributeInfo>      attributes;
+    std::map<std::string, unsigned> attribute_index;
+    std::vector<BlockInfo>          blocks;
+
+    unsigned find_or_add_attribute(const std::string& name, cali_attr_type type) {
+        auto it = attribute_index.find(name);
+
+        if (it != attribute_index.end())
+            return it->second;
+
+        unsigned idx = static_cast<unsigned>(attributes.size());
+
+        attributes.push_back(AttributeInfo { name, type });
+        attribute_index.emplace(name, idx);
+
+        return idx;
+    }
+
+    void add_value(BlockInfo& info, unsigned idx, const Variant& val) {
+        cali_attr_type type = attributes[idx].type;
+        auto it = info.attributes.find(idx);
+
+        if (is_numeric(type)) {
+            bool   ok = is_numeric(val.type());
+            double d  = ok ? val.to_double() : 0.0;
+
+            if (it == info.attributes.end())
+                info.attributes.emplace(idx, ValueRange { ok, d, d });
+            else if (!ok)
+                it->second.numeric = false;
+            else {
+                it->second.min = std::min(it->second.min, d);
+                it->second.max = std::max(it->second.max, d);
+            }
+        } else {
+            if (it == info.attributes.end())
+                info.attributes.emplace(idx, ValueRange { false, 0.0, 0.0 });
+            if (type == CALI_TYPE_STRING)
+                info.add_string(idx, val.to_string());
+        }
+    }
+
+    bool build(const std::string& filename, std::size_t block_size) {
+        std::vector<std::size_t> bounds;
+
+        if (!CsvReader(filename).record_blocks(block_size, bounds))
+            return false;
+
+        file_size = bounds.empty() ? 0 : bounds.back();
+        attributes.clear();
+        attribute_index.clear();
+        blocks.clear();
+
+        CaliperMetadataDB db;
+        IdMap             idmap;
+
+        std::map<cali_id_t, unsigned> attr_id_index;
+        std::vector<Entry>            globals;
+
+        for (std::size_t b = 0; b + 1 < bounds.size(); ++b) {
+            BlockInfo info { Block { bounds[b], bounds[b+1], false }, 0, { }, { } };
+            std::unordered_set<cali_id_t> visited;
+
+            auto attr_idx = [&](cali_id_t id) {
+                auto it = attr_id_index.find(id);
+
+                if (it != attr_id_index.end())
+                    return it->second;
+
+                Attribute attr = db.get_attribute(id);
+                unsigned  idx  = find_or_add_attribute(attr.name(), attr.type());
+
+                attr_id_index.emplace(id, idx);
+
+                return idx;
+            };
+
+            auto node_fn = [&](CaliperMetadataAccessInterface&, const Node*) {
+                info.block.has_metadata = true;
+            };
+            auto snap_fn = [&](CaliperMetadataAccessInterface&, const EntryList& rec) {
+                ++info.num_records;
+
+                for (const Entry& e : rec) {
+                    if (e.is_reference()) {
+                        // nodes above a visited node have been visited, too
+                        for (const Node* node = e.node(); node && node->id() != CALI_INV_ID; node = node->parent()) {
+                            if (!visited.insert(node->id()).second)
+                                break;
+
+                            add_value(info, attr_idx(node->attribute()), node->data());
+                        }
+                    } else if (e.is_immediate()) {
+                        add_value(info, attr_idx(e.attribute()), e.value());
+                    }
+                }
+            };
+
+            if (!db.read_range(filename, bounds[b], bounds[b+1], idmap, node_fn, snap_fn))
+                return false;
+
+            std::vector<Entry> new_globals = db.get_globals();
+
+            if (new_globals != globals) {
+                info.block.has_metadata = true;
+                globals = std::move(new_globals);
+            }
+
+            blocks.push_back(std::move(info));
+        }
+
+        return true;
+    }
+
+    std::ostream& write(std::ostream& os) const {
+        os << "cali-index," << IndexVersion << ',' << file_size << '\n';
+
+        for (std::size_t i = 0; i < attributes.size(); ++i)
+            os << "attr," << i << ','
+               << cali_type2string(attributes[i].type) << ','
+               << attributes[i].name << '\n';
+
+        std::ostringstream values;
+        values << std::setprecision(17);
+
+        for (const BlockInfo& info : blocks) {
+            os << "block,"
+               << info.block.begin << ','
+               << info.block.end   << ','
+               << (info.block.has_metadata ? 1 : 0) << ','
+               << info.num_records << ',';
+
+            values.str("");
+            int count = 0;
+
+            for (const auto& p : info.attributes) {
+                if (count++ > 0)
+                    values << ';';
+
+                values << p.first;
+
+                if (p.second.numeric)
+                    values << ':' << p.second.min << ':' << p.second.max;
+            }
+
+            os << values.str() << ',';
+
+            for (uint64_t w : info.bloom)
+                os << std::hex << std::setw(16) << std::setfill('0') << w;
+
+            os << std::dec << std::setfill(' ') << '\n';
+        }
+
+        return os;
+    }
+
+    bool read(std::istream& is) {
+        std::string line;
+
+        if (!std::getline(is, line))
+            return false;
+
+        std::vector<std::string> header = split(line, ',');
+
+        if (header.size() != 3 || header[0] != "cali-index" || std::atoi(header[1].c_str()) != IndexVersion)
+            return false;
+
+        file_size = std::strtoull(header[2].c_str(), nullptr, 10);
+        attributes.clear();
+        attribute_index.clear();
+        blocks.clear();
+
+        while (std::getline(is, line)) {
+            if (line.compare(0, 5, "attr,") == 0) {
+                std::vector<std::string> f = split(line, ',', 4);
+
+                if (f.size() != 4 || std::strtoul(f[1].c_str(), nullptr, 10) != attributes.size())
+                    return false;
+
+                find_or_add_attribute(f[3], cali_string2type(f[2].c_str()));
+            } else if (line.compare(0, 6, "block,") == 0) {
+                std::vector<std::string> f = split(line, ',');
+
+                if (f.size() != 7)
+                    return false;
+
+                BlockInfo info {
+                    Block {
+                        std::strtoull(f[1].c_str(), nullptr, 10),
+                        std::strtoull(f[2].c_str(), nullptr, 10),
+                        f[3] == "1"
+                    },
+                    std::strtoull(f[4].c_str(), nullptr, 10), { }, { }
+                };
+
+                if (!f[5].empty())
+                    for (const std::string& a : split(f[5], ';')) {
+                        std::vector<std::string> r = split(a, ':');
+                        unsigned idx = std::strtoul(r[0].c_str(), nullptr, 10);
+
+                        if (idx >= attributes.size())
+                            return false;
+
+                        if (r.size() == 3)
+                            info.attributes.emplace(idx, ValueRange { true, std::strtod(r[1].c_str(), nullptr), std::strtod(r[2].c_str(), nullptr) });
+                        else
+                            info.attributes.emplace(idx, ValueRange { false, 0.0, 0.0 });
+                    }
+
+                if (f[6].size() == BloomWords * 16)
+                    for (std::size_t w = 0; w < BloomWords; ++w)
+                        info.bloom.push_back(std::strtoull(f[6].substr(w * 16, 16).c_str(), nullptr, 16));
+                else if (!f[6].empty())
+                    return false;
+
+                blocks.push_back(std::move(info));
+            } else if (!line.empty()) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool may_match(const BlockInfo& info, const QuerySpec::Condition& cond) const {
+        if (cond.op != QuerySpec::Condition::Op::Exist && cond.op != QuerySpec::Condition::Op::Equal)
+            return true;
+
+        auto ait = attribute_index.find(cond.attr_name);
+
+        if (ait == attribute_index.end())
+            return false;
+
+        auto bit = info.attributes.find(ait->second);
+
+        if (bit == info.attributes.end())
+            return false;
+        if (cond.op == QuerySpec::Condition::Op::Exist)
+            return true;
+
+        cali_attr_type type = attributes[ait->second].type;
+
+        if (bit->second.numeric) {
+            bool    ok  = false;
+            Variant val = Variant::from_string(type, cond.value.c_str(), &ok);
+
+            if (!ok || !is_numeric(val.type()))
+                return true;
+
+            double d = val.to_double();
+
+            return d >= bit->second.min && d <= bit->second.max;
+        } else if (type == CALI_TYPE_STRING) {
+            return info.may_contain_string(ait->second, cond.value);
+        }
+
+        return true;
+    }
+
+    std::vector<Block> select_blocks(const QuerySpec& spec) const {
+        std::vector<Block> ret;
+
+        for (const BlockInfo& info : blocks) {
+            bool select = true;
+
+            if (!info.block.has_metadata && spec.filter.selection == QuerySpec::FilterSelection::List)
+                for (const QuerySpec::Condition& cond : spec.filter.list)
+                    if (!may_match(info, cond)) {
+                        select = false;
+                        break;
+                    }
+
+            if (select)
+                ret.push_back(info.block);
+        }
+
+        return ret;
+    }
+
+    RecordIndexImpl()
+        : file_size(0)
+        { }
+};
+
+
+RecordIndex::RecordIndex()
+    : mP { new RecordIndexImpl }
+{ }
+
+RecordIndex::~RecordIndex()
+{ }
+
+bool
+RecordIndex::build(const std::string& filename, std::size_t block_size)
+{
+    return mP->build(filename, block_size);
+}
+
+std::ostream&
+RecordIndex::write(std::ostream& os) const
+{
+    return mP->write(os);
+}
+
+bool
+RecordIndex::read(std::istream& is)
+{
+    return mP->read(is);
+}
+
+std::size_t
+RecordIndex::file_size() const
+{
+    return mP->file_size;
+}
+
+std::vector<RecordIndex::Block>
+RecordIndex::blocks() const
+{
+    std::vector<Block> ret;
+
+    ret.reserve(mP->blocks.size());
+
+    for (const auto& info : mP->blocks)
+        ret.push_back(info.block);
+
+    return ret;
+}
+
+std::vector<RecordIndex::Block>
+RecordIndex::select_blocks(const QuerySpec& spec) const
+{
+    return mP->select_blocks(spec);
+}
+
+std::string
+RecordIndex::index_filename(const std::string& filename)
+{
+    return filename + ".idx";
+}
@@ -41,9 +41,10 @@
 
 #include "caliper/common/util/split.hpp"
 
+#include <atomic>
 #include <iostream>
 #include <iterator>
-#include <mutex>
+#include <unordered_map>
 
 using namespace cali;
 
@@ -116,13 +117,30 @@ using namespace cali;
 
 struct RecordSelector::RecordSelectorImpl
 {
-    std::vector<QuerySpec::Condition> m_filters;    
+    std::vector<QuerySpec::Condition> m_filters;
+    uint64_t                          m_id;
 
+    /// \brief A filter clause compiled against a metadata DB.
+    ///   The attribute ID and the converted value are resolved when the
+    ///   attribute first appears. Per-node results of "the path to this
+    ///   node contains a match" are memoized in \a node_memo.
     struct Clause {
         QuerySpec::Condition::Op op;
-        Attribute attr;
+        const QuerySpec::Condition* filter;
+        bool      resolved;
+        cali_id_t attr_id;
         Variant   value;
-    };    
+
+        std::unordered_map<cali_id_t, bool> node_memo;
+    };
+
+    /// \brief Per-thread filter plan.
+    ///   Records can be processed by several threads concurrently, so
+    ///   each thread compiles and memoizes its own plan.
+    struct Plan {
+        const CaliperMetadataAccessInterface* db = nullptr;
+        std::vector<Clause>                   clauses;
+    };
 
     void configure(const QuerySpec& spec) {
         m_filters.clear();
@@ -131,83 +149,130 @@ struct RecordSelector::RecordSelectorImpl
             m_filters = spec.filter.list;
     }
 
-    Clause make_clause(const CaliperMetadataAccessInterface& db, const QuerySpec::Condition& f) {
-        Clause clause { f.op, Attribute::invalid, Variant() };
+    Plan& get_plan(const CaliperMetadataAccessInterface& db) {
+        static thread_local std::unordered_map<uint64_t, Plan> t_plans;
 
-        clause.attr = db.get_attribute(f.attr_name);
+        Plan& plan = t_plans[m_id];
 
-        if (clause.attr != Attribute::invalid)
-            clause.value = Variant::from_string(clause.attr.type(), f.value.c_str(), nullptr);
-        
-        return clause;
+        if (plan.db != &db || plan.clauses.size() != m_filters.size()) {
+            plan.db = &db;
+            plan.clauses.clear();
+
+            for (const QuerySpec::Condition& f : m_filters)
+                plan.clauses.push_back(Clause { f.op, &f, false, CALI_INV_ID, Variant(), { } });
+        }
+
+        return plan;
+    }
+
+    void resolve(const CaliperMetadataAccessInterface& db, Clause& clause) {
+        Attribute attr = db.get_attribute(clause.filter->attr_name);
+
+        if (attr == Attribute::invalid)
+            return;
+
+        clause.attr_id  = attr.id();
+        clause.value    = Variant::from_string(attr.type(), clause.filter->value.c_str(), nullptr);
+        clause.resolved = true;
     }
 
-    template<class Op>
-    bool have_match(const Entry& entry, Op match) {
+    bool node_match(const Clause& clause, const Node* node) {
+        return node->attribute() == clause.attr_id &&
+            (clause.op == QuerySpec::Condition::Op::Exist ||
+             clause.op == QuerySpec::Condition::Op::NotExist ||
+             node->data() == clause.value);
+    }
+
+    bool path_match(Clause& clause, const Node* node) {
+        auto &memo = clause.node_memo;
+
+        // Walk up to the first node with a known result, then
+        // memoize the result for all nodes on the way
+
+        const Node* n = node;
+        bool result   = false;
+
+        for ( ; n && n->id() != CALI_INV_ID; n = n->parent()) {
+            auto it = memo.find(n->id());
+
+            if (it != memo.end()) {
+                result = it->second;
+                break;
+            }
+            if (node_match(clause, n)) {
+                result = true;
+                break;
+            }
+        }
+
+        // Nodes below a match all match; nodes below a non-match that don't
+        // match themselves (we checked) don't match either
+        for (const Node* m = node; m != n; m = m->parent())
+            memo.emplace(m->id(), result);
+
+        if (n && n->id() != CALI_INV_ID)
+            memo.emplace(n->id(), result);
+
+        return result;
+    }
+
+    bool have_match(Clause& clause, const Entry& entry) {
         const Node* node = entry.node();
 
-        if (node) {
-            for ( ; node && node->id() != CALI_INV_ID; node = node->parent())
-                if (match(node->attribute(), node->data()))
-                    return true;
-        } else if  (match(entry.attribute(), entry.value()))
-            return true;
+        if (node)
+            return path_match(clause, node);
 
-        return false;        
+        return entry.attribute() == clause.attr_id &&
+            (clause.op == QuerySpec::Condition::Op::Exist ||
+             clause.op == QuerySpec::Condition::Op::NotExist ||
+             entry.value() == clause.value);
     }
 
     bool pass(const CaliperMetadataAccessInterface& db, const EntryList& list) {
-        for (auto &f : m_filters) {
-            Clause clause = make_clause(db, f);
+        if (m_filters.empty())
+            return true;
+
+        Plan& plan = get_plan(db);
+
+        for (Clause& clause : plan.clauses) {
+            if (!clause.resolved)
+                resolve(db, clause);
+
+            bool m = false;
+
+            //   An unresolved attribute can't match any entry; an attribute
+            // that appears later can't be on the path of a node we've
+            // already memoized either, so memoized results stay valid.
+            if (clause.resolved)
+                for (const Entry& e : list)
+                    if (have_match(clause, e)) {
+                        m = true;
+                        break;
+                    }
 
             switch (clause.op) {
             case QuerySpec::Condition::Op::Exist:
-                {
-                    bool m = false;
-                    
-                    for (const Entry& e : list)
-                        if (have_match(e, [&clause](cali_id_t attr_id, const Variant&){
-                                    return attr_id == clause.attr.id();
-                                }))
-                            m = true;
-
-                    if (!m)
-                        return false;
-                }
-                break;
-            case QuerySpec::Condition::Op::NotExist:
-                for (const Entry& e : list)
-                    if (have_match(e, [&clause](cali_id_t attr_id, const Variant&){
-                                return attr_id == clause.attr.id();
-                            }))
-                        return false;
-                break;                
             case QuerySpec::Condition::Op::Equal:
-                {
-                    bool m = false;
-                    
-                    for (const Entry& e : list)
-                        if (have_match(e, [&clause](cali_id_t attr_id, const Variant& val){
-                                    return attr_id == clause.attr.id() && val == clause.value;
-                                }))
-                            m = true;
-
-                    if (!m)
-                        return false;
-                }
+                if (!m)
+                    return false;
                 break;
+            case QuerySpec::Condition::Op::NotExist:
             case QuerySpec::Condition::Op::NotEqual:
-                for (const Entry& e : list)
-                    if (have_match(e, [&clause](cali_id_t attr_id, const Variant& val){
-                                return attr_id == clause.attr.id() && val == clause.value;
-                            }))
-                        return false;
+                if (m)
+                    return false;
+                break;
+            default:
                 break;
             }   
         }
 
         return true;
     }
+
+    RecordSelectorImpl() {
+        static std::atomic<uint64_t> s_next_id(0);
+        m_id = s_next_id++;
+    }
 }; // RecordSelectorImpl
 
 
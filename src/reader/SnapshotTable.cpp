@@ -0,0 +1,767 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file SnapshotTable.cpp
+/// \brief SnapshotTable implementation
+
+#include "caliper/reader/SnapshotTable.h"
+
+#include "caliper/common/CaliperMetadataAccessInterface.h"
+#include "caliper/common/Node.h"
+
+#include <algorithm>
+#include <mutex>
+
+using namespace cali;
+
+namespace
+{
+
+SnapshotTable::Storage
+storage_for_type(cali_attr_type type)
+{
+    switch (type) {
+    case CALI_TYPE_INT:
+        return SnapshotTable::Storage::Int;
+    case CALI_TYPE_UINT:
+    case CALI_TYPE_ADDR:
+    case CALI_TYPE_BOOL:
+        return SnapshotTable::Storage::UInt;
+    case CALI_TYPE_DOUBLE:
+        return SnapshotTable::Storage::Double;
+    default:
+        return SnapshotTable::Storage::String;
+    }
+}
+
+/// \brief Does the "/"-separated path \a path contain the element \a val?
+bool
+path_contains(const std::string& path, const std::string& val)
+{
+    std::string::size_type pos = 0;
+
+    while (pos <= path.size()) {
+        std::string::size_type end = path.find('/', pos);
+
+        if (end == std::string::npos)
+            end = path.size();
+        if (path.compare(pos, end-pos, val) == 0)
+            return true;
+
+        pos = end + 1;
+    }
+
+    return false;
+}
+
+template<typename T>
+bool
+compare_op(QuerySpec::Condition::Op op, const T& lhs, const T& rhs)
+{
+    switch (op) {
+    case QuerySpec::Condition::Op::Equal:
+        return lhs == rhs;
+    case QuerySpec::Condition::Op::NotEqual:
+        return !(lhs == rhs);
+    case QuerySpec::Condition::Op::LessThan:
+        return lhs < rhs;
+    case QuerySpec::Condition::Op::GreaterThan:
+        return rhs < lhs;
+    case QuerySpec::Condition::Op::LessOrEqual:
+        return !(rhs < lhs);
+    case QuerySpec::Condition::Op::GreaterOrEqual:
+        return !(lhs < rhs);
+    default:
+        return false;
+    }
+}
+
+template<typename T>
+void
+filter_numeric(const SnapshotTable::Column& col, const std::vector<T>& vec, QuerySpec::Condition::Op op, T val, std::vector<std::size_t>& rows)
+{
+    // rows without a value only pass NotEqual, like in RecordSelector
+    bool pass_invalid = (op == QuerySpec::Condition::Op::NotEqual);
+    std::size_t n = 0;
+
+    for (std::size_t r : rows)
+        if (col.valid[r] ? compare_op(op, vec[r], val) : pass_invalid)
+            rows[n++] = r;
+
+    rows.resize(n);
+}
+
+} // namespace [anonymous]
+
+
+//
+// --- SnapshotTable::Column
+//
+
+Variant
+SnapshotTable::Column::value(std::size_t row) const
+{
+    if (row >= valid.size() || !valid[row])
+        return Variant();
+
+    switch (storage) {
+    case Storage::Int:
+        return Variant(static_cast<int>(ints[row]));
+    case Storage::UInt:
+        if (type == CALI_TYPE_BOOL)
+            return Variant(uints[row] != 0);
+        return Variant(type, &uints[row], sizeof(uint64_t));
+    case Storage::Double:
+        return Variant(doubles[row]);
+    case Storage::String:
+        {
+            const std::string& str = dict[codes[row]];
+            return Variant(CALI_TYPE_STRING, str.data(), str.size());
+        }
+    }
+
+    return Variant();
+}
+
+uint32_t
+SnapshotTable::Column::encode(const std::string& str)
+{
+    auto it = dict_index.find(str);
+
+    if (it != dict_index.end())
+        return it->second;
+
+    uint32_t code = static_cast<uint32_t>(dict.size());
+
+    dict.push_back(str);
+    dict_index.insert(std::make_pair(str, code));
+
+    return code;
+}
+
+
+//
+// --- SnapshotTableImpl
+//
+
+struct SnapshotTable::SnapshotTableImpl
+{
+    std::vector<Column>                   columns;
+    std::unordered_map<cali_id_t, size_t> attr_to_column;
+    std::size_t                           num_rows;
+
+    // scratch space for add()
+    std::vector<unsigned char>            row_set;
+    std::vector<std::string>              row_str;
+
+    std::mutex                            lock;
+
+    SnapshotTableImpl()
+        : num_rows(0)
+        { }
+
+    size_t make_column(const std::string& name, cali_id_t attr_id, cali_attr_type type) {
+        Column col;
+
+        col.name    = name;
+        col.attr_id = attr_id;
+        col.type    = type;
+        col.storage = ::storage_for_type(type);
+
+        // back-fill rows that were added before the column existed
+        col.valid.assign(num_rows, 0);
+
+        switch (col.storage) {
+        case Storage::Int:
+            col.ints.assign(num_rows, 0);
+            break;
+        case Storage::UInt:
+            col.uints.assign(num_rows, 0);
+            break;
+        case Storage::Double:
+            col.doubles.assign(num_rows, 0.0);
+            break;
+        case Storage::String:
+            col.codes.assign(num_rows, 0);
+            break;
+        }
+
+        size_t c = columns.size();
+
+        columns.push_back(std::move(col));
+        row_set.push_back(0);
+        row_str.emplace_back();
+
+        if (attr_id != CALI_INV_ID)
+            attr_to_column[attr_id] = c;
+
+        return c;
+    }
+
+    size_t get_column(CaliperMetadataAccessInterface& db, cali_id_t attr_id) {
+        auto it = attr_to_column.find(attr_id);
+
+        if (it != attr_to_column.end())
+            return it->second;
+
+        Attribute attr = db.get_attribute(attr_id);
+
+        return make_column(attr.name(), attr_id, attr.type());
+    }
+
+    void append_row() {
+        for (Column& col : columns) {
+            col.valid.push_back(0);
+
+            switch (col.storage) {
+            case Storage::Int:
+                col.ints.push_back(0);
+                break;
+            case Storage::UInt:
+                col.uints.push_back(0);
+                break;
+            case Storage::Double:
+                col.doubles.push_back(0.0);
+                break;
+            case Storage::String:
+                col.codes.push_back(0);
+                break;
+            }
+        }
+
+        ++num_rows;
+    }
+
+    /// \brief Set value in the last row. Nested string values are
+    ///   prepended to form a path, as we walk from leaf to root.
+    void set_value(size_t c, const Variant& val) {
+        Column& col = columns[c];
+        size_t  row = num_rows - 1;
+
+        if (col.storage == Storage::String) {
+            if (row_set[c])
+                row_str[c] = val.to_string().append("/").append(row_str[c]);
+            else
+                row_str[c] = val.to_string();
+
+            row_set[c] = 1;
+            return;
+        }
+
+        // numeric values: keep the innermost one. Skip empty values
+        //   (e.g. meta-attribute nodes without data) instead of storing 0.
+        if (col.valid[row] || val.empty())
+            return;
+
+        col.valid[row] = 1;
+
+        switch (col.storage) {
+        case Storage::Int:
+            col.ints[row]    = val.to_int();
+            break;
+        case Storage::UInt:
+            col.uints[row]   = val.to_uint();
+            break;
+        case Storage::Double:
+            col.doubles[row] = val.to_double();
+            break;
+        default:
+            break;
+        }
+    }
+
+    void add(CaliperMetadataAccessInterface& db, const EntryList& list) {
+        std::lock_guard<std::mutex>
+            g(lock);
+
+        append_row();
+
+        for (const Entry& e : list) {
+            if (e.node()) {
+                for (const Node* node = e.node(); node && node->attribute() != CALI_INV_ID; node = node->parent()) {
+                    size_t c = get_column(db, node->attribute());
+
+                    columns[c].is_path = true;
+                    set_value(c, node->data());
+                }
+            } else if (e.attribute() != CALI_INV_ID) {
+                set_value(get_column(db, e.attribute()), e.value());
+            }
+        }
+
+        // encode collected string values
+
+        for (size_t c = 0; c < columns.size(); ++c)
+            if (row_set[c]) {
+                Column& col = columns[c];
+
+                col.valid.back() = 1;
+                col.codes.back() = col.encode(row_str[c]);
+
+                row_set[c] = 0;
+                row_str[c].clear();
+            }
+    }
+
+    const Column* find_column(const std::string& name) const {
+        for (const Column& col : columns)
+            if (col.name == name)
+                return &col;
+
+        return nullptr;
+    }
+
+    void select(const QuerySpec::Condition& cond, std::vector<size_t>& rows) const {
+        typedef QuerySpec::Condition::Op Op;
+
+        const Column* col = find_column(cond.attr_name);
+
+        if (!col) {
+            // missing attribute: only negative conditions pass
+            if (cond.op != Op::NotExist && cond.op != Op::NotEqual)
+                rows.clear();
+            return;
+        }
+
+        if (cond.op == Op::Exist || cond.op == Op::NotExist) {
+            unsigned char want = (cond.op == Op::Exist ? 1 : 0);
+            size_t n = 0;
+
+            for (size_t r : rows)
+                if (col->valid[r] == want)
+                    rows[n++] = r;
+
+            rows.resize(n);
+            return;
+        }
+
+        switch (col->storage) {
+        case Storage::Int:
+            ::filter_numeric<int64_t>(*col, col->ints, cond.op,
+                                      Variant::from_string(CALI_TYPE_INT, cond.value.c_str(), nullptr).to_int(),
+                                      rows);
+            break;
+        case Storage::UInt:
+            ::filter_numeric<uint64_t>(*col, col->uints, cond.op,
+                                       Variant::from_string(col->type, cond.value.c_str(), nullptr).to_uint(),
+                                       rows);
+            break;
+        case Storage::Double:
+            ::filter_numeric<double>(*col, col->doubles, cond.op,
+                                     Variant::from_string(CALI_TYPE_DOUBLE, cond.value.c_str(), nullptr).to_double(),
+                                     rows);
+            break;
+        case Storage::String:
+            {
+                // evaluate the condition once per dictionary entry,
+                // then filter rows by code
+                std::vector<unsigned char> hit(col->dict.size());
+
+                for (size_t i = 0; i < col->dict.size(); ++i) {
+                    if (cond.op == Op::Equal || cond.op == Op::NotEqual)
+                        hit[i] = ((col->is_path ? ::path_contains(col->dict[i], cond.value) : col->dict[i] == cond.value)
+                                  == (cond.op == Op::Equal));
+                    else
+                        hit[i] = ::compare_op(cond.op, col->dict[i], cond.value);
+                }
+
+                bool   pass_invalid = (cond.op == Op::NotEqual);
+                size_t n = 0;
+
+                for (size_t r : rows)
+                    if (col->valid[r] ? hit[col->codes[r]] : pass_invalid)
+                        rows[n++] = r;
+
+                rows.resize(n);
+            }
+            break;
+        }
+    }
+
+    /// \brief Compare rows \a a and \a b in column \a col.
+    ///   Returns <0, 0, >0. \a rank maps string dictionary codes to sort order.
+    int compare_rows(const Column& col, const std::vector<uint32_t>& rank, size_t a, size_t b) const {
+        if (!col.valid[a] || !col.valid[b])
+            return static_cast<int>(col.valid[a]) - static_cast<int>(col.valid[b]);
+
+        switch (col.storage) {
+        case Storage::Int:
+            return (col.ints[a] < col.ints[b] ? -1 : (col.ints[b] < col.ints[a] ? 1 : 0));
+        case Storage::UInt:
+            return (col.uints[a] < col.uints[b] ? -1 : (col.uints[b] < col.uints[a] ? 1 : 0));
+        case Storage::Double:
+            return (col.doubles[a] < col.doubles[b] ? -1 : (col.doubles[b] < col.doubles[a] ? 1 : 0));
+        case Storage::String:
+            {
+                uint32_t ra = rank[col.codes[a]];
+                uint32_t rb = rank[col.codes[b]];
+                return (ra < rb ? -1 : (rb < ra ? 1 : 0));
+            }
+        }
+
+        return 0;
+    }
+
+    void sort(const std::vector<QuerySpec::SortSpec>& spec, std::vector<size_t>& rows) const {
+        struct SortKey {
+            const Column*         col;
+            bool                  descending;
+            std::vector<uint32_t> rank;
+        };
+
+        std::vector<SortKey> keys;
+
+        for (const QuerySpec::SortSpec& s : spec) {
+            const Column* col = find_column(s.attribute);
+
+            if (!col || s.order == QuerySpec::SortSpec::Order::None)
+                continue;
+
+            SortKey key { col, s.order == QuerySpec::SortSpec::Order::Descending, { } };
+
+            // rank dictionary entries once so that comparisons are integer compares
+            if (col->storage == Storage::String) {
+                std::vector<uint32_t> order(col->dict.size());
+
+                for (size_t i = 0; i < order.size(); ++i)
+                    order[i] = static_cast<uint32_t>(i);
+
+                std::sort(order.begin(), order.end(), [col](uint32_t a, uint32_t b){
+                        return col->dict[a] < col->dict[b];
+                    });
+
+                key.rank.resize(order.size());
+
+                for (size_t i = 0; i < order.size(); ++i)
+                    key.rank[order[i]] = static_cast<uint32_t>(i);
+            }
+
+            keys.push_back(std::move(key));
+        }
+
+        if (keys.empty())
+            return;
+
+        std::stable_sort(rows.begin(), rows.end(), [this,&keys](size_t a, size_t b){
+                for (const SortKey& k : keys) {
+                    int c = compare_rows(*k.col, k.rank, a, b);
+
+                    if (c != 0)
+                        return k.descending ? c > 0 : c < 0;
+                }
+
+                return false;
+            });
+    }
+}; // SnapshotTableImpl
+
+
+//
+// --- SnapshotTable public interface
+//
+
+SnapshotTable::SnapshotTable()
+    : mP { new SnapshotTableImpl }
+{ }
+
+SnapshotTable::~SnapshotTable()
+{
+    mP.reset();
+}
+
+void
+SnapshotTable::add(CaliperMetadataAccessInterface& db, const EntryList& list)
+{
+    mP->add(db, list);
+}
+
+std::size_t
+SnapshotTable::num_rows() const
+{
+    return mP->num_rows;
+}
+
+std::size_t
+SnapshotTable::num_columns() const
+{
+    return mP->columns.size();
+}
+
+const SnapshotTable::Column&
+SnapshotTable::column(std::size_t c) const
+{
+    return mP->columns[c];
+}
+
+const SnapshotTable::Column*
+SnapshotTable::column(const std::string& name) const
+{
+    return mP->find_column(name);
+}
+
+std::vector<std::size_t>
+SnapshotTable::all_rows() const
+{
+    std::vector<std::size_t> rows(mP->num_rows);
+
+    for (std::size_t r = 0; r < rows.size(); ++r)
+        rows[r] = r;
+
+    return rows;
+}
+
+std::vector<std::size_t>
+SnapshotTable::select(const std::vector<QuerySpec::Condition>& conditions, const std::vector<std::size_t>& rows) const
+{
+    std::vector<std::size_t> ret(rows);
+
+    for (const QuerySpec::Condition& cond : conditions) {
+        if (ret.empty())
+            break;
+
+        mP->select(cond, ret);
+    }
+
+    return ret;
+}
+
+void
+SnapshotTable::sort(const std::vector<QuerySpec::SortSpec>& spec, std::vector<std::size_t>& rows) const
+{
+    mP->sort(spec, rows);
+}
+
+SnapshotTable
+SnapshotTable::aggregate(CaliperMetadataAccessInterface& db,
+                         const std::vector<std::string>& key,
+                         const std::vector<std::string>& sum,
+                         const std::vector<std::size_t>& rows) const
+{
+    std::vector<const Column*> key_cols;
+    std::vector<const Column*> sum_cols;
+
+    for (const std::string& s : key) {
+        const Column* col = mP->find_column(s);
+
+        if (col)
+            key_cols.push_back(col);
+    }
+    for (const std::string& s : sum) {
+        const Column* col = mP->find_column(s);
+
+        if (col && col->storage != Storage::String)
+            sum_cols.push_back(col);
+    }
+
+    // --- Assign group ids. The group key is the raw column values,
+    //   with an invalid marker for rows without a value.
+
+    const uint64_t invalid = ~static_cast<uint64_t>(0);
+
+    std::unordered_map<std::string, size_t> group_index;
+    std::vector<size_t>                     group_first_row;
+    std::vector<size_t>                     group_of(rows.size());
+
+    std::string             keybuf;
+    std::vector<uint64_t>   keyvals(key_cols.size());
+
+    for (size_t i = 0; i < rows.size(); ++i) {
+        size_t r = rows[i];
+
+        for (size_t k = 0; k < key_cols.size(); ++k) {
+            const Column* col = key_cols[k];
+            uint64_t v = invalid;
+
+            if (col->valid[r]) {
+                switch (col->storage) {
+                case Storage::Int:
+                    v = static_cast<uint64_t>(col->ints[r]);
+                    break;
+                case Storage::UInt:
+                    v = col->uints[r];
+                    break;
+                case Storage::Double:
+                    v = 0;
+                    std::copy_n(reinterpret_cast<const unsigned char*>(&col->doubles[r]), sizeof(double),
+                                reinterpret_cast<unsigned char*>(&v));
+                    break;
+                case Storage::String:
+                    v = col->codes[r];
+                    break;
+                }
+            }
+
+            keyvals[k] = v;
+        }
+
+        keybuf.assign(reinterpret_cast<const char*>(keyvals.data()), keyvals.size() * sizeof(uint64_t));
+
+        auto ret = group_index.insert(std::make_pair(keybuf, group_first_row.size()));
+
+        if (ret.second)
+            group_first_row.push_back(r);
+
+        group_of[i] = ret.first->second;
+    }
+
+    // --- Compute count and sums
+
+    size_t num_groups = group_first_row.size();
+
+    std::vector<uint64_t> counts(num_groups, 0);
+
+    // integer sums use (wrapping) unsigned arithmetic, which is also
+    // correct for signed values in two's complement
+    std::vector< std::vector<uint64_t> > isums(sum_cols.size());
+    std::vector< std::vector<double> >   dsums(sum_cols.size());
+    std::vector< std::vector<unsigned char> > has_sum(sum_cols.size()); // group had a value
+
+    for (size_t i = 0; i < rows.size(); ++i)
+        ++counts[group_of[i]];
+
+    for (size_t s = 0; s < sum_cols.size(); ++s) {
+        const Column* col = sum_cols[s];
+
+        has_sum[s].assign(num_groups, 0);
+
+        for (size_t i = 0; i < rows.size(); ++i)
+            if (col->valid[rows[i]])
+                has_sum[s][group_of[i]] = 1;
+
+        switch (col->storage) {
+        case Storage::Int:
+            isums[s].assign(num_groups, 0);
+            for (size_t i = 0; i < rows.size(); ++i)
+                if (col->valid[rows[i]])
+                    isums[s][group_of[i]] += static_cast<uint64_t>(col->ints[rows[i]]);
+            break;
+        case Storage::UInt:
+            isums[s].assign(num_groups, 0);
+            for (size_t i = 0; i < rows.size(); ++i)
+                if (col->valid[rows[i]])
+                    isums[s][group_of[i]] += col->uints[rows[i]];
+            break;
+        default:
+            dsums[s].assign(num_groups, 0.0);
+            for (size_t i = 0; i < rows.size(); ++i)
+                if (col->valid[rows[i]])
+                    dsums[s][group_of[i]] += col->doubles[rows[i]];
+        }
+    }
+
+    // --- Build result table
+
+    SnapshotTable result;
+    SnapshotTableImpl* res = result.mP.get();
+
+    for (size_t g = 0; g < num_groups; ++g)
+        res->append_row();
+
+    for (const Column* kc : key_cols) {
+        Column& col = res->columns[res->make_column(kc->name, kc->attr_id, kc->type)];
+
+        for (size_t g = 0; g < num_groups; ++g) {
+            size_t r = group_first_row[g];
+
+            col.valid[g] = kc->valid[r];
+
+            if (!kc->valid[r])
+                continue;
+
+            switch (col.storage) {
+            case Storage::Int:
+                col.ints[g]    = kc->ints[r];
+                break;
+            case Storage::UInt:
+                col.uints[g]   = kc->uints[r];
+                break;
+            case Storage::Double:
+                col.doubles[g] = kc->doubles[r];
+                break;
+            case Storage::String:
+                col.codes[g]   = col.encode(kc->dict[kc->codes[r]]);
+                break;
+            }
+        }
+    }
+
+    {
+        Attribute attr = db.create_attribute("count", CALI_TYPE_UINT, CALI_ATTR_ASVALUE);
+        Column&   col  = res->columns[res->make_column(attr.name(), attr.id(), CALI_TYPE_UINT)];
+
+        col.valid.assign(num_groups, 1);
+        col.uints = counts;
+    }
+
+    // like the Aggregator's sum kernel, store sums in the summed
+    // attribute itself, for groups with at least one value
+
+    for (size_t s = 0; s < sum_cols.size(); ++s) {
+        const Column* sc  = sum_cols[s];
+        Column&       col = res->columns[res->make_column(sc->name, sc->attr_id, sc->type)];
+
+        for (size_t g = 0; g < num_groups; ++g) {
+            col.valid[g] = has_sum[s][g];
+
+            switch (col.storage) {
+            case Storage::Int:
+                col.ints[g]    = static_cast<int64_t>(isums[s][g]);
+                break;
+            case Storage::UInt:
+                col.uints[g]   = isums[s][g];
+                break;
+            default:
+                col.doubles[g] = dsums[s][g];
+            }
+        }
+    }
+
+    return result;
+}
+
+void
+SnapshotTable::push(CaliperMetadataAccessInterface& db, const std::vector<std::size_t>& rows, SnapshotProcessFn push) const
+{
+    EntryList list;
+
+    list.reserve(mP->columns.size());
+
+    for (std::size_t r : rows) {
+        list.clear();
+
+        for (const Column& col : mP->columns)
+            if (col.attr_id != CALI_INV_ID && col.valid[r])
+                list.push_back(Entry(col.attr_id, col.value(r)));
+
+        push(db, list);
+    }
+}
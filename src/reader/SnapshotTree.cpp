@@ -37,7 +37,10 @@
 #include "caliper/common/CaliperMetadataAccessInterface.h"
 #include "caliper/common/Node.h"
 
+#include <algorithm>
 #include <cassert>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 using namespace cali;
@@ -45,8 +48,43 @@ using namespace cali;
 
 struct SnapshotTree::SnapshotTreeImpl
 {
+    typedef std::pair<Attribute, Variant> PathElement;
+
+    /// \brief Path and non-path entries found on a context tree branch
+    struct BranchInfo {
+        std::vector<PathElement>        path;       ///< path entries, root first
+        SnapshotTreeNode::AttributeList attributes; ///< non-path entries, leaf first
+    };
+
+    struct PathKeyHash {
+        size_t operator()(const std::pair<const SnapshotTreeNode*, const Node*>& p) const {
+            return std::hash<const void*>()(p.first) ^ (std::hash<const void*>()(p.second) << 1);
+        }
+    };
+
     SnapshotTreeNode* m_root;
 
+    std::mutex        m_lock;
+
+    /// \brief The unpacked branch for each context tree node seen so far
+    std::unordered_map<const Node*, BranchInfo> m_branch_cache;
+
+    struct PathCacheEntry {
+        SnapshotTreeNode* node;
+        unsigned          generation;
+    };
+
+    /// \brief The snapshot tree node reached from a given snapshot tree
+    ///   node by the path in a given context tree branch
+    std::unordered_map< std::pair<const SnapshotTreeNode*, const Node*>, PathCacheEntry, PathKeyHash >
+                      m_path_cache;
+
+    /// \brief Path cache entries from older generations are invalid.
+    ///   Incremented whenever a duplicate node is added: it is placed
+    ///   before the existing node with the same label and hides it
+    ///   from later path lookups.
+    unsigned          m_generation;
+
     void recursive_delete(SnapshotTreeNode* node) {
         if (node) {
             node = node->first_child();
@@ -62,45 +100,144 @@ struct SnapshotTree::SnapshotTreeImpl
         }
     }
 
+    static void add_attribute(SnapshotTreeNode::AttributeList& list, const Attribute& attr, const Variant& val) {
+        for (const auto &p : list)
+            if (p.first == attr)
+                return;
+
+        list.push_back(std::make_pair(attr, val));
+    }
+
+    static size_t label_hash(const Attribute& key, const Variant& value) {
+        // FNV-1a over the attribute id and value bytes
+        uint64_t h = 0xcbf29ce484222325ull;
+
+        auto mix = [&h](const unsigned char* p, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                h ^= p[i];
+                h *= 0x100000001b3ull;
+            }
+        };
+
+        cali_id_t id = key.id();
+
+        mix(reinterpret_cast<const unsigned char*>(&id), sizeof(id));
+        mix(static_cast<const unsigned char*>(value.data()), value.size());
+
+        return static_cast<size_t>(h ^ (h >> 32));
+    }
+
+    SnapshotTreeNode* find_or_create_child(SnapshotTreeNode* node, const PathElement& label) {
+        SnapshotTreeNode* child =
+            node->find_child(label_hash(label.first, label.second),
+                             [&label](const SnapshotTreeNode* n) {
+                                 return n->label_equals(label.first, label.second);
+                             },
+                             [](const SnapshotTreeNode* n) {
+                                 return label_hash(n->label_key(), n->label_value());
+                             });
+
+        if (!child) {
+            child = new SnapshotTreeNode(label.first, label.second, true /* empty */);
+            node->append(child);
+        }
+
+        return child;
+    }
+
+    const BranchInfo& get_branch(const CaliperMetadataAccessInterface& db, const Node* branch, IsPathPredicateFn& is_path) {
+        auto it = m_branch_cache.find(branch);
+
+        if (it != m_branch_cache.end())
+            return it->second;
+
+        BranchInfo info;
+
+        for (const Node* node = branch; node; node = node->parent()) {
+            if (node->id() == CALI_INV_ID)
+                continue;
+
+            Attribute attr = db.get_attribute(node->attribute());
+
+            if (attr == Attribute::invalid)
+                continue;
+
+            if (is_path(attr, node->data()))
+                info.path.push_back(std::make_pair(attr, node->data()));
+            else
+                add_attribute(info.attributes, attr, node->data());
+        }
+
+        std::reverse(info.path.begin(), info.path.end());
+
+        return m_branch_cache.emplace(branch, std::move(info)).first->second;
+    }
+
+    SnapshotTreeNode* descend(SnapshotTreeNode* node, const Node* branch, const BranchInfo& info) {
+        auto key = std::make_pair(static_cast<const SnapshotTreeNode*>(node), branch);
+        auto it  = m_path_cache.find(key);
+
+        if (it != m_path_cache.end() && it->second.generation == m_generation)
+            return it->second.node;
+
+        for (const PathElement& label : info.path)
+            node = find_or_create_child(node, label);
+
+        m_path_cache[key] = PathCacheEntry { node, m_generation };
+
+        return node;
+    }
+
     const SnapshotTreeNode* 
     add_snapshot(const CaliperMetadataAccessInterface& db, 
                  const EntryList&  list,
                  IsPathPredicateFn is_path) 
     {
-        std::vector< std::pair<Attribute, Variant> > path;
-        std::map<Attribute, Variant> attributes;
-
         //
-        // helper function to distinguish path and attribute entries
+        // unpack snapshot; distinguish path and attribute entries.
+        //   Path segments are either a context tree branch or a single
+        //   path element from an immediate entry.
         //
 
-        auto push_entry = [&](cali_id_t attr_id, const Variant& val){
-            Attribute attr = db.get_attribute(attr_id);
+        struct Segment {
+            const Node*       branch;
+            const BranchInfo* info;
+            PathElement       label;
+        };
 
-            if (attr == Attribute::invalid)
-                return;
+        std::vector<Segment> segments;
+        SnapshotTreeNode::AttributeList attributes;
 
-            if (is_path(attr, val))
-                path.push_back(std::make_pair(attr, val));
-            else {
-                if (attributes.count(attr) == 0)
-                    attributes.insert(std::make_pair(attr, val));
-            }   
-        };
+        bool has_path = false;
 
-        //
-        // unpack snapshot; distinguish path and attribute entries
-        //
+        std::lock_guard<std::mutex>
+            g(m_lock);
 
         for (const Entry& e : list)
-            if (e.is_immediate())
-                push_entry(e.attribute(), e.value());
-            else
-                for (const Node* node = e.node(); node; node = node->parent())
-                    if (node->id() != CALI_INV_ID)
-                        push_entry(node->attribute(), node->data());
+            if (e.is_immediate()) {
+                Attribute attr = db.get_attribute(e.attribute());
+
+                if (attr == Attribute::invalid)
+                    continue;
+
+                if (is_path(attr, e.value())) {
+                    segments.push_back(Segment { nullptr, nullptr, std::make_pair(attr, e.value()) });
+                    has_path = true;
+                } else
+                    add_attribute(attributes, attr, e.value());
+            } else if (e.node()) {
+                const BranchInfo& info = get_branch(db, e.node(), is_path);
+
+                if (!info.path.empty()) {
+                    segments.push_back(Segment { e.node(), &info, PathElement() });
+                    has_path = true;
+                }
+
+                for (const auto &p : info.attributes)
+                    add_attribute(attributes, p.first, p.second);
+            }
 
-        if (path.empty())
+        if (!has_path)
             return nullptr;
 
         //
@@ -109,19 +246,11 @@ struct SnapshotTree::SnapshotTreeImpl
 
         SnapshotTreeNode* node = m_root;
 
-        for (auto it = path.rbegin(); it != path.rend(); ++it) {
-            SnapshotTreeNode* child = node->first_child();
-
-            for ( ; child && !child->label_equals((*it).first, (*it).second); child = child->next_sibling())
-                ;
-
-            if (!child) {
-                child = new SnapshotTreeNode((*it).first, (*it).second, true /* empty */);
-                node->append(child);
-            }
-
-            node = child;
-        }
+        for (auto it = segments.rbegin(); it != segments.rend(); ++it)
+            if (it->branch)
+                node = descend(node, it->branch, *(it->info));
+            else
+                node = find_or_create_child(node, it->label);
 
         assert(node);
 
@@ -131,6 +260,8 @@ struct SnapshotTree::SnapshotTreeImpl
 
             node = new SnapshotTreeNode(node->label_key(), node->label_value(), false);
             parent->append(node);
+
+            ++m_generation;
         }
 
         //
@@ -143,7 +274,8 @@ struct SnapshotTree::SnapshotTreeImpl
     }
 
     SnapshotTreeImpl(const Attribute& attr, const Variant& value)
-        : m_root(new SnapshotTreeNode(attr, value, true))
+        : m_root(new SnapshotTreeNode(attr, value, true)),
+          m_generation(0)
         { }
 
     ~SnapshotTreeImpl() {
@@ -39,6 +39,7 @@
 #include "caliper/common/Attribute.h"
 #include "caliper/common/CaliperMetadataAccessInterface.h"
 #include "caliper/common/ContextRecord.h"
+#include "caliper/common/Log.h"
 #include "caliper/common/Node.h"
 #include "caliper/common/StringConverter.h"
 
@@ -47,9 +48,106 @@
 #include <algorithm>
 #include <iterator>
 #include <mutex>
+#include <thread>
+#include <unordered_set>
 
 using namespace cali;
 
+namespace
+{
+
+/// \brief Three-way comparison of table cells. Compares numbers by value
+///   (also across integer and floating-point types).
+int compare_cells(const Variant& lhs, const Variant& rhs)
+{
+    cali_attr_type ltype = lhs.type();
+    cali_attr_type rtype = rhs.type();
+
+    cali_variant_t l = lhs.c_variant();
+    cali_variant_t r = rhs.c_variant();
+
+    if (ltype == rtype) {
+        switch (ltype) {
+        case CALI_TYPE_INT:
+            return (l.value.v_int < r.value.v_int ? -1 : (l.value.v_int > r.value.v_int ? 1 : 0));
+        case CALI_TYPE_UINT:
+        case CALI_TYPE_ADDR:
+            return (l.value.v_uint < r.value.v_uint ? -1 : (l.value.v_uint > r.value.v_uint ? 1 : 0));
+        case CALI_TYPE_DOUBLE:
+            return (l.value.v_double < r.value.v_double ? -1 : (l.value.v_double > r.value.v_double ? 1 : 0));
+        default:
+            return cali_variant_compare(l, r);
+        }
+    }
+
+    auto is_number = [](cali_attr_type t) {
+        return t == CALI_TYPE_INT || t == CALI_TYPE_UINT || t == CALI_TYPE_DOUBLE;
+    };
+
+    if (is_number(ltype) && is_number(rtype)) {
+        double ld = lhs.to_double();
+        double rd = rhs.to_double();
+
+        return (ld < rd ? -1 : (ld > rd ? 1 : 0));
+    }
+
+    return cali_variant_compare(l, r);
+}
+
+/// \brief Sort [\a begin, \a end) with \a cmp, using multiple threads for
+///   large inputs. \a cmp must be a strict total order.
+template<class It, class Cmp>
+void parallel_sort(It begin, It end, Cmp cmp)
+{
+    const size_t min_chunk_size = 16384;
+
+    size_t   n        = std::distance(begin, end);
+    unsigned nthreads = std::min<unsigned>(std::max(1u, std::thread::hardware_concurrency()), 8);
+
+    nthreads = std::min<size_t>(nthreads, n / min_chunk_size);
+
+    if (nthreads < 2) {
+        std::sort(begin, end, cmp);
+        return;
+    }
+
+    std::vector<It> bounds;
+    size_t chunk = (n + nthreads - 1) / nthreads;
+
+    for (size_t i = 0; i < n; i += chunk)
+        bounds.push_back(begin + i);
+
+    bounds.push_back(end);
+
+    size_t nchunks = bounds.size() - 1;
+
+    {
+        std::vector<std::thread> threads;
+
+        for (size_t i = 0; i < nchunks; ++i)
+            threads.emplace_back([&bounds,&cmp,i](){ std::sort(bounds[i], bounds[i+1], cmp); });
+
+        for (auto& t : threads)
+            t.join();
+    }
+
+    // merge sorted chunks pairwise, one tree level at a time
+
+    for (size_t w = 1; w < nchunks; w *= 2) {
+        std::vector<std::thread> threads;
+
+        for (size_t i = 0; i + w < nchunks; i += 2*w)
+            threads.emplace_back([&bounds,&cmp,i,w,nchunks](){
+                    std::inplace_merge(bounds[i], bounds[i+w], bounds[std::min(i+2*w, nchunks)], cmp);
+                });
+
+        for (auto& t : threads)
+            t.join();
+    }
+}
+
+} // namespace [anonymous]
+
 struct TableFormatter::TableImpl
 {
     struct Column {
@@ -68,14 +166,49 @@ struct TableFormatter::TableImpl
             { }
     };
 
+    /// \brief A table row. Cells keep their typed values; strings refer
+    ///   to the formatter's string pool.
+    struct Row {
+        std::vector<Variant> cells;
+        uint64_t             seq;   ///< Arrival order, used as final sort criterion
+    };
+
     std::vector<Column>                     m_cols;
-    std::vector< std::vector<std::string> > m_rows;
+    std::vector<Row>                        m_rows; ///< Rows. A bounded heap in top-k mode.
+
+    /// Sort column indices and descending flag, most significant first
+    std::vector< std::pair<size_t, bool> >  m_sort_cols;
+
+    std::size_t                             m_limit; ///< Max. number of rows to print (0: unlimited)
+    uint64_t                                m_seq;
+
+    std::unordered_set<std::string>         m_strings;
 
     std::mutex                              m_col_lock;
     std::mutex                              m_row_lock;
+    std::mutex                              m_string_lock;
 
     bool                                    m_auto_column;
 
+    TableImpl()
+        : m_limit(0), m_seq(0), m_auto_column(false)
+        { }
+
+    void update_sort_columns() {
+        // Sorting by several columns behaves like applying stable sorts
+        // for each ORDER BY entry in turn, i.e. the last entry is the
+        // most significant one.
+
+        m_sort_cols.clear();
+
+        for (size_t c = m_cols.size(); c > 0; --c) {
+            QuerySpec::SortSpec::Order order = m_cols[c-1].sort_order;
+            
+            if (order == QuerySpec::SortSpec::Order::Ascending || order == QuerySpec::SortSpec::Order::Descending)
+                m_sort_cols.push_back(std::make_pair(c-1, order == QuerySpec::SortSpec::Order::Descending));
+        }
+    }
+
     void parse(const std::string& field_string, const std::string& sort_string) {
         std::vector<std::string> fields;
 
@@ -85,8 +218,9 @@ struct TableFormatter::TableImpl
 
         for (const std::string& s : fields)
             if (s.size() > 0)
-                m_cols.emplace_back(s, s.size(), Attribute::invalid, false);
+                m_cols.emplace_back(s, s.size(), Attribute::invalid, false, QuerySpec::SortSpec::Order::Ascending);
 
+        update_sort_columns();
         fields.clear();
 
         // fill print columns
@@ -123,6 +257,8 @@ struct TableFormatter::TableImpl
             break;
         }
 
+        update_sort_columns();
+
         // Fill header columns
         
         switch (spec.attribute_selection.selection) {
@@ -138,6 +274,21 @@ struct TableFormatter::TableImpl
             // Keep auto_column = false and empty column list
             break;
         }
+
+        // Row limit (first formatter argument)
+
+        m_limit = 0;
+
+        if (spec.format.opt == QuerySpec::FormatSpec::User && spec.format.args.size() > 0) {
+            bool ok = false;
+            m_limit = StringConverter(spec.format.args.front()).to_uint(&ok);
+
+            if (!ok) {
+                Log(0).stream() << "TableFormatter: Invalid row limit \""
+                                << spec.format.args.front() << "\"" << std::endl;
+                m_limit = 0;
+            }
+        }
     }
     
     void update_column_attribute(CaliperMetadataAccessInterface& db, cali_id_t attr_id) {
@@ -164,7 +315,7 @@ struct TableFormatter::TableImpl
         m_cols.emplace_back(name, name.size(), attr, true);
     }
 
-    std::vector<Column> update_columns(CaliperMetadataAccessInterface& db, const EntryList& list) {
+    std::vector<Attribute> update_columns(CaliperMetadataAccessInterface& db, const EntryList& list) {
         std::lock_guard<std::mutex>
             g(m_col_lock);
 
@@ -182,54 +333,110 @@ struct TableFormatter::TableImpl
 
         // Check if we can look up attribute object from name
 
-        for (Column& col : m_cols)
+        std::vector<Attribute> attrs;
+        attrs.reserve(m_cols.size());
+
+        for (Column& col : m_cols) {
             if (col.attr == Attribute::invalid)
                 col.attr = db.get_attribute(col.name);
 
-        return m_cols;
+            attrs.push_back(col.attr);
+        }
+
+        return attrs;
+    }
+
+    /// \brief Return a string variant with a copy of \a str from the string pool
+    Variant make_string_cell(const std::string& str) {
+        std::lock_guard<std::mutex>
+            g(m_string_lock);
+
+        auto it = m_strings.insert(str).first;
+
+        return Variant(CALI_TYPE_STRING, it->data(), it->size());
+    }
+
+    /// \brief Row order for printing: true if \a lhs goes before \a rhs
+    bool before(const Row& lhs, const Row& rhs) const {
+        for (const auto& s : m_sort_cols) {
+            // sort columns come first, so each row has them
+            int cmp = compare_cells(lhs.cells[s.first], rhs.cells[s.first]);
+
+            if (s.second)
+                cmp = -cmp;
+            if (cmp != 0)
+                return cmp < 0;
+        }
+
+        return lhs.seq < rhs.seq;
+    }
+
+    void push_row(Row&& row) {
+        // NOTE: We assume that m_row_lock is locked!
+
+        row.seq = m_seq++;
+
+        if (m_limit == 0) {
+            m_rows.push_back(std::move(row));
+            return;
+        }
+
+        // top-k mode: keep the best m_limit rows in a heap (worst row on top)
+
+        auto cmp = [this](const Row& a, const Row& b){ return this->before(a, b); };
+
+        if (m_rows.size() < m_limit) {
+            m_rows.push_back(std::move(row));
+            std::push_heap(m_rows.begin(), m_rows.end(), cmp);
+        } else if (before(row, m_rows.front())) {
+            std::pop_heap(m_rows.begin(), m_rows.end(), cmp);
+            m_rows.back() = std::move(row);
+            std::push_heap(m_rows.begin(), m_rows.end(), cmp);
+        }
     }
 
     void add(CaliperMetadataAccessInterface& db, const EntryList& list) {
-        std::vector<Column> cols = update_columns(db, list);
-        std::vector<std::string> row(cols.size());
+        std::vector<Attribute> attrs = update_columns(db, list);
+
+        Row  row;
+        row.cells.resize(attrs.size());
 
         bool active = false;
-        bool update_max_width = false;
 
-        for (std::vector<Column>::size_type c = 0; c < cols.size(); ++c) {
-            if (cols[c].attr == Attribute::invalid)
+        for (std::vector<Attribute>::size_type c = 0; c < attrs.size(); ++c) {
+            if (attrs[c] == Attribute::invalid)
                 continue;
 
-            std::string val;
+            Variant val;
 
             for (Entry e : list) {
                 if (e.node()) {
                     std::string str;
 
                     for (const Node* node = e.node(); node; node = node->parent())
-                        if (node->attribute() == cols[c].attr.id())
+                        if (node->attribute() == attrs[c].id())
                             str = node->data().to_string().append(str.empty() ? "" : "/").append(str);
 
                     if (!str.empty()) {
-                        val = str;
+                        val = make_string_cell(str);
                         break;
                     }
-                } else if (e.attribute() == cols[c].attr.id()) {
-                    val = e.value().to_string();
+                } else if (e.attribute() == attrs[c].id()) {
+                    val = e.value();
+
+                    // copy strings into the pool: the record's data may be transient
+                    if (val.type() == CALI_TYPE_STRING || val.type() == CALI_TYPE_USR) {
+                        std::string str = val.to_string();
+                        val = (str.empty() ? Variant() : make_string_cell(str));
+                    }
+
                     break;
                 }
             }
 
             if (!val.empty()) {
                 active = true;
-                row[c] = val;
-
-                size_t width = val.length();
-
-                if (width > cols[c].max_width) {
-                    cols[c].max_width = width;
-                    update_max_width  = true;
-                }
+                row.cells[c] = val;
             }
         }
 
@@ -237,16 +444,7 @@ struct TableFormatter::TableImpl
             std::lock_guard<std::mutex>
                 g(m_row_lock);
 
-            m_rows.push_back(std::move(row));
-        }
-
-        if (update_max_width) {
-            std::lock_guard<std::mutex>
-                g(m_col_lock);
-
-            for (std::vector<Column>::size_type c = 0; c < cols.size(); ++c)
-                if (cols[c].max_width > m_cols[c].max_width)
-                    m_cols[c].max_width = cols[c].max_width;
+            push_row(std::move(row));
         }
     }
 
@@ -254,26 +452,17 @@ struct TableFormatter::TableImpl
         // NOTE: No locking, assume flush() runs serially
 
         // sort rows
-        // NOTE: This is REALLY slow (potentially converts strings to numbers on every comparison)
-
-        for (std::vector<Column>::size_type c = 0; c < m_cols.size(); ++c)
-            if (m_cols[c].sort_order == QuerySpec::SortSpec::Order::Ascending)
-                std::stable_sort(m_rows.begin(), m_rows.end(),
-                                 [c,this](const std::vector<std::string>& lhs, const std::vector<std::string>& rhs){
-                                     if (c >= lhs.size() || c >= rhs.size())
-                                         return lhs.size() < rhs.size();
-                                     cali_attr_type type = this->m_cols[c].attr.type();
-                                     return Variant::from_string(type, lhs[c].c_str()) < Variant::from_string(type, rhs[c].c_str());
-                                 });
-            else if (m_cols[c].sort_order == QuerySpec::SortSpec::Order::Descending)
-                std::stable_sort(m_rows.begin(), m_rows.end(),
-                                 [c,this](const std::vector<std::string>& lhs, const std::vector<std::string>& rhs){
-                                     if (c >= lhs.size() || c >= rhs.size())
-                                         return lhs.size() > rhs.size();
-                                     cali_attr_type type = this->m_cols[c].attr.type();
-                                     return Variant::from_string(type, lhs[c].c_str()) > Variant::from_string(type, rhs[c].c_str());
-                                 });
-                
+
+        auto cmp = [this](const Row& a, const Row& b){ return this->before(a, b); };
+
+        if (m_limit > 0)
+            std::sort_heap(m_rows.begin(), m_rows.end(), cmp);
+        else if (!m_sort_cols.empty())
+            ::parallel_sort(m_rows.begin(), m_rows.end(), cmp);
+
+        // determine column widths from the remaining rows
+
+        update_column_widths();
 
         const char whitespace[120+1] =
             "                                        "
@@ -288,26 +477,79 @@ struct TableFormatter::TableImpl
 
         os << std::endl;
 
-        // print rows
+        // print rows: format row ranges in parallel, write them in order
+
+        Formatter::format_rows(m_rows.size(),
+                               [this,&whitespace](size_t begin, size_t end, std::string& out) {
+                                   for (size_t r = begin; r < end; ++r)
+                                       format_row(m_rows[r], whitespace, out);
+                               },
+                               [&os](const std::string& out) {
+                                   os.write(out.data(), out.size());
+                               });
+    }
+
+    void update_column_widths() {
+        const size_t min_chunk_size = 16384;
+
+        size_t   n        = m_rows.size();
+        unsigned nthreads = std::min<unsigned>(std::max(1u, std::thread::hardware_concurrency()), 8);
 
-        for (auto row : m_rows) {
-            for (std::vector<Column>::size_type c = 0; c < row.size(); ++c) {
-                if (!m_cols[c].print)
-                    continue;
+        nthreads = std::max<size_t>(1, std::min<size_t>(nthreads, n / min_chunk_size));
 
-                std::string    str = row[c];
-                cali_attr_type t   = m_cols[c].attr.type();
-                bool           align_right = (t == CALI_TYPE_INT || t == CALI_TYPE_UINT || t == CALI_TYPE_DOUBLE);
-                std::size_t    len = m_cols[c].max_width-str.size();
+        size_t chunk = (n + nthreads - 1) / nthreads;
 
-                if (align_right)
-                    os << whitespace+(120 - std::min<std::size_t>(120, len)) << str << ' ';
-                else
-                    os << str << whitespace+(120 - std::min<std::size_t>(120, 1+len));
+        std::vector< std::vector<size_t> > widths(nthreads, std::vector<size_t>(m_cols.size(), 0));
+
+        auto scan = [this,&widths,chunk,n](unsigned t) {
+            for (size_t r = t * chunk; r < std::min(n, (t+1) * chunk); ++r) {
+                const Row& row = m_rows[r];
+
+                for (std::vector<Variant>::size_type c = 0; c < row.cells.size(); ++c)
+                    if (m_cols[c].print && !row.cells[c].empty()) {
+                        const Variant& v = row.cells[c];
+                        size_t width = (v.type() == CALI_TYPE_STRING ? v.size() : v.to_string().size());
+
+                        widths[t][c] = std::max(widths[t][c], width);
+                    }
             }
+        };
+
+        if (nthreads < 2) {
+            scan(0);
+        } else {
+            std::vector<std::thread> threads;
+
+            for (unsigned t = 0; t < nthreads; ++t)
+                threads.emplace_back(scan, t);
+
+            for (auto& t : threads)
+                t.join();
+        }
+
+        for (const auto& w : widths)
+            for (size_t c = 0; c < m_cols.size(); ++c)
+                m_cols[c].max_width = std::max(m_cols[c].max_width, w[c]);
+    }
 
-            os << std::endl;
+    /// \brief Append \a row to \a out
+    void format_row(const Row& row, const char* whitespace, std::string& out) const {
+        for (std::vector<Variant>::size_type c = 0; c < row.cells.size(); ++c) {
+            if (!m_cols[c].print)
+                continue;
+
+            std::string    str = row.cells[c].empty() ? std::string() : row.cells[c].to_string();
+            cali_attr_type t   = m_cols[c].attr.type();
+            bool           align_right = (t == CALI_TYPE_INT || t == CALI_TYPE_UINT || t == CALI_TYPE_DOUBLE);
+            std::size_t    len = m_cols[c].max_width-str.size();
+
+            if (align_right)
+                out.append(whitespace+(120 - std::min<std::size_t>(120, len))).append(str).push_back(' ');
+            else
+                out.append(str).append(whitespace+(120 - std::min<std::size_t>(120, 1+len)));
         }
+
+        out.push_back('\n');
     }
 };
 
@@ -47,6 +47,7 @@
 #include <algorithm>
 #include <cassert>
 #include <iterator>
+#include <map>
 #include <mutex>
 #include <utility>
 
@@ -126,34 +127,26 @@ struct TreeFormatter::TreeFormatterImpl
     }
 
     void add(const CaliperMetadataAccessInterface& db, const EntryList& list) {
-        const SnapshotTreeNode* node = nullptr;
+        // Column widths are determined in flush(), we only need to
+        // insert the record here.
 
         if (m_path_key_names.empty()) {
-            node = m_tree.add_snapshot(db, list, [](const Attribute& attr,const Variant&){
+            m_tree.add_snapshot(db, list, [](const Attribute& attr,const Variant&){
                     return attr.is_nested();
                 });
         } else { 
             auto path_keys = get_path_keys(db);
 
-            node = m_tree.add_snapshot(db, list, [&path_keys](const Attribute& attr, const Variant&){
+            m_tree.add_snapshot(db, list, [&path_keys](const Attribute& attr, const Variant&){
                     return (std::find(std::begin(path_keys), std::end(path_keys), 
                                       attr) != std::end(path_keys));
                 });
         }
-        
-        if (!node)
-            return;
-
-        // update column widths
-
-        {
-            int len = node->label_value().to_string().size();
-
-            for (const SnapshotTreeNode* n = node; n && n->label_key() != Attribute::invalid; n = n->parent())
-                len += 2;
+    }
 
-            m_path_column_width = std::max(m_path_column_width, len);
-        }
+    void recursive_update_column_widths(const SnapshotTreeNode* node, int level) {
+        m_path_column_width =
+            std::max<int>(m_path_column_width, node->label_value().to_string().size() + 2*(level+1));
 
         for (auto &p : node->attributes()) {
             int len = p.second.to_string().size();
@@ -164,6 +157,9 @@ struct TreeFormatter::TreeFormatterImpl
             else
                 it->second = std::max(it->second, len);
         }
+
+        for (node = node->first_child(); node; node = node->next_sibling())
+            recursive_update_column_widths(node, level+1);
     }
 
     void recursive_print_nodes(const SnapshotTreeNode* node, 
@@ -185,9 +181,9 @@ struct TreeFormatter::TreeFormatterImpl
             std::string str;
 
             {
-                auto it = node->attributes().find(a);
-                if (it != node->attributes().end())
-                    str = it->second.to_string();
+                Variant val = node->get(a);
+                if (!val.empty())
+                    str = val.to_string();
             }
 
             cali_attr_type t = a.type();
@@ -202,7 +198,7 @@ struct TreeFormatter::TreeFormatterImpl
                 ::pad_right(os, str, m_attribute_column_widths[a]);
         }
 
-        os << std::endl;
+        os << '\n';
 
         // 
         // recursively descend
@@ -213,6 +209,14 @@ struct TreeFormatter::TreeFormatterImpl
     }
 
     void flush(const CaliperMetadataAccessInterface& db, std::ostream& os) {
+        {
+            const SnapshotTreeNode* node = m_tree.root();
+
+            if (node)
+                for (node = node->first_child(); node; node = node->next_sibling())
+                    recursive_update_column_widths(node, 0);
+        }
+
         m_path_column_width = std::max<std::size_t>(m_path_column_width, 4 /* strlen("Path") */);
 
         //
@@ -183,7 +183,7 @@ struct UserFormatter::FormatImpl
             std::lock_guard<std::mutex>
                 g(m_os_lock);
             
-            m_os.stream() << os.str() <<std::endl;
+            m_os.stream() << os.str() << '\n';
         }
     }
 };
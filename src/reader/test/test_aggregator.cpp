@@ -2,10 +2,14 @@
 
 #include "caliper/reader/CaliperMetadataDB.h"
 
+#include "caliper/common/CompressedSnapshotRecord.h"
 #include "caliper/common/Node.h"
 
 #include <gtest/gtest.h>
 
+#include <map>
+#include <thread>
+
 using namespace cali;
 
 namespace
@@ -372,6 +376,80 @@ TEST(AggregatorTest, SingleKeySumOpSpec) {
     EXPECT_EQ(rescount, 2);
 }
 
+TEST(AggregatorTest, PrefixKeyDepth) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute fn_attr =
+        db.create_attribute("fn",  CALI_TYPE_STRING, CALI_ATTR_NESTED);
+    Attribute ctx_attr =
+        db.create_attribute("ctx", CALI_TYPE_INT,    CALI_ATTR_DEFAULT);
+    Attribute val_attr =
+        db.create_attribute("val", CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+
+    // main/foo/bar and main/foo/baz with ctx=1 in between, and main/qux
+    const struct NodeInfo {
+        cali_id_t node_id;
+        cali_id_t attr_id;
+        cali_id_t prnt_id;
+        Variant   data;
+    } test_nodes[] = {
+        { 100, fn_attr.id(),  CALI_INV_ID, Variant(CALI_TYPE_STRING, "main", 5) },
+        { 101, fn_attr.id(),  100,         Variant(CALI_TYPE_STRING, "foo",  4) },
+        { 102, ctx_attr.id(), 101,         Variant(1)                           },
+        { 103, fn_attr.id(),  102,         Variant(CALI_TYPE_STRING, "bar",  4) },
+        { 104, fn_attr.id(),  102,         Variant(CALI_TYPE_STRING, "baz",  4) },
+        { 105, fn_attr.id(),  100,         Variant(CALI_TYPE_STRING, "qux",  4) }
+    };
+
+    for ( const NodeInfo& nI : test_nodes )
+        db.merge_node(nI.node_id, nI.attr_id, nI.prnt_id, nI.data, idmap);
+
+    QuerySpec spec;
+
+    spec.aggregation_key.selection = QuerySpec::SelectionList<std::string>::List;
+    spec.aggregation_key.list.push_back("fn");
+    spec.aggregation_key.list.push_back("ctx");
+    spec.aggregation_key_depth["fn"] = 2;
+
+    spec.aggregation_ops.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregation_ops.list.push_back(::make_op("sum", "val"));
+
+    Aggregator a(spec);
+
+    cali_id_t val_id = val_attr.id();
+    Variant   v_val(1);
+
+    for (cali_id_t n : { 103, 104, 104, 101, 105, 100 })
+        a.add(db, db.merge_snapshot(1, &n, 1, &val_id, &v_val, idmap));
+
+    std::map<std::string, int> res;
+
+    a.flush(db, [&](CaliperMetadataAccessInterface&, const EntryList& list) {
+            std::string path;
+            int val = 0;
+
+            for (const Entry& e : list) {
+                if (e.node()) {
+                    std::string p;
+                    for (const Node* node = e.node(); node && node->attribute() != CALI_INV_ID; node = node->parent())
+                        p = node->data().to_string() + (p.empty() ? "" : "/") + p;
+                    path = p;
+                } else if (e.attribute() == val_id)
+                    val = e.value().to_int();
+            }
+
+            res[path] = val;
+        });
+
+    ASSERT_EQ(res.size(), 4);
+
+    EXPECT_EQ(res["1/main/foo"], 3); // key path: non-nested attributes first
+    EXPECT_EQ(res["main/foo"],   1);
+    EXPECT_EQ(res["main/qux"],   1);
+    EXPECT_EQ(res["main"],       1);
+}
+
 TEST(AggregatorTest, NoneKeySumOpSpec) {
     //
     // --- setup
@@ -667,3 +745,656 @@ TEST(AggregatorTest, PercentTotalKernel) {
     EXPECT_DOUBLE_EQ(dict[attr_avg.id()].value().to_double(), 30.0);
     EXPECT_DOUBLE_EQ(dict[attr_pct.id()].value().to_double(), 75.0);
 }
+
+TEST(AggregatorTest, ParallelAggregation) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx =
+        db.create_attribute("ctx", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    Attribute val_attr =
+        db.create_attribute("val", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    db.merge_node(100, ctx.id(), CALI_INV_ID, Variant(1), idmap);
+    db.merge_node(101, ctx.id(), CALI_INV_ID, Variant(2), idmap);
+
+    QuerySpec spec;
+
+    spec.aggregation_key.selection = QuerySpec::SelectionList<std::string>::Default;
+
+    spec.aggregation_ops.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregation_ops.list.push_back(::make_op("count"));
+    spec.aggregation_ops.list.push_back(::make_op("sum", "val"));
+    spec.aggregation_ops.list.push_back(::make_op("statistics", "val"));
+    spec.aggregation_ops.list.push_back(::make_op("percent_total", "val"));
+
+    Aggregator a(spec);
+
+    // each thread aggregates into its own partial result
+    auto thread_fn = [&](int t) {
+        cali_id_t node_id = 100 + (t % 2);
+        cali_id_t val_id  = val_attr.id();
+
+        for (int i = 0; i < 1000; ++i) {
+            Variant v_val(t+1);
+            a.add(db, db.merge_snapshot(1, &node_id, 1, &val_id, &v_val, idmap));
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 4; ++t)
+        threads.emplace_back(thread_fn, t);
+    for (auto& t : threads)
+        t.join();
+
+    std::vector<EntryList> resdb;
+
+    a.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) {
+            resdb.push_back(list);
+        });
+
+    Attribute attr_count = db.get_attribute("count");
+    Attribute attr_min   = db.get_attribute("min#val");
+    Attribute attr_max   = db.get_attribute("max#val");
+    Attribute attr_pct   = db.get_attribute("percent_total#val");
+
+    ASSERT_NE(attr_count, Attribute::invalid);
+    ASSERT_NE(attr_pct,   Attribute::invalid);
+
+    ASSERT_EQ(resdb.size(), 2);
+
+    auto it = std::find_if(resdb.begin(), resdb.end(), [ctx](const EntryList& list){
+            for (const Entry& e : list)
+                if (e.value(ctx).to_int() == 1)
+                    return true;
+            return false;
+        });
+
+    ASSERT_NE(it, resdb.end());
+
+    auto dict = make_dict_from_entrylist(*it);
+
+    // threads 0 and 2 added values 1 and 3 for ctx=1
+    EXPECT_EQ(dict[attr_count.id()].value().to_uint(), 2000);
+    EXPECT_EQ(dict[val_attr.id()].value().to_int(),    4000);
+    EXPECT_EQ(dict[attr_min.id()].value().to_int(),    1);
+    EXPECT_EQ(dict[attr_max.id()].value().to_int(),    3);
+    EXPECT_DOUBLE_EQ(dict[attr_pct.id()].value().to_double(), 40.0);
+}
+
+TEST(AggregatorTest, ManyImmediateKeys) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx =
+        db.create_attribute("ctx", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    Attribute key_attr =
+        db.create_attribute("key", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    db.merge_node(100, ctx.id(), CALI_INV_ID, Variant(1), idmap);
+
+    QuerySpec spec;
+
+    spec.aggregation_key.selection = QuerySpec::SelectionList<std::string>::List;
+    spec.aggregation_key.list.push_back("ctx");
+    spec.aggregation_key.list.push_back("key");
+
+    spec.aggregation_ops.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregation_ops.list.push_back(::make_op("count"));
+
+    Aggregator a(spec);
+
+    const int nkeys = 20000;
+
+    // add each key three times, the third time without the context node
+    for (int r = 0; r < 3; ++r)
+        for (int k = 0; k < nkeys; ++k) {
+            cali_id_t node_id = 100;
+            cali_id_t key_id  = key_attr.id();
+            Variant   v_key(k);
+
+            a.add(db, db.merge_snapshot(r < 2 ? 1 : 0, &node_id, 1, &key_id, &v_key, idmap));
+        }
+
+    std::vector<EntryList> resdb;
+
+    a.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) {
+            resdb.push_back(list);
+        });
+
+    Attribute attr_count = db.get_attribute("count");
+
+    ASSERT_NE(attr_count, Attribute::invalid);
+    ASSERT_EQ(resdb.size(), static_cast<size_t>(2 * nkeys));
+
+    std::vector<int> counts(2 * nkeys, 0);
+
+    for (const EntryList& list : resdb) {
+        auto dict = make_dict_from_entrylist(list);
+
+        int  k    = dict[key_attr.id()].value().to_int();
+        bool ctx1 = false;
+
+        for (const Entry& e : list)
+            if (e.value(ctx).to_int() == 1)
+                ctx1 = true;
+
+        ASSERT_GE(k, 0);
+        ASSERT_LT(k, nkeys);
+
+        counts[k + (ctx1 ? 0 : nkeys)] += static_cast<int>(dict[attr_count.id()].value().to_uint());
+    }
+
+    for (int k = 0; k < nkeys; ++k) {
+        EXPECT_EQ(counts[k],         2) << "key " << k;
+        EXPECT_EQ(counts[k + nkeys], 1) << "key " << k;
+    }
+}
+
+TEST(AggregatorTest, ParallelImmediateKeyOrder) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute b_attr =
+        db.create_attribute("b", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    QuerySpec spec;
+
+    spec.aggregation_key.selection = QuerySpec::SelectionList<std::string>::List;
+    spec.aggregation_key.list.push_back("a");
+    spec.aggregation_key.list.push_back("b");
+
+    spec.aggregation_ops.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregation_ops.list.push_back(::make_op("count"));
+
+    Aggregator a(spec);
+    Attribute  a_attr;
+
+    // The first thread sees "b" before "a" exists, the second thread
+    // sees both at once: their shards find the key attributes in
+    // different orders.
+
+    std::thread t1([&]() {
+            cali_id_t ids[2] = { b_attr.id(), CALI_INV_ID };
+            Variant   vals[2] = { Variant(1), Variant(1) };
+
+            a.add(db, db.merge_snapshot(0, nullptr, 1, ids, vals, idmap));
+
+            a_attr = db.create_attribute("a", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+            ids[1] = a_attr.id();
+
+            a.add(db, db.merge_snapshot(0, nullptr, 2, ids, vals, idmap));
+        });
+    t1.join();
+
+    std::thread t2([&]() {
+            cali_id_t ids[2] = { a_attr.id(), b_attr.id() };
+            Variant   vals[2] = { Variant(1), Variant(1) };
+
+            a.add(db, db.merge_snapshot(0, nullptr, 2, ids, vals, idmap));
+        });
+    t2.join();
+
+    std::vector<EntryList> resdb;
+
+    a.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) {
+            resdb.push_back(list);
+        });
+
+    Attribute attr_count = db.get_attribute("count");
+
+    ASSERT_NE(attr_count, Attribute::invalid);
+    ASSERT_EQ(resdb.size(), 2);
+
+    for (const EntryList& list : resdb) {
+        auto dict = make_dict_from_entrylist(list);
+
+        EXPECT_EQ(dict[b_attr.id()].value().to_int(), 1);
+
+        if (dict.count(a_attr.id())) {
+            EXPECT_EQ(dict[a_attr.id()].value().to_int(), 1);
+            EXPECT_EQ(dict[attr_count.id()].value().to_uint(), 2);
+        } else
+            EXPECT_EQ(dict[attr_count.id()].value().to_uint(), 1);
+    }
+}
+
+TEST(AggregatorTest, BatchAdd) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx =
+        db.create_attribute("ctx", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    Attribute val_attr =
+        db.create_attribute("val", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    const Node* n1 = db.merge_node(100, ctx.id(), CALI_INV_ID, Variant(1), idmap);
+    const Node* n2 = db.merge_node(101, ctx.id(), CALI_INV_ID, Variant(2), idmap);
+
+    QuerySpec spec;
+
+    spec.aggregation_key.selection = QuerySpec::SelectionList<std::string>::Default;
+
+    spec.aggregation_ops.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregation_ops.list.push_back(::make_op("count"));
+    spec.aggregation_ops.list.push_back(::make_op("sum", "val"));
+
+    Aggregator a(spec);
+
+    // records 0 and 2 go to ctx=1, record 1 to ctx=2
+
+    CompressedSnapshotBatch batch;
+    const Node* nodes[3] = { n1, n2, n1 };
+
+    for (int i = 0; i < 3; ++i) {
+        batch.node_ids.push_back(nodes[i]->id());
+        batch.node_offsets.push_back(batch.node_ids.size());
+        batch.imm_attr.push_back(val_attr.id());
+        batch.imm_data.push_back(Variant(i+1));
+        batch.imm_offsets.push_back(batch.imm_attr.size());
+    }
+
+    a.add(db, batch);
+
+    std::vector<EntryList> resdb;
+
+    a.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) {
+            resdb.push_back(list);
+        });
+
+    Attribute attr_count = db.get_attribute("count");
+
+    ASSERT_NE(attr_count, Attribute::invalid);
+    ASSERT_EQ(resdb.size(), 2);
+
+    for (const EntryList& list : resdb) {
+        auto dict = make_dict_from_entrylist(list);
+        int  c    = 0;
+
+        for (const Entry& e : list)
+            if (e.value(ctx).type() != CALI_TYPE_INV)
+                c = e.value(ctx).to_int();
+
+        if (c == 1) {
+            EXPECT_EQ(dict[attr_count.id()].value().to_uint(), 2);
+            EXPECT_EQ(dict[val_attr.id()].value().to_int(),    4);
+        } else {
+            EXPECT_EQ(c, 2);
+            EXPECT_EQ(dict[attr_count.id()].value().to_uint(), 1);
+            EXPECT_EQ(dict[val_attr.id()].value().to_int(),    2);
+        }
+    }
+}
+
+TEST(AggregatorTest, BatchMatchesSingleRecords) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx =
+        db.create_attribute("ctx",  CALI_TYPE_INT,    CALI_ATTR_DEFAULT);
+    Attribute ival_attr =
+        db.create_attribute("ival", CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+    Attribute dval_attr =
+        db.create_attribute("dval", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    const int nkeys = 3;
+    cali_id_t key_nodes[nkeys];
+
+    for (int k = 0; k < nkeys; ++k)
+        key_nodes[k] = db.merge_node(100+k, ctx.id(), CALI_INV_ID, Variant(k), idmap)->id();
+
+    QuerySpec spec;
+
+    spec.aggregation_key.selection = QuerySpec::SelectionList<std::string>::Default;
+
+    spec.aggregation_ops.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregation_ops.list.push_back(::make_op("count"));
+    spec.aggregation_ops.list.push_back(::make_op("sum", "ival"));
+    spec.aggregation_ops.list.push_back(::make_op("statistics", "ival"));
+    spec.aggregation_ops.list.push_back(::make_op("statistics", "dval"));
+
+    Aggregator a_batch(spec);
+    Aggregator a_single(spec);
+
+    CompressedSnapshotBatch batch;
+
+    for (int i = 0; i < 1000; ++i) {
+        batch.node_ids.push_back(key_nodes[(i*7) % nkeys]);
+        batch.node_offsets.push_back(batch.node_ids.size());
+        batch.imm_attr.push_back(ival_attr.id());
+        batch.imm_data.push_back(Variant((i*37) % 101 - 50));
+
+        if (i % 5 != 0) {
+            batch.imm_attr.push_back(dval_attr.id());
+            batch.imm_data.push_back(Variant(0.5 * ((i*13) % 17)));
+        }
+
+        batch.imm_offsets.push_back(batch.imm_attr.size());
+    }
+
+    // already-aggregated input record: takes the generic statistics path
+
+    Attribute min_attr = db.create_attribute("min#ival", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    batch.node_ids.push_back(key_nodes[0]);
+    batch.node_offsets.push_back(batch.node_ids.size());
+    batch.imm_attr.push_back(min_attr.id());
+    batch.imm_data.push_back(Variant(-1000));
+    batch.imm_offsets.push_back(batch.imm_attr.size());
+
+    a_batch.add(db, batch);
+
+    for (size_t r = 0; r < batch.num_records(); ++r) {
+        EntryList list;
+
+        for (size_t i = 0; i < batch.num_nodes(r); ++i)
+            list.push_back(Entry(db.node(batch.nodes(r)[i])));
+        for (size_t i = 0; i < batch.num_immediates(r); ++i)
+            list.push_back(Entry(batch.immediate_attr(r)[i], batch.immediate_data(r)[i]));
+
+        a_single.add(db, list);
+    }
+
+    auto flush = [&db,&ctx](Aggregator& a) {
+        std::map<int, std::map<cali_id_t, Variant>> res;
+
+        a.flush(db, [&](CaliperMetadataAccessInterface&, const EntryList& list) {
+                int k = -1;
+                std::map<cali_id_t, Variant> vals;
+
+                for (const Entry& e : list)
+                    if (e.value(ctx).type() != CALI_TYPE_INV)
+                        k = e.value(ctx).to_int();
+                    else if (e.is_immediate())
+                        vals[e.attribute()] = e.value();
+
+                res[k] = vals;
+            });
+
+        return res;
+    };
+
+    auto res_batch  = flush(a_batch);
+    auto res_single = flush(a_single);
+
+    ASSERT_EQ(res_batch.size(), nkeys);
+    ASSERT_EQ(res_single.size(), nkeys);
+
+    EXPECT_EQ(res_batch[0][db.get_attribute("min#ival").id()].to_int(), -1000);
+
+    for (auto &p : res_single) {
+        ASSERT_EQ(res_batch[p.first].size(), p.second.size()) << "key " << p.first;
+
+        for (auto &v : p.second) {
+            const Variant& bv = res_batch[p.first][v.first];
+
+            if (v.second.type() == CALI_TYPE_DOUBLE)
+                EXPECT_DOUBLE_EQ(bv.to_double(), v.second.to_double())
+                    << db.get_attribute(v.first).name() << " key " << p.first;
+            else
+                EXPECT_EQ(bv, v.second)
+                    << db.get_attribute(v.first).name() << " key " << p.first;
+        }
+    }
+}
+
+TEST(AggregatorTest, QuantileKernel) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx =
+        db.create_attribute("ctx", CALI_TYPE_INT,    CALI_ATTR_DEFAULT);
+    Attribute val_attr =
+        db.create_attribute("val", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    const Node* node = db.merge_node(100, ctx.id(), CALI_INV_ID, Variant(1), idmap);
+
+    QuerySpec spec;
+
+    spec.aggregation_key.selection = QuerySpec::SelectionList<std::string>::Default;
+
+    QuerySpec::AggregationOp op = ::make_op("quantile", "val");
+    op.args.push_back("50");
+    op.args.push_back("99");
+
+    spec.aggregation_ops.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregation_ops.list.push_back(op);
+
+    // split the values 1..1000 over two aggregators, then merge
+
+    Aggregator a(spec), b(spec);
+
+    cali_id_t node_id = node->id();
+    cali_id_t val_id  = val_attr.id();
+
+    for (int i = 1; i <= 1000; ++i) {
+        Variant v(static_cast<double>(i));
+        (i % 2 ? a : b).add(db, db.merge_snapshot(1, &node_id, 1, &val_id, &v, idmap));
+    }
+
+    b.flush(db, a);
+
+    Attribute attr_p50 = db.get_attribute("p50#val");
+    Attribute attr_p99 = db.get_attribute("p99#val");
+
+    ASSERT_NE(attr_p50, Attribute::invalid);
+    ASSERT_NE(attr_p99, Attribute::invalid);
+
+    std::vector<EntryList> resdb;
+
+    a.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) {
+            resdb.push_back(list);
+        });
+
+    ASSERT_EQ(resdb.size(), 1);
+
+    auto dict = make_dict_from_entrylist(resdb.front());
+
+    // 1..1000 does not fit into 64 bins at 1% accuracy, so the sketch
+    // collapses a few times; the relative error stays bounded nonetheless
+
+    EXPECT_NEAR(dict[attr_p50.id()].value().to_double(), 500.5, 500.5 * 0.1);
+    EXPECT_NEAR(dict[attr_p99.id()].value().to_double(), 990.0, 990.0 * 0.1);
+}
+
+TEST(AggregatorTest, CountDistinctKernel) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx =
+        db.create_attribute("ctx", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    Attribute val_attr =
+        db.create_attribute("val", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    const Node* node = db.merge_node(100, ctx.id(), CALI_INV_ID, Variant(1), idmap);
+
+    QuerySpec spec;
+
+    spec.aggregation_key.selection = QuerySpec::SelectionList<std::string>::Default;
+
+    spec.aggregation_ops.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregation_ops.list.push_back(::make_op("count_distinct", "val"));
+    spec.aggregation_ops.list.push_back(::make_op("count_distinct", "ctx"));
+
+    // 0..29 in a, 20..49 in b: 50 distinct values overall
+
+    Aggregator a(spec), b(spec);
+
+    cali_id_t node_id = node->id();
+    cali_id_t val_id  = val_attr.id();
+
+    for (int i = 0; i < 30; ++i) {
+        Variant va(i), vb(i + 20);
+
+        a.add(db, db.merge_snapshot(1, &node_id, 1, &val_id, &va, idmap));
+        b.add(db, db.merge_snapshot(1, &node_id, 1, &val_id, &vb, idmap));
+    }
+
+    b.flush(db, a);
+
+    Attribute attr_val = db.get_attribute("count_distinct#val");
+    Attribute attr_ctx = db.get_attribute("count_distinct#ctx");
+
+    ASSERT_NE(attr_val, Attribute::invalid);
+    ASSERT_NE(attr_ctx, Attribute::invalid);
+
+    std::vector<EntryList> resdb;
+
+    a.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) {
+            resdb.push_back(list);
+        });
+
+    ASSERT_EQ(resdb.size(), 1);
+
+    auto dict = make_dict_from_entrylist(resdb.front());
+
+    EXPECT_NEAR(static_cast<double>(dict[attr_val.id()].value().to_uint()), 50.0, 5.0);
+    EXPECT_EQ(dict[attr_ctx.id()].value().to_uint(), 1);
+}
+
+TEST(AggregatorTest, MergeKernel) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx =
+        db.create_attribute("ctx", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    Attribute count_attr =
+        db.create_attribute("aggregate.count", CALI_TYPE_UINT, CALI_ATTR_ASVALUE);
+    Attribute sum_attr =
+        db.create_attribute("sum#t", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+    Attribute min_attr =
+        db.create_attribute("min#t", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+    Attribute max_attr =
+        db.create_attribute("max#t", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+    Attribute avg_attr =
+        db.create_attribute("avg#t", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+    Attribute other_attr =
+        db.create_attribute("t", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    const Node* node = db.merge_node(100, ctx.id(), CALI_INV_ID, Variant(1), idmap);
+
+    QuerySpec spec;
+
+    spec.aggregation_key.selection = QuerySpec::SelectionList<std::string>::Default;
+
+    spec.aggregation_ops.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregation_ops.list.push_back(::make_op("merge"));
+
+    // two aggregated profiles of the same region: 1 x 2.0 and 3 x { 1.0, 4.0, 4.0 }
+
+    Aggregator a(spec), b(spec);
+
+    cali_id_t node_id = node->id();
+    cali_id_t ids[6]  = {
+        count_attr.id(), sum_attr.id(), min_attr.id(), max_attr.id(), avg_attr.id(), other_attr.id()
+    };
+
+    Variant va[6] = { Variant(static_cast<uint64_t>(1)), Variant(2.0), Variant(2.0), Variant(2.0), Variant(2.0), Variant(8.0) };
+    Variant vb[6] = { Variant(static_cast<uint64_t>(3)), Variant(9.0), Variant(1.0), Variant(4.0), Variant(3.0), Variant(8.0) };
+
+    a.add(db, db.merge_snapshot(1, &node_id, 6, ids, va, idmap));
+    b.add(db, db.merge_snapshot(1, &node_id, 6, ids, vb, idmap));
+
+    b.flush(db, a);
+
+    std::vector<EntryList> resdb;
+
+    a.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) {
+            resdb.push_back(list);
+        });
+
+    ASSERT_EQ(resdb.size(), 1);
+
+    auto dict = make_dict_from_entrylist(resdb.front());
+
+    EXPECT_EQ(dict[count_attr.id()].value().to_uint(), 4);
+    EXPECT_DOUBLE_EQ(dict[sum_attr.id()].value().to_double(), 11.0);
+    EXPECT_DOUBLE_EQ(dict[min_attr.id()].value().to_double(),  1.0);
+    EXPECT_DOUBLE_EQ(dict[max_attr.id()].value().to_double(),  4.0);
+    EXPECT_DOUBLE_EQ(dict[avg_attr.id()].value().to_double(), 11.0 / 4.0);
+    EXPECT_EQ(dict.count(other_attr.id()), 0);
+}
+
+TEST(AggregatorTest, MemoryLimitSpill) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx =
+        db.create_attribute("ctx", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    Attribute key_attr =
+        db.create_attribute("key", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+    Attribute label_attr =
+        db.create_attribute("label", CALI_TYPE_STRING, CALI_ATTR_ASVALUE);
+    Attribute val_attr =
+        db.create_attribute("val", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    db.merge_node(100, ctx.id(), CALI_INV_ID, Variant(1), idmap);
+
+    QuerySpec spec;
+
+    spec.aggregation_key.selection = QuerySpec::SelectionList<std::string>::List;
+    spec.aggregation_key.list.push_back("ctx");
+    spec.aggregation_key.list.push_back("key");
+    spec.aggregation_key.list.push_back("label");
+
+    spec.aggregation_ops.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregation_ops.list.push_back(::make_op("count"));
+    spec.aggregation_ops.list.push_back(::make_op("statistics", "val"));
+
+    Aggregator a(spec);
+
+    a.set_memory_limit(64 * 1024);
+
+    const int   nkeys = 20000;
+    const char* labels[] = { "a", "bb", "a long label without padding" };
+
+    // add each key three times with a different value; some keys end up
+    // both in memory and in spill files
+    for (int r = 0; r < 3; ++r)
+        for (int k = 0; k < nkeys; ++k) {
+            cali_id_t   node_id = 100;
+            cali_id_t   ids[3]  = { key_attr.id(), label_attr.id(), val_attr.id() };
+            const char* label   = labels[k % 3];
+            Variant     data[3] = {
+                Variant(k), Variant(CALI_TYPE_STRING, label, strlen(label)), Variant(static_cast<double>(r+1))
+            };
+
+            a.add(db, db.merge_snapshot(1, &node_id, 3, ids, data, idmap));
+        }
+
+    std::vector<EntryList> resdb;
+
+    a.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) {
+            resdb.push_back(list);
+        });
+
+    Attribute attr_count = db.get_attribute("count");
+    Attribute attr_min   = db.get_attribute("min#val");
+    Attribute attr_max   = db.get_attribute("max#val");
+
+    ASSERT_NE(attr_count, Attribute::invalid);
+    ASSERT_NE(attr_min,   Attribute::invalid);
+    ASSERT_NE(attr_max,   Attribute::invalid);
+    ASSERT_EQ(resdb.size(), static_cast<size_t>(nkeys));
+
+    std::vector<int> counts(nkeys, 0);
+
+    for (const EntryList& list : resdb) {
+        auto dict = make_dict_from_entrylist(list);
+
+        int k = dict[key_attr.id()].value().to_int();
+
+        ASSERT_GE(k, 0);
+        ASSERT_LT(k, nkeys);
+
+        EXPECT_EQ(dict[label_attr.id()].value().to_string(), std::string(labels[k % 3])) << "key " << k;
+        EXPECT_DOUBLE_EQ(dict[attr_min.id()].value().to_double(), 1.0) << "key " << k;
+        EXPECT_DOUBLE_EQ(dict[attr_max.id()].value().to_double(), 3.0) << "key " << k;
+
+        counts[k] += static_cast<int>(dict[attr_count.id()].value().to_uint());
+    }
+
+    for (int k = 0; k < nkeys; ++k)
+        EXPECT_EQ(counts[k], 3) << "key " << k;
+}
@@ -0,0 +1,132 @@
+#include "caliper/reader/ArrowFormatter.h"
+
+#include "caliper/reader/CaliperMetadataDB.h"
+#include "caliper/reader/QuerySpec.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <sstream>
+#include <string>
+
+using namespace cali;
+
+namespace
+{
+
+QuerySpec
+make_spec()
+{
+    QuerySpec spec;
+
+    spec.aggregation_ops.selection = QuerySpec::AggregationSelection::None;
+    spec.aggregation_key.selection = QuerySpec::AttributeSelection::None;
+    spec.filter.selection          = QuerySpec::FilterSelection::None;
+    spec.sort.selection            = QuerySpec::SortSelection::None;
+
+    spec.attribute_selection.selection = QuerySpec::AttributeSelection::List;
+    spec.attribute_selection.list.push_back("path");
+    spec.attribute_selection.list.push_back("val");
+
+    spec.format.opt = QuerySpec::FormatSpec::User;
+
+    return spec;
+}
+
+template<typename T>
+T read_at(const std::string& buf, size_t pos)
+{
+    T val;
+    std::memcpy(&val, buf.data() + pos, sizeof(T));
+    return val;
+}
+
+} // namespace
+
+TEST(ArrowFormatterTest, FileLayout) {
+    CaliperMetadataDB db;
+
+    Attribute path_attr =
+        db.create_attribute("path", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute val_attr =
+        db.create_attribute("val",  CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    IdMap idmap;
+
+    const Node* a  = db.merge_node(100, path_attr.id(), CALI_INV_ID, Variant(CALI_TYPE_STRING, "a", 1), idmap);
+    const Node* ab = db.merge_node(101, path_attr.id(), 100,         Variant(CALI_TYPE_STRING, "b", 1), idmap);
+
+    ArrowFormatter fmt(make_spec());
+
+    fmt.process_record(db, EntryList { Entry(ab), Entry(val_attr, Variant(1.5)) });
+    fmt.process_record(db, EntryList { Entry(a) });
+    fmt.process_record(db, EntryList { Entry(ab), Entry(val_attr, Variant(4.0)) });
+
+    std::ostringstream os;
+    fmt.flush(db, os);
+
+    std::string buf = os.str();
+
+    ASSERT_GT(buf.size(), 32u);
+
+    EXPECT_EQ(buf.substr(0, 6), std::string("ARROW1"));
+    EXPECT_EQ(buf.substr(buf.size() - 6), std::string("ARROW1"));
+
+    // footer length is right before the trailing magic, preceded by
+    // the end-of-stream marker
+
+    int32_t footer_len = read_at<int32_t>(buf, buf.size() - 10);
+
+    ASSERT_GT(footer_len, 0);
+    ASSERT_LT(static_cast<size_t>(footer_len) + 18, buf.size());
+
+    size_t eos = buf.size() - 10 - footer_len - 8;
+
+    EXPECT_EQ(read_at<uint32_t>(buf, eos), 0xFFFFFFFF);
+    EXPECT_EQ(read_at<int32_t>(buf, eos + 4), 0);
+
+    // walk the encapsulated messages: schema, one dictionary, one record batch
+
+    size_t pos = 8;
+    int    nmsg = 0;
+
+    while (pos < eos) {
+        ASSERT_EQ(pos % 8, 0u);
+        ASSERT_EQ(read_at<uint32_t>(buf, pos), 0xFFFFFFFF);
+
+        int32_t meta_len = read_at<int32_t>(buf, pos + 4);
+
+        ASSERT_GT(meta_len, 0);
+        ASSERT_EQ(meta_len % 8, 0);
+
+        // Message table: root offset, soffset to vtable, bodyLength in slot 3
+        size_t   meta    = pos + 8;
+        size_t   table   = meta + read_at<uint32_t>(buf, meta);
+        size_t   vtable  = table - read_at<int32_t>(buf, table);
+        uint16_t vt_size = read_at<uint16_t>(buf, vtable);
+
+        ASSERT_GE(vt_size, 4 + 2*4);
+
+        uint16_t body_field = read_at<uint16_t>(buf, vtable + 4 + 2*3);
+        int64_t  body_len   = read_at<int64_t>(buf, table + body_field);
+
+        EXPECT_EQ(body_len % 8, 0);
+
+        pos += 8 + meta_len + body_len;
+        ++nmsg;
+    }
+
+    EXPECT_EQ(pos, eos);
+    EXPECT_EQ(nmsg, 3);
+
+    // the double column values are in the record batch body
+
+    double vals[3] = { 1.5, 0.0, 4.0 };
+    std::string valstr(reinterpret_cast<const char*>(vals), sizeof(vals));
+
+    EXPECT_NE(buf.find(valstr), std::string::npos);
+
+    // the dictionary holds the joined paths
+
+    EXPECT_NE(buf.find("a/ba"), std::string::npos);
+}
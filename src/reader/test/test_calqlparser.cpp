@@ -160,6 +160,32 @@ TEST(CalQLParserTest, GroupByClause) {
     EXPECT_EQ(q1.aggregation_key.list[2], "ccc");
 }
 
+TEST(CalQLParserTest, GroupByPrefix) {
+    CalQLParser p1("GROUP BY aa, prefix(function, 3), b");
+
+    EXPECT_FALSE(p1.error()) << "Unexpected parse error: " << p1.error_msg();
+
+    QuerySpec q1 = p1.spec();
+
+    ASSERT_EQ(q1.aggregation_key.list.size(), 3);
+
+    EXPECT_EQ(q1.aggregation_key.list[0], "aa");
+    EXPECT_EQ(q1.aggregation_key.list[1], "function");
+    EXPECT_EQ(q1.aggregation_key.list[2], "b");
+
+    ASSERT_EQ(q1.aggregation_key_depth.size(), 1);
+    EXPECT_EQ(q1.aggregation_key_depth["function"], 3);
+
+    CalQLParser p2("group by prefix(function)");
+    EXPECT_TRUE(p2.error());
+
+    CalQLParser p3("group by prefix(function,0)");
+    EXPECT_TRUE(p3.error());
+
+    CalQLParser p4("group by sum(function,2)");
+    EXPECT_TRUE(p4.error());
+}
+
 TEST(CalQLParserTest, OrderByClause1) {
     CalQLParser p1("Order By aa, b desc , c   asc, ddd ");
 
@@ -364,3 +390,55 @@ TEST(CalQLParserTest, FullStatement) {
     EXPECT_EQ(q4.filter.selection, QuerySpec::FilterSelection::None);
     EXPECT_EQ(q4.format.opt, QuerySpec::FormatSpec::User);    
 }
+
+TEST(CalQLParserTest, LetClause) {
+    CalQLParser p1("LET ipc = inst / cyc, x = -(a + 2.5)*b - 1e-3 SELECT ipc,x");
+
+    EXPECT_FALSE(p1.error()) << "Unexpected parse error: " << p1.error_msg();
+
+    QuerySpec q1 = p1.spec();
+
+    EXPECT_EQ(q1.derived.selection, QuerySpec::DerivationSelection::List);
+    ASSERT_EQ(q1.derived.list.size(), 2);
+
+    const QuerySpec::Derivation& d1 = q1.derived.list[0];
+
+    EXPECT_EQ(d1.name, "ipc");
+    ASSERT_EQ(d1.ops.size(), 3);
+    EXPECT_EQ(d1.ops[0].op, QuerySpec::ExpressionOp::Operand);
+    EXPECT_EQ(d1.ops[0].attr_name, "inst");
+    EXPECT_EQ(d1.ops[1].op, QuerySpec::ExpressionOp::Operand);
+    EXPECT_EQ(d1.ops[1].attr_name, "cyc");
+    EXPECT_EQ(d1.ops[2].op, QuerySpec::ExpressionOp::Div);
+
+    // postfix: a 2.5 + neg b * 1e-3 -
+    const QuerySpec::Derivation& d2 = q1.derived.list[1];
+
+    EXPECT_EQ(d2.name, "x");
+    ASSERT_EQ(d2.ops.size(), 8);
+    EXPECT_EQ(d2.ops[0].attr_name, "a");
+    EXPECT_EQ(d2.ops[1].op, QuerySpec::ExpressionOp::Constant);
+    EXPECT_DOUBLE_EQ(d2.ops[1].value, 2.5);
+    EXPECT_EQ(d2.ops[2].op, QuerySpec::ExpressionOp::Add);
+    EXPECT_EQ(d2.ops[3].op, QuerySpec::ExpressionOp::Neg);
+    EXPECT_EQ(d2.ops[4].attr_name, "b");
+    EXPECT_EQ(d2.ops[5].op, QuerySpec::ExpressionOp::Mul);
+    EXPECT_EQ(d2.ops[6].op, QuerySpec::ExpressionOp::Constant);
+    EXPECT_DOUBLE_EQ(d2.ops[6].value, 1e-3);
+    EXPECT_EQ(d2.ops[7].op, QuerySpec::ExpressionOp::Sub);
+
+    ASSERT_EQ(q1.attribute_selection.list.size(), 2);
+    EXPECT_EQ(q1.attribute_selection.list[0], "ipc");
+
+    CalQLParser p2("LET a = (b + c");
+    EXPECT_TRUE(p2.error());
+
+    CalQLParser p3("LET a b");
+    EXPECT_TRUE(p3.error());
+
+    CalQLParser p4("LET a = b c");
+    EXPECT_TRUE(p4.error());
+
+    CalQLParser p5("select x");
+    EXPECT_EQ(p5.spec().derived.selection, QuerySpec::DerivationSelection::None);
+}
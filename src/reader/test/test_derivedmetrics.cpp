@@ -0,0 +1,99 @@
+#include "caliper/reader/DerivedMetrics.h"
+
+#include "caliper/reader/CalQLParser.h"
+#include "caliper/reader/CaliperMetadataDB.h"
+
+#include "caliper/common/Node.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+using namespace cali;
+
+namespace
+{
+
+bool
+get_value(const EntryList& list, const Attribute& attr, double& val)
+{
+    for (const Entry& e : list)
+        if (e.attribute() == attr.id()) {
+            val = e.value().to_double();
+            return true;
+        }
+
+    return false;
+}
+
+}
+
+TEST(DerivedMetricsTest, Arithmetic) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx_attr =
+        db.create_attribute("ctx", CALI_TYPE_INT,  CALI_ATTR_DEFAULT);
+    Attribute a_attr =
+        db.create_attribute("a",   CALI_TYPE_INT,  CALI_ATTR_ASVALUE);
+    Attribute b_attr =
+        db.create_attribute("b",   CALI_TYPE_UINT, CALI_ATTR_ASVALUE);
+
+    const Node* node = db.merge_node(100, ctx_attr.id(), CALI_INV_ID, Variant(4), idmap);
+
+    std::vector<EntryList> records(3);
+
+    // { ctx=4, a=6, b=3 }, { ctx=4, a=1, b=0 }, { a=2 }
+    records[0] = { Entry(node), Entry(a_attr, Variant(6)), Entry(b_attr, Variant(3)) };
+    records[1] = { Entry(node), Entry(a_attr, Variant(1)), Entry(b_attr, Variant(0)) };
+    records[2] = { Entry(a_attr, Variant(2)) };
+
+    CalQLParser p("LET r = a / b, s = -(r + ctx) * 2, t = a - 1");
+
+    ASSERT_FALSE(p.error()) << "Parse error: " << p.error_msg();
+
+    DerivedMetrics derived(p.spec());
+
+    EXPECT_FALSE(derived.empty());
+
+    derived.process(db, records);
+
+    Attribute r_attr = db.get_attribute("r");
+    Attribute s_attr = db.get_attribute("s");
+    Attribute t_attr = db.get_attribute("t");
+
+    ASSERT_NE(r_attr, Attribute::invalid);
+    ASSERT_NE(s_attr, Attribute::invalid);
+    ASSERT_NE(t_attr, Attribute::invalid);
+
+    EXPECT_EQ(r_attr.type(), CALI_TYPE_DOUBLE);
+
+    double val = 0.0;
+
+    ASSERT_TRUE(get_value(records[0], r_attr, val));
+    EXPECT_DOUBLE_EQ(val, 2.0);
+    ASSERT_TRUE(get_value(records[0], s_attr, val));
+    EXPECT_DOUBLE_EQ(val, -12.0);
+    ASSERT_TRUE(get_value(records[0], t_attr, val));
+    EXPECT_DOUBLE_EQ(val, 5.0);
+
+    // division by zero: no r or s
+    EXPECT_FALSE(get_value(records[1], r_attr, val));
+    EXPECT_FALSE(get_value(records[1], s_attr, val));
+    ASSERT_TRUE(get_value(records[1], t_attr, val));
+    EXPECT_DOUBLE_EQ(val, 0.0);
+
+    // missing b and ctx
+    EXPECT_FALSE(get_value(records[2], r_attr, val));
+    EXPECT_FALSE(get_value(records[2], s_attr, val));
+    ASSERT_TRUE(get_value(records[2], t_attr, val));
+    EXPECT_DOUBLE_EQ(val, 1.0);
+}
+
+TEST(DerivedMetricsTest, Empty) {
+    CalQLParser p("SELECT a");
+
+    DerivedMetrics derived(p.spec());
+
+    EXPECT_TRUE(derived.empty());
+}
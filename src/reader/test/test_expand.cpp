@@ -0,0 +1,103 @@
+#include "caliper/reader/Expand.h"
+
+#include "caliper/reader/CaliperMetadataDB.h"
+
+#include "caliper/common/OutputStream.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+using namespace cali;
+
+TEST(ExpandTest, ExpandRecords) {
+    CaliperMetadataDB db;
+    IdMap idmap;
+
+    Attribute str_attr = db.create_attribute("str", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute oth_attr = db.create_attribute("oth", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute val_attr = db.create_attribute("val", CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+
+    const Node* a   = db.merge_node(100, str_attr.id(), CALI_INV_ID, Variant(CALI_TYPE_STRING, "a", 1), idmap);
+    const Node* ax  = db.merge_node(101, oth_attr.id(), 100,         Variant(CALI_TYPE_STRING, "x", 1), idmap);
+    const Node* axb = db.merge_node(102, str_attr.id(), 101,         Variant(CALI_TYPE_STRING, "b", 1), idmap);
+
+    std::ostringstream sstr;
+    OutputStream stream;
+    stream.set_stream(&sstr);
+
+    Expand exp(stream, "");
+
+    // print each record twice to check the cached expansion
+    for (int i = 0; i < 2; ++i) {
+        exp.process_record(db, EntryList { Entry(axb), Entry(val_attr, Variant(42)) });
+        exp.process_record(db, EntryList { Entry(a) });
+    }
+
+    EXPECT_EQ(sstr.str(),
+              "oth=x,str=a/b,val=42\n"
+              "str=a\n"
+              "oth=x,str=a/b,val=42\n"
+              "str=a\n");
+}
+
+TEST(ExpandTest, SelectAttributes) {
+    CaliperMetadataDB db;
+    IdMap idmap;
+
+    Attribute str_attr = db.create_attribute("str", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute oth_attr = db.create_attribute("oth", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute val_attr = db.create_attribute("val", CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+
+    const Node* a   = db.merge_node(100, str_attr.id(), CALI_INV_ID, Variant(CALI_TYPE_STRING, "a", 1), idmap);
+    const Node* ax  = db.merge_node(101, oth_attr.id(), 100,         Variant(CALI_TYPE_STRING, "x", 1), idmap);
+
+    std::ostringstream sstr;
+    OutputStream stream;
+    stream.set_stream(&sstr);
+
+    Expand exp(stream, "-str");
+
+    exp.process_record(db, EntryList { Entry(ax), Entry(val_attr, Variant(42)) });
+    exp.process_record(db, EntryList { Entry(a) }); // nothing left to print
+
+    EXPECT_EQ(sstr.str(), "oth=x,val=42\n");
+}
+
+TEST(ExpandTest, ProcessRecordBatch) {
+    CaliperMetadataDB db;
+    IdMap idmap;
+
+    Attribute str_attr = db.create_attribute("str", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute val_attr = db.create_attribute("val", CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+
+    const Node* a   = db.merge_node(100, str_attr.id(), CALI_INV_ID, Variant(CALI_TYPE_STRING, "a", 1), idmap);
+
+    // large enough to be formatted on multiple threads
+    std::vector<EntryList> records;
+
+    for (int i = 0; i < 50000; ++i)
+        if (i % 3 == 0)
+            records.push_back(EntryList { Entry(a) });
+        else
+            records.push_back(EntryList { Entry(val_attr, Variant(i)) });
+
+    std::ostringstream batch_sstr;
+    OutputStream batch_stream;
+    batch_stream.set_stream(&batch_sstr);
+
+    Expand batch_exp(batch_stream, "");
+
+    batch_exp.process_records(db, records);
+
+    std::ostringstream sstr;
+    OutputStream stream;
+    stream.set_stream(&sstr);
+
+    Expand exp(stream, "");
+
+    for (const EntryList& rec : records)
+        exp.process_record(db, rec);
+
+    EXPECT_EQ(batch_sstr.str(), sstr.str());
+}
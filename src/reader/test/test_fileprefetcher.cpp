@@ -0,0 +1,143 @@
+#include "caliper/reader/FilePrefetcher.h"
+
+#include "caliper/reader/CaliperMetadataDB.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace cali;
+
+namespace
+{
+
+// Writes a .cali file with num_records "iteration" records
+std::string
+write_test_file(int num_records)
+{
+    char filename[] = "/tmp/caliper-test-fileprefetcher-XXXXXX";
+    int fd = mkstemp(filename);
+
+    if (fd < 0)
+        return std::string();
+
+    close(fd);
+
+    std::ofstream f(filename);
+
+    f << "__rec=node,attr=10,data=1,id=100,parent=1\n"
+      << "__rec=node,attr=8,data=iteration,id=101,parent=100\n";
+
+    for (int i = 0; i < num_records; ++i)
+        f << "__rec=ctx,attr=101,data=" << i << "\n";
+
+    return std::string(filename);
+}
+
+} // namespace [anonymous]
+
+TEST(FilePrefetcherTest, ReadBuffers) {
+    std::vector<std::string> files;
+
+    for (int i = 0; i < 6; ++i) {
+        files.push_back(write_test_file(10 * (i+1)));
+        ASSERT_FALSE(files.back().empty());
+    }
+
+    files.push_back("/tmp/caliper-test-fileprefetcher-does-not-exist");
+
+    std::vector<int> counts;
+
+    {
+        FilePrefetcher prefetcher(files, 2, 3);
+
+        // give the loaders a head start
+        usleep(20000);
+
+        for (size_t i = 0; i < files.size(); ++i) {
+            CaliperMetadataDB    db;
+            int                  count = 0;
+            FilePrefetcher::Buffer buf = prefetcher.take(i);
+
+            auto node_fn = [](CaliperMetadataAccessInterface&, const Node*) { };
+            auto snap_fn = [&count](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+                    Attribute iter_attr = db.get_attribute("iteration");
+                    int64_t   iter = -1;
+                    for (const Entry& e : rec)
+                        if (e.attribute() == iter_attr.id())
+                            iter = e.value().to_int();
+                    EXPECT_EQ(iter, count);
+                    ++count;
+                };
+
+            bool ok = buf ?
+                db.read(files[i], buf->data(), buf->size(), node_fn, snap_fn) :
+                db.read(files[i], node_fn, snap_fn);
+
+            EXPECT_EQ(ok, i < 6) << "file " << i;
+
+            // each file can be taken only once
+            EXPECT_FALSE(prefetcher.take(i));
+
+            counts.push_back(count);
+        }
+
+        EXPECT_GE(prefetcher.num_prefetched(), 1u);
+        EXPECT_LE(prefetcher.num_prefetched(), 6u);
+    }
+
+    for (int i = 0; i < 6; ++i)
+        EXPECT_EQ(counts[i], 10 * (i+1)) << "file " << i;
+
+    for (int i = 0; i < 6; ++i)
+        unlink(files[i].c_str());
+}
+
+TEST(FilePrefetcherTest, MaxFileSize) {
+    std::vector<std::string> files { write_test_file(100), write_test_file(1) };
+
+    {
+        FilePrefetcher prefetcher(files, 1, 4, 128);
+
+        usleep(20000);
+
+        // the first file is too large and not prefetched (whether or not
+        // the loader has gotten to it already)
+        EXPECT_FALSE(prefetcher.take(0));
+
+        FilePrefetcher::Buffer buf = prefetcher.take(1);
+
+        if (buf) {
+            CaliperMetadataDB db;
+            int count = 0;
+
+            EXPECT_TRUE(db.read(files[1], buf->data(), buf->size(),
+                                [](CaliperMetadataAccessInterface&, const Node*) { },
+                                [&count](CaliperMetadataAccessInterface&, const EntryList&) { ++count; }));
+            EXPECT_EQ(count, 1);
+        }
+    }
+
+    for (const std::string& f : files)
+        unlink(f.c_str());
+}
+
+TEST(FilePrefetcherTest, EarlyExit) {
+    std::vector<std::string> files;
+
+    for (int i = 0; i < 8; ++i)
+        files.push_back(write_test_file(10));
+
+    {
+        // destroying the prefetcher with loaded and pending files must not block
+        FilePrefetcher prefetcher(files, 2, 2);
+        prefetcher.take(0);
+    }
+
+    for (const std::string& f : files)
+        unlink(f.c_str());
+}
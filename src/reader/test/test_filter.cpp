@@ -372,3 +372,42 @@ TEST(RecordFilterTest, TestEqual) {
         }
     }
 }
+
+TEST(RecordFilterTest, TestLateAttribute) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx1 =
+        db.create_attribute("ctx.1", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+
+    db.merge_node(100, ctx1.id(), CALI_INV_ID, Variant(CALI_TYPE_STRING, "outer", 5), idmap);
+
+    cali_id_t node_outer = 100;
+
+    QuerySpec spec;
+
+    spec.filter.selection = QuerySpec::FilterSelection::List;
+    spec.filter.list.push_back(QuerySpec::Condition { QuerySpec::Condition::Op::Equal, "ctx.2", "42" });
+
+    RecordSelector filter(spec);
+
+    // ctx.2 doesn't exist yet
+    EXPECT_FALSE(filter.pass(db, db.merge_snapshot(1, &node_outer, 0, nullptr, nullptr, idmap)));
+
+    Attribute ctx2 =
+        db.create_attribute("ctx.2", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+
+    db.merge_node(101, ctx2.id(), 100, Variant(42), idmap);
+    db.merge_node(102, ctx1.id(), 101, Variant(CALI_TYPE_STRING, "inner", 5), idmap);
+    db.merge_node(103, ctx2.id(), 100, Variant(43), idmap);
+
+    cali_id_t node_inner = 102;
+    cali_id_t node_43    = 103;
+
+    // repeat to use memoized node results
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_TRUE (filter.pass(db, db.merge_snapshot(1, &node_inner, 0, nullptr, nullptr, idmap)));
+        EXPECT_FALSE(filter.pass(db, db.merge_snapshot(1, &node_outer, 0, nullptr, nullptr, idmap)));
+        EXPECT_FALSE(filter.pass(db, db.merge_snapshot(1, &node_43,    0, nullptr, nullptr, idmap)));
+    }
+}
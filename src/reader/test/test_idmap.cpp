@@ -0,0 +1,61 @@
+#include "caliper/reader/IdMap.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+
+using namespace cali;
+
+TEST(IdMapTest, DenseAndSparse) {
+    IdMap idmap;
+
+    EXPECT_TRUE(idmap.empty());
+    EXPECT_EQ(idmap.find(11), CALI_INV_ID);
+
+    for (cali_id_t id = 11; id < 10000; ++id)
+        EXPECT_TRUE(idmap.insert(id, 2 * id));
+
+    // far beyond the dense range
+    EXPECT_TRUE(idmap.insert(1000000000ull, 1));
+    EXPECT_TRUE(idmap.insert(CALI_INV_ID - 1, 2));
+
+    EXPECT_FALSE(idmap.insert(42, 0));
+    EXPECT_FALSE(idmap.insert(1000000000ull, 0));
+
+    EXPECT_EQ(idmap.size(), 10000u - 11 + 2);
+
+    for (cali_id_t id = 11; id < 10000; ++id)
+        EXPECT_EQ(idmap.find(id), 2 * id);
+
+    EXPECT_EQ(idmap.find(10), CALI_INV_ID);
+    EXPECT_EQ(idmap.find(10000), CALI_INV_ID);
+    EXPECT_EQ(idmap.find(1000000000ull), 1u);
+    EXPECT_EQ(idmap.find(CALI_INV_ID - 1), 2u);
+    EXPECT_EQ(idmap.find(CALI_INV_ID), CALI_INV_ID);
+
+    idmap.clear();
+
+    EXPECT_TRUE(idmap.empty());
+    EXPECT_EQ(idmap.find(42), CALI_INV_ID);
+}
+
+TEST(IdMapTest, RandomIds) {
+    std::mt19937 rgen(4711);
+    std::uniform_int_distribution<cali_id_t> dist(0, 1 << 20);
+
+    IdMap idmap;
+    std::map<cali_id_t, cali_id_t> ref;
+
+    for (int i = 0; i < 20000; ++i) {
+        cali_id_t from = dist(rgen);
+        cali_id_t to   = static_cast<cali_id_t>(i);
+
+        EXPECT_EQ(idmap.insert(from, to), ref.insert(std::make_pair(from, to)).second);
+    }
+
+    EXPECT_EQ(idmap.size(), ref.size());
+
+    for (const auto &p : ref)
+        EXPECT_EQ(idmap.find(p.first), p.second);
+}
@@ -1,9 +1,27 @@
 #include "caliper/reader/CaliperMetadataDB.h"
 
+#include "caliper/reader/CalQLParser.h"
+
 #include "caliper/common/Node.h"
+#include "caliper/common/OutputStream.h"
+
+#include "caliper/common/binary/BinaryReader.h"
+#include "caliper/common/binary/BinaryWriter.h"
+#include "caliper/common/binary/RankContainerWriter.h"
+
+#include "caliper/common/csv/CsvWriter.h"
 
 #include <gtest/gtest.h>
 
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
 using namespace cali;
 
 TEST(MetaDBTest, MergeSnapshotFromDB) {
@@ -57,6 +75,90 @@ TEST(MetaDBTest, MergeSnapshotFromDB) {
     EXPECT_NE(b_out, b_in);
 }
 
+TEST(MetaDBTest, ConcurrentMergeNode) {
+    CaliperMetadataDB db;
+
+    Attribute str_attr =
+        db.create_attribute("str.attr", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute int_attr =
+        db.create_attribute("int.attr", CALI_TYPE_INT,    CALI_ATTR_DEFAULT);
+
+    const char* strings[] = { "a", "b", "c", "d" };
+
+    const int num_threads = 8;
+    const int num_nodes   = 1000;
+
+    // each "rank file" has the same tree with different stream node IDs
+    std::vector< std::vector<const Node*> > results(num_threads);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back([&,t](){
+                IdMap idmap;
+                cali_id_t base = 1000 + t * 10 * num_nodes;
+
+                for (int i = 0; i < num_nodes; ++i) {
+                    cali_id_t parent = (i == 0 ? CALI_INV_ID : base + (i-1)/2 + 1);
+                    const Node* node = nullptr;
+
+                    if (i % 2)
+                        node = db.merge_node(base + i + 1, str_attr.id(), parent,
+                                             Variant(CALI_TYPE_STRING, strings[i%4], 2), idmap);
+                    else
+                        node = db.merge_node(base + i + 1, int_attr.id(), parent, Variant(i), idmap);
+
+                    results[t].push_back(node);
+                }
+            });
+
+    for (auto& t : threads)
+        t.join();
+
+    for (int t = 1; t < num_threads; ++t)
+        for (int i = 0; i < num_nodes; ++i) {
+            ASSERT_NE(results[t][i], nullptr);
+            EXPECT_EQ(results[t][i], results[0][i]) << "thread " << t << " node " << i;
+        }
+
+    for (int i = 1; i < num_nodes; ++i)
+        EXPECT_EQ(results[0][i]->parent(), results[0][(i-1)/2]);
+}
+
+TEST(MetaDBTest, InternedTreeEntries) {
+    CaliperMetadataDB db;
+
+    Attribute str_attr =
+        db.create_attribute("str.attr", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+
+    // make_tree_entry() with strings from temporary buffers must find the
+    // same nodes as merge_node(), and must not keep the caller's pointers
+
+    std::string name = "a.region.name";
+    Node        tmp_node(1000, str_attr.id(), Variant(CALI_TYPE_STRING, name.data(), name.size()));
+    const Node* nodelist[1] = { &tmp_node };
+
+    Node* n1 = db.make_tree_entry(1, nodelist);
+
+    ASSERT_NE(n1, nullptr);
+    EXPECT_NE(n1->data().data(), static_cast<const void*>(name.data()));
+
+    std::string copy = name;
+    Variant     v_copy(CALI_TYPE_STRING, copy.data(), copy.size());
+    Node        tmp_copy(1001, str_attr.id(), v_copy);
+
+    nodelist[0] = &tmp_copy;
+
+    EXPECT_EQ(db.make_tree_entry(1, nodelist), n1);
+
+    IdMap idmap;
+    const Node* n2 = db.merge_node(100, str_attr.id(), CALI_INV_ID, v_copy, idmap);
+
+    EXPECT_EQ(n2, n1);
+
+    name.assign(name.size(), 'x');
+    EXPECT_EQ(n1->data().to_string(), std::string("a.region.name"));
+}
+
 namespace
 {
 
@@ -112,3 +214,387 @@ TEST(MetaDBTest, SetGlobal) {
     EXPECT_EQ(count_in_record(globals, g_val_attr, v_val  ), 1);
     EXPECT_EQ(count_in_record(globals, no_g_attr,  v_no   ), 0);
 }
+
+TEST(MetaDBTest, ReadFromGrowingFile) {
+    char filename[] = "/tmp/caliper-test-metadb-XXXXXX";
+    int  fd = mkstemp(filename);
+
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    // "val" attribute: ASVALUE property (1), type INT (type node 2)
+    const std::string part1 =
+        "__rec=node,attr=10,data=1,id=100,parent=2\n"
+        "__rec=node,attr=8,data=val,id=101,parent=100\n"
+        "__rec=ctx,attr=101,data=1\n"
+        "__rec=ctx,attr=1";
+    const std::string part2 =
+        "01,data=2\n"
+        "__rec=ctx,attr=101,data=3\n";
+
+    CaliperMetadataDB db;
+    IdMap             idmap;
+    std::size_t       offset = 0;
+    std::vector<int>  values;
+
+    auto node_fn = [](CaliperMetadataAccessInterface&, const Node*) { };
+    auto snap_fn = [&values](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+        for (const Entry& e : rec)
+            if (e.attribute() == db.get_attribute("val").id())
+                values.push_back(e.value().to_int());
+    };
+
+    {
+        std::ofstream f(filename, std::ios::app);
+        f << part1;
+    }
+
+    // the last record is incomplete and must be skipped
+    EXPECT_TRUE(db.read_from(filename, offset, idmap, node_fn, snap_fn));
+    ASSERT_EQ(values.size(), 1u);
+    EXPECT_EQ(values[0], 1);
+    EXPECT_EQ(offset, part1.size() - std::string("__rec=ctx,attr=1").size());
+
+    {
+        std::ofstream f(filename, std::ios::app);
+        f << part2;
+    }
+
+    EXPECT_TRUE(db.read_from(filename, offset, idmap, node_fn, snap_fn));
+    ASSERT_EQ(values.size(), 3u);
+    EXPECT_EQ(values[1], 2);
+    EXPECT_EQ(values[2], 3);
+    EXPECT_EQ(offset, part1.size() + part2.size());
+
+    // nothing new
+    EXPECT_TRUE(db.read_from(filename, offset, idmap, node_fn, snap_fn));
+    EXPECT_EQ(values.size(), 3u);
+
+    // file was truncated
+    {
+        std::ofstream f(filename, std::ios::trunc);
+    }
+
+    EXPECT_FALSE(db.read_from(filename, offset, idmap, node_fn, snap_fn));
+
+    std::remove(filename);
+}
+
+namespace
+{
+
+/// Write a binary .cali stream with one snapshot { val=\a val, str=\a str }.
+/// \a extra_attr shifts the attribute IDs.
+std::string make_rank_stream(int val, const char* str, bool extra_attr)
+{
+    CaliperMetadataDB db;
+
+    if (extra_attr)
+        db.create_attribute("other", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    Attribute val_attr = db.create_attribute("val", CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+    Attribute str_attr = db.create_attribute("str", CALI_TYPE_STRING, CALI_ATTR_ASVALUE);
+
+    cali_id_t attr[2] = { val_attr.id(), str_attr.id() };
+    Variant   vals[2] = { Variant(val), Variant(CALI_TYPE_STRING, str, strlen(str)) };
+
+    std::ostringstream os;
+
+    {
+        OutputStream stream;
+        stream.set_stream(&os);
+
+        BinaryWriter writer(stream);
+        writer.write_snapshot(db, 0, nullptr, 2, attr, vals);
+        writer.flush();
+    }
+
+    return os.str();
+}
+
+}
+
+TEST(MetaDBTest, ReadRankContainer) {
+    char filename[] = "/tmp/caliper-test-rankcontainer-XXXXXX";
+    int  fd = mkstemp(filename);
+
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    // rank 7 uses different IDs and string table entries for the same names
+    std::string s5 = make_rank_stream(5, "five",  false);
+    std::string s7 = make_rank_stream(7, "seven", true);
+
+    {
+        std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+        RankContainerWriter writer(f);
+
+        EXPECT_TRUE(writer.append(5, reinterpret_cast<const unsigned char*>(s5.data()), s5.size()));
+        EXPECT_TRUE(writer.append(7, reinterpret_cast<const unsigned char*>(s7.data()), s7.size()));
+        EXPECT_FALSE(writer.append(9, reinterpret_cast<const unsigned char*>("junk"), 4));
+
+        writer.finish();
+    }
+
+    ASSERT_TRUE(BinaryReader::is_binary(filename));
+
+    CaliperMetadataDB db;
+    std::vector< std::pair<int, std::string> > recs;
+
+    EXPECT_TRUE(db.read(filename,
+            [](CaliperMetadataAccessInterface&, const Node*) { },
+            [&recs](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+                int val = -1;
+                std::string str;
+
+                for (const Entry& e : rec) {
+                    if (e.attribute() == db.get_attribute("val").id())
+                        val = e.value().to_int();
+                    else if (e.attribute() == db.get_attribute("str").id())
+                        str = e.value().to_string();
+                }
+
+                recs.push_back(std::make_pair(val, str));
+            }));
+
+    ASSERT_EQ(recs.size(), 2u);
+    EXPECT_EQ(recs[0].first, 5);
+    EXPECT_EQ(recs[0].second, "five");
+    EXPECT_EQ(recs[1].first, 7);
+    EXPECT_EQ(recs[1].second, "seven");
+
+    std::vector<BinaryReader::RankSection> index;
+
+    ASSERT_TRUE(BinaryReader::rank_index(filename, index));
+    ASSERT_EQ(index.size(), 2u);
+    EXPECT_EQ(index[0].rank, 5u);
+    EXPECT_EQ(index[1].rank, 7u);
+    EXPECT_EQ(index[0].offset + index[0].size, index[1].offset);
+
+    unsigned char c;
+
+    {
+        std::ifstream f(filename, std::ios::binary);
+        f.seekg(index[1].offset);
+        c = f.get();
+    }
+
+    EXPECT_EQ(c, 'R');
+
+    std::remove(filename);
+}
+
+TEST(MetaDBTest, WriteRenumberedNodes) {
+    CaliperMetadataDB db;
+
+    // unused attributes and nodes make the runtime ids sparse
+    for (int i = 0; i < 20; ++i)
+        db.create_attribute(std::string("unused.") + std::to_string(i), CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    Attribute str_attr = db.create_attribute("str.attr", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute int_attr = db.create_attribute("int.attr", CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+
+    IdMap idmap;
+
+    db.merge_node(300, str_attr.id(), CALI_INV_ID, Variant(CALI_TYPE_STRING, "x", 1), idmap);
+
+    const Node* a = db.merge_node(200, str_attr.id(), CALI_INV_ID, Variant(CALI_TYPE_STRING, "a", 1), idmap);
+    const Node* b = db.merge_node(201, str_attr.id(), 200,         Variant(CALI_TYPE_STRING, "b", 1), idmap);
+
+    ASSERT_NE(a, nullptr);
+    ASSERT_NE(b, nullptr);
+
+    cali_id_t node_id = b->id();
+    cali_id_t attr_id = int_attr.id();
+    Variant   val(42);
+
+    std::ostringstream os;
+
+    {
+        OutputStream stream;
+        stream.set_stream(&os);
+
+        CsvWriter writer(stream);
+        writer.write_snapshot(db, 1, &node_id, 1, &attr_id, &val);
+    }
+
+    // only referenced nodes are written, with consecutive ids
+
+    std::istringstream is(os.str());
+    std::string line;
+    std::vector<cali_id_t> ids;
+
+    while (std::getline(is, line)) {
+        EXPECT_EQ(line.find("unused"), std::string::npos);
+        EXPECT_EQ(line.find("data=x"), std::string::npos);
+
+        if (line.compare(0, 14, "__rec=node,id=") == 0)
+            ids.push_back(std::stoull(line.substr(14)));
+    }
+
+    ASSERT_GE(ids.size(), 4u);
+
+    for (size_t i = 1; i < ids.size(); ++i)
+        EXPECT_EQ(ids[i], ids[i-1] + 1);
+
+    char filename[] = "/tmp/caliper-test-renumber-XXXXXX";
+    int  fd = mkstemp(filename);
+
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    {
+        std::ofstream f(filename);
+        f << os.str();
+    }
+
+    CaliperMetadataDB db_in;
+    std::string path;
+    int out_val = -1;
+
+    EXPECT_TRUE(db_in.read(filename,
+            [](CaliperMetadataAccessInterface&, const Node*) { },
+            [&](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+                for (const Entry& e : rec)
+                    if (e.is_reference()) {
+                        for (const Node* node = e.node(); node && node->id() != CALI_INV_ID; node = node->parent())
+                            if (node->attribute() == db.get_attribute("str.attr").id())
+                                path = node->data().to_string() + (path.empty() ? "" : "/") + path;
+                    } else if (e.attribute() == db.get_attribute("int.attr").id())
+                        out_val = e.value().to_int();
+            }));
+
+    EXPECT_EQ(path, "a/b");
+    EXPECT_EQ(out_val, 42);
+
+    std::remove(filename);
+}
+
+TEST(MetaDBTest, LazyBinaryNodes) {
+    CaliperMetadataDB db;
+
+    Attribute str_attr = db.create_attribute("str.attr", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute int_attr = db.create_attribute("int.attr", CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+
+    IdMap idmap;
+
+    const Node* a = db.merge_node(200, str_attr.id(), CALI_INV_ID, Variant(CALI_TYPE_STRING, "a", 1), idmap);
+    const Node* b = db.merge_node(201, str_attr.id(), 200,         Variant(CALI_TYPE_STRING, "b", 1), idmap);
+    const Node* x = db.merge_node(202, str_attr.id(), 200,         Variant(CALI_TYPE_STRING, "x", 1), idmap);
+
+    ASSERT_NE(a, nullptr);
+    ASSERT_NE(b, nullptr);
+    ASSERT_NE(x, nullptr);
+
+    char filename[] = "/tmp/caliper-test-lazynodes-XXXXXX";
+    int  fd = mkstemp(filename);
+
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    {
+        std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+        OutputStream  stream;
+        stream.set_stream(&f);
+
+        cali_id_t node_id = b->id();
+        cali_id_t attr_id = int_attr.id();
+        Variant   val(42);
+
+        BinaryWriter writer(stream);
+
+        // x is written, but no record refers to it
+        writer(db, x);
+        writer.write_snapshot(db, 1, &node_id, 1, &attr_id, &val);
+        writer.flush();
+    }
+
+    auto read_file = [&filename](bool lazy, std::vector<std::string>& nodes, std::string& path) {
+        CaliperMetadataDB db_in;
+
+        if (lazy)
+            db_in.set_read_spec(CalQLParser("select *").spec());
+
+        return db_in.read(filename,
+            [&nodes](CaliperMetadataAccessInterface& db, const Node* node) {
+                if (node->attribute() == db.get_attribute("str.attr").id())
+                    nodes.push_back(node->data().to_string());
+            },
+            [&path](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+                for (const Entry& e : rec)
+                    if (e.is_reference())
+                        for (const Node* node = e.node(); node && node->id() != CALI_INV_ID; node = node->parent())
+                            path = node->data().to_string() + (path.empty() ? "" : "/") + path;
+            });
+    };
+
+    {
+        std::vector<std::string> nodes;
+        std::string path;
+
+        EXPECT_TRUE(read_file(false, nodes, path));
+        EXPECT_EQ(nodes.size(), 3u);
+        EXPECT_EQ(path, "a/b");
+    }
+
+    {
+        std::vector<std::string> nodes;
+        std::string path;
+
+        EXPECT_TRUE(read_file(true, nodes, path));
+        ASSERT_EQ(nodes.size(), 2u);
+        EXPECT_EQ(nodes[0], "a");
+        EXPECT_EQ(nodes[1], "b");
+        EXPECT_EQ(path, "a/b");
+    }
+
+    std::remove(filename);
+}
+
+TEST(MetaDBTest, LargeBinaryRecord) {
+    CaliperMetadataDB db;
+
+    const size_t num_entries = 120;
+
+    std::vector<cali_id_t> attr;
+    std::vector<Variant>   vals;
+
+    for (size_t i = 0; i < num_entries; ++i) {
+        std::string name = std::string("attr.") + std::to_string(i);
+        attr.push_back(db.create_attribute(name, CALI_TYPE_UINT, CALI_ATTR_ASVALUE).id());
+        vals.push_back(Variant(static_cast<uint64_t>(1) << 62));
+    }
+
+    char filename[] = "/tmp/caliper-test-largerecord-XXXXXX";
+    int  fd = mkstemp(filename);
+
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    {
+        std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+        OutputStream  stream;
+        stream.set_stream(&f);
+
+        BinaryWriter writer(stream);
+        writer.write_snapshot(db, 0, nullptr, num_entries, attr.data(), vals.data());
+        writer.flush();
+    }
+
+    CaliperMetadataDB db_in;
+    size_t num_recs = 0;
+    size_t num_imm  = 0;
+
+    EXPECT_TRUE(db_in.read(filename, [](CaliperMetadataAccessInterface&, const Node*){ },
+        [&num_recs,&num_imm](CaliperMetadataAccessInterface&, const EntryList& rec) {
+            ++num_recs;
+            for (const Entry& e : rec)
+                if (e.is_immediate() && e.value().to_uint() == (static_cast<uint64_t>(1) << 62))
+                    ++num_imm;
+        }));
+
+    EXPECT_EQ(num_recs, 1u);
+    EXPECT_EQ(num_imm, num_entries);
+
+    std::remove(filename);
+}
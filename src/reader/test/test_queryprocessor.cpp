@@ -0,0 +1,80 @@
+#include "caliper/reader/QueryProcessor.h"
+
+#include "caliper/reader/CalQLParser.h"
+#include "caliper/reader/CaliperMetadataDB.h"
+
+#include "caliper/common/Node.h"
+#include "caliper/common/OutputStream.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+using namespace cali;
+
+namespace
+{
+
+/// \brief Run \a query with \a num_threads on a set of test records
+std::string
+run_query(const char* query, unsigned num_threads)
+{
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx_attr =
+        db.create_attribute("ctx", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute val_attr =
+        db.create_attribute("val", CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+
+    db.merge_node(100, ctx_attr.id(), CALI_INV_ID, Variant(CALI_TYPE_STRING, "a", 2), idmap);
+    db.merge_node(101, ctx_attr.id(), 100,         Variant(CALI_TYPE_STRING, "b", 2), idmap);
+
+    CalQLParser parser(query);
+
+    EXPECT_FALSE(parser.error()) << parser.error_msg();
+
+    std::ostringstream sstr;
+    OutputStream       stream;
+
+    stream.set_stream(&sstr);
+
+    QueryProcessor proc(parser.spec(), stream, num_threads);
+
+    cali_id_t val_id = val_attr.id();
+
+    // Use enough records to fill several pipeline batches
+    for (int i = 0; i < 5000; ++i) {
+        cali_id_t node_id = (i % 3 == 0 ? 100 : 101);
+        Variant   v_val(i);
+
+        proc.process_record(db, db.merge_snapshot(1, &node_id, 1, &val_id, &v_val, idmap));
+    }
+
+    proc.flush(db);
+
+    return sstr.str();
+}
+
+} // namespace
+
+
+TEST(QueryProcessorTest, PipelineFormat) {
+    const char* query = "select * where val>10 format expand";
+
+    std::string serial   = ::run_query(query, 1);
+    std::string parallel = ::run_query(query, 4);
+
+    EXPECT_FALSE(serial.empty());
+    EXPECT_EQ(serial, parallel);
+}
+
+TEST(QueryProcessorTest, PipelineAggregate) {
+    const char* query = "select ctx,count(),sum(val) group by ctx format expand order by ctx";
+
+    std::string serial   = ::run_query(query, 1);
+    std::string parallel = ::run_query(query, 4);
+
+    EXPECT_FALSE(serial.empty());
+    EXPECT_EQ(serial, parallel);
+}
@@ -0,0 +1,138 @@
+#include "caliper/reader/RecordIndex.h"
+
+#include "caliper/reader/CalQLParser.h"
+#include "caliper/reader/CaliperMetadataDB.h"
+
+#include "caliper/common/Node.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <unistd.h>
+
+using namespace cali;
+
+namespace
+{
+
+// Writes a .cali file with an "iteration" (INT, as value) and a "region"
+// (STRING) attribute. Each region node is followed by 100 records with
+// increasing iteration numbers.
+std::string
+write_test_file(const char* filename, int num_regions)
+{
+    std::ostringstream os;
+
+    os << "__rec=node,attr=10,data=1,id=100,parent=1\n"
+       << "__rec=node,attr=8,data=iteration,id=101,parent=100\n"
+       << "__rec=node,attr=10,data=0,id=102,parent=3\n"
+       << "__rec=node,attr=8,data=region,id=103,parent=102\n";
+
+    for (int r = 0; r < num_regions; ++r) {
+        os << "__rec=node,attr=103,data=region" << r << ",id=" << 200+r << "\n";
+
+        for (int i = r * 100; i < (r+1) * 100; ++i)
+            os << "__rec=ctx,ref=" << 200+r << ",attr=101,data=" << i << "\n";
+    }
+
+    std::ofstream f(filename);
+    f << os.str();
+
+    return os.str();
+}
+
+std::size_t
+count_records(const std::string& filename, const std::vector<RecordIndex::Block>& blocks, const QuerySpec& spec)
+{
+    CaliperMetadataDB db;
+    IdMap             idmap;
+    std::size_t       count = 0;
+
+    db.set_read_spec(spec);
+
+    for (const RecordIndex::Block& b : blocks)
+        db.read_range(filename, b.begin, b.end, idmap,
+                      [](CaliperMetadataAccessInterface&, const Node*) { },
+                      [&count](CaliperMetadataAccessInterface&, const EntryList&) { ++count; });
+
+    return count;
+}
+
+} // namespace [anonymous]
+
+TEST(RecordIndexTest, BuildAndSelect) {
+    char filename[] = "/tmp/caliper-test-recordindex-XXXXXX";
+    int  fd = mkstemp(filename);
+
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    std::string contents = write_test_file(filename, 10);
+
+    RecordIndex index;
+
+    ASSERT_TRUE(index.build(filename, 256));
+
+    std::vector<RecordIndex::Block> blocks = index.blocks();
+
+    ASSERT_GT(blocks.size(), 10u);
+    EXPECT_EQ(index.file_size(), contents.size());
+    EXPECT_EQ(blocks.front().begin, 0u);
+    EXPECT_EQ(blocks.back().end, contents.size());
+
+    for (std::size_t i = 1; i < blocks.size(); ++i) {
+        EXPECT_EQ(blocks[i].begin, blocks[i-1].end);
+        EXPECT_EQ(contents[blocks[i].begin - 1], '\n');
+    }
+
+    // write/read round trip
+
+    std::stringstream ss;
+    index.write(ss);
+
+    RecordIndex index2;
+
+    ASSERT_TRUE(index2.read(ss));
+    EXPECT_EQ(index2.file_size(), index.file_size());
+    EXPECT_EQ(index2.blocks().size(), blocks.size());
+
+    const char* queries[] = {
+        "SELECT * WHERE iteration=345",
+        "SELECT * WHERE region=region7",
+        "SELECT * WHERE region=region2,iteration=250",
+        "SELECT * WHERE region=nope",
+        "SELECT * WHERE NOT region=region3",
+        "SELECT * WHERE iteration"
+    };
+
+    for (const char* q : queries) {
+        QuerySpec spec = CalQLParser(q).spec();
+
+        std::vector<RecordIndex::Block> selected = index2.select_blocks(spec);
+
+        EXPECT_EQ(count_records(filename, selected, spec), count_records(filename, blocks, spec)) << q;
+    }
+
+    QuerySpec spec = CalQLParser("SELECT * WHERE region=region7").spec();
+
+    EXPECT_EQ(count_records(filename, index2.select_blocks(spec), spec), 100u);
+
+    spec = CalQLParser("SELECT * WHERE iteration=345").spec();
+
+    EXPECT_EQ(count_records(filename, index2.select_blocks(spec), spec), 1u);
+    EXPECT_LT(index2.select_blocks(spec).size(), blocks.size() / 2);
+    EXPECT_EQ(index2.select_blocks(CalQLParser("SELECT *").spec()).size(), blocks.size());
+
+    unlink(filename);
+}
+
+TEST(RecordIndexTest, ReadInvalid) {
+    std::istringstream is("not an index\n");
+    RecordIndex index;
+
+    EXPECT_FALSE(index.read(is));
+    EXPECT_FALSE(index.build("/tmp/caliper-test-recordindex-does-not-exist"));
+}
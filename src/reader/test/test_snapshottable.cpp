@@ -0,0 +1,215 @@
+#include "caliper/reader/SnapshotTable.h"
+
+#include "caliper/reader/CaliperMetadataDB.h"
+
+#include "caliper/common/Node.h"
+
+#include <gtest/gtest.h>
+
+using namespace cali;
+
+namespace
+{
+
+// Make a table with a nested string attribute "region", an int "iter"
+// context attribute, and "time" immediate values:
+//
+//   region       iter  time
+//   main          -    1.0
+//   main/foo      0    2.0
+//   main/foo      1    3.0
+//   main/bar      0    4.0
+//   -             -    5.0
+
+void
+make_table(CaliperMetadataDB& db, SnapshotTable& table)
+{
+    IdMap idmap;
+
+    Attribute region_attr =
+        db.create_attribute("region", CALI_TYPE_STRING, CALI_ATTR_NESTED);
+    Attribute iter_attr =
+        db.create_attribute("iter",   CALI_TYPE_INT,    CALI_ATTR_DEFAULT);
+    Attribute time_attr =
+        db.create_attribute("time",   CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    const struct NodeInfo {
+        cali_id_t node_id;
+        cali_id_t attr_id;
+        cali_id_t prnt_id;
+        Variant   data;
+    } test_nodes[] = {
+        { 100, region_attr.id(), CALI_INV_ID, Variant(CALI_TYPE_STRING, "main", 4) },
+        { 101, region_attr.id(), 100,         Variant(CALI_TYPE_STRING, "foo",  3) },
+        { 102, iter_attr.id(),   101,         Variant(0) },
+        { 103, iter_attr.id(),   101,         Variant(1) },
+        { 104, region_attr.id(), 100,         Variant(CALI_TYPE_STRING, "bar",  3) },
+        { 105, iter_attr.id(),   104,         Variant(0) }
+    };
+
+    const Node* nodes[6];
+
+    for (int i = 0; i < 6; ++i)
+        nodes[i] = db.merge_node(test_nodes[i].node_id, test_nodes[i].attr_id, test_nodes[i].prnt_id, test_nodes[i].data, idmap);
+
+    const struct RecordInfo {
+        const Node* node;
+        double      time;
+    } records[] = {
+        { nodes[0], 1.0 }, { nodes[2], 2.0 }, { nodes[3], 3.0 }, { nodes[5], 4.0 }, { nullptr, 5.0 }
+    };
+
+    for (const RecordInfo& rI : records) {
+        EntryList list;
+
+        if (rI.node)
+            list.push_back(Entry(rI.node));
+
+        list.push_back(Entry(time_attr.id(), Variant(rI.time)));
+
+        table.add(db, list);
+    }
+}
+
+} // namespace [anonymous]
+
+TEST(SnapshotTableTest, Columns) {
+    CaliperMetadataDB db;
+    SnapshotTable     table;
+
+    ::make_table(db, table);
+
+    ASSERT_EQ(table.num_rows(), static_cast<size_t>(5));
+    ASSERT_EQ(table.num_columns(), static_cast<size_t>(3));
+
+    const SnapshotTable::Column* region = table.column("region");
+    const SnapshotTable::Column* iter   = table.column("iter");
+    const SnapshotTable::Column* time   = table.column("time");
+
+    ASSERT_NE(region, nullptr);
+    ASSERT_NE(iter,   nullptr);
+    ASSERT_NE(time,   nullptr);
+    EXPECT_EQ(table.column("nope"), nullptr);
+
+    EXPECT_EQ(region->storage, SnapshotTable::Storage::String);
+    EXPECT_EQ(iter->storage,   SnapshotTable::Storage::Int);
+    EXPECT_EQ(time->storage,   SnapshotTable::Storage::Double);
+
+    // nested strings are stored as paths, and dictionary-encoded
+
+    EXPECT_EQ(region->dict.size(), static_cast<size_t>(3));
+    EXPECT_EQ(region->value(0).to_string(), std::string("main"));
+    EXPECT_EQ(region->value(1).to_string(), std::string("main/foo"));
+    EXPECT_EQ(region->codes[1], region->codes[2]);
+    EXPECT_EQ(region->value(3).to_string(), std::string("main/bar"));
+    EXPECT_TRUE(region->value(4).empty());
+
+    // "iter" column was created after row 0 and must be back-filled
+
+    ASSERT_EQ(iter->valid.size(), static_cast<size_t>(5));
+    EXPECT_FALSE(iter->valid[0]);
+    EXPECT_EQ(iter->value(2).to_int(), 1);
+
+    EXPECT_DOUBLE_EQ(time->value(4).to_double(), 5.0);
+}
+
+TEST(SnapshotTableTest, Select) {
+    CaliperMetadataDB db;
+    SnapshotTable     table;
+
+    ::make_table(db, table);
+
+    typedef QuerySpec::Condition C;
+
+    // Equal matches any element of a nested path, like RecordSelector
+    std::vector<size_t> rows = table.select({ C { C::Op::Equal, "region", "foo" } });
+
+    ASSERT_EQ(rows.size(), static_cast<size_t>(2));
+    EXPECT_EQ(rows[0], static_cast<size_t>(1));
+    EXPECT_EQ(rows[1], static_cast<size_t>(2));
+
+    EXPECT_EQ(table.select({ C { C::Op::Equal, "region", "main" } }).size(), static_cast<size_t>(4));
+    EXPECT_EQ(table.select({ C { C::Op::NotEqual, "region", "bar" } }).size(), static_cast<size_t>(4));
+    EXPECT_EQ(table.select({ C { C::Op::Exist, "iter", "" } }).size(), static_cast<size_t>(3));
+    EXPECT_EQ(table.select({ C { C::Op::NotExist, "iter", "" } }).size(), static_cast<size_t>(2));
+    EXPECT_EQ(table.select({ C { C::Op::Exist, "nope", "" } }).size(), static_cast<size_t>(0));
+    EXPECT_EQ(table.select({ C { C::Op::NotExist, "nope", "" } }).size(), static_cast<size_t>(5));
+
+    // numeric comparisons and AND combination
+    rows = table.select({ C { C::Op::GreaterThan, "time", "1.5" }, C { C::Op::Equal, "iter", "0" } });
+
+    ASSERT_EQ(rows.size(), static_cast<size_t>(2));
+    EXPECT_EQ(rows[0], static_cast<size_t>(1));
+    EXPECT_EQ(rows[1], static_cast<size_t>(3));
+}
+
+TEST(SnapshotTableTest, Sort) {
+    CaliperMetadataDB db;
+    SnapshotTable     table;
+
+    ::make_table(db, table);
+
+    std::vector<size_t> rows = table.all_rows();
+
+    table.sort({ QuerySpec::SortSpec("time", QuerySpec::SortSpec::Order::Descending) }, rows);
+
+    ASSERT_EQ(rows.size(), static_cast<size_t>(5));
+    EXPECT_EQ(rows[0], static_cast<size_t>(4));
+    EXPECT_EQ(rows[4], static_cast<size_t>(0));
+
+    // primary key region (rows without value first), then time descending
+    table.sort({ QuerySpec::SortSpec("region"),
+                 QuerySpec::SortSpec("time", QuerySpec::SortSpec::Order::Descending) }, rows);
+
+    const size_t expect[5] = { 4, 0, 3, 2, 1 };
+
+    for (int i = 0; i < 5; ++i)
+        EXPECT_EQ(rows[i], expect[i]) << " at " << i;
+}
+
+TEST(SnapshotTableTest, Aggregate) {
+    CaliperMetadataDB db;
+    SnapshotTable     table;
+
+    ::make_table(db, table);
+
+    SnapshotTable res = table.aggregate(db, { "region" }, { "time", "iter" }, table.all_rows());
+
+    ASSERT_EQ(res.num_rows(), static_cast<size_t>(4));
+
+    const SnapshotTable::Column* region = res.column("region");
+    const SnapshotTable::Column* count  = res.column("count");
+    const SnapshotTable::Column* tsum   = res.column("time");
+    const SnapshotTable::Column* isum   = res.column("iter");
+
+    ASSERT_NE(region, nullptr);
+    ASSERT_NE(count,  nullptr);
+    ASSERT_NE(tsum,   nullptr);
+    ASSERT_NE(isum,   nullptr);
+
+    EXPECT_EQ(isum->storage, SnapshotTable::Storage::Int);
+
+    std::vector<size_t> rows = res.select({ QuerySpec::Condition { QuerySpec::Condition::Op::Equal, "region", "main/foo" } });
+
+    ASSERT_EQ(rows.size(), static_cast<size_t>(1));
+    EXPECT_EQ(count->value(rows[0]).to_uint(), static_cast<uint64_t>(2));
+    EXPECT_DOUBLE_EQ(tsum->value(rows[0]).to_double(), 5.0);
+    EXPECT_EQ(isum->value(rows[0]).to_int(), 1);
+
+    // push results as records
+
+    int  num_records = 0;
+    bool found_count = false;
+
+    Attribute count_attr = db.get_attribute("count");
+
+    res.push(db, [&](CaliperMetadataAccessInterface&, const EntryList& list) {
+            ++num_records;
+            for (const Entry& e : list)
+                if (e.attribute() == count_attr.id())
+                    found_count = true;
+        });
+
+    EXPECT_EQ(num_records, 4);
+    EXPECT_TRUE(found_count);
+}
@@ -0,0 +1,107 @@
+#include "caliper/reader/SnapshotTree.h"
+
+#include "caliper/reader/CaliperMetadataDB.h"
+
+#include "caliper/common/Node.h"
+
+#include <gtest/gtest.h>
+
+using namespace cali;
+
+namespace
+{
+
+int
+count_children(const SnapshotTreeNode* node)
+{
+    int count = 0;
+
+    for (node = node->first_child(); node; node = node->next_sibling())
+        ++count;
+
+    return count;
+}
+
+} // namespace
+
+
+TEST(SnapshotTreeTest, AddSnapshots) {
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute path_attr =
+        db.create_attribute("path", CALI_TYPE_STRING, CALI_ATTR_NESTED);
+    Attribute ctx_attr  =
+        db.create_attribute("ctx",  CALI_TYPE_INT,    CALI_ATTR_DEFAULT);
+    Attribute val_attr  =
+        db.create_attribute("val",  CALI_TYPE_INT,    CALI_ATTR_ASVALUE);
+
+    const struct NodeInfo {
+        cali_id_t node_id;
+        cali_id_t attr_id;
+        cali_id_t prnt_id;
+        Variant   data;
+    } test_nodes[] = {
+        { 100, path_attr.id(), CALI_INV_ID, Variant(CALI_TYPE_STRING, "a", 2) },
+        { 101, ctx_attr.id(),  100,         Variant(42)                       },
+        { 102, path_attr.id(), 101,         Variant(CALI_TYPE_STRING, "b", 2) },
+        { 103, path_attr.id(), 101,         Variant(CALI_TYPE_STRING, "c", 2) }
+    };
+
+    for ( const NodeInfo& nI : test_nodes )
+        db.merge_node(nI.node_id, nI.attr_id, nI.prnt_id, nI.data, idmap);
+
+    auto is_path = [](const Attribute& attr, const Variant&) {
+        return attr.is_nested();
+    };
+
+    SnapshotTree tree;
+
+    cali_id_t node_b = 102;
+    cali_id_t node_c = 103;
+    cali_id_t val_id = val_attr.id();
+    Variant   v_1(1), v_2(2), v_3(3);
+
+    const SnapshotTreeNode* n_b =
+        tree.add_snapshot(db, db.merge_snapshot(1, &node_b, 1, &val_id, &v_1, idmap), is_path);
+    const SnapshotTreeNode* n_c =
+        tree.add_snapshot(db, db.merge_snapshot(1, &node_c, 1, &val_id, &v_2, idmap), is_path);
+
+    // record without path entries
+    EXPECT_EQ(tree.add_snapshot(db, db.merge_snapshot(0, nullptr, 1, &val_id, &v_3, idmap), is_path), nullptr);
+
+    ASSERT_NE(n_b, nullptr);
+    ASSERT_NE(n_c, nullptr);
+
+    EXPECT_FALSE(n_b->is_empty());
+    EXPECT_EQ(n_b->label_key(), path_attr);
+    EXPECT_EQ(n_b->label_value().to_string(), std::string("b"));
+    EXPECT_EQ(n_c->label_value().to_string(), std::string("c"));
+
+    // b and c share the "a" parent
+    ASSERT_NE(n_b->parent(), nullptr);
+    EXPECT_EQ(n_b->parent(), n_c->parent());
+    EXPECT_TRUE(n_b->parent()->is_empty());
+    EXPECT_EQ(n_b->parent()->label_value().to_string(), std::string("a"));
+    EXPECT_EQ(count_children(n_b->parent()), 2);
+    EXPECT_EQ(count_children(tree.root()), 1);
+
+    // non-path entries from the context tree and immediate entries
+    EXPECT_EQ(n_b->attributes().size(), 2);
+    EXPECT_EQ(n_b->get(ctx_attr).to_int(), 42);
+    EXPECT_EQ(n_b->get(val_attr).to_int(), 1);
+    EXPECT_EQ(n_c->get(val_attr).to_int(), 2);
+    EXPECT_TRUE(n_b->get(path_attr).empty());
+
+    // Adding another record with path a/b creates a new b node, which
+    // is found first for later records with the same path
+    const SnapshotTreeNode* n_b2 =
+        tree.add_snapshot(db, db.merge_snapshot(1, &node_b, 1, &val_id, &v_3, idmap), is_path);
+
+    ASSERT_NE(n_b2, nullptr);
+    EXPECT_NE(n_b2, n_b);
+    EXPECT_EQ(n_b2->parent(), n_b->parent());
+    EXPECT_EQ(n_b2->get(val_attr).to_int(), 3);
+    EXPECT_EQ(count_children(n_b->parent()), 3);
+    EXPECT_EQ(n_b->parent()->first_child(), n_b2);
+}
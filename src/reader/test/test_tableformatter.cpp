@@ -0,0 +1,131 @@
+#include "caliper/reader/TableFormatter.h"
+
+#include "caliper/reader/CaliperMetadataDB.h"
+#include "caliper/reader/QuerySpec.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+QuerySpec
+make_spec(const char* sort_attr, QuerySpec::SortSpec::Order order, const char* limit = nullptr)
+{
+    QuerySpec spec;
+
+    spec.aggregation_ops.selection = QuerySpec::AggregationSelection::None;
+    spec.aggregation_key.selection = QuerySpec::AttributeSelection::None;
+    spec.filter.selection          = QuerySpec::FilterSelection::None;
+
+    spec.attribute_selection.selection = QuerySpec::AttributeSelection::List;
+    spec.attribute_selection.list.push_back("val");
+
+    spec.sort.selection = QuerySpec::SortSelection::List;
+    spec.sort.list.push_back(QuerySpec::SortSpec(sort_attr, order));
+
+    spec.format.opt = QuerySpec::FormatSpec::User;
+
+    if (limit)
+        spec.format.args.push_back(limit);
+
+    return spec;
+}
+
+std::vector<std::string>
+get_lines(const std::string& str)
+{
+    std::vector<std::string> lines;
+    std::istringstream is(str);
+    std::string line;
+
+    while (std::getline(is, line))
+        lines.push_back(line.substr(0, line.find_last_not_of(' ') + 1));
+
+    return lines;
+}
+
+} // namespace
+
+TEST(TableFormatterTest, NumericSort) {
+    CaliperMetadataDB db;
+
+    Attribute val_attr =
+        db.create_attribute("val", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    // would sort as 100 < 20 < 3 when compared as strings
+    const int vals[] = { 20, 3, 100, -5 };
+
+    TableFormatter tbl(make_spec("val", QuerySpec::SortSpec::Ascending));
+
+    for (int v : vals)
+        tbl.process_record(db, EntryList { Entry(val_attr, Variant(v)) });
+
+    std::ostringstream os;
+    tbl.flush(db, os);
+
+    std::vector<std::string> lines = get_lines(os.str());
+
+    ASSERT_EQ(lines.size(), 5u);
+
+    EXPECT_EQ(lines[1], " -5");
+    EXPECT_EQ(lines[2], "  3");
+    EXPECT_EQ(lines[3], " 20");
+    EXPECT_EQ(lines[4], "100");
+}
+
+TEST(TableFormatterTest, TopK) {
+    CaliperMetadataDB db;
+
+    Attribute val_attr =
+        db.create_attribute("val", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    TableFormatter tbl(make_spec("val", QuerySpec::SortSpec::Descending, "3"));
+
+    // large enough to exercise the bounded heap
+    for (int i = 0; i < 50000; ++i)
+        tbl.process_record(db, EntryList { Entry(val_attr, Variant((i * 7919) % 50000)) });
+
+    std::ostringstream os;
+    tbl.flush(db, os);
+
+    std::vector<std::string> lines = get_lines(os.str());
+
+    ASSERT_EQ(lines.size(), 4u);
+
+    EXPECT_EQ(lines[1], "49999");
+    EXPECT_EQ(lines[2], "49998");
+    EXPECT_EQ(lines[3], "49997");
+}
+
+TEST(TableFormatterTest, LargeSort) {
+    CaliperMetadataDB db;
+
+    Attribute val_attr =
+        db.create_attribute("val", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    TableFormatter tbl(make_spec("val", QuerySpec::SortSpec::Ascending));
+
+    const int N = 100000;
+
+    for (int i = 0; i < N; ++i)
+        tbl.process_record(db, EntryList { Entry(val_attr, Variant(static_cast<double>((i * 7919) % N))) });
+
+    std::ostringstream os;
+    tbl.flush(db, os);
+
+    std::vector<std::string> lines = get_lines(os.str());
+
+    ASSERT_EQ(lines.size(), static_cast<size_t>(N + 1));
+
+    for (int i = 1; i <= N; ++i)
+        if (std::stod(lines[i]) != static_cast<double>(i - 1)) {
+            ADD_FAILURE() << "row " << i << " is " << lines[i];
+            break;
+        }
+}
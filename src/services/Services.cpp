@@ -39,9 +39,13 @@
 
 #include "caliper/CaliperService.h"
 
+#include "../caliper/SelfProfile.h"
+
 #include "caliper/common/Log.h"
 #include "caliper/common/RuntimeConfig.h"
 
+#include <dlfcn.h>
+
 #include <algorithm>
 #include <string>
 #include <sstream>
@@ -103,13 +107,71 @@ struct Services::ServicesImpl
                 auto it = find(services.begin(), services.end(), string(s->name));
 
                 if (it != services.end()) {
+                    // Tag the service's callbacks for self-profiling
+                    util::callback_owner() = SelfProfile::add_owner(s->name);
                     (*s->register_fn)(c);
+                    util::callback_owner() = SelfProfile::Core;
+
                     services.erase(it);
                 }
             }
 
-        for ( const string& s : services )
-            Log(0).stream() << "Warning: service \"" << s << "\" not found" << endl;
+        // try to load the remaining services from plugins
+
+        for ( const string& s : services ) {
+            const CaliperService* plugin = load_plugin(s);
+            bool found = false;
+
+            for ( ; plugin && plugin->name && plugin->register_fn; ++plugin)
+                if (s == plugin->name) {
+                    util::callback_owner() = SelfProfile::add_owner(plugin->name);
+                    (*plugin->register_fn)(c);
+                    util::callback_owner() = SelfProfile::Core;
+
+                    found = true;
+                }
+
+            if (!found)
+                Log(0).stream() << "Warning: service \"" << s << "\" not found" << endl;
+        }
+    }
+
+    /// \brief Load the libcaliper-<name> service plugin and return its
+    ///   service list, or nullptr if no plugin was found.
+    ///
+    /// Looks in the configured plugin path first, then uses the default
+    /// dynamic library search path (which includes libcaliper's RUNPATH).
+    const CaliperService* load_plugin(const string& name) {
+        string libname = string("libcaliper-") + name + ".so";
+
+        vector<string> paths = m_config.get("plugin_path").to_stringlist(",:");
+        paths.push_back(string());
+
+        for (const string& dir : paths) {
+            string filename = dir.empty() ? libname : dir + "/" + libname;
+            void*  handle   = dlopen(filename.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+            if (!handle) {
+                Log(2).stream() << "Could not load " << filename << ": " << dlerror() << endl;
+                continue;
+            }
+
+            const CaliperService* list =
+                static_cast<const CaliperService*>(dlsym(handle, "caliper_plugin_services"));
+
+            if (!list) {
+                Log(0).stream() << filename << " is not a Caliper service plugin" << endl;
+                dlclose(handle);
+                continue;
+            }
+
+            // Plugins are never unloaded: their callbacks remain registered
+            Log(2).stream() << "Loaded service plugin " << filename << endl;
+
+            return list;
+        }
+
+        return nullptr;
     }
 
     ServicesImpl()
@@ -132,6 +194,11 @@ const ConfigSet::Entry             Services::ServicesImpl::s_configdata[] = {
       "List of service modules to enable",
       "A list of comma-separated names of the service modules to enable"      
     },
+    { "plugin_path", CALI_TYPE_STRING, "",
+      "List of directories with service plugins",
+      "List of directories to search for libcaliper-<service>.so service plugins.\n"
+      "Plugins are also looked up in the default library search path."
+    },
     ConfigSet::Terminator
 };
 
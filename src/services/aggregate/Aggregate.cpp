@@ -33,12 +33,15 @@
 /// \file  Aggregate.cpp
 /// \brief Caliper on-line aggregation service
 
+#include "ShmAggregateDB.h"
+
 #include "caliper/CaliperService.h"
 
 #include "caliper/Caliper.h"
 #include "caliper/SnapshotRecord.h"
 
 #include "caliper/common/ContextRecord.h"
+#include "caliper/common/HyperLogLog.h"
 #include "caliper/common/Log.h"
 #include "caliper/common/Node.h"
 #include "caliper/common/RuntimeConfig.h"
@@ -47,32 +50,59 @@
 #include "caliper/common/c-util/unitfmt.h"
 #include "caliper/common/c-util/vlenc.h"
 
+#include "caliper/common/util/cacheline.hpp"
+#include "caliper/common/util/memory_counter.hpp"
 #include "caliper/common/util/spinlock.hpp"
 
 #include <pthread.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
 #include <cstring>
+#include <iterator>
 #include <limits>
 #include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include <unistd.h>
+
 using namespace cali;
 using namespace std;
 
-#define MAX_KEYLEN          32
-#define SNAP_MAX            80 // max snapshot size
+#define INLINE_KEYLEN       32 // hash keys up to this length are stored in the entry
+#define STACK_KEYLEN       128 // keys up to this length are encoded on the stack
+#define SIGNAL_KEYLEN     1024 // max. key length in signal handlers
+#define KEY_BLOCK_SIZE   65536 // storage block size for long hash keys
+#define HISTOGRAM_BINS      64 // number of bins in a value histogram
+#define KERNEL_BLOCK_SLOTS  4096 // kernel value slots per allocation block
+#define MAX_KERNEL_ATTRS    32 // max. aggregation attributes with kernels per entry
+#define SIGNAL_RESERVE      64 // new entries kept allocated ahead for signal handlers
 
 //
 // --- Class for the per-thread aggregation database
 //
 
-class AggregateDB {
+// Members that other threads write (list links, time slice lists) are
+// kept on separate cache lines from the ones the owning thread updates
+// on every snapshot.
+class alignas(util::cacheline_size) AggregateDB : public util::cacheline_aligned_new {
     //
     // --- members
     //
 
     std::atomic<bool>        m_stopped;
+
+    util::memory_counter*    m_memory;  ///< Memory of the current epoch
+
+    alignas(util::cacheline_size)
     std::atomic<bool>        m_retired;
 
     AggregateDB*             m_next;
@@ -80,32 +110,168 @@ class AggregateDB {
 
     // the actual aggregation db
 
-    struct AggregateKernel  {
-        double   min;
-        double   max;
-        double   sum;
-		double   avg;
-        int      count;
-
-        AggregateKernel()
-            : min(std::numeric_limits<double>::max()),
-              max(std::numeric_limits<double>::min()),
-              sum(0), count(0), avg(0)
-        { }
+    /// \brief Aggregation kernel operations, selected per attribute
+    enum KernelOp {
+        KernelMin = 1,
+        KernelMax = 2,
+        KernelSum = 4,
+        KernelAvg = 8,
+        KernelAll = 15
+    };
+
+    /// \brief Specialized kernel for the operations in \a OPS.
+    ///
+    /// Each kernel only stores the values it needs in consecutive double
+    /// slots: min, max, sum (also for avg), and the sum of sample weights
+    /// (for avg). Unused operations are compiled out of add() and merge().
+    /// Like histograms, kernels are only updated by the owning thread.
+    template<unsigned OPS>
+    struct KernelLayout {
+        static const unsigned MinSlot    = 0;
+        static const unsigned MaxSlot    = MinSlot + ((OPS & KernelMin) ? 1 : 0);
+        static const unsigned SumSlot    = MaxSlot + ((OPS & KernelMax) ? 1 : 0);
+        static const unsigned WeightSlot = SumSlot + ((OPS & (KernelSum | KernelAvg)) ? 1 : 0);
+        static const unsigned NumSlots   = WeightSlot + ((OPS & KernelAvg) ? 1 : 0);
+
+        static void init(double* k) {
+            if (OPS & KernelMin)
+                k[MinSlot] = std::numeric_limits<double>::max();
+            if (OPS & KernelMax)
+                k[MaxSlot] = std::numeric_limits<double>::min();
+            if (OPS & (KernelSum | KernelAvg))
+                k[SumSlot] = 0.0;
+            if (OPS & KernelAvg)
+                k[WeightSlot] = 0.0;
+        }
+
+        static void add(double* k, double val, double w) {
+            if (OPS & KernelMin)
+                k[MinSlot] = std::min(k[MinSlot], val);
+            if (OPS & KernelMax)
+                k[MaxSlot] = std::max(k[MaxSlot], val);
+            if (OPS & (KernelSum | KernelAvg))
+                k[SumSlot] += w * val;
+            if (OPS & KernelAvg)
+                k[WeightSlot] += w;
+        }
+
+        static void merge(double* k, const double* src) {
+            if (OPS & KernelMin)
+                k[MinSlot] = std::min(k[MinSlot], src[MinSlot]);
+            if (OPS & KernelMax)
+                k[MaxSlot] = std::max(k[MaxSlot], src[MaxSlot]);
+            if (OPS & (KernelSum | KernelAvg))
+                k[SumSlot] += src[SumSlot];
+            if (OPS & KernelAvg)
+                k[WeightSlot] += src[WeightSlot];
+        }
+    };
+
+    /// \brief Dispatch table entry for a kernel layout
+    struct KernelFns {
+        void (*init)(double*);
+        void (*add)(double*, double, double);
+        void (*merge)(double*, const double*);
+        unsigned num_slots;
+    };
+
+    template<unsigned OPS>
+    static KernelFns kernel_fns() {
+        return { KernelLayout<OPS>::init, KernelLayout<OPS>::add, KernelLayout<OPS>::merge,
+                 KernelLayout<OPS>::NumSlots };
+    }
+
+    static KernelFns kernel_fns(unsigned ops) {
+        static const KernelFns fns[16] = {
+            kernel_fns<0>(),  kernel_fns<1>(),  kernel_fns<2>(),  kernel_fns<3>(),
+            kernel_fns<4>(),  kernel_fns<5>(),  kernel_fns<6>(),  kernel_fns<7>(),
+            kernel_fns<8>(),  kernel_fns<9>(),  kernel_fns<10>(), kernel_fns<11>(),
+            kernel_fns<12>(), kernel_fns<13>(), kernel_fns<14>(), kernel_fns<15>()
+        };
+
+        return fns[ops & KernelAll];
+    }
+
+    /// \brief Log-linear value histogram.
+    ///
+    /// Bin 0 counts values below the histogram minimum m. Bin i > 0 covers
+    /// [m*2^k*(1+j/2), m*2^k*(1+(j+1)/2)) with k = (i-1)/2, j = (i-1)%2,
+    /// i.e., each power of two is split into two linear sub-bins. The last
+    /// bin also takes all larger values. Like the kernels, histograms are
+    /// only updated by the owning thread and need no atomics.
+    struct Histogram {
+        uint32_t bins[HISTOGRAM_BINS] = { 0 };
+
+        static int bin(double val) {
+            double x = val / s_histogram_min;
+
+            if (!(x >= 1.0))
+                return 0;
+
+            int    e = 0;
+            double f = std::frexp(x, &e); // x = f * 2^e, 0.5 <= f < 1
+
+            int    b = 2*(e-1) + (f < 0.75 ? 1 : 2);
+
+            return std::min(b, HISTOGRAM_BINS-1);
+        }
 
         void add(double val) {
-            min  = std::min(min, val);
-            max  = std::max(max, val);
-            sum += val;
-			avg = ((count*avg) + val)/ (count + 1.0);
-            ++count;
+            ++bins[bin(val)];
         }
     };
 
-    struct TrieNode {
-        uint32_t next[256] = { 0 };
-        uint32_t k_id      = 0xFFFFFFFF;
+    struct AggregateEntry {
+        uint32_t k_id      = 0xFFFFFFFF; ///< First kernel value slot
+        uint32_t d_id      = 0xFFFFFFFF; ///< First distinct-value counter
+        uint32_t h_id      = 0;          ///< First histogram, 0 if none
+        uint32_t k_mask    = 0;          ///< Aggregation attributes seen in this entry
         uint32_t count     = 0;
+        double   weight    = 0;          ///< Sum of sample weights
+    };
+
+    struct TrieNode : public AggregateEntry {
+        uint32_t next[256] = { 0 };
+    };
+
+    struct HashEntry : public AggregateEntry {
+        uint32_t      hash     = 0;
+        uint32_t      keylen   = 0;
+        unsigned char* long_key = nullptr; ///< Key storage for keys longer than INLINE_KEYLEN
+        unsigned char key[INLINE_KEYLEN];
+
+        const unsigned char* key_data() const {
+            return keylen > INLINE_KEYLEN ? long_key : key;
+        }
+    };
+
+    enum class KeyIndex { Trie, Hash };
+
+    /// \brief Growable record buffer for writing aggregated snapshots.
+    ///   Re-used for all records of a flush.
+    struct RecordBuffer {
+        std::vector<cali::Node*> nodes;
+        std::vector<cali_id_t>   attrs;
+        std::vector<Variant>     data;
+
+        void append(cali::Node* node) {
+            nodes.push_back(node);
+        }
+
+        void append(cali_id_t attr, const Variant& val) {
+            attrs.push_back(attr);
+            data.push_back(val);
+        }
+
+        void clear() {
+            nodes.clear();
+            attrs.clear();
+            data.clear();
+        }
+
+        SnapshotRecord record() {
+            return SnapshotRecord(nodes.size(), nodes.data(), attrs.size(), attrs.data(), data.data());
+        }
     };
 
     template<typename T, size_t MAX_BLOCKS = 2048, size_t ENTRIES_PER_BLOCK = 1024>
@@ -118,7 +284,7 @@ class AggregateDB {
         T* get(size_t id, bool alloc) {
             size_t block = id / ENTRIES_PER_BLOCK;
 
-            if (block > MAX_BLOCKS)
+            if (block >= MAX_BLOCKS)
                 return 0;
 
             if (!m_blocks[block]) {
@@ -132,6 +298,15 @@ class AggregateDB {
             return m_blocks[block] + (id % ENTRIES_PER_BLOCK);
         }
 
+        const T* get(size_t id, bool) const {
+            size_t block = id / ENTRIES_PER_BLOCK;
+
+            if (block >= MAX_BLOCKS || !m_blocks[block])
+                return 0;
+
+            return m_blocks[block] + (id % ENTRIES_PER_BLOCK);
+        }
+
         void clear() {
             for (size_t b = 0; b < MAX_BLOCKS; ++b)
                 delete[] m_blocks[b];
@@ -141,282 +316,1578 @@ class AggregateDB {
             m_num_blocks = 0;
         }
 
+        /// \brief Re-initialize all entries, but keep the allocated blocks
+        void reset() {
+            for (size_t b = 0; b < MAX_BLOCKS; ++b)
+                if (m_blocks[b])
+                    std::fill_n(m_blocks[b], ENTRIES_PER_BLOCK, T());
+        }
+
         size_t num_blocks() const {
             return m_num_blocks;
         }
 
-        BlockAlloc() {
-
-        }
+        BlockAlloc()
+            : m_num_blocks(0)
+        { }
 
         ~BlockAlloc() {
             clear();
         }
     };
 
-    BlockAlloc<TrieNode>        m_trie;
-    BlockAlloc<AggregateKernel> m_kernels;
+    /// \brief Aggregation data of one flush epoch: key index, kernels,
+    ///   and statistics. In epoch flush mode, the flush swaps in a fresh
+    ///   epoch and drains the old one while the owner thread continues.
+    ///   With time-sliced aggregation, the owner thread also starts a new
+    ///   epoch for each time slice.
+    struct Epoch {
+        BlockAlloc<TrieNode>        m_trie;
+        BlockAlloc<HashEntry>       m_hash_entries;
+        BlockAlloc<double, 2048, KERNEL_BLOCK_SLOTS>
+                                    m_kernels;
+        BlockAlloc<Histogram>       m_histograms;
+        BlockAlloc<HyperLogLog>     m_distinct;
+
+        // open-addressing hash table with entry ids for the hash key index
+        uint32_t*                   m_hash_slots;
+        size_t                      m_hash_size;
+
+        // storage for hash keys longer than INLINE_KEYLEN
+        struct KeyBlock {
+            unsigned char* data;
+            size_t         size;
+        };
+
+        std::vector<KeyBlock>       m_key_blocks;
+        size_t                      m_key_block;
+        size_t                      m_key_pos;
+
+        RecordBuffer                m_record_buf;
+
+        /// Entries of one- or two-node contexts, for region updates in fused timing mode
+        std::unordered_map<uint64_t, AggregateEntry*>
+                                    m_node_entries;
+
+        // we maintain some internal statistics
+        size_t                   m_num_trie_entries;
+        size_t                   m_num_hash_entries;
+        size_t                   m_num_kernel_entries;
+        size_t                   m_num_histograms;
+        size_t                   m_num_distinct;
+        size_t                   m_num_dropped;
+        size_t                   m_num_signal_dropped; ///< Dropped in signal handlers
+        size_t                   m_num_skipped_keys;
+        size_t                   m_max_keylen;
+
+        uint64_t                 m_number;   ///< Time slice number (aggregate.epoch)
+
+        Epoch()
+            : m_hash_slots(nullptr),
+              m_hash_size(0),
+              m_key_block(0),
+              m_key_pos(0),
+              m_num_trie_entries(0),
+              m_num_hash_entries(0),
+              m_num_kernel_entries(0),
+              m_num_histograms(0),
+              m_num_distinct(0),
+              m_num_dropped(0),
+              m_num_signal_dropped(0),
+              m_num_skipped_keys(0),
+              m_max_keylen(0),
+              m_number(0)
+        {
+            // initialize first block
+            if (s_key_index == KeyIndex::Hash) {
+                m_hash_size  = 1024;
+                m_hash_slots = new uint32_t[m_hash_size];
 
-    Node                        m_aggr_root_node;
-    
-    // we maintain some internal statistics
-    size_t                   m_num_trie_entries;
-    size_t                   m_num_kernel_entries;
-    size_t                   m_num_dropped;
-    size_t                   m_num_skipped_keys;
-    size_t                   m_max_keylen;
+                std::fill_n(m_hash_slots, m_hash_size, 0);
 
-    //
-    // --- static data
-    //
+                m_hash_entries.get(1, true);
+            } else {
+                m_trie.get(0, true);
+            }
 
-    struct StatisticsAttributes {
-        Attribute min_attr;
-        Attribute max_attr;
-        Attribute sum_attr;
-        Attribute avg_attr;
-    };
+            m_kernels.get(0, true);
 
-    static Attribute         s_count_attribute;
+            replenish();
+        }
 
-    static vector<cali_id_t> s_key_attribute_ids;
-    static vector<Attribute> s_key_attributes;
-    static vector<string>    s_key_attribute_names;
-    static vector<Attribute> s_aggr_attributes;
-    static vector<string>    s_aggr_attribute_names;
-    static vector<StatisticsAttributes>
-                             s_stats_attributes;
+        ~Epoch() {
+            delete[] m_hash_slots;
+            clear_key_blocks();
+        }
 
-    static const ConfigSet::Entry
-                             s_configdata[];
-    static ConfigSet         s_config;
+        /// \brief Copy a long hash key into the key storage. Blocks are
+        ///   only allocated if \a alloc is true.
+        unsigned char* store_key(const unsigned char* key, size_t n, bool alloc) {
+            for ( ; m_key_block < m_key_blocks.size(); ++m_key_block, m_key_pos = 0) {
+                const KeyBlock& b = m_key_blocks[m_key_block];
 
-    static pthread_key_t     s_aggregate_db_key;
+                if (m_key_pos + n <= b.size) {
+                    unsigned char* ptr = b.data + m_key_pos;
 
-    static AggregateDB*      s_list;
-    static util::spinlock    s_list_lock;
+                    memcpy(ptr, key, n);
+                    m_key_pos += n;
 
-    // global statistics
-    static size_t            s_global_num_trie_entries;
-    static size_t            s_global_num_kernel_entries;
-    static size_t            s_global_num_trie_blocks;
-    static size_t            s_global_num_kernel_blocks;
-    static size_t            s_global_num_dropped;
-    static size_t            s_global_num_skipped_keys;
-    static size_t            s_global_max_keylen;
+                    return ptr;
+                }
+            }
 
+            if (!alloc)
+                return nullptr;
 
-    //
-    // --- helper functions
-    //
+            size_t size = std::max<size_t>(KEY_BLOCK_SIZE, n);
 
-    void unlink() {
-        if (m_next)
-            m_next->m_prev = m_prev;
-        if (m_prev)
-            m_prev->m_next = m_next;
-    }
+            m_key_blocks.push_back({ new unsigned char[size], size });
+            m_key_block = m_key_blocks.size() - 1;
+            m_key_pos   = n;
+
+            memcpy(m_key_blocks.back().data, key, n);
+
+            return m_key_blocks.back().data;
+        }
+
+        void clear_key_blocks() {
+            for (KeyBlock& b : m_key_blocks)
+                delete[] b.data;
 
-    TrieNode* find_entry(size_t n, unsigned char* key, bool alloc) {
-        TrieNode* entry = m_trie.get(0, alloc);
+            m_key_blocks.clear();
+            m_key_block = 0;
+            m_key_pos   = 0;
+        }
+
+        /// \brief Allocate the kernel value slots and histograms of \a entry.
+        ///   The slots of an entry are kept in one block.
+        bool init_kernels(AggregateEntry* entry, bool alloc) {
+            if (entry->k_id != 0xFFFFFFFF)
+                return true;
+
+            if (s_kernel_slots > 0) {
+                size_t first_id = m_num_kernel_entries + 1;
+
+                if (first_id % KERNEL_BLOCK_SLOTS + s_kernel_slots > KERNEL_BLOCK_SLOTS)
+                    first_id += KERNEL_BLOCK_SLOTS - first_id % KERNEL_BLOCK_SLOTS;
+
+                double* k = m_kernels.get(first_id, alloc);
+
+                if (k == 0)
+                    return false;
+
+                for (const StatisticsAttributes& st : s_stats_attributes)
+                    if (st.kernel.num_slots > 0)
+                        st.kernel.init(k + st.k_offset);
+
+                m_num_kernel_entries = first_id + s_kernel_slots - 1;
+                entry->k_id = static_cast<uint32_t>(first_id);
+            }
+
+            if (s_num_histograms > 0 && entry->h_id == 0) {
+                uint32_t first_id = static_cast<uint32_t>(m_num_histograms + 1);
 
-        for ( size_t i = 0; entry && i < n; ++i ) {
-            uint32_t id = entry->next[key[i]];
+                for (size_t i = 0; i < s_num_histograms; ++i)
+                    if (m_histograms.get(first_id + i, alloc) == 0)
+                        return false;
 
-            if (!id) {
-                id = static_cast<uint32_t>(++m_num_trie_entries);
-                entry->next[key[i]] = id;
+                m_num_histograms += s_num_histograms;
+                entry->h_id = first_id;
             }
 
-            entry = m_trie.get(id, alloc);
+            return true;
         }
-        
-        if (entry && entry->k_id == 0xFFFFFFFF) {
-            size_t num_ids = s_aggr_attributes.size();
 
-            if (num_ids > 0) {
-                uint32_t first_id = static_cast<uint32_t>(m_num_kernel_entries + 1);
+        bool init_distinct(AggregateEntry* entry, bool alloc) {
+            if (entry->d_id != 0xFFFFFFFF)
+                return true;
 
-                m_num_kernel_entries += num_ids;
+            size_t num_ids = s_distinct_attributes.size();
+
+            if (num_ids > 0) {
+                uint32_t first_id = static_cast<uint32_t>(m_num_distinct + 1);
 
                 for (unsigned i = 0; i < num_ids; ++i)
-                    if (m_kernels.get(first_id + i, alloc) == 0)
-                        return 0;
+                    if (m_distinct.get(first_id + i, alloc) == 0)
+                        return false;
 
-                entry->k_id = first_id;
+                m_num_distinct += num_ids;
+                entry->d_id     = first_id;
             }
+
+            return true;
         }
 
-        return entry;
-    }
+        /// \brief Allocate storage for the next SIGNAL_RESERVE new entries
+        ///   ahead of time, so that signal handlers (which can't allocate
+        ///   memory) can create them. Called outside of signal handlers.
+        void replenish() {
+            if (s_key_index == KeyIndex::Hash) {
+                if (4 * (m_num_hash_entries + SIGNAL_RESERVE) > 3 * m_hash_size)
+                    grow_hash_table();
 
-    void write_aggregated_snapshot(const unsigned char* key, const TrieNode* entry, Caliper* c,
-                                   Caliper::SnapshotFlushFn proc_fn) {
-        SnapshotRecord::FixedSnapshotRecord<SNAP_MAX> snapshot_data;
-        SnapshotRecord snapshot(snapshot_data);
+                m_hash_entries.get(m_num_hash_entries + SIGNAL_RESERVE, true);
 
-        // --- decode key
+                // key storage for long keys
+                if (m_max_keylen > INLINE_KEYLEN) {
+                    size_t need  = SIGNAL_RESERVE * m_max_keylen;
+                    size_t avail = 0;
 
-        size_t    p = 0;
+                    for (size_t b = m_key_block; b < m_key_blocks.size() && avail < need; ++b)
+                        avail += m_key_blocks[b].size - (b == m_key_block ? m_key_pos : 0);
 
-        uint64_t  toc = vldec_u64(key+p, &p); // first entry is 2*num_nodes + (1 : w/ immediate, 0 : w/o immediate)
-        int       num_nodes = static_cast<int>(toc)/2;
-        
-        for (int i = 0; i < std::min(num_nodes, SNAP_MAX); ++i)
-            snapshot.append(c->node(vldec_u64(key + p, &p)));
+                    if (avail < need) {
+                        size_t size = std::max<size_t>(KEY_BLOCK_SIZE, need);
+                        m_key_blocks.push_back({ new unsigned char[size], size });
+                    }
+                }
+            } else {
+                // a new key can add several trie nodes
+                m_trie.get(m_num_trie_entries + 4 * SIGNAL_RESERVE, true);
+            }
 
-        if (toc % 2 == 1) {
-            // there are immediate key entries
+            if (s_kernel_slots > 0)
+                m_kernels.get(m_num_kernel_entries + (SIGNAL_RESERVE + 1) * s_kernel_slots, true);
+            if (s_num_histograms > 0)
+                m_histograms.get(m_num_histograms + SIGNAL_RESERVE * s_num_histograms, true);
+            if (!s_distinct_attributes.empty())
+                m_distinct.get(m_num_distinct + SIGNAL_RESERVE * s_distinct_attributes.size(), true);
+        }
 
-            uint64_t imm_bitfield = vldec_u64(key+p, &p);
+        AggregateEntry* find_trie_entry(size_t n, unsigned char* key, bool alloc) {
+            TrieNode* entry = m_trie.get(0, alloc);
 
-            for (size_t k = 0; k < s_key_attribute_ids.size(); ++k)
-                if (imm_bitfield & (1 << k)) {
-                    uint64_t val = vldec_u64(key+p, &p);
-                    Variant  v(s_key_attributes[k].type(), &val, sizeof(uint64_t));
+            for ( size_t i = 0; entry && i < n; ++i ) {
+                uint32_t id = entry->next[key[i]];
 
-                    snapshot.append(s_key_attribute_ids[k], v);
+                if (!id) {
+                    id = static_cast<uint32_t>(++m_num_trie_entries);
+                    entry->next[key[i]] = id;
                 }
+
+                entry = m_trie.get(id, alloc);
+            }
+
+            return entry;
         }
 
-        // --- write aggregate entries
+        static uint32_t hash_key(size_t n, const unsigned char* key) {
+            // FNV-1a
+            uint32_t h = 2166136261u;
 
-        int       num_aggr_attr = s_aggr_attributes.size();
+            for (size_t i = 0; i < n; ++i) {
+                h ^= key[i];
+                h *= 16777619u;
+            }
 
-        Variant   attr_vec[SNAP_MAX];
-        Variant   data_vec[SNAP_MAX];
+            return h;
+        }
 
-        for (int a = 0; a < std::min(num_aggr_attr, SNAP_MAX/3); ++a) {
-            AggregateKernel* k = m_kernels.get(entry->k_id+a, false);
+        void grow_hash_table() {
+            size_t    new_size  = 2 * m_hash_size;
+            uint32_t* new_slots = new uint32_t[new_size];
 
-            if (!k)
-                break;
-            if (k->count == 0)
-                continue;
+            std::fill_n(new_slots, new_size, 0);
 
-            snapshot.append(s_stats_attributes[a].min_attr.id(), Variant(k->min));
-            snapshot.append(s_stats_attributes[a].max_attr.id(), Variant(k->max));
-            snapshot.append(s_stats_attributes[a].sum_attr.id(), Variant(k->sum));
-            snapshot.append(s_stats_attributes[a].avg_attr.id(), Variant(k->avg));
+            for (size_t id = 1; id <= m_num_hash_entries; ++id) {
+                HashEntry* e = m_hash_entries.get(id, false);
+
+                if (!e)
+                    continue;
+
+                size_t s = e->hash & (new_size - 1);
+
+                while (new_slots[s])
+                    s = (s + 1) & (new_size - 1);
+
+                new_slots[s] = static_cast<uint32_t>(id);
+            }
+
+            delete[] m_hash_slots;
+
+            m_hash_slots = new_slots;
+            m_hash_size  = new_size;
         }
 
-        uint64_t count = entry->count;
+        AggregateEntry* find_hash_entry(size_t n, unsigned char* key, bool alloc) {
+            uint32_t h = hash_key(n, key);
+            size_t   s = h & (m_hash_size - 1);
 
-        snapshot.append(s_count_attribute.id(), Variant(CALI_TYPE_UINT, &count, sizeof(uint64_t)));
+            for (uint32_t id = m_hash_slots[s]; id; id = m_hash_slots[s]) {
+                HashEntry* e = m_hash_entries.get(id, false);
 
-        // --- write snapshot record
+                if (e && e->hash == h && e->keylen == n && memcmp(e->key_data(), key, n) == 0)
+                    return e;
 
-        proc_fn(&snapshot);
-    }
+                s = (s + 1) & (m_hash_size - 1);
+            }
 
-    size_t recursive_flush(size_t n, unsigned char* key, TrieNode* entry, Caliper* c, Caliper::SnapshotFlushFn proc_fn) {
-        if (!entry)
-            return 0;
+            // Not found: insert new entry. Keep load factor below 3/4. In
+            // signal handlers we can't re-hash, but take free slots up to 7/8.
 
-        size_t num_written = 0;
+            if (4 * (m_num_hash_entries + 1) > 3 * m_hash_size) {
+                if (alloc) {
+                    grow_hash_table();
+
+                    s = h & (m_hash_size - 1);
+
+                    while (m_hash_slots[s])
+                        s = (s + 1) & (m_hash_size - 1);
+                } else if (8 * (m_num_hash_entries + 1) > 7 * m_hash_size)
+                    return 0;
+            }
+
+            uint32_t   id = static_cast<uint32_t>(m_num_hash_entries + 1);
+            HashEntry* e  = m_hash_entries.get(id, alloc);
+
+            if (!e)
+                return 0;
+
+            if (n > INLINE_KEYLEN) {
+                e->long_key = store_key(key, n, alloc);
+
+                if (!e->long_key)
+                    return 0;
+            } else {
+                memcpy(e->key, key, n);
+            }
+
+            e->hash   = h;
+            e->keylen = static_cast<uint32_t>(n);
+
+            m_hash_slots[s]    = id;
+            m_num_hash_entries = id;
+
+            return e;
+        }
+
+        AggregateEntry* find_entry(size_t n, unsigned char* key, bool alloc) {
+            AggregateEntry* entry = nullptr;
+
+            m_max_keylen = std::max(n, m_max_keylen);
+
+            if (s_key_index == KeyIndex::Hash)
+                entry = find_hash_entry(n, key, alloc);
+            else
+                entry = find_trie_entry(n, key, alloc);
+
+            if (entry && !init_kernels(entry, alloc))
+                return 0;
+            if (entry && !init_distinct(entry, alloc))
+                return 0;
+
+            return entry;
+        }
+
+        void write_aggregated_snapshot(const unsigned char* key, const AggregateEntry* entry, Caliper* c,
+                                       Caliper::SnapshotFlushFn proc_fn) {
+            RecordBuffer& snapshot(m_record_buf);
+
+            snapshot.clear();
+
+            if (s_epoch_attribute != Attribute::invalid)
+                snapshot.append(s_epoch_attribute.id(), Variant(CALI_TYPE_UINT, &m_number, sizeof(uint64_t)));
+
+            // --- decode key
+
+            size_t    p = 0;
+
+            uint64_t  toc = vldec_u64(key+p, &p); // first entry is 2*num_nodes + (1 : w/ immediate, 0 : w/o immediate)
+            int       num_nodes = static_cast<int>(toc)/2;
+
+            for (int i = 0; i < num_nodes; ++i)
+                snapshot.append(c->node(vldec_u64(key + p, &p)));
+
+            if (toc % 2 == 1) {
+                // there are immediate key entries
+
+                uint64_t imm_bitfield = vldec_u64(key+p, &p);
+
+                for (size_t k = 0; k < s_key_attribute_ids.size() && k < 64; ++k)
+                    if (imm_bitfield & (UINT64_C(1) << k)) {
+                        uint64_t val = vldec_u64(key+p, &p);
+                        Variant  v(s_key_attributes[k].type(), &val, sizeof(uint64_t));
+
+                        snapshot.append(s_key_attribute_ids[k], v);
+                    }
+            }
+
+            // --- write aggregate entries
+
+            int       num_aggr_attr = std::min<int>(s_aggr_attributes.size(), MAX_KERNEL_ATTRS);
+
+            const double* kernels =
+                (entry->k_id != 0xFFFFFFFF ? m_kernels.get(entry->k_id, false) : nullptr);
+
+            for (int a = 0; kernels && a < num_aggr_attr; ++a) {
+                const StatisticsAttributes& st = s_stats_attributes[a];
+
+                if (!(entry->k_mask & (1u << a)) || st.kernel.num_slots == 0)
+                    continue;
+
+                const double* k = kernels + st.k_offset;
+                unsigned      i = 0;
+
+                if (st.ops & KernelMin)
+                    snapshot.append(st.min_attr.id(), Variant(k[i++]));
+                if (st.ops & KernelMax)
+                    snapshot.append(st.max_attr.id(), Variant(k[i++]));
+
+                double sum = k[i++];
+
+                if (st.ops & KernelSum)
+                    snapshot.append(st.sum_attr.id(), Variant(sum));
+                if (st.ops & KernelAvg)
+                    snapshot.append(st.avg_attr.id(), Variant(sum / k[i]));
+            }
+
+            // The count is the (rounded) sum of sample weights, which is
+            // the plain record count for unsampled snapshots
+            uint64_t count = static_cast<uint64_t>(entry->weight + 0.5);
+
+            snapshot.append(s_count_attribute.id(), Variant(CALI_TYPE_UINT, &count, sizeof(uint64_t)));
+
+            // --- write distinct-value counts, and the counters for re-aggregation
+
+            if (entry->d_id != 0xFFFFFFFF) {
+                std::vector<uint64_t> codes;
+
+                for (size_t d = 0; d < s_distinct_attributes.size(); ++d) {
+                    const HyperLogLog* hll = m_distinct.get(entry->d_id + d, false);
+
+                    if (!hll || hll->empty())
+                        continue;
+
+                    snapshot.append(s_distinct_attributes[d].result_attr.id(),
+                                    Variant(cali_make_variant_from_uint(hll->estimate())));
+
+                    codes.clear();
+                    hll->encode(codes);
+
+                    for (uint64_t code : codes)
+                        snapshot.append(s_distinct_attributes[d].hll_attr.id(),
+                                        Variant(cali_make_variant_from_uint(code)));
+                }
+            }
+
+            // --- write non-empty histogram bins last: they are dropped if the record is full
+
+            for (int a = 0; entry->h_id && a < num_aggr_attr; ++a) {
+                const StatisticsAttributes& st = s_stats_attributes[a];
+
+                if (!(entry->k_mask & (1u << a)) || st.hist_index < 0)
+                    continue;
+
+                const Histogram* h = m_histograms.get(entry->h_id + st.hist_index, false);
+
+                if (!h)
+                    continue;
+
+                for (int b = 0; b < HISTOGRAM_BINS; ++b)
+                    if (h->bins[b] > 0)
+                        snapshot.append(s_stats_attributes[a].hist_attrs[b].id(),
+                                        Variant(static_cast<uint64_t>(h->bins[b])));
+            }
+
+            // --- write snapshot record
+
+            SnapshotRecord rec = snapshot.record();
+            proc_fn(&rec);
+        }
+
+        /// \brief Write the trie entries below \a entry. \a key holds the key
+        ///   prefix of length \a n and must have room for m_max_keylen bytes.
+        size_t recursive_flush(size_t n, unsigned char* key, TrieNode* entry, Caliper* c, Caliper::SnapshotFlushFn proc_fn) {
+            if (!entry)
+                return 0;
+
+            size_t num_written = 0;
+
+            // --- write current entry if it represents a snapshot
+
+            if (entry->count > 0)
+                write_aggregated_snapshot(key, entry, c, proc_fn);
+
+            num_written += (entry->count > 0 ? 1 : 0);
+
+            // --- iterate over sub-records
+
+            for (size_t i = 0; i < 256 && n < m_max_keylen; ++i) {
+                if (entry->next[i] == 0)
+                    continue;
+
+                TrieNode* e  = m_trie.get(entry->next[i], false);
+                key[n]       = static_cast<unsigned char>(i);
+
+                num_written += recursive_flush(n+1, key, e, c, proc_fn);
+            }
 
-        // --- write current entry if it represents a snapshot
+            return num_written;
+        }
+
+        size_t hash_flush(Caliper* c, Caliper::SnapshotFlushFn proc_fn) {
+            size_t num_written = 0;
+
+            for (size_t id = 1; id <= m_num_hash_entries; ++id) {
+                HashEntry* e = m_hash_entries.get(id, false);
+
+                if (e && e->count > 0) {
+                    write_aggregated_snapshot(e->key_data(), e, c, proc_fn);
+                    ++num_written;
+                }
+            }
+
+            return num_written;
+        }
+
+        template<typename F>
+        void recursive_for_each(size_t n, unsigned char* key, const TrieNode* entry, F& fn) const {
+            if (!entry)
+                return;
+            if (entry->count > 0)
+                fn(n, key, entry);
+
+            for (size_t i = 0; i < 256 && n < m_max_keylen; ++i)
+                if (entry->next[i]) {
+                    key[n] = static_cast<unsigned char>(i);
+                    recursive_for_each(n+1, key, m_trie.get(entry->next[i], false), fn);
+                }
+        }
+
+        /// \brief Invoke \a fn(keylen, key, entry) for each non-empty entry
+        template<typename F>
+        void for_each_entry(F fn) const {
+            if (s_key_index == KeyIndex::Hash) {
+                for (size_t id = 1; id <= m_num_hash_entries; ++id) {
+                    const HashEntry* e = m_hash_entries.get(id, false);
+
+                    if (e && e->count > 0)
+                        fn(e->keylen, e->key_data(), e);
+                }
+            } else {
+                std::vector<unsigned char> key(m_max_keylen + 1, 0);
+                recursive_for_each(0, key.data(), m_trie.get(0, false), fn);
+            }
+        }
+
+        /// \brief Add the entries of \a src to this epoch. Key node ids
+        ///   are translated with \a node_map, and immediate key entries
+        ///   in \a drop_imm are removed from the key.
+        void merge_from(const Epoch& src, const std::unordered_map<cali_id_t, cali_id_t>& node_map, uint64_t drop_imm) {
+            std::vector<unsigned char> newkey;
+
+            src.for_each_entry([this,&src,&node_map,drop_imm,&newkey](size_t, const unsigned char* key, const AggregateEntry* e){
+                    size_t          len = translate_key(key, newkey, node_map, drop_imm);
+                    AggregateEntry* d   = find_entry(len, newkey.data(), true);
+
+                    if (!d) {
+                        ++m_num_dropped;
+                        return;
+                    }
+
+                    d->count  += e->count;
+                    d->weight += e->weight;
+
+                    const double* sk =
+                        (e->k_id != 0xFFFFFFFF ? src.m_kernels.get(e->k_id, false) : nullptr);
+                    double*       dk =
+                        (d->k_id != 0xFFFFFFFF ? m_kernels.get(d->k_id, false) : nullptr);
+
+                    for (size_t a = 0; a < std::min<size_t>(s_stats_attributes.size(), MAX_KERNEL_ATTRS); ++a) {
+                        const StatisticsAttributes& st = s_stats_attributes[a];
+
+                        if (!(e->k_mask & (1u << a)))
+                            continue;
+
+                        d->k_mask |= (1u << a);
+
+                        if (sk && dk && st.kernel.num_slots > 0)
+                            st.kernel.merge(dk + st.k_offset, sk + st.k_offset);
+
+                        if (e->h_id && d->h_id && st.hist_index >= 0) {
+                            const Histogram* sh = src.m_histograms.get(e->h_id + st.hist_index, false);
+                            Histogram*       dh = m_histograms.get(d->h_id + st.hist_index, false);
+
+                            if (sh && dh)
+                                for (int b = 0; b < HISTOGRAM_BINS; ++b)
+                                    dh->bins[b] += sh->bins[b];
+                        }
+                    }
+
+                    if (e->d_id != 0xFFFFFFFF && d->d_id != 0xFFFFFFFF)
+                        for (size_t i = 0; i < s_distinct_attributes.size(); ++i) {
+                            const HyperLogLog* sh = src.m_distinct.get(e->d_id + i, false);
+                            HyperLogLog*       dh = m_distinct.get(d->d_id + i, false);
+
+                            if (sh && dh)
+                                dh->merge(*sh);
+                        }
+                });
+        }
+
+        size_t bytes_reserved() const {
+            return m_trie.num_blocks()         * sizeof(TrieNode)        * 1024
+                +  m_hash_entries.num_blocks() * sizeof(HashEntry)       * 1024
+                +  m_kernels.num_blocks()      * sizeof(double)          * KERNEL_BLOCK_SLOTS
+                +  m_histograms.num_blocks()   * sizeof(Histogram)       * 1024
+                +  m_distinct.num_blocks()     * sizeof(HyperLogLog)     * 1024
+                +  m_hash_size                 * sizeof(uint32_t)
+                +  m_key_blocks.size()         * KEY_BLOCK_SIZE;
+        }
+
+        size_t bytes_used() const {
+            size_t key_bytes = m_key_pos;
+
+            for (size_t b = 0; b < m_key_block && b < m_key_blocks.size(); ++b)
+                key_bytes += m_key_blocks[b].size;
+
+            return m_num_trie_entries          * sizeof(TrieNode)
+                +  m_num_hash_entries          * (sizeof(HashEntry) + sizeof(uint32_t))
+                +  m_num_kernel_entries        * sizeof(double)
+                +  m_num_histograms            * sizeof(Histogram)
+                +  m_num_distinct              * sizeof(HyperLogLog)
+                +  key_bytes;
+        }
+
+        void clear() {
+            m_trie.clear();
+            m_hash_entries.clear();
+            m_kernels.clear();
+            m_histograms.clear();
+            m_distinct.clear();
+
+            clear_key_blocks();
+
+            std::fill_n(m_hash_slots, m_hash_size, 0);
+
+            m_node_entries.clear();
+
+            m_num_trie_entries   = 0;
+            m_num_hash_entries   = 0;
+            m_num_kernel_entries = 0;
+            m_num_histograms     = 0;
+            m_num_distinct       = 0;
+            m_num_dropped        = 0;
+            m_num_signal_dropped = 0;
+            m_num_skipped_keys   = 0;
+            m_max_keylen         = 0;
+        }
+
+        /// \brief Clear the aggregation data, but keep the allocated
+        ///   blocks for re-use
+        void reset() {
+            m_trie.reset();
+            m_hash_entries.reset();
+            m_kernels.reset();
+            m_histograms.reset();
+            m_distinct.reset();
+
+            m_key_block = 0;
+            m_key_pos   = 0;
+
+            std::fill_n(m_hash_slots, m_hash_size, 0);
+
+            m_node_entries.clear();
+
+            m_num_trie_entries   = 0;
+            m_num_hash_entries   = 0;
+            m_num_kernel_entries = 0;
+            m_num_histograms     = 0;
+            m_num_distinct       = 0;
+            m_num_dropped        = 0;
+            m_num_signal_dropped = 0;
+            m_num_skipped_keys   = 0;
+            m_max_keylen         = 0;
+        }
+
+        bool empty() const {
+            return m_num_trie_entries == 0 && m_num_hash_entries == 0;
+        }
+
+        size_t flush(Caliper* c, Caliper::SnapshotFlushFn proc_fn) {
+            if (s_key_index == KeyIndex::Hash)
+                return hash_flush(c, proc_fn);
+
+            TrieNode* entry = m_trie.get(0, false);
+            std::vector<unsigned char> key(m_max_keylen + 1, 0);
+
+            return recursive_flush(0, key.data(), entry, c, proc_fn);
+        }
+    };
+
+    alignas(util::cacheline_size)
+    std::atomic<Epoch*>      m_epoch;   ///< Current epoch. Flush/clear and time slicing swap it.
+    std::atomic<int>         m_active;  ///< Owner thread is updating the current epoch
+
+    // Time-sliced aggregation: completed time slices waiting for a flush,
+    // and reset epochs for re-use
+    alignas(util::cacheline_size)
+    std::vector<Epoch*>      m_completed;
+    std::vector<Epoch*>      m_spare;
+    util::spinlock           m_epoch_list_lock;
+
+    alignas(util::cacheline_size)
+    Node                     m_aggr_root_node;
+
+    std::vector<unsigned char> m_key_pool; ///< Encoding buffer for keys larger than STACK_KEYLEN
+
+    /// \brief Open region in fused timing mode
+    struct FusedRegion {
+        cali_id_t attr;
+        uint64_t  start; ///< Begin time (usec)
+    };
+
+    std::vector<FusedRegion> m_fused_regions;
+
+    //
+    // --- static data
+    //
+
+    struct StatisticsAttributes {
+        Attribute min_attr;
+        Attribute max_attr;
+        Attribute sum_attr;
+        Attribute avg_attr;
+
+        std::vector<Attribute> hist_attrs; ///< Histogram bin attributes; empty if no histogram
+
+        bool      weighted;   ///< Scale values by the sample weight
+
+        unsigned  ops;        ///< Kernel operations (KernelOp bits)
+        KernelFns kernel;     ///< Kernel for ops
+        unsigned  k_offset;   ///< Offset of the kernel slots in an entry
+        int       hist_index; ///< Histogram index in an entry, -1 if none
+    };
+
+    static Attribute         s_count_attribute;
+
+    static vector<cali_id_t> s_key_attribute_ids;
+    static vector<Attribute> s_key_attributes;
+    static vector<string>    s_key_attribute_names;
+    static vector<int>       s_key_attribute_depths; ///< Path depth limit per key attribute, 0 if none
+    static bool              s_has_key_depth;
+    static vector<Attribute> s_aggr_attributes;
+    static vector<string>    s_aggr_attribute_names;
+    static vector<StatisticsAttributes>
+                             s_stats_attributes;
+    static vector<string>    s_histogram_attribute_names;
+    static vector<string>    s_weighted_attribute_names;
+    static cali_id_t         s_weight_attr_id;
+    static vector<string>    s_kernel_specs;
+    static size_t            s_kernel_slots;   ///< Kernel value slots per entry
+    static size_t            s_num_histograms; ///< Histograms per entry
+
+    struct DistinctAttributes {
+        std::string name;
+        cali_id_t   target_id;   ///< Attribute to count distinct values of
+        Attribute   result_attr; ///< count_distinct#name
+        Attribute   hll_attr;    ///< distinct.hll#name: HyperLogLog registers
+    };
+
+    static vector<DistinctAttributes>
+                             s_distinct_attributes;
+    static double            s_histogram_min;
+
+    static const ConfigSet::Entry
+                             s_configdata[];
+    static ConfigSet         s_config;
+
+    static KeyIndex          s_key_index;
+    static bool              s_epoch_flush;
+
+    // time-sliced aggregation
+    static Attribute         s_epoch_attribute;   ///< aggregate.epoch, invalid if not time-sliced
+    static std::atomic<uint64_t>
+                             s_epoch_counter;     ///< Current time slice number
+    static double            s_epoch_interval;
+    static std::string       s_epoch_loop_attr_name;
+    static cali_id_t         s_epoch_loop_attr_id;
+    static uint64_t          s_epoch_iterations;
+    static std::atomic<uint64_t>
+                             s_epoch_loop_count;
+
+    // in-process merge of the per-thread databases
+    static bool              s_merge_threads;
+    static unsigned          s_merge_workers;
+    static vector<string>    s_merge_drop_names;
+    static Node              s_merge_root_node;
+
+    // node-local aggregation in shared memory
+    static ShmAggregateDB*   s_shm_db;
+
+    static std::thread       s_epoch_timer;
+    static std::mutex        s_epoch_timer_lock;
+    static std::condition_variable
+                             s_epoch_timer_cv;
+    static bool              s_epoch_timer_stop;
+
+    static pthread_key_t     s_aggregate_db_key;
+
+    static bool              s_fused_timing;
+    static Attribute         s_fused_duration_attr;
+    static int               s_fused_index; ///< Index of the duration in s_aggr_attributes, -1 if none
+
+    static AggregateDB*      s_list;
+    static util::spinlock    s_list_lock;
+
+    // global statistics
+    static size_t            s_global_num_trie_entries;
+    static size_t            s_global_num_hash_entries;
+    static size_t            s_global_num_kernel_entries;
+    static size_t            s_global_num_trie_blocks;
+    static size_t            s_global_num_hash_blocks;
+    static size_t            s_global_num_hash_slots;
+    static size_t            s_global_num_kernel_blocks;
+    static size_t            s_global_num_histogram_blocks;
+    static size_t            s_global_num_distinct_blocks;
+    static size_t            s_global_num_dropped;
+    static size_t            s_global_num_signal_dropped;
+    static size_t            s_global_num_skipped_keys;
+    static size_t            s_global_max_keylen;
+
+
+    //
+    // --- helper functions
+    //
+
+    /// \brief Swap in a fresh epoch and return the previous one once the
+    ///   owner thread no longer updates it.
+    Epoch* flip_epoch() {
+        Epoch* prev = m_epoch.exchange(new_epoch(s_epoch_counter.load()));
+
+        while (m_active.load() > 0)
+            ;
+
+        return prev;
+    }
+
+    /// \brief Get a spare epoch or allocate a new one
+    Epoch* new_epoch(uint64_t number) {
+        Epoch* epoch = nullptr;
+
+        {
+            std::lock_guard<util::spinlock>
+                g(m_epoch_list_lock);
+
+            if (!m_spare.empty()) {
+                epoch = m_spare.back();
+                m_spare.pop_back();
+            }
+        }
+
+        if (!epoch)
+            epoch = new Epoch;
+
+        epoch->m_number = number;
+
+        return epoch;
+    }
+
+    /// \brief Reset \a epoch and keep it for re-use
+    void recycle_epoch(Epoch* epoch) {
+        epoch->reset();
+
+        {
+            std::lock_guard<util::spinlock>
+                g(m_epoch_list_lock);
+
+            if (m_spare.size() < 2) {
+                m_spare.push_back(epoch);
+                epoch = nullptr;
+            }
+        }
+
+        delete epoch;
+    }
+
+    /// \brief Start a new epoch if the time slice has changed.
+    ///   Only called by the owner thread, with m_active set, and not
+    ///   in signal handlers.
+    void check_time_slice() {
+        uint64_t number  = s_epoch_counter.load(std::memory_order_relaxed);
+        Epoch*   current = m_epoch.load();
+
+        if (current->m_number == number)
+            return;
+
+        Epoch*   fresh   = new_epoch(number);
+
+        if (m_epoch.compare_exchange_strong(current, fresh)) {
+            if (current->empty()) {
+                recycle_epoch(current);
+            } else {
+                std::lock_guard<util::spinlock>
+                    g(m_epoch_list_lock);
+
+                m_completed.push_back(current);
+            }
+        } else {
+            // a flush swapped the epoch in the meantime
+            recycle_epoch(fresh);
+        }
+    }
+
+    /// \brief Return the completed time slices. In epoch flush mode,
+    ///   they are removed from the list.
+    std::vector<Epoch*> completed_epochs(bool remove) {
+        std::lock_guard<util::spinlock>
+            g(m_epoch_list_lock);
+
+        std::vector<Epoch*> ret(m_completed);
+
+        if (remove)
+            m_completed.clear();
+
+        return ret;
+    }
+
+    /// \brief Re-encode an aggregation key into \a out with node ids
+    ///   translated through \a node_map (CALI_INV_ID removes the node)
+    ///   and the immediate key entries in the \a drop_imm bitfield removed.
+    ///   Returns the new key length.
+    static size_t translate_key(const unsigned char* key, std::vector<unsigned char>& out,
+                                const std::unordered_map<cali_id_t, cali_id_t>& node_map,
+                                uint64_t drop_imm) {
+        size_t    p   = 0;
+        uint64_t  toc = vldec_u64(key+p, &p);
+        size_t    n   = toc/2;
+
+        std::vector<cali_id_t> ids;
+
+        ids.reserve(n);
+
+        for (size_t i = 0; i < n; ++i) {
+            cali_id_t id = vldec_u64(key+p, &p);
+            auto      it = node_map.find(id);
+
+            if (it != node_map.end())
+                id = it->second;
+            if (id != CALI_INV_ID)
+                ids.push_back(id);
+        }
+
+        if (s_key_attribute_ids.empty())
+            std::sort(ids.begin(), ids.end());
+
+        uint64_t  imm_bitfield = 0;
+        std::vector<uint64_t> imm_vals;
+
+        if (toc % 2 == 1) {
+            uint64_t bitfield = vldec_u64(key+p, &p);
+
+            for (size_t k = 0; k < s_key_attribute_ids.size() && k < 64; ++k)
+                if (bitfield & (UINT64_C(1) << k)) {
+                    uint64_t val = vldec_u64(key+p, &p);
+
+                    if (!(drop_imm & (UINT64_C(1) << k))) {
+                        imm_bitfield |= (UINT64_C(1) << k);
+                        imm_vals.push_back(val);
+                    }
+                }
+        }
+
+        // encode like process_snapshot()
+
+        out.resize(10 * (ids.size() + imm_vals.size() + 2));
+
+        size_t pos = vlenc_u64(ids.size() * 2 + (imm_bitfield ? 1 : 0), out.data());
+
+        for (cali_id_t id : ids)
+            pos += vlenc_u64(id, out.data() + pos);
+
+        if (imm_bitfield) {
+            pos += vlenc_u64(imm_bitfield, out.data() + pos);
+
+            for (uint64_t val : imm_vals)
+                pos += vlenc_u64(val, out.data() + pos);
+        }
+
+        return pos;
+    }
+
+    /// \brief Map the key node ids in \a epoch to process-wide nodes.
+    ///   Key nodes built from key attributes live under each thread's
+    ///   own aggregation root and are re-created under a common root;
+    ///   nodes of the dropped attributes are removed from the paths.
+    static void map_key_nodes(Caliper* c, const Epoch* epoch, const std::vector<cali_id_t>& drop_ids,
+                              std::unordered_map<cali_id_t, cali_id_t>& node_map) {
+        epoch->for_each_entry([c,&drop_ids,&node_map](size_t, const unsigned char* key, const AggregateEntry*){
+                size_t   p   = 0;
+                uint64_t toc = vldec_u64(key+p, &p);
+
+                for (size_t i = 0; i < toc/2; ++i) {
+                    cali_id_t id = vldec_u64(key+p, &p);
+
+                    if (node_map.count(id))
+                        continue;
+
+                    std::vector<const Node*> path;
+                    bool changed = !s_key_attribute_ids.empty();
+
+                    for (const Node* node = c->node(id); node && node->id() != CALI_INV_ID; node = node->parent())
+                        if (std::find(drop_ids.begin(), drop_ids.end(), node->attribute()) != drop_ids.end())
+                            changed = true;
+                        else
+                            path.push_back(node);
+
+                    cali_id_t mapped = id;
+
+                    if (path.empty()) {
+                        mapped = CALI_INV_ID;
+                    } else if (changed) {
+                        std::reverse(path.begin(), path.end());
+
+                        const Node* node = c->make_tree_entry(path.size(), path.data(), &s_merge_root_node);
+                        mapped = (node ? node->id() : id);
+                    }
+
+                    node_map[id] = mapped;
+                }
+            });
+    }
+
+    /// \brief Run \a fn(i) for i in [0, n) on up to s_merge_workers threads
+    template<typename F>
+    static void parallel_for(size_t n, F fn) {
+        size_t nthreads = std::min<size_t>(n, s_merge_workers);
+
+        if (nthreads <= 1) {
+            for (size_t i = 0; i < n; ++i)
+                fn(i);
+
+            return;
+        }
+
+        std::atomic<size_t>      next { 0 };
+        std::vector<std::thread> threads;
+
+        for (size_t t = 0; t < nthreads; ++t)
+            threads.emplace_back([&next,n,&fn](){
+                    for (size_t i = next++; i < n; i = next++)
+                        fn(i);
+                });
+
+        for (std::thread& t : threads)
+            t.join();
+    }
+
+    /// \brief Merge the epochs of one time slice into a single epoch with
+    ///   a tree reduction. The first round translates the thread-specific
+    ///   keys, later rounds merge pairs of results in parallel.
+    static Epoch* reduce_epochs(const std::vector<Epoch*>& epochs,
+                                const std::unordered_map<cali_id_t, cali_id_t>& node_map,
+                                uint64_t drop_imm) {
+        std::vector<Epoch*> parts(epochs.size(), nullptr);
+        const std::unordered_map<cali_id_t, cali_id_t> identity;
+
+        parallel_for(epochs.size(), [&](size_t i){
+                parts[i] = new Epoch;
+                parts[i]->m_number = epochs[i]->m_number;
+                parts[i]->merge_from(*epochs[i], node_map, drop_imm);
+            });
+
+        for (size_t stride = 1; stride < parts.size(); stride *= 2)
+            parallel_for((parts.size() + 2*stride - 1) / (2*stride), [&](size_t i){
+                    size_t a = 2*stride*i;
+                    size_t b = a + stride;
+
+                    if (b < parts.size()) {
+                        parts[a]->merge_from(*parts[b], identity, 0);
+                        delete parts[b];
+                        parts[b] = nullptr;
+                    }
+                });
+
+        return parts.empty() ? nullptr : parts.front();
+    }
+
+    static size_t merge_flush(Caliper* c, AggregateDB* list, Caliper::SnapshotFlushFn proc_fn) {
+        std::vector< std::pair<AggregateDB*, Epoch*> > sources;
+
+        for (AggregateDB* db = list; db; db = db->m_next) {
+            for (Epoch* epoch : db->completed_epochs(s_epoch_flush))
+                sources.push_back(std::make_pair(db, epoch));
+
+            if (s_epoch_flush) {
+                sources.push_back(std::make_pair(db, db->flip_epoch()));
+            } else {
+                db->m_stopped.store(true);
+                sources.push_back(std::make_pair(db, db->m_epoch.load()));
+            }
+        }
+
+        // --- map key nodes and dropped key attributes
+
+        std::vector<cali_id_t> drop_ids;
+        uint64_t               drop_imm = 0;
+
+        for (const std::string& name : s_merge_drop_names) {
+            Attribute attr = c->get_attribute(name);
+
+            if (attr == Attribute::invalid)
+                continue;
+
+            drop_ids.push_back(attr.id());
+
+            for (size_t k = 0; k < s_key_attribute_ids.size() && k < 64; ++k)
+                if (s_key_attribute_ids[k] == attr.id())
+                    drop_imm |= (UINT64_C(1) << k);
+        }
+
+        std::unordered_map<cali_id_t, cali_id_t> node_map;
+
+        for (auto &src : sources)
+            map_key_nodes(c, src.second, drop_ids, node_map);
+
+        // --- merge each time slice separately
+
+        std::vector<Epoch*> epochs;
+
+        for (auto &src : sources)
+            epochs.push_back(src.second);
+
+        std::stable_sort(epochs.begin(), epochs.end(), [](const Epoch* a, const Epoch* b){
+                return a->m_number < b->m_number;
+            });
+
+        size_t num_written = 0;
+
+        for (auto it = epochs.begin(); it != epochs.end(); ) {
+            auto end = std::find_if(it, epochs.end(), [it](const Epoch* e){ return e->m_number != (*it)->m_number; });
+
+            Epoch* result = reduce_epochs(std::vector<Epoch*>(it, end), node_map, drop_imm);
+
+            if (result) {
+                num_written += result->flush(c, proc_fn);
+                s_global_num_dropped += result->m_num_dropped;
+                delete result;
+            }
+
+            it = end;
+        }
+
+        // --- release the source epochs
+
+        for (auto &src : sources) {
+            add_global_statistics(src.second);
+
+            if (s_epoch_flush)
+                src.first->recycle_epoch(src.second);
+        }
+
+        if (!s_epoch_flush)
+            for (AggregateDB* db = list; db; db = db->m_next)
+                db->m_stopped.store(false);
+
+        Log(2).stream() << "Aggregate: merged " << sources.size() << " thread databases" << std::endl;
+
+        return num_written;
+    }
+
+    static void epoch_timer_loop() {
+        std::unique_lock<std::mutex>
+            lk(s_epoch_timer_lock);
+
+        auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(s_epoch_interval));
+        auto next     = std::chrono::steady_clock::now() + interval;
+
+        while (!s_epoch_timer_stop) {
+            if (s_epoch_timer_cv.wait_until(lk, next) == std::cv_status::timeout) {
+                ++s_epoch_counter;
+                next += interval;
+            }
+        }
+    }
+
+    static void stop_epoch_timer() {
+        {
+            std::lock_guard<std::mutex>
+                g(s_epoch_timer_lock);
+
+            s_epoch_timer_stop = true;
+        }
+
+        s_epoch_timer_cv.notify_one();
+
+        if (s_epoch_timer.joinable())
+            s_epoch_timer.join();
+    }
+
+    static void add_global_statistics(const Epoch* epoch) {
+        s_global_num_trie_entries   += epoch->m_num_trie_entries;
+        s_global_num_hash_entries   += epoch->m_num_hash_entries;
+        s_global_num_kernel_entries += epoch->m_num_kernel_entries;
+        s_global_num_trie_blocks    += epoch->m_trie.num_blocks();
+        s_global_num_hash_blocks    += epoch->m_hash_entries.num_blocks();
+        s_global_num_hash_slots     += epoch->m_hash_size;
+        s_global_num_kernel_blocks  += epoch->m_kernels.num_blocks();
+        s_global_num_histogram_blocks += epoch->m_histograms.num_blocks();
+        s_global_num_distinct_blocks  += epoch->m_distinct.num_blocks();
+        s_global_num_skipped_keys   += epoch->m_num_skipped_keys;
+        s_global_num_dropped        += epoch->m_num_dropped;
+        s_global_num_signal_dropped += epoch->m_num_signal_dropped;
+        s_global_max_keylen = std::max(s_global_max_keylen, epoch->m_max_keylen);
+    }
+
+    void unlink() {
+        if (m_next)
+            m_next->m_prev = m_prev;
+        if (m_prev)
+            m_prev->m_next = m_next;
+    }
+
+    /// \brief Get the kernel operations for aggregation attribute \a name
+    ///   from the kernel specification list. Entries are either a list of
+    ///   operations joined by '+' (e.g., "min+max"), which applies to all
+    ///   attributes, or "attribute=ops" for a specific attribute.
+    static unsigned kernel_ops(const std::string& name) {
+        unsigned ops = KernelAll;
+
+        for (const std::string& spec : s_kernel_specs) {
+            std::string::size_type eq = spec.find('=');
+
+            if (eq != std::string::npos && spec.substr(0, eq) != name)
+                continue;
+
+            std::string list = (eq == std::string::npos ? spec : spec.substr(eq+1));
+            unsigned    spec_ops = 0;
+
+            for (std::string::size_type p = 0; p <= list.size(); ) {
+                std::string::size_type q = list.find('+', p);
+
+                if (q == std::string::npos)
+                    q = list.size();
+
+                std::string op = list.substr(p, q-p);
+
+                if      (op == "min")
+                    spec_ops |= KernelMin;
+                else if (op == "max")
+                    spec_ops |= KernelMax;
+                else if (op == "sum")
+                    spec_ops |= KernelSum;
+                else if (op == "avg")
+                    spec_ops |= KernelAvg;
+                else if (op == "all")
+                    spec_ops |= KernelAll;
+                else if (op != "count" && !op.empty())
+                    Log(0).stream() << "aggregate: warning: unknown kernel \"" << op
+                                    << "\"" << std::endl;
+
+                p = q + 1;
+            }
+
+            ops = spec_ops;
+
+            // attribute-specific entries take precedence
+            if (eq != std::string::npos)
+                break;
+        }
+
+        return ops;
+    }
+
+    static void init_aggregation_attributes(Caliper* c, const std::vector<std::string>& aggr_attr_names) {
+        // Init aggregation attributes
+
+        if (aggr_attr_names.empty()) {
+            // find all attributes of class "class.aggregatable"
+
+            s_aggr_attributes = 
+                c->find_attributes_with(c->get_attribute("class.aggregatable"));
+
+            for (const Attribute& attr : s_aggr_attributes)
+                s_aggr_attribute_names.push_back(attr.name());
+        } else if (aggr_attr_names.front() != "none") {
+            for (const std::string& name : aggr_attr_names) {
+                Attribute attr = c->get_attribute(name);
+
+                if (attr == Attribute::invalid) {
+                    // The attribute may be created later, e.g. by a
+                    // counter. It is resolved in create_attribute_cb().
+                    Log(2).stream() << "Aggregate: Aggregation attribute \""
+                                    << name
+                                    << "\" not found yet."
+                                    << std::endl;
+
+                    s_aggr_attributes.push_back(attr);
+                    s_aggr_attribute_names.push_back(name);
+
+                    continue;
+                }
+
+                cali_attr_type type = attr.type();
+
+                if (!(type == CALI_TYPE_INT  || 
+                      type == CALI_TYPE_UINT || 
+                      type == CALI_TYPE_DOUBLE)) {
+                    Log(1).stream() << "Aggregate: Warning: Aggregation attribute \""
+                                    << name << "\" has invalid type \"" 
+                                    << cali_type2string(type) << "\""
+                                    << std::endl;
+
+                    continue;
+                }
+
+                s_aggr_attributes.push_back(attr);
+                s_aggr_attribute_names.push_back(name);
+            }
+        }
+
+        // Create the derived statistics attributes
+
+        s_stats_attributes.resize(s_aggr_attributes.size());
+
+        for (size_t i = 0; i < s_aggr_attributes.size(); ++i) {
+            const std::string& name = s_aggr_attribute_names[i];
+
+            s_stats_attributes[i].min_attr =
+                c->create_attribute(std::string("min#") + name,
+                                    CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD);
+            s_stats_attributes[i].max_attr =
+                c->create_attribute(std::string("max#") + name,
+                                    CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD);
+            s_stats_attributes[i].sum_attr =
+                c->create_attribute(std::string("sum#") + name,
+                                    CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD);
+            
+			s_stats_attributes[i].avg_attr =
+                c->create_attribute(std::string("avg#") + name,
+                                    CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD);
+
+            if (std::find(s_histogram_attribute_names.begin(), s_histogram_attribute_names.end(),
+                          name) != s_histogram_attribute_names.end())
+                for (int b = 0; b < HISTOGRAM_BINS; ++b)
+                    s_stats_attributes[i].hist_attrs.push_back(
+                        c->create_attribute(std::string("histogram.bin.") + std::to_string(b) + "#" + name,
+                                            CALI_TYPE_UINT, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD));
+
+            s_stats_attributes[i].weighted =
+                std::find(s_weighted_attribute_names.begin(), s_weighted_attribute_names.end(),
+                          name) != s_weighted_attribute_names.end();
+
+            // kernels: attributes beyond MAX_KERNEL_ATTRS can't be tracked per entry
+
+            unsigned ops = (i < MAX_KERNEL_ATTRS ? kernel_ops(name) : 0);
+
+            s_stats_attributes[i].ops        = ops;
+            s_stats_attributes[i].kernel     = kernel_fns(ops);
+            s_stats_attributes[i].k_offset   = s_kernel_slots;
+            s_stats_attributes[i].hist_index = -1;
+
+            s_kernel_slots += s_stats_attributes[i].kernel.num_slots;
+
+            if (i < MAX_KERNEL_ATTRS && !s_stats_attributes[i].hist_attrs.empty())
+                s_stats_attributes[i].hist_index = static_cast<int>(s_num_histograms++);
+        }
+
+        s_count_attribute =
+            c->create_attribute("count",
+                                CALI_TYPE_INT, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD);
+
+        // Create the distinct-value count attributes. Use the same names
+        // as the count_distinct() CalQL kernel, which can merge the
+        // counters further.
+
+        for (DistinctAttributes& d : s_distinct_attributes) {
+            d.result_attr =
+                c->create_attribute(std::string("count_distinct#") + d.name,
+                                    CALI_TYPE_UINT, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD);
+            d.hll_attr    =
+                c->create_attribute(std::string("distinct.hll#") + d.name,
+                                    CALI_TYPE_UINT, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD | CALI_ATTR_HIDDEN);
+
+            Attribute attr = c->get_attribute(d.name);
+
+            if (attr != Attribute::invalid)
+                d.target_id = attr.id();
+        }
+    }
+
+    /// \brief Parse the key attribute list. Entries are separated by
+    ///   ',' or ':', and "prefix(attribute,depth)" limits the key path
+    ///   of an attribute to its outermost \a depth nodes.
+    static void parse_key_list(const std::string& str) {
+        std::vector<std::string> words;
+        std::string word;
+        int         paren = 0;
+
+        for (char c : str + ",") {
+            if ((c == ',' || c == ':') && paren == 0) {
+                size_t b = word.find_first_not_of(" \t\n");
+                size_t e = word.find_last_not_of(" \t\n");
+
+                if (b != std::string::npos)
+                    words.push_back(word.substr(b, e-b+1));
+
+                word.clear();
+                continue;
+            }
+
+            if (c == '(')
+                ++paren;
+            else if (c == ')' && paren > 0)
+                --paren;
+
+            word.push_back(c);
+        }
+
+        for (const std::string& w : words) {
+            std::string name  = w;
+            int         depth = 0;
+
+            if (w.compare(0, 7, "prefix(") == 0 && w.back() == ')') {
+                std::string::size_type comma = w.find_last_of(',');
+
+                if (comma != std::string::npos)
+                    depth = std::atoi(w.c_str() + comma + 1);
+
+                if (comma == std::string::npos || depth < 1) {
+                    Log(0).stream() << "aggregate: invalid key entry \"" << w << "\"" << std::endl;
+                    continue;
+                }
+
+                name = w.substr(7, comma - 7);
+                name.erase(name.find_last_not_of(" \t") + 1);
+                name.erase(0, name.find_first_not_of(" \t"));
+            }
+
+            s_key_attribute_names.push_back(name);
+            s_key_attribute_depths.push_back(depth);
+
+            s_has_key_depth = s_has_key_depth || depth > 0;
+        }
+    }
+
+    /// \brief Default node-local table file name. Use the job ID from
+    ///   the batch system or MPI launcher, so that all processes of a
+    ///   job on a node find the same file.
+    static std::string default_shm_filename() {
+        const char* vars[] = {
+            "SLURM_JOB_ID", "OMPI_MCA_ess_base_jobid", "PBS_JOBID", "LSB_JOBID", "FLUX_JOB_ID"
+        };
+
+        std::string job;
+
+        for (const char* var : vars) {
+            const char* val = getenv(var);
+
+            if (val && *val) {
+                job = val;
+                break;
+            }
+        }
 
-        if (entry->count > 0)
-            write_aggregated_snapshot(key, entry, c, proc_fn);
+        // without a job ID, assume all processes have the same launcher
+        if (job.empty())
+            job = std::string("p") + std::to_string(getppid());
 
-        num_written += (entry->count > 0 ? 1 : 0);
+        for (char& ch : job)
+            if (!isalnum(ch) && ch != '-' && ch != '_')
+                ch = '_';
 
-        // --- iterate over sub-records
+        return std::string("/dev/shm/caliper-aggregate-") + std::to_string(getuid()) + "-" + job;
+    }
 
-        unsigned char* next_key = static_cast<unsigned char*>(alloca(n+2));
+    static void init_shared_memory() {
+        std::string filename = s_config.get("shm_file").to_string();
 
-        memset(next_key, 0, n+2);
-        memcpy(next_key, key, n);
+        if (filename.empty())
+            filename = default_shm_filename();
 
-        for (size_t i = 0; i < 256; ++i) {
-            if (entry->next[i] == 0)
-                continue;
+        if (s_merge_threads || s_epoch_interval > 0.0 || !s_epoch_loop_attr_name.empty() ||
+            !s_key_attribute_names.empty() || !s_histogram_attribute_names.empty() ||
+            !s_kernel_specs.empty() || !s_distinct_attributes.empty())
+            Log(1).stream() << "aggregate: warning: key, kernels, histogram, count_distinct,\n"
+                            << "  time slice, and merge options are ignored with shared memory aggregation"
+                            << std::endl;
 
-            TrieNode* e  = m_trie.get(entry->next[i], false);
-            next_key[n]  = static_cast<unsigned char>(i);
+        s_shm_db =
+            ShmAggregateDB::open(filename,
+                                 s_config.get("shm_size").to_uint() * 1024 * 1024,
+                                 s_config.get("shm_timeout").to_double());
 
-            num_written += recursive_flush(n+1, next_key, e, c, proc_fn);
+        if (!s_shm_db) {
+            Log(0).stream() << "aggregate: shared memory aggregation failed, using process-local aggregation"
+                            << std::endl;
+            return;
         }
 
-        return num_written;
+        s_shm_db->set_metrics(s_aggr_attribute_names);
+
+        Log(1).stream() << "aggregate: " << (s_shm_db->is_leader() ? "created " : "attached to ")
+                        << "node-local aggregation table " << filename << std::endl;
     }
 
-    static void init_aggregation_attributes(Caliper* c, const std::vector<std::string>& aggr_attr_names) {
-        // Init aggregation attributes
+    static bool init_static_data() {
+        s_list_lock.unlock();
 
-        if (aggr_attr_names.empty()) {
-            // find all attributes of class "class.aggregatable"
+        s_config = RuntimeConfig::init("aggregate", s_configdata);
 
-            s_aggr_attributes = 
-                c->find_attributes_with(c->get_attribute("class.aggregatable"));
-        } else if (aggr_attr_names.front() != "none") {
-            for (const std::string& name : aggr_attr_names) {
-                Attribute attr = c->get_attribute(name);
+        parse_key_list(s_config.get("key").to_string());
 
-                if (attr == Attribute::invalid) {
-                    Log(1).stream() << "Aggregate: Warning: Aggregation attribute \"" 
-                                    << name
-                                    << "\" not found." 
-                                    << std::endl;
+        s_histogram_attribute_names =
+            s_config.get("histogram").to_stringlist(",:");
+        s_histogram_min =
+            s_config.get("histogram_min").to_double();
+        s_weighted_attribute_names =
+            s_config.get("weighted_attributes").to_stringlist(",:");
+        s_kernel_specs =
+            s_config.get("kernels").to_stringlist(",:");
 
-                    continue;
-                }
+        for (const std::string& name : s_config.get("count_distinct").to_stringlist(",:"))
+            s_distinct_attributes.push_back({ name, CALI_INV_ID, Attribute::invalid, Attribute::invalid });
 
-                cali_attr_type type = attr.type();
+        if (!(s_histogram_min > 0.0)) {
+            Log(0).stream() << "aggregate: warning: invalid histogram minimum "
+                            << s_config.get("histogram_min").to_string()
+                            << ", using 1.0" << std::endl;
 
-                if (!(type == CALI_TYPE_INT  || 
-                      type == CALI_TYPE_UINT || 
-                      type == CALI_TYPE_DOUBLE)) {
-                    Log(1).stream() << "Aggregate: Warning: Aggregation attribute \""
-                                    << name << "\" has invalid type \"" 
-                                    << cali_type2string(type) << "\""
-                                    << std::endl;
+            s_histogram_min = 1.0;
+        }
 
-                    continue;
-                }
+        if (s_key_attribute_names.size() > 64)
+            Log(0).stream() << "aggregate: warning: more than 64 key attributes, "
+                            << "only the first 64 can be immediate key entries" << std::endl;
 
-                s_aggr_attributes.push_back(attr);
-            }
-        }
+        s_key_attribute_ids.assign(s_key_attribute_names.size(), CALI_INV_ID);
+        s_key_attributes.assign(s_key_attribute_names.size(), Attribute::invalid);
 
-        // Create the derived statistics attributes
+        std::string key_index = s_config.get("key_index").to_string();
 
-        s_stats_attributes.resize(s_aggr_attributes.size());
+        if (key_index == "hash")
+            s_key_index = KeyIndex::Hash;
+        else if (key_index == "trie")
+            s_key_index = KeyIndex::Trie;
+        else
+            Log(0).stream() << "aggregate: warning: unknown key index \"" << key_index
+                            << "\", using \"trie\"" << std::endl;
 
-        for (size_t i = 0; i < s_aggr_attributes.size(); ++i) {
-            std::string name = s_aggr_attributes[i].name();
+        s_epoch_interval   = s_config.get("time_interval").to_double();
+        s_epoch_iterations = s_config.get("loop_iterations").to_uint();
 
-            s_stats_attributes[i].min_attr =
-                c->create_attribute(std::string("min#") + name,
-                                    CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD);
-            s_stats_attributes[i].max_attr =
-                c->create_attribute(std::string("max#") + name,
-                                    CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD);
-            s_stats_attributes[i].sum_attr =
-                c->create_attribute(std::string("sum#") + name,
-                                    CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD);
-            
-			s_stats_attributes[i].avg_attr =
-                c->create_attribute(std::string("avg#") + name,
-                                    CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD);
-        }
+        std::string loop   = s_config.get("loop").to_string();
 
-        s_count_attribute =
-            c->create_attribute("count",
-                                CALI_TYPE_INT, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD);
-    }
+        if (!loop.empty())
+            s_epoch_loop_attr_name = std::string("iteration#") + loop;
 
-    static bool init_static_data() {
-        s_list_lock.unlock();
+        s_merge_threads    = s_config.get("merge_threads").to_bool();
+        s_fused_timing     = s_config.get("fused_timing").to_bool();
+        s_merge_drop_names = s_config.get("merge_drop").to_stringlist(",:");
+        s_merge_workers    = s_config.get("merge_workers").to_uint();
 
-        s_config = RuntimeConfig::init("aggregate", s_configdata);
+        if (s_merge_workers == 0)
+            s_merge_workers = std::max(1u, std::min(16u, std::thread::hardware_concurrency()));
 
-        s_key_attribute_names =
-            s_config.get("key").to_stringlist(",:");
+        std::string flush_mode = s_config.get("flush_mode").to_string();
 
-        s_key_attribute_ids.assign(s_key_attribute_names.size(), CALI_INV_ID);
-        s_key_attributes.assign(s_key_attribute_names.size(), Attribute::invalid);
+        if (flush_mode == "epoch")
+            s_epoch_flush = true;
+        else if (flush_mode == "cumulative")
+            s_epoch_flush = false;
+        else
+            Log(0).stream() << "aggregate: warning: unknown flush mode \"" << flush_mode
+                            << "\", using \"cumulative\"" << std::endl;
         
         if (pthread_key_create(&s_aggregate_db_key, retire) != 0) {
             Log(0).stream() << "aggregate: error: pthread_key_create() failed"
@@ -429,24 +1900,12 @@ class AggregateDB {
 
 public:
 
-    void clear() {
-        m_trie.clear();
-        m_kernels.clear();
-
-        m_num_trie_entries   = 0;
-        m_num_kernel_entries = 0;
-        m_num_dropped        = 0;
-        m_num_skipped_keys   = 0;
-        m_max_keylen         = 0;
-    }
-
-    void process_snapshot(Caliper* c, const SnapshotRecord* snapshot) {
+    /// \brief Encode the aggregation key of \a snapshot and find or
+    ///   create its entry in \a epoch. Returns null if the entry can't
+    ///   be created.
+    AggregateEntry* find_snapshot_entry(Caliper* c, Epoch* epoch, const SnapshotRecord* snapshot) {
         SnapshotRecord::Sizes sizes = snapshot->size();
-
-        if (sizes.n_nodes + sizes.n_immediate == 0)
-            return;
-
-        SnapshotRecord::Data addr   = snapshot->data();
+        SnapshotRecord::Data  addr  = snapshot->data();
 
         //
         // --- create / get context tree nodes for key
@@ -458,11 +1917,15 @@ public:
 
         size_t      n_key_attr = 0;
         cali_id_t*  key_attribute_ids = static_cast<cali_id_t*>(alloca(s_key_attribute_ids.size() * sizeof(cali_id_t)));
+        int*        key_depths = static_cast<int*>(alloca(s_key_attribute_ids.size() * sizeof(int)));
+        int*        skip       = static_cast<int*>(alloca(s_key_attribute_ids.size() * sizeof(int)));
 
         // create list of all valid key attribute ids
         for (size_t i = 0; i < s_key_attribute_ids.size(); ++i)
-            if (s_key_attribute_ids[i] != CALI_INV_ID)
+            if (s_key_attribute_ids[i] != CALI_INV_ID) {
+                key_depths[n_key_attr] = s_key_attribute_depths[i];
                 key_attribute_ids[n_key_attr++] = s_key_attribute_ids[i];
+            }
             
         if (n_key_attr > 0 && sizes.n_nodes > 0) {
             // --- find out number of key node entries
@@ -496,13 +1959,33 @@ public:
 
                 memset(nodelist, 0, key_entries * sizeof(const Node*));
                 
-                for (size_t i = 0; i < sizes.n_nodes; ++i)
+                for (size_t i = 0; i < sizes.n_nodes; ++i) {
+                    // for depth-limited key attributes, skip the innermost
+                    // nodes beyond the given depth
+                    memset(skip, 0, n_key_attr * sizeof(int));
+
+                    if (s_has_key_depth) {
+                        for (const Node* node = start_nodes[i]; node; node = node->parent())
+                            for (size_t a = 0; a < n_key_attr; ++a)
+                                if (key_attribute_ids[a] == node->attribute())
+                                    ++skip[a];
+
+                        for (size_t a = 0; a < n_key_attr; ++a)
+                            skip[a] = (key_depths[a] > 0 && skip[a] > key_depths[a] ? skip[a] - key_depths[a] : 0);
+                    }
+
                     for (const Node* node = start_nodes[i]; node; node = node->parent())
                         for (size_t a = 0; a < n_key_attr; ++a)
-                            if (key_attribute_ids[a] == node->attribute())
-                                nodelist[key_entries - ++filled] = node;
-                
-                const Node* node = c->make_tree_entry(key_entries, nodelist, &m_aggr_root_node);
+                            if (key_attribute_ids[a] == node->attribute()) {
+                                if (skip[a] > 0)
+                                    --skip[a];
+                                else
+                                    nodelist[key_entries - ++filled] = node;
+                            }
+                }
+
+                // filled may be less than key_entries with depth limits
+                const Node* node = c->make_tree_entry(filled, nodelist + (key_entries - filled), &m_aggr_root_node);
 
                 if (node)
                     nodeid_vec[n_nodes++] = node->id();
@@ -532,93 +2015,264 @@ public:
         //    - 1 u64: bitfield of indices in s_key_attributes that mark immediate key entries
         //    - for each immediate entry, 1 u64 entry for the value 
 
-        // encode node key
+        // Keys up to STACK_KEYLEN bytes are encoded on the stack. Larger
+        // keys use the thread's key pool buffer. Signal handlers can't grow
+        // the pool and may interrupt an update that uses it: they encode
+        // keys on the stack, and drop key entries beyond SIGNAL_KEYLEN.
+
+        size_t          n_key_attr_ids = s_key_attribute_ids.size();
+        size_t          max_len = 10 * (n_nodes + std::min<size_t>(n_key_attr_ids, 64) + 2);
+
+        unsigned char   stack_key[STACK_KEYLEN];
+        unsigned char*  buf = stack_key;
+        size_t          cap = STACK_KEYLEN;
 
-        unsigned char   node_key[MAX_KEYLEN];
-        size_t          node_key_len = 0;
+        if (max_len > STACK_KEYLEN) {
+            if (c->is_signal()) {
+                cap = std::min<size_t>(max_len, SIGNAL_KEYLEN);
+                buf = static_cast<unsigned char*>(alloca(cap));
+            } else {
+                if (m_key_pool.size() < max_len)
+                    m_key_pool.resize(max_len);
+
+                buf = m_key_pool.data();
+                cap = m_key_pool.size();
+            }
+        }
 
-        for (size_t i = 0; i < n_nodes; ++i) {
-            size_t p = vlenc_u64(nodeid_vec[i], node_key + node_key_len);
+        // encode node key, leaving room for the toc in front
 
-            if (node_key_len + p + 1 >= MAX_KEYLEN) {
-                ++m_num_skipped_keys;
+        size_t          pos = 10;
+        size_t          n_key_nodes = 0;
+
+        for ( ; n_key_nodes < n_nodes; ++n_key_nodes) {
+            unsigned char tmp[10];
+            size_t        len = vlenc_u64(nodeid_vec[n_key_nodes], tmp);
+
+            if (pos + len > cap) {
+                ++epoch->m_num_skipped_keys;
                 break;
             }
 
-            node_key_len += p;
+            memcpy(buf + pos, tmp, len);
+            pos += len;
         }
 
         // encode selected immediate key entries
 
-        unsigned char   imm_key[MAX_KEYLEN];
-        size_t          imm_key_len = 0;
         uint64_t        imm_key_bitfield = 0;
+        uint64_t*       imm_vals = static_cast<uint64_t*>(alloca((n_key_attr_ids+1) * sizeof(uint64_t)));
+        size_t          n_imm  = 0;
+        size_t          imm_key_len = 0;
 
-        for (size_t k = 0; k < s_key_attribute_ids.size(); ++k) 
+        for (size_t k = 0; k < n_key_attr_ids && k < 64; ++k)
             for (size_t i = 0; i < sizes.n_immediate; ++i)
                 if (s_key_attribute_ids[k] == addr.immediate_attr[i]) {
-                    unsigned char buf[10];
-                    size_t        p = 0;
-
-                    p += vlenc_u64(*static_cast<const uint64_t*>(addr.immediate_data[i].data()), imm_key + imm_key_len);
-                    
-                    // check size and discard entry if it won't fit :(
-                    if (node_key_len + imm_key_len + p + vlenc_u64(imm_key_bitfield | (1 << k), buf) + 1 >= MAX_KEYLEN) {
-                        ++m_num_skipped_keys;
+                    unsigned char tmp[10];
+                    uint64_t      val = *static_cast<const uint64_t*>(addr.immediate_data[i].data());
+                    size_t        len = vlenc_u64(val, tmp);
+
+                    // check size and discard entry if it won't fit
+                    if (pos + imm_key_len + len + vlenc_u64(imm_key_bitfield | (UINT64_C(1) << k), tmp) > cap) {
+                        ++epoch->m_num_skipped_keys;
                         break;
                     }
 
-                    imm_key_bitfield |= (1 << k);
-                    imm_key_len      += p;
-                }
-
-        unsigned char   key[MAX_KEYLEN];
-        size_t          pos = 0;
+                    imm_key_bitfield |= (UINT64_C(1) << k);
+                    imm_vals[n_imm++] = val;
+                    imm_key_len      += len;
 
-        pos += vlenc_u64(n_nodes * 2 + (imm_key_bitfield ? 1 : 0), key + pos);
-        memcpy(key+pos, node_key, node_key_len);
-        pos += node_key_len;
+                    break;
+                }
 
         if (imm_key_bitfield) {
-            pos += vlenc_u64(imm_key_bitfield, key+pos);
-            memcpy(key+pos, imm_key, imm_key_len);
-            pos += imm_key_len;
+            pos += vlenc_u64(imm_key_bitfield, buf + pos);
+
+            for (size_t i = 0; i < n_imm; ++i)
+                pos += vlenc_u64(imm_vals[i], buf + pos);
         }
 
-        m_max_keylen = std::max(pos, m_max_keylen);
+        // prepend the toc
+
+        unsigned char   toc[10];
+        size_t          toc_len = vlenc_u64(n_key_nodes * 2 + (imm_key_bitfield ? 1 : 0), toc);
+        unsigned char*  key     = buf + 10 - toc_len;
+
+        memcpy(key, toc, toc_len);
+        pos -= 10 - toc_len;
 
         //
         // --- find entry
         //
 
-        TrieNode* entry = find_entry(pos, key, !c->is_signal());
+        AggregateEntry* entry = epoch->find_entry(pos, key, !c->is_signal());
 
         if (!entry) {
-            ++m_num_dropped;
-            return;
+            ++epoch->m_num_dropped;
+
+            if (c->is_signal())
+                ++epoch->m_num_signal_dropped;
+
+            return nullptr;
+        }
+
+        if (!c->is_signal()) {
+            epoch->replenish();
+            m_memory->set(epoch->bytes_reserved(), epoch->bytes_used());
         }
 
+        return entry;
+    }
+
+    void process_snapshot(Caliper* c, Epoch* epoch, const SnapshotRecord* snapshot) {
+        SnapshotRecord::Sizes sizes = snapshot->size();
+
+        if (sizes.n_nodes + sizes.n_immediate == 0)
+            return;
+
+        AggregateEntry* entry = find_snapshot_entry(c, epoch, snapshot);
+
+        if (!entry)
+            return;
+
+        SnapshotRecord::Data addr = snapshot->data();
+
         //
         // --- update values
         //
 
+        // Snapshots from sampled events carry a sample weight
+
+        double weight = 1.0;
+
+        if (s_weight_attr_id != CALI_INV_ID)
+            for (size_t i = 0; i < sizes.n_immediate; ++i)
+                if (addr.immediate_attr[i] == s_weight_attr_id) {
+                    weight = addr.immediate_data[i].to_double();
+                    break;
+                }
+
         ++entry->count;
+        entry->weight += weight;
 
-        for (size_t a = 0; a < s_aggr_attributes.size(); ++a)
+        double* kernels =
+            (entry->k_id != 0xFFFFFFFF ? epoch->m_kernels.get(entry->k_id, false) : nullptr);
+
+        for (size_t a = 0; a < std::min<size_t>(s_aggr_attributes.size(), MAX_KERNEL_ATTRS); ++a)
             for (size_t i = 0; i < sizes.n_immediate; ++i)
                 if (addr.immediate_attr[i] == s_aggr_attributes[a].id()) {
-                    AggregateKernel* k = m_kernels.get(entry->k_id + a, !c->is_signal());
+                    const StatisticsAttributes& st = s_stats_attributes[a];
+                    double val = addr.immediate_data[i].to_double();
+
+                    entry->k_mask |= (1u << a);
 
-                    if (k)
-                        k->add(addr.immediate_data[i].to_double());
+                    if (kernels && st.kernel.num_slots > 0)
+                        st.kernel.add(kernels + st.k_offset, val, st.weighted ? weight : 1.0);
+
+                    if (entry->h_id && st.hist_index >= 0) {
+                        Histogram* h = epoch->m_histograms.get(entry->h_id + st.hist_index, false);
+
+                        if (h)
+                            h->add(val);
+                    }
                 }
+
+        if (entry->d_id != 0xFFFFFFFF)
+            for (size_t d = 0; d < s_distinct_attributes.size(); ++d) {
+                cali_id_t id = s_distinct_attributes[d].target_id;
+
+                if (id == CALI_INV_ID)
+                    continue;
+
+                HyperLogLog* hll = epoch->m_distinct.get(entry->d_id + d, false);
+
+                if (!hll)
+                    continue;
+
+                for (size_t i = 0; i < sizes.n_immediate; ++i)
+                    if (addr.immediate_attr[i] == id)
+                        hll->add(addr.immediate_data[i]);
+                for (size_t i = 0; i < sizes.n_nodes; ++i)
+                    for (const Node* node = addr.node_entries[i]; node; node = node->parent())
+                        if (node->attribute() == id)
+                            hll->add(node->data());
+            }
     }
 
-    size_t flush(Caliper* c, Caliper::SnapshotFlushFn proc_fn) {
-        TrieNode*     entry = m_trie.get(0, false);
-        unsigned char key   = 0;
+    /// \brief Add a region instance with inclusive time \a duration to
+    ///   the entry for the current context (fused timing mode).
+    ///
+    ///   This takes the place of the begin/end snapshots and the timestamp
+    ///   service: the context is copied from the blackboard without
+    ///   snapshot callbacks, and with the default key, the entries of
+    ///   simple contexts are cached so the key isn't encoded again.
+    void process_region(Caliper* c, Epoch* epoch, double duration) {
+        SnapshotRecord::FixedSnapshotRecord<80> context_data;
+        SnapshotRecord context(context_data);
+
+        c->pull_context(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, &context);
+
+        SnapshotRecord::Sizes sizes = context.size();
+        SnapshotRecord::Data  addr  = context.data();
+
+        if (sizes.n_nodes + sizes.n_immediate == 0)
+            return;
+
+        // The context usually has a thread and a process node. The cache
+        // key packs both ids.
+
+        bool            cached = s_key_attribute_ids.empty() && (sizes.n_nodes == 1 || sizes.n_nodes == 2);
+        uint64_t        ckey   = 0;
+        AggregateEntry* entry  = nullptr;
+
+        for (size_t i = 0; cached && i < sizes.n_nodes; ++i) {
+            cali_id_t id = addr.node_entries[i]->id();
+
+            if (id >= 0xFFFFFFFF)
+                cached = false;
+
+            ckey |= (i == 0 ? id : (id + 1) << 32);
+        }
+
+        if (cached) {
+            auto it = epoch->m_node_entries.find(ckey);
+
+            if (it != epoch->m_node_entries.end())
+                entry = it->second;
+        }
+
+        if (!entry) {
+            entry = find_snapshot_entry(c, epoch, &context);
+
+            if (!entry)
+                return;
+            if (cached)
+                epoch->m_node_entries.emplace(ckey, entry);
+        }
+
+        ++entry->count;
+        entry->weight += 1.0;
+
+        if (s_fused_index < 0)
+            return;
+
+        const StatisticsAttributes& st = s_stats_attributes[s_fused_index];
+
+        entry->k_mask |= (1u << s_fused_index);
+
+        if (entry->k_id != 0xFFFFFFFF && st.kernel.num_slots > 0) {
+            double* kernels = epoch->m_kernels.get(entry->k_id, false);
+
+            if (kernels)
+                st.kernel.add(kernels + st.k_offset, duration, 1.0);
+        }
+
+        if (entry->h_id && st.hist_index >= 0) {
+            Histogram* h = epoch->m_histograms.get(entry->h_id + st.hist_index, false);
 
-        return recursive_flush(0, &key, entry, c, proc_fn);
+            if (h)
+                h->add(duration);
+        }
     }
 
     bool stopped() const {
@@ -627,24 +2281,28 @@ public:
 
     AggregateDB(Caliper* c)
         : m_stopped(false),
+          m_memory(util::memory_counter::acquire("aggregate", util::memory_counter::thread_id())),
           m_retired(false),
           m_next(nullptr),
           m_prev(nullptr),
-          m_aggr_root_node(CALI_INV_ID, CALI_INV_ID, Variant()),
-          m_num_trie_entries(0),
-          m_num_kernel_entries(0),
-          m_num_dropped(0),
-          m_num_skipped_keys(0),
-          m_max_keylen(0)
+          m_epoch(new Epoch),
+          m_active(0),
+          m_aggr_root_node(CALI_INV_ID, CALI_INV_ID, Variant())
     {
-        Log(2).stream() << "Aggregate: creating aggregation database" << std::endl;
+        m_epoch.load()->m_number = s_epoch_counter.load();
 
-        // initialize first block
-        m_trie.get(0, true);
-        m_kernels.get(0, true);
+        Log(2).stream() << "Aggregate: creating aggregation database" << std::endl;
     }
 
     ~AggregateDB() {
+        delete m_epoch.load();
+
+        for (Epoch* e : m_completed)
+            delete e;
+        for (Epoch* e : m_spare)
+            delete e;
+
+        m_memory->release();
     }
 
     static AggregateDB* acquire(Caliper* c, bool alloc) {
@@ -690,24 +2348,54 @@ public:
 
         size_t num_written = 0;
 
-        for ( ; db; db = db->m_next) {
-            db->m_stopped.store(true);
-            num_written += db->flush(c, proc_fn);
-            db->m_stopped.store(false);
+        if (s_shm_db) {
+            num_written = s_shm_db->flush(c, proc_fn);
+
+            Log(1).stream() << "Aggregate: flushed " << num_written << " node-local snapshots." << std::endl;
+            return;
+        }
+
+        if (s_merge_threads)
+            num_written = merge_flush(c, db, proc_fn);
+        else for ( ; db; db = db->m_next) {
+            // completed time slices
+            for (Epoch* epoch : db->completed_epochs(s_epoch_flush)) {
+                num_written += epoch->flush(c, proc_fn);
+                add_global_statistics(epoch);
+
+                if (s_epoch_flush)
+                    db->recycle_epoch(epoch);
+            }
+
+            if (s_epoch_flush) {
+                // drain the previous epoch while the owner thread continues
+                // aggregating into a fresh one
+                Epoch* epoch = db->flip_epoch();
+
+                num_written += epoch->flush(c, proc_fn);
+                add_global_statistics(epoch);
+
+                db->recycle_epoch(epoch);
+            } else {
+                db->m_stopped.store(true);
+
+                Epoch* epoch = db->m_epoch.load();
 
-            s_global_num_trie_entries   += db->m_num_trie_entries;
-            s_global_num_kernel_entries += db->m_num_kernel_entries;
-            s_global_num_trie_blocks    += db->m_trie.num_blocks();
-            s_global_num_kernel_blocks  += db->m_kernels.num_blocks();
-            s_global_num_skipped_keys   += db->m_num_skipped_keys;
-            s_global_num_dropped        += db->m_num_dropped;
-            s_global_max_keylen = std::max(s_global_max_keylen, db->m_max_keylen);
+                num_written += epoch->flush(c, proc_fn);
+                add_global_statistics(epoch);
+
+                db->m_stopped.store(false);
+            }
         }
 
         Log(1).stream() << "Aggregate: flushed " << num_written << " snapshots." << std::endl;
     }
 
     static void clear_cb(Caliper* c) {
+        // the shared table belongs to all processes on the node
+        if (s_shm_db)
+            return;
+
         AggregateDB* db = nullptr;
 
         {
@@ -718,9 +2406,16 @@ public:
         }
 
         while (db) {
-            db->m_stopped.store(true);
-            db->clear();
-            db->m_stopped.store(false);
+            for (Epoch* epoch : db->completed_epochs(true))
+                db->recycle_epoch(epoch);
+
+            if (s_epoch_flush) {
+                db->recycle_epoch(db->flip_epoch());
+            } else {
+                db->m_stopped.store(true);
+                db->m_epoch.load()->clear();
+                db->m_stopped.store(false);
+            }
 
             if (db->m_retired) {
                 AggregateDB* tmp = db->m_next;
@@ -744,15 +2439,85 @@ public:
     }
 
     static void process_snapshot_cb(Caliper* c, const SnapshotRecord* trigger_info, const SnapshotRecord* snapshot) {
+        if (s_shm_db) {
+            s_shm_db->process_snapshot(c, snapshot, s_aggr_attributes);
+            return;
+        }
+
         AggregateDB* db = acquire(c, !c->is_signal());
 
-        if (db && !db->stopped())
-            db->process_snapshot(c, snapshot);
-        else
+        if (db && !db->stopped()) {
+            ++db->m_active;
+            // Switching epochs takes a lock and may allocate: in signal
+            // handlers, add to the current epoch and let the next regular
+            // snapshot switch.
+            if (s_epoch_attribute != Attribute::invalid && !c->is_signal())
+                db->check_time_slice();
+            db->process_snapshot(c, db->m_epoch.load(), snapshot);
+            --db->m_active;
+        } else {
+            ++s_global_num_dropped;
+
+            if (c->is_signal())
+                ++s_global_num_signal_dropped;
+        }
+    }
+
+    static uint64_t fused_time_usec() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static void fused_begin_cb(Caliper* c, const Attribute& attr, const Variant&) {
+        if (!s_fused_timing || attr.store_as_value() || c->is_signal())
+            return;
+
+        AggregateDB* db = acquire(c, true);
+
+        if (db)
+            db->m_fused_regions.push_back({ attr.id(), fused_time_usec() });
+    }
+
+    static void fused_end_cb(Caliper* c, const Attribute& attr, const Variant&) {
+        if (!s_fused_timing || attr.store_as_value() || c->is_signal())
+            return;
+
+        uint64_t     now = fused_time_usec();
+        AggregateDB* db  = acquire(c, false);
+
+        if (!db)
+            return;
+
+        // find the innermost open region of this attribute
+
+        std::vector<FusedRegion>& regions = db->m_fused_regions;
+
+        auto it = std::find_if(regions.rbegin(), regions.rend(),
+                               [&attr](const FusedRegion& r) { return r.attr == attr.id(); });
+
+        if (it == regions.rend())
+            return;
+
+        double duration = static_cast<double>(now - it->start);
+
+        regions.erase(std::next(it).base());
+
+        if (!db->stopped()) {
+            ++db->m_active;
+            if (s_epoch_attribute != Attribute::invalid)
+                db->check_time_slice();
+            db->process_region(c, db->m_epoch.load(), duration);
+            --db->m_active;
+        } else {
             ++s_global_num_dropped;
+        }
     }
 
     static void post_init_cb(Caliper* c) {
+        Attribute weight_attr = c->get_attribute("cali.event.sample.weight");
+
+        if (weight_attr != Attribute::invalid)
+            s_weight_attr_id = weight_attr.id();
+
         // Update key attributes
         for (unsigned i = 0; i < s_key_attribute_names.size(); ++i) {
             Attribute attr = c->get_attribute(s_key_attribute_names[i]);
@@ -769,11 +2534,71 @@ public:
 
         init_aggregation_attributes(c, names);
 
+        if (s_config.get("shared_memory").to_bool())
+            init_shared_memory();
+
+        if (s_fused_timing) {
+            auto it = std::find(s_aggr_attributes.begin(), s_aggr_attributes.end(), s_fused_duration_attr);
+
+            if (it != s_aggr_attributes.end() && it - s_aggr_attributes.begin() < MAX_KERNEL_ATTRS)
+                s_fused_index = static_cast<int>(it - s_aggr_attributes.begin());
+
+            if (s_shm_db) {
+                Log(0).stream() << "aggregate: fused timing is not supported with shared memory aggregation, disabling it"
+                                << std::endl;
+                s_fused_timing = false;
+            } else if (c->get_attribute("cali.event.begin") != Attribute::invalid) {
+                Log(0).stream() << "aggregate: warning: fused timing is enabled together with the event service,"
+                                << " regions will be counted twice" << std::endl;
+            }
+        }
+
+        // Initialize time-sliced aggregation
+        if (s_epoch_interval > 0.0 || !s_epoch_loop_attr_name.empty()) {
+            s_epoch_attribute =
+                c->create_attribute("aggregate.epoch", CALI_TYPE_UINT,
+                                    CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS);
+
+            Attribute loop_attr = c->get_attribute(s_epoch_loop_attr_name);
+
+            if (loop_attr != Attribute::invalid)
+                s_epoch_loop_attr_id = loop_attr.id();
+        }
+
+        if (s_epoch_interval > 0.0) {
+            s_epoch_timer_stop = false;
+            s_epoch_timer = std::thread(epoch_timer_loop);
+        }
+
         // Initialize master-thread aggregation DB
         acquire(c, true);
     }
 
     static void create_attribute_cb(Caliper* c, const Attribute& attr) {
+        if (attr.name() == "cali.event.sample.weight")
+            s_weight_attr_id = attr.id();
+        if (attr.name() == s_epoch_loop_attr_name)
+            s_epoch_loop_attr_id = attr.id();
+
+        // Resolve aggregation attributes that didn't exist at initialization
+        for (size_t i = 0; i < s_aggr_attributes.size(); ++i)
+            if (s_aggr_attributes[i] == Attribute::invalid && s_aggr_attribute_names[i] == attr.name()) {
+                cali_attr_type type = attr.type();
+
+                if (type == CALI_TYPE_INT || type == CALI_TYPE_UINT || type == CALI_TYPE_DOUBLE)
+                    s_aggr_attributes[i] = attr;
+                else
+                    Log(1).stream() << "Aggregate: Warning: Aggregation attribute \""
+                                    << attr.name() << "\" has invalid type \""
+                                    << cali_type2string(type) << "\""
+                                    << std::endl;
+            }
+
+        // Update distinct-value count attributes
+        for (DistinctAttributes& d : s_distinct_attributes)
+            if (d.name == attr.name())
+                d.target_id = attr.id();
+
         // Update key attributes
         auto it = std::find(s_key_attribute_names.begin(), s_key_attribute_names.end(),
                             attr.name());
@@ -802,6 +2627,13 @@ public:
         }
     }
 
+    static void post_end_cb(Caliper* c, const Attribute& attr, const Variant&) {
+        // start a new time slice every N iterations of the epoch loop
+        if (attr.id() == s_epoch_loop_attr_id && s_epoch_iterations > 0)
+            if ((s_epoch_loop_count.fetch_add(1) + 1) % s_epoch_iterations == 0)
+                ++s_epoch_counter;
+    }
+
     static void create_scope_cb(Caliper* c, cali_context_scope_t scope) {
         // create new aggregation DB on thread
         if (scope == CALI_SCOPE_THREAD)
@@ -809,17 +2641,42 @@ public:
     }
 
     static void finish_cb(Caliper* c) {
+        if (s_epoch_interval > 0.0)
+            stop_epoch_timer();
+
+        if (s_shm_db) {
+            if (s_shm_db->num_dropped() > 0)
+                Log(1).stream() << "Aggregate: dropped " << s_shm_db->num_dropped()
+                                << " snapshots in the node-local table." << std::endl;
+
+            delete s_shm_db;
+            s_shm_db = nullptr;
+        }
+
         if (Log::verbosity() >= 2) {
             unitfmt_result bytes_reserved = 
                 unitfmt(s_global_num_trie_blocks * sizeof(TrieNode) * 1024
-                        + s_global_num_kernel_blocks * sizeof(AggregateKernel) * 1024, unitfmt_bytes);
-
-            Log(2).stream() << "Aggregate: max key len " << s_global_max_keylen << ", "
-                            << s_global_num_kernel_entries << " entries, "
-                            << s_global_num_trie_entries << " nodes, "
-                            << s_global_num_trie_blocks + s_global_num_kernel_blocks << " blocks ("
-                            << bytes_reserved.val << " " << bytes_reserved.symbol << " reserved)"
-                            << std::endl;
+                        + s_global_num_hash_blocks * sizeof(HashEntry) * 1024
+                        + s_global_num_hash_slots  * sizeof(uint32_t)
+                        + s_global_num_kernel_blocks * sizeof(double) * KERNEL_BLOCK_SLOTS
+                        + s_global_num_histogram_blocks * sizeof(Histogram) * 1024
+                        + s_global_num_distinct_blocks * sizeof(HyperLogLog) * 1024, unitfmt_bytes);
+
+            if (s_key_index == KeyIndex::Hash)
+                Log(2).stream() << "Aggregate: max key len " << s_global_max_keylen << ", "
+                                << s_global_num_kernel_entries << " kernel slots, "
+                                << s_global_num_hash_entries << " hash keys, "
+                                << s_global_num_hash_slots << " hash slots, "
+                                << s_global_num_hash_blocks + s_global_num_kernel_blocks + s_global_num_histogram_blocks + s_global_num_distinct_blocks << " blocks ("
+                                << bytes_reserved.val << " " << bytes_reserved.symbol << " reserved)"
+                                << std::endl;
+            else
+                Log(2).stream() << "Aggregate: max key len " << s_global_max_keylen << ", "
+                                << s_global_num_kernel_entries << " kernel slots, "
+                                << s_global_num_trie_entries << " nodes, "
+                                << s_global_num_trie_blocks + s_global_num_kernel_blocks + s_global_num_histogram_blocks + s_global_num_distinct_blocks << " blocks ("
+                                << bytes_reserved.val << " " << bytes_reserved.symbol << " reserved)"
+                                << std::endl;
         }
 
         // report attribute keys we haven't found 
@@ -831,9 +2688,10 @@ public:
 
         if (s_global_num_dropped > 0)
             Log(1).stream() << "Aggregate: dropped " << s_global_num_dropped
-                            << " snapshots." << std::endl;
+                            << " snapshots (" << s_global_num_signal_dropped
+                            << " in signal handlers)." << std::endl;
         if (s_global_num_skipped_keys > 0)
-            Log(0).stream() << "Aggregate: warning: maximum key length exceeded " 
+            Log(0).stream() << "Aggregate: warning: maximum key length in signal handlers exceeded " 
                             << s_global_num_skipped_keys
                             << (s_global_num_skipped_keys == 1 ? " time!" : " times!")
                             << " Some key attributes could not be preserved."
@@ -851,11 +2709,33 @@ public:
         c->events().create_attr_evt.connect(create_attribute_cb);
         c->events().post_init_evt.connect(post_init_cb);
         c->events().create_scope_evt.connect(create_scope_cb);
+        c->events().reuse_scope_evt.connect(create_scope_cb);
         c->events().process_snapshot.connect(process_snapshot_cb);
         c->events().flush_evt.connect(flush_cb);
+
+        if (!s_epoch_loop_attr_name.empty())
+            c->events().post_end_evt.connect(post_end_cb);
         c->events().clear_evt.connect(clear_cb);
         c->events().finish_evt.connect(finish_cb);
 
+        if (s_fused_timing) {
+            // Same attribute as in the timestamp service
+            Attribute unit_attr =
+                c->create_attribute("time.unit", CALI_TYPE_STRING, CALI_ATTR_SKIP_EVENTS);
+            Attribute meta_attr[2] = { c->get_attribute("class.aggregatable"), unit_attr };
+            Variant   meta_vals[2] = { Variant(true), Variant(CALI_TYPE_STRING, "usec", 4) };
+
+            s_fused_duration_attr =
+                c->create_attribute("time.inclusive.duration", CALI_TYPE_UINT,
+                                    CALI_ATTR_ASVALUE       |
+                                    CALI_ATTR_SCOPE_THREAD  |
+                                    CALI_ATTR_SKIP_EVENTS,
+                                    2, meta_attr, meta_vals);
+
+            c->events().post_begin_evt.connect(fused_begin_cb);
+            c->events().pre_end_evt.connect(fused_end_cb);
+        }
+
         Log(1).stream() << "Registered aggregation service" << std::endl;
     }
 
@@ -871,6 +2751,91 @@ const ConfigSet::Entry AggregateDB::s_configdata[] = {
       "List of attributes in the aggregation key",
       "List of attributes in the aggregation key."
       "If specified, only group by the given attributes." },
+    { "key_index", CALI_TYPE_STRING, "trie",
+      "Data structure used to look up aggregation keys",
+      "Data structure used to look up aggregation keys:\n"
+      "   trie:  256-way trie. Fast lookups, but high memory use.\n"
+      "   hash:  Open-addressing hash table. Compact.\n"
+      "Default: trie" },
+    { "flush_mode", CALI_TYPE_STRING, "cumulative",
+      "How a flush treats the aggregation database",
+      "How a flush treats the aggregation database:\n"
+      "   cumulative:  Each flush writes all data aggregated since the last clear.\n"
+      "                Snapshots taken during the flush are dropped.\n"
+      "   epoch:       Each flush swaps in an empty database and writes the data\n"
+      "                aggregated since the previous flush. No snapshots are dropped.\n"
+      "Default: cumulative" },
+    { "time_interval", CALI_TYPE_DOUBLE, "0",
+      "Start a new aggregation time slice every N seconds",
+      "Start a new aggregation time slice (epoch) every N seconds.\n"
+      "Aggregation results are tagged with the aggregate.epoch attribute.\n"
+      "0: Don't slice by time." },
+    { "loop", CALI_TYPE_STRING, "",
+      "Loop whose iterations define aggregation time slices",
+      "Start a new aggregation time slice (epoch) every loop_iterations\n"
+      "iterations of the given loop (marked with CALI_CXX_MARK_LOOP_ITERATION).\n"
+      "Aggregation results are tagged with the aggregate.epoch attribute." },
+    { "loop_iterations", CALI_TYPE_UINT, "1",
+      "Number of loop iterations per aggregation time slice",
+      "Number of iterations of the aggregate loop per aggregation time slice." },
+    { "merge_threads", CALI_TYPE_BOOL, "false",
+      "Merge the per-thread aggregation results at flush",
+      "Merge the per-thread aggregation results into one process-level result\n"
+      "at flush, instead of writing separate records for each thread." },
+    { "merge_drop", CALI_TYPE_STRING, "",
+      "List of attributes to remove from the key when merging threads",
+      "List of attributes to remove from the aggregation key when merging\n"
+      "threads, e.g. pthread.id." },
+    { "merge_workers", CALI_TYPE_UINT, "0",
+      "Number of threads for merging per-thread results",
+      "Number of threads for merging per-thread results.\n"
+      "0: Use the number of hardware threads (at most 16)." },
+    { "fused_timing", CALI_TYPE_BOOL, "false",
+      "Measure region times directly in the aggregation database",
+      "Measure the inclusive time of begin/end regions directly in the aggregation\n"
+      "database, instead of through event snapshots and the timestamp service.\n"
+      "Use without the event and timestamp services." },
+    { "kernels", CALI_TYPE_STRING, "",
+      "Aggregation kernels to compute",
+      "Aggregation kernels to compute. List of kernel sets, either for all\n"
+      "aggregation attributes (e.g., sum), or for a specific attribute\n"
+      "(e.g., time.inclusive.duration=min+max). Kernels: min, max, sum, avg,\n"
+      "count (record count only), all. Default: all kernels." },
+    { "histogram", CALI_TYPE_STRING, "",
+      "List of aggregation attributes to keep value histograms for",
+      "List of aggregation attributes to keep value histograms for.\n"
+      "Histograms have a fixed number of log-linear bins. Non-empty bins\n"
+      "are written as histogram.bin.<N>#attribute entries." },
+    { "count_distinct", CALI_TYPE_STRING, "",
+      "List of attributes to count distinct values of",
+      "List of attributes to count distinct values of. The counts are\n"
+      "HyperLogLog estimates, written as count_distinct#attribute entries." },
+    { "histogram_min", CALI_TYPE_DOUBLE, "1.0",
+      "Lower bound of the first regular histogram bin",
+      "Lower bound of the first regular histogram bin. Smaller values\n"
+      "are counted in bin 0." },
+    { "weighted_attributes", CALI_TYPE_STRING, "time.inclusive.duration",
+      "List of aggregation attributes to scale by the event sample weight",
+      "List of aggregation attributes whose sums are scaled by the sample weight\n"
+      "of snapshots from sampled events (see CALI_EVENT_SAMPLE_MODE). Counts are\n"
+      "always scaled. Don't list attributes measured since the previous snapshot,\n"
+      "like time.duration: they already include the skipped events." },
+    { "shared_memory", CALI_TYPE_BOOL, "false",
+      "Aggregate across the processes on a node in shared memory",
+      "Aggregate across the processes on a node in a shared-memory table.\n"
+      "The first process on the node writes the aggregated records for all\n"
+      "of them; the other processes write none." },
+    { "shm_file", CALI_TYPE_STRING, "",
+      "File for the node-local aggregation table",
+      "File for the node-local aggregation table, normally in /dev/shm.\n"
+      "Default: /dev/shm/caliper-aggregate-<uid>-<job id>" },
+    { "shm_size", CALI_TYPE_UINT, "64",
+      "Size of the node-local aggregation table in MiB",
+      "Size of the node-local aggregation table in MiB." },
+    { "shm_timeout", CALI_TYPE_DOUBLE, "10",
+      "Seconds to wait for the other processes on the node at flush",
+      "Seconds the first process waits at flush for the other processes\n"
+      "on the node to finish their updates." },
     ConfigSet::Terminator
 };
 
@@ -879,21 +2844,65 @@ ConfigSet      AggregateDB::s_config;
 Attribute      AggregateDB::s_count_attribute = Attribute::invalid;
 
 vector<string> AggregateDB::s_key_attribute_names;
+vector<int>    AggregateDB::s_key_attribute_depths;
+bool           AggregateDB::s_has_key_depth = false;
 vector<Attribute> AggregateDB::s_key_attributes;
 vector<Attribute> AggregateDB::s_aggr_attributes;
+vector<string> AggregateDB::s_aggr_attribute_names;
 vector<cali_id_t> AggregateDB::s_key_attribute_ids;
 vector<AggregateDB::StatisticsAttributes> AggregateDB::s_stats_attributes;
+vector<string> AggregateDB::s_histogram_attribute_names;
+double         AggregateDB::s_histogram_min = 1.0;
+vector<string> AggregateDB::s_weighted_attribute_names;
+vector<string> AggregateDB::s_kernel_specs;
+size_t         AggregateDB::s_kernel_slots   = 0;
+size_t         AggregateDB::s_num_histograms = 0;
+cali_id_t      AggregateDB::s_weight_attr_id = CALI_INV_ID;
+vector<AggregateDB::DistinctAttributes> AggregateDB::s_distinct_attributes;
+
+AggregateDB::KeyIndex AggregateDB::s_key_index = AggregateDB::KeyIndex::Trie;
+bool           AggregateDB::s_epoch_flush = false;
+
+Attribute      AggregateDB::s_epoch_attribute = Attribute::invalid;
+std::atomic<uint64_t> AggregateDB::s_epoch_counter { 0 };
+double         AggregateDB::s_epoch_interval = 0.0;
+std::string    AggregateDB::s_epoch_loop_attr_name;
+cali_id_t      AggregateDB::s_epoch_loop_attr_id = CALI_INV_ID;
+uint64_t       AggregateDB::s_epoch_iterations = 1;
+std::atomic<uint64_t> AggregateDB::s_epoch_loop_count { 0 };
+bool           AggregateDB::s_merge_threads = false;
+unsigned       AggregateDB::s_merge_workers = 1;
+vector<string> AggregateDB::s_merge_drop_names;
+Node           AggregateDB::s_merge_root_node(CALI_INV_ID, CALI_INV_ID, Variant());
+
+ShmAggregateDB* AggregateDB::s_shm_db = nullptr;
+
+std::thread    AggregateDB::s_epoch_timer;
+std::mutex     AggregateDB::s_epoch_timer_lock;
+std::condition_variable AggregateDB::s_epoch_timer_cv;
+bool           AggregateDB::s_epoch_timer_stop = false;
 
 pthread_key_t  AggregateDB::s_aggregate_db_key;
 
+bool           AggregateDB::s_fused_timing = false;
+Attribute      AggregateDB::s_fused_duration_attr = Attribute::invalid;
+int            AggregateDB::s_fused_index  = -1;
+
 AggregateDB*   AggregateDB::s_list = nullptr;
-util::spinlock AggregateDB::s_list_lock;
+static util::spinlock_stats s_list_lock_stats("Aggregate list");
+util::spinlock AggregateDB::s_list_lock(&s_list_lock_stats);
 
 size_t         AggregateDB::s_global_num_trie_entries   = 0;
+size_t         AggregateDB::s_global_num_hash_entries   = 0;
 size_t         AggregateDB::s_global_num_kernel_entries = 0;
 size_t         AggregateDB::s_global_num_trie_blocks    = 0;
+size_t         AggregateDB::s_global_num_hash_blocks    = 0;
+size_t         AggregateDB::s_global_num_hash_slots     = 0;
 size_t         AggregateDB::s_global_num_kernel_blocks  = 0;
+size_t         AggregateDB::s_global_num_histogram_blocks = 0;
+size_t         AggregateDB::s_global_num_distinct_blocks  = 0;
 size_t         AggregateDB::s_global_num_dropped        = 0;
+size_t         AggregateDB::s_global_num_signal_dropped = 0;
 size_t         AggregateDB::s_global_num_skipped_keys   = 0;
 size_t         AggregateDB::s_global_max_keylen         = 0;
 
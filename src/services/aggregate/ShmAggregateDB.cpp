@@ -0,0 +1,814 @@
+// Copyright (c) 2016, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+/// \file  ShmAggregateDB.cpp
+/// \brief Node-local aggregation table in shared memory
+
+#include "ShmAggregateDB.h"
+
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/Log.h"
+#include "caliper/common/Node.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cali;
+
+namespace
+{
+
+const uint64_t ShmMagic   = 0x43414c4941474752ULL; // "CALIAGGR"
+const uint32_t ShmVersion = 1;
+
+const uint32_t RootNode   = 0xFFFFFFFF;
+const uint32_t InvalidId  = 0xFFFFFFFE;
+
+const size_t   MaxNameLen = 64;
+
+inline uint64_t fnv1a(uint64_t h, const void* ptr, size_t len)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(ptr);
+
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+const uint64_t FnvOffset = 14695981039346656037ULL;
+
+inline uint64_t to_bits(double d)
+{
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+inline double from_bits(uint64_t u)
+{
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+void atomic_add(std::atomic<uint64_t>& a, double val)
+{
+    uint64_t old = a.load(std::memory_order_relaxed);
+
+    while (!a.compare_exchange_weak(old, to_bits(from_bits(old) + val), std::memory_order_relaxed))
+        ;
+}
+
+void atomic_min(std::atomic<uint64_t>& a, double val)
+{
+    uint64_t old = a.load(std::memory_order_relaxed);
+
+    while (val < from_bits(old) && !a.compare_exchange_weak(old, to_bits(val), std::memory_order_relaxed))
+        ;
+}
+
+void atomic_max(std::atomic<uint64_t>& a, double val)
+{
+    uint64_t old = a.load(std::memory_order_relaxed);
+
+    while (val > from_bits(old) && !a.compare_exchange_weak(old, to_bits(val), std::memory_order_relaxed))
+        ;
+}
+
+struct NodeEntry {
+    uint32_t parent;
+    uint32_t type;
+    uint32_t prop;
+    uint32_t name_off;
+    uint32_t name_len;
+    uint32_t data_off;
+    uint32_t data_len;
+};
+
+struct MetricEntry {
+    std::atomic<uint64_t> n;
+    std::atomic<uint64_t> sum; // doubles stored as bits
+    std::atomic<uint64_t> min;
+    std::atomic<uint64_t> max;
+};
+
+struct TableEntry {
+    uint32_t              keylen;
+    uint32_t              key[ShmAggregateDB::MaxKeyLen];
+    std::atomic<uint64_t> count;
+    MetricEntry           metrics[ShmAggregateDB::MaxMetrics];
+};
+
+// Shared node id cache of a thread. Entries are only valid for the
+// DB instance with the same generation.
+struct NodeCache {
+    unsigned generation;
+    std::unordered_map<cali_id_t, uint32_t> map;
+};
+
+thread_local NodeCache* t_node_cache = nullptr;
+
+std::atomic<unsigned> s_generation { 0 };
+
+size_t align(size_t n)
+{
+    return (n + 63) & ~static_cast<size_t>(63);
+}
+
+} // namespace
+
+//   Shared memory layout: the SharedData header, followed by the
+// string arena, the node dictionary and its hash index, and the
+// aggregation table and its hash index. The index slots hold entry
+// index + 1, or 0 for empty slots. Insertions are serialized with the
+// process-shared mutex. Table index slots are published with release
+// stores after the entry is initialized, so lookups don't need the lock.
+
+struct ShmAggregateDB::SharedData {
+    std::atomic<uint64_t> magic;
+    uint32_t              version;
+    uint64_t              size;
+    pid_t                 leader_pid;
+
+    pthread_mutex_t       lock;
+
+    std::atomic<uint32_t> num_attached;
+    std::atomic<uint32_t> num_flushed;
+
+    uint32_t              num_metrics;
+    char                  metric_names[MaxMetrics][MaxNameLen];
+
+    uint64_t              strings_offset;
+    uint64_t              strings_capacity;
+    uint64_t              strings_used;
+
+    uint64_t              nodes_offset;
+    uint64_t              node_index_offset;
+    uint32_t              nodes_capacity;
+    uint32_t              node_index_slots;
+    uint32_t              num_nodes;
+
+    uint64_t              table_offset;
+    uint64_t              table_index_offset;
+    uint32_t              table_capacity;
+    uint32_t              table_index_slots;
+    std::atomic<uint32_t> num_entries;
+
+    std::atomic<uint64_t> num_dropped;
+
+    char* base() {
+        return reinterpret_cast<char*>(this);
+    }
+
+    char* strings() {
+        return base() + strings_offset;
+    }
+
+    NodeEntry* nodes() {
+        return reinterpret_cast<NodeEntry*>(base() + nodes_offset);
+    }
+
+    uint32_t* node_index() {
+        return reinterpret_cast<uint32_t*>(base() + node_index_offset);
+    }
+
+    TableEntry* table() {
+        return reinterpret_cast<TableEntry*>(base() + table_offset);
+    }
+
+    std::atomic<uint32_t>* table_index() {
+        return reinterpret_cast<std::atomic<uint32_t>*>(base() + table_index_offset);
+    }
+
+    /// \brief Compute the layout for a segment of \a sz bytes
+    bool init_layout(size_t sz) {
+        size = sz;
+
+        size_t pos = align(sizeof(SharedData));
+
+        if (sz < pos + 4096)
+            return false;
+
+        size_t avail = sz - pos;
+
+        strings_offset   = pos;
+        strings_capacity = avail / 16;
+        strings_used     = 0;
+        pos = align(pos + strings_capacity);
+
+        size_t node_bytes = avail / 8;
+
+        nodes_capacity    = static_cast<uint32_t>(node_bytes / (sizeof(NodeEntry) + 2 * sizeof(uint32_t)));
+        node_index_slots  = 2 * nodes_capacity;
+        nodes_offset      = pos;
+        pos = align(pos + nodes_capacity * sizeof(NodeEntry));
+        node_index_offset = pos;
+        pos = align(pos + node_index_slots * sizeof(uint32_t));
+
+        if (pos >= sz)
+            return false;
+
+        size_t table_bytes = sz - pos - 128;
+
+        table_capacity     = static_cast<uint32_t>(table_bytes / (sizeof(TableEntry) + 2 * sizeof(uint32_t)));
+        table_index_slots  = 2 * table_capacity;
+        table_offset       = pos;
+        pos = align(pos + table_capacity * sizeof(TableEntry));
+        table_index_offset = pos;
+        pos += table_index_slots * sizeof(uint32_t);
+
+        num_nodes = 0;
+        num_entries.store(0);
+
+        return pos <= sz && nodes_capacity > 0 && table_capacity > 0;
+    }
+};
+
+
+ShmAggregateDB::ShmAggregateDB(SharedData* shared, size_t size, const std::string& filename, bool leader, double timeout)
+    : m_shared(shared),
+      m_size(size),
+      m_filename(filename),
+      m_leader(leader),
+      m_timeout(timeout),
+      m_flushed(false),
+      m_generation(++s_generation),
+      m_num_dropped(0)
+{
+    m_shared->num_attached.fetch_add(1);
+}
+
+ShmAggregateDB::~ShmAggregateDB()
+{
+    if (!m_flushed)
+        m_shared->num_flushed.fetch_add(1);
+
+    munmap(m_shared, m_size);
+
+    if (m_leader)
+        unlink(m_filename.c_str());
+}
+
+ShmAggregateDB* ShmAggregateDB::open(const std::string& filename, size_t size, double timeout)
+{
+    int  fd     = ::open(filename.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    bool leader = (fd >= 0);
+
+    if (leader) {
+        if (ftruncate(fd, size) != 0) {
+            Log(0).stream() << "aggregate: could not resize " << filename << std::endl;
+            close(fd);
+            unlink(filename.c_str());
+            return nullptr;
+        }
+    } else {
+        fd = ::open(filename.c_str(), O_RDWR);
+
+        if (fd < 0) {
+            Log(0).stream() << "aggregate: could not open " << filename << std::endl;
+            return nullptr;
+        }
+
+        // wait until the leader has sized and initialized the file
+        auto start = std::chrono::steady_clock::now();
+
+        while (true) {
+            struct stat st;
+
+            if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(SharedData)) {
+                void* ptr = mmap(nullptr, sizeof(SharedData), PROT_READ, MAP_SHARED, fd, 0);
+
+                if (ptr != MAP_FAILED) {
+                    const SharedData* hdr = static_cast<const SharedData*>(ptr);
+                    bool ready = (hdr->magic.load(std::memory_order_acquire) == ShmMagic);
+
+                    if (ready)
+                        size = hdr->size;
+
+                    munmap(ptr, sizeof(SharedData));
+
+                    if (ready)
+                        break;
+                }
+            }
+
+            if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > timeout) {
+                Log(0).stream() << "aggregate: " << filename << " was not initialized in time" << std::endl;
+                close(fd);
+                return nullptr;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (!leader && ptr != MAP_FAILED) {
+        // A leftover file from a crashed run: remove it and start over,
+        // unless someone else has replaced it already
+        pid_t pid = static_cast<SharedData*>(ptr)->leader_pid;
+
+        if (kill(pid, 0) != 0 && errno == ESRCH) {
+            struct stat fd_st, path_st;
+
+            if (fstat(fd, &fd_st) == 0 && stat(filename.c_str(), &path_st) == 0 &&
+                fd_st.st_ino == path_st.st_ino) {
+                Log(1).stream() << "aggregate: removing stale " << filename << std::endl;
+                unlink(filename.c_str());
+            }
+
+            munmap(ptr, size);
+            close(fd);
+
+            return open(filename, size, timeout);
+        }
+    }
+
+    close(fd);
+
+    if (ptr == MAP_FAILED) {
+        Log(0).stream() << "aggregate: could not map " << filename << std::endl;
+
+        if (leader)
+            unlink(filename.c_str());
+
+        return nullptr;
+    }
+
+    SharedData* shared = static_cast<SharedData*>(ptr);
+
+    if (leader) {
+        if (!shared->init_layout(size)) {
+            Log(0).stream() << "aggregate: shared memory size " << size << " is too small" << std::endl;
+            munmap(ptr, size);
+            unlink(filename.c_str());
+            return nullptr;
+        }
+
+        shared->version    = ShmVersion;
+        shared->leader_pid = getpid();
+
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutex_init(&shared->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+
+        shared->magic.store(ShmMagic, std::memory_order_release);
+    } else if (shared->version != ShmVersion) {
+        Log(0).stream() << "aggregate: " << filename << " has an incompatible version" << std::endl;
+        munmap(ptr, size);
+        return nullptr;
+    }
+
+    return new ShmAggregateDB(shared, size, filename, leader, timeout);
+}
+
+void ShmAggregateDB::set_metrics(const std::vector<std::string>& names)
+{
+    m_metric_index.assign(names.size(), -1);
+
+    pthread_mutex_lock(&m_shared->lock);
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (names[i].size() >= MaxNameLen)
+            continue;
+
+        uint32_t m = 0;
+
+        while (m < m_shared->num_metrics && names[i] != m_shared->metric_names[m])
+            ++m;
+
+        if (m == m_shared->num_metrics) {
+            if (m >= MaxMetrics)
+                continue;
+
+            strncpy(m_shared->metric_names[m], names[i].c_str(), MaxNameLen-1);
+            ++m_shared->num_metrics;
+        }
+
+        m_metric_index[i] = static_cast<int>(m);
+    }
+
+    pthread_mutex_unlock(&m_shared->lock);
+
+    for (size_t i = 0; i < names.size(); ++i)
+        if (m_metric_index[i] < 0)
+            Log(1).stream() << "aggregate: can't aggregate " << names[i]
+                            << " in shared memory (at most " << MaxMetrics << " attributes)" << std::endl;
+}
+
+uint32_t ShmAggregateDB::find_or_insert_node(uint32_t parent, const Attribute& attr, const Variant& value)
+{
+    std::string    name = attr.name();
+    const void*    data = value.data();
+    size_t         len  = value.size();
+
+    uint64_t h = fnv1a(FnvOffset, &parent, sizeof(parent));
+    h = fnv1a(h, name.data(), name.size());
+    h = fnv1a(h, data, len);
+
+    SharedData* s     = m_shared;
+    uint32_t*   index = s->node_index();
+    NodeEntry*  nodes = s->nodes();
+    char*       str   = s->strings();
+
+    uint32_t    ret   = InvalidId;
+
+    pthread_mutex_lock(&s->lock);
+
+    for (uint32_t probe = 0; probe < s->node_index_slots; ++probe) {
+        uint32_t& slot = index[(h + probe) % s->node_index_slots];
+
+        if (slot == 0) {
+            if (s->num_nodes >= s->nodes_capacity ||
+                s->strings_used + name.size() + len > s->strings_capacity)
+                break;
+
+            uint32_t   id = s->num_nodes++;
+            NodeEntry& e  = nodes[id];
+
+            e.parent   = parent;
+            e.type     = static_cast<uint32_t>(attr.type());
+            e.prop     = static_cast<uint32_t>(attr.properties());
+            e.name_off = static_cast<uint32_t>(s->strings_used);
+            e.name_len = static_cast<uint32_t>(name.size());
+            memcpy(str + s->strings_used, name.data(), name.size());
+            s->strings_used += name.size();
+            e.data_off = static_cast<uint32_t>(s->strings_used);
+            e.data_len = static_cast<uint32_t>(len);
+            memcpy(str + s->strings_used, data, len);
+            s->strings_used += len;
+
+            slot = id + 1;
+            ret  = id;
+
+            break;
+        }
+
+        const NodeEntry& e = nodes[slot - 1];
+
+        if (e.parent == parent && e.name_len == name.size() && e.data_len == len &&
+            memcmp(str + e.name_off, name.data(), name.size()) == 0 &&
+            memcmp(str + e.data_off, data, len) == 0) {
+            ret = slot - 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+uint32_t ShmAggregateDB::shared_node(Caliper* c, const Node* node, bool can_insert)
+{
+    if (!node || node->id() == CALI_INV_ID)
+        return RootNode;
+
+    if (!t_node_cache) {
+        if (!can_insert)
+            return InvalidId;
+
+        t_node_cache = new NodeCache;
+        t_node_cache->generation = m_generation;
+    }
+
+    if (t_node_cache->generation != m_generation) {
+        if (!can_insert)
+            return InvalidId;
+
+        t_node_cache->map.clear();
+        t_node_cache->generation = m_generation;
+    }
+
+    auto it = t_node_cache->map.find(node->id());
+
+    if (it != t_node_cache->map.end())
+        return it->second;
+
+    if (!can_insert)
+        return InvalidId;
+
+    uint32_t parent = shared_node(c, node->parent(), can_insert);
+
+    if (parent == InvalidId)
+        return InvalidId;
+
+    uint32_t id = find_or_insert_node(parent, c->get_attribute(node->attribute()), node->data());
+
+    if (id != InvalidId)
+        t_node_cache->map.insert(std::make_pair(node->id(), id));
+
+    return id;
+}
+
+void ShmAggregateDB::process_snapshot(Caliper* c, const SnapshotRecord* snapshot, const std::vector<Attribute>& aggr_attrs)
+{
+    // Signal handlers can't take the lock or allocate: they can only
+    // update existing entries
+    bool can_insert = !c->is_signal();
+
+    SnapshotRecord::Data  data  = snapshot->data();
+    SnapshotRecord::Sizes sizes = snapshot->size();
+
+    if (sizes.n_nodes > MaxKeyLen) {
+        ++m_num_dropped;
+        m_shared->num_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    uint32_t key[MaxKeyLen];
+    uint32_t keylen = 0;
+
+    for (size_t i = 0; i < sizes.n_nodes; ++i) {
+        uint32_t id = shared_node(c, data.node_entries[i], can_insert);
+
+        if (id == InvalidId) {
+            ++m_num_dropped;
+            m_shared->num_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        key[keylen++] = id;
+    }
+
+    // the key is the set of context nodes
+    std::sort(key, key + keylen);
+
+    uint64_t h = fnv1a(FnvOffset, key, keylen * sizeof(uint32_t));
+
+    SharedData*            s     = m_shared;
+    std::atomic<uint32_t>* index = s->table_index();
+    TableEntry*            table = s->table();
+    TableEntry*            entry = nullptr;
+
+    bool locked = false;
+
+    for (uint32_t probe = 0; probe < s->table_index_slots; ++probe) {
+        std::atomic<uint32_t>& slot = index[(h + probe) % s->table_index_slots];
+        uint32_t val = slot.load(std::memory_order_acquire);
+
+        if (val == 0 && !locked) {
+            if (!can_insert)
+                break;
+
+            // take the lock and look at the slot again
+            pthread_mutex_lock(&s->lock);
+            locked = true;
+            val = slot.load(std::memory_order_acquire);
+        }
+
+        if (val == 0) {
+            uint32_t n = s->num_entries.load(std::memory_order_relaxed);
+
+            if (n >= s->table_capacity)
+                break;
+
+            TableEntry& e = table[n];
+
+            e.keylen = keylen;
+            std::copy(key, key + keylen, e.key);
+            e.count.store(0, std::memory_order_relaxed);
+
+            for (MetricEntry& m : e.metrics) {
+                m.n.store(0, std::memory_order_relaxed);
+                m.sum.store(to_bits(0.0), std::memory_order_relaxed);
+                m.min.store(to_bits(std::numeric_limits<double>::max()), std::memory_order_relaxed);
+                m.max.store(to_bits(std::numeric_limits<double>::lowest()), std::memory_order_relaxed);
+            }
+
+            s->num_entries.store(n + 1, std::memory_order_release);
+            slot.store(n + 1, std::memory_order_release);
+
+            entry = &e;
+            break;
+        }
+
+        TableEntry& e = table[val - 1];
+
+        if (e.keylen == keylen && std::equal(key, key + keylen, e.key)) {
+            entry = &e;
+            break;
+        }
+    }
+
+    if (locked)
+        pthread_mutex_unlock(&s->lock);
+
+    if (!entry) {
+        ++m_num_dropped;
+        s->num_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    entry->count.fetch_add(1, std::memory_order_relaxed);
+
+    size_t nattr = std::min(aggr_attrs.size(), m_metric_index.size());
+
+    for (size_t a = 0; a < nattr; ++a) {
+        if (m_metric_index[a] < 0 || aggr_attrs[a] == Attribute::invalid)
+            continue;
+
+        cali_id_t id = aggr_attrs[a].id();
+
+        for (size_t i = 0; i < sizes.n_immediate; ++i)
+            if (data.immediate_attr[i] == id) {
+                double       val = data.immediate_data[i].to_double();
+                MetricEntry& m   = entry->metrics[m_metric_index[a]];
+
+                m.n.fetch_add(1, std::memory_order_relaxed);
+                atomic_add(m.sum, val);
+                atomic_min(m.min, val);
+                atomic_max(m.max, val);
+
+                break;
+            }
+    }
+}
+
+size_t ShmAggregateDB::flush(Caliper* c, Caliper::SnapshotFlushFn proc_fn)
+{
+    SharedData* s = m_shared;
+
+    if (!m_flushed) {
+        s->num_flushed.fetch_add(1);
+        m_flushed = true;
+
+        if (m_leader) {
+            auto start = std::chrono::steady_clock::now();
+
+            while (s->num_flushed.load() < s->num_attached.load() &&
+                   std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < m_timeout)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+            if (s->num_flushed.load() < s->num_attached.load())
+                Log(1).stream() << "aggregate: "
+                                << s->num_attached.load() - s->num_flushed.load()
+                                << " process(es) on this node did not flush in time" << std::endl;
+        }
+    }
+
+    if (!m_leader)
+        return 0;
+
+    // Re-create the shared context nodes in our context tree
+
+    uint32_t num_nodes = 0;
+    uint32_t num_metrics = 0;
+
+    pthread_mutex_lock(&s->lock);
+    num_nodes   = s->num_nodes;
+    num_metrics = s->num_metrics;
+    pthread_mutex_unlock(&s->lock);
+
+    const NodeEntry* nodes = s->nodes();
+    const char*      str   = s->strings();
+
+    std::vector<Node*> local_nodes(num_nodes, nullptr);
+
+    // nodes are inserted after their parents, so parents always come first
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        const NodeEntry& e = nodes[i];
+
+        Node* parent = (e.parent < i ? local_nodes[e.parent] : nullptr);
+
+        Attribute attr =
+            c->create_attribute(std::string(str + e.name_off, e.name_len),
+                                static_cast<cali_attr_type>(e.type),
+                                static_cast<int>(e.prop));
+
+        local_nodes[i] =
+            c->make_tree_entry(attr, Variant(attr.type(), str + e.data_off, e.data_len), parent);
+    }
+
+    Attribute count_attr =
+        c->create_attribute("count", CALI_TYPE_INT, CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD);
+
+    struct MetricAttributes {
+        Attribute min_attr, max_attr, sum_attr, avg_attr;
+    };
+
+    std::vector<MetricAttributes> metric_attrs;
+
+    for (uint32_t m = 0; m < num_metrics; ++m) {
+        std::string name(s->metric_names[m]);
+        int prop = CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD;
+
+        metric_attrs.push_back(MetricAttributes {
+                c->create_attribute(std::string("min#") + name, CALI_TYPE_DOUBLE, prop),
+                c->create_attribute(std::string("max#") + name, CALI_TYPE_DOUBLE, prop),
+                c->create_attribute(std::string("sum#") + name, CALI_TYPE_DOUBLE, prop),
+                c->create_attribute(std::string("avg#") + name, CALI_TYPE_DOUBLE, prop)
+            });
+    }
+
+    uint32_t    num_entries = s->num_entries.load(std::memory_order_acquire);
+    TableEntry* table       = s->table();
+    size_t      written     = 0;
+
+    for (uint32_t i = 0; i < num_entries; ++i) {
+        const TableEntry& e = table[i];
+
+        SnapshotRecord::FixedSnapshotRecord<MaxKeyLen + 4*MaxMetrics + 1> rec_data;
+        SnapshotRecord rec(rec_data);
+
+        for (uint32_t k = 0; k < e.keylen; ++k)
+            if (e.key[k] < num_nodes && local_nodes[e.key[k]])
+                rec.append(local_nodes[e.key[k]]);
+
+        cali_id_t attr[4*MaxMetrics + 1];
+        Variant   data[4*MaxMetrics + 1];
+        size_t    n = 0;
+
+        attr[n] = count_attr.id();
+        data[n] = Variant(static_cast<int>(e.count.load(std::memory_order_relaxed)));
+        ++n;
+
+        for (uint32_t m = 0; m < num_metrics; ++m) {
+            const MetricEntry& me = e.metrics[m];
+            uint64_t cnt = me.n.load(std::memory_order_relaxed);
+
+            if (cnt == 0)
+                continue;
+
+            double sum = from_bits(me.sum.load(std::memory_order_relaxed));
+
+            attr[n] = metric_attrs[m].min_attr.id();
+            data[n] = Variant(from_bits(me.min.load(std::memory_order_relaxed)));
+            ++n;
+            attr[n] = metric_attrs[m].max_attr.id();
+            data[n] = Variant(from_bits(me.max.load(std::memory_order_relaxed)));
+            ++n;
+            attr[n] = metric_attrs[m].sum_attr.id();
+            data[n] = Variant(sum);
+            ++n;
+            attr[n] = metric_attrs[m].avg_attr.id();
+            data[n] = Variant(sum / cnt);
+            ++n;
+        }
+
+        rec.append(n, attr, data);
+        proc_fn(&rec);
+
+        ++written;
+    }
+
+    uint64_t dropped = s->num_dropped.load();
+
+    if (dropped > 0)
+        Log(1).stream() << "aggregate: " << dropped
+                        << " snapshots did not fit into the shared aggregation table" << std::endl;
+
+    Log(1).stream() << "aggregate: wrote " << written << " shared records for "
+                    << s->num_attached.load() << " process(es)" << std::endl;
+
+    return written;
+}
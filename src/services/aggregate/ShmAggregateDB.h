@@ -0,0 +1,116 @@
+// Copyright (c) 2016, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+/// \file  ShmAggregateDB.h
+/// \brief Node-local aggregation table in shared memory
+
+#pragma once
+
+#include "caliper/Caliper.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace cali
+{
+
+class SnapshotRecord;
+
+/// \brief An aggregation table shared by the processes on a node
+///
+/// The processes map a file in /dev/shm that holds a context tree node
+/// dictionary and a hashed aggregation table. Each process translates
+/// its context tree nodes into shared node ids, and updates the count
+/// and min/max/sum of the aggregation attributes of the table entries
+/// with atomic operations. The process that created the file (the
+/// leader) writes the aggregated records for all of them when it
+/// flushes; the others write nothing.
+class ShmAggregateDB
+{
+    struct SharedData;
+
+    SharedData*      m_shared;
+    size_t           m_size;
+    std::string      m_filename;
+    bool             m_leader;
+    double           m_timeout;
+    bool             m_flushed;
+
+    unsigned         m_generation;
+
+    /// \brief Shared metric index for each local aggregation attribute
+    std::vector<int> m_metric_index;
+
+    std::atomic<size_t> m_num_dropped;
+
+    ShmAggregateDB(SharedData* shared, size_t size, const std::string& filename, bool leader, double timeout);
+
+    uint32_t shared_node(Caliper* c, const Node* node, bool can_insert);
+    uint32_t find_or_insert_node(uint32_t parent, const Attribute& attr, const Variant& value);
+
+public:
+
+    /// \brief Maximum number of context nodes in an aggregation key
+    static const size_t MaxKeyLen  = 16;
+    /// \brief Maximum number of aggregation attributes
+    static const size_t MaxMetrics = 8;
+
+    ~ShmAggregateDB();
+
+    ShmAggregateDB(const ShmAggregateDB&) = delete;
+    ShmAggregateDB& operator = (const ShmAggregateDB&) = delete;
+
+    /// \brief Create or attach to the shared aggregation table in \a filename.
+    ///   Returns null on error.
+    static ShmAggregateDB* open(const std::string& filename, size_t size, double timeout);
+
+    bool   is_leader() const { return m_leader; }
+
+    /// \brief Register the aggregation attribute names. Must be called
+    ///   before processing snapshots.
+    void   set_metrics(const std::vector<std::string>& names);
+
+    /// \brief Add \a snapshot to the shared table. \a aggr_attrs are the
+    ///   aggregation attributes in the order given in set_metrics().
+    void   process_snapshot(Caliper* c, const SnapshotRecord* snapshot, const std::vector<Attribute>& aggr_attrs);
+
+    /// \brief Write the shared table's records (leader only). The leader
+    ///   waits until the other attached processes have flushed, or until
+    ///   the timeout expires.
+    size_t flush(Caliper* c, Caliper::SnapshotFlushFn proc_fn);
+
+    size_t num_dropped() const { return m_num_dropped.load(); }
+};
+
+} // namespace cali
@@ -44,10 +44,17 @@
 #include "caliper/common/Node.h"
 #include "caliper/common/RuntimeConfig.h"
 
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 #include <cstring>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <numeric>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 
 using namespace cali;
@@ -67,6 +74,8 @@ bool g_resolve_addresses        { false };
 bool g_track_allocations        { true  };
 bool g_record_active_mem        { false };
 
+uint64_t g_sample_bytes         { 0 };
+
 // DataTracker attributes
 Attribute mem_alloc_attr        { Attribute::invalid };
 Attribute mem_free_attr         { Attribute::invalid };
@@ -88,6 +97,7 @@ struct alloc_attrs {
 struct AllocInfo {
     uint64_t                 start_addr;
     uint64_t                 total_size;
+    uint64_t                 weight;     // estimated bytes represented by this allocation
     Variant                  v_uid;
     Variant                  v_size;
     size_t                   elem_size;
@@ -95,10 +105,6 @@ struct AllocInfo {
     std::vector<cali::Node*> memattr_label_nodes;
     std::vector<size_t>      dimensions;
     std::string              label;
-    
-    size_t index_1D(uint64_t addr) const {
-        return (addr - start_addr) / elem_size;
-    }
 };
 
 /// Three-way predicate to tell if given address is within AllocInfo's address range, less, or higher
@@ -154,15 +160,81 @@ std::vector<alloc_attrs>   g_memoryaddress_attrs;
 
 cali::Node                 g_alloc_root_node { CALI_INV_ID, CALI_INV_ID, Variant() };
 
-util::SplayTree<AllocInfo, AllocInfoCmp> g_tree;
-std::mutex                 g_tree_lock;
+// The allocation index is sharded by address range so that threads
+// working on different memory regions don't serialize on a single lock.
+// An allocation of at most 2^SHARD_BLOCK_BITS bytes goes into the shard of
+// the block its start address falls into, and can only extend into the next
+// block. Larger allocations go into a separate shard. Thus, an address
+// lookup needs to check at most three shards.
+
+#define SHARD_BLOCK_BITS 20
+#define NUM_SHARDS       64
+
+struct AllocShard {
+    util::SplayTree<AllocInfo, AllocInfoCmp> tree;
+    std::mutex                               lock;
+};
+
+AllocShard                 g_shards[NUM_SHARDS];
+AllocShard                 g_large_shard;
+
+inline AllocShard& shard_for_block(uint64_t block)
+{
+    return g_shards[block % NUM_SHARDS];
+}
+
+inline AllocShard& shard_for_alloc(uint64_t start_addr, uint64_t size)
+{
+    if (size > (1ULL << SHARD_BLOCK_BITS))
+        return g_large_shard;
+
+    return shard_for_block(start_addr >> SHARD_BLOCK_BITS);
+}
+
+//
+// --- Per-thread address lookup cache
+//
+// Maps page numbers to the allocation range that contained the last
+// address resolved on that page, so that repeated samples on hot arrays
+// don't need the shard locks. Entries are copies, and become invalid
+// when any tracked allocation is removed (which bumps the allocation
+// epoch). New allocations don't invalidate entries: they can't overlap
+// a live allocation, and addresses outside the cached range always go
+// to the shards.
+//
+
+#define ADDR_CACHE_PAGE_BITS 12
+#define ADDR_CACHE_ENTRIES   256
+
+std::atomic<uint64_t>      g_alloc_epoch     { 1 };
 
-uint64_t                   g_active_mem      { 0 };
+struct AddressCacheEntry {
+    uint64_t    page       = 0;
+    uint64_t    epoch      = 0;   ///< 0: invalid
+    size_t      attr_index = 0;   ///< index of the memory address attribute
+    uint64_t    start_addr = 0;
+    uint64_t    total_size = 0;
+    size_t      elem_size  = 1;
+    Variant     v_uid;
+    cali::Node* label_node = nullptr;
+};
+
+struct AddressCache {
+    AddressCacheEntry entries[ADDR_CACHE_ENTRIES];
+
+    static size_t slot(uint64_t page, size_t i) {
+        return (page + 131 * i) % ADDR_CACHE_ENTRIES;
+    }
+};
 
-unsigned long              g_current_tracked { 0 };
-unsigned long              g_max_tracked     { 0 };
-unsigned long              g_total_tracked   { 0 };
-unsigned                   g_failed_untrack  { 0 };
+thread_local std::unique_ptr<AddressCache> t_addr_cache;
+
+std::atomic<uint64_t>      g_active_mem      { 0 };
+
+std::atomic<unsigned long> g_current_tracked { 0 };
+std::atomic<unsigned long> g_max_tracked     { 0 };
+std::atomic<unsigned long> g_total_tracked   { 0 };
+std::atomic<unsigned>      g_failed_untrack  { 0 };
 
 
 const ConfigSet::Entry s_configdata[] = {
@@ -178,12 +250,74 @@ const ConfigSet::Entry s_configdata[] = {
       "Record the active allocated memory at each snapshot.",
       "Record the active allocated memory at each snapshot."
     },
+    { "sample_bytes", CALI_TYPE_UINT, "0",
+      "Sample allocations: average number of bytes allocated between samples.",
+      "Sample allocations: average number of bytes allocated between samples.\n"
+      "0: track every allocation."
+    },
     
     ConfigSet::Terminator
 };
 
 #define NUM_TRACKED_ALLOC_ATTRS 2
 
+//
+// --- Allocation sampling
+//
+// Like tcmalloc's heap profiler, take samples every g_sample_bytes
+// allocated bytes on average, with exponentially distributed distances
+// between samples. A sampled allocation of size s stands for
+// s / (1 - exp(-s/g_sample_bytes)) bytes, which makes mem.active and
+// alloc.total_size unbiased estimates.
+//
+
+struct SampleState {
+    uint64_t rng;
+    int64_t  bytes_until_sample;
+};
+
+thread_local SampleState t_sample_state { 0, 0 };
+
+double next_random(SampleState& state)
+{
+    if (state.rng == 0)
+        state.rng = reinterpret_cast<uintptr_t>(&state) | 1;
+
+    // xorshift64*
+    state.rng ^= state.rng >> 12;
+    state.rng ^= state.rng << 25;
+    state.rng ^= state.rng >> 27;
+
+    return ((state.rng * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int64_t next_sample_distance(SampleState& state)
+{
+    return static_cast<int64_t>(-std::log(1.0 - next_random(state)) * g_sample_bytes) + 1;
+}
+
+/// Decide if an allocation of \a size bytes is sampled, and compute its
+/// weight if so
+bool sample_allocation(uint64_t size, uint64_t& weight)
+{
+    SampleState& state(t_sample_state);
+
+    if (state.rng == 0)
+        state.bytes_until_sample = next_sample_distance(state);
+
+    state.bytes_until_sample -= static_cast<int64_t>(size);
+
+    if (state.bytes_until_sample > 0)
+        return false;
+
+    state.bytes_until_sample = next_sample_distance(state);
+
+    double p = 1.0 - std::exp(-static_cast<double>(size) / g_sample_bytes);
+    weight   = p > 0.0 ? static_cast<uint64_t>(size / p + 0.5) : size;
+
+    return true;
+}
+
 
 void track_mem_snapshot(Caliper* c, 
                         const Attribute& alloc_or_free_attr, 
@@ -209,70 +343,281 @@ void track_mem_snapshot(Caliper* c,
     c->push_snapshot(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, &trigger_info);    
 }
 
-void track_mem_cb(Caliper* c, const void* ptr, const char* label, size_t elem_size, size_t ndims, const size_t* dims)
+/// Fill in \a info for a region to track. Returns false if the region
+/// is not sampled.
+bool init_alloc_info(const void* ptr, size_t elem_size, size_t ndims, const size_t* dims, AllocInfo& info)
 {
     size_t total_size =
         std::accumulate(dims, dims+ndims, elem_size, std::multiplies<size_t>());
 
-    AllocInfo info;
+    uint64_t weight = total_size;
+
+    if (g_sample_bytes > 0 && !sample_allocation(total_size, weight))
+        return false;
 
     info.start_addr = reinterpret_cast<uint64_t>(ptr);
     info.total_size = total_size;
+    info.weight     = weight;
     info.v_uid      = Variant(cali_make_variant_from_uint(++g_alloc_uid));
-    info.v_size     = Variant(cali_make_variant_from_uint(total_size));
+    info.v_size     = Variant(cali_make_variant_from_uint(weight));
     info.elem_size  = elem_size;
     info.num_elems  = total_size / elem_size;
 
     info.memattr_label_nodes.resize(g_memoryaddress_attrs.size());
     info.dimensions.assign(dims, dims+ndims);
 
-    info.label      = label;
+    return true;
+}
 
+/// Make the label nodes for each memory address attribute
+std::vector<cali::Node*> make_label_nodes(Caliper* c, const char* label)
+{
     Variant v_label(CALI_TYPE_STRING, label, strlen(label));
-        
-    // make label nodes for each memory address attribute
+    std::vector<cali::Node*> nodes(g_memoryaddress_attrs.size());
+
     for (std::vector<cali::Node*>::size_type i = 0; i < g_memoryaddress_attrs.size(); ++i)
-        info.memattr_label_nodes[i] =
-            c->make_tree_entry(g_memoryaddress_attrs[i].alloc_label_attr, v_label, &g_alloc_root_node);
+        nodes[i] = c->make_tree_entry(g_memoryaddress_attrs[i].alloc_label_attr, v_label, &g_alloc_root_node);
+
+    return nodes;
+}
+
+void add_tracked(unsigned long count, uint64_t weight)
+{
+    unsigned long current = (g_current_tracked += count);
+    unsigned long max     = g_max_tracked.load();
+
+    while (current > max && !g_max_tracked.compare_exchange_weak(max, current))
+        ;
+
+    g_active_mem    += weight;
+    g_total_tracked += count;
+}
+
+void track_mem_cb(Caliper* c, const void* ptr, const char* label, size_t elem_size, size_t ndims, const size_t* dims)
+{
+    AllocInfo info;
+
+    if (!init_alloc_info(ptr, elem_size, ndims, dims, info))
+        return;
+
+    info.label = label;
+    info.memattr_label_nodes = make_label_nodes(c, label);
 
     {
+        AllocShard& shard(shard_for_alloc(info.start_addr, info.total_size));
+
         std::lock_guard<std::mutex>
-            g(g_tree_lock);
-        
-        g_tree.insert(info);
+            g(shard.lock);
         
-        g_max_tracked  = std::max(++g_current_tracked, g_max_tracked);
-        g_active_mem  += total_size;
-        ++g_total_tracked;
+        shard.tree.insert(info);
     }
 
+    add_tracked(1, info.weight);
+
     if (g_track_allocations)
-        track_mem_snapshot(c, mem_alloc_attr, v_label, info.v_size, info.v_uid);
+        track_mem_snapshot(c, mem_alloc_attr, Variant(CALI_TYPE_STRING, label, strlen(label)),
+                           info.v_size, info.v_uid);
 }
 
-void untrack_mem_cb(Caliper* c, const void* ptr)
-{    
+void track_mem_batch_cb(Caliper* c, size_t n, const Caliper::MemoryRegion* regions)
+{
+    std::vector<AllocInfo> infos;
+    infos.reserve(n);
+
+    // Regions often share labels: make the label nodes once per label
+    std::unordered_map< std::string, std::vector<cali::Node*> > label_nodes;
+
+    uint64_t weight = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        AllocInfo info;
+
+        if (!init_alloc_info(regions[i].ptr, regions[i].elem_size, regions[i].ndims, regions[i].dims, info))
+            continue;
+
+        if (regions[i].label) {
+            info.label = regions[i].label;
+
+            auto it = label_nodes.find(info.label);
+
+            if (it == label_nodes.end())
+                it = label_nodes.emplace(info.label, make_label_nodes(c, regions[i].label)).first;
+
+            info.memattr_label_nodes = it->second;
+        }
+
+        weight += info.weight;
+        infos.push_back(std::move(info));
+    }
+
+    // Insert each shard's regions in address order under one lock
+    // acquisition: the splay tree handles sequential inserts cheaply.
+
+    std::sort(infos.begin(), infos.end(), [](const AllocInfo& a, const AllocInfo& b) {
+            AllocShard* sa = &shard_for_alloc(a.start_addr, a.total_size);
+            AllocShard* sb = &shard_for_alloc(b.start_addr, b.total_size);
+            
+            return std::less<AllocShard*>()(sa, sb) || (sa == sb && a.start_addr < b.start_addr);
+        });
+
+    for (auto it = infos.begin(); it != infos.end(); ) {
+        AllocShard& shard(shard_for_alloc(it->start_addr, it->total_size));
+
+        std::lock_guard<std::mutex>
+            g(shard.lock);
+
+        for ( ; it != infos.end() && &shard_for_alloc(it->start_addr, it->total_size) == &shard; ++it)
+            shard.tree.insert(*it);
+    }
+
+    add_tracked(infos.size(), weight);
+
+    if (g_track_allocations)
+        for (const AllocInfo& info : infos)
+            if (!info.label.empty())
+                track_mem_snapshot(c, mem_alloc_attr,
+                                   Variant(CALI_TYPE_STRING, info.label.c_str(), info.label.size()),
+                                   info.v_size, info.v_uid);
+}
+
+/// Set the label of the unlabeled allocation starting at \a addr in \a shard
+bool label_in_shard(AllocShard& shard, uint64_t addr, const char* label, const std::vector<cali::Node*>& nodes, Variant& v_size, Variant& v_uid)
+{
+    std::lock_guard<std::mutex>
+        g(shard.lock);
+
+    auto tree_node = shard.tree.find(HasStartAddress(addr));
+
+    if (!tree_node || !(*tree_node).label.empty())
+        return false;
+
+    (*tree_node).label = label;
+    (*tree_node).memattr_label_nodes = nodes;
+
+    v_size = (*tree_node).v_size;
+    v_uid  = (*tree_node).v_uid;
+
+    return true;
+}
+
+void label_mem_cb(Caliper* c, const void* ptr, const char* label)
+{
+    uint64_t addr = reinterpret_cast<uint64_t>(ptr);
+    std::vector<cali::Node*> nodes = make_label_nodes(c, label);
+    Variant v_size, v_uid;
+
+    if (!label_in_shard(shard_for_block(addr >> SHARD_BLOCK_BITS), addr, label, nodes, v_size, v_uid) &&
+        !label_in_shard(g_large_shard, addr, label, nodes, v_size, v_uid))
+        return;
+
+    // invalidate address cache entries without the label
+    g_alloc_epoch.fetch_add(1, std::memory_order_release);
+
+    if (g_track_allocations)
+        track_mem_snapshot(c, mem_alloc_attr, Variant(CALI_TYPE_STRING, label, strlen(label)), v_size, v_uid);
+}
+
+bool untrack_in_shard(Caliper* c, AllocShard& shard, uint64_t addr)
+{
     std::lock_guard<std::mutex>
-        g(g_tree_lock);
+        g(shard.lock);
     
-    auto tree_node = g_tree.find(HasStartAddress(reinterpret_cast<uint64_t>(ptr)));
+    auto tree_node = shard.tree.find(HasStartAddress(addr));
     
     if (tree_node) {
         size_t size = (*tree_node).total_size;
 
-        if (g_track_allocations)
+        if (g_track_allocations && !(*tree_node).label.empty())
             track_mem_snapshot(c, mem_free_attr,
                                Variant(CALI_TYPE_STRING, (*tree_node).label.c_str(), (*tree_node).label.size()),
                                (*tree_node).v_size,
                                (*tree_node).v_uid);
 
-        g_active_mem -= (*tree_node).total_size;
-        g_tree.remove(tree_node);
+        g_active_mem -= (*tree_node).weight;
+        shard.tree.remove(tree_node);
+
+        g_alloc_epoch.fetch_add(1, std::memory_order_release);
         
         --g_current_tracked;
-    } else {
+
+        return true;
+    }
+
+    return false;
+}
+
+void untrack_mem_cb(Caliper* c, const void* ptr)
+{
+    uint64_t addr = reinterpret_cast<uint64_t>(ptr);
+
+    if (!untrack_in_shard(c, shard_for_block(addr >> SHARD_BLOCK_BITS), addr) &&
+        !untrack_in_shard(c, g_large_shard, addr) &&
+        g_sample_bytes == 0) // with sampling, most untracks are expected to fail
         ++g_failed_untrack;
+}
+
+/// Find the allocation containing \a addr in \a shard and copy out the data
+/// needed for address resolution into \a e
+bool find_in_shard(AllocShard& shard, uint64_t addr, size_t i, AddressCacheEntry& e)
+{
+    std::lock_guard<std::mutex>
+        g(shard.lock);
+
+    auto tree_node = shard.tree.find(ContainsAddress(addr));
+
+    if (!tree_node)
+        return false;
+
+    e.start_addr = (*tree_node).start_addr;
+    e.total_size = (*tree_node).total_size;
+    e.elem_size  = (*tree_node).elem_size;
+    e.v_uid      = (*tree_node).v_uid;
+    e.label_node =
+        (i < (*tree_node).memattr_label_nodes.size() ? (*tree_node).memattr_label_nodes[i] : nullptr);
+
+    return true;
+}
+
+/// Find the allocation containing \a addr for memory address attribute
+/// \a i, first in the thread's address cache, then in the shards
+bool find_allocation(Caliper* c, uint64_t addr, size_t i, AddressCacheEntry& e)
+{
+    uint64_t page  = addr >> ADDR_CACHE_PAGE_BITS;
+    uint64_t epoch = g_alloc_epoch.load(std::memory_order_acquire);
+
+    AddressCache* cache = t_addr_cache.get();
+
+    // Don't allocate the cache in a signal handler
+    if (!cache && !c->is_signal()) {
+        t_addr_cache.reset(new AddressCache);
+        cache = t_addr_cache.get();
+    }
+
+    AddressCacheEntry* slot = cache ? &cache->entries[AddressCache::slot(page, i)] : nullptr;
+
+    if (slot && slot->epoch == epoch && slot->page == page && slot->attr_index == i &&
+        addr >= slot->start_addr && addr < slot->start_addr + slot->total_size) {
+        e = *slot;
+        return true;
     }
+
+    uint64_t block = addr >> SHARD_BLOCK_BITS;
+
+    if (!find_in_shard(shard_for_block(block), addr, i, e) &&
+        !(block > 0 && find_in_shard(shard_for_block(block-1), addr, i, e)) &&
+        !find_in_shard(g_large_shard, addr, i, e))
+        return false;
+
+    if (slot) {
+        // Use the epoch from before the lookup: if an allocation was
+        // removed in between, the entry is already invalid
+        *slot            = e;
+        slot->page       = page;
+        slot->epoch      = epoch;
+        slot->attr_index = i;
+    }
+
+    return true;
 }
 
 void resolve_addresses(Caliper* c, const SnapshotRecord* trigger_info, SnapshotRecord* snapshot)
@@ -289,29 +634,20 @@ void resolve_addresses(Caliper* c, const SnapshotRecord* trigger_info, SnapshotR
             g_memoryaddress_attrs[i].alloc_uid_attr.id(),
             g_memoryaddress_attrs[i].alloc_index_attr.id()
         };
-        Variant     data[2];
-        cali::Node* label_node = nullptr;
+        AddressCacheEntry alloc;
 
-        {
-            std::lock_guard<std::mutex>
-                g(g_tree_lock);
-
-            auto tree_node = g_tree.find(ContainsAddress(addr));
-
-            if (!tree_node)
-                continue;
-
-            data[0] = (*tree_node).v_uid;
-            data[1] = cali_make_variant_from_uint((*tree_node).index_1D(addr));
+        if (!find_allocation(c, addr, i, alloc))
+            continue;
 
-            if (i < (*tree_node).memattr_label_nodes.size())
-                label_node = (*tree_node).memattr_label_nodes[i];
-        }
+        Variant     data[2] = {
+            alloc.v_uid,
+            cali_make_variant_from_uint((addr - alloc.start_addr) / alloc.elem_size)
+        };
 
         snapshot->append(2, attr, data);
 
-        if (label_node)
-            snapshot->append(label_node);
+        if (alloc.label_node)
+            snapshot->append(alloc.label_node);
     }
 }
 
@@ -319,7 +655,7 @@ void snapshot_cb(Caliper* c, int scope, const SnapshotRecord* trigger_info, Snap
 {
     // Record currently active amount of allocated memory
     if (g_record_active_mem)
-        snapshot->append(active_mem_attr.id(), Variant(cali_make_variant_from_uint(g_active_mem)));
+        snapshot->append(active_mem_attr.id(), Variant(cali_make_variant_from_uint(g_active_mem.load())));
 
     if (g_resolve_addresses)
         resolve_addresses(c, trigger_info, snapshot);
@@ -340,7 +676,7 @@ void make_address_attributes(Caliper* c, const Attribute& attr)
     g_memoryaddress_attrs.push_back(attrs);    
 }
 
-void create_attr_cb(Caliper* c, const Attribute& attr)
+void memoryaddress_attr_cb(Caliper* c, const Attribute& attr)
 {
     // Note: this isn't threadsafe!
     if (attr.get(class_memoryaddress_attr).to_bool() == true)
@@ -352,13 +688,7 @@ void post_init_cb(Caliper *c)
     if (!g_resolve_addresses)
         return;
 
-    std::vector<Attribute> address_attrs =
-        c->find_attributes_with(c->get_attribute("class.memoryaddress"));
-
-    for (auto attr : address_attrs)
-        make_address_attributes(c, attr);
-
-    c->events().create_attr_evt.connect(create_attr_cb);
+    c->subscribe_attributes_with(class_memoryaddress_attr, memoryaddress_attr_cb);
 }
 
 void finish_cb(Caliper* c)
@@ -413,8 +743,11 @@ void allocservice_initialize(Caliper* c)
     g_resolve_addresses = config.get("resolve_addresses").to_bool();
     g_track_allocations = config.get("track_allocations").to_bool();
     g_record_active_mem = config.get("record_active_mem").to_bool();
+    g_sample_bytes      = config.get("sample_bytes").to_uint();
 
     c->events().track_mem_evt.connect(track_mem_cb);
+    c->events().track_mem_batch_evt.connect(track_mem_batch_cb);
+    c->events().label_mem_evt.connect(label_mem_cb);
     c->events().untrack_mem_evt.connect(untrack_mem_cb);
 
     if (g_resolve_addresses || g_record_active_mem)
@@ -38,9 +38,14 @@
 #include "caliper/Caliper.h"
 #include "caliper/SnapshotRecord.h"
 
+#include "caliper/common/Node.h"
 #include "caliper/common/RuntimeConfig.h"
 #include "caliper/common/Log.h"
 
+#include "caliper/common/util/tls.hpp"
+
+#include <atomic>
+#include <cstdint>
 #include <cstring>
 #include <string>
 #include <type_traits>
@@ -69,9 +74,12 @@ ConfigSet config;
 
 bool      use_name { false };
 bool      use_addr { false };
+bool      use_fp   { false };
 
 unsigned  skip_frames { 0 };
 
+bool      use_cache { true };
+
 #ifdef CALIPER_HAVE_LIBDW
 Dwfl* dwfl;
 Dwfl_Module* caliper_module;
@@ -86,18 +94,264 @@ static const ConfigSet::Entry s_configdata[] = {
       "Record region addresses for call path",
       "Record region addresses for call path"
     },
+    { "unwinder", CALI_TYPE_STRING, "libunwind",
+      "Stack unwinding method: libunwind or framepointer",
+      "Stack unwinding method:\n"
+      "   libunwind:    Use libunwind\n"
+      "   framepointer: Walk the frame-pointer chain directly. Much faster,\n"
+      "                 but requires code compiled with frame pointers.\n"
+      "                 Falls back to libunwind if the walk fails."
+    },
     { "skip_frames", CALI_TYPE_UINT, "0",
       "Skip this number of stack frames",
       "Skip this number of stack frames.\n"
       "Avoids recording stack frames within the caliper library"
     },
+    { "path_cache", CALI_TYPE_BOOL, "true",
+      "Cache call path nodes per thread",
+      "Cache the call path nodes for recently seen stacks and stack frames\n"
+      "in each thread, so repeated stacks skip the context tree lookup."
+    },
     ConfigSet::Terminator
 };
 
-void snapshot_cb(Caliper* c, int scope, const SnapshotRecord*, SnapshotRecord* snapshot)
+// Stack frame layout with frame pointers: the saved frame pointer of the
+// caller, followed by the return address
+struct StackFrame {
+    const StackFrame* next;
+    const void*       ret;
+};
+
+/// Walk the frame-pointer chain, starting with the caller of the calling
+/// function. Returns the number of addresses stored in ips.
+inline __attribute__((always_inline)) size_t
+fp_unwind(uint64_t* ips, size_t max, unsigned skip)
+{
+    const StackFrame* fp = static_cast<const StackFrame*>(__builtin_frame_address(0));
+    size_t n = 0;
+
+    while (fp && n < max) {
+        uint64_t ret = reinterpret_cast<uintptr_t>(fp->ret);
+
+        if (ret == 0)
+            break;
+
+        if (skip > 0)
+            --skip;
+        else
+            ips[n++] = ret;
+
+        const StackFrame* next = fp->next;
+
+        // Caller frames must be at higher addresses, aligned, and not too
+        // far away. Anything else is a frame without frame pointer.
+        if (next <= fp ||
+            reinterpret_cast<uintptr_t>(next) - reinterpret_cast<uintptr_t>(fp) > (1 << 24) ||
+            reinterpret_cast<uintptr_t>(next) & (sizeof(void*) - 1))
+            break;
+
+        fp = next;
+    }
+
+    return n;
+}
+
+#ifdef CALIPER_HAVE_LIBDW
+inline bool is_caliper_frame(uint64_t ip)
+{
+    return dwfl_addrmodule(dwfl, ip) == caliper_module;
+}
+#endif
+
+//   Per-thread cache of callpath.address nodes. The stack table maps a
+// hash of the whole stack to its leaf node; the edge table maps a
+// (parent node, address) pair to the child node. Both are
+// direct-mapped. Stack hits are verified by walking the leaf's path,
+// so hash collisions can't produce wrong paths. Context tree nodes are
+// never freed, so cached pointers stay valid.
+//   Snapshots run under the thread scope lock, which keeps signal
+// handlers on the same thread from interrupting a cache update.
+
+struct PathCache {
+    static const size_t StackSlots = 256;
+    static const size_t EdgeSlots  = 1024;
+
+    struct StackEntry {
+        uint64_t hash;
+        size_t   len;
+        Node*    leaf;
+    };
+
+    struct EdgeEntry {
+        Node*    parent;
+        uint64_t ip;
+        Node*    node;
+    };
+
+    StackEntry stacks[StackSlots];
+    EdgeEntry  edges[EdgeSlots];
+
+    uint64_t   num_stack_hits;
+    uint64_t   num_edge_hits;
+    uint64_t   num_misses;
+};
+
+thread_local PathCache* t_path_cache CALI_TLS_INITIAL_EXEC = nullptr;
+
+std::atomic<uint64_t> s_num_stack_hits { 0 };
+std::atomic<uint64_t> s_num_edge_hits  { 0 };
+std::atomic<uint64_t> s_num_misses     { 0 };
+
+inline uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+uint64_t hash_stack(size_t n, const uint64_t* ips)
+{
+    uint64_t h = 0xcbf29ce484222325ULL ^ n;
+
+    for (size_t i = 0; i < n; ++i)
+        h = mix(h ^ ips[i]) * 0x100000001b3ULL;
+
+    return mix(h);
+}
+
+/// Check that \a leaf is the root-attached path for \a ips
+/// (innermost frame first)
+bool is_path(const Node* leaf, size_t n, const uint64_t* ips)
+{
+    const Node* node = leaf;
+
+    for (size_t i = 0; i < n; ++i, node = node->parent())
+        if (!node || node->attribute() != callpath_addr_attr.id() || node->data().to_uint() != ips[i])
+            return false;
+
+    // the remaining node must be the tree root
+    return node && !node->parent();
+}
+
+Node* cached_path(Caliper* c, PathCache* cache, size_t n, const uint64_t* ips)
+{
+    uint64_t hash = hash_stack(n, ips);
+    PathCache::StackEntry& se = cache->stacks[hash % PathCache::StackSlots];
+
+    if (se.leaf && se.hash == hash && se.len == n && is_path(se.leaf, n, ips)) {
+        ++cache->num_stack_hits;
+        return se.leaf;
+    }
+
+    Node* node = nullptr;
+
+    // build path from top to bottom
+    for (size_t i = n; i > 0; --i) {
+        uint64_t ip = ips[i-1];
+        PathCache::EdgeEntry& ee =
+            cache->edges[mix(reinterpret_cast<uintptr_t>(node) ^ ip) % PathCache::EdgeSlots];
+
+        if (ee.node && ee.parent == node && ee.ip == ip) {
+            ++cache->num_edge_hits;
+        } else {
+            ++cache->num_misses;
+
+            ee.parent = node;
+            ee.ip     = ip;
+            ee.node   = c->make_tree_entry(callpath_addr_attr, Variant(CALI_TYPE_ADDR, &ip, sizeof(uint64_t)), node);
+        }
+
+        node = ee.node;
+
+        if (!node)
+            return nullptr;
+    }
+
+    se.hash = hash;
+    se.len  = n;
+    se.leaf = node;
+
+    return node;
+}
+
+PathCache* get_path_cache(Caliper* c)
+{
+    // don't allocate in signal handlers
+    if (!t_path_cache && use_cache && !c->is_signal())
+        t_path_cache = new PathCache();
+
+    return t_path_cache;
+}
+
+void release_path_cache()
 {
+    PathCache* cache = t_path_cache;
+
+    t_path_cache = nullptr;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+    if (!cache)
+        return;
+
+    s_num_stack_hits.fetch_add(cache->num_stack_hits);
+    s_num_edge_hits.fetch_add(cache->num_edge_hits);
+    s_num_misses.fetch_add(cache->num_misses);
+
+    delete cache;
+}
+
+/// Append the callpath.address path for the given stack (innermost
+/// frame first).
+void append_address_path(Caliper* c, size_t n, const uint64_t* ips, SnapshotRecord* snapshot)
+{
+    if (n == 0)
+        return;
+
+    PathCache* cache = get_path_cache(c);
+
+    if (cache) {
+        Node* node = cached_path(c, cache, n, ips);
+
+        if (node)
+            snapshot->append(node);
+
+        return;
+    }
+
     Variant v_addr[MAX_PATH];
-    Variant v_name[MAX_PATH];
+
+    // store path from top to bottom
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t uint = ips[i];
+        v_addr[MAX_PATH-(i+1)] = Variant(CALI_TYPE_ADDR, &uint, sizeof(uint64_t));
+    }
+
+    c->make_entrylist(callpath_addr_attr, n, v_addr+(MAX_PATH-n), *snapshot);
+}
+
+void append_addresses(Caliper* c, size_t n, const uint64_t* ips, SnapshotRecord* snapshot)
+{
+#ifdef CALIPER_HAVE_LIBDW
+    uint64_t filtered[MAX_PATH];
+    size_t   m = 0;
+
+    for (size_t i = 0; i < n; ++i)
+        if (!is_caliper_frame(ips[i]))
+            filtered[m++] = ips[i];
+
+    append_address_path(c, m, filtered, snapshot);
+#else
+    append_address_path(c, n, ips, snapshot);
+#endif
+}
+
+inline __attribute__((always_inline)) void
+libunwind_snapshot(Caliper* c, SnapshotRecord* snapshot)
+{
+    uint64_t ips[MAX_PATH];
+    Variant  v_name[MAX_PATH];
 
     char    strbuf[MAX_PATH][NAMELEN];
 
@@ -135,15 +389,14 @@ void snapshot_cb(Caliper* c, int scope, const SnapshotRecord*, SnapshotRecord* s
             continue;
 #endif
 
-        // store path from top to bottom
         if (use_addr) {
 #ifndef CALIPER_HAVE_LIBDW
             unw_word_t ip;
             unw_get_reg(&unw_cursor, UNW_REG_IP, &ip);
 #endif
-            uint64_t uint = ip;
-            v_addr[MAX_PATH-(n+1)] = Variant(CALI_TYPE_ADDR, &uint, sizeof(uint64_t));
+            ips[n] = ip;
         }
+        // store path from top to bottom
         if (use_name) {
             unw_word_t offs;
 
@@ -158,12 +411,52 @@ void snapshot_cb(Caliper* c, int scope, const SnapshotRecord*, SnapshotRecord* s
 
     if (n > 0) {
         if (use_addr)
-            c->make_entrylist(callpath_addr_attr, n, v_addr+(MAX_PATH-n), *snapshot);
+            append_address_path(c, n, ips, snapshot);
         if (use_name)
             c->make_entrylist(callpath_name_attr, n, v_name+(MAX_PATH-n), *snapshot);        
     }
 }
 
+void snapshot_cb(Caliper* c, int scope, const SnapshotRecord*, SnapshotRecord* snapshot)
+{
+    if (use_fp && use_addr) {
+        uint64_t ips[MAX_PATH];
+        size_t   n = fp_unwind(ips, MAX_PATH, skip_frames);
+
+        if (n > 0) {
+            append_addresses(c, n, ips, snapshot);
+            return;
+        }
+    }
+
+    libunwind_snapshot(c, snapshot);
+}
+
+void create_scope_cb(Caliper* c, cali_context_scope_t scope)
+{
+    // allocate the cache here so that threads that only take samples
+    // have one, too
+    if (scope == CALI_SCOPE_THREAD && use_addr)
+        get_path_cache(c);
+}
+
+void release_scope_cb(Caliper*, cali_context_scope_t scope)
+{
+    if (scope == CALI_SCOPE_THREAD)
+        release_path_cache();
+}
+
+void finish_cb(Caliper*)
+{
+    release_path_cache();
+
+    if (use_cache && use_addr)
+        Log(2).stream() << "callpath: path cache: "
+                        << s_num_stack_hits.load() << " stack hits, "
+                        << s_num_edge_hits.load()  << " frame hits, "
+                        << s_num_misses.load()     << " misses" << std::endl;
+}
+
 void initialize()
 {
 #ifdef CALIPER_HAVE_LIBDW
@@ -205,6 +498,24 @@ void callpath_service_register(Caliper* c)
     use_name    = config.get("use_name").to_bool();
     use_addr    = config.get("use_address").to_bool();
     skip_frames = config.get("skip_frames").to_uint();
+    use_cache   = config.get("path_cache").to_bool();
+
+    std::string unwinder = config.get("unwinder").to_string();
+
+    if (unwinder == "framepointer") {
+        use_fp = true;
+
+        if (use_name) {
+            Log(1).stream() << "callpath: Note: region names are not available with the framepointer unwinder.\n"
+                "    Use the symbollookup service to resolve callpath.address at flush time."
+                            << std::endl;
+            use_name = false;
+            use_addr = true;
+        }
+    } else if (unwinder != "libunwind") {
+        Log(0).stream() << "callpath: unknown unwinder \"" << unwinder
+                        << "\", using libunwind" << std::endl;
+    }
 
     Attribute symbol_class_attr = c->get_attribute("class.symboladdress");
     Variant v_true(true);
@@ -222,6 +533,10 @@ void callpath_service_register(Caliper* c)
     initialize();
 
     c->events().snapshot.connect(&snapshot_cb);
+    c->events().create_scope_evt.connect(&create_scope_cb);
+    c->events().reuse_scope_evt.connect(&create_scope_cb);
+    c->events().release_scope_evt.connect(&release_scope_cb);
+    c->events().finish_evt.connect(&finish_cb);
 
     Log(1).stream() << "Registered callpath service" << endl;
 }
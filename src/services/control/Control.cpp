@@ -0,0 +1,339 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file  Control.cpp
+/// \brief Enables and disables services and annotations at runtime
+
+#include "caliper/CaliperService.h"
+
+#include "caliper/Caliper.h"
+
+#include "caliper/common/Log.h"
+#include "caliper/common/RuntimeConfig.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cali;
+using namespace std;
+
+namespace
+{
+
+const ConfigSet::Entry configdata[] = {
+    { "file", CALI_TYPE_STRING, "",
+      "Control file",
+      "Control file with enable/disable commands. Applied at startup and\n"
+      "whenever the file changes." },
+    { "poll_interval", CALI_TYPE_UINT, "1000",
+      "Control file check interval in milliseconds",
+      "Interval in milliseconds for checking whether the control file changed.\n"
+      "0: only re-read the file on the control signal." },
+    { "signal", CALI_TYPE_STRING, "",
+      "Signal that triggers reading the control file",
+      "Re-read the control file when the process receives this signal.\n"
+      "Either USR1, USR2, or a signal number. Default: none" },
+    { "disable", CALI_TYPE_STRING, "",
+      "Services to disable at startup",
+      "List of services to disable at startup, e.g. to enable them\n"
+      "later through the control file." },
+    ConfigSet::Terminator
+};
+
+ConfigSet        config;
+
+std::string      control_file;
+unsigned         poll_interval = 1000;
+int              control_signal = 0;
+
+int              wakeup_pipe[2] = { -1, -1 };
+std::thread      control_thread;
+struct sigaction prev_sigaction;
+
+// Disabled annotation attributes that don't exist yet.
+// Applied when they are created.
+std::vector<std::string> pending_attributes;
+std::mutex               pending_lock;
+
+int parse_signal(const std::string& name) {
+    if (name.empty())
+        return 0;
+    if (name == "USR1" || name == "SIGUSR1")
+        return SIGUSR1;
+    if (name == "USR2" || name == "SIGUSR2")
+        return SIGUSR2;
+
+    int signum = std::atoi(name.c_str());
+
+    if (signum <= 0)
+        Log(0).stream() << "control: error: invalid signal \"" << name << "\"" << endl;
+
+    return std::max(signum, 0);
+}
+
+void set_attribute_enabled(Caliper* c, const std::string& name, bool enable) {
+    Attribute attr = c->get_attribute(name);
+
+    if (attr == Attribute::invalid) {
+        std::lock_guard<std::mutex>
+            g(pending_lock);
+
+        auto it = std::find(pending_attributes.begin(), pending_attributes.end(), name);
+
+        if (enable && it != pending_attributes.end())
+            pending_attributes.erase(it);
+        else if (!enable && it == pending_attributes.end())
+            pending_attributes.push_back(name);
+
+        return;
+    }
+
+    c->set_event_throttle(attr, enable ? 0 : Caliper::EventThrottleCountOnly);
+
+    Log(1).stream() << "control: " << (enable ? "enabled" : "disabled")
+                    << " annotation events for " << name << endl;
+}
+
+// Apply the commands in the control file. Lines are
+//   enable|disable <service>
+//   enable|disable attribute <attribute name>
+//   flush
+// Empty lines and lines starting with '#' are ignored.
+void apply_control_file(Caliper* c) {
+    std::ifstream is(control_file);
+
+    if (!is) {
+        Log(1).stream() << "control: cannot read " << control_file << endl;
+        return;
+    }
+
+    std::string line;
+    int         lineno = 0;
+
+    while (std::getline(is, line)) {
+        ++lineno;
+
+        std::istringstream ls(line);
+        std::string        cmd, arg;
+
+        ls >> cmd >> arg;
+
+        if (cmd.empty() || cmd[0] == '#')
+            continue;
+
+        if (cmd == "flush") {
+            c->flush_and_write(nullptr);
+        } else if ((cmd == "enable" || cmd == "disable") && !arg.empty()) {
+            if (arg == "attribute") {
+                std::string name;
+
+                if (ls >> name)
+                    set_attribute_enabled(c, name, cmd == "enable");
+                else
+                    Log(0).stream() << "control: " << control_file << ":" << lineno
+                                    << ": attribute name missing" << endl;
+            } else {
+                c->set_service_enabled(arg, cmd == "enable");
+            }
+        } else {
+            Log(0).stream() << "control: " << control_file << ":" << lineno
+                            << ": invalid command \"" << line << "\"" << endl;
+        }
+    }
+}
+
+void on_control_signal(int) {
+    char b = 0;
+
+    if (write(wakeup_pipe[1], &b, 1) < 0) {
+        // nothing we can do in a signal handler; the poll timeout still applies
+    }
+}
+
+// Check the control file for changes every poll_interval ms, or when
+// woken up by the control signal. The loop ends when the write end of
+// the pipe is closed.
+void control_loop() {
+    Caliper c;
+
+    struct pollfd pfd;
+
+    pfd.fd     = wakeup_pipe[0];
+    pfd.events = POLLIN;
+
+    struct stat last;
+
+    if (stat(control_file.c_str(), &last) != 0)
+        memset(&last, 0, sizeof(last));
+
+    while (true) {
+        int ret = poll(&pfd, 1, poll_interval > 0 ? static_cast<int>(poll_interval) : -1);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+
+        bool signaled = false;
+
+        if (ret > 0) {
+            char b;
+
+            if (read(wakeup_pipe[0], &b, 1) <= 0)
+                break;
+
+            signaled = true;
+        }
+
+        struct stat st;
+
+        if (stat(control_file.c_str(), &st) != 0)
+            continue;
+
+        if (signaled || st.st_mtime != last.st_mtime || st.st_size != last.st_size
+#ifdef __linux__
+            || st.st_mtim.tv_nsec != last.st_mtim.tv_nsec
+#endif
+            ) {
+            last = st;
+            apply_control_file(&c);
+        }
+    }
+}
+
+void start_control_thread() {
+    if (pipe(wakeup_pipe) != 0) {
+        Log(0).stream() << "control: error: unable to create pipe" << endl;
+        return;
+    }
+
+    fcntl(wakeup_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(wakeup_pipe[1], F_SETFD, FD_CLOEXEC);
+
+    control_thread = std::thread(control_loop);
+
+    if (control_signal > 0) {
+        struct sigaction act;
+
+        memset(&act, 0, sizeof(act));
+        sigemptyset(&act.sa_mask);
+        act.sa_handler = on_control_signal;
+        act.sa_flags   = SA_RESTART;
+
+        sigaction(control_signal, &act, &prev_sigaction);
+    }
+}
+
+void stop_control_thread() {
+    if (wakeup_pipe[1] < 0)
+        return;
+
+    if (control_signal > 0)
+        sigaction(control_signal, &prev_sigaction, NULL);
+
+    close(wakeup_pipe[1]);
+    wakeup_pipe[1] = -1;
+
+    if (control_thread.joinable())
+        control_thread.join();
+
+    close(wakeup_pipe[0]);
+    wakeup_pipe[0] = -1;
+}
+
+void create_attr_cb(Caliper* c, const Attribute& attr) {
+    bool disable = false;
+
+    {
+        std::lock_guard<std::mutex>
+            g(pending_lock);
+
+        auto it = std::find(pending_attributes.begin(), pending_attributes.end(), attr.name());
+
+        if (it != pending_attributes.end()) {
+            pending_attributes.erase(it);
+            disable = true;
+        }
+    }
+
+    if (disable)
+        set_attribute_enabled(c, attr.name(), false);
+}
+
+void post_init_cb(Caliper* c) {
+    // Nothing to write out yet
+    for (const std::string& service : config.get("disable").to_stringlist(",:"))
+        c->set_service_enabled(service, false, false);
+
+    if (!control_file.empty()) {
+        apply_control_file(c);
+        start_control_thread();
+    }
+}
+
+void finish_cb(Caliper*) {
+    stop_control_thread();
+}
+
+void control_register(Caliper* c)
+{
+    config = RuntimeConfig::init("control", configdata);
+
+    control_file   = config.get("file").to_string();
+    poll_interval  = config.get("poll_interval").to_uint();
+    control_signal = parse_signal(config.get("signal").to_string());
+
+    c->events().create_attr_evt.connect(&create_attr_cb);
+    c->events().post_init_evt.connect(&post_init_cb);
+    c->events().finish_evt.connect(&finish_cb);
+
+    Log(1).stream() << "Registered control service" << std::endl;
+}
+
+} // namespace
+
+namespace cali
+{
+    CaliperService control_service = { "control", ::control_register };
+}
@@ -0,0 +1,443 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// CudaEvent.cpp
+// Asynchronous GPU region timing with CUDA events
+
+#include "caliper/CaliperService.h"
+
+#include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/Log.h"
+#include "caliper/common/Node.h"
+#include "caliper/common/RuntimeConfig.h"
+
+#include <cuda_runtime_api.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+const ConfigSet::Entry s_configdata[] = {
+    { "stream", CALI_TYPE_STRING, "default",
+      "CUDA stream to record region events on",
+      "CUDA stream to record region begin/end events on. Possible values:\n"
+      "  default    :  The legacy default stream\n"
+      "  per-thread :  The calling thread's per-thread default stream"
+    },
+    { "pool_size", CALI_TYPE_UINT, "256",
+      "Number of CUDA events to create up front",
+      "Number of CUDA events to create up front. The pool grows as needed."
+    },
+    { "poll_interval", CALI_TYPE_UINT, "10",
+      "Interval in milliseconds for resolving completed events",
+      "Interval in milliseconds at which the background thread resolves\n"
+      "the elapsed times of completed event pairs"
+    },
+    ConfigSet::Terminator
+};
+
+/// An open region on a host thread
+struct OpenRegion {
+    cali_id_t   attr_id;
+    cudaEvent_t start;
+};
+
+/// A region whose end event may not have completed on the device yet
+struct PendingRegion {
+    Node*       node;
+    int         device;
+    cudaEvent_t start;
+    cudaEvent_t stop;
+};
+
+struct RegionTime {
+    uint64_t    duration;
+    uint64_t    count;
+};
+
+ConfigSet           config;
+
+Attribute           gpu_duration_attr;
+Attribute           gpu_count_attr;
+
+cudaStream_t        record_stream = 0;
+unsigned            poll_interval = 10;
+
+std::vector<cudaEvent_t>           event_pool;
+std::mutex                         event_pool_lock;
+
+std::vector<PendingRegion>         pending;
+std::mutex                         pending_lock;
+
+// Accumulated device time per region context node
+std::unordered_map<Node*, RegionTime> region_times;
+std::mutex                         region_times_lock;
+
+std::thread                        resolver_thread;
+std::mutex                         resolver_lock;
+std::condition_variable            resolver_cv;
+bool                               resolver_stop = false;
+
+thread_local std::vector<OpenRegion> t_open_regions;
+
+unsigned num_events_created = 0;
+unsigned num_regions        = 0;
+unsigned num_failed         = 0;
+
+
+cudaEvent_t
+get_event()
+{
+    {
+        std::lock_guard<std::mutex>
+            g(event_pool_lock);
+
+        if (!event_pool.empty()) {
+            cudaEvent_t event = event_pool.back();
+            event_pool.pop_back();
+            return event;
+        }
+    }
+
+    cudaEvent_t event = nullptr;
+
+    if (cudaEventCreate(&event) != cudaSuccess)
+        return nullptr;
+
+    ++num_events_created;
+
+    return event;
+}
+
+void
+release_events(size_t n, const cudaEvent_t* events)
+{
+    std::lock_guard<std::mutex>
+        g(event_pool_lock);
+
+    event_pool.insert(event_pool.end(), events, events + n);
+}
+
+/// Compute elapsed times of the pending regions whose events have
+/// completed. With \a wait, wait for all outstanding events.
+void
+resolve_pending(bool wait)
+{
+    std::vector<PendingRegion> regions;
+
+    {
+        std::lock_guard<std::mutex>
+            g(pending_lock);
+
+        regions.swap(pending);
+    }
+
+    if (regions.empty())
+        return;
+
+    std::vector<PendingRegion> not_ready;
+    std::vector<cudaEvent_t>   done;
+    std::vector< std::pair<Node*, uint64_t> > times;
+
+    int device = -1;
+
+    for (const PendingRegion& r : regions) {
+        if (r.device != device) {
+            cudaSetDevice(r.device);
+            device = r.device;
+        }
+
+        cudaError_t err = wait ? cudaEventSynchronize(r.stop) : cudaEventQuery(r.stop);
+
+        if (err == cudaErrorNotReady) {
+            not_ready.push_back(r);
+            continue;
+        }
+
+        float ms = 0.0;
+
+        if (err == cudaSuccess && cudaEventElapsedTime(&ms, r.start, r.stop) == cudaSuccess)
+            times.push_back(std::make_pair(r.node, static_cast<uint64_t>(ms * 1e6)));
+        else
+            ++num_failed;
+
+        done.push_back(r.start);
+        done.push_back(r.stop);
+    }
+
+    release_events(done.size(), done.data());
+
+    if (!not_ready.empty()) {
+        std::lock_guard<std::mutex>
+            g(pending_lock);
+
+        pending.insert(pending.end(), not_ready.begin(), not_ready.end());
+    }
+
+    std::lock_guard<std::mutex>
+        g(region_times_lock);
+
+    for (const auto &p : times) {
+        RegionTime& t = region_times[p.first];
+
+        t.duration += p.second;
+        ++t.count;
+    }
+}
+
+void
+resolver_loop()
+{
+    std::unique_lock<std::mutex>
+        lk(resolver_lock);
+
+    while (!resolver_stop) {
+        resolver_cv.wait_for(lk, std::chrono::milliseconds(poll_interval));
+
+        if (resolver_stop)
+            break;
+
+        lk.unlock();
+        resolve_pending(false);
+        lk.lock();
+    }
+}
+
+void
+begin_cb(Caliper* c, const Attribute& attr, const Variant&)
+{
+    if (attr.store_as_value())
+        return;
+
+    cudaEvent_t event = get_event();
+
+    if (!event || cudaEventRecord(event, record_stream) != cudaSuccess) {
+        ++num_failed;
+
+        if (event)
+            release_events(1, &event);
+
+        // keep the stack in sync with the region nesting
+        event = nullptr;
+    }
+
+    t_open_regions.push_back(OpenRegion { attr.id(), event });
+}
+
+void
+end_cb(Caliper* c, const Attribute& attr, const Variant&)
+{
+    if (attr.store_as_value())
+        return;
+
+    auto rit = t_open_regions.rbegin();
+
+    for ( ; rit != t_open_regions.rend() && rit->attr_id != attr.id(); ++rit)
+        ;
+
+    if (rit == t_open_regions.rend())
+        return;
+
+    cudaEvent_t start = rit->start;
+
+    t_open_regions.erase(std::next(rit).base());
+
+    if (!start)
+        return;
+
+    // Still before the end update, so this is the region's context node
+    Entry e = c->get(attr);
+
+    cudaEvent_t stop   = get_event();
+    int         device = 0;
+
+    if (!e.node() || !stop ||
+        cudaGetDevice(&device) != cudaSuccess ||
+        cudaEventRecord(stop, record_stream) != cudaSuccess) {
+        ++num_failed;
+
+        release_events(1, &start);
+        if (stop)
+            release_events(1, &stop);
+
+        return;
+    }
+
+    std::lock_guard<std::mutex>
+        g(pending_lock);
+
+    pending.push_back(PendingRegion { const_cast<Node*>(e.node()), device, start, stop });
+    ++num_regions;
+}
+
+void
+flush_cb(Caliper* c, const SnapshotRecord*, Caliper::SnapshotFlushFn proc_fn)
+{
+    resolve_pending(true);
+
+    std::unordered_map<Node*, RegionTime> times;
+
+    {
+        std::lock_guard<std::mutex>
+            g(region_times_lock);
+
+        times = region_times;
+    }
+
+    cali_id_t attr[2] = { gpu_duration_attr.id(), gpu_count_attr.id() };
+
+    for (const auto &p : times) {
+        Node*   node    = p.first;
+        Variant data[2] = { Variant(p.second.duration), Variant(p.second.count) };
+
+        SnapshotRecord rec(1, &node, 2, attr, data);
+
+        proc_fn(&rec);
+    }
+
+    Log(1).stream() << "cudaevent: Wrote " << times.size() << " records." << std::endl;
+}
+
+void
+clear_cb(Caliper*)
+{
+    std::lock_guard<std::mutex>
+        g(region_times_lock);
+
+    region_times.clear();
+}
+
+void
+post_init_cb(Caliper* c)
+{
+    unsigned pool_size = config.get("pool_size").to_uint();
+
+    for (unsigned i = 0; i < pool_size; ++i) {
+        cudaEvent_t event;
+
+        if (cudaEventCreate(&event) != cudaSuccess) {
+            Log(0).stream() << "cudaevent: cudaEventCreate failed" << std::endl;
+            break;
+        }
+
+        event_pool.push_back(event);
+        ++num_events_created;
+    }
+
+    resolver_thread = std::thread(resolver_loop);
+}
+
+void
+finish_cb(Caliper* c)
+{
+    {
+        std::lock_guard<std::mutex>
+            g(resolver_lock);
+
+        resolver_stop = true;
+    }
+
+    resolver_cv.notify_all();
+
+    if (resolver_thread.joinable())
+        resolver_thread.join();
+
+    Log(1).stream() << "cudaevent: Timed " << num_regions << " regions, "
+                    << num_failed << " failed, "
+                    << num_events_created << " CUDA events created." << std::endl;
+
+    // The CUDA runtime may already be shutting down at this point,
+    // so don't check for errors
+    for (cudaEvent_t event : event_pool)
+        cudaEventDestroy(event);
+
+    event_pool.clear();
+}
+
+void
+cudaevent_register(Caliper* c)
+{
+    config = RuntimeConfig::init("cudaevent", s_configdata);
+
+    std::string stream = config.get("stream").to_string();
+
+    if (stream == "per-thread")
+        record_stream = cudaStreamPerThread;
+    else if (stream == "default")
+        record_stream = 0;
+    else
+        Log(0).stream() << "cudaevent: Unknown stream \"" << stream
+                        << "\", using the default stream" << std::endl;
+
+    poll_interval = std::max<unsigned>(config.get("poll_interval").to_uint(), 1);
+
+    Attribute aggr_class_attr = c->get_attribute("class.aggregatable");
+    Variant   v_true(true);
+
+    gpu_duration_attr =
+        c->create_attribute("gpu.duration", CALI_TYPE_UINT,
+                            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+                            1, &aggr_class_attr, &v_true);
+    gpu_count_attr =
+        c->create_attribute("gpu.count",    CALI_TYPE_UINT,
+                            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+                            1, &aggr_class_attr, &v_true);
+
+    c->events().post_begin_evt.connect(&begin_cb);
+    c->events().pre_end_evt.connect(&end_cb);
+    c->events().flush_evt.connect(&flush_cb);
+    c->events().clear_evt.connect(&clear_cb);
+    c->events().post_init_evt.connect(&post_init_cb);
+    c->events().finish_evt.connect(&finish_cb);
+
+    Log(1).stream() << "Registered cudaevent service" << std::endl;
+}
+
+} // namespace
+
+namespace cali
+{
+    CaliperService cudaevent_service = { "cudaevent", ::cudaevent_register };
+}
@@ -33,6 +33,7 @@
 // Cupti.cpp
 // Implementation of Cupti service
 
+#include "CuptiActivity.h"
 #include "CuptiEventSampling.h"
 
 #include "caliper/CaliperService.h"
@@ -91,10 +92,41 @@ namespace
           "CUpti event ID to sample",
           "CUpti event ID to sample"
         },
+        { "activity_tracing", CALI_TYPE_BOOL, "false",
+          "Record GPU kernel and memory activities with the CUpti activity API",
+          "Record GPU kernel, memcpy, and memset activities with the CUpti activity API.\n"
+          "Activity records are buffered asynchronously and written at flush time."
+        },
+        { "activity_buffer_size", CALI_TYPE_UINT, "1048576",
+          "Size of CUpti activity buffers in bytes",
+          "Size of CUpti activity buffers in bytes"
+        },
+        { "pc_sampling", CALI_TYPE_BOOL, "false",
+          "Sample GPU program counters with the CUpti activity API",
+          "Sample GPU program counters and warp stall reasons with the CUpti activity API.\n"
+          "Implies activity_tracing. Samples are buffered on the device and written at flush time."
+        },
+        { "pc_sampling_period", CALI_TYPE_STRING, "mid",
+          "PC sampling period",
+          "PC sampling period. Possible values:\n"
+          "  min, low, mid, high, max"
+        },
 
         ConfigSet::Terminator
     };
 
+    const struct PCSamplingPeriodInfo {
+        CUpti_ActivityPCSamplingPeriod period;
+        const char* name;
+    } pc_sampling_periods[] = {
+        { CUPTI_ACTIVITY_PC_SAMPLING_PERIOD_MIN,  "min"  },
+        { CUPTI_ACTIVITY_PC_SAMPLING_PERIOD_LOW,  "low"  },
+        { CUPTI_ACTIVITY_PC_SAMPLING_PERIOD_MID,  "mid"  },
+        { CUPTI_ACTIVITY_PC_SAMPLING_PERIOD_HIGH, "high" },
+        { CUPTI_ACTIVITY_PC_SAMPLING_PERIOD_MAX,  "max"  },
+        { CUPTI_ACTIVITY_PC_SAMPLING_PERIOD_INVALID, 0   }
+    };
+
     const struct CallbackDomainInfo {
         CUpti_CallbackDomain domain;
         const char* name;
@@ -133,6 +165,7 @@ namespace
     unsigned               num_nvtx_cb;
 
     Cupti::EventSampling   event_sampling;
+    Cupti::ActivityTracing activity_tracing;
     
     //
     // --- Helper functions
@@ -221,6 +254,8 @@ namespace
         case CUPTI_CBID_RESOURCE_CONTEXT_CREATED:
             if (event_sampling.is_enabled())
                 event_sampling.enable_sampling_for_context(cbInfo->context);
+            if (activity_tracing.is_pc_sampling_enabled())
+                activity_tracing.configure_context(cbInfo->context);
             
             handle_context_event(cbInfo->context,
                                  cupti_info.resource_attr,
@@ -393,6 +428,24 @@ namespace
     {
         event_sampling.snapshot(c, trigger_info, snapshot);
     }
+
+    void
+    activity_update_cb(Caliper* c, const Attribute& attr, const Variant&)
+    {
+        activity_tracing.update_context(c, attr);
+    }
+
+    void
+    activity_flush_cb(Caliper* c, const SnapshotRecord*, Caliper::SnapshotFlushFn proc_fn)
+    {
+        activity_tracing.flush(c, proc_fn);
+    }
+
+    void
+    activity_clear_cb(Caliper*)
+    {
+        activity_tracing.clear();
+    }
     
     void
     finish_cb(Caliper* c)
@@ -411,6 +464,13 @@ namespace
         }
         
         event_sampling.stop_all();
+
+        if (activity_tracing.is_enabled()) {
+            activity_tracing.stop();
+
+            if (Log::verbosity() >= 2)
+                activity_tracing.print_statistics(Log(2).stream());
+        }
         
         cuptiUnsubscribe(subscriber);
         cuptiFinalize();
@@ -443,6 +503,35 @@ namespace
             c->create_attribute("cupti.deviceID",   CALI_TYPE_UINT,   CALI_ATTR_SKIP_EVENTS);
         cupti_info.stream_attr =
             c->create_attribute("cupti.streamID",   CALI_TYPE_UINT,   CALI_ATTR_SKIP_EVENTS);
+
+        int pc_sampling_period = 0;
+
+        if (config.get("pc_sampling").to_bool()) {
+            std::string name = config.get("pc_sampling_period").to_string();
+            const PCSamplingPeriodInfo* info = pc_sampling_periods;
+
+            for ( ; info->name && name != info->name; ++info)
+                ;
+
+            if (info->name) {
+                pc_sampling_period = static_cast<int>(info->period);
+            } else {
+                Log(0).stream() << "cupti: warning: Unknown PC sampling period \""
+                                << name << "\", using \"mid\"" << std::endl;
+                pc_sampling_period =
+                    static_cast<int>(CUPTI_ACTIVITY_PC_SAMPLING_PERIOD_MID);
+            }
+        }
+
+        if (config.get("activity_tracing").to_bool() || pc_sampling_period > 0) {
+            if (activity_tracing.setup(c, config.get("activity_buffer_size").to_uint(), pc_sampling_period)) {
+                c->events().post_begin_evt.connect(&activity_update_cb);
+                c->events().post_set_evt.connect(&activity_update_cb);
+                c->events().post_end_evt.connect(&activity_update_cb);
+                c->events().flush_evt.connect(&activity_flush_cb);
+                c->events().clear_evt.connect(&activity_clear_cb);
+            }
+        }
     }
 
     bool
@@ -461,11 +550,11 @@ namespace
         std::vector<std::string> cb_domain_names =
             config.get("callback_domains").to_stringlist(",:");
 
-        // add "resource" domain when event sampling is enabled 
-        if (event_sampling.is_enabled() &&
+        // add "resource" domain when event or PC sampling is enabled
+        if ((event_sampling.is_enabled() || config.get("pc_sampling").to_bool()) &&
             std::find(cb_domain_names.begin(), cb_domain_names.end(),
                       "resource") == cb_domain_names.end()) {
-            Log(1).stream() << "cupti: Event sampling requires resource callbacks, "
+            Log(1).stream() << "cupti: Event and PC sampling require resource callbacks, "
                 "adding \"resource\" callback domain."
                             << std::endl;
 
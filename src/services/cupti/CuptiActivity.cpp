@@ -0,0 +1,613 @@
+// Copyright (c) 2018, Lawrence Livermore National Security, LLC.
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// CuptiActivity.cpp
+// Implementation of buffer-based CUpti activity tracing
+
+#include "CuptiActivity.h"
+
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/Log.h"
+#include "caliper/common/Node.h"
+
+#include <cuda_runtime_api.h>
+
+#include <cstdlib>
+#include <cstring>
+
+using namespace cali;
+using namespace cali::Cupti;
+
+namespace
+{
+
+void
+print_cupti_error(std::ostream& os, CUptiResult err, const char* func)
+{
+    const char* errstr;
+
+    cuptiGetResultString(err, &errstr);
+
+    os << "cupti: " << func << ": error: " << errstr << std::endl;
+}
+
+#define CHECK_CUPTI_ERR(err, cufunc)                        \
+    if (err != CUPTI_SUCCESS) {                             \
+        ::print_cupti_error(Log(0).stream(), err, cufunc);  \
+        return false;                                       \
+    }
+
+#if CUDART_VERSION >= 9000
+typedef CUpti_ActivityKernel4 ActivityKernel;
+typedef CUpti_ActivityPCSampling3 ActivityPCSampling;
+#else
+typedef CUpti_ActivityKernel3 ActivityKernel;
+typedef CUpti_ActivityPCSampling2 ActivityPCSampling;
+#endif
+
+const CUpti_ActivityKind s_activity_kinds[] = {
+    CUPTI_ACTIVITY_KIND_EXTERNAL_CORRELATION,
+    CUPTI_ACTIVITY_KIND_CONCURRENT_KERNEL,
+    CUPTI_ACTIVITY_KIND_MEMCPY,
+    CUPTI_ACTIVITY_KIND_MEMSET
+};
+
+const CUpti_ActivityKind s_pc_sampling_kinds[] = {
+    CUPTI_ACTIVITY_KIND_FUNCTION,
+    CUPTI_ACTIVITY_KIND_PC_SAMPLING,
+    CUPTI_ACTIVITY_KIND_PC_SAMPLING_RECORD_INFO
+};
+
+const char*
+memcpy_kind_string(uint8_t kind)
+{
+    switch (kind) {
+    case CUPTI_ACTIVITY_MEMCPY_KIND_HTOD:
+        return "memcpy.HtoD";
+    case CUPTI_ACTIVITY_MEMCPY_KIND_DTOH:
+        return "memcpy.DtoH";
+    case CUPTI_ACTIVITY_MEMCPY_KIND_DTOD:
+        return "memcpy.DtoD";
+    case CUPTI_ACTIVITY_MEMCPY_KIND_PTOP:
+        return "memcpy.PtoP";
+    default:
+        ;
+    }
+
+    return "memcpy";
+}
+
+const char*
+stall_reason_string(CUpti_ActivityPCSamplingStallReason reason)
+{
+    switch (reason) {
+    case CUPTI_ACTIVITY_PC_SAMPLING_STALL_NONE:
+        return "none";
+    case CUPTI_ACTIVITY_PC_SAMPLING_STALL_INST_FETCH:
+        return "inst_fetch";
+    case CUPTI_ACTIVITY_PC_SAMPLING_STALL_EXEC_DEPENDENCY:
+        return "exec_dependency";
+    case CUPTI_ACTIVITY_PC_SAMPLING_STALL_MEMORY_DEPENDENCY:
+        return "memory_dependency";
+    case CUPTI_ACTIVITY_PC_SAMPLING_STALL_TEXTURE:
+        return "texture";
+    case CUPTI_ACTIVITY_PC_SAMPLING_STALL_SYNC:
+        return "sync";
+    case CUPTI_ACTIVITY_PC_SAMPLING_STALL_CONSTANT_MEMORY_DEPENDENCY:
+        return "constant_memory_dependency";
+    case CUPTI_ACTIVITY_PC_SAMPLING_STALL_PIPE_BUSY:
+        return "pipe_busy";
+    case CUPTI_ACTIVITY_PC_SAMPLING_STALL_MEMORY_THROTTLE:
+        return "memory_throttle";
+    case CUPTI_ACTIVITY_PC_SAMPLING_STALL_NOT_SELECTED:
+        return "not_selected";
+    case CUPTI_ACTIVITY_PC_SAMPLING_STALL_OTHER:
+        return "other";
+    case CUPTI_ACTIVITY_PC_SAMPLING_STALL_SLEEPING:
+        return "sleeping";
+    default:
+        ;
+    }
+
+    return "unknown";
+}
+
+// Whether this thread has pushed an external correlation ID
+thread_local bool t_have_external_id = false;
+
+} // namespace
+
+
+ActivityTracing* ActivityTracing::s_instance = nullptr;
+
+
+void CUPTIAPI
+ActivityTracing::buffer_requested(uint8_t** buffer, size_t* size, size_t* max_num_records)
+{
+    ActivityTracing* self = s_instance;
+
+    *buffer          = nullptr;
+    *size            = 0;
+    *max_num_records = 0;
+
+    if (!self)
+        return;
+
+    {
+        std::lock_guard<std::mutex>
+            g(self->m_buffer_mtx);
+
+        if (!self->m_free_buffers.empty()) {
+            *buffer = self->m_free_buffers.back();
+            self->m_free_buffers.pop_back();
+        }
+    }
+
+    if (!*buffer) {
+        // malloc memory is sufficiently aligned for CUpti's 8-byte requirement
+        *buffer = static_cast<uint8_t*>(malloc(self->m_buffer_size));
+        ++self->m_num_buffers;
+    }
+
+    if (*buffer)
+        *size = self->m_buffer_size;
+}
+
+void CUPTIAPI
+ActivityTracing::buffer_completed(CUcontext ctx, uint32_t stream_id, uint8_t* buffer, size_t, size_t valid_size)
+{
+    ActivityTracing* self = s_instance;
+
+    if (!self || !buffer)
+        return;
+
+    size_t dropped = 0;
+
+    if (cuptiActivityGetNumDroppedRecords(ctx, stream_id, &dropped) == CUPTI_SUCCESS)
+        self->m_num_dropped += dropped;
+
+    std::lock_guard<std::mutex>
+        g(self->m_buffer_mtx);
+
+    if (valid_size > 0)
+        self->m_completed_buffers.push_back(std::make_pair(buffer, valid_size));
+    else
+        self->m_free_buffers.push_back(buffer);
+}
+
+bool
+ActivityTracing::setup(Caliper* c, size_t buffer_size, int pc_sampling_period)
+{
+    Attribute aggr_class_attr = c->get_attribute("class.aggregatable");
+    Variant   v_true(true);
+
+    m_kind_attr     =
+        c->create_attribute("cupti.activity.kind",     CALI_TYPE_STRING,
+                            CALI_ATTR_SKIP_EVENTS);
+    m_name_attr     =
+        c->create_attribute("cupti.kernel.name",       CALI_TYPE_STRING,
+                            CALI_ATTR_SKIP_EVENTS);
+    m_start_attr    =
+        c->create_attribute("cupti.activity.start",    CALI_TYPE_UINT,
+                            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS);
+    m_duration_attr =
+        c->create_attribute("cupti.activity.duration", CALI_TYPE_UINT,
+                            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+                            1, &aggr_class_attr, &v_true);
+    m_bytes_attr    =
+        c->create_attribute("cupti.activity.bytes",    CALI_TYPE_UINT,
+                            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+                            1, &aggr_class_attr, &v_true);
+    m_device_attr   =
+        c->create_attribute("cupti.activity.device",   CALI_TYPE_UINT,
+                            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS);
+    m_stream_attr   =
+        c->create_attribute("cupti.activity.stream",   CALI_TYPE_UINT,
+                            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS);
+
+    if (pc_sampling_period > 0) {
+        m_pc_offset_attr  =
+            c->create_attribute("cupti.pc.offset",       CALI_TYPE_UINT,
+                                CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS);
+        m_pc_samples_attr =
+            c->create_attribute("cupti.pc.samples",      CALI_TYPE_UINT,
+                                CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+                                1, &aggr_class_attr, &v_true);
+        m_pc_stall_attr   =
+            c->create_attribute("cupti.pc.stall_reason", CALI_TYPE_STRING,
+                                CALI_ATTR_SKIP_EVENTS);
+    }
+
+    m_buffer_size = buffer_size;
+    s_instance    = this;
+
+    CUptiResult res =
+        cuptiActivityRegisterCallbacks(buffer_requested, buffer_completed);
+    CHECK_CUPTI_ERR(res, "cuptiActivityRegisterCallbacks");
+
+    for (CUpti_ActivityKind kind : s_activity_kinds) {
+        res = cuptiActivityEnable(kind);
+        CHECK_CUPTI_ERR(res, "cuptiActivityEnable");
+    }
+
+    m_enabled = true;
+
+    Log(1).stream() << "cupti: Activity tracing enabled" << std::endl;
+
+    if (pc_sampling_period > 0) {
+        // Function records provide the names for the PC samples' function IDs.
+        // Keep activity tracing going if PC sampling isn't supported.
+
+        bool ok = true;
+
+        for (CUpti_ActivityKind kind : s_pc_sampling_kinds) {
+            res = cuptiActivityEnable(kind);
+
+            if (res != CUPTI_SUCCESS) {
+                ::print_cupti_error(Log(0).stream(), res, "cuptiActivityEnable");
+                ok = false;
+                break;
+            }
+        }
+
+        if (ok) {
+            m_pc_sampling_period = pc_sampling_period;
+            m_pc_sampling        = true;
+
+            Log(1).stream() << "cupti: PC sampling enabled" << std::endl;
+        } else {
+            for (CUpti_ActivityKind kind : s_pc_sampling_kinds)
+                cuptiActivityDisable(kind);
+        }
+    }
+
+    return true;
+}
+
+bool
+ActivityTracing::configure_context(CUcontext context)
+{
+    if (!m_pc_sampling)
+        return false;
+
+    CUpti_ActivityPCSamplingConfig pc_config;
+
+    memset(&pc_config, 0, sizeof(pc_config));
+
+    pc_config.size           = sizeof(pc_config);
+    pc_config.samplingPeriod =
+        static_cast<CUpti_ActivityPCSamplingPeriod>(m_pc_sampling_period);
+
+    CUptiResult res = cuptiActivityConfigurePCSampling(context, &pc_config);
+    CHECK_CUPTI_ERR(res, "cuptiActivityConfigurePCSampling");
+
+    return true;
+}
+
+void
+ActivityTracing::update_context(Caliper* c, const Attribute& attr)
+{
+    if (attr.store_as_value())
+        return;
+
+    Entry    e  = c->get(attr);
+    uint64_t id = e.node() ? e.node()->id() : 0;
+
+    if (t_have_external_id) {
+        uint64_t last = 0;
+
+        cuptiActivityPopExternalCorrelationId(CUPTI_EXTERNAL_CORRELATION_KIND_CUSTOM0, &last);
+        t_have_external_id = false;
+    }
+
+    if (id == 0 || id == CALI_INV_ID)
+        return;
+
+    if (cuptiActivityPushExternalCorrelationId(CUPTI_EXTERNAL_CORRELATION_KIND_CUSTOM0, id) == CUPTI_SUCCESS)
+        t_have_external_id = true;
+}
+
+bool
+ActivityTracing::process_record(Caliper* c, const CUpti_Activity* rec, Caliper::SnapshotFlushFn proc_fn)
+{
+    const char* kind     = nullptr;
+    const char* name     = nullptr;
+    uint32_t    corr_id  = 0;
+    uint64_t    start    = 0;
+    uint64_t    end      = 0;
+    uint64_t    bytes    = 0;
+    uint32_t    device   = 0;
+    uint32_t    stream   = 0;
+
+    switch (rec->kind) {
+    case CUPTI_ACTIVITY_KIND_KERNEL:
+    case CUPTI_ACTIVITY_KIND_CONCURRENT_KERNEL:
+    {
+        const ActivityKernel* krec = reinterpret_cast<const ActivityKernel*>(rec);
+
+        kind    = "kernel";
+        name    = krec->name;
+        corr_id = krec->correlationId;
+        start   = krec->start;
+        end     = krec->end;
+        device  = krec->deviceId;
+        stream  = krec->streamId;
+    }
+    break;
+    case CUPTI_ACTIVITY_KIND_MEMCPY:
+    {
+        const CUpti_ActivityMemcpy* mrec = reinterpret_cast<const CUpti_ActivityMemcpy*>(rec);
+
+        kind    = memcpy_kind_string(mrec->copyKind);
+        corr_id = mrec->correlationId;
+        start   = mrec->start;
+        end     = mrec->end;
+        bytes   = mrec->bytes;
+        device  = mrec->deviceId;
+        stream  = mrec->streamId;
+    }
+    break;
+    case CUPTI_ACTIVITY_KIND_MEMSET:
+    {
+        const CUpti_ActivityMemset* mrec = reinterpret_cast<const CUpti_ActivityMemset*>(rec);
+
+        kind    = "memset";
+        corr_id = mrec->correlationId;
+        start   = mrec->start;
+        end     = mrec->end;
+        bytes   = mrec->bytes;
+        device  = mrec->deviceId;
+        stream  = mrec->streamId;
+    }
+    break;
+    case CUPTI_ACTIVITY_KIND_PC_SAMPLING:
+        return process_pc_sample(c, rec, proc_fn);
+    default:
+        return false;
+    }
+
+    // Find host context node through the external correlation ID.
+    // PC samples of a kernel share its correlation ID, so the entry is
+    // removed only at the end of the flush.
+
+    Node* node = nullptr;
+    auto  it   = m_correlation_map.find(corr_id);
+
+    if (it != m_correlation_map.end()) {
+        node = c->node(it->second);
+        m_used_correlations.push_back(corr_id);
+    }
+
+    node = c->make_tree_entry(m_kind_attr, Variant(CALI_TYPE_STRING, kind, strlen(kind)), node);
+
+    if (name)
+        node = c->make_tree_entry(m_name_attr, Variant(CALI_TYPE_STRING, name, strlen(name)), node);
+
+    cali_id_t attr[5] = {
+        m_start_attr.id(), m_duration_attr.id(), m_device_attr.id(), m_stream_attr.id(), m_bytes_attr.id()
+    };
+    Variant   data[5] = {
+        Variant(start),
+        Variant(end > start ? end - start : static_cast<uint64_t>(0)),
+        Variant(static_cast<uint64_t>(device)),
+        Variant(static_cast<uint64_t>(stream)),
+        Variant(bytes)
+    };
+
+    SnapshotRecord snapshot(1, &node, bytes > 0 ? 5 : 4, attr, data);
+
+    proc_fn(&snapshot);
+
+    return true;
+}
+
+bool
+ActivityTracing::process_pc_sample(Caliper* c, const CUpti_Activity* activity, Caliper::SnapshotFlushFn proc_fn)
+{
+    const ActivityPCSampling* rec = reinterpret_cast<const ActivityPCSampling*>(activity);
+
+    Node* node = nullptr;
+    auto  it   = m_correlation_map.find(rec->correlationId);
+
+    if (it != m_correlation_map.end())
+        node = c->node(it->second);
+
+    node = c->make_tree_entry(m_kind_attr, Variant(CALI_TYPE_STRING, "pc_sample", 9), node);
+
+    auto fit = m_function_names.find(rec->functionId);
+
+    if (fit != m_function_names.end())
+        node = c->make_tree_entry(m_name_attr,
+                                  Variant(CALI_TYPE_STRING, fit->second.c_str(), fit->second.size()),
+                                  node);
+
+    const char* stall = stall_reason_string(rec->stallReason);
+
+    node = c->make_tree_entry(m_pc_stall_attr, Variant(CALI_TYPE_STRING, stall, strlen(stall)), node);
+
+    cali_id_t attr[2] = { m_pc_offset_attr.id(), m_pc_samples_attr.id() };
+    Variant   data[2] = {
+        Variant(static_cast<uint64_t>(rec->pcOffset)),
+        Variant(static_cast<uint64_t>(rec->samples))
+    };
+
+    SnapshotRecord snapshot(1, &node, 2, attr, data);
+
+    proc_fn(&snapshot);
+
+    m_num_pc_samples += rec->samples;
+
+    return true;
+}
+
+size_t
+ActivityTracing::flush(Caliper* c, Caliper::SnapshotFlushFn proc_fn)
+{
+    if (!m_enabled)
+        return 0;
+
+    cuptiActivityFlushAll(0);
+
+    std::vector< std::pair<uint8_t*, size_t> > buffers;
+
+    {
+        std::lock_guard<std::mutex>
+            g(m_buffer_mtx);
+
+        buffers.swap(m_completed_buffers);
+    }
+
+    // First pass: collect external correlation IDs and function names,
+    // which may come in a different buffer than the corresponding
+    // activity records
+
+    for (auto &buf : buffers) {
+        CUpti_Activity* rec = nullptr;
+
+        while (cuptiActivityGetNextRecord(buf.first, buf.second, &rec) == CUPTI_SUCCESS)
+            if (rec->kind == CUPTI_ACTIVITY_KIND_EXTERNAL_CORRELATION) {
+                const CUpti_ActivityExternalCorrelation* xrec =
+                    reinterpret_cast<const CUpti_ActivityExternalCorrelation*>(rec);
+
+                if (xrec->externalKind == CUPTI_EXTERNAL_CORRELATION_KIND_CUSTOM0)
+                    m_correlation_map[xrec->correlationId] = xrec->externalId;
+            } else if (rec->kind == CUPTI_ACTIVITY_KIND_FUNCTION) {
+                const CUpti_ActivityFunction* frec =
+                    reinterpret_cast<const CUpti_ActivityFunction*>(rec);
+
+                if (frec->name)
+                    m_function_names[frec->id] = frec->name;
+            } else if (rec->kind == CUPTI_ACTIVITY_KIND_PC_SAMPLING_RECORD_INFO) {
+                const CUpti_ActivityPCSamplingRecordInfo* irec =
+                    reinterpret_cast<const CUpti_ActivityPCSamplingRecordInfo*>(rec);
+
+                m_num_pc_samples_dropped += irec->droppedSamples;
+            }
+    }
+
+    // Second pass: process activity records
+
+    size_t num_written = 0;
+
+    for (auto &buf : buffers) {
+        CUpti_Activity* rec = nullptr;
+
+        while (cuptiActivityGetNextRecord(buf.first, buf.second, &rec) == CUPTI_SUCCESS)
+            if (process_record(c, rec, proc_fn))
+                ++num_written;
+    }
+
+    m_num_records += num_written;
+
+    for (uint32_t corr_id : m_used_correlations)
+        m_correlation_map.erase(corr_id);
+
+    m_used_correlations.clear();
+
+    {
+        std::lock_guard<std::mutex>
+            g(m_buffer_mtx);
+
+        for (auto &buf : buffers)
+            m_free_buffers.push_back(buf.first);
+    }
+
+    Log(1).stream() << "cupti: Wrote " << num_written << " activity records." << std::endl;
+
+    return num_written;
+}
+
+void
+ActivityTracing::clear()
+{
+    if (!m_enabled)
+        return;
+
+    cuptiActivityFlushAll(0);
+
+    std::lock_guard<std::mutex>
+        g(m_buffer_mtx);
+
+    for (auto &buf : m_completed_buffers)
+        m_free_buffers.push_back(buf.first);
+
+    m_completed_buffers.clear();
+    m_correlation_map.clear();
+    m_used_correlations.clear();
+}
+
+void
+ActivityTracing::stop()
+{
+    if (!m_enabled)
+        return;
+
+    for (CUpti_ActivityKind kind : s_activity_kinds)
+        cuptiActivityDisable(kind);
+    if (m_pc_sampling)
+        for (CUpti_ActivityKind kind : s_pc_sampling_kinds)
+            cuptiActivityDisable(kind);
+
+    cuptiActivityFlushAll(0);
+
+    m_enabled = false;
+}
+
+std::ostream&
+ActivityTracing::print_statistics(std::ostream& os)
+{
+    os << "cupti: Wrote " << m_num_records << " activity records, "
+       << m_num_dropped << " records dropped, used "
+       << m_num_buffers << " buffers of " << m_buffer_size << " bytes."
+       << std::endl;
+
+    if (m_pc_sampling)
+        os << "cupti: " << m_num_pc_samples << " PC samples, "
+           << m_num_pc_samples_dropped << " dropped." << std::endl;
+
+    return os;
+}
+
+ActivityTracing::ActivityTracing()
+{ }
+
+ActivityTracing::~ActivityTracing()
+{
+    if (s_instance == this)
+        s_instance = nullptr;
+
+    for (auto &buf : m_completed_buffers)
+        free(buf.first);
+    for (uint8_t* buf : m_free_buffers)
+        free(buf);
+}
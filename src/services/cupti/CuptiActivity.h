@@ -0,0 +1,149 @@
+// Copyright (c) 2018, Lawrence Livermore National Security, LLC.
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// CuptiActivity.h
+// Buffer-based CUpti activity tracing
+
+#pragma once
+
+#include "caliper/Caliper.h"
+
+#include "caliper/common/Attribute.h"
+
+#include <cupti.h>
+
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cali
+{
+
+namespace Cupti
+{
+
+/// \brief Records GPU kernel, memcpy, and memset activities and,
+///   optionally, PC samples through the CUpti activity API.
+///
+/// Activity records are collected asynchronously in pooled buffers and
+/// turned into snapshot records at flush time. Host context is
+/// correlated through CUpti external correlation IDs: on each region
+/// update on a host thread, the ID of the updated attribute's context tree
+/// node is pushed as the thread's external correlation ID. PC samples
+/// are correlated with their kernel's host context and function name at
+/// flush time as well.
+class ActivityTracing
+{
+    static ActivityTracing* s_instance;
+
+    Attribute     m_kind_attr     = Attribute::invalid;
+    Attribute     m_name_attr     = Attribute::invalid;
+    Attribute     m_start_attr    = Attribute::invalid;
+    Attribute     m_duration_attr = Attribute::invalid;
+    Attribute     m_bytes_attr    = Attribute::invalid;
+    Attribute     m_device_attr   = Attribute::invalid;
+    Attribute     m_stream_attr   = Attribute::invalid;
+    Attribute     m_pc_offset_attr   = Attribute::invalid;
+    Attribute     m_pc_samples_attr  = Attribute::invalid;
+    Attribute     m_pc_stall_attr    = Attribute::invalid;
+
+    size_t        m_buffer_size   = 0;
+
+    std::vector< std::pair<uint8_t*, size_t> > m_completed_buffers;
+    std::vector< uint8_t* >                    m_free_buffers;
+    std::mutex                                 m_buffer_mtx;
+
+    // CUpti correlation ID -> external correlation ID (context node ID)
+    std::unordered_map<uint32_t, uint64_t>     m_correlation_map;
+    // CUpti function ID -> function name (for PC samples)
+    std::unordered_map<uint32_t, std::string>  m_function_names;
+    // Correlation IDs of records processed in the current flush
+    std::vector<uint32_t>                      m_used_correlations;
+
+    unsigned      m_num_buffers   = 0;
+    unsigned      m_num_records   = 0;
+    unsigned      m_num_dropped   = 0;
+    uint64_t      m_num_pc_samples         = 0;
+    uint64_t      m_num_pc_samples_dropped = 0;
+
+    int           m_pc_sampling_period = 0;
+
+    bool          m_enabled       = false;
+    bool          m_pc_sampling   = false;
+
+    static void CUPTIAPI
+    buffer_requested(uint8_t** buffer, size_t* size, size_t* max_num_records);
+    static void CUPTIAPI
+    buffer_completed(CUcontext ctx, uint32_t stream_id, uint8_t* buffer, size_t size, size_t valid_size);
+
+    bool     process_record(Caliper* c, const CUpti_Activity* rec, Caliper::SnapshotFlushFn proc_fn);
+    bool     process_pc_sample(Caliper* c, const CUpti_Activity* rec, Caliper::SnapshotFlushFn proc_fn);
+
+public:
+
+    bool     is_enabled() const { return m_enabled; }
+    bool     is_pc_sampling_enabled() const { return m_pc_sampling; }
+
+    /// \brief Enable activity tracing.
+    /// \param pc_sampling_period Enable PC sampling with the given
+    ///   \a CUpti_ActivityPCSamplingPeriod value if > 0
+    bool     setup(Caliper* c, size_t buffer_size, int pc_sampling_period = 0);
+
+    /// \brief Set the PC sampling period on a new CUDA context
+    bool     configure_context(CUcontext context);
+
+    /// \brief Set the calling thread's external correlation ID to the
+    ///   context node of \a attr
+    void     update_context(Caliper* c, const Attribute& attr);
+
+    /// \brief Process all completed activity records.
+    /// \return Number of records passed to \a proc_fn
+    size_t   flush(Caliper* c, Caliper::SnapshotFlushFn proc_fn);
+
+    void     clear();
+
+    void     stop();
+
+    std::ostream&
+    print_statistics(std::ostream& os);
+
+    ActivityTracing();
+
+    ~ActivityTracing();
+};
+
+} // namespace Cupti
+
+} // namespace cali
@@ -87,6 +87,12 @@ void set_cb(Caliper* c, const Attribute& attr, const Variant& value)
     Log(1).stream() << "Event: pre_set ("   << attr.name() << "=" << value << ")" << endl;
 }
 
+void set_many_cb(Caliper* c, size_t n, const Attribute* attr, const Variant* value)
+{
+    lock_guard<mutex> lock(dbg_mutex);
+    Log(1).stream() << "Event: pre_set_many (" << n << " attributes)" << endl;
+}
+
 const char* scopestrings[] = { "", "process", "thread", "", "task" };
 
 string scope2string(int scope)
@@ -125,6 +131,12 @@ void create_scope_cb(Caliper* c, cali_context_scope_t scope)
     Log(1).stream() << "Event: create_scope (scope=" << scope2string(scope) << ")" << endl;
 }
 
+void reuse_scope_cb(Caliper* c, cali_context_scope_t scope)
+{
+    lock_guard<mutex> lock(dbg_mutex);
+    Log(1).stream() << "Event: reuse_scope (scope=" << scope2string(scope) << ")" << endl;
+}
+
 void release_scope_cb(Caliper* c, cali_context_scope_t scope)
 {
     lock_guard<mutex> lock(dbg_mutex);
@@ -177,9 +189,11 @@ void debug_service_register(Caliper* c)
     c->events().pre_begin_evt.connect(&begin_cb);
     c->events().pre_end_evt.connect(&end_cb);
     c->events().pre_set_evt.connect(&set_cb);
+    c->events().pre_set_many_evt.connect(&set_many_cb);
     c->events().finish_evt.connect(&finish_cb);
     c->events().create_scope_evt.connect(&create_scope_cb);
     c->events().release_scope_evt.connect(&release_scope_cb);
+    c->events().reuse_scope_evt.connect(&reuse_scope_cb);
     c->events().snapshot.connect(&snapshot_cb);
     c->events().process_snapshot.connect(&process_snapshot_cb);
 
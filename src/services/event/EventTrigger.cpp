@@ -42,8 +42,13 @@
 #include "caliper/common/RuntimeConfig.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -65,6 +70,48 @@ const ConfigSet::Entry   configdata[] = {
       "Enable snapshot info records",
       "Enable snapshot info records."
     },
+    { "sample_mode", CALI_TYPE_STRING, "none",
+      "Sampling mode for begin/end events",
+      "Sampling mode for begin/end events. One of\n"
+      "   none:        Every event triggers a snapshot\n"
+      "   count:       Every Nth begin/end pair triggers snapshots\n"
+      "   probability: Begin/end pairs trigger snapshots with a given probability\n"
+      "   interval:    Begin/end pairs trigger snapshots at most once per interval\n"
+      "Sampled snapshots include the sample weight in cali.event.sample.weight."
+    },
+    { "sample_count", CALI_TYPE_UINT, "100",
+      "Take every Nth begin/end pair in count sampling mode",
+      "Take every Nth begin/end pair in count sampling mode."
+    },
+    { "sample_probability", CALI_TYPE_DOUBLE, "0.01",
+      "Probability of taking a begin/end pair in probability sampling mode",
+      "Probability of taking a begin/end pair in probability sampling mode."
+    },
+    { "sample_interval", CALI_TYPE_UINT, "1000",
+      "Minimum time between sampled begin events in interval sampling mode (usec)",
+      "Minimum time between sampled begin events of an attribute on a thread\n"
+      "in interval sampling mode, in microseconds."
+    },
+    { "sample_attributes", CALI_TYPE_STRING, "",
+      "List of trigger attributes to sample",
+      "List of trigger attributes to sample. If empty, sample all trigger attributes."
+    },
+    { "loop_statistics", CALI_TYPE_STRING, "",
+      "List of loops to keep per-iteration statistics for",
+      "List of loops (as in the \"loop\" attribute) to keep per-iteration statistics for.\n"
+      "Iterations of these loops don't trigger snapshots. Instead, the iteration count\n"
+      "and the sum, min, and max of the iteration times are written at loop end, or\n"
+      "every loop_snapshot_interval iterations."
+    },
+    { "loop_snapshot_interval", CALI_TYPE_UINT, "0",
+      "Write loop statistics every N iterations",
+      "Write loop statistics every N iterations. If 0, write them only at loop end."
+    },
+    { "loop_histogram", CALI_TYPE_BOOL, "false",
+      "Keep a histogram of iteration times for loop statistics",
+      "Keep a histogram of iteration times for loop statistics.\n"
+      "Bin 0 counts iterations below 1 usec, bin N > 0 iterations in [2^(N-1), 2^N) usec."
+    },
 
     ConfigSet::Terminator
 };
@@ -73,11 +120,35 @@ ConfigSet                config;
 
 bool                     enable_snapshot_info;
 
+enum class SampleMode { None, Count, Probability, Interval };
+
+SampleMode               sample_mode        = SampleMode::None;
+uint64_t                 sample_count       = 100;
+double                   sample_probability = 0.01;
+uint64_t                 sample_interval    = 1000;
+
+std::vector<std::string> sample_attr_names;
+
+std::vector<std::string> loop_stat_names;
+uint64_t                 loop_snapshot_interval = 0;
+bool                     loop_histogram         = false;
+
+constexpr int            loop_histogram_bins    = 32;
+
+struct LoopStatAttributes {
+    Attribute count_attr;
+    Attribute sum_attr;
+    Attribute min_attr;
+    Attribute max_attr;
+    Attribute bin_attrs[loop_histogram_bins];
+};
+
+LoopStatAttributes       loop_stat_attrs;
+
 struct EventAttributes {
     Attribute begin_attr;
     Attribute set_attr;
     Attribute end_attr;
-    Attribute lvl_attr;
 };
 
 std::vector<std::string> trigger_attr_names;
@@ -87,9 +158,305 @@ Attribute                trigger_end_attr   { Attribute::invalid };
 Attribute                trigger_set_attr   { Attribute::invalid };
 
 Attribute                trigger_level_attr { Attribute::invalid };
+Attribute                sample_weight_attr { Attribute::invalid };
 
 Attribute                event_info_attr    { Attribute::invalid };
 
+//
+// --- Per-attribute event info table
+//
+//   The derived event attributes of each trigger attribute are looked up
+// once when the attribute is created, and stored in a table indexed by
+// attribute ID, so the event callbacks don't need to walk the
+// attribute's metadata or take the attribute lock.
+//   The table is a fixed array of lazily allocated chunks. Chunks are
+// installed with compare-and-swap, entries are published with a release
+// store of their "valid" flag.
+
+struct EventInfo {
+    EventAttributes       attrs;
+    bool                  process_scope;
+    bool                  sampled;      ///< Sample begin/end pairs of this attribute
+    bool                  loop_stats;   ///< Keep iteration statistics instead of taking snapshots
+    bool                  is_loop;      ///< The "loop" attribute; its end events write loop statistics
+    std::atomic<int64_t>  process_lvl;  ///< Nesting level of process-scope attributes
+    std::atomic<bool>     valid;
+};
+
+constexpr std::size_t    event_info_chunk_size = 1024;
+constexpr std::size_t    event_info_max_chunks = 16384;
+
+std::atomic<EventInfo*>  event_info_table[event_info_max_chunks];
+
+EventInfo*
+find_event_info(cali_id_t id, bool create = false)
+{
+    std::size_t chunk = id / event_info_chunk_size;
+
+    if (id == CALI_INV_ID || chunk >= event_info_max_chunks)
+        return nullptr;
+
+    EventInfo* entries = event_info_table[chunk].load(std::memory_order_acquire);
+
+    if (!entries) {
+        if (!create)
+            return nullptr;
+
+        EventInfo* new_entries = new EventInfo[event_info_chunk_size];
+
+        for (std::size_t i = 0; i < event_info_chunk_size; ++i) {
+            new_entries[i].process_lvl.store(-1, std::memory_order_relaxed);
+            new_entries[i].valid.store(false, std::memory_order_relaxed);
+        }
+
+        if (event_info_table[chunk].compare_exchange_strong(entries, new_entries, std::memory_order_acq_rel))
+            entries = new_entries;
+        else
+            delete[] new_entries;
+    }
+
+    EventInfo* info = entries + (id % event_info_chunk_size);
+
+    if (!create && !info->valid.load(std::memory_order_acquire))
+        return nullptr;
+
+    return info;
+}
+
+/// \brief Look up the derived event attributes for \a attr in its metadata
+bool
+lookup_event_attributes(Caliper* c, const Attribute& attr, EventAttributes& evt_attr)
+{
+    Variant v_ids = attr.get(event_info_attr);
+
+    if (v_ids.empty())
+        return false;
+
+    const cali_id_t* ids = static_cast<const cali_id_t*>(v_ids.data());
+
+    evt_attr.begin_attr = c->get_attribute(ids[0]);
+    evt_attr.set_attr   = c->get_attribute(ids[1]);
+    evt_attr.end_attr   = c->get_attribute(ids[2]);
+
+    return true;
+}
+
+//
+// --- Nesting levels and sampling state
+//
+//   Levels are -1 if the attribute was never set. Levels for
+// process-scope attributes are kept in the event info table; all others
+// in a thread-local table. Sampling is per-thread only, so the sampling
+// state lives in the thread-local table as well.
+
+/// \brief Per-thread iteration time statistics of a loop, in usec
+struct LoopStats {
+    std::string name;       ///< loop name
+
+    uint64_t    count = 0;
+    double      sum   = 0.0;
+    double      min   = 0.0;
+    double      max   = 0.0;
+    uint64_t    bins[loop_histogram_bins] = { 0 };
+
+    uint64_t    start  = 0;      ///< Begin time of the current iteration (nsec)
+    bool        active = false;  ///< In t_active_loops
+
+    void add(double t) {
+        if (count == 0 || t < min)
+            min = t;
+        if (count == 0 || t > max)
+            max = t;
+
+        sum += t;
+        ++count;
+
+        if (loop_histogram) {
+            int b = 0;
+
+            if (t >= 1.0) {
+                std::frexp(t, &b);
+                b = std::min(b, loop_histogram_bins - 1);
+            }
+
+            ++bins[b];
+        }
+    }
+
+    void reset() {
+        count = 0;
+        sum   = min = max = 0.0;
+
+        std::fill_n(bins, loop_histogram_bins, 0);
+    }
+};
+
+struct ThreadEventState {
+    int64_t             lvl         = -1;
+    uint64_t            num_events  = 0; ///< Begin events since the last sampled one
+    uint64_t            last_sample = 0; ///< Time of the last sampled begin event (usec)
+    std::vector<double> weights;         ///< Sample weights of open begin events; 0 if skipped
+
+    std::unique_ptr<LoopStats> loop;     ///< Iteration statistics for loop_stats attributes
+};
+
+thread_local std::vector<ThreadEventState> t_state;
+
+/// \brief IDs of the thread's iteration attributes with unreported statistics
+thread_local std::vector<cali_id_t>        t_active_loops;
+
+ThreadEventState&
+thread_state(cali_id_t id)
+{
+    if (id >= t_state.size())
+        t_state.resize(std::max<std::size_t>(id + 1, 2 * t_state.size()));
+
+    return t_state[id];
+}
+
+int64_t&
+thread_level(cali_id_t id)
+{
+    return thread_state(id).lvl;
+}
+
+uint64_t
+sample_time_usec()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t
+loop_time_nsec()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double
+sample_random()
+{
+    // xorshift64*, seeded per thread
+    thread_local uint64_t state = 0;
+
+    if (state == 0)
+        state = (reinterpret_cast<uintptr_t>(&state) ^ sample_time_usec()) | 1;
+
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+
+    return static_cast<double>((state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+/// \brief Make the sampling decision for a begin event of \a id.
+///   Returns the sample weight, or 0 if the event is skipped.
+double
+sample_begin(cali_id_t id)
+{
+    ThreadEventState& state = thread_state(id);
+    double w = 0.0;
+
+    ++state.num_events;
+
+    switch (sample_mode) {
+    case SampleMode::Count:
+        if (state.num_events >= sample_count) {
+            w = static_cast<double>(state.num_events);
+            state.num_events = 0;
+        }
+        break;
+    case SampleMode::Probability:
+        if (sample_random() < sample_probability)
+            w = 1.0 / sample_probability;
+        break;
+    case SampleMode::Interval:
+    {
+        uint64_t now = sample_time_usec();
+
+        if (now - state.last_sample >= sample_interval) {
+            w = static_cast<double>(state.num_events);
+            state.num_events  = 0;
+            state.last_sample = now;
+        }
+    }
+        break;
+    default:
+        w = 1.0;
+    }
+
+    state.weights.push_back(w);
+
+    return w;
+}
+
+/// \brief Returns the sample weight of the begin event matching
+///   an end event of \a id, or 0 if it was skipped.
+double
+sample_end(cali_id_t id)
+{
+    ThreadEventState& state = thread_state(id);
+
+    if (state.weights.empty())
+        return 1.0;
+
+    double w = state.weights.back();
+    state.weights.pop_back();
+
+    return w;
+}
+
+/// \brief Increase nesting level of \a attr. Returns the new level.
+int64_t
+begin_level(EventInfo* info, cali_id_t id)
+{
+    if (info && info->process_scope) {
+        int64_t prev = info->process_lvl.load(std::memory_order_relaxed);
+
+        while (!info->process_lvl.compare_exchange_weak(prev, std::max<int64_t>(prev, 0) + 1))
+            ;
+
+        return std::max<int64_t>(prev, 0) + 1;
+    }
+
+    int64_t& lvl = thread_level(id);
+    lvl = std::max<int64_t>(lvl, 0) + 1;
+
+    return lvl;
+}
+
+void
+set_level(EventInfo* info, cali_id_t id)
+{
+    // The level for set() is always 1
+    if (info && info->process_scope)
+        info->process_lvl.store(1);
+    else
+        thread_level(id) = 1;
+}
+
+/// \brief Decrease nesting level of \a attr. Returns the previous level,
+///   or -1 if the attribute was never set.
+int64_t
+end_level(EventInfo* info, cali_id_t id)
+{
+    if (info && info->process_scope) {
+        int64_t prev = info->process_lvl.load(std::memory_order_relaxed);
+
+        while (prev >= 0 && !info->process_lvl.compare_exchange_weak(prev, prev > 1 ? prev - 1 : 0))
+            ;
+
+        return prev;
+    }
+
+    int64_t& lvl = thread_level(id);
+    int64_t  prev = lvl;
+
+    if (prev >= 0)
+        lvl = prev > 1 ? prev - 1 : 0;
+
+    return prev;
+}
+
 EventAttributes
 make_event_attributes(Caliper* c, const std::string& name, cali_attr_type type, int prop)
 {
@@ -112,16 +479,6 @@ make_event_attributes(Caliper* c, const std::string& name, cali_attr_type type,
             c->create_attribute(s, type, (prop & ~CALI_ATTR_NESTED) | CALI_ATTR_SKIP_EVENTS);
     }
 
-    std::string s = "cali.lvl#";
-    s.append(name);
-
-    event_attributes.lvl_attr =
-        c->create_attribute(s, CALI_TYPE_INT,
-                            CALI_ATTR_ASVALUE     |
-                            CALI_ATTR_HIDDEN      |
-                            CALI_ATTR_SKIP_EVENTS |
-                            (prop & CALI_ATTR_SCOPE_MASK));
-
     return event_attributes;
 }
 
@@ -140,10 +497,9 @@ pre_create_attribute_cb(Caliper* c, const std::string& name, cali_attr_type type
     } else if (enable_snapshot_info) {
         // Make and append derived event attributes
         EventAttributes evt_attr   = make_event_attributes(c, name, type, *prop);
-        cali_id_t       evt_ids[4] = { evt_attr.begin_attr.id(),
+        cali_id_t       evt_ids[3] = { evt_attr.begin_attr.id(),
                                        evt_attr.set_attr.id(),
-                                       evt_attr.end_attr.id(),
-                                       evt_attr.lvl_attr.id() };
+                                       evt_attr.end_attr.id() };
 
         Variant v_events(CALI_TYPE_USR, evt_ids, sizeof(evt_ids));
 
@@ -153,135 +509,247 @@ pre_create_attribute_cb(Caliper* c, const std::string& name, cali_attr_type type
     }
 }
 
-void event_begin_cb(Caliper* c, const Attribute& attr, const Variant& value)
+void create_attribute_cb(Caliper* c, const Attribute& attr)
 {
-    if (enable_snapshot_info) {
-        Variant v_ids = attr.get(event_info_attr);
+    if (attr.skip_events())
+        return;
 
-        assert(!v_ids.empty());
+    EventAttributes evt_attr;
 
-        const cali_id_t* evt_info_attr_ids =
-            static_cast<const cali_id_t*>(v_ids.data());
+    if (!lookup_event_attributes(c, attr, evt_attr))
+        return;
 
-        assert(evt_info_attr_ids != nullptr);
+    EventInfo* info = find_event_info(attr.id(), true);
 
-        Attribute begin_attr = c->get_attribute(evt_info_attr_ids[0]);
-        Attribute lvl_attr   = c->get_attribute(evt_info_attr_ids[3]);
+    if (!info)
+        return;
 
-        assert(begin_attr != Attribute::invalid);
-        assert(lvl_attr   != Attribute::invalid);
+    info->attrs         = evt_attr;
+    info->process_scope = ((attr.properties() & CALI_ATTR_SCOPE_MASK) == CALI_ATTR_SCOPE_PROCESS);
+    info->sampled       = false;
+    info->loop_stats    = false;
+    info->is_loop       = (attr.name() == "loop");
 
-        uint64_t  lvl = 1;
-        Variant v_lvl(lvl), v_p_lvl;
+    if (!loop_stat_names.empty() && !info->process_scope && attr.name().compare(0, 10, "iteration#") == 0)
+        info->loop_stats =
+            std::find(loop_stat_names.begin(), loop_stat_names.end(), attr.name().substr(10)) != loop_stat_names.end();
 
-        // Use Caliper::exchange() to accelerate common-case of setting new hierarchy level to 1.
-        // If previous level was > 0, we need to increment it further
+    if (sample_mode != SampleMode::None && !info->process_scope)
+        info->sampled = sample_attr_names.empty() ||
+            std::find(sample_attr_names.begin(), sample_attr_names.end(), attr.name()) != sample_attr_names.end();
 
-        // FIXME: There may be a race condition between c->exchange() and c->set()
-        // when two threads update a process-scope attribute.
-        // Can fix that with a more general c->update(update_fn) function
+    info->valid.store(true, std::memory_order_release);
+}
 
-        v_p_lvl = c->exchange(lvl_attr, v_lvl);
-        lvl     = v_p_lvl.to_uint();
+/// \brief Get the event attributes for \a attr. Returns the table
+///   entry, or a nullptr if the attribute is not in the table (yet). Then,
+///   \a tmp is filled with the attributes from the metadata lookup.
+EventInfo*
+get_event_info(Caliper* c, const Attribute& attr, EventAttributes& tmp)
+{
+    EventInfo* info = find_event_info(attr.id());
 
-        if (lvl > 0) {
-            v_lvl = Variant(++lvl);
-            c->set(lvl_attr, v_lvl);
-        }
+    if (!info) {
+        bool found = lookup_event_attributes(c, attr, tmp);
+        assert(found);
+        (void) found;
+    }
 
-        // Construct the trigger info entry
+    return info;
+}
 
-        Attribute attrs[3] = { trigger_level_attr, trigger_begin_attr, begin_attr };
-        Variant    vals[3] = { v_lvl, Variant(attr.id()), value };
+void push_event_snapshot(Caliper* c, const Attribute& trigger_attr, const Attribute& evt_attr,
+                         int64_t lvl, const Attribute& attr, const Variant& value,
+                         double weight = 0.0)
+{
+    // Construct the trigger info entry. Sampled events get a weight entry.
 
-        SnapshotRecord::FixedSnapshotRecord<3> trigger_info_data;
-        SnapshotRecord trigger_info(trigger_info_data);
+    Attribute attrs[4] = { trigger_level_attr, trigger_attr, evt_attr, sample_weight_attr };
+    Variant    vals[4] = { Variant(static_cast<uint64_t>(lvl)), Variant(attr.id()), value, Variant(weight) };
 
-        c->make_entrylist(3, attrs, vals, trigger_info);
-        c->push_snapshot(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, &trigger_info);
-    } else {
-        c->push_snapshot(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, nullptr);
-    }
+    SnapshotRecord::FixedSnapshotRecord<4> trigger_info_data;
+    SnapshotRecord trigger_info(trigger_info_data);
+
+    c->make_entrylist(weight > 0.0 ? 4 : 3, attrs, vals, trigger_info);
+    c->push_snapshot(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, &trigger_info);
 }
 
-void event_set_cb(Caliper* c, const Attribute& attr, const Variant& value)
+/// \brief Push a snapshot with the loop statistics in \a stats and reset them
+void push_loop_snapshot(Caliper* c, const Attribute& evt_attr, int64_t lvl,
+                        const Attribute& attr, const Variant& value, LoopStats& stats)
 {
-    if (enable_snapshot_info) {
-        Variant v_ids = attr.get(event_info_attr);
+    const int max_entries = 7 + loop_histogram_bins;
+
+    Attribute attrs[max_entries] = {
+        trigger_level_attr, trigger_end_attr, evt_attr,
+        loop_stat_attrs.count_attr,
+        loop_stat_attrs.sum_attr,
+        loop_stat_attrs.min_attr,
+        loop_stat_attrs.max_attr
+    };
+    Variant    vals[max_entries] = {
+        Variant(static_cast<uint64_t>(lvl)), Variant(attr.id()), value,
+        Variant(static_cast<uint64_t>(stats.count)),
+        Variant(stats.sum),
+        Variant(stats.min),
+        Variant(stats.max)
+    };
 
-        assert(!v_ids.empty());
+    int n = 7;
 
-        const cali_id_t* evt_info_attr_ids =
-            static_cast<const cali_id_t*>(v_ids.data());
+    if (loop_histogram)
+        for (int b = 0; b < loop_histogram_bins; ++b)
+            if (stats.bins[b] > 0) {
+                attrs[n] = loop_stat_attrs.bin_attrs[b];
+                vals[n]  = Variant(static_cast<uint64_t>(stats.bins[b]));
+                ++n;
+            }
 
-        assert(evt_info_attr_ids != nullptr);
+    SnapshotRecord::FixedSnapshotRecord<max_entries> trigger_info_data;
+    SnapshotRecord trigger_info(trigger_info_data);
 
-        Attribute set_attr = c->get_attribute(evt_info_attr_ids[1]);
-        Attribute lvl_attr = c->get_attribute(evt_info_attr_ids[3]);
+    c->make_entrylist(n, attrs, vals, trigger_info);
+    c->push_snapshot(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, &trigger_info);
 
-        uint64_t  lvl(1);
-        Variant v_lvl(lvl);
+    stats.reset();
+}
 
-        // The level for set() is always 1
-        // FIXME: ... except for set_path()??
-        c->set(lvl_attr, v_lvl);
+void loop_iteration_begin(cali_id_t id)
+{
+    ThreadEventState& state = thread_state(id);
 
-        // Construct the trigger info entry
+    if (!state.loop)
+        state.loop.reset(new LoopStats);
 
-        Attribute attrs[3] = { trigger_level_attr, trigger_set_attr, set_attr };
-        Variant    vals[3] = { v_lvl, Variant(attr.id()), value };
+    state.loop->start = loop_time_nsec();
+}
 
-        SnapshotRecord::FixedSnapshotRecord<3> trigger_info_data;
-        SnapshotRecord trigger_info(trigger_info_data);
+void loop_iteration_end(Caliper* c, EventInfo* info, const Attribute& attr, const Variant& value)
+{
+    ThreadEventState& state = thread_state(attr.id());
 
-        c->make_entrylist(3, attrs, vals, trigger_info);
-        c->push_snapshot(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, &trigger_info);
-    } else {
-        c->push_snapshot(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, nullptr);
+    if (!state.loop)
+        return;
+
+    LoopStats& stats = *state.loop;
+
+    if (!stats.active) {
+        if (stats.name.empty())
+            stats.name = attr.name().substr(10);
+
+        stats.active = true;
+        t_active_loops.push_back(attr.id());
     }
+
+    stats.add((loop_time_nsec() - stats.start) / 1000.0);
+
+    if (loop_snapshot_interval > 0 && stats.count >= loop_snapshot_interval)
+        push_loop_snapshot(c, info->attrs.end_attr, 1, attr, value, stats);
 }
 
-void event_end_cb(Caliper* c, const Attribute& attr, const Variant& value)
+/// \brief Write the statistics of the loop ending with \a value into its
+///   end snapshot. Returns false if there are no statistics for this loop.
+bool loop_end(Caliper* c, EventInfo* info, const Attribute& attr, const Variant& value)
+{
+    std::string name = value.to_string();
+
+    for (auto it = t_active_loops.begin(); it != t_active_loops.end(); ++it) {
+        LoopStats* stats = thread_state(*it).loop.get();
+
+        if (!stats || stats->name != name)
+            continue;
+
+        t_active_loops.erase(it);
+        stats->active = false;
+
+        if (stats->count == 0)
+            return false;
+
+        int64_t lvl = end_level(info, attr.id());
+
+        push_loop_snapshot(c, info->attrs.end_attr, std::max<int64_t>(lvl, 1), attr, value, *stats);
+
+        return true;
+    }
+
+    return false;
+}
+
+void event_begin_cb(Caliper* c, const Attribute& attr, const Variant& value)
 {
     if (enable_snapshot_info) {
-        Variant v_ids = attr.get(event_info_attr);
+        EventAttributes tmp;
+        EventInfo* info = get_event_info(c, attr, tmp);
+
+        if (info && info->loop_stats) {
+            loop_iteration_begin(attr.id());
+            return;
+        }
 
-        assert(!v_ids.empty());
+        int64_t lvl    = begin_level(info, attr.id());
+        double  weight = 0.0;
 
-        const cali_id_t* evt_info_attr_ids =
-            static_cast<const cali_id_t*>(v_ids.data());
+        if (info && info->sampled) {
+            weight = sample_begin(attr.id());
 
-        assert(evt_info_attr_ids != nullptr);
+            if (weight == 0.0)
+                return;
+        }
+
+        push_event_snapshot(c, trigger_begin_attr, info ? info->attrs.begin_attr : tmp.begin_attr,
+                            lvl, attr, value, weight);
+    } else {
+        c->push_snapshot(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, nullptr);
+    }
+}
 
-        Attribute end_attr = c->get_attribute(evt_info_attr_ids[2]);
-        Attribute lvl_attr = c->get_attribute(evt_info_attr_ids[3]);
+void event_set_cb(Caliper* c, const Attribute& attr, const Variant& value)
+{
+    if (enable_snapshot_info) {
+        EventAttributes tmp;
+        EventInfo* info = get_event_info(c, attr, tmp);
 
-        uint64_t  lvl = 0;
-        Variant v_lvl(lvl), v_p_lvl;
+        set_level(info, attr.id());
 
-        // Use Caliper::exchange() to accelerate common-case of setting new level to 0.
-        // If previous level was > 1, we need to update it again
+        push_event_snapshot(c, trigger_set_attr, info ? info->attrs.set_attr : tmp.set_attr,
+                            1, attr, value);
+    } else {
+        c->push_snapshot(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, nullptr);
+    }
+}
 
-        v_p_lvl = c->exchange(lvl_attr, v_lvl);
+void event_end_cb(Caliper* c, const Attribute& attr, const Variant& value)
+{
+    if (enable_snapshot_info) {
+        EventAttributes tmp;
+        EventInfo* info = get_event_info(c, attr, tmp);
 
-        if (v_p_lvl.empty())
+        if (info && info->loop_stats) {
+            loop_iteration_end(c, info, attr, value);
+            return;
+        }
+        if (info && info->is_loop && !t_active_loops.empty() && loop_end(c, info, attr, value))
             return;
 
-        lvl     = v_p_lvl.to_uint();
+        // Report the previous level. Skip the snapshot if the attribute
+        // was never set.
+        int64_t lvl = end_level(info, attr.id());
 
-        if (lvl > 1)
-            c->set(lvl_attr, Variant(--lvl));
+        if (lvl < 0)
+            return;
 
-        // Construct the trigger info entry with previous level
+        // Skip the end event if the matching begin event was skipped
+        double weight = 0.0;
 
-        Attribute attrs[3] = { trigger_level_attr, trigger_end_attr, end_attr };
-        Variant    vals[3] = { v_p_lvl, Variant(attr.id()), value };
+        if (info && info->sampled) {
+            weight = sample_end(attr.id());
 
-        SnapshotRecord::FixedSnapshotRecord<3> trigger_info_data;
-        SnapshotRecord trigger_info(trigger_info_data);
+            if (weight == 0.0)
+                return;
+        }
 
-        c->make_entrylist(3, attrs, vals, trigger_info);
-        c->push_snapshot(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, &trigger_info);
+        push_event_snapshot(c, trigger_end_attr, info ? info->attrs.end_attr : tmp.end_attr,
+                            lvl, attr, value, weight);
     } else {
         c->push_snapshot(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, nullptr);
     }
@@ -296,6 +764,46 @@ void event_trigger_register(Caliper* c)
     trigger_attr_names   = config.get("trigger").to_stringlist(",:");
     enable_snapshot_info = config.get("enable_snapshot_info").to_bool();
 
+    std::string mode = config.get("sample_mode").to_string();
+
+    if (mode == "count")
+        sample_mode = SampleMode::Count;
+    else if (mode == "probability")
+        sample_mode = SampleMode::Probability;
+    else if (mode == "interval")
+        sample_mode = SampleMode::Interval;
+    else if (mode != "none")
+        Log(0).stream() << "event: warning: unknown sample mode \"" << mode
+                        << "\", sampling disabled" << endl;
+
+    sample_count       = std::max<uint64_t>(config.get("sample_count").to_uint(), 1);
+    sample_probability = config.get("sample_probability").to_double();
+    sample_interval    = config.get("sample_interval").to_uint();
+    sample_attr_names  = config.get("sample_attributes").to_stringlist(",:");
+
+    if (sample_mode == SampleMode::Probability && !(sample_probability > 0.0 && sample_probability <= 1.0)) {
+        Log(0).stream() << "event: warning: invalid sample probability "
+                        << config.get("sample_probability").to_string()
+                        << ", sampling disabled" << endl;
+        sample_mode = SampleMode::None;
+    }
+
+    if (sample_mode != SampleMode::None && !enable_snapshot_info) {
+        Log(0).stream() << "event: warning: sampling requires snapshot info records, sampling disabled"
+                        << endl;
+        sample_mode = SampleMode::None;
+    }
+
+    loop_stat_names        = config.get("loop_statistics").to_stringlist(",:");
+    loop_snapshot_interval = config.get("loop_snapshot_interval").to_uint();
+    loop_histogram         = config.get("loop_histogram").to_bool();
+
+    if (!loop_stat_names.empty() && !enable_snapshot_info) {
+        Log(0).stream() << "event: warning: loop statistics require snapshot info records, loop statistics disabled"
+                        << endl;
+        loop_stat_names.clear();
+    }
+
     // register trigger events
 
     if (enable_snapshot_info) {
@@ -313,6 +821,11 @@ void event_trigger_register(Caliper* c)
                                 CALI_TYPE_UINT,
                                 CALI_ATTR_SKIP_EVENTS |
                                 CALI_ATTR_HIDDEN);
+        sample_weight_attr =
+            c->create_attribute("cali.event.sample.weight",
+                                CALI_TYPE_DOUBLE,
+                                CALI_ATTR_SKIP_EVENTS |
+                                CALI_ATTR_ASVALUE);
         event_info_attr =
             c->create_attribute("cali.event.attr.ids",
                                 CALI_TYPE_USR,
@@ -320,9 +833,36 @@ void event_trigger_register(Caliper* c)
                                 CALI_ATTR_HIDDEN);
     }
 
+    if (!loop_stat_names.empty()) {
+        Attribute aggr_class_attr = c->get_attribute("class.aggregatable");
+        Variant   v_true(true);
+
+        int prop = CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD | CALI_ATTR_SKIP_EVENTS;
+
+        loop_stat_attrs.count_attr =
+            c->create_attribute("loop.iterations", CALI_TYPE_UINT, prop,
+                                1, &aggr_class_attr, &v_true);
+        loop_stat_attrs.sum_attr =
+            c->create_attribute("loop.iteration.duration.sum", CALI_TYPE_DOUBLE, prop,
+                                1, &aggr_class_attr, &v_true);
+        loop_stat_attrs.min_attr =
+            c->create_attribute("loop.iteration.duration.min", CALI_TYPE_DOUBLE, prop,
+                                1, &aggr_class_attr, &v_true);
+        loop_stat_attrs.max_attr =
+            c->create_attribute("loop.iteration.duration.max", CALI_TYPE_DOUBLE, prop,
+                                1, &aggr_class_attr, &v_true);
+
+        if (loop_histogram)
+            for (int b = 0; b < loop_histogram_bins; ++b)
+                loop_stat_attrs.bin_attrs[b] =
+                    c->create_attribute(std::string("loop.iteration.duration.bin.") + std::to_string(b),
+                                        CALI_TYPE_UINT, prop);
+    }
+
     // register callbacks
 
     c->events().pre_create_attr_evt.connect(&pre_create_attribute_cb);
+    c->events().create_attr_evt.connect(&create_attribute_cb);
 
     c->events().pre_begin_evt.connect(&event_begin_cb);
     c->events().pre_set_evt.connect(&event_set_cb);
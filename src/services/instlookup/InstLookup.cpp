@@ -38,7 +38,6 @@
 #include "x86_util.h"
 
 #include "caliper/Caliper.h"
-#include "../../caliper/MemoryPool.h"
 #include "caliper/SnapshotRecord.h"
 
 #include "caliper/common/Log.h"
@@ -56,6 +55,7 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
 
 using namespace cali;
 
@@ -94,6 +94,7 @@ class InstLookup
     std::mutex     m_lookup_mutex;
 
     unsigned m_num_lookups;
+    unsigned m_num_cached;
     unsigned m_num_failed;
 
     //
@@ -145,62 +146,76 @@ class InstLookup
             make_inst_attributes(c, a);
     }
     
+    struct InstInfo {
+        std::string op;
+        uint64_t    read_size;
+        uint64_t    write_size;
+    };
+
+    // Decoded instruction cache. Failed lookups are cached as nullptr.
+    // Entries are never removed, so references into the map stay valid
+    // outside of m_lookup_mutex.
+    std::unordered_map< uint64_t, std::unique_ptr<InstInfo> > m_inst_cache;
+
+    const InstInfo* lookup_instruction(uint64_t address) {
+        std::lock_guard<std::mutex>
+            g(m_lookup_mutex);
+
+        auto it = m_inst_cache.find(address);
+
+        if (it != m_inst_cache.end()) {
+            ++m_num_cached;
+            return it->second.get();
+        }
+
+        ++m_num_lookups;
+
+        std::unique_ptr<InstInfo> info;
+        void* inst_raw = nullptr;
+
+        if (m_sts && m_sts->isValidAddress(address))
+            inst_raw = m_sts->getPtrToInstruction(address);
+
+        if (inst_raw) {
+            // Get and decode instruction
+            InstructionDecoder dec(inst_raw, m_inst_length, m_arch);
+            Instruction::Ptr inst = dec.decode();
+            Operation op = inst->getOperation();
+            entryID eid = op.getID();
+
+            // Extract semantics
+            info.reset(new InstInfo { NS_x86::entryNames_IAPI[eid], 0, 0 });
+
+            if (inst->readsMemory())
+                info->read_size  = getReadSize(inst);
+            if (inst->writesMemory())
+                info->write_size = getWriteSize(inst);
+        } else {
+            ++m_num_failed;
+        }
+
+        return m_inst_cache.emplace(address, std::move(info)).first->second.get();
+    }
+
     void add_inst_attributes(const Entry& e, 
                              const InstAttributes& sym_attr,
-                             MemoryPool& mempool,
                              std::vector<Attribute>& attr, 
                              std::vector<Variant>&   data) {
+        const InstInfo* info = lookup_instruction(e.value().to_uint());
 
-        uint64_t address  = e.value().to_uint();
+        if (!info)
+            return;
 
-        {
-            std::lock_guard<std::mutex>
-                g(m_lookup_mutex);
-
-            void *inst_raw = nullptr;
-            if(m_sts->isValidAddress(address))
-            {
-                inst_raw = m_sts->getPtrToInstruction(address);
-
-                if(inst_raw)
-                {
-                    // Get and decode instruction
-                    InstructionDecoder dec(inst_raw, m_inst_length, m_arch);
-                    Instruction::Ptr inst = dec.decode();
-                    Operation op = inst->getOperation();
-                    entryID eid = op.getID();
-                    
-                    // Extract semantics
-                    uint64_t read_size = 0;
-                    uint64_t write_size = 0;
-                    std::string inst_name;
-
-                    inst_name = NS_x86::entryNames_IAPI[eid];
-
-                    if(inst->readsMemory()) {
-                        read_size = getReadSize(inst);
-                    }
-                    if(inst->writesMemory()) {
-                        read_size = getWriteSize(inst);
-                    }
-
-                    // Hack to put string on heap
-                    char* tmp_s = static_cast<char*>(mempool.allocate(inst_name.size()+1));
-                    std::copy(inst_name.begin(), inst_name.end(), tmp_s);
-                    tmp_s[inst_name.size()] = '\0';
-
-                    // Add attributes and data
-                    attr.push_back(sym_attr.op_attr);
-                    attr.push_back(sym_attr.read_size_attr);
-                    attr.push_back(sym_attr.write_size_attr);
-
-                    data.push_back(Variant(CALI_TYPE_STRING, tmp_s, inst_name.size()));
-                    data.push_back(Variant(read_size));
-                    data.push_back(Variant(write_size));
-                }
-            }
-        }
-        
+        // Strings point into the instruction cache; they are copied into
+        // the metadata tree in make_entrylist()
+
+        attr.push_back(sym_attr.op_attr);
+        attr.push_back(sym_attr.read_size_attr);
+        attr.push_back(sym_attr.write_size_attr);
+
+        data.push_back(Variant(CALI_TYPE_STRING, info->op.data(), info->op.size()));
+        data.push_back(Variant(CALI_TYPE_UINT,   &info->read_size,  sizeof(uint64_t)));
+        data.push_back(Variant(CALI_TYPE_UINT,   &info->write_size, sizeof(uint64_t)));
     }
 
     void process_snapshot(Caliper* c, SnapshotRecord* snapshot) {
@@ -221,10 +236,6 @@ class InstLookup
         std::vector<Attribute> attr;
         std::vector<Variant>   data;
 
-        // Bit of a hack: Use mempool to allocate temporary memory for strings.
-        // Should be fixed with string database in Caliper runtime.
-        MemoryPool mempool(64 * 1024);
-
         // unpack nodes, check for address attributes, and perform inst lookup
         for (auto it : sym_map) {
             Entry e = snapshot->get(it.first);
@@ -232,9 +243,9 @@ class InstLookup
             if (e.node()) {
                 for (const cali::Node* node = e.node(); node; node = node->parent()) 
                     if (node->attribute() == it.first.id())
-                        add_inst_attributes(Entry(node), it.second, mempool, attr, data);
+                        add_inst_attributes(Entry(node), it.second, attr, data);
             } else if (e.is_immediate()) {
-                add_inst_attributes(e, it.second, mempool, attr, data);
+                add_inst_attributes(e, it.second, attr, data);
             }
         }
 
@@ -242,7 +253,7 @@ class InstLookup
         std::reverse(attr.begin(), attr.end());
         std::reverse(data.begin(), data.end());
 
-        // Add entries to snapshot. Strings are copied here, temporary mempool will be free'd
+        // Add entries to snapshot. Strings are copied here
         if (attr.size() > 0)
             c->make_entrylist(attr.size(), attr.data(), data.data(), *snapshot);
     }
@@ -250,7 +261,8 @@ class InstLookup
     // some final log output; print warning if we didn't find an address attribute
     void finish_log(Caliper* c) {
         Log(1).stream() << "Instlookup: Performed " 
-                        << m_num_lookups << " address lookups, "
+                        << m_num_lookups << " address lookups ("
+                        << m_num_cached  << " cached), "
                         << m_num_failed  << " failed." 
                         << std::endl;
     }
@@ -308,7 +320,10 @@ class InstLookup
 
     InstLookup(Caliper* c)
         : m_config(RuntimeConfig::init("instlookup", s_configdata)),
-          m_sts(nullptr)
+          m_sts(nullptr),
+          m_num_lookups(0),
+          m_num_cached(0),
+          m_num_failed(0)
         {
             m_addr_attr_names  = m_config.get("attributes").to_stringlist(",:");
             m_instruction_type = m_config.get("instruction_type").to_bool();
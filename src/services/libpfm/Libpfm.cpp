@@ -62,6 +62,11 @@
 #include <sys/mman.h>
 //#include <linux/perf_event.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CALI_LIBPFM_HAVE_RDPMC
+#endif
+
 #include "perf_postprocessing.h"
 
 extern "C"
@@ -145,6 +150,19 @@ namespace {
              "Extra event configurations",
              "Comma-separated list of extra event configuration values for supported events"
             },
+            {"batch_samples", CALI_TYPE_BOOL, "false",
+             "Process samples in batches at region boundaries",
+             "Process samples in batches at region boundaries instead of signaling each sample (true|false)"
+            },
+            {"buffer_pages", CALI_TYPE_UINT, "1",
+             "Sample buffer size in pages",
+             "Size of the per-event sample ring buffer in pages. Must be a power of two."
+            },
+            {"rdpmc", CALI_TYPE_BOOL, "false",
+             "Read counters in user space with rdpmc",
+             "Read counters in user space with rdpmc where the kernel permits it (true|false).\n"
+             "Falls back to the read() syscall otherwise."
+            },
             ConfigSet::Terminator
     };
 
@@ -153,7 +171,9 @@ namespace {
      */
     int num_attributes = 0;
     static bool record_counters;
+    static bool use_rdpmc;
     static bool enable_sampling;
+    static bool batch_samples;
     static std::string events_string;
     static std::vector<std::string> event_list;
     static std::vector<uint64_t> sampling_period_list;
@@ -188,12 +208,24 @@ namespace {
     static __thread perf_event_sample_t sample;
 
     static __thread int thread_id;
+    static __thread bool thread_active = false;
     static __thread perf_event_desc_t *fds;
     static __thread int num_events;
+    static __thread uint64_t last_counter_values[MAX_EVENTS];
+    static __thread uint64_t last_time_enabled[MAX_EVENTS];
+    static __thread uint64_t last_time_running[MAX_EVENTS];
+
+    static uint64_t num_rdpmc_reads = 0;
+    static uint64_t num_syscall_reads = 0;
 
     static int signum = SIGIO;
     static int buffer_pages = 1;
 
+    // Encoded perf_event descriptions, set up once per process and
+    // copied into each thread's event list
+    static perf_event_desc_t *process_fds = NULL;
+    static int process_num_events = 0;
+
     static std::mutex id_mutex;
     static int num_threads = 0;
 
@@ -275,28 +307,106 @@ namespace {
         }
     }
 
+    /// Process all samples in this thread's ring buffers
+    static void drain_sample_buffers() {
+        struct perf_event_header ehdr;
+
+        for (int i = 0; i < num_events; i++) {
+            perf_event_desc_t *fdx = &fds[i];
+
+            if (!fdx->buf || fdx->buf == MAP_FAILED)
+                continue;
+
+            struct perf_event_mmap_page *hdr =
+                static_cast<struct perf_event_mmap_page*>(fdx->buf);
+
+            uint64_t head = hdr->data_head;
+            __sync_synchronize(); // read data_head before the sample data
+
+            while (head - hdr->data_tail >= sizeof(ehdr)) {
+                if (perf_read_buffer(fdx, &ehdr, sizeof(ehdr)))
+                    break;
+
+                if (ehdr.type == PERF_RECORD_SAMPLE) {
+                    if (perf_read_sample(fdx, 1, 0, &ehdr, &sample, stderr)) {
+                        Log(1).stream() << "libpfm: cannot read sample" << std::endl;
+                        perf_skip_buffer(fdx, head - hdr->data_tail);
+                        break;
+                    }
+
+                    sample_handler(i);
+                } else {
+                    thread_states[thread_id].bad_samples++;
+                    perf_skip_buffer(fdx, ehdr.size - sizeof(ehdr));
+                }
+            }
+        }
+    }
+
+    static void drain_update_cb(Caliper*, const Attribute&, const Variant&) {
+        drain_sample_buffers();
+    }
+
+    static bool ensure_thread_setup(Caliper* c);
+
+    static void setup_update_cb(Caliper* c, const Attribute&, const Variant&) {
+        ensure_thread_setup(c);
+    }
+
+    static void drain_flush_cb(Caliper*, const SnapshotRecord*) {
+        drain_sample_buffers();
+    }
+
     static void setup_process_events(Caliper *c) {
-        int check_num_events = 0;
-        perf_event_desc_t *check_fds = NULL;
-        int ret = perf_setup_list_events(events_string.c_str(), &check_fds, &check_num_events);
+        int ret = perf_setup_list_events(events_string.c_str(), &process_fds, &process_num_events);
 
-        if (ret || !check_num_events)
+        if (ret || !process_num_events)
             Log(0).stream() << "libpfm: WARNING: invalid event(s) specified!" << std::endl;
         
-        if (num_events > MAX_EVENTS)
+        if (process_num_events > MAX_EVENTS) {
             Log(0).stream() << "libpfm: WARNING: too many events specified for libpfm service! Maximum is " << MAX_EVENTS << std::endl;
+            process_num_events = MAX_EVENTS;
+        }
+
+        for(int i=0; i < process_num_events; i++) {
+            // Set up the perf_event attributes shared by all threads
+            process_fds[i].hw.disabled = 1;
+            process_fds[i].hw.read_format = record_counters ? PERF_FORMAT_SCALE : 0;
 
-        for(int i=0; i < check_num_events; i++) {
             if (enable_sampling) {
+                process_fds[i].hw.wakeup_events = 1;
+                process_fds[i].hw.sample_type = sample_attributes;
+                process_fds[i].hw.sample_period = sampling_period_list[i]; 
+                process_fds[i].hw.precise_ip = precise_ip_list[i];
+                process_fds[i].hw.config1 = config1_list[i];
+
                 // Store Caliper nodes for each event name
                 event_name_nodes.push_back(
                         c->make_tree_entry(libpfm_event_name_attr,
-                                           Variant(CALI_TYPE_STRING, check_fds[i].name, strlen(check_fds[i].name))));
+                                           Variant(CALI_TYPE_STRING, process_fds[i].name, strlen(process_fds[i].name))));
             }
         }
     }
 
-    static void setup_thread_events(Caliper *c) {
+    /// Copy the process-wide event list for a new thread
+    static perf_event_desc_t* copy_process_events() {
+        perf_event_desc_t *thread_fds =
+            static_cast<perf_event_desc_t*>(calloc(process_num_events + 1, sizeof(perf_event_desc_t)));
+
+        if (!thread_fds)
+            return NULL;
+
+        memcpy(thread_fds, process_fds, process_num_events * sizeof(perf_event_desc_t));
+
+        for (int i = 0; i < process_num_events; ++i) {
+            thread_fds[i].name = process_fds[i].name ? strdup(process_fds[i].name) : NULL;
+            thread_fds[i].fstr = process_fds[i].fstr ? strdup(process_fds[i].fstr) : NULL;
+        }
+
+        return thread_fds;
+    }
+
+    static bool setup_thread_events() {
         struct thread_state *ts;
         struct f_owner_ex fown_ex;
         int ret, fd, flags, i;
@@ -304,51 +414,46 @@ namespace {
 
         // Get unique thread id
         id_mutex.lock();
+        if (num_threads >= MAX_THR) {
+            id_mutex.unlock();
+            Log(0).stream() << "libpfm: too many threads, maximum is " << MAX_THR << std::endl;
+            return false;
+        }
         thread_id = num_threads++;
         id_mutex.unlock();
 
+        // Copy the pre-encoded perf_events
+        fds = copy_process_events();
+        num_events = fds ? process_num_events : 0;
+
         // Set thread state
         ts = &thread_states[thread_id];
         ts->id = thread_id;
         ts->tid = gettid();
         ts->fds = fds;
 
-        // Get perf_event from string
-        fds = NULL;
-        num_events = 0;
-        perf_setup_list_events(events_string.c_str(), &fds, &num_events);
-
         for(i=0; i < num_events; i++) {
-
-            // Set up perf_event
-            fds[i].hw.disabled = 1;
-            fds[i].hw.read_format = record_counters ? PERF_FORMAT_SCALE : 0;
-
-            if (enable_sampling) {
-                fds[i].hw.wakeup_events = 1;
-                fds[i].hw.sample_type = sample_attributes;
-                fds[i].hw.sample_period = sampling_period_list[i]; 
-                fds[i].hw.precise_ip = precise_ip_list[i];
-                fds[i].hw.config1 = config1_list[i];
-            }
-
             fds[i].fd = fd = perf_event_open(&fds[i].hw, ts->tid, -1, -1, 0);
             if (fd == -1)
                 Log(0).stream() << "libpfm: cannot attach event " << fds[i].name << std::endl;
 
-            // Set up perf_event file descriptor to signal this thread
-            flags = fcntl(fd, F_GETFL, 0);
-            if (fcntl(fd, F_SETFL, flags | O_ASYNC) < 0)
-                Log(0).stream() << "libpfm: fcntl SETFL failed" << std::endl;
-
-            fown_ex.type = F_OWNER_TID;
-            fown_ex.pid = ts->tid;
-            ret = fcntl(fd, F_SETOWN_EX, (unsigned long) &fown_ex);
-            if (ret)
-                Log(0).stream() << "libpfm: fcntl SETOWN failed" << std::endl;
-
-            if (fcntl(fd, F_SETSIG, signum) < 0)
-                Log(0).stream() << "libpfm: fcntl SETSIG failed" << std::endl;
+            // Set up perf_event file descriptor to signal this thread.
+            // In batch mode, samples stay in the ring buffer until the next
+            // region boundary.
+            if (!batch_samples) {
+                flags = fcntl(fd, F_GETFL, 0);
+                if (fcntl(fd, F_SETFL, flags | O_ASYNC) < 0)
+                    Log(0).stream() << "libpfm: fcntl SETFL failed" << std::endl;
+
+                fown_ex.type = F_OWNER_TID;
+                fown_ex.pid = ts->tid;
+                ret = fcntl(fd, F_SETOWN_EX, (unsigned long) &fown_ex);
+                if (ret)
+                    Log(0).stream() << "libpfm: fcntl SETOWN failed" << std::endl;
+
+                if (fcntl(fd, F_SETSIG, signum) < 0)
+                    Log(0).stream() << "libpfm: fcntl SETSIG failed" << std::endl;
+            }
 
             fds[i].buf = mmap(NULL, (buffer_pages + 1) * pgsz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
             if (fds[i].buf == MAP_FAILED)
@@ -356,6 +461,8 @@ namespace {
 
             fds[i].pgmsk = (buffer_pages * pgsz) - 1;
         }
+
+        return fds != NULL;
     }
 
     static int setup_process_signals() {
@@ -399,7 +506,7 @@ namespace {
     }
 
     static int begin_thread_sampling() {
-        int i, ret;
+        int i, ret = 0;
         
         for (i=0; i<num_events; i++) {
             ret = ioctl(fds[i].fd, PERF_EVENT_IOC_RESET, 0);
@@ -411,13 +518,17 @@ namespace {
 
             if (ret == -1)
                 Log(0).stream() << "libpfm: cannot enable event " << fds[i].name << std::endl;
+
+            last_counter_values[i] = 0;
+            last_time_enabled[i]   = 0;
+            last_time_running[i]   = 0;
         }
 
         return ret;
     }
 
     static int end_thread_sampling() {
-        int i, ret;
+        int i, ret = 0;
         size_t pgsz = sysconf(_SC_PAGESIZE);
 
         for (i=0; i<num_events; i++) {
@@ -426,13 +537,14 @@ namespace {
             if (ret)
                 Log(0).stream() <<  "libpfm: cannot disable event " << fds[i].name << std::endl;
 
-            munmap(fds[i].buf, pgsz);
+            munmap(fds[i].buf, (buffer_pages + 1) * pgsz);
             close(fds[i].fd);
         }
 
         perf_free_fds(fds, num_events);
 
-        pfm_terminate();
+        fds = NULL;
+        num_events = 0;
 
         return ret;
     }
@@ -442,6 +554,14 @@ namespace {
 
         enable_sampling = config.get("enable_sampling").to_bool();
         record_counters = config.get("record_counters").to_bool();
+        use_rdpmc       = config.get("rdpmc").to_bool();
+        batch_samples   = config.get("batch_samples").to_bool();
+        buffer_pages    = config.get("buffer_pages").to_uint();
+
+        if (buffer_pages < 1 || (buffer_pages & (buffer_pages - 1))) {
+            Log(0).stream() << "libpfm: buffer_pages must be a power of two, using 1" << std::endl;
+            buffer_pages = 1;
+        }
 
         events_string = config.get("events").to_string();
         event_list    = StringConverter(events_string).to_stringlist();
@@ -615,6 +735,35 @@ namespace {
         }
     }
 
+    /// Open this thread's perf_events on first use. Thread setup is
+    /// not async-signal-safe, so it's skipped in signal handlers.
+    static bool ensure_thread_setup(Caliper* c) {
+        if (thread_active)
+            return true;
+        if (c->is_signal())
+            return false;
+
+        thread_active = setup_thread_events();
+
+        if (thread_active) {
+            setup_thread_pointers();
+            begin_thread_sampling();
+        }
+
+        return thread_active;
+    }
+
+    static void finish_thread_sampling() {
+        if (!thread_active)
+            return;
+
+        if (enable_sampling && batch_samples)
+            drain_sample_buffers();
+
+        end_thread_sampling();
+        thread_active = false;
+    }
+
     struct read_format {
         uint64_t value;     /* The value of the event */
         uint64_t time_enabled;  /* if PERF_FORMAT_TOTAL_TIME_ENABLED */
@@ -622,7 +771,89 @@ namespace {
         //uint64_t id;        /* if PERF_FORMAT_ID */
     };
 
+    /// Read the counter for \a fd in user space through the perf_event
+    /// mmap page. Returns false if the kernel doesn't permit it or the
+    /// event isn't currently scheduled on a hardware counter.
+    static bool rdpmc_read(const perf_event_desc_t& fd, uint64_t& value) {
+#ifdef CALI_LIBPFM_HAVE_RDPMC
+        if (!fd.buf || fd.buf == MAP_FAILED)
+            return false;
+
+        volatile struct perf_event_mmap_page* pc =
+            static_cast<volatile struct perf_event_mmap_page*>(fd.buf);
+
+        uint32_t seq;
+        uint64_t count;
+
+        // Retry if the kernel updated the page while we read it
+        do {
+            seq = pc->lock;
+            asm volatile("" ::: "memory");
+
+            uint32_t idx = pc->index;
+
+            if (!pc->cap_user_rdpmc || idx == 0)
+                return false;
+
+            unsigned width = pc->pmc_width;
+            int64_t  pmc   = static_cast<int64_t>(__rdpmc(idx - 1));
+
+            // sign-extend the pmc_width-bit counter value
+            pmc <<= 64 - width;
+            pmc >>= 64 - width;
+
+            count = pc->offset + pmc;
+
+            asm volatile("" ::: "memory");
+        } while (pc->lock != seq);
+
+        value = count;
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /// Record counter increases since the last snapshot without resetting
+    /// the counters, using rdpmc where possible
+    static void rdpmc_snapshot(SnapshotRecord* snapshot) {
+        Variant data[MAX_EVENTS];
+
+        for (int i = 0; i < num_events; ++i) {
+            uint64_t value;
+
+            if (rdpmc_read(fds[i], value)) {
+                ++num_rdpmc_reads; // not locked, doesn't matter too much if it's slightly off
+            } else {
+                struct read_format counter_read;
+
+                if (read(fds[i].fd, &counter_read, sizeof(struct read_format)) < static_cast<ssize_t>(sizeof(struct read_format))) {
+                    Log(1).stream() << "libpfm: failed to read counter for event " << fds[i].name << std::endl;
+                    value = last_counter_values[i];
+                } else {
+                    value = counter_read.value;
+                }
+
+                ++num_syscall_reads;
+            }
+
+            data[i] = Variant(value - last_counter_values[i]);
+            last_counter_values[i] = value;
+        }
+
+        snapshot->append(num_events, libpfm_event_counter_attr_ids.data(), data);
+    }
+
     void snapshot_cb(Caliper* c, int scope, const SnapshotRecord*, SnapshotRecord* snapshot) {
+        if (!ensure_thread_setup(c))
+            return;
+
+        if (use_rdpmc) {
+            rdpmc_snapshot(snapshot);
+            return;
+        }
+
         int i, ret;
         Variant data[MAX_EVENTS];
 
@@ -642,46 +873,51 @@ namespace {
         }
 
         for (i=0; i<num_events; i++) {
-            // FIXME: everyone does this but it does not make sense...
-            //      : 1. this calculation scales down rather than interpolate for missing values
-            //      : 2. time_enabled and time_running are not reset when counters are reset
-            // double raw     = (double)counter_reads[i].value;
-            // double enabled = (double)counter_reads[i].time_enabled;
-            // double running = (double)counter_reads[i].time_running;
-            // uint64_t scaled = (uint64_t)((enabled < running) ? (raw * enabled / running) : raw);
-            data[i] = Variant(counter_reads[i].value);
+            // With more events than hardware counters, the kernel
+            // multiplexes them. Extrapolate the count to the whole interval
+            // using the enabled and running time increases since the last
+            // snapshot (the reset above doesn't reset the times).
+            uint64_t enabled = counter_reads[i].time_enabled - last_time_enabled[i];
+            uint64_t running = counter_reads[i].time_running - last_time_running[i];
+            uint64_t value   = counter_reads[i].value;
+
+            if (running > 0 && running < enabled)
+                value = static_cast<uint64_t>(static_cast<double>(value) * enabled / running);
+
+            last_time_enabled[i] = counter_reads[i].time_enabled;
+            last_time_running[i] = counter_reads[i].time_running;
+
+            data[i] = Variant(value);
         }
 
         snapshot->append(num_events, libpfm_event_counter_attr_ids.data(), data);
     }
 
     void post_init_cb(Caliper* c) {
-        // Run on master thread initialization
+        // Encode the events once; threads open them on first use
         setup_process_events(c);
-        setup_thread_events(c);
-        setup_thread_pointers();
-        begin_thread_sampling();
-    }
-
-    void create_scope_cb(Caliper* c, cali_context_scope_t scope) {
-        if (scope == CALI_SCOPE_THREAD) {
-            setup_thread_events(c);
-            setup_thread_pointers();
-            begin_thread_sampling();
-        }
     }
 
     void release_scope_cb(Caliper* c, cali_context_scope_t scope) {
-        if (scope == CALI_SCOPE_THREAD) {
-            end_thread_sampling();
-        }
+        if (scope == CALI_SCOPE_THREAD)
+            finish_thread_sampling();
     }
 
     void finish_cb(Caliper* c) {
-        end_thread_sampling();
+        finish_thread_sampling();
+
+        if (process_fds)
+            perf_free_fds(process_fds, process_num_events);
+
+        process_fds = NULL;
+        process_num_events = 0;
 
         pfm_terminate();
 
+        if (record_counters && use_rdpmc)
+            Log(1).stream() << "libpfm: " << num_rdpmc_reads << " counter reads with rdpmc, "
+                            << num_syscall_reads << " with read()" << std::endl;
+
         if (enable_sampling) {
             Log(1).stream() << "libpfm: thread sampling stats:" << std::endl;
             for (int i=0; i<num_threads; i++) {
@@ -785,13 +1021,29 @@ namespace {
 
         setup_process_signals();
         
-        c->events().create_scope_evt.connect(create_scope_cb);
+        c->events().release_scope_evt.connect(release_scope_cb);
         c->events().post_init_evt.connect(post_init_cb);
         c->events().finish_evt.connect(finish_cb);
 
         if (enable_sampling)
             c->events().postprocess_snapshot.connect(postprocess_snapshot_cb);
 
+        if (enable_sampling && batch_samples) {
+            // Attribute buffered samples to the context that was active
+            // when they were taken, i.e. before each update
+            c->events().pre_begin_evt.connect(drain_update_cb);
+            c->events().pre_set_evt.connect(drain_update_cb);
+            c->events().pre_end_evt.connect(drain_update_cb);
+            c->events().pre_flush_evt.connect(drain_flush_cb);
+        }
+
+        if (enable_sampling) {
+            // Start sampling a thread at its first annotation update
+            // even if it doesn't take snapshots
+            c->events().post_begin_evt.connect(setup_update_cb);
+            c->events().post_set_evt.connect(setup_update_cb);
+        }
+
         if (record_counters)
             c->events().snapshot.connect(snapshot_cb);
 
@@ -1,5 +1,8 @@
 /// \file  NetOut.cpp
-/// \brief Caliper text log service
+/// \brief Caliper network output service: posts formatted snapshots to
+///   a URL. Snapshots are batched and posted by a background thread.
+
+#include "caliper/caliper-config.h"
 
 #include "caliper/CaliperService.h"
 
@@ -14,7 +17,13 @@
 
 #include "caliper/common/util/split.hpp"
 
+#ifdef CALIPER_HAVE_ZLIB
+#include "common/util/gzip_util.h"
+#endif
+
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <functional>
 #include <iterator>
@@ -23,6 +32,7 @@
 #include <mutex>
 #include <string>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 using namespace cali;
@@ -51,6 +61,37 @@ const ConfigSet::Entry   configdata[] = {
     { "posturl" , CALI_TYPE_STRING, "https://lc.llnl.gov",
       "URL to issue requests to"
     },
+    { "batch_size", CALI_TYPE_UINT, "64",
+      "Post a batch when this many KiB of output are pending",
+      "Post a batch when this many KiB of formatted snapshots are pending"
+    },
+    { "batch_time", CALI_TYPE_UINT, "1000",
+      "Post pending output at least every this many milliseconds",
+      "Post pending output at least every this many milliseconds"
+    },
+    { "queue_size", CALI_TYPE_UINT, "4096",
+      "Maximum amount of pending output in KiB",
+      "Maximum amount of pending output in KiB. Snapshots that don't fit are dropped."
+    },
+    { "backpressure", CALI_TYPE_STRING, "drop",
+      "What to do when output is pending faster than it can be posted",
+      "What to do when output is pending faster than it can be posted. Either one of\n"
+      "   drop:   Drop snapshots while the queue is full\n"
+      "   sample: Keep only every sample_rate'th snapshot while the queue\n"
+      "           is more than half full, drop snapshots when it is full"
+    },
+    { "sample_rate", CALI_TYPE_UINT, "10",
+      "Keep every n'th snapshot under backpressure in sample mode",
+      "Keep every n'th snapshot under backpressure in sample mode"
+    },
+    { "compress", CALI_TYPE_BOOL, "true",
+      "Compress posted data with gzip",
+      "Compress posted data with gzip (Content-Encoding: gzip). Requires zlib."
+    },
+    { "timeout", CALI_TYPE_UINT, "10",
+      "Timeout for a post request in seconds",
+      "Timeout for a post request in seconds"
+    },
     ConfigSet::Terminator
 };
 
@@ -62,12 +103,13 @@ class NetOutService
     typedef std::map<cali_id_t, Attribute> TriggerAttributeMap;
     TriggerAttributeMap         trigger_attr_map;
 
-    CURL*                        m_curl;
+    CURL*                       m_curl;
+    CURLM*                      m_multi;
+    struct curl_slist*          m_headers;
 
     std::vector<std::string>    trigger_attr_names;
 
     SnapshotTextFormatter       formatter;
-    std::stringstream           string_output;
     enum class Stream { None, File, StdErr, StdOut };
 
     Stream                      m_stream;
@@ -76,6 +118,30 @@ class NetOutService
     Attribute                   set_event_attr;   
     Attribute                   end_event_attr;
 
+    // --- the post queue
+
+    std::mutex                  m_queue_lock;
+    std::condition_variable     m_queue_cv;
+
+    std::string                 m_pending;      ///< Formatted snapshots waiting to be posted
+    std::size_t                 m_batch_size;
+    std::chrono::milliseconds   m_batch_time;
+    std::size_t                 m_queue_size;
+    bool                        m_sample;
+    unsigned                    m_sample_rate;
+    bool                        m_compress;
+    bool                        m_stop;
+
+    unsigned long long          m_num_queued;
+    unsigned long long          m_num_dropped;
+    unsigned long long          m_num_sampled;
+    unsigned long long          m_sample_count;
+    unsigned long long          m_num_posts;
+    unsigned long long          m_num_failed;
+    unsigned long long          m_bytes_posted;
+
+    std::thread                 m_thread;
+
     static unique_ptr<NetOutService> 
                                 s_netout;
 
@@ -183,37 +249,199 @@ class NetOutService
         for (size_t n = 0; n < size.n_immediate; ++n)
             entrylist.push_back(Entry(data.immediate_attr[n], data.immediate_data[n]));
 
-        // DZPOLIA EDITING HERE
-        formatter.print(string_output, c, entrylist) << std::endl;
-        std::string outThis = string_output.str();
-        curl_easy_setopt(m_curl,CURLOPT_URL,m_output_url.c_str());
-        curl_easy_setopt(m_curl,CURLOPT_USERAGENT,"libcurl-agent/1.0");
-        curl_easy_setopt(s_netout->getCurl(),CURLOPT_POSTFIELDS,outThis.c_str());
-        curl_easy_setopt(s_netout->getCurl(),CURLOPT_POSTFIELDSIZE,outThis.length());
-        CURLcode result = curl_easy_perform(m_curl);
-        if(result != CURLE_OK) {
-            fprintf(stderr, "curl_easy_perform() failed: %s\n",
-            curl_easy_strerror(result));
+        std::ostringstream os;
+        formatter.print(os, *c, entrylist) << '\n';
+
+        enqueue(os.str());
+    }
+
+    /// \brief Add a formatted snapshot to the post queue. Never blocks on
+    ///   the network: under backpressure, the snapshot is dropped.
+    void enqueue(const std::string& str) {
+        std::lock_guard<std::mutex>
+            g(m_queue_lock);
+
+        if (m_pending.size() + str.size() > m_queue_size) {
+            ++m_num_dropped;
+            return;
         }
-        else{
-            fprintf(stderr, "curl_easy_perform() success\n");
+        if (m_sample && m_pending.size() > m_queue_size / 2 && (m_sample_count++ % m_sample_rate) != 0) {
+            ++m_num_sampled;
+            return;
         }
-        
+
+        m_pending.append(str);
+        ++m_num_queued;
+
+        if (m_pending.size() >= m_batch_size)
+            m_queue_cv.notify_one();
+    }
+
+    /// \brief Post \a batch. Runs on the background thread.
+    void post(const std::string& batch) {
+        const char* data = batch.data();
+        std::size_t len  = batch.size();
+
+        struct curl_slist* headers = m_headers;
+
+#ifdef CALIPER_HAVE_ZLIB
+        std::vector<char> gz;
+        struct curl_slist* gz_headers = nullptr;
+
+        if (m_compress && util::gzip_compress_member(batch.data(), batch.size(), gz)) {
+            data = gz.data();
+            len  = gz.size();
+
+            for (struct curl_slist* h = m_headers; h; h = h->next)
+                gz_headers = curl_slist_append(gz_headers, h->data);
+
+            headers = gz_headers = curl_slist_append(gz_headers, "Content-Encoding: gzip");
+        }
+#endif
+
+        curl_easy_setopt(m_curl, CURLOPT_HTTPHEADER,    headers);
+        curl_easy_setopt(m_curl, CURLOPT_POSTFIELDS,    data);
+        curl_easy_setopt(m_curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(len));
+
+        // the multi handle keeps connections open between posts
+
+        CURLcode result = CURLE_OK;
+        int      running = 1;
+
+        curl_multi_add_handle(m_multi, m_curl);
+
+        while (running) {
+            if (curl_multi_perform(m_multi, &running) != CURLM_OK)
+                break;
+            if (running)
+                curl_multi_wait(m_multi, nullptr, 0, 1000, nullptr);
+        }
+
+        int       num_msgs = 0;
+        CURLMsg*  msg      = nullptr;
+
+        while ((msg = curl_multi_info_read(m_multi, &num_msgs)))
+            if (msg->msg == CURLMSG_DONE && msg->easy_handle == m_curl)
+                result = msg->data.result;
+
+        curl_multi_remove_handle(m_multi, m_curl);
+
+#ifdef CALIPER_HAVE_ZLIB
+        curl_easy_setopt(m_curl, CURLOPT_HTTPHEADER, m_headers);
+        curl_slist_free_all(gz_headers);
+#endif
+
+        if (result != CURLE_OK) {
+            if (m_num_failed++ == 0)
+                Log(1).stream() << "NetOut: post to " << m_output_url << " failed: "
+                                << curl_easy_strerror(result) << std::endl;
+        } else {
+            ++m_num_posts;
+            m_bytes_posted += len;
+        }
+    }
+
+    /// \brief The background thread: post pending output when a batch is
+    ///   full or the batch time has passed
+    void post_loop() {
+        std::unique_lock<std::mutex>
+            lk(m_queue_lock);
+
+        while (true) {
+            m_queue_cv.wait_for(lk, m_batch_time, [this](){
+                    return m_stop || m_pending.size() >= m_batch_size;
+                });
+
+            if (m_pending.empty()) {
+                if (m_stop)
+                    break;
+
+                continue;
+            }
+
+            std::string batch;
+            batch.swap(m_pending);
+
+            lk.unlock();
+            post(batch);
+            lk.lock();
+        }
+    }
+
+    void finish_cb(Caliper* c) {
+        {
+            std::lock_guard<std::mutex>
+                g(m_queue_lock);
+
+            m_stop = true;
+        }
+
+        m_queue_cv.notify_one();
+
+        if (m_thread.joinable())
+            m_thread.join();
+
+        Log(1).stream() << "NetOut: Queued " << m_num_queued << " snapshots, posted "
+                        << m_num_posts << " requests (" << m_bytes_posted << " bytes), "
+                        << m_num_failed << " requests failed, "
+                        << m_num_dropped << " snapshots dropped, "
+                        << m_num_sampled << " sampled out." << std::endl;
+
+        if (m_multi)
+            curl_multi_cleanup(m_multi);
+        if (m_curl)
+            curl_easy_cleanup(m_curl);
+        if (m_headers)
+            curl_slist_free_all(m_headers);
+
+        m_multi   = nullptr;
+        m_curl    = nullptr;
+        m_headers = nullptr;
     }
 
     void post_init_cb(Caliper* c) {
         std::string formatstr = config.get("formatstring").to_string();
         curl_global_init(CURL_GLOBAL_ALL); 
         m_output_url = config.get("posturl").to_string();
-        // DZPOLIA OPTIONS HERE
-        m_curl = curl_easy_init();
+
+        m_curl    = curl_easy_init();
+        m_multi   = curl_multi_init();
+        m_headers = curl_slist_append(nullptr, "Content-Type: text/plain");
+
+        curl_easy_setopt(m_curl, CURLOPT_URL,        m_output_url.c_str());
+        curl_easy_setopt(m_curl, CURLOPT_USERAGENT,  "libcurl-agent/1.0");
+        curl_easy_setopt(m_curl, CURLOPT_HTTPHEADER, m_headers);
+        curl_easy_setopt(m_curl, CURLOPT_TIMEOUT,    static_cast<long>(config.get("timeout").to_uint()));
+        curl_easy_setopt(m_curl, CURLOPT_NOSIGNAL,   1L);
+
+        m_batch_size  = config.get("batch_size").to_uint() * 1024;
+        m_batch_time  = std::chrono::milliseconds(config.get("batch_time").to_uint());
+        m_queue_size  = std::max<std::size_t>(config.get("queue_size").to_uint() * 1024, m_batch_size);
+        m_sample_rate = std::max<unsigned>(config.get("sample_rate").to_uint(), 1);
+        m_compress    = config.get("compress").to_bool();
+
+        std::string backpressure = config.get("backpressure").to_string();
+
+        if (backpressure == "sample")
+            m_sample = true;
+        else if (backpressure != "drop")
+            Log(0).stream() << "NetOut: unknown backpressure mode \"" << backpressure
+                            << "\", using \"drop\"" << std::endl;
+
+#ifndef CALIPER_HAVE_ZLIB
+        if (m_compress)
+            Log(1).stream() << "NetOut: zlib support is not available, posting uncompressed data" << std::endl;
+#endif
+
+        m_thread = std::thread(&NetOutService::post_loop, this);
+
         if (formatstr.size() == 0)
             formatstr = create_default_formatstring(trigger_attr_names);
 
         formatter.reset(formatstr);
 
-        set_event_attr      = c->get_attribute("cali.snapshot.event.set");
-        end_event_attr      = c->get_attribute("cali.snapshot.event.end");
+        set_event_attr      = c->get_attribute("cali.event.set");
+        end_event_attr      = c->get_attribute("cali.event.end");
 
         if (end_event_attr      == Attribute::invalid ||
             set_event_attr      == Attribute::invalid)
@@ -234,13 +462,32 @@ class NetOutService
     static void s_post_init_cb(Caliper* c) { 
         s_netout->post_init_cb(c);
     }
-    decltype(m_curl) getCurl(){
-        return m_curl;
+
+    static void s_finish_cb(Caliper* c) {
+        s_netout->finish_cb(c);
     }
+
     NetOutService(Caliper* c)
         : config(RuntimeConfig::init("netout", configdata)),
+          m_curl(nullptr),
+          m_multi(nullptr),
+          m_headers(nullptr),
           set_event_attr(Attribute::invalid),
-          end_event_attr(Attribute::invalid)
+          end_event_attr(Attribute::invalid),
+          m_batch_size(64 * 1024),
+          m_batch_time(1000),
+          m_queue_size(4096 * 1024),
+          m_sample(false),
+          m_sample_rate(10),
+          m_compress(false),
+          m_stop(false),
+          m_num_queued(0),
+          m_num_dropped(0),
+          m_num_sampled(0),
+          m_sample_count(0),
+          m_num_posts(0),
+          m_num_failed(0),
+          m_bytes_posted(0)
         { 
             init_stream();
 
@@ -250,8 +497,9 @@ class NetOutService
             c->events().create_attr_evt.connect(&NetOutService::s_create_attribute_cb);
             c->events().post_init_evt.connect(&NetOutService::s_post_init_cb);
             c->events().process_snapshot.connect(&NetOutService::s_process_snapshot_cb);
+            c->events().finish_evt.connect(&NetOutService::s_finish_cb);
 
-            Log(1).stream() << "Registered text log service" << std::endl;
+            Log(1).stream() << "Registered netout service" << std::endl;
         }
 
 public:
@@ -40,7 +40,6 @@
 
 #include <atomic>
 #include <cassert>
-#include <map>
 #include <mutex>
 
 namespace cali
@@ -54,8 +53,59 @@ class NVProfBinding : public AnnotationBinding
     Attribute             m_color_attr;
     std::atomic<int>      m_color_id;
 
-    std::map<cali_id_t, nvtxDomainHandle_t> m_domain_map;
-    std::mutex            m_domain_mutex;
+    struct AttributeInfo {
+        nvtxDomainHandle_t domain; // nullptr for nested attributes
+        uint32_t           color;
+    };
+
+    struct ValueInfo {
+        const char*        ascii;
+        nvtxStringHandle_t registered;
+    };
+
+    // Domains must be unique per process, so the per-thread caches
+    // fall back to the shared one, which is accessed under a lock
+
+    HandleCache<AttributeInfo> m_shared_attr_info;
+    std::mutex                 m_shared_attr_info_lock;
+
+    static thread_local HandleCache<AttributeInfo> s_attr_info;
+    static thread_local HandleCache<ValueInfo>     s_value_info;
+
+    AttributeInfo get_attribute_info(const Attribute& attr) {
+        return s_attr_info.attribute_handle(attr, [this](const Attribute& a){
+                std::lock_guard<std::mutex>
+                    g(m_shared_attr_info_lock);
+
+                return m_shared_attr_info.attribute_handle(a, [this](const Attribute& sa){
+                        return make_attribute_info(sa);
+                    });
+            });
+    }
+
+    AttributeInfo make_attribute_info(const Attribute& attr) {
+        Variant v_color = attr.get(m_color_attr);
+
+        // For properly nested attributes, just use default push/pop.
+        // For other attributes, create a domain.
+
+        AttributeInfo info = {
+            attr.is_nested() ? nullptr : nvtxDomainCreateA(attr.name_c_str()),
+            v_color.empty() ? s_colors[0] : static_cast<uint32_t>(v_color.to_uint())
+        };
+
+        return info;
+    }
+
+    static ValueInfo get_value_info(const Attribute& attr, const Variant& value, nvtxDomainHandle_t domain) {
+        return s_value_info.value_handle(attr, value, [domain](const Attribute&, const char* str){
+                ValueInfo info = {
+                    str, domain ? nvtxDomainRegisterStringA(domain, str) : nullptr
+                };
+
+                return info;
+            });
+    }
 
 public:
 
@@ -77,73 +127,42 @@ public:
     }
 
     void on_begin(Caliper*, const Attribute &attr, const Variant& value) {
-        Variant  v_color = attr.get(m_color_attr);
-        uint32_t color   =
-            v_color.empty() ? s_colors[0] : static_cast<uint32_t>(v_color.to_uint());
+        AttributeInfo a_info = get_attribute_info(attr);
+        ValueInfo     v_info = get_value_info(attr, value, a_info.domain);
 
         nvtxEventAttributes_t eventAttrib = { 0 };
 
         eventAttrib.version       = NVTX_VERSION;
         eventAttrib.size          = NVTX_EVENT_ATTRIB_STRUCT_SIZE;
         eventAttrib.colorType     = NVTX_COLOR_ARGB;
-        eventAttrib.color         = color;
-        eventAttrib.messageType   = NVTX_MESSAGE_TYPE_ASCII;
-        eventAttrib.message.ascii =
-            (value.type() == CALI_TYPE_STRING ? static_cast<const char*>(value.data()) : value.to_string().c_str());
+        eventAttrib.color         = a_info.color;
 
-        // For properly nested attributes, just use default push/pop.
-        // For other attributes, create a domain.
+        if (a_info.domain) {
+            eventAttrib.messageType        = NVTX_MESSAGE_TYPE_REGISTERED;
+            eventAttrib.message.registered = v_info.registered;
 
-        if (attr.is_nested()) {
-            nvtxRangePushEx(&eventAttrib);
+            nvtxDomainRangePushEx(a_info.domain, &eventAttrib);
         } else {
-            nvtxDomainHandle_t domain;
-
-            {
-                std::lock_guard<std::mutex>
-                    g(m_domain_mutex);
+            eventAttrib.messageType   = NVTX_MESSAGE_TYPE_ASCII;
+            eventAttrib.message.ascii = v_info.ascii;
 
-                auto it = m_domain_map.find(attr.id());
-
-                if (it == m_domain_map.end()) {
-                    domain = nvtxDomainCreateA(attr.name().c_str());
-                    m_domain_map.insert(std::make_pair(attr.id(), domain));
-                } else {
-                    domain = it->second;
-                }
-            }
-
-            nvtxDomainRangePushEx(domain, &eventAttrib);
+            nvtxRangePushEx(&eventAttrib);
         }
     }
 
     void on_end(Caliper*, const Attribute& attr, const Variant& value) {
-        if (attr.is_nested()) {
-            nvtxRangePop();
-        } else {
-            nvtxDomainHandle_t domain;
-
-            {
-                std::lock_guard<std::mutex>
-                    g(m_domain_mutex);
-
-                auto it = m_domain_map.find(attr.id());
-
-                if (it == m_domain_map.end()) {
-                    Log(0).stream() << "nvvp: on_end(): error: domain for attribute "
-                                    << attr.name()
-                                    << " not found!" << std::endl;
-                    return;
-                }
+        AttributeInfo a_info = get_attribute_info(attr);
 
-                domain = it->second;
-            }
-
-            nvtxDomainRangePop(domain);
-        }
+        if (a_info.domain)
+            nvtxDomainRangePop(a_info.domain);
+        else
+            nvtxRangePop();
     }
 };
 
+thread_local AnnotationBinding::HandleCache<NVProfBinding::AttributeInfo> NVProfBinding::s_attr_info;
+thread_local AnnotationBinding::HandleCache<NVProfBinding::ValueInfo>     NVProfBinding::s_value_info;
+
 const uint32_t NVProfBinding::s_colors[] = {
     0x0000cc00, 0x000000cc, 0x00cccc00, 0x00cc00cc,
     0x0000cccc, 0x00cc0000, 0x00cccccc
@@ -36,10 +36,12 @@
 #include "caliper/CaliperService.h"
 
 #include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
 
 #include "caliper/common/Log.h"
 #include "caliper/common/RuntimeConfig.h"
 
+#include <chrono>
 #include <map>
 #include <mutex>
 
@@ -70,6 +72,12 @@ const ConfigSet::Entry configdata[] = {
       "Capture OpenMP events (enter/exit parallel regions, barriers, etc.)",
       "Capture OpenMP events (enter/exit parallel regions, barriers, etc.)"
     },
+    { "aggregate_events", CALI_TYPE_BOOL, "false",
+      "Accumulate OpenMP event metrics per thread instead of capturing each event",
+      "Accumulate barrier wait, idle, and implicit task time and task counts per thread.\n"
+      "  Metrics are emitted at the end of the enclosing Caliper region, at the end of\n"
+      "  a worker thread's implicit task, or at flush, instead of one snapshot per event."
+    },
     ConfigSet::Terminator
 };
 
@@ -85,6 +93,29 @@ map<ompt_thread_id_t, Caliper::Scope*> thread_env; ///< Thread ID -> Environment
 
 map<ompt_state_t, string>        runtime_states;
 
+Attribute                        barrier_time_attr { Attribute::invalid };
+Attribute                        idle_time_attr    { Attribute::invalid };
+Attribute                        itask_time_attr   { Attribute::invalid };
+Attribute                        task_count_attr   { Attribute::invalid };
+
+/// Per-thread OpenMP event metrics for the aggregate_events mode.
+/// Times are in nanoseconds.
+struct OmptMetrics {
+    uint64_t barrier_time   { 0 };
+    uint64_t idle_time      { 0 };
+    uint64_t itask_time     { 0 };
+    uint64_t num_tasks      { 0 };
+
+    uint64_t barrier_start  { 0 };
+    uint64_t idle_start     { 0 };
+    uint64_t itask_start    { 0 };
+
+    bool     is_worker      { false };
+    bool     pending        { false };
+};
+
+thread_local OmptMetrics         thread_metrics;
+
 ConfigSet                        config;
 
 
@@ -115,6 +146,113 @@ struct OmptAPI {
 // --- OMPT Callbacks
 //
 
+inline uint64_t
+now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// Push a snapshot with this thread's accumulated metrics and reset them
+
+void
+emit_thread_metrics(Caliper* c)
+{
+    OmptMetrics& m = thread_metrics;
+
+    if (!m.pending)
+        return;
+
+    m.pending = false;
+
+    Attribute attr[4] = { barrier_time_attr, idle_time_attr, itask_time_attr, task_count_attr };
+    Variant   data[4] = {
+        Variant(m.barrier_time), Variant(m.idle_time), Variant(m.itask_time), Variant(m.num_tasks)
+    };
+
+    m.barrier_time = 0;
+    m.idle_time    = 0;
+    m.itask_time   = 0;
+    m.num_tasks    = 0;
+
+    SnapshotRecord::FixedSnapshotRecord<4> trigger_info_data;
+    SnapshotRecord trigger_info(trigger_info_data);
+
+    c->make_entrylist(4, attr, data, trigger_info);
+    c->push_snapshot(CALI_SCOPE_PROCESS | CALI_SCOPE_THREAD, &trigger_info);
+}
+
+// aggregate_events mode callbacks: these only touch thread-local counters
+
+void
+cb_aggr_wait_barrier_begin(ompt_parallel_id_t, ompt_task_id_t)
+{
+    thread_metrics.barrier_start = now_ns();
+}
+
+void
+cb_aggr_wait_barrier_end(ompt_parallel_id_t, ompt_task_id_t)
+{
+    OmptMetrics& m = thread_metrics;
+
+    if (m.barrier_start) {
+        m.barrier_time += now_ns() - m.barrier_start;
+        m.barrier_start = 0;
+        m.pending       = true;
+    }
+}
+
+void
+cb_aggr_idle_begin(ompt_thread_id_t)
+{
+    thread_metrics.idle_start = now_ns();
+}
+
+void
+cb_aggr_idle_end(ompt_thread_id_t)
+{
+    OmptMetrics& m = thread_metrics;
+
+    if (m.idle_start) {
+        m.idle_time += now_ns() - m.idle_start;
+        m.idle_start = 0;
+        m.pending    = true;
+    }
+}
+
+void
+cb_aggr_implicit_task_begin(ompt_parallel_id_t, ompt_task_id_t)
+{
+    thread_metrics.itask_start = now_ns();
+}
+
+void
+cb_aggr_implicit_task_end(ompt_parallel_id_t, ompt_task_id_t)
+{
+    OmptMetrics& m = thread_metrics;
+
+    if (m.itask_start) {
+        m.itask_time += now_ns() - m.itask_start;
+        m.itask_start = 0;
+        m.pending     = true;
+    }
+
+    // Worker threads usually don't end any Caliper regions themselves, so
+    // emit their metrics once per implicit task. The initial thread's metrics
+    // go into its enclosing region.
+
+    if (m.is_worker && enable_ompt && !finished) {
+        Caliper c;
+        emit_thread_metrics(&c);
+    }
+}
+
+void
+cb_aggr_task_begin(ompt_task_id_t, ompt_frame_t*, ompt_task_id_t, void*)
+{
+    ++thread_metrics.num_tasks;
+    thread_metrics.pending = true;
+}
+
 // ompt_event_thread_begin
 
 void
@@ -122,6 +260,8 @@ cb_event_thread_begin(ompt_thread_type_t type, ompt_thread_id_t thread_id)
 {
     Caliper c;
 
+    thread_metrics.is_worker = (type == ompt_thread_worker);
+
     if (config.get("environment_mapping").to_bool() == true) {
         // Create a new Caliper environment for each thread. 
         // Record thread id -> environment id mapping for later use in get_environment()
@@ -285,6 +425,20 @@ finish_cb(Caliper*)
     finished = true;
 }
 
+void
+aggr_pre_end_cb(Caliper* c, const Attribute& attr, const Variant&)
+{
+    if (enable_ompt && !finished && !attr.skip_events())
+        emit_thread_metrics(c);
+}
+
+void
+aggr_pre_flush_cb(Caliper* c, const SnapshotRecord*)
+{
+    if (enable_ompt && !finished)
+        emit_thread_metrics(c);
+}
+
 Caliper::Scope*
 get_thread_scope(Caliper* c, bool alloc) 
 {
@@ -324,7 +478,7 @@ snapshot_cb(Caliper* c, int scope, const SnapshotRecord*, SnapshotRecord*)
 /// Register our callbacks with the OpenMP runtime
 
 bool
-register_ompt_callbacks(bool capture_events)
+register_ompt_callbacks(bool capture_events, bool aggregate_events)
 {
     if (!api.set_callback)
         return false;
@@ -344,6 +498,14 @@ register_ompt_callbacks(bool capture_events)
 	{ ompt_event_wait_barrier_end,   (ompt_callback_t) &cb_event_wait_barrier_end   },
 	{ ompt_event_parallel_begin,     (ompt_callback_t) &cb_event_parallel_begin     },
 	{ ompt_event_parallel_end,       (ompt_callback_t) &cb_event_parallel_end       }
+    }, aggregate_callbacks[] = {
+        { ompt_event_idle_begin,          (ompt_callback_t) &cb_aggr_idle_begin          },
+        { ompt_event_idle_end,            (ompt_callback_t) &cb_aggr_idle_end            },
+        { ompt_event_wait_barrier_begin,  (ompt_callback_t) &cb_aggr_wait_barrier_begin  },
+        { ompt_event_wait_barrier_end,    (ompt_callback_t) &cb_aggr_wait_barrier_end    },
+        { ompt_event_implicit_task_begin, (ompt_callback_t) &cb_aggr_implicit_task_begin },
+        { ompt_event_implicit_task_end,   (ompt_callback_t) &cb_aggr_implicit_task_end   },
+        { ompt_event_task_begin,          (ompt_callback_t) &cb_aggr_task_begin          }
     };
 
     for ( auto cb : basic_callbacks ) 
@@ -355,6 +517,13 @@ register_ompt_callbacks(bool capture_events)
             if ((*api.set_callback)(cb.event, cb.cbptr) == 0)
                 return false;
 
+    // Runtimes may not implement all of the optional aggregate_events
+    // callbacks, so don't fail if some are missing
+    if (aggregate_events && !capture_events)
+        for ( auto cb : aggregate_callbacks )
+            if ((*api.set_callback)(cb.event, cb.cbptr) == 0)
+                Log(1).stream() << "ompt: Could not register callback for event " << cb.event << endl;
+
     return true;
 }
 
@@ -397,6 +566,36 @@ omptservice_initialize(Caliper* c)
     if (config.get("environment_mapping").to_bool() == true)
         c->set_scope_callback(CALI_SCOPE_THREAD, &get_thread_scope);
 
+    if (config.get("aggregate_events").to_bool() == true) {
+        if (config.get("capture_events").to_bool() == true) {
+            Log(0).stream() << "ompt: aggregate_events and capture_events are exclusive, "
+                "using capture_events" << endl;
+        } else {
+            Attribute aggr_class_attr = c->get_attribute("class.aggregatable");
+            Variant   v_true(true);
+
+            barrier_time_attr =
+                c->create_attribute("ompt.barrier.time",       CALI_TYPE_UINT,
+                                    CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_SCOPE_THREAD,
+                                    1, &aggr_class_attr, &v_true);
+            idle_time_attr    =
+                c->create_attribute("ompt.idle.time",          CALI_TYPE_UINT,
+                                    CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_SCOPE_THREAD,
+                                    1, &aggr_class_attr, &v_true);
+            itask_time_attr   =
+                c->create_attribute("ompt.implicit_task.time", CALI_TYPE_UINT,
+                                    CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_SCOPE_THREAD,
+                                    1, &aggr_class_attr, &v_true);
+            task_count_attr   =
+                c->create_attribute("ompt.task.count",         CALI_TYPE_UINT,
+                                    CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_SCOPE_THREAD,
+                                    1, &aggr_class_attr, &v_true);
+
+            c->events().pre_end_evt.connect(&aggr_pre_end_cb);
+            c->events().pre_flush_evt.connect(&aggr_pre_flush_cb);
+        }
+    }
+
     c->events().finish_evt.connect(&finish_cb);
 
     Log(1).stream() << "Registered OMPT service" << endl;
@@ -421,7 +620,9 @@ ompt_initialize_real(ompt_function_lookup_t lookup,
     
     // register callbacks
 
-    if (!::api.init(lookup) || !::register_ompt_callbacks(::config.get("capture_events").to_bool())) {
+    if (!::api.init(lookup) ||
+        !::register_ompt_callbacks(::config.get("capture_events").to_bool(),
+                                   ::config.get("aggregate_events").to_bool())) {
         Log(0).stream() << "Callback registration error: OMPT interface disabled" << endl;
         return;
     }
@@ -0,0 +1,639 @@
+// Copyright (c) 2016, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Otf2.cpp
+// Stream region enter/leave events into an OTF2 trace archive
+
+#include "caliper/CaliperService.h"
+
+#include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/Log.h"
+#include "caliper/common/RuntimeConfig.h"
+
+#include <otf2/otf2.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+const ConfigSet::Entry s_configdata[] = {
+    { "archive_path", CALI_TYPE_STRING, "",
+      "Directory of the OTF2 archive",
+      "Directory of the OTF2 archive. By default, a name is generated\n"
+      "from the date and the process id." },
+    { "archive_name", CALI_TYPE_STRING, "traces",
+      "Name of the OTF2 archive",
+      "Name of the OTF2 archive (the anchor file is <archive_name>.otf2)" },
+    { "chunk_size", CALI_TYPE_UINT, "64",
+      "Size of the per-thread event chunks in KiB",
+      "Size of the per-thread event chunks in KiB. Threads hand full\n"
+      "chunks to the writer thread, which streams them into the archive." },
+    ConfigSet::Terminator
+};
+
+enum EventType : uint32_t { Enter = 0, Leave = 1 };
+
+struct Event {
+    uint64_t time;
+    uint32_t region;
+    uint32_t type;
+};
+
+/// A chunk of events recorded by one thread
+struct EventChunk {
+    uint64_t           location;
+    std::vector<Event> events;
+};
+
+/// Per-thread event recording state. Only used by the owning thread,
+/// and by finish_cb() at program exit.
+struct ThreadState {
+    uint64_t    location;
+    EventChunk* chunk;
+
+    // open regions per attribute, for set and end events
+    std::unordered_map< cali_id_t, std::vector<uint32_t> > open_regions;
+    // local copy of the region table
+    std::map< std::pair<cali_id_t, std::string>, uint32_t > regions;
+};
+
+struct RegionInfo {
+    std::string name;
+    std::string attr_name;
+};
+
+ConfigSet      config;
+
+OTF2_Archive*  archive           = nullptr;
+bool           archive_open      = false;
+
+size_t         chunk_events      = 4096;
+
+std::chrono::steady_clock::time_point start_time;
+
+Attribute      begin_attr        = Attribute::invalid;
+Attribute      set_attr          = Attribute::invalid;
+Attribute      end_attr          = Attribute::invalid;
+Attribute      level_attr        = Attribute::invalid;
+Attribute      weight_attr       = Attribute::invalid;
+
+// Region definitions, indexed by region ref
+std::vector<RegionInfo> region_list;
+std::map< std::pair<cali_id_t, std::string>, uint32_t > region_map;
+std::mutex     region_lock;
+
+std::vector<ThreadState*> thread_list;
+std::mutex     thread_list_lock;
+
+thread_local ThreadState* t_state = nullptr;
+
+//
+// --- Writer thread
+//
+//   Application threads only fill event chunks. All OTF2 calls happen
+//   on the writer thread (and in finish_cb() after the writer thread
+//   is stopped), so the archive needs no locking callbacks.
+//
+
+std::vector<EventChunk*> write_queue;
+std::vector<EventChunk*> free_chunks;
+std::mutex     queue_lock;
+std::condition_variable queue_cv;
+bool           writer_stop       = false;
+std::thread    writer_thread;
+
+std::map<uint64_t, OTF2_EvtWriter*> evt_writers;
+
+uint64_t       max_time          = 0;
+uint64_t       num_events        = 0;
+
+uint64_t timestamp() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+OTF2_FlushType pre_flush(void*, OTF2_FileType, OTF2_LocationRef, void*, bool) {
+    return OTF2_FLUSH;
+}
+
+OTF2_TimeStamp post_flush(void*, OTF2_FileType, OTF2_LocationRef) {
+    return timestamp();
+}
+
+OTF2_FlushCallbacks flush_callbacks = { pre_flush, post_flush };
+
+EventChunk* get_chunk(uint64_t location) {
+    EventChunk* chunk = nullptr;
+
+    {
+        std::lock_guard<std::mutex>
+            g(queue_lock);
+
+        if (!free_chunks.empty()) {
+            chunk = free_chunks.back();
+            free_chunks.pop_back();
+        }
+    }
+
+    if (!chunk) {
+        chunk = new EventChunk;
+        chunk->events.reserve(chunk_events);
+    }
+
+    chunk->location = location;
+    chunk->events.clear();
+
+    return chunk;
+}
+
+void queue_chunk(EventChunk* chunk) {
+    {
+        std::lock_guard<std::mutex>
+            g(queue_lock);
+
+        write_queue.push_back(chunk);
+    }
+
+    queue_cv.notify_one();
+}
+
+OTF2_EvtWriter* evt_writer(uint64_t location) {
+    auto it = evt_writers.find(location);
+
+    if (it != evt_writers.end())
+        return it->second;
+
+    OTF2_EvtWriter* w = OTF2_Archive_GetEvtWriter(archive, location);
+
+    if (!w)
+        Log(0).stream() << "otf2: error: could not create event writer for location "
+                        << location << std::endl;
+
+    evt_writers.insert(std::make_pair(location, w));
+
+    return w;
+}
+
+void write_chunk(const EventChunk* chunk) {
+    OTF2_EvtWriter* w = evt_writer(chunk->location);
+
+    if (!w)
+        return;
+
+    for (const Event& e : chunk->events) {
+        if (e.type == Enter)
+            OTF2_EvtWriter_Enter(w, nullptr, e.time, e.region);
+        else
+            OTF2_EvtWriter_Leave(w, nullptr, e.time, e.region);
+    }
+
+    if (!chunk->events.empty())
+        max_time = std::max(max_time, chunk->events.back().time);
+
+    num_events += chunk->events.size();
+}
+
+void writer_loop() {
+    std::vector<EventChunk*> chunks;
+    bool stop = false;
+
+    while (!stop) {
+        {
+            std::unique_lock<std::mutex>
+                g(queue_lock);
+
+            queue_cv.wait(g, [](){ return writer_stop || !write_queue.empty(); });
+
+            chunks.swap(write_queue);
+            stop = writer_stop;
+        }
+
+        for (EventChunk* chunk : chunks)
+            write_chunk(chunk);
+
+        {
+            std::lock_guard<std::mutex>
+                g(queue_lock);
+
+            free_chunks.insert(free_chunks.end(), chunks.begin(), chunks.end());
+        }
+
+        chunks.clear();
+    }
+}
+
+//
+// --- Event recording
+//
+
+ThreadState* thread_state() {
+    if (!t_state) {
+        t_state = new ThreadState;
+
+        std::lock_guard<std::mutex>
+            g(thread_list_lock);
+
+        t_state->location = thread_list.size();
+        t_state->chunk    = get_chunk(t_state->location);
+
+        thread_list.push_back(t_state);
+    }
+
+    return t_state;
+}
+
+uint32_t region_ref(ThreadState* state, const Attribute& attr, const Variant& value) {
+    auto key = std::make_pair(attr.id(), value.to_string());
+    auto it  = state->regions.find(key);
+
+    if (it != state->regions.end())
+        return it->second;
+
+    uint32_t ref = 0;
+
+    {
+        std::lock_guard<std::mutex>
+            g(region_lock);
+
+        auto rit = region_map.find(key);
+
+        if (rit == region_map.end()) {
+            ref = static_cast<uint32_t>(region_list.size());
+            region_list.push_back(RegionInfo { key.second, attr.name() });
+            region_map.insert(std::make_pair(key, ref));
+        } else {
+            ref = rit->second;
+        }
+    }
+
+    state->regions.insert(std::make_pair(key, ref));
+
+    return ref;
+}
+
+void push_event(ThreadState* state, uint32_t type, uint32_t region, uint64_t time) {
+    if (!state->chunk) // after finish_cb()
+        return;
+
+    state->chunk->events.push_back(Event { time, region, type });
+
+    if (state->chunk->events.size() >= chunk_events) {
+        queue_chunk(state->chunk);
+        state->chunk = get_chunk(state->location);
+    }
+}
+
+void process_snapshot_cb(Caliper* c, const SnapshotRecord* trigger_info, const SnapshotRecord*) {
+    // Signal handlers can't allocate chunks, and samples have no
+    // begin/end information anyway
+    if (!trigger_info || c->is_signal())
+        return;
+
+    SnapshotRecord::Data  data = trigger_info->data();
+    SnapshotRecord::Sizes size = trigger_info->size();
+
+    cali_id_t event_id  = CALI_INV_ID;
+    cali_id_t region_id = CALI_INV_ID;
+    Variant   value;
+
+    for (size_t i = 0; i < size.n_immediate; ++i) {
+        cali_id_t id = data.immediate_attr[i];
+
+        if (id == begin_attr.id() || id == set_attr.id() || id == end_attr.id()) {
+            event_id  = id;
+            region_id = data.immediate_data[i].to_id();
+        } else if (id != level_attr.id() && id != weight_attr.id()) {
+            value = data.immediate_data[i];
+        }
+    }
+
+    if (event_id == CALI_INV_ID || region_id == CALI_INV_ID)
+        return;
+
+    uint64_t     time  = timestamp();
+    ThreadState* state = thread_state();
+
+    std::vector<uint32_t>& stack = state->open_regions[region_id];
+
+    if (event_id == end_attr.id()) {
+        if (stack.empty()) // unmatched end event
+            return;
+
+        push_event(state, Leave, stack.back(), time);
+        stack.pop_back();
+    } else {
+        if (event_id == set_attr.id() && !stack.empty()) {
+            push_event(state, Leave, stack.back(), time);
+            stack.pop_back();
+        }
+
+        uint32_t ref = region_ref(state, c->get_attribute(region_id), value);
+
+        push_event(state, Enter, ref, time);
+        stack.push_back(ref);
+    }
+}
+
+void release_scope_cb(Caliper*, cali_context_scope_t scope) {
+    if (scope != CALI_SCOPE_THREAD || !t_state)
+        return;
+
+    if (!t_state->chunk)
+        return;
+
+    // hand off the events of the exiting thread
+    queue_chunk(t_state->chunk);
+    t_state->chunk = get_chunk(t_state->location);
+}
+
+//
+// --- Archive setup and definitions
+//
+
+std::string create_archive_path() {
+    char   timestring[16];
+    time_t tm = time(NULL);
+    strftime(timestring, sizeof(timestring), "%y%m%d-%H%M%S", localtime(&tm));
+
+    return std::string("caliper-otf2-") + timestring + "_" + std::to_string(static_cast<int>(getpid()));
+}
+
+void open_archive() {
+    std::string path = config.get("archive_path").to_string();
+
+    if (path.empty())
+        path = create_archive_path();
+
+    archive = OTF2_Archive_Open(path.c_str(),
+                                config.get("archive_name").to_string().c_str(),
+                                OTF2_FILEMODE_WRITE,
+                                OTF2_CHUNK_SIZE_EVENTS_DEFAULT,
+                                OTF2_CHUNK_SIZE_DEFINITIONS_DEFAULT,
+                                OTF2_SUBSTRATE_POSIX,
+                                OTF2_COMPRESSION_NONE);
+
+    if (!archive) {
+        Log(0).stream() << "otf2: error: could not open archive in " << path << std::endl;
+        return;
+    }
+
+    OTF2_Archive_SetFlushCallbacks(archive, &flush_callbacks, nullptr);
+    OTF2_Archive_SetSerialCollectiveCallbacks(archive);
+    OTF2_Archive_OpenEvtFiles(archive);
+
+    archive_open = true;
+
+    Log(1).stream() << "otf2: writing trace to " << path << std::endl;
+}
+
+class StringTable {
+    OTF2_GlobalDefWriter* m_writer;
+    std::map<std::string, OTF2_StringRef> m_strings;
+
+public:
+
+    StringTable(OTF2_GlobalDefWriter* w)
+        : m_writer(w)
+        { }
+
+    OTF2_StringRef operator()(const std::string& str) {
+        auto it = m_strings.find(str);
+
+        if (it != m_strings.end())
+            return it->second;
+
+        OTF2_StringRef ref = static_cast<OTF2_StringRef>(m_strings.size());
+
+        OTF2_GlobalDefWriter_WriteString(m_writer, ref, str.c_str());
+        m_strings.insert(std::make_pair(str, ref));
+
+        return ref;
+    }
+};
+
+void write_definitions(const std::map<uint64_t, uint64_t>& location_events) {
+    // Local definition files must exist for each location
+    OTF2_Archive_OpenDefFiles(archive);
+
+    for (const auto& p : location_events) {
+        OTF2_DefWriter* dw = OTF2_Archive_GetDefWriter(archive, p.first);
+        OTF2_Archive_CloseDefWriter(archive, dw);
+    }
+
+    OTF2_Archive_CloseDefFiles(archive);
+
+    OTF2_GlobalDefWriter* gw = OTF2_Archive_GetGlobalDefWriter(archive);
+
+    if (!gw) {
+        Log(0).stream() << "otf2: error: could not create definitions writer" << std::endl;
+        return;
+    }
+
+#if OTF2_VERSION_MAJOR >= 3
+    OTF2_GlobalDefWriter_WriteClockProperties(gw, 1000000000, 0, max_time + 1, OTF2_UNDEFINED_TIMESTAMP);
+#else
+    OTF2_GlobalDefWriter_WriteClockProperties(gw, 1000000000, 0, max_time + 1);
+#endif
+
+    StringTable str(gw);
+
+    OTF2_StringRef empty = str("");
+
+    for (size_t i = 0; i < region_list.size(); ++i) {
+        const RegionInfo& r = region_list[i];
+
+        OTF2_GlobalDefWriter_WriteRegion(gw, static_cast<OTF2_RegionRef>(i),
+                                         str(r.name),
+                                         str(r.attr_name + "=" + r.name),
+                                         str(r.attr_name),
+                                         OTF2_REGION_ROLE_CODE,
+                                         OTF2_PARADIGM_USER,
+                                         OTF2_REGION_FLAG_NONE,
+                                         empty, 0, 0);
+    }
+
+    char hostname[256] = { 0 };
+    gethostname(hostname, sizeof(hostname)-1);
+
+    OTF2_GlobalDefWriter_WriteSystemTreeNode(gw, 0, str(hostname), str("node"),
+                                             OTF2_UNDEFINED_SYSTEM_TREE_NODE);
+
+    std::string procname = std::string("process ") + std::to_string(static_cast<int>(getpid()));
+
+#if OTF2_VERSION_MAJOR >= 3
+    OTF2_GlobalDefWriter_WriteLocationGroup(gw, 0, str(procname), OTF2_LOCATION_GROUP_TYPE_PROCESS, 0,
+                                            OTF2_UNDEFINED_LOCATION_GROUP);
+#else
+    OTF2_GlobalDefWriter_WriteLocationGroup(gw, 0, str(procname), OTF2_LOCATION_GROUP_TYPE_PROCESS, 0);
+#endif
+
+    for (const auto& p : location_events)
+        OTF2_GlobalDefWriter_WriteLocation(gw, p.first,
+                                           str(std::string("thread ") + std::to_string(p.first)),
+                                           OTF2_LOCATION_TYPE_CPU_THREAD,
+                                           p.second,
+                                           0);
+
+    OTF2_Archive_CloseGlobalDefWriter(archive, gw);
+}
+
+//
+// --- Caliper callbacks
+//
+
+void post_init_cb(Caliper* c) {
+    begin_attr  = c->get_attribute("cali.event.begin");
+    set_attr    = c->get_attribute("cali.event.set");
+    end_attr    = c->get_attribute("cali.event.end");
+    level_attr  = c->get_attribute("cali.event.attr.level");
+    weight_attr = c->get_attribute("cali.event.sample.weight");
+
+    if (begin_attr == Attribute::invalid || end_attr == Attribute::invalid) {
+        Log(0).stream() << "otf2: event attributes not found: "
+                        << "the event service is required. Not writing a trace." << std::endl;
+        return;
+    }
+
+    start_time = std::chrono::steady_clock::now();
+
+    open_archive();
+
+    if (!archive_open)
+        return;
+
+    writer_stop   = false;
+    writer_thread = std::thread(writer_loop);
+
+    c->events().process_snapshot.connect(&process_snapshot_cb);
+    c->events().release_scope_evt.connect(&release_scope_cb);
+}
+
+void finish_cb(Caliper*) {
+    if (!archive_open)
+        return;
+
+    uint64_t time = timestamp();
+
+    {
+        std::lock_guard<std::mutex>
+            g(thread_list_lock);
+
+        // Leave the regions that are still open and hand off the rest
+        // of each thread's events
+        for (ThreadState* state : thread_list) {
+            for (auto& p : state->open_regions)
+                while (!p.second.empty()) {
+                    state->chunk->events.push_back(Event { time, p.second.back(), Leave });
+                    p.second.pop_back();
+                }
+
+            queue_chunk(state->chunk);
+            state->chunk = nullptr;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex>
+            g(queue_lock);
+
+        writer_stop = true;
+    }
+
+    queue_cv.notify_one();
+    writer_thread.join();
+
+    std::map<uint64_t, uint64_t> location_events;
+
+    for (auto& p : evt_writers) {
+        uint64_t n = 0;
+
+        if (p.second) {
+            OTF2_EvtWriter_GetNumberOfEvents(p.second, &n);
+            OTF2_Archive_CloseEvtWriter(archive, p.second);
+        }
+
+        location_events[p.first] = n;
+    }
+
+    OTF2_Archive_CloseEvtFiles(archive);
+
+    write_definitions(location_events);
+
+    OTF2_Archive_Close(archive);
+
+    archive      = nullptr;
+    archive_open = false;
+
+    Log(1).stream() << "otf2: wrote " << num_events << " events for "
+                    << location_events.size() << " thread(s), "
+                    << region_list.size() << " regions." << std::endl;
+
+    evt_writers.clear();
+
+    for (EventChunk* chunk : free_chunks)
+        delete chunk;
+
+    free_chunks.clear();
+}
+
+void otf2_register(Caliper* c) {
+    config       = RuntimeConfig::init("otf2", s_configdata);
+    chunk_events = std::max<size_t>(config.get("chunk_size").to_uint() * 1024 / sizeof(Event), 1);
+
+    c->events().post_init_evt.connect(&post_init_cb);
+    c->events().finish_evt.connect(&finish_cb);
+
+    Log(1).stream() << "Registered otf2 service" << std::endl;
+}
+
+} // namespace
+
+namespace cali
+{
+    CaliperService otf2_service { "otf2", &::otf2_register };
+}
@@ -0,0 +1,554 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+/// \file  PosixIOService.cpp
+/// \brief Aggregated statistics of POSIX I/O calls
+
+#include "caliper/CaliperService.h"
+
+#include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/Log.h"
+#include "caliper/common/Node.h"
+#include "caliper/common/RuntimeConfig.h"
+
+#include "caliper/common/util/spinlock.hpp"
+
+#include <gotcha/gotcha.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cali;
+
+namespace
+{
+
+//
+// --- Operations and file descriptor classes
+//
+
+enum IOFunction {
+    Read = 0, Write, PRead, PWrite, Open, Close, Fsync, NumFunctions
+};
+
+const char* function_names[NumFunctions] = {
+    "read", "write", "pread", "pwrite", "open", "close", "fsync"
+};
+
+enum FdClass {
+    Unknown = 0, File, Pipe, Socket, CharDevice, Other, NumClasses
+};
+
+const char* class_names[NumClasses] = {
+    "unknown", "file", "pipe", "socket", "chardev", "other"
+};
+
+/// Context tree nodes for each (function, fd class) combination,
+/// created at initialization so that wrappers never create nodes
+Node* io_nodes[NumFunctions][NumClasses];
+
+// File descriptor classes are cached to avoid an fstat() per call.
+// close() resets the entry.
+
+const int MaxCachedFd = 4096;
+
+std::atomic<unsigned char> fd_classes[MaxCachedFd];
+
+int (*orig_fstat)(int, struct stat*) = ::fstat;
+
+int classify(int fd)
+{
+    if (fd < 0)
+        return Other;
+
+    if (fd < MaxCachedFd) {
+        int cls = fd_classes[fd].load(std::memory_order_relaxed);
+
+        if (cls != Unknown)
+            return cls;
+    }
+
+    struct stat st;
+    int cls = Other;
+
+    if ((*orig_fstat)(fd, &st) == 0) {
+        if (S_ISREG(st.st_mode))
+            cls = File;
+        else if (S_ISFIFO(st.st_mode))
+            cls = Pipe;
+        else if (S_ISSOCK(st.st_mode))
+            cls = Socket;
+        else if (S_ISCHR(st.st_mode))
+            cls = CharDevice;
+    }
+
+    if (fd < MaxCachedFd)
+        fd_classes[fd].store(static_cast<unsigned char>(cls), std::memory_order_relaxed);
+
+    return cls;
+}
+
+//
+// --- Per-thread aggregation tables
+//
+
+const size_t MaxContextNodes = 8;
+
+/// \brief Statistics of one (context, function, fd class) combination
+struct IOEntry {
+    uint64_t    hash;     ///< 0 for an empty slot
+    const Node* io_node;
+    size_t      n_nodes;
+    const Node* nodes[MaxContextNodes];
+
+    uint64_t    count;
+    uint64_t    bytes;
+    uint64_t    duration_ns;
+};
+
+/// \brief Fixed-size open-addressing hash table, so that recording a
+///   call never allocates memory. Updated by the owning thread and read
+///   and cleared by the flushing thread, under \a lock.
+struct IOTable {
+    static const size_t NumSlots = 1024;
+    static const size_t MaxProbe = 16;
+
+    IOEntry         entries[NumSlots];
+
+    util::spinlock  lock;
+    bool            retired;
+    size_t          num_dropped;
+
+    IOTable*        next;
+
+    IOTable()
+        : retired(false), num_dropped(0), next(nullptr)
+        {
+            clear();
+        }
+
+    void clear() {
+        memset(entries, 0, sizeof(entries));
+    }
+
+    void add(const Node* io_node, size_t n_nodes, const Node* const* nodes, uint64_t bytes, uint64_t ns) {
+        n_nodes = std::min(n_nodes, MaxContextNodes);
+
+        uint64_t hash = reinterpret_cast<uintptr_t>(io_node);
+
+        for (size_t i = 0; i < n_nodes; ++i)
+            hash = (hash ^ reinterpret_cast<uintptr_t>(nodes[i])) * 0x100000001b3ull;
+
+        hash |= 1;
+
+        std::lock_guard<util::spinlock>
+            g(lock);
+
+        for (size_t p = 0; p < MaxProbe; ++p) {
+            IOEntry& e = entries[(hash + p) % NumSlots];
+
+            if (e.hash == 0) {
+                e.hash    = hash;
+                e.io_node = io_node;
+                e.n_nodes = n_nodes;
+
+                std::copy(nodes, nodes + n_nodes, e.nodes);
+            } else if (e.hash != hash || e.io_node != io_node || e.n_nodes != n_nodes ||
+                       !std::equal(nodes, nodes + n_nodes, e.nodes))
+                continue;
+
+            ++e.count;
+            e.bytes       += bytes;
+            e.duration_ns += ns;
+
+            return;
+        }
+
+        ++num_dropped;
+    }
+};
+
+IOTable*       table_list = nullptr;
+std::mutex     table_list_lock;
+
+pthread_key_t  table_key;
+
+void retire_table(void* ptr)
+{
+    IOTable* table = static_cast<IOTable*>(ptr);
+
+    std::lock_guard<util::spinlock>
+        g(table->lock);
+
+    table->retired = true;
+}
+
+IOTable* acquire_table()
+{
+    thread_local IOTable* t_table = nullptr;
+
+    if (!t_table) {
+        t_table = new IOTable;
+
+        pthread_setspecific(table_key, t_table);
+
+        std::lock_guard<std::mutex>
+            g(table_list_lock);
+
+        t_table->next = table_list;
+        table_list    = t_table;
+    }
+
+    return t_table;
+}
+
+Attribute count_attr;
+Attribute bytes_attr;
+Attribute duration_attr;
+
+std::atomic<bool> bindings_are_active { false };
+
+void record(int fn, int cls, ssize_t bytes, std::chrono::steady_clock::time_point start)
+{
+    uint64_t ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    // Skip calls from within Caliper, e.g. when writing output
+    Caliper c = Caliper::sigsafe_instance();
+
+    if (!c)
+        return;
+
+    SnapshotRecord::FixedSnapshotRecord<32> snapshot_data;
+    SnapshotRecord rec(snapshot_data);
+
+    c.pull_context(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, &rec);
+
+    acquire_table()->add(io_nodes[fn][cls], rec.size().n_nodes, rec.data().node_entries,
+                         bytes > 0 ? static_cast<uint64_t>(bytes) : 0, ns);
+}
+
+//
+// --- Wrappers
+//
+
+ssize_t (*orig_read)(int, void*, size_t)                = nullptr;
+ssize_t (*orig_write)(int, const void*, size_t)         = nullptr;
+ssize_t (*orig_pread)(int, void*, size_t, off_t)        = nullptr;
+ssize_t (*orig_pwrite)(int, const void*, size_t, off_t) = nullptr;
+int     (*orig_open)(const char*, int, ...)             = nullptr;
+int     (*orig_close)(int)                              = nullptr;
+int     (*orig_fsync)(int)                              = nullptr;
+
+ssize_t cali_read_wrapper(int fd, void* buf, size_t count)
+{
+    auto    start = std::chrono::steady_clock::now();
+    ssize_t ret   = (*orig_read)(fd, buf, count);
+
+    record(Read, classify(fd), ret, start);
+    return ret;
+}
+
+ssize_t cali_write_wrapper(int fd, const void* buf, size_t count)
+{
+    auto    start = std::chrono::steady_clock::now();
+    ssize_t ret   = (*orig_write)(fd, buf, count);
+
+    record(Write, classify(fd), ret, start);
+    return ret;
+}
+
+ssize_t cali_pread_wrapper(int fd, void* buf, size_t count, off_t offset)
+{
+    auto    start = std::chrono::steady_clock::now();
+    ssize_t ret   = (*orig_pread)(fd, buf, count, offset);
+
+    record(PRead, classify(fd), ret, start);
+    return ret;
+}
+
+ssize_t cali_pwrite_wrapper(int fd, const void* buf, size_t count, off_t offset)
+{
+    auto    start = std::chrono::steady_clock::now();
+    ssize_t ret   = (*orig_pwrite)(fd, buf, count, offset);
+
+    record(PWrite, classify(fd), ret, start);
+    return ret;
+}
+
+int cali_open_wrapper(const char* path, int flags, ...)
+{
+    mode_t mode = 0;
+
+    if (flags & O_CREAT) {
+        va_list args;
+        va_start(args, flags);
+        mode = static_cast<mode_t>(va_arg(args, int));
+        va_end(args);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int  ret   = (*orig_open)(path, flags, mode);
+
+    if (ret >= 0 && ret < MaxCachedFd)
+        fd_classes[ret].store(Unknown, std::memory_order_relaxed);
+
+    record(Open, ret >= 0 ? classify(ret) : Other, 0, start);
+    return ret;
+}
+
+int cali_close_wrapper(int fd)
+{
+    int cls = classify(fd);
+
+    if (fd >= 0 && fd < MaxCachedFd)
+        fd_classes[fd].store(Unknown, std::memory_order_relaxed);
+
+    auto start = std::chrono::steady_clock::now();
+    int  ret   = (*orig_close)(fd);
+
+    record(Close, cls, 0, start);
+    return ret;
+}
+
+int cali_fsync_wrapper(int fd)
+{
+    auto start = std::chrono::steady_clock::now();
+    int  ret   = (*orig_fsync)(fd);
+
+    record(Fsync, classify(fd), 0, start);
+    return ret;
+}
+
+const char* read_str   = "read";
+const char* write_str  = "write";
+const char* pread_str  = "pread";
+const char* pwrite_str = "pwrite";
+const char* open_str   = "open";
+const char* close_str  = "close";
+const char* fsync_str  = "fsync";
+
+struct gotcha_binding_t io_bindings[] = {
+    { read_str,   (void*) cali_read_wrapper,   &orig_read   },
+    { write_str,  (void*) cali_write_wrapper,  &orig_write  },
+    { pread_str,  (void*) cali_pread_wrapper,  &orig_pread  },
+    { pwrite_str, (void*) cali_pwrite_wrapper, &orig_pwrite },
+    { open_str,   (void*) cali_open_wrapper,   &orig_open   },
+    { close_str,  (void*) cali_close_wrapper,  &orig_close  },
+    { fsync_str,  (void*) cali_fsync_wrapper,  &orig_fsync  }
+};
+
+//
+// --- Caliper callbacks
+//
+
+void flush_cb(Caliper* c, const SnapshotRecord*, Caliper::SnapshotFlushFn proc_fn)
+{
+    std::lock_guard<std::mutex>
+        g(table_list_lock);
+
+    size_t num_written = 0;
+    size_t num_dropped = 0;
+
+    IOTable** prev_next = &table_list;
+
+    for (IOTable* table = table_list; table; ) {
+        IOTable* next    = table->next;
+        bool     retired = false;
+
+        {
+            std::lock_guard<util::spinlock>
+                g(table->lock);
+
+            for (const IOEntry& e : table->entries) {
+                if (e.hash == 0)
+                    continue;
+
+                Node* nodes[MaxContextNodes + 1];
+
+                for (size_t i = 0; i < e.n_nodes; ++i)
+                    nodes[i] = const_cast<Node*>(e.nodes[i]);
+
+                nodes[e.n_nodes] = const_cast<Node*>(e.io_node);
+
+                cali_id_t attr[3] = { count_attr.id(), bytes_attr.id(), duration_attr.id() };
+                Variant   data[3] = { Variant(e.count), Variant(e.bytes), Variant(e.duration_ns) };
+
+                SnapshotRecord rec(e.n_nodes + 1, nodes, 3, attr, data);
+                proc_fn(&rec);
+
+                ++num_written;
+            }
+
+            num_dropped += table->num_dropped;
+            retired      = table->retired;
+        }
+
+        // Merged tables of finished threads are no longer needed
+        if (retired) {
+            *prev_next = next;
+            delete table;
+        } else
+            prev_next = &table->next;
+
+        table = next;
+    }
+
+    Log(1).stream() << "posixio: Wrote " << num_written << " I/O statistics records." << std::endl;
+
+    if (num_dropped > 0)
+        Log(1).stream() << "posixio: " << num_dropped
+                        << " calls not recorded because the table of their thread was full." << std::endl;
+}
+
+void clear_cb(Caliper*)
+{
+    std::lock_guard<std::mutex>
+        g(table_list_lock);
+
+    for (IOTable* table = table_list; table; table = table->next) {
+        std::lock_guard<util::spinlock>
+            g(table->lock);
+
+        table->clear();
+        table->num_dropped = 0;
+    }
+}
+
+void post_init_cb(Caliper* c)
+{
+    Attribute fn_attr =
+        c->create_attribute("io.function", CALI_TYPE_STRING, CALI_ATTR_SKIP_EVENTS);
+    Attribute class_attr =
+        c->create_attribute("io.fd.class", CALI_TYPE_STRING, CALI_ATTR_SKIP_EVENTS);
+
+    for (int cls = 0; cls < NumClasses; ++cls) {
+        Node* class_node =
+            c->make_tree_entry(class_attr, Variant(CALI_TYPE_STRING, class_names[cls], strlen(class_names[cls])));
+
+        for (int fn = 0; fn < NumFunctions; ++fn)
+            io_nodes[fn][cls] =
+                c->make_tree_entry(fn_attr,
+                                   Variant(CALI_TYPE_STRING, function_names[fn], strlen(function_names[fn])),
+                                   class_node);
+    }
+
+    Log(1).stream() << "posixio: Wrapping I/O functions" << std::endl;
+
+    gotcha_wrap(io_bindings,
+                sizeof(io_bindings)/sizeof(struct gotcha_binding_t),
+                "Caliper posixio wrap");
+
+    bindings_are_active = true;
+}
+
+void finish_cb(Caliper*)
+{
+    if (!bindings_are_active)
+        return;
+
+    Log(1).stream() << "posixio: Removing I/O wrappers" << std::endl;
+
+    void* dummy = nullptr;
+
+    struct gotcha_binding_t orig_bindings[] = {
+        { read_str,   (void*) orig_read,   &dummy },
+        { write_str,  (void*) orig_write,  &dummy },
+        { pread_str,  (void*) orig_pread,  &dummy },
+        { pwrite_str, (void*) orig_pwrite, &dummy },
+        { open_str,   (void*) orig_open,   &dummy },
+        { close_str,  (void*) orig_close,  &dummy },
+        { fsync_str,  (void*) orig_fsync,  &dummy }
+    };
+
+    gotcha_wrap(orig_bindings,
+                sizeof(orig_bindings)/sizeof(struct gotcha_binding_t),
+                "Caliper posixio unwrap");
+
+    bindings_are_active = false;
+}
+
+void posixio_initialize(Caliper* c)
+{
+    if (pthread_key_create(&table_key, retire_table) != 0) {
+        Log(0).stream() << "posixio: error: pthread_key_create() failed" << std::endl;
+        return;
+    }
+
+    for (int fd = 0; fd < MaxCachedFd; ++fd)
+        fd_classes[fd].store(Unknown, std::memory_order_relaxed);
+
+    Attribute aggr_class_attr = c->get_attribute("class.aggregatable");
+    Variant   v_true(true);
+
+    count_attr =
+        c->create_attribute("io.count", CALI_TYPE_UINT,
+                            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+                            1, &aggr_class_attr, &v_true);
+    bytes_attr =
+        c->create_attribute("io.bytes", CALI_TYPE_UINT,
+                            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+                            1, &aggr_class_attr, &v_true);
+    duration_attr =
+        c->create_attribute("io.duration.ns", CALI_TYPE_UINT,
+                            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+                            1, &aggr_class_attr, &v_true);
+
+    c->events().post_init_evt.connect(post_init_cb);
+    c->events().flush_evt.connect(flush_cb);
+    c->events().clear_evt.connect(clear_cb);
+    c->events().finish_evt.connect(finish_cb);
+
+    Log(1).stream() << "Registered posixio service" << std::endl;
+}
+
+} // namespace [anonymous]
+
+
+namespace cali
+{
+
+CaliperService posixio_service { "posixio", ::posixio_initialize };
+
+}
@@ -36,9 +36,13 @@
 #include "caliper/CaliperService.h"
 
 #include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
 
 #include "caliper/common/Log.h"
+#include "caliper/common/RuntimeConfig.h"
 
+#include <cerrno>
+#include <chrono>
 #include <cstdlib>
 #include <pthread.h>
 
@@ -53,6 +57,43 @@ int (*orig_pthread_create)(pthread_t*, const pthread_attr_t*, void*(*)(void*), v
 
 Attribute id_attr = Attribute::invalid;
 
+int (*orig_pthread_mutex_lock)(pthread_mutex_t*) = NULL;
+int (*orig_pthread_mutex_trylock)(pthread_mutex_t*) = NULL;
+int (*orig_pthread_cond_wait)(pthread_cond_t*, pthread_mutex_t*) = NULL;
+int (*orig_pthread_barrier_wait)(pthread_barrier_t*) = NULL;
+
+Attribute mutex_wait_attr      = Attribute::invalid;
+Attribute mutex_contended_attr = Attribute::invalid;
+Attribute cond_wait_attr       = Attribute::invalid;
+Attribute barrier_wait_attr    = Attribute::invalid;
+
+// Per-thread wait time accumulated since the last snapshot on this thread.
+// The wrappers only touch these counters and never call into Caliper,
+// so Caliper's own locking goes through them safely.
+struct WaitCounters {
+    uint64_t mutex_ns;
+    uint64_t mutex_contended;
+    uint64_t cond_ns;
+    uint64_t barrier_ns;
+};
+
+thread_local WaitCounters t_wait = { 0, 0, 0, 0 };
+
+const ConfigSet::Entry s_configdata[] = {
+    { "lock_profile", CALI_TYPE_BOOL, "false",
+      "Measure time spent waiting in mutexes, condition variables, and barriers",
+      "Measure time spent waiting in pthread_mutex_lock (contended calls only),\n"
+      "pthread_cond_wait, and pthread_barrier_wait, and add it to snapshots."
+    },
+    ConfigSet::Terminator
+};
+
+inline uint64_t
+elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
 struct wrapper_args {
     void* (*fn)(void*);
     void* arg;
@@ -83,6 +124,118 @@ cali_pthread_create_wrapper(pthread_t *thread, const pthread_attr_t *attr,
     return (*orig_pthread_create)(thread, attr, thread_wrapper, new wrapper_args({ fn, arg }));
 }
 
+// Wrapper for pthread_mutex_lock(). Try the lock first, so that only
+// contended calls pay for the time measurement.
+int
+cali_pthread_mutex_lock_wrapper(pthread_mutex_t* mutex)
+{
+    int ret = (*orig_pthread_mutex_trylock)(mutex);
+
+    if (ret != EBUSY)
+        return ret;
+
+    auto start = std::chrono::steady_clock::now();
+    ret = (*orig_pthread_mutex_lock)(mutex);
+
+    t_wait.mutex_ns += elapsed_ns(start);
+    ++t_wait.mutex_contended;
+
+    return ret;
+}
+
+// Wrapper for pthread_cond_wait()
+int
+cali_pthread_cond_wait_wrapper(pthread_cond_t* cond, pthread_mutex_t* mutex)
+{
+    auto start = std::chrono::steady_clock::now();
+    int  ret   = (*orig_pthread_cond_wait)(cond, mutex);
+
+    t_wait.cond_ns += elapsed_ns(start);
+
+    return ret;
+}
+
+// Wrapper for pthread_barrier_wait()
+int
+cali_pthread_barrier_wait_wrapper(pthread_barrier_t* barrier)
+{
+    auto start = std::chrono::steady_clock::now();
+    int  ret   = (*orig_pthread_barrier_wait)(barrier);
+
+    t_wait.barrier_ns += elapsed_ns(start);
+
+    return ret;
+}
+
+// Add the wait time since the previous snapshot on this thread
+void
+snapshot_cb(Caliper* c, int scope, const SnapshotRecord*, SnapshotRecord* snapshot)
+{
+    if (!(scope & CALI_SCOPE_THREAD))
+        return;
+
+    cali_id_t attr[4];
+    Variant   data[4];
+    int       n = 0;
+
+    if (t_wait.mutex_contended > 0) {
+        attr[n] = mutex_wait_attr.id();
+        data[n] = Variant(CALI_TYPE_UINT, &t_wait.mutex_ns, sizeof(uint64_t));
+        ++n;
+        attr[n] = mutex_contended_attr.id();
+        data[n] = Variant(CALI_TYPE_UINT, &t_wait.mutex_contended, sizeof(uint64_t));
+        ++n;
+    }
+    if (t_wait.cond_ns > 0) {
+        attr[n] = cond_wait_attr.id();
+        data[n] = Variant(CALI_TYPE_UINT, &t_wait.cond_ns, sizeof(uint64_t));
+        ++n;
+    }
+    if (t_wait.barrier_ns > 0) {
+        attr[n] = barrier_wait_attr.id();
+        data[n] = Variant(CALI_TYPE_UINT, &t_wait.barrier_ns, sizeof(uint64_t));
+        ++n;
+    }
+
+    if (n > 0)
+        snapshot->append(n, attr, data);
+
+    t_wait = { 0, 0, 0, 0 };
+}
+
+void
+init_lock_profiling(Caliper* c)
+{
+    Attribute aggr_class_attr = c->get_attribute("class.aggregatable");
+    Variant   v_true(true);
+
+    int prop = CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD | CALI_ATTR_SKIP_EVENTS;
+
+    mutex_wait_attr =
+        c->create_attribute("pthread.mutex.wait.ns", CALI_TYPE_UINT, prop, 1, &aggr_class_attr, &v_true);
+    mutex_contended_attr =
+        c->create_attribute("pthread.mutex.contended", CALI_TYPE_UINT, prop, 1, &aggr_class_attr, &v_true);
+    cond_wait_attr =
+        c->create_attribute("pthread.cond.wait.ns", CALI_TYPE_UINT, prop, 1, &aggr_class_attr, &v_true);
+    barrier_wait_attr =
+        c->create_attribute("pthread.barrier.wait.ns", CALI_TYPE_UINT, prop, 1, &aggr_class_attr, &v_true);
+
+    // pthread_mutex_trylock isn't wrapped; we just need its address
+    struct gotcha_binding_t lock_bindings[] = {
+        { "pthread_mutex_lock",   (void*) cali_pthread_mutex_lock_wrapper,   &orig_pthread_mutex_lock   },
+        { "pthread_cond_wait",    (void*) cali_pthread_cond_wait_wrapper,    &orig_pthread_cond_wait    },
+        { "pthread_barrier_wait", (void*) cali_pthread_barrier_wait_wrapper, &orig_pthread_barrier_wait }
+    };
+
+    orig_pthread_mutex_trylock = ::pthread_mutex_trylock;
+
+    gotcha_wrap(lock_bindings, sizeof(lock_bindings)/sizeof(struct gotcha_binding_t), "Caliper");
+
+    c->events().snapshot.connect(&snapshot_cb);
+
+    Log(1).stream() << "pthread: Lock profiling enabled" << std::endl;
+}
+
 // Initialization routine.
 void 
 pthreadservice_initialize(Caliper* c)
@@ -95,6 +248,11 @@ pthreadservice_initialize(Caliper* c)
 
     gotcha_wrap(pthread_binding, sizeof(pthread_binding)/sizeof(struct gotcha_binding_t), "Caliper");
 
+    ConfigSet config = RuntimeConfig::init("pthread", s_configdata);
+
+    if (config.get("lock_profile").to_bool())
+        init_lock_profiling(c);
+
     Log(1).stream() << "Registered pthread service" << std::endl;
 }
 
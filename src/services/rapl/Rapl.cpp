@@ -0,0 +1,565 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+/// \file  Rapl.cpp
+/// \brief RAPL energy counters
+
+#include "caliper/CaliperService.h"
+
+#include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/Log.h"
+#include "caliper/common/RuntimeConfig.h"
+
+#include <linux/perf_event.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace cali;
+using namespace std;
+
+namespace
+{
+
+const ConfigSet::Entry configdata[] = {
+    { "domains", CALI_TYPE_STRING, "pkg,ram",
+      "Comma-separated list of RAPL domains",
+      "Comma-separated list of RAPL domains to read:\n"
+      "   pkg:   Processor package\n"
+      "   ram:   DRAM\n"
+      "   cores: Processor cores (power plane 0)\n"
+      "   gpu:   Integrated graphics (power plane 1)\n"
+      "   psys:  Platform"
+    },
+    { "backend", CALI_TYPE_STRING, "perf",
+      "Counter access method: perf or msr",
+      "Counter access method:\n"
+      "   perf: The perf_event power PMU\n"
+      "   msr:  The RAPL model-specific registers through /dev/cpu/*/msr"
+    },
+    { "interval", CALI_TYPE_UINT, "10",
+      "Counter read interval in milliseconds",
+      "The background thread reads the energy counters of each socket\n"
+      "every <interval> milliseconds. Snapshots use the last values read."
+    },
+    { "inclusive", CALI_TYPE_BOOL, "true",
+      "Record inclusive energy of begin/end regions",
+      "Record the energy consumed between the begin and end of a region\n"
+      "in energy.inclusive.<domain> attributes."
+    },
+    ConfigSet::Terminator
+};
+
+const int MaxDomains = 5;
+
+struct DomainInfo {
+    const char* name;
+    unsigned    msr;  ///< energy status MSR
+};
+
+const DomainInfo domain_info_tbl[] = {
+    { "pkg",   0x611 },
+    { "ram",   0x619 },
+    { "cores", 0x639 },
+    { "gpu",   0x641 },
+    { "psys",  0x64d }
+};
+
+const unsigned MSR_RAPL_POWER_UNIT = 0x606;
+
+/// \brief A counter of one domain on one socket
+struct Counter {
+    int      fd;
+    uint64_t last;    ///< previous raw value
+    double   scale;   ///< joules per count
+};
+
+struct Domain {
+    std::string          name;
+    unsigned             msr;
+
+    std::vector<Counter> counters; ///< one per socket
+
+    /// Total energy of all sockets since program start in microjoules.
+    /// Written by the reader thread only; read in snapshots.
+    std::atomic<uint64_t> energy_uj;
+    double                energy_j;
+
+    Attribute             attr;
+    Attribute             inclusive_attr;
+
+    Domain()
+        : msr(0), energy_uj(0), energy_j(0.0)
+        { }
+};
+
+Domain   domains[MaxDomains];
+size_t   num_domains = 0;
+
+bool     use_msr     = false;
+unsigned interval_ms = 10;
+bool     record_inclusive = true;
+
+std::thread             reader;
+std::mutex              reader_mutex;
+std::condition_variable reader_cv;
+bool                    reader_stop = false;
+
+Attribute begin_evt_attr { Attribute::invalid };
+Attribute set_evt_attr   { Attribute::invalid };
+Attribute end_evt_attr   { Attribute::invalid };
+Attribute lvl_attr       { Attribute::invalid };
+
+/// \brief Energy values of the thread's previous snapshot
+struct ThreadState {
+    bool     init;
+    uint64_t last[MaxDomains];
+};
+
+thread_local ThreadState t_state = { false, { 0 } };
+
+// Per-thread stacks of begin energy values, indexed by attribute ID.
+// Each level holds num_domains values.
+typedef std::unordered_map< cali_id_t, std::vector<uint64_t> > EnergyStackMap;
+
+pthread_key_t  energy_stacks_key;
+
+void delete_energy_stacks(void* ptr)
+{
+    delete static_cast<EnergyStackMap*>(ptr);
+}
+
+EnergyStackMap* acquire_energy_stacks()
+{
+    thread_local EnergyStackMap* t_stacks = nullptr;
+
+    if (!t_stacks) {
+        t_stacks = new EnergyStackMap;
+        pthread_setspecific(energy_stacks_key, t_stacks);
+    }
+
+    return t_stacks;
+}
+
+bool read_file(const std::string& path, std::string& str)
+{
+    std::ifstream is(path.c_str());
+
+    if (!is)
+        return false;
+
+    std::getline(is, str);
+    return true;
+}
+
+/// \brief One CPU per socket, from the power PMU's cpumask or the CPU
+///   topology
+std::vector<int> socket_cpus()
+{
+    std::vector<int> cpus;
+    std::string      mask;
+
+    if (read_file("/sys/bus/event_source/devices/power/cpumask", mask)) {
+        std::stringstream is(mask);
+        std::string       range;
+
+        while (std::getline(is, range, ','))
+            if (!range.empty())
+                cpus.push_back(std::atoi(range.c_str()));
+
+        return cpus;
+    }
+
+    std::vector<int> seen;
+    int ncpu = static_cast<int>(sysconf(_SC_NPROCESSORS_CONF));
+
+    for (int cpu = 0; cpu < ncpu; ++cpu) {
+        std::string str;
+
+        if (!read_file(std::string("/sys/devices/system/cpu/cpu") + std::to_string(cpu) + "/topology/physical_package_id", str))
+            continue;
+
+        int socket = std::atoi(str.c_str());
+
+        if (std::find(seen.begin(), seen.end(), socket) == seen.end()) {
+            seen.push_back(socket);
+            cpus.push_back(cpu);
+        }
+    }
+
+    return cpus;
+}
+
+bool read_msr(int fd, unsigned msr, uint64_t& val)
+{
+    return pread(fd, &val, sizeof(val), msr) == sizeof(val);
+}
+
+bool open_perf_counter(Domain& d, int cpu, Counter& ctr)
+{
+    const std::string dir = "/sys/bus/event_source/devices/power/";
+
+    std::string type, event, scale;
+
+    if (!read_file(dir + "type", type) || !read_file(dir + "events/energy-" + d.name, event))
+        return false;
+
+    size_t pos = event.find("event=");
+
+    if (pos == std::string::npos)
+        return false;
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.size   = sizeof(attr);
+    attr.type   = std::atoi(type.c_str());
+    attr.config = std::strtoull(event.c_str() + pos + 6, nullptr, 0);
+
+    ctr.fd    = static_cast<int>(syscall(SYS_perf_event_open, &attr, -1, cpu, -1, 0));
+    ctr.scale = read_file(dir + "events/energy-" + d.name + ".scale", scale) ? std::strtod(scale.c_str(), nullptr) : 1.0;
+
+    if (ctr.fd < 0) {
+        Log(1).stream() << "rapl: perf_event_open() failed for energy-" << d.name
+                        << " on cpu " << cpu << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool open_msr_counter(Domain& d, int cpu, Counter& ctr)
+{
+    std::string path = std::string("/dev/cpu/") + std::to_string(cpu) + "/msr";
+
+    ctr.fd = open(path.c_str(), O_RDONLY);
+
+    if (ctr.fd < 0) {
+        Log(1).stream() << "rapl: cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    uint64_t units = 0;
+    uint64_t val   = 0;
+
+    if (!read_msr(ctr.fd, MSR_RAPL_POWER_UNIT, units) || !read_msr(ctr.fd, d.msr, val)) {
+        Log(1).stream() << "rapl: cannot read " << d.name << " energy MSR on cpu " << cpu << std::endl;
+        close(ctr.fd);
+        ctr.fd = -1;
+        return false;
+    }
+
+    // Energy status unit: 1/2^ESU joules, in bits 12:8
+    ctr.scale = std::ldexp(1.0, -static_cast<int>((units >> 8) & 0x1F));
+
+    return true;
+}
+
+/// \brief Read all counters and update the cached totals.
+///   Only called by one thread at a time.
+void read_counters()
+{
+    for (size_t i = 0; i < num_domains; ++i) {
+        Domain& d = domains[i];
+
+        for (Counter& ctr : d.counters) {
+            uint64_t val = 0;
+
+            if (use_msr) {
+                if (!read_msr(ctr.fd, d.msr, val))
+                    continue;
+
+                // The MSR energy counters are 32 bits wide and wrap around
+                val &= 0xFFFFFFFFull;
+                d.energy_j += ctr.scale * static_cast<double>((val - ctr.last) & 0xFFFFFFFFull);
+            } else {
+                if (read(ctr.fd, &val, sizeof(val)) != sizeof(val))
+                    continue;
+
+                d.energy_j += ctr.scale * static_cast<double>(val - ctr.last);
+            }
+
+            ctr.last = val;
+        }
+
+        d.energy_uj.store(static_cast<uint64_t>(d.energy_j * 1e6), std::memory_order_relaxed);
+    }
+}
+
+void reader_thread_fn()
+{
+    std::unique_lock<std::mutex>
+        g(reader_mutex);
+
+    while (!reader_stop) {
+        reader_cv.wait_for(g, std::chrono::milliseconds(interval_ms));
+        read_counters();
+    }
+}
+
+void snapshot_cb(Caliper* c, int scope, const SnapshotRecord* trigger_info, SnapshotRecord* snapshot)
+{
+    if (!(scope & CALI_SCOPE_THREAD))
+        return;
+
+    uint64_t  val[MaxDomains];
+    cali_id_t attr[2*MaxDomains];
+    Variant   data[2*MaxDomains];
+    size_t    n = 0;
+
+    for (size_t i = 0; i < num_domains; ++i)
+        val[i] = domains[i].energy_uj.load(std::memory_order_relaxed);
+
+    if (t_state.init)
+        for (size_t i = 0; i < num_domains; ++i) {
+            attr[n] = domains[i].attr.id();
+            data[n] = Variant(1e-6 * static_cast<double>(val[i] - t_state.last[i]));
+            ++n;
+        }
+
+    for (size_t i = 0; i < num_domains; ++i)
+        t_state.last[i] = val[i];
+
+    t_state.init = true;
+
+    // Inclusive energy of begin/end regions, as in the timestamp service
+
+    if (record_inclusive && trigger_info && !c->is_signal()) {
+        Entry event = trigger_info->get(begin_evt_attr);
+
+        if (event.is_empty())
+            event = trigger_info->get(set_evt_attr);
+        if (event.is_empty())
+            event = trigger_info->get(end_evt_attr);
+
+        cali_id_t evt_attr_id = event.is_empty() ? CALI_INV_ID : event.value().to_id();
+        Variant   v_level     = trigger_info->get(lvl_attr).value();
+        size_t    level       = v_level.empty() ? 0 : v_level.to_uint();
+
+        if (evt_attr_id != CALI_INV_ID && level > 0) {
+            std::vector<uint64_t>& stack = (*acquire_energy_stacks())[evt_attr_id];
+            bool has_begin = (stack.size() >= level * num_domains);
+
+            if (event.attribute() != begin_evt_attr.id() && has_begin)
+                for (size_t i = 0; i < num_domains; ++i) {
+                    attr[n] = domains[i].inclusive_attr.id();
+                    data[n] = Variant(1e-6 * static_cast<double>(val[i] - stack[(level-1)*num_domains + i]));
+                    ++n;
+                }
+
+            if (event.attribute() == end_evt_attr.id()) {
+                if (has_begin)
+                    stack.resize((level-1) * num_domains);
+            } else {
+                // begin, set: save the values for the current entry
+                stack.resize(level * num_domains);
+
+                for (size_t i = 0; i < num_domains; ++i)
+                    stack[(level-1)*num_domains + i] = val[i];
+            }
+        }
+    }
+
+    snapshot->append(n, attr, data);
+}
+
+void post_init_cb(Caliper* c)
+{
+    begin_evt_attr = c->get_attribute("cali.event.begin");
+    set_evt_attr   = c->get_attribute("cali.event.set");
+    end_evt_attr   = c->get_attribute("cali.event.end");
+    lvl_attr       = c->get_attribute("cali.event.attr.level");
+
+    if (begin_evt_attr == Attribute::invalid ||
+        set_evt_attr   == Attribute::invalid ||
+        end_evt_attr   == Attribute::invalid ||
+        lvl_attr       == Attribute::invalid) {
+        if (record_inclusive)
+            Log(1).stream() << "rapl: Note: event trigger attributes not registered,\n"
+                "    disabling inclusive energy." << std::endl;
+
+        record_inclusive = false;
+    }
+
+    reader = std::thread(reader_thread_fn);
+}
+
+void finish_cb(Caliper*)
+{
+    if (reader.joinable()) {
+        {
+            std::lock_guard<std::mutex>
+                g(reader_mutex);
+
+            reader_stop = true;
+        }
+
+        reader_cv.notify_all();
+        reader.join();
+    }
+
+    for (size_t i = 0; i < num_domains; ++i) {
+        for (Counter& ctr : domains[i].counters)
+            close(ctr.fd);
+
+        Log(1).stream() << "rapl: " << domains[i].name << " energy: "
+                        << domains[i].energy_j << " J" << std::endl;
+    }
+}
+
+void rapl_register(Caliper* c)
+{
+    ConfigSet config = RuntimeConfig::init("rapl", configdata);
+
+    std::string backend = config.get("backend").to_string();
+
+    if (backend == "msr")
+        use_msr = true;
+    else if (backend != "perf")
+        Log(0).stream() << "rapl: unknown backend \"" << backend << "\", using perf" << std::endl;
+
+    interval_ms      = std::max<unsigned>(config.get("interval").to_uint(), 1);
+    record_inclusive = config.get("inclusive").to_bool();
+
+    std::vector<int> cpus = socket_cpus();
+
+    if (cpus.empty()) {
+        Log(0).stream() << "rapl: cannot determine the CPU sockets" << std::endl;
+        return;
+    }
+
+    for (const std::string& name : config.get("domains").to_stringlist(",")) {
+        const DomainInfo* info = nullptr;
+
+        for (const DomainInfo& di : domain_info_tbl)
+            if (name == di.name)
+                info = &di;
+
+        if (!info) {
+            Log(0).stream() << "rapl: unknown domain \"" << name << "\"" << std::endl;
+            continue;
+        }
+        if (num_domains >= MaxDomains)
+            break;
+
+        Domain& d = domains[num_domains];
+
+        d.name = name;
+        d.msr  = info->msr;
+
+        for (int cpu : cpus) {
+            Counter ctr { -1, 0, 1.0 };
+
+            if (use_msr ? open_msr_counter(d, cpu, ctr) : open_perf_counter(d, cpu, ctr))
+                d.counters.push_back(ctr);
+        }
+
+        if (d.counters.empty()) {
+            Log(0).stream() << "rapl: cannot read " << name << " energy counters" << std::endl;
+            d.name.clear();
+            continue;
+        }
+
+        ++num_domains;
+    }
+
+    if (num_domains == 0)
+        return;
+
+    if (record_inclusive && pthread_key_create(&energy_stacks_key, delete_energy_stacks) != 0) {
+        Log(0).stream() << "rapl: error: pthread_key_create() failed,\n"
+            "    disabling inclusive energy." << std::endl;
+        record_inclusive = false;
+    }
+
+    // Set the initial raw values
+    for (size_t i = 0; i < num_domains; ++i) {
+        for (Counter& ctr : domains[i].counters) {
+            uint64_t val = 0;
+
+            if (use_msr ? read_msr(ctr.fd, domains[i].msr, val) : (read(ctr.fd, &val, sizeof(val)) == sizeof(val)))
+                ctr.last = use_msr ? (val & 0xFFFFFFFFull) : val;
+        }
+    }
+
+    Attribute aggr_class_attr = c->get_attribute("class.aggregatable");
+    Attribute unit_attr       = c->create_attribute("energy.unit", CALI_TYPE_STRING, CALI_ATTR_SKIP_EVENTS);
+
+    Attribute meta_attr[2] = { aggr_class_attr, unit_attr };
+    Variant   meta_vals[2] = { Variant(true), Variant(CALI_TYPE_STRING, "J", 1) };
+
+    for (size_t i = 0; i < num_domains; ++i) {
+        domains[i].attr =
+            c->create_attribute(std::string("energy.") + domains[i].name, CALI_TYPE_DOUBLE,
+                                CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD | CALI_ATTR_SKIP_EVENTS,
+                                2, meta_attr, meta_vals);
+        domains[i].inclusive_attr =
+            c->create_attribute(std::string("energy.inclusive.") + domains[i].name, CALI_TYPE_DOUBLE,
+                                CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD | CALI_ATTR_SKIP_EVENTS,
+                                2, meta_attr, meta_vals);
+    }
+
+    c->events().post_init_evt.connect(&post_init_cb);
+    c->events().snapshot.connect(&snapshot_cb);
+    c->events().finish_evt.connect(&finish_cb);
+
+    Log(1).stream() << "Registered rapl service (" << num_domains << " domains, "
+                    << cpus.size() << " sockets)" << std::endl;
+}
+
+} // namespace
+
+namespace cali
+{
+    CaliperService rapl_service = { "rapl", ::rapl_register };
+}
@@ -38,6 +38,7 @@
 #include "caliper/Caliper.h"
 #include "caliper/SnapshotRecord.h"
 
+#include "caliper/common/binary/BinaryWriter.h"
 #include "caliper/common/csv/CsvWriter.h"
 
 #include "caliper/common/ContextRecord.h"
@@ -51,11 +52,17 @@
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <mutex>
 #include <fstream>
 #include <random>
+#include <streambuf>
 #include <string>
+#include <thread>
+#include <vector>
 
 using namespace cali;
 using namespace std;
@@ -63,6 +70,193 @@ using namespace std;
 namespace 
 {
 
+/// \brief Stream buffer that hands off output in batches to a background
+///   I/O thread.
+///
+/// Writers fill a batch buffer; full batches are queued and written to
+/// their target output stream by a dedicated thread. Writers block
+/// when more than queue_depth batches are waiting to be written.
+class AsyncWriter : public std::streambuf
+{
+    struct Batch {
+        std::vector<char> data;
+        size_t            len;
+        OutputStream      os;
+    };
+
+    size_t                  m_batch_size;
+    size_t                  m_queue_depth;
+
+    OutputStream            m_target;
+    std::vector<char>       m_current;
+
+    std::deque<Batch>       m_queue;
+    std::vector< std::vector<char> >
+                            m_free;
+
+    std::mutex              m_lock;
+    std::condition_variable m_queue_cv;
+    std::condition_variable m_space_cv;
+
+    bool                    m_busy;
+    bool                    m_stop;
+
+    size_t                  m_num_batches;
+    size_t                  m_num_stalls;
+
+    std::thread             m_thread;
+
+    void io_thread_loop() {
+        std::unique_lock<std::mutex> g(m_lock);
+
+        while (true) {
+            m_queue_cv.wait(g, [this](){ return m_stop || !m_queue.empty(); });
+
+            if (m_queue.empty())
+                break; // stopped
+
+            Batch batch = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_busy = true;
+
+            g.unlock();
+
+            std::ostream& os = batch.os.stream();
+
+            os.write(batch.data.data(), batch.len);
+
+            g.lock();
+
+            if (m_queue.empty())
+                os.flush();
+
+            m_free.push_back(std::move(batch.data));
+            m_busy = false;
+            ++m_num_batches;
+
+            m_space_cv.notify_all();
+        }
+    }
+
+    void handoff() {
+        size_t len = pptr() - pbase();
+
+        if (len == 0)
+            return;
+
+        std::unique_lock<std::mutex> g(m_lock);
+
+        if (m_queue.size() >= m_queue_depth) {
+            ++m_num_stalls;
+            m_space_cv.wait(g, [this](){ return m_queue.size() < m_queue_depth; });
+        }
+
+        m_queue.push_back(Batch { std::move(m_current), len, m_target });
+
+        if (m_free.empty()) {
+            m_current.assign(m_batch_size, 0);
+        } else {
+            m_current = std::move(m_free.back());
+            m_free.pop_back();
+        }
+
+        g.unlock();
+
+        m_queue_cv.notify_one();
+
+        setp(m_current.data(), m_current.data() + m_current.size());
+    }
+
+protected:
+
+    int_type overflow(int_type ch) {
+        handoff();
+
+        if (traits_type::eq_int_type(ch, traits_type::eof()))
+            return traits_type::not_eof(ch);
+
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+
+        return ch;
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) {
+        std::streamsize written = 0;
+
+        while (written < n) {
+            if (pptr() == epptr())
+                handoff();
+
+            std::streamsize len = std::min<std::streamsize>(n - written, epptr() - pptr());
+
+            memcpy(pptr(), s + written, len);
+            pbump(static_cast<int>(len));
+
+            written += len;
+        }
+
+        return written;
+    }
+
+    int sync() {
+        // Records are written with std::endl: don't hand off on every
+        // flush request, only when the batch is full or committed
+        return 0;
+    }
+
+public:
+
+    AsyncWriter(size_t batch_size, size_t queue_depth)
+        : m_batch_size(std::max<size_t>(batch_size, 1024)),
+          m_queue_depth(std::max<size_t>(queue_depth, 1)),
+          m_current(m_batch_size, 0),
+          m_busy(false),
+          m_stop(false),
+          m_num_batches(0),
+          m_num_stalls(0)
+    {
+        setp(m_current.data(), m_current.data() + m_current.size());
+        m_thread = std::thread(&AsyncWriter::io_thread_loop, this);
+    }
+
+    ~AsyncWriter() {
+        drain();
+
+        {
+            std::lock_guard<std::mutex> g(m_lock);
+            m_stop = true;
+        }
+
+        m_queue_cv.notify_one();
+        m_thread.join();
+    }
+
+    /// \brief Set the output stream for subsequent writes.
+    ///   Pending output goes to the previous target stream.
+    void set_target(const OutputStream& os) {
+        handoff();
+        m_target = os;
+    }
+
+    /// \brief Queue the current batch for writing.
+    void commit() {
+        handoff();
+    }
+
+    /// \brief Block until all pending output has been written.
+    void drain() {
+        handoff();
+
+        std::unique_lock<std::mutex> g(m_lock);
+
+        m_space_cv.wait(g, [this](){ return m_queue.empty() && !m_busy; });
+    }
+
+    size_t num_batches() const { return m_num_batches; }
+    size_t num_stalls()  const { return m_num_stalls;  }
+};
+
 class Recorder
 {    
     static unique_ptr<Recorder>   s_instance;
@@ -70,6 +264,15 @@ class Recorder
 
     ConfigSet m_config;
     CsvWriter m_writer;
+
+    bool         m_binary;
+    BinaryWriter m_bin_writer;
+
+    bool         m_compress;
+    OutputStream m_stream;
+
+    unique_ptr<AsyncWriter>  m_async;
+    unique_ptr<std::ostream> m_async_stream;
     
     // --- helpers
 
@@ -108,12 +311,37 @@ class Recorder
         std::string filename = m_config.get("filename").to_string();
 
         if (filename.empty())
-            filename = create_filename();
+            filename = create_filename() + (m_compress && !m_binary ? ".gz" : "");
 
         OutputStream stream;
         stream.set_filename(filename.c_str(), *c, flush_info->to_entrylist());
-        
-        m_writer = CsvWriter(stream);
+
+        stream.set_buffer_size(m_config.get("buffer_size").to_uint() * 1024);
+        stream.set_direct_io(m_config.get("direct_io").to_bool());
+        stream.set_fsync(m_config.get("fsync").to_bool());
+
+        if (m_compress)
+            stream.set_compression(OutputStream::Gzip);
+        if (m_binary && stream.compression() != OutputStream::NoCompression) {
+            Log(1).stream() << "Recorder: binary output can't be compressed, writing uncompressed output" << endl;
+            stream.set_compression(OutputStream::NoCompression);
+        }
+
+        m_stream = stream;
+
+        if (m_async) {
+            // write into the async writer's batch buffers instead
+            OutputStream batchstream;
+            batchstream.set_stream(m_async_stream.get());
+
+            m_async->set_target(stream);
+            stream = batchstream;
+        }
+
+        if (m_binary)
+            m_bin_writer = BinaryWriter(stream);
+        else
+            m_writer = CsvWriter(stream);
     }
 
     void flush_snapshot(Caliper* c, const SnapshotRecord* flush_info, const SnapshotRecord* snapshot) {        
@@ -126,12 +354,26 @@ class Recorder
         for (size_t i = 0; i < nn; ++i)
             node_ids[i] = data.node_entries[i]->id();
 
-        m_writer.write_snapshot(*c, nn, node_ids,
-                                sizes.n_immediate, data.immediate_attr, data.immediate_data);
+        if (m_binary)
+            m_bin_writer.write_snapshot(*c, nn, node_ids,
+                                        sizes.n_immediate, data.immediate_attr, data.immediate_data);
+        else
+            m_writer.write_snapshot(*c, nn, node_ids,
+                                    sizes.n_immediate, data.immediate_attr, data.immediate_data);
     }
 
     void post_flush(Caliper* c) {
-        m_writer.write_globals(*c, c->get_globals());
+        if (m_binary) {
+            m_bin_writer.write_globals(*c, c->get_globals());
+            m_bin_writer.flush();
+        } else {
+            m_writer.write_globals(*c, c->get_globals());
+        }
+
+        if (m_async)
+            m_async->commit();
+        else if (m_stream.compression() != OutputStream::NoCompression)
+            m_stream.stream().flush(); // write out the compressed blocks
     }
 
     static void flush_snapshot_cb(Caliper* c, const SnapshotRecord* flush_info, const SnapshotRecord* snapshot) {
@@ -156,8 +398,21 @@ class Recorder
     }
 
     static void finish_cb(Caliper* c) {
-        if (s_instance)
-            Log(1).stream() << "Recorder: Wrote " << s_instance->m_writer.num_written() << " records." << endl;
+        if (!s_instance)
+            return;
+
+        if (s_instance->m_async) {
+            s_instance->m_async->drain();
+
+            Log(2).stream() << "Recorder: async writer wrote "
+                            << s_instance->m_async->num_batches() << " batches, stalled "
+                            << s_instance->m_async->num_stalls()  << " times." << endl;
+        }
+
+        size_t num_written = s_instance->m_binary ?
+            s_instance->m_bin_writer.num_written() : s_instance->m_writer.num_written();
+
+        Log(1).stream() << "Recorder: Wrote " << num_written << " records." << endl;
     }
     
     void register_callbacks(Caliper* c) {
@@ -168,8 +423,24 @@ class Recorder
     }
 
     Recorder(Caliper* c)
-        : m_config { RuntimeConfig::init("recorder", s_configdata) }
+        : m_config { RuntimeConfig::init("recorder", s_configdata) },
+          m_binary { false },
+          m_compress { m_config.get("compress").to_bool() }
     { 
+        std::string format = m_config.get("format").to_string();
+
+        if (format == "binary")
+            m_binary = true;
+        else if (format != "csv")
+            Log(0).stream() << "Recorder: Unknown output format \"" << format
+                            << "\", using csv" << endl;
+
+        if (m_config.get("async").to_bool()) {
+            m_async.reset(new AsyncWriter(m_config.get("async_buffer_size").to_uint() * 1024,
+                                          m_config.get("async_queue_depth").to_uint()));
+            m_async_stream.reset(new std::ostream(m_async.get()));
+        }
+
         register_callbacks(c);
         Log(1).stream() << "Registered recorder service" << endl;
     }
@@ -194,6 +465,48 @@ const ConfigSet::Entry Recorder::s_configdata[] = {
       "   stderr: Standard error stream.\n"
       " or a file name pattern. By default, a filename is auto-generated.\n"
     },
+    { "format", CALI_TYPE_STRING, "csv",
+      "Output format: csv or binary",
+      "Output format. Either one of\n"
+      "   csv:    Text .cali format,\n"
+      "   binary: Binary .cali container format.\n"
+      " cali-query reads both formats.\n"
+    },
+    { "async", CALI_TYPE_BOOL, "false",
+      "Write output in a background thread",
+      "Write output in a background thread.\n"
+      "Records are formatted into batch buffers, which are written\n"
+      "to the output stream by a dedicated I/O thread."
+    },
+    { "async_buffer_size", CALI_TYPE_UINT, "1024",
+      "Size of async writer batch buffers in KiB",
+      "Size of async writer batch buffers in KiB"
+    },
+    { "async_queue_depth", CALI_TYPE_UINT, "4",
+      "Max. number of batches waiting to be written in async mode",
+      "Max. number of batches waiting to be written in async mode.\n"
+      "Writers block when the queue is full."
+    },
+    { "compress", CALI_TYPE_BOOL, "false",
+      "Write gzip-compressed output",
+      "Write gzip-compressed output (csv format only).\n"
+      "Compression runs in background threads. File names ending\n"
+      "in .gz enable compression as well."
+    },
+    { "buffer_size", CALI_TYPE_UINT, "4096",
+      "Size of the file write buffer in KiB",
+      "Size of the file write buffer in KiB.\n"
+      "Output files are written in blocks of this size."
+    },
+    { "direct_io", CALI_TYPE_BOOL, "false",
+      "Write output files with direct I/O (O_DIRECT)",
+      "Write output files with direct I/O (O_DIRECT), bypassing the\n"
+      "OS page cache."
+    },
+    { "fsync", CALI_TYPE_BOOL, "false",
+      "Call fsync() after writing an output file",
+      "Call fsync() after writing an output file"
+    },
     ConfigSet::Terminator
 };
 
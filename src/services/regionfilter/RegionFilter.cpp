@@ -0,0 +1,318 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+/// \file  RegionFilter.cpp
+/// \brief Drops begin/end events of selected regions at runtime
+
+#include "caliper/CaliperService.h"
+
+#include "caliper/Caliper.h"
+
+#include "caliper/common/Log.h"
+#include "caliper/common/RuntimeConfig.h"
+
+#include <fnmatch.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <vector>
+
+using namespace cali;
+using namespace std;
+
+namespace
+{
+
+const ConfigSet::Entry configdata[] = {
+    { "exclude", CALI_TYPE_STRING, "",
+      "Comma-separated list of regions to drop",
+      "Comma-separated list of regions to drop, as [attribute=]value patterns.\n"
+      "A pattern without attribute applies to all nested region attributes\n"
+      "(e.g., function, loop, annotation)."
+    },
+    { "include", CALI_TYPE_STRING, "",
+      "Comma-separated list of regions to keep",
+      "Comma-separated list of regions to keep, as [attribute=]value patterns.\n"
+      "Regions of the given attributes that match none of the patterns are\n"
+      "dropped. Exclude patterns take precedence."
+    },
+    { "regex", CALI_TYPE_BOOL, "false",
+      "Use regular expressions instead of glob patterns",
+      "Interpret patterns as (ECMAScript) regular expressions instead of\n"
+      "shell-style glob patterns."
+    },
+    ConfigSet::Terminator
+};
+
+struct Pattern {
+    std::string text;
+    std::regex  re;
+    bool        is_regex;
+
+    bool match(const std::string& str) const {
+        if (is_regex)
+            return std::regex_match(str, re);
+
+        return fnmatch(text.c_str(), str.c_str(), 0) == 0;
+    }
+
+    bool matches_all() const {
+        return is_regex ? (text == ".*") : (text == "*");
+    }
+};
+
+struct Rule {
+    Pattern attr;
+    Pattern value;
+    bool    any_region; ///< no attribute pattern: applies to nested attributes
+};
+
+std::vector<Rule> exclude_rules;
+std::vector<Rule> include_rules;
+
+/// \brief The rules that apply to one attribute, with a cache of
+///   per-value decisions.
+///
+///   Cache slots hold a value hash with the decision in bit 1 and a
+/// valid flag in bit 0. Slots are replaced freely, so a lookup is a
+/// single lock-free load. Hashes don't need to be unique for all values
+/// ever seen: a 62-bit collision between two region names of the same
+/// attribute is not a practical concern.
+struct AttributeFilter {
+    static const size_t CacheSlots = 1024;
+
+    std::vector<const Rule*> excludes;
+    std::vector<const Rule*> includes;
+
+    std::atomic<uint64_t>    cache[CacheSlots];
+
+    AttributeFilter() {
+        for (size_t i = 0; i < CacheSlots; ++i)
+            cache[i].store(0, std::memory_order_relaxed);
+    }
+
+    bool is_excluded(const std::string& value) const {
+        for (const Rule* r : excludes)
+            if (r->value.match(value))
+                return true;
+
+        if (includes.empty())
+            return false;
+
+        for (const Rule* r : includes)
+            if (r->value.match(value))
+                return false;
+
+        return true;
+    }
+};
+
+std::mutex                                    filter_lock;
+std::vector< std::unique_ptr<AttributeFilter> > filters;
+std::vector<Attribute>                        filtered_attrs;
+
+inline uint64_t hash_value(const Variant& v)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(v.data());
+    size_t   n = v.size();
+    uint64_t h = 0xcbf29ce484222325ULL ^ static_cast<uint64_t>(v.type());
+
+    for (size_t i = 0; i < n; ++i)
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+bool exclude_all_cb(const void*, const Attribute&, const Variant&, bool)
+{
+    return true;
+}
+
+bool filter_cb(const void* arg, const Attribute&, const Variant& value, bool is_signal)
+{
+    const AttributeFilter* f = static_cast<const AttributeFilter*>(arg);
+
+    uint64_t h    = hash_value(value);
+    uint64_t key  = h & ~uint64_t(3);
+    auto&    slot = const_cast<AttributeFilter*>(f)->cache[h % AttributeFilter::CacheSlots];
+    uint64_t e    = slot.load(std::memory_order_relaxed);
+
+    if ((e & 1) && (e & ~uint64_t(3)) == key)
+        return (e & 2);
+
+    // Pattern matching may allocate: keep uncached regions in signal handlers
+    if (is_signal)
+        return false;
+
+    std::string str = (value.type() == CALI_TYPE_STRING ?
+                       std::string(static_cast<const char*>(value.data()), value.size()) :
+                       value.to_string());
+
+    bool excluded = f->is_excluded(str);
+
+    slot.store(key | (excluded ? 2 : 0) | 1, std::memory_order_relaxed);
+
+    return excluded;
+}
+
+bool rule_applies(const Rule& r, const Attribute& attr)
+{
+    if (r.any_region)
+        return attr.is_nested();
+
+    return r.attr.match(attr.name());
+}
+
+void create_attr_cb(Caliper* c, const Attribute& attr)
+{
+    std::unique_ptr<AttributeFilter> f(new AttributeFilter);
+
+    for (const Rule& r : exclude_rules)
+        if (rule_applies(r, attr))
+            f->excludes.push_back(&r);
+    for (const Rule& r : include_rules)
+        if (rule_applies(r, attr))
+            f->includes.push_back(&r);
+
+    if (f->excludes.empty() && f->includes.empty())
+        return;
+
+    bool exclude_all = false;
+
+    for (const Rule* r : f->excludes)
+        if (r->value.matches_all())
+            exclude_all = true;
+
+    std::lock_guard<std::mutex>
+        g(filter_lock);
+
+    filtered_attrs.push_back(attr);
+
+    if (exclude_all) {
+        c->set_region_filter(attr, exclude_all_cb);
+    } else {
+        c->set_region_filter(attr, filter_cb, f.get());
+        filters.push_back(std::move(f));
+    }
+
+    Log(2).stream() << "regionfilter: filtering regions of " << attr.name() << std::endl;
+}
+
+bool parse_rules(const std::vector<std::string>& list, bool use_regex, std::vector<Rule>& rules)
+{
+    for (const std::string& s : list) {
+        if (s.empty())
+            continue;
+
+        std::string::size_type eq = s.find('=');
+
+        Rule r;
+
+        r.any_region     = (eq == std::string::npos);
+        r.attr.text      = r.any_region ? std::string() : s.substr(0, eq);
+        r.value.text     = r.any_region ? s : s.substr(eq + 1);
+        r.attr.is_regex  = use_regex;
+        r.value.is_regex = use_regex;
+
+        if (use_regex) {
+            try {
+                if (!r.any_region)
+                    r.attr.re = std::regex(r.attr.text);
+                r.value.re = std::regex(r.value.text);
+            } catch (const std::regex_error& e) {
+                Log(0).stream() << "regionfilter: invalid regular expression in \""
+                                << s << "\": " << e.what() << std::endl;
+                return false;
+            }
+        }
+
+        rules.push_back(r);
+    }
+
+    return true;
+}
+
+void finish_cb(Caliper* c)
+{
+    std::lock_guard<std::mutex>
+        g(filter_lock);
+
+    for (const Attribute& attr : filtered_attrs) {
+        uint64_t n = c->num_filtered_regions(attr);
+
+        if (n > 0)
+            Log(1).stream() << "regionfilter: " << attr.name() << ": "
+                            << n << " regions dropped" << std::endl;
+    }
+}
+
+void regionfilter_register(Caliper* c)
+{
+    ConfigSet config = RuntimeConfig::init("regionfilter", configdata);
+
+    bool use_regex = config.get("regex").to_bool();
+
+    if (!parse_rules(config.get("exclude").to_stringlist(","), use_regex, exclude_rules) ||
+        !parse_rules(config.get("include").to_stringlist(","), use_regex, include_rules)) {
+        Log(0).stream() << "regionfilter: no regions will be filtered" << std::endl;
+        return;
+    }
+
+    if (exclude_rules.empty() && include_rules.empty()) {
+        Log(1).stream() << "regionfilter: no filter patterns given" << std::endl;
+        return;
+    }
+
+    for (const Attribute& attr : c->get_attributes())
+        create_attr_cb(c, attr);
+
+    c->events().create_attr_evt.connect(&create_attr_cb);
+    c->events().finish_evt.connect(&finish_cb);
+
+    Log(1).stream() << "Registered regionfilter service" << std::endl;
+}
+
+} // namespace
+
+namespace cali
+{
+    CaliperService regionfilter_service = { "regionfilter", ::regionfilter_register };
+}
@@ -59,9 +59,20 @@ namespace
         static const ConfigSet::Entry  s_configdata[];
 
         QueryProcessor m_query;
+        EntryList      m_list; ///< record buffer reused across snapshots
 
         void process_snapshot(Caliper* c, const SnapshotRecord* snapshot) {
-            m_query.process_record(*c, snapshot->to_entrylist());
+            SnapshotRecord::Data  data = snapshot->data();
+            SnapshotRecord::Sizes size = snapshot->size();
+
+            m_list.clear();
+
+            for (size_t i = 0; i < size.n_nodes; ++i)
+                m_list.push_back(Entry(data.node_entries[i]));
+            for (size_t i = 0; i < size.n_immediate; ++i)
+                m_list.push_back(Entry(data.immediate_attr[i], data.immediate_data[i]));
+
+            m_query.process_record(*c, m_list);
         }
 
         void flush(Caliper* c, const SnapshotRecord*) {
@@ -101,7 +112,9 @@ namespace
             if (!filename.empty())
                 stream.set_filename(filename.c_str(), *c, flush_info->to_entrylist());
             
-            s_instance.reset(new Report(QueryProcessor(spec, stream)));
+            unsigned     threads = config.get("threads").to_uint();
+
+            s_instance.reset(new Report(QueryProcessor(spec, stream, threads)));
         }
 
         static void write_snapshot_cb(Caliper* c, const SnapshotRecord*, const SnapshotRecord* snapshot) {
@@ -146,6 +159,12 @@ namespace
           "Report configuration/query specification in CalQL",
           "Report configuration/query specification in CalQL"
         },
+        { "threads", CALI_TYPE_UINT, "1",
+          "Number of threads for filtering and aggregating records",
+          "Number of worker threads for filtering and aggregating records.\n"
+          "With more than one thread, records are processed in batches in\n"
+          "a pipeline, and a separate thread writes the output."
+        },
         ConfigSet::Terminator
     };
 
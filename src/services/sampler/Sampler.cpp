@@ -41,6 +41,9 @@
 #include "caliper/common/Log.h"
 #include "caliper/common/RuntimeConfig.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <signal.h>
@@ -55,6 +58,12 @@
 
 #include "context.h"
 
+#ifdef CALI_HAVE_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#endif
+
 using namespace cali;
 using namespace std;
 
@@ -62,16 +71,44 @@ namespace
 {
     Attribute timer_attr   { Attribute::invalid };
     Attribute sampler_attr { Attribute::invalid };
+    Attribute weight_attr  { Attribute::invalid };
 
     cali_id_t sampler_attr_id    = CALI_INV_ID;
+    cali_id_t weight_attr_id     = CALI_INV_ID;
     
     ConfigSet config;
 
     int       nsec_interval       = 0;
+    int       frequency           = 10;
     int       sample_contexts     = 0;
 
-    int       n_samples           = 0;
-    int       n_processed_samples = 0;
+    bool      use_perf            = false;
+
+    bool      adaptive            = false;
+    long      min_nsec_interval   = 0;
+    long      max_nsec_interval   = 0;
+    double    target_overhead     = 0.01;
+
+    /// \brief Per-thread state for the adaptive timer mode.
+    ///
+    /// Written only by the owning thread, in its signal handler and
+    /// annotation callbacks. The first access happens outside of the
+    /// signal handler, in setup_settimer().
+    struct AdaptiveTimer {
+        timer_t           timer;
+        bool              active;
+        long              nsec_interval;   ///< Current sampling interval
+        long              nsec_floor;      ///< Shortest interval within the overhead limit
+        double            nsec_cost;       ///< Running average of the handler time
+        struct timespec   last_sample;     ///< Time of the previous sample
+        volatile unsigned ctx_changes;     ///< Context updates, counted in annotation callbacks
+        unsigned          last_ctx_changes;
+    };
+
+    thread_local AdaptiveTimer t_adaptive = { timer_t(), false, 0, 0, 0.0, { 0, 0 }, 0, 0 };
+
+    std::atomic<int> n_samples           { 0 };
+    std::atomic<int> n_processed_samples { 0 };
 
     static const ConfigSet::Entry s_configdata[] = {
         { "frequency", CALI_TYPE_INT, "10",
@@ -82,12 +119,144 @@ namespace
           "Capture process-wide context information",
           "Capture process-wide context information in addition to thread-local context"
         },
+        { "backend", CALI_TYPE_STRING, "timer",
+          "Sampling mechanism",
+          "Sampling mechanism:\n"
+          "   timer:  Take snapshots in a SIGPROF timer signal handler\n"
+          "   perf:   Let the kernel record program addresses into a perf_event\n"
+          "           ring buffer, and process them at the thread's next\n"
+          "           annotation event or flush. Linux only."
+        },
+        { "perf_event", CALI_TYPE_STRING, "task-clock",
+          "perf_event event for the perf backend",
+          "perf_event event that triggers samples with the perf backend:\n"
+          "   task-clock:  CPU time of the thread\n"
+          "   cpu-clock:   CPU clock\n"
+          "   cycles:      CPU cycles (hardware event)"
+        },
+        { "adaptive", CALI_TYPE_BOOL, "false",
+          "Adapt each thread's sampling frequency at runtime",
+          "Adapt each thread's sampling frequency at runtime. Starting at\n"
+          "the given frequency, the sampling interval drops to the shortest\n"
+          "allowed interval when the thread's context changes, and grows\n"
+          "by a quarter with each sample in steady regions, within the\n"
+          "min_frequency/max_frequency range and the target_overhead limit.\n"
+          "Each sample gets a cali.sampler.weight attribute with the time\n"
+          "(in seconds) since the thread's previous sample. Timer backend only."
+        },
+        { "min_frequency", CALI_TYPE_INT, "1",
+          "Lowest sampling frequency (in Hz) in adaptive mode",
+          "Lowest sampling frequency (in Hz) in adaptive mode"
+        },
+        { "max_frequency", CALI_TYPE_INT, "1000",
+          "Highest sampling frequency (in Hz) in adaptive mode",
+          "Highest sampling frequency (in Hz) in adaptive mode"
+        },
+        { "target_overhead", CALI_TYPE_DOUBLE, "1.0",
+          "Max. time spent taking samples in adaptive mode, in percent",
+          "Max. time spent taking samples in adaptive mode, in percent of\n"
+          "each thread's run time. Limits the sampling frequency."
+        },
+        { "perf_buffer_pages", CALI_TYPE_UINT, "64",
+          "Size of the per-thread perf_event ring buffer in pages",
+          "Size of the per-thread perf_event ring buffer in memory pages.\n"
+          "Rounded up to a power of two. Samples are lost when the buffer\n"
+          "overflows before it is processed."
+        },
         ConfigSet::Terminator
     };
 
+    bool set_interval(timer_t timer, long nsec)
+    {
+        struct itimerspec spec;
+
+        spec.it_interval.tv_sec  = nsec / 1000000000;
+        spec.it_interval.tv_nsec = nsec % 1000000000;
+        spec.it_value            = spec.it_interval;
+
+        return timer_settime(timer, 0, &spec, NULL) == 0;
+    }
+
+    long timespec_diff_nsec(const struct timespec& beg, const struct timespec& end)
+    {
+        return (end.tv_sec - beg.tv_sec) * 1000000000L + (end.tv_nsec - beg.tv_nsec);
+    }
+
+    /// \brief Pick the calling thread's next sampling interval, given the
+    ///   time \a nsec_cost the last sample took. Runs in the signal handler.
+    void adapt_interval(AdaptiveTimer& t, long nsec_cost)
+    {
+        t.nsec_cost  = (t.nsec_cost > 0.0 ? 0.875 * t.nsec_cost + 0.125 * nsec_cost : nsec_cost);
+        t.nsec_floor = std::min(std::max(min_nsec_interval, static_cast<long>(t.nsec_cost / target_overhead)),
+                                max_nsec_interval);
+
+        unsigned changes = t.ctx_changes;
+        long     nsec    = t.nsec_interval;
+
+        // Sample short phases at a high rate, and steady ones at a lower rate
+        if (changes != t.last_ctx_changes)
+            nsec = t.nsec_floor;
+        else
+            nsec += nsec / 4;
+
+        t.last_ctx_changes = changes;
+
+        nsec = std::min(std::max(nsec, t.nsec_floor), max_nsec_interval);
+
+        if (nsec != t.nsec_interval && set_interval(t.timer, nsec))
+            t.nsec_interval = nsec;
+    }
+
+    void on_prof_adaptive(void* context)
+    {
+        AdaptiveTimer& t = t_adaptive;
+
+        if (!t.active)
+            return;
+
+        struct timespec beg;
+        clock_gettime(CLOCK_MONOTONIC, &beg);
+
+        Caliper c = Caliper::sigsafe_instance();
+
+        if (c) {
+            // The sample represents the time since the previous one.
+            //   A dropped sample's time goes to the next one.
+            double weight = 1e-9 * timespec_diff_nsec(t.last_sample, beg);
+
+            t.last_sample = beg;
+
+            Variant v_weight(weight);
+#ifdef CALI_SAMPLER_GET_PC
+            uint64_t  pc = static_cast<uint64_t>( CALI_SAMPLER_GET_PC(context) );
+
+            cali_id_t attr[2] = { sampler_attr_id, weight_attr_id };
+            Variant   data[2] = { Variant(CALI_TYPE_ADDR, &pc, sizeof(uint64_t)), v_weight };
+
+            SnapshotRecord trigger_info(2, attr, data);
+#else
+            SnapshotRecord trigger_info(1, &weight_attr_id, &v_weight);
+#endif
+
+            c.push_snapshot(sample_contexts, &trigger_info);
+
+            ++n_processed_samples;
+        }
+
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        adapt_interval(t, timespec_diff_nsec(beg, end));
+    }
+
     void on_prof(int sig, siginfo_t *info, void *context)
     {
         ++n_samples;
+
+        if (adaptive) {
+            on_prof_adaptive(context);
+            return;
+        }
         
         Caliper c = Caliper::sigsafe_instance();
 
@@ -147,15 +316,22 @@ namespace
             Log(0).stream() << "sampler: timer_create() failed" << std::endl;
             return;
         }
-        
-        struct itimerspec spec;
 
-        spec.it_interval.tv_sec  = 0;
-        spec.it_interval.tv_nsec = nsec_interval;
-        spec.it_value.tv_sec     = 0;
-        spec.it_value.tv_nsec    = nsec_interval;
+        if (adaptive) {
+            AdaptiveTimer& t = t_adaptive;
+
+            t.timer            = timer;
+            t.nsec_interval    = nsec_interval;
+            t.nsec_floor       = min_nsec_interval;
+            t.nsec_cost        = 0.0;
+            t.last_ctx_changes = t.ctx_changes;
+
+            clock_gettime(CLOCK_MONOTONIC, &t.last_sample);
 
-        if (timer_settime(timer, 0, &spec, NULL) == -1) {
+            t.active           = true;
+        }
+
+        if (!set_interval(timer, nsec_interval)) {
             Log(0).stream() << "sampler: timer_settime() failed" << std::endl;
             return;
         }
@@ -186,26 +362,305 @@ namespace
 
         Log(2).stream() << "Deleting timer " << v_timer << endl;
 
+        // only the timer's thread can have an adaptive timer state for it
+        if (t_adaptive.active && memcmp(&t_adaptive.timer, &timer, sizeof(timer_t)) == 0)
+            t_adaptive.active = false;
+
         timer_delete(timer);
     }
+
+    void adaptive_context_change(Caliper* c) {
+        AdaptiveTimer& t = t_adaptive;
+
+        ++t.ctx_changes;
+
+        // Restart a long interval right away, so that a short phase after
+        // a long steady one doesn't go unsampled. The interval has to
+        // grow again first before the next restart, which bounds the
+        // number of timer_settime() calls.
+        if (!t.active || t.nsec_interval <= 4 * t.nsec_floor)
+            return;
+
+        t.nsec_interval = t.nsec_floor;
+        set_interval(t.timer, t.nsec_floor);
+
+        // The time since the previous sample belongs to the context that
+        // is about to change: take a snapshot (without program address)
+        // with its weight now rather than adding it to the next sample
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        Variant v_weight(1e-9 * timespec_diff_nsec(t.last_sample, now));
+        SnapshotRecord trigger_info(1, &weight_attr_id, &v_weight);
+
+        t.last_sample = now;
+
+        c->push_snapshot(sample_contexts, &trigger_info);
+    }
+
+    void adaptive_update_cb(Caliper* c, const Attribute&, const Variant&) {
+        adaptive_context_change(c);
+    }
+
+    void adaptive_set_many_cb(Caliper* c, size_t, const Attribute*, const Variant*) {
+        adaptive_context_change(c);
+    }
     
+#ifdef CALI_HAVE_PERF_EVENT_H
+
+    //
+    // --- perf_event backend
+    //
+    //   The kernel writes a PERF_RECORD_SAMPLE with the program address
+    //   into a per-thread ring buffer with each sample. The thread turns
+    //   the samples into snapshots right before its context changes, i.e.
+    //   in the pre_begin/set/end callbacks, at flushes, and when the
+    //   thread ends. All samples taken since the last context change
+    //   share the context that is still on the blackboard then.
+    //
+
+    uint32_t  perf_type           = PERF_TYPE_SOFTWARE;
+    uint64_t  perf_config         = PERF_COUNT_SW_TASK_CLOCK;
+    size_t    perf_pages          = 64; // ring buffer data pages
+
+    std::atomic<int> n_lost_samples { 0 };
+
+    struct PerfBuffer {
+        int                          fd;
+        struct perf_event_mmap_page* meta;
+        size_t                       map_size;
+        unsigned char*               data;
+        uint64_t                     data_size; // power of two
+        bool                         draining;
+    };
+
+    thread_local PerfBuffer* t_perf_buf = nullptr;
+
+    bool setup_perf_buffer() {
+        if (t_perf_buf)
+            return true;
+
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+
+        attr.size           = sizeof(attr);
+        attr.type           = perf_type;
+        attr.config         = perf_config;
+        attr.freq           = 1;
+        attr.sample_freq    = frequency;
+        attr.sample_type    = PERF_SAMPLE_IP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+
+        unsigned long flags = 0;
+#ifdef PERF_FLAG_FD_CLOEXEC
+        flags |= PERF_FLAG_FD_CLOEXEC;
+#endif
+
+        // pid 0, cpu -1: the calling thread on any CPU
+        int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, flags));
+
+        if (fd < 0) {
+            Log(0).stream() << "sampler: perf_event_open() failed: " << strerror(errno) << endl;
+            return false;
+        }
+
+        size_t pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t map_size = (perf_pages + 1) * pagesize;
+        void*  ptr      = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (ptr == MAP_FAILED) {
+            Log(0).stream() << "sampler: mmap() of perf_event buffer failed: " << strerror(errno) << endl;
+            close(fd);
+            return false;
+        }
+
+        PerfBuffer* buf = new PerfBuffer;
+
+        buf->fd         = fd;
+        buf->meta       = static_cast<struct perf_event_mmap_page*>(ptr);
+        buf->map_size   = map_size;
+        buf->data       = static_cast<unsigned char*>(ptr) + pagesize;
+        buf->data_size  = perf_pages * pagesize;
+        buf->draining   = false;
+
+        t_perf_buf = buf;
+
+        return true;
+    }
+
+    // Copy len bytes at ring buffer position pos, which may wrap around
+    void read_ring(const PerfBuffer* buf, uint64_t pos, void* dst, size_t len) {
+        size_t offset = pos & (buf->data_size - 1);
+        size_t first  = std::min<size_t>(len, buf->data_size - offset);
+
+        memcpy(dst, buf->data + offset, first);
+
+        if (first < len)
+            memcpy(static_cast<unsigned char*>(dst) + first, buf->data, len - first);
+    }
+
+    void drain_perf_buffer(Caliper* c) {
+        PerfBuffer* buf = t_perf_buf;
+
+        if (!buf || buf->draining)
+            return;
+
+        uint64_t head = __atomic_load_n(&buf->meta->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = buf->meta->data_tail;
+
+        if (head == tail)
+            return;
+
+        // the snapshots may invoke callbacks that end up here again
+        buf->draining = true;
+
+        while (tail < head) {
+            struct perf_event_header hdr;
+
+            read_ring(buf, tail, &hdr, sizeof(hdr));
+
+            if (hdr.size < sizeof(hdr))
+                break;
+
+            if (hdr.type == PERF_RECORD_SAMPLE) {
+                uint64_t pc = 0;
+
+                read_ring(buf, tail + sizeof(hdr), &pc, sizeof(pc));
+
+                Variant v_pc(CALI_TYPE_ADDR, &pc, sizeof(uint64_t));
+                SnapshotRecord trigger_info(1, &sampler_attr_id, &v_pc);
+
+                ++n_samples;
+
+                c->push_snapshot(sample_contexts, &trigger_info);
+
+                ++n_processed_samples;
+            } else if (hdr.type == PERF_RECORD_LOST) {
+                struct { uint64_t id; uint64_t lost; } rec;
+
+                read_ring(buf, tail + sizeof(hdr), &rec, sizeof(rec));
+
+                n_samples      += static_cast<int>(rec.lost);
+                n_lost_samples += static_cast<int>(rec.lost);
+            }
+
+            tail += hdr.size;
+        }
+
+        __atomic_store_n(&buf->meta->data_tail, tail, __ATOMIC_RELEASE);
+
+        buf->draining = false;
+    }
+
+    void clear_perf_buffer(Caliper* c) {
+        PerfBuffer* buf = t_perf_buf;
+
+        if (!buf)
+            return;
+
+        ioctl(buf->fd, PERF_EVENT_IOC_DISABLE, 0);
+        drain_perf_buffer(c);
+
+        munmap(buf->meta, buf->map_size);
+        close(buf->fd);
+
+        delete buf;
+        t_perf_buf = nullptr;
+    }
+
+    void pre_update_cb(Caliper* c, const Attribute&, const Variant&) {
+        drain_perf_buffer(c);
+    }
+
+    void pre_set_many_cb(Caliper* c, size_t, const Attribute*, const Variant*) {
+        drain_perf_buffer(c);
+    }
+
+    void pre_flush_cb(Caliper* c, const SnapshotRecord*) {
+        drain_perf_buffer(c);
+    }
+
+    bool init_perf_backend(Caliper* c) {
+        std::string event = config.get("perf_event").to_string();
+
+        if (event == "cpu-clock") {
+            perf_type   = PERF_TYPE_SOFTWARE;
+            perf_config = PERF_COUNT_SW_CPU_CLOCK;
+        } else if (event == "cycles") {
+            perf_type   = PERF_TYPE_HARDWARE;
+            perf_config = PERF_COUNT_HW_CPU_CYCLES;
+        } else if (event != "task-clock") {
+            Log(0).stream() << "sampler: unknown perf_event \"" << event
+                            << "\", using task-clock" << endl;
+        }
+
+        perf_pages = 1;
+
+        for (size_t n = config.get("perf_buffer_pages").to_uint(); perf_pages < n; perf_pages *= 2)
+            ;
+
+        if (!setup_perf_buffer())
+            return false;
+
+        c->events().pre_begin_evt.connect(pre_update_cb);
+        c->events().pre_set_evt.connect(pre_update_cb);
+        c->events().pre_end_evt.connect(pre_update_cb);
+        c->events().pre_set_many_evt.connect(pre_set_many_cb);
+        c->events().pre_flush_evt.connect(pre_flush_cb);
+
+        return true;
+    }
+
+#endif // CALI_HAVE_PERF_EVENT_H
+
     void create_scope_cb(Caliper* c, cali_context_scope_t scope) {
-        if (scope == CALI_SCOPE_THREAD)
-            setup_settimer(c);
+        if (scope != CALI_SCOPE_THREAD)
+            return;
+
+#ifdef CALI_HAVE_PERF_EVENT_H
+        if (use_perf) {
+            setup_perf_buffer();
+            return;
+        }
+#endif
+
+        setup_settimer(c);
     }
 
     void release_scope_cb(Caliper* c, cali_context_scope_t scope) {
-        if (scope == CALI_SCOPE_THREAD)
-            clear_timer(c);
+        if (scope != CALI_SCOPE_THREAD)
+            return;
+
+#ifdef CALI_HAVE_PERF_EVENT_H
+        if (use_perf) {
+            clear_perf_buffer(c);
+            return;
+        }
+#endif
+
+        clear_timer(c);
     }
 
     void finish_cb(Caliper* c) {
-        clear_timer(c);
-        clear_signal();
+#ifdef CALI_HAVE_PERF_EVENT_H
+        if (use_perf) {
+            clear_perf_buffer(c);
+
+            if (n_lost_samples.load() > 0)
+                Log(1).stream() << "Sampler: lost " << n_lost_samples.load()
+                                << " samples in perf_event buffer overflows." << endl;
+        } else
+#endif
+        {
+            clear_timer(c);
+            clear_signal();
+        }
 
-        Log(1).stream() << "Sampler: processed " << n_processed_samples << " samples ("
-                        << n_samples << " total, "
-                        << n_samples - n_processed_samples << " dropped)." << endl;
+        Log(1).stream() << "Sampler: processed " << n_processed_samples.load() << " samples ("
+                        << n_samples.load() << " total, "
+                        << n_samples.load() - n_processed_samples.load() << " dropped)." << endl;
     }
     
     void sampler_register(Caliper* c)
@@ -231,26 +686,77 @@ namespace
 
         sampler_attr_id = sampler_attr.id();
 
-        int frequency = config.get("frequency").to_int();
+        frequency     = config.get("frequency").to_int();
         
         // some sanity checking
         frequency     = std::min(std::max(frequency, 1), 10000);
         nsec_interval = 1000000000 / frequency;
 
+        if (config.get("adaptive").to_bool() == true) {
+            int min_frequency = std::min(std::max(config.get("min_frequency").to_int(), 1), 10000);
+            int max_frequency = std::min(std::max(config.get("max_frequency").to_int(), min_frequency), 10000);
+
+            adaptive          = true;
+            min_nsec_interval = 1000000000L / max_frequency;
+            max_nsec_interval = 1000000000L / min_frequency;
+            target_overhead   = std::max(config.get("target_overhead").to_double(), 0.001) / 100.0;
+            nsec_interval     = std::min(std::max(static_cast<long>(nsec_interval), min_nsec_interval), max_nsec_interval);
+        }
+
         sample_contexts = CALI_SCOPE_THREAD;
 
         if (config.get("add_shared_context").to_bool() == true)
             sample_contexts |= CALI_SCOPE_PROCESS;
         
         c->events().create_scope_evt.connect(create_scope_cb);
+        c->events().reuse_scope_evt.connect(create_scope_cb);
         c->events().release_scope_evt.connect(release_scope_cb);
         c->events().finish_evt.connect(finish_cb);
 
-        setup_signal();
-        setup_settimer(c);
+        std::string backend = config.get("backend").to_string();
+
+        if (backend == "perf") {
+#ifdef CALI_HAVE_PERF_EVENT_H
+            use_perf = init_perf_backend(c);
+#endif
+            if (!use_perf)
+                Log(0).stream() << "sampler: perf backend not available, using timer" << endl;
+        } else if (backend != "timer") {
+            Log(0).stream() << "sampler: unknown backend \"" << backend
+                            << "\", using timer" << endl;
+        }
+
+        if (use_perf && adaptive) {
+            Log(0).stream() << "sampler: adaptive mode is not supported with the perf backend" << endl;
+            adaptive = false;
+        }
+
+        if (adaptive) {
+            Attribute aggr_class_attr = c->get_attribute("class.aggregatable");
+
+            weight_attr =
+                c->create_attribute("cali.sampler.weight", CALI_TYPE_DOUBLE,
+                                    CALI_ATTR_SCOPE_THREAD |
+                                    CALI_ATTR_SKIP_EVENTS  |
+                                    CALI_ATTR_ASVALUE,
+                                    1, &aggr_class_attr, &v_true);
+
+            weight_attr_id = weight_attr.id();
+
+            c->events().pre_begin_evt.connect(adaptive_update_cb);
+            c->events().pre_set_evt.connect(adaptive_update_cb);
+            c->events().pre_end_evt.connect(adaptive_update_cb);
+            c->events().pre_set_many_evt.connect(adaptive_set_many_cb);
+        }
+
+        if (!use_perf) {
+            setup_signal();
+            setup_settimer(c);
+        }
         
         Log(1).stream() << "Registered sampler service. Using "
-                        << frequency << "Hz sampling frequency." << endl;
+                        << frequency << "Hz sampling frequency"
+                        << (use_perf ? " (perf_event backend)." : (adaptive ? " (adaptive)." : ".")) << endl;
     }
 
 } // namespace
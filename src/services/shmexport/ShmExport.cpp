@@ -0,0 +1,322 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file ShmExport.cpp
+/// Live snapshot export into a shared-memory ring buffer
+
+#include "caliper/CaliperService.h"
+
+#include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/CompressedSnapshotRecord.h"
+#include "caliper/common/Log.h"
+#include "caliper/common/Node.h"
+#include "caliper/common/NodeBuffer.h"
+#include "caliper/common/RuntimeConfig.h"
+#include "caliper/common/ShmRing.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace cali;
+
+namespace
+{
+
+class ShmExport
+{
+    static std::unique_ptr<ShmExport> s_instance;
+    static const ConfigSet::Entry     s_configdata[];
+
+    std::string    m_filename;
+    bool           m_keep;
+
+    void*          m_mem;
+    std::size_t    m_size;
+
+    ShmRingWriter* m_writer;
+
+    //   Node dictionary export state: a node is "claimed" by the thread
+    // that exports it, and "done" when its dictionary entry is written.
+    std::size_t    m_max_nodes;
+    std::unique_ptr< std::atomic<uint64_t>[] > m_claimed;
+    std::unique_ptr< std::atomic<uint64_t>[] > m_done;
+
+    std::atomic<bool> m_dict_full;
+    std::atomic<unsigned long long> m_num_skipped;
+
+    void export_node(Caliper* c, const Node* node) {
+        if (!node || node->id() < 11) // hard-coded metadata nodes
+            return;
+
+        cali_id_t id = node->id();
+
+        if (id >= m_max_nodes)
+            return;
+
+        uint64_t bit = static_cast<uint64_t>(1) << (id % 64);
+
+        if (m_claimed[id / 64].fetch_or(bit, std::memory_order_acq_rel) & bit) {
+            // another thread may be exporting it right now: wait until it's done
+            while (!(m_done[id / 64].load(std::memory_order_acquire) & bit))
+                std::this_thread::yield();
+
+            return;
+        }
+
+        export_node(c, c->node(node->attribute()));
+
+        if (node->parent() && node->parent()->id() != CALI_INV_ID)
+            export_node(c, node->parent());
+
+        NodeBuffer buf;
+        buf.append(node);
+
+        if (!m_writer->add_node(buf.data(), buf.size()) && !m_dict_full.exchange(true))
+            Log(1).stream() << "shmexport: node dictionary is full" << std::endl;
+
+        m_done[id / 64].fetch_or(bit, std::memory_order_release);
+    }
+
+    void export_snapshot(Caliper* c, const SnapshotRecord* snapshot) {
+        SnapshotRecord::Data  data  = snapshot->data();
+        SnapshotRecord::Sizes sizes = snapshot->size();
+
+        size_t nn = std::min<size_t>(sizes.n_nodes,     128);
+        size_t ni = std::min<size_t>(sizes.n_immediate, 128);
+
+        for (size_t i = 0; i < nn; ++i)
+            export_node(c, data.node_entries[i]);
+
+        // immediate string and blob values point into process memory:
+        //   skip them
+        cali_id_t attr[128];
+        Variant   vals[128];
+        size_t    nv = 0;
+
+        for (size_t i = 0; i < ni; ++i) {
+            cali_attr_type type = data.immediate_data[i].type();
+
+            if (type == CALI_TYPE_STRING || type == CALI_TYPE_USR) {
+                m_num_skipped.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            export_node(c, c->node(data.immediate_attr[i]));
+
+            attr[nv]   = data.immediate_attr[i];
+            vals[nv++] = data.immediate_data[i];
+        }
+
+        unsigned char buf[4096];
+        CompressedSnapshotRecord rec(sizeof(buf), buf);
+
+        rec.append(nn, data.node_entries);
+        rec.append(nv, attr, vals);
+
+        m_writer->add_record(rec.data(), rec.size());
+    }
+
+    bool open_segment(std::size_t size, std::size_t dict_size, std::size_t slot_size) {
+        int fd = open(m_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+        if (fd < 0) {
+            Log(0).stream() << "shmexport: could not create " << m_filename << std::endl;
+            return false;
+        }
+
+        if (ftruncate(fd, size) != 0) {
+            Log(0).stream() << "shmexport: could not resize " << m_filename << std::endl;
+            close(fd);
+            return false;
+        }
+
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        close(fd);
+
+        if (mem == MAP_FAILED) {
+            Log(0).stream() << "shmexport: could not map " << m_filename << std::endl;
+            return false;
+        }
+
+        m_mem    = mem;
+        m_size   = size;
+        m_writer = new ShmRingWriter(mem, size, dict_size, slot_size);
+
+        if (!m_writer->valid()) {
+            Log(0).stream() << "shmexport: segment size is too small" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    void finish(Caliper*) {
+        if (m_writer)
+            Log(1).stream() << "shmexport: Published " << m_writer->num_records() << " records, "
+                            << m_writer->num_dropped() << " dropped, "
+                            << m_num_skipped.load() << " string values skipped." << std::endl;
+
+        delete m_writer;
+        m_writer = nullptr;
+
+        if (m_mem)
+            munmap(m_mem, m_size);
+        if (!m_keep)
+            unlink(m_filename.c_str());
+
+        m_mem = nullptr;
+    }
+
+    static void process_snapshot_cb(Caliper* c, const SnapshotRecord*, const SnapshotRecord* snapshot) {
+        if (s_instance && s_instance->m_writer)
+            s_instance->export_snapshot(c, snapshot);
+    }
+
+    static void finish_cb(Caliper* c) {
+        if (s_instance)
+            s_instance->finish(c);
+
+        s_instance.reset();
+    }
+
+    ShmExport(const std::string& filename, bool keep, std::size_t max_nodes)
+        : m_filename(filename),
+          m_keep(keep),
+          m_mem(nullptr),
+          m_size(0),
+          m_writer(nullptr),
+          m_max_nodes((max_nodes + 63) / 64 * 64),
+          m_claimed(new std::atomic<uint64_t>[m_max_nodes / 64]),
+          m_done(new std::atomic<uint64_t>[m_max_nodes / 64]),
+          m_dict_full(false),
+          m_num_skipped(0)
+        {
+            for (std::size_t i = 0; i < m_max_nodes / 64; ++i) {
+                m_claimed[i].store(0);
+                m_done[i].store(0);
+            }
+        }
+
+public:
+
+    ~ShmExport() {
+        finish(nullptr);
+    }
+
+    static void init(Caliper* c) {
+        ConfigSet config = RuntimeConfig::init("shmexport", s_configdata);
+
+        std::string filename = config.get("filename").to_string();
+
+        if (filename.empty())
+            filename = "/dev/shm/caliper-" + std::to_string(getpid());
+
+        s_instance.reset(new ShmExport(filename, config.get("keep").to_bool(),
+                                       config.get("max_nodes").to_uint()));
+
+        if (!s_instance->open_segment(config.get("size").to_uint() * 1024,
+                                      config.get("dictionary_size").to_uint() * 1024,
+                                      config.get("slot_size").to_uint())) {
+            s_instance.reset();
+            return;
+        }
+
+        std::string source = config.get("source").to_string();
+
+        if (source == "flush") {
+            c->events().write_snapshot.connect(process_snapshot_cb);
+        } else {
+            if (source != "snapshot")
+                Log(0).stream() << "shmexport: unknown source \"" << source
+                                << "\", using \"snapshot\"" << std::endl;
+
+            c->events().process_snapshot.connect(process_snapshot_cb);
+        }
+
+        c->events().finish_evt.connect(finish_cb);
+
+        Log(1).stream() << "Registered shmexport service, exporting to " << filename << std::endl;
+    }
+};
+
+std::unique_ptr<ShmExport> ShmExport::s_instance;
+
+const ConfigSet::Entry     ShmExport::s_configdata[] = {
+    { "filename", CALI_TYPE_STRING, "",
+      "Shared memory file to export to",
+      "Shared memory file to export to. Default: /dev/shm/caliper-<pid>"
+    },
+    { "size", CALI_TYPE_UINT, "4096",
+      "Size of the shared memory segment in KiB",
+      "Size of the shared memory segment in KiB, including the node dictionary"
+    },
+    { "dictionary_size", CALI_TYPE_UINT, "1024",
+      "Size of the node dictionary in KiB",
+      "Size of the node dictionary in KiB"
+    },
+    { "slot_size", CALI_TYPE_UINT, "256",
+      "Size of a record slot in the ring buffer in bytes",
+      "Size of a record slot in the ring buffer in bytes. Larger records are dropped."
+    },
+    { "max_nodes", CALI_TYPE_UINT, "1048576",
+      "Maximum context tree node ID to export",
+      "Maximum context tree node ID to export"
+    },
+    { "source", CALI_TYPE_STRING, "snapshot",
+      "Which records to export: snapshot or flush",
+      "Which records to export. Either one of\n"
+      "   snapshot: Each snapshot as it is taken\n"
+      "   flush:    The records written in a flush, e.g. aggregated data"
+    },
+    { "keep", CALI_TYPE_BOOL, "false",
+      "Keep the shared memory file after the program ends",
+      "Keep the shared memory file after the program ends"
+    },
+    ConfigSet::Terminator
+};
+
+} // namespace [anonymous]
+
+namespace cali
+{
+    CaliperService shmexport_service = { "shmexport", ::ShmExport::init };
+}
@@ -7,11 +7,14 @@
 #include "caliper/SnapshotRecord.h"
 
 #include "caliper/common/Log.h"
+#include "caliper/common/Node.h"
 #include "caliper/common/RuntimeConfig.h"
 #include "caliper/common/SnapshotTextFormatter.h"
 
 #include <atomic>
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <functional>
 #include <iostream>
@@ -19,6 +22,7 @@
 #include <mutex>
 #include <string>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 #include<sos.h>
@@ -36,21 +40,76 @@ const ConfigSet::Entry   configdata[] = {
       "Attribute that triggers flush & publish",
       "Attribute that triggers flush & publish"
     },
+    { "publish_interval", CALI_TYPE_UINT, "1000",
+      "Publish packed snapshots at least every this many milliseconds",
+      "Publish packed snapshots at least every this many milliseconds.\n"
+      "If 0, publish at every flush on the application thread."
+    },
+    { "publish_threshold", CALI_TYPE_UINT, "1024",
+      "Publish when this many snapshots are packed",
+      "Publish when this many snapshots are packed"
+    },
     ConfigSet::Terminator
 };
 
-// Takes an unpacked Caliper snapshot and publishes it in SOS
-void pack_snapshot(SOS_pub* sos_pub, int snapshot_id, const std::map< Attribute, std::vector<Variant> >& unpacked_snapshot) {
-    for (auto &p : unpacked_snapshot) {
-        switch (p.first.type()) {
+/// \brief Pack a Caliper snapshot into an SOS publication
+///
+/// Values for attributes in the context tree are combined into one
+/// path string (root first); for numeric attributes, the innermost
+/// value is used.
+void pack_snapshot(Caliper* c, SOS_pub* sos_pub, int snapshot_id, const SnapshotRecord* snapshot) {
+    SnapshotRecord::Sizes sizes = snapshot->size();
+    SnapshotRecord::Data  data  = snapshot->data();
+
+    // per-attribute path entries (leaf first) of the snapshot's nodes; 
+    // reused between calls to avoid allocations
+    struct PathEntry {
+        cali_id_t attr_id;
+        std::vector<const Node*> nodes;
+    };
+
+    thread_local std::vector<PathEntry> paths;
+    std::size_t num_paths = 0;
+
+    for (std::size_t i = 0; i < sizes.n_nodes; ++i)
+        for (const Node* node = data.node_entries[i]; node; node = node->parent()) {
+            if (node->attribute() == CALI_INV_ID)
+                continue;
+
+            std::size_t p = 0;
+
+            while (p < num_paths && paths[p].attr_id != node->attribute())
+                ++p;
+
+            if (p == num_paths) {
+                if (paths.size() <= p)
+                    paths.emplace_back();
+
+                paths[p].attr_id = node->attribute();
+                paths[p].nodes.clear();
+                ++num_paths;
+            }
+
+            paths[p].nodes.push_back(node);
+        }
+
+    for (std::size_t p = 0; p < num_paths; ++p) {
+        Attribute attr = c->get_attribute(paths[p].attr_id);
+        const std::vector<const Node*>& nodes = paths[p].nodes;
+
+        switch (attr.type()) {
         case CALI_TYPE_STRING:
         {
             std::string pubstr;
 
-            for (const Variant &val : p.second)
-                pubstr.append(val.to_string()).append(pubstr.empty() ? "" : "/");
+            for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+                if (!pubstr.empty())
+                    pubstr.append("/");
+
+                pubstr.append(static_cast<const char*>((*it)->data().data()), (*it)->data().size());
+            }
 
-            SOS_pack_related(sos_pub, snapshot_id, p.first.name_c_str(), SOS_VAL_TYPE_STRING, pubstr.c_str());
+            SOS_pack_related(sos_pub, snapshot_id, attr.name_c_str(), SOS_VAL_TYPE_STRING, pubstr.c_str());
         }
         break;
         case CALI_TYPE_ADDR:
@@ -58,21 +117,51 @@ void pack_snapshot(SOS_pub* sos_pub, int snapshot_id, const std::map< Attribute,
         case CALI_TYPE_UINT:
         case CALI_TYPE_BOOL:
         {
-            int64_t val = p.second.front().to_int();
-            SOS_pack_related(sos_pub, snapshot_id, p.first.name_c_str(), SOS_VAL_TYPE_INT, &val);
+            int64_t val = nodes.front()->data().to_int();
+            SOS_pack_related(sos_pub, snapshot_id, attr.name_c_str(), SOS_VAL_TYPE_INT, &val);
         }
         break;
         case CALI_TYPE_DOUBLE:
         {
-            double val = p.second.front().to_double();
-            SOS_pack_related(sos_pub, snapshot_id, p.first.name_c_str(), SOS_VAL_TYPE_DOUBLE, &val);   
+            double val = nodes.front()->data().to_double();
+            SOS_pack_related(sos_pub, snapshot_id, attr.name_c_str(), SOS_VAL_TYPE_DOUBLE, &val);
         }
+        break;
         default:
             ;
         }
     }
 
-    SOS_publish(sos_pub);
+    for (std::size_t i = 0; i < sizes.n_immediate; ++i) {
+        Attribute attr = c->get_attribute(data.immediate_attr[i]);
+        const Variant& v = data.immediate_data[i];
+
+        switch (attr.type()) {
+        case CALI_TYPE_STRING:
+        {
+            std::string str(static_cast<const char*>(v.data()), v.size());
+            SOS_pack_related(sos_pub, snapshot_id, attr.name_c_str(), SOS_VAL_TYPE_STRING, str.c_str());
+        }
+        break;
+        case CALI_TYPE_ADDR:
+        case CALI_TYPE_INT:
+        case CALI_TYPE_UINT:
+        case CALI_TYPE_BOOL:
+        {
+            int64_t val = v.to_int();
+            SOS_pack_related(sos_pub, snapshot_id, attr.name_c_str(), SOS_VAL_TYPE_INT, &val);
+        }
+        break;
+        case CALI_TYPE_DOUBLE:
+        {
+            double val = v.to_double();
+            SOS_pack_related(sos_pub, snapshot_id, attr.name_c_str(), SOS_VAL_TYPE_DOUBLE, &val);
+        }
+        break;
+        default:
+            ;
+        }
+    }
 }
 
 class SosService
@@ -86,13 +175,69 @@ class SosService
 
     Attribute   trigger_attr;
 
+    // --- background publishing
+
+    std::mutex                  m_pub_lock;   ///< Protects sos_publication_handle
+    std::condition_variable     m_pub_cv;
+
+    std::chrono::milliseconds   m_publish_interval;
+    std::size_t                 m_publish_threshold;
+    std::size_t                 m_num_pending; ///< Snapshots packed since the last publish
+    bool                        m_stop;
+
+    unsigned long long          m_num_packed;
+    unsigned long long          m_num_published;
+
+    std::thread                 m_thread;
+
+    /// \brief Publish pending data. Assumes m_pub_lock is locked.
+    void publish() {
+        if (m_num_pending == 0)
+            return;
+
+        SOS_publish(sos_publication_handle);
+
+        m_num_pending = 0;
+        ++m_num_published;
+    }
+
+    void publish_loop() {
+        std::unique_lock<std::mutex>
+            lk(m_pub_lock);
+
+        while (!m_stop) {
+            m_pub_cv.wait_for(lk, m_publish_interval, [this](){
+                    return m_stop || m_num_pending >= m_publish_threshold;
+                });
+
+            publish();
+        }
+    }
+
     void flush_and_publish(Caliper* c) {
         Log(2).stream() << "sos: Publishing Caliper data" << std::endl;
 
-        c->flush(nullptr, [this,c](const SnapshotRecord* snapshot){
-                pack_snapshot(sos_publication_handle, ++snapshot_id, snapshot->unpack(*c));
-                return true;
-            });
+        bool notify = false;
+
+        {
+            std::lock_guard<std::mutex>
+                g(m_pub_lock);
+
+            c->flush(nullptr, [this,c](const SnapshotRecord* snapshot){
+                    pack_snapshot(c, sos_publication_handle, ++snapshot_id, snapshot);
+                    ++m_num_pending;
+                    ++m_num_packed;
+                    return true;
+                });
+
+            if (!m_thread.joinable())
+                publish();
+            else
+                notify = (m_num_pending >= m_publish_threshold);
+        }
+
+        if (notify)
+            m_pub_cv.notify_one();
     }
 
     void create_attr(const Attribute& attr) {
@@ -101,7 +246,12 @@ class SosService
     }
 
     void process_snapshot(Caliper* c, const SnapshotRecord* trigger_info, const SnapshotRecord* snapshot) {
-        pack_snapshot(sos_publication_handle, ++snapshot_id, snapshot->unpack(*c));
+        std::lock_guard<std::mutex>
+            g(m_pub_lock);
+
+        pack_snapshot(c, sos_publication_handle, ++snapshot_id, snapshot);
+        ++m_num_pending;
+        ++m_num_packed;
     }
 
     void post_end(Caliper* c, const Attribute& attr) {
@@ -117,6 +267,33 @@ class SosService
 
         // trigger_attr will be invalid if it's not found - still need to check attributes in create_attribute_cb
         trigger_attr = c->get_attribute(config.get("trigger_attr").to_string());
+
+        if (m_publish_interval.count() > 0)
+            m_thread = std::thread(&SosService::publish_loop, this);
+    }
+
+    void finish(Caliper* c) {
+        {
+            std::lock_guard<std::mutex>
+                g(m_pub_lock);
+
+            m_stop = true;
+        }
+
+        m_pub_cv.notify_one();
+
+        if (m_thread.joinable())
+            m_thread.join();
+
+        {
+            std::lock_guard<std::mutex>
+                g(m_pub_lock);
+
+            publish();
+        }
+
+        Log(1).stream() << "sos: Packed " << m_num_packed << " snapshots, published "
+                        << m_num_published << " times" << std::endl;
     }
 
     // static callbacks
@@ -137,15 +314,26 @@ class SosService
         s_sos->post_init(c);
     }
 
+    static void finish_cb(Caliper* c) {
+        s_sos->finish(c);
+    }
+
     SosService(Caliper* c)
         : config(RuntimeConfig::init("sos", configdata)),
-          trigger_attr(Attribute::invalid)
+          trigger_attr(Attribute::invalid),
+          m_publish_interval(config.get("publish_interval").to_uint()),
+          m_publish_threshold(std::max<std::size_t>(config.get("publish_threshold").to_uint(), 1)),
+          m_num_pending(0),
+          m_stop(false),
+          m_num_packed(0),
+          m_num_published(0)
         {
             
             c->events().create_attr_evt.connect(&SosService::create_attr_cb);
             c->events().post_init_evt.connect(&SosService::post_init_cb);
             // c->events().process_snapshot.connect(&SosService::process_snapshot_cb);
             c->events().post_end_evt.connect(&SosService::post_end_cb);
+            c->events().finish_evt.connect(&SosService::finish_cb);
 
             Log(1).stream() << "Registered SOS service" << std::endl;
         }
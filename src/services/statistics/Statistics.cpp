@@ -94,6 +94,7 @@ void statistics_service_register(Caliper* c)
     c->events().pre_set_evt.connect(&update_cb);
     c->events().finish_evt.connect(&finish_cb);
     c->events().create_scope_evt.connect(&create_scope_cb);
+    c->events().reuse_scope_evt.connect(&create_scope_cb);
     c->events().snapshot.connect(&snapshot_cb);
 
     Log(1).stream() << "Registered debug service" << endl;
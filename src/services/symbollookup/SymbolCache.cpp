@@ -0,0 +1,397 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file  SymbolCache.cpp
+/// \brief SymbolCache implementation
+
+#include "SymbolCache.h"
+
+#include "caliper/common/Log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cali;
+
+namespace
+{
+
+// Cache file layout (native byte order):
+//   header:  char magic[8]; uint32_t flags; uint32_t reserved; uint64_t count;
+//   records: uint64_t offset; uint64_t line; uint32_t len[3];
+//            char func[len[0]]; char file[len[1]]; char mod[len[2]];
+
+const char     s_magic[8] = { 'C', 'A', 'L', 'I', 'S', 'Y', 'M', '1' };
+const size_t   s_header_size = 8 + 2*sizeof(uint32_t) + sizeof(uint64_t);
+const size_t   s_record_size = 2*sizeof(uint64_t) + 3*sizeof(uint32_t);
+
+struct ModuleInfo {
+    uint64_t    start;
+    uint64_t    end;
+    uint64_t    base;
+    std::string build_id;
+};
+
+std::string
+find_build_id(const struct dl_phdr_info* info)
+{
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr)& phdr(info->dlpi_phdr[i]);
+
+        if (phdr.p_type != PT_NOTE)
+            continue;
+
+        const char* ptr = reinterpret_cast<const char*>(info->dlpi_addr + phdr.p_vaddr);
+        const char* end = ptr + phdr.p_memsz;
+
+        while (ptr + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr)* nhdr = reinterpret_cast<const ElfW(Nhdr)*>(ptr);
+
+            const char* name = ptr  + sizeof(ElfW(Nhdr));
+            const char* desc = name + ((nhdr->n_namesz + 3) & ~3u);
+
+            ptr = desc + ((nhdr->n_descsz + 3) & ~3u);
+
+            if (ptr > end)
+                break;
+
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 && strncmp(name, "GNU", 4) == 0) {
+                static const char hex[] = "0123456789abcdef";
+                std::string ret;
+
+                for (unsigned j = 0; j < nhdr->n_descsz; ++j) {
+                    unsigned char c = static_cast<unsigned char>(desc[j]);
+                    ret.push_back(hex[c >> 4]);
+                    ret.push_back(hex[c & 0xF]);
+                }
+
+                return ret;
+            }
+        }
+    }
+
+    return std::string();
+}
+
+int
+add_module_cb(struct dl_phdr_info* info, size_t, void* data)
+{
+    std::vector<ModuleInfo>* modules = static_cast<std::vector<ModuleInfo>*>(data);
+
+    uint64_t start = UINT64_MAX;
+    uint64_t end   = 0;
+
+    for (int i = 0; i < info->dlpi_phnum; ++i)
+        if (info->dlpi_phdr[i].p_type == PT_LOAD) {
+            start = std::min<uint64_t>(start, info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+            end   = std::max<uint64_t>(end,   info->dlpi_addr + info->dlpi_phdr[i].p_vaddr + info->dlpi_phdr[i].p_memsz);
+        }
+
+    if (start < end)
+        modules->push_back(ModuleInfo { start, end, info->dlpi_addr, find_build_id(info) });
+
+    return 0;
+}
+
+} // namespace
+
+
+struct SymbolCache::SymbolCacheImpl
+{
+    struct ModuleCache {
+        std::unordered_map<uint64_t, Symbol> symbols;
+        bool dirty;
+    };
+
+    std::string m_directory;
+    uint32_t    m_flags;
+
+    std::vector<ModuleInfo> m_modules; // sorted by start address
+
+    std::map<std::string, ModuleCache> m_caches; // by build-id
+
+    std::string filename(const std::string& build_id) const {
+        return m_directory + "/" + build_id + ".symcache";
+    }
+
+    void read(const std::string& build_id, ModuleCache& cache) {
+        std::string fname = filename(build_id);
+
+        int fd = open(fname.c_str(), O_RDONLY);
+
+        if (fd < 0)
+            return;
+
+        struct stat st;
+
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < s_header_size) {
+            close(fd);
+            return;
+        }
+
+        size_t size = static_cast<size_t>(st.st_size);
+        void*  addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        close(fd);
+
+        if (addr == MAP_FAILED)
+            return;
+
+        const char* ptr = static_cast<const char*>(addr);
+        const char* end = ptr + size;
+
+        uint32_t flags;
+        uint64_t count;
+
+        memcpy(&flags, ptr + 8, sizeof(uint32_t));
+        memcpy(&count, ptr + 8 + 2*sizeof(uint32_t), sizeof(uint64_t));
+
+        if (memcmp(ptr, s_magic, 8) != 0 || flags != m_flags) {
+            Log(2).stream() << "Symbollookup: Ignoring incompatible symbol cache " << fname << std::endl;
+            munmap(addr, size);
+            return;
+        }
+
+        ptr += s_header_size;
+
+        for (uint64_t n = 0; n < count && ptr + s_record_size <= end; ++n) {
+            uint64_t offset;
+            uint32_t len[3];
+            Symbol   sym;
+
+            memcpy(&offset,   ptr, sizeof(uint64_t));
+            memcpy(&sym.line, ptr + sizeof(uint64_t), sizeof(uint64_t));
+            memcpy(len,       ptr + 2*sizeof(uint64_t), 3*sizeof(uint32_t));
+
+            ptr += s_record_size;
+
+            if (static_cast<uint64_t>(end - ptr) < static_cast<uint64_t>(len[0]) + len[1] + len[2])
+                break;
+
+            sym.func.assign(ptr, len[0]); ptr += len[0];
+            sym.file.assign(ptr, len[1]); ptr += len[1];
+            sym.mod.assign (ptr, len[2]); ptr += len[2];
+
+            cache.symbols.emplace(offset, std::move(sym));
+        }
+
+        munmap(addr, size);
+
+        Log(2).stream() << "Symbollookup: Read " << cache.symbols.size()
+                        << " symbols from " << fname << std::endl;
+    }
+
+    bool write(const std::string& build_id, const ModuleCache& cache) {
+        std::string fname = filename(build_id);
+        std::string tmpname = fname + ".tmp." + std::to_string(getpid());
+
+        {
+            std::ofstream out(tmpname.c_str(), std::ios::binary | std::ios::trunc);
+
+            if (!out) {
+                Log(0).stream() << "Symbollookup: Cannot write symbol cache file " << tmpname << std::endl;
+                return false;
+            }
+
+            uint32_t reserved = 0;
+            uint64_t count    = cache.symbols.size();
+
+            out.write(s_magic, 8);
+            out.write(reinterpret_cast<const char*>(&m_flags),  sizeof(uint32_t));
+            out.write(reinterpret_cast<const char*>(&reserved), sizeof(uint32_t));
+            out.write(reinterpret_cast<const char*>(&count),    sizeof(uint64_t));
+
+            for (const auto& p : cache.symbols) {
+                uint32_t len[3] = {
+                    static_cast<uint32_t>(p.second.func.size()),
+                    static_cast<uint32_t>(p.second.file.size()),
+                    static_cast<uint32_t>(p.second.mod.size())
+                };
+
+                out.write(reinterpret_cast<const char*>(&p.first),       sizeof(uint64_t));
+                out.write(reinterpret_cast<const char*>(&p.second.line), sizeof(uint64_t));
+                out.write(reinterpret_cast<const char*>(len),            3*sizeof(uint32_t));
+                out.write(p.second.func.data(), len[0]);
+                out.write(p.second.file.data(), len[1]);
+                out.write(p.second.mod.data(),  len[2]);
+            }
+
+            if (!out) {
+                Log(0).stream() << "Symbollookup: Error writing symbol cache file " << tmpname << std::endl;
+                unlink(tmpname.c_str());
+                return false;
+            }
+        }
+
+        // atomically replace the old file so concurrent readers see a complete cache
+        if (rename(tmpname.c_str(), fname.c_str()) != 0) {
+            unlink(tmpname.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    const ModuleInfo* find_module(uint64_t address) const {
+        auto it = std::upper_bound(m_modules.begin(), m_modules.end(), address,
+                                   [](uint64_t a, const ModuleInfo& m) { return a < m.start; });
+
+        if (it == m_modules.begin())
+            return nullptr;
+
+        --it;
+
+        return (address < it->end ? &(*it) : nullptr);
+    }
+
+    ModuleCache* get_cache(const ModuleInfo* mod) {
+        if (!mod || mod->build_id.empty())
+            return nullptr;
+
+        auto it = m_caches.find(mod->build_id);
+
+        if (it == m_caches.end()) {
+            it = m_caches.emplace(mod->build_id, ModuleCache { {}, false }).first;
+            read(mod->build_id, it->second);
+        }
+
+        return &(it->second);
+    }
+
+    SymbolCacheImpl(const std::string& directory, uint32_t flags)
+        : m_directory(directory), m_flags(flags)
+        { }
+};
+
+
+SymbolCache::SymbolCache(const std::string& directory, uint32_t flags)
+    : mP(new SymbolCacheImpl(directory, flags))
+{
+    update_modules();
+}
+
+SymbolCache::~SymbolCache()
+{
+    mP.reset();
+}
+
+void
+SymbolCache::update_modules()
+{
+    mP->m_modules.clear();
+    dl_iterate_phdr(add_module_cb, &(mP->m_modules));
+
+    std::sort(mP->m_modules.begin(), mP->m_modules.end(),
+              [](const ModuleInfo& a, const ModuleInfo& b) { return a.start < b.start; });
+}
+
+bool
+SymbolCache::find(uint64_t address, Symbol& sym)
+{
+    const ModuleInfo* mod = mP->find_module(address);
+    SymbolCacheImpl::ModuleCache* cache = mP->get_cache(mod);
+
+    if (!cache)
+        return false;
+
+    auto it = cache->symbols.find(address - mod->base);
+
+    if (it == cache->symbols.end())
+        return false;
+
+    sym = it->second;
+
+    return true;
+}
+
+void
+SymbolCache::insert(uint64_t address, const Symbol& sym)
+{
+    const ModuleInfo* mod = mP->find_module(address);
+    SymbolCacheImpl::ModuleCache* cache = mP->get_cache(mod);
+
+    if (!cache)
+        return;
+
+    cache->symbols[address - mod->base] = sym;
+    cache->dirty = true;
+}
+
+unsigned
+SymbolCache::write()
+{
+    unsigned count = 0;
+
+    for (auto& p : mP->m_caches)
+        if (p.second.dirty && mP->write(p.first, p.second)) {
+            p.second.dirty = false;
+            ++count;
+        }
+
+    return count;
+}
+
+bool
+SymbolCache::module_offset(uint64_t address, std::string& build_id, uint64_t& offset) const
+{
+    const ModuleInfo* mod = mP->find_module(address);
+
+    if (!mod || mod->build_id.empty())
+        return false;
+
+    build_id = mod->build_id;
+    offset   = address - mod->base;
+
+    return true;
+}
+
+uint64_t
+SymbolCache::address(const std::string& build_id, uint64_t offset) const
+{
+    for (const ModuleInfo& mod : mP->m_modules)
+        if (mod.build_id == build_id)
+            return mod.base + offset;
+
+    return 0;
+}
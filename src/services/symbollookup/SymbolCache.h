@@ -0,0 +1,101 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file  SymbolCache.h
+/// \brief Persistent on-disk cache for symbol lookup results
+
+#ifndef CALI_SYMBOLCACHE_H
+#define CALI_SYMBOLCACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace cali
+{
+
+/// \brief Persistent on-disk cache of symbol lookup results.
+///
+/// Symbols are stored per module (executable or shared library) in
+/// `<directory>/<build-id>.symcache`, keyed by the address offset relative
+/// to the module's load address. Modules without an ELF build-id are not
+/// cached.
+class SymbolCache
+{
+    struct SymbolCacheImpl;
+    std::unique_ptr<SymbolCacheImpl> mP;
+
+public:
+
+    struct Symbol {
+        std::string func;
+        std::string file;
+        std::string mod;
+        uint64_t    line;
+    };
+
+    /// \param directory Cache directory
+    /// \param flags     Lookup configuration tag. Cache files written with
+    ///   different flags are ignored and overwritten.
+    SymbolCache(const std::string& directory, uint32_t flags);
+
+    ~SymbolCache();
+
+    /// \brief Re-read the list of loaded modules
+    void     update_modules();
+
+    /// \brief Look up the cached symbol for \a address.
+    /// \return true if found, false otherwise
+    bool     find(uint64_t address, Symbol& sym);
+
+    /// \brief Add symbol \a sym for \a address
+    void     insert(uint64_t address, const Symbol& sym);
+
+    /// \brief Write modified module caches to disk
+    /// \return Number of cache files written
+    unsigned write();
+
+    /// \brief Get the build-id of the module containing \a address and
+    ///   the address offset relative to the module's load address.
+    ///   Does not access the cache directory.
+    /// \return false if the address is not in a module with a build-id
+    bool     module_offset(uint64_t address, std::string& build_id, uint64_t& offset) const;
+
+    /// \brief Get the address of \a offset in the loaded module with the
+    ///   given build-id. Inverse of module_offset().
+    /// \return The address, or 0 if no such module is loaded
+    uint64_t address(const std::string& build_id, uint64_t offset) const;
+};
+
+} // namespace cali
+
+#endif
@@ -33,10 +33,11 @@
 // SymbolLookup.cpp
 // Caliper symbol lookup service
 
+#include "SymbolCache.h"
+
 #include "caliper/CaliperService.h"
 
 #include "caliper/Caliper.h"
-#include "../../caliper/MemoryPool.h"
 #include "caliper/SnapshotRecord.h"
 
 #include "caliper/common/Log.h"
@@ -49,10 +50,14 @@
 #include <AddrLookup.h>
 
 #include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <iterator>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <unordered_map>
 
 using namespace cali;
 
@@ -73,6 +78,7 @@ class SymbolLookup
         Attribute func_attr;
         Attribute loc_attr;
         Attribute mod_attr;
+        Attribute ref_attr;  ///< symbol.ref#<attr>, for coordinated lookups
     };
 
     ConfigSet m_config;
@@ -82,6 +88,10 @@ class SymbolLookup
     bool m_lookup_file;
     bool m_lookup_line;
     bool m_lookup_mod;
+
+    /// Coordinated mode: write portable symbol references at flush time,
+    /// resolve them on request through resolve_symbols_evt
+    bool m_coordinated;
     
     std::map<Attribute, SymbolAttributes> m_sym_attr_map;
     std::mutex m_sym_attr_mutex;
@@ -89,9 +99,16 @@ class SymbolLookup
     std::vector<std::string> m_addr_attr_names;
 
     AddressLookup* m_lookup;
+    bool           m_lookup_created;
     std::mutex     m_lookup_mutex;
 
+    std::unique_ptr<SymbolCache> m_disk_cache;
+    /// Module table for symbol references if there is no disk cache
+    std::unique_ptr<SymbolCache> m_module_table;
+
     unsigned m_num_lookups;
+    unsigned m_num_cached;
+    unsigned m_num_disk_cached;
     unsigned m_num_failed;
 
     //
@@ -116,6 +133,9 @@ class SymbolLookup
         sym_attribs.mod_attr  =
             c->create_attribute("module#" + attr.name(),
                                 CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+        sym_attribs.ref_attr  =
+            c->create_attribute("symbol.ref#" + attr.name(),
+                                CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
             
         std::lock_guard<std::mutex>
             g(m_sym_attr_mutex);
@@ -148,123 +168,179 @@ class SymbolLookup
             make_symbol_attributes(c, a);
     }
     
-    void add_symbol_attributes(const Entry& e, 
-                               const SymbolAttributes& sym_attr,
-                               MemoryPool& mempool,
-                               std::vector<Attribute>& attr, 
-                               std::vector<Variant>&   data) {
+    struct SymbolInfo {
+        std::string func;
+        std::string file;
+        std::string loc;
+        std::string mod;
+        uint64_t    line;
+    };
+
+    // Symbol information cache. Entries are never removed, so references
+    // into the map stay valid outside of m_lookup_mutex.
+    std::unordered_map<uint64_t, SymbolInfo> m_sym_cache;
+
+    const SymbolInfo* lookup_symbol(uint64_t address) {
+        std::lock_guard<std::mutex>
+            g(m_lookup_mutex);
+
+        auto it = m_sym_cache.find(address);
+
+        if (it != m_sym_cache.end()) {
+            ++m_num_cached;
+            return &(it->second);
+        }
+
+        SymbolInfo info { "UNKNOWN", "UNKNOWN", "UNKNOWN", "UNKNOWN", 0 };
+
+        if (m_disk_cache) {
+            SymbolCache::Symbol sym;
+
+            if (m_disk_cache->find(address, sym)) {
+                info.func = sym.func;
+                info.file = sym.file;
+                info.mod  = sym.mod;
+                info.line = sym.line;
+                info.loc  = info.file + ":" + std::to_string(info.line);
+
+                ++m_num_disk_cached;
+
+                return &(m_sym_cache.emplace(address, std::move(info)).first->second);
+            }
+        }
+
+        // Only create the Dyninst address lookup object when we actually need it
+        create_lookup();
+
+        if (!m_lookup)
+            return nullptr;
+
         std::vector<Statement*> statements;
         SymtabAPI::Function* function = 0;
-        SymtabAPI::Module*   module   = 0;
-        std::string          modname  = "UNKNOWN";
 
         bool     ret_line = false;
         bool     ret_func = false;
-        bool     ret_mod  = false;
 
-        uint64_t address  = e.value().to_uint();
+        Symtab* symtab;
+        Offset  offset;
 
-        {
-            std::lock_guard<std::mutex>
-                g(m_lookup_mutex);
+        bool ret = m_lookup->getOffset(address, symtab, offset);
 
-            if (!m_lookup)
-                return;
+        if (ret && (m_lookup_sourceloc || m_lookup_file || m_lookup_line))
+            ret_line = symtab->getSourceLines(statements, offset);
+        if (ret && m_lookup_functions)
+            ret_func = symtab->getContainingFunction(offset, function);
+        if (ret && m_lookup_mod)
+            info.mod  = symtab->name();
 
-            Symtab* symtab;
-            Offset  offset;
+        ++m_num_lookups;
 
-            bool ret = m_lookup->getOffset(address, symtab, offset);
+        if (ret_line && statements.size() > 0) {
+            info.file = statements.front()->getFile();
+            info.line = statements.front()->getLine();
+        }
 
-            if (ret && m_lookup_sourceloc)
-                ret_line = symtab->getSourceLines(statements, offset);
-            if (ret && m_lookup_functions)
-                ret_func = symtab->getContainingFunction(offset, function);
-            if (ret && m_lookup_mod)
-                modname = symtab->name();
-            
-            ++m_num_lookups;
+        info.loc = info.file + ":" + std::to_string(info.line);
+
+        if (ret_func && function) {
+            auto it = function->pretty_names_begin();
+
+            if (it != function->pretty_names_end())
+                info.func = *it;
         }
 
-        if (m_lookup_sourceloc) {
-            std::string filename = "UNKNOWN";
-            uint64_t    lineno   = 0;
+        if ((m_lookup_functions && !ret_func) ||
+            ((m_lookup_sourceloc || m_lookup_file || m_lookup_line) && !ret_line))
+            ++m_num_failed;
 
-            if (ret_line && statements.size() > 0) {
-                filename = statements.front()->getFile();
-                lineno   = statements.front()->getLine();
-            }
+        if (m_disk_cache && ret)
+            m_disk_cache->insert(address, SymbolCache::Symbol { info.func, info.file, info.mod, info.line });
+
+        return &(m_sym_cache.emplace(address, std::move(info)).first->second);
+    }
+
+    SymbolCache* module_table() {
+        return m_disk_cache ? m_disk_cache.get() : m_module_table.get();
+    }
+
+    /// \brief Make a process-independent reference for \a address:
+    ///   "<build-id>+0x<offset>" in modules with a build-id, "0x<address>"
+    ///   otherwise
+    std::string make_symbol_ref(uint64_t address) {
+        std::string build_id;
+        uint64_t    offset = 0;
+        char        buf[24];
+
+        if (module_table() && module_table()->module_offset(address, build_id, offset)) {
+            snprintf(buf, sizeof(buf), "+0x%llx", static_cast<unsigned long long>(offset));
+            return build_id + buf;
+        }
 
-            filename.append(":");
-            filename.append(std::to_string(lineno));
+        snprintf(buf, sizeof(buf), "0x%llx", static_cast<unsigned long long>(address));
+        return std::string(buf);
+    }
+
+    /// \brief Get the address in this process for symbol reference \a ref
+    uint64_t parse_symbol_ref(const std::string& ref) {
+        std::string::size_type pos = ref.find('+');
 
-            char* tmp_s = static_cast<char*>(mempool.allocate(filename.size()+1));
-            std::copy(filename.begin(), filename.end(), tmp_s);
-            tmp_s[filename.size()] = '\0';
+        if (pos == std::string::npos)
+            return std::strtoull(ref.c_str(), nullptr, 16);
+        if (!module_table())
+            return 0;
 
+        return module_table()->address(ref.substr(0, pos), std::strtoull(ref.c_str() + pos + 1, nullptr, 16));
+    }
+
+    void add_symbol_attributes(const Entry& e, 
+                               const SymbolAttributes& sym_attr,
+                               std::vector<Attribute>& attr, 
+                               std::vector<Variant>&   data) {
+        add_symbol_attributes(e.value().to_uint(), sym_attr, attr, data);
+    }
+
+    void add_symbol_attributes(uint64_t address,
+                               const SymbolAttributes& sym_attr,
+                               std::vector<Attribute>& attr, 
+                               std::vector<Variant>&   data) {
+        if (address == 0)
+            return;
+
+        const SymbolInfo* info = lookup_symbol(address);
+
+        if (!info)
+            return;
+
+        // Strings point into the symbol cache; they are copied into the
+        // metadata tree in make_entrylist()
+
+        if (m_lookup_sourceloc) {
             attr.push_back(sym_attr.loc_attr);
             attr.push_back(sym_attr.line_attr);
 
-            data.push_back(Variant(CALI_TYPE_STRING, tmp_s, filename.size()));
-            data.push_back(Variant(CALI_TYPE_UINT,   &lineno, sizeof(uint64_t)));
+            data.push_back(Variant(CALI_TYPE_STRING, info->loc.data(), info->loc.size()));
+            data.push_back(Variant(CALI_TYPE_UINT,   &info->line, sizeof(uint64_t)));
         }
 
         if (m_lookup_file) {
-            std::string filename = "UNKNOWN";
-
-            if (ret_line && statements.size() > 0) {
-                filename = statements.front()->getFile();
-            }
-
-            char* tmp_s = static_cast<char*>(mempool.allocate(filename.size()+1));
-            std::copy(filename.begin(), filename.end(), tmp_s);
-            tmp_s[filename.size()] = '\0';
-
             attr.push_back(sym_attr.file_attr);
-            data.push_back(Variant(CALI_TYPE_STRING, tmp_s, filename.size()));
+            data.push_back(Variant(CALI_TYPE_STRING, info->file.data(), info->file.size()));
         }
 
         if (m_lookup_line) {
-            uint64_t lineno = 0;
-
-            if (ret_line && statements.size() > 0) {
-                lineno = statements.front()->getLine();
-            }
-
             attr.push_back(sym_attr.line_attr);
-            data.push_back(Variant(CALI_TYPE_UINT,   &lineno, sizeof(uint64_t)));
+            data.push_back(Variant(CALI_TYPE_UINT,   &info->line, sizeof(uint64_t)));
         }
 
         if (m_lookup_functions) {
-            std::string funcname = "UNKNOWN";
-
-            if (ret_func && function) {
-                auto it = function->pretty_names_begin();
-
-                if (it != function->pretty_names_end())
-                    funcname = *it;
-            }
-
-            char* tmp_f = static_cast<char*>(mempool.allocate(funcname.size()+1));
-            std::copy(funcname.begin(), funcname.end(), tmp_f);
-            tmp_f[funcname.size()] = '\0';
-
             attr.push_back(sym_attr.func_attr);
-            data.push_back(Variant(CALI_TYPE_STRING, tmp_f, funcname.size()));
+            data.push_back(Variant(CALI_TYPE_STRING, info->func.data(), info->func.size()));
         }
 
         if (m_lookup_mod) {
-            char* tmp_f = static_cast<char*>(mempool.allocate(modname.size()+1));
-            std::copy(modname.begin(), modname.end(), tmp_f);
-            tmp_f[modname.size()] = '\0';
-
             attr.push_back(sym_attr.mod_attr);
-            data.push_back(Variant(CALI_TYPE_STRING, tmp_f, modname.size()));            
+            data.push_back(Variant(CALI_TYPE_STRING, info->mod.data(), info->mod.size()));
         }
-
-        if ((m_lookup_functions && !ret_func) ||
-            ((m_lookup_sourceloc || m_lookup_file || m_lookup_line) && !ret_line))
-            ++m_num_failed; // not locked, doesn't matter too much if it's slightly off
     }
 
     void process_snapshot(Caliper* c, SnapshotRecord* snapshot) {
@@ -285,9 +361,10 @@ class SymbolLookup
         std::vector<Attribute> attr;
         std::vector<Variant>   data;
 
-        // Bit of a hack: Use mempool to allocate temporary memory for strings.
-        // Should be fixed with string database in Caliper runtime.
-        MemoryPool mempool(64 * 1024);
+        if (m_coordinated) {
+            add_symbol_refs(c, snapshot, sym_map, attr);
+            return;
+        }
 
         // unpack nodes, check for address attributes, and perform symbol lookup
         for (auto it : sym_map) {
@@ -296,9 +373,9 @@ class SymbolLookup
             if (e.node()) {
                 for (const cali::Node* node = e.node(); node; node = node->parent()) 
                     if (node->attribute() == it.first.id())
-                        add_symbol_attributes(Entry(node), it.second, mempool, attr, data);
+                        add_symbol_attributes(Entry(node), it.second, attr, data);
             } else if (e.is_immediate()) {
-                add_symbol_attributes(e, it.second, mempool, attr, data);
+                add_symbol_attributes(e, it.second, attr, data);
             }
         }
 
@@ -306,7 +383,70 @@ class SymbolLookup
         std::reverse(attr.begin(), attr.end());
         std::reverse(data.begin(), data.end());
 
-        // Add entries to snapshot. Strings are copied here, temporary mempool will be free'd
+        // Add entries to snapshot. Strings are copied here
+        if (attr.size() > 0)
+            c->make_entrylist(attr.size(), attr.data(), data.data(), *snapshot);
+    }
+
+    /// \brief Coordinated mode: add symbol references instead of symbols
+    void add_symbol_refs(Caliper* c, SnapshotRecord* snapshot, const std::map<Attribute, SymbolAttributes>& sym_map,
+                         std::vector<Attribute>& attr) {
+        std::vector<std::string> refs;
+
+        for (auto it : sym_map) {
+            Entry e = snapshot->get(it.first);
+
+            if (e.node()) {
+                for (const cali::Node* node = e.node(); node; node = node->parent())
+                    if (node->attribute() == it.first.id()) {
+                        attr.push_back(it.second.ref_attr);
+                        refs.push_back(make_symbol_ref(node->data().to_uint()));
+                    }
+            } else if (e.is_immediate()) {
+                attr.push_back(it.second.ref_attr);
+                refs.push_back(make_symbol_ref(e.value().to_uint()));
+            }
+        }
+
+        if (attr.empty())
+            return;
+
+        std::reverse(attr.begin(), attr.end());
+        std::reverse(refs.begin(), refs.end());
+
+        std::vector<Variant> data;
+
+        for (const std::string& ref : refs)
+            data.push_back(Variant(CALI_TYPE_STRING, ref.data(), ref.size()));
+
+        c->make_entrylist(attr.size(), attr.data(), data.data(), *snapshot);
+    }
+
+    /// \brief Resolve the symbol references in \a snapshot (coordinated mode)
+    void resolve_snapshot(Caliper* c, SnapshotRecord* snapshot) {
+        std::map<Attribute, SymbolAttributes> sym_map;
+
+        {
+            std::lock_guard<std::mutex>
+                g(m_sym_attr_mutex);
+
+            sym_map = m_sym_attr_map;
+        }
+
+        std::vector<Attribute> attr;
+        std::vector<Variant>   data;
+
+        for (auto it : sym_map) {
+            Entry e = snapshot->get(it.second.ref_attr);
+
+            for (const cali::Node* node = e.node(); node; node = node->parent())
+                if (node->attribute() == it.second.ref_attr.id())
+                    add_symbol_attributes(parse_symbol_ref(node->data().to_string()), it.second, attr, data);
+        }
+
+        std::reverse(attr.begin(), attr.end());
+        std::reverse(data.begin(), data.end());
+
         if (attr.size() > 0)
             c->make_entrylist(attr.size(), attr.data(), data.data(), *snapshot);
     }
@@ -314,24 +454,47 @@ class SymbolLookup
     // some final log output; print warning if we didn't find an address attribute
     void finish_log(Caliper* c) {
         Log(1).stream() << "Symbollookup: Performed " 
-                        << m_num_lookups << " address lookups, "
+                        << m_num_lookups << " address lookups ("
+                        << m_num_cached  << " cached), "
                         << m_num_failed  << " failed." 
                         << std::endl;
+
+        if (m_disk_cache) {
+            unsigned n = m_disk_cache->write();
+
+            Log(1).stream() << "Symbollookup: Found "
+                            << m_num_disk_cached << " symbols in the persistent cache, updated "
+                            << n << " cache files." << std::endl;
+        }
     }
 
-    void init_lookup() {
-        std::lock_guard<std::mutex> 
-            g(m_lookup_mutex);
+    // m_lookup_mutex must be held
+    void create_lookup() {
+        if (m_lookup_created)
+            return;
+
+        m_lookup_created = true;
+        m_lookup = AddressLookup::createAddressLookup();
 
         if (!m_lookup) {
-            m_lookup = AddressLookup::createAddressLookup();
+            Log(0).stream() << "Symbollookup: Could not create address lookup object"
+                            << std::endl;
+            return;
+        }
 
-            if (!m_lookup)
-                Log(0).stream() << "Symbollookup: Could not create address lookup object"
-                                << std::endl;
+        m_lookup->refresh();
+    }
 
-            m_lookup->refresh();
-        }
+    void init_lookup() {
+        std::lock_guard<std::mutex> 
+            g(m_lookup_mutex);
+
+        // With the persistent cache or in coordinated mode, the lookup
+        // object is created lazily on the first cache miss
+        if (module_table())
+            module_table()->update_modules();
+        if (!m_disk_cache && !m_coordinated)
+            create_lookup();
     }
 
     static void pre_flush_cb(Caliper* c, const SnapshotRecord*) {
@@ -343,6 +506,10 @@ class SymbolLookup
         s_instance->process_snapshot(c, snapshot);
     }
 
+    static void resolve_symbols_cb(Caliper* c, SnapshotRecord* snapshot) {
+        s_instance->resolve_snapshot(c, snapshot);
+    }
+
     static void finish_cb(Caliper* c) {
         s_instance->finish_log(c);
     }
@@ -351,11 +518,19 @@ class SymbolLookup
         c->events().pre_flush_evt.connect(pre_flush_cb);
         c->events().postprocess_snapshot.connect(postprocess_snapshot_cb);
         c->events().finish_evt.connect(finish_cb);
+
+        if (m_coordinated)
+            c->events().resolve_symbols_evt.connect(resolve_symbols_cb);
     }
 
     SymbolLookup(Caliper* c)
         : m_config(RuntimeConfig::init("symbollookup", s_configdata)),
-          m_lookup(0)
+          m_lookup(0),
+          m_lookup_created(false),
+          m_num_lookups(0),
+          m_num_cached(0),
+          m_num_disk_cached(0),
+          m_num_failed(0)
         {
             m_addr_attr_names  = m_config.get("attributes").to_stringlist(",:");
 
@@ -364,6 +539,22 @@ class SymbolLookup
             m_lookup_file      = m_config.get("lookup_file").to_bool();
             m_lookup_line      = m_config.get("lookup_line").to_bool();
             m_lookup_mod       = m_config.get("lookup_module").to_bool();
+            m_coordinated      = m_config.get("coordinated").to_bool();
+
+            std::string cache_dir = m_config.get("cache_dir").to_string();
+
+            if (!cache_dir.empty()) {
+                // Cache files are only valid for the same lookup configuration
+                uint32_t flags =
+                    (m_lookup_functions ? 0x01 : 0) |
+                    (m_lookup_sourceloc || m_lookup_file || m_lookup_line ? 0x02 : 0) |
+                    (m_lookup_mod       ? 0x04 : 0);
+
+                m_disk_cache.reset(new SymbolCache(cache_dir, flags));
+            }
+
+            if (m_coordinated && !m_disk_cache)
+                m_module_table.reset(new SymbolCache(std::string(), 0));
 
             register_callbacks(c);
 
@@ -404,6 +595,18 @@ const ConfigSet::Entry SymbolLookup::s_configdata[] = {
       "Perform module lookup",
       "Perform module lookup",
     },
+    { "coordinated", CALI_TYPE_BOOL, "false",
+      "Defer symbol lookup until after cross-process aggregation",
+      "Defer symbol lookup until after cross-process aggregation. Writes\n"
+      "process-independent symbol.ref#<attribute> references (module build-id\n"
+      "and offset) at flush time, which report services such as mpireport\n"
+      "resolve once per unique reference after aggregation."
+    },
+    { "cache_dir", CALI_TYPE_STRING, "",
+      "Directory for the persistent symbol cache",
+      "Directory for the persistent symbol cache. Resolved symbols are stored\n"
+      "per module, keyed by the module's ELF build-id. Empty: no persistent cache."
+    },
     ConfigSet::Terminator
 };
     
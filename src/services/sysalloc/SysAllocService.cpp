@@ -35,9 +35,16 @@
 #include "caliper/Caliper.h"
 
 #include "caliper/common/Log.h"
+#include "caliper/common/RuntimeConfig.h"
+
+#include "caliper/common/util/tls.hpp"
 
 #include <gotcha/gotcha.h>
 
+#include <atomic>
+
+#include <malloc.h>
+
 using namespace cali;
 
 namespace
@@ -62,6 +69,88 @@ const char *free_str = "free";
 
 bool bindings_are_active = false;
 
+// Allocations with a usable size below this are only counted, not tracked
+size_t g_min_size = 0;
+
+// Per-thread counts of untracked allocations, published into the global
+// counters in batches. Initial-exec TLS, because the dynamic TLS model may
+// call malloc on first access.
+
+#define PUBLISH_INTERVAL 1024
+
+struct UntrackedCounts {
+    unsigned long num_alloc;
+    unsigned long num_free;
+    unsigned long bytes;
+    unsigned      events;
+};
+
+thread_local UntrackedCounts t_untracked CALI_TLS_INITIAL_EXEC = { 0, 0, 0, 0 };
+
+std::atomic<unsigned long> g_untracked_alloc { 0 };
+std::atomic<unsigned long> g_untracked_free  { 0 };
+std::atomic<unsigned long> g_untracked_bytes { 0 };
+
+void publish_untracked_counts()
+{
+    g_untracked_alloc += t_untracked.num_alloc;
+    g_untracked_free  += t_untracked.num_free;
+    g_untracked_bytes += t_untracked.bytes;
+
+    t_untracked = UntrackedCounts { 0, 0, 0, 0 };
+}
+
+/// Returns true if the allocation at \a ptr should be tracked individually,
+/// or counts it and returns false otherwise. Classifies by usable size so
+/// that alloc and free of the same block always agree.
+inline bool track_alloc(void* ptr)
+{
+    if (!ptr)
+        return false;
+    if (g_min_size == 0)
+        return true;
+
+    size_t size = malloc_usable_size(ptr);
+
+    if (size >= g_min_size)
+        return true;
+
+    ++t_untracked.num_alloc;
+    t_untracked.bytes += size;
+
+    if (++t_untracked.events >= PUBLISH_INTERVAL)
+        publish_untracked_counts();
+
+    return false;
+}
+
+inline bool track_free(void* ptr)
+{
+    if (!ptr)
+        return false;
+    if (g_min_size == 0)
+        return true;
+
+    if (malloc_usable_size(ptr) >= g_min_size)
+        return true;
+
+    ++t_untracked.num_free;
+
+    if (++t_untracked.events >= PUBLISH_INTERVAL)
+        publish_untracked_counts();
+
+    return false;
+}
+
+const ConfigSet::Entry s_configdata[] = {
+    { "min_size", CALI_TYPE_UINT, "0",
+      "Minimum size of individually tracked allocations",
+      "Minimum size (in bytes) of individually tracked allocations.\n"
+      "Smaller allocations are only counted."
+    },
+    ConfigSet::Terminator
+};
+
 struct gotcha_binding_t alloc_bindings[] = {
     { malloc_str,   (void*) cali_malloc_wrapper,    &orig_malloc  },
     { calloc_str,   (void*) cali_calloc_wrapper,    &orig_calloc  },
@@ -73,6 +162,9 @@ void* cali_malloc_wrapper(size_t size)
 {
     void *ret = (*orig_malloc)(size);
 
+    if (!track_alloc(ret))
+        return ret;
+
     Caliper c = Caliper::sigsafe_instance(); // prevent reentry
 
     if (c)
@@ -85,6 +177,9 @@ void* cali_calloc_wrapper(size_t num, size_t size)
 {
     void *ret = (*orig_calloc)(num, size);
 
+    if (!track_alloc(ret))
+        return ret;
+
     Caliper c = Caliper::sigsafe_instance(); // prevent reentry
 
     if (c)
@@ -95,13 +190,23 @@ void* cali_calloc_wrapper(size_t num, size_t size)
 
 void* cali_realloc_wrapper(void *ptr, size_t size)
 {
+    // ptr can't be inspected after realloc
+    bool track_old = track_free(ptr);
+
     void *ret = (*orig_realloc)(ptr, size);
 
+    bool track_new = track_alloc(ret);
+
+    if (!track_old && !track_new)
+        return ret;
+
     Caliper c = Caliper::sigsafe_instance();
 
     if (c) {
-        c.memory_region_end(ptr);
-        c.memory_region_begin(ret, "realloc", 1, 1, &size);
+        if (track_old)
+            c.memory_region_end(ptr);
+        if (track_new)
+            c.memory_region_begin(ret, "realloc", 1, 1, &size);
     }
 
     return ret;
@@ -109,8 +214,13 @@ void* cali_realloc_wrapper(void *ptr, size_t size)
 
 void cali_free_wrapper(void *ptr)
 {
+    bool track = track_free(ptr);
+
     (*orig_free)(ptr);
 
+    if (!track)
+        return;
+
     Caliper c = Caliper::sigsafe_instance();
 
     if (c)
@@ -149,9 +259,23 @@ void clear_alloc_hooks(Caliper*)
                 "Caliper sysalloc unwrap");
 
     bindings_are_active = false;
+
+    if (g_min_size > 0) {
+        publish_untracked_counts();
+
+        Log(1).stream() << "sysalloc: "
+                        << g_untracked_alloc << " allocations ("
+                        << g_untracked_bytes << " bytes) and "
+                        << g_untracked_free  << " frees below min_size counted but not tracked."
+                        << std::endl;
+    }
 }
 
 void sysalloc_initialize(Caliper* c) {
+    ConfigSet config = RuntimeConfig::init("sysalloc", s_configdata);
+
+    g_min_size = config.get("min_size").to_uint();
+
     c->events().post_init_evt.connect(init_alloc_hooks);
     c->events().finish_evt.connect(clear_alloc_hooks);
 }
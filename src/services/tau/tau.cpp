@@ -33,46 +33,71 @@
 /// @file  tau.cpp
 /// @brief Caliper TAU service
 
-#include "../common/ToolWrapper.h"
-#include "caliper/common/filters/RegexFilter.h"
+#include "caliper/AnnotationBinding.h"
 
+#include "caliper/common/Attribute.h"
+#include "caliper/common/Variant.h"
 
-#include <map>
 #include <TAU.h>
 
-namespace cali {
+#include <mutex>
+#include <string>
 
+using namespace cali;
 
-class TAUWrapper : public ToolWrapper {
-  public:
-    virtual void initialize(){
-        TAU_PROFILE_SET_NODE(0);
-    }
+namespace
+{
+
+class TAUBinding : public cali::AnnotationBinding
+{
+    // TAU timers are process-wide, so the per-thread caches fall back
+    // to the shared one, which is accessed under a lock
+
+    HandleCache<void*> m_shared_timers;
+    std::mutex         m_shared_timers_lock;
+
+    static thread_local HandleCache<void*> s_timers;
+
+    void* get_timer(const Attribute& attr, const Variant& value) {
+        return s_timers.value_handle(attr, value, [this,&value](const Attribute& a, const char* str){
+                std::lock_guard<std::mutex>
+                    g(m_shared_timers_lock);
+
+                return m_shared_timers.value_handle(a, value, [](const Attribute& sa, const char* sstr){
+                        std::string name(sa.name());
+                        name.append("=").append(sstr);
 
-    virtual std::string service_name() { 
-      return "TAU service";
+                        void* timer = nullptr;
+                        TAU_PROFILER_CREATE(timer, name.c_str(), "", TAU_USER);
+
+                        return timer;
+                    });
+            });
     }
-    virtual std::string service_tag(){
-      return "tau";
+
+public:
+
+    void initialize(Caliper* c) {
+        TAU_PROFILE_SET_NODE(0);
     }
-    virtual void beginAction(Caliper* c, const Attribute &attr, const Variant& value){
-      std::stringstream ss;
-      ss << attr.name() << "=" << value.to_string();
-      std::string name = ss.str();
 
-      TAU_START(name.c_str());
+    const char* service_tag() const { return "tau"; }
+
+    void on_begin(Caliper* c, const Attribute& attr, const Variant& value) {
+        TAU_PROFILER_START(get_timer(attr, value));
     }
 
-    virtual void endAction(Caliper* c, const Attribute& attr, const Variant& value){
-      std::stringstream ss;
-      ss << attr.name() << "=" << value.to_string();
-      std::string name = ss.str();
-      TAU_STOP(name.c_str());
+    void on_end(Caliper* c, const Attribute& attr, const Variant& value) {
+        TAU_PROFILER_STOP(get_timer(attr, value));
     }
 };
 
-CaliperService tau_service { "tau", &setCallbacks<TAUWrapper>};
+thread_local AnnotationBinding::HandleCache<void*> TAUBinding::s_timers;
 
+} // namespace [anonymous]
 
-}
 
+namespace cali
+{
+    CaliperService tau_service { "tau", &AnnotationBinding::make_binding<::TAUBinding> };
+}
@@ -11,6 +11,8 @@
 #include "caliper/common/SnapshotTextFormatter.h"
 
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <functional>
 #include <iostream>
@@ -18,6 +20,7 @@
 #include <mutex>
 #include <string>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 using namespace cali;
@@ -43,6 +46,16 @@ const ConfigSet::Entry   configdata[] = {
       "   none:   No output,\n"
       " or a file name. The default is stdout\n"
     },
+    { "buffer_size", CALI_TYPE_UINT, "1048576",
+      "Size of the output buffer in bytes",
+      "Size of the output buffer in bytes. A background thread writes the buffer\n"
+      "when it is full, after the flush interval, and at the end.\n"
+      "0 writes every log entry immediately."
+    },
+    { "flush_interval", CALI_TYPE_UINT, "1000",
+      "Maximum time output stays in the buffer, in milliseconds",
+      "Maximum time output stays in the buffer, in milliseconds."
+    },
     ConfigSet::Terminator
 };
 
@@ -67,6 +80,20 @@ class TextLogService
     Attribute                   end_event_attr;
 
     std::mutex                  stream_mutex;
+
+    // Output buffering. Log entries are appended to m_pending, and the
+    // writer thread swaps it out and writes it to the stream.
+
+    size_t                      m_buffer_size;
+    std::chrono::milliseconds   m_flush_interval;
+
+    std::string                 m_pending;
+    std::string                 m_batch;   // protected by stream_mutex
+    std::mutex                  m_pending_lock;
+    std::condition_variable     m_pending_cv;
+    bool                        m_stop;
+
+    std::thread                 m_thread;
     
     static unique_ptr<TextLogService> 
                                 s_textlog;
@@ -167,12 +194,102 @@ class TextLogService
 
         ostringstream os;
         
-        formatter.print(os, *c, snapshot->to_entrylist()) << std::endl;
+        formatter.print(os, *c, snapshot->to_entrylist()) << '\n';
+
+        write(os.str());
+    }
+
+    /// \brief Add \a str to the output buffer, or write it immediately if
+    ///   buffering is disabled or the writer thread has stopped.
+    void write(const std::string& str) {
+        if (m_buffer_size > 0) {
+            std::unique_lock<std::mutex>
+                lk(m_pending_lock);
+
+            if (!m_stop) {
+                m_pending.append(str);
+
+                size_t size = m_pending.size();
+                lk.unlock();
+
+                if (size >= 4 * m_buffer_size)
+                    // the writer fell far behind: write here to bound the buffer size
+                    write_pending(false);
+                else if (size >= m_buffer_size)
+                    m_pending_cv.notify_one();
+
+                return;
+            }
+        }
+
+        std::lock_guard<std::mutex>
+            g(stream_mutex);
+
+        get_stream().write(str.data(), str.size());
+    }
+
+    /// \brief Write out the output buffer. Holding stream_mutex while
+    ///   swapping the buffer keeps the output in order.
+    void write_pending(bool flush) {
+        std::lock_guard<std::mutex>
+            g(stream_mutex);
+
+        {
+            std::lock_guard<std::mutex>
+                g(m_pending_lock);
+
+            m_batch.swap(m_pending);
+        }
+
+        get_stream().write(m_batch.data(), m_batch.size());
+
+        if (flush)
+            get_stream().flush();
+
+        m_batch.clear();
+    }
+
+    /// \brief The writer thread: write the buffer when it is full or the
+    ///   flush interval has passed
+    void write_loop() {
+        std::unique_lock<std::mutex>
+            lk(m_pending_lock);
+
+        while (true) {
+            m_pending_cv.wait_for(lk, m_flush_interval, [this](){
+                    return m_stop || m_pending.size() >= m_buffer_size;
+                });
+
+            if (m_pending.empty()) {
+                if (m_stop)
+                    break;
+
+                continue;
+            }
+
+            lk.unlock();
+            write_pending(true);
+            lk.lock();
+        }
+    }
+
+    void stop_writer() {
+        {
+            std::lock_guard<std::mutex>
+                g(m_pending_lock);
+
+            m_stop = true;
+        }
+
+        m_pending_cv.notify_one();
+
+        if (m_thread.joinable())
+            m_thread.join();
 
         std::lock_guard<std::mutex>
             g(stream_mutex);
 
-        get_stream() << os.str();
+        get_stream().flush();
     }
 
     void post_init(Caliper* c) {
@@ -183,6 +300,12 @@ class TextLogService
 
         formatter.reset(formatstr);
 
+        if (m_buffer_size > 0 && m_stream != Stream::None) {
+            m_pending.reserve(m_buffer_size);
+            m_batch.reserve(m_buffer_size);
+            m_thread = std::thread(&TextLogService::write_loop, this);
+        }
+
         set_event_attr = c->get_attribute("cali.event.set");
         end_event_attr = c->get_attribute("cali.event.end");
 
@@ -206,24 +329,38 @@ class TextLogService
         s_textlog->post_init(c);
     }
 
+    static void finish_cb(Caliper* c) {
+        s_textlog->stop_writer();
+    }
+
     TextLogService(Caliper* c)
         : config(RuntimeConfig::init("textlog", configdata)),
           set_event_attr(Attribute::invalid),
-          end_event_attr(Attribute::invalid)
+          end_event_attr(Attribute::invalid),
+          m_stop(false)
         { 
             init_stream();
 
+            m_buffer_size    = config.get("buffer_size").to_uint();
+            m_flush_interval = std::chrono::milliseconds(std::max<uint64_t>(config.get("flush_interval").to_uint(), 1));
+
             trigger_attr_names = config.get("trigger").to_stringlist(",:");
 
             c->events().create_attr_evt.connect(&TextLogService::create_attr_cb);
             c->events().post_init_evt.connect(&TextLogService::post_init_cb);
             c->events().process_snapshot.connect(&TextLogService::process_snapshot_cb);
+            c->events().finish_evt.connect(&TextLogService::finish_cb);
 
             Log(1).stream() << "Registered text log service" << std::endl;
         }
 
 public:
 
+    ~TextLogService() {
+        if (m_thread.joinable())
+            stop_writer();
+    }
+
     static void textlog_register(Caliper* c) {
         s_textlog.reset(new TextLogService(c));
     }
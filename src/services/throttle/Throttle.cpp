@@ -0,0 +1,282 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file  Throttle.cpp
+/// \brief Throttles annotations with a high event rate or overhead
+
+#include "caliper/CaliperService.h"
+
+#include "caliper/Caliper.h"
+
+#include "caliper/common/Log.h"
+#include "caliper/common/RuntimeConfig.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CALI_THROTTLE_HAVE_TSC
+#endif
+
+using namespace cali;
+using namespace std;
+
+namespace
+{
+
+const ConfigSet::Entry configdata[] = {
+    { "max_rate", CALI_TYPE_DOUBLE, "100000",
+      "Maximum events per second for an attribute on a thread",
+      "Maximum number of begin/set/end events per second for an attribute\n"
+      "on a thread. Attributes above the limit are throttled. 0 disables the limit."
+    },
+    { "max_overhead", CALI_TYPE_DOUBLE, "0.05",
+      "Maximum fraction of time spent in an attribute's events on a thread",
+      "Maximum fraction of the time on a thread spent in Caliper callbacks for\n"
+      "an attribute's events. Attributes above the limit are throttled.\n"
+      "0 disables the limit."
+    },
+    { "interval", CALI_TYPE_UINT, "100",
+      "Measurement interval in milliseconds",
+      "Measurement interval in milliseconds. Rates and overheads are\n"
+      "computed for each interval."
+    },
+    { "mode", CALI_TYPE_STRING, "sample",
+      "What to do with throttled attributes",
+      "What to do with throttled attributes:\n"
+      "   sample:  Invoke callbacks only for every Nth begin/end pair\n"
+      "   count:   Don't invoke callbacks, only count the events"
+    },
+    { "sample_count", CALI_TYPE_UINT, "100",
+      "N for the sample mode",
+      "N for the sample mode: invoke callbacks for every Nth begin/end pair."
+    },
+    { "attributes", CALI_TYPE_STRING, "",
+      "List of attributes that may be throttled",
+      "List of attributes that may be throttled. If empty, all attributes\n"
+      "may be throttled."
+    },
+    ConfigSet::Terminator
+};
+
+double           max_rate     = 100000;
+double           max_overhead = 0.05;
+unsigned         throttle_rate = 100;
+
+std::chrono::milliseconds interval { 100 };
+
+std::vector<std::string> attribute_names;
+
+// Number of events between checks whether the interval is over
+const unsigned   check_events = 64;
+
+std::mutex       throttled_lock;
+std::vector<Attribute> throttled_attrs;
+
+inline uint64_t read_ticks()
+{
+#ifdef CALI_THROTTLE_HAVE_TSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct EventCounter {
+    uint64_t events = 0;
+    uint64_t ticks  = 0; ///< Ticks spent in callbacks for the attribute's events
+};
+
+struct ThreadData {
+    std::vector<EventCounter> counters;    ///< Indexed by attribute ID
+    std::vector<cali_id_t>    active_ids;  ///< Attributes with events in the current interval
+
+    uint64_t   event_start   = 0;
+    uint64_t   window_ticks  = 0;
+    unsigned   num_events    = 0;
+
+    std::chrono::steady_clock::time_point window_start;
+
+    ThreadData()
+        : window_ticks(read_ticks()), window_start(std::chrono::steady_clock::now())
+        { }
+};
+
+thread_local ThreadData t_data;
+
+void throttle(Caliper* c, cali_id_t id, double rate, double overhead)
+{
+    Attribute attr = c->get_attribute(id);
+
+    if (attr == Attribute::invalid)
+        return;
+    if (!attribute_names.empty() &&
+        std::find(attribute_names.begin(), attribute_names.end(), attr.name()) == attribute_names.end())
+        return;
+
+    {
+        std::lock_guard<std::mutex>
+            g(throttled_lock);
+
+        if (std::find(throttled_attrs.begin(), throttled_attrs.end(), attr) != throttled_attrs.end())
+            return;
+
+        throttled_attrs.push_back(attr);
+    }
+
+    c->set_event_throttle(attr, throttle_rate);
+
+    Log(1).stream() << "throttle: Throttling \"" << attr.name() << "\" ("
+                    << static_cast<uint64_t>(rate) << " events/s, "
+                    << 100.0 * overhead << "% overhead): "
+                    << (throttle_rate == Caliper::EventThrottleCountOnly ?
+                        std::string("counting only") :
+                        std::string("sampling every ") + std::to_string(throttle_rate) + "th event")
+                    << std::endl;
+}
+
+void check_interval(Caliper* c, ThreadData& td, uint64_t now)
+{
+    auto   tnow    = std::chrono::steady_clock::now();
+
+    if (tnow - td.window_start < interval)
+        return;
+
+    double sec     = std::chrono::duration<double>(tnow - td.window_start).count();
+    double ticks   = static_cast<double>(now - td.window_ticks);
+
+    for (cali_id_t id : td.active_ids) {
+        EventCounter& k = td.counters[id];
+
+        double rate     = k.events / sec;
+        double overhead = ticks > 0 ? k.ticks / ticks : 0.0;
+
+        if ((max_rate > 0 && rate > max_rate) || (max_overhead > 0 && overhead > max_overhead))
+            throttle(c, id, rate, overhead);
+
+        k = EventCounter();
+    }
+
+    td.active_ids.clear();
+
+    td.window_start = tnow;
+    td.window_ticks = now;
+}
+
+void pre_event_cb(Caliper*, const Attribute&, const Variant&)
+{
+    t_data.event_start = read_ticks();
+}
+
+void post_event_cb(Caliper* c, const Attribute& attr, const Variant&)
+{
+    if (c->is_signal())
+        return;
+
+    uint64_t    now = read_ticks();
+    ThreadData& td  = t_data;
+    cali_id_t   id  = attr.id();
+
+    if (id >= td.counters.size())
+        td.counters.resize(std::max<size_t>(id + 1, 2 * td.counters.size()));
+
+    EventCounter& k = td.counters[id];
+
+    if (k.events == 0)
+        td.active_ids.push_back(id);
+
+    ++k.events;
+    k.ticks += now - td.event_start;
+
+    if (++td.num_events % check_events == 0)
+        check_interval(c, td, now);
+}
+
+void finish_cb(Caliper* c)
+{
+    std::lock_guard<std::mutex>
+        g(throttled_lock);
+
+    for (const Attribute& attr : throttled_attrs)
+        Log(1).stream() << "throttle: \"" << attr.name() << "\": "
+                        << c->num_throttled_events(attr) << " events throttled"
+                        << std::endl;
+}
+
+void throttle_register(Caliper* c)
+{
+    ConfigSet config = RuntimeConfig::init("throttle", configdata);
+
+    max_rate        = config.get("max_rate").to_double();
+    max_overhead    = config.get("max_overhead").to_double();
+    interval        = std::chrono::milliseconds(std::max<unsigned>(config.get("interval").to_uint(), 1));
+    attribute_names = config.get("attributes").to_stringlist(",:");
+
+    std::string mode = config.get("mode").to_string();
+
+    if (mode == "count")
+        throttle_rate = Caliper::EventThrottleCountOnly;
+    else {
+        if (mode != "sample")
+            Log(0).stream() << "throttle: unknown mode \"" << mode << "\", using \"sample\"" << std::endl;
+
+        throttle_rate = std::max<unsigned>(config.get("sample_count").to_uint(), 2);
+    }
+
+    c->events().pre_begin_evt.connect(&pre_event_cb);
+    c->events().pre_set_evt.connect(&pre_event_cb);
+    c->events().pre_end_evt.connect(&pre_event_cb);
+
+    // Connect the post-event callbacks last, so they measure the other
+    // services' post-event callbacks as well
+    c->events().post_init_evt.connect([](Caliper* c){
+            c->events().post_begin_evt.connect(&post_event_cb);
+            c->events().post_set_evt.connect(&post_event_cb);
+            c->events().post_end_evt.connect(&post_event_cb);
+        });
+
+    c->events().finish_evt.connect(&finish_cb);
+
+    Log(1).stream() << "Registered throttle service" << std::endl;
+}
+
+} // namespace
+
+namespace cali
+{
+    CaliperService throttle_service = { "throttle", ::throttle_register };
+}
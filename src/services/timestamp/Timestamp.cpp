@@ -42,14 +42,25 @@
 #include "caliper/common/ContextRecord.h"
 #include "caliper/common/Log.h"
 
+#include <algorithm>
 #include <cassert>
+#include <iterator>
 #include <chrono>
-#include <map>
-#include <mutex>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define CALI_TIMER_HAVE_TSC
+#elif defined(__powerpc__) && defined(__GNUC__)
+#define CALI_TIMER_HAVE_TSC
+#endif
+
 using namespace cali;
 using namespace std;
 
@@ -58,10 +69,15 @@ namespace
 
 chrono::time_point<chrono::high_resolution_clock> tstart;
 
+bool      use_tsc     = false;
+uint64_t  tsc_start   = 0;
+double    usec_per_tick = 0.0;
+
 Attribute timestamp_attr { Attribute::invalid } ;
 Attribute timeoffs_attr  { Attribute::invalid } ;
 Attribute snapshot_duration_attr { Attribute::invalid };
 Attribute phase_duration_attr    { Attribute::invalid };
+Attribute exclusive_duration_attr { Attribute::invalid };
 
 ConfigSet config;
 
@@ -69,16 +85,75 @@ bool      record_timestamp;
 bool      record_offset;
 bool      record_duration;
 bool      record_phases;
+bool      record_exclusive;
 
 Attribute begin_evt_attr { Attribute::invalid };
 Attribute set_evt_attr   { Attribute::invalid };
 Attribute end_evt_attr   { Attribute::invalid };
 Attribute lvl_attr       { Attribute::invalid };
 
-typedef std::map<uint64_t, Attribute> OffsetAttributeMap;
+// Per-thread stacks of begin offsets, indexed by attribute ID and
+// hierarchy level - 1
+typedef std::unordered_map< cali_id_t, std::vector<uint64_t> > OffsetStackMap;
+
+// Open region for exclusive time: the time spent in its child regions
+// is subtracted from its inclusive time at the end
+struct ExclusiveFrame {
+    cali_id_t attr;
+    uint64_t  begin;
+    uint64_t  child_time;
+};
+
+struct ThreadTimers {
+    OffsetStackMap              offset_stacks;
+    std::vector<ExclusiveFrame> frames; ///< Open regions of all attributes, innermost last
+};
+
+pthread_key_t  thread_timers_key;
+
+void delete_thread_timers(void* ptr)
+{
+    delete static_cast<ThreadTimers*>(ptr);
+}
+
+// The stacks are a heap object released by a pthread key destructor
+// rather than a thread_local map: end events from exit handlers may come
+// in after the main thread's thread_local objects are destroyed.
+
+ThreadTimers* acquire_thread_timers()
+{
+    thread_local ThreadTimers* t_timers = nullptr;
+
+    if (!t_timers) {
+        t_timers = new ThreadTimers;
+        pthread_setspecific(thread_timers_key, t_timers);
+    }
+
+    return t_timers;
+}
+
+/// \brief Close the innermost open region of \a attr at \a usec.
+///   Returns its exclusive time, and adds its inclusive time to the
+///   child time of the enclosing region.
+bool end_exclusive_frame(std::vector<ExclusiveFrame>& frames, cali_id_t attr, uint64_t usec, uint64_t* exclusive)
+{
+    auto it = std::find_if(frames.rbegin(), frames.rend(),
+                           [attr](const ExclusiveFrame& f) { return f.attr == attr; });
+
+    if (it == frames.rend())
+        return false;
+
+    uint64_t inclusive = usec - it->begin;
+
+    *exclusive = (inclusive > it->child_time ? inclusive - it->child_time : 0);
+
+    auto pos = frames.erase(std::next(it).base());
+
+    if (pos != frames.begin())
+        (pos-1)->child_time += inclusive;
 
-std::mutex         offset_attributes_mutex;
-OffsetAttributeMap offset_attributes;
+    return true;
+}
 
 static const ConfigSet::Entry s_configdata[] = {
     { "snapshot_duration", CALI_TYPE_BOOL, "false",
@@ -97,78 +172,94 @@ static const ConfigSet::Entry s_configdata[] = {
       "Record inclusive duration of begin/end phases.",
       "Record inclusive duration of begin/end phases."
     },
+    { "exclusive_duration", CALI_TYPE_BOOL, "false",
+      "Record exclusive duration of begin/end phases.",
+      "Record exclusive duration of begin/end phases, i.e. the inclusive duration\n"
+      "minus the time spent in nested phases of any attribute on the same thread."
+    },
+    { "clock", CALI_TYPE_STRING, "chrono",
+      "Clock source for time offsets and durations: chrono or tsc",
+      "Clock source for time offsets and durations:\n"
+      "   chrono: std::chrono::high_resolution_clock\n"
+      "   tsc:    CPU time-stamp counter (invariant TSC on x86, timebase on POWER)"
+    },
     ConfigSet::Terminator
 };
 
 
-uint64_t make_offset_attribute_key(cali_id_t attr_id, unsigned level)
+#ifdef CALI_TIMER_HAVE_TSC
+inline uint64_t read_tsc()
 {
-    // assert((level   & 0xFFFF)         == 0);
-    // assert((attr_id & 0xFFFFFFFFFFFF) == 0);
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return __builtin_ppc_get_timebase();
+#endif
+}
+#endif
 
-    uint64_t lvl_k = static_cast<uint64_t>(level) << 48;
+/// Time since program start, in microseconds
+inline uint64_t read_usec()
+{
+#ifdef CALI_TIMER_HAVE_TSC
+    if (use_tsc)
+        return static_cast<uint64_t>((read_tsc() - tsc_start) * usec_per_tick);
+#endif
 
-    return lvl_k | attr_id;    
+    return chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - tstart).count();
 }
 
-// Get or create a hidden offset attribute for the given attribute and its
-// current hierarchy level
-
-Attribute make_offset_attribute(Caliper* c, cali_id_t attr_id, unsigned level)
+/// Check if the time-stamp counter is usable and calibrate it against
+/// the steady clock
+bool init_tsc()
 {
-    uint64_t key = make_offset_attribute_key(attr_id, level);
-
-    {
-        std::lock_guard<std::mutex>  lock(offset_attributes_mutex);
-        OffsetAttributeMap::iterator it = offset_attributes.find(key);
-    
-        if (it != offset_attributes.end())
-            return it->second;
+#ifdef CALI_TIMER_HAVE_TSC
+#if defined(__x86_64__) || defined(__i386__)
+    // Require invariant TSC (CPUID 0x80000007, EDX bit 8): it ticks at a
+    // constant rate across frequency changes and is synchronized across cores
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))) {
+        Log(0).stream() << "Timestamp: CPU has no invariant TSC" << std::endl;
+        return false;
     }
+#endif
 
-    // Not found -> create new entry
+    auto     t0   = chrono::steady_clock::now();
+    uint64_t tsc0 = read_tsc();
+    auto     t1   = t0;
 
-    std::string name = "offs.";
-    name.append(std::to_string(attr_id));
-    name.append(".");
-    name.append(std::to_string(level));
+    do {
+        t1 = chrono::steady_clock::now();
+    } while (t1 - t0 < chrono::milliseconds(10));
 
-    Attribute offs_attr = 
-        c->create_attribute(name, CALI_TYPE_UINT,
-                            CALI_ATTR_ASVALUE     |
-                            CALI_ATTR_SKIP_EVENTS |
-                            CALI_ATTR_HIDDEN      |
-                            CALI_ATTR_SCOPE_THREAD); // FIXME: needs to be original attribute's scope
+    uint64_t tsc1 = read_tsc();
+    auto     tnow = chrono::high_resolution_clock::now();
+    double   usec = chrono::duration<double, std::micro>(t1 - t0).count();
 
-    std::lock_guard<std::mutex> lock(offset_attributes_mutex);
-    offset_attributes.insert(std::make_pair(key, offs_attr));
+    if (tsc1 <= tsc0) {
+        Log(0).stream() << "Timestamp: TSC calibration failed" << std::endl;
+        return false;
+    }
 
-    return offs_attr;
-}
+    usec_per_tick = usec / static_cast<double>(tsc1 - tsc0);
 
-// Get existing hidden offset attribute for the given attribute and its
-// current hierarchy level
+    Log(2).stream() << "Timestamp: TSC frequency is " << 1.0 / usec_per_tick << " MHz" << std::endl;
 
-Attribute find_offset_attribute(Caliper* c, cali_id_t attr_id, unsigned level)
-{
-    uint64_t key = make_offset_attribute_key(attr_id, level);
+    // Ticks are relative to the chrono start time to keep offsets consistent
+    tsc_start = tsc1 - static_cast<uint64_t>(
+        chrono::duration<double, std::micro>(tnow - tstart).count() / usec_per_tick);
 
-    {
-        std::lock_guard<std::mutex>  lock(offset_attributes_mutex);
-        OffsetAttributeMap::iterator it = offset_attributes.find(key);
-    
-        if (it != offset_attributes.end())
-            return it->second;
-    }
-
-    return Attribute::invalid;
+    return true;
+#else
+    Log(0).stream() << "Timestamp: TSC clock is not supported on this platform" << std::endl;
+    return false;
+#endif
 }
 
 void snapshot_cb(Caliper* c, int scope, const SnapshotRecord* trigger_info, SnapshotRecord* sbuf) {
-    auto now = chrono::high_resolution_clock::now();
-
-    if ((record_duration || record_phases || record_offset) && scope & CALI_SCOPE_THREAD) {
-        uint64_t  usec = chrono::duration_cast<chrono::microseconds>(now - tstart).count();
+    if ((record_duration || record_phases || record_exclusive || record_offset) && scope & CALI_SCOPE_THREAD) {
+        uint64_t  usec = read_usec();
         Variant v_usec = Variant(usec);
         Variant v_offs = c->exchange(timeoffs_attr, v_usec);
 
@@ -178,7 +269,7 @@ void snapshot_cb(Caliper* c, int scope, const SnapshotRecord* trigger_info, Snap
             sbuf->append(snapshot_duration_attr.id(), Variant(duration));
         }
 
-        if (record_phases && trigger_info) {
+        if ((record_phases || record_exclusive) && trigger_info) {
             Entry event = trigger_info->get(begin_evt_attr);
 
             cali_id_t evt_attr_id;
@@ -197,32 +288,46 @@ void snapshot_cb(Caliper* c, int scope, const SnapshotRecord* trigger_info, Snap
             if (evt_attr_id == CALI_INV_ID || v_level.empty())
                 goto record_phases_exit;
 
-            if (event.attribute() == begin_evt_attr.id()) {
-                // begin/set event: save time for current entry
+            if (v_level.to_uint() == 0)
+                goto record_phases_exit;
+
+            if (record_exclusive) {
+                std::vector<ExclusiveFrame>& frames = acquire_thread_timers()->frames;
+                uint64_t exclusive = 0;
 
-                c->set(make_offset_attribute(c, evt_attr_id, v_level.to_uint()), v_usec);
-            } else if (event.attribute() == set_evt_attr.id())   {
-                // set event: get saved time for current entry and calculate duration
+                // a set event ends the previous phase and begins a new one
+                if (event.attribute() != begin_evt_attr.id())
+                    if (end_exclusive_frame(frames, evt_attr_id, usec, &exclusive))
+                        sbuf->append(exclusive_duration_attr.id(), Variant(exclusive));
+                if (event.attribute() != end_evt_attr.id())
+                    frames.push_back({ evt_attr_id, usec, 0 });
+            }
 
-                Variant v_p_usec    = 
-                    c->exchange(make_offset_attribute(c, evt_attr_id, v_level.to_uint()), v_usec);
+            if (record_phases) {
+                std::vector<uint64_t>& stack = acquire_thread_timers()->offset_stacks[evt_attr_id];
+                size_t level = v_level.to_uint();
 
-                if (!v_p_usec.empty())
-                    sbuf->append(phase_duration_attr.id(), Variant(usec - v_p_usec.to_uint()));
-            } else if (event.attribute() == end_evt_attr.id())   {
-                // end event: get saved time for current entry and calculate duration
+                if (event.attribute() == begin_evt_attr.id()) {
+                    // begin event: save time for current entry
 
-                Attribute offs_attr = 
-                    find_offset_attribute(c, evt_attr_id, v_level.to_uint());
+                    stack.resize(level);
+                    stack[level-1] = usec;
+                } else if (event.attribute() == set_evt_attr.id())   {
+                    // set event: get saved time for current entry and calculate duration
 
-                if (offs_attr == Attribute::invalid)
-                    goto record_phases_exit;
+                    if (stack.size() >= level)
+                        sbuf->append(phase_duration_attr.id(), Variant(usec - stack[level-1]));
 
-                Variant v_p_usec    = 
-                    c->exchange(offs_attr, Variant());
+                    stack.resize(level);
+                    stack[level-1] = usec;
+                } else if (event.attribute() == end_evt_attr.id())   {
+                    // end event: get saved time for current entry and calculate duration
 
-                if (!v_p_usec.empty())
-                    sbuf->append(phase_duration_attr.id(), Variant(usec - v_p_usec.to_uint()));
+                    if (stack.size() >= level) {
+                        sbuf->append(phase_duration_attr.id(), Variant(usec - stack[level-1]));
+                        stack.resize(level-1);
+                    }
+                }
             }
 record_phases_exit:
             ;
@@ -247,11 +352,12 @@ void post_init_cb(Caliper* c)
         set_evt_attr   == Attribute::invalid ||
         end_evt_attr   == Attribute::invalid ||
         lvl_attr       == Attribute::invalid) {
-        if (record_phases)
+        if (record_phases || record_exclusive)
             Log(1).stream() << "Timestamp: Note: event trigger attributes not registered,\n"
                 "    disabling phase timers." << std::endl;
 
-        record_phases = false;
+        record_phases    = false;
+        record_exclusive = false;
     }
 }
 
@@ -268,6 +374,26 @@ void timestamp_service_register(Caliper* c)
     record_offset    = config.get("offset").to_bool();
     record_timestamp = config.get("timestamp").to_bool();
     record_phases    = config.get("inclusive_duration").to_bool();
+    record_exclusive = config.get("exclusive_duration").to_bool();
+
+    std::string clock = config.get("clock").to_string();
+
+    if (clock == "tsc") {
+        use_tsc = init_tsc();
+
+        if (!use_tsc)
+            Log(0).stream() << "Timestamp: using chrono clock" << std::endl;
+    } else if (clock != "chrono") {
+        Log(0).stream() << "Timestamp: unknown clock \"" << clock
+                        << "\", using chrono clock" << std::endl;
+    }
+
+    if ((record_phases || record_exclusive) && pthread_key_create(&thread_timers_key, delete_thread_timers) != 0) {
+        Log(0).stream() << "Timestamp: error: pthread_key_create() failed,\n"
+            "    disabling phase timers." << std::endl;
+        record_phases    = false;
+        record_exclusive = false;
+    }
 
     Attribute unit_attr = 
         c->create_attribute("time.unit", CALI_TYPE_STRING, CALI_ATTR_SKIP_EVENTS);
@@ -278,7 +404,7 @@ void timestamp_service_register(Caliper* c)
     Variant   sec_val   = Variant(CALI_TYPE_STRING, "sec",  3);
     Variant   true_val  = Variant(true);
     
-    int hide_offset  = ((record_duration || record_phases) && !record_offset ? CALI_ATTR_HIDDEN : 0);
+    int hide_offset  = ((record_duration || record_phases || record_exclusive) && !record_offset ? CALI_ATTR_HIDDEN : 0);
 
     Attribute meta_attr[2] = { aggr_class_attr, unit_attr };
     Variant   meta_vals[2] = { true_val,        usec_val  };
@@ -308,6 +434,14 @@ void timestamp_service_register(Caliper* c)
                             CALI_ATTR_SKIP_EVENTS,
                             2, meta_attr, meta_vals);
 
+    if (record_exclusive)
+        exclusive_duration_attr =
+            c->create_attribute("time.exclusive.duration", CALI_TYPE_UINT,
+                                CALI_ATTR_ASVALUE       |
+                                CALI_ATTR_SCOPE_THREAD  |
+                                CALI_ATTR_SKIP_EVENTS,
+                                2, meta_attr, meta_vals);
+
     c->set(timeoffs_attr, Variant(static_cast<uint64_t>(0)));
 
     // c->events().create_attr_evt.connect(&create_attr_cb);
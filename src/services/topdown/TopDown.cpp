@@ -0,0 +1,382 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+/// \file  TopDown.cpp
+/// \brief Computes top-down microarchitecture metrics from libpfm counters
+
+#include "caliper/CaliperService.h"
+
+#include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/Log.h"
+#include "caliper/common/RuntimeConfig.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace cali;
+using namespace std;
+
+namespace
+{
+
+const ConfigSet::Entry configdata[] = {
+    { "arch", CALI_TYPE_STRING, "auto",
+      "Microarchitecture",
+      "Microarchitecture to compute metrics for. Either auto (detect)\n"
+      "or ivybridge." },
+    { "level", CALI_TYPE_UINT, "2",
+      "Top-down hierarchy level",
+      "Compute metrics up to this top-down hierarchy level (1-3).\n"
+      "Higher levels require more counter events." },
+    { "keep_counters", CALI_TYPE_BOOL, "false",
+      "Keep the raw counter values",
+      "Keep the raw libpfm counter values in the output records.\n"
+      "By default, only the top-down metrics are written." },
+    ConfigSet::Terminator
+};
+
+//
+// --- Top-down metrics
+//
+
+enum Metric {
+    // level 1
+    Retiring, BadSpeculation, FrontendBound, BackendBound,
+    // level 2
+    BranchMispredict, MachineClear, FrontendLatency, FrontendBandwidth,
+    MemoryBound, CoreBound,
+    // level 3
+    MemBound, L1Bound, L2Bound, L3Bound, UncoreBound,
+
+    NumMetrics
+};
+
+const struct MetricDef {
+    const char* name;
+    unsigned    level;
+} metric_defs[] = {
+    { "topdown.retiring",           1 },
+    { "topdown.bad_speculation",    1 },
+    { "topdown.frontend_bound",     1 },
+    { "topdown.backend_bound",      1 },
+    { "topdown.branch_mispredict",  2 },
+    { "topdown.machine_clear",      2 },
+    { "topdown.frontend_latency",   2 },
+    { "topdown.frontend_bandwidth", 2 },
+    { "topdown.memory_bound",       2 },
+    { "topdown.core_bound",         2 },
+    { "topdown.mem_bound",          3 },
+    { "topdown.l1_bound",           3 },
+    { "topdown.l2_bound",           3 },
+    { "topdown.l3_bound",           3 },
+    { "topdown.uncore_bound",       3 }
+};
+
+//
+// --- Microarchitecture definitions
+//
+
+struct EventDef {
+    const char* name;
+    unsigned    level; ///< Lowest level that needs this event
+};
+
+struct ArchDef {
+    const char*     name;
+    const int*      models;     ///< Intel family 6 model numbers, terminated by 0
+    const EventDef* events;
+    int             num_events;
+    /// Compute metrics up to \a level from \a ev. Missing events are NaN.
+    void          (*compute)(const double* ev, unsigned level, double* metrics);
+};
+
+// Ivy Bridge. Same formulas as examples/scripts/topdown/topdown.py.
+
+enum IvbEvent {
+    IvbClocks, IvbRetireSlots, IvbUopsIssued, IvbRecoveryCycles, IvbUopsNotDelivered,
+    IvbBrMisp, IvbMachineClears, IvbStallsLdm, IvbCyclesNoExecute, IvbExecGe1, IvbExecGe2,
+    IvbStallsL1d, IvbStallsL2, IvbL3Hit, IvbL3Miss,
+
+    IvbNumEvents
+};
+
+const EventDef ivb_events[] = {
+    { "CPU_CLK_UNHALTED.THREAD_P",        1 },
+    { "UOPS_RETIRED.RETIRE_SLOTS",        1 },
+    { "UOPS_ISSUED.ANY",                  1 },
+    { "INT_MISC.RECOVERY_CYCLES",         1 },
+    { "IDQ_UOPS_NOT_DELIVERED.CORE",      1 },
+    { "BR_MISP_RETIRED.ALL_BRANCHES",     2 },
+    { "MACHINE_CLEARS.COUNT",             2 },
+    { "CYCLE_ACTIVITY.STALLS_LDM_PENDING", 2 },
+    { "CYCLE_ACTIVITY.CYCLES_NO_EXECUTE", 2 },
+    { "UOPS_EXECUTED.CORE_CYCLES_GE_1",   2 },
+    { "UOPS_EXECUTED.CORE_CYCLES_GE_2",   2 },
+    { "CYCLE_ACTIVITY.STALLS_L1D_PENDING", 3 },
+    { "CYCLE_ACTIVITY.STALLS_L2_PENDING", 3 },
+    { "MEM_LOAD_UOPS_RETIRED.L3_HIT",     3 },
+    { "MEM_LOAD_UOPS_RETIRED.L3_MISS",    3 }
+};
+
+const int ivb_models[] = { 58, 62, 0 };
+
+void compute_ivb(const double* ev, unsigned level, double* m)
+{
+    double clocks = ev[IvbClocks];
+    double slots  = 4.0 * clocks;
+
+    m[Retiring]       = ev[IvbRetireSlots] / slots;
+    m[BadSpeculation] =
+        (ev[IvbUopsIssued] - ev[IvbRetireSlots] + 4.0 * ev[IvbRecoveryCycles]) / slots;
+    m[FrontendBound]  = ev[IvbUopsNotDelivered] / slots;
+    m[BackendBound]   = 1.0 - (m[FrontendBound] + m[BadSpeculation] + m[Retiring]);
+
+    if (level < 2)
+        return;
+
+    m[BranchMispredict]  = ev[IvbBrMisp] / (ev[IvbBrMisp] + ev[IvbMachineClears]);
+    m[MachineClear]      = 1.0 - m[BranchMispredict];
+    m[FrontendLatency]   = std::max(ev[IvbUopsNotDelivered], 4.0) / clocks;
+    m[FrontendBandwidth] = 1.0 - m[FrontendLatency];
+    m[MemoryBound]       = ev[IvbStallsLdm] / clocks;
+    m[CoreBound]         =
+        (ev[IvbCyclesNoExecute] + ev[IvbExecGe1] - ev[IvbExecGe2]) / clocks - m[MemoryBound];
+
+    if (level < 3)
+        return;
+
+    double l3_weighted = ev[IvbL3Hit] + 7.0 * ev[IvbL3Miss];
+
+    m[MemBound]    = ev[IvbStallsL2] * (7.0 * ev[IvbL3Miss] / l3_weighted) / clocks;
+    m[L1Bound]     = (ev[IvbStallsLdm] - ev[IvbStallsL1d]) / clocks;
+    m[L2Bound]     = (ev[IvbStallsL1d] - ev[IvbStallsL2]) / clocks;
+    m[L3Bound]     = ev[IvbStallsL2] * (ev[IvbL3Hit] / l3_weighted) / clocks;
+    m[UncoreBound] = ev[IvbStallsL2] / clocks;
+}
+
+const ArchDef arch_defs[] = {
+    { "ivybridge", ivb_models, ivb_events, IvbNumEvents, compute_ivb }
+};
+
+const int MaxEvents = 16;
+
+/// \brief Find the architecture for this CPU in /proc/cpuinfo
+const ArchDef* detect_arch()
+{
+    std::ifstream is("/proc/cpuinfo");
+    std::string   line;
+
+    std::string vendor;
+    int family = -1, model = -1;
+
+    while (std::getline(is, line) && !line.empty()) {
+        std::string::size_type pos = line.find(':');
+
+        if (pos == std::string::npos)
+            continue;
+
+        std::string key = line.substr(0, line.find_last_not_of(" \t", pos - 1) + 1);
+        std::istringstream val(line.substr(pos + 1));
+
+        if (key == "vendor_id")
+            val >> vendor;
+        else if (key == "cpu family")
+            val >> family;
+        else if (key == "model")
+            val >> model;
+    }
+
+    if (vendor == "GenuineIntel" && family == 6)
+        for (const ArchDef& a : arch_defs)
+            for (const int* p = a.models; *p; ++p)
+                if (*p == model)
+                    return &a;
+
+    return nullptr;
+}
+
+//
+// --- Service state
+//
+
+const ArchDef* arch          = nullptr;
+unsigned       level         = 2;
+bool           keep_counters = false;
+
+cali_id_t      metric_attrs[NumMetrics];
+
+// Counter attributes in flushed records, resolved in pre_flush:
+// the event index for each attribute, and the raw counter attributes
+// to remove from the output.
+struct CounterAttr {
+    cali_id_t id;
+    int       event;
+    bool      is_sum; ///< aggregated sum#libpfm.counter.<event>
+};
+
+std::vector<CounterAttr> counter_attrs;
+std::vector<cali_id_t>   drop_attrs;
+
+void pre_flush_cb(Caliper* c, const SnapshotRecord*)
+{
+    counter_attrs.clear();
+    drop_attrs.clear();
+
+    const char* prefixes[] = { "sum#", "min#", "max#", "avg#", "" };
+
+    for (int i = 0; i < arch->num_events; ++i) {
+        if (arch->events[i].level > level)
+            continue;
+
+        std::string name = std::string("libpfm.counter.") + arch->events[i].name;
+
+        for (const char* p : prefixes) {
+            Attribute attr = c->get_attribute(std::string(p) + name);
+
+            if (attr == Attribute::invalid)
+                continue;
+
+            drop_attrs.push_back(attr.id());
+
+            if (*p == '\0' || p == prefixes[0])
+                counter_attrs.push_back( { attr.id(), i, p == prefixes[0] } );
+        }
+    }
+}
+
+void postprocess_snapshot_cb(Caliper*, SnapshotRecord* rec)
+{
+    if (counter_attrs.empty())
+        return;
+
+    double ev[MaxEvents];
+    bool   have_sum[MaxEvents];
+    bool   found = false;
+
+    std::fill_n(ev, MaxEvents, std::numeric_limits<double>::quiet_NaN());
+    std::fill_n(have_sum, MaxEvents, false);
+
+    SnapshotRecord::Data data = rec->data();
+
+    // Aggregated records may have both the sum and the raw counter
+    // attribute. Use the sum then.
+    for (size_t j = 0; j < rec->num_immediate(); ++j)
+        for (const CounterAttr& a : counter_attrs)
+            if (a.id == data.immediate_attr[j] && (a.is_sum || !have_sum[a.event])) {
+                ev[a.event]       = data.immediate_data[j].to_double();
+                have_sum[a.event] = a.is_sum;
+                found             = true;
+            }
+
+    if (!found)
+        return;
+
+    double metrics[NumMetrics];
+
+    std::fill_n(metrics, NumMetrics, std::numeric_limits<double>::quiet_NaN());
+    arch->compute(ev, level, metrics);
+
+    if (!keep_counters)
+        rec->remove_immediate(drop_attrs.size(), drop_attrs.data());
+
+    for (int m = 0; m < NumMetrics; ++m)
+        if (metric_defs[m].level <= level && std::isfinite(metrics[m]))
+            rec->append(metric_attrs[m], Variant(metrics[m]));
+}
+
+void topdown_register(Caliper* c)
+{
+    ConfigSet config = RuntimeConfig::init("topdown", configdata);
+
+    std::string archname = config.get("arch").to_string();
+
+    arch          = nullptr;
+    level         = std::min<unsigned>(std::max<unsigned>(config.get("level").to_uint(), 1), 3);
+    keep_counters = config.get("keep_counters").to_bool();
+
+    if (archname == "auto") {
+        arch = detect_arch();
+
+        if (!arch) {
+            Log(0).stream() << "topdown: error: unsupported CPU, set CALI_TOPDOWN_ARCH" << std::endl;
+            return;
+        }
+    } else {
+        for (const ArchDef& a : arch_defs)
+            if (archname == a.name)
+                arch = &a;
+
+        if (!arch) {
+            Log(0).stream() << "topdown: error: unknown architecture \"" << archname << "\"" << std::endl;
+            return;
+        }
+    }
+
+    // Set up the libpfm service to count just the events we need.
+    // Explicit CALI_LIBPFM_ settings take precedence.
+
+    std::string events;
+
+    for (int i = 0; i < arch->num_events; ++i)
+        if (arch->events[i].level <= level)
+            events.append(events.empty() ? "" : ",").append(arch->events[i].name);
+
+    RuntimeConfig::preset("CALI_LIBPFM_EVENTS", events);
+    RuntimeConfig::preset("CALI_LIBPFM_ENABLE_SAMPLING", "false");
+    RuntimeConfig::preset("CALI_LIBPFM_RECORD_COUNTERS", "true");
+
+    for (int m = 0; m < NumMetrics; ++m)
+        metric_attrs[m] =
+            c->create_attribute(metric_defs[m].name, CALI_TYPE_DOUBLE,
+                                CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS).id();
+
+    c->events().pre_flush_evt.connect(&pre_flush_cb);
+    c->events().postprocess_snapshot.connect(&postprocess_snapshot_cb);
+
+    Log(1).stream() << "Registered topdown service (" << arch->name
+                    << ", level " << level << ")" << std::endl;
+}
+
+} // namespace
+
+namespace cali
+{
+    CaliperService topdown_service = { "topdown", ::topdown_register };
+}
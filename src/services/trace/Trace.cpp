@@ -41,18 +41,33 @@
 #include "caliper/SnapshotRecord.h"
 
 #include "caliper/common/Log.h"
+#include "caliper/common/Node.h"
 #include "caliper/common/RuntimeConfig.h"
 
 #include "caliper/common/c-util/unitfmt.h"
 
+#include "caliper/common/util/cacheline.hpp"
+#include "caliper/common/util/memory_counter.hpp"
 #include "caliper/common/util/spinlock.hpp"
 
+#include <fcntl.h>
 #include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 using namespace trace;
 using namespace cali;
@@ -60,155 +75,1608 @@ using namespace std;
 
 namespace 
 {
+    util::spinlock_stats s_tbuf_lock_stats("Trace buffer list");
+
     enum   BufferPolicy {
-        Flush, Grow, Stop
+        Flush, Grow, Stop, Spill, Ring
     };
+
+    //
+    // --- Process-wide free list for recycling trace buffer chunks
+    //
+
+    size_t         buffersize        = 2 * 1024 * 1024;
+    size_t         min_chunk_size    = 64 * 1024;
+    bool           delta_encoding    = false;
+    bool           use_signal_reserve = false;
+
+    std::mutex     free_list_lock;
+    std::vector<TraceBufferChunk*> free_list;
+    size_t         free_list_bytes   = 0;
+
+    // Chunks in the free list are reserved, chunks in use by buffers
+    // (or waiting for a flush or spill) are also used
+    util::memory_counter s_memory("trace");
+
+    // Keep at most this many bytes in the free list
+    inline size_t max_free_list_bytes() {
+        return 4 * buffersize;
+    }
+
+    TraceBufferChunk* alloc_chunk(size_t size) {
+        {
+            std::lock_guard<std::mutex>
+                g(free_list_lock);
+
+            for (auto it = free_list.rbegin(); it != free_list.rend(); ++it)
+                if ((*it)->size() == size) {
+                    TraceBufferChunk* chunk = *it;
+
+                    free_list.erase(std::next(it).base());
+                    free_list_bytes -= size;
+
+                    s_memory.add(0, size);
+
+                    return chunk;
+                }
+        }
+
+        s_memory.add(size, size);
+
+        return new TraceBufferChunk(size, delta_encoding);
+    }
+
+    // Put all chunks in the given list into the free list
+    void free_chunks(TraceBufferChunk* chunk) {
+        while (chunk) {
+            TraceBufferChunk* next = chunk->unlink_next();
+
+            chunk->reset();
+
+            size_t size = chunk->size();
+
+            {
+                std::lock_guard<std::mutex>
+                    g(free_list_lock);
+
+                if (free_list_bytes + size <= max_free_list_bytes()) {
+                    free_list.push_back(chunk);
+                    free_list_bytes += size;
+                    chunk = nullptr;
+                }
+            }
+
+            s_memory.sub(chunk ? size : 0, size);
+
+            delete chunk;
+            chunk = next;
+        }
+    }
+
+    void clear_free_list() {
+        std::lock_guard<std::mutex>
+            g(free_list_lock);
+
+        for (TraceBufferChunk* chunk : free_list) {
+            s_memory.sub(chunk->size(), 0);
+            delete chunk;
+        }
+
+        free_list.clear();
+        free_list_bytes = 0;
+    }
     
-    struct TraceBuffer {
+    // Pending runs of coalesced snapshots of a thread (see coalesce_snapshot())
+
+    constexpr size_t coalesce_max_runs = 4;
+
+    struct CoalesceRun {
+        size_t    n_nodes;
+        cali_id_t nodes[TraceBufferChunk::MaxRecordEntries];
+        size_t    n_imm;
+        cali_id_t attr[TraceBufferChunk::MaxRecordEntries];
+        Variant   data[TraceBufferChunk::MaxRecordEntries];
+        uint64_t  repeat;
+    };
+
+    struct CoalesceState {
+        size_t      n_runs = 0;
+        CoalesceRun runs[coalesce_max_runs];
+    };
+
+    // Running mean of region durations, for the outlier_factor filter
+    struct DurationStats {
+        uint64_t count;
+        double   sum;
+    };
+
+    // Fields are grouped by cache line: the first line is updated by the
+    // owning thread on every snapshot, the second one holds the list links
+    // and flags that other threads write when buffers are added, retired,
+    // or flushed.
+    struct alignas(util::cacheline_size) TraceBuffer : public util::cacheline_aligned_new {
         std::atomic<bool>  stopped;
+        std::atomic<bool>  writing;
+
+        std::atomic<TraceBufferChunk*> chunks;
+
+        // Spare chunk for signal handlers, which can't allocate memory.
+        // Taken with exchange() in the signal handler, and replenished by
+        // the owning thread outside of signal handlers.
+        std::atomic<TraceBufferChunk*> reserve;
+
+        // Size of the next chunk to allocate. Doubles with each new
+        // chunk up to buffersize, and starts over after a clear.
+        std::atomic<size_t> next_chunk_size;
+
+        // Duration statistics per context for the outlier filter.
+        // Only used by the owning thread outside of signal handlers.
+        std::unordered_map<uint64_t, DurationStats> duration_stats;
+
+        // Pending snapshot runs in coalescing mode. Allocated by the
+        // owning thread outside of signal handlers.
+        std::unique_ptr<CoalesceState> coalesce;
+
+        alignas(util::cacheline_size)
         std::atomic<bool>  retired;
 
-        TraceBufferChunk*  chunks;
         TraceBuffer*       next;
         TraceBuffer*       prev;
 
-        TraceBuffer(size_t s)
-            : stopped(false), retired(false), chunks(new TraceBufferChunk(s)), next(0), prev(0)
-            { }
-        
-        ~TraceBuffer() {
-            delete chunks;
-        }
+        // Spill file for full chunks with the spill buffer policy.
+        // Protected by spill_write_lock.
+        int                spill_fd;
+
+        TraceBuffer()
+            : stopped(false), writing(false), chunks(nullptr), reserve(nullptr),
+              next_chunk_size(min_chunk_size), retired(false), next(0), prev(0), spill_fd(-1)
+            {
+                chunks.store(new_chunk());
+                replenish();
+            }
+        
+        ~TraceBuffer() {
+            free_chunks(chunks.load());
+            free_chunks(reserve.load());
+
+            if (spill_fd >= 0)
+                close(spill_fd);
+        }
+
+        /// \brief Allocate a chunk with the next size in the growth sequence
+        TraceBufferChunk* new_chunk() {
+            size_t size = next_chunk_size.load(std::memory_order_relaxed);
+
+            next_chunk_size.store(std::min(2 * size, buffersize), std::memory_order_relaxed);
+
+            return alloc_chunk(size);
+        }
+
+        /// \brief Make sure there is a spare chunk for signal handlers.
+        ///   Must not be called in a signal handler.
+        void replenish() {
+            if (!use_signal_reserve || reserve.load(std::memory_order_relaxed))
+                return;
+
+            // Both the owning thread and the refill thread may get here
+            TraceBufferChunk* chunk = alloc_chunk(next_chunk_size.load(std::memory_order_relaxed));
+            TraceBufferChunk* empty = nullptr;
+
+            if (!reserve.compare_exchange_strong(empty, chunk))
+                free_chunks(chunk);
+        }
+
+        /// \brief Restart the chunk growth sequence and return a chunk
+        ///   of the initial size
+        TraceBufferChunk* first_chunk() {
+            next_chunk_size.store(min_chunk_size, std::memory_order_relaxed);
+            return new_chunk();
+        }
+
+        void unlink() {
+            if (next)
+                next->prev = prev;
+            if (prev)
+                prev->next = next;
+        }
+    };
+
+    // Lock-free multi-producer/single-consumer list of full chunks
+    // handed off by writer threads in double-buffer mode. Producers
+    // push individual nodes, the flusher always takes the entire list.
+
+    struct HandoffNode {
+        TraceBufferChunk* chunk;
+        HandoffNode*      next;
+    };
+
+    std::atomic<HandoffNode*> handoff_list { nullptr };
+
+    void handoff_push(TraceBufferChunk* chunk) {
+        HandoffNode* node = new HandoffNode { chunk, handoff_list.load() };
+
+        while (!handoff_list.compare_exchange_weak(node->next, node))
+            ;
+    }
+
+    HandoffNode* handoff_take_all() {
+        HandoffNode* list = handoff_list.exchange(nullptr);
+        HandoffNode* rev  = nullptr;
+
+        // reverse the list to restore the original hand-off order
+        while (list) {
+            HandoffNode* tmp = list->next;
+            list->next = rev;
+            rev  = list;
+            list = tmp;
+        }
+
+        return rev;
+    }
+
+    const ConfigSet::Entry configdata[] = {
+        { "buffer_size",   CALI_TYPE_UINT, "2",
+          "Maximum size of per-thread trace buffer chunks in MiB",
+          "Maximum size of per-thread trace buffer chunks in MiB" },
+        { "initial_chunk_size", CALI_TYPE_UINT, "64",
+          "Size of the first trace buffer chunk of a thread in KiB",
+          "Size of the first trace buffer chunk of a thread in KiB.\n"
+          "Subsequent chunks double in size up to buffer_size.\n"
+          "0: Always use buffer_size." },
+        { "buffer_policy", CALI_TYPE_STRING, "grow",
+          "What to do when trace buffer is full",
+          "What to do when trace buffer is full:\n"
+          "   flush:  Write out and clear contents\n"
+          "   grow:   Increase buffer size\n"
+          "   stop:   Stop recording.\n"
+          "   spill:  Write full buffers to a temporary file\n"
+          "   ring:   Overwrite the oldest buffer chunk\n"
+          "Default: grow" },
+        { "double_buffer", CALI_TYPE_BOOL, "false",
+          "Keep tracing while buffers are being flushed",
+          "Keep tracing while buffers are being flushed.\n"
+          "Threads swap in a fresh trace buffer chunk instead of\n"
+          "stopping recording while their buffer is being flushed.\n"
+          "Full chunks are handed off to the flushing thread." },
+        { "delta_encoding", CALI_TYPE_BOOL, "false",
+          "Delta-encode trace records in the trace buffer",
+          "Delta-encode trace records against the previous record in the\n"
+          "trace buffer to save buffer memory. Node ids and UINT values are\n"
+          "stored as differences, and repeated values as a one-byte code." },
+        { "spill_directory", CALI_TYPE_STRING, "",
+          "Directory for trace spill files",
+          "Directory for the temporary per-thread trace files of the spill\n"
+          "buffer policy. Default: $TMPDIR or /tmp" },
+        { "memory_limit", CALI_TYPE_UINT, "64",
+          "Trace buffer memory limit in MiB for the spill policy",
+          "Trace buffer memory limit in MiB for the spill policy.\n"
+          "Full buffers are written to disk by a background thread.\n"
+          "When the active and not-yet-written buffers exceed the limit,\n"
+          "threads write their full buffers to disk themselves." },
+        { "ring_size", CALI_TYPE_UINT, "8",
+          "Per-thread trace memory in MiB for the ring policy",
+          "Per-thread trace memory in MiB for the ring buffer policy.\n"
+          "When all chunks are full, the oldest chunk is overwritten." },
+        { "ring_duration", CALI_TYPE_DOUBLE, "0",
+          "Only flush the last N seconds of the ring buffer",
+          "Only flush snapshots from the last N seconds with the ring buffer\n"
+          "policy, in units of buffer chunks. 0: flush the entire buffer." },
+        { "flush_signal", CALI_TYPE_STRING, "",
+          "Signal that triggers a trace flush",
+          "Flush (and clear) the trace buffers when the process receives this\n"
+          "signal. Either USR1, USR2, or a signal number. Default: none" },
+        { "flush_on_duration", CALI_TYPE_DOUBLE, "0",
+          "Flush when a region takes longer than N seconds",
+          "Flush (and clear) the trace buffers when a snapshot has a\n"
+          "time.inclusive.duration of more than N seconds. 0: disabled" },
+        { "regions", CALI_TYPE_STRING, "",
+          "Only trace snapshots in the given regions",
+          "Only trace snapshots in the given regions. A list of attribute\n"
+          "names or attribute=value pairs. Snapshots are recorded if they\n"
+          "match any of the entries, on any nesting level. Default: trace everything" },
+        { "flush_order", CALI_TYPE_STRING, "thread",
+          "Order of the flushed snapshots",
+          "Order of the flushed snapshots:\n"
+          "   thread:  Write the thread buffers one after another\n"
+          "   time:    Merge the thread buffers by order_attribute\n"
+          "Default: thread" },
+        { "order_attribute", CALI_TYPE_STRING, "time.offset",
+          "Timestamp attribute for the time-ordered flush",
+          "Timestamp attribute for flush_order=time. Snapshots without\n"
+          "it keep their position in the thread's buffer." },
+        { "coalesce", CALI_TYPE_BOOL, "false",
+          "Merge consecutive snapshots with the same context",
+          "Merge runs of consecutive snapshots with the same context nodes\n"
+          "and immediate attributes into one record with a trace.repeat count.\n"
+          "Aggregatable values (e.g., durations) are summed up, and the\n"
+          "order attribute keeps the value of the run's first snapshot.\n"
+          "All other values must be equal. Not supported with double buffering." },
+        { "outlier_duration", CALI_TYPE_DOUBLE, "0",
+          "Only trace regions that take longer than N seconds",
+          "Only trace snapshots with a time.inclusive.duration of more than\n"
+          "N seconds. Combine with the aggregate service to keep a profile\n"
+          "of all regions and a trace of the slow ones. 0: disabled" },
+        { "outlier_factor", CALI_TYPE_DOUBLE, "0",
+          "Only trace regions that take longer than N times their mean duration",
+          "Only trace snapshots with a time.inclusive.duration of more than\n"
+          "N times the mean duration of the previous instances of the same\n"
+          "region (i.e., the same context), per thread. If outlier_duration\n"
+          "is set too, snapshots exceeding either threshold are traced.\n"
+          "0: disabled" },
+        
+        ConfigSet::Terminator
+    };
+    
+    ConfigSet      config;
+    
+    BufferPolicy   policy            = BufferPolicy::Grow;
+    bool           double_buffer     = false;
+    bool           time_ordered      = false;
+
+    std::atomic<size_t> dropped_snapshots { 0 };
+    std::atomic<size_t> signal_dropped_snapshots { 0 };
+
+    inline void drop_snapshot(Caliper* c) {
+        ++dropped_snapshots;
+
+        if (c->is_signal())
+            ++signal_dropped_snapshots;
+    }
+    
+    pthread_key_t  trace_buf_key;
+
+    TraceBuffer*   global_tbuf_list  = nullptr;
+    util::spinlock global_tbuf_lock { &s_tbuf_lock_stats };
+
+    std::mutex     global_flush_lock;
+
+    std::atomic<bool> overflow_flush_active { false };
+    std::atomic<bool> overflow_flush_requested { false };
+
+    std::atomic<size_t> num_tbufs { 0 };
+
+    //
+    // --- Ring buffer policy and flush triggers
+    //
+
+    size_t         ring_bytes        = 8 * 1024 * 1024;
+    double         ring_duration     = 0.0;
+
+    int            flush_signal      = 0;
+    int            flush_pipe[2]     = { -1, -1 };
+    std::thread    flush_thread;
+    struct sigaction prev_sigaction;
+
+    double         flush_duration    = 0.0; // usec
+    Attribute      duration_attr     = Attribute::invalid;
+
+    //
+    // --- Outlier filter
+    //
+
+    double         outlier_duration  = 0.0; // usec
+    double         outlier_factor    = 0.0;
+
+    std::atomic<size_t> outlier_snapshots { 0 };
+
+    inline bool use_outlier_filter() {
+        return outlier_duration > 0.0 || outlier_factor > 0.0;
+    }
+
+    //
+    // --- Region filter
+    //
+    //   Attributes are resolved when they are created. The list itself
+    //   is fixed at initialization, so readers don't need a lock.
+    //
+
+    struct RegionFilter {
+        std::string            name;
+        std::string            value;    // empty: any value
+        std::atomic<cali_id_t> attr_id;
+        Variant                v_value;  // value converted to the attribute's type
+        bool                   store_as_value;
+    };
+
+    std::vector< std::unique_ptr<RegionFilter> > region_filters;
+
+    void init_region_filters(Caliper* c) {
+        region_filters.clear();
+
+        for (const std::string& entry : config.get("regions").to_stringlist(",:")) {
+            std::unique_ptr<RegionFilter> f(new RegionFilter);
+
+            std::string::size_type pos = entry.find('=');
+
+            f->name    = entry.substr(0, pos);
+            f->value   = (pos == std::string::npos ? std::string() : entry.substr(pos+1));
+            f->attr_id.store(CALI_INV_ID);
+            f->store_as_value = false;
+
+            region_filters.push_back(std::move(f));
+        }
+    }
+
+    // Set up filters for attr. This has to be done before the attribute
+    // id is published: snapshot processing reads the other fields then.
+    void resolve_region_filters(const Attribute& attr) {
+        for (auto& f : region_filters)
+            if (f->attr_id.load() == CALI_INV_ID && f->name == attr.name()) {
+                if (!f->value.empty()) {
+                    bool ok = false;
+
+                    f->v_value = Variant::from_string(attr.type(), f->value.c_str(), &ok);
+
+                    if (!ok) {
+                        Log(0).stream() << "trace: error: invalid region value \"" << f->value
+                                        << "\" for attribute " << attr.name() << endl;
+                        continue;
+                    }
+                }
+
+                f->store_as_value = attr.store_as_value();
+                f->attr_id.store(attr.id());
+            }
+    }
+
+    bool in_selected_region(const SnapshotRecord* sbuf) {
+        SnapshotRecord::Data  data = sbuf->data();
+        SnapshotRecord::Sizes size = sbuf->size();
+
+        for (const auto& f : region_filters) {
+            cali_id_t id = f->attr_id.load(std::memory_order_acquire);
+
+            if (id == CALI_INV_ID)
+                continue;
+
+            if (f->store_as_value) {
+                for (size_t i = 0; i < size.n_immediate; ++i)
+                    if (data.immediate_attr[i] == id && (f->value.empty() || data.immediate_data[i] == f->v_value))
+                        return true;
+            } else {
+                for (size_t i = 0; i < size.n_nodes; ++i)
+                    for (const Node* node = data.node_entries[i]; node; node = node->parent())
+                        if (node->attribute() == id && (f->value.empty() || node->data() == f->v_value))
+                            return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Identify the region of a snapshot for the outlier statistics
+    uint64_t context_key(const SnapshotRecord* sbuf) {
+        SnapshotRecord::Data  data = sbuf->data();
+        SnapshotRecord::Sizes size = sbuf->size();
+
+        uint64_t key = 14695981039346656037ULL; // FNV-1a
+
+        for (size_t i = 0; i < size.n_nodes; ++i) {
+            key ^= data.node_entries[i]->id();
+            key *= 1099511628211ULL;
+        }
+        // immediate attributes tell apart, e.g., a loop and its
+        // iterations (event.end#iteration), but their values don't count
+        for (size_t i = 0; i < size.n_immediate; ++i) {
+            key ^= data.immediate_attr[i];
+            key *= 1099511628211ULL;
+        }
+
+        return key;
+    }
+
+    // Is sbuf a region whose duration exceeds the outlier thresholds?
+    // Updates the running mean of the snapshot's context. Signal
+    // handlers can't allocate, so they only check the absolute threshold.
+    bool is_outlier(Caliper* c, TraceBuffer* tbuf, const SnapshotRecord* sbuf) {
+        Entry e = sbuf->get(duration_attr);
+
+        if (e.is_empty())
+            return false;
+
+        double duration = e.value().to_double();
+        bool   ret      = (outlier_duration > 0.0 && duration > outlier_duration);
+
+        if (outlier_factor > 0.0 && !c->is_signal()) {
+            DurationStats& stats = tbuf->duration_stats[context_key(sbuf)];
+
+            if (stats.count > 0 && duration > outlier_factor * stats.sum / stats.count)
+                ret = true;
+
+            ++stats.count;
+            stats.sum += duration;
+        }
+
+        if (ret)
+            ++outlier_snapshots;
+
+        return ret;
+    }
+
+    // Trigger a flush from a signal handler: just wake up the flush thread
+    void on_flush_signal(int) {
+        char b = 0;
+
+        if (write(flush_pipe[1], &b, 1) < 0) {
+            // can't report errors from a signal handler: the request is dropped
+        }
+    }
+
+    void flush_loop() {
+        char b;
+
+        while (read(flush_pipe[0], &b, 1) > 0) {
+            Caliper c;
+
+            Log(1).stream() << "trace: flush requested by signal " << flush_signal << endl;
+
+            c.flush_and_write(nullptr);
+            c.clear();
+        }
+    }
+
+    int parse_signal(const std::string& name) {
+        if (name.empty())
+            return 0;
+        if (name == "USR1" || name == "SIGUSR1")
+            return SIGUSR1;
+        if (name == "USR2" || name == "SIGUSR2")
+            return SIGUSR2;
+
+        int signum = std::atoi(name.c_str());
+
+        if (signum <= 0)
+            Log(0).stream() << "trace: error: invalid flush signal \"" << name << "\"" << endl;
+
+        return std::max(signum, 0);
+    }
+
+    void setup_flush_signal() {
+        if (pipe(flush_pipe) != 0) {
+            Log(0).stream() << "trace: error: unable to create flush signal pipe" << endl;
+            return;
+        }
+
+        flush_thread = std::thread(flush_loop);
+
+        struct sigaction act;
+
+        memset(&act, 0, sizeof(act));
+        sigemptyset(&act.sa_mask);
+        act.sa_handler = on_flush_signal;
+        act.sa_flags   = SA_RESTART;
+
+        sigaction(flush_signal, &act, &prev_sigaction);
+    }
+
+    void clear_flush_signal() {
+        if (flush_pipe[1] < 0)
+            return;
+
+        sigaction(flush_signal, &prev_sigaction, NULL);
+
+        close(flush_pipe[1]);
+        flush_pipe[1] = -1;
+
+        if (flush_thread.joinable())
+            flush_thread.join();
+
+        close(flush_pipe[0]);
+        flush_pipe[0] = -1;
+    }
+
+    //
+    // --- Refill thread for the signal reserve chunks
+    //
+    //   A signal handler that used up its thread's reserve chunk sends
+    //   the trace buffer address through a (non-blocking) pipe, and the
+    //   refill thread allocates a new reserve chunk. This way, reserves
+    //   are replenished even if the thread doesn't create snapshots
+    //   outside of signal handlers.
+    //
+
+    int            refill_pipe[2]    = { -1, -1 };
+    std::thread    refill_thread;
+
+    void request_refill(TraceBuffer* tbuf) {
+        if (refill_pipe[1] >= 0)
+            if (write(refill_pipe[1], &tbuf, sizeof(tbuf)) < 0) {
+                // pipe full or closed: the reserve stays empty until the next refill
+            }
+    }
+
+    void refill_loop() {
+        TraceBuffer* tbuf = nullptr;
+
+        while (read(refill_pipe[0], &tbuf, sizeof(tbuf)) == sizeof(tbuf)) {
+            // clear_cb() deletes retired trace buffers under the flush lock:
+            // check that the buffer still exists
+            std::lock_guard<std::mutex>
+                g(global_flush_lock);
+
+            TraceBuffer* p = nullptr;
+
+            {
+                std::lock_guard<util::spinlock>
+                    g(global_tbuf_lock);
+
+                p = global_tbuf_list;
+            }
+
+            for ( ; p && p != tbuf; p = p->next)
+                ;
+
+            if (p)
+                p->replenish();
+        }
+    }
+
+    void setup_refill_thread() {
+        if (pipe(refill_pipe) != 0) {
+            Log(0).stream() << "trace: error: unable to create reserve refill pipe" << endl;
+            return;
+        }
+
+        // signal handlers must not block if the pipe is full
+        fcntl(refill_pipe[1], F_SETFL, fcntl(refill_pipe[1], F_GETFL) | O_NONBLOCK);
+
+        // child processes (e.g., MPI daemons) must not keep the pipe open,
+        // or the refill thread never sees the end of input
+        fcntl(refill_pipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(refill_pipe[1], F_SETFD, FD_CLOEXEC);
+
+        refill_thread = std::thread(refill_loop);
+    }
+
+    void stop_refill_thread() {
+        if (refill_pipe[1] < 0)
+            return;
+
+        close(refill_pipe[1]);
+        refill_pipe[1] = -1;
+
+        if (refill_thread.joinable())
+            refill_thread.join();
+
+        close(refill_pipe[0]);
+        refill_pipe[0] = -1;
+    }
+
+    //
+    // --- Spill-to-disk support for the spill buffer policy
+    //
+    //   Full chunks are queued and written to their thread's spill file
+    //   in FIFO order by a background thread. The spill_write_lock
+    //   protects the spill files and serializes writing the queue.
+    //
+
+    struct SpillEntry {
+        TraceBuffer*      tbuf;
+        TraceBufferChunk* chunk;
+    };
+
+    std::string             spill_dir;
+    size_t                  memory_limit = 64 * 1024 * 1024;
+
+    std::vector<SpillEntry> spill_queue;
+    std::mutex              spill_queue_lock;
+    std::condition_variable spill_cv;
+    bool                    spill_stop   = false;
+
+    std::mutex              spill_write_lock;
+    std::thread             spill_thread;
+
+    std::atomic<size_t>     spill_queued_bytes { 0 };
+    size_t                  spilled_bytes  = 0;
+    size_t                  spilled_chunks = 0;
+
+    bool open_spill_file(TraceBuffer* tbuf) {
+        std::string path = spill_dir + "/caliper-trace-XXXXXX";
+        std::vector<char> buf(path.begin(), path.end());
+        buf.push_back('\0');
+
+        tbuf->spill_fd = mkstemp(buf.data());
+
+        if (tbuf->spill_fd < 0) {
+            Log(0).stream() << "trace: error: unable to create spill file in " << spill_dir << endl;
+            return false;
+        }
+
+        // The file is only accessed through the descriptor: remove the
+        // name right away so it won't be left over
+        unlink(buf.data());
+
+        return true;
+    }
+
+    // Write all queued chunks. Requires spill_write_lock.
+    void write_spill_queue_locked() {
+        std::vector<SpillEntry> queue;
+
+        {
+            std::lock_guard<std::mutex>
+                g(spill_queue_lock);
+
+            queue.swap(spill_queue);
+        }
+
+        std::vector<TraceBufferChunk*> list;
+
+        for (const SpillEntry& e : queue) {
+            TraceBufferChunk::UsageInfo info = e.chunk->info();
+
+            // The entry is a list of chunks (newest first) if chunks
+            // from the signal reserve were added: write oldest first
+            list.clear();
+
+            for (TraceBufferChunk* p = e.chunk; p; p = p->unlink_next())
+                list.push_back(p);
+
+            for (auto it = list.rbegin(); it != list.rend(); ++it) {
+                if ((e.tbuf->spill_fd >= 0 || open_spill_file(e.tbuf)) && (*it)->write_to(e.tbuf->spill_fd)) {
+                    spilled_bytes += (*it)->info().used;
+                    ++spilled_chunks;
+                } else {
+                    Log(0).stream() << "trace: error: unable to write spill file" << endl;
+                    dropped_snapshots += (*it)->num_records();
+                }
+
+                free_chunks(*it);
+            }
+
+            spill_queued_bytes.fetch_sub(info.reserved);
+        }
+    }
+
+    void write_spill_queue() {
+        std::lock_guard<std::mutex>
+            g(spill_write_lock);
+
+        write_spill_queue_locked();
+    }
+
+    void spill_loop() {
+        std::unique_lock<std::mutex>
+            lk(spill_queue_lock);
+
+        while (!spill_stop) {
+            spill_cv.wait(lk, [](){ return spill_stop || !spill_queue.empty(); });
+
+            lk.unlock();
+            write_spill_queue();
+            lk.lock();
+        }
+    }
+
+    void stop_spill_thread() {
+        {
+            std::lock_guard<std::mutex>
+                g(spill_queue_lock);
+
+            spill_stop = true;
+        }
+
+        spill_cv.notify_one();
+
+        if (spill_thread.joinable())
+            spill_thread.join();
+    }
+
+    // Swap a fresh chunk into tbuf and queue the full one for writing
+    TraceBuffer* spill_chunk(TraceBuffer* tbuf) {
+        TraceBufferChunk* full = tbuf->chunks.load();
+
+        tbuf->chunks.store(tbuf->new_chunk());
+
+        size_t size   = full->info().reserved;
+        size_t queued = spill_queued_bytes.fetch_add(size) + size;
+
+        {
+            std::lock_guard<std::mutex>
+                g(spill_queue_lock);
+
+            spill_queue.push_back(SpillEntry { tbuf, full });
+        }
+
+        if (queued + num_tbufs.load() * buffersize > memory_limit)
+            write_spill_queue();
+        else
+            spill_cv.notify_one();
+
+        return tbuf;
+    }
+
+    // Flush the spilled chunks of tbuf. Requires spill_write_lock.
+    size_t flush_spill_file(Caliper* c, TraceBuffer* tbuf, Caliper::SnapshotFlushFn proc_fn) {
+        if (tbuf->spill_fd < 0)
+            return 0;
+
+        size_t num_written = 0;
+
+        lseek(tbuf->spill_fd, 0, SEEK_SET);
+
+        while (TraceBufferChunk* chunk = TraceBufferChunk::read_from(tbuf->spill_fd)) {
+            num_written += chunk->flush(c, proc_fn);
+            delete chunk;
+        }
+
+        lseek(tbuf->spill_fd, 0, SEEK_END);
+
+        return num_written;
+    }
+
+    // Discard the queued and spilled chunks. Requires spill_write_lock.
+    void clear_spill_files_locked(TraceBuffer* tbuf) {
+        {
+            std::lock_guard<std::mutex>
+                g(spill_queue_lock);
+
+            for (const SpillEntry& e : spill_queue) {
+                spill_queued_bytes.fetch_sub(e.chunk->info().reserved);
+                free_chunks(e.chunk);
+            }
+
+            spill_queue.clear();
+        }
+
+        for ( ; tbuf; tbuf = tbuf->next)
+            if (tbuf->spill_fd >= 0) {
+                if (ftruncate(tbuf->spill_fd, 0) != 0)
+                    Log(0).stream() << "trace: error: unable to truncate spill file" << endl;
+
+                lseek(tbuf->spill_fd, 0, SEEK_SET);
+            }
+    }
+    
+
+    void destroy_tbuf(void* ctx) {
+        TraceBuffer* tbuf = static_cast<TraceBuffer*>(ctx);
+
+        if (!tbuf)
+            return;
+
+        tbuf->retired.store(true);
+    }
+    
+    TraceBuffer* acquire_tbuf(bool alloc = true) {
+        TraceBuffer* tbuf = static_cast<TraceBuffer*>(pthread_getspecific(trace_buf_key));
+
+        if (alloc && !tbuf) {
+            tbuf = new TraceBuffer;
+
+            if (!tbuf) {
+                Log(0).stream() << "trace: error: unable to  allocate trace buffer!" << endl;
+                return 0;
+            }
+
+            if (pthread_setspecific(trace_buf_key, tbuf) == 0) {
+                std::lock_guard<util::spinlock>
+                    g(global_tbuf_lock);
+
+                if (global_tbuf_list)
+                    global_tbuf_list->prev = tbuf;
+                
+                tbuf->next       = global_tbuf_list;
+                global_tbuf_list = tbuf;                
+
+                ++num_tbufs;
+            } else {
+                Log(0).stream() << "trace: error: unable to set thread trace buffer" << endl;
+                delete tbuf;
+                tbuf = 0;
+            }
+        }
+
+        return tbuf;
+    }
+
+    //
+    // --- Writer/flusher handshake
+    //
+    //   The owning thread sets the writing flag while it accesses its
+    //   chunks, and drops the snapshot if the buffer is stopped. Flush and
+    //   clear stop the buffer and wait for the writer before they read,
+    //   unlink, or reset another thread's chunks. Both sides use
+    //   sequentially consistent operations, so either the writer sees the
+    //   stop or the flusher sees the writer.
+    //
+
+    bool begin_write(TraceBuffer* tbuf) {
+        tbuf->writing.store(true);
+
+        if (tbuf->stopped.load()) {
+            tbuf->writing.store(false);
+            return false;
+        }
+
+        return true;
+    }
+
+    void end_write(TraceBuffer* tbuf) {
+        tbuf->writing.store(false);
+    }
+
+    // Stop recording into tbuf and wait until its writer is done.
+    // Must not be called while the calling thread is writing.
+    void stop_writer(TraceBuffer* tbuf) {
+        tbuf->stopped.store(true);
+
+        while (tbuf->writing.load())
+            std::this_thread::yield();
+    }
+
+    // Replace the chunks of tbuf with one of the initial size and recycle
+    // the old ones. The writer must be stopped.
+    void reset_chunks(TraceBuffer* tbuf) {
+        free_chunks(tbuf->chunks.exchange(tbuf->first_chunk()));
+    }
+
+    // In signal handlers, continue in the reserve chunk instead of
+    // allocating, flushing, or spilling. The buffer is spilled or
+    // flushed at the next overflow outside of a signal handler.
+    TraceBuffer* handle_signal_overflow(Caliper* c, TraceBuffer* tbuf) {
+        TraceBufferChunk* newchunk = tbuf->reserve.exchange(nullptr);
+
+        if (!newchunk) {
+            drop_snapshot(c);
+            return 0;
+        }
+
+        newchunk->append(tbuf->chunks.load());
+        tbuf->chunks.store(newchunk);
+
+        request_refill(tbuf);
+
+        return tbuf;
+    }
+
+    TraceBuffer* handle_overflow(Caliper* c, TraceBuffer* tbuf) {
+        if (c->is_signal() && use_signal_reserve && policy != BufferPolicy::Ring)
+            return handle_signal_overflow(c, tbuf);
+
+        switch (policy) {
+        case BufferPolicy::Stop:
+            tbuf->stopped.store(true);
+            Log(1).stream() << "Trace buffer full: recording stopped." << endl;
+            return 0;
+                
+        case BufferPolicy::Grow:
+        {
+            TraceBufferChunk* newchunk = tbuf->new_chunk();
+
+            if (!newchunk) {
+                Log(0).stream() << "trace: error: unable to allocate new trace buffer. Recording stopped." << endl;
+                tbuf->stopped.store(true);
+                return 0;
+            }
+            
+            newchunk->append(tbuf->chunks.load());
+            tbuf->chunks.store(newchunk);
+
+            return tbuf;
+        }
+            
+        case BufferPolicy::Flush:
+        {
+            TraceBufferChunk* head = tbuf->chunks.load();
+
+            // Grow until the buffer reaches buffersize. Then we need to
+            // flush, but we can't while we're writing: keep the snapshot
+            // in a new chunk, and flush when we're done (see
+            // process_snapshot_cb()). The flush resets the buffer.
+            if (head->info().reserved + tbuf->next_chunk_size.load(std::memory_order_relaxed) > buffersize)
+                overflow_flush_requested.store(true);
+
+            TraceBufferChunk* newchunk = tbuf->new_chunk();
+
+            newchunk->append(head);
+            tbuf->chunks.store(newchunk);
+
+            return tbuf;
+        }
+
+        case BufferPolicy::Ring:
+        {
+            TraceBufferChunk* head = tbuf->chunks.load();
+            TraceBufferChunk* newchunk = nullptr;
+
+            head->set_filled(std::chrono::steady_clock::now());
+
+            size_t reserved = head->info().reserved;
+            size_t nextsize = tbuf->next_chunk_size.load(std::memory_order_relaxed);
+
+            if (reserved + nextsize <= ring_bytes) {
+                // Can't allocate in signal handlers: use the reserve there,
+                // or overwrite if it's gone
+                if (c->is_signal()) {
+                    newchunk = tbuf->reserve.exchange(nullptr);
+
+                    if (newchunk)
+                        request_refill(tbuf);
+                } else {
+                    newchunk = tbuf->new_chunk();
+                }
+            }
+
+            if (!newchunk) {
+                newchunk = head->unlink_last();
+
+                if (!newchunk) {
+                    head->reset();
+                    return tbuf;
+                }
+
+                if (newchunk->size() < nextsize && reserved - newchunk->size() + nextsize <= ring_bytes
+                    && !c->is_signal()) {
+                    // replace the small chunk from the start of the growth sequence
+                    free_chunks(newchunk);
+                    newchunk = tbuf->new_chunk();
+                } else {
+                    newchunk->reset();
+                }
+            }
+
+            newchunk->append(head);
+            tbuf->chunks.store(newchunk);
+
+            return tbuf;
+        }
+
+        case BufferPolicy::Spill:
+            return spill_chunk(tbuf);
+        
+        } // switch (policy)
+
+        return 0;
+    }
+    
+    // Flush and clear the trace buffers when sbuf has a region duration
+    // above the flush_on_duration threshold
+    void check_flush_duration(Caliper* c, const SnapshotRecord* sbuf) {
+        if (c->is_signal())
+            return;
+
+        Entry e = sbuf->get(duration_attr);
+
+        if (!e.is_empty() && e.value().to_double() > flush_duration
+            && !overflow_flush_active.exchange(true)) {
+            Log(1).stream() << "trace: region duration exceeds threshold: flushing." << endl;
+
+            c->flush_and_write(nullptr);
+            c->clear();
+
+            overflow_flush_active.store(false);
+        }
+    }
+
+    //
+    // --- Snapshot coalescing
+    //
+    //   A thread keeps up to coalesce_max_runs pending runs with distinct
+    //   keys (context nodes and immediate attribute list), so that the
+    //   begin and end snapshots of a region called in a loop coalesce
+    //   into one record each. A snapshot with a new key when all run
+    //   slots are taken, or with values that don't match the run with
+    //   its key, ends all runs. Aggregatable attribute ids are kept in a
+    //   fixed table that readers access without a lock.
+    //
+
+    bool           coalesce          = false;
+    Attribute      repeat_attr       = Attribute::invalid;
+    std::string    order_attr_name;
+    std::atomic<cali_id_t> order_attr_id { CALI_INV_ID };
+
+    constexpr int  max_sum_attrs     = 64;
+
+    cali_id_t      sum_attr_ids[max_sum_attrs];
+    std::atomic<int> num_sum_attrs   { 0 };
+    std::mutex     sum_attr_lock;
+
+    bool is_sum_attr(cali_id_t id) {
+        int n = num_sum_attrs.load(std::memory_order_acquire);
+
+        for (int i = 0; i < n; ++i)
+            if (sum_attr_ids[i] == id)
+                return true;
+
+        return false;
+    }
+
+    void resolve_coalesce_attribute(Caliper* c, const Attribute& attr) {
+        if (attr.name() == order_attr_name)
+            order_attr_id.store(attr.id());
+
+        if (!attr.get(c->get_attribute("class.aggregatable")).to_bool())
+            return;
+
+        std::lock_guard<std::mutex>
+            g(sum_attr_lock);
+
+        int n = num_sum_attrs.load();
+
+        if (n < max_sum_attrs && !is_sum_attr(attr.id())) {
+            sum_attr_ids[n] = attr.id();
+            num_sum_attrs.store(n + 1, std::memory_order_release);
+        }
+    }
+
+    Variant sum_values(const Variant& a, const Variant& b) {
+        switch (a.type()) {
+        case CALI_TYPE_UINT:
+            return Variant(a.to_uint() + b.to_uint());
+        case CALI_TYPE_INT:
+            return Variant(a.to_int() + b.to_int());
+        case CALI_TYPE_DOUBLE:
+            return Variant(a.to_double() + b.to_double());
+        default:
+            return a;
+        }
+    }
+
+    // Write sbuf into the current chunk of tbuf. During a flush, the
+    // buffer grows regardless of the policy: it is flushed right away.
+    bool write_snapshot(Caliper* c, TraceBuffer* tbuf, const SnapshotRecord* sbuf, bool flushing = false) {
+        if (!tbuf->chunks.load()->fits(sbuf)) {
+            if (flushing) {
+                TraceBufferChunk* newchunk = tbuf->new_chunk();
+
+                newchunk->append(tbuf->chunks.load());
+                tbuf->chunks.store(newchunk);
+            } else {
+                tbuf = handle_overflow(c, tbuf);
+            }
+        }
+
+        if (!tbuf)
+            return false;
+
+        tbuf->chunks.load()->save_snapshot(sbuf);
+
+        return true;
+    }
+
+    // Write and end the pending runs of tbuf
+    void commit_runs(Caliper* c, TraceBuffer* tbuf, bool flushing = false) {
+        CoalesceState* st = tbuf->coalesce.get();
+
+        if (!st)
+            return;
+
+        // reset first: with the flush policy, writing may trigger a
+        // flush that commits the runs of this buffer again
+        size_t n_runs = st->n_runs;
+        st->n_runs = 0;
+
+        for (size_t r = 0; r < n_runs; ++r) {
+            const CoalesceRun& run = st->runs[r];
+
+            SnapshotRecord::FixedSnapshotRecord<TraceBufferChunk::MaxRecordEntries + 1> rec_data;
+            SnapshotRecord rec(rec_data);
+
+            for (size_t i = 0; i < run.n_nodes; ++i)
+                rec.append(c->node(run.nodes[i]));
+
+            rec.append(run.n_imm, run.attr, run.data);
+
+            if (run.repeat > 1)
+                rec.append(repeat_attr.id(), Variant(run.repeat));
+
+            write_snapshot(c, tbuf, &rec, flushing);
+        }
+    }
+
+    void start_run(CoalesceRun& run, const SnapshotRecord::Sizes& sizes, const SnapshotRecord::Data& addr) {
+        run.n_nodes = sizes.n_nodes;
+        run.n_imm   = sizes.n_immediate;
+        run.repeat  = 1;
+
+        for (size_t i = 0; i < sizes.n_nodes; ++i)
+            run.nodes[i] = addr.node_entries[i]->id();
+
+        std::copy(addr.immediate_attr, addr.immediate_attr + run.n_imm, run.attr);
+        std::copy(addr.immediate_data, addr.immediate_data + run.n_imm, run.data);
+    }
+
+    bool has_key(const CoalesceRun& run, const SnapshotRecord::Sizes& sizes, const SnapshotRecord::Data& addr) {
+        if (run.n_nodes != sizes.n_nodes || run.n_imm != sizes.n_immediate)
+            return false;
+
+        for (size_t i = 0; i < run.n_nodes; ++i)
+            if (run.nodes[i] != addr.node_entries[i]->id())
+                return false;
+
+        return std::equal(run.attr, run.attr + run.n_imm, addr.immediate_attr);
+    }
+
+    // Add sbuf to a pending run of tbuf, or end the runs and start a new
+    // one with sbuf. Returns false if sbuf can't be coalesced and must
+    // be written as is.
+    bool coalesce_snapshot(Caliper* c, TraceBuffer* tbuf, const SnapshotRecord* sbuf) {
+        CoalesceState* st = tbuf->coalesce.get();
+
+        if (!st) {
+            if (c->is_signal())
+                return false;
+
+            st = new CoalesceState;
+            tbuf->coalesce.reset(st);
+        }
+
+        SnapshotRecord::Sizes sizes = sbuf->size();
+        SnapshotRecord::Data  addr  = sbuf->data();
+
+        bool ok = sizes.n_nodes + sizes.n_immediate > 0
+            && sizes.n_nodes     <= static_cast<size_t>(TraceBufferChunk::MaxRecordEntries)
+            && sizes.n_immediate <= static_cast<size_t>(TraceBufferChunk::MaxRecordEntries);
+
+        // string values may be gone by the time the run is written
+        for (size_t i = 0; ok && i < sizes.n_immediate; ++i) {
+            cali_attr_type type = addr.immediate_data[i].type();
+            ok = (type != CALI_TYPE_STRING && type != CALI_TYPE_USR && type != CALI_TYPE_INV);
+        }
+
+        if (!ok) {
+            commit_runs(c, tbuf);
+            return false;
+        }
+
+        CoalesceRun* run = nullptr;
+
+        for (size_t r = 0; !run && r < st->n_runs; ++r)
+            if (has_key(st->runs[r], sizes, addr))
+                run = st->runs + r;
+
+        if (run) {
+            cali_id_t order_id = order_attr_id.load(std::memory_order_relaxed);
+            bool      match    = true;
+
+            for (size_t i = 0; match && i < run->n_imm; ++i)
+                if (run->attr[i] != order_id && !is_sum_attr(run->attr[i]))
+                    match = (run->data[i] == addr.immediate_data[i]);
+
+            if (match) {
+                for (size_t i = 0; i < run->n_imm; ++i)
+                    if (is_sum_attr(run->attr[i]))
+                        run->data[i] = sum_values(run->data[i], addr.immediate_data[i]);
+
+                ++run->repeat;
+
+                return true;
+            }
+        }
+
+        if (run || st->n_runs == coalesce_max_runs)
+            commit_runs(c, tbuf);
+
+        start_run(st->runs[st->n_runs], sizes, addr);
+        ++st->n_runs;
+
+        return true;
+    }
+
+    void process_snapshot_cb(Caliper* c, const SnapshotRecord*, const SnapshotRecord* sbuf) {
+        if (!region_filters.empty() && !in_selected_region(sbuf))
+            return;
+
+        TraceBuffer* tbuf = acquire_tbuf(!c->is_signal());
+
+        if (!tbuf || !begin_write(tbuf)) { // error messaging is done in acquire_tbuf()
+            drop_snapshot(c);
+            return;
+        }
+
+        bool recorded = false;
+
+        if (!use_outlier_filter() || is_outlier(c, tbuf, sbuf))
+            recorded = (coalesce && coalesce_snapshot(c, tbuf, sbuf)) || write_snapshot(c, tbuf, sbuf);
+
+        end_write(tbuf);
+
+        if (!recorded)
+            return;
+
+        if (!c->is_signal())
+            tbuf->replenish();
+
+        // Only one thread needs to trigger a flush
+        if (overflow_flush_requested.load() && !c->is_signal() && !overflow_flush_active.exchange(true)) {
+            overflow_flush_requested.store(false);
+
+            Log(1).stream() << "Trace buffer full: flushing." << std::endl;
+            c->flush_and_write(nullptr);
+
+            overflow_flush_active.store(false);
+        }
+
+        if (flush_duration > 0.0)
+            check_flush_duration(c, sbuf);
+    }        
+
+    // Swap a fresh chunk into tbuf and hand off the full one.
+    // The flusher may have swapped the chunk out under us already,
+    // in which case we just continue with the flusher's chunk.
+    TraceBufferChunk* handoff_chunk(TraceBuffer* tbuf, TraceBufferChunk* full) {
+        TraceBufferChunk* newchunk = tbuf->new_chunk();
+
+        if (tbuf->chunks.compare_exchange_strong(full, newchunk)) {
+            handoff_push(full);
+            return newchunk;
+        }
+
+        free_chunks(newchunk);
+        return full; // now holds the flusher's fresh chunk
+    }
+
+    // Signal handler version of handoff_chunk(): prepend the reserve chunk
+    // to the full one. The list is handed off with the next swap.
+    TraceBufferChunk* signal_reserve_chunk(TraceBuffer* tbuf, TraceBufferChunk* full) {
+        TraceBufferChunk* newchunk = tbuf->reserve.exchange(nullptr);
+
+        if (!newchunk)
+            return nullptr;
+
+        newchunk->append(full);
+
+        if (tbuf->chunks.compare_exchange_strong(full, newchunk)) {
+            request_refill(tbuf);
+            return newchunk;
+        }
+
+        // the flusher swapped the chunk out under us: keep the reserve
+        newchunk->unlink_next();
+        tbuf->reserve.store(newchunk);
+
+        return full; // now holds the flusher's fresh chunk
+    }
+
+    void process_snapshot_double_buffer_cb(Caliper* c, const SnapshotRecord*, const SnapshotRecord* sbuf) {
+        if (!region_filters.empty() && !in_selected_region(sbuf))
+            return;
+
+        TraceBuffer* tbuf = acquire_tbuf(!c->is_signal());
+
+        if (!tbuf || tbuf->stopped.load()) {
+            drop_snapshot(c);
+            return;
+        }
+
+        if (use_outlier_filter() && !is_outlier(c, tbuf, sbuf))
+            return;
+
+        bool do_flush = false;
+
+        // The writing flag tells the flusher that we may still be
+        // accessing a chunk it swapped out
+        tbuf->writing.store(true);
+
+        TraceBufferChunk* chunk = tbuf->chunks.load();
+
+        if (!chunk->fits(sbuf)) {
+            if (c->is_signal() && policy != BufferPolicy::Stop) {
+                chunk = signal_reserve_chunk(tbuf, chunk);
+            } else if (policy == BufferPolicy::Stop) {
+                tbuf->stopped.store(true);
+                Log(1).stream() << "Trace buffer full: recording stopped." << endl;
+
+                chunk = nullptr;
+            } else {
+                chunk    = handoff_chunk(tbuf, chunk);
+                do_flush = (policy == BufferPolicy::Flush);
+            }
+        }
+
+        if (chunk && chunk->fits(sbuf))
+            chunk->save_snapshot(sbuf);
+        else
+            drop_snapshot(c);
+
+        tbuf->writing.store(false);
+
+        if (!c->is_signal())
+            tbuf->replenish();
 
-        void unlink() {
-            if (next)
-                next->prev = prev;
-            if (prev)
-                prev->next = next;
+        // Only one thread needs to trigger a flush. Chunks handed off
+        // while a flush is active will be picked up by the next one.
+        if (do_flush && !overflow_flush_active.exchange(true)) {
+            Log(1).stream() << "Trace buffer full: flushing." << std::endl;
+            c->flush_and_write(nullptr);
+            overflow_flush_active.store(false);
         }
-    };
 
-    const ConfigSet::Entry configdata[] = {
-        { "buffer_size",   CALI_TYPE_UINT, "2",
-          "Size of initial per-thread trace buffer in MiB",
-          "Size of initial per-thread trace buffer in MiB" },
-        { "buffer_policy", CALI_TYPE_STRING, "grow",
-          "What to do when trace buffer is full",
-          "What to do when trace buffer is full:\n"
-          "   flush:  Write out contents\n"
-          "   grow:   Increase buffer size\n"
-          "   stop:   Stop recording.\n"
-          "Default: grow" },
-        
-        ConfigSet::Terminator
-    };
-    
-    ConfigSet      config;
-    
-    BufferPolicy   policy            = BufferPolicy::Grow;
-    size_t         buffersize        = 2 * 1024 * 1024;
+        if (flush_duration > 0.0)
+            check_flush_duration(c, sbuf);
+    }
 
-    size_t         dropped_snapshots = 0;
-    
-    pthread_key_t  trace_buf_key;
+    // Swap fresh chunks into all thread buffers and collect the old ones
+    // for flushing. Writers can continue to record in the meantime.
+    HandoffNode* swap_chunks() {
+        TraceBuffer* tbuf = nullptr;
 
-    TraceBuffer*   global_tbuf_list  = nullptr;
-    util::spinlock global_tbuf_lock;
+        {
+            std::lock_guard<util::spinlock>
+                g(global_tbuf_lock);
 
-    std::mutex     global_flush_lock;
-    
+            tbuf = global_tbuf_list;
+        }
 
-    void destroy_tbuf(void* ctx) {
-        TraceBuffer* tbuf = static_cast<TraceBuffer*>(ctx);
+        for (; tbuf; tbuf = tbuf->next) {
+            // keep the current chunk size: with the flush policy,
+            // small chunks would mean frequent flushes
+            TraceBufferChunk* old = tbuf->chunks.exchange(tbuf->new_chunk());
 
-        if (!tbuf)
-            return;
+            // wait until the writer is done with the old chunk
+            while (tbuf->writing.load())
+                ;
 
-        tbuf->retired.store(true);
+            handoff_push(old);
+        }
+
+        return handoff_take_all();
     }
-    
-    TraceBuffer* acquire_tbuf(bool alloc = true) {
-        TraceBuffer* tbuf = static_cast<TraceBuffer*>(pthread_getspecific(trace_buf_key));
 
-        if (alloc && !tbuf) {
-            tbuf = new TraceBuffer(buffersize);
+    void flush_double_buffer_cb(Caliper* c, const SnapshotRecord*, Caliper::SnapshotFlushFn proc_fn) {
+        std::lock_guard<std::mutex>
+            g(global_flush_lock);
 
-            if (!tbuf) {
-                Log(0).stream() << "trace: error: unable to  allocate trace buffer!" << endl;
-                return 0;
-            }
+        size_t num_written = 0;
 
-            if (pthread_setspecific(trace_buf_key, tbuf) == 0) {
-                std::lock_guard<util::spinlock>
-                    g(global_tbuf_lock);
+        TraceBufferChunk::UsageInfo aggregate_info { 0, 0, 0 };
 
-                if (global_tbuf_list)
-                    global_tbuf_list->prev = tbuf;
-                
-                tbuf->next       = global_tbuf_list;
-                global_tbuf_list = tbuf;                
-            } else {
-                Log(0).stream() << "trace: error: unable to set thread trace buffer" << endl;
-                delete tbuf;
-                tbuf = 0;
+        for (HandoffNode* node = swap_chunks(); node; ) {
+            if (Log::verbosity() > 1) {
+                TraceBufferChunk::UsageInfo info = node->chunk->info();
+
+                aggregate_info.nchunks  += info.nchunks;
+                aggregate_info.reserved += info.reserved;
+                aggregate_info.used     += info.used;
             }
+
+            num_written += node->chunk->flush(c, proc_fn);
+
+            HandoffNode* tmp = node->next;
+
+            free_chunks(node->chunk);
+            delete node;
+
+            node = tmp;
         }
 
-        return tbuf;
+        if (Log::verbosity() > 1) {
+            unitfmt_result bytes_reserved 
+                = unitfmt(aggregate_info.reserved, unitfmt_bytes);
+            unitfmt_result bytes_used     
+                = unitfmt(aggregate_info.used,     unitfmt_bytes);
+
+            Log(2).stream() << "Trace: "
+                            << bytes_reserved.val      << " " 
+                            << bytes_reserved.symbol   << " reserved, "
+                            << bytes_used.val          << " " 
+                            << bytes_used.symbol       << " used, "
+                            << aggregate_info.nchunks  << " chunks." << std::endl;
+        }
+
+        Log(1).stream() << "Trace: Flushed " << num_written << " snapshots." << endl;
     }
 
-    TraceBuffer* handle_overflow(Caliper* c, TraceBuffer* tbuf) {
-        switch (policy) {
-        case BufferPolicy::Stop:
-            tbuf->stopped.store(true);
-            Log(1).stream() << "Trace buffer full: recording stopped." << endl;
-            return 0;
-                
-        case BufferPolicy::Grow:
-        {
-            TraceBufferChunk* newchunk = new TraceBufferChunk(buffersize);
+    //
+    // --- Time-ordered flush
+    //
+    //   Each thread's records are in time order, so a k-way merge over
+    //   the threads with a heap produces time-ordered output. Only one
+    //   decoded record per thread is kept; spilled chunks are read back
+    //   one at a time.
+    //
 
-            if (!newchunk) {
-                Log(0).stream() << "trace: error: unable to allocate new trace buffer. Recording stopped." << endl;
-                tbuf->stopped.store(true);
-                return 0;
+    /// \brief A thread's trace buffer and the chunk list to flush
+    struct FlushList {
+        TraceBuffer*      tbuf;
+        TraceBufferChunk* chunks;
+    };
+
+    /// \brief Reads one thread's records in order: the spilled chunks
+    ///   first, then the chunks in memory (stored newest to oldest)
+    struct MergeStream {
+        TraceBuffer*                   tbuf;
+        bool                           read_spill;
+        TraceBufferChunk*              spill_chunk;
+        std::vector<TraceBufferChunk*> chunks;  // newest first
+        std::unique_ptr<TraceBufferChunk::Reader> reader;
+
+        SnapshotRecord::FixedSnapshotRecord<TraceBufferChunk::MaxRecordEntries> data;
+        SnapshotRecord                 rec;
+        uint64_t                       key;
+
+        MergeStream(const FlushList& list)
+            : tbuf(list.tbuf), read_spill(list.tbuf->spill_fd >= 0), spill_chunk(nullptr), key(0)
+            {
+                for (TraceBufferChunk* chunk = list.chunks; chunk; chunk = chunk->next())
+                    chunks.push_back(chunk);
+
+                if (read_spill)
+                    lseek(tbuf->spill_fd, 0, SEEK_SET);
             }
-            
-            newchunk->append(tbuf->chunks);
-            tbuf->chunks = newchunk;
 
-            return tbuf;
+        ~MergeStream() {
+            reader.reset();
+            delete spill_chunk;
+
+            if (tbuf->spill_fd >= 0)
+                lseek(tbuf->spill_fd, 0, SEEK_END);
         }
-            
-        case BufferPolicy::Flush:
-        {
-            Log(1).stream() << "Trace buffer full: flushing." << std::endl;
 
-            c->flush_and_write(nullptr);
-            
-            return tbuf;
+        /// \brief Decode the next record into rec. Records without the
+        ///   order attribute keep the previous record's key.
+        bool advance(Caliper* c, const Attribute& order_attr) {
+            while (true) {
+                if (reader) {
+                    rec = SnapshotRecord(data);
+
+                    if (reader->next(c, rec)) {
+                        Entry e = rec.get(order_attr);
+
+                        if (!e.is_empty())
+                            key = e.value().to_uint();
+
+                        return true;
+                    }
+
+                    reader.reset();
+                }
+
+                if (read_spill) {
+                    delete spill_chunk;
+                    spill_chunk = TraceBufferChunk::read_from(tbuf->spill_fd);
+
+                    if (spill_chunk) {
+                        reader.reset(new TraceBufferChunk::Reader(spill_chunk));
+                        continue;
+                    }
+
+                    read_spill = false;
+                }
+
+                if (chunks.empty())
+                    return false;
+
+                reader.reset(new TraceBufferChunk::Reader(chunks.back()));
+                chunks.pop_back();
+            }
         }
-        
-        } // switch (policy)
+    };
 
-        return 0;
-    }
-    
-    void process_snapshot_cb(Caliper* c, const SnapshotRecord*, const SnapshotRecord* sbuf) {
-        TraceBuffer* tbuf = acquire_tbuf(!c->is_signal());
+    size_t flush_time_ordered(Caliper* c, const std::vector<FlushList>& lists, const Attribute& order_attr, Caliper::SnapshotFlushFn proc_fn) {
+        std::vector< std::unique_ptr<MergeStream> > streams;
 
-        if (!tbuf || tbuf->stopped.load()) { // error messaging is done in acquire_tbuf()
-            ++dropped_snapshots;
-            return;
+        for (const FlushList& list : lists)
+            streams.emplace_back(new MergeStream(list));
+
+        // min-heap of (key, stream index); the index breaks ties
+        typedef std::pair<uint64_t, size_t> heap_entry_t;
+
+        std::priority_queue< heap_entry_t, std::vector<heap_entry_t>, std::greater<heap_entry_t> >
+            heap;
+
+        for (size_t i = 0; i < streams.size(); ++i)
+            if (streams[i]->advance(c, order_attr))
+                heap.push(std::make_pair(streams[i]->key, i));
+
+        size_t num_written = 0;
+
+        while (!heap.empty()) {
+            MergeStream* stream = streams[heap.top().second].get();
+            size_t       index  = heap.top().second;
+
+            heap.pop();
+
+            proc_fn(&stream->rec);
+            ++num_written;
+
+            if (stream->advance(c, order_attr))
+                heap.push(std::make_pair(stream->key, index));
         }
-        
-        if (!tbuf->chunks->fits(sbuf))
-            tbuf = handle_overflow(c, tbuf);
-        if (!tbuf)
-            return;
 
-        tbuf->chunks->save_snapshot(sbuf);
-    }        
+        return num_written;
+    }
 
     void flush_cb(Caliper* c, const SnapshotRecord*, Caliper::SnapshotFlushFn proc_fn) {
         std::lock_guard<std::mutex>
@@ -226,24 +1694,91 @@ namespace
         size_t num_written = 0;
 
         TraceBufferChunk::UsageInfo aggregate_info { 0, 0, 0 };
-        
+
+        // Stop tracing while we flush: writers won't block but just
+        // drop the snapshot. Wait for the ones that are still writing
+        // before we access their chunks or the spill queue, and before
+        // taking the spill lock (writers may hold it to spill a chunk).
+        for (TraceBuffer* t = tbuf; t; t = t->next)
+            stop_writer(t);
+
+        std::unique_lock<std::mutex>
+            sg(spill_write_lock, std::defer_lock);
+
+        if (policy == BufferPolicy::Spill) {
+            sg.lock();
+            write_spill_queue_locked();
+        }
+
+        Attribute order_attr = Attribute::invalid;
+
+        if (time_ordered) {
+            std::string name = config.get("order_attribute").to_string();
+            order_attr = c->get_attribute(name);
+
+            if (order_attr == Attribute::invalid)
+                Log(1).stream() << "trace: order attribute " << name
+                                << " not found, flushing thread buffers in sequence" << endl;
+        }
+
+        // Pending coalesce runs belong to their thread: only write our own.
+        // Other threads write theirs with their next snapshot or when they end.
+        TraceBuffer* own_tbuf = (coalesce ? acquire_tbuf(false) : nullptr);
+
+        std::vector<FlushList> lists;
+
         for (; tbuf; tbuf = tbuf->next) {
-            // Stop tracing while we flush: writers won't block
-            // but just drop the snapshot
-            
-            tbuf->stopped.store(true);
+            if (tbuf == own_tbuf)
+                commit_runs(c, tbuf, true);
+
+            if (policy == BufferPolicy::Ring && ring_duration > 0.0)
+                free_chunks(tbuf->chunks.load()->split_older_than(std::chrono::steady_clock::now() -
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(ring_duration))));
+
+            if (policy == BufferPolicy::Flush) {
+                // The buffer contents are written out only once: take the
+                // chunks out and let the writer continue with a fresh one
+                lists.push_back(FlushList { tbuf, tbuf->chunks.exchange(tbuf->first_chunk()) });
+                tbuf->stopped.store(false);
+            } else {
+                lists.push_back(FlushList { tbuf, tbuf->chunks.load() });
+            }
+        }
 
-            // Accumulate usage statistics before they're reset in flush
+        for (const FlushList& list : lists) {
             if (Log::verbosity() > 1) {
-                TraceBufferChunk::UsageInfo info = tbuf->chunks->info();
+                TraceBufferChunk::UsageInfo info = list.chunks->info();
 
                 aggregate_info.nchunks  += info.nchunks;
                 aggregate_info.reserved += info.reserved;
                 aggregate_info.used     += info.used;
             }
-            
-            num_written += tbuf->chunks->flush(c, proc_fn);
-            tbuf->stopped.store(false);
+
+            if (order_attr != Attribute::invalid)
+                continue;
+
+            if (policy == BufferPolicy::Spill)
+                num_written += flush_spill_file(c, list.tbuf, proc_fn);
+
+            num_written += list.chunks->flush(c, proc_fn);
+        }
+
+        if (order_attr != Attribute::invalid)
+            num_written += flush_time_ordered(c, lists, order_attr, proc_fn);
+
+        for (const FlushList& list : lists)
+            if (policy == BufferPolicy::Flush)
+                free_chunks(list.chunks);
+            else
+                list.tbuf->stopped.store(false);
+
+        if (policy == BufferPolicy::Spill && spilled_chunks > 0) {
+            unitfmt_result bytes_spilled = unitfmt(spilled_bytes, unitfmt_bytes);
+
+            Log(2).stream() << "Trace: "
+                            << bytes_spilled.val    << " "
+                            << bytes_spilled.symbol << " in "
+                            << spilled_chunks       << " chunks spilled to disk." << std::endl;
         }
 
         if (Log::verbosity() > 1) {
@@ -276,9 +1811,46 @@ namespace
             tbuf = global_tbuf_list;
         }
 
+        // Writers may spill chunks: stop them before clearing the spill
+        // queue and files, too
+        for (TraceBuffer* t = tbuf; t; t = t->next)
+            stop_writer(t);
+
+        if (policy == BufferPolicy::Spill) {
+            std::lock_guard<std::mutex>
+                sg(spill_write_lock);
+
+            clear_spill_files_locked(tbuf);
+
+            spilled_bytes  = 0;
+            spilled_chunks = 0;
+        }
+
+        if (double_buffer)
+            for (HandoffNode* node = handoff_take_all(); node; ) {
+                HandoffNode* tmp = node->next;
+
+                free_chunks(node->chunk);
+                delete node;
+
+                node = tmp;
+            }
+
         while (tbuf) {
-            tbuf->stopped.store(true);
-            tbuf->chunks->reset();
+            if (double_buffer) {
+                TraceBufferChunk* old = tbuf->chunks.exchange(tbuf->first_chunk());
+
+                while (tbuf->writing.load())
+                    ;
+
+                free_chunks(old);
+            } else {
+                reset_chunks(tbuf);
+            }
+
+            if (tbuf->coalesce)
+                tbuf->coalesce->n_runs = 0;
+
             tbuf->stopped.store(false);
 
             if (tbuf->retired.load()) {
@@ -293,6 +1865,7 @@ namespace
                 }
                 
                 delete tbuf;
+                --num_tbufs;
                 tbuf = tmp;
             } else {
                 tbuf = tbuf->next;
@@ -304,7 +1877,9 @@ namespace
         const map<std::string, BufferPolicy> polmap {
             { "grow",    BufferPolicy::Grow    },
             { "flush",   BufferPolicy::Flush   },
-            { "stop",    BufferPolicy::Stop    } };
+            { "stop",    BufferPolicy::Stop    },
+            { "spill",   BufferPolicy::Spill   },
+            { "ring",    BufferPolicy::Ring    } };
 
         string polname = config.get("buffer_policy").to_string();
         auto it = polmap.find(polname);
@@ -315,15 +1890,75 @@ namespace
             Log(0).stream() << "trace: error: unknown buffer policy \"" << polname << "\"" << endl;
     }
 
+    void create_attr_cb(Caliper* c, const Attribute& attr) {
+        resolve_region_filters(attr);
+
+        if (coalesce)
+            resolve_coalesce_attribute(c, attr);
+    }
+
     void create_scope_cb(Caliper* c, cali_context_scope_t scope) {
         // init trace buffer on new threads
         if (scope == CALI_SCOPE_THREAD)
             acquire_tbuf(true);
     }
 
+    // Write the pending coalesce runs of a thread that ends
+    void release_scope_cb(Caliper* c, cali_context_scope_t scope) {
+        if (scope != CALI_SCOPE_THREAD)
+            return;
+
+        TraceBuffer* tbuf = acquire_tbuf(false);
+
+        if (!tbuf || !tbuf->coalesce)
+            return;
+
+        // Hold the flush lock so a concurrent flush doesn't make us drop the runs
+        std::lock_guard<std::mutex>
+            g(global_flush_lock);
+
+        if (begin_write(tbuf)) {
+            commit_runs(c, tbuf);
+            end_write(tbuf);
+        }
+    }
+
+    void post_init_cb(Caliper* c) {
+        duration_attr = c->get_attribute("time.inclusive.duration");
+
+        if (flush_duration > 0.0 && duration_attr == Attribute::invalid) {
+            Log(0).stream() << "trace: time.inclusive.duration attribute not found, "
+                            << "flush_on_duration is disabled" << endl;
+            flush_duration = 0.0;
+        }
+        if (use_outlier_filter() && duration_attr == Attribute::invalid) {
+            Log(0).stream() << "trace: time.inclusive.duration attribute not found, "
+                            << "outlier_duration and outlier_factor are disabled" << endl;
+            outlier_duration = 0.0;
+            outlier_factor   = 0.0;
+        }
+
+        if (coalesce)
+            for (const Attribute& attr : c->get_attributes())
+                resolve_coalesce_attribute(c, attr);
+    }
+
     void finish_cb(Caliper* c) {
-        if (dropped_snapshots > 0)
-            Log(1).stream() << "Trace: dropped " << dropped_snapshots << " snapshots." << endl;
+        if (policy == BufferPolicy::Spill)
+            stop_spill_thread();
+        if (flush_signal > 0)
+            clear_flush_signal();
+
+        stop_refill_thread();
+        clear_free_list();
+
+        if (dropped_snapshots.load() > 0)
+            Log(1).stream() << "Trace: dropped " << dropped_snapshots.load()
+                            << " snapshots (" << signal_dropped_snapshots.load()
+                            << " in signal handlers)." << endl;
+        if (use_outlier_filter())
+            Log(1).stream() << "Trace: recorded " << outlier_snapshots.load()
+                            << " outlier snapshots." << endl;
     }
     
     void trace_register(Caliper* c) {
@@ -331,23 +1966,114 @@ namespace
         global_flush_lock.unlock();
         
         config = RuntimeConfig::init("trace", configdata);
-        dropped_snapshots = 0;
+        dropped_snapshots.store(0);
+        signal_dropped_snapshots.store(0);
         
         init_overflow_policy();
         
-        buffersize = config.get("buffer_size").to_uint() * 1024 * 1024;
+        buffersize     = config.get("buffer_size").to_uint() * 1024 * 1024;
+        min_chunk_size = config.get("initial_chunk_size").to_uint() * 1024;
+
+        if (min_chunk_size == 0 || min_chunk_size > buffersize)
+            min_chunk_size = buffersize;
+        double_buffer  = config.get("double_buffer").to_bool();
+        delta_encoding = config.get("delta_encoding").to_bool();
+
+        {
+            std::string order = config.get("flush_order").to_string();
+
+            time_ordered = (order == "time");
+
+            if (!time_ordered && order != "thread")
+                Log(0).stream() << "trace: error: unknown flush order \"" << order << "\"" << endl;
+            if (time_ordered && double_buffer) {
+                Log(0).stream() << "trace: time-ordered flush is not supported with double buffering" << endl;
+                time_ordered = false;
+            }
+        }
+
+        if ((policy == BufferPolicy::Spill || policy == BufferPolicy::Ring) && double_buffer) {
+            Log(0).stream() << "trace: " << config.get("buffer_policy").to_string()
+                            << " buffer policy is not supported with double buffering, using grow" << endl;
+            policy = BufferPolicy::Grow;
+        }
+
+        use_signal_reserve = (policy != BufferPolicy::Stop);
+
+        ring_bytes     = config.get("ring_size").to_uint() * 1024 * 1024;
+        ring_duration  = config.get("ring_duration").to_double();
+        flush_duration = config.get("flush_on_duration").to_double() * 1e6;
+        flush_signal   = parse_signal(config.get("flush_signal").to_string());
+
+        outlier_duration = config.get("outlier_duration").to_double() * 1e6;
+        outlier_factor   = config.get("outlier_factor").to_double();
+        outlier_snapshots.store(0);
+
+        coalesce = config.get("coalesce").to_bool();
+
+        if (coalesce && double_buffer) {
+            Log(0).stream() << "trace: coalescing is not supported with double buffering" << endl;
+            coalesce = false;
+        }
+
+        if (coalesce) {
+            order_attr_name = config.get("order_attribute").to_string();
+            order_attr_id.store(CALI_INV_ID);
+            num_sum_attrs.store(0);
+
+            repeat_attr =
+                c->create_attribute("trace.repeat", CALI_TYPE_UINT,
+                                    CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS);
+        }
+
+        if (policy == BufferPolicy::Spill) {
+            spill_dir    = config.get("spill_directory").to_string();
+            memory_limit = config.get("memory_limit").to_uint() * 1024 * 1024;
+
+            if (spill_dir.empty()) {
+                const char* tmpdir = getenv("TMPDIR");
+                spill_dir = (tmpdir && *tmpdir ? tmpdir : "/tmp");
+            }
+
+            spill_stop   = false;
+            spill_thread = std::thread(spill_loop);
+        }
         
         if (pthread_key_create(&trace_buf_key, destroy_tbuf) != 0) {
             Log(0).stream() << "trace: error: pthread_key_create() failed" << endl;
             return;
         }        
         
+        init_region_filters(c);
+
+        if (!region_filters.empty())
+            for (const Attribute& attr : c->get_attributes())
+                resolve_region_filters(attr);
+        if (!region_filters.empty() || coalesce)
+            c->events().create_attr_evt.connect(&create_attr_cb);
+        if (coalesce)
+            c->events().release_scope_evt.connect(&release_scope_cb);
+
         c->events().create_scope_evt.connect(&create_scope_cb);
-        c->events().process_snapshot.connect(&process_snapshot_cb);
-        c->events().flush_evt.connect(&flush_cb);
+        c->events().reuse_scope_evt.connect(&create_scope_cb);
+
+        if (double_buffer) {
+            c->events().process_snapshot.connect(&process_snapshot_double_buffer_cb);
+            c->events().flush_evt.connect(&flush_double_buffer_cb);
+        } else {
+            c->events().process_snapshot.connect(&process_snapshot_cb);
+            c->events().flush_evt.connect(&flush_cb);
+        }
+
         c->events().clear_evt.connect(&clear_cb);
+        c->events().post_init_evt.connect(&post_init_cb);
         c->events().finish_evt.connect(&finish_cb);
 
+        if (flush_signal > 0)
+            setup_flush_signal();
+        if (use_signal_reserve)
+            setup_refill_thread();
+
         // Initialize trace buffer on master thread
         acquire_tbuf(true);
         
@@ -42,15 +42,170 @@
 
 #include "caliper/common/c-util/vlenc.h"
 
-#define SNAP_MAX 80
+#define SNAP_MAX TraceBufferChunk::MaxRecordEntries
+
+#include <algorithm>
+
+#include <unistd.h>
 
 using namespace trace;
 using namespace cali;
 
+//   Delta-encoded record layout:
+//
+//     n_nodes, n_imm, k: number of leading node ids equal to the previous record's
+//     node ids k..n_nodes-1: zigzag delta to the previous record's id at the same index
+//     attribute list code: i > 0 if the attribute ids equal the i-th entry in
+//       the attribute list dictionary, 0 if n_imm attribute ids follow
+//     n_imm values, each starting with a code:
+//       0: same as the last value of this attribute
+//       1: full packed variant follows
+//       n > 1: UINT/ADDR value, zigzag delta n-1 to the last value of this attribute
+//
+// The last value of each attribute is kept in a small direct-mapped
+// table, so values are still delta-encoded when different kinds of
+// records (e.g., begin and end events) alternate. Only numeric values are
+// kept: string values point to memory that may be gone by the next snapshot.
+
+struct TraceBufferChunk::DeltaState
+{
+    static const size_t NumValueSlots = 64;
+    static const size_t NumAttrLists  = 4;
+
+    struct ValueSlot {
+        cali_id_t attr;
+        Variant   val;
+    };
+
+    struct AttrList {
+        size_t    n;
+        cali_id_t attr[SNAP_MAX];
+    };
+
+    size_t    n_nodes;
+    cali_id_t nodes[SNAP_MAX];
+
+    ValueSlot values[NumValueSlots];
+
+    AttrList  attr_lists[NumAttrLists];
+    size_t    next_attr_list;
+
+    DeltaState()
+        : n_nodes(0), next_attr_list(0)
+        {
+            for (ValueSlot& v : values)
+                v.attr = CALI_INV_ID;
+            for (AttrList& l : attr_lists)
+                l.n = 0;
+        }
+
+    ValueSlot& slot(cali_id_t attr) {
+        return values[attr % NumValueSlots];
+    }
+
+    /// \brief Return the attribute list dictionary code for the given list
+    unsigned find_attr_list(size_t n, const cali_id_t* attr) const {
+        for (size_t i = 0; i < NumAttrLists; ++i)
+            if (attr_lists[i].n == n && std::equal(attr, attr + n, attr_lists[i].attr))
+                return i + 1;
+
+        return 0;
+    }
+
+    void add_attr_list(size_t n, const cali_id_t* attr) {
+        AttrList& l = attr_lists[next_attr_list];
+
+        l.n = n;
+        std::copy(attr, attr + n, l.attr);
+
+        next_attr_list = (next_attr_list + 1) % NumAttrLists;
+    }
+};
+
+namespace
+{
+
+inline uint64_t zigzag_enc(uint64_t d)
+{
+    return (d << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(d) >> 63);
+}
+
+inline uint64_t zigzag_dec(uint64_t z)
+{
+    return (z >> 1) ^ (~(z & 1) + 1);
+}
+
+inline bool is_delta_type(cali_attr_type type)
+{
+    return type == CALI_TYPE_UINT || type == CALI_TYPE_ADDR;
+}
+
+inline bool is_numeric_type(cali_attr_type type)
+{
+    return type != CALI_TYPE_INV && type != CALI_TYPE_STRING && type != CALI_TYPE_USR;
+}
+
+bool write_all(int fd, const void* buf, size_t len)
+{
+    const char* p = static_cast<const char*>(buf);
+
+    while (len > 0) {
+        ssize_t ret = ::write(fd, p, len);
+
+        if (ret < 0)
+            return false;
+
+        p   += ret;
+        len -= ret;
+    }
+
+    return true;
+}
+
+bool read_all(int fd, void* buf, size_t len)
+{
+    char* p = static_cast<char*>(buf);
+
+    while (len > 0) {
+        ssize_t ret = ::read(fd, p, len);
+
+        if (ret <= 0)
+            return false;
+
+        p   += ret;
+        len -= ret;
+    }
+
+    return true;
+}
+
+// Header for chunks written to a spill file
+struct SpillHeader {
+    uint64_t size;
+    uint64_t nrec;
+    uint64_t delta;
+};
+
+}
+
+
+const int TraceBufferChunk::MaxRecordEntries;
+
+
+TraceBufferChunk::TraceBufferChunk(size_t s, bool delta)
+    : m_size(s),
+      m_pos(0),
+      m_nrec(0),
+      m_data(new unsigned char[s]),
+      m_next(0),
+      m_delta(delta ? new DeltaState : 0)
+{ }
+
 
 TraceBufferChunk::~TraceBufferChunk()
 {
     delete[] m_data;
+    delete m_delta;
 
     if (m_next)
         delete m_next;
@@ -70,63 +225,226 @@ void TraceBufferChunk::reset()
 {
     m_pos  = 0;
     m_nrec = 0;
-            
-    memset(m_data, 0, m_size);
+
+    if (m_delta)
+        *m_delta = DeltaState();
 
     delete m_next;
     m_next = 0;
 }
 
 
-size_t TraceBufferChunk::flush(Caliper* c, Caliper::SnapshotFlushFn proc_fn)
+TraceBufferChunk* TraceBufferChunk::unlink_last()
 {
-    size_t written = 0;
+    if (!m_next)
+        return 0;
 
-    //
-    // local flush
-    //
+    TraceBufferChunk* prev = this;
 
-    size_t p = 0;
+    while (prev->m_next->m_next)
+        prev = prev->m_next;
 
-    for (size_t r = 0; r < m_nrec; ++r) {
-        // decode snapshot record
-                
-        int n_nodes = static_cast<int>(std::min(static_cast<int>(vldec_u64(m_data + p, &p)), SNAP_MAX));
-        int n_attr  = static_cast<int>(std::min(static_cast<int>(vldec_u64(m_data + p, &p)), SNAP_MAX));
+    TraceBufferChunk* last = prev->m_next;
+    prev->m_next = 0;
 
-        SnapshotRecord::FixedSnapshotRecord<SNAP_MAX> snapshot_data;
-        SnapshotRecord snapshot(snapshot_data);
+    return last;
+}
 
-        cali_id_t attr[SNAP_MAX];
-        Variant   data[SNAP_MAX];
+
+TraceBufferChunk* TraceBufferChunk::split_older_than(std::chrono::steady_clock::time_point t)
+{
+    TraceBufferChunk* prev = this;
+
+    while (prev->m_next && !(prev->m_next->m_filled < t))
+        prev = prev->m_next;
+
+    return prev->unlink_next();
+}
+
+
+TraceBufferChunk::Reader::Reader(const TraceBufferChunk* chunk)
+    : m_chunk(chunk),
+      m_pos(0),
+      m_rec(0),
+      m_delta(chunk->m_delta ? new DeltaState : 0)
+{ }
+
+
+TraceBufferChunk::Reader::~Reader()
+{
+    delete m_delta;
+}
+
+
+bool TraceBufferChunk::Reader::next(Caliper* c, SnapshotRecord& snapshot)
+{
+    if (m_rec >= m_chunk->m_nrec)
+        return false;
+
+    const unsigned char* data_ptr = m_chunk->m_data;
+    size_t& p = m_pos;
+
+    cali_id_t attr[SNAP_MAX];
+    Variant   data[SNAP_MAX];
+
+    if (!m_delta) {
+        int n_nodes = static_cast<int>(std::min(static_cast<int>(vldec_u64(data_ptr + p, &p)), SNAP_MAX));
+        int n_attr  = static_cast<int>(std::min(static_cast<int>(vldec_u64(data_ptr + p, &p)), SNAP_MAX));
 
         for (int i = 0; i < n_nodes; ++i)
-            snapshot.append(c->node(vldec_u64(m_data + p, &p)));
-        for (int i = 0; i < n_attr;  ++i) 
-            attr[i] = vldec_u64(m_data + p, &p);
+            snapshot.append(c->node(vldec_u64(data_ptr + p, &p)));
         for (int i = 0; i < n_attr;  ++i)
-            data[i] = Variant::unpack(m_data + p, &p, nullptr);
+            attr[i] = vldec_u64(data_ptr + p, &p);
+        for (int i = 0; i < n_attr;  ++i)
+            data[i] = Variant::unpack(data_ptr + p, &p, nullptr);
 
         snapshot.append(n_attr, attr, data);
+    } else {
+        DeltaState& st = *m_delta;
+
+        size_t n_nodes = vldec_u64(data_ptr + p, &p);
+        size_t n_imm   = vldec_u64(data_ptr + p, &p);
+        size_t k       = vldec_u64(data_ptr + p, &p);
 
-        // write snapshot                
+        for (size_t i = k; i < n_nodes; ++i)
+            st.nodes[i] = (i < st.n_nodes ? st.nodes[i] : 0) + zigzag_dec(vldec_u64(data_ptr + p, &p));
 
-        proc_fn(&snapshot);
+        st.n_nodes = n_nodes;
+
+        for (size_t i = 0; i < n_nodes; ++i)
+            snapshot.append(c->node(st.nodes[i]));
+
+        unsigned  list = vldec_u64(data_ptr + p, &p);
+
+        if (list > 0) {
+            std::copy(st.attr_lists[list-1].attr, st.attr_lists[list-1].attr + n_imm, attr);
+        } else {
+            for (size_t i = 0; i < n_imm; ++i)
+                attr[i] = vldec_u64(data_ptr + p, &p);
+
+            st.add_attr_list(n_imm, attr);
+        }
+
+        for (size_t i = 0; i < n_imm; ++i) {
+            DeltaState::ValueSlot& slot = st.slot(attr[i]);
+            uint64_t code = vldec_u64(data_ptr + p, &p);
+
+            if (code == 0) {
+                data[i] = slot.val;
+            } else if (code == 1) {
+                data[i] = Variant::unpack(data_ptr + p, &p, nullptr);
+            } else {
+                uint64_t val = slot.val.to_uint() + zigzag_dec(code - 1);
+                data[i] = Variant(slot.val.type(), &val, sizeof(uint64_t));
+            }
+
+            slot.attr = attr[i];
+            slot.val  = (is_numeric_type(data[i].type()) ? data[i] : Variant());
+        }
+
+        snapshot.append(n_imm, attr, data);
+    }
+
+    ++m_rec;
+
+    return true;
+}
+
+
+size_t TraceBufferChunk::flush(Caliper* c, Caliper::SnapshotFlushFn proc_fn)
+{
+    size_t written = 0;
+
+    {
+        Reader reader(this);
+
+        while (true) {
+            SnapshotRecord::FixedSnapshotRecord<SNAP_MAX> snapshot_data;
+            SnapshotRecord snapshot(snapshot_data);
+
+            if (!reader.next(c, snapshot))
+                break;
+
+            proc_fn(&snapshot);
+            ++written;
+        }
     }
 
-    written += m_nrec;
-            
     //
     // flush subsequent buffers in list
-    // 
-            
+    //
+
     if (m_next)
         written += m_next->flush(c, proc_fn);
-            
+
     return written;
 }
 
 
+void TraceBufferChunk::save_snapshot_delta(const SnapshotRecord* s)
+{
+    DeltaState&           st    = *m_delta;
+    SnapshotRecord::Sizes sizes = s->size();
+    SnapshotRecord::Data  addr  = s->data();
+
+    size_t n_nodes = std::min<size_t>(sizes.n_nodes,     SNAP_MAX);
+    size_t n_imm   = std::min<size_t>(sizes.n_immediate, SNAP_MAX);
+
+    size_t k = 0;
+
+    while (k < n_nodes && k < st.n_nodes && st.nodes[k] == addr.node_entries[k]->id())
+        ++k;
+
+    m_pos += vlenc_u64(n_nodes, m_data + m_pos);
+    m_pos += vlenc_u64(n_imm,   m_data + m_pos);
+    m_pos += vlenc_u64(k,       m_data + m_pos);
+
+    for (size_t i = k; i < n_nodes; ++i) {
+        cali_id_t id   = addr.node_entries[i]->id();
+        cali_id_t prev = (i < st.n_nodes ? st.nodes[i] : 0);
+
+        m_pos += vlenc_u64(zigzag_enc(id - prev), m_data + m_pos);
+        st.nodes[i] = id;
+    }
+
+    st.n_nodes = n_nodes;
+
+    unsigned list = st.find_attr_list(n_imm, addr.immediate_attr);
+
+    m_pos += vlenc_u64(list, m_data + m_pos);
+
+    if (list == 0) {
+        for (size_t i = 0; i < n_imm; ++i)
+            m_pos += vlenc_u64(addr.immediate_attr[i], m_data + m_pos);
+
+        st.add_attr_list(n_imm, addr.immediate_attr);
+    }
+
+    for (size_t i = 0; i < n_imm; ++i) {
+        const Variant&         val  = addr.immediate_data[i];
+        cali_attr_type         type = val.type();
+        DeltaState::ValueSlot& slot = st.slot(addr.immediate_attr[i]);
+
+        bool have_prev = (slot.attr == addr.immediate_attr[i]);
+
+        if (have_prev && is_numeric_type(type) && slot.val == val) {
+            m_data[m_pos++] = 0;
+        } else if (have_prev && is_delta_type(type) && slot.val.type() == type &&
+                   zigzag_enc(val.to_uint() - slot.val.to_uint()) < UINT64_MAX) {
+            m_pos += vlenc_u64(zigzag_enc(val.to_uint() - slot.val.to_uint()) + 1, m_data + m_pos);
+        } else {
+            m_data[m_pos++] = 1;
+            m_pos += val.pack(m_data + m_pos);
+        }
+
+        slot.attr = addr.immediate_attr[i];
+        slot.val  = (is_numeric_type(type) ? val : Variant());
+    }
+
+    ++m_nrec;
+}
+
+
 void TraceBufferChunk::save_snapshot(const SnapshotRecord* s)
 {
     SnapshotRecord::Sizes sizes = s->size();
@@ -134,6 +452,11 @@ void TraceBufferChunk::save_snapshot(const SnapshotRecord* s)
     if ((sizes.n_nodes + sizes.n_immediate) == 0)
         return;
 
+    if (m_delta) {
+        save_snapshot_delta(s);
+        return;
+    }
+
     sizes.n_nodes     = std::min<size_t>(sizes.n_nodes,     SNAP_MAX);
     sizes.n_immediate = std::min<size_t>(sizes.n_immediate, SNAP_MAX);
                 
@@ -158,11 +481,11 @@ bool TraceBufferChunk::fits(const SnapshotRecord* s) const
     SnapshotRecord::Sizes sizes = s->size();
 
     // get worst-case estimate of packed snapshot size:
-    //   20 bytes for size indicators
+    //   20 bytes for size indicators (+11 for the delta encoding header)
     //   10 bytes per node id
-    //   10+22 bytes per immediate entry (10 for attr, 22 for variant)
+    //   10+22 bytes per immediate entry (10 for attr, 22 for variant, +1 delta code)
             
-    size_t max = 20 + 10 * sizes.n_nodes + 32 * sizes.n_immediate;
+    size_t max = 31 + 10 * sizes.n_nodes + 33 * sizes.n_immediate;
 
     return (m_pos + max) < m_size;
 }
@@ -181,3 +504,32 @@ TraceBufferChunk::UsageInfo TraceBufferChunk::info() const
 
     return info;
 }
+
+
+bool TraceBufferChunk::write_to(int fd) const
+{
+    SpillHeader hdr { m_pos, m_nrec, m_delta ? 1u : 0u };
+
+    return write_all(fd, &hdr, sizeof(hdr)) && write_all(fd, m_data, m_pos);
+}
+
+
+TraceBufferChunk* TraceBufferChunk::read_from(int fd)
+{
+    SpillHeader hdr;
+
+    if (!read_all(fd, &hdr, sizeof(hdr)))
+        return 0;
+
+    TraceBufferChunk* chunk = new TraceBufferChunk(hdr.size + 1, hdr.delta != 0);
+
+    if (!read_all(fd, chunk->m_data, hdr.size)) {
+        delete chunk;
+        return 0;
+    }
+
+    chunk->m_pos  = hdr.size;
+    chunk->m_nrec = hdr.nrec;
+
+    return chunk;
+}
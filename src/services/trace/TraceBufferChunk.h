@@ -37,6 +37,7 @@
 
 #include "caliper/Caliper.h"
 
+#include <chrono>
 #include <cstring>
 
 
@@ -57,17 +58,83 @@ namespace trace
         
         TraceBufferChunk* m_next;
 
+        /// \brief When the chunk was filled up. Used by the ring buffer policy.
+        std::chrono::steady_clock::time_point m_filled;
+
+        /// \brief The previous record in this chunk, for delta encoding.
+        ///   Null if delta encoding is disabled.
+        struct DeltaState;
+
+        DeltaState*       m_delta;
+
+        void   save_snapshot_delta(const cali::SnapshotRecord* s);
+
     public:
 
-        TraceBufferChunk(size_t s)
-            : m_size(s), m_pos(0), m_nrec(0), m_data(new unsigned char[s]), m_next(0)
-            { }
+        /// \brief Maximum number of node and immediate entries per record
+        static const int MaxRecordEntries = 80;
+
+        /// \brief Decodes the records of one chunk (without subsequent
+        ///   chunks in the list) one at a time
+        class Reader {
+            const TraceBufferChunk* m_chunk;
+            size_t                  m_pos;
+            size_t                  m_rec;
+            DeltaState*             m_delta;
+
+        public:
+
+            explicit Reader(const TraceBufferChunk* chunk);
+            ~Reader();
+
+            Reader(const Reader&) = delete;
+            Reader& operator = (const Reader&) = delete;
+
+            /// \brief Decode the next record into \a snapshot, which must be
+            ///   empty and have room for MaxRecordEntries entries.
+            ///   Returns false at the end of the chunk.
+            bool next(cali::Caliper* c, cali::SnapshotRecord& snapshot);
+        };
+
+        /// \brief Create a chunk of \a s bytes. With \a delta, records are
+        ///   delta-encoded against the previous record in the chunk.
+        TraceBufferChunk(size_t s, bool delta = false);
 
         ~TraceBufferChunk();
 
         void   append(TraceBufferChunk* chunk);
         void   reset();
 
+        /// \brief Remove the last chunk from the list and return it.
+        ///   Returns null if this is the only chunk in the list.
+        TraceBufferChunk* unlink_last();
+
+        /// \brief Detach subsequent chunks in the list that were filled up
+        ///   before \a t and return them. Assumes the list is ordered from
+        ///   newest to oldest.
+        TraceBufferChunk* split_older_than(std::chrono::steady_clock::time_point t);
+
+        /// \brief Detach the rest of the list after this chunk and return it
+        TraceBufferChunk* unlink_next() {
+            TraceBufferChunk* next = m_next;
+            m_next = 0;
+            return next;
+        }
+
+        /// \brief The next chunk in the list
+        TraceBufferChunk* next() const {
+            return m_next;
+        }
+
+        /// \brief Capacity of this chunk in bytes
+        size_t size() const {
+            return m_size;
+        }
+
+        void   set_filled(std::chrono::steady_clock::time_point t) {
+            m_filled = t;
+        }
+
         size_t flush(cali::Caliper* c, cali::Caliper::SnapshotFlushFn proc_fn);
 
         void   save_snapshot(const cali::SnapshotRecord* s);
@@ -80,6 +147,19 @@ namespace trace
         };
 
         UsageInfo info() const;
+
+        /// \brief Number of records in this chunk and subsequent chunks
+        size_t num_records() const {
+            return m_nrec + (m_next ? m_next->num_records() : 0);
+        }
+
+        /// \brief Write this chunk (without subsequent chunks in the list)
+        ///   to file descriptor \a fd. Returns false on error.
+        bool   write_to(int fd) const;
+
+        /// \brief Read a chunk written by write_to() from file descriptor \a fd.
+        ///   Returns null at the end of the file or on error.
+        static TraceBufferChunk* read_from(int fd);
     };
     
 } // namespace trace
@@ -0,0 +1,584 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+/// \file  Uncore.cpp
+/// \brief Per-socket uncore (e.g., memory controller) counters
+
+#include "caliper/CaliperService.h"
+
+#include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/Log.h"
+#include "caliper/common/RuntimeConfig.h"
+
+#include <linux/perf_event.h>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cali;
+using namespace std;
+
+namespace
+{
+
+const ConfigSet::Entry configdata[] = {
+    { "pmu", CALI_TYPE_STRING, "uncore_imc",
+      "Uncore PMU to read",
+      "Name of the uncore PMU in /sys/bus/event_source/devices to read.\n"
+      "All PMU instances with this name or name prefix followed by _<n>\n"
+      "(e.g., the uncore_imc_0 ... uncore_imc_5 memory controller channels)\n"
+      "are summed up per socket."
+    },
+    { "events", CALI_TYPE_STRING, "cas_count_read,cas_count_write",
+      "Comma-separated list of uncore events",
+      "Comma-separated list of uncore events of the PMU, as listed in\n"
+      "/sys/bus/event_source/devices/<pmu>/events. Values are scaled as\n"
+      "given by the kernel (e.g., in MiB for the CAS count events)."
+    },
+    { "interval", CALI_TYPE_UINT, "0",
+      "Counter read interval in milliseconds",
+      "Read the counters every <interval> milliseconds in a background\n"
+      "thread per socket. With 0, the counters are read by one designated\n"
+      "application thread per socket in its snapshots (e.g., at region\n"
+      "boundaries)."
+    },
+    ConfigSet::Terminator
+};
+
+const int MaxEvents = 16;
+
+/// \brief The shared counter values of one socket.
+///
+///   Values are published by a single writer, either the designated
+/// application thread or the socket's background reader, under a
+/// sequence lock. Readers in snapshots never block: they retry a few
+/// times while an update is in progress and then give up.
+struct SocketSlot {
+    int                   socket;
+    int                   cpu;      ///< CPU the uncore events are opened on
+    std::vector<int>      fds;      ///< per event and PMU instance
+
+    std::atomic<unsigned> seq;
+    std::atomic<uint64_t> values[MaxEvents];
+
+    std::atomic<pid_t>    owner;    ///< Designated reader thread, or 0
+
+    SocketSlot()
+        : socket(-1), cpu(-1), seq(0), owner(0)
+        {
+            for (int i = 0; i < MaxEvents; ++i)
+                values[i].store(0);
+        }
+
+    void publish(size_t num_events, size_t num_pmus) {
+        uint64_t v[MaxEvents] = { 0 };
+
+        for (size_t e = 0; e < num_events; ++e)
+            for (size_t p = 0; p < num_pmus; ++p) {
+                int      fd  = fds[e*num_pmus + p];
+                uint64_t val = 0;
+
+                if (fd >= 0 && read(fd, &val, sizeof(val)) == sizeof(val))
+                    v[e] += val;
+            }
+
+        unsigned s = seq.load(std::memory_order_relaxed);
+
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (size_t e = 0; e < num_events; ++e)
+            values[e].store(v[e], std::memory_order_relaxed);
+
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    bool get(size_t num_events, uint64_t* v) const {
+        for (int retry = 0; retry < 16; ++retry) {
+            unsigned s = seq.load(std::memory_order_acquire);
+
+            if (s & 1)
+                continue;
+
+            for (size_t e = 0; e < num_events; ++e)
+                v[e] = values[e].load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (seq.load(std::memory_order_relaxed) == s)
+                return true;
+        }
+
+        return false;
+    }
+};
+
+struct UncoreEvent {
+    std::string name;
+    double      scale;
+    Attribute   attr;
+};
+
+struct PMU {
+    std::string name;
+    int         type;
+};
+
+std::vector<UncoreEvent> events;
+std::vector<PMU>         pmus;
+
+SocketSlot*              slots     = nullptr;
+size_t                   num_slots = 0;
+
+std::vector<int>         cpu_to_slot; ///< slot index for each CPU, or -1
+
+Attribute                socket_attr;
+
+unsigned                 interval_ms = 0;
+
+std::vector<std::thread> reader_threads;
+std::mutex               reader_mutex;
+std::condition_variable  reader_cv;
+bool                     reader_stop = false;
+
+std::atomic<unsigned>    num_failed_reads { 0 };
+
+/// \brief Per-thread counter values seen in the previous snapshot
+struct ThreadState {
+    pid_t    tid;
+    int      slot;   ///< slot of the previous snapshot, -1 for none
+    uint64_t last[MaxEvents];
+};
+
+thread_local ThreadState t_state = { 0, -1, { 0 } };
+
+const char* pmu_root = "/sys/bus/event_source/devices/";
+
+bool read_file(const std::string& path, std::string& str)
+{
+    std::ifstream is(path.c_str());
+
+    if (!is)
+        return false;
+
+    std::getline(is, str);
+    return true;
+}
+
+/// \brief Parse a CPU list like "0,28" or "0-3,8"
+std::vector<int> parse_cpulist(const std::string& str)
+{
+    std::vector<int>  ret;
+    std::stringstream is(str);
+    std::string       range;
+
+    while (std::getline(is, range, ',')) {
+        if (range.empty())
+            continue;
+
+        size_t pos = range.find('-');
+        int    lo  = std::atoi(range.c_str());
+        int    hi  = (pos == std::string::npos) ? lo : std::atoi(range.c_str() + pos + 1);
+
+        for (int i = lo; i <= hi; ++i)
+            ret.push_back(i);
+    }
+
+    return ret;
+}
+
+/// \brief Set the bits of the perf_event config fields given by a
+///   sysfs format description like "config:0-7,21" to \a val
+bool apply_format(const std::string& format, uint64_t val, struct perf_event_attr& attr)
+{
+    size_t colon = format.find(':');
+
+    if (colon == std::string::npos)
+        return false;
+
+    std::string field = format.substr(0, colon);
+    __u64*      cfg   = nullptr;
+
+    if (field == "config")
+        cfg = &attr.config;
+    else if (field == "config1")
+        cfg = &attr.config1;
+    else if (field == "config2")
+        cfg = &attr.config2;
+    else
+        return false;
+
+    std::stringstream is(format.substr(colon + 1));
+    std::string       range;
+
+    while (std::getline(is, range, ',')) {
+        size_t pos = range.find('-');
+        int    lo  = std::atoi(range.c_str());
+        int    hi  = (pos == std::string::npos) ? lo : std::atoi(range.c_str() + pos + 1);
+
+        for (int bit = lo; bit <= hi && bit < 64; ++bit, val >>= 1)
+            if (val & 1)
+                *cfg |= (__u64(1) << bit);
+    }
+
+    return true;
+}
+
+/// \brief Set up the perf_event attribute for \a event of \a pmu from
+///   its sysfs description, e.g. "event=0x04,umask=0x03"
+bool make_event_attr(const PMU& pmu, const std::string& event, struct perf_event_attr& attr)
+{
+    std::string dir = std::string(pmu_root) + pmu.name + "/";
+    std::string desc;
+
+    if (!read_file(dir + "events/" + event, desc))
+        return false;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.size = sizeof(attr);
+    attr.type = pmu.type;
+
+    std::stringstream is(desc);
+    std::string       term;
+
+    while (std::getline(is, term, ',')) {
+        size_t      pos  = term.find('=');
+        std::string name = term.substr(0, pos);
+        uint64_t    val  = (pos == std::string::npos) ? 1 : std::strtoull(term.c_str() + pos + 1, nullptr, 0);
+        std::string format;
+
+        if (!read_file(dir + "format/" + name, format) || !apply_format(format, val, attr)) {
+            Log(0).stream() << "uncore: cannot parse event term " << term
+                            << " of " << pmu.name << "/" << event << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// \brief Find the PMU instances named \a prefix or \a prefix_<n>
+void find_pmus(const std::string& prefix)
+{
+    DIR* dir = opendir(pmu_root);
+
+    if (!dir)
+        return;
+
+    for (struct dirent* d = readdir(dir); d; d = readdir(dir)) {
+        std::string name(d->d_name);
+
+        if (name.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        if (name.size() > prefix.size() &&
+            (name[prefix.size()] != '_' || name.find_first_not_of("0123456789", prefix.size() + 1) != std::string::npos))
+            continue;
+
+        std::string type;
+
+        if (read_file(std::string(pmu_root) + name + "/type", type))
+            pmus.push_back( { name, std::atoi(type.c_str()) } );
+    }
+
+    closedir(dir);
+}
+
+int socket_of_cpu(int cpu)
+{
+    std::string str;
+    std::string path =
+        std::string("/sys/devices/system/cpu/cpu") + std::to_string(cpu) + "/topology/physical_package_id";
+
+    return read_file(path, str) ? std::atoi(str.c_str()) : -1;
+}
+
+/// \brief Open the uncore events on one CPU of each socket, as given in
+///   the PMU's cpumask
+bool setup_slots(const std::vector<std::string>& event_names)
+{
+    std::string mask;
+
+    if (!read_file(std::string(pmu_root) + pmus.front().name + "/cpumask", mask))
+        return false;
+
+    std::vector<int> cpus = parse_cpulist(mask);
+
+    if (cpus.empty())
+        return false;
+
+    num_slots = cpus.size();
+    slots     = new SocketSlot[num_slots];
+
+    int ncpu = static_cast<int>(sysconf(_SC_NPROCESSORS_CONF));
+
+    cpu_to_slot.assign(std::max(ncpu, 1), -1);
+
+    for (size_t s = 0; s < num_slots; ++s) {
+        slots[s].cpu    = cpus[s];
+        slots[s].socket = socket_of_cpu(cpus[s]);
+    }
+
+    for (int cpu = 0; cpu < ncpu; ++cpu) {
+        int socket = socket_of_cpu(cpu);
+
+        for (size_t s = 0; s < num_slots; ++s)
+            if (slots[s].socket == socket)
+                cpu_to_slot[cpu] = static_cast<int>(s);
+    }
+
+    size_t num_open = 0;
+
+    for (size_t s = 0; s < num_slots; ++s)
+        for (const std::string& name : event_names)
+            for (const PMU& pmu : pmus) {
+                struct perf_event_attr attr;
+                int fd = -1;
+
+                if (make_event_attr(pmu, name, attr)) {
+                    fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, -1, slots[s].cpu, -1, 0));
+
+                    if (fd < 0)
+                        Log(1).stream() << "uncore: perf_event_open() failed for " << pmu.name << "/" << name
+                                        << " on cpu " << slots[s].cpu << ": " << strerror(errno) << std::endl;
+                    else
+                        ++num_open;
+                }
+
+                slots[s].fds.push_back(fd);
+            }
+
+    return num_open > 0;
+}
+
+void reader_thread(SocketSlot* slot)
+{
+    cpu_set_t cpuset;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(slot->cpu, &cpuset);
+
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+
+    std::unique_lock<std::mutex>
+        g(reader_mutex);
+
+    while (!reader_stop) {
+        slot->publish(events.size(), pmus.size());
+        reader_cv.wait_for(g, std::chrono::milliseconds(interval_ms));
+    }
+}
+
+void snapshot_cb(Caliper*, int scope, const SnapshotRecord*, SnapshotRecord* snapshot)
+{
+    if (!(scope & CALI_SCOPE_THREAD))
+        return;
+
+    int cpu  = sched_getcpu();
+    int slot = (cpu >= 0 && static_cast<size_t>(cpu) < cpu_to_slot.size()) ? cpu_to_slot[cpu] : -1;
+
+    if (slot < 0)
+        return;
+
+    SocketSlot* s = slots + slot;
+
+    if (interval_ms == 0) {
+        // The first thread to come along on a socket becomes its reader
+        if (t_state.tid == 0)
+            t_state.tid = static_cast<pid_t>(syscall(SYS_gettid));
+
+        pid_t owner = s->owner.load(std::memory_order_relaxed);
+
+        if (owner == 0 && s->owner.compare_exchange_strong(owner, t_state.tid))
+            owner = t_state.tid;
+        if (owner == t_state.tid)
+            s->publish(events.size(), pmus.size());
+    }
+
+    uint64_t v[MaxEvents];
+
+    if (!s->get(events.size(), v)) {
+        ++num_failed_reads;
+        return;
+    }
+
+    // Start over when the thread moved to another socket: counts of the
+    // previous socket don't belong to this one
+    bool fresh = (t_state.slot != slot);
+
+    cali_id_t attr[MaxEvents + 1];
+    Variant   data[MaxEvents + 1];
+
+    for (size_t e = 0; e < events.size(); ++e) {
+        attr[e] = events[e].attr.id();
+        data[e] = Variant(fresh ? 0.0 : events[e].scale * static_cast<double>(v[e] - t_state.last[e]));
+
+        t_state.last[e] = v[e];
+    }
+
+    t_state.slot = slot;
+
+    attr[events.size()] = socket_attr.id();
+    data[events.size()] = Variant(s->socket);
+
+    snapshot->append(events.size() + 1, attr, data);
+}
+
+void release_scope_cb(Caliper*, cali_context_scope_t scope)
+{
+    if (scope != CALI_SCOPE_THREAD || t_state.tid == 0)
+        return;
+
+    // Hand off the reader role of exiting threads
+    for (size_t s = 0; s < num_slots; ++s) {
+        pid_t owner = t_state.tid;
+        slots[s].owner.compare_exchange_strong(owner, 0);
+    }
+}
+
+void post_init_cb(Caliper*)
+{
+    if (interval_ms == 0)
+        return;
+
+    for (size_t s = 0; s < num_slots; ++s)
+        reader_threads.push_back(std::thread(reader_thread, slots + s));
+}
+
+void finish_cb(Caliper*)
+{
+    {
+        std::lock_guard<std::mutex>
+            g(reader_mutex);
+
+        reader_stop = true;
+    }
+
+    reader_cv.notify_all();
+
+    for (std::thread& t : reader_threads)
+        t.join();
+
+    reader_threads.clear();
+
+    for (size_t s = 0; s < num_slots; ++s)
+        for (int fd : slots[s].fds)
+            if (fd >= 0)
+                close(fd);
+
+    if (num_failed_reads.load() > 0)
+        Log(1).stream() << "uncore: " << num_failed_reads.load()
+                        << " counter reads skipped during updates" << std::endl;
+}
+
+void uncore_register(Caliper* c)
+{
+    ConfigSet config = RuntimeConfig::init("uncore", configdata);
+
+    std::string              pmu_name    = config.get("pmu").to_string();
+    std::vector<std::string> event_names = config.get("events").to_stringlist(",");
+
+    interval_ms = config.get("interval").to_uint();
+
+    if (event_names.size() > MaxEvents) {
+        Log(0).stream() << "uncore: too many events, using the first " << MaxEvents << std::endl;
+        event_names.resize(MaxEvents);
+    }
+
+    find_pmus(pmu_name);
+
+    if (pmus.empty()) {
+        Log(0).stream() << "uncore: no " << pmu_name << " PMU found" << std::endl;
+        return;
+    }
+
+    if (event_names.empty() || !setup_slots(event_names)) {
+        Log(0).stream() << "uncore: could not open uncore events" << std::endl;
+        return;
+    }
+
+    Attribute aggr_class_attr = c->get_attribute("class.aggregatable");
+    Variant   v_true(true);
+
+    for (const std::string& name : event_names) {
+        std::string scale;
+        double      s = 1.0;
+
+        if (read_file(std::string(pmu_root) + pmus.front().name + "/events/" + name + ".scale", scale))
+            s = std::strtod(scale.c_str(), nullptr);
+
+        Attribute attr =
+            c->create_attribute(std::string("uncore.") + name, CALI_TYPE_DOUBLE,
+                                CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS,
+                                1, &aggr_class_attr, &v_true);
+
+        events.push_back( { name, s, attr } );
+    }
+
+    socket_attr =
+        c->create_attribute("uncore.socket", CALI_TYPE_INT, CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS);
+
+    c->events().post_init_evt.connect(&post_init_cb);
+    c->events().snapshot.connect(&snapshot_cb);
+    c->events().release_scope_evt.connect(&release_scope_cb);
+    c->events().finish_evt.connect(&finish_cb);
+
+    Log(1).stream() << "Registered uncore service ("
+                    << pmus.size() << " " << pmu_name << " PMUs, "
+                    << num_slots << " sockets)" << std::endl;
+}
+
+} // namespace
+
+namespace cali
+{
+    CaliperService uncore_service = { "uncore", ::uncore_register };
+}
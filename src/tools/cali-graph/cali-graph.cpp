@@ -43,13 +43,17 @@
 
 #include "caliper/common/Node.h"
 
-#include "caliper/common/csv/CsvReader.h"
 
 #include "caliper/common/util/split.hpp"
 
+#include <algorithm>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 using namespace cali;
 using namespace std;
@@ -69,6 +73,14 @@ namespace
         { "skip-attribute-prefixes", "skip-attribute-prefixes", 0, false,
           "Skip attribute prefixes in nodes", nullptr 
         },
+        { "metric", "metric", 'm', true,
+          "Aggregate this metric attribute over the snapshot records and export only significant nodes",
+          "ATTRIBUTE"
+        },
+        { "threshold", "threshold", 't', true,
+          "With --metric, collapse nodes below this percentage of the metric total. Default: 1",
+          "PERCENT"
+        },
         { "output", "output", 'o', true,  "Set the output file name", "FILE"  },
         { "help",   "help",   'h', false, "Print help message",       nullptr },
         Args::Table::Terminator
@@ -132,10 +144,159 @@ namespace
                      << endl;
         }
 
+        void print_metric_node(CaliperMetadataAccessInterface& db, const Node* node, double pct) {
+            Attribute attr = db.get_attribute(node->attribute());
+
+            m_os << "  " << node->id()
+                 << " [label=\"" << format_attr_name(attr) << ":" << node->data().to_string()
+                 << "\\n" << std::fixed << std::setprecision(1) << pct << "%\"];"
+                 << endl;
+
+            if (node->parent() && node->parent()->id() != CALI_INV_ID)
+                m_os << "  " << node->parent()->id() << " -- " << node->id() << ";"
+                     << endl;
+        }
+
+        /// \brief Print a node for \a count collapsed children of \a parent
+        void print_other_node(cali_id_t parent, size_t count, double pct) {
+            std::string id = (parent == CALI_INV_ID ? std::string("other") : "other_" + std::to_string(parent));
+
+            m_os << "  " << id
+                 << " [label=\"other (" << count << " nodes)\\n"
+                 << std::fixed << std::setprecision(1) << pct << "%\", style=dashed];"
+                 << endl;
+
+            if (parent != CALI_INV_ID)
+                m_os << "  " << parent << " -- " << id << ";"
+                     << endl;
+        }
+
         void operator()(CaliperMetadataAccessInterface& db, const Node* node) {
             print_node(db, node);
         }
     };
+
+    /// Sums up a metric for each context tree node in a single pass over
+    /// the snapshot records. A node's value includes the values of all
+    /// records whose context contains the node, so the metric should be
+    /// an exclusive one, e.g. time.duration or sum#time.duration.
+    /// Only nodes with at least the threshold fraction of the total are
+    /// printed; the children of a printed node that are below the
+    /// threshold are collapsed into a single "other" node.
+    class MetricGraph {
+        std::string m_metric_name;
+        Attribute   m_metric_attr;
+        double      m_threshold;
+        double      m_total;
+
+        std::unordered_map<cali_id_t, double> m_values;
+        std::vector<cali_id_t> m_visited;
+
+    public:
+
+        MetricGraph(const std::string& metric, double threshold)
+            : m_metric_name(metric),
+              m_metric_attr(Attribute::invalid),
+              m_threshold(threshold),
+              m_total(0.0)
+            { }
+
+        void operator()(CaliperMetadataAccessInterface& db, const EntryList& rec) {
+            if (m_metric_attr == Attribute::invalid) {
+                m_metric_attr = db.get_attribute(m_metric_name);
+
+                if (m_metric_attr == Attribute::invalid)
+                    return;
+            }
+
+            double val   = 0.0;
+            bool   found = false;
+
+            for (const Entry& e : rec)
+                if (e.is_immediate() && e.attribute() == m_metric_attr.id()) {
+                    val  += e.value().to_double();
+                    found = true;
+                }
+
+            if (!found)
+                return;
+
+            m_total += val;
+
+            // add the value to each node on the record's context paths,
+            // but only once to nodes shared by several paths
+            m_visited.clear();
+
+            for (const Entry& e : rec) {
+                if (!e.is_reference())
+                    continue;
+
+                for (const Node* node = e.node(); node && node->id() != CALI_INV_ID; node = node->parent()) {
+                    if (std::find(m_visited.begin(), m_visited.end(), node->id()) != m_visited.end())
+                        break;
+
+                    m_visited.push_back(node->id());
+                    m_values[node->id()] += val;
+                }
+            }
+        }
+
+        void print(CaliperMetadataAccessInterface& db, DotPrinter& printer) {
+            if (m_metric_attr == Attribute::invalid) {
+                cerr << "cali-graph: metric attribute " << m_metric_name << " not found" << endl;
+                return;
+            }
+            if (m_total == 0.0)
+                return;
+
+            struct Collapsed {
+                size_t count = 0;
+                double value = 0.0;
+            };
+
+            std::vector<const Node*> kept;
+            std::unordered_map<cali_id_t, Collapsed> collapsed; // by parent id
+
+            for (const auto &p : m_values) {
+                const Node* node = db.node(p.first);
+
+                if (!node)
+                    continue;
+
+                if (p.second >= m_threshold * m_total) {
+                    kept.push_back(node);
+                } else {
+                    const Node* parent = node->parent();
+                    cali_id_t   id     = (parent ? parent->id() : CALI_INV_ID);
+
+                    // only collapse the topmost pruned nodes
+                    if (id != CALI_INV_ID && m_values[id] < m_threshold * m_total)
+                        continue;
+
+                    Collapsed& c = collapsed[id];
+
+                    ++c.count;
+                    c.value += p.second;
+                }
+            }
+
+            std::sort(kept.begin(), kept.end(), [](const Node* a, const Node* b) {
+                    return a->id() < b->id();
+                });
+
+            for (const Node* node : kept)
+                printer.print_metric_node(db, node, 100.0 * m_values[node->id()] / m_total);
+
+            std::vector< std::pair<cali_id_t, Collapsed> > others(collapsed.begin(), collapsed.end());
+
+            std::sort(others.begin(), others.end(), [](const std::pair<cali_id_t, Collapsed>& a, const std::pair<cali_id_t, Collapsed>& b) {
+                    return a.first < b.first;
+                });
+
+            for (const auto &p : others)
+                printer.print_other_node(p.first, p.second.count, 100.0 * p.second.value / m_total);
+        }
+    };
     
 
     /// A node record filter that filters redundant identical node records.
@@ -251,6 +412,25 @@ int main(int argc, const char* argv[])
 
     node_proc = ::NodeFilterStep(::FilterDuplicateNodes(), node_proc);
 
+    // With --metric, aggregate the metric while reading and print the
+    // significant nodes at the end instead of streaming all nodes
+
+    std::shared_ptr<MetricGraph> metric_graph;
+
+    if (args.is_set("metric")) {
+        double threshold = 1.0;
+
+        if (args.is_set("threshold"))
+            threshold = std::stod(args.get("threshold"));
+
+        metric_graph = std::make_shared<MetricGraph>(args.get("metric"), threshold / 100.0);
+
+        node_proc = [](CaliperMetadataAccessInterface&,const Node*){ return; };
+        snap_proc = [metric_graph](CaliperMetadataAccessInterface& db, const EntryList& rec){
+            (*metric_graph)(db, rec);
+        };
+    }
+
     //
     // --- Process inputs
     //
@@ -265,12 +445,12 @@ int main(int argc, const char* argv[])
         Annotation::Guard 
             g_s(Annotation("cali-graph.stream").set(file.c_str()));
             
-        CsvReader reader(file);
-        IdMap     idmap;
-
-        if (!reader.read([&](const RecordMap& rec){ metadb.merge(rec, idmap, node_proc, snap_proc); }))
+        if (!metadb.read(file, node_proc, snap_proc))
             cerr << "Could not read file " << file << endl;
     }
 
+    if (metric_graph)
+        metric_graph->print(metadb, dotprint);
+
     dotprint.print_postfix();
 }
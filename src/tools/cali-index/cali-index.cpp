@@ -0,0 +1,144 @@
+// Copyright (c) 2016, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file cali-index.cpp
+/// A tool that writes block index files for random access into .cali files
+
+#include "caliper/tools-util/Args.h"
+
+#include "caliper/reader/RecordIndex.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+using namespace cali;
+using namespace util;
+
+namespace
+{
+    const char* usage = "cali-index [OPTION]... FILE..."
+        "\n  Write block index files for CSV .cali files."
+        "\n  cali-query --use-index uses the index to skip blocks that can't match a query.";
+
+    const Args::Table option_table[] = {
+        // name, longopt name, shortopt char, has argument, info, argument info
+        { "block-size", "block-size", 'b', true,
+          "Approximate index block size in KiB (default: 256)", "KIB"
+        },
+        { "output", "output", 'o', true,
+          "Set the index file name (default: FILE.idx; only with a single input file)", "FILE"
+        },
+        { "verbose", "verbose", 'v', false, "Be verbose",         nullptr },
+        { "help",    "help",    'h', false, "Print help message", nullptr },
+        Args::Table::Terminator
+    };
+}
+
+int main(int argc, const char* argv[])
+{
+    Args args(::option_table);
+
+    //
+    // --- Parse command line arguments
+    //
+
+    {
+        int i = args.parse(argc, argv);
+
+        if (i < argc) {
+            std::cerr << "cali-index: error: unknown option: " << argv[i] << '\n'
+                      << "  Available options: ";
+
+            args.print_available_options(std::cerr);
+
+            return -1;
+        }
+
+        if (args.is_set("help")) {
+            std::cerr << usage << "\n\n";
+
+            args.print_available_options(std::cerr);
+
+            return 0;
+        }
+    }
+
+    std::vector<std::string> files = args.arguments();
+
+    if (files.empty()) {
+        std::cerr << "cali-index: error: no input files" << std::endl;
+        return -1;
+    }
+    if (args.is_set("output") && files.size() > 1) {
+        std::cerr << "cali-index: error: --output can only be used with a single input file" << std::endl;
+        return -1;
+    }
+
+    long block_kib = std::strtol(args.get("block-size", "256").c_str(), nullptr, 10);
+
+    if (block_kib < 1) {
+        std::cerr << "cali-index: error: invalid block size " << args.get("block-size") << std::endl;
+        return -1;
+    }
+
+    bool verbose = args.is_set("verbose");
+    int  ret     = 0;
+
+    for (const std::string& file : files) {
+        RecordIndex index;
+
+        if (!index.build(file, static_cast<std::size_t>(block_kib) * 1024)) {
+            std::cerr << "cali-index: error: could not index " << file
+                      << " (binary .cali files can't be indexed)" << std::endl;
+            ret = -1;
+            continue;
+        }
+
+        std::string   idxfile = args.get("output", RecordIndex::index_filename(file));
+        std::ofstream os(idxfile.c_str());
+
+        if (!os) {
+            std::cerr << "cali-index: error: could not open " << idxfile << std::endl;
+            ret = -1;
+            continue;
+        }
+
+        index.write(os);
+
+        if (verbose)
+            std::cerr << "cali-index: wrote " << idxfile << " ("
+                      << index.blocks().size() << " blocks)" << std::endl;
+    }
+
+    return ret;
+}
@@ -0,0 +1,389 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file QueryCache.cpp
+/// QueryCache class implementation
+
+#include "QueryCache.h"
+
+#include "caliper/reader/CaliperMetadataDB.h"
+#include "caliper/reader/RecordSelector.h"
+
+#include "caliper/common/OutputStream.h"
+
+#include "caliper/common/csv/CsvWriter.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cali;
+
+namespace
+{
+
+/// \brief 64-bit FNV-1a hash of \a str
+uint64_t hash_string(const std::string& str)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (unsigned char c : str) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+/// \brief Write \a name and the size and modification time of the file to
+///   \a os. \return false if the file is not a regular file.
+bool write_file_identity(const std::string& name, std::ostream& os)
+{
+    if (name.empty())
+        return false;
+
+    struct stat st;
+
+    if (stat(name.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+
+    char  buf[PATH_MAX];
+    char* path = realpath(name.c_str(), buf);
+
+    os << "file " << (path ? path : name.c_str())
+       << ' ' << static_cast<unsigned long long>(st.st_size)
+       << ' ' << static_cast<long long>(st.st_mtime);
+#ifdef __linux__
+    os << '.' << st.st_mtim.tv_nsec;
+#endif
+    os << '\n';
+
+    return true;
+}
+
+void write_conditions(const std::vector<QuerySpec::Condition>& conditions, std::ostream& os)
+{
+    // filter conditions are a conjunction: their order doesn't matter
+    std::vector<std::string> strs;
+
+    for (const QuerySpec::Condition& c : conditions)
+        strs.push_back(std::to_string(static_cast<int>(c.op)) + ' ' + c.attr_name + '=' + c.value);
+
+    std::sort(strs.begin(), strs.end());
+
+    os << "where";
+
+    for (const std::string& s : strs)
+        os << ' ' << s.size() << ':' << s;
+
+    os << '\n';
+}
+
+} // namespace [anonymous]
+
+struct QueryCache::QueryCacheImpl
+{
+    std::string m_dir;
+    std::string m_files_key;    ///< Input file identities
+    std::string m_aggr_key;     ///< Aggregation ops and key
+    bool        m_cacheable;
+
+    std::vector<QuerySpec::Condition> m_filter;
+    /// Conditions on aggregation key attributes, which can be applied to
+    /// the aggregated records
+    std::vector<QuerySpec::Condition> m_refine;
+
+    std::string m_filename;
+
+    // state for writing a new entry
+    std::string  m_key;
+    std::string  m_tmpname;
+    OutputStream m_stream;
+    CsvWriter    m_writer;
+    bool         m_writing;
+
+    void setup(const QuerySpec& spec, const std::vector<std::string>& files) {
+        m_cacheable =
+            !m_dir.empty() && !files.empty() &&
+            spec.aggregation_ops.selection != QuerySpec::AggregationSelection::None;
+
+        if (!m_cacheable)
+            return;
+
+        {
+            std::ostringstream os;
+
+            for (const std::string& file : files)
+                if (!write_file_identity(file, os)) {
+                    m_cacheable = false;
+                    return;
+                }
+
+            m_files_key = os.str();
+        }
+
+        bool percent_total = false;
+
+        {
+            std::ostringstream os;
+
+            os << "aggregate " << static_cast<int>(spec.aggregation_ops.selection);
+
+            for (const QuerySpec::AggregationOp& op : spec.aggregation_ops.list) {
+                os << ' ' << op.op.name << '(';
+
+                for (const std::string& arg : op.args)
+                    os << arg.size() << ':' << arg;
+
+                os << ')' << op.alias.size() << ':' << op.alias;
+
+                if (std::string(op.op.name) == "percent_total")
+                    percent_total = true;
+            }
+
+            os << "\ngroup by " << static_cast<int>(spec.aggregation_key.selection);
+
+            for (const std::string& s : spec.aggregation_key.list)
+                os << ' ' << s.size() << ':' << s;
+            for (const auto& p : spec.aggregation_key_depth)
+                os << " prefix(" << p.first.size() << ':' << p.first << ',' << p.second << ')';
+
+            os << '\n';
+
+            m_aggr_key = os.str();
+        }
+
+        if (spec.filter.selection != QuerySpec::FilterSelection::List)
+            return;
+
+        // Conditions on (non-prefix) aggregation key attributes select
+        // whole aggregation groups, so they can be applied to the
+        // aggregated records instead. Not with percent_total(), which
+        // depends on the records in all groups.
+
+        const std::vector<std::string>& key = spec.aggregation_key.list;
+        bool key_list = spec.aggregation_key.selection == QuerySpec::AttributeSelection::List;
+
+        for (const QuerySpec::Condition& c : spec.filter.list) {
+            bool refinable = key_list && !percent_total &&
+                std::find(key.begin(), key.end(), c.attr_name) != key.end() &&
+                spec.aggregation_key_depth.count(c.attr_name) == 0;
+
+            (refinable ? m_refine : m_filter).push_back(c);
+        }
+    }
+
+    std::string make_key(const std::vector<QuerySpec::Condition>& filter) const {
+        std::ostringstream os;
+
+        os << m_files_key << m_aggr_key;
+        write_conditions(filter, os);
+
+        return os.str();
+    }
+
+    std::string base_filename(const std::string& key) const {
+        char buf[17];
+        std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(hash_string(key)));
+
+        return m_dir + "/" + buf;
+    }
+
+    bool read_entry(const std::string& key, CaliperMetadataDB& db, SnapshotProcessFn snap_fn) {
+        std::string base = base_filename(key);
+
+        {
+            std::ifstream is((base + ".key").c_str(), std::ios::binary);
+
+            if (!is)
+                return false;
+
+            std::string str((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+
+            if (str != key)
+                return false;
+        }
+
+        std::string filename = base + ".cali";
+
+        if (access(filename.c_str(), R_OK) != 0)
+            return false;
+
+        m_filename = filename;
+
+        return db.read(filename, [](CaliperMetadataAccessInterface&, const Node*){ }, snap_fn);
+    }
+
+    bool read(CaliperMetadataDB& db, SnapshotProcessFn snap_fn) {
+        if (!m_cacheable)
+            return false;
+
+        std::vector<QuerySpec::Condition> filter(m_filter);
+        filter.insert(filter.end(), m_refine.begin(), m_refine.end());
+
+        if (read_entry(make_key(filter), db, snap_fn))
+            return true;
+        if (m_refine.empty())
+            return false;
+
+        // Try the entry for the query without the key attribute conditions
+
+        QuerySpec spec;
+
+        spec.filter.selection = QuerySpec::FilterSelection::List;
+        spec.filter.list      = m_refine;
+
+        RecordSelector selector(spec);
+
+        return read_entry(make_key(m_filter), db, [&selector,snap_fn](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+                if (selector.pass(db, rec))
+                    snap_fn(db, rec);
+            });
+    }
+
+    void start_write() {
+        std::vector<QuerySpec::Condition> filter(m_filter);
+        filter.insert(filter.end(), m_refine.begin(), m_refine.end());
+
+        m_key      = make_key(filter);
+        m_filename = base_filename(m_key) + ".cali";
+        m_tmpname  = m_filename + ".tmp." + std::to_string(getpid());
+
+        mkdir(m_dir.c_str(), 0755);
+
+        m_stream.set_filename(m_tmpname.c_str());
+        m_writer  = CsvWriter(m_stream);
+        m_writing = true;
+    }
+
+    bool commit(CaliperMetadataAccessInterface& db) {
+        if (!m_writing)
+            return false;
+
+        m_writer.write_globals(db, db.get_globals());
+
+        bool ok = static_cast<bool>(m_stream.stream().flush());
+
+        // close the file
+        m_writer  = CsvWriter();
+        m_stream  = OutputStream();
+        m_writing = false;
+
+        std::string base    = base_filename(m_key);
+        std::string keyname = base + ".key";
+        std::string keytmp  = keyname + ".tmp." + std::to_string(getpid());
+
+        if (ok) {
+            std::ofstream os(keytmp.c_str(), std::ios::binary | std::ios::trunc);
+
+            os << m_key;
+            ok = static_cast<bool>(os.flush());
+        }
+
+        // Replace the key file first and the data file last: a reader
+        // checks the key, and only finds a data file once it's complete
+        ok = ok &&
+            std::rename(keytmp.c_str(),    keyname.c_str())    == 0 &&
+            std::rename(m_tmpname.c_str(), m_filename.c_str()) == 0;
+
+        if (!ok) {
+            unlink(keytmp.c_str());
+            unlink(m_tmpname.c_str());
+        }
+
+        return ok;
+    }
+
+    QueryCacheImpl(const std::string& dir)
+        : m_dir(dir), m_cacheable(false), m_writing(false)
+        { }
+};
+
+
+QueryCache::QueryCache(const std::string& dir, const QuerySpec& spec, const std::vector<std::string>& files)
+    : mP { new QueryCacheImpl(dir) }
+{
+    mP->setup(spec, files);
+}
+
+QueryCache::~QueryCache()
+{
+    mP.reset();
+}
+
+bool
+QueryCache::is_cacheable() const
+{
+    return mP->m_cacheable;
+}
+
+bool
+QueryCache::read(CaliperMetadataDB& db, SnapshotProcessFn snap_fn)
+{
+    return mP->read(db, snap_fn);
+}
+
+std::string
+QueryCache::filename() const
+{
+    return mP->m_filename;
+}
+
+SnapshotProcessFn
+QueryCache::writer(SnapshotProcessFn snap_fn)
+{
+    if (!mP->m_cacheable)
+        return snap_fn;
+
+    mP->start_write();
+
+    std::shared_ptr<QueryCacheImpl> p = mP;
+
+    return [p,snap_fn](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+        p->m_writer.write_snapshot(db, rec);
+        snap_fn(db, rec);
+    };
+}
+
+bool
+QueryCache::commit(CaliperMetadataAccessInterface& db)
+{
+    return mP->commit(db);
+}
@@ -0,0 +1,95 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file QueryCache.h
+/// \brief Cache for aggregated query results
+
+#pragma once
+
+#include "caliper/reader/QuerySpec.h"
+#include "caliper/reader/RecordProcessor.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cali
+{
+
+class CaliperMetadataDB;
+
+/// \brief Stores aggregated query results as .cali files in a cache directory.
+///
+/// Cache entries are keyed by the identity (path, size, and modification
+/// time) of the input files and the parts of the query that determine the
+/// aggregated records: the filter, the aggregation operators, and the
+/// aggregation key. The other parts of the query (attribute selection,
+/// sorting, and formatting) are applied to the cached records.
+///
+/// A query that adds filter conditions on aggregation key attributes to a
+/// cached query is served from the cached entry by filtering its records.
+class QueryCache
+{
+    struct QueryCacheImpl;
+    std::shared_ptr<QueryCacheImpl> mP;
+
+public:
+
+    /// \brief Set up the cache for \a spec over input \a files in
+    ///   directory \a dir.
+    QueryCache(const std::string& dir, const QuerySpec& spec, const std::vector<std::string>& files);
+
+    ~QueryCache();
+
+    /// \brief Return false if the query or the input files can't be cached,
+    ///   e.g. for non-aggregating queries or input from stdin.
+    bool is_cacheable() const;
+
+    /// \brief Read a cached result for the query into \a db and pass its
+    ///   records to \a snap_fn.
+    /// \return true if a cached result was found, false otherwise.
+    bool read(CaliperMetadataDB& db, SnapshotProcessFn snap_fn);
+
+    /// \brief Return the name of the cache file used by the last
+    ///   read() or write().
+    std::string filename() const;
+
+    /// \brief Return a snapshot processor that adds each aggregated record
+    ///   to a new cache entry and passes it on to \a snap_fn.
+    SnapshotProcessFn writer(SnapshotProcessFn snap_fn);
+
+    /// \brief Complete the cache entry started with writer().
+    /// \return true if the entry was written successfully.
+    bool commit(CaliperMetadataAccessInterface& db);
+};
+
+} // namespace cali
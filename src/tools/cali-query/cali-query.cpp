@@ -34,6 +34,7 @@
 // A basic tool for Caliper metadata queries
 
 #include "AttributeExtract.h"
+#include "QueryCache.h"
 #include "query_common.h"
 
 #include "caliper/tools-util/Args.h"
@@ -42,24 +43,28 @@
 
 #include "caliper/reader/Aggregator.h"
 #include "caliper/reader/CaliperMetadataDB.h"
+#include "caliper/reader/FilePrefetcher.h"
 #include "caliper/reader/FormatProcessor.h"
+#include "caliper/reader/RecordIndex.h"
 #include "caliper/reader/RecordProcessor.h"
 #include "caliper/reader/RecordSelector.h"
+#include "caliper/reader/SnapshotTable.h"
 
 #include "caliper/common/ContextRecord.h"
 #include "caliper/common/Node.h"
 #include "caliper/common/OutputStream.h"
 #include "caliper/common/StringConverter.h"
 
-#include "caliper/common/csv/CsvReader.h"
 #include "caliper/common/csv/CsvWriter.h"
 
 #include "caliper/common/util/split.hpp"
 
 #include <atomic>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <thread>
@@ -88,6 +93,10 @@ namespace
           "List of attributes to aggregate over (collapses all other attributes): attribute[:...]",
           "ATTRIBUTES"
         },
+        { "merge", "merge", 0, false,
+          "Merge aggregated profiles: combine count, sum#, min#, max#, and avg# attributes of matching records",
+          nullptr
+        },
         { "expand", "expand", 'e', false,  
           "Expand context records and print the selected attributes (default: all)", 
           nullptr 
@@ -124,8 +133,44 @@ namespace
           "Print given attributes in web-friendly json format",
           "ATTRIBUTES"
         },
+        { "arrow", "arrow", 0, false,
+          "Write records in the Apache Arrow IPC file format (Feather V2)",
+          nullptr
+        },
+        { "follow", "follow", 0, false,
+          "Keep reading records appended to the (CSV) input file, and print updated results",
+          nullptr
+        },
+        { "follow-interval", "follow-interval", 0, true,
+          "Seconds between checks for new records in follow mode (default: 2)",
+          "SECONDS"
+        },
+        { "use-index", "use-index", 0, false,
+          "Use FILE.idx index files written by cali-index to skip blocks that can't match the query",
+          nullptr
+        },
+        { "memory-limit", "memory-limit", 0, true,
+          "Limit aggregation memory to about MB megabytes, spilling the rest to temporary files",
+          "MB"
+        },
+        { "spill-dir", "spill-dir", 0, true,
+          "Directory for aggregation spill files (default: $TMPDIR or /tmp)",
+          "DIR"
+        },
+        { "prefetch", "prefetch", 0, true,
+          "Read up to N upcoming input files into memory in the background (default: 8, 0 disables)",
+          "N"
+        },
+        { "columnar", "columnar", 0, false,
+          "Collect records in a columnar table, and filter, aggregate (count and sum only), and sort them there",
+          nullptr
+        },
+        { "cache", "cache", 0, true,
+          "Store aggregated results in DIR and re-use them for repeated queries over unchanged files",
+          "DIR"
+        },
         { "threads", "threads", 0, true,
-          "Use this many threads (applicable only with multiple files)",
+          "Use this many threads (split across input files, and within large files)",
           "THREADS"
         },
         { "query", "query", 'q', true,
@@ -182,6 +227,34 @@ namespace
     };
 
 
+    /// Collects records and passes them on to a FormatProcessor in
+    /// batches, so stream formatters can format them in parallel
+    class FormatBatcher {
+        FormatProcessor&       m_format;
+        std::vector<EntryList> m_batch;
+
+    public:
+
+        FormatBatcher(FormatProcessor& format)
+            : m_format(format)
+            { }
+
+        void operator()(CaliperMetadataAccessInterface& db, const EntryList& rec) {
+            m_batch.push_back(rec);
+
+            if (m_batch.size() >= 65536)
+                flush(db);
+        }
+
+        void flush(CaliperMetadataAccessInterface& db) {
+            if (!m_batch.empty())
+                m_format.process_records(db, m_batch);
+
+            m_batch.clear();
+        }
+    };
+
+
     /// NodeFilterStep helper struct
     /// Basically the chain link in the processing chain.
     /// Passes result of @param m_filter_fn to @param m_push_fn
@@ -198,6 +271,118 @@ namespace
         }
     };
 
+    /// Read the blocks of the CSV file @param filename that may match the
+    /// filter in @param spec, using the file's RecordIndex.
+    /// \return false if there is no index or it is out-of-date. Otherwise,
+    ///   true, and @param ok indicates if all blocks were read.
+    bool read_with_index(CaliperMetadataDB& db, const std::string& filename, const QuerySpec& spec,
+                         NodeProcessFn node_fn, SnapshotProcessFn snap_fn,
+                         std::size_t& num_read, std::size_t& num_blocks, bool& ok)
+    {
+        std::ifstream is(RecordIndex::index_filename(filename).c_str());
+        RecordIndex   index;
+
+        if (!is || !index.read(is))
+            return false;
+
+        std::ifstream fs(filename.c_str(), std::ios::binary | std::ios::ate);
+
+        if (!fs || static_cast<std::size_t>(fs.tellg()) != index.file_size())
+            return false;
+
+        std::vector<RecordIndex::Block> blocks = index.select_blocks(spec);
+        IdMap idmap;
+
+        num_read   = blocks.size();
+        num_blocks = index.blocks().size();
+        ok         = true;
+
+        for (const RecordIndex::Block& b : blocks)
+            if (!db.read_range(filename, b.begin, b.end, idmap, node_fn, snap_fn)) {
+                ok = false;
+                break;
+            }
+
+        return true;
+    }
+
+    /// Check if the query can run on a SnapshotTable (see --columnar).
+    /// The table aggregates only count() and sum() over a list of key
+    /// attributes.
+    bool is_columnar_query(const QuerySpec& spec)
+    {
+        switch (spec.aggregation_ops.selection) {
+        case QuerySpec::AggregationSelection::None:
+            return true;
+        case QuerySpec::AggregationSelection::List:
+            if (spec.aggregation_key.selection != QuerySpec::AttributeSelection::List ||
+                !spec.aggregation_key_depth.empty())
+                return false;
+
+            for (const QuerySpec::AggregationOp& op : spec.aggregation_ops.list)
+                if (!(std::string(op.op.name) == "count" ||
+                      (std::string(op.op.name) == "sum" && op.args.size() == 1)))
+                    return false;
+
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// The read spec for --columnar queries. The table evaluates the
+    /// filter, so the reader keeps the filter attributes instead of
+    /// applying the filter itself.
+    QuerySpec columnar_read_spec(QuerySpec spec)
+    {
+        if (spec.filter.selection == QuerySpec::FilterSelection::List)
+            for (const QuerySpec::Condition& c : spec.filter.list) {
+                spec.aggregation_key.list.push_back(c.attr_name);
+                spec.attribute_selection.list.push_back(c.attr_name);
+            }
+
+        spec.filter.selection = QuerySpec::FilterSelection::None;
+        spec.filter.list.clear();
+
+        return spec;
+    }
+
+    /// Filter, aggregate, and sort the records collected in @param table,
+    /// and pass the result rows to @param push
+    void flush_columnar(CaliperMetadataAccessInterface& db, const QuerySpec& spec,
+                        const SnapshotTable& table, SnapshotProcessFn push)
+    {
+        std::vector<std::size_t> rows = table.all_rows();
+
+        if (spec.filter.selection == QuerySpec::FilterSelection::List)
+            rows = table.select(spec.filter.list, rows);
+
+        bool sort = (spec.sort.selection == QuerySpec::SortSelection::List);
+
+        if (spec.aggregation_ops.selection == QuerySpec::AggregationSelection::None) {
+            if (sort)
+                table.sort(spec.sort.list, rows);
+
+            table.push(db, rows, push);
+            return;
+        }
+
+        std::vector<std::string> sum;
+
+        for (const QuerySpec::AggregationOp& op : spec.aggregation_ops.list)
+            if (std::string(op.op.name) == "sum")
+                sum.push_back(op.args.front());
+
+        SnapshotTable result = table.aggregate(db, spec.aggregation_key.list, sum, rows);
+
+        rows = result.all_rows();
+
+        if (sort)
+            result.sort(spec.sort.list, rows);
+
+        result.push(db, rows, push);
+    }
+
 }
 
 
@@ -328,15 +513,34 @@ int main(int argc, const char* argv[])
 
     Aggregator        aggregate(spec);
 
+    if (args.is_set("memory-limit"))
+        aggregate.set_memory_limit(std::stoul(args.get("memory-limit")) * 1024 * 1024,
+                                   args.get("spill-dir", ""));
+
+    // --columnar: collect the records in a SnapshotTable, and filter,
+    //   aggregate, and sort them there in the end
+    SnapshotTable     table;
+    bool              columnar = false;
+
+    if (args.is_set("columnar")) {
+        if (args.is_set("follow") || args.is_set("list-globals") || args.is_set("list-attributes"))
+            cerr << "cali-query: --columnar can't be combined with --follow, --list-globals, or --list-attributes"
+                 << std::endl;
+        else if (!::is_columnar_query(spec))
+            cerr << "cali-query: --columnar supports only count() and sum() aggregations over a list of key attributes,"
+                 << " using the regular aggregator" << std::endl;
+        else
+            columnar = true;
+    }
+
     if (!args.is_set("list-globals")) {
-        if (spec.aggregation_ops.selection == QuerySpec::AggregationSelection::None)
+        if (columnar)
+            snap_proc = table;
+        else if (spec.aggregation_ops.selection == QuerySpec::AggregationSelection::None)
             snap_proc = format;
         else
             snap_proc = aggregate;
-    
-        if (spec.filter.selection == QuerySpec::FilterSelection::List)
-            snap_proc = SnapshotFilterStep(RecordSelector(spec), snap_proc);
-    
+
         if (args.is_set("list-attributes")) {
             node_proc = AttributeExtract(snap_proc);
             snap_proc = [](CaliperMetadataAccessInterface&,const EntryList&){ return; };
@@ -350,13 +554,17 @@ int main(int argc, const char* argv[])
     if (files.empty())
         files.push_back(""); // read from stdin if no files are given
     
+    unsigned max_threads = std::max<unsigned>(1, std::stoul(args.get("threads", "4")));
     unsigned num_threads =
-        std::min<unsigned>(files.size(), std::stoul(args.get("threads", "4")));
+        std::min<unsigned>(files.size(), max_threads);
+    // left-over threads parse chunks within each file
+    unsigned file_threads = max_threads / num_threads;
 
     if (verbose)
         std::cerr << "cali-query: Processing " << files.size()
                   << " files using "
-                  << num_threads << " thread" << (num_threads == 1 ? "." : "s.")
+                  << num_threads << " thread" << (num_threads == 1 ? "" : "s")
+                  << " (" << file_threads << " per file)."
                   << std::endl;
 
     Annotation("cali-query.num-threads", CALI_ATTR_SCOPE_PROCESS | CALI_ATTR_SKIP_EVENTS).set(static_cast<int>(num_threads));
@@ -372,7 +580,106 @@ int main(int argc, const char* argv[])
     CaliperMetadataDB     metadb;
     std::atomic<unsigned> index(0);
     std::mutex            msgmutex;
+
+    FormatBatcher         batcher(format);
+
+    //
+    // --- Result cache: read a cached aggregation result instead of the
+    //   input files if there is one
+    //
+
+    std::unique_ptr<QueryCache> cache;
+    bool cache_hit = false;
+
+    if (args.is_set("cache") && !args.is_set("follow") && !args.is_set("list-globals") && !args.is_set("list-attributes")) {
+        cache.reset(new QueryCache(args.get("cache"), spec, files));
+
+        if (!cache->is_cacheable()) {
+            if (verbose)
+                std::cerr << "cali-query: Query result can't be cached" << std::endl;
+
+            cache.reset();
+        } else {
+            cache_hit = cache->read(metadb, [&batcher](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+                    batcher(db, rec);
+                });
+
+            if (cache_hit && verbose)
+                std::cerr << "cali-query: Read cached result " << cache->filename() << std::endl;
+        }
+    }
+
+    // Let the reader drop filtered-out records and unreferenced attributes
+    if (!cache_hit && !args.is_set("list-globals") && !args.is_set("list-attributes"))
+        metadb.set_read_spec(columnar ? ::columnar_read_spec(spec) : spec);
     
+    //
+    // --- Follow mode: keep the metadata DB and aggregator, and only read
+    //   the records appended to the file since the last refresh
+    //
+
+    if (args.is_set("follow")) {
+        if (files.size() != 1 || files.front().empty() || args.is_set("list-globals") || args.is_set("list-attributes")) {
+            std::cerr << "cali-query: error: --follow requires exactly one input file"
+                      << " and can't be combined with --list-globals or --list-attributes"
+                      << std::endl;
+            return -1;
+        }
+
+        double interval = std::max(0.01, std::stod(args.get("follow-interval", "2")));
+        bool   do_aggregate = (spec.aggregation_ops.selection != QuerySpec::AggregationSelection::None);
+
+        std::size_t      offset = 0;
+        IdMap            idmap;
+        FormatProcessor* refresh_format = nullptr;
+
+        // without aggregation, print the new records with each refresh
+        SnapshotProcessFn follow_proc = snap_proc;
+
+        if (!do_aggregate)
+            follow_proc = [&refresh_format](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+                refresh_format->process_record(db, rec);
+            };
+
+        while (true) {
+            FormatProcessor refresh(spec, stream);
+            std::size_t     prev_offset = offset;
+
+            refresh_format = &refresh;
+
+            if (!metadb.read_from(files.front(), offset, idmap, node_proc, follow_proc)) {
+                std::cerr << "cali-query: Error: Could not read file " << files.front() << std::endl;
+                return -1;
+            }
+
+            if (offset != prev_offset) {
+                if (do_aggregate)
+                    aggregate.flush(metadb, refresh);
+
+                refresh.flush(metadb);
+                stream.stream() << std::flush;
+            }
+
+            refresh_format = nullptr;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<long>(interval * 1000.0)));
+        }
+    }
+
+    bool use_index = args.is_set("use-index");
+
+    // Load upcoming files in the background while earlier ones are parsed.
+    //   Not useful for a single file, and the index reader only reads some
+    //   blocks of each file.
+    std::unique_ptr<FilePrefetcher> prefetcher;
+
+    {
+        unsigned window = std::stoul(args.get("prefetch", "8"));
+
+        if (window > 0 && files.size() > 1 && !use_index && !cache_hit)
+            prefetcher.reset(new FilePrefetcher(files, std::min(window, 4u), window));
+    }
+
     auto thread_fn = [&](unsigned t) {
         Annotation::Guard
             g_t(Annotation("thread").set(static_cast<int>(t)));
@@ -390,12 +697,44 @@ int main(int argc, const char* argv[])
                 std::cerr << "cali-query: Reading " << filename << std::endl;
             }
            
-            CsvReader reader(files[i]);
-            IdMap     idmap;
+            if (use_index && !files[i].empty()) {
+                std::size_t num_read = 0, num_blocks = 0;
+                bool ok = false;
+
+                if (::read_with_index(metadb, files[i], spec, node_proc, snap_proc, num_read, num_blocks, ok)) {
+                    std::lock_guard<std::mutex>
+                        g(msgmutex);
+
+                    if (!ok)
+                        std::cerr << "cali-query: Error: Could not read file " << filename << std::endl;
+                    else if (verbose)
+                        std::cerr << "cali-query: Read " << num_read << " of " << num_blocks
+                                  << " blocks in " << filename << " using its index" << std::endl;
+
+                    continue;
+                }
+
+                if (verbose) {
+                    std::lock_guard<std::mutex>
+                        g(msgmutex);
+
+                    std::cerr << "cali-query: No valid index for " << filename
+                              << ", reading the whole file" << std::endl;
+                }
+            }
+
+            FilePrefetcher::Buffer buf;
+
+            if (prefetcher)
+                buf = prefetcher->take(i);
 
-            if (!reader.read([&](const RecordMap& rec){
-                        metadb.merge(rec, idmap, node_proc, snap_proc);
-                    })) {
+            bool ok = buf ?
+                metadb.read(files[i], buf->data(), buf->size(), node_proc, snap_proc, file_threads) :
+                metadb.read(files[i], node_proc, snap_proc, file_threads);
+
+            buf.reset();
+
+            if (!ok) {
                 std::lock_guard<std::mutex>
                     g(msgmutex);
                 
@@ -410,12 +749,19 @@ int main(int argc, const char* argv[])
     // --- Fill thread vector and process
     //
 
-    for (unsigned t = 0; t < num_threads; ++t)
-        threads.emplace_back(thread_fn, t);
+    if (!cache_hit)
+        for (unsigned t = 0; t < num_threads; ++t)
+            threads.emplace_back(thread_fn, t);
 
     for (auto &t : threads)
         t.join();
 
+    if (prefetcher && verbose)
+        std::cerr << "cali-query: Prefetched " << prefetcher->num_prefetched()
+                  << " of " << files.size() << " files" << std::endl;
+
+    prefetcher.reset();
+
     CALI_MARK_END("Processing");
     
     //
@@ -442,7 +788,30 @@ int main(int argc, const char* argv[])
             global_format.flush(metadb);
         }
     } else {
-        aggregate.flush(metadb, format);
+        if (!cache_hit) {
+            SnapshotProcessFn push = [&batcher](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+                batcher(db, rec);
+            };
+
+            if (cache)
+                push = cache->writer(push);
+
+            if (columnar)
+                ::flush_columnar(metadb, spec, table, push);
+            else
+                aggregate.flush(metadb, push);
+
+            if (cache) {
+                if (cache->commit(metadb)) {
+                    if (verbose)
+                        std::cerr << "cali-query: Wrote cached result " << cache->filename() << std::endl;
+                } else {
+                    std::cerr << "cali-query: Could not write cached result " << cache->filename() << std::endl;
+                }
+            }
+        }
+
+        batcher.flush(metadb);
         format.flush(metadb);
     }
 
@@ -166,6 +166,17 @@ parse_functioncall(std::istream& is, const QuerySpec::FunctionSignature* defs)
     return std::make_pair(retid, std::move(args));
 }
 
+void
+parse_aggregation_key(const std::string& keystr, QuerySpec& spec)
+{
+    if (keystr == "none") {
+        spec.aggregation_key.selection = QuerySpec::AttributeSelection::None;
+    } else {
+        spec.aggregation_key.selection = QuerySpec::AttributeSelection::List;
+        util::split(keystr, ',', std::back_inserter(spec.aggregation_key.list));
+    }
+}
+
 }
 
 namespace cali
@@ -179,6 +190,7 @@ QueryArgsParser::parse_args(const Args& args)
     m_spec.aggregation_ops.selection     = QuerySpec::AggregationSelection::None;
     m_spec.aggregation_key.selection     = QuerySpec::AttributeSelection::None;
     m_spec.sort.selection                = QuerySpec::SortSelection::Default;
+    m_spec.derived.selection             = QuerySpec::DerivationSelection::None;
     m_spec.format.opt                    = QuerySpec::FormatSpec::Default;
 
     m_error = false;
@@ -241,15 +253,25 @@ QueryArgsParser::parse_args(const Args& args)
         // aggregation key 
         m_spec.aggregation_key.selection = QuerySpec::AttributeSelection::Default;
         
-        if (args.is_set("aggregate-key")) {
-            std::string keystr = args.get("aggregate-key");
-
-            if (keystr == "none") {
-                m_spec.aggregation_key.selection = QuerySpec::AttributeSelection::None;
-            } else {
-                m_spec.aggregation_key.selection = QuerySpec::AttributeSelection::List;
-                util::split(keystr, ',', std::back_inserter(m_spec.aggregation_key.list));
+        if (args.is_set("aggregate-key"))
+            parse_aggregation_key(args.get("aggregate-key"), m_spec);
+    }
+
+    if (args.is_set("merge")) {
+        // add the merge op to the given query (if any)
+        const QuerySpec::FunctionSignature* defs = Aggregator::aggregation_defs();
+
+        for (int i = 0; defs && defs[i].name; ++i)
+            if (std::string(defs[i].name) == "merge") {
+                m_spec.aggregation_ops.selection = QuerySpec::AggregationSelection::List;
+                m_spec.aggregation_ops.list.emplace_back(defs[i], std::vector<std::string>(), "");
             }
+
+        if (m_spec.aggregation_key.selection == QuerySpec::AttributeSelection::None) {
+            m_spec.aggregation_key.selection = QuerySpec::AttributeSelection::Default;
+
+            if (args.is_set("aggregate-key"))
+                parse_aggregation_key(args.get("aggregate-key"), m_spec);
         }
     }
     
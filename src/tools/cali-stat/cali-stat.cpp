@@ -37,24 +37,25 @@
 
 #include "caliper/tools-util/Args.h"
 
-#include "caliper/reader/Aggregator.h"
 #include "caliper/reader/CaliperMetadataDB.h"
-#include "caliper/reader/RecordProcessor.h"
 
-#include "caliper/common/ContextRecord.h"
 #include "caliper/common/Node.h"
-#include "caliper/common/StringConverter.h"
 
-#include "caliper/common/csv/CsvReader.h"
-
-#include "caliper/common/util/split.hpp"
+#include <sys/stat.h>
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
-#include <iterator>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace cali;
 using namespace std;
@@ -70,298 +71,266 @@ namespace
         { "reuse",  "reuse-statistics", 'r', false,
           "Print tree data reuse statistics", nullptr
         },
+        { "threads", "threads", 0, true,
+          "Use this many threads (split across input files, and within large files)",
+          "THREADS"
+        },
         { "output", "output", 'o', true,  "Set the output file name", "FILE"  },
         { "help",   "help",   'h', false, "Print help message",       nullptr },
         Args::Table::Terminator
     };
 
-    class ReuseStat {
-        struct S {
-            struct ReuseInfo {
-                int              nodes; // number of nodes with this attribute
-                map<string, int> data;  // different data elements 
-            };
-            
-            std::map< cali_id_t, ReuseInfo > reuse;
-        };
-
-        std::shared_ptr<S> mS;
+    /// \brief Keeps a separate instance of \a T for each thread, which
+    ///   lets reader threads update statistics without locking.
+    ///   \a T must provide merge().
+    template<class T>
+    class ThreadPartials {
+        std::mutex                        m_lock;
+        std::vector< std::unique_ptr<T> > m_parts;
 
     public:
 
-        ReuseStat()
-            : mS(new S)
-            { }
+        T* local() {
+            thread_local std::pair<ThreadPartials*, T*> t_part { nullptr, nullptr };
 
-        void print_results(CaliperMetadataAccessInterface& db, ostream& os) {
-            os << "\nReuse statistics:\n"
-               << "Attribute                       #nodes      #elem       #uses       #uses/elem  #uses/node\n";
+            if (t_part.first != this) {
+                std::lock_guard<std::mutex>
+                    g(m_lock);
 
-            for (auto &p : mS->reuse) {
-                int nelem = static_cast<int>(p.second.data.size());
-                
-                os << std::setw(32) << db.get_attribute(p.first).name()
-                   << std::setw(12) << p.second.nodes
-                   << std::setw(12) << nelem;
+                m_parts.emplace_back(new T);
+                t_part = std::make_pair(this, m_parts.back().get());
+            }
 
-                double total_uses = 0.0;
+            return t_part.second;
+        }
 
-                for ( auto &dp : p.second.data )
-                    total_uses += dp.second;
+        /// \brief Merge all partial results. Call only when no threads
+        ///   are updating the partials anymore.
+        T merged() {
+            T res;
 
-                os << std::setw(12) << total_uses
-                   << std::setw(12) << (nelem > 0 ? total_uses / nelem : 0.0)
-                   << std::setw(12) << (total_uses / p.second.nodes)
-                   << endl;
-            }
-                
+            for (auto &p : m_parts)
+                res.merge(*p);
+
+            return res;
         }
+    };
 
-        void process_node(CaliperMetadataAccessInterface& db, const Node* node) {
-            auto it = mS->reuse.find(node->attribute());
+    class ReuseStat {
+        struct Count {
+            uint64_t records; // number of node records for this node
+            uint64_t uses;    // number of references in snapshot records
+        };
 
-            if (it == mS->reuse.end()) {
-                S::ReuseInfo info;
+        // counts by merged node id; values are looked up only for printing
+        std::unordered_map<cali_id_t, Count> m_counts;
 
-                info.nodes = 1;
-                info.data[node->data().to_string()] = 1;
+    public:
+
+        void merge(const ReuseStat& other) {
+            for (const auto &p : other.m_counts) {
+                Count& c = m_counts[p.first];
 
-                mS->reuse.insert(make_pair(node->attribute(), info));
-            } else {
-                ++(it->second.nodes);
-                ++(it->second.data[node->data().to_string()]);
+                c.records += p.second.records;
+                c.uses    += p.second.uses;
             }
         }
-        
-        void process_snapshot(const CaliperMetadataAccessInterface& db, const RecordMap& rec) {
-            auto ref_it = rec.find("ref");
 
-            int ref = ref_it == rec.end() ? 0 : static_cast<int>(ref_it->second.size());
+        void print_results(CaliperMetadataAccessInterface& db, ostream& os) {
+            struct ReuseInfo {
+                uint64_t                        nodes; // number of nodes with this attribute
+                std::unordered_set<std::string> data;  // different data elements
+                uint64_t                        uses;
+            };
+
+            std::map<cali_id_t, ReuseInfo> reuse;
 
-            if (ref_it != rec.end())
-                for ( const std::string& node_id_str : ref_it->second )
-                    for (const Node* node = db.node(StringConverter(node_id_str).to_id()); node; node = node->parent()) {
-                        auto it = mS->reuse.find(node->attribute());
+            for (const auto &p : m_counts) {
+                const Node* node = db.node(p.first);
 
-                        if (it != mS->reuse.end())
-                            ++(it->second.data[node->data().to_string()]);
-                    }   
+                if (!node)
+                    continue;
+
+                ReuseInfo& info = reuse[node->attribute()];
+
+                info.nodes += p.second.records;
+                info.uses  += p.second.records + p.second.uses;
+                info.data.insert(node->data().to_string());
+            }
+
+            os << "\nReuse statistics:\n"
+               << "Attribute                       #nodes      #elem       #uses       #uses/elem  #uses/node\n";
+
+            for (auto &p : reuse) {
+                uint64_t nelem      = p.second.data.size();
+                double   total_uses = static_cast<double>(p.second.uses);
+
+                os << std::setw(32) << db.get_attribute(p.first).name()
+                   << std::setw(12) << p.second.nodes
+                   << std::setw(12) << nelem
+                   << std::setw(12) << total_uses
+                   << std::setw(12) << (nelem > 0 ? total_uses / nelem : 0.0)
+                   << std::setw(12) << (p.second.nodes > 0 ? total_uses / p.second.nodes : 0.0)
+                   << endl;
+            }
         }
 
-        void operator()(CaliperMetadataAccessInterface& db, const RecordMap& rec) {
-            string type = get_record_type(rec);
-            
-            if      (type == "node") {
-                auto id_entry_it = rec.find("id");
+        void process_node(CaliperMetadataAccessInterface&, const Node* node) {
+            ++m_counts[node->id()].records;
+        }
 
-                if (id_entry_it != rec.end() && !id_entry_it->second.empty())
-                    process_node(db, db.node(StringConverter(id_entry_it->second.front()).to_id()));
-            } else if (type == "ctx")
-                process_snapshot(db, rec);
+        void process_snapshot(CaliperMetadataAccessInterface&, const EntryList& list) {
+            for (const Entry& e : list)
+                if (e.node())
+                    for (const Node* node = e.node(); node && node->id() != CALI_INV_ID; node = node->parent())
+                        ++m_counts[node->id()].uses;
         }
     };
     
     class CaliStreamStat {
-        struct S {
-            int n_snapshots;
-            int n_nodes;
+        uint64_t n_snapshots;
+        uint64_t n_nodes;
 
-            int n_max_snapshot; // max number of elements in snapshot record
-            int n_min_snapshot; // min number of elements in snapshot record
-            
-            int n_ref;          // number of tree reference elements
-            int n_val;          // number of immediate data elements
-            int n_tot;          // number of total data elements in ctx records
+        uint64_t n_max_snapshot; // max number of elements in snapshot record
+        uint64_t n_min_snapshot; // min number of elements in snapshot record
 
-            int n_attr_refs;    // number of attributes in snapshot records
+        uint64_t n_ref;          // number of tree reference elements
+        uint64_t n_val;          // number of immediate data elements
+        uint64_t n_tot;          // number of total data elements in ctx records
 
-            int size_nodes;     // (est.) size of all node records
-            int size_snapshots; // (est.) size of all snapshot records
-        };
+        uint64_t n_attr_refs;    // number of attributes in snapshot records
 
-        std::shared_ptr<S> mS;
+        uint64_t size_nodes;     // (est.) size of all node records
+        uint64_t size_snapshots; // (est.) size of all snapshot records
 
-        string format_size(double size) {
+        static string format_size(double size) {
             ostringstream os;
 
-            const char* postfix[] = { "", "KiB", "MiB", "GiB" };
+            const char* postfix[] = { "", "KiB", "MiB", "GiB", "TiB" };
             int p = 0;
             
-            for ( ; size > 1024 && p < 3; ++p)
+            for ( ; size > 1024 && p < 4; ++p)
                 size /= 1024;
 
             os << size << postfix[p];
 
             return os.str();
         }
+
+        static uint64_t data_size(cali_attr_type type, const Variant& v) {
+            // Get string size for usr and string data, otherwise assume 8 bytes
+            return (type == CALI_TYPE_USR || type == CALI_TYPE_STRING ? v.size() : 8);
+        }
         
     public:
 
         CaliStreamStat()
-            : mS(new S { 0, 0, 0, std::numeric_limits<int>::max(), 0, 0, 0, 0, 0, 0 } )
+            : n_snapshots(0), n_nodes(0),
+              n_max_snapshot(0), n_min_snapshot(std::numeric_limits<uint64_t>::max()),
+              n_ref(0), n_val(0), n_tot(0), n_attr_refs(0),
+              size_nodes(0), size_snapshots(0)
             { }
 
-        void print_results(ostream& os) {
+        void merge(const CaliStreamStat& other) {
+            n_snapshots    += other.n_snapshots;
+            n_nodes        += other.n_nodes;
+            n_max_snapshot  = std::max(n_max_snapshot, other.n_max_snapshot);
+            n_min_snapshot  = std::min(n_min_snapshot, other.n_min_snapshot);
+            n_ref          += other.n_ref;
+            n_val          += other.n_val;
+            n_tot          += other.n_tot;
+            n_attr_refs    += other.n_attr_refs;
+            size_nodes     += other.size_nodes;
+            size_snapshots += other.size_snapshots;
+        }
+
+        void print_results(ostream& os, uint64_t file_size) {
             os << "Number of records\n"
                << "Total          Nodes          Snapshots\n"
                << std::left
-               << std::setw(15) << mS->n_snapshots + mS->n_nodes
-               << std::setw(15) << mS->n_nodes
-               << std::setw(15) << mS->n_snapshots
+               << std::setw(15) << n_snapshots + n_nodes
+               << std::setw(15) << n_nodes
+               << std::setw(15) << n_snapshots
                << endl;
 
             os << "\nNumber of elements\n"
                << "Total          Nodes          Tree refs      Direct val\n"
-               << std::setw(15) << mS->n_tot + 4 * mS->n_nodes
-               << std::setw(15) << 4 * mS->n_nodes
-               << std::setw(15) << mS->n_ref
-               << std::setw(15) << 2 * mS->n_val
+               << std::setw(15) << n_tot + 4 * n_nodes
+               << std::setw(15) << 4 * n_nodes
+               << std::setw(15) << n_ref
+               << std::setw(15) << 2 * n_val
                << endl;
 
+            uint64_t size_total = size_nodes + size_snapshots;
+
             os << "\nData size (est.)\n"
-               << "Total          Nodes          Snapshots\n"
-               << std::setw(15) << format_size(mS->size_nodes + mS->size_snapshots)
-               << std::setw(15) << format_size(mS->size_nodes)
-               << std::setw(15) << format_size(mS->size_snapshots)
+               << "Total          Nodes          Snapshots      File size      Data/file size\n"
+               << std::setw(15) << format_size(size_total)
+               << std::setw(15) << format_size(size_nodes)
+               << std::setw(15) << format_size(size_snapshots)
+               << std::setw(15) << format_size(file_size)
+               << std::setw(15) << (file_size > 0 ? static_cast<double>(size_total) / file_size : 0.0)
                << endl;
             
-            if (mS->n_snapshots < 1)
+            if (n_snapshots < 1)
                 return;
             
             os << "\nElements/snapshot\n"
                << "Min            Max            Average\n"
-               << std::setw(15) << mS->n_min_snapshot
-               << std::setw(15) << mS->n_max_snapshot
-               << std::setw(15) << static_cast<double>(mS->n_tot) / mS->n_snapshots
+               << std::setw(15) << n_min_snapshot
+               << std::setw(15) << n_max_snapshot
+               << std::setw(15) << static_cast<double>(n_tot) / n_snapshots
                << endl;
             
             os << "\nAttributes referenced in snapshot records\n"
                << "Total          Average        Refs/Elem\n"
-               << std::setw(15) << mS->n_attr_refs
-               << std::setw(15) << static_cast<double>(mS->n_attr_refs) / mS->n_snapshots
-               << std::setw(15) << static_cast<double>(mS->n_attr_refs) / (mS->n_tot + 4 * mS->n_nodes)
+               << std::setw(15) << n_attr_refs
+               << std::setw(15) << static_cast<double>(n_attr_refs) / n_snapshots
+               << std::setw(15) << static_cast<double>(n_attr_refs) / (n_tot + 4 * n_nodes)
                << endl;
         }
 
         void process_node(CaliperMetadataAccessInterface& db, const Node* node) {
-            ++mS->n_nodes;
-
-            // Get string size for usr and string nodes, otherwise assume 8 bytes
-            cali_attr_type type = db.get_attribute(node->attribute()).type();
-            
-            mS->size_nodes += 3 * 8 +
-                (type == CALI_TYPE_USR || type == CALI_TYPE_STRING ? node->data().to_string().size() : 8);
+            ++n_nodes;
+            size_nodes += 3 * 8 + data_size(db.get_attribute(node->attribute()).type(), node->data());
         }
 
-        void process_snapshot(const CaliperMetadataAccessInterface& db, const RecordMap& rec) {
-            ++mS->n_snapshots;
-            
-            auto ref_entry_it  = rec.find("ref");
-            auto attr_entry_it = rec.find("attr");
-            auto val_entry_it  = rec.find("data");
-            
-            int ref = ref_entry_it == rec.end() ? 0 : static_cast<int>(ref_entry_it->second.size());
-            int val = val_entry_it == rec.end() ? 0 : static_cast<int>(val_entry_it->second.size());
-
-            int ref_attr = 0;
-            
-            if (ref_entry_it != rec.end())
-                for ( const std::string& node_id_str : ref_entry_it->second )
-                    for (const Node* node = db.node(StringConverter(node_id_str).to_id()); node && node->id() != CALI_INV_ID; node = node->parent())
-                        ++ref_attr;
-                    
-            mS->n_ref += ref;
-            mS->n_val += val;
-            mS->n_tot += ref + 2*val;
-
-            mS->n_min_snapshot = std::min(mS->n_min_snapshot, ref + 2*val);
-            mS->n_max_snapshot = std::max(mS->n_max_snapshot, ref + 2*val);
-
-            mS->n_attr_refs += ref_attr + val;
-
-            mS->size_snapshots += ref * 8;
-            
-            for (int i = 0; i < val; ++i) {
-                cali_attr_type type = db.get_attribute(StringConverter(attr_entry_it->second[i]).to_id()).type();
-
-                mS->size_snapshots +=
-                    (type == CALI_TYPE_USR || type == CALI_TYPE_STRING ? val_entry_it->second[i].size() : 8);
-            }
-        }        
+        void process_snapshot(CaliperMetadataAccessInterface& db, const EntryList& list) {
+            ++n_snapshots;
 
-        void operator()(CaliperMetadataAccessInterface& db, const RecordMap& rec) {
-            string type = get_record_type(rec);
-            
-            if      (type == "node") {
-                auto id_entry_it = rec.find("id");
+            uint64_t ref = 0, val = 0, ref_attr = 0;
 
-                if (id_entry_it != rec.end() && !id_entry_it->second.empty())
-                    process_node(db, db.node(StringConverter(id_entry_it->second.front()).to_id()));
-            } else if (type == "ctx")
-                process_snapshot(db, rec);
-        }
-    };
-    
-
-    /// A node record filter that filters redundant identical node records.
-    /// Redundant node records can occur when merging/unifying two streams.
-    class FilterDuplicateNodes {
-        cali_id_t       m_max_node;
+            for (const Entry& e : list) {
+                if (e.node()) {
+                    ++ref;
 
-    public:
+                    for (const Node* node = e.node(); node && node->id() != CALI_INV_ID; node = node->parent())
+                        ++ref_attr;
 
-        FilterDuplicateNodes()
-            : m_max_node { 0 }
-            { } 
-        
-        void operator()(CaliperMetadataAccessInterface& db, const RecordMap& rec, RecordProcessFn push) {
-            if (get_record_type(rec) == "node") {
-                auto id_entry_it = rec.find("id");
-
-                if (id_entry_it != rec.end() && !id_entry_it->second.empty()) {
-                    cali_id_t id = StringConverter(id_entry_it->second.front()).to_id();
-
-                    if (id != CALI_INV_ID) {
-                        if (id < m_max_node)
-                            return;
-                        else
-                            m_max_node = id;
-                    }
-                }                
+                    size_snapshots += 8;
+                } else if (e.attribute() != CALI_INV_ID) {
+                    ++val;
+                    size_snapshots += data_size(e.value().type(), e.value());
+                }
             }
 
-            push(db, rec);
-        }
-    };
-
-    /// FilterStep helper struct
-    /// Basically the chain link in the processing chain.
-    /// Passes result of @param m_filter_fn to @param m_push_fn
-    struct FilterStep {
-        RecordFilterFn  m_filter_fn; ///< This processing step
-        RecordProcessFn m_push_fn;   ///< Next processing step
+            n_ref += ref;
+            n_val += val;
+            n_tot += ref + 2*val;
 
-        FilterStep(RecordFilterFn filter_fn, RecordProcessFn push_fn) 
-            : m_filter_fn { filter_fn }, m_push_fn { push_fn }
-            { }
+            n_min_snapshot = std::min(n_min_snapshot, ref + 2*val);
+            n_max_snapshot = std::max(n_max_snapshot, ref + 2*val);
 
-        void operator ()(CaliperMetadataAccessInterface& db, const RecordMap& rec) {
-            m_filter_fn(db, rec, m_push_fn);
+            n_attr_refs += ref_attr + val;
         }
     };
 
-    struct MultiProcessor {
-        vector<RecordProcessFn> m_processors;
-
-        void add(RecordProcessFn fn) {
-            m_processors.push_back(fn);
-        }
+    uint64_t file_size(const std::string& filename)
+    {
+        struct stat s;
 
-        void operator()(CaliperMetadataAccessInterface& db, const RecordMap& rec) {
-            for (auto &f : m_processors)
-                f(db, rec);
-        }
-    };
+        return (::stat(filename.c_str(), &s) == 0 ? static_cast<uint64_t>(s.st_size) : 0);
+    }
 }
 
 
@@ -424,20 +393,27 @@ int main(int argc, const char* argv[])
     }
 
     //
-    // --- Build up processing chain (from back to front)
+    // --- Set up statistics
     //
 
-    ::ReuseStat      reuse_stat;
-    ::CaliStreamStat stream_stat;
-    
-    MultiProcessor   stats;
-    
-    if (args.is_set("reuse"))
-        stats.add(reuse_stat);
+    bool do_reuse = args.is_set("reuse");
+
+    ::ThreadPartials<::ReuseStat>      reuse_stats;
+    ::ThreadPartials<::CaliStreamStat> stream_stats;
+
+    auto node_proc = [&](CaliperMetadataAccessInterface& db, const Node* node) {
+        stream_stats.local()->process_node(db, node);
 
-    stats.add(stream_stat);
+        if (do_reuse)
+            reuse_stats.local()->process_node(db, node);
+    };
+
+    auto snap_proc = [&](CaliperMetadataAccessInterface& db, const EntryList& list) {
+        stream_stats.local()->process_snapshot(db, list);
 
-    RecordProcessFn  processor = ::FilterStep(::FilterDuplicateNodes(), stats);
+        if (do_reuse)
+            reuse_stats.local()->process_snapshot(db, list);
+    };
 
     //
     // --- Process inputs
@@ -447,19 +423,44 @@ int main(int argc, const char* argv[])
 
     CaliperMetadataDB metadb;
 
-    for (const string& file : args.arguments()) {
-        Annotation::Guard 
-            g_s(Annotation("cali-stat.stream").set(file.c_str()));
-            
-        CsvReader reader(file);
-        IdMap     idmap;
+    std::vector<std::string> files = args.arguments();
 
-        if (!reader.read([&](const RecordMap& rec){ processor(metadb, metadb.merge(rec, idmap)); }))
-            cerr << "Could not read file " << file << endl;
-    }
+    unsigned max_threads = std::max<unsigned>(1, std::stoul(args.get("threads", "4")));
+    unsigned num_threads =
+        std::max<unsigned>(1, std::min<unsigned>(files.size(), max_threads));
+    // left-over threads parse chunks within each file
+    unsigned file_threads = max_threads / num_threads;
+
+    std::atomic<unsigned> index(0);
+    std::atomic<uint64_t> total_file_size(0);
+    std::mutex            msgmutex;
+
+    auto thread_fn = [&](){
+        for (unsigned i = index++; i < files.size(); i = index++) { // "index++" is atomic read-mod-write
+            Annotation::Guard 
+                g_s(Annotation("cali-stat.stream").set(files[i].c_str()));
+
+            total_file_size += ::file_size(files[i]);
+
+            if (!metadb.read(files[i], node_proc, snap_proc, file_threads)) {
+                std::lock_guard<std::mutex>
+                    g(msgmutex);
+
+                cerr << "Could not read file " << files[i] << endl;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (unsigned t = 0; t < num_threads; ++t)
+        threads.emplace_back(thread_fn);
+
+    for (auto &t : threads)
+        t.join();
 
-    stream_stat.print_results(fs.is_open() ? fs : cout);
+    stream_stats.merged().print_results(fs.is_open() ? fs : cout, total_file_size.load());
 
-    if (args.is_set("reuse"))
-        reuse_stat.print_results(metadb, fs.is_open() ? fs : cout);
+    if (do_reuse)
+        reuse_stats.merged().print_results(metadb, fs.is_open() ? fs : cout);
 }
@@ -0,0 +1,508 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC.  
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// -- cali-bench
+//
+// Micro-benchmarks for Caliper's instrumentation hot paths.
+//
+// Each benchmark runs a fixed number of iterations on every thread
+// and reports the average cost of a single operation (in nanoseconds)
+// as seen by one thread. The benchmarks are:
+//
+//   annotation.begin_end   Nested begin/end with one annotation up to the
+//                          given nesting depth. Two ops per level.
+//   annotation.set         set() on the given number of by-value
+//                          annotations. One op per attribute.
+//   snapshot.push          Caliper::push_snapshot() with the given nesting
+//                          depth and number of by-value attributes on the
+//                          blackboard. The cost includes snapshot processing
+//                          in the enabled services (e.g., aggregate or trace).
+//   metadata.tree_growth   Nested begin/end pairs with unique values. Each
+//                          pair creates a new context tree node.
+//
+// Every combination of the given thread counts, nesting depths and
+// attribute counts is run. Results are written as JSON, one record per
+// line. With --baseline, results are compared against a previous output
+// file, and the program exits with an error if any benchmark became
+// slower than the given tolerance allows.
+
+#include <caliper/cali.h>
+
+#include <caliper/Caliper.h>
+
+#include <caliper/tools-util/Args.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+
+struct Config
+{
+    int depth;
+    int attributes;
+    int iterations;
+};
+
+struct Result
+{
+    std::string benchmark;
+    int         threads;
+    int         depth;
+    int         attributes;
+    int         iterations;
+    long long   ops;
+    double      time_sec;
+    double      ns_per_op;
+};
+
+typedef long long (*BenchmarkFn)(const Config&, int thread);
+
+//
+// --- Annotations used by the benchmarks
+//
+
+cali::Annotation*              nested_annotation = nullptr;
+cali::Annotation*              growth_annotation = nullptr;
+std::vector<cali::Annotation*> value_annotations;
+
+const int max_attributes = 64;
+
+void create_annotations()
+{
+    nested_annotation = new cali::Annotation("bench.nested");
+    growth_annotation = new cali::Annotation("bench.growth");
+
+    for (int i = 0; i < max_attributes; ++i)
+        value_annotations.push_back(new cali::Annotation((std::string("bench.value.") + std::to_string(i)).c_str(),
+                                                         CALI_ATTR_ASVALUE));
+}
+
+//
+// --- Benchmark kernels
+//
+
+long long bench_begin_end(const Config& cfg, int)
+{
+    for (int i = 0; i < cfg.iterations; ++i) {
+        for (int d = 0; d < cfg.depth; ++d)
+            nested_annotation->begin(d);
+        for (int d = 0; d < cfg.depth; ++d)
+            nested_annotation->end();
+    }
+
+    return 2LL * cfg.iterations * cfg.depth;
+}
+
+long long bench_set(const Config& cfg, int)
+{
+    for (int i = 0; i < cfg.iterations; ++i)
+        for (int a = 0; a < cfg.attributes; ++a)
+            value_annotations[a]->set(i);
+
+    for (int a = 0; a < cfg.attributes; ++a)
+        value_annotations[a]->end();
+
+    return static_cast<long long>(cfg.iterations) * cfg.attributes;
+}
+
+long long bench_push_snapshot(const Config& cfg, int)
+{
+    for (int d = 0; d < cfg.depth; ++d)
+        nested_annotation->begin(d);
+    for (int a = 0; a < cfg.attributes; ++a)
+        value_annotations[a]->set(a);
+
+    cali::Caliper c;
+
+    for (int i = 0; i < cfg.iterations; ++i)
+        c.push_snapshot(CALI_SCOPE_THREAD | CALI_SCOPE_PROCESS, nullptr);
+
+    for (int a = 0; a < cfg.attributes; ++a)
+        value_annotations[a]->end();
+    for (int d = 0; d < cfg.depth; ++d)
+        nested_annotation->end();
+
+    return cfg.iterations;
+}
+
+long long bench_tree_growth(const Config& cfg, int)
+{
+    // Use a distinct value range for each run and thread so that each
+    // begin() creates a new node. The annotations are nested, so every new
+    // node is the first child of its parent and we measure node creation
+    // rather than sibling lookup.
+    static std::atomic<int> run_counter { 0 };
+
+    int64_t base = static_cast<int64_t>(run_counter++) << 32;
+
+    for (int i = 0; i < cfg.iterations; ++i) {
+        int64_t val = base + i;
+        growth_annotation->begin(cali::Variant(CALI_TYPE_INT, &val, sizeof(val)));
+    }
+    for (int i = 0; i < cfg.iterations; ++i)
+        growth_annotation->end();
+
+    return cfg.iterations;
+}
+
+const struct BenchmarkInfo {
+    const char* name;
+    BenchmarkFn fn;
+    bool        uses_depth;
+    bool        uses_attributes;
+} benchmark_list[] = {
+    { "annotation.begin_end", bench_begin_end,     true,  false },
+    { "annotation.set",       bench_set,           false, true  },
+    { "snapshot.push",        bench_push_snapshot, true,  true  },
+    { "metadata.tree_growth", bench_tree_growth,   false, false },
+
+    { nullptr, nullptr, false, false }
+};
+
+//
+// --- Driver
+//
+
+Result run_benchmark(const BenchmarkInfo& b, int num_threads, const Config& cfg)
+{
+    std::vector<double>      times(num_threads, 0.0);
+    std::vector<long long>   ops(num_threads, 0);
+    std::vector<std::thread> threads;
+
+    auto thread_fn = [&](int t) {
+        // warm-up: create per-thread scope and tree nodes
+        Config warmup = cfg;
+        warmup.iterations = std::max(1, cfg.iterations / 10);
+        (*b.fn)(warmup, t);
+
+        auto stime = std::chrono::steady_clock::now();
+        ops[t] = (*b.fn)(cfg, t);
+        auto etime = std::chrono::steady_clock::now();
+
+        times[t] = std::chrono::duration<double>(etime - stime).count();
+    };
+
+    for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back(thread_fn, t);
+    for (auto& t : threads)
+        t.join();
+
+    Result r { b.name, num_threads, cfg.depth, cfg.attributes, cfg.iterations, 0, 0.0, 0.0 };
+
+    double total_time = 0.0;
+
+    for (int t = 0; t < num_threads; ++t) {
+        r.ops      += ops[t];
+        total_time += times[t];
+        r.time_sec  = std::max(r.time_sec, times[t]);
+    }
+
+    r.ns_per_op = r.ops > 0 ? 1e9 * total_time / r.ops : 0.0;
+
+    return r;
+}
+
+std::vector<int> parse_int_list(const std::string& str)
+{
+    std::vector<int>   ret;
+    std::istringstream is(str);
+    std::string        s;
+
+    while (std::getline(is, s, ','))
+        if (!s.empty())
+            ret.push_back(std::stoi(s));
+
+    return ret;
+}
+
+std::vector<std::string> parse_string_list(const std::string& str)
+{
+    std::vector<std::string> ret;
+    std::istringstream       is(str);
+    std::string              s;
+
+    while (std::getline(is, s, ','))
+        if (!s.empty())
+            ret.push_back(s);
+
+    return ret;
+}
+
+void write_json(std::ostream& os, const std::vector<Result>& results, const std::string& services)
+{
+    os << "[\n";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+
+        os << "{ \"benchmark\": \""  << r.benchmark
+           << "\", \"services\": \"" << services
+           << "\", \"threads\": "    << r.threads
+           << ", \"depth\": "        << r.depth
+           << ", \"attributes\": "   << r.attributes
+           << ", \"iterations\": "   << r.iterations
+           << ", \"ops\": "          << r.ops
+           << ", \"time_sec\": "     << r.time_sec
+           << ", \"ns_per_op\": "    << r.ns_per_op
+           << " }" << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+
+    os << "]" << std::endl;
+}
+
+// Extract the value of "key" from a JSON record line written by write_json()
+std::string get_field(const std::string& line, const std::string& key)
+{
+    std::string pattern = "\"" + key + "\": ";
+    auto pos = line.find(pattern);
+
+    if (pos == std::string::npos)
+        return std::string();
+
+    pos += pattern.size();
+
+    if (pos < line.size() && line[pos] == '"') {
+        auto end = line.find('"', pos + 1);
+        return line.substr(pos + 1, end == std::string::npos ? end : end - pos - 1);
+    }
+
+    auto end = line.find_first_of(",} ", pos);
+    return line.substr(pos, end == std::string::npos ? end : end - pos);
+}
+
+typedef std::tuple<std::string, int, int, int> ResultKey;
+
+std::map<ResultKey, double> read_baseline(std::istream& is)
+{
+    std::map<ResultKey, double> ret;
+    std::string line;
+
+    while (std::getline(is, line)) {
+        std::string name = get_field(line, "benchmark");
+
+        if (name.empty())
+            continue;
+
+        ResultKey key { name,
+                        std::stoi(get_field(line, "threads")),
+                        std::stoi(get_field(line, "depth")),
+                        std::stoi(get_field(line, "attributes")) };
+
+        ret[key] = std::stod(get_field(line, "ns_per_op"));
+    }
+
+    return ret;
+}
+
+// Compare results against baseline. Returns the number of regressions.
+int compare_with_baseline(const std::vector<Result>& results, const std::map<ResultKey, double>& baseline, double tolerance)
+{
+    int regressions = 0;
+
+    for (const Result& r : results) {
+        auto it = baseline.find(ResultKey { r.benchmark, r.threads, r.depth, r.attributes });
+
+        if (it == baseline.end() || it->second <= 0.0)
+            continue;
+
+        double change = 100.0 * (r.ns_per_op - it->second) / it->second;
+        bool   fail   = change > tolerance;
+
+        std::cerr << (fail ? "REGRESSION " : "ok         ")
+                  << r.benchmark
+                  << " threads=" << r.threads
+                  << " depth="   << r.depth
+                  << " attributes=" << r.attributes
+                  << ": " << r.ns_per_op << " ns/op (baseline " << it->second << " ns/op, "
+                  << (change >= 0.0 ? "+" : "") << change << "%)"
+                  << std::endl;
+
+        if (fail)
+            ++regressions;
+    }
+
+    return regressions;
+}
+
+} // namespace [anonymous]
+
+
+int main(int argc, char* argv[])
+{
+    const util::Args::Table option_table[] = {
+        { "benchmarks", "benchmarks", 'b', true,
+          "Comma-separated list of benchmarks to run. Default: all", "BENCHMARKS"
+        },
+        { "threads",    "threads",    't', true,
+          "Comma-separated list of thread counts. Default: 1", "THREADS"
+        },
+        { "depth",      "depth",      'd', true,
+          "Comma-separated list of nesting depths. Default: 1,8", "DEPTH"
+        },
+        { "attributes", "attributes", 'a', true,
+          "Comma-separated list of by-value attribute counts. Default: 1,8", "ATTRIBUTES"
+        },
+        { "iterations", "iterations", 'i', true,
+          "Iterations per thread. Default: 100000", "ITERATIONS"
+        },
+        { "services",   "services",   's', true,
+          "Caliper services to enable (e.g., aggregate or trace). Default: none", "SERVICES"
+        },
+        { "output",     "output",     'o', true,
+          "Write JSON results to this file instead of stdout", "FILE"
+        },
+        { "baseline",   "baseline",   0,   true,
+          "Compare results against a previous JSON output file", "FILE"
+        },
+        { "tolerance",  "tolerance",  0,   true,
+          "Allowed slowdown vs. baseline in percent. Default: 10", "PERCENT"
+        },
+        { "list",       "list",       'l', false,
+          "List available benchmarks", nullptr
+        },
+
+        { "help", "help", 'h', false, "Print help", nullptr },
+
+        util::Args::Table::Terminator
+    };
+
+    util::Args args(option_table);
+
+    int lastarg = args.parse(argc, argv);
+
+    if (lastarg < argc) {
+        std::cerr << "cali-bench: unknown option: " << argv[lastarg] << '\n'
+                  << "Available options: ";
+
+        args.print_available_options(std::cerr);
+
+        return 1;
+    }
+
+    if (args.is_set("help")) {
+        args.print_available_options(std::cerr);
+        return 2;
+    }
+
+    if (args.is_set("list")) {
+        for (const BenchmarkInfo* b = benchmark_list; b->name; ++b)
+            std::cout << b->name << std::endl;
+
+        return 0;
+    }
+
+    std::vector<std::string> benchmarks = parse_string_list(args.get("benchmarks"));
+    std::vector<int> thread_counts    = parse_int_list(args.get("threads",    "1"));
+    std::vector<int> depths           = parse_int_list(args.get("depth",      "1,8"));
+    std::vector<int> attribute_counts = parse_int_list(args.get("attributes", "1,8"));
+
+    int         iterations = std::stoi(args.get("iterations", "100000"));
+    std::string services   = args.get("services");
+
+    for (int n : attribute_counts)
+        if (n < 0 || n > max_attributes) {
+            std::cerr << "cali-bench: attribute count must be between 0 and "
+                      << max_attributes << std::endl;
+            return 1;
+        }
+
+    // --- Caliper setup. Must happen before Caliper is initialized.
+
+    cali_config_preset("CALI_SERVICES_ENABLE", services.c_str());
+    cali_config_preset("CALI_REPORT_FILENAME", "stderr");
+
+    create_annotations();
+
+    // --- Run benchmarks
+
+    std::vector<Result> results;
+
+    for (const BenchmarkInfo* b = benchmark_list; b->name; ++b) {
+        if (!benchmarks.empty() && std::find(benchmarks.begin(), benchmarks.end(), b->name) == benchmarks.end())
+            continue;
+
+        // only vary the parameters the benchmark actually uses
+        std::vector<int> b_depths     = b->uses_depth      ? depths           : std::vector<int>(1, 0);
+        std::vector<int> b_attributes = b->uses_attributes ? attribute_counts : std::vector<int>(1, 0);
+
+        for (int threads : thread_counts)
+            for (int depth : b_depths)
+                for (int attributes : b_attributes) {
+                    Config cfg { depth, attributes, iterations };
+
+                    CALI_MARK_BEGIN(b->name);
+                    results.push_back(run_benchmark(*b, threads, cfg));
+                    CALI_MARK_END(b->name);
+                }
+    }
+
+    // --- Output
+
+    if (args.is_set("output")) {
+        std::ofstream os(args.get("output").c_str());
+
+        if (!os) {
+            std::cerr << "cali-bench: cannot open output file " << args.get("output") << std::endl;
+            return 1;
+        }
+
+        write_json(os, results, services);
+    } else
+        write_json(std::cout, results, services);
+
+    if (args.is_set("baseline")) {
+        std::ifstream is(args.get("baseline").c_str());
+
+        if (!is) {
+            std::cerr << "cali-bench: cannot open baseline file " << args.get("baseline") << std::endl;
+            return 1;
+        }
+
+        double tolerance = std::stod(args.get("tolerance", "10"));
+
+        if (compare_with_baseline(results, read_baseline(is), tolerance) > 0)
+            return 3;
+    }
+
+    return 0;
+}
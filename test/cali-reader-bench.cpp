@@ -0,0 +1,646 @@
+// Copyright (c) 2015, Lawrence Livermore National Security, LLC.
+// Produced at the Lawrence Livermore National Laboratory.
+//
+// This file is part of Caliper.
+// Written by David Boehme, boehme3@llnl.gov.
+// LLNL-CODE-678900
+// All rights reserved.
+//
+// For details, see https://github.com/scalability-llnl/Caliper.
+// Please also see the LICENSE file for our additional BSD notice.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the disclaimer below.
+//  * Redistributions in binary form must reproduce the above copyright notice, this list of
+//    conditions and the disclaimer (as noted below) in the documentation and/or other materials
+//    provided with the distribution.
+//  * Neither the name of the LLNS/LLNL nor the names of its contributors may be used to endorse
+//    or promote products derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS
+// OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// LAWRENCE LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+// ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// -- cali-reader-bench
+//
+// Throughput benchmarks for Caliper's reader (post-processing) side.
+//
+// Generates a synthetic .cali file (or uses a given one) and measures
+// the throughput of the reader components in records and (input) bytes
+// per second:
+//
+//   metadata.read     CaliperMetadataDB::read() of the whole file, with
+//                     its built-in parallel parsing for > 1 thread
+//   select            RecordSelector::pass() on all records
+//   aggregate         Aggregator::add() and flush() on all records
+//   format.<name>     FormatProcessor with the given formatter (csv, json,
+//                     expand, table, tree) writing to a null stream.
+//                     Single-threaded.
+//
+// Except for metadata.read, the records are read into memory first and
+// only the component itself is timed. select and aggregate split the
+// records across the given number of threads.
+//
+// The synthetic data has a "region" context tree with the given number
+// of nodes and maximum depth, and the given number of by-value attributes
+// (bench.value.N, alternating int and double) in each record. Results are
+// written as JSON, one record per line. With --baseline, results are
+// compared against a previous output file, and the program exits with
+// an error if the throughput of any benchmark dropped by more than the
+// given tolerance.
+
+#include <caliper/reader/Aggregator.h>
+#include <caliper/reader/CaliperMetadataDB.h>
+#include <caliper/reader/CalQLParser.h>
+#include <caliper/reader/FormatProcessor.h>
+#include <caliper/reader/RecordSelector.h>
+
+#include <caliper/common/Node.h>
+#include <caliper/common/OutputStream.h>
+
+#include <caliper/common/csv/CsvWriter.h>
+
+#include <caliper/tools-util/Args.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+struct GeneratorConfig
+{
+    int      nodes;
+    int      depth;
+    long     records;
+    int      attributes;
+    unsigned seed;
+};
+
+struct Result
+{
+    std::string benchmark;
+    int         threads;
+    long        records;
+    size_t      bytes;
+    double      time_sec;
+    double      records_per_sec;
+    double      mb_per_sec;
+};
+
+/// A simple deterministic linear congruential generator, so that the
+/// same options always produce the same file
+struct Lcg
+{
+    uint64_t state;
+
+    uint32_t next() {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<uint32_t>(state >> 33);
+    }
+};
+
+/// Discards all output, to measure formatting without I/O
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+//
+// --- Synthetic data generator
+//
+
+bool generate(const std::string& filename, const GeneratorConfig& cfg)
+{
+    CaliperMetadataDB db;
+    IdMap             idmap;
+    Lcg               rng { cfg.seed };
+
+    Attribute region_attr =
+        db.create_attribute("region", CALI_TYPE_STRING, CALI_ATTR_NESTED);
+
+    std::vector<Attribute> value_attrs;
+
+    for (int a = 0; a < cfg.attributes; ++a)
+        value_attrs.push_back(db.create_attribute(std::string("bench.value.") + std::to_string(a),
+                                                  (a % 2 == 0) ? CALI_TYPE_INT : CALI_TYPE_DOUBLE,
+                                                  CALI_ATTR_ASVALUE));
+
+    // Build a random tree: each node's parent is a random earlier node
+    // above the maximum depth (or the root)
+
+    std::vector<const Node*> nodes;
+    std::vector<int>         depths;
+
+    for (int i = 0; i < cfg.nodes; ++i) {
+        const Node* parent = nullptr;
+        int         depth  = 1;
+
+        if (!nodes.empty() && rng.next() % 8 != 0) {
+            size_t p = rng.next() % nodes.size();
+
+            if (depths[p] < cfg.depth) {
+                parent = nodes[p];
+                depth  = depths[p] + 1;
+            }
+        }
+
+        std::string name = "region." + std::to_string(i);
+        const Node* node =
+            db.merge_node(CALI_INV_ID - 1, region_attr.id(), parent ? parent->id() : CALI_INV_ID,
+                          Variant(CALI_TYPE_STRING, name.c_str(), name.size()), idmap);
+
+        if (!node)
+            return false;
+
+        nodes.push_back(node);
+        depths.push_back(depth);
+    }
+
+    OutputStream stream;
+    stream.set_filename(filename.c_str());
+
+    CsvWriter writer(stream);
+
+    std::vector<cali_id_t> attr_ids;
+    std::vector<Variant>   values(cfg.attributes);
+
+    for (const Attribute& a : value_attrs)
+        attr_ids.push_back(a.id());
+
+    for (long r = 0; r < cfg.records; ++r) {
+        cali_id_t node_id = nodes.empty() ? CALI_INV_ID : nodes[rng.next() % nodes.size()]->id();
+
+        for (int a = 0; a < cfg.attributes; ++a)
+            values[a] = (a % 2 == 0)
+                ? Variant(static_cast<int>(rng.next() % 1000))
+                : Variant(static_cast<double>(rng.next() % 100000) / 100.0);
+
+        writer.write_snapshot(db, nodes.empty() ? 0 : 1, &node_id, cfg.attributes, attr_ids.data(), values.data());
+    }
+
+    stream.stream().flush();
+
+    return stream.stream().good();
+}
+
+size_t file_size(const std::string& filename)
+{
+    std::ifstream is(filename.c_str(), std::ios::binary | std::ios::ate);
+    return is ? static_cast<size_t>(is.tellg()) : 0;
+}
+
+//
+// --- Benchmarks
+//
+
+typedef std::vector<EntryList> RecordList;
+
+template<typename Fn>
+double time_fn(Fn fn)
+{
+    auto stime = std::chrono::steady_clock::now();
+    fn();
+    auto etime = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double>(etime - stime).count();
+}
+
+/// Run \a fn(begin, end) on \a num_threads threads over chunks of [0, n)
+template<typename Fn>
+void run_parallel(int num_threads, size_t n, Fn fn)
+{
+    if (num_threads <= 1) {
+        fn(static_cast<size_t>(0), n);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    size_t chunk = (n + num_threads - 1) / num_threads;
+
+    for (int t = 0; t < num_threads; ++t) {
+        size_t begin = std::min(n, t * chunk);
+        size_t end   = std::min(n, begin + chunk);
+
+        threads.emplace_back(fn, begin, end);
+    }
+
+    for (auto& t : threads)
+        t.join();
+}
+
+double bench_read(const std::string& filename, int threads)
+{
+    return time_fn([&](){
+            CaliperMetadataDB db;
+
+            db.read(filename,
+                    [](CaliperMetadataAccessInterface&, const Node*) { },
+                    [](CaliperMetadataAccessInterface&, const EntryList&) { },
+                    threads);
+        });
+}
+
+double bench_select(CaliperMetadataDB& db, const RecordList& records, int threads)
+{
+    RecordSelector selector("region=region.0,bench.value.0");
+
+    return time_fn([&](){
+            run_parallel(threads, records.size(), [&](size_t begin, size_t end){
+                    size_t n = 0;
+
+                    for (size_t i = begin; i < end; ++i)
+                        if (selector.pass(db, records[i]))
+                            ++n;
+
+                    // keep the loop from being optimized away
+                    if (n == records.size() + 1)
+                        std::cerr << n;
+                });
+        });
+}
+
+double bench_aggregate(CaliperMetadataDB& db, const RecordList& records, int threads)
+{
+    CalQLParser parser("SELECT region,count(),sum(bench.value.0),min(bench.value.1),max(bench.value.1) GROUP BY region");
+    Aggregator  aggregator(parser.spec());
+
+    return time_fn([&](){
+            run_parallel(threads, records.size(), [&](size_t begin, size_t end){
+                    for (size_t i = begin; i < end; ++i)
+                        aggregator.add(db, records[i]);
+                });
+
+            aggregator.flush(db, [](CaliperMetadataAccessInterface&, const EntryList&) { });
+        });
+}
+
+double bench_format(CaliperMetadataDB& db, const RecordList& records, const std::string& format)
+{
+    NullBuffer   nullbuf;
+    std::ostream nullstream(&nullbuf);
+
+    OutputStream stream;
+    stream.set_stream(&nullstream);
+
+    CalQLParser     parser((std::string("SELECT * FORMAT ") + format).c_str());
+    FormatProcessor formatter(parser.spec(), stream);
+
+    return time_fn([&](){
+            for (const EntryList& rec : records)
+                formatter.process_record(db, rec);
+
+            formatter.flush(db);
+        });
+}
+
+const char* benchmark_names[] = {
+    "metadata.read", "select", "aggregate",
+    "format.csv", "format.json", "format.expand", "format.table", "format.tree",
+    nullptr
+};
+
+//
+// --- Helpers
+//
+
+std::vector<int> parse_int_list(const std::string& str)
+{
+    std::vector<int>   ret;
+    std::istringstream is(str);
+    std::string        s;
+
+    while (std::getline(is, s, ','))
+        if (!s.empty())
+            ret.push_back(std::stoi(s));
+
+    return ret;
+}
+
+std::vector<std::string> parse_string_list(const std::string& str)
+{
+    std::vector<std::string> ret;
+    std::istringstream       is(str);
+    std::string              s;
+
+    while (std::getline(is, s, ','))
+        if (!s.empty())
+            ret.push_back(s);
+
+    return ret;
+}
+
+Result make_result(const std::string& name, int threads, long records, size_t bytes, double time_sec)
+{
+    Result r { name, threads, records, bytes, time_sec, 0.0, 0.0 };
+
+    if (time_sec > 0.0) {
+        r.records_per_sec = records / time_sec;
+        r.mb_per_sec      = bytes / time_sec / (1024.0 * 1024.0);
+    }
+
+    return r;
+}
+
+void write_json(std::ostream& os, const std::vector<Result>& results)
+{
+    os << "[\n";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+
+        os << "{ \"benchmark\": \""      << r.benchmark
+           << "\", \"threads\": "        << r.threads
+           << ", \"records\": "          << r.records
+           << ", \"bytes\": "            << r.bytes
+           << ", \"time_sec\": "         << r.time_sec
+           << ", \"records_per_sec\": "  << r.records_per_sec
+           << ", \"mb_per_sec\": "       << r.mb_per_sec
+           << " }" << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+
+    os << "]" << std::endl;
+}
+
+// Extract the value of "key" from a JSON record line written by write_json()
+std::string get_field(const std::string& line, const std::string& key)
+{
+    std::string pattern = "\"" + key + "\": ";
+    auto pos = line.find(pattern);
+
+    if (pos == std::string::npos)
+        return std::string();
+
+    pos += pattern.size();
+
+    if (pos < line.size() && line[pos] == '"') {
+        auto end = line.find('"', pos + 1);
+        return line.substr(pos + 1, end == std::string::npos ? end : end - pos - 1);
+    }
+
+    auto end = line.find_first_of(",} ", pos);
+    return line.substr(pos, end == std::string::npos ? end : end - pos);
+}
+
+typedef std::tuple<std::string, int, long> ResultKey;
+
+std::map<ResultKey, double> read_baseline(std::istream& is)
+{
+    std::map<ResultKey, double> ret;
+    std::string line;
+
+    while (std::getline(is, line)) {
+        std::string name = get_field(line, "benchmark");
+
+        if (name.empty())
+            continue;
+
+        ResultKey key { name,
+                        std::stoi(get_field(line, "threads")),
+                        std::stol(get_field(line, "records")) };
+
+        ret[key] = std::stod(get_field(line, "records_per_sec"));
+    }
+
+    return ret;
+}
+
+// Compare results against baseline. Returns the number of regressions.
+int compare_with_baseline(const std::vector<Result>& results, const std::map<ResultKey, double>& baseline, double tolerance)
+{
+    int regressions = 0;
+
+    for (const Result& r : results) {
+        auto it = baseline.find(ResultKey { r.benchmark, r.threads, r.records });
+
+        if (it == baseline.end() || it->second <= 0.0)
+            continue;
+
+        double change = 100.0 * (r.records_per_sec - it->second) / it->second;
+        bool   fail   = change < -tolerance;
+
+        std::cerr << (fail ? "REGRESSION " : "ok         ")
+                  << r.benchmark
+                  << " threads=" << r.threads
+                  << ": " << r.records_per_sec << " records/s (baseline " << it->second << " records/s, "
+                  << (change >= 0.0 ? "+" : "") << change << "%)"
+                  << std::endl;
+
+        if (fail)
+            ++regressions;
+    }
+
+    return regressions;
+}
+
+} // namespace [anonymous]
+
+
+int main(int argc, char* argv[])
+{
+    const util::Args::Table option_table[] = {
+        { "benchmarks", "benchmarks", 'b', true,
+          "Comma-separated list of benchmarks to run. Default: all", "BENCHMARKS"
+        },
+        { "threads",    "threads",    't', true,
+          "Comma-separated list of thread counts. Default: 1,4", "THREADS"
+        },
+        { "input",      "input",      0,   true,
+          "Benchmark with this .cali file instead of generating one", "FILE"
+        },
+        { "file",       "file",       'f', true,
+          "Name of the generated .cali file. Default: cali-reader-bench.cali", "FILE"
+        },
+        { "nodes",      "nodes",      'n', true,
+          "Number of context tree nodes to generate. Default: 1000", "NODES"
+        },
+        { "depth",      "depth",      'd', true,
+          "Maximum depth of the generated context tree. Default: 8", "DEPTH"
+        },
+        { "records",    "records",    'r', true,
+          "Number of snapshot records to generate. Default: 200000", "RECORDS"
+        },
+        { "attributes", "attributes", 'a', true,
+          "Number of by-value attributes per generated record. Default: 4", "ATTRIBUTES"
+        },
+        { "seed",       "seed",       0,   true,
+          "Random seed for the generator. Default: 1", "SEED"
+        },
+        { "generate",   "generate",   'g', false,
+          "Only generate the .cali file, don't run benchmarks", nullptr
+        },
+        { "output",     "output",     'o', true,
+          "Write JSON results to this file instead of stdout", "FILE"
+        },
+        { "baseline",   "baseline",   0,   true,
+          "Compare results against a previous JSON output file", "FILE"
+        },
+        { "tolerance",  "tolerance",  0,   true,
+          "Allowed throughput drop vs. baseline in percent. Default: 10", "PERCENT"
+        },
+        { "list",       "list",       'l', false,
+          "List available benchmarks", nullptr
+        },
+
+        { "help", "help", 'h', false, "Print help", nullptr },
+
+        util::Args::Table::Terminator
+    };
+
+    util::Args args(option_table);
+
+    int lastarg = args.parse(argc, argv);
+
+    if (lastarg < argc) {
+        std::cerr << "cali-reader-bench: unknown option: " << argv[lastarg] << '\n'
+                  << "Available options: ";
+
+        args.print_available_options(std::cerr);
+
+        return 1;
+    }
+
+    if (args.is_set("help")) {
+        args.print_available_options(std::cerr);
+        return 2;
+    }
+
+    if (args.is_set("list")) {
+        for (const char** b = benchmark_names; *b; ++b)
+            std::cout << *b << std::endl;
+
+        return 0;
+    }
+
+    std::vector<std::string> benchmarks    = parse_string_list(args.get("benchmarks"));
+    std::vector<int>         thread_counts = parse_int_list(args.get("threads", "1,4"));
+
+    // --- Generate input
+
+    std::string filename = args.get("input");
+
+    if (filename.empty()) {
+        GeneratorConfig cfg;
+
+        cfg.nodes      = std::max(0, std::stoi(args.get("nodes", "1000")));
+        cfg.depth      = std::max(1, std::stoi(args.get("depth", "8")));
+        cfg.records    = std::max(0L, std::stol(args.get("records", "200000")));
+        cfg.attributes = std::max(0, std::stoi(args.get("attributes", "4")));
+        cfg.seed       = static_cast<unsigned>(std::stoul(args.get("seed", "1")));
+
+        filename = args.get("file", "cali-reader-bench.cali");
+
+        if (!generate(filename, cfg)) {
+            std::cerr << "cali-reader-bench: cannot write " << filename << std::endl;
+            return 1;
+        }
+    }
+
+    if (args.is_set("generate"))
+        return 0;
+
+    size_t bytes = file_size(filename);
+
+    // --- Read the records for the in-memory benchmarks
+
+    CaliperMetadataDB db;
+    RecordList        records;
+
+    bool ok = db.read(filename,
+                      [](CaliperMetadataAccessInterface&, const Node*) { },
+                      [&records](CaliperMetadataAccessInterface&, const EntryList& rec) {
+                          records.push_back(rec);
+                      });
+
+    if (!ok) {
+        std::cerr << "cali-reader-bench: cannot read " << filename << std::endl;
+        return 1;
+    }
+
+    long num_records = static_cast<long>(records.size());
+
+    // --- Run benchmarks
+
+    auto selected = [&benchmarks](const std::string& name) {
+        return benchmarks.empty() || std::find(benchmarks.begin(), benchmarks.end(), name) != benchmarks.end();
+    };
+
+    std::vector<Result> results;
+
+    for (int threads : thread_counts) {
+        if (selected("metadata.read"))
+            results.push_back(make_result("metadata.read", threads, num_records, bytes,
+                                          bench_read(filename, threads)));
+        if (selected("select"))
+            results.push_back(make_result("select", threads, num_records, bytes,
+                                          bench_select(db, records, threads)));
+        if (selected("aggregate"))
+            results.push_back(make_result("aggregate", threads, num_records, bytes,
+                                          bench_aggregate(db, records, threads)));
+    }
+
+    // Formatters are single-threaded
+
+    for (const char** b = benchmark_names; *b; ++b) {
+        std::string name = *b;
+
+        if (name.compare(0, 7, "format.") != 0 || !selected(name))
+            continue;
+
+        results.push_back(make_result(name, 1, num_records, bytes,
+                                      bench_format(db, records, name.substr(7))));
+    }
+
+    // --- Output
+
+    if (args.is_set("output")) {
+        std::ofstream os(args.get("output").c_str());
+
+        if (!os) {
+            std::cerr << "cali-reader-bench: cannot open output file " << args.get("output") << std::endl;
+            return 1;
+        }
+
+        write_json(os, results);
+    } else
+        write_json(std::cout, results);
+
+    if (args.is_set("baseline")) {
+        std::ifstream is(args.get("baseline").c_str());
+
+        if (!is) {
+            std::cerr << "cali-reader-bench: cannot open baseline file " << args.get("baseline") << std::endl;
+            return 1;
+        }
+
+        double tolerance = std::stod(args.get("tolerance", "10"));
+
+        if (compare_with_baseline(results, read_baseline(is), tolerance) > 0)
+            return 3;
+    }
+
+    return 0;
+}
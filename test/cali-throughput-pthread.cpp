@@ -151,6 +151,9 @@ int main(int argc, const char* argv[])
         { "sleep",           "sleep",           's', true,
           "Sleep time per iteration (in microseconds)",
           "0" },
+        { "scaling",         "scaling",         0,   false,
+          "Run with 1, 2, 4, ... threads up to the given number of threads",
+          nullptr },
 
         util::Args::Table::Terminator
     };
@@ -205,33 +208,55 @@ int main(int argc, const char* argv[])
     //
     // run benchmarks
     //
- 
+
+    // With --scaling, the per-thread throughput at increasing thread
+    // counts shows how much threads slow each other down, e.g. through
+    // false sharing of per-thread runtime data.
+
+    std::vector<int> thread_counts;
+
+    if (args.is_set("scaling"))
+        for (int n = 1; n < num_threads; n *= 2)
+            thread_counts.push_back(n);
+
+    thread_counts.push_back(num_threads);
+
     std::vector<std::thread> threads;
 
     benchmark_annotation.begin("Iteration throughput test");
 
-    auto stime = std::chrono::system_clock::now();
+    for (int nthreads : thread_counts) {
+        auto stime = std::chrono::system_clock::now();
 
-    for (int run = 0; run < num_runs; ++run) {
-        cali::Annotation::Guard benchmark_run_scope(benchmark_run.set(run));
+        for (int run = 0; run < num_runs; ++run) {
+            cali::Annotation::Guard benchmark_run_scope(benchmark_run.set(run));
 
-        for (int i = 0; i < num_threads; ++i)
-            threads.push_back(std::thread(&iteration_throughput_thread, i, info));
+            for (int i = 0; i < nthreads; ++i)
+                threads.push_back(std::thread(&iteration_throughput_thread, i, info));
 
-        for (auto& t : threads)
-            t.join();
+            for (auto& t : threads)
+                t.join();
 
-        threads.clear();
-    }
+            threads.clear();
+        }
 
-    auto etime = std::chrono::system_clock::now();
+        auto etime = std::chrono::system_clock::now();
 
-    benchmark_annotation.end();
+        double usec  = std::chrono::duration_cast<std::chrono::microseconds>(etime-stime).count();
+        double iters = static_cast<double>(num_runs) * info.iterations;
+
+        std::cout << "Threads: "     << nthreads
+                  << "  Runs: "       << num_runs
+                  << "  Iterations: " << info.iterations
+                  << "  Time: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(etime-stime).count()
+                  << "msec";
+
+        if (usec > 0)
+            std::cout << "  Iterations/sec/thread: " << static_cast<uint64_t>(1e6 * iters / usec);
 
-    std::cout << "Threads: "     << num_threads 
-              << "  Runs: "       << num_runs 
-              << "  Iterations: " << info.iterations
-              << "  Time: " 
-              << std::chrono::duration_cast<std::chrono::milliseconds>(etime-stime).count() 
-              << "msec" << std::endl;
+        std::cout << std::endl;
+    }
+
+    benchmark_annotation.end();
 }
@@ -54,11 +54,87 @@ void ci_test_alloc()
   CALI_MARK_FUNCTION_END;
 }
 
+void ci_test_alloc_large()
+{
+  CALI_MARK_FUNCTION_BEGIN;
+
+  int         val_true    = 1;
+  const void* val_ptrs[1] = { &val_true};
+  size_t      val_size    = sizeof(int);
+
+  cali_id_t ptr_in_attr  = 
+    cali_create_attribute_with_metadata("ptr_in",  CALI_TYPE_ADDR, CALI_ATTR_ASVALUE,
+                                        1, &cali_class_memoryaddress_attr_id, val_ptrs, &val_size);
+
+  /* 4MiB: larger than an alloc index shard block */
+  int *B = 
+    cali_datatracker_allocate_dimensional("test_alloc_B", sizeof(int), (const size_t[]) { 1048576 }, 1);
+
+  size_t     size     = sizeof(int*);
+  int        scope    = CALI_SCOPE_PROCESS | CALI_SCOPE_THREAD;
+
+  cali_begin_byname("test_alloc.large");
+  int* B_inside  = B+786432;
+  cali_push_snapshot(scope, 1, &ptr_in_attr, (const void*[]) { &B_inside }, &size);
+  cali_end_byname("test_alloc.large");
+
+  cali_datatracker_free(B);
+
+  CALI_MARK_FUNCTION_END;
+}
+
+void ci_test_alloc_batch()
+{
+  CALI_MARK_FUNCTION_BEGIN;
+
+  int         val_true    = 1;
+  const void* val_ptrs[1] = { &val_true};
+  size_t      val_size    = sizeof(int);
+
+  cali_id_t ptr_in_attr  = 
+    cali_create_attribute_with_metadata("ptr_in",  CALI_TYPE_ADDR, CALI_ATTR_ASVALUE,
+                                        1, &cali_class_memoryaddress_attr_id, val_ptrs, &val_size);
+
+  int    C[16];
+  int    D[16];
+  size_t dims = 16;
+
+  /* C is labeled later */
+  cali_datatracker_region_t regions[2] = {
+    { D, "test_alloc_D", sizeof(int), &dims, 1 },
+    { C, NULL,           sizeof(int), &dims, 1 }
+  };
+
+  cali_datatracker_track_regions(regions, 2);
+
+  size_t     size     = sizeof(int*);
+  int        scope    = CALI_SCOPE_PROCESS | CALI_SCOPE_THREAD;
+
+  cali_begin_byname("test_alloc.batch");
+  int* D_inside  = D+3;
+  cali_push_snapshot(scope, 1, &ptr_in_attr, (const void*[]) { &D_inside }, &size);
+  cali_end_byname("test_alloc.batch");
+
+  cali_datatracker_label(C, "test_alloc_C");
+
+  cali_begin_byname("test_alloc.labeled");
+  int* C_inside  = C+5;
+  cali_push_snapshot(scope, 1, &ptr_in_attr, (const void*[]) { &C_inside }, &size);
+  cali_end_byname("test_alloc.labeled");
+
+  cali_datatracker_untrack(C);
+  cali_datatracker_untrack(D);
+
+  CALI_MARK_FUNCTION_END;
+}
+
 int main()
 {
   CALI_MARK_FUNCTION_BEGIN;
 
   ci_test_alloc();
+  ci_test_alloc_large();
+  ci_test_alloc_batch();
 
   CALI_MARK_FUNCTION_END;
 }
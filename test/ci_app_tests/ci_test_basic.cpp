@@ -20,4 +20,11 @@ int main()
     }
 
     phase_ann.end();
+
+    cali::Annotation::Region finalize = phase_ann.region("finalize");
+
+    for (int i = 0; i < 2; ++i) {
+        finalize.begin();
+        finalize.end();
+    }
 }
@@ -2,6 +2,20 @@
 
 #include "caliper/cali.h"
 
+void cached_fn()
+{
+  CALI_MARK_FUNCTION_BEGIN_CACHED;
+
+  CALI_MARK_LOOP_BEGIN_CACHED(cachedloop, "cachedloop");
+  for (int i = 0; i < 2; ++i) {
+    CALI_MARK_ITERATION_BEGIN(cachedloop, i);
+    CALI_MARK_ITERATION_END(cachedloop);
+  }
+  CALI_MARK_LOOP_END_CACHED(cachedloop);
+
+  CALI_MARK_FUNCTION_END_CACHED;
+}
+
 int main()
 {
   cali_config_preset("CALI_CALIPER_FLUSH_ON_EXIT", "false");
@@ -42,5 +56,32 @@ int main()
 
   cali_end_byname("ci_test_c_ann.setbyname");
 
+  cali_begin_byname("ci_test_c_ann.setbatch");
+
+  cali_id_t batch_attrs[3] = {
+    cali_create_attribute("batch.int", CALI_TYPE_INT,    CALI_ATTR_ASVALUE),
+    cali_create_attribute("batch.dbl", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE),
+    cali_create_attribute("batch.str", CALI_TYPE_STRING, CALI_ATTR_DEFAULT)
+  };
+  cali_variant_t batch_vals[3] = {
+    cali_make_variant_from_int(42),
+    cali_make_variant_from_double(2.5),
+    cali_make_variant(CALI_TYPE_STRING, "batch", 5)
+  };
+
+  cali_set_batch(3, batch_attrs, batch_vals);
+
+  cali_end_byname("ci_test_c_ann.setbatch");
+
+  cali_begin_string_byname("phase", "cached");
+
+  for (int i = 0; i < 3; ++i) {
+    CALI_MARK_BEGIN_CACHED(cachedregion, "ci_test_c_ann.cached");
+    cached_fn();
+    CALI_MARK_END_CACHED(cachedregion);
+  }
+
+  cali_end_byname("phase");
+
   cali_flush(CALI_FLUSH_CLEAR_BUFFERS);
 }
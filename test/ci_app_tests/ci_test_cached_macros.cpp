@@ -0,0 +1,35 @@
+// --- Caliper continuous integration test app for the cached annotation macros
+
+#include "caliper/cali.h"
+
+void bar()
+{
+    CALI_CXX_MARK_FUNCTION_CACHED;
+
+    CALI_MARK_BEGIN_CACHED(barregion, "bar-region");
+    CALI_MARK_END_CACHED(barregion);
+
+    CALI_CXX_MARK_LOOP_BEGIN_CACHED(barloop, "barloop");
+    for (int i = 0; i < 4; ++i) {
+        CALI_CXX_MARK_LOOP_ITERATION_CACHED(barloop, i);
+    }
+    CALI_CXX_MARK_LOOP_END(barloop);
+}
+
+int main()
+{
+    CALI_CXX_MARK_FUNCTION_CACHED;
+
+    CALI_CXX_MARK_LOOP_BEGIN_CACHED(mainloop, "mainloop");
+
+    // enter bar() repeatedly: later calls use the cached handles
+    for (int i = 0; i < 3; ++i) {
+        CALI_CXX_MARK_LOOP_ITERATION_CACHED(mainloop, i);
+        bar();
+    }
+
+    CALI_CXX_MARK_LOOP_END(mainloop);
+
+    // enter bar() under a different parent region
+    bar();
+}
@@ -0,0 +1,26 @@
+// --- Caliper continuous integration test app: large aggregation keys
+
+#include "caliper/Annotation.h"
+#include "caliper/common/Variant.h"
+
+#include <string>
+
+int main()
+{
+    const int num_attrs = 40;
+
+    // Set many large immediate values: with key.0 ... key.N as aggregation
+    // key attributes, this creates snapshots and keys with many entries
+
+    for (int i = 0; i < num_attrs; ++i) {
+        uint64_t val = 1000000000000ull + i;
+
+        cali::Annotation((std::string("key.") + std::to_string(i)).c_str(), CALI_ATTR_ASVALUE)
+            .set(cali::Variant(CALI_TYPE_UINT, &val, sizeof(uint64_t)));
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        cali::Annotation::Guard
+            g( cali::Annotation("function").begin("foo") );
+    }
+}
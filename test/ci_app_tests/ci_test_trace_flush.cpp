@@ -0,0 +1,55 @@
+// --- Caliper continuous integration test app: flush while threads are writing
+
+#include "caliper/cali.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdlib>
+
+std::atomic<int> num_done { 0 };
+
+void* thread_proc(void* arg)
+{
+    CALI_CXX_MARK_FUNCTION;
+
+    int iterations = *(static_cast<int*>(arg));
+
+    for (int i = 0; i < iterations; ++i) {
+        CALI_MARK_BEGIN("work");
+        CALI_MARK_END("work");
+    }
+
+    ++num_done;
+
+    return NULL;
+}
+
+// Usage: ci_test_trace_flush [iterations per thread] [signal number]
+//   Sends the signal to the process every 5ms until all threads are done.
+//   The trace service must be configured to handle it.
+
+int main(int argc, char* argv[])
+{
+    CALI_CXX_MARK_FUNCTION;
+
+    int iterations = (argc > 1 ? std::atoi(argv[1]) : 2000);
+    int signum     = (argc > 2 ? std::atoi(argv[2]) : 0);
+
+    pthread_t thread[4];
+
+    for (int i = 0; i < 4; ++i)
+        pthread_create(&thread[i], NULL, thread_proc, &iterations);
+
+    while (num_done.load() < 4) {
+        usleep(5000);
+
+        if (signum > 0)
+            kill(getpid(), signum);
+    }
+
+    for (int i = 0; i < 4; ++i)
+        pthread_join(thread[i], NULL);
+}
@@ -1,5 +1,8 @@
 # Basic smoke tests: aggregation
 
+import os
+import shutil
+import subprocess
 import unittest
 
 import calipertest as calitest
@@ -66,6 +69,25 @@ class CaliperAggregationTest(unittest.TestCase):
                 'iteration': '3',
                 'count': '1' }))
 
+    def test_aggregate_prefix_key(self):
+        target_cmd = [ './ci_test_macros' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'aggregate:event:recorder',
+            'CALI_AGGREGATE_KEY'     : 'prefix(function,1)',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, { 'function': 'main', 'count': '27' }))
+        self.assertFalse(calitest.has_snapshot_with_attributes(
+            snapshots, { 'function': 'main/foo' }))
+
     def test_aggregate_attributes(self):
         target_cmd = [ './ci_test_aggregate' ]
         query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
@@ -89,5 +111,440 @@ class CaliperAggregationTest(unittest.TestCase):
         self.assertFalse(calitest.has_snapshot_with_keys(
             snapshots, [ 'sum#time.inclusive.duration' ] ))
 
+    def test_aggregate_hash_key_index(self):
+        target_cmd = [ './ci_test_aggregate' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'aggregate:event:recorder:timestamp',
+            'CALI_TIMER_SNAPSHOT_DURATION' : 'true',
+            'CALI_AGGREGATE_KEY_INDEX' : 'hash',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(calitest.has_snapshot_with_keys(
+            snapshots, [ 'loop.id', 'function', 
+                         'sum#time.duration',
+                         'count' ] ))
+
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#function': 'foo', 
+                'loop.id': 'A',
+                'count': '6' }))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#function': 'foo', 
+                'loop.id': 'B',
+                'count': '4' }))
+
+    def test_aggregate_histogram(self):
+        target_cmd = [ './ci_test_aggregate' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'aggregate:event:recorder:timestamp',
+            'CALI_TIMER_SNAPSHOT_DURATION' : 'true',
+            'CALI_AGGREGATE_KEY'     : 'event.end#function:loop.id',
+            'CALI_AGGREGATE_HISTOGRAM' : 'time.duration',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(calitest.has_snapshot_with_keys(
+            snapshots, [ 'loop.id', 'avg#time.duration', 'count' ] ))
+
+        foo_b = [ s for s in snapshots
+                  if s.get('event.end#function') == 'foo' and s.get('loop.id') == 'B' ]
+
+        self.assertEqual(len(foo_b), 1)
+
+        # every time.duration value falls into exactly one bin
+        bins = [ int(v) for k, v in foo_b[0].items() if k.startswith('histogram.bin.') ]
+
+        self.assertTrue(len(bins) > 0)
+        self.assertEqual(sum(bins), 4)
+
+    def test_aggregate_count_distinct(self):
+        target_cmd = [ './ci_test_aggregate' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'aggregate:event:recorder',
+            'CALI_AGGREGATE_KEY'     : 'event.end#function:loop.id',
+            'CALI_AGGREGATE_COUNT_DISTINCT' : 'iteration',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#function': 'foo',
+                'loop.id': 'A',
+                'count_distinct#iteration': '3' }))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#function': 'foo',
+                'loop.id': 'B',
+                'count_distinct#iteration': '4' }))
+
+    def test_aggregate_loop_time_slices(self):
+        target_cmd = [ './ci_test_macros' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'aggregate:event:recorder',
+            'CALI_AGGREGATE_KEY'     : 'event.end#iteration#mainloop',
+            'CALI_AGGREGATE_LOOP'    : 'mainloop',
+            'CALI_AGGREGATE_LOOP_ITERATIONS' : '2',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#iteration#mainloop': '1',
+                'aggregate.epoch': '0',
+                'count': '1' }))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#iteration#mainloop': '2',
+                'aggregate.epoch': '1',
+                'count': '1' }))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'aggregate.epoch': '2' }))
+
+    def test_aggregate_large_key(self):
+        target_cmd = [ './ci_test_large_key' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        key = ':'.join([ 'function' ] + [ 'key.' + str(i) for i in range(40) ])
+
+        for key_index in [ 'trie', 'hash' ]:
+            caliper_config = {
+                'CALI_SERVICES_ENABLE'     : 'aggregate:event:recorder',
+                'CALI_AGGREGATE_KEY'       : key,
+                'CALI_AGGREGATE_KEY_INDEX' : key_index,
+                'CALI_RECORDER_FILENAME'   : 'stdout',
+                'CALI_LOG_VERBOSITY'       : '0'
+            }
+
+            query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+            snapshots = calitest.get_snapshots_from_text(query_output)
+
+            self.assertTrue(calitest.has_snapshot_with_attributes(
+                snapshots, {
+                    'function': 'foo',
+                    'key.0'   : '1000000000000',
+                    'key.39'  : '1000000000039',
+                    'count'   : '3' }))
+
+    def test_aggregate_kernels(self):
+        target_cmd = [ './ci_test_aggregate' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'aggregate:event:recorder:timestamp',
+            'CALI_TIMER_SNAPSHOT_DURATION' : 'true',
+            'CALI_TIMER_INCLUSIVE_DURATION' : 'true',
+            'CALI_AGGREGATE_KERNELS' : 'sum,time.inclusive.duration=min+max',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(calitest.has_snapshot_with_keys(
+            snapshots, [ 'loop.id', 'function',
+                         'min#time.inclusive.duration',
+                         'max#time.inclusive.duration',
+                         'sum#time.duration',
+                         'count' ] ))
+        self.assertFalse(calitest.has_snapshot_with_keys(
+            snapshots, [ 'sum#time.inclusive.duration' ]))
+        self.assertFalse(calitest.has_snapshot_with_keys(
+            snapshots, [ 'min#time.duration' ]))
+        self.assertFalse(calitest.has_snapshot_with_keys(
+            snapshots, [ 'avg#time.duration' ]))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#function': 'foo',
+                'loop.id': 'A',
+                'count': '6' }))
+
+    def test_aggregate_fused_timing(self):
+        target_cmd = [ './ci_test_aggregate' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'aggregate:recorder',
+            'CALI_AGGREGATE_FUSED_TIMING' : 'true',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(calitest.has_snapshot_with_keys(
+            snapshots, [ 'loop.id', 'function',
+                         'sum#time.inclusive.duration',
+                         'min#time.inclusive.duration',
+                         'max#time.inclusive.duration',
+                         'count' ] ))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'function': 'foo',
+                'loop.id': 'A',
+                'count': '6' }))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'function': 'foo',
+                'loop.id': 'B',
+                'count': '4' }))
+        self.assertFalse(calitest.has_snapshot_with_keys(
+            snapshots, [ 'event.end#function' ]))
+
+    def test_aggregate_merge_threads(self):
+        target_cmd = [ './ci_test_thread' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'aggregate:event:recorder',
+            'CALI_AGGREGATE_KEY'     : 'function:event.end#function:my_thread_id',
+            'CALI_AGGREGATE_MERGE_THREADS' : 'true',
+            'CALI_AGGREGATE_MERGE_DROP'    : 'my_thread_id',
+            'CALI_AGGREGATE_MERGE_WORKERS' : '2',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#function': 'thread_proc',
+                'function': 'thread_proc',
+                'count': '4' }))
+        self.assertFalse(calitest.has_snapshot_with_keys(
+            snapshots, [ 'my_thread_id' ]))
+    def test_aggregate_counter(self):
+        target_cmd = [ './ci_test_counter' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'      : 'aggregate:event:recorder',
+            'CALI_AGGREGATE_ATTRIBUTES' : 'counter.val',
+            'CALI_RECORDER_FILENAME'    : 'stdout',
+            'CALI_LOG_VERBOSITY'        : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'phase'           : 'A',
+                'sum#counter.val' : '2000.000000',
+                'count'           : '1' }))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'phase'           : 'B',
+                'sum#counter.val' : '40.000000' }))
+
+    def test_aggregate_shared_memory(self):
+        target_cmd = [ './ci_test_aggregate' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'aggregate:event:recorder:timestamp',
+            'CALI_TIMER_SNAPSHOT_DURATION'  : 'true',
+            'CALI_TIMER_INCLUSIVE_DURATION' : 'true',
+            'CALI_AGGREGATE_SHARED_MEMORY'  : 'true',
+            'CALI_AGGREGATE_SHM_FILE'       : 'aggregate_shm_single.tmp',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(calitest.has_snapshot_with_keys(
+            snapshots, [ 'loop.id', 'function',
+                         'sum#time.inclusive.duration',
+                         'avg#time.inclusive.duration',
+                         'count' ] ))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#function': 'foo',
+                'loop.id': 'A',
+                'count': '6' }))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#function': 'foo',
+                'loop.id': 'B',
+                'count': '4' }))
+
+    def test_aggregate_shared_memory_multiprocess(self):
+        # Processes that overlap share one table; the others each create
+        # their own. Either way, the counts must add up.
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'aggregate:event:recorder',
+            'CALI_AGGREGATE_SHARED_MEMORY' : 'true',
+            'CALI_AGGREGATE_SHM_FILE'      : 'aggregate_shm_multi.tmp',
+            'CALI_AGGREGATE_SHM_TIMEOUT'   : '2',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        files = [ 'aggregate_shm_' + str(i) + '.cali' for i in range(3) ]
+        procs = []
+
+        for filename in files:
+            env = dict(caliper_config)
+            env['CALI_RECORDER_FILENAME'] = filename
+            procs.append(subprocess.Popen([ './ci_test_aggregate' ], env=env))
+
+        for proc in procs:
+            self.assertEqual(proc.wait(), 0)
+
+        query_cmd = [ '../../src/tools/cali-query/cali-query', '-e',
+                      '-q', 'select event.end#function,loop.id,sum(count) group by event.end#function,loop.id' ]
+
+        query_output = calitest.run_test(query_cmd + files, {})
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        for filename in files:
+            os.remove(filename)
+
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#function': 'foo',
+                'loop.id': 'A',
+                'count': '18' }))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#function': 'foo',
+                'loop.id': 'B',
+                'count': '12' }))
+
+    def test_query_cache(self):
+        """ Re-use aggregated results with cali-query --cache """
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'event:recorder:trace',
+            'CALI_RECORDER_FILENAME' : 'query_cache_input.cali',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        calitest.run_test([ './ci_test_aggregate' ], caliper_config)
+
+        cache_dir = 'query_cache.tmp'
+        query     = 'select event.end#function,loop.id,count() where event.end#function group by event.end#function,loop.id'
+        query_cmd = [ '../../src/tools/cali-query/cali-query', '-e', '-q' ]
+
+        uncached = calitest.run_test(query_cmd + [ query, 'query_cache_input.cali' ], {})
+        first    = calitest.run_test(query_cmd + [ query, '--cache', cache_dir, 'query_cache_input.cali' ], {})
+        cached   = calitest.run_test(query_cmd + [ query, '--cache', cache_dir, 'query_cache_input.cali' ], {})
+
+        cache_files = os.listdir(cache_dir)
+
+        # additional filter on a key attribute: served from the cached result
+        refined  = calitest.run_test(query_cmd + [ query.replace('where ', 'where loop.id=A,'), '--cache', cache_dir, 'query_cache_input.cali' ], {})
+
+        shutil.rmtree(cache_dir)
+        os.remove('query_cache_input.cali')
+
+        # the order of aggregated records may differ between runs
+        self.assertEqual(sorted(first.splitlines()),  sorted(uncached.splitlines()))
+        self.assertEqual(sorted(cached.splitlines()), sorted(uncached.splitlines()))
+        self.assertEqual(len([ f for f in cache_files if f.endswith('.cali') ]), 1)
+
+        snapshots = calitest.get_snapshots_from_text(refined)
+
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#function': 'foo',
+                'loop.id': 'A',
+                'count': '6' }))
+        self.assertFalse(any(s.get('loop.id') == 'B' for s in snapshots))
+
+    def test_query_columnar(self):
+        """ Filter and aggregate in a columnar table with cali-query --columnar """
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'event:recorder:trace',
+            'CALI_RECORDER_FILENAME' : 'query_columnar_input.cali',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        calitest.run_test([ './ci_test_aggregate' ], caliper_config)
+
+        query_cmd = [ '../../src/tools/cali-query/cali-query', '-e', '-q' ]
+        queries   = [
+            'select event.end#function,loop.id,count() where event.end#function group by event.end#function,loop.id',
+            'select loop.id,iteration,event.end#function where loop.id=A,not event.begin#function order by iteration'
+        ]
+
+        for query in queries:
+            regular  = calitest.run_test(query_cmd + [ query, 'query_columnar_input.cali' ], {})
+            columnar = calitest.run_test(query_cmd + [ query, '--columnar', 'query_columnar_input.cali' ], {})
+
+            # the attribute and record order may differ
+            expect = sorted(sorted(s.items()) for s in calitest.get_snapshots_from_text(regular))
+            result = sorted(sorted(s.items()) for s in calitest.get_snapshots_from_text(columnar))
+
+            self.assertTrue(len(expect) > 0)
+            self.assertEqual(result, expect)
+
+        os.remove('query_columnar_input.cali')
+
+    def test_topdown(self):
+        target_cmd = [ './ci_test_topdown' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        events = [ 'CPU_CLK_UNHALTED.THREAD_P', 'UOPS_RETIRED.RETIRE_SLOTS', 'UOPS_ISSUED.ANY',
+                   'INT_MISC.RECOVERY_CYCLES', 'IDQ_UOPS_NOT_DELIVERED.CORE' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'      : 'aggregate:event:recorder:topdown',
+            'CALI_AGGREGATE_ATTRIBUTES' : ':'.join([ 'libpfm.counter.' + e for e in events ]),
+            'CALI_TOPDOWN_ARCH'         : 'ivybridge',
+            'CALI_TOPDOWN_LEVEL'        : '1',
+            'CALI_RECORDER_FILENAME'    : 'stdout',
+            'CALI_LOG_VERBOSITY'        : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {
+                'phase'                   : 'A',
+                'topdown.retiring'        : '0.500000',
+                'topdown.bad_speculation' : '0.150000',
+                'topdown.frontend_bound'  : '0.200000',
+                'topdown.backend_bound'   : '0.150000' }))
+
+        # only the derived metrics are written by default
+        self.assertFalse(any(k.startswith('sum#libpfm.counter') for s in snapshots for k in s))
+
+        # level 1 only
+        self.assertFalse(any('topdown.frontend_latency' in s for s in snapshots))
+
+
 if __name__ == "__main__":
     unittest.main()
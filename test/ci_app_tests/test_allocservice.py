@@ -21,7 +21,7 @@ class CaliperAllocServiceTest(unittest.TestCase):
         query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
         snapshots = cat.get_snapshots_from_text(query_output)
 
-        self.assertTrue(len(snapshots) == 5)
+        self.assertTrue(len(snapshots) == 14)
 
         # test allocated.0
 
@@ -61,6 +61,32 @@ class CaliperAllocServiceTest(unittest.TestCase):
         self.assertFalse(cat.has_snapshot_with_keys(
             snapshots, { 'test_alloc.freed', 'alloc.uid#ptr_in' }))
 
+        # test large allocation
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {'test_alloc.large'       : 'true',
+                        'alloc.uid#ptr_in'       : '2',
+                        'alloc.index#ptr_in'     : '786432',
+                        'alloc.label#ptr_in'     : 'test_alloc_B'
+                    }))
+
+        # test batch registration and deferred labeling
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {'test_alloc.batch'       : 'true',
+                        'alloc.uid#ptr_in'       : '3',
+                        'alloc.index#ptr_in'     : '3',
+                        'alloc.label#ptr_in'     : 'test_alloc_D'
+                    }))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {'test_alloc.labeled'     : 'true',
+                        'alloc.uid#ptr_in'       : '4',
+                        'alloc.index#ptr_in'     : '5',
+                        'alloc.label#ptr_in'     : 'test_alloc_C'
+                    }))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {'mem.alloc' : 'test_alloc_C', 'alloc.uid' : '4' }))
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -29,6 +29,158 @@ class CaliperBasicTraceTest(unittest.TestCase):
             snapshots, {'event.end#phase': 'initialization', 'phase': 'initialization'}))
         self.assertTrue(cat.has_snapshot_with_attributes(
             snapshots, {'event.end#iteration': '3', 'iteration': '3', 'phase': 'loop'}))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {'event.end#phase': 'finalize', 'phase': 'finalize'}))
+
+    def test_async_recorder(self):
+        target_cmd = [ './ci_test_basic' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'    : 'serial-trace',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_RECORDER_ASYNC'    : 'true',
+            'CALI_RECORDER_ASYNC_BUFFER_SIZE' : '1',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertTrue(len(snapshots) > 10)
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {'event.end#phase': 'initialization', 'phase': 'initialization'}))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {'event.end#iteration': '3', 'iteration': '3', 'phase': 'loop'}))
+
+    def test_binary_format(self):
+        target_cmd = [ './ci_test_basic' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'    : 'serial-trace',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_RECORDER_FORMAT'   : 'binary',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertTrue(len(snapshots) > 10)
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {'event.end#phase': 'initialization', 'phase': 'initialization'}))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {'event.end#iteration': '3', 'iteration': '3', 'phase': 'loop'}))
+
+    def test_delta_encoding(self):
+        """ Delta-encoded trace buffers must decode to the same records """
+        target_cmd = [ './ci_test_basic' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e', '--threads=1' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'       : 'serial-trace',
+            'CALI_RECORDER_FILENAME'    : 'stdout',
+            'CALI_LOG_VERBOSITY'        : '0'
+        }
+
+        plain_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+
+        caliper_config['CALI_TRACE_DELTA_ENCODING'] = 'true'
+
+        delta_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+
+        # timestamps differ between runs
+        def without_times(output):
+            records = []
+            for s in cat.get_snapshots_from_text(output):
+                records.append(sorted((k, v) for k, v in s.items() if not k.startswith('time.')))
+            return sorted(records)
+
+        self.assertTrue(len(cat.get_snapshots_from_text(delta_output)) > 10)
+        self.assertEqual(without_times(plain_output), without_times(delta_output))
+
+    def test_spill_policy(self):
+        """ The spill buffer policy must produce the same records """
+        target_cmd = [ './ci_test_basic' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e', '--threads=1' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'       : 'serial-trace',
+            'CALI_RECORDER_FILENAME'    : 'stdout',
+            'CALI_LOG_VERBOSITY'        : '0'
+        }
+
+        plain_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+
+        caliper_config['CALI_TRACE_BUFFER_POLICY'] = 'spill'
+        caliper_config['CALI_TRACE_BUFFER_SIZE']   = '1'
+        caliper_config['CALI_TRACE_MEMORY_LIMIT']  = '1'
+
+        spill_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+
+        def without_times(output):
+            records = []
+            for s in cat.get_snapshots_from_text(output):
+                records.append(sorted((k, v) for k, v in s.items() if not k.startswith('time.')))
+            return sorted(records)
+
+        self.assertTrue(len(cat.get_snapshots_from_text(spill_output)) > 10)
+        self.assertEqual(without_times(plain_output), without_times(spill_output))
+
+    def test_ring_policy(self):
+        """ The ring buffer policy must keep all records while the buffer isn't full """
+        target_cmd = [ './ci_test_basic' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e', '--threads=1' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'       : 'serial-trace',
+            'CALI_RECORDER_FILENAME'    : 'stdout',
+            'CALI_LOG_VERBOSITY'        : '0'
+        }
+
+        plain_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+
+        caliper_config['CALI_TRACE_BUFFER_POLICY'] = 'ring'
+        caliper_config['CALI_TRACE_BUFFER_SIZE']   = '1'
+        caliper_config['CALI_TRACE_RING_SIZE']     = '2'
+        caliper_config['CALI_TRACE_FLUSH_SIGNAL']  = 'USR2'
+
+        ring_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+
+        def without_times(output):
+            records = []
+            for s in cat.get_snapshots_from_text(output):
+                records.append(sorted((k, v) for k, v in s.items() if not k.startswith('time.')))
+            return sorted(records)
+
+        self.assertTrue(len(cat.get_snapshots_from_text(ring_output)) > 10)
+        self.assertEqual(without_times(plain_output), without_times(ring_output))
+
+    def test_small_node_blocks(self):
+        """ Node storage must grow beyond the initial number of node blocks """
+        target_cmd = [ './ci_test_basic' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'    : 'serial-trace',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_CONTEXTTREE_NUM_BLOCKS'      : '1',
+            'CALI_CONTEXTTREE_NODES_PER_BLOCK' : '16',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertTrue(len(snapshots) > 10)
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {'event.end#phase': 'initialization', 'phase': 'initialization'}))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {'event.end#iteration': '3', 'iteration': '3', 'phase': 'loop'}))
 
     def test_globals(self):
         target_cmd = [ './ci_test_basic' ]
@@ -94,6 +246,40 @@ class CaliperBasicTraceTest(unittest.TestCase):
                 'loop'       : 'mainloop/fooloop',
                 'iteration#fooloop' : '3' }))
         
+    def test_cached_macros(self):
+        target_cmd = [ './ci_test_cached_macros' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'    : 'serial-trace',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {
+                'function'   : 'main/bar',
+                'loop'       : 'mainloop',
+                'iteration#mainloop' : '2',
+                'annotation' : 'bar-region' }))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {
+                'function'   : 'main/bar',
+                'loop'       : 'mainloop/barloop',
+                'iteration#mainloop' : '2',
+                'iteration#barloop'  : '3' }))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {
+                'function'   : 'main/bar',
+                'loop'       : 'barloop',
+                'iteration#barloop'  : '3' }))
+        self.assertFalse(cat.has_snapshot_with_attributes(
+            snapshots, {
+                'function'   : 'main/bar/bar' }))
+
     def test_property_override(self):
         target_cmd = [ './ci_test_macros' ]
         query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e', '--list-attributes' ]
@@ -155,6 +341,277 @@ class CaliperBasicTraceTest(unittest.TestCase):
         self.assertTrue(cat.has_snapshot_with_attributes(
             snapshots, { 'testbinding' : 'binding.nested=outer/binding.nested=inner' }))
 
+    def test_counter(self):
+        target_cmd = [ './ci_test_counter' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'    : 'serial-trace',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0',
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'event.end#phase' : 'A', 'counter.val' : '2000' }))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'event.end#phase' : 'B', 'counter.val' : '40' }))
+
+    def test_loop_statistics(self):
+        target_cmd = [ './ci_test_macros' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'         : 'serial-trace',
+            'CALI_RECORDER_FILENAME'      : 'stdout',
+            'CALI_LOG_VERBOSITY'          : '0',
+            'CALI_EVENT_LOOP_STATISTICS'  : 'mainloop:fooloop',
+            'CALI_EVENT_LOOP_SNAPSHOT_INTERVAL' : '3'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        # no snapshots for single iterations
+        self.assertFalse(cat.has_snapshot_with_keys(
+            snapshots, { 'event.begin#iteration#mainloop' }))
+        self.assertFalse(cat.has_snapshot_with_keys(
+            snapshots, { 'event.begin#iteration#fooloop' }))
+
+        # every 3rd iteration and at loop end
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'event.end#iteration#mainloop' : '2',
+                         'loop.iterations' : '3' }))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'event.end#loop' : 'mainloop',
+                         'loop.iterations' : '1' }))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'event.end#loop' : 'fooloop',
+                         'loop.iterations' : '1' }))
+        self.assertTrue(cat.has_snapshot_with_keys(
+            snapshots, { 'event.end#loop',
+                         'loop.iteration.duration.sum',
+                         'loop.iteration.duration.min',
+                         'loop.iteration.duration.max' }))
+
+
+    def test_exclusive_duration(self):
+        target_cmd = [ './ci_test_basic' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'          : 'event:timestamp:trace:recorder',
+            'CALI_TIMER_EXCLUSIVE_DURATION' : 'true',
+            'CALI_RECORDER_FILENAME'        : 'stdout',
+            'CALI_LOG_VERBOSITY'            : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        iterations = [ s for s in snapshots if 'event.end#iteration' in s ]
+        loop = [ s for s in snapshots if s.get('event.end#phase') == 'loop' ]
+
+        self.assertEqual(len(iterations), 4)
+        self.assertEqual(len(loop), 1)
+
+        for s in iterations:
+            self.assertEqual(s['time.exclusive.duration'], s['time.inclusive.duration'])
+
+        self.assertTrue(int(loop[0]['time.exclusive.duration']) <= int(loop[0]['time.inclusive.duration']))
+
+    def test_trace_regions(self):
+        """ Aggregate everything, but only trace the selected region """
+        target_cmd = [ './ci_test_basic' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'        : 'aggregate:event:trace:recorder',
+            'CALI_TRACE_REGIONS'          : 'phase=loop',
+            'CALI_RECORDER_FILENAME'      : 'stdout',
+            'CALI_LOG_VERBOSITY'          : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        traced     = [ s for s in snapshots if 'count' not in s ]
+        aggregated = [ s for s in snapshots if 'count' in s ]
+
+        self.assertEqual(len(traced), 9)
+        self.assertTrue(all(s.get('phase') == 'loop' for s in traced))
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            traced, { 'event.end#iteration' : '2', 'phase' : 'loop' }))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            aggregated, { 'event.end#phase' : 'initialization', 'count' : '1' }))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            aggregated, { 'event.end#phase' : 'finalize', 'count' : '2' }))
+
+    def test_trace_outliers(self):
+        """ Aggregate everything, but only trace regions above the duration threshold """
+        target_cmd = [ './ci_test_basic' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'        : 'aggregate:event:timestamp:trace:recorder',
+            'CALI_TRACE_OUTLIER_DURATION' : '0.000000001',
+            'CALI_RECORDER_FILENAME'      : 'stdout',
+            'CALI_LOG_VERBOSITY'          : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        traced     = [ s for s in snapshots if 'count' not in s ]
+        aggregated = [ s for s in snapshots if 'count' in s ]
+
+        # only end-of-region snapshots have a duration
+        self.assertTrue(len(traced) > 0)
+        self.assertTrue(all('time.inclusive.duration' in s for s in traced))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            traced, { 'event.end#iteration' : '2', 'phase' : 'loop' }))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            aggregated, { 'event.end#phase' : 'initialization', 'count' : '1' }))
+
+        caliper_config['CALI_TRACE_OUTLIER_DURATION'] = '1000'
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertEqual(len([ s for s in snapshots if 'count' not in s ]), 0)
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'event.end#phase' : 'finalize', 'count' : '2' }))
+
+    def test_control_disable(self):
+        """ Disable the trace service at startup with the control service """
+        target_cmd = [ './ci_test_basic' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'        : 'aggregate:control:event:trace:recorder',
+            'CALI_CONTROL_DISABLE'        : 'trace',
+            'CALI_RECORDER_FILENAME'      : 'stdout',
+            'CALI_LOG_VERBOSITY'          : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertTrue(len(snapshots) > 0)
+        self.assertTrue(all('count' in s for s in snapshots))
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'event.end#phase' : 'finalize', 'count' : '2' }))
+
+    def test_control_file(self):
+        """ Disable a service and an attribute in a control file """
+        target_cmd = [ './ci_test_basic' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        with open('control_test.txt', 'w') as f:
+            f.write('# test control file\n')
+            f.write('disable aggregate\n')
+            f.write('disable attribute iteration\n')
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'        : 'aggregate:control:event:trace:recorder',
+            'CALI_CONTROL_FILE'           : 'control_test.txt',
+            'CALI_RECORDER_FILENAME'      : 'stdout',
+            'CALI_LOG_VERBOSITY'          : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertTrue(len(snapshots) > 0)
+        self.assertFalse(any('count' in s for s in snapshots))
+        self.assertFalse(any('event.end#iteration' in s for s in snapshots))
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'event.end#phase' : 'loop' }))
+
+    def test_region_filter(self):
+        """ Drop regions with the regionfilter service """
+        target_cmd = [ './ci_test_macros' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'        : 'event:trace:recorder:regionfilter',
+            'CALI_REGIONFILTER_EXCLUDE'   : 'pre-*,loop=fooloop',
+            'CALI_RECORDER_FILENAME'      : 'stdout',
+            'CALI_LOG_VERBOSITY'          : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertTrue(len(snapshots) > 10)
+
+        self.assertFalse(any(s.get('annotation') == 'pre-loop' for s in snapshots))
+        self.assertFalse(any('fooloop' in s.get('loop', '') for s in snapshots))
+        self.assertFalse(any('event.begin#annotation' in s for s in snapshots))
+
+        # regions nested in dropped regions are kept
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {
+                'function'   : 'main/foo',
+                'loop'       : 'mainloop',
+                'iteration#fooloop' : '3' }))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'event.end#function' : 'main' }))
+
+    def test_region_filter_include(self):
+        """ Keep only selected function regions with the regionfilter service """
+        target_cmd = [ './ci_test_macros' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'        : 'event:trace:recorder:regionfilter',
+            'CALI_REGIONFILTER_INCLUDE'   : 'function=ma.*',
+            'CALI_REGIONFILTER_REGEX'     : 'true',
+            'CALI_RECORDER_FILENAME'      : 'stdout',
+            'CALI_LOG_VERBOSITY'          : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertTrue(len(snapshots) > 10)
+
+        self.assertTrue(all(s.get('function', 'main') == 'main' for s in snapshots))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {
+                'function'   : 'main',
+                'annotation' : 'pre-loop' }))
+
+    def test_coalesce(self):
+        """ Merge repeated snapshots with the trace service coalesce option """
+        target_cmd = [ './ci_test_aggregate' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'        : 'event:timestamp:trace:recorder',
+            'CALI_TRACE_COALESCE'         : 'true',
+            'CALI_RECORDER_FILENAME'      : 'stdout',
+            'CALI_LOG_VERBOSITY'          : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        # foo is called twice per iteration in loop A, once in loop B
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, {
+                'event.end#function' : 'foo',
+                'loop.id'            : 'A',
+                'iteration'          : '1',
+                'trace.repeat'       : '2' }))
+        self.assertTrue(cat.has_snapshot_with_keys(
+            snapshots, [ 'event.end#function', 'trace.repeat', 'time.inclusive.duration' ]))
+        self.assertFalse(any('trace.repeat' in s for s in snapshots if s.get('loop.id') == 'B'))
 
 if __name__ == "__main__":
     unittest.main()
@@ -34,6 +34,17 @@ class CaliperCAPITest(unittest.TestCase):
             snapshots, { 'attr.int' : '20', 'attr.str' : 'fidibus' }))
         self.assertTrue(calitest.has_snapshot_with_attributes(
             snapshots, { 'test-attr-with-metadata' : 'abracadabra' }))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, { 'ci_test_c_ann.setbatch' : 'true',
+                         'batch.int' : '42',
+                         'batch.dbl' : '2.500000',
+                         'batch.str' : 'batch' }))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, { 'phase'      : 'cached',
+                         'annotation' : 'ci_test_c_ann.cached',
+                         'function'   : 'cached_fn',
+                         'loop'       : 'cachedloop',
+                         'iteration#cachedloop' : '1' }))
 
     def test_c_ann_metadata(self):
         target_cmd = [ './ci_test_c_ann' ]
@@ -75,6 +75,45 @@ class CaliperJSONTest(unittest.TestCase):
 
         self.assertEqual(nodes[data[0][index]]['label'], '  \\\\ weird," name",' )
 
+
+    def test_jsonsplit_stream(self):
+        """ Test json-split formatter stream option """
+        target_cmd = [ './ci_test_macros' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query',
+                       '-q', 'select count(),iteration#mainloop group by iteration#mainloop format json-split(stream)' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'    : 'serial-trace',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        obj    = json.loads( output )
+
+        # columns and column_metadata must come before the data
+        self.assertLess(output.find(b'"columns"'), output.find(b'"data"'))
+        self.assertLess(output.find(b'"column_metadata"'), output.find(b'"data"'))
+
+        columns = obj['columns']
+        data    = obj['data']
+
+        self.assertEqual(len(obj['column_metadata']), len(columns))
+        self.assertTrue('iteration#mainloop' in columns)
+        self.assertTrue('count' in columns)
+
+        iterindex = columns.index('iteration#mainloop')
+        countindex = columns.index('count')
+
+        iters = sorted([ row[iterindex] for row in data if row[iterindex] is not None ])
+
+        self.assertEqual(iters, [ 0, 1, 2, 3 ])
+
+        for row in data:
+            self.assertEqual(len(row), len(columns))
+            if row[iterindex] is not None:
+                self.assertGreater(row[countindex], 0)
+
         
 if __name__ == "__main__":
     unittest.main()
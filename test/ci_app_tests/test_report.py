@@ -29,6 +29,29 @@ class CaliperReportTest(unittest.TestCase):
             snapshots, { 'iteration#fooloop': '3', 'count': '1' }))
 
 
+    def test_report_threads(self):
+        """ Test report service with the multi-threaded pipeline """
+
+        target_cmd = [ './ci_test_macros' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query',
+                       '-q', 'SELECT count(),iteration#fooloop WHERE loop=fooloop GROUP BY iteration#fooloop FORMAT expand' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'event,trace,report',
+            'CALI_REPORT_CONFIG'     : 'format cali',
+            'CALI_REPORT_THREADS'    : '4',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertTrue(len(snapshots) == 5)
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'iteration#fooloop': '3', 'count': '1' }))
+
+
     def test_report(self):
         target_cmd = [ './ci_test_report' ]
         # create some distraction: read-from-env should be disabled
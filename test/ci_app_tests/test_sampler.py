@@ -36,5 +36,72 @@ class CaliperSamplerTest(unittest.TestCase):
 
         self.assertTrue('ci_dgemm_memtrack' in sfile.get('source.file#cali.sampler.pc'))
 
+    def test_sampler_trace_spill(self):
+        target_cmd = [ './ci_dgemm_memtrack' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        # Tiny buffer chunks overflow in the sampler's signal handler
+        # all the time: samples must go into the reserve chunks
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'sampler:trace:recorder',
+            'CALI_SAMPLER_FREQUENCY' : '1000',
+            'CALI_TRACE_BUFFER_POLICY'       : 'spill',
+            'CALI_TRACE_INITIAL_CHUNK_SIZE'  : '1',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        samples = [ s for s in snapshots if 'cali.sampler.pc' in s ]
+
+        self.assertTrue(len(samples) > 500)
+
+    def test_sampler_perf_backend(self):
+        target_cmd = [ './ci_dgemm_memtrack' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        # Falls back to the timer backend if perf_event is not available
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'sampler:trace:recorder',
+            'CALI_SAMPLER_BACKEND'   : 'perf',
+            'CALI_SAMPLER_FREQUENCY' : '500',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(len(snapshots) > 1)
+
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, { 'function' : 'main/ci_dgemm_do_work' }))
+        self.assertTrue(calitest.has_snapshot_with_keys(
+            snapshots, { 'cali.sampler.pc', 'function' }))
+
+    def test_sampler_adaptive(self):
+        target_cmd = [ './ci_dgemm_memtrack' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'sampler:trace:recorder',
+            'CALI_SAMPLER_ADAPTIVE'  : 'true',
+            'CALI_SAMPLER_FREQUENCY' : '100',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        samples = [ s for s in snapshots if 'cali.sampler.pc' in s ]
+
+        self.assertTrue(len(samples) > 1)
+        self.assertTrue(calitest.has_snapshot_with_keys(
+            snapshots, { 'cali.sampler.pc', 'cali.sampler.weight', 'function' }))
+        self.assertTrue(all(float(s['cali.sampler.weight']) > 0.0 for s in samples))
+
 if __name__ == "__main__":
     unittest.main()
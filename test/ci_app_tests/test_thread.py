@@ -1,5 +1,6 @@
 # Thread tests
 
+import signal
 import unittest
 
 import calipertest as calitest
@@ -38,5 +39,198 @@ class CaliperThreadTest(unittest.TestCase):
             snapshots, { 'function'    : 'main',
                          'local'       : '99' }))
 
+    def test_thread_time_ordered_flush(self):
+        """ Thread buffers merged by time.offset """
+        target_cmd = [ './ci_test_thread' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'    : 'serial-trace',
+            'CALI_TIMER_OFFSET'      : 'true',
+            'CALI_TRACE_FLUSH_ORDER' : 'time',
+            'CALI_TRACE_INITIAL_CHUNK_SIZE' : '1',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(len(snapshots) >= 16)
+
+        offsets = [ int(s['time.offset']) for s in snapshots if 'time.offset' in s ]
+
+        self.assertEqual(len(offsets), len(snapshots))
+        self.assertEqual(offsets, sorted(offsets))
+
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {'my_thread_id' : '49',
+                        'function'     : 'thread_proc',
+                        'global'       : '999' }))
+
+    def test_thread_double_buffer(self):
+        target_cmd = [ './ci_test_thread' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'    : 'serial-trace',
+            'CALI_TRACE_DOUBLE_BUFFER' : 'true',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        self.assertTrue(len(snapshots) >= 16)
+
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {'my_thread_id' : '16', 
+                        'function'     : 'thread_proc', 
+                        'global'       : '999' }))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, {'my_thread_id' : '49', 
+                        'function'     : 'thread_proc', 
+                        'global'       : '999' }))
+        self.assertTrue(calitest.has_snapshot_with_attributes(
+            snapshots, { 'function'    : 'main',
+                         'local'       : '99' }))
+
+    def test_flush_signal_while_writing(self):
+        """ Flush and clear the trace buffers while threads are writing """
+        target_cmd = [ './ci_test_trace_flush', '20000', str(int(signal.SIGUSR1)) ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'        : 'serial-trace',
+            'CALI_TRACE_BUFFER_POLICY'   : 'ring',
+            'CALI_TRACE_BUFFER_SIZE'     : '1',
+            'CALI_TRACE_RING_SIZE'       : '1',
+            'CALI_TRACE_FLUSH_SIGNAL'    : 'USR1',
+            'CALI_RECORDER_FILENAME'     : 'stdout',
+            'CALI_LOG_VERBOSITY'         : '0'
+        }
+
+        # The program must not crash. Any signal may clear the buffers,
+        # so the output itself varies from run to run.
+        calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+
+    def test_coalesce_threads(self):
+        """ Threads write their pending coalesce runs when they end """
+        target_cmd = [ './ci_test_trace_flush', '2000' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'       : 'event:timestamp:trace:recorder',
+            'CALI_TRACE_COALESCE'        : 'true',
+            'CALI_RECORDER_FILENAME'     : 'stdout',
+            'CALI_LOG_VERBOSITY'         : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        repeats = [ int(s.get('trace.repeat', '1')) for s in snapshots
+                    if s.get('event.end#annotation') == 'work' ]
+
+        self.assertEqual(sum(repeats), 4 * 2000)
+
+    def test_coalesce_flush_signal_while_writing(self):
+        """ Flush with coalescing while threads are writing """
+        target_cmd = [ './ci_test_trace_flush', '20000', str(int(signal.SIGUSR1)) ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'       : 'event:timestamp:trace:recorder',
+            'CALI_TRACE_COALESCE'        : 'true',
+            'CALI_TRACE_FLUSH_SIGNAL'    : 'USR1',
+            'CALI_RECORDER_FILENAME'     : 'stdout',
+            'CALI_LOG_VERBOSITY'         : '0'
+        }
+
+        # The program must not crash. Any signal may clear the buffers,
+        # so the output itself varies from run to run.
+        calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+
+    def test_spill_policy_threads(self):
+        """ Spill buffers of several threads that write concurrently """
+        target_cmd = [ './ci_test_trace_flush', '20000' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'        : 'serial-trace',
+            'CALI_TRACE_BUFFER_POLICY'   : 'spill',
+            'CALI_TRACE_BUFFER_SIZE'     : '1',
+            'CALI_TRACE_MEMORY_LIMIT'    : '1',
+            'CALI_RECORDER_FILENAME'     : 'stdout',
+            'CALI_LOG_VERBOSITY'         : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        # begin/end of main, and of thread_proc and 20000 work regions per thread
+        self.assertEqual(len(snapshots), 2 + 4 * (2 + 2 * 20000))
+
+    def test_spill_flush_signal_while_writing(self):
+        """ Flush and clear spilled buffers while threads are writing """
+        target_cmd = [ './ci_test_trace_flush', '20000', str(int(signal.SIGUSR1)) ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'        : 'serial-trace',
+            'CALI_TRACE_BUFFER_POLICY'   : 'spill',
+            'CALI_TRACE_BUFFER_SIZE'     : '1',
+            'CALI_TRACE_MEMORY_LIMIT'    : '1',
+            'CALI_TRACE_FLUSH_SIGNAL'    : 'USR1',
+            'CALI_RECORDER_FILENAME'     : 'stdout',
+            'CALI_LOG_VERBOSITY'         : '0'
+        }
+
+        # The program must not crash. Any signal may clear the buffers,
+        # so the output itself varies from run to run.
+        calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+
+    def test_flush_policy_threads(self):
+        """ Flush buffer policy at the default buffer size """
+        target_cmd = [ './ci_test_trace_flush', '2000' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'        : 'serial-trace',
+            'CALI_TRACE_BUFFER_POLICY'   : 'flush',
+            'CALI_RECORDER_FILENAME'     : 'stdout',
+            'CALI_LOG_VERBOSITY'         : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = calitest.get_snapshots_from_text(query_output)
+
+        # begin/end of main, and of thread_proc and 2000 work regions per thread
+        self.assertEqual(len(snapshots), 2 + 4 * (2 + 2 * 2000))
+
+    def test_flush_policy_multiple_flushes(self):
+        """ Flush buffer policy writes each snapshot at most once """
+        target_cmd = [ './ci_test_trace_flush', '50000' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-q', 'select count() format expand' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'        : 'serial-trace',
+            'CALI_TRACE_BUFFER_POLICY'   : 'flush',
+            'CALI_TRACE_BUFFER_SIZE'     : '1',
+            'CALI_RECORDER_FILENAME'     : 'stdout',
+            'CALI_LOG_VERBOSITY'         : '0'
+        }
+
+        query_output = calitest.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        count = sum(int(s['count']) for s in calitest.get_snapshots_from_text(query_output))
+
+        # Snapshots taken while the flush swaps out the buffers are dropped,
+        # but none may be written twice
+        expected = 2 + 4 * (2 + 2 * 50000)
+
+        self.assertTrue(count <= expected)
+        self.assertTrue(count > expected * 0.9)
+
 if __name__ == "__main__":
     unittest.main()